@@ -812,6 +812,10 @@ def program(defn, platform, test=False):
     if 'testcase' in defn:
         gvar_add("check_PROGRAMS", name)
         gvar_add("TESTS", name)
+    elif 'benchmark' in defn:
+        gvar_add("EXTRA_PROGRAMS", name)
+        gvar_add("BENCHMARKS", name)
+        gvar_add("CLEANFILES", name)
     else:
         var_add(installdir(defn) + "_PROGRAMS", name)
         if 'mansection' in defn:
@@ -147,6 +147,7 @@ grub_usb_device_initialize (grub_usb_device_t dev)
     {
       int pos;
       int currif;
+      int endp;
       char *data;
       struct grub_usb_desc *desc;
 
@@ -205,6 +206,25 @@ grub_usb_device_initialize (grub_usb_device_t dev)
               pos += desc->length;
             }
 
+	  /* USB 3 devices follow each endpoint descriptor by a SuperSpeed
+	     companion descriptor.  Squeeze those out so that the endpoint
+	     descriptors stay an array.  */
+	  for (endp = 1;
+	       endp <= dev->config[i].interf[currif].descif->endpointcnt;
+	       endp++)
+	    {
+	      int next = pos + endp * sizeof (struct grub_usb_desc_endp);
+
+	      desc = (struct grub_usb_desc *) &data[next];
+	      if (next + 2 > config.totallen
+		  || desc->type != GRUB_USB_DESCRIPTOR_SS_ENDPOINT_COMPANION
+		  || !desc->length || next + desc->length > config.totallen)
+		continue;
+	      config.totallen -= desc->length;
+	      grub_memmove (desc, (char *) desc + desc->length,
+			    config.totallen - next);
+	    }
+
 	  /* Point to the first endpoint.  */
 	  dev->config[i].interf[currif].descendp
 	    = (struct grub_usb_desc_endp *) &data[pos];
@@ -44,12 +44,22 @@ struct grub_usb_hub
 static struct grub_usb_hub *hubs;
 static grub_usb_controller_dev_t grub_usb_list;
 
+/* Let the host controller driver forget about DEV.  */
+static void
+grub_usb_hub_release_dev (grub_usb_device_t dev)
+{
+  if (dev->controller.dev->detach_dev)
+    dev->controller.dev->detach_dev (&dev->controller, dev);
+}
+
 /* Add a device that currently has device number 0 and resides on
-   CONTROLLER, the Hub reported that the device speed is SPEED.  */
+   CONTROLLER, the Hub reported that the device speed is SPEED.  The
+   device is behind root hub port ROOT_PORTNO along ROUTE.  */
 static grub_usb_device_t
 grub_usb_hub_add_dev (grub_usb_controller_t controller,
                       grub_usb_speed_t speed,
-                      int split_hubport, int split_hubaddr)
+                      int split_hubport, int split_hubaddr,
+		      int root_portno, grub_uint32_t route)
 {
   grub_usb_device_t dev;
   int i;
@@ -65,10 +75,13 @@ grub_usb_hub_add_dev (grub_usb_controller_t controller,
   dev->speed = speed;
   dev->split_hubport = split_hubport;
   dev->split_hubaddr = split_hubaddr;
+  dev->root_portno = root_portno;
+  dev->route = route;
 
   err = grub_usb_device_initialize (dev);
   if (err)
     {
+      grub_usb_hub_release_dev (dev);
       grub_free (dev);
       return NULL;
     }
@@ -82,6 +95,7 @@ grub_usb_hub_add_dev (grub_usb_controller_t controller,
   if (i == GRUB_USBHUB_MAX_DEVICES)
     {
       grub_error (GRUB_ERR_IO, "can't assign address to USB device");
+      grub_usb_hub_release_dev (dev);
       for (i = 0; i < 8; i++)
         grub_free (dev->config[i].descconf);
       grub_free (dev);
@@ -96,6 +110,7 @@ grub_usb_hub_add_dev (grub_usb_controller_t controller,
 			      i, 0, 0, NULL);
   if (err)
     {
+      grub_usb_hub_release_dev (dev);
       for (i = 0; i < 8; i++)
         grub_free (dev->config[i].descconf);
       grub_free (dev);
@@ -224,7 +239,7 @@ attach_root_port (struct grub_usb_hub *hub, int portno,
      and full/low speed device connected to OHCI/UHCI needs not
      transaction translation - e.g. hubport and hubaddr should be
      always none (zero) for any device connected to any root hub. */
-  dev = grub_usb_hub_add_dev (hub->controller, speed, 0, 0);
+  dev = grub_usb_hub_add_dev (hub->controller, speed, 0, 0, portno + 1, 0);
   hub->controller->dev->pending_reset = 0;
   npending--;
   if (! dev)
@@ -600,6 +615,8 @@ poll_nonroot_hub (grub_usb_device_t dev)
 	      grub_usb_device_t next_dev;
 	      int split_hubport = 0;
 	      int split_hubaddr = 0;
+	      grub_uint32_t route;
+	      int tier;
 
 	      /* Determine the device speed.  */
 	      if (status & GRUB_USB_HUB_STATUS_PORT_LOWSPEED)
@@ -643,9 +660,18 @@ poll_nonroot_hub (grub_usb_device_t dev)
 		    split_hubaddr = dev->split_hubaddr;
 		  }
 		
+	      /* Append this port to the route of the hub, 4 bits per
+		 tier with ports above 15 saturating.  */
+	      for (tier = 0; tier < 5 && ((dev->route >> (4 * tier)) & 0xf);
+		   tier++);
+	      route = dev->route;
+	      if (tier < 5)
+		route |= (i < 15 ? i : 15) << (4 * tier);
+
 	      /* Add the device and assign a device address to it.  */
 	      next_dev = grub_usb_hub_add_dev (&dev->controller, speed,
-					       split_hubport, split_hubaddr);
+					       split_hubport, split_hubaddr,
+					       dev->root_portno, route);
 	      if (dev->controller.dev->pending_reset)
 		{
 		  dev->controller.dev->pending_reset = 0;
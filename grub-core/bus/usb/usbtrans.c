@@ -39,25 +39,17 @@ grub_usb_bulk_maxpacket (grub_usb_device_t dev,
 
 
 static grub_usb_err_t
-grub_usb_execute_and_wait_transfer (grub_usb_device_t dev, 
-				    grub_usb_transfer_t transfer,
-				    int timeout, grub_size_t *actual)
+grub_usb_wait_transfer (grub_usb_device_t dev, grub_usb_transfer_t transfer,
+			int timeout, grub_size_t *actual)
 {
   grub_usb_err_t err;
   grub_uint64_t endtime;
 
-  err = dev->controller.dev->setup_transfer (&dev->controller, transfer);
-  if (err)
-    return err;
-  /* endtime moved behind setup transfer to prevent false timeouts
-   * while debugging... */
   endtime = grub_get_time_ms () + timeout;
   while (1)
     {
       err = dev->controller.dev->check_transfer (&dev->controller, transfer,
 						 actual);
-      if (!err)
-	return GRUB_USB_ERR_NONE;
       if (err != GRUB_USB_ERR_WAIT)
 	return err;
       if (grub_get_time_ms () > endtime)
@@ -72,6 +64,21 @@ grub_usb_execute_and_wait_transfer (grub_usb_device_t dev,
     }
 }
 
+static grub_usb_err_t
+grub_usb_execute_and_wait_transfer (grub_usb_device_t dev, 
+				    grub_usb_transfer_t transfer,
+				    int timeout, grub_size_t *actual)
+{
+  grub_usb_err_t err;
+
+  err = dev->controller.dev->setup_transfer (&dev->controller, transfer);
+  if (err)
+    return err;
+  /* endtime moved behind setup transfer to prevent false timeouts
+   * while debugging... */
+  return grub_usb_wait_transfer (dev, transfer, timeout, actual);
+}
+
 grub_usb_err_t
 grub_usb_control_msg (grub_usb_device_t dev,
 		      grub_uint8_t reqtype,
@@ -161,6 +168,7 @@ grub_usb_control_msg (grub_usb_device_t dev,
   setupdata->value = value;
   setupdata->index = index;
   setupdata->length = size;
+  transfer->setup = setupdata;
   transfer->transactions[0].size = sizeof (*setupdata);
   transfer->transactions[0].pid = GRUB_USB_TRANSFER_TYPE_SETUP;
   transfer->transactions[0].data = setupdata_addr;
@@ -210,6 +218,21 @@ grub_usb_control_msg (grub_usb_device_t dev,
   return err;
 }
 
+/* Give the transactions of TRANSFER alternating data toggles, starting
+   with the toggle the endpoint is at now.  */
+static void
+grub_usb_bulk_set_toggles (grub_usb_transfer_t transfer)
+{
+  int toggle = transfer->dev->toggle[transfer->endpoint];
+  int i;
+
+  for (i = 0; i < transfer->transcnt; i++)
+    {
+      transfer->transactions[i].toggle = toggle;
+      toggle = toggle ? 0 : 1;
+    }
+}
+
 static grub_usb_transfer_t
 grub_usb_bulk_setup_readwrite (grub_usb_device_t dev,
 			       struct grub_usb_desc_endp *endpoint,
@@ -224,7 +247,6 @@ grub_usb_bulk_setup_readwrite (grub_usb_device_t dev,
   grub_uint32_t data_addr;
   struct grub_pci_dma_chunk *data_chunk;
   grub_size_t size = size0;
-  int toggle = dev->toggle[endpoint->endp_addr];
 
   grub_dprintf ("usb", "bulk: size=0x%02lx type=%d\n", (unsigned long) size,
 		type);
@@ -258,6 +280,7 @@ grub_usb_bulk_setup_readwrite (grub_usb_device_t dev,
   transfer->max = max;
   transfer->dev = dev;
   transfer->last_trans = -1; /* Reset index of last processed transaction (TD) */
+  transfer->setup = NULL;
   transfer->data_chunk = data_chunk;
   transfer->data = data_in;
 
@@ -277,20 +300,19 @@ grub_usb_bulk_setup_readwrite (grub_usb_device_t dev,
       grub_usb_transaction_t tr = &transfer->transactions[i];
 
       tr->size = (size > max) ? max : size;
-      /* XXX: Use the right most bit as the data toggle.  Simple and
-	 effective.  */
-      tr->toggle = toggle;
-      toggle = toggle ? 0 : 1;
       tr->pid = type;
       tr->data = data_addr + i * max;
       tr->preceding = i * max;
       size -= tr->size;
     }
+  /* XXX: Use the right most bit as the data toggle.  Simple and
+     effective.  */
+  grub_usb_bulk_set_toggles (transfer);
   return transfer;
 }
 
 static void
-grub_usb_bulk_finish_readwrite (grub_usb_transfer_t transfer)
+grub_usb_bulk_finish_toggle (grub_usb_transfer_t transfer)
 {
   grub_usb_device_t dev = transfer->dev;
   int toggle = dev->toggle[transfer->endpoint];
@@ -304,6 +326,12 @@ grub_usb_bulk_finish_readwrite (grub_usb_transfer_t transfer)
     toggle = dev->toggle[transfer->endpoint]; /* Nothing done, take original */
   grub_dprintf ("usb", "bulk: toggle=%d\n", toggle);
   dev->toggle[transfer->endpoint] = toggle;
+}
+
+static void
+grub_usb_bulk_finish_readwrite (grub_usb_transfer_t transfer)
+{
+  grub_usb_bulk_finish_toggle (transfer);
 
   if (transfer->dir == GRUB_USB_TRANSFER_TYPE_IN)
     grub_memcpy (transfer->data, (void *)
@@ -336,6 +364,10 @@ grub_usb_bulk_readwrite (grub_usb_device_t dev,
   return err;
 }
 
+/* Transfer SIZE bytes in chunks as large as the controller takes.  While
+   the controller works on one chunk the next one is already prepared, and
+   the next one is started before the data of the finished one is copied
+   back, so that the controller does not sit idle while GRUB copies.  */
 static grub_usb_err_t
 grub_usb_bulk_readwrite_packetize (grub_usb_device_t dev,
 				   struct grub_usb_desc_endp *endpoint,
@@ -344,9 +376,10 @@ grub_usb_bulk_readwrite_packetize (grub_usb_device_t dev,
 {
   grub_size_t actual, transferred;
   grub_usb_err_t err = GRUB_USB_ERR_NONE;
-  grub_size_t current_size, position;
+  grub_size_t current_size, next_size, position;
   grub_size_t max_bulk_transfer_len = MAX_USB_TRANSFER_LEN;
   grub_size_t max;
+  grub_usb_transfer_t transfer, next;
 
   if (dev->controller.dev->max_bulk_tds)
     {
@@ -356,16 +389,58 @@ grub_usb_bulk_readwrite_packetize (grub_usb_device_t dev,
       max_bulk_transfer_len = dev->controller.dev->max_bulk_tds * max;
     }
 
-  for (position = 0, transferred = 0;
-       position < size; position += max_bulk_transfer_len)
+  if (!size)
+    return GRUB_USB_ERR_NONE;
+
+  current_size = (size < max_bulk_transfer_len) ? size
+    : max_bulk_transfer_len;
+  transfer = grub_usb_bulk_setup_readwrite (dev, endpoint, current_size,
+					    data, type);
+  if (!transfer)
+    return GRUB_USB_ERR_INTERNAL;
+  err = dev->controller.dev->setup_transfer (&dev->controller, transfer);
+  if (err)
     {
-      current_size = size - position;
-      if (current_size >= max_bulk_transfer_len)
-	current_size = max_bulk_transfer_len;
-      err = grub_usb_bulk_readwrite (dev, endpoint, current_size,
-              &data[position], type, 1000, &actual);
+      grub_usb_bulk_finish_readwrite (transfer);
+      return err;
+    }
+
+  for (position = 0, transferred = 0; transfer; position += current_size,
+	 current_size = next_size, transfer = next)
+    {
+      next = NULL;
+      next_size = size - position - current_size;
+      if (next_size > max_bulk_transfer_len)
+	next_size = max_bulk_transfer_len;
+      if (next_size)
+	next = grub_usb_bulk_setup_readwrite (dev, endpoint, next_size,
+					      &data[position + current_size],
+					      type);
+
+      err = grub_usb_wait_transfer (dev, transfer, 1000, &actual);
       transferred += actual;
-      if (err || (current_size != actual)) break;
+
+      /* The toggles of the next chunk follow from how far this one got.  */
+      grub_usb_bulk_finish_toggle (transfer);
+      if (next && (err || current_size != actual))
+	{
+	  grub_usb_bulk_finish_readwrite (next);
+	  next = NULL;
+	}
+      else if (next)
+	{
+	  grub_usb_bulk_set_toggles (next);
+	  err = dev->controller.dev->setup_transfer (&dev->controller, next);
+	  if (err)
+	    {
+	      grub_usb_bulk_finish_readwrite (next);
+	      next = NULL;
+	    }
+	}
+      else if (next_size && !err && current_size == actual)
+	err = GRUB_USB_ERR_INTERNAL;
+
+      grub_usb_bulk_finish_readwrite (transfer);
     }
 
   if (!err && transferred != size)
@@ -0,0 +1,1677 @@
+/* xhci.c - xHCI Support.  */
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2026  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <grub/dl.h>
+#include <grub/mm.h>
+#include <grub/usb.h>
+#include <grub/usbtrans.h>
+#include <grub/misc.h>
+#include <grub/pci.h>
+#include <grub/time.h>
+#include <grub/loader.h>
+#include <grub/disk.h>
+
+GRUB_MOD_LICENSE ("GPLv3+");
+
+/* This simple GRUB implementation of xHCI driver:
+ *      - assumes no IRQ, the event ring is polled
+ *      - uses 32-bit DMA addresses only
+ *      - keeps one transfer per endpoint in flight, but a bulk transfer
+ *        is queued as a chain of TRBs of up to 64 KiB each
+ *      - is not supporting isochronous transfers or streams
+ */
+
+/* Capability registers offsets */
+enum
+{
+  GRUB_XHCI_CAP_CAPLENGTH = 0x00,	/* byte */
+  GRUB_XHCI_CAP_HCSPARAMS1 = 0x04,
+  GRUB_XHCI_CAP_HCSPARAMS2 = 0x08,
+  GRUB_XHCI_CAP_HCCPARAMS1 = 0x10,
+  GRUB_XHCI_CAP_DBOFF = 0x14,
+  GRUB_XHCI_CAP_RTSOFF = 0x18,
+};
+
+#define GRUB_XHCI_HCS1_MAX_SLOTS(x)	((x) & 0xff)
+#define GRUB_XHCI_HCS1_MAX_PORTS(x)	(((x) >> 24) & 0xff)
+#define GRUB_XHCI_HCS2_MAX_SCRATCH(x)	((((x) >> 16) & 0x3e0) \
+					 | (((x) >> 27) & 0x1f))
+#define GRUB_XHCI_HCC1_CSZ		(1 << 2)
+#define GRUB_XHCI_HCC1_PPC		(1 << 3)
+#define GRUB_XHCI_HCC1_XECP(x)		(((x) >> 16) & 0xffff)
+
+/* Operational registers offsets */
+enum
+{
+  GRUB_XHCI_OPER_USBCMD = 0x00,
+  GRUB_XHCI_OPER_USBSTS = 0x04,
+  GRUB_XHCI_OPER_CRCR = 0x18,
+  GRUB_XHCI_OPER_DCBAAP = 0x30,
+  GRUB_XHCI_OPER_CONFIG = 0x38,
+  GRUB_XHCI_OPER_PORTSC = 0x400,
+};
+
+enum
+{
+  GRUB_XHCI_CMD_RUNSTOP = (1 << 0),
+  GRUB_XHCI_CMD_HCRST = (1 << 1),
+};
+
+enum
+{
+  GRUB_XHCI_STS_HCH = (1 << 0),
+  GRUB_XHCI_STS_CNR = (1 << 11),
+};
+
+enum
+{
+  GRUB_XHCI_PORTSC_CCS = (1 << 0),
+  GRUB_XHCI_PORTSC_PED = (1 << 1),
+  GRUB_XHCI_PORTSC_PR = (1 << 4),
+  GRUB_XHCI_PORTSC_PP = (1 << 9),
+  GRUB_XHCI_PORTSC_CSC = (1 << 17),
+  GRUB_XHCI_PORTSC_PEC = (1 << 18),
+  GRUB_XHCI_PORTSC_WRC = (1 << 19),
+  GRUB_XHCI_PORTSC_OCC = (1 << 20),
+  GRUB_XHCI_PORTSC_PRC = (1 << 21),
+  GRUB_XHCI_PORTSC_PLC = (1 << 22),
+  GRUB_XHCI_PORTSC_CEC = (1 << 23),
+  /* Bits which keep their value when written back.  Everything else is
+     either read-only or cleared/triggered by writing a one.  */
+  GRUB_XHCI_PORTSC_PRESERVE = 0x0e00c3e9,
+};
+
+#define GRUB_XHCI_PORTSC_SPEED(x)	(((x) >> 10) & 0xf)
+
+/* Port speed IDs with their default meaning.  */
+enum
+{
+  GRUB_XHCI_SPEED_FULL = 1,
+  GRUB_XHCI_SPEED_LOW = 2,
+  GRUB_XHCI_SPEED_HIGH = 3,
+  GRUB_XHCI_SPEED_SUPER = 4,
+};
+
+/* Runtime registers offsets of interrupter 0 */
+enum
+{
+  GRUB_XHCI_IR0_ERSTSZ = 0x28,
+  GRUB_XHCI_IR0_ERSTBA = 0x30,
+  GRUB_XHCI_IR0_ERDP = 0x38,
+};
+
+#define GRUB_XHCI_ERDP_EHB	(1 << 3)
+
+/* Extended capabilities */
+enum
+{
+  GRUB_XHCI_XCAP_LEGACY = 1,
+  GRUB_XHCI_XCAP_PROTOCOL = 2,
+};
+
+#define GRUB_XHCI_LEGACY_BIOS_OWNED	(1 << 16)
+#define GRUB_XHCI_LEGACY_OS_OWNED	(1 << 24)
+
+/* Intel PCH registers routing the shared ports to EHCI or xHCI.  */
+#define GRUB_XHCI_INTEL_XUSB2PR		0xd0
+#define GRUB_XHCI_INTEL_XUSB2PRM	0xd4
+#define GRUB_XHCI_INTEL_USB3_PSSEN	0xd8
+#define GRUB_XHCI_INTEL_USB3PRM		0xdc
+
+struct grub_xhci_trb
+{
+  grub_uint64_t ptr;
+  grub_uint32_t status;
+  grub_uint32_t control;
+};
+
+enum
+{
+  GRUB_XHCI_TRB_CYCLE = (1 << 0),
+  GRUB_XHCI_TRB_TC = (1 << 1),
+  GRUB_XHCI_TRB_ISP = (1 << 2),
+  GRUB_XHCI_TRB_CH = (1 << 4),
+  GRUB_XHCI_TRB_IOC = (1 << 5),
+  GRUB_XHCI_TRB_IDT = (1 << 6),
+  GRUB_XHCI_TRB_BSR = (1 << 9),
+  GRUB_XHCI_TRB_DIR_IN = (1 << 16),
+};
+
+#define GRUB_XHCI_TRB_TYPE_SHIFT	10
+#define GRUB_XHCI_TRB_TYPE(x)		(((x) >> 10) & 0x3f)
+#define GRUB_XHCI_TRB_TRT_SHIFT		16
+#define GRUB_XHCI_TRB_EP_SHIFT		16
+#define GRUB_XHCI_TRB_SLOT_SHIFT	24
+#define GRUB_XHCI_TRB_TD_SIZE_SHIFT	17
+#define GRUB_XHCI_TRB_LENGTH(x)		((x) & 0x1ffff)
+
+enum
+{
+  GRUB_XHCI_TRB_NORMAL = 1,
+  GRUB_XHCI_TRB_SETUP = 2,
+  GRUB_XHCI_TRB_DATA = 3,
+  GRUB_XHCI_TRB_STATUS = 4,
+  GRUB_XHCI_TRB_LINK = 6,
+  GRUB_XHCI_TRB_ENABLE_SLOT = 9,
+  GRUB_XHCI_TRB_DISABLE_SLOT = 10,
+  GRUB_XHCI_TRB_ADDRESS_DEVICE = 11,
+  GRUB_XHCI_TRB_CONFIGURE_EP = 12,
+  GRUB_XHCI_TRB_EVALUATE_CTX = 13,
+  GRUB_XHCI_TRB_RESET_EP = 14,
+  GRUB_XHCI_TRB_STOP_EP = 15,
+  GRUB_XHCI_TRB_SET_TR_DEQUEUE = 16,
+  GRUB_XHCI_TRB_TRANSFER_EVENT = 32,
+  GRUB_XHCI_TRB_COMMAND_EVENT = 33,
+};
+
+/* Completion codes */
+enum
+{
+  GRUB_XHCI_CC_INVALID = 0,
+  GRUB_XHCI_CC_SUCCESS = 1,
+  GRUB_XHCI_CC_DATA_BUFFER = 2,
+  GRUB_XHCI_CC_BABBLE = 3,
+  GRUB_XHCI_CC_TRANSACTION = 4,
+  GRUB_XHCI_CC_STALL = 6,
+  GRUB_XHCI_CC_SHORT_PACKET = 13,
+};
+
+/* Endpoint types in the endpoint context */
+enum
+{
+  GRUB_XHCI_EP_BULK_OUT = 2,
+  GRUB_XHCI_EP_INTERRUPT_OUT = 3,
+  GRUB_XHCI_EP_CONTROL = 4,
+  GRUB_XHCI_EP_BULK_IN = 6,
+  GRUB_XHCI_EP_INTERRUPT_IN = 7,
+};
+
+/* Number of TRBs in each ring, the last one of a transfer or command
+   ring is the link back to the start.  */
+#define GRUB_XHCI_RING_TRBS	256
+#define GRUB_XHCI_RING_SIZE	(GRUB_XHCI_RING_TRBS \
+				 * sizeof (struct grub_xhci_trb))
+/* A TRB buffer must not cross a 64 KiB boundary.  */
+#define GRUB_XHCI_TRB_MAX_LENGTH	0x10000
+/* Large enough for a device context or an input context of 64-byte
+   contexts.  */
+#define GRUB_XHCI_CTX_SIZE	4096
+
+#define GRUB_XHCI_MAX_SLOTS	256
+#define GRUB_XHCI_NUM_DCI	32
+
+/* Packets per bulk transfer: 512 KiB at high speed, 1 MiB at super
+   speed.  That is at most 17 TRBs, well within one ring.  */
+#define GRUB_XHCI_MAX_BULK_PACKETS	1024
+
+struct grub_xhci_ring
+{
+  struct grub_pci_dma_chunk *chunk;
+  volatile struct grub_xhci_trb *trbs;
+  grub_uint32_t phys;
+  unsigned enqueue;
+  grub_uint32_t cycle;
+};
+
+struct grub_xhci_transfer_controller_data
+{
+  struct grub_xhci_slot *slot;
+  unsigned dci;
+  int control;
+  /* Ring indices of the first and the last TRB of the transfer.  */
+  unsigned first;
+  unsigned last;
+  grub_size_t length;
+  grub_size_t actual;
+  int short_packet;
+  int done;
+  grub_uint32_t code;
+};
+
+struct grub_xhci_slot
+{
+  unsigned id;
+  struct grub_pci_dma_chunk *ctx_chunk;
+  grub_uint8_t speed;
+  unsigned mps0;
+  struct grub_xhci_ring *rings[GRUB_XHCI_NUM_DCI];
+  struct grub_xhci_transfer_controller_data *pending[GRUB_XHCI_NUM_DCI];
+};
+
+struct grub_xhci
+{
+  volatile grub_uint8_t *cap;
+  volatile grub_uint32_t *oper;
+  volatile grub_uint32_t *run;
+  volatile grub_uint32_t *db;
+  unsigned max_slots;
+  unsigned max_ports;
+  unsigned ctx_size;
+  /* Major USB revision of each root hub port, 0 if unknown.  */
+  grub_uint8_t *port_major;
+
+  struct grub_pci_dma_chunk *dcbaa_chunk;
+  volatile grub_uint64_t *dcbaa;
+  struct grub_pci_dma_chunk *scratch_chunk;
+  struct grub_pci_dma_chunk *scratch_pages;
+  struct grub_pci_dma_chunk *input_chunk;
+  volatile grub_uint32_t *input;
+
+  struct grub_xhci_ring cmd_ring;
+  /* The command waited for and its result.  */
+  grub_uint32_t cmd_phys;
+  int cmd_done;
+  grub_uint32_t cmd_code;
+  unsigned cmd_slot;
+
+  struct grub_pci_dma_chunk *event_chunk;
+  volatile struct grub_xhci_trb *event_trbs;
+  grub_uint32_t event_phys;
+  unsigned event_dequeue;
+  grub_uint32_t event_cycle;
+  struct grub_pci_dma_chunk *erst_chunk;
+
+  struct grub_xhci_slot *slots[GRUB_XHCI_MAX_SLOTS];
+
+  struct grub_xhci *next;
+};
+
+static struct grub_xhci *xhci;
+
+/* Register access functions */
+static inline grub_uint32_t
+grub_xhci_cap_read32 (struct grub_xhci *x, grub_uint32_t addr)
+{
+  return grub_le_to_cpu32 (*(volatile grub_uint32_t *) (x->cap + addr));
+}
+
+static inline grub_uint32_t
+grub_xhci_oper_read32 (struct grub_xhci *x, grub_uint32_t addr)
+{
+  return grub_le_to_cpu32 (x->oper[addr / sizeof (grub_uint32_t)]);
+}
+
+static inline void
+grub_xhci_oper_write32 (struct grub_xhci *x, grub_uint32_t addr,
+			grub_uint32_t value)
+{
+  x->oper[addr / sizeof (grub_uint32_t)] = grub_cpu_to_le32 (value);
+}
+
+static inline void
+grub_xhci_oper_write64 (struct grub_xhci *x, grub_uint32_t addr,
+			grub_uint64_t value)
+{
+  grub_xhci_oper_write32 (x, addr, value & 0xffffffff);
+  grub_xhci_oper_write32 (x, addr + 4, value >> 32);
+}
+
+static inline void
+grub_xhci_run_write32 (struct grub_xhci *x, grub_uint32_t addr,
+		       grub_uint32_t value)
+{
+  x->run[addr / sizeof (grub_uint32_t)] = grub_cpu_to_le32 (value);
+}
+
+static inline void
+grub_xhci_run_write64 (struct grub_xhci *x, grub_uint32_t addr,
+		       grub_uint64_t value)
+{
+  grub_xhci_run_write32 (x, addr, value & 0xffffffff);
+  grub_xhci_run_write32 (x, addr + 4, value >> 32);
+}
+
+static inline void
+grub_xhci_doorbell (struct grub_xhci *x, unsigned slot, unsigned target)
+{
+  x->db[slot] = grub_cpu_to_le32 (target);
+}
+
+static inline grub_uint32_t
+grub_xhci_port_read (struct grub_xhci *x, unsigned port)
+{
+  return grub_xhci_oper_read32 (x, GRUB_XHCI_OPER_PORTSC + port * 0x10);
+}
+
+/* Write BITS to the port, leaving all other bits unchanged and all
+   change bits uncleared.  */
+static inline void
+grub_xhci_port_setbits (struct grub_xhci *x, unsigned port,
+			grub_uint32_t bits)
+{
+  grub_xhci_oper_write32 (x, GRUB_XHCI_OPER_PORTSC + port * 0x10,
+			  (grub_xhci_port_read (x, port)
+			   & GRUB_XHCI_PORTSC_PRESERVE) | bits);
+}
+
+static grub_usb_err_t
+grub_xhci_halt (struct grub_xhci *x)
+{
+  grub_uint64_t maxtime;
+
+  grub_xhci_oper_write32 (x, GRUB_XHCI_OPER_USBCMD,
+			  grub_xhci_oper_read32 (x, GRUB_XHCI_OPER_USBCMD)
+			  & ~GRUB_XHCI_CMD_RUNSTOP);
+  maxtime = grub_get_time_ms () + 1000;
+  while (!(grub_xhci_oper_read32 (x, GRUB_XHCI_OPER_USBSTS)
+	   & GRUB_XHCI_STS_HCH))
+    if (grub_get_time_ms () > maxtime)
+      return GRUB_USB_ERR_TIMEOUT;
+
+  return GRUB_USB_ERR_NONE;
+}
+
+static grub_usb_err_t
+grub_xhci_reset (struct grub_xhci *x)
+{
+  grub_uint64_t maxtime;
+
+  grub_xhci_oper_write32 (x, GRUB_XHCI_OPER_USBCMD, GRUB_XHCI_CMD_HCRST);
+  /* Some controllers hang if the register is read too early.  */
+  grub_millisleep (1);
+  maxtime = grub_get_time_ms () + 1000;
+  while ((grub_xhci_oper_read32 (x, GRUB_XHCI_OPER_USBCMD)
+	  & GRUB_XHCI_CMD_HCRST)
+	 || (grub_xhci_oper_read32 (x, GRUB_XHCI_OPER_USBSTS)
+	     & GRUB_XHCI_STS_CNR))
+    if (grub_get_time_ms () > maxtime)
+      return GRUB_USB_ERR_TIMEOUT;
+
+  return GRUB_USB_ERR_NONE;
+}
+
+static grub_usb_err_t
+grub_xhci_ring_init (struct grub_xhci_ring *r)
+{
+  r->chunk = grub_memalign_dma32 (GRUB_XHCI_RING_SIZE, GRUB_XHCI_RING_SIZE);
+  if (!r->chunk)
+    return GRUB_USB_ERR_INTERNAL;
+  r->trbs = grub_dma_get_virt (r->chunk);
+  r->phys = grub_dma_get_phys (r->chunk);
+  grub_memset ((void *) r->trbs, 0, GRUB_XHCI_RING_SIZE);
+  r->enqueue = 0;
+  r->cycle = 1;
+  return GRUB_USB_ERR_NONE;
+}
+
+static struct grub_xhci_ring *
+grub_xhci_ring_alloc (void)
+{
+  struct grub_xhci_ring *r;
+
+  r = grub_malloc (sizeof (*r));
+  if (!r)
+    return NULL;
+  if (grub_xhci_ring_init (r))
+    {
+      grub_free (r);
+      return NULL;
+    }
+  return r;
+}
+
+static void
+grub_xhci_ring_free (struct grub_xhci_ring *r)
+{
+  if (!r)
+    return;
+  grub_dma_free (r->chunk);
+  grub_free (r);
+}
+
+/* Put a TRB on ring R and return its physical address.  The cycle bit
+   is supplied here.  */
+static grub_uint32_t
+grub_xhci_ring_enqueue (struct grub_xhci_ring *r, grub_uint64_t ptr,
+			grub_uint32_t status, grub_uint32_t control)
+{
+  volatile struct grub_xhci_trb *trb = &r->trbs[r->enqueue];
+  grub_uint32_t phys = r->phys + r->enqueue * sizeof (*trb);
+
+  trb->ptr = grub_cpu_to_le64 (ptr);
+  trb->status = grub_cpu_to_le32 (status);
+  trb->control = grub_cpu_to_le32 (control | r->cycle);
+
+  if (++r->enqueue == GRUB_XHCI_RING_TRBS - 1)
+    {
+      /* Link back to the start.  A link in the middle of a TD has to
+	 keep the chain going.  */
+      trb = &r->trbs[r->enqueue];
+      trb->ptr = grub_cpu_to_le64 (r->phys);
+      trb->status = 0;
+      trb->control = grub_cpu_to_le32 ((GRUB_XHCI_TRB_LINK
+					<< GRUB_XHCI_TRB_TYPE_SHIFT)
+				       | GRUB_XHCI_TRB_TC
+				       | (control & GRUB_XHCI_TRB_CH)
+				       | r->cycle);
+      r->enqueue = 0;
+      r->cycle ^= 1;
+    }
+
+  return phys;
+}
+
+static inline grub_uint32_t
+grub_xhci_ring_dequeue_ptr (struct grub_xhci_ring *r)
+{
+  return (r->phys + r->enqueue * sizeof (struct grub_xhci_trb)) | r->cycle;
+}
+
+static inline int
+grub_xhci_in_range (unsigned idx, unsigned first, unsigned last)
+{
+  if (first <= last)
+    return idx >= first && idx <= last;
+  return idx >= first || idx <= last;
+}
+
+/* Bytes moved by the data TRBs of CDATA before ring index IDX.  */
+static grub_size_t
+grub_xhci_bytes_before (struct grub_xhci_ring *r,
+			struct grub_xhci_transfer_controller_data *cdata,
+			unsigned idx)
+{
+  grub_size_t bytes = 0;
+  unsigned i;
+
+  for (i = cdata->first; i != idx; i = (i + 1) % GRUB_XHCI_RING_TRBS)
+    {
+      grub_uint32_t control = grub_le_to_cpu32 (r->trbs[i].control);
+      grub_uint32_t type = GRUB_XHCI_TRB_TYPE (control);
+
+      if (type == GRUB_XHCI_TRB_NORMAL || type == GRUB_XHCI_TRB_DATA)
+	bytes += GRUB_XHCI_TRB_LENGTH (grub_le_to_cpu32 (r->trbs[i].status));
+    }
+  return bytes;
+}
+
+static void
+grub_xhci_transfer_event (struct grub_xhci *x,
+			  volatile struct grub_xhci_trb *ev)
+{
+  grub_uint32_t control = grub_le_to_cpu32 (ev->control);
+  grub_uint32_t status = grub_le_to_cpu32 (ev->status);
+  grub_uint64_t ptr = grub_le_to_cpu64 (ev->ptr);
+  unsigned slot_id = control >> GRUB_XHCI_TRB_SLOT_SHIFT;
+  unsigned dci = (control >> GRUB_XHCI_TRB_EP_SHIFT) & 0x1f;
+  struct grub_xhci_transfer_controller_data *cdata;
+  struct grub_xhci_slot *slot;
+  struct grub_xhci_ring *r;
+  grub_uint32_t code = status >> 24;
+  unsigned idx;
+
+  slot = x->slots[slot_id];
+  if (!slot)
+    return;
+  cdata = slot->pending[dci];
+  r = slot->rings[dci];
+  if (!cdata || cdata->done || !r)
+    return;
+
+  /* Late events of an earlier transfer on this endpoint are dropped.  */
+  if (ptr < r->phys || ptr >= r->phys + GRUB_XHCI_RING_SIZE)
+    return;
+  idx = (ptr - r->phys) / sizeof (struct grub_xhci_trb);
+  if (!grub_xhci_in_range (idx, cdata->first, cdata->last))
+    return;
+
+  if (code == GRUB_XHCI_CC_SHORT_PACKET)
+    {
+      cdata->actual = grub_xhci_bytes_before (r, cdata, idx)
+	+ GRUB_XHCI_TRB_LENGTH (grub_le_to_cpu32 (r->trbs[idx].status))
+	- (status & 0xffffff);
+      cdata->short_packet = 1;
+      /* A short data stage still goes on to the status stage.  */
+      if (!cdata->control)
+	cdata->done = 1;
+    }
+  else if (code != GRUB_XHCI_CC_SUCCESS)
+    {
+      cdata->code = code;
+      cdata->done = 1;
+    }
+
+  if (idx == cdata->last)
+    cdata->done = 1;
+}
+
+static void
+grub_xhci_process_events (struct grub_xhci *x)
+{
+  int any = 0;
+
+  while (1)
+    {
+      volatile struct grub_xhci_trb *ev = &x->event_trbs[x->event_dequeue];
+      grub_uint32_t control = grub_le_to_cpu32 (ev->control);
+
+      if ((control & GRUB_XHCI_TRB_CYCLE) != x->event_cycle)
+	break;
+
+      switch (GRUB_XHCI_TRB_TYPE (control))
+	{
+	case GRUB_XHCI_TRB_TRANSFER_EVENT:
+	  grub_xhci_transfer_event (x, ev);
+	  break;
+	case GRUB_XHCI_TRB_COMMAND_EVENT:
+	  if (grub_le_to_cpu64 (ev->ptr) == x->cmd_phys)
+	    {
+	      x->cmd_code = grub_le_to_cpu32 (ev->status) >> 24;
+	      x->cmd_slot = control >> GRUB_XHCI_TRB_SLOT_SHIFT;
+	      x->cmd_done = 1;
+	    }
+	  break;
+	default:
+	  /* Port status changes are picked up by detect_dev.  */
+	  break;
+	}
+
+      if (++x->event_dequeue == GRUB_XHCI_RING_TRBS)
+	{
+	  x->event_dequeue = 0;
+	  x->event_cycle ^= 1;
+	}
+      any = 1;
+    }
+
+  if (any)
+    grub_xhci_run_write64 (x, GRUB_XHCI_IR0_ERDP,
+			   (x->event_phys + x->event_dequeue
+			    * sizeof (struct grub_xhci_trb))
+			   | GRUB_XHCI_ERDP_EHB);
+}
+
+/* Run a command and wait for its completion.  Return the completion
+   code.  */
+static grub_uint32_t
+grub_xhci_command (struct grub_xhci *x, grub_uint64_t ptr,
+		   grub_uint32_t control, unsigned *slot_id)
+{
+  grub_uint64_t maxtime;
+
+  x->cmd_done = 0;
+  x->cmd_phys = grub_xhci_ring_enqueue (&x->cmd_ring, ptr, 0, control);
+  grub_xhci_doorbell (x, 0, 0);
+
+  maxtime = grub_get_time_ms () + 5000;
+  while (!x->cmd_done)
+    {
+      grub_xhci_process_events (x);
+      if (!x->cmd_done && grub_get_time_ms () > maxtime)
+	{
+	  grub_dprintf ("xhci", "command %08x timed out\n", control);
+	  return GRUB_XHCI_CC_INVALID;
+	}
+    }
+
+  if (x->cmd_code != GRUB_XHCI_CC_SUCCESS)
+    grub_dprintf ("xhci", "command %08x failed: %d\n", control, x->cmd_code);
+  if (slot_id)
+    *slot_id = x->cmd_slot;
+  return x->cmd_code;
+}
+
+static inline volatile grub_uint32_t *
+grub_xhci_input_ctx (struct grub_xhci *x, unsigned n)
+{
+  return (volatile grub_uint32_t *) ((grub_uint8_t *) x->input
+				     + n * x->ctx_size);
+}
+
+static inline volatile grub_uint32_t *
+grub_xhci_slot_ctx (struct grub_xhci *x, struct grub_xhci_slot *slot,
+		    unsigned n)
+{
+  return (volatile grub_uint32_t *)
+    ((grub_uint8_t *) grub_dma_get_virt (slot->ctx_chunk) + n * x->ctx_size);
+}
+
+/* Start a new input context adding contexts ADD.  The slot context is
+   filled from the device context.  */
+static void
+grub_xhci_input_reset (struct grub_xhci *x, struct grub_xhci_slot *slot,
+		       grub_uint32_t add)
+{
+  volatile grub_uint32_t *in;
+  unsigned i;
+
+  grub_memset ((void *) x->input, 0, GRUB_XHCI_CTX_SIZE);
+  x->input[1] = grub_cpu_to_le32 (add);
+
+  in = grub_xhci_input_ctx (x, 1);
+  if (slot)
+    for (i = 0; i < 4; i++)
+      in[i] = grub_xhci_slot_ctx (x, slot, 0)[i];
+}
+
+static void
+grub_xhci_setup_ep0 (struct grub_xhci *x, struct grub_xhci_slot *slot)
+{
+  volatile grub_uint32_t *ep = grub_xhci_input_ctx (x, 2);
+
+  ep[1] = grub_cpu_to_le32 ((3 << 1) | (GRUB_XHCI_EP_CONTROL << 3)
+			    | (slot->mps0 << 16));
+  ep[2] = grub_cpu_to_le32 (grub_xhci_ring_dequeue_ptr (slot->rings[1]));
+  ep[3] = 0;
+  ep[4] = grub_cpu_to_le32 (8);
+}
+
+static grub_uint8_t
+grub_xhci_device_speed (struct grub_xhci *x, grub_usb_device_t dev)
+{
+  if (dev->route == 0 && dev->root_portno > 0)
+    return GRUB_XHCI_PORTSC_SPEED (grub_xhci_port_read (x,
+							dev->root_portno - 1));
+  switch (dev->speed)
+    {
+    case GRUB_USB_SPEED_LOW:
+      return GRUB_XHCI_SPEED_LOW;
+    case GRUB_USB_SPEED_FULL:
+      return GRUB_XHCI_SPEED_FULL;
+    case GRUB_USB_SPEED_SUPER:
+      return GRUB_XHCI_SPEED_SUPER;
+    default:
+      return GRUB_XHCI_SPEED_HIGH;
+    }
+}
+
+/* Helper for grub_xhci_tt_slot.  */
+static int
+grub_xhci_find_hub (grub_usb_device_t dev, void *data)
+{
+  grub_usb_device_t *hub = data;
+
+  if (dev->addr == (*hub)->split_hubaddr
+      && dev->controller.data == (*hub)->controller.data)
+    {
+      *hub = dev;
+      return 1;
+    }
+  return 0;
+}
+
+/* Slot of the high speed hub doing the transaction translation for
+   DEV, or 0.  */
+static unsigned
+grub_xhci_tt_slot (grub_usb_device_t dev)
+{
+  grub_usb_device_t hub = dev;
+  struct grub_xhci_slot *slot;
+
+  if (!dev->split_hubaddr
+      || !grub_usb_iterate (grub_xhci_find_hub, &hub))
+    return 0;
+  slot = hub->controller_data;
+  return slot ? slot->id : 0;
+}
+
+static void
+grub_xhci_free_slot (struct grub_xhci *x, struct grub_xhci_slot *slot)
+{
+  unsigned i;
+
+  if (slot->id)
+    {
+      x->dcbaa[slot->id] = 0;
+      x->slots[slot->id] = NULL;
+    }
+  for (i = 0; i < GRUB_XHCI_NUM_DCI; i++)
+    {
+      grub_xhci_ring_free (slot->rings[i]);
+      grub_free (slot->pending[i]);
+    }
+  if (slot->ctx_chunk)
+    grub_dma_free (slot->ctx_chunk);
+  grub_free (slot);
+}
+
+/* Enable a slot for the device at the default address and give it a
+   default control endpoint, without addressing the device yet: the
+   USB core does that with SET_ADDRESS later on.  */
+static struct grub_xhci_slot *
+grub_xhci_new_slot (struct grub_xhci *x, grub_usb_device_t dev)
+{
+  struct grub_xhci_slot *slot;
+  volatile grub_uint32_t *sc;
+  unsigned id = 0;
+
+  if (grub_xhci_command (x, 0, GRUB_XHCI_TRB_ENABLE_SLOT
+			 << GRUB_XHCI_TRB_TYPE_SHIFT, &id)
+      != GRUB_XHCI_CC_SUCCESS || !id || id >= GRUB_XHCI_MAX_SLOTS)
+    return NULL;
+
+  slot = grub_zalloc (sizeof (*slot));
+  if (!slot)
+    goto fail;
+  slot->id = id;
+  slot->ctx_chunk = grub_memalign_dma32 (64, GRUB_XHCI_CTX_SIZE);
+  slot->rings[1] = grub_xhci_ring_alloc ();
+  if (!slot->ctx_chunk || !slot->rings[1])
+    goto fail;
+  grub_memset ((void *) grub_dma_get_virt (slot->ctx_chunk), 0,
+	       GRUB_XHCI_CTX_SIZE);
+  x->dcbaa[id] = grub_cpu_to_le64 (grub_dma_get_phys (slot->ctx_chunk));
+  x->slots[id] = slot;
+
+  slot->speed = grub_xhci_device_speed (x, dev);
+  switch (slot->speed)
+    {
+    case GRUB_XHCI_SPEED_LOW:
+      slot->mps0 = 8;
+      break;
+    case GRUB_XHCI_SPEED_FULL:
+    case GRUB_XHCI_SPEED_HIGH:
+      slot->mps0 = 64;
+      break;
+    default:
+      slot->mps0 = 512;
+      break;
+    }
+
+  grub_xhci_input_reset (x, NULL, 3);
+  sc = grub_xhci_input_ctx (x, 1);
+  sc[0] = grub_cpu_to_le32 ((dev->route & 0xfffff) | (slot->speed << 20)
+			    | (1 << 27));
+  sc[1] = grub_cpu_to_le32 (dev->root_portno << 16);
+  if (slot->speed == GRUB_XHCI_SPEED_LOW
+      || slot->speed == GRUB_XHCI_SPEED_FULL)
+    sc[2] = grub_cpu_to_le32 (grub_xhci_tt_slot (dev)
+			      | (dev->split_hubport << 8));
+  grub_xhci_setup_ep0 (x, slot);
+
+  if (grub_xhci_command (x, grub_dma_get_phys (x->input_chunk),
+			 (GRUB_XHCI_TRB_ADDRESS_DEVICE
+			  << GRUB_XHCI_TRB_TYPE_SHIFT)
+			 | GRUB_XHCI_TRB_BSR
+			 | (id << GRUB_XHCI_TRB_SLOT_SHIFT), NULL)
+      != GRUB_XHCI_CC_SUCCESS)
+    goto fail;
+
+  grub_dprintf ("xhci", "slot %u: port %d route %x speed %d\n", id,
+		dev->root_portno, dev->route, slot->speed);
+  return slot;
+
+ fail:
+  if (slot)
+    grub_xhci_free_slot (x, slot);
+  grub_xhci_command (x, 0, (GRUB_XHCI_TRB_DISABLE_SLOT
+			    << GRUB_XHCI_TRB_TYPE_SHIFT)
+		     | (id << GRUB_XHCI_TRB_SLOT_SHIFT), NULL);
+  return NULL;
+}
+
+static grub_usb_err_t
+grub_xhci_address_device (struct grub_xhci *x, struct grub_xhci_slot *slot)
+{
+  grub_xhci_input_reset (x, slot, 3);
+  grub_xhci_setup_ep0 (x, slot);
+  /* The control ring is reused as is.  */
+  grub_xhci_input_ctx (x, 2)[2]
+    = grub_cpu_to_le32 (grub_xhci_ring_dequeue_ptr (slot->rings[1]));
+
+  if (grub_xhci_command (x, grub_dma_get_phys (x->input_chunk),
+			 (GRUB_XHCI_TRB_ADDRESS_DEVICE
+			  << GRUB_XHCI_TRB_TYPE_SHIFT)
+			 | (slot->id << GRUB_XHCI_TRB_SLOT_SHIFT), NULL)
+      != GRUB_XHCI_CC_SUCCESS)
+    return GRUB_USB_ERR_BADDEVICE;
+  return GRUB_USB_ERR_NONE;
+}
+
+static grub_usb_err_t
+grub_xhci_update_mps0 (struct grub_xhci *x, struct grub_xhci_slot *slot,
+		       unsigned mps0)
+{
+  slot->mps0 = mps0;
+  grub_xhci_input_reset (x, slot, 2);
+  grub_xhci_setup_ep0 (x, slot);
+  if (grub_xhci_command (x, grub_dma_get_phys (x->input_chunk),
+			 (GRUB_XHCI_TRB_EVALUATE_CTX
+			  << GRUB_XHCI_TRB_TYPE_SHIFT)
+			 | (slot->id << GRUB_XHCI_TRB_SLOT_SHIFT), NULL)
+      != GRUB_XHCI_CC_SUCCESS)
+    return GRUB_USB_ERR_INTERNAL;
+  return GRUB_USB_ERR_NONE;
+}
+
+static struct grub_usb_desc_endp *
+grub_xhci_find_endpoint (grub_usb_device_t dev, int endp_addr)
+{
+  struct grub_usb_desc_config *conf = dev->config[0].descconf;
+  int i, j;
+
+  if (!conf)
+    return NULL;
+  for (i = 0; i < conf->numif; i++)
+    {
+      struct grub_usb_interface *interf = &dev->config[0].interf[i];
+
+      for (j = 0; j < interf->descif->endpointcnt; j++)
+	if (interf->descendp[j].endp_addr == endp_addr)
+	  return &interf->descendp[j];
+    }
+  return NULL;
+}
+
+/* Add the endpoint at device context index DCI, as described by its
+   descriptor, to the slot.  Endpoints are only added when first used:
+   GRUB never changes configuration after setting the first one.  */
+static grub_usb_err_t
+grub_xhci_configure_endpoint (struct grub_xhci *x,
+			      struct grub_xhci_slot *slot,
+			      grub_usb_device_t dev, unsigned dci,
+			      int endp_addr)
+{
+  struct grub_usb_desc_endp *desc;
+  volatile grub_uint32_t *sc, *ep;
+  grub_uint32_t type, mps, interval = 0, entries;
+
+  desc = grub_xhci_find_endpoint (dev, endp_addr);
+  if (!desc)
+    return GRUB_USB_ERR_INTERNAL;
+  mps = grub_le_to_cpu16 (desc->maxpacket) & 0x7ff;
+
+  if (grub_usb_get_ep_type (desc) == GRUB_USB_EP_INTERRUPT)
+    {
+      type = (endp_addr & 0x80) ? GRUB_XHCI_EP_INTERRUPT_IN
+	: GRUB_XHCI_EP_INTERRUPT_OUT;
+      if (slot->speed == GRUB_XHCI_SPEED_LOW
+	  || slot->speed == GRUB_XHCI_SPEED_FULL)
+	{
+	  /* bInterval is in frames, the context wants 2^n microframes.  */
+	  interval = 3;
+	  while (interval < 10 && (1U << (interval - 2)) <= desc->interval)
+	    interval++;
+	}
+      else if (desc->interval)
+	interval = desc->interval - 1;
+    }
+  else if (grub_usb_get_ep_type (desc) == GRUB_USB_EP_BULK)
+    type = (endp_addr & 0x80) ? GRUB_XHCI_EP_BULK_IN : GRUB_XHCI_EP_BULK_OUT;
+  else
+    return GRUB_USB_ERR_INTERNAL;
+
+  slot->rings[dci] = grub_xhci_ring_alloc ();
+  if (!slot->rings[dci])
+    return GRUB_USB_ERR_INTERNAL;
+
+  grub_xhci_input_reset (x, slot, 1 | (1 << dci));
+  sc = grub_xhci_input_ctx (x, 1);
+  entries = grub_le_to_cpu32 (sc[0]) >> 27;
+  if (dci > entries)
+    entries = dci;
+  sc[0] = grub_cpu_to_le32 ((grub_le_to_cpu32 (sc[0]) & 0x07ffffff)
+			    | (entries << 27)
+			    | (dev->descdev.class == GRUB_USB_CLASS_HUB
+			       ? (1 << 26) : 0));
+  if (dev->descdev.class == GRUB_USB_CLASS_HUB)
+    sc[1] = grub_cpu_to_le32 ((grub_le_to_cpu32 (sc[1]) & 0x00ffffff)
+			      | (dev->nports << 24));
+  /* Slot state and address are output only.  */
+  sc[3] = 0;
+
+  ep = grub_xhci_input_ctx (x, dci + 1);
+  ep[0] = grub_cpu_to_le32 (interval << 16);
+  ep[1] = grub_cpu_to_le32 ((3 << 1) | (type << 3) | (mps << 16));
+  ep[2] = grub_cpu_to_le32 (grub_xhci_ring_dequeue_ptr (slot->rings[dci]));
+  ep[3] = 0;
+  if (type == GRUB_XHCI_EP_INTERRUPT_IN || type == GRUB_XHCI_EP_INTERRUPT_OUT)
+    ep[4] = grub_cpu_to_le32 (mps | (mps << 16));
+  else
+    ep[4] = grub_cpu_to_le32 (3072);
+
+  if (grub_xhci_command (x, grub_dma_get_phys (x->input_chunk),
+			 (GRUB_XHCI_TRB_CONFIGURE_EP
+			  << GRUB_XHCI_TRB_TYPE_SHIFT)
+			 | (slot->id << GRUB_XHCI_TRB_SLOT_SHIFT), NULL)
+      != GRUB_XHCI_CC_SUCCESS)
+    {
+      grub_xhci_ring_free (slot->rings[dci]);
+      slot->rings[dci] = NULL;
+      return GRUB_USB_ERR_INTERNAL;
+    }
+
+  grub_dprintf ("xhci", "slot %u: endpoint %02x (dci %u) type %u mps %u\n",
+		slot->id, endp_addr, dci, type, mps);
+  return GRUB_USB_ERR_NONE;
+}
+
+/* Queue LEN bytes at PHYS, split at 64 KiB boundaries.  The first TRB is
+   of TYPE and gets FIRST_FLAGS, the last one LAST_FLAGS, all others are
+   normal TRBs chained to the next one.  Return the physical address of
+   the last TRB.  */
+static grub_uint32_t
+grub_xhci_queue_data (struct grub_xhci_ring *r, grub_uint32_t phys,
+		      grub_size_t len, unsigned max, grub_uint32_t type,
+		      grub_uint32_t first_flags, grub_uint32_t last_flags)
+{
+  grub_uint32_t trb = 0;
+
+  do
+    {
+      grub_size_t n = GRUB_XHCI_TRB_MAX_LENGTH
+	- (phys & (GRUB_XHCI_TRB_MAX_LENGTH - 1));
+      grub_size_t packets;
+      grub_uint32_t control;
+
+      if (n > len)
+	n = len;
+      /* TD Size is the number of packets still to come.  */
+      packets = (len - n + max - 1) / max;
+      if (packets > 31)
+	packets = 31;
+
+      control = (type << GRUB_XHCI_TRB_TYPE_SHIFT) | first_flags
+	| GRUB_XHCI_TRB_ISP;
+      control |= (n == len) ? last_flags : GRUB_XHCI_TRB_CH;
+      trb = grub_xhci_ring_enqueue (r, phys,
+				    n | (packets
+					 << GRUB_XHCI_TRB_TD_SIZE_SHIFT),
+				    control);
+      phys += n;
+      len -= n;
+      type = GRUB_XHCI_TRB_NORMAL;
+      first_flags = 0;
+    }
+  while (len);
+
+  return trb;
+}
+
+static inline unsigned
+grub_xhci_ring_index (struct grub_xhci_ring *r, grub_uint32_t phys)
+{
+  return (phys - r->phys) / sizeof (struct grub_xhci_trb);
+}
+
+static grub_usb_err_t
+grub_xhci_setup_transfer (grub_usb_controller_t dev,
+			  grub_usb_transfer_t transfer)
+{
+  struct grub_xhci *x = (struct grub_xhci *) dev->data;
+  struct grub_xhci_slot *slot = transfer->dev->controller_data;
+  struct grub_xhci_transfer_controller_data *cdata;
+  struct grub_xhci_ring *r;
+  grub_uint32_t last;
+  unsigned dci;
+  grub_usb_err_t err;
+
+  grub_xhci_process_events (x);
+
+  if (!slot)
+    {
+      slot = grub_xhci_new_slot (x, transfer->dev);
+      if (!slot)
+	return GRUB_USB_ERR_INTERNAL;
+      transfer->dev->controller_data = slot;
+    }
+
+  if (transfer->type == GRUB_USB_TRANSACTION_TYPE_CONTROL)
+    dci = 1;
+  else
+    dci = ((transfer->endpoint & 0xf) << 1)
+      | ((transfer->endpoint & 0x80) ? 1 : 0);
+  if (slot->pending[dci])
+    return GRUB_USB_ERR_INTERNAL;
+
+  cdata = grub_zalloc (sizeof (*cdata));
+  if (!cdata)
+    return GRUB_USB_ERR_INTERNAL;
+  cdata->slot = slot;
+  cdata->dci = dci;
+
+  if (transfer->type == GRUB_USB_TRANSACTION_TYPE_CONTROL)
+    {
+      volatile struct grub_usb_packet_setup *setup = transfer->setup;
+      grub_uint64_t packet;
+      grub_uint32_t trt = 0, dir_in = setup->reqtype & 0x80;
+
+      /* The controller picks the address itself.  */
+      if (setup->request == GRUB_USB_REQ_SET_ADDRESS
+	  && (setup->reqtype & 0x7f) == 0)
+	{
+	  err = grub_xhci_address_device (x, slot);
+	  if (err)
+	    {
+	      grub_free (cdata);
+	      return err;
+	    }
+	  cdata->done = 1;
+	  cdata->code = GRUB_XHCI_CC_SUCCESS;
+	  transfer->controller_data = cdata;
+	  return GRUB_USB_ERR_NONE;
+	}
+
+      if (slot->speed != GRUB_XHCI_SPEED_SUPER
+	  && transfer->max && (unsigned) transfer->max != slot->mps0)
+	{
+	  err = grub_xhci_update_mps0 (x, slot, transfer->max);
+	  if (err)
+	    {
+	      grub_free (cdata);
+	      return err;
+	    }
+	}
+
+      r = slot->rings[1];
+      cdata->control = 1;
+      cdata->length = transfer->size;
+      cdata->first = r->enqueue;
+
+      packet = setup->reqtype | (setup->request << 8)
+	| ((grub_uint64_t) setup->value << 16)
+	| ((grub_uint64_t) setup->index << 32)
+	| ((grub_uint64_t) setup->length << 48);
+      if (transfer->size)
+	trt = dir_in ? 3 : 2;
+      grub_xhci_ring_enqueue (r, packet, 8,
+			      (GRUB_XHCI_TRB_SETUP
+			       << GRUB_XHCI_TRB_TYPE_SHIFT)
+			      | GRUB_XHCI_TRB_IDT
+			      | (trt << GRUB_XHCI_TRB_TRT_SHIFT));
+      if (transfer->size)
+	grub_xhci_queue_data (r, transfer->transactions[1].data,
+			      transfer->size, slot->mps0, GRUB_XHCI_TRB_DATA,
+			      dir_in ? GRUB_XHCI_TRB_DIR_IN : 0, 0);
+      /* The status stage goes the other way, or in without data.  */
+      last = grub_xhci_ring_enqueue (r, 0, 0,
+				     (GRUB_XHCI_TRB_STATUS
+				      << GRUB_XHCI_TRB_TYPE_SHIFT)
+				     | GRUB_XHCI_TRB_IOC
+				     | ((dir_in && transfer->size)
+					? 0 : GRUB_XHCI_TRB_DIR_IN));
+    }
+  else
+    {
+      if (!slot->rings[dci])
+	{
+	  err = grub_xhci_configure_endpoint (x, slot, transfer->dev, dci,
+					      transfer->endpoint);
+	  if (err)
+	    {
+	      grub_free (cdata);
+	      return err;
+	    }
+	}
+
+      r = slot->rings[dci];
+      cdata->length = transfer->size + 1;
+      cdata->first = r->enqueue;
+      last = grub_xhci_queue_data (r, transfer->transactions[0].data,
+				   cdata->length, transfer->max,
+				   GRUB_XHCI_TRB_NORMAL, 0,
+				   GRUB_XHCI_TRB_IOC);
+    }
+
+  cdata->last = grub_xhci_ring_index (r, last);
+  slot->pending[dci] = cdata;
+  transfer->controller_data = cdata;
+
+  grub_xhci_doorbell (x, slot->id, dci);
+
+  return GRUB_USB_ERR_NONE;
+}
+
+/* Restart the ring of an endpoint after a halt or a stop, skipping
+   whatever is left on it.  */
+static void
+grub_xhci_restart_endpoint (struct grub_xhci *x, struct grub_xhci_slot *slot,
+			    unsigned dci, int halted)
+{
+  grub_uint32_t target = (dci << GRUB_XHCI_TRB_EP_SHIFT)
+    | (slot->id << GRUB_XHCI_TRB_SLOT_SHIFT);
+
+  if (halted)
+    grub_xhci_command (x, 0, (GRUB_XHCI_TRB_RESET_EP
+			      << GRUB_XHCI_TRB_TYPE_SHIFT) | target, NULL);
+  else
+    grub_xhci_command (x, 0, (GRUB_XHCI_TRB_STOP_EP
+			      << GRUB_XHCI_TRB_TYPE_SHIFT) | target, NULL);
+  grub_xhci_command (x, grub_xhci_ring_dequeue_ptr (slot->rings[dci]),
+		     (GRUB_XHCI_TRB_SET_TR_DEQUEUE
+		      << GRUB_XHCI_TRB_TYPE_SHIFT) | target, NULL);
+}
+
+static grub_usb_err_t
+grub_xhci_check_transfer (grub_usb_controller_t dev,
+			  grub_usb_transfer_t transfer, grub_size_t *actual)
+{
+  struct grub_xhci *x = (struct grub_xhci *) dev->data;
+  struct grub_xhci_transfer_controller_data *cdata =
+    transfer->controller_data;
+  struct grub_xhci_slot *slot = cdata->slot;
+  grub_usb_err_t err;
+
+  *actual = 0;
+
+  grub_xhci_process_events (x);
+  if (!cdata->done)
+    return GRUB_USB_ERR_WAIT;
+
+  if (slot->pending[cdata->dci] == cdata)
+    slot->pending[cdata->dci] = NULL;
+
+  switch (cdata->code)
+    {
+    case GRUB_XHCI_CC_SUCCESS:
+      err = GRUB_USB_ERR_NONE;
+      *actual = cdata->short_packet ? cdata->actual : cdata->length;
+      break;
+    case GRUB_XHCI_CC_STALL:
+      err = GRUB_USB_ERR_STALL;
+      break;
+    case GRUB_XHCI_CC_BABBLE:
+      err = GRUB_USB_ERR_BABBLE;
+      break;
+    case GRUB_XHCI_CC_TRANSACTION:
+    case GRUB_XHCI_CC_DATA_BUFFER:
+      err = GRUB_USB_ERR_DATA;
+      break;
+    default:
+      err = GRUB_USB_ERR_INTERNAL;
+      break;
+    }
+
+  if (err)
+    {
+      grub_dprintf ("xhci", "slot %u dci %u: completion code %u\n",
+		    slot->id, cdata->dci, cdata->code);
+      grub_xhci_restart_endpoint (x, slot, cdata->dci, 1);
+    }
+
+  transfer->last_trans = transfer->transcnt - 1;
+  grub_free (cdata);
+  return err;
+}
+
+static grub_usb_err_t
+grub_xhci_cancel_transfer (grub_usb_controller_t dev,
+			   grub_usb_transfer_t transfer)
+{
+  struct grub_xhci *x = (struct grub_xhci *) dev->data;
+  struct grub_xhci_transfer_controller_data *cdata =
+    transfer->controller_data;
+  struct grub_xhci_slot *slot = cdata->slot;
+
+  if (slot->pending[cdata->dci] == cdata)
+    {
+      slot->pending[cdata->dci] = NULL;
+      if (!cdata->done)
+	grub_xhci_restart_endpoint (x, slot, cdata->dci, 0);
+    }
+
+  grub_free (cdata);
+  return GRUB_USB_ERR_NONE;
+}
+
+static void
+grub_xhci_detach_dev (grub_usb_controller_t dev, grub_usb_device_t usbdev)
+{
+  struct grub_xhci *x = (struct grub_xhci *) dev->data;
+  struct grub_xhci_slot *slot = usbdev->controller_data;
+  unsigned id;
+
+  if (!slot)
+    return;
+  usbdev->controller_data = NULL;
+
+  id = slot->id;
+  grub_xhci_command (x, 0, (GRUB_XHCI_TRB_DISABLE_SLOT
+			    << GRUB_XHCI_TRB_TYPE_SHIFT)
+		     | (id << GRUB_XHCI_TRB_SLOT_SHIFT), NULL);
+  grub_xhci_free_slot (x, slot);
+}
+
+static int
+grub_xhci_hubports (grub_usb_controller_t dev)
+{
+  struct grub_xhci *x = (struct grub_xhci *) dev->data;
+
+  return x->max_ports;
+}
+
+static grub_usb_err_t
+grub_xhci_portstatus (grub_usb_controller_t dev,
+		      unsigned int port, unsigned int enable)
+{
+  struct grub_xhci *x = (struct grub_xhci *) dev->data;
+  grub_uint64_t endtime;
+  grub_uint32_t status;
+
+  status = grub_xhci_port_read (x, port);
+  grub_dprintf ("xhci", "portstatus: port=%d, status=%08x, enable=%d\n",
+		port, status, enable);
+
+  if (!enable)
+    {
+      if (status & GRUB_XHCI_PORTSC_PED)
+	grub_xhci_port_setbits (x, port, GRUB_XHCI_PORTSC_PED);
+      return GRUB_USB_ERR_NONE;
+    }
+
+  /* USB 3 ports enable themselves once the link is trained.  */
+  if (x->port_major[port] == 3 || (status & GRUB_XHCI_PORTSC_PED))
+    return (status & GRUB_XHCI_PORTSC_PED) ? GRUB_USB_ERR_NONE
+      : GRUB_USB_ERR_BADDEVICE;
+
+  grub_boot_time ("Resetting port %d", port);
+  grub_xhci_port_setbits (x, port, GRUB_XHCI_PORTSC_PR);
+  endtime = grub_get_time_ms () + 1000;
+  while (!(grub_xhci_port_read (x, port) & GRUB_XHCI_PORTSC_PRC))
+    if (grub_get_time_ms () > endtime)
+      return GRUB_USB_ERR_TIMEOUT;
+  grub_xhci_port_setbits (x, port, GRUB_XHCI_PORTSC_PRC);
+  grub_boot_time ("Port %d reset", port);
+
+  if (!(grub_xhci_port_read (x, port) & GRUB_XHCI_PORTSC_PED))
+    return GRUB_USB_ERR_BADDEVICE;
+
+  /* "Reset recovery time" (USB spec.) */
+  grub_millisleep (10);
+
+  return GRUB_USB_ERR_NONE;
+}
+
+static grub_usb_speed_t
+grub_xhci_detect_dev (grub_usb_controller_t dev, int port, int *changed)
+{
+  struct grub_xhci *x = (struct grub_xhci *) dev->data;
+  grub_uint32_t status;
+
+  /* Keep the event ring drained even when nothing is transferring.  */
+  grub_xhci_process_events (x);
+
+  status = grub_xhci_port_read (x, port);
+
+  if (status & GRUB_XHCI_PORTSC_CSC)
+    {
+      *changed = 1;
+      grub_xhci_port_setbits (x, port, GRUB_XHCI_PORTSC_CSC);
+    }
+  else
+    *changed = 0;
+
+  /* Other change bits are not used, but would keep generating port
+     status change events.  */
+  if (status & (GRUB_XHCI_PORTSC_PEC | GRUB_XHCI_PORTSC_WRC
+		| GRUB_XHCI_PORTSC_OCC | GRUB_XHCI_PORTSC_PLC
+		| GRUB_XHCI_PORTSC_CEC))
+    grub_xhci_port_setbits (x, port,
+			    status & (GRUB_XHCI_PORTSC_PEC
+				      | GRUB_XHCI_PORTSC_WRC
+				      | GRUB_XHCI_PORTSC_OCC
+				      | GRUB_XHCI_PORTSC_PLC
+				      | GRUB_XHCI_PORTSC_CEC));
+
+  if (!(status & GRUB_XHCI_PORTSC_CCS))
+    return GRUB_USB_SPEED_NONE;
+
+  switch (GRUB_XHCI_PORTSC_SPEED (status))
+    {
+    case GRUB_XHCI_SPEED_LOW:
+      return GRUB_USB_SPEED_LOW;
+    case GRUB_XHCI_SPEED_FULL:
+      return GRUB_USB_SPEED_FULL;
+    case GRUB_XHCI_SPEED_HIGH:
+      return GRUB_USB_SPEED_HIGH;
+    case 0:
+      /* Not known until a USB 2 port has been reset.  */
+      return (x->port_major[port] == 3) ? GRUB_USB_SPEED_NONE
+	: GRUB_USB_SPEED_FULL;
+    default:
+      return GRUB_USB_SPEED_SUPER;
+    }
+}
+
+/* Take the controller over from the firmware and learn which ports
+   are USB 2 and which USB 3.  */
+static void
+grub_xhci_parse_xcaps (struct grub_xhci *x)
+{
+  grub_uint32_t offset;
+
+  offset = GRUB_XHCI_HCC1_XECP (grub_xhci_cap_read32
+				(x, GRUB_XHCI_CAP_HCCPARAMS1)) * 4;
+  while (offset)
+    {
+      grub_uint32_t cap = grub_xhci_cap_read32 (x, offset);
+
+      if ((cap & 0xff) == GRUB_XHCI_XCAP_LEGACY
+	  && (cap & GRUB_XHCI_LEGACY_BIOS_OWNED))
+	{
+	  volatile grub_uint32_t *reg
+	    = (volatile grub_uint32_t *) (x->cap + offset);
+	  grub_uint64_t maxtime;
+
+	  grub_boot_time ("Taking ownership of xHCI controller");
+	  *reg = grub_cpu_to_le32 (cap | GRUB_XHCI_LEGACY_OS_OWNED);
+	  maxtime = grub_get_time_ms () + 1000;
+	  while ((grub_le_to_cpu32 (*reg) & GRUB_XHCI_LEGACY_BIOS_OWNED)
+		 && grub_get_time_ms () < maxtime);
+	  if (grub_le_to_cpu32 (*reg) & GRUB_XHCI_LEGACY_BIOS_OWNED)
+	    {
+	      grub_dprintf ("xhci", "BIOS didn't release the controller\n");
+	      *reg = grub_cpu_to_le32 (GRUB_XHCI_LEGACY_OS_OWNED);
+	    }
+	  /* Disable SMIs and clear pending ones.  */
+	  reg[1] = grub_cpu_to_le32 (0xe0000000);
+	}
+      else if ((cap & 0xff) == GRUB_XHCI_XCAP_PROTOCOL)
+	{
+	  grub_uint32_t ports = grub_xhci_cap_read32 (x, offset + 8);
+	  unsigned first = ports & 0xff, count = (ports >> 8) & 0xff, i;
+
+	  for (i = first; i < first + count && i <= x->max_ports; i++)
+	    if (i)
+	      x->port_major[i - 1] = cap >> 24;
+	}
+
+      if (!((cap >> 8) & 0xff))
+	break;
+      offset += ((cap >> 8) & 0xff) * 4;
+    }
+}
+
+static grub_usb_err_t
+grub_xhci_start (struct grub_xhci *x)
+{
+  grub_uint64_t maxtime;
+  unsigned i;
+
+  if (grub_xhci_halt (x) || grub_xhci_reset (x))
+    return GRUB_USB_ERR_TIMEOUT;
+
+  grub_xhci_oper_write32 (x, GRUB_XHCI_OPER_CONFIG, x->max_slots);
+  grub_xhci_oper_write64 (x, GRUB_XHCI_OPER_DCBAAP,
+			  grub_dma_get_phys (x->dcbaa_chunk));
+
+  x->cmd_ring.enqueue = 0;
+  x->cmd_ring.cycle = 1;
+  grub_memset ((void *) x->cmd_ring.trbs, 0, GRUB_XHCI_RING_SIZE);
+  grub_xhci_oper_write64 (x, GRUB_XHCI_OPER_CRCR, x->cmd_ring.phys | 1);
+
+  x->event_dequeue = 0;
+  x->event_cycle = 1;
+  grub_memset ((void *) x->event_trbs, 0, GRUB_XHCI_RING_SIZE);
+  grub_xhci_run_write32 (x, GRUB_XHCI_IR0_ERSTSZ, 1);
+  grub_xhci_run_write64 (x, GRUB_XHCI_IR0_ERDP, x->event_phys);
+  grub_xhci_run_write64 (x, GRUB_XHCI_IR0_ERSTBA,
+			 grub_dma_get_phys (x->erst_chunk));
+
+  grub_xhci_oper_write32 (x, GRUB_XHCI_OPER_USBCMD, GRUB_XHCI_CMD_RUNSTOP);
+  maxtime = grub_get_time_ms () + 1000;
+  while (grub_xhci_oper_read32 (x, GRUB_XHCI_OPER_USBSTS) & GRUB_XHCI_STS_HCH)
+    if (grub_get_time_ms () > maxtime)
+      return GRUB_USB_ERR_TIMEOUT;
+
+  if (grub_xhci_cap_read32 (x, GRUB_XHCI_CAP_HCCPARAMS1) & GRUB_XHCI_HCC1_PPC)
+    for (i = 0; i < x->max_ports; i++)
+      if (!(grub_xhci_port_read (x, i) & GRUB_XHCI_PORTSC_PP))
+	grub_xhci_port_setbits (x, i, GRUB_XHCI_PORTSC_PP);
+
+  return GRUB_USB_ERR_NONE;
+}
+
+static void
+grub_xhci_free (struct grub_xhci *x)
+{
+  if (x->scratch_pages)
+    grub_dma_free (x->scratch_pages);
+  if (x->scratch_chunk)
+    grub_dma_free (x->scratch_chunk);
+  if (x->dcbaa_chunk)
+    grub_dma_free (x->dcbaa_chunk);
+  if (x->input_chunk)
+    grub_dma_free (x->input_chunk);
+  if (x->cmd_ring.chunk)
+    grub_dma_free (x->cmd_ring.chunk);
+  if (x->event_chunk)
+    grub_dma_free (x->event_chunk);
+  if (x->erst_chunk)
+    grub_dma_free (x->erst_chunk);
+  grub_free (x->port_major);
+  grub_free (x);
+}
+
+static int
+grub_xhci_pci_iter (grub_pci_device_t dev, grub_pci_id_t pciid,
+		    void *data __attribute__ ((unused)))
+{
+  grub_pci_address_t addr;
+  grub_uint32_t class_code, base, base_h;
+  grub_uint32_t hcs1, hcs2;
+  volatile grub_uint64_t *erst;
+  struct grub_xhci *x;
+  unsigned nscratch, i;
+
+  addr = grub_pci_make_address (dev, GRUB_PCI_REG_CLASS);
+  class_code = grub_pci_read (addr) >> 8;
+  if (class_code != 0x0c0330)
+    return 0;
+
+  addr = grub_pci_make_address (dev, GRUB_PCI_REG_ADDRESS_REG0);
+  base = grub_pci_read (addr);
+  addr = grub_pci_make_address (dev, GRUB_PCI_REG_ADDRESS_REG1);
+  base_h = grub_pci_read (addr);
+  /* GRUB does not currently work with registers mapped above 4G.  */
+  if ((base & GRUB_PCI_ADDR_MEM_TYPE_MASK) != GRUB_PCI_ADDR_MEM_TYPE_32
+      && base_h != 0)
+    {
+      grub_dprintf ("xhci", "registers above 4G are not supported\n");
+      return 0;
+    }
+  base &= GRUB_PCI_ADDR_MEM_MASK;
+  if (!base)
+    {
+      grub_dprintf ("xhci", "xHCI is not mapped\n");
+      return 0;
+    }
+
+  addr = grub_pci_make_address (dev, GRUB_PCI_REG_COMMAND);
+  grub_pci_write_word (addr, GRUB_PCI_COMMAND_MEM_ENABLED
+		       | GRUB_PCI_COMMAND_BUS_MASTER
+		       | grub_pci_read_word (addr));
+
+  /* On Intel chipsets the ports go to the EHCI controller until told
+     otherwise.  */
+  if ((pciid & 0xffff) == 0x8086)
+    {
+      grub_pci_write (grub_pci_make_address (dev, GRUB_XHCI_INTEL_USB3_PSSEN),
+		      grub_pci_read (grub_pci_make_address
+				     (dev, GRUB_XHCI_INTEL_USB3PRM)));
+      grub_pci_write (grub_pci_make_address (dev, GRUB_XHCI_INTEL_XUSB2PR),
+		      grub_pci_read (grub_pci_make_address
+				     (dev, GRUB_XHCI_INTEL_XUSB2PRM)));
+    }
+
+  x = grub_zalloc (sizeof (*x));
+  if (!x)
+    return 1;
+
+  x->cap = grub_pci_device_map_range (dev, base, 0x10000);
+  x->oper = (volatile grub_uint32_t *)
+    (x->cap + (grub_xhci_cap_read32 (x, GRUB_XHCI_CAP_CAPLENGTH) & 0xff));
+  x->run = (volatile grub_uint32_t *)
+    (x->cap + (grub_xhci_cap_read32 (x, GRUB_XHCI_CAP_RTSOFF) & ~0x1f));
+  x->db = (volatile grub_uint32_t *)
+    (x->cap + (grub_xhci_cap_read32 (x, GRUB_XHCI_CAP_DBOFF) & ~0x3));
+
+  hcs1 = grub_xhci_cap_read32 (x, GRUB_XHCI_CAP_HCSPARAMS1);
+  hcs2 = grub_xhci_cap_read32 (x, GRUB_XHCI_CAP_HCSPARAMS2);
+  x->max_slots = GRUB_XHCI_HCS1_MAX_SLOTS (hcs1);
+  x->max_ports = GRUB_XHCI_HCS1_MAX_PORTS (hcs1);
+  x->ctx_size = (grub_xhci_cap_read32 (x, GRUB_XHCI_CAP_HCCPARAMS1)
+		 & GRUB_XHCI_HCC1_CSZ) ? 64 : 32;
+  nscratch = GRUB_XHCI_HCS2_MAX_SCRATCH (hcs2);
+
+  grub_dprintf ("xhci", "xHCI at %08x: %u slots, %u ports, %u scratchpad"
+		" pages, %u-byte contexts\n", base, x->max_slots,
+		x->max_ports, nscratch, x->ctx_size);
+
+  x->port_major = grub_zalloc (x->max_ports ? : 1);
+  if (!x->port_major)
+    goto fail;
+
+  grub_xhci_parse_xcaps (x);
+
+  x->dcbaa_chunk = grub_memalign_dma32 (64, GRUB_XHCI_MAX_SLOTS
+					* sizeof (grub_uint64_t));
+  x->input_chunk = grub_memalign_dma32 (64, GRUB_XHCI_CTX_SIZE);
+  x->event_chunk = grub_memalign_dma32 (GRUB_XHCI_RING_SIZE,
+					GRUB_XHCI_RING_SIZE);
+  x->erst_chunk = grub_memalign_dma32 (64, 16);
+  if (!x->dcbaa_chunk || !x->input_chunk || !x->event_chunk
+      || !x->erst_chunk || grub_xhci_ring_init (&x->cmd_ring))
+    goto fail;
+
+  x->dcbaa = grub_dma_get_virt (x->dcbaa_chunk);
+  grub_memset ((void *) x->dcbaa, 0,
+	       GRUB_XHCI_MAX_SLOTS * sizeof (grub_uint64_t));
+  x->input = grub_dma_get_virt (x->input_chunk);
+  x->event_trbs = grub_dma_get_virt (x->event_chunk);
+  x->event_phys = grub_dma_get_phys (x->event_chunk);
+
+  erst = grub_dma_get_virt (x->erst_chunk);
+  erst[0] = grub_cpu_to_le64 (x->event_phys);
+  erst[1] = grub_cpu_to_le64 (GRUB_XHCI_RING_TRBS);
+
+  if (nscratch)
+    {
+      volatile grub_uint64_t *array;
+
+      x->scratch_chunk = grub_memalign_dma32 (64, nscratch
+					      * sizeof (grub_uint64_t));
+      x->scratch_pages = grub_memalign_dma32 (4096, nscratch * 4096);
+      if (!x->scratch_chunk || !x->scratch_pages)
+	goto fail;
+      array = grub_dma_get_virt (x->scratch_chunk);
+      for (i = 0; i < nscratch; i++)
+	array[i] = grub_cpu_to_le64 (grub_dma_get_phys (x->scratch_pages)
+				     + i * 4096);
+      x->dcbaa[0] = grub_cpu_to_le64 (grub_dma_get_phys (x->scratch_chunk));
+    }
+
+  if (grub_xhci_start (x))
+    {
+      grub_dprintf ("xhci", "couldn't start the controller\n");
+      goto fail;
+    }
+
+  x->next = xhci;
+  xhci = x;
+
+  return 0;
+
+ fail:
+  grub_xhci_free (x);
+  return 0;
+}
+
+static int
+grub_xhci_iterate (grub_usb_controller_iterate_hook_t hook, void *hook_data)
+{
+  struct grub_xhci *x;
+  struct grub_usb_controller dev;
+
+  for (x = xhci; x; x = x->next)
+    {
+      dev.data = x;
+      if (hook (&dev, hook_data))
+	return 1;
+    }
+
+  return 0;
+}
+
+static grub_err_t
+grub_xhci_restore_hw (void)
+{
+  struct grub_xhci *x;
+
+  for (x = xhci; x; x = x->next)
+    {
+      grub_uint64_t maxtime;
+
+      /* The state survives a halt, just pick up where it stopped.  */
+      grub_xhci_oper_write32 (x, GRUB_XHCI_OPER_USBCMD,
+			      grub_xhci_oper_read32 (x, GRUB_XHCI_OPER_USBCMD)
+			      | GRUB_XHCI_CMD_RUNSTOP);
+      maxtime = grub_get_time_ms () + 1000;
+      while (grub_xhci_oper_read32 (x, GRUB_XHCI_OPER_USBSTS)
+	     & GRUB_XHCI_STS_HCH)
+	if (grub_get_time_ms () > maxtime)
+	  {
+	    grub_error (GRUB_ERR_TIMEOUT, "restore_hw: xHCI start timeout");
+	    break;
+	  }
+    }
+
+  return GRUB_ERR_NONE;
+}
+
+static grub_err_t
+grub_xhci_fini_hw (int noreturn)
+{
+  struct grub_xhci *x;
+
+  /* We should disable all xHCI HW to prevent any DMA access etc. */
+  for (x = xhci; x; x = x->next)
+    {
+      grub_xhci_halt (x);
+      /* Only leave the slots in place if GRUB may come back.  */
+      if (noreturn)
+	grub_xhci_reset (x);
+    }
+
+  return GRUB_ERR_NONE;
+}
+
+static struct grub_usb_controller_dev usb_controller = {
+  .name = "xhci",
+  .iterate = grub_xhci_iterate,
+  .setup_transfer = grub_xhci_setup_transfer,
+  .check_transfer = grub_xhci_check_transfer,
+  .cancel_transfer = grub_xhci_cancel_transfer,
+  .hubports = grub_xhci_hubports,
+  .portstatus = grub_xhci_portstatus,
+  .detect_dev = grub_xhci_detect_dev,
+  .detach_dev = grub_xhci_detach_dev,
+  .max_bulk_tds = GRUB_XHCI_MAX_BULK_PACKETS
+};
+
+GRUB_MOD_INIT (xhci)
+{
+  COMPILE_TIME_ASSERT (sizeof (struct grub_xhci_trb) == 16);
+
+  grub_stop_disk_firmware ();
+
+  grub_boot_time ("Initing xHCI hardware");
+  grub_pci_iterate (grub_xhci_pci_iter, NULL);
+  grub_boot_time ("Registering xHCI driver");
+  grub_usb_controller_dev_register (&usb_controller);
+  grub_boot_time ("xHCI driver registered");
+  grub_loader_register_preboot_hook (grub_xhci_fini_hw, grub_xhci_restore_hw,
+				     GRUB_LOADER_PREBOOT_HOOK_PRIO_DISK);
+}
+
+GRUB_MOD_FINI (xhci)
+{
+  grub_xhci_fini_hw (1);
+  grub_usb_controller_dev_unregister (&usb_controller);
+}
@@ -76,25 +76,17 @@ static char root_creator_id[4];
 static grub_uint32_t root_creator_rev;
 static struct grub_acpi_rsdp_v10 *rsdpv1_new = 0;
 static struct grub_acpi_rsdp_v20 *rsdpv2_new = 0;
-static char *playground = 0, *playground_ptr = 0;
-static int playground_size = 0;
 
-/* Linked list of ACPI tables. */
-struct efiemu_acpi_table
+/* A table to go into the new ACPI region, copied either from the host
+   tables or from a file.  */
+struct acpi_table_source
 {
-  void *addr;
+  const struct grub_acpi_table_header *addr;
+  grub_file_t file;
   grub_size_t size;
-  struct efiemu_acpi_table *next;
+  /* Where the table ends up in the new region.  */
+  struct grub_acpi_table_header *dest;
 };
-static struct efiemu_acpi_table *acpi_tables = 0;
-
-/* DSDT isn't in RSDT. So treat it specially. */
-static void *table_dsdt = 0;
-/* Pointer to recreated RSDT. */
-static void *rsdt_addr = 0;
-
-/* Allocation handles for different tables. */
-static grub_size_t dsdt_size = 0;
 
 /* Address of original FACS. */
 static grub_uint32_t facs_addr = 0;
@@ -304,163 +296,209 @@ grub_acpi_create_ebda (void)
 }
 #endif
 
-/* Create tables common to ACPIv1 and ACPIv2+ */
+/* Tables are placed at this alignment in the new region.  */
+#define ACPI_TABLE_ALIGN 8
+
+static void
+set_root_header (struct grub_acpi_table_header *hdr, const char *signature,
+		 grub_uint32_t length)
+{
+  grub_memcpy (&(hdr->signature), signature, 4);
+  hdr->length = length;
+  hdr->revision = 1;
+  grub_memcpy (&(hdr->oemid), root_oemid, sizeof (hdr->oemid));
+  grub_memcpy (&(hdr->oemtable), root_oemtable, sizeof (hdr->oemtable));
+  hdr->oemrev = root_oemrev;
+  grub_memcpy (&(hdr->creator_id), root_creator_id, sizeof (hdr->creator_id));
+  hdr->creator_rev = root_creator_rev;
+  hdr->checksum = 0;
+}
+
+/* Point FADT at the new DSDT and the original FACS.  */
 static void
-setup_common_tables (void)
+fixup_fadt (struct grub_acpi_fadt *fadt, void *dsdt)
+{
+  fadt->dsdt_addr = (grub_addr_t) dsdt;
+  fadt->facs_addr = facs_addr;
+
+  /* Does a revision 2 exist at all? */
+  if (fadt->hdr.revision >= 3)
+    {
+      fadt->dsdt_xaddr = (grub_addr_t) dsdt;
+      fadt->facs_xaddr = facs_addr;
+    }
+}
+
+/* Copy SRC to its place in the new region.  */
+static grub_err_t
+place_table (struct acpi_table_source *src, const char *name)
 {
-  struct efiemu_acpi_table *cur;
-  struct grub_acpi_table_header *rsdt;
+  if (src->addr)
+    {
+      grub_memcpy (src->dest, src->addr, src->size);
+      return GRUB_ERR_NONE;
+    }
+
+  grub_file_seek (src->file, 0);
+  if (grub_file_read (src->file, src->dest, src->size)
+      != (grub_ssize_t) src->size)
+    {
+      if (!grub_errno)
+	grub_error (GRUB_ERR_BAD_OS, N_("premature end of file %s"), name);
+      return grub_errno;
+    }
+  return GRUB_ERR_NONE;
+}
+
+/* Lay out the DSDT, the other tables, RSDT and the RSDPs and XSDT that
+   are asked for one after another in a single region, copy the tables
+   there and fill in the rest.  Each table is checksummed once it is
+   complete.  */
+static grub_err_t
+build_tables (struct acpi_table_source *dsdt, struct acpi_table_source *tables,
+	      int numoftables, int *mmapregion)
+{
+  grub_size_t size, rsdt_size, xsdt_size;
+  grub_uint8_t *playground, *ptr;
+  struct grub_acpi_table_header *rsdt, *xsdt = 0;
   grub_uint32_t *rsdt_entry;
-  int numoftables;
+  grub_uint64_t *xsdt_entry;
+  grub_err_t err;
+  int i;
 
-  /* Treat DSDT. */
-  grub_memcpy (playground_ptr, table_dsdt, dsdt_size);
-  grub_free (table_dsdt);
-  table_dsdt = playground_ptr;
-  playground_ptr += dsdt_size;
+  rsdt_size = sizeof (struct grub_acpi_table_header)
+    + sizeof (grub_uint32_t) * numoftables;
+  xsdt_size = sizeof (struct grub_acpi_table_header)
+    + sizeof (grub_uint64_t) * numoftables;
 
-  /* Treat other tables. */
-  for (cur = acpi_tables; cur; cur = cur->next)
+  size = ALIGN_UP (dsdt->size, ACPI_TABLE_ALIGN);
+  for (i = 0; i < numoftables; i++)
+    size += ALIGN_UP (tables[i].size, ACPI_TABLE_ALIGN);
+  size += ALIGN_UP (rsdt_size, ACPI_TABLE_ALIGN);
+  if (rev1)
+    size += ALIGN_UP (sizeof (struct grub_acpi_rsdp_v10), ACPI_TABLE_ALIGN);
+  if (rev2)
+    size += ALIGN_UP (xsdt_size, ACPI_TABLE_ALIGN)
+      + sizeof (struct grub_acpi_rsdp_v20);
+
+  playground = grub_mmap_malign_and_register (16, size, mmapregion,
+					      GRUB_MEMORY_ACPI, 0);
+  if (! playground)
+    return grub_error (GRUB_ERR_OUT_OF_MEMORY,
+		       "couldn't allocate space for ACPI tables");
+
+  ptr = playground;
+  dsdt->dest = (struct grub_acpi_table_header *) ptr;
+  ptr += ALIGN_UP (dsdt->size, ACPI_TABLE_ALIGN);
+  /* The tables were collected in firmware then argument order; the table
+     list has always been the reverse of that.  */
+  for (i = numoftables - 1; i >= 0; i--)
+    {
+      tables[i].dest = (struct grub_acpi_table_header *) ptr;
+      ptr += ALIGN_UP (tables[i].size, ACPI_TABLE_ALIGN);
+    }
+  rsdt = (struct grub_acpi_table_header *) ptr;
+  ptr += ALIGN_UP (rsdt_size, ACPI_TABLE_ALIGN);
+
+  if (dsdt->size)
+    {
+      err = place_table (dsdt, "DSDT");
+      if (err)
+	goto fail;
+    }
+  for (i = numoftables - 1; i >= 0; i--)
     {
       struct grub_acpi_fadt *fadt;
 
-      grub_memcpy (playground_ptr, cur->addr, cur->size);
-      grub_free (cur->addr);
-      cur->addr = playground_ptr;
-      playground_ptr += cur->size;
+      err = place_table (&tables[i], tables[i].file ? tables[i].file->name
+			 : "");
+      if (err)
+	goto fail;
 
       /* If it's FADT correct DSDT and FACS addresses. */
-      fadt = (struct grub_acpi_fadt *) cur->addr;
+      fadt = (struct grub_acpi_fadt *) tables[i].dest;
       if (grub_memcmp (fadt->hdr.signature, GRUB_ACPI_FADT_SIGNATURE,
 		       sizeof (fadt->hdr.signature)) == 0)
 	{
-	  fadt->dsdt_addr = (grub_addr_t) table_dsdt;
-	  fadt->facs_addr = facs_addr;
-
-	  /* Does a revision 2 exist at all? */
-	  if (fadt->hdr.revision >= 3)
-	    {
-	      fadt->dsdt_xaddr = (grub_addr_t) table_dsdt;
-	      fadt->facs_xaddr = facs_addr;
-	    }
-
-	  /* Recompute checksum. */
+	  fixup_fadt (fadt, dsdt->size ? dsdt->dest : 0);
 	  fadt->hdr.checksum = 0;
-	  fadt->hdr.checksum = 1 + ~grub_byte_checksum (fadt, fadt->hdr.length);
+	  fadt->hdr.checksum = 1 + ~grub_byte_checksum (fadt,
+							fadt->hdr.length);
 	}
     }
 
-  /* Fill RSDT entries. */
-  numoftables = 0;
-  for (cur = acpi_tables; cur; cur = cur->next)
-    numoftables++;
-
-  rsdt_addr = rsdt = (struct grub_acpi_table_header *) playground_ptr;
-  playground_ptr += sizeof (struct grub_acpi_table_header) + sizeof (grub_uint32_t) * numoftables;
-
+  /* Fill RSDT. */
+  set_root_header (rsdt, "RSDT", rsdt_size);
   rsdt_entry = (grub_uint32_t *) (rsdt + 1);
-
-  /* Fill RSDT header. */
-  grub_memcpy (&(rsdt->signature), "RSDT", 4);
-  rsdt->length = sizeof (struct grub_acpi_table_header) + sizeof (grub_uint32_t) * numoftables;
-  rsdt->revision = 1;
-  grub_memcpy (&(rsdt->oemid), root_oemid, sizeof (rsdt->oemid));
-  grub_memcpy (&(rsdt->oemtable), root_oemtable, sizeof (rsdt->oemtable));
-  rsdt->oemrev = root_oemrev;
-  grub_memcpy (&(rsdt->creator_id), root_creator_id, sizeof (rsdt->creator_id));
-  rsdt->creator_rev = root_creator_rev;
-
-  for (cur = acpi_tables; cur; cur = cur->next)
-    *(rsdt_entry++) = (grub_addr_t) cur->addr;
-
-  /* Recompute checksum. */
-  rsdt->checksum = 0;
+  for (i = numoftables - 1; i >= 0; i--)
+    *(rsdt_entry++) = (grub_addr_t) tables[i].dest;
   rsdt->checksum = 1 + ~grub_byte_checksum (rsdt, rsdt->length);
-}
 
-/* Regenerate ACPIv1 RSDP */
-static void
-setv1table (void)
-{
-  /* Create RSDP. */
-  rsdpv1_new = (struct grub_acpi_rsdp_v10 *) playground_ptr;
-  playground_ptr += sizeof (struct grub_acpi_rsdp_v10);
-  grub_memcpy (&(rsdpv1_new->signature), GRUB_RSDP_SIGNATURE,
-	       sizeof (rsdpv1_new->signature));
-  grub_memcpy (&(rsdpv1_new->oemid), root_oemid, sizeof  (rsdpv1_new->oemid));
-  rsdpv1_new->revision = 0;
-  rsdpv1_new->rsdt_addr = (grub_addr_t) rsdt_addr;
-  rsdpv1_new->checksum = 0;
-  rsdpv1_new->checksum = 1 + ~grub_byte_checksum (rsdpv1_new,
-						  sizeof (*rsdpv1_new));
-  grub_dprintf ("acpi", "Generated ACPIv1 tables\n");
-}
+  /* Regenerate ACPIv1 RSDP. */
+  if (rev1)
+    {
+      rsdpv1_new = (struct grub_acpi_rsdp_v10 *) ptr;
+      ptr += ALIGN_UP (sizeof (struct grub_acpi_rsdp_v10), ACPI_TABLE_ALIGN);
+      grub_memcpy (&(rsdpv1_new->signature), GRUB_RSDP_SIGNATURE,
+		   sizeof (rsdpv1_new->signature));
+      grub_memcpy (&(rsdpv1_new->oemid), root_oemid,
+		   sizeof (rsdpv1_new->oemid));
+      rsdpv1_new->revision = 0;
+      rsdpv1_new->rsdt_addr = (grub_addr_t) rsdt;
+      rsdpv1_new->checksum = 0;
+      rsdpv1_new->checksum = 1 + ~grub_byte_checksum (rsdpv1_new,
+						      sizeof (*rsdpv1_new));
+      grub_dprintf ("acpi", "Generated ACPIv1 tables\n");
+    }
 
-static void
-setv2table (void)
-{
-  struct grub_acpi_table_header *xsdt;
-  struct efiemu_acpi_table *cur;
-  grub_uint64_t *xsdt_entry;
-  int numoftables;
+  if (rev2)
+    {
+      /* Create XSDT. */
+      xsdt = (struct grub_acpi_table_header *) ptr;
+      ptr += ALIGN_UP (xsdt_size, ACPI_TABLE_ALIGN);
+      set_root_header (xsdt, "XSDT", xsdt_size);
+      xsdt_entry = (grub_uint64_t *) (xsdt + 1);
+      for (i = numoftables - 1; i >= 0; i--)
+	*(xsdt_entry++) = (grub_addr_t) tables[i].dest;
+      xsdt->checksum = 1 + ~grub_byte_checksum (xsdt, xsdt->length);
+
+      /* Create RSDPv2. */
+      rsdpv2_new = (struct grub_acpi_rsdp_v20 *) ptr;
+      grub_memcpy (&(rsdpv2_new->rsdpv1.signature), GRUB_RSDP_SIGNATURE,
+		   sizeof (rsdpv2_new->rsdpv1.signature));
+      grub_memcpy (&(rsdpv2_new->rsdpv1.oemid), root_oemid,
+		   sizeof (rsdpv2_new->rsdpv1.oemid));
+      rsdpv2_new->rsdpv1.revision = rev2;
+      rsdpv2_new->rsdpv1.rsdt_addr = (grub_addr_t) rsdt;
+      rsdpv2_new->rsdpv1.checksum = 0;
+      rsdpv2_new->rsdpv1.checksum = 1 + ~grub_byte_checksum
+	(&(rsdpv2_new->rsdpv1), sizeof (rsdpv2_new->rsdpv1));
+      rsdpv2_new->length = sizeof (*rsdpv2_new);
+      rsdpv2_new->xsdt_addr = (grub_addr_t) xsdt;
+      rsdpv2_new->checksum = 0;
+      rsdpv2_new->checksum = 1 + ~grub_byte_checksum (rsdpv2_new,
+						      rsdpv2_new->length);
+      grub_dprintf ("acpi", "Generated ACPIv2 tables\n");
+    }
 
-  numoftables = 0;
-  for (cur = acpi_tables; cur; cur = cur->next)
-    numoftables++;
-
-  /* Create XSDT. */
-  xsdt = (struct grub_acpi_table_header *) playground_ptr;
-  playground_ptr += sizeof (struct grub_acpi_table_header) + sizeof (grub_uint64_t) * numoftables;
-
-  xsdt_entry = (grub_uint64_t *)(xsdt + 1);
-  for (cur = acpi_tables; cur; cur = cur->next)
-    *(xsdt_entry++) = (grub_addr_t) cur->addr;
-  grub_memcpy (&(xsdt->signature), "XSDT", 4);
-  xsdt->length = sizeof (struct grub_acpi_table_header) + sizeof (grub_uint64_t) * numoftables;
-  xsdt->revision = 1;
-  grub_memcpy (&(xsdt->oemid), root_oemid, sizeof (xsdt->oemid));
-  grub_memcpy (&(xsdt->oemtable), root_oemtable, sizeof (xsdt->oemtable));
-  xsdt->oemrev = root_oemrev;
-  grub_memcpy (&(xsdt->creator_id), root_creator_id, sizeof (xsdt->creator_id));
-  xsdt->creator_rev = root_creator_rev;
-  xsdt->checksum = 0;
-  xsdt->checksum = 1 + ~grub_byte_checksum (xsdt, xsdt->length);
-
-  /* Create RSDPv2. */
-  rsdpv2_new = (struct grub_acpi_rsdp_v20 *) playground_ptr;
-  playground_ptr += sizeof (struct grub_acpi_rsdp_v20);
-  grub_memcpy (&(rsdpv2_new->rsdpv1.signature), GRUB_RSDP_SIGNATURE,
-	       sizeof (rsdpv2_new->rsdpv1.signature));
-  grub_memcpy (&(rsdpv2_new->rsdpv1.oemid), root_oemid,
-	       sizeof (rsdpv2_new->rsdpv1.oemid));
-  rsdpv2_new->rsdpv1.revision = rev2;
-  rsdpv2_new->rsdpv1.rsdt_addr = (grub_addr_t) rsdt_addr;
-  rsdpv2_new->rsdpv1.checksum = 0;
-  rsdpv2_new->rsdpv1.checksum = 1 + ~grub_byte_checksum
-    (&(rsdpv2_new->rsdpv1), sizeof (rsdpv2_new->rsdpv1));
-  rsdpv2_new->length = sizeof (*rsdpv2_new);
-  rsdpv2_new->xsdt_addr = (grub_addr_t) xsdt;
-  rsdpv2_new->checksum = 0;
-  rsdpv2_new->checksum = 1 + ~grub_byte_checksum (rsdpv2_new,
-						  rsdpv2_new->length);
-  grub_dprintf ("acpi", "Generated ACPIv2 tables\n");
+  return GRUB_ERR_NONE;
+
+ fail:
+  grub_mmap_free_and_unregister (*mmapregion);
+  return err;
 }
 
 static void
-free_tables (void)
+close_files (struct acpi_table_source *dsdt, struct acpi_table_source *tables,
+	     int numoftables)
 {
-  struct efiemu_acpi_table *cur, *t;
-  if (table_dsdt)
-    grub_free (table_dsdt);
-  for (cur = acpi_tables; cur;)
-    {
-      t = cur;
-      grub_free (cur->addr);
-      cur = cur->next;
-      grub_free (t);
-    }
-  acpi_tables = 0;
-  table_dsdt = 0;
+  int i;
+
+  if (dsdt->file)
+    grub_file_close (dsdt->file);
+  for (i = 0; i < numoftables; i++)
+    if (tables[i].file)
+      grub_file_close (tables[i].file);
 }
 
 static grub_err_t
@@ -468,17 +506,17 @@ grub_cmd_acpi (struct grub_extcmd_context *ctxt, int argc, char **args)
 {
   struct grub_arg_list *state = ctxt->state;
   struct grub_acpi_rsdp_v10 *rsdp;
-  struct efiemu_acpi_table *cur, *t;
+  struct acpi_table_source dsdt = { 0 }, *tables;
+  struct grub_acpi_table_header *rsdt = 0;
   int i, mmapregion;
-  int numoftables;
+  int numoftables, maxtables;
+  grub_err_t err;
 
   /* Default values if no RSDP is found. */
   rev1 = 1;
   rev2 = 3;
 
   facs_addr = 0;
-  playground = playground_ptr = 0;
-  playground_size = 0;
 
   rsdp = (struct grub_acpi_rsdp_v10 *) grub_machine_acpi_get_rsdpv2 ();
 
@@ -487,14 +525,24 @@ grub_cmd_acpi (struct grub_extcmd_context *ctxt, int argc, char **args)
 
   grub_dprintf ("acpi", "RSDP @%p\n", rsdp);
 
+  /* RSDT consists of header and an array of 32-bit pointers. */
+  maxtables = argc;
+  if (rsdp)
+    {
+      rsdt = (struct grub_acpi_table_header *) (grub_addr_t) rsdp->rsdt_addr;
+      maxtables += (rsdt->length - sizeof (*rsdt)) / sizeof (grub_uint32_t);
+    }
+  tables = grub_zalloc ((maxtables ? : 1) * sizeof (tables[0]));
+  if (! tables)
+    return grub_errno;
+  numoftables = 0;
+
   if (rsdp)
     {
       grub_uint32_t *entry_ptr;
       char *exclude = 0;
       char *load_only = 0;
       char *ptr;
-      /* RSDT consists of header and an array of 32-bit pointers. */
-      struct grub_acpi_table_header *rsdt;
 
       exclude = state[0].set ? grub_strdup (state[0].arg) : 0;
       if (exclude)
@@ -513,15 +561,13 @@ grub_cmd_acpi (struct grub_extcmd_context *ctxt, int argc, char **args)
       /* Set revision variables to replicate the same version as host. */
       rev1 = ! rsdp->revision;
       rev2 = rsdp->revision;
-      rsdt = (struct grub_acpi_table_header *) (grub_addr_t) rsdp->rsdt_addr;
-      /* Load host tables. */
+      /* Collect host tables. */
       for (entry_ptr = (grub_uint32_t *) (rsdt + 1);
 	   entry_ptr < (grub_uint32_t *) (((grub_uint8_t *) rsdt)
 					  + rsdt->length);
 	   entry_ptr++)
 	{
 	  char signature[5];
-	  struct efiemu_acpi_table *table;
 	  struct grub_acpi_table_header *curtable
 	    = (struct grub_acpi_table_header *) (grub_addr_t) *entry_ptr;
 	  signature[4] = 0;
@@ -531,7 +577,7 @@ grub_cmd_acpi (struct grub_extcmd_context *ctxt, int argc, char **args)
 	  /* If it's FADT it contains addresses of DSDT and FACS. */
 	  if (grub_strcmp (signature, "facp") == 0)
 	    {
-	      struct grub_acpi_table_header *dsdt;
+	      struct grub_acpi_table_header *host_dsdt;
 	      struct grub_acpi_fadt *fadt = (struct grub_acpi_fadt *) curtable;
 
 	      /* Set root header variables to the same values
@@ -545,23 +591,15 @@ grub_cmd_acpi (struct grub_extcmd_context *ctxt, int argc, char **args)
 			   sizeof (root_creator_id));
 	      root_creator_rev = fadt->hdr.creator_rev;
 
-	      /* Load DSDT if not excluded. */
-	      dsdt = (struct grub_acpi_table_header *)
+	      /* Use DSDT if not excluded. */
+	      host_dsdt = (struct grub_acpi_table_header *)
 		(grub_addr_t) fadt->dsdt_addr;
-	      if (dsdt && (! exclude || ! grub_strword (exclude, "dsdt"))
+	      if (host_dsdt && (! exclude || ! grub_strword (exclude, "dsdt"))
 		  && (! load_only || grub_strword (load_only, "dsdt"))
-		  && dsdt->length >= sizeof (*dsdt))
+		  && host_dsdt->length >= sizeof (*host_dsdt))
 		{
-		  dsdt_size = dsdt->length;
-		  table_dsdt = grub_malloc (dsdt->length);
-		  if (! table_dsdt)
-		    {
-		      free_tables ();
-		      grub_free (exclude);
-		      grub_free (load_only);
-		      return grub_errno;
-		    }
-		  grub_memcpy (table_dsdt, dsdt, dsdt->length);
+		  dsdt.addr = host_dsdt;
+		  dsdt.size = host_dsdt->length;
 		}
 
 	      /* Save FACS address. FACS shouldn't be overridden. */
@@ -578,26 +616,9 @@ grub_cmd_acpi (struct grub_extcmd_context *ctxt, int argc, char **args)
 	  if (curtable->length < sizeof (*curtable))
 	    continue;
 
-	  table = (struct efiemu_acpi_table *) grub_malloc
-	    (sizeof (struct efiemu_acpi_table));
-	  if (! table)
-	    {
-	      free_tables ();
-	      grub_free (exclude);
-	      grub_free (load_only);
-	      return grub_errno;
-	    }
-	  table->size = curtable->length;
-	  table->addr = grub_malloc (table->size);
-	  playground_size += table->size;
-	  if (! table->addr)
-	    {
-	      free_tables ();
-	      return grub_errno;
-	    }
-	  table->next = acpi_tables;
-	  acpi_tables = table;
-	  grub_memcpy (table->addr, curtable, table->size);
+	  tables[numoftables].addr = curtable;
+	  tables[numoftables].size = curtable->length;
+	  numoftables++;
 	}
       grub_free (exclude);
       grub_free (load_only);
@@ -625,123 +646,58 @@ grub_cmd_acpi (struct grub_extcmd_context *ctxt, int argc, char **args)
   if (state[8].set)
     root_creator_rev = grub_strtoul (state[8].arg, 0, 0);
 
-  /* Load user tables */
+  /* Open user tables.  Only their headers are read now; the contents go
+     straight to the new region once its layout is known.  */
   for (i = 0; i < argc; i++)
     {
+      struct grub_acpi_table_header hdr;
       grub_file_t file;
       grub_size_t size;
-      char *buf;
 
       file = grub_file_open (args[i]);
       if (! file)
-	{
-	  free_tables ();
-	  return grub_errno;
-	}
+	goto fail;
 
       size = grub_file_size (file);
-      if (size < sizeof (struct grub_acpi_table_header))
+      if (size < sizeof (hdr)
+	  || grub_file_read (file, &hdr, sizeof (hdr)) != sizeof (hdr))
 	{
 	  grub_file_close (file);
-	  free_tables ();
-	  return grub_error (GRUB_ERR_BAD_OS, N_("premature end of file %s"),
-			     args[i]);
-	}
-
-      buf = (char *) grub_malloc (size);
-      if (! buf)
-	{
-	  grub_file_close (file);
-	  free_tables ();
-	  return grub_errno;
-	}
-
-      if (grub_file_read (file, buf, size) != (int) size)
-	{
-	  grub_file_close (file);
-	  free_tables ();
 	  if (!grub_errno)
 	    grub_error (GRUB_ERR_BAD_OS, N_("premature end of file %s"),
 			args[i]);
-	  return grub_errno;
+	  goto fail;
 	}
-      grub_file_close (file);
 
-      if (grub_memcmp (((struct grub_acpi_table_header *) buf)->signature,
-		       "DSDT", 4) == 0)
+      if (grub_memcmp (hdr.signature, "DSDT", 4) == 0)
 	{
-	  grub_free (table_dsdt);
-	  table_dsdt = buf;
-	  dsdt_size = size;
+	  if (dsdt.file)
+	    grub_file_close (dsdt.file);
+	  dsdt.addr = 0;
+	  dsdt.file = file;
+	  dsdt.size = size;
 	}
       else
 	{
-	  struct efiemu_acpi_table *table;
-	  table = (struct efiemu_acpi_table *) grub_malloc
-	    (sizeof (struct efiemu_acpi_table));
-	  if (! table)
-	    {
-	      free_tables ();
-	      return grub_errno;
-	    }
-
-	  table->size = size;
-	  table->addr = buf;
-	  playground_size += table->size;
-
-	  table->next = acpi_tables;
-	  acpi_tables = table;
+	  tables[numoftables].file = file;
+	  tables[numoftables].size = size;
+	  numoftables++;
 	}
     }
 
-  numoftables = 0;
-  for (cur = acpi_tables; cur; cur = cur->next)
-    numoftables++;
-
-  /* DSDT. */
-  playground_size += dsdt_size;
-  /* RSDT. */
-  playground_size += sizeof (struct grub_acpi_table_header) + sizeof (grub_uint32_t) * numoftables;
-  /* RSDPv1. */
-  playground_size += sizeof (struct grub_acpi_rsdp_v10);
-  /* XSDT. */
-  playground_size += sizeof (struct grub_acpi_table_header) + sizeof (grub_uint64_t) * numoftables;
-  /* RSDPv2. */
-  playground_size += sizeof (struct grub_acpi_rsdp_v20);
-
-  playground = playground_ptr
-    = grub_mmap_malign_and_register (1, playground_size, &mmapregion,
-				     GRUB_MEMORY_ACPI, 0);
-
-  if (! playground)
+  err = build_tables (&dsdt, tables, numoftables, &mmapregion);
+  close_files (&dsdt, tables, numoftables);
+  grub_free (tables);
+  if (err)
     {
-      free_tables ();
-      return grub_error (GRUB_ERR_OUT_OF_MEMORY,
-			 "couldn't allocate space for ACPI tables");
+      rsdpv1_new = 0;
+      rsdpv2_new = 0;
+      return err;
     }
 
-  setup_common_tables ();
-
-  /* Request space for RSDPv1. */
-  if (rev1)
-    setv1table ();
-
-  /* Request space for RSDPv2+ and XSDT. */
-  if (rev2)
-    setv2table ();
-
-  for (cur = acpi_tables; cur;)
-    {
-      t = cur;
-      cur = cur->next;
-      grub_free (t);
-    }
-  acpi_tables = 0;
-
 #if defined (__i386__) || defined (__x86_64__)
   if (! state[9].set)
     {
-      grub_err_t err;
       err = grub_acpi_create_ebda ();
       if (err)
 	{
@@ -766,6 +722,11 @@ grub_cmd_acpi (struct grub_extcmd_context *ctxt, int argc, char **args)
 #endif
 
   return GRUB_ERR_NONE;
+
+ fail:
+  close_files (&dsdt, tables, numoftables);
+  grub_free (tables);
+  return grub_errno;
 }
 
 static grub_extcmd_t cmd;
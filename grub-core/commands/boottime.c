@@ -18,48 +18,162 @@
 
 #include <grub/dl.h>
 #include <grub/misc.h>
-#include <grub/command.h>
+#include <grub/mm.h>
+#include <grub/env.h>
+#include <grub/time.h>
+#include <grub/extcmd.h>
 #include <grub/i18n.h>
 
 GRUB_MOD_LICENSE ("GPLv3+");
 
+static const struct grub_arg_option options[] =
+  {
+    {"json", 'j', 0, N_("Print the records as JSON."), 0, 0},
+    {"depth", 'd', 0, N_("Only print records nested at most DEPTH deep."),
+     N_("DEPTH"), ARG_TYPE_INT},
+    {"set", 's', 0,
+     N_("Store the milliseconds since the first record in VARNAME."),
+     N_("VARNAME"), ARG_TYPE_STRING},
+    {0, 0, 0, 0, 0, 0}
+  };
 
+static void
+print_json_string (const char *s)
+{
+  grub_printf ("\"");
+  for (; s && *s; s++)
+    if (*s == '"' || *s == '\\')
+      grub_printf ("\\%c", *s);
+    else if ((unsigned char) *s < 0x20)
+      grub_printf ("\\u%04x", (unsigned char) *s);
+    else
+      grub_printf ("%c", *s);
+  grub_printf ("\"");
+}
+
+/* One object per record, in order.  Spans carry their duration and byte
+   count; every record names the index of the span it happened in.  Records
+   deeper than MAX_DEPTH are left out but keep their index, so the output
+   of two runs can still be matched up.  */
 static grub_err_t
-grub_cmd_boottime (struct grub_command *cmd __attribute__ ((unused)),
+print_json (grub_uint64_t start_time, int max_depth)
+{
+  struct grub_boot_time *cur;
+  int *parents = NULL;
+  int nparents = 0, index = 0, printed = 0;
+
+  grub_printf ("[");
+  for (cur = grub_boot_time_head; cur; cur = cur->next, index++)
+    {
+      if (cur->depth >= nparents)
+	{
+	  int *n = grub_realloc (parents, (cur->depth + 1) * sizeof (*n));
+
+	  if (!n)
+	    {
+	      grub_free (parents);
+	      return grub_errno;
+	    }
+	  parents = n;
+	  nparents = cur->depth + 1;
+	}
+      parents[cur->depth] = index;
+
+      if (cur->depth > max_depth)
+	continue;
+
+      grub_printf ("%s\n{\"index\":%d,\"parent\":%d,\"time\":%llu,\"file\":",
+		   printed++ ? "," : "", index,
+		   cur->depth ? parents[cur->depth - 1] : -1,
+		   (unsigned long long) (cur->tp - start_time));
+      print_json_string (cur->file);
+      grub_printf (",\"line\":%d,\"msg\":", cur->line);
+      print_json_string (cur->msg);
+      if (cur->is_span)
+	{
+	  if (cur->end)
+	    grub_printf (",\"duration\":%llu",
+			 (unsigned long long) (cur->end - cur->tp));
+	  grub_printf (",\"bytes\":%llu", (unsigned long long) cur->bytes);
+	}
+      grub_printf ("}");
+    }
+  grub_printf ("\n]\n");
+
+  grub_free (parents);
+  return GRUB_ERR_NONE;
+}
+
+static grub_err_t
+grub_cmd_boottime (grub_extcmd_context_t ctxt,
 		   int argc __attribute__ ((unused)),
 		   char *argv[] __attribute__ ((unused)))
 {
+  struct grub_arg_list *state = ctxt->state;
   struct grub_boot_time *cur;
   grub_uint64_t last_time = 0, start_time = 0;
+  int max_depth = GRUB_INT_MAX;
+
   if (!grub_boot_time_head)
     {
       grub_puts_ (N_("No boot time statistics is available\n"));
       return 0;
     }
   start_time = last_time = grub_boot_time_head->tp;
+
+  if (state[1].set)
+    max_depth = grub_strtol (state[1].arg, NULL, 0);
+
+  if (state[2].set)
+    {
+      char buf[32];
+
+      grub_snprintf (buf, sizeof (buf), "%llu",
+		     (unsigned long long) (grub_get_time_ms () - start_time));
+      return grub_env_set (state[2].arg, buf);
+    }
+
+  if (state[0].set)
+    return print_json (start_time, max_depth);
+
   for (cur = grub_boot_time_head; cur; cur = cur->next)
     {
       grub_uint32_t tmabs = cur->tp - start_time;
       grub_uint32_t tmrel = cur->tp - last_time;
+      int i;
+
+      if (cur->depth > max_depth)
+	continue;
+
       last_time = cur->tp;
+      grub_printf ("%3d.%03ds %2d.%03ds %s:%d ", 
+		   tmabs / 1000, tmabs % 1000, tmrel / 1000, tmrel % 1000, cur->file, cur->line);
+      for (i = 0; i < cur->depth; i++)
+	grub_printf ("  ");
+      grub_printf ("%s", cur->msg);
+      if (cur->is_span && cur->end)
+	{
+	  grub_uint32_t tmspan = cur->end - cur->tp;
 
-      grub_printf ("%3d.%03ds %2d.%03ds %s:%d %s\n", 
-		   tmabs / 1000, tmabs % 1000, tmrel / 1000, tmrel % 1000, cur->file, cur->line,
-		   cur->msg);
+	  grub_printf (" (%d.%03ds, %llu bytes)", tmspan / 1000, tmspan % 1000,
+		       (unsigned long long) cur->bytes);
+	}
+      grub_printf ("\n");
     }
  return 0;
 }
 
-static grub_command_t cmd_boottime;
+static grub_extcmd_t cmd_boottime;
 
 GRUB_MOD_INIT(boottime)
 {
   cmd_boottime =
-    grub_register_command ("boottime", grub_cmd_boottime,
-			   0, N_("Show boot time statistics."));
+    grub_register_extcmd ("boottime", grub_cmd_boottime, 0,
+			  N_("[--json] [--depth DEPTH] [--set VARNAME]"),
+			  N_("Show boot time statistics."), options);
 }
 
 GRUB_MOD_FINI(boottime)
 {
-  grub_unregister_command (cmd_boottime);
+  grub_unregister_extcmd (cmd_boottime);
 }
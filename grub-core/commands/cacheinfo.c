@@ -30,19 +30,36 @@ grub_rescue_cmd_info (struct grub_command *cmd __attribute__ ((unused)),
     int argc __attribute__ ((unused)),
     char *argv[] __attribute__ ((unused)))
 {
-  unsigned long hits, misses;
+  unsigned long hits, misses, reads;
+  grub_uint64_t read_bytes;
+  unsigned long used = 0;
+  unsigned i;
 
   grub_disk_cache_get_performance (&hits, &misses);
   if (hits + misses)
     {
       unsigned long ratio = hits * 10000 / (hits + misses);
-      grub_printf ("(%lu.%lu%%)\n", ratio / 100, ratio % 100);
       grub_printf_ (N_("Disk cache statistics: hits = %lu (%lu.%02lu%%),"
-		     " misses = %lu\n"), ratio / 100, ratio % 100,
-		    hits, misses);
+		     " misses = %lu\n"), hits, ratio / 100, ratio % 100,
+		    misses);
     }
   else
-    grub_printf ("%s\n", _("No disk cache statistics available\n"));    
+    grub_printf ("%s\n", _("No disk cache statistics available"));
+
+  grub_disk_get_read_stats (&reads, &read_bytes);
+  grub_printf_ (N_("Disk reads: %lu (%llu KiB)\n"), reads,
+		(unsigned long long) (read_bytes >> 10));
+
+  for (i = 0; grub_disk_cache_table
+	 && i < grub_disk_cache_sets * GRUB_DISK_CACHE_WAYS; i++)
+    if (grub_disk_cache_table[i].data)
+      used++;
+
+  grub_printf_ (N_("Disk cache geometry: %u sets of %u ways,"
+		 " %lu of %lu lines in use (%lu KiB)\n"),
+		grub_disk_cache_sets, GRUB_DISK_CACHE_WAYS, used,
+		(unsigned long) grub_disk_cache_sets * GRUB_DISK_CACHE_WAYS,
+		used << (GRUB_DISK_CACHE_BITS + GRUB_DISK_SECTOR_BITS - 10));
 
  return 0;
 }
@@ -0,0 +1,381 @@
+/* profile.c - sample where GRUB spends its time.  */
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2026  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* A periodic timer event samples the instruction GRUB was executing when
+   the timer interrupt came.  The firmware does not hand that address to the
+   notify function, but it handles the interrupt on GRUB's stack, so the
+   frame the processor pushed is found by walking up from the notify
+   function.  Samples are attributed to modules and functions only when
+   they are printed.  */
+
+#include <grub/dl.h>
+#include <grub/extcmd.h>
+#include <grub/i18n.h>
+#include <grub/loader.h>
+#include <grub/misc.h>
+#include <grub/mm.h>
+#include <grub/efi/api.h>
+#include <grub/efi/efi.h>
+
+GRUB_MOD_LICENSE ("GPLv3+");
+
+/* The firmware calls the notify function with the EFI calling convention,
+   which on x86_64 is not the one GRUB is built with.  */
+#if defined (__x86_64__) && !defined (__MINGW64__) && !defined (__CYGWIN__)
+#define NOTIFY_FUNCTION __attribute__ ((ms_abi))
+#else
+#define NOTIFY_FUNCTION
+#endif
+
+/* Distinct addresses kept, a power of two.  */
+#define PROFILE_SLOTS		8192
+/* Slots probed before a sample is dropped.  */
+#define PROFILE_PROBES		32
+/* How far up the stack the interrupt frame is looked for, in words.  */
+#define PROFILE_SCAN_WORDS	1024
+
+#define PROFILE_DEFAULT_RATE	1000
+#define PROFILE_DEFAULT_TOP	20
+
+struct sample
+{
+  grub_addr_t pc;
+  grub_uint32_t count;
+};
+
+/* Samples with the same attribution, summed for printing.  */
+struct entry
+{
+  grub_dl_t mod;
+  const char *where;
+  grub_uint32_t count;
+};
+
+static struct sample *samples;
+static grub_uint32_t total, unknown, dropped;
+static grub_efi_event_t event;
+static struct grub_preboot *preboot;
+static grub_addr_t code_selector, stack_selector;
+
+static const struct grub_arg_option options[] =
+  {
+    {"start", 0, 0, N_("Discard the samples and start sampling."), 0, 0},
+    {"stop", 0, 0, N_("Stop sampling."), 0, 0},
+    {"rate", 'r', 0, N_("Take HZ samples per second (default 1000).  The "
+			"firmware timer tick, often 10 ms, limits it."),
+     N_("HZ"), ARG_TYPE_INT},
+    {"modules", 'm', 0, N_("Sum the samples per module."), 0, 0},
+    {"top", 'n', 0, N_("Print the N busiest places (default 20)."),
+     N_("N"), ARG_TYPE_INT},
+    {0, 0, 0, 0, 0, 0}
+  };
+
+enum options
+  {
+    PROFILE_START,
+    PROFILE_STOP,
+    PROFILE_RATE,
+    PROFILE_MODULES,
+    PROFILE_TOP
+  };
+
+/* Whether F is the frame the processor pushes when it interrupts code
+   running at the same privilege level: the return address, the code
+   segment and the flags with interrupts enabled, and in long mode the
+   stack pointer and segment from before the frame was aligned.  */
+static inline int
+interrupt_frame (const grub_addr_t *f)
+{
+  if (f[1] != code_selector
+      || (f[2] & 0x202) != 0x202 || (f[2] & ~(grub_addr_t) 0x3f7fd7))
+    return 0;
+#ifdef __x86_64__
+  if (f[4] != stack_selector
+      || f[3] - (grub_addr_t) (f + 5) >= 16)
+    return 0;
+#endif
+  return f[0] != 0;
+}
+
+static void NOTIFY_FUNCTION
+profile_tick (grub_efi_event_t ev __attribute__ ((unused)),
+	      void *context __attribute__ ((unused)))
+{
+  const grub_addr_t *sp = __builtin_frame_address (0);
+  grub_addr_t pc = 0;
+  unsigned i, slot;
+
+  for (i = 0; i < PROFILE_SCAN_WORDS; i++)
+    if (interrupt_frame (sp + i))
+      {
+	pc = sp[i];
+	break;
+      }
+
+  total++;
+  /* Run from the firmware after it lowered the priority level rather than
+     from the interrupt.  */
+  if (!pc)
+    {
+      unknown++;
+      return;
+    }
+
+  slot = ((grub_uint32_t) (pc >> 1) * 2654435761U) % PROFILE_SLOTS;
+  for (i = 0; i < PROFILE_PROBES; i++, slot = (slot + 1) % PROFILE_SLOTS)
+    {
+      if (samples[slot].pc == pc)
+	{
+	  samples[slot].count++;
+	  return;
+	}
+      if (!samples[slot].count)
+	{
+	  samples[slot].pc = pc;
+	  samples[slot].count = 1;
+	  return;
+	}
+    }
+  dropped++;
+}
+
+static void
+stop_timer (void)
+{
+  grub_efi_boot_services_t *b = grub_efi_system_table->boot_services;
+
+  if (!event)
+    return;
+  efi_call_3 (b->set_timer, event, GRUB_EFI_TIMER_CANCEL, 0);
+  efi_call_1 (b->close_event, event);
+  event = 0;
+}
+
+/* The loader is walking the hooks, so this one stays registered.  */
+static grub_err_t
+profile_preboot (int noret __attribute__ ((unused)))
+{
+  stop_timer ();
+  return GRUB_ERR_NONE;
+}
+
+static void
+profile_stop (void)
+{
+  stop_timer ();
+  if (preboot)
+    grub_loader_unregister_preboot_hook (preboot);
+  preboot = 0;
+}
+
+static grub_err_t
+profile_start (unsigned long rate)
+{
+  grub_efi_boot_services_t *b = grub_efi_system_table->boot_services;
+  grub_uint16_t cs, ss;
+
+  profile_stop ();
+  if (rate == 0 || rate > 100000)
+    return grub_error (GRUB_ERR_BAD_ARGUMENT, N_("invalid rate %lu"), rate);
+
+  if (!samples)
+    {
+      samples = grub_malloc (PROFILE_SLOTS * sizeof (*samples));
+      if (!samples)
+	return grub_errno;
+    }
+  grub_memset (samples, 0, PROFILE_SLOTS * sizeof (*samples));
+  total = unknown = dropped = 0;
+
+  asm volatile ("mov %%cs, %0; mov %%ss, %1" : "=r" (cs), "=r" (ss));
+  code_selector = cs;
+  stack_selector = ss;
+
+  if (efi_call_5 (b->create_event,
+		  GRUB_EFI_EVT_TIMER | GRUB_EFI_EVT_NOTIFY_SIGNAL,
+		  GRUB_EFI_TPL_NOTIFY, profile_tick, NULL, &event)
+      != GRUB_EFI_SUCCESS)
+    {
+      event = 0;
+      return grub_error (GRUB_ERR_IO, "couldn't create timer event");
+    }
+
+  /* The timer period is in units of 100 ns.  */
+  if (efi_call_3 (b->set_timer, event, GRUB_EFI_TIMER_PERIODIC,
+		  10000000 / rate) != GRUB_EFI_SUCCESS)
+    {
+      efi_call_1 (b->close_event, event);
+      event = 0;
+      return grub_error (GRUB_ERR_IO, "couldn't start timer");
+    }
+
+  preboot = grub_loader_register_preboot_hook (profile_preboot, NULL,
+					       GRUB_LOADER_PREBOOT_HOOK_PRIO_NORMAL);
+  return GRUB_ERR_NONE;
+}
+
+/* Find the module and function PC belongs to.  */
+static void
+attribute (grub_addr_t pc, grub_efi_loaded_image_t *image, int per_module,
+	   struct entry *e)
+{
+  const char *name = 0;
+  grub_size_t offset;
+  grub_dl_t mod;
+
+  e->mod = 0;
+
+  if (image && pc >= (grub_addr_t) image->image_base
+      && pc - (grub_addr_t) image->image_base < image->image_size)
+    {
+      if (!per_module)
+	name = grub_dl_find_function (0, (void *) pc, &offset);
+      e->where = name ? name : "kernel";
+      return;
+    }
+
+  FOR_DL_MODULES (mod)
+    if (pc >= (grub_addr_t) mod->base
+	&& pc - (grub_addr_t) mod->base < mod->sz)
+      {
+	if (!per_module)
+	  name = grub_dl_find_function (mod, (void *) pc, &offset);
+	e->mod = mod;
+	e->where = name ? name : mod->name;
+	return;
+      }
+
+  e->where = "firmware";
+}
+
+static grub_err_t
+profile_print (int per_module, unsigned long top)
+{
+  grub_efi_boot_services_t *b = grub_efi_system_table->boot_services;
+  grub_efi_loaded_image_t *image;
+  struct sample *copy;
+  struct entry *entries, e, tmp;
+  grub_uint32_t copy_total, copy_unknown, copy_dropped;
+  grub_efi_tpl_t old_tpl;
+  unsigned i, j, n = 0;
+
+  if (!samples)
+    return grub_error (GRUB_ERR_BAD_ARGUMENT, N_("no samples taken"));
+
+  copy = grub_malloc (PROFILE_SLOTS * sizeof (*copy));
+  entries = grub_malloc (PROFILE_SLOTS * sizeof (*entries));
+  if (!copy || !entries)
+    {
+      grub_free (copy);
+      grub_free (entries);
+      return grub_errno;
+    }
+
+  old_tpl = efi_call_1 (b->raise_tpl, GRUB_EFI_TPL_NOTIFY);
+  grub_memcpy (copy, samples, PROFILE_SLOTS * sizeof (*copy));
+  copy_total = total;
+  copy_unknown = unknown;
+  copy_dropped = dropped;
+  efi_call_1 (b->restore_tpl, old_tpl);
+
+  image = grub_efi_get_loaded_image (grub_efi_image_handle);
+  for (i = 0; i < PROFILE_SLOTS; i++)
+    {
+      if (!copy[i].count)
+	continue;
+      attribute (copy[i].pc, image, per_module, &e);
+      for (j = 0; j < n; j++)
+	if (entries[j].mod == e.mod && entries[j].where == e.where)
+	  break;
+      if (j == n)
+	{
+	  entries[n] = e;
+	  entries[n++].count = 0;
+	}
+      entries[j].count += copy[i].count;
+    }
+
+  /* Busiest first.  */
+  for (i = 1; i < n; i++)
+    {
+      tmp = entries[i];
+      for (j = i; j > 0 && entries[j - 1].count < tmp.count; j--)
+	entries[j] = entries[j - 1];
+      entries[j] = tmp;
+    }
+
+  grub_printf_ (N_("%u samples, %u outside an interrupt, %u dropped\n"),
+		copy_total, copy_unknown, copy_dropped);
+  for (i = 0; i < n && i < top; i++)
+    {
+      grub_uint32_t permille = (grub_uint64_t) entries[i].count * 1000
+	/ copy_total;
+
+      grub_printf ("%8u %3u.%u%%  %s", entries[i].count, permille / 10,
+		   permille % 10, entries[i].where);
+      if (!per_module && entries[i].mod
+	  && entries[i].where != entries[i].mod->name)
+	grub_printf (" [%s]", entries[i].mod->name);
+      grub_printf ("\n");
+    }
+
+  grub_free (copy);
+  grub_free (entries);
+  return GRUB_ERR_NONE;
+}
+
+static grub_err_t
+grub_cmd_profile (grub_extcmd_context_t ctxt,
+		  int argc __attribute__ ((unused)),
+		  char **args __attribute__ ((unused)))
+{
+  struct grub_arg_list *state = ctxt->state;
+  unsigned long top = PROFILE_DEFAULT_TOP;
+
+  if (state[PROFILE_START].set)
+    return profile_start (state[PROFILE_RATE].set
+			  ? grub_strtoul (state[PROFILE_RATE].arg, NULL, 0)
+			  : PROFILE_DEFAULT_RATE);
+  if (state[PROFILE_STOP].set)
+    {
+      profile_stop ();
+      return GRUB_ERR_NONE;
+    }
+
+  if (state[PROFILE_TOP].set)
+    top = grub_strtoul (state[PROFILE_TOP].arg, NULL, 0);
+  return profile_print (state[PROFILE_MODULES].set, top);
+}
+
+static grub_extcmd_t cmd;
+
+GRUB_MOD_INIT(profile)
+{
+  cmd = grub_register_extcmd ("profile", grub_cmd_profile, 0,
+			      N_("[--start [-r HZ]|--stop] [-m] [-n N]"),
+			      N_("Sample where GRUB spends its time."),
+			      options);
+}
+
+GRUB_MOD_FINI(profile)
+{
+  profile_stop ();
+  grub_free (samples);
+  grub_unregister_extcmd (cmd);
+}
@@ -82,6 +82,7 @@ grub_find_next (const char *disk_name,
   grub_device_t dev = NULL;
   grub_gpt_t gpt = NULL;
   grub_uint32_t i, part_index;
+  int repaired = 0;
 
   dev = grub_device_open (disk_name);
   if (!dev)
@@ -92,8 +93,11 @@ grub_find_next (const char *disk_name,
     goto done;
 
   if (!(gpt->status & GRUB_GPT_BOTH_VALID))
-    if (grub_gpt_repair (dev->disk, gpt))
-      goto done;
+    {
+      if (grub_gpt_repair (dev->disk, gpt))
+	goto done;
+      repaired = 1;
+    }
 
   for (i = 0; i < grub_le_to_cpu32 (gpt->primary.maxpart); i++)
     {
@@ -130,10 +134,15 @@ grub_find_next (const char *disk_name,
 
       grub_gptprio_set_tries_left (part_found, tries_left - 1);
 
-      if (grub_gpt_update_checksums (gpt))
-	goto done;
-
-      if (grub_gpt_write (dev->disk, gpt))
+      /* A repaired table has to be written out in full, otherwise only
+	 the sector holding this entry changed.  */
+      if (repaired)
+	{
+	  if (grub_gpt_update_checksums (gpt)
+	      || grub_gpt_write (dev->disk, gpt))
+	    goto done;
+	}
+      else if (grub_gpt_write_entry (dev->disk, gpt, part_index))
 	goto done;
     }
 
@@ -25,6 +25,7 @@
 #include <grub/crypto.h>
 #include <grub/normal.h>
 #include <grub/i18n.h>
+#include <grub/job.h>
 
 GRUB_MOD_LICENSE ("GPLv3+");
 
@@ -60,41 +61,332 @@ hextoval (char c)
   return -1;
 }
 
-static grub_err_t
-hash_file (grub_file_t file, const gcry_md_spec_t *hash, void *result)
+/* Files are read on the calling processor in large chunks, one file after
+   the other, and the chunks are hashed by jobs while the next ones are
+   read.  The chunks of a file are hashed in order, one job at a time, but
+   a later file can be hashed on another processor while an earlier one is
+   still catching up, as long as there are free chunks.  Results are
+   reported in the order the files were given.  */
+
+#define HASH_CHUNK_SIZE		(512 * 1024)
+#define HASH_MAX_STREAMS	8
+
+struct hash_chunk
 {
+  struct hash_chunk *next;
+  grub_uint8_t *data;
+  grub_size_t len;
+};
+
+/* One file being hashed.  */
+struct hash_stream
+{
+  /* Hashes RUNNING into CONTEXT.  */
+  struct grub_job job;
+  const gcry_md_spec_t *hash;
   void *context;
-  grub_uint8_t *readbuf;
-#define BUF_SIZE 4096
-  readbuf = grub_malloc (BUF_SIZE);
-  if (!readbuf)
-    return grub_errno;
-  context = grub_zalloc (hash->contextsize);
-  if (!readbuf || !context)
-    goto fail;
+  struct hash_chunk *running;
+  /* Chunks read but not hashed yet.  */
+  struct hash_chunk *queue;
+  struct hash_chunk **queue_tail;
+  char *name;
+  grub_uint8_t expected[GRUB_CRYPTO_MAX_MDLEN];
+};
+
+struct hash_pipe
+{
+  const gcry_md_spec_t *hash;
+  struct hash_stream *streams;
+  unsigned nstreams;
+  /* Slot of the next file, which holds the oldest one.  */
+  unsigned next;
+  struct hash_chunk *chunks;
+  unsigned nchunks;
+  struct hash_chunk *free_chunks;
+  int check;
+  int keep;
+  unsigned unread;
+  unsigned mismatch;
+};
+
+static void
+run_hash_chunk (struct grub_job *job)
+{
+  struct hash_stream *s = (struct hash_stream *) job;
+
+  s->hash->write (s->context, s->running->data, s->running->len);
+}
+
+/* Retire the chunk of S being hashed if it is done, or wait for it if
+   BLOCK, and start hashing the next one.  */
+static void
+stream_poll (struct hash_pipe *pipe, struct hash_stream *s, int block)
+{
+  if (s->running)
+    {
+      if (!block && !s->job.done)
+	return;
+      grub_job_wait (&s->job);
+      s->running->next = pipe->free_chunks;
+      pipe->free_chunks = s->running;
+      s->running = NULL;
+    }
+
+  if (s->queue)
+    {
+      s->running = s->queue;
+      s->queue = s->queue->next;
+      if (!s->queue)
+	s->queue_tail = &s->queue;
+      grub_job_submit (&s->job);
+    }
+}
+
+/* Hash everything queued for S.  */
+static void
+stream_drain (struct hash_pipe *pipe, struct hash_stream *s)
+{
+  while (s->running)
+    stream_poll (pipe, s, 1);
+}
+
+static struct hash_chunk *
+get_chunk (struct hash_pipe *pipe)
+{
+  struct hash_chunk *c;
+  unsigned i;
+
+  for (i = 0; i < pipe->nstreams; i++)
+    stream_poll (pipe, &pipe->streams[i], 0);
+
+  /* Every chunk is queued or being hashed, wait for the oldest file.  */
+  for (i = 0; !pipe->free_chunks && i < pipe->nstreams; i++)
+    {
+      struct hash_stream *s = &pipe->streams[(pipe->next + i)
+					      % pipe->nstreams];
+      if (s->running)
+	stream_poll (pipe, s, 1);
+    }
+
+  c = pipe->free_chunks;
+  pipe->free_chunks = c->next;
+  return c;
+}
+
+/* Finish the file in S and report it.  */
+static grub_err_t
+stream_report (struct hash_pipe *pipe, struct hash_stream *s)
+{
+  const grub_uint8_t *result;
+  unsigned j;
+
+  if (!s->name)
+    return GRUB_ERR_NONE;
+
+  stream_drain (pipe, s);
+  pipe->hash->final (s->context);
+  result = pipe->hash->read (s->context);
+
+  if (!pipe->check)
+    {
+      for (j = 0; j < pipe->hash->mdlen; j++)
+	grub_printf ("%02x", result[j]);
+      grub_printf ("  %s\n", s->name);
+    }
+  else if (grub_crypto_memcmp (s->expected, result, pipe->hash->mdlen) != 0)
+    {
+      grub_printf_ (N_("%s: HASH MISMATCH\n"), s->name);
+      if (!pipe->keep)
+	return grub_error (GRUB_ERR_TEST_FAILURE,
+			   "hash of '%s' mismatches", s->name);
+      pipe->mismatch++;
+    }
+  else
+    grub_printf_ (N_("%s: OK\n"), s->name);
+
+  grub_free (s->name);
+  s->name = NULL;
+  return GRUB_ERR_NONE;
+}
+
+/* Report every file still in flight, oldest first.  */
+static grub_err_t
+pipe_flush (struct hash_pipe *pipe)
+{
+  grub_err_t err;
+  unsigned i;
+
+  for (i = 0; i < pipe->nstreams; i++)
+    {
+      err = stream_report (pipe, &pipe->streams[(pipe->next + i)
+						% pipe->nstreams]);
+      if (err)
+	return err;
+    }
+  return GRUB_ERR_NONE;
+}
+
+/* NAME couldn't be opened or read, which grub_errno tells about.  Report
+   the files before it first.  In a hash list an unopenable file is fatal
+   (OPENED is 0).  */
+static grub_err_t
+file_failed (struct hash_pipe *pipe, const char *name, int opened)
+{
+  char msg[GRUB_MAX_ERRMSG];
+  grub_err_t err = grub_errno, flush_err;
+
+  grub_memcpy (msg, grub_errmsg, sizeof (msg));
+  grub_errno = GRUB_ERR_NONE;
+  flush_err = pipe_flush (pipe);
+  if (flush_err)
+    return flush_err;
+  grub_error (err, "%s", msg);
+
+  if (pipe->check && !opened)
+    return err;
+  if (pipe->check)
+    grub_printf_ (N_("%s: READ ERROR\n"), name);
+  if (!pipe->keep)
+    return err;
+  grub_print_error ();
+  grub_errno = GRUB_ERR_NONE;
+  pipe->unread++;
+  return GRUB_ERR_NONE;
+}
+
+/* Read FILENAME and queue its chunks, reporting the oldest file in flight
+   if its slot is needed.  */
+static grub_err_t
+pipe_add (struct hash_pipe *pipe, const char *filename, const char *name,
+	  int uncompress, const grub_uint8_t *expected)
+{
+  struct hash_stream *s = &pipe->streams[pipe->next];
+  struct hash_chunk *c;
+  grub_file_t file;
+  grub_ssize_t r;
+  grub_err_t err;
+
+  err = stream_report (pipe, s);
+  if (err)
+    return err;
+
+  if (!uncompress)
+    grub_file_filter_disable_compression ();
+  file = grub_file_open (filename);
+  if (!file)
+    return file_failed (pipe, name, 0);
+
+  s->name = grub_strdup (name);
+  if (!s->name)
+    {
+      grub_file_close (file);
+      return grub_errno;
+    }
+  if (expected)
+    grub_memcpy (s->expected, expected, pipe->hash->mdlen);
+  pipe->hash->init (s->context);
+  pipe->next = (pipe->next + 1) % pipe->nstreams;
 
-  hash->init (context);
   while (1)
     {
-      grub_ssize_t r;
-      r = grub_file_read (file, readbuf, BUF_SIZE);
-      if (r < 0)
-	goto fail;
-      if (r == 0)
-	break;
-      hash->write (context, readbuf, r);
+      c = get_chunk (pipe);
+      r = grub_file_read (file, c->data, HASH_CHUNK_SIZE);
+      if (r <= 0)
+	{
+	  c->next = pipe->free_chunks;
+	  pipe->free_chunks = c;
+	  break;
+	}
+      c->len = r;
+      c->next = NULL;
+      *s->queue_tail = c;
+      s->queue_tail = &c->next;
+      if (!s->running)
+	stream_poll (pipe, s, 0);
+    }
+  grub_file_close (file);
+
+  if (r < 0)
+    {
+      /* Forget the file, but let the work already handed out finish.  */
+      stream_drain (pipe, s);
+      grub_free (s->name);
+      s->name = NULL;
+      return file_failed (pipe, name, 1);
     }
-  hash->final (context);
-  grub_memcpy (result, hash->read (context), hash->mdlen);
+  return GRUB_ERR_NONE;
+}
+
+static void
+pipe_free (struct hash_pipe *pipe)
+{
+  unsigned i;
+
+  if (pipe->streams)
+    for (i = 0; i < pipe->nstreams; i++)
+      {
+	stream_drain (pipe, &pipe->streams[i]);
+	grub_free (pipe->streams[i].context);
+	grub_free (pipe->streams[i].name);
+      }
+  if (pipe->chunks)
+    for (i = 0; i < pipe->nchunks; i++)
+      grub_free (pipe->chunks[i].data);
+  grub_free (pipe->chunks);
+  grub_free (pipe->streams);
+}
+
+static grub_err_t
+pipe_init (struct hash_pipe *pipe, const gcry_md_spec_t *hash, int check,
+	   int keep)
+{
+  unsigned i;
+
+  grub_memset (pipe, 0, sizeof (*pipe));
+  pipe->hash = hash;
+  pipe->check = check;
+  pipe->keep = keep;
+
+  /* One file per processor, and two chunks each so that one can be read
+     while the other is hashed.  */
+  pipe->nstreams = grub_job_workers () + 1;
+  if (pipe->nstreams > HASH_MAX_STREAMS)
+    pipe->nstreams = HASH_MAX_STREAMS;
+  pipe->nchunks = 2 * pipe->nstreams;
 
-  grub_free (readbuf);
-  grub_free (context);
+  pipe->streams = grub_zalloc (pipe->nstreams * sizeof (pipe->streams[0]));
+  pipe->chunks = grub_zalloc (pipe->nchunks * sizeof (pipe->chunks[0]));
+  if (!pipe->streams || !pipe->chunks)
+    goto fail;
+
+  for (i = 0; i < pipe->nstreams; i++)
+    {
+      struct hash_stream *s = &pipe->streams[i];
 
+      s->job.run = run_hash_chunk;
+      s->hash = hash;
+      s->queue_tail = &s->queue;
+      s->context = grub_zalloc (hash->contextsize);
+      if (!s->context)
+	goto fail;
+    }
+
+  for (i = 0; i < pipe->nchunks; i++)
+    {
+#if defined (GRUB_MACHINE_EMU) || defined (GRUB_UTIL)
+      pipe->chunks[i].data = grub_malloc (HASH_CHUNK_SIZE);
+#else
+      pipe->chunks[i].data = grub_memalign (4096, HASH_CHUNK_SIZE);
+#endif
+      if (!pipe->chunks[i].data)
+	goto fail;
+      pipe->chunks[i].next = pipe->free_chunks;
+      pipe->free_chunks = &pipe->chunks[i];
+    }
   return GRUB_ERR_NONE;
 
  fail:
-  grub_free (readbuf);
-  grub_free (context);
+  pipe_free (pipe);
   return grub_errno;
 }
 
@@ -102,13 +394,12 @@ static grub_err_t
 check_list (const gcry_md_spec_t *hash, const char *hashfilename,
 	    const char *prefix, int keep, int uncompress)
 {
-  grub_file_t hashlist, file;
+  grub_file_t hashlist;
+  struct hash_pipe pipe;
   char *buf = NULL;
   grub_uint8_t expected[GRUB_CRYPTO_MAX_MDLEN];
-  grub_uint8_t actual[GRUB_CRYPTO_MAX_MDLEN];
   grub_err_t err;
   unsigned i;
-  unsigned unread = 0, mismatch = 0;
 
   if (hash->mdlen > GRUB_CRYPTO_MAX_MDLEN)
     return grub_error (GRUB_ERR_BUG, "mdlen is too long");
@@ -116,10 +407,19 @@ check_list (const gcry_md_spec_t *hash, const char *hashfilename,
   hashlist = grub_file_open (hashfilename);
   if (!hashlist)
     return grub_errno;
-  
+
+  err = pipe_init (&pipe, hash, 1, keep);
+  if (err)
+    {
+      grub_file_close (hashlist);
+      return err;
+    }
+
   while (grub_free (buf), (buf = grub_file_getline (hashlist)))
     {
       const char *p = buf;
+      char *filename = NULL;
+
       while (grub_isspace (p[0]))
 	p++;
       for (i = 0; i < hash->mdlen; i++)
@@ -128,72 +428,44 @@ check_list (const gcry_md_spec_t *hash, const char *hashfilename,
 	  high = hextoval (*p++);
 	  low = hextoval (*p++);
 	  if (high < 0 || low < 0)
-	    return grub_error (GRUB_ERR_BAD_FILE_TYPE, "invalid hash list");
+	    {
+	      err = grub_error (GRUB_ERR_BAD_FILE_TYPE, "invalid hash list");
+	      goto out;
+	    }
 	  expected[i] = (high << 4) | low;
 	}
       if ((p[0] != ' ' && p[0] != '\t') || (p[1] != ' ' && p[1] != '\t'))
-	return grub_error (GRUB_ERR_BAD_FILE_TYPE, "invalid hash list");
+	{
+	  err = grub_error (GRUB_ERR_BAD_FILE_TYPE, "invalid hash list");
+	  goto out;
+	}
       p += 2;
       if (prefix)
 	{
-	  char *filename;
-	  
 	  filename = grub_xasprintf ("%s/%s", prefix, p);
 	  if (!filename)
-	    return grub_errno;
-	  if (!uncompress)
-	    grub_file_filter_disable_compression ();
-	  file = grub_file_open (filename);
-	  grub_free (filename);
-	}
-      else
-	{
-	  if (!uncompress)
-	    grub_file_filter_disable_compression ();
-	  file = grub_file_open (p);
-	}
-      if (!file)
-	{
-	  grub_file_close (hashlist);
-	  grub_free (buf);
-	  return grub_errno;
-	}
-      err = hash_file (file, hash, actual);
-      grub_file_close (file);
-      if (err)
-	{
-	  grub_printf_ (N_("%s: READ ERROR\n"), p);
-	  if (!keep)
-	    {
-	      grub_file_close (hashlist);
-	      grub_free (buf);
-	      return err;
-	    }
-	  grub_print_error ();
-	  grub_errno = GRUB_ERR_NONE;
-	  unread++;
-	  continue;
-	}
-      if (grub_crypto_memcmp (expected, actual, hash->mdlen) != 0)
-	{
-	  grub_printf_ (N_("%s: HASH MISMATCH\n"), p);
-	  if (!keep)
 	    {
-	      grub_file_close (hashlist);
-	      grub_free (buf);
-	      return grub_error (GRUB_ERR_TEST_FAILURE,
-				 "hash of '%s' mismatches", p);
+	      err = grub_errno;
+	      goto out;
 	    }
-	  mismatch++;
-	  continue;	  
 	}
-      grub_printf_ (N_("%s: OK\n"), p);
+      err = pipe_add (&pipe, filename ? : p, p, uncompress, expected);
+      grub_free (filename);
+      if (err)
+	goto out;
     }
-  if (mismatch || unread)
-    return grub_error (GRUB_ERR_TEST_FAILURE,
-		       "%d files couldn't be read and hash "
-		       "of %d files mismatches", unread, mismatch);
-  return GRUB_ERR_NONE;
+
+  err = pipe_flush (&pipe);
+  if (!err && (pipe.mismatch || pipe.unread))
+    err = grub_error (GRUB_ERR_TEST_FAILURE,
+		      "%d files couldn't be read and hash "
+		      "of %d files mismatches", pipe.unread, pipe.mismatch);
+
+ out:
+  pipe_free (&pipe);
+  grub_free (buf);
+  grub_file_close (hashlist);
+  return err;
 }
 
 static grub_err_t
@@ -207,7 +479,8 @@ grub_cmd_hashsum (struct grub_extcmd_context *ctxt,
   unsigned i;
   int keep = state[3].set;
   int uncompress = state[4].set;
-  unsigned unread = 0;
+  struct hash_pipe pipe;
+  grub_err_t err;
 
   for (i = 0; i < ARRAY_SIZE (aliases); i++)
     if (grub_strcmp (ctxt->extcmd->cmd->name, aliases[i].name) == 0)
@@ -218,6 +491,10 @@ grub_cmd_hashsum (struct grub_extcmd_context *ctxt,
   if (!hashname)
     return grub_error (GRUB_ERR_BAD_ARGUMENT, "no hash specified");
 
+  /* Load every provider of the hash, the lookup would stop at the first
+     one and miss an accelerated implementation.  */
+  if (grub_crypto_autoload_hook)
+    grub_crypto_autoload_hook (hashname);
   hash = grub_crypto_lookup_md_by_name (hashname);
   if (!hash)
     return grub_error (GRUB_ERR_BAD_ARGUMENT, "unknown hash");
@@ -236,44 +513,20 @@ grub_cmd_hashsum (struct grub_extcmd_context *ctxt,
       return check_list (hash, state[1].arg, prefix, keep, uncompress);
     }
 
-  for (i = 0; i < (unsigned) argc; i++)
-    {
-      GRUB_PROPERLY_ALIGNED_ARRAY (result, GRUB_CRYPTO_MAX_MDLEN);
-      grub_file_t file;
-      grub_err_t err;
-      unsigned j;
-      if (!uncompress)
-	grub_file_filter_disable_compression ();
-      file = grub_file_open (args[i]);
-      if (!file)
-	{
-	  if (!keep)
-	    return grub_errno;
-	  grub_print_error ();
-	  grub_errno = GRUB_ERR_NONE;
-	  unread++;
-	  continue;
-	}
-      err = hash_file (file, hash, result);
-      grub_file_close (file);
-      if (err)
-	{
-	  if (!keep)
-	    return err;
-	  grub_print_error ();
-	  grub_errno = GRUB_ERR_NONE;
-	  unread++;
-	  continue;
-	}
-      for (j = 0; j < hash->mdlen; j++)
-	grub_printf ("%02x", ((grub_uint8_t *) result)[j]);
-      grub_printf ("  %s\n", args[i]);
-    }
+  err = pipe_init (&pipe, hash, 0, keep);
+  if (err)
+    return err;
 
-  if (unread)
-    return grub_error (GRUB_ERR_TEST_FAILURE, "%d files couldn't be read",
-		       unread);
-  return GRUB_ERR_NONE;
+  for (i = 0; i < (unsigned) argc && !err; i++)
+    err = pipe_add (&pipe, args[i], args[i], uncompress, NULL);
+  if (!err)
+    err = pipe_flush (&pipe);
+  if (!err && pipe.unread)
+    err = grub_error (GRUB_ERR_TEST_FAILURE, "%d files couldn't be read",
+		      pipe.unread);
+
+  pipe_free (&pipe);
+  return err;
 }
 
 static grub_extcmd_t cmd, cmd_md5, cmd_sha1, cmd_sha256, cmd_sha512, cmd_crc;
@@ -0,0 +1,105 @@
+/* iostat.c - per disk device I/O statistics  */
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2026  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <grub/dl.h>
+#include <grub/misc.h>
+#include <grub/extcmd.h>
+#include <grub/i18n.h>
+#include <grub/disk.h>
+
+GRUB_MOD_LICENSE ("GPLv3+");
+
+static const struct grub_arg_option options[] =
+  {
+    {"all", 'a', 0, N_("Include devices which have not been used."), 0, 0},
+    {"reset", 'r', 0, N_("Reset the counters after printing them."), 0, 0},
+    {0, 0, 0, 0, 0, 0}
+  };
+
+enum
+  {
+    IOSTAT_ALL,
+    IOSTAT_RESET
+  };
+
+static void
+print_stats (const char *name, const struct grub_disk_dev_stats *stats)
+{
+  unsigned long lookups = stats->cache_hits + stats->cache_misses;
+
+  grub_printf ("%s:\n", name);
+  grub_printf_ (N_("  reads: %lu (%llu KiB), %lu agglomerated,"
+		   " largest %llu KiB\n"),
+		stats->reads, (unsigned long long) (stats->read_bytes >> 10),
+		stats->agglomerated_reads,
+		(unsigned long long) (stats->largest_read >> 10));
+  if (stats->reads)
+    grub_printf_ (N_("  read time: %llu ms, min/avg/max %llu/%llu/%llu ms\n"),
+		  (unsigned long long) stats->read_time,
+		  (unsigned long long) stats->min_read_time,
+		  (unsigned long long) grub_divmod64 (stats->read_time,
+						      stats->reads, 0),
+		  (unsigned long long) stats->max_read_time);
+  if (lookups)
+    {
+      unsigned long ratio = stats->cache_hits * 10000 / lookups;
+      grub_printf_ (N_("  cache: hits = %lu (%lu.%02lu%%), misses = %lu\n"),
+		    stats->cache_hits, ratio / 100, ratio % 100,
+		    stats->cache_misses);
+    }
+  if (stats->writes)
+    grub_printf_ (N_("  writes: %lu (%llu KiB)\n"), stats->writes,
+		  (unsigned long long) (stats->write_bytes >> 10));
+}
+
+static grub_err_t
+grub_cmd_iostat (grub_extcmd_context_t ctxt,
+		 int argc __attribute__ ((unused)),
+		 char **args __attribute__ ((unused)))
+{
+  struct grub_arg_list *state = ctxt->state;
+  grub_disk_dev_t dev;
+
+  for (dev = grub_disk_dev_list; dev; dev = dev->next)
+    {
+      if (state[IOSTAT_ALL].set
+	  || dev->stats.reads || dev->stats.writes
+	  || dev->stats.cache_hits || dev->stats.cache_misses)
+	print_stats (dev->name, &dev->stats);
+      if (state[IOSTAT_RESET].set)
+	grub_memset (&dev->stats, 0, sizeof (dev->stats));
+    }
+
+  return GRUB_ERR_NONE;
+}
+
+static grub_extcmd_t cmd;
+
+GRUB_MOD_INIT(iostat)
+{
+  cmd = grub_register_extcmd ("iostat", grub_cmd_iostat, 0,
+			      N_("[-a] [-r]"),
+			      N_("Show I/O statistics for each disk driver."),
+			      options);
+}
+
+GRUB_MOD_FINI(iostat)
+{
+  grub_unregister_extcmd (cmd);
+}
@@ -23,6 +23,8 @@
 #include <grub/err.h>
 #include <grub/dl.h>
 #include <grub/file.h>
+#include <grub/fs.h>
+#include <grub/env.h>
 #include <grub/normal.h>
 #include <grub/script_sh.h>
 #include <grub/i18n.h>
@@ -44,156 +46,370 @@ legacy_file_getline (char **line, int cont __attribute__ ((unused)),
   return GRUB_ERR_NONE;
 }
 
-static grub_err_t
-legacy_file (const char *filename)
+/* A legacy config translated into GRUB script: the commands outside of
+   entries and the entries in file order, then the suffix the translator
+   collected.  Translations are kept for the files they came from, so a
+   menu.lst that is sourced again is not translated again as long as its
+   size and modification time stay the same.  Entry bodies are parsed only
+   when the entry is run, like those of menuentry.  */
+struct legacy_item
 {
-  grub_file_t file;
-  char *entryname = NULL, *entrysrc = NULL;
-  grub_menu_t menu;
-  char *suffix = grub_strdup ("");
+  struct legacy_item *next;
+  /* Entry title, or NULL for commands run when the file is sourced.  */
+  char *entryname;
+  char *script;
+  /* Entries other than the last one are restricted to user "legacy".  */
+  int restricted;
+};
 
-  if (!suffix)
-    return grub_errno;
+struct legacy_translation
+{
+  struct legacy_translation *next;
+  char *name;
+  grub_off_t size;
+  grub_int64_t mtime;
+  struct legacy_item *items;
+  char *suffix;
+  /* Set while in legacy_cache.  */
+  int cached;
+  /* Number of legacy_file calls running its commands.  */
+  int refs;
+};
 
-  file = grub_file_open (filename);
-  if (! file)
+#define LEGACY_CACHE_MAX 4
+
+static struct legacy_translation *legacy_cache;
+
+static void
+legacy_translation_free (struct legacy_translation *tr)
+{
+  struct legacy_item *item, *next;
+
+  for (item = tr->items; item; item = next)
     {
-      grub_free (suffix);
-      return grub_errno;
+      next = item->next;
+      grub_free (item->entryname);
+      grub_free (item->script);
+      grub_free (item);
     }
+  grub_free (tr->name);
+  grub_free (tr->suffix);
+  grub_free (tr);
+}
 
-  menu = grub_env_get_menu ();
-  if (! menu)
+/* Drop TR from the cache.  Sourcing it may still be in progress, in which
+   case the last legacy_file using it frees it.  */
+static void
+legacy_translation_drop (struct legacy_translation *tr)
+{
+  tr->cached = 0;
+  if (!tr->refs)
+    legacy_translation_free (tr);
+}
+
+/* Context for legacy_file_mtime.  */
+struct legacy_mtime_ctx
+{
+  const char *basename;
+  grub_int64_t mtime;
+  int found;
+};
+
+/* Helper for legacy_file_mtime.  */
+static int
+legacy_file_mtime_iter (const char *filename,
+			const struct grub_dirhook_info *info, void *data)
+{
+  struct legacy_mtime_ctx *ctx = data;
+
+  if ((info->case_insensitive ? grub_strcasecmp (filename, ctx->basename)
+       : grub_strcmp (filename, ctx->basename)) != 0)
+    return 0;
+  if (info->mtimeset)
     {
-      menu = grub_zalloc (sizeof (*menu));
-      if (! menu)
-	{
-	  grub_free (suffix);
-	  return grub_errno;
-	}
+      ctx->mtime = info->mtime;
+      ctx->found = 1;
+    }
+  return 1;
+}
 
-      grub_env_set_menu (menu);
+/* Look up the modification time of FILE, opened as FILENAME.  Returns 1
+   if the file system provides one.  */
+static int
+legacy_file_mtime (grub_file_t file, const char *filename,
+		   grub_int64_t *mtime)
+{
+  struct legacy_mtime_ctx ctx = { .found = 0 };
+  const char *path;
+  char *dir;
+
+  if (!file->device || !file->device->disk || !file->fs || !file->fs->dir)
+    return 0;
+
+  path = grub_strchr (filename, ')');
+  path = path ? path + 1 : filename;
+  ctx.basename = grub_strrchr (path, '/');
+  if (!ctx.basename)
+    return 0;
+  ctx.basename++;
+
+  dir = grub_strndup (path, ctx.basename - path);
+  if (!dir)
+    {
+      grub_errno = GRUB_ERR_NONE;
+      return 0;
+    }
+  file->fs->dir (file->device, dir, legacy_file_mtime_iter, &ctx);
+  grub_free (dir);
+  grub_errno = GRUB_ERR_NONE;
+
+  *mtime = ctx.mtime;
+  return ctx.found;
+}
+
+static grub_err_t
+legacy_add_item (struct legacy_item ***tail, char *entryname, char *script,
+		 int restricted)
+{
+  struct legacy_item *item;
+
+  item = grub_zalloc (sizeof (*item));
+  if (!item)
+    {
+      grub_free (entryname);
+      grub_free (script);
+      return grub_errno;
     }
+  item->entryname = entryname;
+  item->script = script;
+  item->restricted = restricted;
+  **tail = item;
+  *tail = &item->next;
+  return GRUB_ERR_NONE;
+}
+
+/* Translate the legacy config in FILE into *TR.  */
+static grub_err_t
+legacy_translate (grub_file_t file, struct legacy_translation *tr)
+{
+  char *entryname = NULL, *entrysrc = NULL;
+  struct legacy_item **tail = &tr->items;
+
+  tr->suffix = grub_strdup ("");
+  if (!tr->suffix)
+    return grub_errno;
 
   while (1)
     {
       char *buf = grub_file_getline (file);
       char *parsed = NULL;
+      char *oldname;
+      char *newsuffix;
+      char *ptr;
 
       if (!buf && grub_errno)
-	{
-	  grub_file_close (file);
-	  grub_free (suffix);
-	  return grub_errno;
-	}
+	goto fail;
 
       if (!buf)
 	break;
 
-      {
-	char *oldname = NULL;
-	char *newsuffix;
-	char *ptr;
+      for (ptr = buf; *ptr && grub_isspace (*ptr); ptr++);
 
-	for (ptr = buf; *ptr && grub_isspace (*ptr); ptr++);
+      oldname = entryname;
+      parsed = grub_legacy_parse (ptr, &entryname, &newsuffix);
+      grub_free (buf);
+      if (newsuffix)
+	{
+	  char *t;
 
-	oldname = entryname;
-	parsed = grub_legacy_parse (ptr, &entryname, &newsuffix);
-	grub_free (buf);
-	buf = NULL;
-	if (newsuffix)
-	  {
-	    char *t;
-	    
-	    t = suffix;
-	    suffix = grub_realloc (suffix, grub_strlen (suffix)
-				   + grub_strlen (newsuffix) + 1);
-	    if (!suffix)
-	      {
-		grub_free (t);
-		grub_free (entrysrc);
-		grub_free (parsed);
-		grub_free (newsuffix);
-		grub_free (suffix);
-		return grub_errno;
-	      }
-	    grub_memcpy (suffix + grub_strlen (suffix), newsuffix,
-			 grub_strlen (newsuffix) + 1);
-	    grub_free (newsuffix);
-	    newsuffix = NULL;
-	  }
-	if (oldname != entryname && oldname)
-	  {
-	    const char **args = grub_malloc (sizeof (args[0]));
-	    if (!args)
-	      {
-		grub_file_close (file);
-		return grub_errno;
-	      }
-	    args[0] = oldname;
-	    grub_normal_add_menu_entry (1, args, NULL, NULL, "legacy",
-					NULL, NULL,
-					entrysrc, 0);
-	    grub_free (args);
-	    entrysrc[0] = 0;
-	    grub_free (oldname);
-	  }
-      }
+	  t = grub_realloc (tr->suffix, grub_strlen (tr->suffix)
+			    + grub_strlen (newsuffix) + 1);
+	  if (!t)
+	    {
+	      grub_free (parsed);
+	      grub_free (newsuffix);
+	      goto fail;
+	    }
+	  tr->suffix = t;
+	  grub_memcpy (tr->suffix + grub_strlen (tr->suffix), newsuffix,
+		       grub_strlen (newsuffix) + 1);
+	  grub_free (newsuffix);
+	}
+      if (oldname != entryname && oldname)
+	{
+	  if (legacy_add_item (&tail, oldname, entrysrc ? : grub_strdup (""),
+			       1))
+	    {
+	      entrysrc = NULL;
+	      grub_free (parsed);
+	      goto fail;
+	    }
+	  entrysrc = NULL;
+	}
 
       if (parsed && !entryname)
 	{
-	  grub_normal_parse_line (parsed, legacy_file_getline, NULL);
-	  grub_print_error ();
-	  grub_free (parsed);
-	  parsed = NULL;
+	  if (legacy_add_item (&tail, NULL, parsed, 0))
+	    goto fail;
 	}
+      else if (parsed && !entrysrc)
+	entrysrc = parsed;
       else if (parsed)
 	{
-	  if (!entrysrc)
-	    entrysrc = parsed;
-	  else
-	    {
-	      char *t;
+	  char *t;
 
-	      t = entrysrc;
-	      entrysrc = grub_realloc (entrysrc, grub_strlen (entrysrc)
-				       + grub_strlen (parsed) + 1);
-	      if (!entrysrc)
-		{
-		  grub_free (t);
-		  grub_free (parsed);
-		  grub_free (suffix);
-		  return grub_errno;
-		}
-	      grub_memcpy (entrysrc + grub_strlen (entrysrc), parsed,
-			   grub_strlen (parsed) + 1);
+	  t = grub_realloc (entrysrc, grub_strlen (entrysrc)
+			    + grub_strlen (parsed) + 1);
+	  if (!t)
+	    {
 	      grub_free (parsed);
-	      parsed = NULL;
+	      goto fail;
 	    }
+	  entrysrc = t;
+	  grub_memcpy (entrysrc + grub_strlen (entrysrc), parsed,
+		       grub_strlen (parsed) + 1);
+	  grub_free (parsed);
 	}
     }
-  grub_file_close (file);
 
   if (entryname)
+    return legacy_add_item (&tail, entryname, entrysrc ? : grub_strdup (""),
+			    0);
+  grub_free (entrysrc);
+  return GRUB_ERR_NONE;
+
+ fail:
+  grub_free (entryname);
+  grub_free (entrysrc);
+  return grub_errno;
+}
+
+/* Find the translation of FILENAME, opened as FILE, in the cache or
+   translate it and add it there.  */
+static struct legacy_translation *
+legacy_get_translation (grub_file_t file, const char *filename)
+{
+  struct legacy_translation *tr, **prev;
+  grub_int64_t mtime = 0;
+  int have_mtime;
+  char *name;
+  unsigned n;
+
+  if (filename[0] == '(')
+    name = grub_strdup (filename);
+  else
+    name = grub_xasprintf ("(%s)%s", grub_env_get ("root") ? : "", filename);
+  if (!name)
+    return NULL;
+
+  have_mtime = legacy_file_mtime (file, filename, &mtime);
+
+  for (prev = &legacy_cache; *prev; prev = &(*prev)->next)
+    if (grub_strcmp ((*prev)->name, name) == 0)
+      {
+	tr = *prev;
+	*prev = tr->next;
+	if (have_mtime && tr->size == grub_file_size (file)
+	    && tr->mtime == mtime)
+	  {
+	    /* Most recently used first.  */
+	    tr->next = legacy_cache;
+	    legacy_cache = tr;
+	    grub_free (name);
+	    return tr;
+	  }
+	legacy_translation_drop (tr);
+	break;
+      }
+
+  tr = grub_zalloc (sizeof (*tr));
+  if (!tr)
+    {
+      grub_free (name);
+      return NULL;
+    }
+  tr->name = name;
+  tr->size = grub_file_size (file);
+  tr->mtime = mtime;
+  if (legacy_translate (file, tr))
+    {
+      legacy_translation_free (tr);
+      return NULL;
+    }
+
+  /* Without a modification time a change of the file can't be told, so
+     the translation is used this once only.  */
+  if (!have_mtime)
+    return tr;
+
+  tr->cached = 1;
+  tr->next = legacy_cache;
+  legacy_cache = tr;
+  for (prev = &legacy_cache, n = 0; *prev; prev = &(*prev)->next, n++)
+    if (n == LEGACY_CACHE_MAX)
+      {
+	legacy_translation_drop (*prev);
+	*prev = NULL;
+	break;
+      }
+  return tr;
+}
+
+static grub_err_t
+legacy_file (const char *filename)
+{
+  grub_file_t file;
+  grub_menu_t menu;
+  struct legacy_translation *tr;
+  struct legacy_item *item;
+
+  file = grub_file_open (filename);
+  if (! file)
+    return grub_errno;
+
+  tr = legacy_get_translation (file, filename);
+  grub_file_close (file);
+  if (!tr)
+    return grub_errno;
+
+  menu = grub_env_get_menu ();
+  if (! menu)
     {
-      const char **args = grub_malloc (sizeof (args[0]));
-      if (!args)
+      menu = grub_zalloc (sizeof (*menu));
+      if (! menu)
 	{
-	  grub_file_close (file);
-	  grub_free (suffix);
-	  grub_free (entrysrc);
+	  if (!tr->cached)
+	    legacy_translation_free (tr);
 	  return grub_errno;
 	}
-      args[0] = entryname;
-      grub_normal_add_menu_entry (1, args, NULL, NULL, NULL,
-				  NULL, NULL, entrysrc, 0);
-      grub_free (args);
+
+      grub_env_set_menu (menu);
     }
 
-  grub_normal_parse_line (suffix, legacy_file_getline, NULL);
+  /* The commands may source legacy configs themselves.  */
+  tr->refs++;
+  for (item = tr->items; item; item = item->next)
+    {
+      const char *args[1];
+
+      if (!item->entryname)
+	{
+	  grub_normal_parse_line (item->script, legacy_file_getline, NULL);
+	  grub_print_error ();
+	  continue;
+	}
+
+      args[0] = item->entryname;
+      grub_normal_add_menu_entry (1, args, NULL, NULL,
+				  item->restricted ? "legacy" : NULL,
+				  NULL, NULL, item->script, 0);
+    }
+
+  grub_normal_parse_line (tr->suffix, legacy_file_getline, NULL);
   grub_print_error ();
-  grub_free (suffix);
-  grub_free (entrysrc);
+
+  if (!--tr->refs && !tr->cached)
+    legacy_translation_free (tr);
 
   return GRUB_ERR_NONE;
 }
@@ -858,6 +1074,15 @@ GRUB_MOD_INIT(legacycfg)
 
 GRUB_MOD_FINI(legacycfg)
 {
+  struct legacy_translation *tr, *next;
+
+  for (tr = legacy_cache; tr; tr = next)
+    {
+      next = tr->next;
+      legacy_translation_free (tr);
+    }
+  legacy_cache = NULL;
+
   grub_unregister_command (cmd_source);
   grub_unregister_command (cmd_configfile);
   grub_unregister_command (cmd_source_extract);
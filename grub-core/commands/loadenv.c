@@ -319,9 +319,12 @@ check_blocklists (grub_envblk_t envblk, struct blocklist *blocklists,
   return GRUB_ERR_NONE;
 }
 
+/* Write ENVBLK back through BLOCKLISTS.  Only sectors that differ from
+   OLD, the contents of the file on disk, are written, so that updating a
+   counter of unchanged width costs a single sector.  */
 static int
 write_blocklists (grub_envblk_t envblk, struct blocklist *blocklists,
-                  grub_file_t file)
+                  grub_file_t file, const char *old)
 {
   char *buf;
   grub_disk_t disk;
@@ -336,14 +339,100 @@ write_blocklists (grub_envblk_t envblk, struct blocklist *blocklists,
   index = 0;
   for (p = blocklists; p; index += p->length, p = p->next)
     {
-      if (grub_disk_write (disk, p->sector - part_start,
-                           p->offset, p->length, buf + index))
-        return 0;
+      grub_disk_addr_t sector = p->sector - part_start;
+      unsigned offset = p->offset;
+      unsigned done = 0;
+
+      while (done < p->length)
+	{
+	  unsigned len;
+
+	  len = GRUB_DISK_SECTOR_SIZE - (offset & (GRUB_DISK_SECTOR_SIZE - 1));
+	  if (len > p->length - done)
+	    len = p->length - done;
+
+	  if (grub_memcmp (buf + index + done, old + index + done, len) != 0
+	      && grub_disk_write (disk, sector, offset, len,
+				  buf + index + done))
+	    return 0;
+
+	  done += len;
+	  offset += len;
+	}
     }
 
   return 1;
 }
 
+/* The layout of the last environment block written, so that the next
+   save_env to the same file can skip finding and re-verifying the
+   blocklists, and need not read the file back: nothing but save_env
+   writes to it while GRUB runs.  */
+static struct
+{
+  char *name;
+  unsigned long dev_id;
+  unsigned long disk_id;
+  grub_disk_addr_t part_start;
+  unsigned long generation;
+  struct blocklist *blocklists;
+  char *buf;
+  grub_size_t size;
+} envblk_cache;
+
+static void
+envblk_cache_flush (void)
+{
+  grub_free (envblk_cache.name);
+  free_blocklists (envblk_cache.blocklists);
+  grub_free (envblk_cache.buf);
+  grub_memset (&envblk_cache, 0, sizeof (envblk_cache));
+}
+
+static int
+envblk_cache_match (grub_file_t file)
+{
+  grub_disk_t disk = file->device->disk;
+
+  return (envblk_cache.name
+	  && envblk_cache.generation == grub_disk_generation
+	  && envblk_cache.dev_id == disk->dev->id
+	  && envblk_cache.disk_id == disk->id
+	  && envblk_cache.part_start == grub_partition_get_start (disk->partition)
+	  && envblk_cache.size == grub_file_size (file)
+	  && grub_strcmp (envblk_cache.name, file->name) == 0);
+}
+
+/* Remember BLOCKLISTS and BUF for FILE; takes over BLOCKLISTS.  */
+static void
+envblk_cache_store (grub_file_t file, struct blocklist *blocklists,
+		    const char *buf, grub_size_t size)
+{
+  grub_disk_t disk = file->device->disk;
+
+  if (envblk_cache.blocklists != blocklists)
+    {
+      envblk_cache_flush ();
+      envblk_cache.name = grub_strdup (file->name);
+      envblk_cache.buf = grub_malloc (size);
+      if (! envblk_cache.name || ! envblk_cache.buf)
+	{
+	  grub_errno = GRUB_ERR_NONE;
+	  free_blocklists (blocklists);
+	  envblk_cache_flush ();
+	  return;
+	}
+      envblk_cache.dev_id = disk->dev->id;
+      envblk_cache.disk_id = disk->id;
+      envblk_cache.part_start = grub_partition_get_start (disk->partition);
+      envblk_cache.generation = grub_disk_generation;
+      envblk_cache.blocklists = blocklists;
+      envblk_cache.size = size;
+    }
+
+  grub_memcpy (envblk_cache.buf, buf, size);
+}
+
 /* Context for grub_cmd_save_env.  */
 struct grub_cmd_save_env_ctx
 {
@@ -380,7 +469,9 @@ grub_cmd_save_env (grub_extcmd_context_t ctxt, int argc, char **args)
 {
   struct grub_arg_list *state = ctxt->state;
   grub_file_t file;
-  grub_envblk_t envblk;
+  grub_envblk_t envblk = 0;
+  struct blocklist *blocklists;
+  char *old = 0;
   struct grub_cmd_save_env_ctx ctx = {
     .head = 0,
     .tail = 0
@@ -400,15 +491,41 @@ grub_cmd_save_env (grub_extcmd_context_t ctxt, int argc, char **args)
       return grub_error (GRUB_ERR_BAD_DEVICE, "disk device required");
     }
 
-  file->read_hook = save_env_read_hook;
-  file->read_hook_data = &ctx;
-  envblk = read_envblk_file (file);
-  file->read_hook = 0;
-  if (! envblk)
-    goto fail;
+  if (envblk_cache_match (file))
+    {
+      char *buf;
 
-  if (check_blocklists (envblk, ctx.head, file))
+      blocklists = envblk_cache.blocklists;
+      buf = grub_malloc (envblk_cache.size);
+      if (! buf)
+	goto fail;
+      grub_memcpy (buf, envblk_cache.buf, envblk_cache.size);
+      envblk = grub_envblk_open (buf, envblk_cache.size);
+      if (! envblk)
+	{
+	  grub_free (buf);
+	  grub_error (GRUB_ERR_BAD_FILE_TYPE, "invalid environment block");
+	  goto fail;
+	}
+    }
+  else
+    {
+      file->read_hook = save_env_read_hook;
+      file->read_hook_data = &ctx;
+      envblk = read_envblk_file (file);
+      file->read_hook = 0;
+      if (! envblk)
+	goto fail;
+
+      if (check_blocklists (envblk, ctx.head, file))
+	goto fail;
+      blocklists = ctx.head;
+    }
+
+  old = grub_malloc (grub_envblk_size (envblk));
+  if (! old)
     goto fail;
+  grub_memcpy (old, grub_envblk_buffer (envblk), grub_envblk_size (envblk));
 
   while (argc)
     {
@@ -430,11 +547,23 @@ grub_cmd_save_env (grub_extcmd_context_t ctxt, int argc, char **args)
       args++;
     }
 
-  write_blocklists (envblk, ctx.head, file);
+  if (write_blocklists (envblk, blocklists, file, old))
+    {
+      envblk_cache_store (file, blocklists, grub_envblk_buffer (envblk),
+			  grub_envblk_size (envblk));
+      ctx.head = 0;
+    }
+  else
+    {
+      /* What is on disk is unknown now.  */
+      if (blocklists == envblk_cache.blocklists)
+	envblk_cache_flush ();
+    }
 
  fail:
   if (envblk)
     grub_envblk_close (envblk);
+  grub_free (old);
   free_blocklists (ctx.head);
   grub_file_close (file);
   return grub_errno;
@@ -465,4 +594,5 @@ GRUB_MOD_FINI(loadenv)
   grub_unregister_extcmd (cmd_load);
   grub_unregister_extcmd (cmd_list);
   grub_unregister_extcmd (cmd_save);
+  envblk_cache_flush ();
 }
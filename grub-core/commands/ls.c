@@ -32,6 +32,7 @@
 #include <grub/datetime.h>
 #include <grub/i18n.h>
 #include <grub/net.h>
+#include <grub/arena.h>
 
 GRUB_MOD_LICENSE ("GPLv3+");
 
@@ -89,6 +90,8 @@ struct grub_ls_list_files_ctx
   char *dirname;
   int all;
   int human;
+  /* Per-entry scratch space, reset after every entry.  */
+  grub_arena_t arena;
 };
 
 /* Helper for grub_ls_list_files.  */
@@ -114,18 +117,28 @@ print_files_long (const char *filename, const struct grub_dirhook_info *info,
   if ((! ctx->all) && (filename[0] == '.'))
     return 0;
 
-  if (! info->dir)
+  if (! info->dir && info->sizeset)
+    {
+      if (! ctx->human)
+	grub_printf ("%-12llu", (unsigned long long) info->size);
+      else
+	grub_printf ("%-12s", grub_get_human_size (info->size,
+						   GRUB_HUMAN_SIZE_SHORT));
+    }
+  else if (! info->dir)
     {
       grub_file_t file;
       char *pathname;
+      grub_size_t dirlen = grub_strlen (ctx->dirname);
+      grub_size_t len = dirlen + grub_strlen (filename) + 2;
 
-      if (ctx->dirname[grub_strlen (ctx->dirname) - 1] == '/')
-	pathname = grub_xasprintf ("%s%s", ctx->dirname, filename);
-      else
-	pathname = grub_xasprintf ("%s/%s", ctx->dirname, filename);
-
+      pathname = grub_arena_alloc (ctx->arena, len);
       if (!pathname)
 	return 1;
+      if (ctx->dirname[dirlen - 1] == '/')
+	grub_snprintf (pathname, len, "%s%s", ctx->dirname, filename);
+      else
+	grub_snprintf (pathname, len, "%s/%s", ctx->dirname, filename);
 
       /* XXX: For ext2fs symlinks are detected as files while they
 	 should be reported as directories.  */
@@ -134,7 +147,7 @@ print_files_long (const char *filename, const struct grub_dirhook_info *info,
       if (! file)
 	{
 	  grub_errno = 0;
-	  grub_free (pathname);
+	  grub_arena_reset (ctx->arena);
 	  return 0;
 	}
 
@@ -144,7 +157,7 @@ print_files_long (const char *filename, const struct grub_dirhook_info *info,
 	grub_printf ("%-12s", grub_get_human_size (file->size,
 						   GRUB_HUMAN_SIZE_SHORT));
       grub_file_close (file);
-      grub_free (pathname);
+      grub_arena_reset (ctx->arena);
     }
   else
     grub_printf ("%-12s", _("DIR"));
@@ -177,6 +190,7 @@ grub_ls_list_files (char *dirname, int longlist, int all, int human)
   grub_fs_t fs;
   const char *path;
   grub_device_t dev;
+  grub_arena_t arena = 0;
 
   device_name = grub_file_get_device_name (dirname);
   dev = grub_device_open (device_name);
@@ -212,7 +226,13 @@ grub_ls_list_files (char *dirname, int longlist, int all, int human)
       };
 
       if (longlist)
-	(fs->dir) (dev, path, print_files_long, &ctx);
+	{
+	  arena = grub_arena_create (0);
+	  if (! arena)
+	    goto fail;
+	  ctx.arena = arena;
+	  (fs->dir) (dev, path, print_files_long, &ctx);
+	}
       else
 	(fs->dir) (dev, path, print_files, &ctx);
 
@@ -254,6 +274,7 @@ grub_ls_list_files (char *dirname, int longlist, int all, int human)
     }
 
  fail:
+  grub_arena_destroy (arena);
   if (dev)
     grub_device_close (dev);
 
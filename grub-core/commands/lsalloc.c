@@ -0,0 +1,240 @@
+/* lsalloc.c - report heap usage per allocation site */
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2026  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <grub/dl.h>
+#include <grub/misc.h>
+#include <grub/mm.h>
+#include <grub/env.h>
+#include <grub/extcmd.h>
+#include <grub/i18n.h>
+
+GRUB_MOD_LICENSE ("GPLv3+");
+
+static const struct grub_arg_option options[] =
+  {
+    {"start", 0, 0, N_("Start or restart collecting."), 0, 0},
+    {"stop", 0, 0, N_("Stop collecting."), 0, 0},
+    {"top", 'n', 0, N_("Show the N sites with the highest peak (20 by default)."),
+     N_("N"), ARG_TYPE_INT},
+    {"set", 's', 0, N_("Store the per-module usage in variable VARNAME."),
+     N_("VARNAME"), ARG_TYPE_STRING},
+    {0, 0, 0, 0, 0, 0}
+  };
+
+enum options
+  {
+    LSALLOC_START,
+    LSALLOC_STOP,
+    LSALLOC_TOP,
+    LSALLOC_SET
+  };
+
+#ifndef GRUB_MACHINE_EMU
+/* Return the module holding ADDR, or NULL for the kernel, and the offset
+   of ADDR in the segment containing it.  */
+static grub_dl_t
+site_module (void *addr, grub_size_t *offset)
+{
+  grub_dl_t mod;
+  grub_dl_segment_t seg;
+
+  FOR_DL_MODULES (mod)
+    for (seg = mod->segment; seg; seg = seg->next)
+      if ((grub_addr_t) addr >= (grub_addr_t) seg->addr
+	  && (grub_addr_t) addr < (grub_addr_t) seg->addr + seg->size)
+	{
+	  *offset = (grub_addr_t) addr - (grub_addr_t) seg->addr;
+	  return mod;
+	}
+  *offset = (grub_addr_t) addr;
+  return NULL;
+}
+
+/* Add the live and total bytes of the sites inside MOD, or the kernel
+   for NULL.  */
+static void
+module_usage (const struct grub_mm_profile *profile, grub_dl_t mod,
+	      grub_size_t *live, grub_uint64_t *bytes)
+{
+  unsigned i;
+  grub_size_t offset;
+
+  *live = 0;
+  *bytes = 0;
+  for (i = 0; i < GRUB_MM_PROFILE_SITES; i++)
+    if (profile->sites[i].caller
+	&& site_module (profile->sites[i].caller, &offset) == mod)
+      {
+	*live += profile->sites[i].live;
+	*bytes += profile->sites[i].bytes;
+      }
+}
+
+/* Append "NAME:LIVE:BYTES" to the space separated list in *BUF.  */
+static grub_err_t
+append_usage (char **buf, grub_size_t *len, const char *name,
+	      grub_size_t live, grub_uint64_t bytes)
+{
+  char *entry, *n;
+  grub_size_t elen;
+
+  entry = grub_xasprintf ("%s%s:%" PRIuGRUB_SIZE ":%llu", *len ? " " : "",
+			  name, live, (unsigned long long) bytes);
+  if (!entry)
+    return grub_errno;
+  elen = grub_strlen (entry);
+  n = grub_realloc (*buf, *len + elen + 1);
+  if (!n)
+    {
+      grub_free (entry);
+      return grub_errno;
+    }
+  grub_memcpy (n + *len, entry, elen + 1);
+  grub_free (entry);
+  *buf = n;
+  *len += elen;
+  return GRUB_ERR_NONE;
+}
+
+static grub_err_t
+export_usage (const struct grub_mm_profile *profile, const char *var)
+{
+  grub_dl_t mod;
+  grub_size_t live, len = 0;
+  grub_uint64_t bytes;
+  char *buf = NULL;
+  grub_err_t err;
+
+  err = append_usage (&buf, &len, "total", profile->live, profile->peak);
+  module_usage (profile, NULL, &live, &bytes);
+  if (!err && bytes)
+    err = append_usage (&buf, &len, "kernel", live, bytes);
+  FOR_DL_MODULES (mod)
+    {
+      if (err)
+	break;
+      module_usage (profile, mod, &live, &bytes);
+      if (bytes)
+	err = append_usage (&buf, &len, mod->name, live, bytes);
+    }
+  if (!err)
+    err = grub_env_set (var, buf);
+  grub_free (buf);
+  return err;
+}
+
+static void
+print_sites (const struct grub_mm_profile *profile, unsigned top)
+{
+  /* Bit set of the sites already shown.  */
+  grub_uint8_t shown[GRUB_MM_PROFILE_SITES / 8];
+  unsigned i, n;
+
+  grub_memset (shown, 0, sizeof (shown));
+  grub_printf ("%-28s %10s %12s %10s %10s\n", _("site"), _("count"),
+	       _("bytes"), _("live"), _("peak"));
+
+  for (n = 0; n < top; n++)
+    {
+      const struct grub_mm_profile_site *best = NULL;
+      unsigned best_i = 0;
+      grub_size_t offset;
+      grub_dl_t mod;
+
+      for (i = 0; i < GRUB_MM_PROFILE_SITES; i++)
+	if (profile->sites[i].caller && !(shown[i / 8] & (1 << (i % 8)))
+	    && (!best || profile->sites[i].peak > best->peak))
+	  {
+	    best = &profile->sites[i];
+	    best_i = i;
+	  }
+      if (!best)
+	break;
+      shown[best_i / 8] |= 1 << (best_i % 8);
+
+      mod = site_module (best->caller, &offset);
+      if (mod)
+	grub_printf ("%16s+0x%-9" PRIxGRUB_SIZE, mod->name, offset);
+      else
+	grub_printf ("%16s 0x%-9" PRIxGRUB_SIZE, "kernel", offset);
+      grub_printf (" %10" PRIuGRUB_SIZE " %12llu %10" PRIuGRUB_SIZE
+		   " %10" PRIuGRUB_SIZE "\n",
+		   best->count, (unsigned long long) best->bytes,
+		   best->live, best->peak);
+    }
+}
+#endif
+
+static grub_err_t
+grub_cmd_lsalloc (grub_extcmd_context_t ctxt,
+		  int argc __attribute__ ((unused)),
+		  char **args __attribute__ ((unused)))
+{
+#ifndef GRUB_MACHINE_EMU
+  struct grub_arg_list *state = ctxt->state;
+  const struct grub_mm_profile *profile;
+  unsigned top = 20;
+
+  if (state[LSALLOC_START].set)
+    return grub_mm_profile_start ();
+  if (state[LSALLOC_STOP].set)
+    {
+      grub_mm_profile_stop ();
+      return GRUB_ERR_NONE;
+    }
+
+  profile = grub_mm_profile_get ();
+  if (!profile)
+    return grub_error (GRUB_ERR_BAD_ARGUMENT,
+		       N_("allocation profiling was never started"));
+
+  if (state[LSALLOC_SET].set)
+    return export_usage (profile, state[LSALLOC_SET].arg);
+
+  if (state[LSALLOC_TOP].set)
+    top = grub_strtoul (state[LSALLOC_TOP].arg, 0, 0);
+
+  grub_printf_ (N_("Profiling %s; live %" PRIuGRUB_SIZE " bytes, peak %"
+		   PRIuGRUB_SIZE " bytes, %" PRIuGRUB_SIZE
+		   " unattributed allocations\n"),
+		profile->active ? _("active") : _("stopped"),
+		profile->live, profile->peak, profile->dropped);
+  print_sites (profile, top);
+  return GRUB_ERR_NONE;
+#else
+  (void) ctxt;
+  return grub_error (GRUB_ERR_NOT_IMPLEMENTED_YET,
+		     N_("allocation profiling isn't supported on this platform"));
+#endif
+}
+
+static grub_extcmd_t cmd;
+
+GRUB_MOD_INIT(lsalloc)
+{
+  cmd = grub_register_extcmd ("lsalloc", grub_cmd_lsalloc, 0,
+			      N_("[--start|--stop] [-n N] [--set VARNAME]"),
+			      N_("Show heap usage per allocation site."),
+			      options);
+}
+
+GRUB_MOD_FINI(lsalloc)
+{
+  grub_unregister_extcmd (cmd);
+}
@@ -89,14 +89,12 @@ grub_normal_add_menu_entry (int argc, const char **args,
   struct grub_menu_entry_class *menu_classes = NULL;
 
   grub_menu_t menu;
-  grub_menu_entry_t *last;
+  grub_menu_entry_t entry;
 
   menu = grub_env_get_menu ();
   if (! menu)
     return grub_error (GRUB_ERR_MENU, "no menu context");
 
-  last = &menu->entry_list;
-
   menu_sourcecode = grub_xasprintf ("%s%s", prefix ?: "", sourcecode);
   if (! menu_sourcecode)
     return grub_errno;
@@ -169,27 +167,24 @@ grub_normal_add_menu_entry (int argc, const char **args,
     menu_args[argc] = NULL;
   }
 
-  /* Add the menu entry at the end of the list.  */
-  while (*last)
-    last = &(*last)->next;
-
-  *last = grub_zalloc (sizeof (**last));
-  if (! *last)
+  entry = grub_zalloc (sizeof (*entry));
+  if (! entry)
     goto fail;
 
-  (*last)->title = menu_title;
-  (*last)->id = menu_id;
-  (*last)->hotkey = menu_hotkey;
-  (*last)->classes = menu_classes;
+  entry->title = menu_title;
+  entry->id = menu_id;
+  entry->hotkey = menu_hotkey;
+  entry->classes = menu_classes;
   if (menu_users)
-    (*last)->restricted = 1;
-  (*last)->users = menu_users;
-  (*last)->argc = argc;
-  (*last)->args = menu_args;
-  (*last)->sourcecode = menu_sourcecode;
-  (*last)->submenu = submenu;
-
-  menu->size++;
+    entry->restricted = 1;
+  entry->users = menu_users;
+  entry->argc = argc;
+  entry->args = menu_args;
+  entry->sourcecode = menu_sourcecode;
+  entry->submenu = submenu;
+
+  /* Add the menu entry at the end of the list.  */
+  grub_menu_append_entry (menu, entry);
   return GRUB_ERR_NONE;
 
  fail:
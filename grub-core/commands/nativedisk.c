@@ -34,7 +34,7 @@ GRUB_MOD_LICENSE ("GPLv3+");
 static const char *modnames_def[] = { 
   /* FIXME: autogenerate this.  */
 #if defined (__i386__) || defined (__x86_64__) || defined (GRUB_MACHINE_MIPS_LOONGSON)
-  "pata", "ahci", "usbms", "ohci", "uhci", "ehci"
+  "pata", "ahci", "nvme", "usbms", "ohci", "uhci", "ehci", "xhci"
 #elif defined (GRUB_MACHINE_MIPS_QEMU_MIPS)
   "pata"
 #else
@@ -77,6 +77,7 @@ get_uuid (const char *name, char **uuid, int getnative)
     case GRUB_DISK_DEVICE_ATA_ID:
     case GRUB_DISK_DEVICE_SCSI_ID:
     case GRUB_DISK_DEVICE_XEN:
+    case GRUB_DISK_DEVICE_NVME_ID:
       if (getnative)
 	break;
 
@@ -310,7 +311,7 @@ static grub_command_t cmd;
 GRUB_MOD_INIT(nativedisk)
 {
   cmd = grub_register_command ("nativedisk", grub_cmd_nativedisk, N_("[MODULE1 MODULE2 ...]"),
-			       N_("Switch to native disk drivers. If no modules are specified default set (pata,ahci,usbms,ohci,uhci,ehci) is used"));
+			       N_("Switch to native disk drivers. If no modules are specified default set (pata,ahci,nvme,usbms,ohci,uhci,ehci,xhci) is used"));
 }
 
 GRUB_MOD_FINI(nativedisk)
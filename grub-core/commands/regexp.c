@@ -25,10 +25,98 @@
 #include <grub/extcmd.h>
 #include <grub/i18n.h>
 #include <grub/script_sh.h>
-#include <regex.h>
+#include <grub/regexp.h>
 
 GRUB_MOD_LICENSE ("GPLv3+");
 
+/* Number of compiled patterns kept around.  Menus tend to run the same
+   few patterns over and over, e.g. in a for loop over devices.  */
+#define REGEXP_CACHE_SIZE 16
+
+struct regexp_cache_entry
+{
+  struct regexp_cache_entry *next;
+  char *pattern;
+  int cflags;
+  regex_t regex;
+};
+
+/* Most recently used first.  */
+static struct regexp_cache_entry *regexp_cache;
+
+static void
+regexp_cache_entry_free (struct regexp_cache_entry *e)
+{
+  regfree (&e->regex);
+  grub_free (e->pattern);
+  grub_free (e);
+}
+
+const regex_t *
+grub_regexp_compile (const char *pattern, int cflags, int *err)
+{
+  struct regexp_cache_entry *e, **prev;
+  unsigned n = 0;
+
+  for (prev = &regexp_cache; (e = *prev); prev = &e->next, n++)
+    if (e->cflags == cflags && grub_strcmp (e->pattern, pattern) == 0)
+      {
+	*prev = e->next;
+	e->next = regexp_cache;
+	regexp_cache = e;
+	return &e->regex;
+      }
+
+  e = grub_zalloc (sizeof (*e));
+  if (! e)
+    {
+      *err = REG_ESPACE;
+      return NULL;
+    }
+  e->pattern = grub_strdup (pattern);
+  if (! e->pattern)
+    {
+      grub_free (e);
+      *err = REG_ESPACE;
+      return NULL;
+    }
+  e->cflags = cflags;
+
+  *err = regcomp (&e->regex, pattern, cflags);
+  if (*err)
+    {
+      grub_free (e->pattern);
+      grub_free (e);
+      return NULL;
+    }
+
+  /* Drop the least recently used pattern if the cache is full.  */
+  if (n >= REGEXP_CACHE_SIZE)
+    {
+      for (prev = &regexp_cache; (*prev)->next; prev = &(*prev)->next)
+	;
+      regexp_cache_entry_free (*prev);
+      *prev = NULL;
+    }
+
+  e->next = regexp_cache;
+  regexp_cache = e;
+  return &e->regex;
+}
+
+static void
+regexp_cache_flush (void)
+{
+  struct regexp_cache_entry *e, *next;
+
+  for (e = regexp_cache; e; e = next)
+    {
+      next = e->next;
+      regexp_cache_entry_free (e);
+    }
+  regexp_cache = NULL;
+}
+
 static const struct grub_arg_option options[] =
   {
     { "set", 's', GRUB_ARG_OPTION_REPEATABLE,
@@ -102,7 +190,7 @@ set_matches (char **varnames, char *str, grub_size_t nmatches,
 static grub_err_t
 grub_cmd_regexp (grub_extcmd_context_t ctxt, int argc, char **args)
 {
-  regex_t regex;
+  const regex_t *regex;
   int ret;
   grub_size_t s;
   char *comperr;
@@ -112,36 +200,31 @@ grub_cmd_regexp (grub_extcmd_context_t ctxt, int argc, char **args)
   if (argc != 2)
     return grub_error (GRUB_ERR_BAD_ARGUMENT, N_("two arguments expected"));
 
-  ret = regcomp (&regex, args[0], REG_EXTENDED);
-  if (ret)
+  regex = grub_regexp_compile (args[0], REG_EXTENDED, &ret);
+  if (! regex)
     goto fail;
 
-  matches = grub_zalloc (sizeof (*matches) * (regex.re_nsub + 1));
+  matches = grub_zalloc (sizeof (*matches) * (regex->re_nsub + 1));
   if (! matches)
     goto fail;
 
-  ret = regexec (&regex, args[1], regex.re_nsub + 1, matches, 0);
+  ret = regexec (regex, args[1], regex->re_nsub + 1, matches, 0);
   if (!ret)
     {
       err = set_matches (ctxt->state[0].args, args[1],
-			 regex.re_nsub + 1, matches);
-      regfree (&regex);
+			 regex->re_nsub + 1, matches);
       grub_free (matches);
       return err;
     }
 
  fail:
   grub_free (matches);
-  s = regerror (ret, &regex, 0, 0);
+  s = regerror (ret, regex, 0, 0);
   comperr = grub_malloc (s);
   if (!comperr)
-    {
-      regfree (&regex);
-      return grub_errno;
-    }
-  regerror (ret, &regex, comperr, s);
+    return grub_errno;
+  regerror (ret, regex, comperr, s);
   err = grub_error (GRUB_ERR_TEST_FAILURE, "%s", comperr);
-  regfree (&regex);
   grub_free (comperr);
   return err;
 }
@@ -165,4 +248,5 @@ GRUB_MOD_FINI(regexp)
 {
   grub_unregister_extcmd (cmd);
   grub_wildcard_translator = 0;
+  regexp_cache_flush ();
 }
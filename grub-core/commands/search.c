@@ -37,6 +37,18 @@
 
 GRUB_MOD_LICENSE ("GPLv3+");
 
+#if defined(DO_SEARCH_FS_UUID) || defined(DO_SEARCH_DISK_UUID)
+#define compare_fn grub_strcasecmp
+#else
+#define compare_fn grub_strcmp
+#endif
+
+/* Every device looked at so far with the value it has for this kind of
+   search (its UUID, label, ...), in the order grub_device_iterate visits
+   them, so that a search for another value can go straight to the device
+   holding it instead of probing every device again.  For file searches,
+   the devices a file was found on.  The whole index is dropped when the
+   set of disks changes.  */
 struct cache_entry
 {
   struct cache_entry *next;
@@ -45,6 +57,86 @@ struct cache_entry
 };
 
 static struct cache_entry *cache;
+static unsigned long cache_generation;
+
+static void
+cache_flush (void)
+{
+  struct cache_entry *cache_ent, *next;
+
+  for (cache_ent = cache; cache_ent; cache_ent = next)
+    {
+      next = cache_ent->next;
+      grub_free (cache_ent->key);
+      grub_free (cache_ent->value);
+      grub_free (cache_ent);
+    }
+  cache = 0;
+  cache_generation = grub_disk_generation;
+}
+
+/* Record that device NAME has KEY, or nothing if KEY is NULL.  */
+static void
+cache_record (const char *name, const char *key)
+{
+  struct cache_entry **prev;
+  struct cache_entry *cache_ent;
+
+  for (prev = &cache, cache_ent = *prev; cache_ent;
+       prev = &cache_ent->next, cache_ent = *prev)
+    if (grub_strcmp (cache_ent->value, name) == 0
+#ifdef DO_SEARCH_FILE
+	&& grub_strcmp (cache_ent->key, key) == 0
+#endif
+	)
+      break;
+
+  if (cache_ent)
+    {
+      char *new_key;
+
+      if (key && grub_strcmp (cache_ent->key, key) == 0)
+	return;
+      if (!key)
+	{
+	  *prev = cache_ent->next;
+	  grub_free (cache_ent->key);
+	  grub_free (cache_ent->value);
+	  grub_free (cache_ent);
+	  return;
+	}
+      new_key = grub_strdup (key);
+      if (!new_key)
+	{
+	  grub_errno = GRUB_ERR_NONE;
+	  return;
+	}
+      grub_free (cache_ent->key);
+      cache_ent->key = new_key;
+      return;
+    }
+
+  if (!key)
+    return;
+
+  /* Append, so that lookups find devices in iteration order.  */
+  cache_ent = grub_malloc (sizeof (*cache_ent));
+  if (cache_ent)
+    {
+      cache_ent->next = 0;
+      cache_ent->key = grub_strdup (key);
+      cache_ent->value = grub_strdup (name);
+      if (cache_ent->value && cache_ent->key)
+	{
+	  *prev = cache_ent;
+	  return;
+	}
+      grub_free (cache_ent->value);
+      grub_free (cache_ent->key);
+      grub_free (cache_ent);
+    }
+  grub_errno = GRUB_ERR_NONE;
+}
 
 /* Context for FUNC_NAME.  */
 struct search_ctx
@@ -55,27 +147,65 @@ struct search_ctx
   char **hints;
   unsigned nhints;
   int count;
-  int is_cache;
+#ifdef DO_SEARCH_PART_UUID
+  /* Last disk whose partition table is known not to hold KEY.  */
+  char *gpt_disk;
+#endif
 };
 
+#ifdef DO_SEARCH_PART_UUID
+/* Whether NAME is a partition straight from the GPT on DISK.  */
+static int
+is_gpt_partition (const char *disk, const char *name)
+{
+  grub_size_t len = grub_strlen (disk);
+
+  if (grub_strncmp (name, disk, len) != 0
+      || grub_strncmp (name + len, ",gpt", sizeof (",gpt") - 1) != 0)
+    return 0;
+
+  name += len + sizeof (",gpt") - 1;
+  if (!*name)
+    return 0;
+  for (; *name; name++)
+    if (!grub_isdigit (*name))
+      return 0;
+
+  return 1;
+}
+#endif
+
+/* Skip floppy drives when requested.  */
+static int
+skip_device (struct search_ctx *ctx, const char *name)
+{
+  return (ctx->no_floppy && name[0] == 'f' && name[1] == 'd'
+	  && name[2] >= '0' && name[2] <= '9');
+}
+
+static void
+found_device (struct search_ctx *ctx, const char *name)
+{
+  ctx->count++;
+  if (ctx->var)
+    grub_env_set (ctx->var, name);
+  else
+    grub_printf (" %s", name);
+}
+
 /* Helper for FUNC_NAME.  */
 static int
 iterate_device (const char *name, void *data)
 {
   struct search_ctx *ctx = data;
   int found = 0;
+#ifndef DO_SEARCH_FILE
+  char *quid = 0;
+#endif
 
-  /* Skip floppy drives when requested.  */
-  if (ctx->no_floppy &&
-      name[0] == 'f' && name[1] == 'd' && name[2] >= '0' && name[2] <= '9')
+  if (skip_device (ctx, name))
     return 0;
 
-#if defined(DO_SEARCH_FS_UUID) || defined(DO_SEARCH_DISK_UUID)
-#define compare_fn grub_strcasecmp
-#else
-#define compare_fn grub_strcmp
-#endif
-
 #ifdef DO_SEARCH_FILE
     {
       char *buf;
@@ -97,37 +227,51 @@ iterate_device (const char *name, void *data)
 #elif defined(DO_SEARCH_PART_UUID)
     {
       grub_device_t dev;
-      char *quid;
+      grub_uint32_t number;
+      char *part_name = 0;
+
+      if (ctx->gpt_disk && is_gpt_partition (ctx->gpt_disk, name))
+	return 0;
 
       dev = grub_device_open (name);
       if (dev)
 	{
-	  if (grub_gpt_part_uuid (dev, &quid) == GRUB_ERR_NONE)
+	  /* Look the key up in the table of a whole disk at once, rather
+	     than opening each of its partitions in turn.  */
+	  if (ctx->var && dev->disk && !dev->disk->partition)
 	    {
-	      if (grub_strcasecmp (quid, ctx->key) == 0)
-		    found = 1;
-
-	      grub_free (quid);
+	      if (grub_gpt_find_part_uuid (dev->disk, ctx->key, &number)
+		  == GRUB_ERR_NONE)
+		part_name = grub_xasprintf ("%s,gpt%u", name, number + 1);
+	      else if (grub_errno == GRUB_ERR_FILE_NOT_FOUND)
+		{
+		  grub_free (ctx->gpt_disk);
+		  ctx->gpt_disk = grub_strdup (name);
+		}
+	      grub_errno = GRUB_ERR_NONE;
 	    }
+	  else if (grub_gpt_part_uuid (dev, &quid) != GRUB_ERR_NONE)
+	    quid = 0;
 
 	  grub_device_close (dev);
 	}
+
+      if (part_name)
+	{
+	  found = iterate_device (part_name, ctx);
+	  grub_free (part_name);
+	  return found;
+	}
     }
 #elif defined(DO_SEARCH_PART_LABEL)
     {
       grub_device_t dev;
-      char *quid;
 
       dev = grub_device_open (name);
       if (dev)
 	{
-	  if (grub_gpt_part_label (dev, &quid) == GRUB_ERR_NONE)
-	    {
-	      if (grub_strcmp (quid, ctx->key) == 0)
-		    found = 1;
-
-	      grub_free (quid);
-	    }
+	  if (grub_gpt_part_label (dev, &quid) != GRUB_ERR_NONE)
+	    quid = 0;
 
 	  grub_device_close (dev);
 	}
@@ -135,18 +279,12 @@ iterate_device (const char *name, void *data)
 #elif defined(DO_SEARCH_DISK_UUID)
     {
       grub_device_t dev;
-      char *quid;
 
       dev = grub_device_open (name);
       if (dev)
 	{
-	  if (grub_gpt_disk_uuid (dev, &quid) == GRUB_ERR_NONE)
-	    {
-	      if (grub_strcmp (quid, ctx->key) == 0)
-		found = 1;
-
-	      grub_free (quid);
-	    }
+	  if (grub_gpt_disk_uuid (dev, &quid) != GRUB_ERR_NONE)
+	    quid = 0;
 
 	  grub_device_close (dev);
 	}
@@ -156,7 +294,6 @@ iterate_device (const char *name, void *data)
       /* SEARCH_FS_UUID or SEARCH_LABEL */
       grub_device_t dev;
       grub_fs_t fs;
-      char *quid;
 
       dev = grub_device_open (name);
       if (dev)
@@ -173,13 +310,8 @@ iterate_device (const char *name, void *data)
 	    {
 	      fs->read_fn (dev, &quid);
 
-	      if (grub_errno == GRUB_ERR_NONE && quid)
-		{
-		  if (compare_fn (quid, ctx->key) == 0)
-		    found = 1;
-
-		  grub_free (quid);
-		}
+	      if (grub_errno != GRUB_ERR_NONE)
+		quid = 0;
 	    }
 
 	  grub_device_close (dev);
@@ -187,39 +319,19 @@ iterate_device (const char *name, void *data)
     }
 #endif
 
-  if (!ctx->is_cache && found && ctx->count == 0)
-    {
-      struct cache_entry *cache_ent;
-      cache_ent = grub_malloc (sizeof (*cache_ent));
-      if (cache_ent)
-	{
-	  cache_ent->key = grub_strdup (ctx->key);
-	  cache_ent->value = grub_strdup (name);
-	  if (cache_ent->value && cache_ent->key)
-	    {
-	      cache_ent->next = cache;
-	      cache = cache_ent;
-	    }
-	  else
-	    {
-	      grub_free (cache_ent->value);
-	      grub_free (cache_ent->key);
-	      grub_free (cache_ent);
-	      grub_errno = GRUB_ERR_NONE;
-	    }
-	}
-      else
-	grub_errno = GRUB_ERR_NONE;
-    }
+#ifdef DO_SEARCH_FILE
+  if (found)
+    cache_record (name, ctx->key);
+#else
+  if (quid && compare_fn (quid, ctx->key) == 0)
+    found = 1;
+  grub_errno = GRUB_ERR_NONE;
+  cache_record (name, quid);
+  grub_free (quid);
+#endif
 
   if (found)
-    {
-      ctx->count++;
-      if (ctx->var)
-	grub_env_set (ctx->var, name);
-      else
-	grub_printf (" %s", name);
-    }
+    found_device (ctx, name);
 
   grub_errno = GRUB_ERR_NONE;
   return (found && ctx->var);
@@ -252,31 +364,24 @@ static void
 try (struct search_ctx *ctx)    
 {
   unsigned i;
-  struct cache_entry **prev;
   struct cache_entry *cache_ent;
 
-  for (prev = &cache, cache_ent = *prev; cache_ent;
-       prev = &cache_ent->next, cache_ent = *prev)
-    if (compare_fn (cache_ent->key, ctx->key) == 0)
-      break;
-  if (cache_ent)
-    {
-      ctx->is_cache = 1;
-      if (iterate_device (cache_ent->value, ctx))
+  if (cache_generation != grub_disk_generation)
+    cache_flush ();
+
+  /* Only a search setting a variable stops at the first match; one
+     listing all matches has to see every device anyway.  Entries were
+     read since the set of disks last changed, so they are taken as they
+     are: generated menus repeat the same search in every entry, and
+     falling back through them should not read the devices again.  */
+  if (ctx->var)
+    for (cache_ent = cache; cache_ent; cache_ent = cache_ent->next)
+      if (compare_fn (cache_ent->key, ctx->key) == 0
+	  && !skip_device (ctx, cache_ent->value))
 	{
-	  ctx->is_cache = 0;
+	  found_device (ctx, cache_ent->value);
 	  return;
 	}
-      ctx->is_cache = 0;
-      /* Cache entry was outdated. Remove it.  */
-      if (!ctx->count)
-	{
-	  *prev = cache_ent->next;
-	  grub_free (cache_ent->key);
-	  grub_free (cache_ent->value);
-	  grub_free (cache_ent);
-	}
-    }
 
   for (i = 0; i < ctx->nhints; i++)
     {
@@ -331,8 +436,7 @@ FUNC_NAME (const char *key, const char *var, int no_floppy,
     .no_floppy = no_floppy,
     .hints = hints,
     .nhints = nhints,
-    .count = 0,
-    .is_cache = 0
+    .count = 0
   };
   grub_fs_autoload_hook_t saved_autoload;
 
@@ -353,6 +457,10 @@ FUNC_NAME (const char *key, const char *var, int no_floppy,
   else
     try (&ctx);
 
+#ifdef DO_SEARCH_PART_UUID
+  grub_free (ctx.gpt_disk);
+#endif
+
   if (grub_errno == GRUB_ERR_NONE && ctx.count == 0)
     grub_error (GRUB_ERR_FILE_NOT_FOUND, "no such device: %s", key);
 }
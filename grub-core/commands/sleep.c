@@ -55,8 +55,11 @@ grub_interruptible_millisleep (grub_uint32_t ms)
   start = grub_get_time_ms ();
 
   while (grub_get_time_ms () - start < ms)
-    if (grub_getkey_noblock () == GRUB_TERM_ESC)
-      return 1;
+    {
+      if (grub_getkey_noblock () == GRUB_TERM_ESC)
+	return 1;
+      grub_term_idle (start + ms);
+    }
 
   return 0;
 }
@@ -1,4 +1,4 @@
-/* testspeed.c - Command to test file read speed  */
+/* testspeed.c - Command to test file and disk read speed  */
 /*
  *  GRUB  --  GRand Unified Bootloader
  *  Copyright (C) 2012  Free Software Foundation, Inc.
@@ -19,6 +19,7 @@
 
 #include <grub/mm.h>
 #include <grub/file.h>
+#include <grub/disk.h>
 #include <grub/time.h>
 #include <grub/misc.h>
 #include <grub/dl.h>
@@ -29,72 +30,394 @@
 GRUB_MOD_LICENSE ("GPLv3+");
 
 #define DEFAULT_BLOCK_SIZE	65536
+#define DEFAULT_RANDOM_COUNT	256
+/* Direct disk reads stop here unless --length says otherwise, reading a
+   whole disk is rarely what is wanted.  */
+#define DEFAULT_DISK_LENGTH	(64 << 20)
+#define MAX_BLOCK_SIZES		8
 
 static const struct grub_arg_option options[] =
   {
-    {"size", 's', 0, N_("Specify size for each read operation"), 0, ARG_TYPE_INT},
+    {"size", 's', 0,
+     N_("Read SIZE bytes at a time. Several comma-separated sizes are "
+	"run one after the other."), N_("SIZE[,SIZE...]"), ARG_TYPE_STRING},
+    {"random", 'r', 0, N_("Read blocks at random offsets."), 0, 0},
+    {"count", 'c', 0, N_("Number of random reads (default 256)."),
+     N_("COUNT"), ARG_TYPE_INT},
+    {"length", 'l', 0, N_("Read no further than LENGTH bytes."),
+     N_("LENGTH"), ARG_TYPE_STRING},
+    {"disk", 'd', 0, N_("Read the device directly, bypassing the filesystem."),
+     0, 0},
+    {"warm", 'w', 0, N_("Do not drop the disk caches before the first run, "
+			"and run only once."), 0, 0},
     {0, 0, 0, 0, 0, 0}
   };
 
-static grub_err_t
-grub_cmd_testspeed (grub_extcmd_context_t ctxt, int argc, char **args)
+enum options
+  {
+    TESTSPEED_SIZE,
+    TESTSPEED_RANDOM,
+    TESTSPEED_COUNT,
+    TESTSPEED_LENGTH,
+    TESTSPEED_DISK,
+    TESTSPEED_WARM
+  };
+
+struct speed_target
 {
-  struct grub_arg_list *state = ctxt->state;
-  grub_uint64_t start;
-  grub_uint64_t end;
-  grub_ssize_t block_size;
-  grub_disk_addr_t total_size;
-  char *buffer;
   grub_file_t file;
-  grub_uint64_t whole, fraction;
+  grub_disk_t disk;
+  grub_uint64_t size;
+};
 
-  if (argc == 0)
-    return grub_error (GRUB_ERR_BAD_ARGUMENT, N_("filename expected"));
+struct speed_run
+{
+  /* Time taken by each read, in nanoseconds.  */
+  grub_uint64_t *latency;
+  grub_size_t nreads;
+  grub_size_t alloc;
+  grub_uint64_t bytes;
+  grub_uint64_t elapsed;
+};
 
-  block_size = (state[0].set) ?
-    grub_strtoul (state[0].arg, 0, 0) : DEFAULT_BLOCK_SIZE;
+/* Parse a size with an optional K, M or G suffix.  */
+static grub_err_t
+parse_size (const char *str, const char **end, grub_uint64_t *size)
+{
+  char *ptr;
 
-  if (block_size <= 0)
-    return grub_error (GRUB_ERR_BAD_ARGUMENT, N_("invalid block size"));
+  *size = grub_strtoull (str, &ptr, 0);
+  if (grub_errno || ptr == str)
+    return grub_error (GRUB_ERR_BAD_ARGUMENT, N_("invalid size `%s'"), str);
 
-  buffer = grub_malloc (block_size);
-  if (buffer == NULL)
-    return grub_errno;
+  switch (*ptr)
+    {
+    case 'g':
+    case 'G':
+      *size <<= 10;
+      /* Fallthrough.  */
+    case 'm':
+    case 'M':
+      *size <<= 10;
+      /* Fallthrough.  */
+    case 'k':
+    case 'K':
+      *size <<= 10;
+      ptr++;
+      break;
+    }
+
+  if (end)
+    *end = ptr;
+  else if (*ptr)
+    return grub_error (GRUB_ERR_BAD_ARGUMENT, N_("invalid size `%s'"), str);
+  return GRUB_ERR_NONE;
+}
+
+static grub_err_t
+target_open (struct speed_target *target, char *name, int disk,
+	     grub_uint64_t limit)
+{
+  grub_memset (target, 0, sizeof (*target));
 
-  file = grub_file_open (args[0]);
-  if (file == NULL)
-    goto quit;
+  if (disk)
+    {
+      grub_size_t len = grub_strlen (name);
+
+      if (name[0] == '(' && name[len - 1] == ')')
+	{
+	  name[len - 1] = 0;
+	  target->disk = grub_disk_open (name + 1);
+	  name[len - 1] = ')';
+	}
+      else
+	target->disk = grub_disk_open (name);
+      if (! target->disk)
+	return grub_errno;
+
+      target->size = grub_disk_get_size (target->disk);
+      if (target->size != GRUB_DISK_SIZE_UNKNOWN)
+	target->size <<= GRUB_DISK_SECTOR_BITS;
+      if (! limit)
+	limit = DEFAULT_DISK_LENGTH;
+    }
+  else
+    {
+      target->file = grub_file_open (name);
+      if (! target->file)
+	return grub_errno;
+      target->size = grub_file_size (target->file);
+    }
+
+  if (limit && limit < target->size)
+    target->size = limit;
+  return GRUB_ERR_NONE;
+}
+
+static void
+target_close (struct speed_target *target)
+{
+  if (target->file)
+    grub_file_close (target->file);
+  if (target->disk)
+    grub_disk_close (target->disk);
+}
+
+static grub_ssize_t
+target_read (struct speed_target *target, grub_uint64_t offset,
+	     char *buf, grub_size_t len)
+{
+  if (offset >= target->size)
+    return 0;
+  if (len > target->size - offset)
+    len = target->size - offset;
+
+  if (target->disk)
+    {
+      if (grub_disk_read (target->disk, offset >> GRUB_DISK_SECTOR_BITS,
+			  offset & (GRUB_DISK_SECTOR_SIZE - 1), len, buf))
+	return -1;
+      return len;
+    }
+
+  if (target->file->offset != offset)
+    grub_file_seek (target->file, offset);
+  return grub_file_read (target->file, buf, len);
+}
+
+static grub_err_t
+run_record (struct speed_run *run, grub_uint64_t ns, grub_size_t bytes)
+{
+  if (run->nreads == run->alloc)
+    {
+      grub_uint64_t *latency;
+      grub_size_t alloc = run->alloc ? run->alloc * 2 : 1024;
+
+      latency = grub_realloc (run->latency, alloc * sizeof (*latency));
+      if (! latency)
+	return grub_errno;
+      run->latency = latency;
+      run->alloc = alloc;
+    }
+
+  run->latency[run->nreads++] = ns;
+  run->bytes += bytes;
+  return GRUB_ERR_NONE;
+}
+
+/* Pseudo-random offsets, the same sequence on every run so that a warm run
+   reads exactly what the cold run before it did.  */
+static grub_uint64_t
+next_random (grub_uint64_t *state)
+{
+  *state ^= *state << 13;
+  *state ^= *state >> 7;
+  *state ^= *state << 17;
+  return *state;
+}
+
+static grub_err_t
+run_once (struct speed_target *target, struct speed_run *run, char *buffer,
+	  grub_size_t block_size, unsigned long count)
+{
+  grub_uint64_t seed = 0x9e3779b97f4a7c15ULL;
+  grub_uint64_t nblocks = 0, offset = 0, start, before, after;
+  unsigned long i;
 
-  total_size = 0;
-  start = grub_get_time_ms ();
-  while (1)
+  if (count)
     {
-      grub_ssize_t size = grub_file_read (file, buffer, block_size);
-      if (size <= 0)
+      if (target->size == GRUB_FILE_SIZE_UNKNOWN)
+	return grub_error (GRUB_ERR_BAD_ARGUMENT,
+			   N_("size unknown, use --length for random reads"));
+      nblocks = grub_divmod64 (target->size, block_size, 0);
+      if (! nblocks)
+	return grub_error (GRUB_ERR_OUT_OF_RANGE,
+			   N_("shorter than one block"));
+    }
+
+  run->nreads = 0;
+  run->bytes = 0;
+  start = grub_get_time_ns ();
+  for (i = 0; ! count || i < count; i++)
+    {
+      grub_ssize_t size;
+
+      if (count)
+	{
+	  grub_uint64_t block;
+
+	  grub_divmod64 (next_random (&seed), nblocks, &block);
+	  offset = block * block_size;
+	}
+
+      before = grub_get_time_ns ();
+      size = target_read (target, offset, buffer, block_size);
+      after = grub_get_time_ns ();
+      if (size < 0)
+	return grub_errno;
+      if (size == 0)
 	break;
-      total_size += size;
+      if (run_record (run, after - before, size))
+	return grub_errno;
+      offset += size;
     }
-  end = grub_get_time_ms ();
-  grub_file_close (file);
+  run->elapsed = grub_get_time_ns () - start;
+
+  return GRUB_ERR_NONE;
+}
+
+static void
+sort_latency (grub_uint64_t *latency, grub_size_t n)
+{
+  grub_size_t gap, i, j;
+
+  for (gap = n / 2; gap > 0; gap /= 2)
+    for (i = gap; i < n; i++)
+      {
+	grub_uint64_t v = latency[i];
+
+	for (j = i; j >= gap && latency[j - gap] > v; j -= gap)
+	  latency[j] = latency[j - gap];
+	latency[j] = v;
+      }
+}
+
+static grub_uint64_t
+percentile (const struct speed_run *run, unsigned p)
+{
+  return grub_divmod64 (run->latency[(run->nreads - 1) * p / 100], 1000, 0);
+}
+
+static void
+run_report (struct speed_run *run)
+{
+  grub_uint64_t whole, fraction, us;
 
   grub_printf_ (N_("File size: %s\n"),
-		grub_get_human_size (total_size, GRUB_HUMAN_SIZE_NORMAL));
-  whole = grub_divmod64 (end - start, 1000, &fraction);
+		grub_get_human_size (run->bytes, GRUB_HUMAN_SIZE_NORMAL));
+  whole = grub_divmod64 (run->elapsed, 1000000000, &fraction);
   grub_printf_ (N_("Elapsed time: %d.%03d s \n"),
 		(unsigned) whole,
-		(unsigned) fraction);
+		(unsigned) grub_divmod64 (fraction, 1000000, 0));
 
-  if (end != start)
+  us = grub_divmod64 (run->elapsed, 1000, 0);
+  if (us)
     {
       grub_uint64_t speed =
-	grub_divmod64 (total_size * 100ULL * 1000ULL, end - start, 0);
+	grub_divmod64 (run->bytes * 100ULL * 1000000ULL, us, 0);
 
       grub_printf_ (N_("Speed: %s \n"),
 		    grub_get_human_size (speed,
 					 GRUB_HUMAN_SIZE_SPEED));
     }
 
+  if (! run->nreads)
+    return;
+
+  sort_latency (run->latency, run->nreads);
+  grub_printf_ (N_("Latency: min %llu us, 50%% %llu us, 90%% %llu us, "
+		   "99%% %llu us, max %llu us (%lu reads)\n"),
+		(unsigned long long) percentile (run, 0),
+		(unsigned long long) percentile (run, 50),
+		(unsigned long long) percentile (run, 90),
+		(unsigned long long) percentile (run, 99),
+		(unsigned long long) percentile (run, 100),
+		(unsigned long) run->nreads);
+}
+
+static grub_err_t
+grub_cmd_testspeed (grub_extcmd_context_t ctxt, int argc, char **args)
+{
+  struct grub_arg_list *state = ctxt->state;
+  grub_uint64_t sizes[MAX_BLOCK_SIZES];
+  unsigned nsizes = 0, i, pass;
+  grub_uint64_t limit = 0, max_size = 0;
+  unsigned long count = 0;
+  struct speed_run run;
+  char *buffer;
+
+  if (argc == 0)
+    return grub_error (GRUB_ERR_BAD_ARGUMENT, N_("filename expected"));
+
+  if (state[TESTSPEED_SIZE].set)
+    {
+      const char *ptr = state[TESTSPEED_SIZE].arg;
+
+      do
+	{
+	  if (nsizes == MAX_BLOCK_SIZES)
+	    return grub_error (GRUB_ERR_BAD_ARGUMENT,
+			       N_("too many block sizes"));
+	  if (parse_size (ptr, &ptr, &sizes[nsizes]))
+	    return grub_errno;
+	  if (*ptr && *ptr != ',')
+	    return grub_error (GRUB_ERR_BAD_ARGUMENT,
+			       N_("invalid size `%s'"),
+			       state[TESTSPEED_SIZE].arg);
+	  nsizes++;
+	}
+      while (*ptr++ == ',');
+    }
+  else
+    sizes[nsizes++] = DEFAULT_BLOCK_SIZE;
+
+  for (i = 0; i < nsizes; i++)
+    {
+      if (sizes[i] == 0 || sizes[i] > GRUB_INT_MAX)
+	return grub_error (GRUB_ERR_BAD_ARGUMENT, N_("invalid block size"));
+      if (sizes[i] > max_size)
+	max_size = sizes[i];
+    }
+
+  if (state[TESTSPEED_LENGTH].set
+      && parse_size (state[TESTSPEED_LENGTH].arg, 0, &limit))
+    return grub_errno;
+
+  if (state[TESTSPEED_RANDOM].set)
+    {
+      count = (state[TESTSPEED_COUNT].set)
+	? grub_strtoul (state[TESTSPEED_COUNT].arg, 0, 0)
+	: DEFAULT_RANDOM_COUNT;
+      if (count == 0)
+	return grub_error (GRUB_ERR_BAD_ARGUMENT, N_("invalid read count"));
+    }
+
+  buffer = grub_malloc (max_size);
+  if (buffer == NULL)
+    return grub_errno;
+
+  grub_memset (&run, 0, sizeof (run));
+
+  for (i = 0; i < nsizes; i++)
+    /* The cold pass drops the caches first, the warm one reruns the same
+       reads on top of what the cold pass left behind.  */
+    for (pass = state[TESTSPEED_WARM].set ? 1 : 0; pass < 2; pass++)
+      {
+	struct speed_target target;
+	grub_err_t err;
+
+	if (pass == 0)
+	  grub_disk_drop_caches ();
+
+	if (target_open (&target, args[0], state[TESTSPEED_DISK].set, limit))
+	  goto quit;
+
+	grub_printf_ (N_("%s %s read, %llu byte blocks, %s:\n"),
+		      count ? _("Random") : _("Sequential"),
+		      state[TESTSPEED_DISK].set ? _("disk") : _("file"),
+		      (unsigned long long) sizes[i],
+		      pass ? _("warm") : _("cold"));
+
+	err = run_once (&target, &run, buffer, sizes[i], count);
+	target_close (&target);
+	if (err)
+	  goto quit;
+
+	run_report (&run);
+      }
+
  quit:
+  grub_free (run.latency);
   grub_free (buffer);
 
   return grub_errno;
@@ -104,8 +427,10 @@ static grub_extcmd_t cmd;
 
 GRUB_MOD_INIT(testspeed)
 {
-  cmd = grub_register_extcmd ("testspeed", grub_cmd_testspeed, 0, N_("[-s SIZE] FILENAME"),
-			      N_("Test file read speed."),
+  cmd = grub_register_extcmd ("testspeed", grub_cmd_testspeed, 0,
+			      N_("[-s SIZE[,SIZE...]] [-r [-c COUNT]] "
+				 "[-l LENGTH] [-d] [-w] FILE|DEVICE"),
+			      N_("Test file or disk read speed."),
 			      options);
 }
 
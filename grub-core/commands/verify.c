@@ -179,6 +179,236 @@ struct
     [17] = { "dsa", 2, 4, &grub_crypto_pk_dsa, dsa_pad, "gcry_dsa" },
   };
 
+/* RSA keys keep their modulus in Montgomery form, set up when the key is
+   loaded, so that checking a signature is a handful of Montgomery
+   multiplications instead of a full division after every step of
+   libgcrypt's powm.  Keys that don't fit fall back to libgcrypt.  */
+
+#define RSA_MONT_MAX_BITS 8192
+
+struct rsa_mont
+{
+  unsigned nbits;
+  unsigned nlimbs;
+  grub_uint32_t e;
+  /* -n^-1 mod 2^32.  */
+  grub_uint32_t n0inv;
+  /* Least significant limb first.  */
+  grub_uint32_t *n;
+  /* R^2 mod n, with R = 2^(32 * nlimbs).  */
+  grub_uint32_t *rr;
+};
+
+static void
+limbs_from_bytes (grub_uint32_t *limbs, unsigned nlimbs,
+		  const grub_uint8_t *bytes, grub_size_t len)
+{
+  grub_size_t i;
+
+  grub_memset (limbs, 0, nlimbs * sizeof (limbs[0]));
+  for (i = 0; i < len && i < nlimbs * 4; i++)
+    limbs[i / 4] |= (grub_uint32_t) bytes[len - 1 - i] << (8 * (i % 4));
+}
+
+static void
+limbs_to_bytes (grub_uint8_t *bytes, grub_size_t len,
+		const grub_uint32_t *limbs, unsigned nlimbs)
+{
+  grub_size_t i;
+
+  for (i = 0; i < len; i++)
+    bytes[len - 1 - i] = i < nlimbs * 4 ? limbs[i / 4] >> (8 * (i % 4)) : 0;
+}
+
+static int
+limbs_cmp (const grub_uint32_t *a, const grub_uint32_t *b, unsigned nlimbs)
+{
+  while (nlimbs--)
+    if (a[nlimbs] != b[nlimbs])
+      return a[nlimbs] > b[nlimbs] ? 1 : -1;
+  return 0;
+}
+
+static void
+limbs_sub (grub_uint32_t *r, const grub_uint32_t *a, const grub_uint32_t *b,
+	   unsigned nlimbs)
+{
+  grub_uint64_t borrow = 0;
+  unsigned i;
+
+  for (i = 0; i < nlimbs; i++)
+    {
+      grub_uint64_t d = (grub_uint64_t) a[i] - b[i] - borrow;
+      r[i] = d;
+      borrow = (d >> 32) & 1;
+    }
+}
+
+/* R = A * B / R mod n.  R may alias A or B.  T has room for nlimbs + 2
+   limbs.  */
+static void
+mont_mul (const struct rsa_mont *m, grub_uint32_t *r, const grub_uint32_t *a,
+	  const grub_uint32_t *b, grub_uint32_t *t)
+{
+  unsigned n = m->nlimbs, i, j;
+  grub_uint64_t acc;
+  grub_uint32_t carry, u;
+
+  grub_memset (t, 0, (n + 2) * sizeof (t[0]));
+  for (i = 0; i < n; i++)
+    {
+      carry = 0;
+      for (j = 0; j < n; j++)
+	{
+	  acc = (grub_uint64_t) a[j] * b[i] + t[j] + carry;
+	  t[j] = acc;
+	  carry = acc >> 32;
+	}
+      acc = (grub_uint64_t) t[n] + carry;
+      t[n] = acc;
+      t[n + 1] = acc >> 32;
+
+      u = t[0] * m->n0inv;
+      acc = (grub_uint64_t) u * m->n[0] + t[0];
+      carry = acc >> 32;
+      for (j = 1; j < n; j++)
+	{
+	  acc = (grub_uint64_t) u * m->n[j] + t[j] + carry;
+	  t[j - 1] = acc;
+	  carry = acc >> 32;
+	}
+      acc = (grub_uint64_t) t[n] + carry;
+      t[n - 1] = acc;
+      t[n] = t[n + 1] + (acc >> 32);
+    }
+
+  if (t[n] || limbs_cmp (t, m->n, n) >= 0)
+    limbs_sub (t, t, m->n, n);
+  grub_memcpy (r, t, n * sizeof (r[0]));
+}
+
+static void
+rsa_mont_free (struct rsa_mont *m)
+{
+  if (!m)
+    return;
+  grub_free (m->n);
+  grub_free (m);
+}
+
+/* Set up the Montgomery form of the public key (N, E), or return NULL
+   without an error if it has to go through libgcrypt.  */
+static struct rsa_mont *
+rsa_mont_new (gcry_mpi_t n, gcry_mpi_t e)
+{
+  grub_uint8_t buf[RSA_MONT_MAX_BITS / GRUB_CHAR_BIT];
+  struct rsa_mont *m;
+  grub_size_t written;
+  grub_uint32_t x, carry, next;
+  unsigned i, j, top;
+
+  if (gcry_mpi_get_nbits (n) > RSA_MONT_MAX_BITS
+      || gcry_mpi_get_nbits (e) > 32)
+    return NULL;
+
+  m = grub_zalloc (sizeof (*m));
+  if (!m)
+    goto fail;
+  m->nbits = gcry_mpi_get_nbits (n);
+  m->nlimbs = (m->nbits + 31) / 32;
+
+  if (gcry_mpi_print (GCRYMPI_FMT_USG, buf, sizeof (buf), &written, e))
+    goto fail;
+  for (i = 0; i < written; i++)
+    m->e = (m->e << GRUB_CHAR_BIT) | buf[i];
+  if (gcry_mpi_print (GCRYMPI_FMT_USG, buf, sizeof (buf), &written, n))
+    goto fail;
+  if (m->nbits < 64 || m->e < 3 || !(buf[written - 1] & 1))
+    goto fail;
+
+  m->n = grub_malloc (2 * m->nlimbs * sizeof (m->n[0]));
+  if (!m->n)
+    goto fail;
+  m->rr = m->n + m->nlimbs;
+  limbs_from_bytes (m->n, m->nlimbs, buf, written);
+
+  /* Newton's iteration doubles the correct low bits, an odd number is its
+     own inverse modulo 8.  */
+  x = m->n[0];
+  for (i = 0; i < 4; i++)
+    x *= 2 - m->n[0] * x;
+  m->n0inv = -x;
+
+  /* Double 1 up to R^2, reducing as we go.  */
+  grub_memset (m->rr, 0, m->nlimbs * sizeof (m->rr[0]));
+  m->rr[0] = 1;
+  for (i = 0; i < 64 * m->nlimbs; i++)
+    {
+      top = m->rr[m->nlimbs - 1] >> 31;
+      carry = 0;
+      for (j = 0; j < m->nlimbs; j++)
+	{
+	  next = m->rr[j] >> 31;
+	  m->rr[j] = (m->rr[j] << 1) | carry;
+	  carry = next;
+	}
+      if (top || limbs_cmp (m->rr, m->n, m->nlimbs) >= 0)
+	limbs_sub (m->rr, m->rr, m->n, m->nlimbs);
+    }
+  return m;
+
+ fail:
+  rsa_mont_free (m);
+  grub_errno = GRUB_ERR_NONE;
+  return NULL;
+}
+
+/* Check that SIG ^ e mod n is EM, which is EMLEN bytes long.  */
+static int
+rsa_mont_verify (const struct rsa_mont *m, gcry_mpi_t sig,
+		 const grub_uint8_t *em, grub_size_t emlen)
+{
+  grub_uint8_t buf[RSA_MONT_MAX_BITS / GRUB_CHAR_BIT];
+  grub_uint32_t *s, *acc, *one, *t;
+  grub_size_t written;
+  int bit, ret = 1;
+
+  if (emlen != (m->nbits + 7) / 8
+      || gcry_mpi_print (GCRYMPI_FMT_USG, buf, sizeof (buf), &written, sig)
+      || written > emlen)
+    return 1;
+
+  s = grub_malloc ((4 * m->nlimbs + 2) * sizeof (s[0]));
+  if (!s)
+    return 1;
+  acc = s + m->nlimbs;
+  one = acc + m->nlimbs;
+  t = one + m->nlimbs;
+
+  limbs_from_bytes (s, m->nlimbs, buf, written);
+  if (limbs_cmp (s, m->n, m->nlimbs) >= 0)
+    goto out;
+
+  mont_mul (m, s, s, m->rr, t);
+  grub_memcpy (acc, s, m->nlimbs * sizeof (acc[0]));
+  for (bit = 30 - __builtin_clz (m->e); bit >= 0; bit--)
+    {
+      mont_mul (m, acc, acc, acc, t);
+      if (m->e & (1U << bit))
+	mont_mul (m, acc, acc, s, t);
+    }
+  grub_memset (one, 0, m->nlimbs * sizeof (one[0]));
+  one[0] = 1;
+  mont_mul (m, acc, acc, one, t);
+
+  limbs_to_bytes (buf, emlen, acc, m->nlimbs);
+  ret = grub_crypto_memcmp (buf, em, emlen) != 0;
+
+ out:
+  grub_free (s);
+  return ret;
+}
+
 struct grub_public_key
 {
   struct grub_public_key *next;
@@ -191,6 +421,7 @@ struct grub_public_subkey
   grub_uint8_t type;
   grub_uint32_t fingerprint[5];
   gcry_mpi_t mpis[10];
+  struct rsa_mont *mont;
 };
 
 static void
@@ -203,6 +434,7 @@ free_pk (struct grub_public_key *pk)
       for (i = 0; i < ARRAY_SIZE (sk->mpis); i++)
 	if (sk->mpis[i])
 	  gcry_mpi_release (sk->mpis[i]);
+      rsa_mont_free (sk->mont);
       nsk = sk->next;
       grub_free (sk);
     }
@@ -210,6 +442,8 @@ free_pk (struct grub_public_key *pk)
 }
 
 #define READBUF_SIZE 4096
+/* The signed file is hashed after every chunk this big is read.  */
+#define VERIFY_CHUNK_SIZE (256 * 1024)
 
 struct grub_public_key *
 grub_load_public_key (grub_file_t f)
@@ -352,6 +586,9 @@ grub_load_public_key (grub_file_t f)
 
       GRUB_MD_SHA1->final (fingerprint_context);
 
+      if (pkalgos[pk].algo == &grub_crypto_pk_rsa)
+	sk->mont = rsa_mont_new (sk->mpis[0], sk->mpis[1]);
+
       grub_memcpy (sk->fingerprint, GRUB_MD_SHA1->read (fingerprint_context), 20);
 
       *last = sk;
@@ -370,6 +607,8 @@ grub_load_public_key (grub_file_t f)
 
 struct grub_public_key *grub_pk_trusted;
 
+static int sec = 0;
+
 struct grub_public_subkey *
 grub_crypto_pk_locate_subkey (grub_uint64_t keyid, struct grub_public_key *pkey)
 {
@@ -394,6 +633,29 @@ grub_crypto_pk_locate_subkey_in_trustdb (grub_uint64_t keyid)
   return 0;
 }
 
+/* Find a trusted RSA key by its modulus and exponent, for keys that don't
+   come with an OpenPGP key ID.  */
+struct grub_public_subkey *
+grub_crypto_pk_locate_rsa_in_trustdb (gcry_mpi_t n, gcry_mpi_t e)
+{
+  struct grub_public_key *pkey;
+  struct grub_public_subkey *sk;
+  for (pkey = grub_pk_trusted; pkey; pkey = pkey->next)
+    for (sk = pkey->subkeys; sk; sk = sk->next)
+      if (sk->type < ARRAY_SIZE (pkalgos)
+	  && pkalgos[sk->type].algo == &grub_crypto_pk_rsa
+	  && gcry_mpi_cmp (sk->mpis[0], n) == 0
+	  && gcry_mpi_cmp (sk->mpis[1], e) == 0)
+	return sk;
+  return 0;
+}
+
+int
+grub_verify_enforced (void)
+{
+  return sec;
+}
+
 
 static int
 dsa_pad (gcry_mpi_t *hmpi, grub_uint8_t *hval,
@@ -407,22 +669,20 @@ dsa_pad (gcry_mpi_t *hmpi, grub_uint8_t *hval,
 			: (unsigned) hash->mdlen, 0);
 }
 
-static int
-rsa_pad (gcry_mpi_t *hmpi, grub_uint8_t *hval,
-	 const gcry_md_spec_t *hash, struct grub_public_subkey *sk)
+/* Build the EMSA-PKCS1-v1_5 encoding of HVAL, EMLEN bytes long.  */
+static grub_uint8_t *
+rsa_encode (grub_uint8_t *hval, const gcry_md_spec_t *hash, grub_size_t emlen)
 {
-  grub_size_t tlen, emlen, fflen;
+  grub_size_t tlen, fflen;
   grub_uint8_t *em, *emptr;
-  unsigned nbits = gcry_mpi_get_nbits (sk->mpis[0]);
-  int ret;
+
   tlen = hash->mdlen + hash->asnlen;
-  emlen = (nbits + 7) / 8;
   if (emlen < tlen + 11)
-    return 1;
+    return NULL;
 
   em = grub_malloc (emlen);
   if (!em)
-    return 1;
+    return NULL;
 
   em[0] = 0x00;
   em[1] = 0x01;
@@ -433,6 +693,22 @@ rsa_pad (gcry_mpi_t *hmpi, grub_uint8_t *hval,
   grub_memcpy (emptr, hash->asnoid, hash->asnlen);
   emptr += hash->asnlen;
   grub_memcpy (emptr, hval, hash->mdlen);
+  return em;
+}
+
+static int
+rsa_pad (gcry_mpi_t *hmpi, grub_uint8_t *hval,
+	 const gcry_md_spec_t *hash, struct grub_public_subkey *sk)
+{
+  grub_size_t emlen;
+  grub_uint8_t *em;
+  unsigned nbits = gcry_mpi_get_nbits (sk->mpis[0]);
+  int ret;
+
+  emlen = (nbits + 7) / 8;
+  em = rsa_encode (hval, hash, emlen);
+  if (!em)
+    return 1;
 
   ret = gcry_mpi_scan (hmpi, GCRYMPI_FMT_USG, em, emlen, 0);
   grub_free (em);
@@ -511,7 +787,31 @@ grub_verify_signature_real (char *buf, grub_size_t size,
       goto fail;
 
     hash->init (context);
-    if (buf)
+    if (buf && f)
+      {
+	grub_size_t done;
+
+	/* Hash each chunk right after it lands in BUF, while it is still
+	   in the cache, rather than going over the whole file again once
+	   it is in.  */
+	for (done = 0; done < size; done += r)
+	  {
+	    grub_size_t chunk = size - done;
+
+	    if (chunk > VERIFY_CHUNK_SIZE)
+	      chunk = VERIFY_CHUNK_SIZE;
+	    r = grub_file_read (f, buf + done, chunk);
+	    if (r <= 0)
+	      {
+		if (!grub_errno)
+		  grub_error (GRUB_ERR_FILE_READ_ERROR,
+			      N_("premature end of file %s"), f->name);
+		goto fail;
+	      }
+	    hash->write (context, buf + done, r);
+	  }
+      }
+    else if (buf)
       hash->write (context, buf, size);
     else 
       while (1)
@@ -626,6 +926,22 @@ grub_verify_signature_real (char *buf, grub_size_t size,
 	goto fail;
       }
 
+    if (sk->mont && pkalgos[pk].algo == &grub_crypto_pk_rsa)
+      {
+	grub_size_t emlen = (sk->mont->nbits + 7) / 8;
+	grub_uint8_t *em;
+	int bad;
+
+	em = rsa_encode (hval, hash, emlen);
+	if (!em)
+	  goto fail;
+	bad = rsa_mont_verify (sk->mont, mpis[0], em, emlen);
+	grub_free (em);
+	if (bad)
+	  goto fail;
+	goto done;
+      }
+
     if (pkalgos[pk].pad (&hmpi, hval, hash, sk))
       goto fail;
     if (!*pkalgos[pk].algo)
@@ -643,6 +959,7 @@ grub_verify_signature_real (char *buf, grub_size_t size,
     if ((*pkalgos[pk].algo)->verify (0, hmpi, mpis, sk->mpis, 0, 0))
       goto fail;
 
+  done:
     grub_free (context);
     grub_free (readbuf);
 
@@ -664,6 +981,298 @@ grub_verify_signature (grub_file_t f, grub_file_t sig,
   return grub_verify_signature_real (0, 0, f, sig, pkey);
 }
 
+/* Files listed in a signed manifest are checked against their SHA-256
+   digest there instead of a signature of their own.  Entries are keyed by
+   the file name with the device spelled out.  */
+
+#define MANIFEST_BUCKETS 256
+#define MANIFEST_MAX_SIZE (16 * 1024 * 1024)
+
+struct manifest_entry
+{
+  struct manifest_entry *next;
+  grub_uint8_t digest[32];
+  char name[0];
+};
+
+static struct manifest_entry *manifest[MANIFEST_BUCKETS];
+
+static unsigned
+manifest_bucket (const char *name)
+{
+  grub_uint32_t h = 5381;
+
+  while (*name)
+    h = h * 33 + (grub_uint8_t) *name++;
+  return h % MANIFEST_BUCKETS;
+}
+
+static int
+hextoval (char c)
+{
+  if (c >= '0' && c <= '9')
+    return c - '0';
+  if (c >= 'a' && c <= 'f')
+    return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F')
+    return c - 'A' + 10;
+  return -1;
+}
+
+/* Spell out the device of FILENAME, relative to DEVICE or $root.  */
+static char *
+manifest_key (const char *filename, const char *device)
+{
+  if (filename[0] == '(')
+    return grub_strdup (filename);
+  if (!device)
+    device = grub_env_get ("root");
+  return grub_xasprintf ("(%s)%s", device ? : "", filename);
+}
+
+static const struct manifest_entry *
+manifest_lookup (const char *filename)
+{
+  struct manifest_entry *entry;
+  char *key;
+
+  key = manifest_key (filename, NULL);
+  if (!key)
+    {
+      grub_errno = GRUB_ERR_NONE;
+      return NULL;
+    }
+  for (entry = manifest[manifest_bucket (key)]; entry; entry = entry->next)
+    if (grub_strcmp (entry->name, key) == 0)
+      break;
+  grub_free (key);
+  return entry;
+}
+
+/* Read F into BUF, hashing it as it comes in, and compare it with what
+   the manifest says.  */
+static grub_err_t
+verify_manifest_entry (char *buf, grub_size_t size, grub_file_t f,
+		       const struct manifest_entry *entry)
+{
+  const gcry_md_spec_t *hash;
+  grub_size_t done, chunk;
+  grub_ssize_t r;
+  void *context;
+  int bad;
+
+  if (grub_crypto_autoload_hook)
+    grub_crypto_autoload_hook ("sha256");
+  hash = grub_crypto_lookup_md_by_name ("sha256");
+  if (!hash)
+    return grub_error (GRUB_ERR_BAD_SIGNATURE, "hash `%s' not loaded",
+		       "sha256");
+
+  context = grub_zalloc (hash->contextsize);
+  if (!context)
+    return grub_errno;
+
+  hash->init (context);
+  for (done = 0; done < size; done += r)
+    {
+      chunk = size - done;
+      if (chunk > VERIFY_CHUNK_SIZE)
+	chunk = VERIFY_CHUNK_SIZE;
+      r = grub_file_read (f, buf + done, chunk);
+      if (r <= 0)
+	{
+	  grub_free (context);
+	  if (!grub_errno)
+	    grub_error (GRUB_ERR_FILE_READ_ERROR,
+			N_("premature end of file %s"), f->name);
+	  return grub_errno;
+	}
+      hash->write (context, buf + done, r);
+    }
+  hash->final (context);
+  bad = grub_crypto_memcmp (hash->read (context), entry->digest,
+			    sizeof (entry->digest));
+  grub_free (context);
+
+  if (bad)
+    return grub_error (GRUB_ERR_BAD_SIGNATURE,
+		       N_("hash of `%s' doesn't match the manifest"),
+		       entry->name);
+  return GRUB_ERR_NONE;
+}
+
+/* Parse the sha256sum-style list in BUF.  Names are relative to DEVICE
+   unless they give one.  Nothing is added unless the whole list is
+   good.  */
+static grub_err_t
+manifest_parse (char *buf, const char *device)
+{
+  struct manifest_entry *entries = NULL, *entry;
+  grub_uint8_t digest[sizeof (entry->digest)];
+  char *line, *eol, *key;
+  unsigned i;
+
+  for (line = buf; *line; line = eol)
+    {
+      eol = grub_strchr (line, '\n');
+      if (eol)
+	*eol++ = '\0';
+      else
+	eol = line + grub_strlen (line);
+      while (grub_isspace (*line))
+	line++;
+      if (!*line)
+	continue;
+      if (line[grub_strlen (line) - 1] == '\r')
+	line[grub_strlen (line) - 1] = '\0';
+
+      for (i = 0; i < sizeof (digest); i++)
+	{
+	  int high, low;
+	  high = hextoval (*line++);
+	  low = hextoval (*line++);
+	  if (high < 0 || low < 0)
+	    goto bad;
+	  digest[i] = (high << 4) | low;
+	}
+      if ((line[0] != ' ' && line[0] != '\t')
+	  || (line[1] != ' ' && line[1] != '\t'))
+	goto bad;
+      line += 2;
+      if (line[0] != '(' && line[0] != '/')
+	goto bad;
+
+      key = manifest_key (line, device);
+      if (!key)
+	goto fail;
+      entry = grub_malloc (sizeof (*entry) + grub_strlen (key) + 1);
+      if (!entry)
+	{
+	  grub_free (key);
+	  goto fail;
+	}
+      grub_memcpy (entry->digest, digest, sizeof (digest));
+      grub_strcpy (entry->name, key);
+      grub_free (key);
+      entry->next = entries;
+      entries = entry;
+    }
+
+  /* Later lists take precedence.  */
+  while (entries)
+    {
+      unsigned bucket = manifest_bucket (entries->name);
+
+      entry = entries;
+      entries = entry->next;
+      entry->next = manifest[bucket];
+      manifest[bucket] = entry;
+    }
+  return GRUB_ERR_NONE;
+
+ bad:
+  grub_error (GRUB_ERR_BAD_FILE_TYPE, "invalid manifest");
+ fail:
+  while (entries)
+    {
+      entry = entries;
+      entries = entry->next;
+      grub_free (entry);
+    }
+  return grub_errno;
+}
+
+static void
+manifest_free (void)
+{
+  struct manifest_entry *entry;
+  unsigned i;
+
+  for (i = 0; i < MANIFEST_BUCKETS; i++)
+    while (manifest[i])
+      {
+	entry = manifest[i];
+	manifest[i] = entry->next;
+	grub_free (entry);
+      }
+}
+
+static grub_err_t
+grub_cmd_trust_manifest (grub_command_t cmd __attribute__ ((unused)),
+			 int argc, char **args)
+{
+  grub_file_t mf = NULL, sig = NULL;
+  char *buf = NULL, *signame = NULL, *device = NULL;
+  grub_size_t size;
+  grub_err_t err;
+
+  if (argc < 1)
+    return grub_error (GRUB_ERR_BAD_ARGUMENT, N_("one argument expected"));
+
+  if (argc > 1)
+    signame = grub_strdup (args[1]);
+  else
+    signame = grub_xasprintf ("%s.sig", args[0]);
+  if (!signame)
+    return grub_errno;
+
+  /* The manifest is checked against the trusted keys whether signatures
+     are enforced or not.  */
+  grub_file_filter_disable_all ();
+  mf = grub_file_open (args[0]);
+  if (!mf)
+    {
+      err = grub_errno;
+      goto fail;
+    }
+  if (mf->size > MANIFEST_MAX_SIZE)
+    {
+      err = grub_error (GRUB_ERR_OUT_OF_RANGE, "manifest is too big");
+      goto fail;
+    }
+  size = mf->size;
+  buf = grub_malloc (size + 1);
+  if (!buf)
+    {
+      err = grub_errno;
+      goto fail;
+    }
+  if (grub_file_read (mf, buf, size) != (grub_ssize_t) size)
+    {
+      if (!grub_errno)
+	grub_error (GRUB_ERR_FILE_READ_ERROR, N_("premature end of file %s"),
+		    args[0]);
+      err = grub_errno;
+      goto fail;
+    }
+  buf[size] = '\0';
+
+  grub_file_filter_disable_all ();
+  sig = grub_file_open (signame);
+  if (!sig)
+    {
+      err = grub_errno;
+      goto fail;
+    }
+  err = grub_verify_signature_real (buf, size, NULL, sig, NULL);
+  if (err)
+    goto fail;
+
+  device = grub_file_get_device_name (args[0]);
+  grub_errno = GRUB_ERR_NONE;
+  err = manifest_parse (buf, device);
+
+ fail:
+  if (sig)
+    grub_file_close (sig);
+  if (mf)
+    grub_file_close (mf);
+  grub_free (device);
+  grub_free (buf);
+  grub_free (signame);
+  return err;
+}
+
 static grub_err_t
 grub_cmd_trust (grub_extcmd_context_t ctxt,
 		int argc, char **args)
@@ -807,7 +1416,6 @@ grub_cmd_verify_signature (grub_extcmd_context_t ctxt,
   return err;
 }
 
-static int sec = 0;
 
 static void
 verified_free (grub_verified_t verified)
@@ -854,12 +1462,13 @@ struct grub_fs verified_fs =
 static grub_file_t
 grub_pubkey_open (grub_file_t io, const char *filename)
 {
-  grub_file_t sig;
+  grub_file_t sig = NULL;
   char *fsuf, *ptr;
   grub_err_t err;
   grub_file_filter_t curfilt[GRUB_FILE_FILTER_MAX];
-  grub_file_t ret;
+  grub_file_t ret = NULL;
   grub_verified_t verified;
+  const struct manifest_entry *entry;
 
   if (!sec)
     return io;
@@ -867,28 +1476,29 @@ grub_pubkey_open (grub_file_t io, const char *filename)
       (io->device->disk->dev->id == GRUB_DISK_DEVICE_MEMDISK_ID
        || io->device->disk->dev->id == GRUB_DISK_DEVICE_PROCFS_ID))
     return io;
-  fsuf = grub_malloc (grub_strlen (filename) + sizeof (".sig"));
-  if (!fsuf)
-    return NULL;
-  ptr = grub_stpcpy (fsuf, filename);
-  grub_memcpy (ptr, ".sig", sizeof (".sig"));
-
-  grub_memcpy (curfilt, grub_file_filters_enabled,
-	       sizeof (curfilt));
-  grub_file_filter_disable_all ();
-  sig = grub_file_open (fsuf);
-  grub_memcpy (grub_file_filters_enabled, curfilt,
-	       sizeof (curfilt));
-  grub_free (fsuf);
-  if (!sig)
-    return NULL;
+  entry = manifest_lookup (filename);
+  if (!entry)
+    {
+      fsuf = grub_malloc (grub_strlen (filename) + sizeof (".sig"));
+      if (!fsuf)
+	return NULL;
+      ptr = grub_stpcpy (fsuf, filename);
+      grub_memcpy (ptr, ".sig", sizeof (".sig"));
+
+      grub_memcpy (curfilt, grub_file_filters_enabled,
+		   sizeof (curfilt));
+      grub_file_filter_disable_all ();
+      sig = grub_file_open (fsuf);
+      grub_memcpy (grub_file_filters_enabled, curfilt,
+		   sizeof (curfilt));
+      grub_free (fsuf);
+      if (!sig)
+	return NULL;
+    }
 
   ret = grub_malloc (sizeof (*ret));
   if (!ret)
-    {
-      grub_file_close (sig);
-      return NULL;
-    }
+    goto fail;
   *ret = *io;
 
   ret->fs = &verified_fs;
@@ -897,38 +1507,28 @@ grub_pubkey_open (grub_file_t io, const char *filename)
     {
       grub_error (GRUB_ERR_NOT_IMPLEMENTED_YET,
 		  "big file signature isn't implemented yet");
-      grub_file_close (sig);
-      grub_free (ret);
-      return NULL;
+      goto fail;
     }
   verified = grub_malloc (sizeof (*verified));
   if (!verified)
-    {
-      grub_file_close (sig);
-      grub_free (ret);
-      return NULL;
-    }
+    goto fail;
   verified->buf = grub_malloc (ret->size);
   if (!verified->buf)
     {
-      grub_file_close (sig);
       grub_free (verified);
-      grub_free (ret);
-      return NULL;
+      goto fail;
     }
-  if (grub_file_read (io, verified->buf, ret->size) != (grub_ssize_t) ret->size)
+
+  /* Read the file in while it is being hashed.  Nothing is handed out
+     before the signature checks, so it still has to go through BUF.  */
+  if (entry)
+    err = verify_manifest_entry (verified->buf, ret->size, io, entry);
+  else
     {
-      if (!grub_errno)
-	grub_error (GRUB_ERR_FILE_READ_ERROR, N_("premature end of file %s"),
-		    filename);
+      err = grub_verify_signature_real (verified->buf, ret->size, io, sig,
+					NULL);
       grub_file_close (sig);
-      verified_free (verified);
-      grub_free (ret);
-      return NULL;
     }
-
-  err = grub_verify_signature_real (verified->buf, ret->size, 0, sig, NULL);
-  grub_file_close (sig);
   if (err)
     {
       verified_free (verified);
@@ -938,6 +1538,12 @@ grub_pubkey_open (grub_file_t io, const char *filename)
   verified->file = io;
   ret->data = verified;
   return ret;
+
+ fail:
+  if (sig)
+    grub_file_close (sig);
+  grub_free (ret);
+  return NULL;
 }
 
 static char *
@@ -965,7 +1571,7 @@ struct grub_fs pseudo_fs =
 
 
 static grub_extcmd_t cmd, cmd_trust;
-static grub_command_t cmd_distrust, cmd_list;
+static grub_command_t cmd_distrust, cmd_list, cmd_trust_manifest;
 
 GRUB_MOD_INIT(verify)
 {
@@ -1024,6 +1630,11 @@ GRUB_MOD_INIT(verify)
   cmd_distrust = grub_register_command ("distrust", grub_cmd_distrust,
 					N_("PUBKEY_ID"),
 					N_("Remove PUBKEY_ID from trusted keys."));
+  cmd_trust_manifest = grub_register_command ("trust_manifest",
+					      grub_cmd_trust_manifest,
+					      N_("MANIFEST_FILE [SIGNATURE_FILE]"),
+					      N_("Trust the files listed in a "
+						 "signed MANIFEST_FILE."));
 }
 
 GRUB_MOD_FINI(verify)
@@ -1033,4 +1644,6 @@ GRUB_MOD_FINI(verify)
   grub_unregister_extcmd (cmd_trust);
   grub_unregister_command (cmd_list);
   grub_unregister_command (cmd_distrust);
+  grub_unregister_command (cmd_trust_manifest);
+  manifest_free ();
 }
@@ -22,15 +22,15 @@
 #include <grub/env.h>
 #include <grub/file.h>
 #include <grub/device.h>
+#include <grub/disk.h>
 #include <grub/script_sh.h>
-
-#include <regex.h>
+#include <grub/regexp.h>
 
 static inline int isregexop (char ch);
 static char ** merge (char **lhs, char **rhs);
 static char *make_dir (const char *prefix, const char *start, const char *end);
 static int make_regex (const char *regex_start, const char *regex_end,
-		       regex_t *regexp);
+		       const regex_t **regexp);
 static void split_path (const char *path, const char **suffix_end, const char **regex_end);
 static char ** match_devices (const regex_t *regexp, int noparts);
 static char ** match_files (const char *prefix, const char *suffix_start,
@@ -38,8 +38,13 @@ static char ** match_files (const char *prefix, const char *suffix_start,
 
 static grub_err_t wildcard_expand (const char *s, char ***strs);
 
+static void listing_begin (void);
+static void listing_end (void);
+
 struct grub_script_wildcard_translator grub_filename_translator = {
   .expand = wildcard_expand,
+  .begin = listing_begin,
+  .end = listing_end,
 };
 
 static char **
@@ -110,9 +115,10 @@ make_dir (const char *prefix, const char *start, const char *end)
 }
 
 static int
-make_regex (const char *start, const char *end, regex_t *regexp)
+make_regex (const char *start, const char *end, const regex_t **regexp)
 {
   char ch;
+  int err;
   int i = 0;
   unsigned len = end - start;
   char *buffer = grub_malloc (len * 2 + 2 + 1); /* worst case size. */
@@ -163,7 +169,8 @@ make_regex (const char *start, const char *end, regex_t *regexp)
   buffer[i] = '\0';
   grub_dprintf ("expand", "Regexp is %s\n", buffer);
 
-  if (regcomp (regexp, buffer, RE_SYNTAX_GNU_AWK))
+  *regexp = grub_regexp_compile (buffer, RE_SYNTAX_GNU_AWK, &err);
+  if (! *regexp)
     {
       grub_free (buffer);
       return 1;
@@ -210,256 +217,372 @@ split_path (const char *str, const char **noregexop, const char **regexop)
     *noregexop = split;
 }
 
-/* Context for match_devices.  */
-struct match_devices_ctx
+/* Directory listings and the device list, kept while a script runs so
+   that a glob in a loop body or repeated across menu entries reads each
+   directory only once.  Outside scripts they only live for one
+   expansion.  */
+#define LISTING_CACHE_SIZE 32
+
+struct listing
 {
-  const regex_t *regexp;
-  int noparts;
-  int ndev;
-  char **devs;
+  struct listing *next;
+  /* Device and path of the directory, both NULL for the device list.  */
+  char *device;
+  char *path;
+  /* Reading the directory failed, NAMES holds what was read before.  */
+  int failed;
+  grub_size_t count;
+  grub_size_t alloc;
+  char **names;
+  grub_uint8_t *case_insensitive;
 };
 
-/* Helper for match_devices.  */
-static int
-match_devices_iter (const char *name, void *data)
-{
-  struct match_devices_ctx *ctx = data;
-  char **t;
-  char *buffer;
+/* Most recently used first.  */
+static struct listing *listing_cache;
+static unsigned long listing_generation;
+static int listing_keep;
 
-  /* skip partitions if asked to. */
-  if (ctx->noparts && grub_strchr (name, ','))
-    return 0;
+static void
+listing_free (struct listing *l)
+{
+  grub_size_t i;
+
+  for (i = 0; i < l->count; i++)
+    grub_free (l->names[i]);
+  grub_free (l->names);
+  grub_free (l->case_insensitive);
+  grub_free (l->device);
+  grub_free (l->path);
+  grub_free (l);
+}
 
-  buffer = grub_xasprintf ("(%s)", name);
-  if (! buffer)
-    return 1;
+static void
+listing_flush (void)
+{
+  struct listing *l, *next;
 
-  grub_dprintf ("expand", "matching: %s\n", buffer);
-  if (regexec (ctx->regexp, buffer, 0, 0, 0))
+  for (l = listing_cache; l; l = next)
     {
-      grub_dprintf ("expand", "not matched\n");
-      grub_free (buffer);
-      return 0;
+      next = l->next;
+      listing_free (l);
     }
+  listing_cache = 0;
+}
 
-  t = grub_realloc (ctx->devs, sizeof (char*) * (ctx->ndev + 2));
-  if (! t)
+static void
+listing_begin (void)
+{
+  listing_flush ();
+  listing_keep = 1;
+}
+
+static void
+listing_end (void)
+{
+  listing_keep = 0;
+  listing_flush ();
+}
+
+static int
+listing_add (struct listing *l, const char *name, int case_insensitive)
+{
+  if (l->count == l->alloc)
     {
-      grub_free (buffer);
-      return 1;
+      grub_size_t alloc = l->alloc ? l->alloc * 2 : 16;
+      char **names;
+      grub_uint8_t *ci;
+
+      names = grub_realloc (l->names, alloc * sizeof (names[0]));
+      if (! names)
+	return 1;
+      l->names = names;
+      ci = grub_realloc (l->case_insensitive, alloc);
+      if (! ci)
+	return 1;
+      l->case_insensitive = ci;
+      l->alloc = alloc;
     }
 
-  ctx->devs = t;
-  ctx->devs[ctx->ndev++] = buffer;
-  ctx->devs[ctx->ndev] = 0;
+  l->names[l->count] = grub_strdup (name);
+  if (! l->names[l->count])
+    return 1;
+  l->case_insensitive[l->count++] = !! case_insensitive;
   return 0;
 }
 
-static char **
-match_devices (const regex_t *regexp, int noparts)
+static int
+listing_device_iter (const char *name, void *data)
 {
-  struct match_devices_ctx ctx = {
-    .regexp = regexp,
-    .noparts = noparts,
-    .ndev = 0,
-    .devs = 0
-  };
-  int i;
+  return listing_add (data, name, 0);
+}
 
-  if (grub_device_iterate (match_devices_iter, &ctx))
-    goto fail;
+static int
+listing_dir_iter (const char *name, const struct grub_dirhook_info *info,
+		  void *data)
+{
+  return listing_add (data, name, info->case_insensitive);
+}
 
-  return ctx.devs;
+static int
+key_equal (const char *a, const char *b)
+{
+  if (! a || ! b)
+    return a == b;
+  return grub_strcmp (a, b) == 0;
+}
 
- fail:
+/* Return the listing of PATH on DEVICE, or the device list if both are
+   NULL, reading it unless it is cached.  */
+static struct listing *
+listing_get (const char *device, const char *path)
+{
+  struct listing *l, **prev;
+  unsigned n = 0;
+  grub_device_t dev;
+  grub_fs_t fs;
+
+  /* Devices may have come or gone, and loopbacks been remapped.  */
+  if (listing_generation != grub_disk_generation)
+    {
+      listing_flush ();
+      listing_generation = grub_disk_generation;
+    }
+
+  for (prev = &listing_cache; (l = *prev); prev = &l->next, n++)
+    if (key_equal (l->device, device) && key_equal (l->path, path))
+      {
+	*prev = l->next;
+	l->next = listing_cache;
+	listing_cache = l;
+	return l;
+      }
+
+  l = grub_zalloc (sizeof (*l));
+  if (! l)
+    return 0;
+  if (device)
+    {
+      l->device = grub_strdup (device);
+      l->path = grub_strdup (path);
+      if (! l->device || ! l->path)
+	goto fail;
+
+      dev = grub_device_open (device[0] ? device : 0);
+      if (! dev)
+	l->failed = 1;
+      else
+	{
+	  fs = grub_fs_probe (dev);
+	  if (! fs || fs->dir (dev, path, listing_dir_iter, l))
+	    l->failed = 1;
+	  grub_device_close (dev);
+	}
+      if (l->failed && grub_errno == GRUB_ERR_OUT_OF_MEMORY)
+	goto fail;
+      grub_errno = GRUB_ERR_NONE;
+    }
+  else if (grub_device_iterate (listing_device_iter, l))
+    goto fail;
 
-  for (i = 0; ctx.devs && ctx.devs[i]; i++)
-    grub_free (ctx.devs[i]);
+  /* Drop the least recently used listing if the cache is full.  */
+  if (n >= LISTING_CACHE_SIZE)
+    {
+      for (prev = &listing_cache; (*prev)->next; prev = &(*prev)->next)
+	;
+      listing_free (*prev);
+      *prev = 0;
+    }
 
-  grub_free (ctx.devs);
+  l->next = listing_cache;
+  listing_cache = l;
+  return l;
 
+ fail:
+  listing_free (l);
   return 0;
 }
 
-/* Context for match_files.  */
-struct match_files_ctx
+/* Return the listing of directory DIR, which may start with a device.  */
+static struct listing *
+listing_get_dir (const char *dir)
 {
-  const regex_t *regexp;
-  char **files;
-  unsigned nfile;
-  char *dir;
-};
-
-/* Helper for match_files.  */
-static int
-match_files_iter (const char *name,
-		  const struct grub_dirhook_info *info __attribute__((unused)),
-		  void *data)
-{
-  struct match_files_ctx *ctx = data;
-  char **t;
-  char *buffer;
+  struct listing *l;
+  const char *device, *path;
+  char *device_name;
 
-  /* skip . and .. names */
-  if (grub_strcmp(".", name) == 0 || grub_strcmp("..", name) == 0)
+  device_name = grub_file_get_device_name (dir);
+  if (grub_errno)
     return 0;
 
-  grub_dprintf ("expand", "matching: %s in %s\n", name, ctx->dir);
-  if (regexec (ctx->regexp, name, 0, 0, 0))
-    return 0;
+  if (dir[0] == '(')
+    {
+      path = grub_strchr (dir, ')');
+      if (! path)
+	{
+	  grub_free (device_name);
+	  return 0;
+	}
+      path++;
+    }
+  else
+    path = dir;
 
-  grub_dprintf ("expand", "matched\n");
+  /* Without a device the path is on $root, which scripts change.  */
+  device = device_name ? device_name : grub_env_get ("root");
+  l = listing_get (device ? device : "", path[0] ? path : "/");
+  grub_free (device_name);
+  return l;
+}
 
-  buffer = grub_xasprintf ("%s%s", ctx->dir, name);
-  if (! buffer)
+static int
+append (char ***list, unsigned *n, char *s)
+{
+  char **t;
+
+  if (! s)
     return 1;
 
-  t = grub_realloc (ctx->files, sizeof (char*) * (ctx->nfile + 2));
+  t = grub_realloc (*list, sizeof (char*) * (*n + 2));
   if (! t)
     {
-      grub_free (buffer);
+      grub_free (s);
       return 1;
     }
 
-  ctx->files = t;
-  ctx->files[ctx->nfile++] = buffer;
-  ctx->files[ctx->nfile] = 0;
+  *list = t;
+  t[(*n)++] = s;
+  t[*n] = 0;
   return 0;
 }
 
-static char **
-match_files (const char *prefix, const char *suffix, const char *end,
-	     const regex_t *regexp)
+static void
+free_list (char **list)
 {
-  struct match_files_ctx ctx = {
-    .regexp = regexp,
-    .nfile = 0,
-    .files = 0
-  };
   int i;
-  const char *path;
-  char *device_name;
-  grub_fs_t fs;
-  grub_device_t dev;
 
-  dev = 0;
-  device_name = 0;
-  grub_error_push ();
+  for (i = 0; list && list[i]; i++)
+    grub_free (list[i]);
 
-  ctx.dir = make_dir (prefix, suffix, end);
-  if (! ctx.dir)
-    goto fail;
+  grub_free (list);
+}
 
-  device_name = grub_file_get_device_name (ctx.dir);
-  dev = grub_device_open (device_name);
-  if (! dev)
-    goto fail;
+static char **
+match_devices (const regex_t *regexp, int noparts)
+{
+  struct listing *l;
+  char **devs = 0;
+  unsigned ndev = 0;
+  grub_size_t i;
 
-  fs = grub_fs_probe (dev);
-  if (! fs)
-    goto fail;
+  l = listing_get (0, 0);
+  if (! l)
+    return 0;
 
-  if (ctx.dir[0] == '(')
+  for (i = 0; i < l->count; i++)
     {
-      path = grub_strchr (ctx.dir, ')');
-      if (!path)
+      char *buffer;
+
+      /* skip partitions if asked to. */
+      if (noparts && grub_strchr (l->names[i], ','))
+	continue;
+
+      buffer = grub_xasprintf ("(%s)", l->names[i]);
+      if (! buffer)
 	goto fail;
-      path++;
-    }
-  else
-    path = ctx.dir;
 
-  if (fs->dir (dev, path, match_files_iter, &ctx))
-    goto fail;
+      grub_dprintf ("expand", "matching: %s\n", buffer);
+      if (regexec (regexp, buffer, 0, 0, 0))
+	{
+	  grub_dprintf ("expand", "not matched\n");
+	  grub_free (buffer);
+	  continue;
+	}
 
-  grub_free (ctx.dir);
-  grub_device_close (dev);
-  grub_free (device_name);
-  grub_error_pop ();
-  return ctx.files;
+      if (append (&devs, &ndev, buffer))
+	goto fail;
+    }
+
+  return devs;
 
  fail:
+  free_list (devs);
+  return 0;
+}
 
-  grub_free (ctx.dir);
+static char **
+match_files (const char *prefix, const char *suffix, const char *end,
+	     const regex_t *regexp)
+{
+  struct listing *l;
+  char **files = 0;
+  unsigned nfile = 0;
+  grub_size_t i;
+  char *dir;
 
-  for (i = 0; ctx.files && ctx.files[i]; i++)
-    grub_free (ctx.files[i]);
+  grub_error_push ();
 
-  grub_free (ctx.files);
+  dir = make_dir (prefix, suffix, end);
+  if (! dir)
+    goto fail;
 
-  if (dev)
-    grub_device_close (dev);
+  l = listing_get_dir (dir);
+  if (! l || l->failed)
+    goto fail;
 
-  grub_free (device_name);
+  for (i = 0; i < l->count; i++)
+    {
+      const char *name = l->names[i];
 
-  grub_error_pop ();
-  return 0;
-}
+      /* skip . and .. names */
+      if (grub_strcmp(".", name) == 0 || grub_strcmp("..", name) == 0)
+	continue;
 
-/* Context for check_file.  */
-struct check_file_ctx
-{
-  const char *basename;
-  int found;
-};
+      grub_dprintf ("expand", "matching: %s in %s\n", name, dir);
+      if (regexec (regexp, name, 0, 0, 0))
+	continue;
 
-/* Helper for check_file.  */
-static int
-check_file_iter (const char *name, const struct grub_dirhook_info *info,
-		 void *data)
-{
-  struct check_file_ctx *ctx = data;
+      grub_dprintf ("expand", "matched\n");
 
-  if (ctx->basename[0] == 0
-      || (info->case_insensitive ? grub_strcasecmp (name, ctx->basename) == 0
-	  : grub_strcmp (name, ctx->basename) == 0))
-    {
-      ctx->found = 1;
-      return 1;
+      if (append (&files, &nfile, grub_xasprintf ("%s%s", dir, name)))
+	goto fail;
     }
-  
+
+  grub_free (dir);
+  grub_error_pop ();
+  return files;
+
+ fail:
+
+  grub_free (dir);
+  free_list (files);
+
+  grub_error_pop ();
   return 0;
 }
 
 static int
 check_file (const char *dir, const char *basename)
 {
-  struct check_file_ctx ctx = {
-    .basename = basename,
-    .found = 0
-  };
-  grub_fs_t fs;
-  grub_device_t dev;
-  const char *device_name, *path;
-
-  device_name = grub_file_get_device_name (dir);
-  dev = grub_device_open (device_name);
-  if (! dev)
-    goto fail;
+  struct listing *l;
+  grub_size_t i;
+  int found = 0;
 
-  fs = grub_fs_probe (dev);
-  if (! fs)
+  l = listing_get_dir (dir);
+  if (! l)
     goto fail;
 
-  if (dir[0] == '(')
-    {
-      path = grub_strchr (dir, ')');
-      if (!path)
-	goto fail;
-      path++;
-    }
-  else
-    path = dir;
+  if (basename[0] == 0)
+    found = ! l->failed;
 
-  fs->dir (dev, path[0] ? path : "/", check_file_iter, &ctx);
-  if (grub_errno == 0 && basename[0] == 0)
-    ctx.found = 1;
+  for (i = 0; ! found && i < l->count; i++)
+    if (l->case_insensitive[i] ? grub_strcasecmp (l->names[i], basename) == 0
+	: grub_strcmp (l->names[i], basename) == 0)
+      found = 1;
 
  fail:
   grub_errno = 0;
 
-  return ctx.found;
+  return found;
 }
 
 static void
@@ -493,7 +616,7 @@ wildcard_expand (const char *s, char ***strs)
   int had_regexp = 0;
 
   unsigned i;
-  regex_t regexp;
+  const regex_t *regexp;
 
   *strs = 0;
   if (s[0] != '/' && s[0] != '(' && s[0] != '*')
@@ -570,6 +693,8 @@ wildcard_expand (const char *s, char ***strs)
 	  continue;
 	}
 
+      /* REGEXP belongs to the cache, so it is only good until the next
+	 make_regex.  */
       if (make_regex (noregexop, regexop, &regexp))
 	goto fail;
 
@@ -578,10 +703,10 @@ wildcard_expand (const char *s, char ***strs)
       if (paths == 0)
 	{
 	  if (start == noregexop) /* device part has regexop */
-	    paths = match_devices (&regexp, *start != '(');
+	    paths = match_devices (regexp, *start != '(');
 
 	  else  /* device part explicit wo regexop */
-	    paths = match_files ("", start, noregexop, &regexp);
+	    paths = match_files ("", start, noregexop, regexp);
 	}
       else
 	{
@@ -591,7 +716,7 @@ wildcard_expand (const char *s, char ***strs)
 	    {
 	      char **p;
 
-	      p = match_files (paths[i], start, noregexop, &regexp);
+	      p = match_files (paths[i], start, noregexop, regexp);
 	      grub_free (paths[i]);
 	      if (! p)
 		continue;
@@ -604,7 +729,6 @@ wildcard_expand (const char *s, char ***strs)
 	  paths = r;
 	}
 
-      regfree (&regexp);
       if (! paths)
 	goto done;
 
@@ -613,14 +737,17 @@ wildcard_expand (const char *s, char ***strs)
 
  done:
 
+  if (! listing_keep)
+    listing_flush ();
   *strs = paths;
   return 0;
 
  fail:
 
+  if (! listing_keep)
+    listing_flush ();
   for (i = 0; paths && paths[i]; i++)
     grub_free (paths[i]);
   grub_free (paths);
-  regfree (&regexp);
   return grub_errno;
 }
@@ -101,7 +101,15 @@ struct grub_ahci_received_fis
 
 enum
   {
-    GRUB_AHCI_HBA_CAP_NPORTS_MASK = 0x1f
+    GRUB_AHCI_HBA_CAP_NPORTS_MASK = 0x1f,
+    GRUB_AHCI_HBA_CAP_NCS_SHIFT = 8,
+    GRUB_AHCI_HBA_CAP_NCS_MASK = 0x1f00,
+    GRUB_AHCI_HBA_CAP_SNCQ = 0x40000000
+  };
+
+enum
+  {
+    GRUB_AHCI_HBA_PORT_IS_TFES = 0x40000000
   };
 
 enum
@@ -134,6 +142,11 @@ struct grub_ahci_device
   struct grub_pci_dma_chunk *rfis;
   int present;
   int atapi;
+  /* Command slots usable for NCQ, 0 if the HBA has no NCQ support.  */
+  unsigned ncq_slots;
+  /* One command table per slot for queued commands, allocated on first
+     use.  */
+  struct grub_pci_dma_chunk *queue_table_chunk;
 };
 
 static grub_err_t 
@@ -162,6 +175,11 @@ enum
 
 #define GRUB_AHCI_PRDT_MAX_CHUNK_LENGTH 0x200000
 
+/* Bytes transferred by one queued command.  */
+#define GRUB_AHCI_QUEUED_CHUNK_LENGTH 0x20000
+/* Command tables must be 128-byte aligned.  */
+#define GRUB_AHCI_QUEUED_TABLE_STRIDE 0x100
+
 static struct grub_ahci_device *grub_ahci_devices;
 static int numdevs;
 
@@ -349,6 +367,9 @@ grub_ahci_pciinit (grub_pci_device_t dev,
       adevs[i]->port = i;
       adevs[i]->present = 1;
       adevs[i]->num = numdevs++;
+      if (hba->cap & GRUB_AHCI_HBA_CAP_SNCQ)
+	adevs[i]->ncq_slots = ((hba->cap & GRUB_AHCI_HBA_CAP_NCS_MASK)
+			       >> GRUB_AHCI_HBA_CAP_NCS_SHIFT) + 1;
     }
 
   for (i = 0; i < nports; i++)
@@ -681,9 +702,12 @@ grub_ahci_fini_hw (int noreturn __attribute__ ((unused)))
       grub_dma_free (dev->command_list_chunk);
       grub_dma_free (dev->command_table_chunk);
       grub_dma_free (dev->rfis);
+      if (dev->queue_table_chunk)
+	grub_dma_free (dev->queue_table_chunk);
       dev->command_list_chunk = NULL;
       dev->command_table_chunk = NULL;
       dev->rfis = NULL;
+      dev->queue_table_chunk = NULL;
     }
   return GRUB_ERR_NONE;
 }
@@ -695,7 +719,8 @@ reinit_port (struct grub_ahci_device *dev)
   struct grub_pci_dma_chunk *command_table;
   grub_uint64_t endtime;
 
-  command_list = grub_memalign_dma32 (1024, sizeof (struct grub_ahci_cmd_head));
+  command_list = grub_memalign_dma32 (1024,
+				      sizeof (struct grub_ahci_cmd_head) * 32);
   if (!command_list)
     return 1;
 
@@ -758,6 +783,8 @@ reinit_port (struct grub_ahci_device *dev)
 
   dev->command_list_chunk = command_list;
   dev->command_list = grub_dma_get_virt (command_list);
+  grub_memset ((void *) dev->command_list, 0,
+	       sizeof (struct grub_ahci_cmd_head) * 32);
   dev->command_table_chunk = command_table;
   dev->command_table = grub_dma_get_virt (command_table);
   dev->command_list->command_table_base
@@ -1084,6 +1111,188 @@ grub_ahci_readwrite (grub_ata_t disk,
   return grub_ahci_readwrite_real (disk->data, parms, spinup, 0);
 }
 
+/* Set up slot TAG for a READ/WRITE FPDMA QUEUED of COUNT sectors at
+   SECTOR, to or from the DMA address PHYS.  */
+static void
+grub_ahci_setup_queued (struct grub_ahci_device *dev, unsigned tag,
+			grub_disk_addr_t sector, grub_size_t count,
+			grub_uint64_t phys, grub_size_t len, int write)
+{
+  volatile struct grub_ahci_cmd_table *table;
+
+  table = (volatile struct grub_ahci_cmd_table *)
+    ((char *) grub_dma_get_virt (dev->queue_table_chunk)
+     + tag * GRUB_AHCI_QUEUED_TABLE_STRIDE);
+
+  dev->command_list[tag].config
+    = (5 << GRUB_AHCI_CONFIG_CFIS_LENGTH_SHIFT)
+    | (0 << GRUB_AHCI_CONFIG_PMP_SHIFT)
+    | (1 << GRUB_AHCI_CONFIG_PRDT_LENGTH_SHIFT)
+    | (write ? GRUB_AHCI_CONFIG_WRITE : GRUB_AHCI_CONFIG_READ);
+  dev->command_list[tag].transfered = 0;
+  dev->command_list[tag].command_table_base
+    = grub_dma_get_phys (dev->queue_table_chunk)
+    + tag * GRUB_AHCI_QUEUED_TABLE_STRIDE;
+  grub_memset ((char *) dev->command_list[tag].unused, 0,
+	       sizeof (dev->command_list[tag].unused));
+
+  grub_memset ((char *) table, 0, sizeof (*table));
+  table->cfis[0] = GRUB_AHCI_FIS_REG_H2D;
+  table->cfis[1] = 0x80;
+  table->cfis[2] = write ? GRUB_ATA_CMD_WRITE_FPDMA_QUEUED
+    : GRUB_ATA_CMD_READ_FPDMA_QUEUED;
+  /* The sector count goes in the features registers.  */
+  table->cfis[3] = count & 0xff;
+  table->cfis[4] = sector & 0xff;
+  table->cfis[5] = (sector >> 8) & 0xff;
+  table->cfis[6] = (sector >> 16) & 0xff;
+  table->cfis[7] = 0x40;
+  table->cfis[8] = (sector >> 24) & 0xff;
+  table->cfis[9] = (sector >> 32) & 0xff;
+  table->cfis[10] = (sector >> 40) & 0xff;
+  table->cfis[11] = (count >> 8) & 0xff;
+  table->cfis[12] = tag << 3;
+
+  table->prdt[0].data_base = phys;
+  table->prdt[0].unused = 0;
+  table->prdt[0].size = len - 1;
+}
+
+/* Transfer SIZE sectors at SECTOR to or from the DMA buffer BUFC, split
+   into queued commands.  A slot is given a new command as soon as its
+   previous one completes, so that the drive always has up to DEPTH
+   commands to choose from.  */
+static grub_err_t
+grub_ahci_queue (struct grub_ahci_device *dev, unsigned depth,
+		 unsigned log_sector_size, grub_disk_addr_t sector,
+		 grub_size_t size, struct grub_pci_dma_chunk *bufc, int write)
+{
+  volatile struct grub_ahci_hba_port *port = &dev->hba->ports[dev->port];
+  grub_size_t chunk = GRUB_AHCI_QUEUED_CHUNK_LENGTH >> log_sector_size;
+  grub_size_t done = 0;
+  grub_uint32_t outstanding = 0;
+  grub_uint64_t endtime;
+
+  port->intstatus = 0xffffffff;
+  endtime = grub_get_time_ms () + GRUB_ATA_TOUT_DATA;
+
+  while (done < size || outstanding)
+    {
+      grub_uint32_t busy;
+      unsigned tag;
+
+      for (tag = 0; tag < depth && done < size; tag++)
+	{
+	  grub_size_t n = size - done;
+
+	  if (outstanding & (1U << tag))
+	    continue;
+	  if (n > chunk)
+	    n = chunk;
+	  grub_ahci_setup_queued (dev, tag, sector + done, n,
+				  grub_dma_get_phys (bufc)
+				  + (done << log_sector_size),
+				  n << log_sector_size, write);
+	  outstanding |= 1U << tag;
+	  /* Writing zeros to these registers has no effect.  */
+	  port->sata_active = 1U << tag;
+	  port->command_issue = 1U << tag;
+	  done += n;
+	}
+
+      busy = port->sata_active | port->command_issue;
+      if ((outstanding & ~busy) != 0)
+	{
+	  outstanding &= busy;
+	  endtime = grub_get_time_ms () + GRUB_ATA_TOUT_DATA;
+	}
+
+      if ((port->intstatus & GRUB_AHCI_HBA_PORT_IS_TFES)
+	  || (port->task_file_data & GRUB_ATA_STATUS_ERR))
+	{
+	  grub_dprintf ("ahci", "queued command failed <%x %x %x %x>\n",
+			port->command_issue, port->sata_active,
+			port->intstatus, port->task_file_data);
+	  grub_error (GRUB_ERR_IO, "AHCI queued transfer failed");
+	  break;
+	}
+      if (grub_get_time_ms () > endtime)
+	{
+	  grub_dprintf ("ahci", "queued command timed out <%x %x %x %x>\n",
+			port->command_issue, port->sata_active,
+			port->intstatus, port->task_file_data);
+	  grub_error (GRUB_ERR_IO, "AHCI transfer timed out");
+	  break;
+	}
+    }
+
+  if (done < size || outstanding)
+    {
+      grub_err_t err = grub_errno;
+
+      grub_ahci_reset_port (dev, 1);
+      grub_errno = err;
+      return err;
+    }
+
+  return GRUB_ERR_NONE;
+}
+
+static grub_err_t
+grub_ahci_readwrite_queued (grub_ata_t disk, grub_disk_addr_t sector,
+			    grub_size_t size, char *buf, int write)
+{
+  struct grub_ahci_device *dev = disk->data;
+  grub_size_t max = GRUB_AHCI_PRDT_MAX_CHUNK_LENGTH >> disk->log_sector_size;
+  unsigned depth = disk->ncq_depth;
+
+  if (!dev->ncq_slots)
+    return grub_error (GRUB_ERR_NOT_IMPLEMENTED_YET,
+		       "AHCI controller doesn't support NCQ");
+  if (depth > dev->ncq_slots)
+    depth = dev->ncq_slots;
+
+  if (!dev->queue_table_chunk)
+    {
+      dev->queue_table_chunk
+	= grub_memalign_dma32 (1024, GRUB_AHCI_QUEUED_TABLE_STRIDE * 32);
+      if (!dev->queue_table_chunk)
+	return grub_errno;
+    }
+
+  grub_ahci_reset_port (dev, 0);
+  dev->hba->ports[dev->port].sata_error
+    = dev->hba->ports[dev->port].sata_error;
+
+  while (size)
+    {
+      struct grub_pci_dma_chunk *bufc;
+      grub_size_t n = size < max ? size : max;
+      grub_size_t len = n << disk->log_sector_size;
+      grub_err_t err;
+
+      bufc = grub_memalign_dma32 (1024, len);
+      if (!bufc)
+	return grub_errno;
+      if (write)
+	grub_memcpy ((char *) grub_dma_get_virt (bufc), buf, len);
+
+      err = grub_ahci_queue (dev, depth, disk->log_sector_size,
+			     sector, n, bufc, write);
+      if (!err && !write)
+	grub_memcpy (buf, (char *) grub_dma_get_virt (bufc), len);
+      grub_dma_free (bufc);
+      if (err)
+	return err;
+
+      sector += n;
+      buf += len;
+      size -= n;
+    }
+
+  return GRUB_ERR_NONE;
+}
+
 static grub_err_t
 grub_ahci_open (int id, int devnum, struct grub_ata *ata)
 {
@@ -1105,6 +1314,7 @@ grub_ahci_open (int id, int devnum, struct grub_ata *ata)
   ata->dma = 1;
   ata->atapi = dev->atapi;
   ata->maxbuffer = GRUB_AHCI_PRDT_MAX_CHUNK_LENGTH;
+  ata->ncq_depth = dev->ncq_slots;
   ata->present = &dev->present;
 
   return GRUB_ERR_NONE;
@@ -1115,6 +1325,7 @@ static struct grub_ata_dev grub_ahci_dev =
     .iterate = grub_ahci_iterate,
     .open = grub_ahci_open,
     .readwrite = grub_ahci_readwrite,
+    .readwrite_queued = grub_ahci_readwrite_queued,
   };
 
 
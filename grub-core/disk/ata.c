@@ -189,6 +189,16 @@ grub_ata_identify (struct grub_ata *dev)
   else
     dev->log_sector_size = 9;
 
+  /* NCQ needs LBA48.  Word 75 holds the queue depth minus one.  */
+  if (dev->addr == GRUB_ATA_LBA48
+      && (info16[76] & grub_cpu_to_le16_compile_time ((1 << 8))))
+    {
+      if (dev->ncq_depth > (grub_le_to_cpu16 (info16[75]) & 0x1f) + 1U)
+	dev->ncq_depth = (grub_le_to_cpu16 (info16[75]) & 0x1f) + 1;
+    }
+  else
+    dev->ncq_depth = 0;
+
   /* Read CHS information.  */
   dev->cylinders = grub_le_to_cpu16 (info16[1]);
   dev->heads = grub_le_to_cpu16 (info16[3]);
@@ -292,6 +302,16 @@ grub_ata_readwrite (grub_disk_t disk, grub_disk_addr_t sector,
   grub_dprintf("ata", "grub_ata_readwrite (size=%llu, rw=%d)\n",
 	       (unsigned long long) size, rw);
 
+  if (ata->ncq_depth && ata->dev->readwrite_queued)
+    {
+      if (ata->dev->readwrite_queued (ata, sector, size, buf, rw)
+	  == GRUB_ERR_NONE)
+	return GRUB_ERR_NONE;
+      grub_dprintf ("ata", "queued transfer failed: %s\n", grub_errmsg);
+      grub_errno = GRUB_ERR_NONE;
+      ata->ncq_depth = 0;
+    }
+
   if (addressing == GRUB_ATA_LBA48 && ((sector + size) >> 28) != 0)
     {
       if (ata->dma)
@@ -471,7 +491,9 @@ grub_ata_open (const char *name, grub_disk_t disk)
 
   disk->total_sectors = ata->size;
   disk->max_agglomerate = (ata->maxbuffer >> (GRUB_DISK_CACHE_BITS + GRUB_DISK_SECTOR_BITS));
-  if (disk->max_agglomerate > (256U >> (GRUB_DISK_CACHE_BITS + GRUB_DISK_SECTOR_BITS - ata->log_sector_size)))
+  /* Queued transfers are not limited to one 256-sector command.  */
+  if (!(ata->ncq_depth && ata->dev->readwrite_queued)
+      && disk->max_agglomerate > (256U >> (GRUB_DISK_CACHE_BITS + GRUB_DISK_SECTOR_BITS - ata->log_sector_size)))
     disk->max_agglomerate = (256U >> (GRUB_DISK_CACHE_BITS + GRUB_DISK_SECTOR_BITS - ata->log_sector_size));
 
   disk->log_sector_size = ata->log_sector_size;
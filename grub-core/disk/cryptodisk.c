@@ -24,13 +24,20 @@
 #include <grub/i18n.h>
 #include <grub/fs.h>
 #include <grub/file.h>
+#include <grub/job.h>
 #include <grub/procfs.h>
 #include <grub/partition.h>
+#include <grub/loader.h>
 
 #ifdef GRUB_UTIL
 #include <grub/emu/hostdisk.h>
 #endif
 
+#if defined (__x86_64__) && defined (GRUB_MACHINE_EFI)
+#include <grub/x86_64/aesni.h>
+#define USE_AESNI 1
+#endif
+
 GRUB_MOD_LICENSE ("GPLv3+");
 
 grub_cryptodisk_dev_t grub_cryptodisk_list;
@@ -221,18 +228,161 @@ lrw_xor (const struct lrw_sector *sec,
 		   dev->lrw_precalc, sec->low_byte * GRUB_CRYPTODISK_GF_BYTES);
 }
 
+#ifdef USE_AESNI
+/* Blocks handled per pass; bounds the scratch space on the stack.  */
+#define AESNI_CHUNK 32
+
+static void
+aesni_release (grub_cryptodisk_t dev)
+{
+  if (!dev->aesni)
+    return;
+  grub_memset (dev->aesni, 0, 2 * sizeof (*dev->aesni));
+  grub_free (dev->aesni);
+  dev->aesni = NULL;
+}
+
+/* Expand KEY for the AES-NI paths when the cipher and mode allow it.
+   Failing to do so is not an error: the generic code is used instead.  */
+static void
+aesni_setkey (grub_cryptodisk_t dev, const grub_uint8_t *key,
+	      grub_size_t keysize)
+{
+  if (grub_strncasecmp (dev->cipher->cipher->name, "AES", 3) != 0
+      || dev->cipher->cipher->blocksize != GRUB_AESNI_BLOCK_SIZE
+      || (keysize != 16 && keysize != 24 && keysize != 32)
+      || (dev->mode != GRUB_CRYPTODISK_MODE_ECB
+	  && dev->mode != GRUB_CRYPTODISK_MODE_CBC
+	  && dev->mode != GRUB_CRYPTODISK_MODE_XTS)
+      || !grub_aesni_is_supported ())
+    {
+      aesni_release (dev);
+      return;
+    }
+
+  if (!dev->aesni)
+    {
+      dev->aesni = grub_malloc (2 * sizeof (*dev->aesni));
+      if (!dev->aesni)
+	{
+	  grub_errno = GRUB_ERR_NONE;
+	  return;
+	}
+      grub_dprintf ("cryptodisk", "using AES-NI\n");
+    }
+
+  grub_aesni_set_key (&dev->aesni[0], key, keysize);
+  if (dev->mode == GRUB_CRYPTODISK_MODE_XTS)
+    grub_aesni_set_key (&dev->aesni[1], key + keysize, keysize);
+}
+
+static void
+aesni_ecb (const struct grub_aesni_key *key, grub_uint8_t *data,
+	   grub_size_t len, int do_encrypt)
+{
+  if (do_encrypt)
+    grub_aesni_ecb_encrypt (key->enc, key->rounds, data, data,
+			    len / GRUB_AESNI_BLOCK_SIZE);
+  else
+    grub_aesni_ecb_decrypt (key->dec, key->rounds, data, data,
+			    len / GRUB_AESNI_BLOCK_SIZE);
+}
+
+static void
+aesni_cbc (grub_cryptodisk_t dev, grub_uint8_t *data, grub_size_t len,
+	   grub_uint8_t *iv, int do_encrypt)
+{
+  const struct grub_aesni_key *key = &dev->aesni[0];
+
+  if (do_encrypt)
+    {
+      /* Each block depends on the previous one; nothing to interleave.  */
+      for (; len; data += GRUB_AESNI_BLOCK_SIZE, len -= GRUB_AESNI_BLOCK_SIZE)
+	{
+	  grub_crypto_xor (data, data, iv, GRUB_AESNI_BLOCK_SIZE);
+	  grub_aesni_ecb_encrypt (key->enc, key->rounds, data, data, 1);
+	  iv = data;
+	}
+      return;
+    }
+
+  while (len)
+    {
+      grub_uint8_t prev[AESNI_CHUNK * GRUB_AESNI_BLOCK_SIZE];
+      grub_size_t n = len < sizeof (prev) ? len : sizeof (prev);
+
+      grub_memcpy (prev, data, n);
+      grub_aesni_ecb_decrypt (key->dec, key->rounds, data, data,
+			      n / GRUB_AESNI_BLOCK_SIZE);
+      grub_crypto_xor (data, data, iv, GRUB_AESNI_BLOCK_SIZE);
+      grub_crypto_xor (data + GRUB_AESNI_BLOCK_SIZE,
+		       data + GRUB_AESNI_BLOCK_SIZE, prev,
+		       n - GRUB_AESNI_BLOCK_SIZE);
+      grub_memcpy (iv, prev + n - GRUB_AESNI_BLOCK_SIZE,
+		   GRUB_AESNI_BLOCK_SIZE);
+      grub_memset (prev, 0, n);
+      data += n;
+      len -= n;
+    }
+}
+
+static void
+aesni_xts (grub_cryptodisk_t dev, grub_uint8_t *data, grub_size_t len,
+	   grub_uint8_t *iv, int do_encrypt)
+{
+  grub_uint64_t tweaks[2 * AESNI_CHUNK];
+  grub_uint64_t lo, hi;
+
+  grub_aesni_ecb_encrypt (dev->aesni[1].enc, dev->aesni[1].rounds,
+			  iv, iv, 1);
+  lo = grub_get_unaligned64 (iv);
+  hi = grub_get_unaligned64 (iv + 8);
+  lo = grub_le_to_cpu64 (lo);
+  hi = grub_le_to_cpu64 (hi);
+
+  while (len)
+    {
+      grub_size_t n = len < sizeof (tweaks) ? len : sizeof (tweaks);
+      unsigned j;
+
+      /* Same as gf_mul_x, on the tweak as a little-endian 128-bit
+	 number.  */
+      for (j = 0; j < n / GRUB_AESNI_BLOCK_SIZE; j++)
+	{
+	  grub_uint64_t carry = hi >> 63;
+
+	  tweaks[2 * j] = grub_cpu_to_le64 (lo);
+	  tweaks[2 * j + 1] = grub_cpu_to_le64 (hi);
+	  hi = (hi << 1) | (lo >> 63);
+	  lo = (lo << 1) ^ (carry * GF_POLYNOM);
+	}
+      grub_crypto_xor (data, data, tweaks, n);
+      aesni_ecb (&dev->aesni[0], data, n, do_encrypt);
+      grub_crypto_xor (data, data, tweaks, n);
+      data += n;
+      len -= n;
+    }
+  grub_memset (tweaks, 0, sizeof (tweaks));
+}
+#endif
+
 static gcry_err_code_t
-grub_cryptodisk_endecrypt (struct grub_cryptodisk *dev,
-			   grub_uint8_t * data, grub_size_t len,
-			   grub_disk_addr_t sector, int do_encrypt)
+endecrypt_range (struct grub_cryptodisk *dev,
+		 grub_uint8_t * data, grub_size_t len,
+		 grub_disk_addr_t sector, int do_encrypt)
 {
   grub_size_t i;
   gcry_err_code_t err;
-
-  if (dev->cipher->cipher->blocksize > GRUB_CRYPTO_MAX_CIPHER_BLOCKSIZE)
-    return GPG_ERR_INV_ARG;
+  GRUB_PROPERLY_ALIGNED_ARRAY (hash_ctx, GRUB_CRYPTO_MAX_MD_CONTEXT_SIZE);
 
   /* The only mode without IV.  */
+#ifdef USE_AESNI
+  if (dev->mode == GRUB_CRYPTODISK_MODE_ECB && !dev->rekey && dev->aesni)
+    {
+      aesni_ecb (&dev->aesni[0], data, len, do_encrypt);
+      return GPG_ERR_NO_ERROR;
+    }
+#endif
   if (dev->mode == GRUB_CRYPTODISK_MODE_ECB && !dev->rekey)
     return (do_encrypt ? grub_crypto_ecb_encrypt (dev->cipher, data, data, len)
 	    : grub_crypto_ecb_decrypt (dev->cipher, data, data, len));
@@ -266,6 +416,18 @@ grub_cryptodisk_endecrypt (struct grub_cryptodisk *dev,
 	    grub_uint64_t tmp;
 	    void *ctx;
 
+	    /* Carry on from the state after the prefix.  */
+	    if (dev->iv_hash_ctx)
+	      {
+		tmp = grub_cpu_to_le64 (sector << dev->log_sector_size);
+		grub_memcpy (hash_ctx, dev->iv_hash_ctx,
+			     dev->iv_hash->contextsize);
+		dev->iv_hash->write (hash_ctx, &tmp, sizeof (tmp));
+		dev->iv_hash->final (hash_ctx);
+		grub_memcpy (iv, dev->iv_hash->read (hash_ctx), sizeof (iv));
+		break;
+	      }
+
 	    ctx = grub_zalloc (dev->iv_hash->contextsize);
 	    if (!ctx)
 	      return GPG_ERR_OUT_OF_MEMORY;
@@ -305,6 +467,29 @@ grub_cryptodisk_endecrypt (struct grub_cryptodisk *dev,
 	    return err;
 	}
 
+#ifdef USE_AESNI
+      if (dev->aesni)
+	{
+	  switch (dev->mode)
+	    {
+	    case GRUB_CRYPTODISK_MODE_CBC:
+	      aesni_cbc (dev, data + i, (1U << dev->log_sector_size),
+			 (grub_uint8_t *) iv, do_encrypt);
+	      break;
+	    case GRUB_CRYPTODISK_MODE_XTS:
+	      aesni_xts (dev, data + i, (1U << dev->log_sector_size),
+			 (grub_uint8_t *) iv, do_encrypt);
+	      break;
+	    default:
+	      aesni_ecb (&dev->aesni[0], data + i,
+			 (1U << dev->log_sector_size), do_encrypt);
+	      break;
+	    }
+	  sector++;
+	  continue;
+	}
+#endif
+
       switch (dev->mode)
 	{
 	case GRUB_CRYPTODISK_MODE_CBC:
@@ -392,6 +577,149 @@ grub_cryptodisk_endecrypt (struct grub_cryptodisk *dev,
 	}
       sector++;
     }
+  if (dev->mode_iv == GRUB_CRYPTODISK_MODE_IV_BYTECOUNT64_HASH)
+    grub_memset (hash_ctx, 0, sizeof (hash_ctx));
+  return GPG_ERR_NO_ERROR;
+}
+
+/* Sectors are independent once the keys are set up, so large requests are
+   split between the processors grub_job_submit can use.  Smaller pieces
+   than this aren't worth starting another processor for.  */
+#define ENDECRYPT_JOB_SIZE 65536
+#define ENDECRYPT_MAX_JOBS 16
+
+struct endecrypt_job
+{
+  struct grub_job job;
+  struct grub_cryptodisk *dev;
+  grub_uint8_t *data;
+  grub_size_t len;
+  grub_disk_addr_t sector;
+  int do_encrypt;
+  gcry_err_code_t err;
+};
+
+static void
+endecrypt_job_run (struct grub_job *job)
+{
+  struct endecrypt_job *j = (struct endecrypt_job *) job;
+
+  j->err = endecrypt_range (j->dev, j->data, j->len, j->sector,
+			    j->do_encrypt);
+}
+
+/* Process whole sectors of a single key zone, on several processors if
+   the request is large enough.  */
+static gcry_err_code_t
+endecrypt_split (struct grub_cryptodisk *dev,
+		 grub_uint8_t * data, grub_size_t len,
+		 grub_disk_addr_t sector, int do_encrypt)
+{
+  struct endecrypt_job jobs[ENDECRYPT_MAX_JOBS];
+  grub_size_t sector_size = (1U << dev->log_sector_size);
+  grub_size_t part;
+  unsigned njobs, i;
+  gcry_err_code_t err;
+
+  if (len < 2 * ENDECRYPT_JOB_SIZE)
+    return endecrypt_range (dev, data, len, sector, do_encrypt);
+
+  njobs = grub_job_workers ();
+  if (!njobs)
+    return endecrypt_range (dev, data, len, sector, do_encrypt);
+
+  /* Some ciphers build their decryption key schedule on first use.  Get
+     that done here rather than in several jobs at once.  */
+  err = endecrypt_range (dev, data, sector_size, sector, do_encrypt);
+  if (err)
+    return err;
+  data += sector_size;
+  len -= sector_size;
+  sector++;
+
+  njobs++;
+  if (njobs > ENDECRYPT_MAX_JOBS)
+    njobs = ENDECRYPT_MAX_JOBS;
+  if (njobs > len / ENDECRYPT_JOB_SIZE)
+    njobs = len / ENDECRYPT_JOB_SIZE;
+  part = ALIGN_UP (len / njobs, sector_size);
+
+  for (i = 0; i < njobs && len; i++)
+    {
+      jobs[i].job.run = endecrypt_job_run;
+      jobs[i].dev = dev;
+      jobs[i].data = data;
+      jobs[i].len = len < part ? len : part;
+      jobs[i].sector = sector;
+      jobs[i].do_encrypt = do_encrypt;
+      data += jobs[i].len;
+      sector += jobs[i].len >> dev->log_sector_size;
+      len -= jobs[i].len;
+    }
+  njobs = i;
+
+  /* The first part is done here while the others run.  */
+  for (i = 1; i < njobs; i++)
+    grub_job_submit (&jobs[i].job);
+  endecrypt_job_run (&jobs[0].job);
+
+  err = jobs[0].err;
+  for (i = 1; i < njobs; i++)
+    {
+      grub_job_wait (&jobs[i].job);
+      if (!err)
+	err = jobs[i].err;
+    }
+  return err;
+}
+
+static gcry_err_code_t
+grub_cryptodisk_endecrypt (struct grub_cryptodisk *dev,
+			   grub_uint8_t * data, grub_size_t len,
+			   grub_disk_addr_t sector, int do_encrypt)
+{
+  grub_size_t sector_size = (1U << dev->log_sector_size);
+  gcry_err_code_t err;
+
+  if (dev->cipher->cipher->blocksize > GRUB_CRYPTO_MAX_CIPHER_BLOCKSIZE)
+    return GPG_ERR_INV_ARG;
+
+  /* Hashed IVs allocate memory unless the prefix state was set up, which
+     may not happen in a job.  */
+  if ((dev->mode_iv == GRUB_CRYPTODISK_MODE_IV_BYTECOUNT64_HASH
+       && !dev->iv_hash_ctx)
+      || (len & (sector_size - 1)))
+    return endecrypt_range (dev, data, len, sector, do_encrypt);
+
+  if (!dev->rekey)
+    return endecrypt_split (dev, data, len, sector, do_encrypt);
+
+  /* Rekeying changes the device, so switch keys here once per zone and
+     split up the sectors within the zone like any other request.  */
+  while (len)
+    {
+      grub_uint64_t zone = sector >> dev->rekey_shift;
+      grub_uint64_t left;
+      grub_size_t n;
+
+      if (zone != dev->last_rekey)
+	{
+	  err = dev->rekey (dev, zone);
+	  if (err)
+	    return err;
+	  dev->last_rekey = zone;
+	}
+
+      left = (((zone + 1) << dev->rekey_shift) - sector)
+	<< dev->log_sector_size;
+      n = left < len ? left : len;
+      err = endecrypt_split (dev, data, n, sector, do_encrypt);
+      if (err)
+	return err;
+      data += n;
+      len -= n;
+      sector += n >> dev->log_sector_size;
+    }
   return GPG_ERR_NO_ERROR;
 }
 
@@ -403,6 +731,41 @@ grub_cryptodisk_decrypt (struct grub_cryptodisk *dev,
   return grub_cryptodisk_endecrypt (dev, data, len, sector, 0);
 }
 
+/* Set the secret that hashed IVs start with, and keep the state of the IV
+   hash after it so each sector only hashes its own number.  */
+gcry_err_code_t
+grub_cryptodisk_set_iv_prefix (grub_cryptodisk_t dev,
+			       const grub_uint8_t *prefix, grub_size_t len)
+{
+  if (len > sizeof (dev->iv_prefix))
+    return GPG_ERR_INV_ARG;
+
+  grub_memcpy (dev->iv_prefix, prefix, len);
+  dev->iv_prefix_len = len;
+
+  if (dev->iv_hash_ctx)
+    {
+      grub_memset (dev->iv_hash_ctx, 0, dev->iv_hash->contextsize);
+      grub_free (dev->iv_hash_ctx);
+      dev->iv_hash_ctx = NULL;
+    }
+
+  /* Without the state every sector hashes the prefix again.  */
+  if (!dev->iv_hash
+      || dev->iv_hash->contextsize > GRUB_CRYPTO_MAX_MD_CONTEXT_SIZE)
+    return GPG_ERR_NO_ERROR;
+
+  dev->iv_hash_ctx = grub_zalloc (dev->iv_hash->contextsize);
+  if (!dev->iv_hash_ctx)
+    {
+      grub_errno = GRUB_ERR_NONE;
+      return GPG_ERR_NO_ERROR;
+    }
+  dev->iv_hash->init (dev->iv_hash_ctx);
+  dev->iv_hash->write (dev->iv_hash_ctx, prefix, len);
+  return GPG_ERR_NO_ERROR;
+}
+
 gcry_err_code_t
 grub_cryptodisk_setkey (grub_cryptodisk_t dev, grub_uint8_t *key, grub_size_t keysize)
 {
@@ -445,6 +808,10 @@ grub_cryptodisk_setkey (grub_cryptodisk_t dev, grub_uint8_t *key, grub_size_t ke
 	return err;
     }
 
+#ifdef USE_AESNI
+  aesni_setkey (dev, key, real_keysize);
+#endif
+
   if (dev->mode == GRUB_CRYPTODISK_MODE_LRW)
     {
       unsigned i;
@@ -722,6 +1089,7 @@ grub_cryptodisk_insert (grub_cryptodisk_t newdev, const char *name,
   newdev->partition_start = grub_partition_get_start (source->partition);
   newdev->next = cryptodisk_list;
   cryptodisk_list = newdev;
+  grub_disk_generation++;
 
   return GRUB_ERR_NONE;
 }
@@ -769,6 +1137,7 @@ grub_cryptodisk_cheat_insert (grub_cryptodisk_t newdev, const char *name,
   newdev->id = last_cryptodisk_id++;
   newdev->next = cryptodisk_list;
   cryptodisk_list = newdev;
+  grub_disk_generation++;
 
   return GRUB_ERR_NONE;
 }
@@ -815,6 +1184,14 @@ cryptodisk_close (grub_cryptodisk_t dev)
   grub_crypto_cipher_close (dev->cipher);
   grub_crypto_cipher_close (dev->secondary_cipher);
   grub_crypto_cipher_close (dev->essiv_cipher);
+#ifdef USE_AESNI
+  aesni_release (dev);
+#endif
+  if (dev->iv_hash_ctx)
+    {
+      grub_memset (dev->iv_hash_ctx, 0, dev->iv_hash->contextsize);
+      grub_free (dev->iv_hash_ctx);
+    }
   grub_free (dev);
 }
 
@@ -1136,6 +1513,25 @@ struct grub_procfs_entry luks_script =
 
 static grub_extcmd_t cmd;
 
+#ifndef GRUB_UTIL
+static struct grub_preboot *preboot_hnd;
+
+/* The disk cache holds decrypted sectors of our devices; make sure none
+   of it is left in memory handed over to the OS.  */
+static grub_err_t
+cryptodisk_preboot (int noreturn __attribute__ ((unused)))
+{
+  grub_disk_cache_invalidate_all ();
+  return GRUB_ERR_NONE;
+}
+
+static grub_err_t
+cryptodisk_preboot_rest (void)
+{
+  return GRUB_ERR_NONE;
+}
+#endif
+
 GRUB_MOD_INIT (cryptodisk)
 {
   grub_disk_dev_register (&grub_cryptodisk_dev);
@@ -1143,6 +1539,11 @@ GRUB_MOD_INIT (cryptodisk)
 			      N_("SOURCE|-u UUID|-a|-b"),
 			      N_("Mount a crypto device."), options);
   grub_procfs_register ("luks_script", &luks_script);
+#ifndef GRUB_UTIL
+  preboot_hnd = grub_loader_register_preboot_hook (cryptodisk_preboot,
+						   cryptodisk_preboot_rest,
+						   GRUB_LOADER_PREBOOT_HOOK_PRIO_NORMAL);
+#endif
 }
 
 GRUB_MOD_FINI (cryptodisk)
@@ -1150,4 +1551,7 @@ GRUB_MOD_FINI (cryptodisk)
   grub_disk_dev_unregister (&grub_cryptodisk_dev);
   cryptodisk_cleanup ();
   grub_procfs_unregister (&luks_script);
+#ifndef GRUB_UTIL
+  grub_loader_unregister_preboot_hook (preboot_hnd);
+#endif
 }
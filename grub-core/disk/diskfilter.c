@@ -24,21 +24,47 @@
 #include <grub/misc.h>
 #include <grub/diskfilter.h>
 #include <grub/partition.h>
+#include <grub/crypto.h>
+#include <grub/command.h>
 #ifdef GRUB_UTIL
 #include <grub/i18n.h>
 #include <grub/util/misc.h>
 #endif
+#if defined (__x86_64__) && defined (GRUB_MACHINE_EFI)
+#include <grub/x86_64/raid.h>
+#endif
 
 GRUB_MOD_LICENSE ("GPLv3+");
 
+/* How far ahead, in sectors, a failed RAID4/5 member is rebuilt.  */
+#define GRUB_DISKFILTER_RECOVER_AHEAD 2048
+
 /* Linked list of DISKFILTER arrays. */
 static struct grub_diskfilter_vg *array_list;
 grub_raid5_recover_func_t grub_raid5_recover_func;
 grub_raid6_recover_func_t grub_raid6_recover_func;
 grub_diskfilter_t grub_diskfilter_list;
+unsigned long grub_diskfilter_generation;
 static int inscnt = 0;
 static int lv_num = 0;
 
+/* Disks which have been through every diskfilter, whole and partition by
+   partition, since the disk and diskfilter generations had the values
+   below.  Scanning them again cannot turn up anything new.  */
+struct scanned_disk
+{
+  struct scanned_disk *next;
+  unsigned long dev_id;
+  unsigned long disk_id;
+};
+static struct scanned_disk *scanned_disks;
+static unsigned long scanned_disk_generation;
+static unsigned long scanned_diskfilter_generation;
+
+/* The diskfilter which recognised the last member.  Members of a set share
+   their metadata format, so it is tried first.  */
+static grub_diskfilter_t scan_hint;
+
 static struct grub_diskfilter_lv *
 find_lv (const char *name);
 static int is_lv_readable (struct grub_diskfilter_lv *lv, int easily);
@@ -123,14 +149,97 @@ is_valid_diskfilter_name (const char *name)
 	  || grub_memcmp (name, "ldm/", sizeof ("ldm/") - 1) == 0);
 }
 
+static void
+scan_cache_flush (void)
+{
+  struct scanned_disk *s, *next;
+
+  for (s = scanned_disks; s; s = next)
+    {
+      next = s->next;
+      grub_free (s);
+    }
+  scanned_disks = 0;
+  scan_hint = 0;
+  scanned_disk_generation = grub_disk_generation;
+  scanned_diskfilter_generation = grub_diskfilter_generation;
+}
+
+static int
+scan_cache_lookup (grub_disk_t disk)
+{
+  struct scanned_disk *s;
+
+  if (scanned_disk_generation != grub_disk_generation
+      || scanned_diskfilter_generation != grub_diskfilter_generation)
+    scan_cache_flush ();
+
+  for (s = scanned_disks; s; s = s->next)
+    if (s->dev_id == disk->dev->id && s->disk_id == disk->id)
+      return 1;
+  return 0;
+}
+
+static void
+scan_cache_add (grub_disk_t disk)
+{
+  struct scanned_disk *s;
+
+  s = grub_malloc (sizeof (*s));
+  if (!s)
+    {
+      grub_errno = GRUB_ERR_NONE;
+      return;
+    }
+  s->dev_id = disk->dev->id;
+  s->disk_id = disk->id;
+  s->next = scanned_disks;
+  scanned_disks = s;
+}
+
+/* Helper for scan_disk_partition_iter.  Return 1 if DISKFILTER recognised
+   DISK as an array member.  */
+static int
+scan_disk_filter (grub_diskfilter_t diskfilter, grub_disk_t disk,
+		  const char *name __attribute__ ((unused)))
+{
+  struct grub_diskfilter_vg *arr;
+  grub_disk_addr_t start_sector;
+  struct grub_diskfilter_pv_id id;
+
+#ifdef GRUB_UTIL
+  grub_util_info ("Scanning for %s devices on disk %s", 
+		  diskfilter->name, name);
+#endif
+  id.uuid = 0;
+  id.uuidlen = 0;
+  arr = diskfilter->detect (disk, &id, &start_sector);
+  if (arr &&
+      (! insert_array (disk, &id, arr, start_sector, diskfilter)))
+    {
+      if (id.uuidlen)
+	grub_free (id.uuid);
+      scan_hint = diskfilter;
+      return 1;
+    }
+  if (arr && id.uuidlen)
+    grub_free (id.uuid);
+
+  /* This error usually means it's not diskfilter, no need to display
+     it.  */
+  if (grub_errno != GRUB_ERR_OUT_OF_RANGE)
+    grub_print_error ();
+
+  grub_errno = GRUB_ERR_NONE;
+  return 0;
+}
+
 /* Helper for scan_disk.  */
 static int
 scan_disk_partition_iter (grub_disk_t disk, grub_partition_t p, void *data)
 {
   const char *name = data;
   struct grub_diskfilter_vg *arr;
-  grub_disk_addr_t start_sector;
-  struct grub_diskfilter_pv_id id;
   grub_diskfilter_t diskfilter;
 
   grub_dprintf ("diskfilter", "Scanning for DISKFILTER devices on disk %s\n",
@@ -152,32 +261,12 @@ scan_disk_partition_iter (grub_disk_t disk, grub_partition_t p, void *data)
 	  return 0;
     }
 
-  for (diskfilter = grub_diskfilter_list; diskfilter; diskfilter = diskfilter->next)
-    {
-#ifdef GRUB_UTIL
-      grub_util_info ("Scanning for %s devices on disk %s", 
-		      diskfilter->name, name);
-#endif
-      id.uuid = 0;
-      id.uuidlen = 0;
-      arr = diskfilter->detect (disk, &id, &start_sector);
-      if (arr &&
-	  (! insert_array (disk, &id, arr, start_sector, diskfilter)))
-	{
-	  if (id.uuidlen)
-	    grub_free (id.uuid);
-	  return 0;
-	}
-      if (arr && id.uuidlen)
-	grub_free (id.uuid);
-
-      /* This error usually means it's not diskfilter, no need to display
-	 it.  */
-      if (grub_errno != GRUB_ERR_OUT_OF_RANGE)
-	grub_print_error ();
+  if (scan_hint && scan_disk_filter (scan_hint, disk, name))
+    return 0;
 
-      grub_errno = GRUB_ERR_NONE;
-    }
+  for (diskfilter = grub_diskfilter_list; diskfilter; diskfilter = diskfilter->next)
+    if (diskfilter != scan_hint && scan_disk_filter (diskfilter, disk, name))
+      return 0;
 
   return 0;
 }
@@ -202,8 +291,12 @@ scan_disk (const char *name, int accept_diskfilter)
       scan_depth--;
       return 0;
     }
-  scan_disk_partition_iter (disk, 0, (void *) name);
-  grub_partition_iterate (disk, scan_disk_partition_iter, (void *) name);
+  if (!scan_cache_lookup (disk))
+    {
+      scan_disk_partition_iter (disk, 0, (void *) name);
+      grub_partition_iterate (disk, scan_disk_partition_iter, (void *) name);
+      scan_cache_add (disk);
+    }
   grub_disk_close (disk);
   scan_depth--;
   return 0;
@@ -485,6 +578,22 @@ grub_diskfilter_read_node (const struct grub_diskfilter_node *node,
   return grub_error (GRUB_ERR_UNKNOWN_DEVICE, "unknown node '%s'", node->name);
 }
 
+void
+grub_raid_block_xor (char *dst, const char *src, grub_size_t size)
+{
+#if defined (__x86_64__) && defined (GRUB_MACHINE_EFI)
+  grub_size_t n = size & ~(grub_size_t) (GRUB_RAID_SSE2_BLOCK - 1);
+
+  if (n)
+    {
+      grub_raid_xor_sse2 (dst, src, n);
+      dst += n;
+      src += n;
+      size -= n;
+    }
+#endif
+  grub_crypto_xor (dst, dst, src, size);
+}
 
 static grub_err_t
 validate_segment (struct grub_diskfilter_segment *seg);
@@ -575,6 +684,179 @@ validate_segment (struct grub_diskfilter_segment *seg)
 
 }
 
+typedef void (*striped_chunk_hook_t) (unsigned int k,
+				      grub_disk_addr_t member_sector,
+				      grub_size_t pos, grub_size_t len,
+				      void *data);
+
+/* Call HOOK for every chunk of a STRIPED or RAID10 read of SIZE sectors at
+   SECTOR, with the member K holding its first copy, where the chunk
+   starts on that member and where it goes in the request.  */
+static void
+striped_iterate_chunks (struct grub_diskfilter_segment *seg,
+			grub_disk_addr_t sector, grub_size_t size,
+			striped_chunk_hook_t hook, void *hook_data)
+{
+  grub_disk_addr_t read_sector;
+  grub_uint64_t disknr, b, near = 1, ofs = 1;
+  grub_size_t pos = 0;
+
+  if (seg->type == GRUB_DISKFILTER_RAID10)
+    {
+      near = seg->layout & 0xFF;
+      if (seg->layout >> 16)
+	ofs = (seg->layout >> 8) & 0xFF;
+    }
+
+  read_sector = grub_divmod64 (sector, seg->stripe_size, &b);
+  read_sector = grub_divmod64 (read_sector * near, seg->node_count, &disknr);
+  ofs *= seg->stripe_size;
+  read_sector *= ofs;
+
+  while (pos < size)
+    {
+      grub_size_t len;
+
+      len = seg->stripe_size - b;
+      if (len > size - pos)
+	len = size - pos;
+
+      hook (disknr, read_sector + b, pos, len, hook_data);
+
+      pos += len;
+      b = 0;
+      disknr += near;
+      while (disknr >= seg->node_count)
+	{
+	  disknr -= seg->node_count;
+	  read_sector += ofs;
+	}
+    }
+}
+
+struct striped_member
+{
+  grub_disk_addr_t start;
+  grub_disk_addr_t end;
+  char *buf;
+};
+
+static void
+striped_plan_chunk (unsigned int k, grub_disk_addr_t member_sector,
+		    grub_size_t pos __attribute__ ((unused)), grub_size_t len,
+		    void *data)
+{
+  struct striped_member *m = (struct striped_member *) data + k;
+
+  if (m->end == 0 || member_sector < m->start)
+    m->start = member_sector;
+  if (member_sector + len > m->end)
+    m->end = member_sector + len;
+}
+
+struct striped_copy_ctx
+{
+  struct striped_member *members;
+  char *buf;
+};
+
+static void
+striped_copy_chunk (unsigned int k, grub_disk_addr_t member_sector,
+		    grub_size_t pos, grub_size_t len, void *data)
+{
+  struct striped_copy_ctx *ctx = data;
+  struct striped_member *m = &ctx->members[k];
+
+  grub_memcpy (ctx->buf + (pos << GRUB_DISK_SECTOR_BITS),
+	       m->buf + ((member_sector - m->start) << GRUB_DISK_SECTOR_BITS),
+	       len << GRUB_DISK_SECTOR_BITS);
+}
+
+/* Read a STRIPED or RAID10 request spanning several members with one read
+   per member instead of one per chunk.  Every member is asked to start on
+   its share in the background first, so the members transfer in parallel
+   while we collect from them one after the other.  Returns 1 if BUF was
+   filled, 0 if the caller has to read chunk by chunk, which is also the
+   path that knows how to fall back to other copies.  */
+static int
+read_striped_parallel (struct grub_diskfilter_segment *seg,
+		       grub_disk_addr_t sector, grub_size_t size, char *buf)
+{
+  struct striped_member *members;
+  struct striped_copy_ctx ctx;
+  grub_uint64_t b;
+  grub_size_t total = 0;
+  unsigned int k, used = 0;
+  char *tmp = 0;
+  int ret = 0;
+
+  grub_divmod64 (sector, seg->stripe_size, &b);
+  if (b + size <= seg->stripe_size)
+    return 0;
+
+  members = grub_zalloc (seg->node_count * sizeof (*members));
+  if (! members)
+    {
+      grub_errno = GRUB_ERR_NONE;
+      return 0;
+    }
+
+  striped_iterate_chunks (seg, sector, size, striped_plan_chunk, members);
+
+  for (k = 0; k < seg->node_count; k++)
+    if (members[k].end)
+      {
+	used++;
+	total += members[k].end - members[k].start;
+      }
+
+  /* Layouts that leave holes in the per-member ranges are not worth the
+     extra reading.  */
+  if (used < 2 || total > 2 * size)
+    goto out;
+
+  tmp = grub_malloc (total << GRUB_DISK_SECTOR_BITS);
+  if (! tmp)
+    {
+      grub_errno = GRUB_ERR_NONE;
+      goto out;
+    }
+
+  total = 0;
+  for (k = 0; k < seg->node_count; k++)
+    if (members[k].end)
+      {
+	struct grub_diskfilter_node *node = &seg->nodes[k];
+
+	members[k].buf = tmp + (total << GRUB_DISK_SECTOR_BITS);
+	total += members[k].end - members[k].start;
+	if (node->pv && node->pv->disk)
+	  grub_disk_prefetch (node->pv->disk, members[k].start + node->start
+			      + node->pv->start_sector,
+			      members[k].end - members[k].start);
+      }
+
+  for (k = 0; k < seg->node_count; k++)
+    if (members[k].end
+	&& grub_diskfilter_read_node (&seg->nodes[k], members[k].start,
+				      members[k].end - members[k].start,
+				      members[k].buf))
+      {
+	grub_errno = GRUB_ERR_NONE;
+	goto out;
+      }
+
+  ctx.members = members;
+  ctx.buf = buf;
+  striped_iterate_chunks (seg, sector, size, striped_copy_chunk, &ctx);
+  ret = 1;
+
+ out:
+  grub_free (tmp);
+  grub_free (members);
+  return ret;
+}
+
 static grub_err_t
 read_segment (struct grub_diskfilter_segment *seg, grub_disk_addr_t sector,
 	      grub_size_t size, char *buf)
@@ -593,6 +875,10 @@ read_segment (struct grub_diskfilter_segment *seg, grub_disk_addr_t sector,
 	grub_disk_addr_t read_sector, far_ofs;
 	grub_uint64_t disknr, b, near, far, ofs;
 	unsigned int i, j;
+
+	if (seg->type != GRUB_DISKFILTER_MIRROR
+	    && read_striped_parallel (seg, sector, size, buf))
+	  return GRUB_ERR_NONE;
 	    
 	read_sector = grub_divmod64 (sector, seg->stripe_size, &b);
 	far = ofs = near = 1;
@@ -694,6 +980,12 @@ read_segment (struct grub_diskfilter_segment *seg, grub_disk_addr_t sector,
       {
 	grub_disk_addr_t read_sector;
 	grub_uint64_t b, p, n, disknr, e;
+	/* Member which failed during this request and, for RAID4/5, its
+	   contents rebuilt ahead from REC_START on.  */
+	grub_uint64_t failed = seg->node_count;
+	char *rec_buf = 0;
+	grub_disk_addr_t rec_start = 0;
+	grub_size_t rec_size = 0;
 
 	/* n = 1 for level 4 and 5, 2 for level 6.  */
 	n = seg->type / 3;
@@ -749,19 +1041,35 @@ read_segment (struct grub_diskfilter_segment *seg, grub_disk_addr_t sector,
 		|| grub_errno == GRUB_ERR_UNKNOWN_DEVICE)
 	      grub_errno = GRUB_ERR_NONE;
 
-	    err = grub_diskfilter_read_node (&seg->nodes[disknr],
-					     read_sector + b,
-					     read_size,
-					     buf);
+	    if (disknr == failed && rec_buf && read_sector + b >= rec_start
+		&& read_sector + b + read_size <= rec_start + rec_size)
+	      {
+		grub_memcpy (buf, rec_buf + ((read_sector + b - rec_start)
+					     << GRUB_DISK_SECTOR_BITS),
+			     read_size << GRUB_DISK_SECTOR_BITS);
+		err = GRUB_ERR_NONE;
+	      }
+	    else if (disknr == failed)
+	      /* Don't retry a member which already failed.  */
+	      err = GRUB_ERR_READ_ERROR;
+	    else
+	      err = grub_diskfilter_read_node (&seg->nodes[disknr],
+					       read_sector + b,
+					       read_size,
+					       buf);
 
 	    if ((err) && (err != GRUB_ERR_READ_ERROR
 			  && err != GRUB_ERR_UNKNOWN_DEVICE))
-	      return err;
+	      {
+		grub_free (rec_buf);
+		return err;
+	      }
 	    e++;
 
 	    if (err)
 	      {
 		grub_errno = GRUB_ERR_NONE;
+		failed = disknr;
 		if (seg->type == GRUB_DISKFILTER_RAID6)
 		  {
 		    err = ((grub_raid6_recover_func) ?
@@ -772,19 +1080,59 @@ read_segment (struct grub_diskfilter_segment *seg, grub_disk_addr_t sector,
 				       N_("module `%s' isn't loaded"),
 				       "raid6rec"));
 		  }
-		else
+		else if (grub_raid5_recover_func)
 		  {
-		    err = ((grub_raid5_recover_func) ?
-			   (*grub_raid5_recover_func) (seg, disknr,
-						       buf, read_sector + b,
-						       read_size) :
-			   grub_error (GRUB_ERR_BAD_DEVICE,
-				       N_("module `%s' isn't loaded"),
-				       "raid5rec"));
+		    /* Every member is the xor of all the others whether it
+		       holds data or parity in a given row, so the member
+		       can be rebuilt for all the rows this request still
+		       touches in one go, with one large read per
+		       surviving member instead of one per row.  */
+		    grub_uint64_t last_row;
+		    grub_size_t ahead;
+
+		    last_row = grub_divmod64 (grub_divmod64 (sector + size - 1,
+							     seg->stripe_size,
+							     0),
+					      seg->node_count - n, 0);
+		    ahead = (last_row + 1) * seg->stripe_size
+		      - (read_sector + b);
+		    if (ahead > GRUB_DISKFILTER_RECOVER_AHEAD)
+		      ahead = GRUB_DISKFILTER_RECOVER_AHEAD;
+		    if (ahead < read_size)
+		      ahead = read_size;
+
+		    grub_free (rec_buf);
+		    rec_buf = 0;
+		    if (ahead > read_size)
+		      rec_buf = grub_malloc (ahead << GRUB_DISK_SECTOR_BITS);
+		    if (rec_buf)
+		      {
+			rec_start = read_sector + b;
+			rec_size = ahead;
+			err = (*grub_raid5_recover_func) (seg, disknr, rec_buf,
+							  rec_start, rec_size);
+			if (!err)
+			  grub_memcpy (buf, rec_buf,
+				       read_size << GRUB_DISK_SECTOR_BITS);
+		      }
+		    else
+		      {
+			grub_errno = GRUB_ERR_NONE;
+			err = (*grub_raid5_recover_func) (seg, disknr,
+							  buf, read_sector + b,
+							  read_size);
+		      }
 		  }
+		else
+		  err = grub_error (GRUB_ERR_BAD_DEVICE,
+				    N_("module `%s' isn't loaded"),
+				    "raid5rec");
 
 		if (err)
-		  return err;
+		  {
+		    grub_free (rec_buf);
+		    return err;
+		  }
 	      }
 
 	    buf += read_size << GRUB_DISK_SECTOR_BITS;
@@ -843,7 +1191,8 @@ read_segment (struct grub_diskfilter_segment *seg, grub_disk_addr_t sector,
 		  disknr = 0;
 	      }
 	  }
-      }   
+	grub_free (rec_buf);
+      }
       return GRUB_ERR_NONE;
     default:
       return grub_error (GRUB_ERR_NOT_IMPLEMENTED_YET,
@@ -1338,13 +1687,31 @@ static struct grub_disk_dev grub_diskfilter_dev =
   };
 
 
+static grub_err_t
+grub_cmd_diskfilter_rescan (grub_command_t cmd __attribute__ ((unused)),
+			    int argc __attribute__ ((unused)),
+			    char **args __attribute__ ((unused)))
+{
+  scan_cache_flush ();
+  scan_devices (NULL);
+  return grub_errno;
+}
+
+static grub_command_t cmd_rescan;
+
 GRUB_MOD_INIT(diskfilter)
 {
   grub_disk_dev_register (&grub_diskfilter_dev);
+  cmd_rescan = grub_register_command ("diskfilter_rescan",
+				      grub_cmd_diskfilter_rescan, 0,
+				      N_("Scan all disks for RAID and LVM "
+					 "members again."));
 }
 
 GRUB_MOD_FINI(diskfilter)
 {
+  grub_unregister_command (cmd_rescan);
   grub_disk_dev_unregister (&grub_diskfilter_dev);
+  scan_cache_flush ();
   free_array ();
 }
@@ -27,17 +27,55 @@
 #include <grub/efi/efi.h>
 #include <grub/efi/disk.h>
 
+enum grub_efidisk_prefetch_state
+  {
+    GRUB_EFIDISK_PREFETCH_NONE,
+    GRUB_EFIDISK_PREFETCH_PENDING,
+    GRUB_EFIDISK_PREFETCH_DONE
+  };
+
+/* A background read issued through EFI_BLOCK_IO2_PROTOCOL.  */
+struct grub_efidisk_prefetch
+{
+  enum grub_efidisk_prefetch_state state;
+  grub_efi_block_io2_token_t token;
+  grub_efi_uint32_t media_id;
+  grub_disk_addr_t sector;
+  grub_size_t size;
+  char *buf;
+  grub_size_t buf_size;
+  /* When the slot was last filled or read from, to pick one to reuse.  */
+  unsigned long stamp;
+};
+
+/* Background reads kept per disk: the window the reader is working
+   through and the one after it.  */
+#define GRUB_EFIDISK_PREFETCH_SLOTS	2
+
 struct grub_efidisk_data
 {
   grub_efi_handle_t handle;
   grub_efi_device_path_t *device_path;
   grub_efi_device_path_t *last_device_path;
   grub_efi_block_io_t *block_io;
+  grub_efi_block_io2_t *block_io2;
+  struct grub_efidisk_prefetch prefetch[GRUB_EFIDISK_PREFETCH_SLOTS];
+  unsigned long prefetch_stamp;
+  /* Largest transfer in bytes the device is believed to handle, or 0 if
+     it hasn't been opened yet.  */
+  grub_size_t max_transfer;
   struct grub_efidisk_data *next;
 };
 
+/* Transfers start at GRUB_EFIDISK_MAX_TRANSFER bytes.  If the firmware
+   rejects one, the limit is halved down to GRUB_EFIDISK_SAFE_TRANSFER,
+   which is known to work with all firmware.  */
+#define GRUB_EFIDISK_MAX_TRANSFER	0x1000000
+#define GRUB_EFIDISK_SAFE_TRANSFER	0xa0000
+
 /* GUID.  */
 static grub_efi_guid_t block_io_guid = GRUB_EFI_BLOCK_IO_GUID;
+static grub_efi_guid_t block_io2_guid = GRUB_EFI_BLOCK_IO2_GUID;
 
 static struct grub_efidisk_data *fd_devices;
 static struct grub_efidisk_data *hd_devices;
@@ -80,7 +118,7 @@ make_devices (void)
 	/* This should not happen... Why?  */
 	continue;
 
-      d = grub_malloc (sizeof (*d));
+      d = grub_zalloc (sizeof (*d));
       if (! d)
 	{
 	  /* Uggh.  */
@@ -92,6 +130,9 @@ make_devices (void)
       d->device_path = dp;
       d->last_device_path = ldp;
       d->block_io = bio;
+      /* Optional, used for read-ahead.  */
+      d->block_io2 = grub_efi_open_protocol (*handle, &block_io2_guid,
+					     GRUB_EFI_OPEN_PROTOCOL_GET_PROTOCOL);
       d->next = devices;
       devices = d;
     }
@@ -349,6 +390,62 @@ name_devices (struct grub_efidisk_data *devices)
     }
 }
 
+/* Wait until the background read in PF, if any, is over.  */
+static void
+prefetch_wait (struct grub_efidisk_prefetch *pf)
+{
+  grub_efi_uintn_t index;
+
+  if (pf->state != GRUB_EFIDISK_PREFETCH_PENDING)
+    return;
+
+  efi_call_3 (grub_efi_system_table->boot_services->wait_for_event, 1,
+	      &pf->token.event, &index);
+  pf->state = (pf->token.transaction_status == GRUB_EFI_SUCCESS
+	       ? GRUB_EFIDISK_PREFETCH_DONE : GRUB_EFIDISK_PREFETCH_NONE);
+}
+
+/* Wait until all background reads of D are over.  */
+static void
+prefetch_wait_all (struct grub_efidisk_data *d)
+{
+  unsigned i;
+
+  for (i = 0; i < GRUB_EFIDISK_PREFETCH_SLOTS; i++)
+    prefetch_wait (&d->prefetch[i]);
+}
+
+/* Return non-zero if the background read in PF is over, without
+   blocking.  */
+static int
+prefetch_poll (struct grub_efidisk_prefetch *pf)
+{
+  grub_efi_status_t status;
+
+  if (pf->state != GRUB_EFIDISK_PREFETCH_PENDING)
+    return 1;
+
+  status = efi_call_1 (grub_efi_system_table->boot_services->check_event,
+		       pf->token.event);
+  if (status == GRUB_EFI_NOT_READY)
+    return 0;
+
+  prefetch_wait (pf);
+  return 1;
+}
+
+static void
+prefetch_release (struct grub_efidisk_prefetch *pf)
+{
+  /* The firmware may still be writing into the buffer.  */
+  prefetch_wait (pf);
+  if (pf->token.event)
+    efi_call_1 (grub_efi_system_table->boot_services->close_event,
+		pf->token.event);
+  grub_free (pf->buf);
+  grub_memset (pf, 0, sizeof (*pf));
+}
+
 static void
 free_devices (struct grub_efidisk_data *devices)
 {
@@ -356,7 +453,11 @@ free_devices (struct grub_efidisk_data *devices)
 
   for (p = devices; p; p = q)
     {
+      unsigned i;
+
       q = p->next;
+      for (i = 0; i < GRUB_EFIDISK_PREFETCH_SLOTS; i++)
+	prefetch_release (&p->prefetch[i]);
       grub_free (p);
     }
 }
@@ -490,11 +591,26 @@ grub_efidisk_open (const char *name, struct grub_disk *disk)
   grub_dprintf ("efidisk", "m = %p, last block = %llx, block size = %x\n",
 		m, (unsigned long long) m->last_block, m->block_size);
   disk->total_sectors = m->last_block + 1;
-  /* Don't increase this value due to bug in some EFI.  */
-  disk->max_agglomerate = 0xa0000 >> (GRUB_DISK_CACHE_BITS + GRUB_DISK_SECTOR_BITS);
   if (m->block_size & (m->block_size - 1) || !m->block_size)
     return grub_error (GRUB_ERR_IO, "invalid sector size %d",
 		       m->block_size);
+  if (! d->max_transfer)
+    {
+      d->max_transfer = GRUB_EFIDISK_MAX_TRANSFER;
+      /* Keep transfers a multiple of the granularity the device prefers.  */
+      if (d->block_io->revision >= GRUB_EFI_BLOCK_IO_REVISION3
+	  && m->optimal_transfer_length_granularity)
+	{
+	  grub_size_t gran = ((grub_size_t) m->optimal_transfer_length_granularity
+			      * m->block_size);
+	  if (gran <= d->max_transfer)
+	    d->max_transfer -= d->max_transfer % gran;
+	}
+    }
+  grub_dprintf ("efidisk", "io align = %x, max transfer = %lx\n",
+		m->io_align, (unsigned long) d->max_transfer);
+  disk->max_agglomerate = d->max_transfer >> (GRUB_DISK_CACHE_BITS
+					      + GRUB_DISK_SECTOR_BITS);
   for (disk->log_sector_size = 0;
        (1U << disk->log_sector_size) < m->block_size;
        disk->log_sector_size++);
@@ -518,27 +634,222 @@ grub_efidisk_readwrite (struct grub_disk *disk, grub_disk_addr_t sector,
 {
   struct grub_efidisk_data *d;
   grub_efi_block_io_t *bio;
+  grub_size_t io_align;
 
   d = disk->data;
   bio = d->block_io;
+  io_align = bio->media->io_align ? bio->media->io_align : 1;
+
+  while (size)
+    {
+      grub_efi_status_t status;
+      grub_size_t count, bytes;
+      char *io_buf = buf;
+
+      count = d->max_transfer >> disk->log_sector_size;
+      if (count > size)
+	count = size;
+      bytes = count << disk->log_sector_size;
+
+      /* The firmware may refuse buffers not aligned to its liking, so
+	 bounce those.  Aligned ones are transferred in place.  */
+      if ((grub_addr_t) buf & (io_align - 1))
+	{
+	  io_buf = grub_memalign (io_align, bytes);
+	  if (! io_buf)
+	    {
+	      grub_errno = GRUB_ERR_NONE;
+	      return GRUB_EFI_OUT_OF_RESOURCES;
+	    }
+	  if (wr)
+	    grub_memcpy (io_buf, buf, bytes);
+	}
+
+      status = efi_call_5 ((wr ? bio->write_blocks : bio->read_blocks), bio,
+			   bio->media->media_id,
+			   (grub_efi_uint64_t) sector,
+			   (grub_efi_uintn_t) bytes, io_buf);
+
+      if (io_buf != buf)
+	{
+	  if (! wr && status == GRUB_EFI_SUCCESS)
+	    grub_memcpy (buf, io_buf, bytes);
+	  grub_free (io_buf);
+	}
 
-  return efi_call_5 ((wr ? bio->write_blocks : bio->read_blocks), bio,
-		     bio->media->media_id,
-		     (grub_efi_uint64_t) sector,
-		     (grub_efi_uintn_t) size << disk->log_sector_size,
-		     buf);
+      if (status != GRUB_EFI_SUCCESS)
+	{
+	  if (bytes <= GRUB_EFIDISK_SAFE_TRANSFER
+	      || status == GRUB_EFI_NO_MEDIA || status == GRUB_EFI_MEDIA_CHANGED)
+	    return status;
+
+	  /* Retry with smaller transfers and stick to them.  */
+	  d->max_transfer = ALIGN_UP ((bytes >> 1),
+				      (1U << disk->log_sector_size));
+	  if (d->max_transfer < GRUB_EFIDISK_SAFE_TRANSFER)
+	    d->max_transfer = GRUB_EFIDISK_SAFE_TRANSFER;
+	  disk->max_agglomerate = d->max_transfer >> (GRUB_DISK_CACHE_BITS
+						      + GRUB_DISK_SECTOR_BITS);
+	  grub_dprintf ("efidisk", "lowering max transfer of %s to %lx\n",
+			disk->name, (unsigned long) d->max_transfer);
+	  continue;
+	}
+
+      sector += count;
+      size -= count;
+      buf += bytes;
+    }
+
+  return GRUB_EFI_SUCCESS;
+}
+
+static grub_err_t
+grub_efidisk_prefetch (struct grub_disk *disk, grub_disk_addr_t sector,
+		       grub_size_t size)
+{
+  struct grub_efidisk_data *d = disk->data;
+  struct grub_efidisk_prefetch *pf = NULL;
+  grub_efi_block_io2_t *bio2 = d->block_io2;
+  grub_size_t bytes;
+  grub_efi_status_t status;
+  unsigned i;
+
+  if (size > (d->max_transfer >> disk->log_sector_size))
+    size = d->max_transfer >> disk->log_sector_size;
+  bytes = size << disk->log_sector_size;
+
+  if (! bio2)
+    return grub_error (GRUB_ERR_NOT_IMPLEMENTED_YET, "no BlockIo2 on `%s'",
+		       disk->name);
+
+  /* Take a free slot, or else the one used least recently.  Reads still
+     in flight are left alone.  */
+  for (i = 0; i < GRUB_EFIDISK_PREFETCH_SLOTS; i++)
+    {
+      struct grub_efidisk_prefetch *p = &d->prefetch[i];
+
+      if (p->state != GRUB_EFIDISK_PREFETCH_NONE
+	  && sector >= p->sector && sector + size <= p->sector + p->size)
+	return GRUB_ERR_NONE;
+      if (! prefetch_poll (p))
+	continue;
+      if (! pf
+	  || (p->state == GRUB_EFIDISK_PREFETCH_NONE
+	      && pf->state != GRUB_EFIDISK_PREFETCH_NONE)
+	  || (p->state == pf->state && p->stamp < pf->stamp))
+	pf = p;
+    }
+  if (! pf)
+    return GRUB_ERR_NONE;
+
+  if (pf->buf_size < bytes)
+    {
+      grub_size_t align = bio2->media->io_align;
+
+      grub_free (pf->buf);
+      pf->buf_size = 0;
+      pf->state = GRUB_EFIDISK_PREFETCH_NONE;
+      pf->buf = grub_memalign (align > 1 ? align : 1, bytes);
+      if (! pf->buf)
+	return grub_errno;
+      pf->buf_size = bytes;
+    }
+
+  if (! pf->token.event
+      && efi_call_5 (grub_efi_system_table->boot_services->create_event,
+		     0, 0, NULL, NULL, &pf->token.event) != GRUB_EFI_SUCCESS)
+    {
+      pf->token.event = 0;
+      d->block_io2 = 0;
+      return grub_error (GRUB_ERR_IO, "couldn't create event");
+    }
+
+  grub_dprintf ("efidisk",
+		"prefetching 0x%lx sectors at the sector 0x%llx from %s\n",
+		(unsigned long) size, (unsigned long long) sector, disk->name);
+
+  pf->media_id = bio2->media->media_id;
+  pf->sector = sector;
+  pf->size = size;
+  pf->stamp = ++d->prefetch_stamp;
+  pf->token.transaction_status = GRUB_EFI_SUCCESS;
+  status = efi_call_6 (bio2->read_blocks_ex, bio2, pf->media_id,
+		       (grub_efi_uint64_t) sector, &pf->token,
+		       (grub_efi_uintn_t) bytes, pf->buf);
+  if (status != GRUB_EFI_SUCCESS)
+    {
+      pf->state = GRUB_EFIDISK_PREFETCH_NONE;
+      return grub_error (GRUB_ERR_READ_ERROR,
+			 N_("failure reading sector 0x%llx from `%s'"),
+			 (unsigned long long) sector, disk->name);
+    }
+
+  pf->state = GRUB_EFIDISK_PREFETCH_PENDING;
+  return GRUB_ERR_NONE;
+}
+
+/* Return the finished background read of D holding SECTOR, if any.  */
+static struct grub_efidisk_prefetch *
+prefetch_find (struct grub_efidisk_data *d, grub_disk_addr_t sector)
+{
+  unsigned i;
+
+  for (i = 0; i < GRUB_EFIDISK_PREFETCH_SLOTS; i++)
+    {
+      struct grub_efidisk_prefetch *pf = &d->prefetch[i];
+
+      if (pf->state == GRUB_EFIDISK_PREFETCH_DONE
+	  && pf->media_id == d->block_io->media->media_id
+	  && sector >= pf->sector && sector < pf->sector + pf->size)
+	return pf;
+    }
+  return NULL;
 }
 
 static grub_err_t
 grub_efidisk_read (struct grub_disk *disk, grub_disk_addr_t sector,
 		   grub_size_t size, char *buf)
 {
+  struct grub_efidisk_data *d = disk->data;
+  struct grub_efidisk_prefetch *pf;
   grub_efi_status_t status;
 
   grub_dprintf ("efidisk",
 		"reading 0x%lx sectors at the sector 0x%llx from %s\n",
 		(unsigned long) size, (unsigned long long) sector, disk->name);
 
+  /* Don't mix blocking and non-blocking requests to the same device, some
+     firmware doesn't cope with it.  */
+  prefetch_wait_all (d);
+
+  /* Take whatever the background reads have of the start and the end of
+     the range, only the rest goes to the firmware.  */
+  while (size && (pf = prefetch_find (d, sector)))
+    {
+      grub_size_t n = pf->sector + pf->size - sector;
+
+      if (n > size)
+	n = size;
+      grub_memcpy (buf, pf->buf + ((sector - pf->sector)
+				   << disk->log_sector_size),
+		   n << disk->log_sector_size);
+      pf->stamp = ++d->prefetch_stamp;
+      sector += n;
+      size -= n;
+      buf += n << disk->log_sector_size;
+    }
+  while (size && (pf = prefetch_find (d, sector + size - 1)))
+    {
+      grub_size_t n = sector + size - pf->sector;
+
+      grub_memcpy (buf + ((size - n) << disk->log_sector_size), pf->buf,
+		   n << disk->log_sector_size);
+      pf->stamp = ++d->prefetch_stamp;
+      size -= n;
+    }
+  if (! size)
+    return GRUB_ERR_NONE;
+
   status = grub_efidisk_readwrite (disk, sector, size, buf, 0);
 
   if (status != GRUB_EFI_SUCCESS)
@@ -554,12 +865,20 @@ static grub_err_t
 grub_efidisk_write (struct grub_disk *disk, grub_disk_addr_t sector,
 		    grub_size_t size, const char *buf)
 {
+  struct grub_efidisk_data *d = disk->data;
   grub_efi_status_t status;
+  unsigned i;
 
   grub_dprintf ("efidisk",
 		"writing 0x%lx sectors at the sector 0x%llx to %s\n",
 		(unsigned long) size, (unsigned long long) sector, disk->name);
 
+  prefetch_wait_all (d);
+  for (i = 0; i < GRUB_EFIDISK_PREFETCH_SLOTS; i++)
+    if (sector < d->prefetch[i].sector + d->prefetch[i].size
+	&& sector + size > d->prefetch[i].sector)
+      d->prefetch[i].state = GRUB_EFIDISK_PREFETCH_NONE;
+
   status = grub_efidisk_readwrite (disk, sector, size, (char *) buf, 1);
 
   if (status != GRUB_EFI_SUCCESS)
@@ -579,6 +898,7 @@ static struct grub_disk_dev grub_efidisk_dev =
     .close = grub_efidisk_close,
     .read = grub_efidisk_read,
     .write = grub_efidisk_write,
+    .prefetch = grub_efidisk_prefetch,
     .next = 0
   };
 
@@ -567,12 +567,13 @@ recover_key (grub_disk_t source, grub_cryptodisk_t dev)
 		       >= sizeof (geli_cipher_key));
 	}
 
-      dev->iv_prefix_len = sizeof (candidate_key.iv_key);
-      grub_memcpy (dev->iv_prefix, candidate_key.iv_key,
-		   sizeof (candidate_key.iv_key));
-
       COMPILE_TIME_ASSERT (sizeof (dev->iv_prefix) >= sizeof (candidate_key.iv_key));
 
+      gcry_err = grub_cryptodisk_set_iv_prefix (dev, candidate_key.iv_key,
+						sizeof (candidate_key.iv_key));
+      if (gcry_err)
+	return grub_crypto_gcry_error (gcry_err);
+
       return GRUB_ERR_NONE;
     }
 
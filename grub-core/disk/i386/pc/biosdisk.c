@@ -33,6 +33,8 @@ GRUB_MOD_LICENSE ("GPLv3+");
 
 static int cd_drive = 0;
 static int grub_biosdisk_rw_int13_extensions (int ah, int drive, void *dap);
+static grub_size_t get_safe_sectors (grub_disk_t disk,
+				     grub_disk_addr_t sector);
 
 static int grub_biosdisk_get_num_floppies (void)
 {
@@ -329,6 +331,27 @@ grub_biosdisk_iterate (grub_disk_dev_iterate_hook_t hook, void *hook_data,
   return 0;
 }
 
+/* The DAP sits at the end of the scratch area, everything before it is
+   the bounce buffer.  */
+#define GRUB_BIOSDISK_DAP_ADDR	(GRUB_MEMORY_MACHINE_SCRATCH_ADDR \
+				 + GRUB_MEMORY_MACHINE_SCRATCH_SIZE \
+				 - sizeof (struct grub_biosdisk_dap))
+
+/* Return the number of sectors the bounce buffer takes, at most 0x7f
+   because of Phoenix EDD.  */
+static grub_size_t
+get_max_sectors (grub_disk_t disk)
+{
+  grub_size_t size;
+
+  size = (GRUB_BIOSDISK_DAP_ADDR - GRUB_MEMORY_MACHINE_SCRATCH_ADDR)
+    >> disk->log_sector_size;
+  if (size > 0x7f)
+    size = 0x7f;
+
+  return size;
+}
+
 static grub_err_t
 grub_biosdisk_open (const char *name, grub_disk_t disk)
 {
@@ -431,12 +454,13 @@ grub_biosdisk_open (const char *name, grub_disk_t disk)
     }
 
   disk->total_sectors = total_sectors;
-  /* Limit the max to 0x7f because of Phoenix EDD.  */
-  disk->max_agglomerate = 0x7f >> GRUB_DISK_CACHE_BITS;
-  COMPILE_TIME_ASSERT ((0x7f >> GRUB_DISK_CACHE_BITS
-			<< (GRUB_DISK_SECTOR_BITS + GRUB_DISK_CACHE_BITS))
-		       + sizeof (struct grub_biosdisk_dap)
-		       < GRUB_MEMORY_MACHINE_SCRATCH_SIZE);
+  /* Large reads are split into BIOS calls by grub_biosdisk_read, so let
+     the disk layer hand them over in one piece.  */
+  disk->max_agglomerate = 1048576 >> (GRUB_DISK_SECTOR_BITS
+				      + GRUB_DISK_CACHE_BITS);
+  grub_dprintf ("biosdisk", "%s: %s, %" PRIuGRUB_SIZE " sectors per call\n",
+		disk->name, (data->flags & GRUB_BIOSDISK_FLAG_LBA)
+		? "LBA" : "CHS", get_max_sectors (disk));
 
   disk->data = data;
 
@@ -474,9 +498,7 @@ grub_biosdisk_rw (int cmd, grub_disk_t disk,
     {
       struct grub_biosdisk_dap *dap;
 
-      dap = (struct grub_biosdisk_dap *) (GRUB_MEMORY_MACHINE_SCRATCH_ADDR
-					  + (data->sectors
-					     << disk->log_sector_size));
+      dap = (struct grub_biosdisk_dap *) GRUB_BIOSDISK_DAP_ADDR;
       dap->length = sizeof (*dap);
       dap->reserved = 0;
       dap->blocks = size;
@@ -503,10 +525,21 @@ grub_biosdisk_rw (int cmd, grub_disk_t disk,
       else
         if (grub_biosdisk_rw_int13_extensions (cmd + 0x42, data->drive, dap))
 	  {
-	    /* Fall back to the CHS mode.  */
+	    /* Fall back to the CHS mode, one track at a time.  */
 	    data->flags &= ~GRUB_BIOSDISK_FLAG_LBA;
 	    disk->total_sectors = data->cylinders * data->heads * data->sectors;
-	    return grub_biosdisk_rw (cmd, disk, sector, size, segment);
+	    while (size)
+	      {
+		grub_size_t len = get_safe_sectors (disk, sector);
+
+		if (len > size)
+		  len = size;
+		if (grub_biosdisk_rw (cmd, disk, sector, len, segment))
+		  return grub_errno;
+		sector += len;
+		size -= len;
+		segment += (len << disk->log_sector_size) >> 4;
+	      }
 	  }
     }
   else
@@ -565,11 +598,18 @@ get_safe_sectors (grub_disk_t disk, grub_disk_addr_t sector)
   struct grub_biosdisk_data *data = disk->data;
   grub_uint32_t sectors = data->sectors;
 
+  /* LBA transfers don't care about tracks.  */
+  if (data->flags & GRUB_BIOSDISK_FLAG_LBA)
+    return get_max_sectors (disk);
+
   /* OFFSET = SECTOR % SECTORS */
   grub_divmod64 (sector, sectors, &offset);
 
   size = sectors - offset;
 
+  if (size > get_max_sectors (disk))
+    size = get_max_sectors (disk);
+
   return size;
 }
 
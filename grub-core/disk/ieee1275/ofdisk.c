@@ -25,8 +25,12 @@
 #include <grub/i18n.h>
 #include <grub/time.h>
 
-static char *last_devpath;
-static grub_ieee1275_ihandle_t last_ihandle;
+/* Client interface calls are expensive on some firmware (PowerVM in
+   particular), so whatever a call has told about a device is kept in its
+   hash entry: the instance opened for reading stays open until
+   grub_ofdisk_fini, the device type and block size are asked for only
+   once and a seek is skipped when the read continues where the last one
+   ended.  */
 
 struct ofdisk_hash_ent
 {
@@ -36,6 +40,16 @@ struct ofdisk_hash_ent
   int is_boot;
   int is_removable;
   int block_size_fails;
+  /* Set once the node is known to be of type "block".  */
+  int is_block;
+  /* Block size asked from the firmware, 0 if it has no answer.  */
+  grub_uint32_t block_size;
+  int block_size_known;
+  /* Largest transfer the firmware takes in one read, 0 if unknown.  */
+  grub_uint32_t max_transfer;
+  /* Instance of open_path, or 0, and its position in bytes.  */
+  grub_ieee1275_ihandle_t ihandle;
+  grub_uint64_t pos;
   /* Pointer to shortest available name on nodes representing canonical names,
      otherwise NULL.  */
   const char *shortest;
@@ -44,9 +58,11 @@ struct ofdisk_hash_ent
 };
 
 static grub_err_t
-grub_ofdisk_get_block_size (const char *device, grub_uint32_t *block_size,
+grub_ofdisk_get_block_size (grub_uint32_t *block_size,
 			    struct ofdisk_hash_ent *op);
 
+#define OFDISK_POS_UNKNOWN	((grub_uint64_t) -1)
+
 #define OFDISK_HASH_SZ	8
 static struct ofdisk_hash_ent *ofdisk_hash[OFDISK_HASH_SZ];
 
@@ -358,7 +374,17 @@ dev_iterate (const struct grub_ieee1275_devalias *alias)
 static void
 scan (void)
 {
+  static int scanned;
+  static unsigned long scan_generation;
   struct grub_ieee1275_devalias alias;
+
+  /* Walking the device tree takes a client interface call per node, and
+     the nodes don't change until the disks are said to have.  */
+  if (scanned && scan_generation == grub_disk_generation)
+    return;
+  scanned = 1;
+  scan_generation = grub_disk_generation;
+
   FOR_IEEE1275_DEVALIASES(alias)
     {
       if (grub_strcmp (alias.type, "block") != 0)
@@ -451,6 +477,55 @@ compute_dev_path (const char *name)
   return devpath;
 }
 
+static grub_err_t
+ofdisk_open_instance (struct ofdisk_hash_ent *op)
+{
+  if (op->ihandle)
+    return GRUB_ERR_NONE;
+
+  grub_ieee1275_open (op->open_path, &op->ihandle);
+  if (! op->ihandle)
+    return grub_error (GRUB_ERR_UNKNOWN_DEVICE, "can't open device");
+  op->pos = OFDISK_POS_UNKNOWN;
+  return GRUB_ERR_NONE;
+}
+
+static void
+ofdisk_close_instance (struct ofdisk_hash_ent *op)
+{
+  if (op->ihandle)
+    grub_ieee1275_close (op->ihandle);
+  op->ihandle = 0;
+}
+
+/* Ask the firmware for the largest read it takes at once.  */
+static void
+ofdisk_get_max_transfer (struct ofdisk_hash_ent *op)
+{
+  struct max_transfer_args
+    {
+      struct grub_ieee1275_common_hdr common;
+      grub_ieee1275_cell_t method;
+      grub_ieee1275_cell_t ihandle;
+      grub_ieee1275_cell_t catch_result;
+      grub_ieee1275_cell_t max;
+    } args;
+
+  INIT_IEEE1275_COMMON (&args.common, "call-method", 2, 2);
+  args.method = (grub_ieee1275_cell_t) "max-transfer";
+  args.ihandle = op->ihandle;
+  args.catch_result = 1;
+  args.max = 0;
+
+  if (IEEE1275_CALL_ENTRY_FN (&args) == -1 || args.catch_result)
+    {
+      grub_dprintf ("disk", "can't get max transfer\n");
+      return;
+    }
+  op->max_transfer = args.max;
+  grub_dprintf ("disk", "max transfer = %u\n", op->max_transfer);
+}
+
 static grub_err_t
 grub_ofdisk_open (const char *name, grub_disk_t disk)
 {
@@ -461,6 +536,7 @@ grub_ofdisk_open (const char *name, grub_disk_t disk)
   grub_ssize_t actual;
   grub_uint32_t block_size = 0;
   grub_err_t err;
+  struct ofdisk_hash_ent *op;
 
   if (grub_strncmp (name, "ieee1275/", sizeof ("ieee1275/") - 1) != 0)
       return grub_error (GRUB_ERR_UNKNOWN_DEVICE,
@@ -471,24 +547,48 @@ grub_ofdisk_open (const char *name, grub_disk_t disk)
 
   grub_dprintf ("disk", "Opening `%s'.\n", devpath);
 
-  if (grub_ieee1275_finddevice (devpath, &dev))
+  op = ofdisk_hash_find (devpath);
+  if (op)
     {
       grub_free (devpath);
-      return grub_error (GRUB_ERR_UNKNOWN_DEVICE,
-			 "can't read device properties");
+      devpath = op->devpath;
     }
 
-  if (grub_ieee1275_get_property (dev, "device_type", prop, sizeof (prop),
-				  &actual))
+  if (! op || ! op->is_block)
     {
-      grub_free (devpath);
-      return grub_error (GRUB_ERR_UNKNOWN_DEVICE, "can't read the device type");
-    }
+      if (grub_ieee1275_finddevice (devpath, &dev))
+	{
+	  if (! op)
+	    grub_free (devpath);
+	  return grub_error (GRUB_ERR_UNKNOWN_DEVICE,
+			     "can't read device properties");
+	}
 
-  if (grub_strcmp (prop, "block"))
-    {
-      grub_free (devpath);
-      return grub_error (GRUB_ERR_UNKNOWN_DEVICE, "not a block device");
+      if (grub_ieee1275_get_property (dev, "device_type", prop, sizeof (prop),
+				      &actual))
+	{
+	  if (! op)
+	    grub_free (devpath);
+	  return grub_error (GRUB_ERR_UNKNOWN_DEVICE,
+			     "can't read the device type");
+	}
+
+      if (grub_strcmp (prop, "block"))
+	{
+	  if (! op)
+	    grub_free (devpath);
+	  return grub_error (GRUB_ERR_UNKNOWN_DEVICE, "not a block device");
+	}
+
+      /* The hash entry takes over devpath.  */
+      if (! op)
+	op = ofdisk_hash_add (devpath, NULL);
+      if (! op)
+	{
+	  grub_free (devpath);
+	  return grub_errno;
+	}
+      op->is_block = 1;
     }
 
   /* XXX: There is no property to read the number of blocks.  There
@@ -496,97 +596,113 @@ grub_ofdisk_open (const char *name, grub_disk_t disk)
      is possible to use seek for this.  */
   disk->total_sectors = GRUB_DISK_SIZE_UNKNOWN;
 
-  {
-    struct ofdisk_hash_ent *op;
-    op = ofdisk_hash_find (devpath);
-    if (!op)
-      op = ofdisk_hash_add (devpath, NULL);
-    if (!op)
-      {
-        grub_free (devpath);
-        return grub_errno;
-      }
-    disk->id = (unsigned long) op;
-    disk->data = op->open_path;
+  disk->id = (unsigned long) op;
+  disk->data = op;
 
-    err = grub_ofdisk_get_block_size (devpath, &block_size, op);
-    if (err)
-      {
-        grub_free (devpath);
-        return err;
-      }
-    if (block_size != 0)
-      {
-	for (disk->log_sector_size = 0;
-	     (1U << disk->log_sector_size) < block_size;
-	     disk->log_sector_size++);
-      }
-    else
-      disk->log_sector_size = 9;
-  }
+  err = grub_ofdisk_get_block_size (&block_size, op);
+  if (err)
+    return err;
+  if (block_size != 0)
+    {
+      for (disk->log_sector_size = 0;
+	   (1U << disk->log_sector_size) < block_size;
+	   disk->log_sector_size++);
+    }
+  else
+    disk->log_sector_size = 9;
+
+  /* Let the disk layer hand over reads as large as the firmware takes,
+     rather than the default 1MiB.  */
+  if (op->max_transfer >> (GRUB_DISK_SECTOR_BITS + GRUB_DISK_CACHE_BITS)
+      > disk->max_agglomerate)
+    {
+      disk->max_agglomerate = op->max_transfer
+	>> (GRUB_DISK_SECTOR_BITS + GRUB_DISK_CACHE_BITS);
+      if (disk->max_agglomerate > GRUB_DISK_MAX_MAX_AGGLOMERATE)
+	disk->max_agglomerate = GRUB_DISK_MAX_MAX_AGGLOMERATE;
+    }
 
-  grub_free (devpath);
   return 0;
 }
 
 static void
 grub_ofdisk_close (grub_disk_t disk)
 {
-  if (disk->data == last_devpath)
-    {
-      if (last_ihandle)
-	grub_ieee1275_close (last_ihandle);
-      last_ihandle = 0;
-      last_devpath = NULL;
-    }
+  /* The instance stays open for the next user of the device.  */
   disk->data = 0;
 }
 
 static grub_err_t
 grub_ofdisk_prepare (grub_disk_t disk, grub_disk_addr_t sector)
 {
+  struct ofdisk_hash_ent *op = disk->data;
   grub_ssize_t status;
   unsigned long long pos;
+  grub_err_t err;
 
-  if (disk->data != last_devpath)
-    {
-      if (last_ihandle)
-	grub_ieee1275_close (last_ihandle);
-      last_ihandle = 0;
-      last_devpath = NULL;
-
-      grub_ieee1275_open (disk->data, &last_ihandle);
-      if (! last_ihandle)
-	return grub_error (GRUB_ERR_UNKNOWN_DEVICE, "can't open device");
-      last_devpath = disk->data;      
-    }
+  err = ofdisk_open_instance (op);
+  if (err)
+    return err;
 
   pos = sector << disk->log_sector_size;
+  if (pos == op->pos)
+    return 0;
 
-  grub_ieee1275_seek (last_ihandle, pos, &status);
+  op->pos = OFDISK_POS_UNKNOWN;
+  grub_ieee1275_seek (op->ihandle, pos, &status);
   if (status < 0)
     return grub_error (GRUB_ERR_READ_ERROR,
 		       "seek error, can't seek block %llu",
 		       (long long) sector);
+  op->pos = pos;
   return 0;
 }
 
+/* Number of sectors of a transfer of SIZE sectors the firmware takes in
+   one call.  */
+static grub_size_t
+ofdisk_chunk (grub_disk_t disk, grub_size_t size)
+{
+  struct ofdisk_hash_ent *op = disk->data;
+  grub_size_t max = op->max_transfer >> disk->log_sector_size;
+
+  if (max && size > max)
+    return max;
+  return size;
+}
+
 static grub_err_t
 grub_ofdisk_read (grub_disk_t disk, grub_disk_addr_t sector,
 		  grub_size_t size, char *buf)
 {
+  struct ofdisk_hash_ent *op = disk->data;
   grub_err_t err;
   grub_ssize_t actual;
+
   err = grub_ofdisk_prepare (disk, sector);
   if (err)
     return err;
-  grub_ieee1275_read (last_ihandle, buf, size  << disk->log_sector_size,
-		      &actual);
-  if (actual != (grub_ssize_t) (size  << disk->log_sector_size))
-    return grub_error (GRUB_ERR_READ_ERROR, N_("failure reading sector 0x%llx "
-					       "from `%s'"),
-		       (unsigned long long) sector,
-		       disk->name);
+
+  while (size)
+    {
+      grub_size_t cur = ofdisk_chunk (disk, size);
+
+      grub_ieee1275_read (op->ihandle, buf, cur << disk->log_sector_size,
+			  &actual);
+      if (actual != (grub_ssize_t) (cur << disk->log_sector_size))
+	{
+	  op->pos = OFDISK_POS_UNKNOWN;
+	  return grub_error (GRUB_ERR_READ_ERROR,
+			     N_("failure reading sector 0x%llx "
+				"from `%s'"),
+			     (unsigned long long) sector,
+			     disk->name);
+	}
+      op->pos += cur << disk->log_sector_size;
+      sector += cur;
+      size -= cur;
+      buf += cur << disk->log_sector_size;
+    }
 
   return 0;
 }
@@ -595,18 +711,34 @@ static grub_err_t
 grub_ofdisk_write (grub_disk_t disk, grub_disk_addr_t sector,
 		   grub_size_t size, const char *buf)
 {
+  struct ofdisk_hash_ent *op = disk->data;
   grub_err_t err;
   grub_ssize_t actual;
+
   err = grub_ofdisk_prepare (disk, sector);
   if (err)
     return err;
-  grub_ieee1275_write (last_ihandle, buf, size  << disk->log_sector_size,
-		       &actual);
-  if (actual != (grub_ssize_t) (size << disk->log_sector_size))
-    return grub_error (GRUB_ERR_WRITE_ERROR, N_("failure writing sector 0x%llx "
-						"to `%s'"),
-		       (unsigned long long) sector,
-		       disk->name);
+
+  while (size)
+    {
+      grub_size_t cur = ofdisk_chunk (disk, size);
+
+      grub_ieee1275_write (op->ihandle, buf, cur << disk->log_sector_size,
+			   &actual);
+      if (actual != (grub_ssize_t) (cur << disk->log_sector_size))
+	{
+	  op->pos = OFDISK_POS_UNKNOWN;
+	  return grub_error (GRUB_ERR_WRITE_ERROR,
+			     N_("failure writing sector 0x%llx "
+				"to `%s'"),
+			     (unsigned long long) sector,
+			     disk->name);
+	}
+      op->pos += cur << disk->log_sector_size;
+      sector += cur;
+      size -= cur;
+      buf += cur << disk->log_sector_size;
+    }
 
   return 0;
 }
@@ -666,10 +798,12 @@ insert_bootpath (void)
 void
 grub_ofdisk_fini (void)
 {
-  if (last_ihandle)
-    grub_ieee1275_close (last_ihandle);
-  last_ihandle = 0;
-  last_devpath = NULL;
+  unsigned i;
+  struct ofdisk_hash_ent *ent;
+
+  for (i = 0; i < ARRAY_SIZE (ofdisk_hash); i++)
+    for (ent = ofdisk_hash[i]; ent; ent = ent->next)
+      ofdisk_close_instance (ent);
 
   grub_disk_dev_unregister (&grub_ofdisk_dev);
 }
@@ -685,7 +819,7 @@ grub_ofdisk_init (void)
 }
 
 static grub_err_t
-grub_ofdisk_get_block_size (const char *device, grub_uint32_t *block_size,
+grub_ofdisk_get_block_size (grub_uint32_t *block_size,
 			    struct ofdisk_hash_ent *op)
 {
   struct size_args_ieee1275
@@ -697,25 +831,29 @@ grub_ofdisk_get_block_size (const char *device, grub_uint32_t *block_size,
       grub_ieee1275_cell_t size1;
       grub_ieee1275_cell_t size2;
     } args_ieee1275;
+  grub_err_t err;
 
-  if (last_ihandle)
-    grub_ieee1275_close (last_ihandle);
+  *block_size = 0;
 
-  last_ihandle = 0;
-  last_devpath = NULL;
+  if (op->block_size_known)
+    {
+      *block_size = op->block_size;
+      return GRUB_ERR_NONE;
+    }
 
-  grub_ieee1275_open (device, &last_ihandle);
-  if (! last_ihandle)
-    return grub_error (GRUB_ERR_UNKNOWN_DEVICE, "can't open device");
+  err = ofdisk_open_instance (op);
+  if (err)
+    return err;
 
-  *block_size = 0;
+  if (! op->max_transfer)
+    ofdisk_get_max_transfer (op);
 
   if (op->block_size_fails >= 2)
     return GRUB_ERR_NONE;
 
   INIT_IEEE1275_COMMON (&args_ieee1275.common, "call-method", 2, 2);
   args_ieee1275.method = (grub_ieee1275_cell_t) "block-size";
-  args_ieee1275.ihandle = last_ihandle;
+  args_ieee1275.ihandle = op->ihandle;
   args_ieee1275.result = 1;
 
   if (IEEE1275_CALL_ENTRY_FN (&args_ieee1275) == -1)
@@ -734,8 +872,12 @@ grub_ofdisk_get_block_size (const char *device, grub_uint32_t *block_size,
 	   && args_ieee1275.size1 >= 512 && args_ieee1275.size1 <= 16384)
     {
       op->block_size_fails = 0;
+      op->block_size = args_ieee1275.size1;
+      op->block_size_known = 1;
       *block_size = args_ieee1275.size1;
     }
+  else
+    op->block_size_known = 1;
 
   return 0;
 }
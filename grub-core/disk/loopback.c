@@ -27,14 +27,32 @@
 
 GRUB_MOD_LICENSE ("GPLv3+");
 
+/* Where a run of the backing file is on its disk.  */
+struct grub_loopback_extent
+{
+  grub_off_t offset;
+  grub_off_t length;
+  grub_disk_addr_t sector;
+  grub_off_t sector_offset;
+  int hole;
+};
+
 struct grub_loopback
 {
   char *devname;
   grub_file_t file;
+  /* Extents of FILE, in file order, or NULL if it has to be read through
+     its filesystem.  */
+  struct grub_loopback_extent *extents;
+  grub_size_t nextents;
+  grub_size_t allocated;
   struct grub_loopback *next;
   unsigned long id;
 };
 
+/* Length of the pieces the backing file is mapped in.  */
+#define GRUB_LOOPBACK_MAP_CHUNK	0x40000000
+
 static struct grub_loopback *loopback_list;
 static unsigned long last_id = 0;
 
@@ -65,14 +83,104 @@ delete_loopback (const char *name)
 
   /* Remove the device from the list.  */
   *prev = dev->next;
+  grub_disk_generation++;
 
   grub_free (dev->devname);
   grub_file_close (dev->file);
+  grub_free (dev->extents);
   grub_free (dev);
 
   return 0;
 }
 
+/* Helper for map_backing_file.  */
+static grub_err_t
+map_backing_file_iter (const struct grub_fs_extent *extent, void *data)
+{
+  struct grub_loopback *dev = data;
+  struct grub_loopback_extent *last;
+
+  last = dev->nextents ? &dev->extents[dev->nextents - 1] : NULL;
+  if (last && last->offset + last->length == extent->offset
+      && last->hole == extent->hole
+      && (last->hole
+	  || ((last->sector << GRUB_DISK_SECTOR_BITS) + last->sector_offset
+	      + last->length
+	      == (extent->sector << GRUB_DISK_SECTOR_BITS)
+	      + extent->sector_offset)))
+    {
+      last->length += extent->length;
+      return GRUB_ERR_NONE;
+    }
+
+  if (dev->nextents == dev->allocated)
+    {
+      struct grub_loopback_extent *n;
+
+      dev->allocated = dev->allocated ? dev->allocated * 2 : 16;
+      n = grub_realloc (dev->extents,
+			dev->allocated * sizeof (dev->extents[0]));
+      if (!n)
+	return grub_errno;
+      dev->extents = n;
+    }
+
+  last = &dev->extents[dev->nextents++];
+  last->offset = extent->offset;
+  last->length = extent->length;
+  last->sector = extent->sector;
+  last->sector_offset = extent->sector_offset;
+  last->hole = extent->hole;
+  return GRUB_ERR_NONE;
+}
+
+/* Find out where the backing file of DEV is on its disk, so that reads
+   can go to the disk directly instead of through the filesystem and a
+   second cache.  Leave DEV->extents NULL if that isn't possible, e.g.
+   for compressed files.  */
+static void
+map_backing_file (struct grub_loopback *dev)
+{
+  grub_file_t file = dev->file;
+  grub_off_t pos;
+
+  grub_free (dev->extents);
+  dev->extents = NULL;
+  dev->nextents = 0;
+  dev->allocated = 0;
+
+  if (file->size == GRUB_FILE_SIZE_UNKNOWN)
+    return;
+
+  for (pos = 0; pos < file->size; pos += GRUB_LOOPBACK_MAP_CHUNK)
+    {
+      grub_off_t len = file->size - pos;
+
+      if (len > GRUB_LOOPBACK_MAP_CHUNK)
+	len = GRUB_LOOPBACK_MAP_CHUNK;
+      if (grub_file_seek (file, pos) == (grub_off_t) -1
+	  || grub_file_map (file, len, map_backing_file_iter, dev))
+	break;
+    }
+
+  /* Anything short of the whole file is no use.  */
+  if (pos < file->size || !dev->nextents
+      || dev->extents[dev->nextents - 1].offset
+      + dev->extents[dev->nextents - 1].length != file->size)
+    {
+      grub_dprintf ("loopback", "%s: reading through the filesystem\n",
+		    dev->devname);
+      grub_free (dev->extents);
+      dev->extents = NULL;
+      dev->nextents = 0;
+      dev->allocated = 0;
+    }
+  else
+    grub_dprintf ("loopback", "%s: %" PRIuGRUB_SIZE " extents\n",
+		  dev->devname, dev->nextents);
+  grub_errno = GRUB_ERR_NONE;
+}
+
 /* The command to add and remove loopback devices.  */
 static grub_err_t
 grub_cmd_loopback (grub_extcmd_context_t ctxt, int argc, char **args)
@@ -105,12 +213,15 @@ grub_cmd_loopback (grub_extcmd_context_t ctxt, int argc, char **args)
     {
       grub_file_close (newdev->file);
       newdev->file = file;
+      map_backing_file (newdev);
+      /* Same disk, different contents.  */
+      grub_disk_generation++;
 
       return 0;
     }
 
   /* Unable to replace it, make a new entry.  */
-  newdev = grub_malloc (sizeof (struct grub_loopback));
+  newdev = grub_zalloc (sizeof (struct grub_loopback));
   if (! newdev)
     goto fail;
 
@@ -123,10 +234,12 @@ grub_cmd_loopback (grub_extcmd_context_t ctxt, int argc, char **args)
 
   newdev->file = file;
   newdev->id = last_id++;
+  map_backing_file (newdev);
 
   /* Add the new entry to the list.  */
   newdev->next = loopback_list;
   loopback_list = newdev;
+  grub_disk_generation++;
 
   return 0;
 
@@ -181,18 +294,83 @@ grub_loopback_open (const char *name, grub_disk_t disk)
   return 0;
 }
 
+/* Read LEN bytes at OFFSET of the backing file of DEV straight from its
+   disk.  */
+static grub_err_t
+read_extents (struct grub_loopback *dev, grub_off_t offset, grub_size_t len,
+	      char *buf)
+{
+  grub_disk_t disk = dev->file->device->disk;
+  grub_size_t lo = 0, hi = dev->nextents;
+
+  /* Find the extent holding OFFSET.  */
+  while (hi - lo > 1)
+    {
+      grub_size_t mid = (lo + hi) / 2;
+
+      if (dev->extents[mid].offset <= offset)
+	lo = mid;
+      else
+	hi = mid;
+    }
+
+  for (; len && lo < dev->nextents; lo++)
+    {
+      struct grub_loopback_extent *e = &dev->extents[lo];
+      grub_off_t skip = offset - e->offset;
+      grub_size_t n = len;
+
+      if (n > e->length - skip)
+	n = e->length - skip;
+
+      if (e->hole)
+	grub_memset (buf, 0, n);
+      else
+	{
+	  grub_off_t pos = (e->sector << GRUB_DISK_SECTOR_BITS)
+	    + e->sector_offset + skip;
+
+	  if (grub_disk_read (disk, pos >> GRUB_DISK_SECTOR_BITS,
+			      pos & (GRUB_DISK_SECTOR_SIZE - 1), n, buf))
+	    return grub_errno;
+	}
+
+      offset += n;
+      len -= n;
+      buf += n;
+    }
+
+  return GRUB_ERR_NONE;
+}
+
 static grub_err_t
 grub_loopback_read (grub_disk_t disk, grub_disk_addr_t sector,
 		    grub_size_t size, char *buf)
 {
-  grub_file_t file = ((struct grub_loopback *) disk->data)->file;
+  struct grub_loopback *dev = disk->data;
+  grub_file_t file = dev->file;
   grub_off_t pos;
 
-  grub_file_seek (file, sector << GRUB_DISK_SECTOR_BITS);
+  if (dev->extents)
+    {
+      grub_off_t offset = sector << GRUB_DISK_SECTOR_BITS;
+      grub_size_t len = size << GRUB_DISK_SECTOR_BITS;
+
+      if (offset > file->size)
+	len = 0;
+      else if (len > file->size - offset)
+	len = file->size - offset;
+      if (read_extents (dev, offset, len, buf))
+	return grub_errno;
+    }
+  else
+    {
+      grub_file_seek (file, sector << GRUB_DISK_SECTOR_BITS);
 
-  grub_file_read (file, buf, size << GRUB_DISK_SECTOR_BITS);
-  if (grub_errno)
-    return grub_errno;
+      grub_file_read (file, buf, size << GRUB_DISK_SECTOR_BITS);
+      if (grub_errno)
+	return grub_errno;
+    }
 
   /* In case there is more data read than there is available, in case
      of files that are not a multiple of GRUB_DISK_SECTOR_SIZE, fill
@@ -34,85 +34,738 @@
 GRUB_MOD_LICENSE ("GPLv3+");
 
 
-/* Go the string STR and return the number after STR.  *P will point
-   at the number.  In case STR is not found, *P will be NULL and the
-   return value will be 0.  */
-static grub_uint64_t
-grub_lvm_getvalue (char **p, const char *str)
+/* The metadata text is a tree of sections ("name { ... }") and assignments
+   ("name = value"), where a value is a number, a quoted string or a
+   bracketed list of those.  It is tokenized once into nodes pointing into
+   the text, which are then looked up by name.  */
+enum lvm_node_type
+  {
+    LVM_NODE_SECTION,
+    LVM_NODE_NUMBER,
+    LVM_NODE_STRING,
+    LVM_NODE_LIST
+  };
+
+struct lvm_node
 {
-  *p = grub_strstr (*p, str);
-  if (! *p)
-    return 0;
-  *p += grub_strlen (str);
-  return grub_strtoull (*p, p, 10);
+  struct lvm_node *next;
+  /* Contents of a section.  */
+  struct lvm_node *child;
+  enum lvm_node_type type;
+  const char *name;
+  grub_size_t namelen;
+  /* Value of an assignment: the number, the string without its quotes or
+     the list without its brackets.  */
+  const char *value;
+  grub_size_t valuelen;
+};
+
+/* Real metadata nests sections five levels deep.  */
+#define LVM_MAX_DEPTH 16
+
+struct lvm_parser
+{
+  const char *ptr;
+  const char *end;
+};
+
+static void
+lvm_skip_space (struct lvm_parser *ps)
+{
+  while (ps->ptr < ps->end)
+    {
+      if (*ps->ptr == '#')
+	while (ps->ptr < ps->end && *ps->ptr != '\n')
+	  ps->ptr++;
+      else if (grub_isspace (*ps->ptr))
+	ps->ptr++;
+      else
+	break;
+    }
 }
 
-#if 0
 static int
-grub_lvm_checkvalue (char **p, char *str, char *tmpl)
+lvm_is_name_char (char c)
 {
-  int tmpllen = grub_strlen (tmpl);
-  *p = grub_strstr (*p, str);
-  if (! *p)
+  return grub_isalnum (c) || c == '_' || c == '-' || c == '.' || c == '+';
+}
+
+/* Skip the quoted string at PS->ptr.  */
+static int
+lvm_skip_string (struct lvm_parser *ps)
+{
+  for (ps->ptr++; ps->ptr < ps->end && *ps->ptr != '"'; ps->ptr++)
+    if (*ps->ptr == '\\' && ps->ptr + 1 < ps->end)
+      ps->ptr++;
+  if (ps->ptr == ps->end)
     return 0;
-  *p += grub_strlen (str);
-  if (**p != '"')
+  ps->ptr++;
+  return 1;
+}
+
+static int
+lvm_parse_value (struct lvm_parser *ps, struct lvm_node *node)
+{
+  lvm_skip_space (ps);
+  if (ps->ptr == ps->end)
     return 0;
-  return (grub_memcmp (*p + 1, tmpl, tmpllen) == 0 && (*p)[tmpllen + 1] == '"');
+
+  if (*ps->ptr == '"')
+    {
+      node->type = LVM_NODE_STRING;
+      node->value = ps->ptr + 1;
+      if (!lvm_skip_string (ps))
+	return 0;
+      node->valuelen = ps->ptr - 1 - node->value;
+      return 1;
+    }
+
+  if (*ps->ptr == '[')
+    {
+      node->type = LVM_NODE_LIST;
+      node->value = ++ps->ptr;
+      while (ps->ptr < ps->end && *ps->ptr != ']')
+	{
+	  if (*ps->ptr != '"')
+	    ps->ptr++;
+	  else if (!lvm_skip_string (ps))
+	    return 0;
+	}
+      if (ps->ptr == ps->end)
+	return 0;
+      node->valuelen = ps->ptr++ - node->value;
+      return 1;
+    }
+
+  node->type = LVM_NODE_NUMBER;
+  node->value = ps->ptr;
+  while (ps->ptr < ps->end
+	 && (grub_isdigit (*ps->ptr) || *ps->ptr == '-' || *ps->ptr == '.'))
+    ps->ptr++;
+  node->valuelen = ps->ptr - node->value;
+  return node->valuelen != 0;
 }
-#endif
 
+/* Parse the contents of a section up to its closing brace, or up to the
+   end of the text at the top level, into the list *OUT.  Nodes are linked
+   in as soon as they are allocated, so that a partial tree can be freed
+   on failure.  */
 static int
-grub_lvm_check_flag (char *p, const char *str, const char *flag)
+lvm_parse_section (struct lvm_parser *ps, int depth, struct lvm_node **out)
 {
-  grub_size_t len_str = grub_strlen (str), len_flag = grub_strlen (flag);
+  struct lvm_node *node;
+
+  *out = NULL;
   while (1)
     {
-      char *q;
-      p = grub_strstr (p, str);
-      if (! p)
+      lvm_skip_space (ps);
+      if (ps->ptr == ps->end)
+	return depth == 0;
+      if (*ps->ptr == '}')
+	{
+	  ps->ptr++;
+	  return depth != 0;
+	}
+
+      node = grub_zalloc (sizeof (*node));
+      if (!node)
+	return 0;
+      *out = node;
+      out = &node->next;
+
+      node->name = ps->ptr;
+      while (ps->ptr < ps->end && lvm_is_name_char (*ps->ptr))
+	ps->ptr++;
+      node->namelen = ps->ptr - node->name;
+      if (!node->namelen)
 	return 0;
-      p += len_str;
-      if (grub_memcmp (p, " = [", sizeof (" = [") - 1) != 0)
-	continue;
-      q = p + sizeof (" = [") - 1;
-      while (1)
+
+      lvm_skip_space (ps);
+      if (ps->ptr == ps->end)
+	return 0;
+      if (*ps->ptr == '{' && depth < LVM_MAX_DEPTH)
 	{
-	  while (grub_isspace (*q))
-	    q++;
-	  if (*q != '"')
+	  ps->ptr++;
+	  node->type = LVM_NODE_SECTION;
+	  if (!lvm_parse_section (ps, depth + 1, &node->child))
 	    return 0;
-	  q++;
-	  if (grub_memcmp (q, flag, len_flag) == 0 && q[len_flag] == '"')
-	    return 1;
-	  while (*q != '"')
-	    q++;
-	  q++;
-	  if (*q == ']')
+	}
+      else if (*ps->ptr == '=')
+	{
+	  ps->ptr++;
+	  if (!lvm_parse_value (ps, node))
 	    return 0;
-	  q++;
 	}
+      else
+	return 0;
+    }
+}
+
+static void
+lvm_free_nodes (struct lvm_node *node)
+{
+  struct lvm_node *next;
+
+  for (; node; node = next)
+    {
+      next = node->next;
+      lvm_free_nodes (node->child);
+      grub_free (node);
+    }
+}
+
+static int
+lvm_name_is (const struct lvm_node *node, const char *name)
+{
+  grub_size_t len = grub_strlen (name);
+
+  return node->namelen == len && grub_memcmp (node->name, name, len) == 0;
+}
+
+static int
+lvm_value_is (const struct lvm_node *node, const char *value)
+{
+  grub_size_t len = grub_strlen (value);
+
+  return node->valuelen == len && grub_memcmp (node->value, value, len) == 0;
+}
+
+static struct lvm_node *
+lvm_find (const struct lvm_node *section, const char *name,
+	  enum lvm_node_type type)
+{
+  struct lvm_node *node;
+
+  for (node = section->child; node; node = node->next)
+    if (node->type == type && lvm_name_is (node, name))
+      return node;
+  return NULL;
+}
+
+/* Store the number assigned to NAME in SECTION in *VALUE.  Return 0 if
+   there's no such number.  */
+static int
+lvm_getvalue (const struct lvm_node *section, const char *name,
+	      grub_uint64_t *value)
+{
+  struct lvm_node *node;
+
+  node = lvm_find (section, name, LVM_NODE_NUMBER);
+  if (!node)
+    return 0;
+  *value = grub_strtoull (node->value, 0, 10);
+  return 1;
+}
+
+static void
+lvm_list_init (struct lvm_parser *list, const struct lvm_node *node)
+{
+  list->ptr = node->value;
+  list->end = node->value + node->valuelen;
+}
+
+/* Parse the next element of LIST into ELEM.  */
+static int
+lvm_list_next (struct lvm_parser *list, struct lvm_node *elem)
+{
+  while (1)
+    {
+      lvm_skip_space (list);
+      if (list->ptr == list->end)
+	return 0;
+      if (*list->ptr != ',')
+	break;
+      list->ptr++;
+    }
+  return lvm_parse_value (list, elem);
+}
+
+/* Return the next string of LIST as a newly allocated C string, or NULL if
+   there are no more.  */
+static char *
+lvm_list_next_string (struct lvm_parser *list)
+{
+  struct lvm_node elem;
+
+  while (lvm_list_next (list, &elem))
+    if (elem.type == LVM_NODE_STRING)
+      return grub_strndup (elem.value, elem.valuelen);
+  return NULL;
+}
+
+static int
+lvm_check_flag (const struct lvm_node *section, const char *name,
+		const char *flag)
+{
+  struct lvm_node *node, elem;
+  struct lvm_parser list;
+
+  node = lvm_find (section, name, LVM_NODE_LIST);
+  if (!node)
+    return 0;
+  lvm_list_init (&list, node);
+  while (lvm_list_next (&list, &elem))
+    if (elem.type == LVM_NODE_STRING && lvm_value_is (&elem, flag))
+      return 1;
+  return 0;
+}
+
+static const char *
+lvm_get_id (const struct lvm_node *section)
+{
+  struct lvm_node *node;
+
+  node = lvm_find (section, "id", LVM_NODE_STRING);
+  if (!node || node->valuelen != GRUB_LVM_ID_STRLEN)
+    return NULL;
+  return node->value;
+}
+
+static void
+lvm_free_lv (struct grub_diskfilter_lv *lv)
+{
+  unsigned i, j;
+
+  if (lv->segments)
+    for (i = 0; i < lv->segment_count; i++)
+      {
+	if (!lv->segments[i].nodes)
+	  continue;
+	for (j = 0; j < lv->segments[i].node_count; j++)
+	  grub_free (lv->segments[i].nodes[j].name);
+	grub_free (lv->segments[i].nodes);
+      }
+  grub_free (lv->segments);
+  grub_free (lv->name);
+  grub_free (lv->fullname);
+  grub_free (lv->idname);
+  grub_free (lv);
+}
+
+/* Fill SEG from the segment section SEGSEC.  Return -1 on error and 1 if
+   the segment type isn't supported.  */
+static int
+lvm_parse_segment (struct grub_diskfilter_vg *vg,
+		   struct grub_diskfilter_lv *lv,
+		   struct grub_diskfilter_segment *seg,
+		   const struct lvm_node *segsec, int is_pvmove)
+{
+  struct lvm_node *type, *node;
+  struct lvm_parser list;
+  grub_uint64_t value;
+  unsigned j;
+
+  if (!lvm_getvalue (segsec, "start_extent", &seg->start_extent))
+    {
+#ifdef GRUB_UTIL
+      grub_util_info ("unknown start_extent");
+#endif
+      return -1;
+    }
+  if (!lvm_getvalue (segsec, "extent_count", &seg->extent_count))
+    {
+#ifdef GRUB_UTIL
+      grub_util_info ("unknown extent_count");
+#endif
+      return -1;
+    }
+
+  type = lvm_find (segsec, "type", LVM_NODE_STRING);
+  if (!type)
+    return -1;
+
+  lv->size += seg->extent_count * vg->extent_size;
+
+  if (lvm_value_is (type, "striped"))
+    {
+      seg->type = GRUB_DISKFILTER_STRIPED;
+      if (!lvm_getvalue (segsec, "stripe_count", &value))
+	{
+#ifdef GRUB_UTIL
+	  grub_util_info ("unknown stripe_count");
+#endif
+	  return -1;
+	}
+      seg->node_count = value;
+
+      if (seg->node_count != 1)
+	{
+	  if (!lvm_getvalue (segsec, "stripe_size", &value))
+	    {
+#ifdef GRUB_UTIL
+	      grub_util_info ("unknown stripe_size");
+#endif
+	      return -1;
+	    }
+	  seg->stripe_size = value;
+	}
+
+      node = lvm_find (segsec, "stripes", LVM_NODE_LIST);
+      if (!node)
+	{
+#ifdef GRUB_UTIL
+	  grub_util_info ("unknown stripes");
+#endif
+	  return -1;
+	}
+
+      seg->nodes = grub_zalloc (sizeof (seg->nodes[0]) * seg->node_count);
+      if (!seg->nodes)
+	return -1;
+
+      /* Pairs of PV name and starting extent.  */
+      lvm_list_init (&list, node);
+      for (j = 0; j < seg->node_count; j++)
+	{
+	  struct lvm_node start;
+
+	  seg->nodes[j].name = lvm_list_next_string (&list);
+	  if (!seg->nodes[j].name)
+	    break;
+	  if (lvm_list_next (&list, &start) && start.type == LVM_NODE_NUMBER)
+	    seg->nodes[j].start = grub_strtoull (start.value, 0, 10)
+	      * vg->extent_size;
+	}
+      return 0;
+    }
+
+  if (lvm_value_is (type, "mirror"))
+    {
+      seg->type = GRUB_DISKFILTER_MIRROR;
+      if (!lvm_getvalue (segsec, "mirror_count", &value))
+	{
+#ifdef GRUB_UTIL
+	  grub_util_info ("unknown mirror_count");
+#endif
+	  return -1;
+	}
+      seg->node_count = value;
+
+      node = lvm_find (segsec, "mirrors", LVM_NODE_LIST);
+      if (!node)
+	{
+#ifdef GRUB_UTIL
+	  grub_util_info ("unknown mirrors");
+#endif
+	  return -1;
+	}
+
+      seg->nodes = grub_zalloc (sizeof (seg->nodes[0]) * seg->node_count);
+      if (!seg->nodes)
+	return -1;
+
+      lvm_list_init (&list, node);
+      for (j = 0; j < seg->node_count; j++)
+	{
+	  seg->nodes[j].name = lvm_list_next_string (&list);
+	  if (!seg->nodes[j].name)
+	    break;
+	}
+      /* Only first (original) is ok with in progress pvmove.  */
+      if (is_pvmove)
+	seg->node_count = 1;
+      return 0;
+    }
+
+  if (type->valuelen == sizeof ("raidX") - 1
+      && grub_memcmp (type->value, "raid", sizeof ("raid") - 1) == 0
+      && ((type->value[sizeof ("raid") - 1] >= '4'
+	   && type->value[sizeof ("raid") - 1] <= '6')
+	  || type->value[sizeof ("raid") - 1] == '1'))
+    {
+      switch (type->value[sizeof ("raid") - 1])
+	{
+	case '1':
+	  seg->type = GRUB_DISKFILTER_MIRROR;
+	  break;
+	case '4':
+	  seg->type = GRUB_DISKFILTER_RAID4;
+	  seg->layout = GRUB_RAID_LAYOUT_LEFT_ASYMMETRIC;
+	  break;
+	case '5':
+	  seg->type = GRUB_DISKFILTER_RAID5;
+	  seg->layout = GRUB_RAID_LAYOUT_LEFT_SYMMETRIC;
+	  break;
+	case '6':
+	  seg->type = GRUB_DISKFILTER_RAID6;
+	  seg->layout = (GRUB_RAID_LAYOUT_RIGHT_ASYMMETRIC
+			 | GRUB_RAID_LAYOUT_MUL_FROM_POS);
+	  break;
+	}
+
+      if (!lvm_getvalue (segsec, "device_count", &value))
+	{
+#ifdef GRUB_UTIL
+	  grub_util_info ("unknown device_count");
+#endif
+	  return -1;
+	}
+      seg->node_count = value;
+
+      if (seg->type != GRUB_DISKFILTER_MIRROR)
+	{
+	  if (!lvm_getvalue (segsec, "stripe_size", &value))
+	    {
+#ifdef GRUB_UTIL
+	      grub_util_info ("unknown stripe_size");
+#endif
+	      return -1;
+	    }
+	  seg->stripe_size = value;
+	}
+
+      node = lvm_find (segsec, "raids", LVM_NODE_LIST);
+      if (!node)
+	{
+#ifdef GRUB_UTIL
+	  grub_util_info ("unknown raids");
+#endif
+	  return -1;
+	}
+
+      seg->nodes = grub_zalloc (sizeof (seg->nodes[0]) * seg->node_count);
+      if (!seg->nodes)
+	return -1;
+
+      /* Pairs of metadata and image LV, only the images carry data.  */
+      lvm_list_init (&list, node);
+      for (j = 0; j < seg->node_count; j++)
+	{
+	  char *meta;
+
+	  meta = lvm_list_next_string (&list);
+	  if (!meta)
+	    break;
+	  grub_free (meta);
+	  seg->nodes[j].name = lvm_list_next_string (&list);
+	  if (!seg->nodes[j].name)
+	    break;
+	}
+      if (seg->type == GRUB_DISKFILTER_RAID4)
+	{
+	  char *tmp;
+	  tmp = seg->nodes[0].name;
+	  grub_memmove (seg->nodes, seg->nodes + 1,
+			sizeof (seg->nodes[0])
+			* (seg->node_count - 1));
+	  seg->nodes[seg->node_count - 1].name = tmp;
+	}
+      return 0;
+    }
+
+#ifdef GRUB_UTIL
+  {
+    char *name = grub_strndup (type->value, type->valuelen);
+    grub_util_info ("unknown LVM type %s", name);
+    grub_free (name);
+  }
+#endif
+  /* Found a non-supported type, give up and move on. */
+  return 1;
+}
+
+/* Create the LV described by LVSEC.  Return NULL with *SKIP set if it uses
+   an unsupported segment type.  */
+static struct grub_diskfilter_lv *
+lvm_parse_lv (struct grub_diskfilter_vg *vg, const struct lvm_node *lvsec,
+	      const char *vg_id, int *skip)
+{
+  struct grub_diskfilter_lv *lv;
+  const struct lvm_node *node;
+  const char *lv_id;
+  grub_uint64_t segment_count;
+  int is_pvmove;
+  unsigned i;
+
+  lv = grub_zalloc (sizeof (*lv));
+  if (!lv)
+    return NULL;
+
+  lv->name = grub_strndup (lvsec->name, lvsec->namelen);
+  if (!lv->name)
+    goto fail;
+
+  {
+    const char *iptr;
+    char *optr;
+    grub_size_t vgname_len = grub_strlen (vg->name);
+
+    lv->fullname = grub_malloc (sizeof ("lvm/") - 1 + 2 * vgname_len
+				+ 1 + 2 * lvsec->namelen + 1);
+    if (!lv->fullname)
+      goto fail;
+
+    grub_memcpy (lv->fullname, "lvm/", sizeof ("lvm/") - 1);
+    optr = lv->fullname + sizeof ("lvm/") - 1;
+    for (iptr = vg->name; iptr < vg->name + vgname_len; iptr++)
+      {
+	*optr++ = *iptr;
+	if (*iptr == '-')
+	  *optr++ = '-';
+      }
+    *optr++ = '-';
+    for (iptr = lvsec->name; iptr < lvsec->name + lvsec->namelen; iptr++)
+      {
+	*optr++ = *iptr;
+	if (*iptr == '-')
+	  *optr++ = '-';
+      }
+    *optr++ = 0;
+
+    lv_id = lvm_get_id (lvsec);
+    if (!lv_id)
+      {
+#ifdef GRUB_UTIL
+	grub_util_info ("couldn't find ID");
+#endif
+	goto fail;
+      }
+
+    lv->idname = grub_malloc (sizeof ("lvmid/")
+			      + 2 * GRUB_LVM_ID_STRLEN + 1);
+    if (!lv->idname)
+      goto fail;
+    grub_memcpy (lv->idname, "lvmid/", sizeof ("lvmid/") - 1);
+    grub_memcpy (lv->idname + sizeof ("lvmid/") - 1,
+		 vg_id, GRUB_LVM_ID_STRLEN);
+    lv->idname[sizeof ("lvmid/") - 1 + GRUB_LVM_ID_STRLEN] = '/';
+    grub_memcpy (lv->idname + sizeof ("lvmid/") - 1
+		 + GRUB_LVM_ID_STRLEN + 1,
+		 lv_id, GRUB_LVM_ID_STRLEN);
+    lv->idname[sizeof ("lvmid/") - 1 + 2 * GRUB_LVM_ID_STRLEN + 1] = '\0';
+  }
+
+  lv->size = 0;
+
+  lv->visible = lvm_check_flag (lvsec, "status", "VISIBLE");
+  is_pvmove = lvm_check_flag (lvsec, "status", "PVMOVE");
+
+  if (!lvm_getvalue (lvsec, "segment_count", &segment_count))
+    {
+#ifdef GRUB_UTIL
+      grub_util_info ("unknown segment_count");
+#endif
+      goto fail;
+    }
+  lv->segments = grub_zalloc (sizeof (lv->segments[0]) * segment_count);
+  if (!lv->segments)
+    goto fail;
+  lv->segment_count = segment_count;
+
+  /* The segments are the subsections "segment1", "segment2" and so on.  */
+  node = lvsec->child;
+  for (i = 0; i < lv->segment_count; i++)
+    {
+      int ret;
+
+      while (node && (node->type != LVM_NODE_SECTION
+		      || node->namelen <= sizeof ("segment") - 1
+		      || grub_memcmp (node->name, "segment",
+				      sizeof ("segment") - 1) != 0))
+	node = node->next;
+      if (!node)
+	{
+#ifdef GRUB_UTIL
+	  grub_util_info ("unknown segment");
+#endif
+	  goto fail;
+	}
+
+      ret = lvm_parse_segment (vg, lv, &lv->segments[i], node, is_pvmove);
+      if (ret < 0)
+	goto fail;
+      if (ret > 0)
+	{
+	  *skip = 1;
+	  goto fail;
+	}
+      node = node->next;
     }
+
+  lv->vg = vg;
+  return lv;
+
+ fail:
+  lvm_free_lv (lv);
+  return NULL;
 }
 
-static struct grub_diskfilter_vg * 
+/* Metadata areas are large but the text in them rarely changes between
+   scans.  Remember for each PV where its current metadata text lives and
+   which VG it belongs to.  LVM writes every new seqno to a new location
+   with a new checksum, so as long as the raw location in the metadata
+   area header is unchanged and the VG is known, neither the text needs to
+   be read nor parsed again.  */
+struct lvm_pv_cache
+{
+  struct lvm_pv_cache *next;
+  char pv_id[GRUB_LVM_ID_STRLEN];
+  char vg_id[GRUB_LVM_ID_STRLEN];
+  grub_uint64_t offset;
+  grub_uint64_t size;
+  grub_uint32_t checksum;
+};
+
+static struct lvm_pv_cache *pv_cache;
+
+static struct lvm_pv_cache *
+lvm_pv_cache_find (const char *pv_id)
+{
+  struct lvm_pv_cache *c;
+
+  for (c = pv_cache; c; c = c->next)
+    if (grub_memcmp (c->pv_id, pv_id, GRUB_LVM_ID_STRLEN) == 0)
+      return c;
+  return NULL;
+}
+
+static void
+lvm_pv_cache_update (const char *pv_id, const char *vg_id,
+		     const struct grub_lvm_raw_locn *rlocn)
+{
+  struct lvm_pv_cache *c;
+
+  c = lvm_pv_cache_find (pv_id);
+  if (!c)
+    {
+      c = grub_malloc (sizeof (*c));
+      if (!c)
+	{
+	  grub_errno = GRUB_ERR_NONE;
+	  return;
+	}
+      grub_memcpy (c->pv_id, pv_id, GRUB_LVM_ID_STRLEN);
+      c->next = pv_cache;
+      pv_cache = c;
+    }
+  grub_memcpy (c->vg_id, vg_id, GRUB_LVM_ID_STRLEN);
+  c->offset = grub_le_to_cpu64 (rlocn->offset);
+  c->size = grub_le_to_cpu64 (rlocn->size);
+  c->checksum = grub_le_to_cpu32 (rlocn->checksum);
+}
+
+static struct grub_diskfilter_vg *
 grub_lvm_detect (grub_disk_t disk,
 		 struct grub_diskfilter_pv_id *id,
 		 grub_disk_addr_t *start_sector)
 {
   grub_err_t err;
-  grub_uint64_t mda_offset, mda_size;
+  grub_uint64_t mda_offset, mda_size, mdah_size, text_offset, text_size;
   char buf[GRUB_LVM_LABEL_SIZE];
+  char mdabuf[GRUB_LVM_MDA_HEADER_SIZE];
   char vg_id[GRUB_LVM_ID_STRLEN+1];
   char pv_id[GRUB_LVM_ID_STRLEN+1];
-  char *metadatabuf, *p, *q, *vgname;
+  char *metadatabuf, *vgname;
+  const char *p;
   struct grub_lvm_label_header *lh = (struct grub_lvm_label_header *) buf;
   struct grub_lvm_pv_header *pvh;
   struct grub_lvm_disk_locn *dlocn;
   struct grub_lvm_mda_header *mdah;
   struct grub_lvm_raw_locn *rlocn;
+  struct lvm_pv_cache *cached;
+  struct lvm_parser ps;
+  struct lvm_node *root = NULL, *vgsec, *node;
   unsigned int i, j;
-  grub_size_t vgname_len;
   struct grub_diskfilter_vg *vg;
   struct grub_diskfilter_pv *pv;
 
@@ -172,16 +825,11 @@ grub_lvm_detect (grub_disk_t disk,
   /* It's possible to have multiple copies of metadata areas, we just use the
      first one.  */
 
-  /* Allocate buffer space for the circular worst-case scenario. */
-  metadatabuf = grub_malloc (2 * mda_size);
-  if (! metadatabuf)
-    goto fail;
-
-  err = grub_disk_read (disk, 0, mda_offset, mda_size, metadatabuf);
+  err = grub_disk_read (disk, 0, mda_offset, sizeof (mdabuf), mdabuf);
   if (err)
-    goto fail2;
+    goto fail;
 
-  mdah = (struct grub_lvm_mda_header *) metadatabuf;
+  mdah = (struct grub_lvm_mda_header *) mdabuf;
   if ((grub_strncmp ((char *)mdah->magic, GRUB_LVM_FMTT_MAGIC,
 		     sizeof (mdah->magic)))
       || (grub_le_to_cpu32 (mdah->version) != GRUB_LVM_FMTT_VERSION))
@@ -191,42 +839,67 @@ grub_lvm_detect (grub_disk_t disk,
 #ifdef GRUB_UTIL
       grub_util_info ("unknown LVM metadata header");
 #endif
-      goto fail2;
+      goto fail;
     }
 
   rlocn = mdah->raw_locns;
-  if (grub_le_to_cpu64 (rlocn->offset) + grub_le_to_cpu64 (rlocn->size) >
-      grub_le_to_cpu64 (mdah->size))
+  mdah_size = grub_le_to_cpu64 (mdah->size);
+  text_offset = grub_le_to_cpu64 (rlocn->offset);
+  text_size = grub_le_to_cpu64 (rlocn->size);
+  if (mdah_size > mda_size
+      || text_offset < GRUB_LVM_MDA_HEADER_SIZE || text_offset >= mdah_size
+      || text_size > mdah_size - GRUB_LVM_MDA_HEADER_SIZE)
     {
-      /* Metadata is circular. Copy the wrap in place. */
-      grub_memcpy (metadatabuf + mda_size,
-		   metadatabuf + GRUB_LVM_MDA_HEADER_SIZE,
-		   grub_le_to_cpu64 (rlocn->offset) +
-		   grub_le_to_cpu64 (rlocn->size) -
-		   grub_le_to_cpu64 (mdah->size));
+#ifdef GRUB_UTIL
+      grub_util_info ("error parsing metadata");
+#endif
+      goto fail;
     }
-  p = q = metadatabuf + grub_le_to_cpu64 (rlocn->offset);
 
-  while (*q != ' ' && q < metadatabuf + mda_size)
-    q++;
+  cached = lvm_pv_cache_find (pv_id);
+  if (cached && cached->offset == text_offset && cached->size == text_size
+      && cached->checksum == grub_le_to_cpu32 (rlocn->checksum))
+    {
+      vg = grub_diskfilter_get_vg_by_uuid (GRUB_LVM_ID_STRLEN, cached->vg_id);
+      if (vg)
+	goto found;
+    }
+
+  metadatabuf = grub_malloc (text_size + 1);
+  if (! metadatabuf)
+    goto fail;
 
-  if (q == metadatabuf + mda_size)
+  if (text_offset + text_size > mdah_size)
+    {
+      /* Metadata is circular, the rest follows the header.  */
+      err = grub_disk_read (disk, 0, mda_offset + text_offset,
+			    mdah_size - text_offset, metadatabuf);
+      if (!err)
+	err = grub_disk_read (disk, 0, mda_offset + GRUB_LVM_MDA_HEADER_SIZE,
+			      text_offset + text_size - mdah_size,
+			      metadatabuf + mdah_size - text_offset);
+    }
+  else
+    err = grub_disk_read (disk, 0, mda_offset + text_offset, text_size,
+			  metadatabuf);
+  if (err)
+    goto fail2;
+  metadatabuf[text_size] = '\0';
+
+  ps.ptr = metadatabuf;
+  ps.end = metadatabuf + grub_strlen (metadatabuf);
+  if (!lvm_parse_section (&ps, 0, &root))
     {
 #ifdef GRUB_UTIL
       grub_util_info ("error parsing metadata");
 #endif
-      goto fail2;
+      goto fail3;
     }
 
-  vgname_len = q - p;
-  vgname = grub_malloc (vgname_len + 1);
-  if (!vgname)
-    goto fail2;
-
-  grub_memcpy (vgname, p, vgname_len);
-  vgname[vgname_len] = '\0';
-
-  p = grub_strstr (q, "id = \"");
+  for (vgsec = root; vgsec; vgsec = vgsec->next)
+    if (vgsec->type == LVM_NODE_SECTION)
+      break;
+  p = vgsec ? lvm_get_id (vgsec) : NULL;
   if (p == NULL)
     {
 #ifdef GRUB_UTIL
@@ -234,7 +907,6 @@ grub_lvm_detect (grub_disk_t disk,
 #endif
       goto fail3;
     }
-  p += sizeof ("id = \"") - 1;
   grub_memcpy (vg_id, p, GRUB_LVM_ID_STRLEN);
   vg_id[GRUB_LVM_ID_STRLEN] = '\0';
 
@@ -244,481 +916,88 @@ grub_lvm_detect (grub_disk_t disk,
     {
       /* First time we see this volume group. We've to create the
 	 whole volume group structure. */
-      vg = grub_malloc (sizeof (*vg));
-      if (! vg)
+      vgname = grub_strndup (vgsec->name, vgsec->namelen);
+      if (!vgname)
 	goto fail3;
+      vg = grub_zalloc (sizeof (*vg));
+      if (! vg)
+	goto fail4;
       vg->name = vgname;
       vg->uuid = grub_malloc (GRUB_LVM_ID_STRLEN);
       if (! vg->uuid)
-	goto fail3;
+	goto fail5;
       grub_memcpy (vg->uuid, vg_id, GRUB_LVM_ID_STRLEN);
       vg->uuid_len = GRUB_LVM_ID_STRLEN;
 
-      vg->extent_size = grub_lvm_getvalue (&p, "extent_size = ");
-      if (p == NULL)
+      if (!lvm_getvalue (vgsec, "extent_size", &vg->extent_size))
 	{
 #ifdef GRUB_UTIL
 	  grub_util_info ("unknown extent size");
 #endif
-	  goto fail4;
+	  goto fail6;
 	}
 
-      vg->lvs = NULL;
-      vg->pvs = NULL;
-
-      p = grub_strstr (p, "physical_volumes {");
-      if (p)
+      /* Add all the pvs to the volume group. */
+      node = lvm_find (vgsec, "physical_volumes", LVM_NODE_SECTION);
+      for (node = node ? node->child : NULL; node; node = node->next)
 	{
-	  p += sizeof ("physical_volumes {") - 1;
-
-	  /* Add all the pvs to the volume group. */
-	  while (1)
+	  if (node->type != LVM_NODE_SECTION)
+	    continue;
+
+	  pv = grub_zalloc (sizeof (*pv));
+	  if (!pv)
+	    goto fail6;
+	  pv->name = grub_strndup (node->name, node->namelen);
+	  if (!pv->name)
+	    goto pvs_fail;
+
+	  p = lvm_get_id (node);
+	  if (p == NULL)
+	    goto pvs_fail;
+	  pv->id.uuid = grub_malloc (GRUB_LVM_ID_STRLEN);
+	  if (!pv->id.uuid)
+	    goto pvs_fail;
+	  grub_memcpy (pv->id.uuid, p, GRUB_LVM_ID_STRLEN);
+	  pv->id.uuidlen = GRUB_LVM_ID_STRLEN;
+
+	  if (!lvm_getvalue (node, "pe_start", &pv->start_sector))
 	    {
-	      grub_ssize_t s;
-	      while (grub_isspace (*p))
-		p++;
-
-	      if (*p == '}')
-		break;
-
-	      pv = grub_zalloc (sizeof (*pv));
-	      q = p;
-	      while (*q != ' ')
-		q++;
-
-	      s = q - p;
-	      pv->name = grub_malloc (s + 1);
-	      grub_memcpy (pv->name, p, s);
-	      pv->name[s] = '\0';
-
-	      p = grub_strstr (p, "id = \"");
-	      if (p == NULL)
-		goto pvs_fail;
-	      p += sizeof("id = \"") - 1;
-
-	      pv->id.uuid = grub_malloc (GRUB_LVM_ID_STRLEN);
-	      if (!pv->id.uuid)
-		goto pvs_fail;
-	      grub_memcpy (pv->id.uuid, p, GRUB_LVM_ID_STRLEN);
-	      pv->id.uuidlen = GRUB_LVM_ID_STRLEN;
-
-	      pv->start_sector = grub_lvm_getvalue (&p, "pe_start = ");
-	      if (p == NULL)
-		{
-#ifdef GRUB_UTIL
-		  grub_util_info ("unknown pe_start");
-#endif
-		  goto pvs_fail;
-		}
-
-	      p = grub_strchr (p, '}');
-	      if (p == NULL)
-		{
 #ifdef GRUB_UTIL
-		  grub_util_info ("error parsing pe_start");
+	      grub_util_info ("unknown pe_start");
 #endif
-		  goto pvs_fail;
-		}
-	      p++;
-
-	      pv->disk = NULL;
-	      pv->next = vg->pvs;
-	      vg->pvs = pv;
-
-	      continue;
-	    pvs_fail:
-	      grub_free (pv->name);
-	      grub_free (pv);
-	      goto fail4;
+	      goto pvs_fail;
 	    }
-	}
-
-      p = grub_strstr (p, "logical_volumes {");
-      if (p)
-	{
-	  p += sizeof ("logical_volumes {") - 1;
-
-	  /* And add all the lvs to the volume group. */
-	  while (1)
-	    {
-	      grub_ssize_t s;
-	      int skip_lv = 0;
-	      struct grub_diskfilter_lv *lv;
-	      struct grub_diskfilter_segment *seg;
-	      int is_pvmove;
-
-	      while (grub_isspace (*p))
-		p++;
-
-	      if (*p == '}')
-		break;
-
-	      lv = grub_zalloc (sizeof (*lv));
-
-	      q = p;
-	      while (*q != ' ')
-		q++;
-
-	      s = q - p;
-	      lv->name = grub_strndup (p, s);
-	      if (!lv->name)
-		goto lvs_fail;
-
-	      {
-		const char *iptr;
-		char *optr;
-		lv->fullname = grub_malloc (sizeof ("lvm/") - 1 + 2 * vgname_len
-					    + 1 + 2 * s + 1);
-		if (!lv->fullname)
-		  goto lvs_fail;
-
-		grub_memcpy (lv->fullname, "lvm/", sizeof ("lvm/") - 1);
-		optr = lv->fullname + sizeof ("lvm/") - 1;
-		for (iptr = vgname; iptr < vgname + vgname_len; iptr++)
-		  {
-		    *optr++ = *iptr;
-		    if (*iptr == '-')
-		      *optr++ = '-';
-		  }
-		*optr++ = '-';
-		for (iptr = p; iptr < p + s; iptr++)
-		  {
-		    *optr++ = *iptr;
-		    if (*iptr == '-')
-		      *optr++ = '-';
-		  }
-		*optr++ = 0;
-		lv->idname = grub_malloc (sizeof ("lvmid/")
-					  + 2 * GRUB_LVM_ID_STRLEN + 1);
-		if (!lv->idname)
-		  goto lvs_fail;
-		grub_memcpy (lv->idname, "lvmid/",
-			     sizeof ("lvmid/") - 1);
-		grub_memcpy (lv->idname + sizeof ("lvmid/") - 1,
-			     vg_id, GRUB_LVM_ID_STRLEN);
-		lv->idname[sizeof ("lvmid/") - 1 + GRUB_LVM_ID_STRLEN] = '/';
-
-		p = grub_strstr (q, "id = \"");
-		if (p == NULL)
-		  {
-#ifdef GRUB_UTIL
-		    grub_util_info ("couldn't find ID");
-#endif
-		    goto lvs_fail;
-		  }
-		p += sizeof ("id = \"") - 1;
-		grub_memcpy (lv->idname + sizeof ("lvmid/") - 1
-			     + GRUB_LVM_ID_STRLEN + 1,
-			     p, GRUB_LVM_ID_STRLEN);
-		lv->idname[sizeof ("lvmid/") - 1 + 2 * GRUB_LVM_ID_STRLEN + 1] = '\0';
-	      }
-
-	      lv->size = 0;
-
-	      lv->visible = grub_lvm_check_flag (p, "status", "VISIBLE");
-	      is_pvmove = grub_lvm_check_flag (p, "status", "PVMOVE");
-
-	      lv->segment_count = grub_lvm_getvalue (&p, "segment_count = ");
-	      if (p == NULL)
-		{
-#ifdef GRUB_UTIL
-		  grub_util_info ("unknown segment_count");
-#endif
-		  goto lvs_fail;
-		}
-	      lv->segments = grub_zalloc (sizeof (*seg) * lv->segment_count);
-	      seg = lv->segments;
-
-	      for (i = 0; i < lv->segment_count; i++)
-		{
-
-		  p = grub_strstr (p, "segment");
-		  if (p == NULL)
-		    {
-#ifdef GRUB_UTIL
-		      grub_util_info ("unknown segment");
-#endif
-		      goto lvs_segment_fail;
-		    }
-
-		  seg->start_extent = grub_lvm_getvalue (&p, "start_extent = ");
-		  if (p == NULL)
-		    {
-#ifdef GRUB_UTIL
-		      grub_util_info ("unknown start_extent");
-#endif
-		      goto lvs_segment_fail;
-		    }
-		  seg->extent_count = grub_lvm_getvalue (&p, "extent_count = ");
-		  if (p == NULL)
-		    {
-#ifdef GRUB_UTIL
-		      grub_util_info ("unknown extent_count");
-#endif
-		      goto lvs_segment_fail;
-		    }
 
-		  p = grub_strstr (p, "type = \"");
-		  if (p == NULL)
-		    goto lvs_segment_fail;
-		  p += sizeof("type = \"") - 1;
+	  pv->disk = NULL;
+	  pv->next = vg->pvs;
+	  vg->pvs = pv;
 
-		  lv->size += seg->extent_count * vg->extent_size;
-
-		  if (grub_memcmp (p, "striped\"",
-				   sizeof ("striped\"") - 1) == 0)
-		    {
-		      struct grub_diskfilter_node *stripe;
-
-		      seg->type = GRUB_DISKFILTER_STRIPED;
-		      seg->node_count = grub_lvm_getvalue (&p, "stripe_count = ");
-		      if (p == NULL)
-			{
-#ifdef GRUB_UTIL
-			  grub_util_info ("unknown stripe_count");
-#endif
-			  goto lvs_segment_fail;
-			}
-
-		      if (seg->node_count != 1)
-			seg->stripe_size = grub_lvm_getvalue (&p, "stripe_size = ");
-
-		      seg->nodes = grub_zalloc (sizeof (*stripe)
-						* seg->node_count);
-		      stripe = seg->nodes;
-
-		      p = grub_strstr (p, "stripes = [");
-		      if (p == NULL)
-			{
-#ifdef GRUB_UTIL
-			  grub_util_info ("unknown stripes");
-#endif
-			  goto lvs_segment_fail2;
-			}
-		      p += sizeof("stripes = [") - 1;
-
-		      for (j = 0; j < seg->node_count; j++)
-			{
-			  p = grub_strchr (p, '"');
-			  if (p == NULL)
-			    continue;
-			  q = ++p;
-			  while (*q != '"')
-			    q++;
-
-			  s = q - p;
-
-			  stripe->name = grub_malloc (s + 1);
-			  if (stripe->name == NULL)
-			    goto lvs_segment_fail2;
-
-			  grub_memcpy (stripe->name, p, s);
-			  stripe->name[s] = '\0';
-
-			  p = q + 1;
-
-			  stripe->start = grub_lvm_getvalue (&p, ",")
-			    * vg->extent_size;
-			  if (p == NULL)
-			    continue;
-
-			  stripe++;
-			}
-		    }
-		  else if (grub_memcmp (p, "mirror\"", sizeof ("mirror\"") - 1)
-			   == 0)
-		    {
-		      seg->type = GRUB_DISKFILTER_MIRROR;
-		      seg->node_count = grub_lvm_getvalue (&p, "mirror_count = ");
-		      if (p == NULL)
-			{
-#ifdef GRUB_UTIL
-			  grub_util_info ("unknown mirror_count");
-#endif
-			  goto lvs_segment_fail;
-			}
-
-		      seg->nodes = grub_zalloc (sizeof (seg->nodes[0])
-						* seg->node_count);
-
-		      p = grub_strstr (p, "mirrors = [");
-		      if (p == NULL)
-			{
-#ifdef GRUB_UTIL
-			  grub_util_info ("unknown mirrors");
-#endif
-			  goto lvs_segment_fail2;
-			}
-		      p += sizeof("mirrors = [") - 1;
-
-		      for (j = 0; j < seg->node_count; j++)
-			{
-			  char *lvname;
-
-			  p = grub_strchr (p, '"');
-			  if (p == NULL)
-			    continue;
-			  q = ++p;
-			  while (*q != '"')
-			    q++;
-
-			  s = q - p;
-
-			  lvname = grub_malloc (s + 1);
-			  if (lvname == NULL)
-			    goto lvs_segment_fail2;
-
-			  grub_memcpy (lvname, p, s);
-			  lvname[s] = '\0';
-			  seg->nodes[j].name = lvname;
-			  p = q + 1;
-			}
-		      /* Only first (original) is ok with in progress pvmove.  */
-		      if (is_pvmove)
-			seg->node_count = 1;
-		    }
-		  else if (grub_memcmp (p, "raid", sizeof ("raid") - 1) == 0
-			   && ((p[sizeof ("raid") - 1] >= '4'
-				&& p[sizeof ("raid") - 1] <= '6')
-			       || p[sizeof ("raid") - 1] == '1')
-			   && p[sizeof ("raidX") - 1] == '"')
-		    {
-		      switch (p[sizeof ("raid") - 1])
-			{
-			case '1':
-			  seg->type = GRUB_DISKFILTER_MIRROR;
-			  break;
-			case '4':
-			  seg->type = GRUB_DISKFILTER_RAID4;
-			  seg->layout = GRUB_RAID_LAYOUT_LEFT_ASYMMETRIC;
-			  break;
-			case '5':
-			  seg->type = GRUB_DISKFILTER_RAID5;
-			  seg->layout = GRUB_RAID_LAYOUT_LEFT_SYMMETRIC;
-			  break;
-			case '6':
-			  seg->type = GRUB_DISKFILTER_RAID6;
-			  seg->layout = (GRUB_RAID_LAYOUT_RIGHT_ASYMMETRIC
-					 | GRUB_RAID_LAYOUT_MUL_FROM_POS);
-			  break;
-			}
-		      seg->node_count = grub_lvm_getvalue (&p, "device_count = ");
-
-		      if (p == NULL)
-			{
-#ifdef GRUB_UTIL
-			  grub_util_info ("unknown device_count");
-#endif
-			  goto lvs_segment_fail;
-			}
-
-		      if (seg->type != GRUB_DISKFILTER_MIRROR)
-			{
-			  seg->stripe_size = grub_lvm_getvalue (&p, "stripe_size = ");
-			  if (p == NULL)
-			    {
-#ifdef GRUB_UTIL
-			      grub_util_info ("unknown stripe_size");
-#endif
-			      goto lvs_segment_fail;
-			    }
-			}
-
-		      seg->nodes = grub_zalloc (sizeof (seg->nodes[0])
-						* seg->node_count);
-
-		      p = grub_strstr (p, "raids = [");
-		      if (p == NULL)
-			{
-#ifdef GRUB_UTIL
-			  grub_util_info ("unknown raids");
-#endif
-			  goto lvs_segment_fail2;
-			}
-		      p += sizeof("raids = [") - 1;
-
-		      for (j = 0; j < seg->node_count; j++)
-			{
-			  char *lvname;
-
-			  p = grub_strchr (p, '"');
-			  p = p ? grub_strchr (p + 1, '"') : 0;
-			  p = p ? grub_strchr (p + 1, '"') : 0;
-			  if (p == NULL)
-			    continue;
-			  q = ++p;
-			  while (*q != '"')
-			    q++;
-
-			  s = q - p;
-
-			  lvname = grub_malloc (s + 1);
-			  if (lvname == NULL)
-			    goto lvs_segment_fail2;
-
-			  grub_memcpy (lvname, p, s);
-			  lvname[s] = '\0';
-			  seg->nodes[j].name = lvname;
-			  p = q + 1;
-			}
-		      if (seg->type == GRUB_DISKFILTER_RAID4)
-			{
-			  char *tmp;
-			  tmp = seg->nodes[0].name;
-			  grub_memmove (seg->nodes, seg->nodes + 1,
-					sizeof (seg->nodes[0])
-					* (seg->node_count - 1));
-			  seg->nodes[seg->node_count - 1].name = tmp;
-			}
-		    }
-		  else
-		    {
-#ifdef GRUB_UTIL
-		      char *p2;
-		      p2 = grub_strchr (p, '"');
-		      if (p2)
-			*p2 = 0;
-		      grub_util_info ("unknown LVM type %s", p);
-		      if (p2)
-			*p2 ='"';
-#endif
-		      /* Found a non-supported type, give up and move on. */
-		      skip_lv = 1;
-		      break;
-		    }
+	  continue;
+	pvs_fail:
+	  grub_free (pv->id.uuid);
+	  grub_free (pv->name);
+	  grub_free (pv);
+	  goto fail6;
+	}
 
-		  seg++;
+      /* And add all the lvs to the volume group. */
+      node = lvm_find (vgsec, "logical_volumes", LVM_NODE_SECTION);
+      for (node = node ? node->child : NULL; node; node = node->next)
+	{
+	  struct grub_diskfilter_lv *lv;
+	  int skip_lv = 0;
 
-		  continue;
-		lvs_segment_fail2:
-		  grub_free (seg->nodes);
-		lvs_segment_fail:
-		  goto fail4;
-		}
-
-	      if (p != NULL)
-		p = grub_strchr (p, '}');
-	      if (p == NULL)
-		goto lvs_fail;
-	      p += 3;
-
-	      if (skip_lv)
-		{
-		  grub_free (lv->name);
-		  grub_free (lv);
-		  continue;
-		}
+	  if (node->type != LVM_NODE_SECTION)
+	    continue;
 
-	      lv->vg = vg;
-	      lv->next = vg->lvs;
-	      vg->lvs = lv;
+	  lv = lvm_parse_lv (vg, node, vg_id, &skip_lv);
+	  if (skip_lv)
+	    continue;
+	  if (!lv)
+	    goto fail6;
 
-	      continue;
-	    lvs_fail:
-	      grub_free (lv->name);
-	      grub_free (lv);
-	      goto fail4;
-	    }
+	  lv->next = vg->lvs;
+	  vg->lvs = lv;
 	}
 
       /* Match lvs.  */
@@ -729,6 +1008,8 @@ grub_lvm_detect (grub_disk_t disk,
 	  for (i = 0; i < lv1->segment_count; i++)
 	    for (j = 0; j < lv1->segments[i].node_count; j++)
 	      {
+		if (!lv1->segments[i].nodes[j].name)
+		  continue;
 		if (vg->pvs)
 		  for (pv = vg->pvs; pv; pv = pv->next)
 		    {
@@ -748,35 +1029,63 @@ grub_lvm_detect (grub_disk_t disk,
 	
       }
       if (grub_diskfilter_vg_register (vg))
-	goto fail4;
-    }
-  else
-    {
-      grub_free (vgname);
+	goto fail6;
     }
 
+  lvm_free_nodes (root);
+  grub_free (metadatabuf);
+  lvm_pv_cache_update (pv_id, vg_id, rlocn);
+
+ found:
   id->uuid = grub_malloc (GRUB_LVM_ID_STRLEN);
   if (!id->uuid)
-    goto fail4;
+    return NULL;
   grub_memcpy (id->uuid, pv_id, GRUB_LVM_ID_STRLEN);
   id->uuidlen = GRUB_LVM_ID_STRLEN;
-  grub_free (metadatabuf);
   *start_sector = -1;
   return vg;
 
   /* Failure path.  */
- fail4:
+ fail6:
+  while (vg->lvs)
+    {
+      struct grub_diskfilter_lv *lv = vg->lvs;
+      vg->lvs = lv->next;
+      lvm_free_lv (lv);
+    }
+  while (vg->pvs)
+    {
+      pv = vg->pvs;
+      vg->pvs = pv->next;
+      grub_free (pv->id.uuid);
+      grub_free (pv->name);
+      grub_free (pv);
+    }
+  grub_free (vg->uuid);
+ fail5:
   grub_free (vg);
- fail3:
+ fail4:
   grub_free (vgname);
-
+ fail3:
+  lvm_free_nodes (root);
  fail2:
   grub_free (metadatabuf);
  fail:
   return NULL;
 }
 
-
+static void
+lvm_pv_cache_free (void)
+{
+  struct lvm_pv_cache *c, *next;
+
+  for (c = pv_cache; c; c = next)
+    {
+      next = c->next;
+      grub_free (c);
+    }
+  pv_cache = NULL;
+}
 
 static struct grub_diskfilter grub_lvm_dev = {
   .name = "lvm",
@@ -792,4 +1101,5 @@ GRUB_MOD_INIT (lvm)
 GRUB_MOD_FINI (lvm)
 {
   grub_diskfilter_unregister (&grub_lvm_dev);
+  lvm_pv_cache_free ();
 }
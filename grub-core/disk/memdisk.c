@@ -48,6 +48,7 @@ grub_memdisk_open (const char *name, grub_disk_t disk)
   disk->total_sectors = memdisk_size / GRUB_DISK_SECTOR_SIZE;
   disk->max_agglomerate = GRUB_DISK_MAX_MAX_AGGLOMERATE;
   disk->id = 0;
+  disk->memory = memdisk_addr;
 
   return GRUB_ERR_NONE;
 }
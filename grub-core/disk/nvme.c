@@ -0,0 +1,990 @@
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2026  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <grub/dl.h>
+#include <grub/disk.h>
+#include <grub/mm.h>
+#include <grub/time.h>
+#include <grub/pci.h>
+#include <grub/misc.h>
+#include <grub/list.h>
+#include <grub/loader.h>
+#include <grub/i18n.h>
+
+GRUB_MOD_LICENSE ("GPLv3+");
+
+/* Controller registers.  */
+enum
+  {
+    GRUB_NVME_REG_CAP = 0x00,
+    GRUB_NVME_REG_CC = 0x14,
+    GRUB_NVME_REG_CSTS = 0x1c,
+    GRUB_NVME_REG_AQA = 0x24,
+    GRUB_NVME_REG_ASQ = 0x28,
+    GRUB_NVME_REG_ACQ = 0x30,
+    GRUB_NVME_REG_DOORBELL = 0x1000
+  };
+
+enum
+  {
+    GRUB_NVME_CC_ENABLE = 0x1,
+    GRUB_NVME_CC_SHUTDOWN_NORMAL = 0x4000,
+    /* 64-byte submission and 16-byte completion queue entries.  */
+    GRUB_NVME_CC_IOSQES = 6 << 16,
+    GRUB_NVME_CC_IOCQES = 4 << 20
+  };
+
+enum
+  {
+    GRUB_NVME_CSTS_READY = 0x1,
+    GRUB_NVME_CSTS_FATAL = 0x2,
+    GRUB_NVME_CSTS_SHUTDOWN_MASK = 0xc,
+    GRUB_NVME_CSTS_SHUTDOWN_DONE = 0x8
+  };
+
+enum
+  {
+    GRUB_NVME_ADMIN_CREATE_SQ = 0x01,
+    GRUB_NVME_ADMIN_CREATE_CQ = 0x05,
+    GRUB_NVME_ADMIN_IDENTIFY = 0x06
+  };
+
+enum
+  {
+    GRUB_NVME_CMD_WRITE = 0x01,
+    GRUB_NVME_CMD_READ = 0x02
+  };
+
+enum
+  {
+    GRUB_NVME_IDENTIFY_NAMESPACE = 0,
+    GRUB_NVME_IDENTIFY_CONTROLLER = 1
+  };
+
+#define GRUB_NVME_PAGE_SIZE 4096
+#define GRUB_NVME_ADMIN_QUEUE_SIZE 16
+#define GRUB_NVME_IO_QUEUE_SIZE 64
+/* Commands in flight on the I/O queue, each with its own buffer.  */
+#define GRUB_NVME_REQUESTS 8
+/* Largest transfer of a single command; the controller may allow less.  */
+#define GRUB_NVME_MAX_TRANSFER (256 * 1024)
+#define GRUB_NVME_MAX_NAMESPACES 16
+#define GRUB_NVME_TIMEOUT 20000
+
+struct grub_nvme_sqe
+{
+  grub_uint32_t cdw0;
+  grub_uint32_t nsid;
+  grub_uint64_t reserved;
+  grub_uint64_t mptr;
+  grub_uint64_t prp1;
+  grub_uint64_t prp2;
+  grub_uint32_t cdw10;
+  grub_uint32_t cdw11;
+  grub_uint32_t cdw12;
+  grub_uint32_t cdw13;
+  grub_uint32_t cdw14;
+  grub_uint32_t cdw15;
+} GRUB_PACKED;
+
+struct grub_nvme_cqe
+{
+  grub_uint32_t dw0;
+  grub_uint32_t dw1;
+  grub_uint16_t sq_head;
+  grub_uint16_t sq_id;
+  grub_uint16_t cid;
+  grub_uint16_t status;
+} GRUB_PACKED;
+
+struct grub_nvme_queue
+{
+  unsigned id;
+  unsigned size;
+  struct grub_pci_dma_chunk *sq_chunk;
+  volatile struct grub_nvme_sqe *sq;
+  struct grub_pci_dma_chunk *cq_chunk;
+  volatile struct grub_nvme_cqe *cq;
+  unsigned sq_tail;
+  unsigned cq_head;
+  /* Phase tag of the completions not seen yet.  */
+  grub_uint16_t phase;
+};
+
+enum grub_nvme_request_state
+  {
+    GRUB_NVME_REQUEST_FREE,
+    GRUB_NVME_REQUEST_PENDING,
+    GRUB_NVME_REQUEST_DONE
+  };
+
+struct grub_nvme_ns;
+
+/* An I/O command slot.  Its index is the command identifier.  A finished
+   read stays DONE until all of it has been copied out, so that data read
+   ahead can be handed to later reads.  */
+struct grub_nvme_request
+{
+  enum grub_nvme_request_state state;
+  grub_uint16_t status;
+  struct grub_nvme_ns *ns;
+  grub_disk_addr_t lba;
+  grub_size_t count;
+  grub_uint32_t seq;
+  struct grub_pci_dma_chunk *buf;
+  struct grub_pci_dma_chunk *prp_list;
+};
+
+struct grub_nvme_ctrl
+{
+  struct grub_nvme_ctrl *next;
+  struct grub_nvme_ctrl **prev;
+  int num;
+  volatile grub_uint8_t *regs;
+  unsigned doorbell_stride;
+  grub_uint32_t ready_timeout;
+  grub_size_t max_transfer;
+  struct grub_nvme_queue admin;
+  struct grub_nvme_queue io;
+  struct grub_pci_dma_chunk *identify;
+  struct grub_nvme_request requests[GRUB_NVME_REQUESTS];
+  grub_uint32_t seq;
+  /* Set when a command timed out: the controller may still own a buffer.  */
+  int broken;
+};
+
+struct grub_nvme_ns
+{
+  struct grub_nvme_ns *next;
+  struct grub_nvme_ns **prev;
+  struct grub_nvme_ctrl *ctrl;
+  char *name;
+  unsigned long id;
+  grub_uint32_t nsid;
+  grub_uint64_t size;
+  unsigned log_sector_size;
+};
+
+static struct grub_nvme_ctrl *grub_nvme_ctrls;
+static struct grub_nvme_ns *grub_nvme_namespaces;
+static int numctrls;
+static unsigned long numns;
+
+static grub_uint32_t
+grub_nvme_read32 (struct grub_nvme_ctrl *ctrl, unsigned reg)
+{
+  return grub_le_to_cpu32 (*(volatile grub_uint32_t *) (ctrl->regs + reg));
+}
+
+static void
+grub_nvme_write32 (struct grub_nvme_ctrl *ctrl, unsigned reg,
+		   grub_uint32_t val)
+{
+  *(volatile grub_uint32_t *) (ctrl->regs + reg) = grub_cpu_to_le32 (val);
+}
+
+static grub_uint64_t
+grub_nvme_read64 (struct grub_nvme_ctrl *ctrl, unsigned reg)
+{
+  return grub_nvme_read32 (ctrl, reg)
+    | ((grub_uint64_t) grub_nvme_read32 (ctrl, reg + 4) << 32);
+}
+
+static void
+grub_nvme_write64 (struct grub_nvme_ctrl *ctrl, unsigned reg,
+		   grub_uint64_t val)
+{
+  grub_nvme_write32 (ctrl, reg, val);
+  grub_nvme_write32 (ctrl, reg + 4, val >> 32);
+}
+
+static void
+grub_nvme_ring (struct grub_nvme_ctrl *ctrl, unsigned qid, int cq,
+		unsigned val)
+{
+  grub_nvme_write32 (ctrl, GRUB_NVME_REG_DOORBELL
+		     + (2 * qid + cq) * ctrl->doorbell_stride, val);
+}
+
+static grub_err_t
+grub_nvme_wait_status (struct grub_nvme_ctrl *ctrl, grub_uint32_t mask,
+		       grub_uint32_t val)
+{
+  grub_uint64_t endtime = grub_get_time_ms () + ctrl->ready_timeout;
+
+  while ((grub_nvme_read32 (ctrl, GRUB_NVME_REG_CSTS) & mask) != val)
+    {
+      if (grub_nvme_read32 (ctrl, GRUB_NVME_REG_CSTS) & GRUB_NVME_CSTS_FATAL)
+	return grub_error (GRUB_ERR_IO, "NVMe controller fatal status");
+      if (grub_get_time_ms () > endtime)
+	return grub_error (GRUB_ERR_IO, "NVMe controller not ready");
+    }
+  return GRUB_ERR_NONE;
+}
+
+static grub_err_t
+grub_nvme_queue_alloc (struct grub_nvme_queue *q, unsigned id, unsigned size)
+{
+  q->id = id;
+  q->size = size;
+  q->sq_chunk = grub_memalign_dma32 (GRUB_NVME_PAGE_SIZE,
+				     size * sizeof (struct grub_nvme_sqe));
+  if (!q->sq_chunk)
+    return grub_errno;
+  q->cq_chunk = grub_memalign_dma32 (GRUB_NVME_PAGE_SIZE,
+				     size * sizeof (struct grub_nvme_cqe));
+  if (!q->cq_chunk)
+    {
+      grub_dma_free (q->sq_chunk);
+      q->sq_chunk = NULL;
+      return grub_errno;
+    }
+  q->sq = grub_dma_get_virt (q->sq_chunk);
+  q->cq = grub_dma_get_virt (q->cq_chunk);
+  return GRUB_ERR_NONE;
+}
+
+static void
+grub_nvme_queue_free (struct grub_nvme_queue *q)
+{
+  if (q->sq_chunk)
+    grub_dma_free (q->sq_chunk);
+  if (q->cq_chunk)
+    grub_dma_free (q->cq_chunk);
+  q->sq_chunk = NULL;
+  q->cq_chunk = NULL;
+}
+
+static void
+grub_nvme_queue_reset (struct grub_nvme_queue *q)
+{
+  grub_memset ((void *) q->cq, 0, q->size * sizeof (struct grub_nvme_cqe));
+  q->sq_tail = 0;
+  q->cq_head = 0;
+  q->phase = 1;
+}
+
+static void
+grub_nvme_submit (struct grub_nvme_ctrl *ctrl, struct grub_nvme_queue *q,
+		  const struct grub_nvme_sqe *cmd)
+{
+  grub_memcpy ((void *) &q->sq[q->sq_tail], cmd, sizeof (*cmd));
+  if (++q->sq_tail == q->size)
+    q->sq_tail = 0;
+  grub_nvme_ring (ctrl, q->id, 0, q->sq_tail);
+}
+
+/* Take the next entry off the completion queue of Q, if there is one.  */
+static int
+grub_nvme_poll (struct grub_nvme_ctrl *ctrl, struct grub_nvme_queue *q,
+		grub_uint16_t *cid, grub_uint16_t *status)
+{
+  volatile struct grub_nvme_cqe *cqe = &q->cq[q->cq_head];
+  grub_uint16_t st = grub_le_to_cpu16 (cqe->status);
+
+  if ((st & 1) != q->phase)
+    return 0;
+
+  *cid = grub_le_to_cpu16 (cqe->cid);
+  *status = st >> 1;
+  if (++q->cq_head == q->size)
+    {
+      q->cq_head = 0;
+      q->phase ^= 1;
+    }
+  grub_nvme_ring (ctrl, q->id, 1, q->cq_head);
+  return 1;
+}
+
+static grub_err_t
+grub_nvme_admin (struct grub_nvme_ctrl *ctrl, grub_uint8_t opcode,
+		 grub_uint32_t nsid, grub_uint32_t prp1,
+		 grub_uint32_t cdw10, grub_uint32_t cdw11)
+{
+  struct grub_nvme_sqe cmd;
+  grub_uint64_t endtime;
+  grub_uint16_t cid, status;
+
+  grub_memset (&cmd, 0, sizeof (cmd));
+  cmd.cdw0 = grub_cpu_to_le32 (opcode);
+  cmd.nsid = grub_cpu_to_le32 (nsid);
+  cmd.prp1 = grub_cpu_to_le64 (prp1);
+  cmd.cdw10 = grub_cpu_to_le32 (cdw10);
+  cmd.cdw11 = grub_cpu_to_le32 (cdw11);
+  grub_nvme_submit (ctrl, &ctrl->admin, &cmd);
+
+  endtime = grub_get_time_ms () + GRUB_NVME_TIMEOUT;
+  while (!grub_nvme_poll (ctrl, &ctrl->admin, &cid, &status))
+    if (grub_get_time_ms () > endtime)
+      {
+	ctrl->broken = 1;
+	return grub_error (GRUB_ERR_IO, "NVMe admin command 0x%x timed out",
+			   opcode);
+      }
+
+  if (status)
+    return grub_error (GRUB_ERR_IO,
+		       "NVMe admin command 0x%x failed with status 0x%x",
+		       opcode, status);
+  return GRUB_ERR_NONE;
+}
+
+/* Reset CTRL and set up the admin and I/O queues.  */
+static grub_err_t
+grub_nvme_enable (struct grub_nvme_ctrl *ctrl)
+{
+  grub_err_t err;
+  unsigned i;
+
+  if (grub_nvme_read32 (ctrl, GRUB_NVME_REG_CC) & GRUB_NVME_CC_ENABLE)
+    {
+      grub_nvme_write32 (ctrl, GRUB_NVME_REG_CC, 0);
+      err = grub_nvme_wait_status (ctrl, GRUB_NVME_CSTS_READY, 0);
+      if (err)
+	return err;
+    }
+
+  grub_nvme_queue_reset (&ctrl->admin);
+  grub_nvme_queue_reset (&ctrl->io);
+  for (i = 0; i < GRUB_NVME_REQUESTS; i++)
+    ctrl->requests[i].state = GRUB_NVME_REQUEST_FREE;
+  ctrl->broken = 0;
+
+  grub_nvme_write32 (ctrl, GRUB_NVME_REG_AQA,
+		     ((ctrl->admin.size - 1) << 16) | (ctrl->admin.size - 1));
+  grub_nvme_write64 (ctrl, GRUB_NVME_REG_ASQ,
+		     grub_dma_get_phys (ctrl->admin.sq_chunk));
+  grub_nvme_write64 (ctrl, GRUB_NVME_REG_ACQ,
+		     grub_dma_get_phys (ctrl->admin.cq_chunk));
+  grub_nvme_write32 (ctrl, GRUB_NVME_REG_CC, GRUB_NVME_CC_ENABLE
+		     | GRUB_NVME_CC_IOSQES | GRUB_NVME_CC_IOCQES);
+  err = grub_nvme_wait_status (ctrl, GRUB_NVME_CSTS_READY,
+			       GRUB_NVME_CSTS_READY);
+  if (err)
+    return err;
+
+  /* Physically contiguous, polled, completion queue first.  */
+  err = grub_nvme_admin (ctrl, GRUB_NVME_ADMIN_CREATE_CQ, 0,
+			 grub_dma_get_phys (ctrl->io.cq_chunk),
+			 ((ctrl->io.size - 1) << 16) | ctrl->io.id, 1);
+  if (err)
+    return err;
+  return grub_nvme_admin (ctrl, GRUB_NVME_ADMIN_CREATE_SQ, 0,
+			  grub_dma_get_phys (ctrl->io.sq_chunk),
+			  ((ctrl->io.size - 1) << 16) | ctrl->io.id,
+			  (ctrl->io.id << 16) | 1);
+}
+
+static void
+grub_nvme_add_namespace (struct grub_nvme_ctrl *ctrl, grub_uint32_t nsid)
+{
+  volatile grub_uint8_t *id = grub_dma_get_virt (ctrl->identify);
+  struct grub_nvme_ns *ns;
+  grub_uint64_t size;
+  unsigned format, lbads;
+
+  if (grub_nvme_admin (ctrl, GRUB_NVME_ADMIN_IDENTIFY, nsid,
+		       grub_dma_get_phys (ctrl->identify),
+		       GRUB_NVME_IDENTIFY_NAMESPACE, 0))
+    {
+      grub_errno = GRUB_ERR_NONE;
+      return;
+    }
+
+  size = grub_le_to_cpu64 (*(volatile grub_uint64_t *) id);
+  format = id[26] & 0xf;
+  lbads = id[128 + 4 * format + 2];
+  if (!size)
+    return;
+  if (lbads < GRUB_DISK_SECTOR_BITS || lbads > 12
+      || (1U << lbads) > ctrl->max_transfer)
+    {
+      grub_dprintf ("nvme", "nvme%dn%u: unsupported sector size 2^%u\n",
+		    ctrl->num, nsid, lbads);
+      return;
+    }
+
+  ns = grub_zalloc (sizeof (*ns));
+  if (!ns)
+    return;
+  ns->name = grub_xasprintf ("nvme%dn%u", ctrl->num, nsid);
+  if (!ns->name)
+    {
+      grub_free (ns);
+      return;
+    }
+  ns->ctrl = ctrl;
+  ns->id = numns++;
+  ns->nsid = nsid;
+  ns->size = size;
+  ns->log_sector_size = lbads;
+
+  grub_dprintf ("nvme", "found %s, %llu sectors of %u bytes\n", ns->name,
+		(unsigned long long) size, 1U << lbads);
+  grub_list_push (GRUB_AS_LIST_P (&grub_nvme_namespaces), GRUB_AS_LIST (ns));
+}
+
+static void
+grub_nvme_free (struct grub_nvme_ctrl *ctrl)
+{
+  unsigned i;
+
+  for (i = 0; i < GRUB_NVME_REQUESTS; i++)
+    {
+      if (ctrl->requests[i].buf)
+	grub_dma_free (ctrl->requests[i].buf);
+      if (ctrl->requests[i].prp_list)
+	grub_dma_free (ctrl->requests[i].prp_list);
+    }
+  if (ctrl->identify)
+    grub_dma_free (ctrl->identify);
+  grub_nvme_queue_free (&ctrl->admin);
+  grub_nvme_queue_free (&ctrl->io);
+  grub_free (ctrl);
+}
+
+static int
+grub_nvme_pciinit (grub_pci_device_t dev,
+		   grub_pci_id_t pciid __attribute__ ((unused)),
+		   void *data __attribute__ ((unused)))
+{
+  grub_pci_address_t addr;
+  grub_uint32_t class, bar, nn;
+  grub_uint64_t base, cap;
+  struct grub_nvme_ctrl *ctrl;
+  volatile grub_uint8_t *id;
+  unsigned i, mdts;
+
+  addr = grub_pci_make_address (dev, GRUB_PCI_REG_CLASS);
+  class = grub_pci_read (addr);
+
+  /* Mass storage, non-volatile memory, NVM Express.  */
+  if (class >> 8 != 0x010802)
+    return 0;
+
+  addr = grub_pci_make_address (dev, GRUB_PCI_REG_ADDRESS_REG0);
+  bar = grub_pci_read (addr);
+  if ((bar & GRUB_PCI_ADDR_SPACE_MASK) != GRUB_PCI_ADDR_SPACE_MEMORY)
+    return 0;
+  base = bar & GRUB_PCI_ADDR_MEM_MASK;
+  if ((bar & GRUB_PCI_ADDR_MEM_TYPE_MASK) == GRUB_PCI_ADDR_MEM_TYPE_64)
+    {
+      addr = grub_pci_make_address (dev, GRUB_PCI_REG_ADDRESS_REG1);
+      base |= (grub_uint64_t) grub_pci_read (addr) << 32;
+    }
+#if GRUB_CPU_SIZEOF_VOID_P == 4
+  if (base >> 32)
+    {
+      grub_dprintf ("nvme", "%x:%x.%x: registers above 4GiB\n",
+		    dev.bus, dev.device, dev.function);
+      return 0;
+    }
+#endif
+
+  addr = grub_pci_make_address (dev, GRUB_PCI_REG_COMMAND);
+  grub_pci_write_word (addr, grub_pci_read_word (addr)
+		       | GRUB_PCI_COMMAND_MEM_ENABLED
+		       | GRUB_PCI_COMMAND_BUS_MASTER);
+
+  ctrl = grub_zalloc (sizeof (*ctrl));
+  if (!ctrl)
+    return 1;
+
+  ctrl->regs = grub_pci_device_map_range (dev, base, GRUB_NVME_REG_DOORBELL);
+  cap = grub_nvme_read64 (ctrl, GRUB_NVME_REG_CAP);
+  ctrl->doorbell_stride = 4 << ((cap >> 32) & 0xf);
+  ctrl->ready_timeout = ((cap >> 24) & 0xff) * 500;
+  if (!ctrl->ready_timeout)
+    ctrl->ready_timeout = 500;
+  if (((cap >> 48) & 0xf) != 0 || !((cap >> 37) & 1))
+    {
+      grub_dprintf ("nvme", "%x:%x.%x: no 4KiB pages or NVM command set\n",
+		    dev.bus, dev.device, dev.function);
+      grub_free (ctrl);
+      return 0;
+    }
+
+  /* Map the two pairs of doorbells as well.  */
+  ctrl->regs = grub_pci_device_map_range (dev, base, GRUB_NVME_REG_DOORBELL
+					  + 4 * ctrl->doorbell_stride);
+
+  grub_dprintf ("nvme", "%x:%x.%x: cap %llx\n", dev.bus, dev.device,
+		dev.function, (unsigned long long) cap);
+
+  if (grub_nvme_queue_alloc (&ctrl->admin, 0, GRUB_NVME_ADMIN_QUEUE_SIZE)
+      || grub_nvme_queue_alloc (&ctrl->io, 1,
+				(cap & 0xffff) + 1 < GRUB_NVME_IO_QUEUE_SIZE
+				? (cap & 0xffff) + 1 : GRUB_NVME_IO_QUEUE_SIZE))
+    goto fail;
+  ctrl->identify = grub_memalign_dma32 (GRUB_NVME_PAGE_SIZE,
+					GRUB_NVME_PAGE_SIZE);
+  if (!ctrl->identify)
+    goto fail;
+
+  if (grub_nvme_enable (ctrl))
+    goto fail;
+
+  if (grub_nvme_admin (ctrl, GRUB_NVME_ADMIN_IDENTIFY, 0,
+		       grub_dma_get_phys (ctrl->identify),
+		       GRUB_NVME_IDENTIFY_CONTROLLER, 0))
+    goto fail;
+  id = grub_dma_get_virt (ctrl->identify);
+  mdts = id[77];
+  nn = grub_le_to_cpu32 (*(volatile grub_uint32_t *) (id + 516));
+
+  ctrl->max_transfer = GRUB_NVME_MAX_TRANSFER;
+  if (mdts && mdts < 16
+      && ((grub_size_t) GRUB_NVME_PAGE_SIZE << mdts) < ctrl->max_transfer)
+    ctrl->max_transfer = (grub_size_t) GRUB_NVME_PAGE_SIZE << mdts;
+
+  for (i = 0; i < GRUB_NVME_REQUESTS; i++)
+    {
+      ctrl->requests[i].buf = grub_memalign_dma32 (GRUB_NVME_PAGE_SIZE,
+						   ctrl->max_transfer);
+      ctrl->requests[i].prp_list = grub_memalign_dma32 (GRUB_NVME_PAGE_SIZE,
+							GRUB_NVME_PAGE_SIZE);
+      if (!ctrl->requests[i].buf || !ctrl->requests[i].prp_list)
+	goto fail;
+    }
+
+  ctrl->num = numctrls++;
+  grub_list_push (GRUB_AS_LIST_P (&grub_nvme_ctrls), GRUB_AS_LIST (ctrl));
+
+  if (nn > GRUB_NVME_MAX_NAMESPACES)
+    nn = GRUB_NVME_MAX_NAMESPACES;
+  for (i = 1; i <= nn; i++)
+    grub_nvme_add_namespace (ctrl, i);
+
+  return 0;
+
+ fail:
+  grub_dprintf ("nvme", "%x:%x.%x: %s\n", dev.bus, dev.device, dev.function,
+		grub_errmsg);
+  grub_errno = GRUB_ERR_NONE;
+  grub_nvme_write32 (ctrl, GRUB_NVME_REG_CC, 0);
+  grub_nvme_free (ctrl);
+  return 0;
+}
+
+/* Mark the I/O commands the controller has finished.  */
+static void
+grub_nvme_reap (struct grub_nvme_ctrl *ctrl)
+{
+  grub_uint16_t cid, status;
+
+  while (grub_nvme_poll (ctrl, &ctrl->io, &cid, &status))
+    if (cid < GRUB_NVME_REQUESTS
+	&& ctrl->requests[cid].state == GRUB_NVME_REQUEST_PENDING)
+      {
+	ctrl->requests[cid].status = status;
+	ctrl->requests[cid].state = GRUB_NVME_REQUEST_DONE;
+      }
+}
+
+static grub_err_t
+grub_nvme_wait (struct grub_nvme_ctrl *ctrl, struct grub_nvme_request *req)
+{
+  grub_uint64_t endtime = grub_get_time_ms () + GRUB_NVME_TIMEOUT;
+
+  while (1)
+    {
+      grub_nvme_reap (ctrl);
+      if (req->state != GRUB_NVME_REQUEST_PENDING)
+	return GRUB_ERR_NONE;
+      if (grub_get_time_ms () > endtime)
+	{
+	  ctrl->broken = 1;
+	  return grub_error (GRUB_ERR_IO, "NVMe transfer timed out");
+	}
+    }
+}
+
+/* Return a slot for a new command.  Unless WAIT, only a free one;
+   otherwise the oldest finished one may be reused, or pending commands
+   are waited for.  */
+static struct grub_nvme_request *
+grub_nvme_get_request (struct grub_nvme_ctrl *ctrl, int wait)
+{
+  struct grub_nvme_request *req, *done, *pending;
+  unsigned i;
+
+  grub_nvme_reap (ctrl);
+  while (1)
+    {
+      done = pending = NULL;
+      for (i = 0; i < GRUB_NVME_REQUESTS; i++)
+	{
+	  req = &ctrl->requests[i];
+	  if (req->state == GRUB_NVME_REQUEST_FREE)
+	    return req;
+	  if (req->state == GRUB_NVME_REQUEST_DONE
+	      && (!done || (grub_int32_t) (req->seq - done->seq) < 0))
+	    done = req;
+	  if (req->state == GRUB_NVME_REQUEST_PENDING
+	      && (!pending || (grub_int32_t) (req->seq - pending->seq) < 0))
+	    pending = req;
+	}
+      if (!wait)
+	return NULL;
+      if (done)
+	return done;
+      if (grub_nvme_wait (ctrl, pending))
+	return NULL;
+    }
+}
+
+/* The command of NS holding SECTOR, if any.  */
+static struct grub_nvme_request *
+grub_nvme_find (struct grub_nvme_ns *ns, grub_disk_addr_t sector)
+{
+  unsigned i;
+
+  for (i = 0; i < GRUB_NVME_REQUESTS; i++)
+    {
+      struct grub_nvme_request *req = &ns->ctrl->requests[i];
+
+      if (req->state != GRUB_NVME_REQUEST_FREE && req->ns == ns
+	  && sector >= req->lba && sector < req->lba + req->count)
+	return req;
+    }
+  return NULL;
+}
+
+/* How many of the SIZE sectors at SECTOR one new command should
+   transfer: no more than the controller allows and not into data
+   already requested.  */
+static grub_size_t
+grub_nvme_chunk (struct grub_nvme_ns *ns, grub_disk_addr_t sector,
+		 grub_size_t size)
+{
+  grub_size_t n = ns->ctrl->max_transfer >> ns->log_sector_size;
+  unsigned i;
+
+  if (n > size)
+    n = size;
+  for (i = 0; i < GRUB_NVME_REQUESTS; i++)
+    {
+      struct grub_nvme_request *req = &ns->ctrl->requests[i];
+
+      if (req->state != GRUB_NVME_REQUEST_FREE && req->ns == ns
+	  && req->lba > sector && req->lba < sector + n)
+	n = req->lba - sector;
+    }
+  return n;
+}
+
+static void
+grub_nvme_submit_io (struct grub_nvme_ns *ns, struct grub_nvme_request *req,
+		     grub_uint8_t opcode, grub_disk_addr_t lba,
+		     grub_size_t count)
+{
+  struct grub_nvme_ctrl *ctrl = ns->ctrl;
+  grub_uint32_t phys = grub_dma_get_phys (req->buf);
+  grub_size_t bytes = count << ns->log_sector_size;
+  struct grub_nvme_sqe cmd;
+
+  grub_memset (&cmd, 0, sizeof (cmd));
+  cmd.cdw0 = grub_cpu_to_le32 (opcode | ((req - ctrl->requests) << 16));
+  cmd.nsid = grub_cpu_to_le32 (ns->nsid);
+  cmd.prp1 = grub_cpu_to_le64 (phys);
+  if (bytes > 2 * GRUB_NVME_PAGE_SIZE)
+    {
+      volatile grub_uint64_t *list = grub_dma_get_virt (req->prp_list);
+      grub_size_t i;
+
+      for (i = 1; i * GRUB_NVME_PAGE_SIZE < bytes; i++)
+	list[i - 1] = grub_cpu_to_le64 (phys + i * GRUB_NVME_PAGE_SIZE);
+      cmd.prp2 = grub_cpu_to_le64 (grub_dma_get_phys (req->prp_list));
+    }
+  else if (bytes > GRUB_NVME_PAGE_SIZE)
+    cmd.prp2 = grub_cpu_to_le64 (phys + GRUB_NVME_PAGE_SIZE);
+  cmd.cdw10 = grub_cpu_to_le32 (lba);
+  cmd.cdw11 = grub_cpu_to_le32 (lba >> 32);
+  cmd.cdw12 = grub_cpu_to_le32 (count - 1);
+
+  req->state = GRUB_NVME_REQUEST_PENDING;
+  req->status = 0;
+  req->ns = ns;
+  req->lba = lba;
+  req->count = count;
+  req->seq = ctrl->seq++;
+  grub_nvme_submit (ctrl, &ctrl->io, &cmd);
+}
+
+static int
+grub_nvme_iterate (grub_disk_dev_iterate_hook_t hook, void *hook_data,
+		   grub_disk_pull_t pull)
+{
+  struct grub_nvme_ns *ns;
+
+  if (pull != GRUB_DISK_PULL_NONE)
+    return 0;
+
+  FOR_LIST_ELEMENTS (ns, grub_nvme_namespaces)
+    if (hook (ns->name, hook_data))
+      return 1;
+
+  return 0;
+}
+
+static grub_err_t
+grub_nvme_open (const char *name, grub_disk_t disk)
+{
+  struct grub_nvme_ns *ns;
+
+  FOR_LIST_ELEMENTS (ns, grub_nvme_namespaces)
+    if (grub_strcmp (ns->name, name) == 0)
+      break;
+
+  if (!ns)
+    return grub_error (GRUB_ERR_UNKNOWN_DEVICE, "not an NVMe namespace");
+
+  disk->total_sectors = ns->size;
+  disk->log_sector_size = ns->log_sector_size;
+  /* Large reads and read-ahead are spread over all the slots.  */
+  disk->max_agglomerate = (ns->ctrl->max_transfer * GRUB_NVME_REQUESTS)
+    >> (GRUB_DISK_CACHE_BITS + GRUB_DISK_SECTOR_BITS);
+  if (!disk->max_agglomerate)
+    disk->max_agglomerate = 1;
+  disk->id = ns->id;
+  disk->data = ns;
+
+  return GRUB_ERR_NONE;
+}
+
+/* Queue reads of the SIZE sectors at SECTOR on the free slots, without
+   waiting for them.  */
+static grub_err_t
+grub_nvme_prefetch (grub_disk_t disk, grub_disk_addr_t sector,
+		    grub_size_t size)
+{
+  struct grub_nvme_ns *ns = disk->data;
+  struct grub_nvme_ctrl *ctrl = ns->ctrl;
+
+  if (ctrl->broken)
+    return grub_error (GRUB_ERR_IO, "NVMe controller not responding");
+
+  while (size)
+    {
+      struct grub_nvme_request *req;
+      grub_size_t n;
+
+      req = grub_nvme_find (ns, sector);
+      if (req)
+	n = req->lba + req->count - sector;
+      else
+	{
+	  req = grub_nvme_get_request (ctrl, 0);
+	  if (!req)
+	    break;
+	  n = grub_nvme_chunk (ns, sector, size);
+	  grub_nvme_submit_io (ns, req, GRUB_NVME_CMD_READ, sector, n);
+	}
+      if (n > size)
+	n = size;
+      sector += n;
+      size -= n;
+    }
+
+  return GRUB_ERR_NONE;
+}
+
+static grub_err_t
+grub_nvme_read (grub_disk_t disk, grub_disk_addr_t sector,
+		grub_size_t size, char *buf)
+{
+  struct grub_nvme_ns *ns = disk->data;
+  struct grub_nvme_ctrl *ctrl = ns->ctrl;
+
+  if (ctrl->broken)
+    return grub_error (GRUB_ERR_IO, "NVMe controller not responding");
+
+  /* Have as much as possible in flight at once.  */
+  grub_nvme_prefetch (disk, sector, size);
+
+  while (size)
+    {
+      struct grub_nvme_request *req;
+      grub_size_t n;
+
+      req = grub_nvme_find (ns, sector);
+      if (!req)
+	{
+	  n = grub_nvme_chunk (ns, sector, size);
+	  req = grub_nvme_get_request (ctrl, 1);
+	  if (!req)
+	    return grub_errno;
+	  grub_nvme_submit_io (ns, req, GRUB_NVME_CMD_READ, sector, n);
+	}
+
+      if (grub_nvme_wait (ctrl, req))
+	return grub_errno;
+      if (req->status)
+	{
+	  req->state = GRUB_NVME_REQUEST_FREE;
+	  return grub_error (GRUB_ERR_READ_ERROR,
+			     N_("failure reading sector 0x%llx from `%s'"),
+			     (unsigned long long) sector, disk->name);
+	}
+
+      n = req->lba + req->count - sector;
+      if (n > size)
+	n = size;
+      grub_memcpy (buf, (char *) grub_dma_get_virt (req->buf)
+		   + ((sector - req->lba) << ns->log_sector_size),
+		   n << ns->log_sector_size);
+      if (sector + n == req->lba + req->count)
+	req->state = GRUB_NVME_REQUEST_FREE;
+
+      sector += n;
+      size -= n;
+      buf += n << ns->log_sector_size;
+    }
+
+  return GRUB_ERR_NONE;
+}
+
+static grub_err_t
+grub_nvme_write (grub_disk_t disk, grub_disk_addr_t sector,
+		 grub_size_t size, const char *buf)
+{
+  struct grub_nvme_ns *ns = disk->data;
+  struct grub_nvme_ctrl *ctrl = ns->ctrl;
+  unsigned i;
+
+  if (ctrl->broken)
+    return grub_error (GRUB_ERR_IO, "NVMe controller not responding");
+
+  /* Drop what was read ahead of the range being overwritten.  */
+  for (i = 0; i < GRUB_NVME_REQUESTS; i++)
+    {
+      struct grub_nvme_request *req = &ctrl->requests[i];
+
+      if (req->state == GRUB_NVME_REQUEST_FREE || req->ns != ns
+	  || req->lba >= sector + size || req->lba + req->count <= sector)
+	continue;
+      if (grub_nvme_wait (ctrl, req))
+	return grub_errno;
+      req->state = GRUB_NVME_REQUEST_FREE;
+    }
+
+  while (size)
+    {
+      struct grub_nvme_request *req;
+      grub_size_t n;
+
+      n = grub_nvme_chunk (ns, sector, size);
+      req = grub_nvme_get_request (ctrl, 1);
+      if (!req)
+	return grub_errno;
+      grub_memcpy ((char *) grub_dma_get_virt (req->buf), buf,
+		   n << ns->log_sector_size);
+      grub_nvme_submit_io (ns, req, GRUB_NVME_CMD_WRITE, sector, n);
+      if (grub_nvme_wait (ctrl, req))
+	return grub_errno;
+      req->state = GRUB_NVME_REQUEST_FREE;
+      if (req->status)
+	return grub_error (GRUB_ERR_WRITE_ERROR,
+			   N_("failure writing sector 0x%llx to `%s'"),
+			   (unsigned long long) sector, disk->name);
+
+      sector += n;
+      size -= n;
+      buf += n << ns->log_sector_size;
+    }
+
+  return GRUB_ERR_NONE;
+}
+
+static struct grub_disk_dev grub_nvme_dev =
+  {
+    .name = "nvme",
+    .id = GRUB_DISK_DEVICE_NVME_ID,
+    .iterate = grub_nvme_iterate,
+    .open = grub_nvme_open,
+    .read = grub_nvme_read,
+    .write = grub_nvme_write,
+    .prefetch = grub_nvme_prefetch,
+    .next = 0
+  };
+
+/* Let the commands in flight finish and shut the controllers down, as the
+   OS expects to find them.  */
+static grub_err_t
+grub_nvme_fini_hw (int noreturn __attribute__ ((unused)))
+{
+  struct grub_nvme_ctrl *ctrl;
+  unsigned i;
+
+  FOR_LIST_ELEMENTS (ctrl, grub_nvme_ctrls)
+    {
+      if (!ctrl->broken)
+	for (i = 0; i < GRUB_NVME_REQUESTS; i++)
+	  if (grub_nvme_wait (ctrl, &ctrl->requests[i]))
+	    break;
+      grub_errno = GRUB_ERR_NONE;
+
+      grub_nvme_write32 (ctrl, GRUB_NVME_REG_CC,
+			 grub_nvme_read32 (ctrl, GRUB_NVME_REG_CC)
+			 | GRUB_NVME_CC_SHUTDOWN_NORMAL);
+      if (grub_nvme_wait_status (ctrl, GRUB_NVME_CSTS_SHUTDOWN_MASK,
+				 GRUB_NVME_CSTS_SHUTDOWN_DONE))
+	grub_errno = GRUB_ERR_NONE;
+      grub_nvme_write32 (ctrl, GRUB_NVME_REG_CC, 0);
+      if (grub_nvme_wait_status (ctrl, GRUB_NVME_CSTS_READY, 0))
+	grub_errno = GRUB_ERR_NONE;
+    }
+  return GRUB_ERR_NONE;
+}
+
+static grub_err_t
+grub_nvme_restore_hw (void)
+{
+  struct grub_nvme_ctrl *ctrl;
+
+  FOR_LIST_ELEMENTS (ctrl, grub_nvme_ctrls)
+    if (grub_nvme_enable (ctrl))
+      {
+	ctrl->broken = 1;
+	grub_print_error ();
+      }
+  return GRUB_ERR_NONE;
+}
+
+static struct grub_preboot *fini_hnd;
+
+GRUB_MOD_INIT(nvme)
+{
+  grub_stop_disk_firmware ();
+
+  grub_pci_iterate (grub_nvme_pciinit, NULL);
+
+  grub_disk_dev_register (&grub_nvme_dev);
+
+  fini_hnd = grub_loader_register_preboot_hook (grub_nvme_fini_hw,
+						grub_nvme_restore_hw,
+						GRUB_LOADER_PREBOOT_HOOK_PRIO_DISK);
+}
+
+GRUB_MOD_FINI(nvme)
+{
+  grub_nvme_fini_hw (0);
+  grub_loader_unregister_preboot_hook (fini_hnd);
+
+  grub_disk_dev_unregister (&grub_nvme_dev);
+}
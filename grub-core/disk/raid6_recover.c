@@ -23,7 +23,15 @@
 #include <grub/err.h>
 #include <grub/misc.h>
 #include <grub/diskfilter.h>
-#include <grub/crypto.h>
+#if defined (__x86_64__) && defined (GRUB_MACHINE_EFI)
+#include <grub/i386/cpuid.h>
+#include <grub/x86_64/raid.h>
+
+/* CPUID.1:ECX.SSSE3  */
+#define CPUID_SSSE3 (1 << 9)
+
+static int have_ssse3;
+#endif
 
 GRUB_MOD_LICENSE ("GPLv3+");
 
@@ -33,16 +41,56 @@ static grub_uint8_t powx[255 * 2];
 static unsigned powx_inv[256];
 static const grub_uint8_t poly = 0x1d;
 
+static inline grub_uint8_t
+grub_raid6_mul (unsigned mul, grub_uint8_t v)
+{
+  return v ? powx[mul + powx_inv[v]] : 0;
+}
+
+/* DST = x**MUL * SRC, or DST ^= x**MUL * SRC if ACCUMULATE.  DST may be
+   SRC.  */
 static void
-grub_raid_block_mulx (unsigned mul, char *buf, grub_size_t size)
+grub_raid_block_mulx (unsigned mul, char *dst, const char *src,
+		      grub_size_t size, int accumulate)
 {
+  grub_uint8_t table[256];
+  grub_uint8_t *d = (grub_uint8_t *) dst;
+  const grub_uint8_t *s = (const grub_uint8_t *) src;
   grub_size_t i;
-  grub_uint8_t *p;
 
-  p = (grub_uint8_t *) buf;
-  for (i = 0; i < size; i++, p++)
-    if (*p)
-      *p = powx[mul + powx_inv[*p]];
+#if defined (__x86_64__) && defined (GRUB_MACHINE_EFI)
+  if (have_ssse3 && size >= GRUB_RAID_SSSE3_BLOCK)
+    {
+      grub_uint8_t nibbles[32];
+      grub_size_t n = size & ~(grub_size_t) (GRUB_RAID_SSSE3_BLOCK - 1);
+
+      for (i = 0; i < 16; i++)
+	{
+	  nibbles[i] = grub_raid6_mul (mul, i);
+	  nibbles[16 + i] = grub_raid6_mul (mul, i << 4);
+	}
+      if (accumulate)
+	grub_raid6_mul_xor_ssse3 (d, s, n, nibbles);
+      else
+	grub_raid6_mul_ssse3 (d, s, n, nibbles);
+      d += n;
+      s += n;
+      size -= n;
+      if (!size)
+	return;
+    }
+#endif
+
+  /* One lookup per byte instead of two and a branch.  */
+  for (i = 0; i < 256; i++)
+    table[i] = grub_raid6_mul (mul, i);
+
+  if (accumulate)
+    for (i = 0; i < size; i++)
+      d[i] ^= table[s[i]];
+  else
+    for (i = 0; i < size; i++)
+      d[i] = table[s[i]];
 }
 
 static void
@@ -112,9 +160,8 @@ grub_raid6_recover (struct grub_diskfilter_segment *array, int disknr, int p,
           if (! grub_diskfilter_read_node (&array->nodes[pos], sector,
 					   size >> GRUB_DISK_SECTOR_BITS, buf))
             {
-              grub_crypto_xor (pbuf, pbuf, buf, size);
-              grub_raid_block_mulx (c, buf, size);
-              grub_crypto_xor (qbuf, qbuf, buf, size);
+              grub_raid_block_xor (pbuf, buf, size);
+              grub_raid_block_mulx (c, qbuf, buf, size, 1);
             }
           else
             {
@@ -142,7 +189,7 @@ grub_raid6_recover (struct grub_diskfilter_segment *array, int disknr, int p,
       if ((! grub_diskfilter_read_node (&array->nodes[p], sector,
 					size >> GRUB_DISK_SECTOR_BITS, buf)))
         {
-          grub_crypto_xor (buf, buf, pbuf, size);
+          grub_raid_block_xor (buf, pbuf, size);
           goto quit;
         }
 
@@ -151,9 +198,8 @@ grub_raid6_recover (struct grub_diskfilter_segment *array, int disknr, int p,
 				     size >> GRUB_DISK_SECTOR_BITS, buf))
         goto quit;
 
-      grub_crypto_xor (buf, buf, qbuf, size);
-      grub_raid_block_mulx (255 - bad1, buf,
-                           size);
+      grub_raid_block_xor (buf, qbuf, size);
+      grub_raid_block_mulx (255 - bad1, buf, buf, size, 0);
     }
   else
     {
@@ -164,23 +210,22 @@ grub_raid6_recover (struct grub_diskfilter_segment *array, int disknr, int p,
 				     size >> GRUB_DISK_SECTOR_BITS, buf))
         goto quit;
 
-      grub_crypto_xor (pbuf, pbuf, buf, size);
+      grub_raid_block_xor (pbuf, buf, size);
 
       if (grub_diskfilter_read_node (&array->nodes[q], sector,
 				     size >> GRUB_DISK_SECTOR_BITS, buf))
         goto quit;
 
-      grub_crypto_xor (qbuf, qbuf, buf, size);
+      grub_raid_block_xor (qbuf, buf, size);
 
       c = mod_255((255 ^ bad1)
 		  + (255 ^ powx_inv[(powx[bad2 + (bad1 ^ 255)] ^ 1)]));
-      grub_raid_block_mulx (c, qbuf, size);
+      grub_raid_block_mulx (c, qbuf, qbuf, size, 0);
 
       c = mod_255((unsigned) bad2 + c);
-      grub_raid_block_mulx (c, pbuf, size);
+      grub_raid_block_mulx (c, buf, pbuf, size, 0);
 
-      grub_crypto_xor (pbuf, pbuf, qbuf, size);
-      grub_memcpy (buf, pbuf, size);
+      grub_raid_block_xor (buf, qbuf, size);
     }
 
 quit:
@@ -192,6 +237,12 @@ quit:
 
 GRUB_MOD_INIT(raid6rec)
 {
+#if defined (__x86_64__) && defined (GRUB_MACHINE_EFI)
+  grub_uint32_t eax, ebx, ecx, edx;
+
+  grub_cpuid (1, eax, ebx, ecx, edx);
+  have_ssse3 = !!(ecx & CPUID_SSSE3);
+#endif
   grub_raid6_init_table ();
   grub_raid6_recover_func = grub_raid6_recover;
 }
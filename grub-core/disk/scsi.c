@@ -511,7 +511,7 @@ grub_scsi_open (const char *name, grub_disk_t disk)
 
   bus = grub_strtoul (nameend + 1, 0, 0);
 
-  scsi = grub_malloc (sizeof (*scsi));
+  scsi = grub_zalloc (sizeof (*scsi));
   if (! scsi)
     return grub_errno;
 
@@ -606,12 +606,12 @@ grub_scsi_open (const char *name, grub_disk_t disk)
 	}
 
       disk->total_sectors = scsi->last_block + 1;
-      /* PATA doesn't support more than 32K reads.
-	 Not sure about AHCI and USB. If it's confirmed that either of
-	 them can do bigger reads reliably this value can be moved to 'scsi'
-	 structure.  */
-      disk->max_agglomerate = 32768 >> (GRUB_DISK_SECTOR_BITS
-					+ GRUB_DISK_CACHE_BITS);
+      /* PATA doesn't support more than 32K reads, so that is what is
+	 used unless the device knows better.  */
+      disk->max_agglomerate = (scsi->max_transfer ? : 32768)
+	>> (GRUB_DISK_SECTOR_BITS + GRUB_DISK_CACHE_BITS);
+      if (!disk->max_agglomerate)
+	disk->max_agglomerate = 1;
 
       if (scsi->blocksize & (scsi->blocksize - 1) || !scsi->blocksize)
 	{
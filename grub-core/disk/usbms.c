@@ -23,6 +23,7 @@
 #include <grub/scsi.h>
 #include <grub/scsicmd.h>
 #include <grub/misc.h>
+#include <grub/disk.h>
 
 GRUB_MOD_LICENSE ("GPLv3+");
 
@@ -34,6 +35,12 @@ GRUB_MOD_LICENSE ("GPLv3+");
  * device in DATA stage */
 #define GRUB_USBMS_CBI_ADSC_REQ         0x00
 
+/* Largest data transfer of one command.  Some USB 2 devices fail
+   commands above 120 KiB, USB 3 devices are expected to cope with
+   more.  */
+#define GRUB_USBMS_MAX_TRANSFER		(120 << 10)
+#define GRUB_USBMS_MAX_TRANSFER_SUPER	(1 << 20)
+
 /* The USB Mass Storage Command Block Wrapper.  */
 struct grub_usbms_cbw
 {
@@ -134,6 +141,7 @@ grub_usbms_detach (grub_usb_device_t usbdev, int config, int interface)
       {
 	grub_free (grub_usbms_devices[i]);
 	grub_usbms_devices[i] = 0;
+	grub_disk_generation++;
       }
 }
 
@@ -243,6 +251,7 @@ grub_usbms_attach (grub_usb_device_t usbdev, int configno, int interfno)
   grub_dprintf ("usbms", "alive\n");
 
   usbdev->config[configno].interf[interfno].detach_hook = grub_usbms_detach;
+  grub_disk_generation++;
 
   grub_boot_time ("Attached USB mass storage");
 
@@ -621,6 +630,10 @@ grub_usbms_open (int id, int devnum, struct grub_scsi *scsi)
 
   scsi->data = grub_usbms_devices[devnum];
   scsi->luns = grub_usbms_devices[devnum]->luns;
+  if (grub_usbms_devices[devnum]->dev->speed == GRUB_USB_SPEED_SUPER)
+    scsi->max_transfer = GRUB_USBMS_MAX_TRANSFER_SUPER;
+  else
+    scsi->max_transfer = GRUB_USBMS_MAX_TRANSFER;
 
   return GRUB_ERR_NONE;
 }
@@ -28,6 +28,27 @@
 #include <grub/time.h>
 #include <xen/io/blkif.h>
 
+/* Requests kept in flight at once, each in its own slot.  */
+#define VIRTDISK_MAX_SLOTS 4
+/* Segments per request when the backend takes indirect requests.  The
+   descriptors of a request fit in a single indirect page.  */
+#define VIRTDISK_INDIRECT_SEGMENTS 32
+
+struct virtdisk_slot
+{
+  /* Data pages, granted once and reused by every request (persistent
+     grants), so the backend can keep them mapped.  */
+  void **pages;
+  grub_xen_grant_t *grants;
+  /* Segment descriptors of indirect requests, or NULL.  */
+  struct blkif_request_segment *indirect;
+  grub_xen_grant_t indirect_grant;
+  /* Request in flight: where read data goes and how many bytes.  */
+  int busy;
+  char *buf;
+  grub_size_t len;
+};
+
 struct virtdisk
 {
   int handle;
@@ -38,8 +59,10 @@ struct virtdisk
   struct blkif_front_ring ring;
   grub_xen_grant_t grant;
   grub_xen_evtchn_t evtchn;
-  void *dma_page;
-  grub_xen_grant_t dma_grant;
+  struct virtdisk_slot slots[VIRTDISK_MAX_SLOTS];
+  unsigned nslots;
+  /* Data pages per slot.  */
+  unsigned nsegs;
   struct virtdisk *compat_next;
 };
 
@@ -126,126 +149,178 @@ grub_virtdisk_close (grub_disk_t disk __attribute__ ((unused)))
 {
 }
 
-static grub_err_t
-grub_virtdisk_read (grub_disk_t disk, grub_disk_addr_t sector,
-		    grub_size_t size, char *buf)
+/* Queue the first part of the transfer of SIZE sectors at SECTOR in SLOT,
+   which is request ID.  Return the number of sectors queued.  */
+static grub_size_t
+queue_request (grub_disk_t disk, struct virtdisk_slot *slot, unsigned id,
+	       int op, grub_disk_addr_t sector, grub_size_t size, char *buf)
 {
   struct virtdisk *data = disk->data;
-
-  while (size)
+  struct blkif_request *req;
+  struct blkif_request_segment *seg;
+  grub_size_t cur, len, off;
+  unsigned i, nseg;
+
+  cur = size;
+  if (cur > ((grub_size_t) data->nsegs * GRUB_XEN_PAGE_SIZE)
+      >> disk->log_sector_size)
+    cur = ((grub_size_t) data->nsegs * GRUB_XEN_PAGE_SIZE)
+      >> disk->log_sector_size;
+  len = cur << disk->log_sector_size;
+  nseg = (len + GRUB_XEN_PAGE_SIZE - 1) >> GRUB_XEN_LOG_PAGE_SIZE;
+
+  req = RING_GET_REQUEST (&data->ring, data->ring.req_prod_pvt);
+  if (nseg > BLKIF_MAX_SEGMENTS_PER_REQUEST)
     {
-      grub_size_t cur;
-      struct blkif_request *req;
-      struct blkif_response *resp;
-      int sta = 0;
-      struct evtchn_send send;
-      cur = size;
-      if (cur > (unsigned) (GRUB_XEN_PAGE_SIZE >> disk->log_sector_size))
-	cur = GRUB_XEN_PAGE_SIZE >> disk->log_sector_size;
-      while (RING_FULL (&data->ring))
-	grub_xen_sched_op (SCHEDOP_yield, 0);
-      req = RING_GET_REQUEST (&data->ring, data->ring.req_prod_pvt);
-      req->operation = BLKIF_OP_READ;
-      req->nr_segments = 1;
+      struct blkif_request_indirect *ind = (void *) req;
+
+      ind->operation = BLKIF_OP_INDIRECT;
+      ind->indirect_op = op;
+      ind->nr_segments = nseg;
+      ind->handle = data->handle;
+      ind->id = id;
+      ind->sector_number = sector << (disk->log_sector_size - 9);
+      ind->indirect_grefs[0] = slot->indirect_grant;
+      seg = slot->indirect;
+    }
+  else
+    {
+      req->operation = op;
+      req->nr_segments = nseg;
       req->handle = data->handle;
-      req->id = 0;
+      req->id = id;
       req->sector_number = sector << (disk->log_sector_size - 9);
-      req->seg[0].gref = data->dma_grant;
-      req->seg[0].first_sect = 0;
-      req->seg[0].last_sect = (cur << (disk->log_sector_size - 9)) - 1;
-      data->ring.req_prod_pvt++;
-      RING_PUSH_REQUESTS (&data->ring);
-      mb ();
-      send.port = data->evtchn;
-      grub_xen_event_channel_op (EVTCHNOP_send, &send);
+      seg = req->seg;
+    }
 
-      while (!RING_HAS_UNCONSUMED_RESPONSES (&data->ring))
-	{
-	  grub_xen_sched_op (SCHEDOP_yield, 0);
-	  mb ();
-	}
-      while (1)
+  for (i = 0, off = 0; i < nseg; i++, off += GRUB_XEN_PAGE_SIZE)
+    {
+      grub_size_t n = len - off;
+      if (n > GRUB_XEN_PAGE_SIZE)
+	n = GRUB_XEN_PAGE_SIZE;
+      if (op == BLKIF_OP_WRITE)
+	grub_memcpy (slot->pages[i], buf + off, n);
+      seg[i].gref = slot->grants[i];
+      seg[i].first_sect = 0;
+      seg[i].last_sect = (n >> 9) - 1;
+    }
+  data->ring.req_prod_pvt++;
+
+  slot->busy = 1;
+  slot->buf = buf;
+  slot->len = len;
+  return cur;
+}
+
+/* Consume the responses on the ring and return how many requests they
+   completed.  */
+static unsigned
+collect_responses (struct virtdisk *data, int op, int *failed)
+{
+  unsigned done = 0;
+
+  while (1)
+    {
+      struct blkif_response *resp;
+      struct virtdisk_slot *slot;
+      grub_size_t off;
+      unsigned i;
+      int wtd;
+
+      RING_FINAL_CHECK_FOR_RESPONSES (&data->ring, wtd);
+      if (!wtd)
+	break;
+      resp = RING_GET_RESPONSE (&data->ring, data->ring.rsp_cons);
+      data->ring.rsp_cons++;
+      if (resp->id >= data->nslots || !data->slots[resp->id].busy)
+	continue;
+      slot = &data->slots[resp->id];
+      slot->busy = 0;
+      done++;
+      if (resp->status)
 	{
-	  int wtd;
-	  RING_FINAL_CHECK_FOR_RESPONSES (&data->ring, wtd);
-	  if (!wtd)
-	    break;
-	  resp = RING_GET_RESPONSE (&data->ring, data->ring.rsp_cons);
-	  data->ring.rsp_cons++;
-	  if (resp->status)
-	    sta = resp->status;
+	  *failed = 1;
+	  continue;
 	}
-      if (sta)
-	return grub_error (GRUB_ERR_IO, "read failed");
-      grub_memcpy (buf, data->dma_page, cur << disk->log_sector_size);
-      size -= cur;
-      sector += cur;
-      buf += cur << disk->log_sector_size;
+      if (op != BLKIF_OP_READ)
+	continue;
+      for (i = 0, off = 0; off < slot->len; i++, off += GRUB_XEN_PAGE_SIZE)
+	grub_memcpy (slot->buf + off, slot->pages[i],
+		     slot->len - off > GRUB_XEN_PAGE_SIZE
+		     ? GRUB_XEN_PAGE_SIZE : slot->len - off);
     }
-  return GRUB_ERR_NONE;
+  return done;
 }
 
+/* Split the transfer into requests of up to nsegs pages and keep one in
+   flight in every free slot, so that the backend always has the next one
+   queued.  */
 static grub_err_t
-grub_virtdisk_write (grub_disk_t disk, grub_disk_addr_t sector,
-		     grub_size_t size, const char *buf)
+virtdisk_transfer (grub_disk_t disk, int op, grub_disk_addr_t sector,
+		   grub_size_t size, char *buf)
 {
   struct virtdisk *data = disk->data;
+  unsigned inflight = 0;
+  int failed = 0;
 
-  while (size)
+  while (1)
     {
-      grub_size_t cur;
-      struct blkif_request *req;
-      struct blkif_response *resp;
-      int sta = 0;
-      struct evtchn_send send;
-      cur = size;
-      if (cur > (unsigned) (GRUB_XEN_PAGE_SIZE >> disk->log_sector_size))
-	cur = GRUB_XEN_PAGE_SIZE >> disk->log_sector_size;
-
-      grub_memcpy (data->dma_page, buf, cur << disk->log_sector_size);
-
-      while (RING_FULL (&data->ring))
-	grub_xen_sched_op (SCHEDOP_yield, 0);
-      req = RING_GET_REQUEST (&data->ring, data->ring.req_prod_pvt);
-      req->operation = BLKIF_OP_WRITE;
-      req->nr_segments = 1;
-      req->handle = data->handle;
-      req->id = 0;
-      req->sector_number = sector << (disk->log_sector_size - 9);
-      req->seg[0].gref = data->dma_grant;
-      req->seg[0].first_sect = 0;
-      req->seg[0].last_sect = (cur << (disk->log_sector_size - 9)) - 1;
-      data->ring.req_prod_pvt++;
-      RING_PUSH_REQUESTS (&data->ring);
-      mb ();
-      send.port = data->evtchn;
-      grub_xen_event_channel_op (EVTCHNOP_send, &send);
+      unsigned i;
+      int queued = 0;
 
-      while (!RING_HAS_UNCONSUMED_RESPONSES (&data->ring))
+      for (i = 0; size && !failed && i < data->nslots; i++)
 	{
-	  grub_xen_sched_op (SCHEDOP_yield, 0);
+	  grub_size_t cur;
+
+	  if (data->slots[i].busy || RING_FULL (&data->ring))
+	    continue;
+	  cur = queue_request (disk, &data->slots[i], i, op, sector, size, buf);
+	  size -= cur;
+	  sector += cur;
+	  buf += cur << disk->log_sector_size;
+	  inflight++;
+	  queued = 1;
+	}
+      if (queued)
+	{
+	  struct evtchn_send send;
+
+	  RING_PUSH_REQUESTS (&data->ring);
 	  mb ();
+	  send.port = data->evtchn;
+	  grub_xen_event_channel_op (EVTCHNOP_send, &send);
 	}
-      while (1)
+      if (!inflight)
+	break;
+
+      while (!RING_HAS_UNCONSUMED_RESPONSES (&data->ring))
 	{
-	  int wtd;
-	  RING_FINAL_CHECK_FOR_RESPONSES (&data->ring, wtd);
-	  if (!wtd)
-	    break;
-	  resp = RING_GET_RESPONSE (&data->ring, data->ring.rsp_cons);
-	  data->ring.rsp_cons++;
-	  if (resp->status)
-	    sta = resp->status;
+	  grub_xen_sched_op (SCHEDOP_yield, 0);
+	  mb ();
 	}
-      if (sta)
-	return grub_error (GRUB_ERR_IO, "write failed");
-      size -= cur;
-      sector += cur;
-      buf += cur << disk->log_sector_size;
+      inflight -= collect_responses (data, op, &failed);
     }
+
+  if (failed)
+    return grub_error (GRUB_ERR_IO, op == BLKIF_OP_READ ? "read failed"
+		       : "write failed");
   return GRUB_ERR_NONE;
 }
 
+static grub_err_t
+grub_virtdisk_read (grub_disk_t disk, grub_disk_addr_t sector,
+		    grub_size_t size, char *buf)
+{
+  return virtdisk_transfer (disk, BLKIF_OP_READ, sector, size, buf);
+}
+
+static grub_err_t
+grub_virtdisk_write (grub_disk_t disk, grub_disk_addr_t sector,
+		     grub_size_t size, const char *buf)
+{
+  return virtdisk_transfer (disk, BLKIF_OP_WRITE, sector, size, (char *) buf);
+}
+
 static struct grub_disk_dev grub_virtdisk_dev = {
   .name = "xen",
   .id = GRUB_DISK_DEVICE_XEN,
@@ -257,6 +332,61 @@ static struct grub_disk_dev grub_virtdisk_dev = {
   .next = 0
 };
 
+static void
+free_slot (struct virtdisk_slot *slot, unsigned nsegs)
+{
+  unsigned i;
+
+  if (slot->pages)
+    for (i = 0; i < nsegs && slot->pages[i]; i++)
+      grub_xen_free_shared_page (slot->pages[i]);
+  if (slot->indirect)
+    grub_xen_free_shared_page (slot->indirect);
+  grub_free (slot->pages);
+  grub_free (slot->grants);
+  grub_memset (slot, 0, sizeof (*slot));
+}
+
+static int
+alloc_slot (struct virtdisk_slot *slot, domid_t dom, unsigned nsegs)
+{
+  unsigned i;
+
+  grub_memset (slot, 0, sizeof (*slot));
+  slot->pages = grub_zalloc (nsegs * sizeof (slot->pages[0]));
+  slot->grants = grub_malloc (nsegs * sizeof (slot->grants[0]));
+  if (!slot->pages || !slot->grants)
+    goto fail;
+  for (i = 0; i < nsegs; i++)
+    {
+      slot->pages[i] = grub_xen_alloc_shared_page (dom, &slot->grants[i]);
+      if (!slot->pages[i])
+	goto fail;
+    }
+  if (nsegs > BLKIF_MAX_SEGMENTS_PER_REQUEST)
+    {
+      slot->indirect = grub_xen_alloc_shared_page (dom,
+						   &slot->indirect_grant);
+      if (!slot->indirect)
+	goto fail;
+    }
+  return 1;
+
+fail:
+  free_slot (slot, nsegs);
+  return 0;
+}
+
+static void
+free_slots (struct virtdisk *vd)
+{
+  unsigned i;
+
+  for (i = 0; i < vd->nslots; i++)
+    free_slot (&vd->slots[i], vd->nsegs);
+  vd->nslots = 0;
+}
+
 static int
 count (const char *dir __attribute__ ((unused)), void *data)
 {
@@ -327,10 +457,34 @@ fill (const char *dir, void *data)
   if (!virtdisks[vdiskcnt].shared_page)
     goto out_fail_1;
 
-  virtdisks[vdiskcnt].dma_page =
-    grub_xen_alloc_shared_page (dom, &virtdisks[vdiskcnt].dma_grant);
-  if (!virtdisks[vdiskcnt].dma_page)
+  /* Backends that take indirect requests let one request carry more than
+     BLKIF_MAX_SEGMENTS_PER_REQUEST pages.  */
+  virtdisks[vdiskcnt].nsegs = BLKIF_MAX_SEGMENTS_PER_REQUEST;
+  grub_snprintf (fdir, sizeof (fdir), "%s/feature-max-indirect-segments",
+		 virtdisks[vdiskcnt].backend_dir);
+  buf = grub_xenstore_get_file (fdir, NULL);
+  if (buf)
+    {
+      unsigned long max = grub_strtoul (buf, 0, 10);
+      grub_free (buf);
+      if (!grub_errno && max > BLKIF_MAX_SEGMENTS_PER_REQUEST)
+	virtdisks[vdiskcnt].nsegs = max < VIRTDISK_INDIRECT_SEGMENTS
+	  ? max : VIRTDISK_INDIRECT_SEGMENTS;
+    }
+  grub_errno = 0;
+
+  /* Take as many slots as the grant table has room for, at least one.  */
+  for (virtdisks[vdiskcnt].nslots = 0;
+       virtdisks[vdiskcnt].nslots < VIRTDISK_MAX_SLOTS;
+       virtdisks[vdiskcnt].nslots++)
+    if (!alloc_slot (&virtdisks[vdiskcnt].slots[virtdisks[vdiskcnt].nslots],
+		     dom, virtdisks[vdiskcnt].nsegs))
+      break;
+  if (!virtdisks[vdiskcnt].nslots)
     goto out_fail_2;
+  grub_errno = 0;
+  grub_dprintf ("xen", "%u slots of %u pages\n", virtdisks[vdiskcnt].nslots,
+		virtdisks[vdiskcnt].nsegs);
 
   alloc_unbound.dom = DOMID_SELF;
   alloc_unbound.remote_dom = dom;
@@ -354,6 +508,12 @@ fill (const char *dir, void *data)
   if (err)
     goto out_fail_3;
 
+  grub_snprintf (fdir, sizeof (fdir), "device/vbd/%s/feature-persistent",
+		 dir);
+  err = grub_xenstore_write_file (fdir, "1", 1);
+  if (err)
+    goto out_fail_3;
+
   grub_snprintf (fdir, sizeof (fdir), "device/vbd/%s/protocol", dir);
   err = grub_xenstore_write_file (fdir, XEN_IO_PROTO_ABI_NATIVE,
 				  grub_strlen (XEN_IO_PROTO_ABI_NATIVE));
@@ -405,7 +565,7 @@ fill (const char *dir, void *data)
   return 0;
 
 out_fail_3:
-  grub_xen_free_shared_page (virtdisks[vdiskcnt].dma_page);
+  free_slots (&virtdisks[vdiskcnt]);
 out_fail_2:
   grub_xen_free_shared_page (virtdisks[vdiskcnt].shared_page);
 out_fail_1:
@@ -472,7 +632,7 @@ grub_xendisk_fini (void)
 		     virtdisks[i].frontend_dir);
       grub_xenstore_write_file (fdir, NULL, 0);
 
-      grub_xen_free_shared_page (virtdisks[i].dma_page);
+      free_slots (&virtdisks[i]);
       grub_xen_free_shared_page (virtdisks[i].shared_page);
 
       grub_xen_event_channel_op (EVTCHNOP_close, &close_op);
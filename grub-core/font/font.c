@@ -30,6 +30,8 @@
 #include <grub/unicode.h>
 #include <grub/fontformat.h>
 #include <grub/env.h>
+#include <grub/i18n.h>
+#include <grub/reclaim.h>
 
 GRUB_MOD_LICENSE ("GPLv3+");
 
@@ -41,14 +43,31 @@ GRUB_MOD_LICENSE ("GPLv3+");
 #define FONT_DEBUG 0
 #endif
 
-struct char_index_entry
+/* A run of consecutive code points in the character index.  Glyph N of
+   the run has index FIRST + N in the font's offset and glyph tables.  */
+struct char_index_run
 {
   grub_uint32_t code;
-  grub_uint8_t storage_flags;
-  grub_uint32_t offset;
+  grub_uint32_t count;
+  grub_uint32_t first;
+};
 
-  /* Glyph if loaded, or NULL otherwise.  */
-  struct grub_font_glyph *glyph;
+/* Loaded glyphs are kept in slot tables of this many pointers, which are
+   only allocated once a glyph in their range is used.  */
+#define FONT_GLYPH_SLOT_SHIFT 8
+#define FONT_GLYPH_SLOTS (1 << FONT_GLYPH_SLOT_SHIFT)
+
+/* Glyph data is read from the font file a page at a time into a small
+   LRU, since neighbouring code points are stored next to each other.  */
+#define FONT_PAGE_SIZE 4096
+#define FONT_PAGE_COUNT 4
+
+struct font_page
+{
+  grub_off_t offset;
+  grub_size_t len;
+  grub_uint32_t last_use;
+  grub_uint8_t data[FONT_PAGE_SIZE];
 };
 
 #define FONT_WEIGHT_NORMAL 100
@@ -58,6 +77,16 @@ struct char_index_entry
 /* Definition of font registry.  */
 struct grub_font_node *grub_font_list;
 
+static grub_size_t font_pages_shrink (grub_size_t wanted);
+
+/* The page caches of all fonts.  They are small, so they are given back
+   all at once.  */
+static struct grub_reclaim_cache font_pages_reclaim =
+  {
+    .name = "font pages",
+    .shrink = font_pages_shrink
+  };
+
 static int register_font (grub_font_t font);
 static void font_init (grub_font_t font);
 static void free_font (grub_font_t font);
@@ -183,9 +212,18 @@ grub_font_loader_init (void)
   null_font.max_char_width = unknown_glyph->width;
   null_font.max_char_height = unknown_glyph->height;
 
+  grub_reclaim_register (&font_pages_reclaim);
+
   font_loader_initialized = 1;
 }
 
+void
+grub_font_loader_fini (void)
+{
+  if (font_loader_initialized)
+    grub_reclaim_unregister (&font_pages_reclaim);
+}
+
 /* Initialize the font object with initial default values.  */
 static void
 font_init (grub_font_t font)
@@ -204,8 +242,11 @@ font_init (grub_font_t font)
   font->ascent = 0;
   font->descent = 0;
   font->num_chars = 0;
-  font->char_index = 0;
-  font->bmp_idx = 0;
+  font->num_runs = 0;
+  font->char_runs = 0;
+  font->glyph_offsets = 0;
+  font->glyph_slots = 0;
+  font->pages = 0;
 }
 
 /* Open the next section in the file.
@@ -263,17 +304,24 @@ open_section (grub_file_t file, struct font_file_section *section)
    entry in the font file.  */
 #define FONT_CHAR_INDEX_ENTRY_SIZE (4 + 1 + 4)
 
+/* Number of character index entries read from the file at once.  */
+#define FONT_CHAR_INDEX_CHUNK 455
+
 /* Load the character index (CHIX) section contents from the font file.  This
    presumes that the position of FILE is positioned immediately after the
    section length for the CHIX section (i.e., at the start of the section
-   contents).  Returns 0 upon success, nonzero for failure (in which case
-   grub_errno is set appropriately).  */
+   contents).  Consecutive code points are folded into runs, so only the
+   glyph offsets are kept per character.  Returns 0 upon success, nonzero
+   for failure (in which case grub_errno is set appropriately).  */
 static int
 load_font_index (grub_file_t file, grub_uint32_t sect_length, struct
 		 grub_font *font)
 {
-  unsigned i;
+  grub_uint8_t *chunk;
+  grub_uint32_t i;
   grub_uint32_t last_code;
+  grub_uint32_t max_runs;
+  grub_uint32_t num_slots;
 
 #if FONT_DEBUG >= 2
   grub_dprintf ("font", "load_font_index(sect_length=%d)\n", sect_length);
@@ -291,17 +339,27 @@ load_font_index (grub_file_t file, grub_uint32_t sect_length, struct
 
   /* Calculate the number of characters.  */
   font->num_chars = sect_length / FONT_CHAR_INDEX_ENTRY_SIZE;
+  if (font->num_chars == 0)
+    return 0;
 
-  /* Allocate the character index array.  */
-  font->char_index = grub_malloc (font->num_chars
-				  * sizeof (struct char_index_entry));
-  if (!font->char_index)
+  font->glyph_offsets = grub_malloc (font->num_chars
+				     * sizeof (font->glyph_offsets[0]));
+  if (!font->glyph_offsets)
     return 1;
-  font->bmp_idx = grub_malloc (0x10000 * sizeof (grub_uint16_t));
-  if (!font->bmp_idx)
+
+  num_slots = (font->num_chars + FONT_GLYPH_SLOTS - 1) >> FONT_GLYPH_SLOT_SHIFT;
+  font->glyph_slots = grub_zalloc (num_slots * sizeof (font->glyph_slots[0]));
+  if (!font->glyph_slots)
     return 1;
-  grub_memset (font->bmp_idx, 0xff, 0x10000 * sizeof (grub_uint16_t));
 
+  max_runs = 16;
+  font->char_runs = grub_malloc (max_runs * sizeof (font->char_runs[0]));
+  if (!font->char_runs)
+    return 1;
+
+  chunk = grub_malloc (FONT_CHAR_INDEX_CHUNK * FONT_CHAR_INDEX_ENTRY_SIZE);
+  if (!chunk)
+    return 1;
 
 #if FONT_DEBUG >= 2
   grub_dprintf ("font", "num_chars=%d)\n", font->num_chars);
@@ -312,47 +370,195 @@ load_font_index (grub_file_t file, grub_uint32_t sect_length, struct
   /* Load the character index data from the file.  */
   for (i = 0; i < font->num_chars; i++)
     {
-      struct char_index_entry *entry = &font->char_index[i];
+      const grub_uint8_t *entry;
+      grub_uint32_t n = i % FONT_CHAR_INDEX_CHUNK;
+      grub_uint32_t code;
+
+      if (n == 0)
+	{
+	  grub_ssize_t len;
+
+	  len = font->num_chars - i;
+	  if (len > FONT_CHAR_INDEX_CHUNK)
+	    len = FONT_CHAR_INDEX_CHUNK;
+	  len *= FONT_CHAR_INDEX_ENTRY_SIZE;
+	  if (grub_file_read (file, chunk, len) != len)
+	    goto fail;
+	}
+      entry = chunk + n * FONT_CHAR_INDEX_ENTRY_SIZE;
 
       /* Read code point value; convert to native byte order.  */
-      if (grub_file_read (file, &entry->code, 4) != 4)
-	return 1;
-      entry->code = grub_be_to_cpu32 (entry->code);
+      code = grub_be_to_cpu32 (grub_get_unaligned32 (entry));
 
       /* Verify that characters are in ascending order.  */
-      if (i != 0 && entry->code <= last_code)
+      if (i != 0 && code <= last_code)
 	{
 	  grub_error (GRUB_ERR_BAD_FONT,
 		      "font characters not in ascending order: %u <= %u",
-		      entry->code, last_code);
-	  return 1;
+		      code, last_code);
+	  goto fail;
 	}
 
-      if (entry->code < 0x10000)
-	font->bmp_idx[entry->code] = i;
-
-      last_code = entry->code;
+      if (i != 0 && code == last_code + 1)
+	font->char_runs[font->num_runs - 1].count++;
+      else
+	{
+	  struct char_index_run *run;
 
-      /* Read storage flags byte.  */
-      if (grub_file_read (file, &entry->storage_flags, 1) != 1)
-	return 1;
+	  if (font->num_runs == max_runs)
+	    {
+	      struct char_index_run *runs;
+
+	      max_runs *= 2;
+	      runs = grub_realloc (font->char_runs,
+				   max_runs * sizeof (font->char_runs[0]));
+	      if (!runs)
+		goto fail;
+	      font->char_runs = runs;
+	    }
+	  run = &font->char_runs[font->num_runs++];
+	  run->code = code;
+	  run->count = 1;
+	  run->first = i;
+	}
 
-      /* Read glyph data offset; convert to native byte order.  */
-      if (grub_file_read (file, &entry->offset, 4) != 4)
-	return 1;
-      entry->offset = grub_be_to_cpu32 (entry->offset);
+      last_code = code;
 
-      /* No glyph loaded.  Will be loaded on demand and cached thereafter.  */
-      entry->glyph = 0;
+      /* Skip the storage flags byte and read the glyph data offset.  The
+	 glyph itself is loaded on demand and cached thereafter.  */
+      font->glyph_offsets[i] = grub_be_to_cpu32 (grub_get_unaligned32
+						 (entry + 5));
 
 #if FONT_DEBUG >= 5
       /* Print the 1st 10 characters.  */
       if (i < 10)
-	grub_dprintf ("font", "c=%d o=%d\n", entry->code, entry->offset);
+	grub_dprintf ("font", "c=%d o=%d\n", code, font->glyph_offsets[i]);
 #endif
     }
 
+  grub_free (chunk);
+
+  /* Give back the slack from growing the run table.  */
+  if (font->num_runs < max_runs)
+    {
+      struct char_index_run *runs;
+
+      runs = grub_realloc (font->char_runs,
+			   font->num_runs * sizeof (font->char_runs[0]));
+      if (runs)
+	font->char_runs = runs;
+    }
+
+#if FONT_DEBUG >= 2
+  grub_dprintf ("font", "num_runs=%d\n", font->num_runs);
+#endif
+
+  return 0;
+
+ fail:
+  grub_free (chunk);
+  return 1;
+}
+
+/* Load the range-encoded character index (CHRG section), which grub-mkfont
+   writes ahead of the CHIX section when asked to.  It holds the number of
+   runs, then the first code point and length of each run, then the offset
+   of the first glyph and finally the length of every glyph, all stored in
+   the order of the DATA section.  The runs are taken over as they are and
+   the glyph offsets are summed up from the lengths.  Returns 0 upon
+   success, nonzero for failure (in which case grub_errno is set
+   appropriately).  */
+static int
+load_font_ranges (grub_file_t file, grub_uint32_t sect_length, struct
+		  grub_font *font)
+{
+  grub_uint8_t *sect;
+  const grub_uint8_t *ptr;
+  grub_uint32_t num_runs;
+  grub_uint32_t num_chars;
+  grub_uint32_t num_slots;
+  grub_uint32_t offset;
+  grub_uint32_t i;
+
+  if (sect_length < 8)
+    goto bad;
+
+  sect = grub_malloc (sect_length);
+  if (!sect)
+    return 1;
+  if (grub_file_read (file, sect, sect_length) != (grub_ssize_t) sect_length)
+    goto fail;
+
+  num_runs = grub_be_to_cpu32 (grub_get_unaligned32 (sect));
+  if (num_runs == 0 || num_runs > (sect_length - 8) / 8)
+    goto bad_free;
+
+  font->char_runs = grub_malloc (num_runs * sizeof (font->char_runs[0]));
+  if (!font->char_runs)
+    goto fail;
+
+  num_chars = 0;
+  ptr = sect + 4;
+  for (i = 0; i < num_runs; i++, ptr += 8)
+    {
+      struct char_index_run *run = &font->char_runs[i];
+
+      run->code = grub_be_to_cpu32 (grub_get_unaligned32 (ptr));
+      run->count = grub_be_to_cpu32 (grub_get_unaligned32 (ptr + 4));
+      run->first = num_chars;
+
+      /* Runs must be non-empty, ascending and must not overlap.  */
+      if (run->count == 0
+	  || run->count > (sect_length - 8 - num_runs * 8) / 2 - num_chars
+	  || (i != 0 && (run->code <= run[-1].code
+			 || run->code - run[-1].code < run[-1].count)))
+	goto bad_free;
+      num_chars += run->count;
+    }
+  font->num_runs = num_runs;
+
+  if (sect_length != 8 + num_runs * 8 + num_chars * 2)
+    goto bad_free;
+
+  font->num_chars = num_chars;
+  font->glyph_offsets = grub_malloc (num_chars
+				     * sizeof (font->glyph_offsets[0]));
+  if (!font->glyph_offsets)
+    goto fail;
+
+  num_slots = (num_chars + FONT_GLYPH_SLOTS - 1) >> FONT_GLYPH_SLOT_SHIFT;
+  font->glyph_slots = grub_zalloc (num_slots * sizeof (font->glyph_slots[0]));
+  if (!font->glyph_slots)
+    goto fail;
+
+  offset = grub_be_to_cpu32 (grub_get_unaligned32 (ptr));
+  ptr += 4;
+  for (i = 0; i < num_chars; i++, ptr += 2)
+    {
+      font->glyph_offsets[i] = offset;
+      offset += grub_be_to_cpu16 (grub_get_unaligned16 (ptr));
+      if (offset < font->glyph_offsets[i])
+	goto bad_free;
+    }
+
+#if FONT_DEBUG >= 2
+  grub_dprintf ("font", "num_chars=%d num_runs=%d\n", font->num_chars,
+		font->num_runs);
+#endif
+
+  grub_free (sect);
   return 0;
+
+ bad_free:
+  grub_free (sect);
+ bad:
+  grub_error (GRUB_ERR_BAD_FONT,
+	      "font file format error: invalid character range index");
+  return 1;
+
+ fail:
+  grub_free (sect);
+  return 1;
 }
 
 /* Read the contents of the specified section as a string, which is
@@ -591,7 +797,28 @@ grub_font_load (const char *filename)
 			    sizeof (FONT_FORMAT_SECTION_NAMES_CHAR_INDEX) -
 			    1) == 0)
 	{
-	  if (load_font_index (file, section.length, font) != 0)
+	  /* The range index, if there was one, already covers this.  */
+	  if (font->char_runs)
+	    {
+	      grub_off_t section_end = grub_file_tell (file) + section.length;
+	      if ((int) grub_file_seek (file, section_end) == -1)
+		goto fail;
+	    }
+	  else if (load_font_index (file, section.length, font) != 0)
+	    goto fail;
+	}
+      else if (grub_memcmp (section.name,
+			    FONT_FORMAT_SECTION_NAMES_CHAR_RANGES,
+			    sizeof (FONT_FORMAT_SECTION_NAMES_CHAR_RANGES) -
+			    1) == 0)
+	{
+	  if (font->char_runs)
+	    {
+	      grub_error (GRUB_ERR_BAD_FONT,
+			  "font file format error: duplicate character index");
+	      goto fail;
+	    }
+	  if (load_font_ranges (file, section.length, font) != 0)
 	    goto fail;
 	}
       else if (grub_memcmp (section.name, FONT_FORMAT_SECTION_NAMES_DATA,
@@ -629,7 +856,7 @@ grub_font_load (const char *filename)
   if (font->max_char_width == 0
       || font->max_char_height == 0
       || font->num_chars == 0
-      || font->char_index == 0 || font->ascent == 0 || font->descent == 0)
+      || font->char_runs == 0 || font->ascent == 0 || font->descent == 0)
     {
       grub_error (GRUB_ERR_BAD_FONT,
 		  "invalid font file: missing some required data");
@@ -652,88 +879,165 @@ fail:
   return 0;
 }
 
-/* Read a 16-bit big-endian integer from FILE, convert it to native byte
-   order, and store it in *VALUE.
-   Returns 0 on success, 1 on failure.  */
-static int
-read_be_uint16 (grub_file_t file, grub_uint16_t * value)
-{
-  if (grub_file_read (file, value, 2) != 2)
-    return 1;
-  *value = grub_be_to_cpu16 (*value);
-  return 0;
-}
-
-static int
-read_be_int16 (grub_file_t file, grub_int16_t * value)
-{
-  /* For the signed integer version, use the same code as for unsigned.  */
-  return read_be_uint16 (file, (grub_uint16_t *) value);
-}
-
-/* Return a pointer to the character index entry for the glyph corresponding to
-   the codepoint CODE in the font FONT.  If not found, return zero.  */
-static inline struct char_index_entry *
-find_glyph (const grub_font_t font, grub_uint32_t code)
+/* Look up the codepoint CODE in the character index of FONT and store the
+   index of its glyph in *INDEX.  Returns 1 if found, 0 otherwise.  */
+static inline int
+find_glyph (const grub_font_t font, grub_uint32_t code, grub_uint32_t *index)
 {
-  struct char_index_entry *table;
+  const struct char_index_run *runs = font->char_runs;
   grub_size_t lo;
   grub_size_t hi;
   grub_size_t mid;
 
-  table = font->char_index;
+  if (!runs)
+    return 0;
 
-  /* Use BMP index if possible.  */
-  if (code < 0x10000 && font->bmp_idx)
+  /* Find the last run starting at or below CODE.  */
+  lo = 0;
+  hi = font->num_runs;
+  while (hi - lo > 1)
     {
-      if (font->bmp_idx[code] == 0xffff)
-	return 0;
-      return &table[font->bmp_idx[code]];
+      mid = lo + (hi - lo) / 2;
+      if (code < runs[mid].code)
+	hi = mid;
+      else
+	lo = mid;
     }
 
-  /* Do a binary search in `char_index', which is ordered by code point.  */
-  lo = 0;
-  hi = font->num_chars - 1;
-
-  if (!table)
+  if (code < runs[lo].code || code - runs[lo].code >= runs[lo].count)
     return 0;
 
-  while (lo <= hi)
+  *index = runs[lo].first + (code - runs[lo].code);
+  return 1;
+}
+
+/* Copy LEN bytes at OFFSET in the font file of FONT into BUF, going
+   through the page cache.  Returns 0 on success, 1 on failure.  */
+static int
+read_font_data (grub_font_t font, grub_off_t offset, void *buf,
+		grub_size_t len)
+{
+  static grub_uint32_t page_clock;
+  grub_uint8_t *ptr = buf;
+  int ret = 1;
+
+  /* Reading the file may allocate, which mustn't free the page being
+     filled.  */
+  font_pages_reclaim.busy++;
+  grub_reclaim_touch (&font_pages_reclaim);
+
+  if (!font->pages)
     {
-      mid = lo + (hi - lo) / 2;
-      if (code < table[mid].code)
-	hi = mid - 1;
-      else if (code > table[mid].code)
-	lo = mid + 1;
-      else
-	return &table[mid];
+      font->pages = grub_zalloc (FONT_PAGE_COUNT * sizeof (font->pages[0]));
+      if (!font->pages)
+	goto out;
+      font_pages_reclaim.size += FONT_PAGE_COUNT * sizeof (font->pages[0]);
     }
 
-  return 0;
+  while (len > 0)
+    {
+      grub_off_t page_offset = offset & ~(grub_off_t) (FONT_PAGE_SIZE - 1);
+      struct font_page *page = 0;
+      grub_size_t pos;
+      grub_size_t n;
+      unsigned i;
+
+      for (i = 0; i < FONT_PAGE_COUNT; i++)
+	{
+	  struct font_page *p = &font->pages[i];
+
+	  if (p->len != 0 && p->offset == page_offset)
+	    {
+	      page = p;
+	      break;
+	    }
+	  /* Otherwise remember the least recently used page, preferring
+	     empty ones.  */
+	  if (!page || p->len == 0
+	      || (page->len != 0 && p->last_use < page->last_use))
+	    page = p;
+	}
+
+      if (page->len == 0 || page->offset != page_offset)
+	{
+	  grub_ssize_t r;
+
+	  page->len = 0;
+	  grub_file_seek (font->file, page_offset);
+	  r = grub_file_read (font->file, page->data, FONT_PAGE_SIZE);
+	  if (r < 0)
+	    goto out;
+	  page->offset = page_offset;
+	  page->len = r;
+	}
+      page->last_use = ++page_clock;
+
+      pos = offset - page_offset;
+      if (pos >= page->len)
+	{
+	  grub_error (GRUB_ERR_BAD_FONT, N_("premature end of file %s"),
+		      font->file->name);
+	  goto out;
+	}
+
+      n = page->len - pos;
+      if (n > len)
+	n = len;
+      grub_memcpy (ptr, page->data + pos, n);
+      ptr += n;
+      offset += n;
+      len -= n;
+    }
+  ret = 0;
+
+ out:
+  font_pages_reclaim.busy--;
+  return ret;
 }
 
+static grub_size_t
+font_pages_shrink (grub_size_t wanted __attribute__ ((unused)))
+{
+  struct grub_font_node *node;
+  grub_size_t freed = 0;
+
+  for (node = grub_font_list; node; node = node->next)
+    if (node->value->pages)
+      {
+	grub_free (node->value->pages);
+	node->value->pages = 0;
+	freed += FONT_PAGE_COUNT * sizeof (struct font_page);
+      }
+
+  font_pages_reclaim.size -= freed;
+  return freed;
+}
+
+/* Size of the glyph header in the DATA section: width, height, x and y
+   offsets and device width, each a big-endian 16-bit value.  */
+#define FONT_GLYPH_HEADER_SIZE 10
+
 /* Get a glyph for the Unicode character CODE in FONT.  The glyph is loaded
    from the font file if has not been loaded yet.
    Returns a pointer to the glyph if found, or 0 if it is not found.  */
 static struct grub_font_glyph *
 grub_font_get_glyph_internal (grub_font_t font, grub_uint32_t code)
 {
-  struct char_index_entry *index_entry;
+  grub_uint32_t index;
 
-  index_entry = find_glyph (font, code);
-  if (index_entry)
+  if (find_glyph (font, code, &index))
     {
       struct grub_font_glyph *glyph = 0;
+      struct grub_font_glyph **slots;
+      grub_uint8_t header[FONT_GLYPH_HEADER_SIZE];
       grub_uint16_t width;
       grub_uint16_t height;
-      grub_int16_t xoff;
-      grub_int16_t yoff;
-      grub_int16_t dwidth;
       int len;
 
-      if (index_entry->glyph)
+      slots = font->glyph_slots[index >> FONT_GLYPH_SLOT_SHIFT];
+      if (slots && slots[index & (FONT_GLYPH_SLOTS - 1)])
 	/* Return cached glyph.  */
-	return index_entry->glyph;
+	return slots[index & (FONT_GLYPH_SLOTS - 1)];
 
       if (!font->file)
 	/* No open file, can't load any glyphs.  */
@@ -743,19 +1047,27 @@ grub_font_get_glyph_internal (grub_font_t font, grub_uint32_t code)
          error message to error stack and reset error message.  */
       grub_error_push ();
 
-      grub_file_seek (font->file, index_entry->offset);
+      if (!slots)
+	{
+	  slots = grub_zalloc (FONT_GLYPH_SLOTS * sizeof (slots[0]));
+	  if (!slots)
+	    {
+	      grub_error_pop ();
+	      return 0;
+	    }
+	  font->glyph_slots[index >> FONT_GLYPH_SLOT_SHIFT] = slots;
+	}
 
       /* Read the glyph width, height, and baseline.  */
-      if (read_be_uint16 (font->file, &width) != 0
-	  || read_be_uint16 (font->file, &height) != 0
-	  || read_be_int16 (font->file, &xoff) != 0
-	  || read_be_int16 (font->file, &yoff) != 0
-	  || read_be_int16 (font->file, &dwidth) != 0)
+      if (read_font_data (font, font->glyph_offsets[index], header,
+			  sizeof (header)) != 0)
 	{
 	  remove_font (font);
 	  return 0;
 	}
 
+      width = grub_be_to_cpu16 (grub_get_unaligned16 (header));
+      height = grub_be_to_cpu16 (grub_get_unaligned16 (header + 2));
       len = (width * height + 7) / 8;
       glyph = grub_malloc (sizeof (struct grub_font_glyph) + len);
       if (!glyph)
@@ -767,14 +1079,19 @@ grub_font_get_glyph_internal (grub_font_t font, grub_uint32_t code)
       glyph->font = font;
       glyph->width = width;
       glyph->height = height;
-      glyph->offset_x = xoff;
-      glyph->offset_y = yoff;
-      glyph->device_width = dwidth;
+      glyph->offset_x = (grub_int16_t) grub_be_to_cpu16 (grub_get_unaligned16
+							 (header + 4));
+      glyph->offset_y = (grub_int16_t) grub_be_to_cpu16 (grub_get_unaligned16
+							 (header + 6));
+      glyph->device_width = (grub_int16_t) grub_be_to_cpu16
+	(grub_get_unaligned16 (header + 8));
 
       /* Don't try to read empty bitmaps (e.g., space characters).  */
       if (len != 0)
 	{
-	  if (grub_file_read (font->file, glyph->bitmap, len) != len)
+	  if (read_font_data (font, font->glyph_offsets[index]
+			      + FONT_GLYPH_HEADER_SIZE, glyph->bitmap,
+			      len) != 0)
 	    {
 	      remove_font (font);
 	      grub_free (glyph);
@@ -786,7 +1103,7 @@ grub_font_get_glyph_internal (grub_font_t font, grub_uint32_t code)
       grub_error_pop ();
 
       /* Cache the glyph.  */
-      index_entry->glyph = glyph;
+      slots[index & (FONT_GLYPH_SLOTS - 1)] = glyph;
 
       return glyph;
     }
@@ -807,8 +1124,21 @@ free_font (grub_font_t font)
 	grub_file_close (font->file);
       grub_free (font->name);
       grub_free (font->family);
-      grub_free (font->char_index);
-      grub_free (font->bmp_idx);
+      grub_free (font->char_runs);
+      grub_free (font->glyph_offsets);
+      if (font->glyph_slots)
+	{
+	  grub_uint32_t i;
+
+	  for (i = 0; i < font->num_chars; i += FONT_GLYPH_SLOTS)
+	    grub_free (font->glyph_slots[i >> FONT_GLYPH_SLOT_SHIFT]);
+	  grub_free (font->glyph_slots);
+	}
+      if (font->pages)
+	{
+	  grub_free (font->pages);
+	  font_pages_reclaim.size -= FONT_PAGE_COUNT * sizeof (font->pages[0]);
+	}
       grub_free (font);
     }
 }
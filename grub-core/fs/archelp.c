@@ -20,6 +20,8 @@
 #include <grub/err.h>
 #include <grub/fs.h>
 #include <grub/disk.h>
+#include <grub/partition.h>
+#include <grub/mm.h>
 #include <grub/dl.h>
 
 GRUB_MOD_LICENSE ("GPLv3+");
@@ -54,9 +56,253 @@ canonicalize (char *name)
   *optr = 0;
 }
 
+/* Archives are mounted again for every operation, so the index of an
+   archive is kept across mounts, keyed by the disk it is on, and
+   dropped when the set of disks changes.  */
+#define ARCHELP_INDEX_CACHE_SIZE 4
+
+struct archelp_entry
+{
+  char *name;
+  grub_off_t hofs;
+  grub_int32_t mtime;
+  grub_uint32_t mode;
+};
+
+struct archelp_index
+{
+  struct grub_archelp_ops *arcops;
+  unsigned long dev_id;
+  unsigned long disk_id;
+  grub_disk_addr_t part_start;
+  struct archelp_entry *entries;
+  grub_size_t count;
+  /* Walks in progress and whether the cache still holds it.  */
+  unsigned refs;
+  int cached;
+};
+
+static struct archelp_index *index_cache[ARCHELP_INDEX_CACHE_SIZE];
+static unsigned index_cache_next;
+static unsigned long index_cache_generation;
+
+static void
+free_index (struct archelp_index *index)
+{
+  grub_size_t i;
+
+  for (i = 0; i < index->count; i++)
+    grub_free (index->entries[i].name);
+  grub_free (index->entries);
+  grub_free (index);
+}
+
+static void
+evict_index (unsigned slot)
+{
+  struct archelp_index *index = index_cache[slot];
+
+  index_cache[slot] = NULL;
+  if (!index)
+    return;
+  index->cached = 0;
+  if (!index->refs)
+    free_index (index);
+}
+
+static void
+release_index (struct archelp_index *index)
+{
+  if (index && --index->refs == 0 && !index->cached)
+    free_index (index);
+}
+
+/* Scan the whole archive once and record every entry in it.  */
+static struct archelp_index *
+build_index (struct grub_archelp_data *data,
+	     struct grub_archelp_ops *arcops)
+{
+  struct archelp_index *index;
+  grub_size_t alloc = 0;
+
+  index = grub_zalloc (sizeof (*index));
+  if (!index)
+    return NULL;
+
+  arcops->rewind (data);
+  while (1)
+    {
+      struct archelp_entry *entry;
+      grub_off_t hofs = arcops->tell (data);
+      grub_int32_t mtime = 0;
+      grub_uint32_t mode;
+      char *name;
+
+      if (arcops->find_file (data, &name, &mtime, &mode))
+	goto fail;
+
+      if (mode == GRUB_ARCHELP_ATTR_END)
+	break;
+
+      canonicalize (name);
+
+      if (index->count == alloc)
+	{
+	  struct archelp_entry *entries;
+
+	  alloc = alloc ? 2 * alloc : 64;
+	  entries = grub_realloc (index->entries, alloc * sizeof (*entries));
+	  if (!entries)
+	    {
+	      grub_free (name);
+	      goto fail;
+	    }
+	  index->entries = entries;
+	}
+
+      entry = &index->entries[index->count++];
+      entry->name = name;
+      entry->hofs = hofs;
+      entry->mtime = mtime;
+      entry->mode = mode;
+    }
+
+  arcops->rewind (data);
+  return index;
+
+ fail:
+  free_index (index);
+  arcops->rewind (data);
+  return NULL;
+}
+
+/* Return the index of the archive behind DATA with a reference held,
+   or NULL if it should be scanned instead.  */
+static struct archelp_index *
+get_index (struct grub_archelp_data *data,
+	   struct grub_archelp_ops *arcops)
+{
+  struct archelp_index *index;
+  grub_disk_addr_t part_start;
+  grub_disk_t disk;
+  unsigned i;
+
+  if (!arcops->get_disk || !arcops->tell || !arcops->seek)
+    return NULL;
+
+  if (index_cache_generation != grub_disk_generation)
+    {
+      for (i = 0; i < ARCHELP_INDEX_CACHE_SIZE; i++)
+	evict_index (i);
+      index_cache_generation = grub_disk_generation;
+    }
+
+  disk = arcops->get_disk (data);
+  part_start = grub_partition_get_start (disk->partition);
+
+  for (i = 0; i < ARCHELP_INDEX_CACHE_SIZE; i++)
+    {
+      index = index_cache[i];
+      if (index && index->arcops == arcops
+	  && index->dev_id == disk->dev->id && index->disk_id == disk->id
+	  && index->part_start == part_start)
+	{
+	  index->refs++;
+	  return index;
+	}
+    }
+
+  index = build_index (data, arcops);
+  if (!index)
+    {
+      /* A damaged archive is still scanned up to the damage.  */
+      grub_errno = GRUB_ERR_NONE;
+      return NULL;
+    }
+
+  index->arcops = arcops;
+  index->dev_id = disk->dev->id;
+  index->disk_id = disk->id;
+  index->part_start = part_start;
+  index->refs = 1;
+  index->cached = 1;
+
+  evict_index (index_cache_next);
+  index_cache[index_cache_next] = index;
+  index_cache_next = (index_cache_next + 1) % ARCHELP_INDEX_CACHE_SIZE;
+
+  return index;
+}
+
+/* A walk over the entries of an archive, from its index if there is one
+   and by reading header after header otherwise.  */
+struct archelp_iter
+{
+  struct grub_archelp_data *data;
+  struct grub_archelp_ops *arcops;
+  struct archelp_index *index;
+  grub_size_t pos;
+};
+
+static grub_err_t
+iter_next (struct archelp_iter *iter, char **name,
+	   grub_int32_t *mtime, grub_uint32_t *mode)
+{
+  struct archelp_entry *entry;
+
+  if (!iter->index)
+    {
+      if (iter->arcops->find_file (iter->data, name, mtime, mode))
+	return grub_errno;
+      if (*mode != GRUB_ARCHELP_ATTR_END)
+	canonicalize (*name);
+      return GRUB_ERR_NONE;
+    }
+
+  if (iter->pos == iter->index->count)
+    {
+      *mode = GRUB_ARCHELP_ATTR_END;
+      return GRUB_ERR_NONE;
+    }
+
+  entry = &iter->index->entries[iter->pos++];
+  *name = grub_strdup (entry->name);
+  if (!*name)
+    return grub_errno;
+  *mtime = entry->mtime;
+  *mode = entry->mode;
+  return GRUB_ERR_NONE;
+}
+
+/* Make the driver data describe the entry returned last.  */
 static grub_err_t
-handle_symlink (struct grub_archelp_data *data,
-		struct grub_archelp_ops *arcops,
+iter_load (struct archelp_iter *iter)
+{
+  grub_uint32_t mode;
+  char *name;
+
+  if (!iter->index)
+    return GRUB_ERR_NONE;
+
+  iter->arcops->seek (iter->data, iter->index->entries[iter->pos - 1].hofs);
+  if (iter->arcops->find_file (iter->data, &name, NULL, &mode))
+    return grub_errno;
+  if (mode != GRUB_ARCHELP_ATTR_END)
+    grub_free (name);
+  return GRUB_ERR_NONE;
+}
+
+static void
+iter_rewind (struct archelp_iter *iter)
+{
+  if (iter->index)
+    iter->pos = 0;
+  else
+    iter->arcops->rewind (iter->data);
+}
+
+static grub_err_t
+handle_symlink (struct archelp_iter *iter,
 		const char *fn, char **name,
 		grub_uint32_t mode, int *restart)
 {
@@ -72,7 +318,7 @@ handle_symlink (struct grub_archelp_data *data,
   *restart = 0;
 
   if ((mode & GRUB_ARCHELP_ATTR_TYPE) != GRUB_ARCHELP_ATTR_LNK
-      || !arcops->get_link_target)
+      || !iter->arcops->get_link_target)
     return GRUB_ERR_NONE;
   flen = grub_strlen (fn);
   if (grub_memcmp (*name, fn, flen) != 0 
@@ -92,7 +338,9 @@ handle_symlink (struct grub_archelp_data *data,
   if (prefixlen)
     prefixlen++;
 
-  linktarget = arcops->get_link_target (data);
+  if (iter_load (iter))
+    return grub_errno;
+  linktarget = iter->arcops->get_link_target (iter->data);
   if (!linktarget)
     return grub_errno;
   if (linktarget[0] == '\0')
@@ -142,10 +390,12 @@ grub_archelp_dir (struct grub_archelp_data *data,
   char *prev, *name, *path, *ptr;
   grub_size_t len;
   int symlinknest = 0;
+  struct archelp_iter iter = { .data = data, .arcops = arcops };
 
   path = grub_strdup (path_in + 1);
   if (!path)
     return grub_errno;
+  iter.index = get_index (data, arcops);
   canonicalize (path);
   for (ptr = path + grub_strlen (path) - 1; ptr >= path && *ptr == '/'; ptr--)
     *ptr = 0;
@@ -159,14 +409,12 @@ grub_archelp_dir (struct grub_archelp_data *data,
       grub_uint32_t mode;
       grub_err_t err;
 
-      if (arcops->find_file (data, &name, &mtime, &mode))
+      if (iter_next (&iter, &name, &mtime, &mode))
 	goto fail;
 
       if (mode == GRUB_ARCHELP_ATTR_END)
 	break;
 
-      canonicalize (name);
-
       if (grub_memcmp (path, name, len) == 0
 	  && (name[len] == 0 || name[len] == '/' || len == 0))
 	{
@@ -202,8 +450,7 @@ grub_archelp_dir (struct grub_archelp_data *data,
 	  else
 	    {
 	      int restart = 0;
-	      err = handle_symlink (data, arcops, name,
-				    &path, mode, &restart);
+	      err = handle_symlink (&iter, name, &path, mode, &restart);
 	      grub_free (name);
 	      if (err)
 		goto fail;
@@ -216,7 +463,7 @@ grub_archelp_dir (struct grub_archelp_data *data,
 				  N_("too deep nesting of symlinks"));
 		      goto fail;
 		    }
-		  arcops->rewind (data);
+		  iter_rewind (&iter);
 		}
 	    }
 	}
@@ -226,6 +473,7 @@ grub_archelp_dir (struct grub_archelp_data *data,
 
 fail:
 
+  release_index (iter.index);
   grub_free (path);
   grub_free (prev);
 
@@ -240,11 +488,13 @@ grub_archelp_open (struct grub_archelp_data *data,
   char *fn;
   char *name = grub_strdup (name_in + 1);
   int symlinknest = 0;
+  struct archelp_iter iter = { .data = data, .arcops = arcops };
 
   if (!name)
     return grub_errno;
 
   canonicalize (name);
+  iter.index = get_index (data, arcops);
 
   while (1)
     {
@@ -252,7 +502,7 @@ grub_archelp_open (struct grub_archelp_data *data,
       grub_int32_t mtime;
       int restart;
       
-      if (arcops->find_file (data, &fn, &mtime, &mode))
+      if (iter_next (&iter, &fn, &mtime, &mode))
 	goto fail;
 
       if (mode == GRUB_ARCHELP_ATTR_END)
@@ -261,9 +511,7 @@ grub_archelp_open (struct grub_archelp_data *data,
 	  break;
 	}
 
-      canonicalize (fn);
-
-      if (handle_symlink (data, arcops, fn, &name, mode, &restart))
+      if (handle_symlink (&iter, fn, &name, mode, &restart))
 	{
 	  grub_free (fn);
 	  goto fail;
@@ -271,7 +519,7 @@ grub_archelp_open (struct grub_archelp_data *data,
 
       if (restart)
 	{
-	  arcops->rewind (data);
+	  iter_rewind (&iter);
 	  if (++symlinknest == 8)
 	    {
 	      grub_error (GRUB_ERR_SYMLINK_LOOP,
@@ -287,7 +535,9 @@ grub_archelp_open (struct grub_archelp_data *data,
       grub_free (fn);
       grub_free (name);
 
-      return GRUB_ERR_NONE;
+      iter_load (&iter);
+      release_index (iter.index);
+      return grub_errno;
 
     no_match:
 
@@ -295,7 +545,16 @@ grub_archelp_open (struct grub_archelp_data *data,
     }
 
 fail:
+  release_index (iter.index);
   grub_free (name);
 
   return grub_errno;
 }
+
+GRUB_MOD_FINI (archelp)
+{
+  unsigned i;
+
+  for (i = 0; i < ARCHELP_INDEX_CACHE_SIZE; i++)
+    evict_index (i);
+}
@@ -26,6 +26,7 @@
 #include <grub/types.h>
 #include <grub/lib/crc.h>
 #include <grub/deflate.h>
+#include <grub/zstd.h>
 #include <minilzo.h>
 #include <grub/i18n.h>
 #include <grub/btrfs.h>
@@ -66,7 +67,10 @@ struct grub_btrfs_superblock
   grub_uint64_t chunk_tree;
   grub_uint8_t dummy2[0x20];
   grub_uint64_t root_dir_objectid;
-  grub_uint8_t dummy3[0x41];
+  grub_uint64_t num_devices;
+  grub_uint32_t sectorsize;
+  grub_uint32_t nodesize;
+  grub_uint8_t dummy3[0x31];
   struct grub_btrfs_device this_device;
   char label[0x100];
   grub_uint8_t dummy4[0x100];
@@ -88,6 +92,14 @@ struct grub_btrfs_device_desc
   grub_uint64_t id;
 };
 
+/* A chunk of the logical address space, with its stripes.  */
+struct grub_btrfs_chunk_map
+{
+  grub_uint64_t start;
+  grub_uint64_t size;
+  struct grub_btrfs_chunk_item *chunk;
+};
+
 struct grub_btrfs_data
 {
   struct grub_btrfs_superblock sblock;
@@ -98,6 +110,12 @@ struct grub_btrfs_data
   unsigned n_devices_attached;
   unsigned n_devices_allocated;
 
+  /* Chunks found so far, sorted by start.  */
+  struct grub_btrfs_chunk_map *chunks;
+  unsigned n_chunks;
+  unsigned n_chunks_allocated;
+  int chunks_loaded;
+
   /* Cached extent data.  */
   grub_uint64_t extstart;
   grub_uint64_t extend;
@@ -212,6 +230,7 @@ struct grub_btrfs_extent_data
 #define GRUB_BTRFS_COMPRESSION_NONE 0
 #define GRUB_BTRFS_COMPRESSION_ZLIB 1
 #define GRUB_BTRFS_COMPRESSION_LZO  2
+#define GRUB_BTRFS_COMPRESSION_ZSTD 3
 
 #define GRUB_BTRFS_OBJECT_ID_CHUNK 0x100
 
@@ -278,6 +297,103 @@ key_cmp (const struct grub_btrfs_key *a, const struct grub_btrfs_key *b)
   return 0;
 }
 
+/* Tree nodes, kept across mounts.  Btrfs never rewrites a node in place,
+   so the node at a given address is the same for as long as the
+   superblock generation is.  */
+#define GRUB_BTRFS_NODE_CACHE_SIZE 64
+
+struct grub_btrfs_node_cache
+{
+  grub_btrfs_uuid_t fsid;
+  grub_uint64_t generation;
+  grub_disk_addr_t addr;
+  grub_uint8_t *node;
+};
+
+static struct grub_btrfs_node_cache node_cache[GRUB_BTRFS_NODE_CACHE_SIZE];
+static unsigned long node_cache_generation;
+
+static void
+node_cache_flush (void)
+{
+  unsigned i;
+
+  for (i = 0; i < GRUB_BTRFS_NODE_CACHE_SIZE; i++)
+    {
+      grub_free (node_cache[i].node);
+      node_cache[i].node = NULL;
+    }
+}
+
+static struct grub_btrfs_node_cache *
+node_cache_slot (struct grub_btrfs_data *data, grub_disk_addr_t addr)
+{
+  return &node_cache[grub_divmod64 (addr,
+				    grub_le_to_cpu32 (data->sblock.nodesize),
+				    NULL) % GRUB_BTRFS_NODE_CACHE_SIZE];
+}
+
+/* Point NODE at the whole tree node at ADDR.  It stays valid until the
+   next call.  */
+static grub_err_t
+get_node (struct grub_btrfs_data *data, grub_disk_addr_t addr,
+	  const grub_uint8_t **node, int recursion_depth)
+{
+  grub_uint32_t nodesize = grub_le_to_cpu32 (data->sblock.nodesize);
+  struct grub_btrfs_node_cache *slot;
+  const struct btrfs_header *head;
+  grub_size_t itemsize;
+  grub_uint8_t *buf;
+  grub_err_t err;
+
+  if (node_cache_generation != grub_disk_generation)
+    {
+      node_cache_flush ();
+      node_cache_generation = grub_disk_generation;
+    }
+
+  slot = node_cache_slot (data, addr);
+  if (slot->node && slot->addr == addr
+      && slot->generation == data->sblock.generation
+      && grub_memcmp (slot->fsid, data->sblock.uuid, sizeof (slot->fsid)) == 0)
+    {
+      *node = slot->node;
+      return GRUB_ERR_NONE;
+    }
+
+  /* Reading may have to look up the chunk tree, which goes through the
+     cache as well, so only fill the slot once the node is in.  */
+  buf = grub_malloc (nodesize);
+  if (!buf)
+    return grub_errno;
+  err = grub_btrfs_read_logical (data, addr, buf, nodesize, recursion_depth);
+  if (err)
+    {
+      grub_free (buf);
+      return err;
+    }
+
+  head = (const struct btrfs_header *) buf;
+  itemsize = head->level ? sizeof (struct grub_btrfs_internal_node)
+    : sizeof (struct grub_btrfs_leaf_node);
+  if (grub_le_to_cpu32 (head->nitems)
+      > (nodesize - sizeof (*head)) / itemsize)
+    {
+      grub_free (buf);
+      return grub_error (GRUB_ERR_BAD_FS, "invalid btrfs node");
+    }
+
+  slot = node_cache_slot (data, addr);
+  grub_free (slot->node);
+  grub_memcpy (slot->fsid, data->sblock.uuid, sizeof (slot->fsid));
+  slot->generation = data->sblock.generation;
+  slot->addr = addr;
+  slot->node = buf;
+
+  *node = buf;
+  return GRUB_ERR_NONE;
+}
+
 static void
 free_iterator (struct grub_btrfs_leaf_descriptor *desc)
 {
@@ -314,6 +430,7 @@ next (struct grub_btrfs_data *data,
 {
   grub_err_t err;
   struct grub_btrfs_leaf_node leaf;
+  const grub_uint8_t *nodebuf;
 
   for (; desc->depth > 0; desc->depth--)
     {
@@ -327,31 +444,29 @@ next (struct grub_btrfs_data *data,
   while (!desc->data[desc->depth - 1].leaf)
     {
       struct grub_btrfs_internal_node node;
-      struct btrfs_header head;
+      const struct btrfs_header *head;
 
-      err = grub_btrfs_read_logical (data, desc->data[desc->depth - 1].iter
-				     * sizeof (node)
-				     + sizeof (struct btrfs_header)
-				     + desc->data[desc->depth - 1].addr,
-				     &node, sizeof (node), 0);
+      err = get_node (data, desc->data[desc->depth - 1].addr, &nodebuf, 0);
       if (err)
 	return -err;
+      grub_memcpy (&node, nodebuf + sizeof (struct btrfs_header)
+		   + desc->data[desc->depth - 1].iter * sizeof (node),
+		   sizeof (node));
 
-      err = grub_btrfs_read_logical (data, grub_le_to_cpu64 (node.addr),
-				     &head, sizeof (head), 0);
+      err = get_node (data, grub_le_to_cpu64 (node.addr), &nodebuf, 0);
       if (err)
 	return -err;
+      head = (const struct btrfs_header *) nodebuf;
 
       save_ref (desc, grub_le_to_cpu64 (node.addr), 0,
-		grub_le_to_cpu32 (head.nitems), !head.level);
+		grub_le_to_cpu32 (head->nitems), !head->level);
     }
-  err = grub_btrfs_read_logical (data, desc->data[desc->depth - 1].iter
-				 * sizeof (leaf)
-				 + sizeof (struct btrfs_header)
-				 + desc->data[desc->depth - 1].addr, &leaf,
-				 sizeof (leaf), 0);
+  err = get_node (data, desc->data[desc->depth - 1].addr, &nodebuf, 0);
   if (err)
     return -err;
+  grub_memcpy (&leaf, nodebuf + sizeof (struct btrfs_header)
+	       + desc->data[desc->depth - 1].iter * sizeof (leaf),
+	       sizeof (leaf));
   *outsize = grub_le_to_cpu32 (leaf.size);
   *outaddr = desc->data[desc->depth - 1].addr + sizeof (struct btrfs_header)
     + grub_le_to_cpu32 (leaf.offset);
@@ -393,29 +508,26 @@ lower_bound (struct grub_btrfs_data *data,
   while (1)
     {
       grub_err_t err;
-      struct btrfs_header head;
+      const grub_uint8_t *nodebuf;
+      const struct btrfs_header *head;
 
     reiter:
       depth++;
-      /* FIXME: preread few nodes into buffer. */
-      err = grub_btrfs_read_logical (data, addr, &head, sizeof (head),
-				     recursion_depth + 1);
+      err = get_node (data, addr, &nodebuf, recursion_depth + 1);
       if (err)
 	return err;
-      addr += sizeof (head);
-      if (head.level)
+      head = (const struct btrfs_header *) nodebuf;
+      addr += sizeof (*head);
+      if (head->level)
 	{
 	  unsigned i;
 	  struct grub_btrfs_internal_node node, node_last;
 	  int have_last = 0;
 	  grub_memset (&node_last, 0, sizeof (node_last));
-	  for (i = 0; i < grub_le_to_cpu32 (head.nitems); i++)
+	  for (i = 0; i < grub_le_to_cpu32 (head->nitems); i++)
 	    {
-	      err = grub_btrfs_read_logical (data, addr + i * sizeof (node),
-					     &node, sizeof (node),
-					     recursion_depth + 1);
-	      if (err)
-		return err;
+	      grub_memcpy (&node, nodebuf + sizeof (*head) + i * sizeof (node),
+			   sizeof (node));
 
 	      grub_dprintf ("btrfs",
 			    "internal node (depth %d) %" PRIxGRUB_UINT64_T
@@ -427,8 +539,8 @@ lower_bound (struct grub_btrfs_data *data,
 		{
 		  err = GRUB_ERR_NONE;
 		  if (desc)
-		    err = save_ref (desc, addr - sizeof (head), i,
-				    grub_le_to_cpu32 (head.nitems), 0);
+		    err = save_ref (desc, addr - sizeof (*head), i,
+				    grub_le_to_cpu32 (head->nitems), 0);
 		  if (err)
 		    return err;
 		  addr = grub_le_to_cpu64 (node.addr);
@@ -443,8 +555,8 @@ lower_bound (struct grub_btrfs_data *data,
 	    {
 	      err = GRUB_ERR_NONE;
 	      if (desc)
-		err = save_ref (desc, addr - sizeof (head), i - 1,
-				grub_le_to_cpu32 (head.nitems), 0);
+		err = save_ref (desc, addr - sizeof (*head), i - 1,
+				grub_le_to_cpu32 (head->nitems), 0);
 	      if (err)
 		return err;
 	      addr = grub_le_to_cpu64 (node_last.addr);
@@ -454,21 +566,18 @@ lower_bound (struct grub_btrfs_data *data,
 	  *outaddr = 0;
 	  grub_memset (key_out, 0, sizeof (*key_out));
 	  if (desc)
-	    return save_ref (desc, addr - sizeof (head), -1,
-			     grub_le_to_cpu32 (head.nitems), 0);
+	    return save_ref (desc, addr - sizeof (*head), -1,
+			     grub_le_to_cpu32 (head->nitems), 0);
 	  return GRUB_ERR_NONE;
 	}
       {
 	unsigned i;
 	struct grub_btrfs_leaf_node leaf, leaf_last;
 	int have_last = 0;
-	for (i = 0; i < grub_le_to_cpu32 (head.nitems); i++)
+	for (i = 0; i < grub_le_to_cpu32 (head->nitems); i++)
 	  {
-	    err = grub_btrfs_read_logical (data, addr + i * sizeof (leaf),
-					   &leaf, sizeof (leaf),
-					   recursion_depth + 1);
-	    if (err)
-	      return err;
+	    grub_memcpy (&leaf, nodebuf + sizeof (*head) + i * sizeof (leaf),
+			 sizeof (leaf));
 
 	    grub_dprintf ("btrfs",
 			  "leaf (depth %d) %" PRIxGRUB_UINT64_T
@@ -481,8 +590,8 @@ lower_bound (struct grub_btrfs_data *data,
 		*outsize = grub_le_to_cpu32 (leaf.size);
 		*outaddr = addr + grub_le_to_cpu32 (leaf.offset);
 		if (desc)
-		  return save_ref (desc, addr - sizeof (head), i,
-				   grub_le_to_cpu32 (head.nitems), 1);
+		  return save_ref (desc, addr - sizeof (*head), i,
+				   grub_le_to_cpu32 (head->nitems), 1);
 		return GRUB_ERR_NONE;
 	      }
 
@@ -499,16 +608,16 @@ lower_bound (struct grub_btrfs_data *data,
 	    *outsize = grub_le_to_cpu32 (leaf_last.size);
 	    *outaddr = addr + grub_le_to_cpu32 (leaf_last.offset);
 	    if (desc)
-	      return save_ref (desc, addr - sizeof (head), i - 1,
-			       grub_le_to_cpu32 (head.nitems), 1);
+	      return save_ref (desc, addr - sizeof (*head), i - 1,
+			       grub_le_to_cpu32 (head->nitems), 1);
 	    return GRUB_ERR_NONE;
 	  }
 	*outsize = 0;
 	*outaddr = 0;
 	grub_memset (key_out, 0, sizeof (*key_out));
 	if (desc)
-	  return save_ref (desc, addr - sizeof (head), -1,
-			   grub_le_to_cpu32 (head.nitems), 1);
+	  return save_ref (desc, addr - sizeof (*head), -1,
+			   grub_le_to_cpu32 (head->nitems), 1);
 	return GRUB_ERR_NONE;
       }
     }
@@ -606,6 +715,313 @@ find_device (struct grub_btrfs_data *data, grub_uint64_t id, int do_rescan)
   return ctx.dev_found;
 }
 
+/* Return the chunk holding ADDR, if it is known yet.  */
+static struct grub_btrfs_chunk_map *
+chunk_map_find (struct grub_btrfs_data *data, grub_uint64_t addr)
+{
+  unsigned low = 0, high = data->n_chunks;
+
+  while (low < high)
+    {
+      unsigned mid = low + (high - low) / 2;
+
+      if (data->chunks[mid].start <= addr)
+	low = mid + 1;
+      else
+	high = mid;
+    }
+  if (low == 0 || addr - data->chunks[low - 1].start
+      >= data->chunks[low - 1].size)
+    return NULL;
+  return &data->chunks[low - 1];
+}
+
+/* Remember CHUNK, of CHSIZE bytes, as mapping the addresses from START.
+   CHUNK is taken over even on failure.  */
+static grub_err_t
+chunk_map_add (struct grub_btrfs_data *data, grub_uint64_t start,
+	       struct grub_btrfs_chunk_item *chunk, grub_size_t chsize)
+{
+  unsigned low = 0, high = data->n_chunks;
+
+  if (chsize < sizeof (*chunk)
+      || (chsize - sizeof (*chunk)) / sizeof (struct grub_btrfs_chunk_stripe)
+	 < grub_le_to_cpu16 (chunk->nstripes))
+    {
+      grub_free (chunk);
+      return grub_error (GRUB_ERR_BAD_FS, "invalid btrfs chunk item");
+    }
+
+  while (low < high)
+    {
+      unsigned mid = low + (high - low) / 2;
+
+      if (data->chunks[mid].start < start)
+	low = mid + 1;
+      else
+	high = mid;
+    }
+  if (low < data->n_chunks && data->chunks[low].start == start)
+    {
+      grub_free (chunk);
+      return GRUB_ERR_NONE;
+    }
+
+  if (data->n_chunks == data->n_chunks_allocated)
+    {
+      struct grub_btrfs_chunk_map *tmp;
+
+      tmp = grub_realloc (data->chunks, (2 * data->n_chunks_allocated + 16)
+			  * sizeof (data->chunks[0]));
+      if (!tmp)
+	{
+	  grub_free (chunk);
+	  return grub_errno;
+	}
+      data->chunks = tmp;
+      data->n_chunks_allocated = 2 * data->n_chunks_allocated + 16;
+    }
+
+  grub_memmove (&data->chunks[low + 1], &data->chunks[low],
+		(data->n_chunks - low) * sizeof (data->chunks[0]));
+  data->chunks[low].start = start;
+  data->chunks[low].size = grub_le_to_cpu64 (chunk->size);
+  data->chunks[low].chunk = chunk;
+  data->n_chunks++;
+  return GRUB_ERR_NONE;
+}
+
+/* Read the whole chunk tree into the chunk map, so that later address
+   translations do not need a tree lookup each.  */
+static grub_err_t
+chunk_map_load (struct grub_btrfs_data *data, int recursion_depth)
+{
+  struct grub_btrfs_key key_in, key_out;
+  struct grub_btrfs_leaf_descriptor desc;
+  grub_disk_addr_t elemaddr;
+  grub_size_t elemsize;
+  grub_err_t err;
+  int r = 1;
+
+  data->chunks_loaded = 1;
+
+  key_in.object_id = grub_cpu_to_le64_compile_time (GRUB_BTRFS_OBJECT_ID_CHUNK);
+  key_in.type = GRUB_BTRFS_ITEM_TYPE_CHUNK;
+  key_in.offset = 0;
+  err = lower_bound (data, &key_in, &key_out, data->sblock.chunk_tree,
+		     &elemaddr, &elemsize, &desc, recursion_depth);
+  if (err)
+    {
+      free_iterator (&desc);
+      return err;
+    }
+  if (key_out.object_id != key_in.object_id || key_out.type != key_in.type)
+    r = next (data, &desc, &elemaddr, &elemsize, &key_out);
+
+  while (r > 0 && key_out.object_id == key_in.object_id
+	 && key_out.type == key_in.type)
+    {
+      struct grub_btrfs_chunk_item *chunk;
+
+      chunk = grub_malloc (elemsize);
+      if (!chunk)
+	{
+	  r = -grub_errno;
+	  break;
+	}
+      err = grub_btrfs_read_logical (data, elemaddr, chunk, elemsize,
+				     recursion_depth);
+      if (err)
+	grub_free (chunk);
+      else
+	err = chunk_map_add (data, grub_le_to_cpu64 (key_out.offset),
+			     chunk, elemsize);
+      if (err)
+	{
+	  r = -err;
+	  break;
+	}
+      r = next (data, &desc, &elemaddr, &elemsize, &key_out);
+    }
+
+  free_iterator (&desc);
+  return r < 0 ? -r : GRUB_ERR_NONE;
+}
+
+/* Where the data at OFF into CHUNK lives.  */
+struct grub_btrfs_stripe_map
+{
+  /* The first of REDUNDANCY stripes holding a copy.  */
+  grub_uint64_t stripen;
+  unsigned redundancy;
+  /* Which of the copies to try first.  */
+  unsigned mirror;
+  grub_uint64_t stripe_offset;
+  /* Bytes from OFF on that stay in the same place.  */
+  grub_uint64_t csize;
+};
+
+/* RAID1 reads alternate between the mirrors in pieces of this size.  */
+#define GRUB_BTRFS_MIRROR_UNIT (1024 * 1024)
+
+static grub_err_t
+map_stripe (struct grub_btrfs_chunk_item *chunk, grub_uint64_t chstart,
+	    grub_uint64_t off, struct grub_btrfs_stripe_map *sm)
+{
+  grub_uint64_t chunk_stripe_length;
+  grub_uint16_t nstripes;
+
+  if (grub_le_to_cpu64 (chunk->size) <= off)
+    {
+      grub_dprintf ("btrfs", "no chunk\n");
+      return grub_error (GRUB_ERR_BAD_FS,
+			 "couldn't find the chunk descriptor");
+    }
+
+  nstripes = grub_le_to_cpu16 (chunk->nstripes) ? : 1;
+  chunk_stripe_length = grub_le_to_cpu64 (chunk->stripe_length) ? : 512;
+  grub_dprintf ("btrfs", "chunk 0x%" PRIxGRUB_UINT64_T
+		"+0x%" PRIxGRUB_UINT64_T
+		" (%d stripes (%d substripes) of %"
+		PRIxGRUB_UINT64_T ")\n",
+		chstart,
+		grub_le_to_cpu64 (chunk->size),
+		nstripes,
+		grub_le_to_cpu16 (chunk->nsubstripes),
+		chunk_stripe_length);
+
+  sm->redundancy = 1;
+  sm->mirror = 0;
+
+  switch (grub_le_to_cpu64 (chunk->type)
+	  & ~GRUB_BTRFS_CHUNK_TYPE_BITS_DONTCARE)
+    {
+    case GRUB_BTRFS_CHUNK_TYPE_SINGLE:
+      {
+	grub_uint64_t stripe_length;
+	grub_dprintf ("btrfs", "single\n");
+	stripe_length = grub_divmod64 (grub_le_to_cpu64 (chunk->size),
+				       nstripes,
+				       NULL);
+	if (stripe_length == 0)
+	  stripe_length = 512;
+	sm->stripen = grub_divmod64 (off, stripe_length, &sm->stripe_offset);
+	sm->csize = (sm->stripen + 1) * stripe_length - off;
+	break;
+      }
+    case GRUB_BTRFS_CHUNK_TYPE_DUPLICATED:
+    case GRUB_BTRFS_CHUNK_TYPE_RAID1:
+      {
+	grub_dprintf ("btrfs", "RAID1\n");
+	sm->stripen = 0;
+	sm->stripe_offset = off;
+	sm->csize = grub_le_to_cpu64 (chunk->size) - off;
+	sm->redundancy = 2;
+	/* Both copies of DUP are on the same device, there is nothing to
+	   balance.  */
+	if ((grub_le_to_cpu64 (chunk->type) & GRUB_BTRFS_CHUNK_TYPE_RAID1)
+	    && nstripes >= 2)
+	  {
+	    grub_uint64_t unit_left = GRUB_BTRFS_MIRROR_UNIT
+	      - (off & (GRUB_BTRFS_MIRROR_UNIT - 1));
+
+	    sm->mirror = (off / GRUB_BTRFS_MIRROR_UNIT) & 1;
+	    if (sm->csize > unit_left)
+	      sm->csize = unit_left;
+	  }
+	break;
+      }
+    case GRUB_BTRFS_CHUNK_TYPE_RAID0:
+      {
+	grub_uint64_t middle, high;
+	grub_uint64_t low;
+	grub_dprintf ("btrfs", "RAID0\n");
+	middle = grub_divmod64 (off,
+				chunk_stripe_length,
+				&low);
+
+	high = grub_divmod64 (middle, nstripes,
+			      &sm->stripen);
+	sm->stripe_offset =
+	  low + chunk_stripe_length * high;
+	sm->csize = chunk_stripe_length - low;
+	break;
+      }
+    case GRUB_BTRFS_CHUNK_TYPE_RAID10:
+      {
+	grub_uint64_t middle, high;
+	grub_uint64_t low, mirror;
+	grub_uint16_t nsubstripes;
+	nsubstripes = grub_le_to_cpu16 (chunk->nsubstripes) ? : 1;
+	middle = grub_divmod64 (off,
+				chunk_stripe_length,
+				&low);
+
+	high = grub_divmod64 (middle,
+			      nstripes / nsubstripes ? : 1,
+			      &sm->stripen);
+	sm->stripen *= nsubstripes;
+	sm->redundancy = nsubstripes;
+	sm->stripe_offset = low + chunk_stripe_length
+	  * high;
+	sm->csize = chunk_stripe_length - low;
+	/* Alternate rows between the copies.  */
+	grub_divmod64 (high, nsubstripes, &mirror);
+	sm->mirror = mirror;
+	break;
+      }
+    default:
+      grub_dprintf ("btrfs", "unsupported RAID\n");
+      return grub_error (GRUB_ERR_NOT_IMPLEMENTED_YET,
+			 "unsupported RAID flags %" PRIxGRUB_UINT64_T,
+			 grub_le_to_cpu64 (chunk->type));
+    }
+  if (sm->csize == 0)
+    return grub_error (GRUB_ERR_BUG,
+		       "couldn't find the chunk descriptor");
+  return GRUB_ERR_NONE;
+}
+
+/* Ask the device holding the start of the SIZE bytes at ADDR to read them
+   ahead, unless it is BUSY with the current piece.  Only chunks already
+   in the map are considered; failures are ignored.  */
+static void
+prefetch_logical (struct grub_btrfs_data *data, grub_disk_addr_t addr,
+		  grub_size_t size, grub_uint64_t busy)
+{
+  struct grub_btrfs_chunk_map *map;
+  struct grub_btrfs_chunk_stripe *stripe;
+  struct grub_btrfs_stripe_map sm;
+  grub_disk_addr_t paddr;
+  grub_device_t dev;
+
+  map = chunk_map_find (data, addr);
+  if (!map || map_stripe (map->chunk, map->start, addr - map->start, &sm))
+    {
+      grub_errno = GRUB_ERR_NONE;
+      return;
+    }
+
+  stripe = (struct grub_btrfs_chunk_stripe *) (map->chunk + 1);
+  stripe += sm.stripen + sm.mirror;
+  if (stripe->device_id == busy)
+    return;
+
+  dev = find_device (data, stripe->device_id, 0);
+  if (!dev)
+    {
+      grub_errno = GRUB_ERR_NONE;
+      return;
+    }
+
+  if (sm.csize > size)
+    sm.csize = size;
+  paddr = grub_le_to_cpu64 (stripe->offset) + sm.stripe_offset;
+  grub_disk_prefetch (dev->disk, paddr >> GRUB_DISK_SECTOR_BITS,
+		      ((paddr & (GRUB_DISK_SECTOR_SIZE - 1)) + sm.csize
+		       + GRUB_DISK_SECTOR_SIZE - 1) >> GRUB_DISK_SECTOR_BITS);
+}
+
 static grub_err_t
 grub_btrfs_read_logical (struct grub_btrfs_data *data, grub_disk_addr_t addr,
 			 void *buf, grub_size_t size, int recursion_depth)
@@ -615,10 +1031,11 @@ grub_btrfs_read_logical (struct grub_btrfs_data *data, grub_disk_addr_t addr,
       grub_uint8_t *ptr;
       struct grub_btrfs_key *key;
       struct grub_btrfs_chunk_item *chunk;
+      struct grub_btrfs_chunk_map *map;
+      grub_uint64_t chstart;
       grub_uint64_t csize;
       grub_err_t err = 0;
       struct grub_btrfs_key key_out;
-      int challoc = 0;
       grub_device_t dev;
       struct grub_btrfs_key key_in;
       grub_size_t chsize;
@@ -626,6 +1043,14 @@ grub_btrfs_read_logical (struct grub_btrfs_data *data, grub_disk_addr_t addr,
 
       grub_dprintf ("btrfs", "searching for laddr %" PRIxGRUB_UINT64_T "\n",
 		    addr);
+      map = chunk_map_find (data, addr);
+      if (map)
+	{
+	  chunk = map->chunk;
+	  chstart = map->start;
+	  goto chunk_found;
+	}
+
       for (ptr = data->sblock.bootstrap_mapping;
 	   ptr < data->sblock.bootstrap_mapping
 	   + sizeof (data->sblock.bootstrap_mapping)
@@ -642,12 +1067,33 @@ grub_btrfs_read_logical (struct grub_btrfs_data *data, grub_disk_addr_t addr,
 	  if (grub_le_to_cpu64 (key->offset) <= addr
 	      && addr < grub_le_to_cpu64 (key->offset)
 	      + grub_le_to_cpu64 (chunk->size))
-	    goto chunk_found;
+	    {
+	      chstart = grub_le_to_cpu64 (key->offset);
+	      goto chunk_found;
+	    }
 	  ptr += sizeof (*key) + sizeof (*chunk)
 	    + sizeof (struct grub_btrfs_chunk_stripe)
 	    * grub_le_to_cpu16 (chunk->nstripes);
 	}
 
+      /* The first time the chunk tree is needed, take all of it.  */
+      if (!data->chunks_loaded)
+	{
+	  err = chunk_map_load (data, recursion_depth);
+	  if (err)
+	    {
+	      grub_dprintf ("btrfs", "couldn't load the chunk tree\n");
+	      grub_errno = err = GRUB_ERR_NONE;
+	    }
+	  map = chunk_map_find (data, addr);
+	  if (map)
+	    {
+	      chunk = map->chunk;
+	      chstart = map->start;
+	      goto chunk_found;
+	    }
+	}
+
       key_in.object_id = grub_cpu_to_le64_compile_time (GRUB_BTRFS_OBJECT_ID_CHUNK);
       key_in.type = GRUB_BTRFS_ITEM_TYPE_CHUNK;
       key_in.offset = grub_cpu_to_le64 (addr);
@@ -666,7 +1112,6 @@ grub_btrfs_read_logical (struct grub_btrfs_data *data, grub_disk_addr_t addr,
       if (!chunk)
 	return grub_errno;
 
-      challoc = 1;
       err = grub_btrfs_read_logical (data, chaddr, chunk, chsize,
 				     recursion_depth);
       if (err)
@@ -674,117 +1119,49 @@ grub_btrfs_read_logical (struct grub_btrfs_data *data, grub_disk_addr_t addr,
 	  grub_free (chunk);
 	  return err;
 	}
+      chstart = grub_le_to_cpu64 (key->offset);
+      err = chunk_map_add (data, chstart, chunk, chsize);
+      if (err)
+	return err;
 
     chunk_found:
       {
+	struct grub_btrfs_stripe_map sm;
 	grub_uint64_t stripen;
 	grub_uint64_t stripe_offset;
-	grub_uint64_t off = addr - grub_le_to_cpu64 (key->offset);
-	grub_uint64_t chunk_stripe_length;
-	grub_uint16_t nstripes;
-	unsigned redundancy = 1;
-	unsigned i, j;
+	unsigned redundancy;
+	unsigned i, j, k;
 
-	if (grub_le_to_cpu64 (chunk->size) <= off)
-	  {
-	    grub_dprintf ("btrfs", "no chunk\n");
-	    return grub_error (GRUB_ERR_BAD_FS,
-			       "couldn't find the chunk descriptor");
-	  }
+	err = map_stripe (chunk, chstart, addr - chstart, &sm);
+	if (err)
+	  return err;
+	stripen = sm.stripen;
+	stripe_offset = sm.stripe_offset;
+	redundancy = sm.redundancy;
+	csize = sm.csize;
+	if (csize > (grub_uint64_t) size)
+	  csize = size;
 
-	nstripes = grub_le_to_cpu16 (chunk->nstripes) ? : 1;
-	chunk_stripe_length = grub_le_to_cpu64 (chunk->stripe_length) ? : 512;
-	grub_dprintf ("btrfs", "chunk 0x%" PRIxGRUB_UINT64_T
-		      "+0x%" PRIxGRUB_UINT64_T
-		      " (%d stripes (%d substripes) of %"
-		      PRIxGRUB_UINT64_T ")\n",
-		      grub_le_to_cpu64 (key->offset),
-		      grub_le_to_cpu64 (chunk->size),
-		      nstripes,
-		      grub_le_to_cpu16 (chunk->nsubstripes),
-		      chunk_stripe_length);
-
-	switch (grub_le_to_cpu64 (chunk->type)
-		& ~GRUB_BTRFS_CHUNK_TYPE_BITS_DONTCARE)
+	/* Let the device holding the next piece start on it while this one
+	   is read.  */
+	if (size > csize)
 	  {
-	  case GRUB_BTRFS_CHUNK_TYPE_SINGLE:
-	    {
-	      grub_uint64_t stripe_length;
-	      grub_dprintf ("btrfs", "single\n");
-	      stripe_length = grub_divmod64 (grub_le_to_cpu64 (chunk->size),
-					     nstripes,
-					     NULL);
-	      if (stripe_length == 0)
-		stripe_length = 512;
-	      stripen = grub_divmod64 (off, stripe_length, &stripe_offset);
-	      csize = (stripen + 1) * stripe_length - off;
-	      break;
-	    }
-	  case GRUB_BTRFS_CHUNK_TYPE_DUPLICATED:
-	  case GRUB_BTRFS_CHUNK_TYPE_RAID1:
-	    {
-	      grub_dprintf ("btrfs", "RAID1\n");
-	      stripen = 0;
-	      stripe_offset = off;
-	      csize = grub_le_to_cpu64 (chunk->size) - off;
-	      redundancy = 2;
-	      break;
-	    }
-	  case GRUB_BTRFS_CHUNK_TYPE_RAID0:
-	    {
-	      grub_uint64_t middle, high;
-	      grub_uint64_t low;
-	      grub_dprintf ("btrfs", "RAID0\n");
-	      middle = grub_divmod64 (off,
-				      chunk_stripe_length,
-				      &low);
-
-	      high = grub_divmod64 (middle, nstripes,
-				    &stripen);
-	      stripe_offset =
-		low + chunk_stripe_length * high;
-	      csize = chunk_stripe_length - low;
-	      break;
-	    }
-	  case GRUB_BTRFS_CHUNK_TYPE_RAID10:
-	    {
-	      grub_uint64_t middle, high;
-	      grub_uint64_t low;
-	      grub_uint16_t nsubstripes;
-	      nsubstripes = grub_le_to_cpu16 (chunk->nsubstripes) ? : 1;
-	      middle = grub_divmod64 (off,
-				      chunk_stripe_length,
-				      &low);
-
-	      high = grub_divmod64 (middle,
-				    nstripes / nsubstripes ? : 1,
-				    &stripen);
-	      stripen *= nsubstripes;
-	      redundancy = nsubstripes;
-	      stripe_offset = low + chunk_stripe_length
-		* high;
-	      csize = chunk_stripe_length - low;
-	      break;
-	    }
-	  default:
-	    grub_dprintf ("btrfs", "unsupported RAID\n");
-	    return grub_error (GRUB_ERR_NOT_IMPLEMENTED_YET,
-			       "unsupported RAID flags %" PRIxGRUB_UINT64_T,
-			       grub_le_to_cpu64 (chunk->type));
+	    struct grub_btrfs_chunk_stripe *stripe;
+
+	    stripe = (struct grub_btrfs_chunk_stripe *) (chunk + 1);
+	    stripe += stripen + sm.mirror;
+	    prefetch_logical (data, addr + csize, size - csize,
+			      stripe->device_id);
 	  }
-	if (csize == 0)
-	  return grub_error (GRUB_ERR_BUG,
-			     "couldn't find the chunk descriptor");
-	if (csize > (grub_uint64_t) size)
-	  csize = size;
 
 	for (j = 0; j < 2; j++)
 	  {
-	    for (i = 0; i < redundancy; i++)
+	    for (k = 0; k < redundancy; k++)
 	      {
 		struct grub_btrfs_chunk_stripe *stripe;
 		grub_disk_addr_t paddr;
 
+		i = (sm.mirror + k) % redundancy;
 		stripe = (struct grub_btrfs_chunk_stripe *) (chunk + 1);
 		/* Right now the redundancy handling is easy.
 		   With RAID5-like it will be more difficult.  */
@@ -797,7 +1174,7 @@ grub_btrfs_read_logical (struct grub_btrfs_data *data, grub_disk_addr_t addr,
 			      " (%d stripes (%d substripes) of %"
 			      PRIxGRUB_UINT64_T ") stripe %" PRIxGRUB_UINT64_T
 			      " maps to 0x%" PRIxGRUB_UINT64_T "\n",
-			      grub_le_to_cpu64 (key->offset),
+			      chstart,
 			      grub_le_to_cpu64 (chunk->size),
 			      grub_le_to_cpu16 (chunk->nstripes),
 			      grub_le_to_cpu16 (chunk->nsubstripes),
@@ -822,7 +1199,7 @@ grub_btrfs_read_logical (struct grub_btrfs_data *data, grub_disk_addr_t addr,
 		  break;
 		grub_errno = GRUB_ERR_NONE;
 	      }
-	    if (i != redundancy)
+	    if (k != redundancy)
 	      break;
 	  }
 	if (err)
@@ -831,8 +1208,6 @@ grub_btrfs_read_logical (struct grub_btrfs_data *data, grub_disk_addr_t addr,
       size -= csize;
       buf = (grub_uint8_t *) buf + csize;
       addr += csize;
-      if (challoc)
-	grub_free (chunk);
     }
   return GRUB_ERR_NONE;
 }
@@ -841,6 +1216,7 @@ static struct grub_btrfs_data *
 grub_btrfs_mount (grub_device_t dev)
 {
   struct grub_btrfs_data *data;
+  grub_uint32_t nodesize;
   grub_err_t err;
 
   if (!dev->disk)
@@ -860,6 +1236,15 @@ grub_btrfs_mount (grub_device_t dev)
       return NULL;
     }
 
+  /* Tree nodes are read whole.  */
+  nodesize = grub_le_to_cpu32 (data->sblock.nodesize);
+  if (nodesize < 4096 || nodesize > 65536 || (nodesize & (nodesize - 1)))
+    {
+      grub_free (data);
+      grub_error (GRUB_ERR_BAD_FS, "invalid btrfs node size");
+      return NULL;
+    }
+
   data->n_devices_allocated = 16;
   data->devices_attached = grub_malloc (sizeof (data->devices_attached[0])
 					* data->n_devices_allocated);
@@ -883,6 +1268,9 @@ grub_btrfs_unmount (struct grub_btrfs_data *data)
   for (i = 1; i < data->n_devices_attached; i++)
     grub_device_close (data->devices_attached[i].dev);
   grub_free (data->devices_attached);
+  for (i = 0; i < data->n_chunks; i++)
+    grub_free (data->chunks[i].chunk);
+  grub_free (data->chunks);
   grub_free (data->extent);
   grub_free (data);
 }
@@ -1005,6 +1393,139 @@ grub_btrfs_lzo_decompress(char *ibuf, grub_size_t isize, grub_off_t off,
   return ret;
 }
 
+static grub_ssize_t
+grub_btrfs_decompress (grub_uint8_t compression, char *in, grub_size_t insize,
+		       grub_off_t off, char *out, grub_size_t outsize)
+{
+  switch (compression)
+    {
+    case GRUB_BTRFS_COMPRESSION_ZLIB:
+      return grub_zlib_decompress (in, insize, off, out, outsize);
+    case GRUB_BTRFS_COMPRESSION_LZO:
+      return grub_btrfs_lzo_decompress (in, insize, off, out, outsize);
+    case GRUB_BTRFS_COMPRESSION_ZSTD:
+      return grub_zstd_decompress (in, insize, off, out, outsize);
+    }
+  return -1;
+}
+
+/* Decompressed contents of compressed extents, kept across mounts and
+   replaced least recently used first.  Without them every small read
+   from a compressed file reads and decompresses its extent again.  As
+   with tree nodes, an extent doesn't change within a generation.  */
+#define GRUB_BTRFS_EXTENT_CACHE_SIZE 8
+
+/* Btrfs doesn't compress more than this into one extent.  */
+#define GRUB_BTRFS_EXTENT_CACHE_MAX (128 * 1024)
+
+struct grub_btrfs_extent_cache
+{
+  grub_btrfs_uuid_t fsid;
+  grub_uint64_t generation;
+  grub_uint64_t laddr;
+  grub_uint64_t zsize;
+  grub_uint8_t compression;
+  unsigned long last_use;
+  grub_size_t len;
+  char *buf;
+};
+
+static struct grub_btrfs_extent_cache extent_cache[GRUB_BTRFS_EXTENT_CACHE_SIZE];
+static unsigned long extent_cache_generation;
+static unsigned long extent_cache_clock;
+
+static void
+extent_cache_flush (void)
+{
+  unsigned i;
+
+  for (i = 0; i < GRUB_BTRFS_EXTENT_CACHE_SIZE; i++)
+    {
+      grub_free (extent_cache[i].buf);
+      extent_cache[i].buf = NULL;
+    }
+}
+
+/* Return the decompressed contents of the compressed regular extent
+   EXTENT and store their length in *LEN.  They stay valid until the
+   next call.  */
+static const char *
+get_decompressed_extent (struct grub_btrfs_data *data,
+			 const struct grub_btrfs_extent_data *extent,
+			 grub_size_t *len)
+{
+  grub_uint64_t laddr = grub_le_to_cpu64 (extent->laddr);
+  grub_uint64_t zsize = grub_le_to_cpu64 (extent->compressed_size);
+  grub_size_t size = grub_le_to_cpu64 (extent->size);
+  struct grub_btrfs_extent_cache *slot, *victim;
+  grub_ssize_t ret;
+  char *tmp, *buf;
+  unsigned i;
+
+  if (extent_cache_generation != grub_disk_generation)
+    {
+      extent_cache_flush ();
+      extent_cache_generation = grub_disk_generation;
+    }
+
+  victim = &extent_cache[0];
+  for (i = 0; i < GRUB_BTRFS_EXTENT_CACHE_SIZE; i++)
+    {
+      slot = &extent_cache[i];
+      if (slot->buf && slot->laddr == laddr && slot->zsize == zsize
+	  && slot->compression == extent->compression
+	  && slot->generation == data->sblock.generation
+	  && grub_memcmp (slot->fsid, data->sblock.uuid,
+			  sizeof (slot->fsid)) == 0)
+	{
+	  slot->last_use = ++extent_cache_clock;
+	  *len = slot->len;
+	  return slot->buf;
+	}
+      if (victim->buf && (!slot->buf || slot->last_use < victim->last_use))
+	victim = slot;
+    }
+
+  tmp = grub_malloc (zsize);
+  if (!tmp)
+    return NULL;
+  if (grub_btrfs_read_logical (data, laddr, tmp, zsize, 0))
+    {
+      grub_free (tmp);
+      return NULL;
+    }
+
+  buf = grub_malloc (size);
+  if (!buf)
+    {
+      grub_free (tmp);
+      return NULL;
+    }
+  ret = grub_btrfs_decompress (extent->compression, tmp, zsize, 0, buf, size);
+  grub_free (tmp);
+  if (ret < 0)
+    {
+      grub_free (buf);
+      if (!grub_errno)
+	grub_error (GRUB_ERR_BAD_COMPRESSED_DATA,
+		    "premature end of compressed");
+      return NULL;
+    }
+
+  grub_free (victim->buf);
+  grub_memcpy (victim->fsid, data->sblock.uuid, sizeof (victim->fsid));
+  victim->generation = data->sblock.generation;
+  victim->laddr = laddr;
+  victim->zsize = zsize;
+  victim->compression = extent->compression;
+  victim->last_use = ++extent_cache_clock;
+  victim->len = ret;
+  victim->buf = buf;
+
+  *len = ret;
+  return buf;
+}
+
 static grub_ssize_t
 grub_btrfs_extent_read (struct grub_btrfs_data *data,
 			grub_uint64_t ino, grub_uint64_t tree,
@@ -1087,7 +1608,8 @@ grub_btrfs_extent_read (struct grub_btrfs_data *data,
 
       if (data->extent->compression != GRUB_BTRFS_COMPRESSION_NONE
 	  && data->extent->compression != GRUB_BTRFS_COMPRESSION_ZLIB
-	  && data->extent->compression != GRUB_BTRFS_COMPRESSION_LZO)
+	  && data->extent->compression != GRUB_BTRFS_COMPRESSION_LZO
+	  && data->extent->compression != GRUB_BTRFS_COMPRESSION_ZSTD)
 	{
 	  grub_error (GRUB_ERR_NOT_IMPLEMENTED_YET,
 		      "compression type 0x%x not supported",
@@ -1127,6 +1649,20 @@ grub_btrfs_extent_read (struct grub_btrfs_data *data,
 		  != (grub_ssize_t) csize)
 		return -1;
 	    }
+	  else if (data->extent->compression == GRUB_BTRFS_COMPRESSION_ZSTD)
+	    {
+	      if (grub_zstd_decompress (data->extent->inl, data->extsize -
+					((grub_uint8_t *) data->extent->inl
+					 - (grub_uint8_t *) data->extent),
+					extoff, buf, csize)
+		  != (grub_ssize_t) csize)
+		{
+		  if (!grub_errno)
+		    grub_error (GRUB_ERR_BAD_COMPRESSED_DATA,
+				"premature end of compressed");
+		  return -1;
+		}
+	    }
 	  else
 	    grub_memcpy (buf, data->extent->inl + extoff, csize);
 	  break;
@@ -1137,6 +1673,27 @@ grub_btrfs_extent_read (struct grub_btrfs_data *data,
 	      break;
 	    }
 
+	  if (data->extent->compression != GRUB_BTRFS_COMPRESSION_NONE
+	      && grub_le_to_cpu64 (data->extent->size)
+		 <= GRUB_BTRFS_EXTENT_CACHE_MAX)
+	    {
+	      grub_off_t from = extoff + grub_le_to_cpu64 (data->extent->offset);
+	      const char *dec;
+	      grub_size_t declen;
+
+	      dec = get_decompressed_extent (data, data->extent, &declen);
+	      if (!dec)
+		return -1;
+	      if (from > declen || declen - from < csize)
+		{
+		  grub_error (GRUB_ERR_BAD_COMPRESSED_DATA,
+			      "premature end of compressed");
+		  return -1;
+		}
+	      grub_memcpy (buf, dec + from, csize);
+	      break;
+	    }
+
 	  if (data->extent->compression != GRUB_BTRFS_COMPRESSION_NONE)
 	    {
 	      char *tmp;
@@ -1156,16 +1713,10 @@ grub_btrfs_extent_read (struct grub_btrfs_data *data,
 		  return -1;
 		}
 
-	      if (data->extent->compression == GRUB_BTRFS_COMPRESSION_ZLIB)
-		ret = grub_zlib_decompress (tmp, zsize, extoff
-				    + grub_le_to_cpu64 (data->extent->offset),
-				    buf, csize);
-	      else if (data->extent->compression == GRUB_BTRFS_COMPRESSION_LZO)
-		ret = grub_btrfs_lzo_decompress (tmp, zsize, extoff
-				    + grub_le_to_cpu64 (data->extent->offset),
-				    buf, csize);
-	      else
-		ret = -1;
+	      ret = grub_btrfs_decompress (data->extent->compression, tmp, zsize,
+					   extoff
+					   + grub_le_to_cpu64 (data->extent->offset),
+					   buf, csize);
 
 	      grub_free (tmp);
 
@@ -1597,6 +2148,11 @@ grub_btrfs_dir (grub_device_t device, const char *path,
 	    {
 	      info.mtime = grub_le_to_cpu64 (inode.mtime.sec);
 	      info.mtimeset = 1;
+	      if (cdirel->type == GRUB_BTRFS_DIR_ITEM_TYPE_REGULAR)
+		{
+		  info.size = grub_le_to_cpu64 (inode.size);
+		  info.sizeset = 1;
+		}
 	    }
 	  c = cdirel->name[grub_le_to_cpu16 (cdirel->n)];
 	  cdirel->name[grub_le_to_cpu16 (cdirel->n)] = 0;
@@ -1749,6 +2305,13 @@ grub_btrfs_embed (grub_device_t device __attribute__ ((unused)),
 }
 #endif
 
+static const struct grub_fs_magic grub_btrfs_magics[] =
+  {
+    { (64 * 2 << GRUB_DISK_SECTOR_BITS) + 64,
+      sizeof (GRUB_BTRFS_SIGNATURE) - 1, GRUB_BTRFS_SIGNATURE },
+    { 0, 0, 0 }
+  };
+
 static struct grub_fs grub_btrfs_fs = {
   .name = "btrfs",
   .dir = grub_btrfs_dir,
@@ -1757,6 +2320,7 @@ static struct grub_fs grub_btrfs_fs = {
   .close = grub_btrfs_close,
   .uuid = grub_btrfs_uuid,
   .label = grub_btrfs_label,
+  .magics = grub_btrfs_magics,
 #ifdef GRUB_UTIL
   .embed = grub_btrfs_embed,
   .reserved_first_sector = 1,
@@ -1772,4 +2336,6 @@ GRUB_MOD_INIT (btrfs)
 GRUB_MOD_FINI (btrfs)
 {
   grub_fs_unregister (&grub_btrfs_fs);
+  node_cache_flush ();
+  extent_cache_flush ();
 }
@@ -43,9 +43,11 @@
 #include <grub/mm.h>
 #include <grub/misc.h>
 #include <grub/disk.h>
+#include <grub/partition.h>
 #include <grub/dl.h>
 #include <grub/types.h>
 #include <grub/fshelp.h>
+#include <grub/reclaim.h>
 
 GRUB_MOD_LICENSE ("GPLv3+");
 
@@ -139,6 +141,23 @@ GRUB_MOD_LICENSE ("GPLv3+");
 #define EXT3_JOURNAL_FLAG_LAST_TAG	8
 
 #define EXT4_EXTENTS_FLAG		0x80000
+#define EXT2_INDEX_FL			0x1000
+
+/* Superblock flags telling how the hash tree hashes names.  */
+#define EXT2_FLAGS_SIGNED_HASH		0x0001
+#define EXT2_FLAGS_UNSIGNED_HASH	0x0002
+
+/* Hash tree name hashes.  The unsigned variants are never stored on
+   disk, they are selected by EXT2_FLAGS_UNSIGNED_HASH.  */
+#define EXT2_DX_HASH_LEGACY		0
+#define EXT2_DX_HASH_HALF_MD4		1
+#define EXT2_DX_HASH_TEA		2
+#define EXT2_DX_HASH_LEGACY_UNSIGNED	3
+#define EXT2_DX_HASH_HALF_MD4_UNSIGNED	4
+#define EXT2_DX_HASH_TEA_UNSIGNED	5
+
+/* Index blocks below the root that a hash tree may have.  */
+#define EXT2_DX_MAX_INDIRECT		2
 
 /* The ext2 superblock.  */
 struct grub_ext2_sblock
@@ -193,6 +212,12 @@ struct grub_ext2_sblock
   grub_uint32_t first_meta_bg;
   grub_uint32_t mkfs_time;
   grub_uint32_t jnl_blocks[17];
+  grub_uint32_t total_blocks_hi;
+  grub_uint32_t reserved_blocks_hi;
+  grub_uint32_t free_blocks_hi;
+  grub_uint16_t min_extra_isize;
+  grub_uint16_t want_extra_isize;
+  grub_uint32_t flags;
 };
 
 /* The ext2 blockgroup.  */
@@ -259,6 +284,31 @@ struct ext2_dirent
   grub_uint8_t filetype;
 };
 
+/* The header of a hash tree directory, following the "." and ".."
+   entries in its first block.  */
+struct grub_ext2_dx_root_info
+{
+  grub_uint32_t reserved_zero;
+  grub_uint8_t hash_version;
+  grub_uint8_t info_length;
+  grub_uint8_t indirect_levels;
+  grub_uint8_t unused_flags;
+};
+
+/* An index entry.  In the first entry of each index block, HASH is
+   replaced by a struct grub_ext2_dx_countlimit.  */
+struct grub_ext2_dx_entry
+{
+  grub_uint32_t hash;
+  grub_uint32_t block;
+};
+
+struct grub_ext2_dx_countlimit
+{
+  grub_uint16_t limit;
+  grub_uint16_t count;
+};
+
 struct grub_ext3_journal_header
 {
   grub_uint32_t magic;
@@ -336,6 +386,36 @@ struct grub_ext2_data
 
 static grub_dl_t my_mod;
 
+/* Whole group descriptor and inode table blocks, kept across mounts so
+   that stat'ing the entries of a directory costs one read per block
+   rather than one per inode.  The table is direct-mapped on the block
+   number.  */
+#define EXT2_BLOCK_CACHE_SIZE		64
+/* Don't keep blocks larger than this.  */
+#define EXT2_BLOCK_CACHE_MAX_SIZE	65536
+
+struct grub_ext2_block_cache
+{
+  unsigned long dev_id;
+  unsigned long disk_id;
+  grub_disk_addr_t part_start;
+  grub_disk_addr_t sector;
+  grub_size_t size;
+  char *buf;
+};
+
+static struct grub_ext2_block_cache block_cache[EXT2_BLOCK_CACHE_SIZE];
+static unsigned long block_cache_generation;
+
+static grub_size_t block_cache_shrink (grub_size_t wanted);
+
+/* Busy while a block is being read into its slot.  */
+static struct grub_reclaim_cache block_cache_reclaim =
+  {
+    .name = "ext2",
+    .shrink = block_cache_shrink
+  };
+
 
 
 /* Check is a = b^x for some x.  */
@@ -367,6 +447,96 @@ group_has_super_block (struct grub_ext2_data *data, grub_uint64_t group)
 	  is_power_of(group, 3));
 }
 
+static void
+block_cache_flush (void)
+{
+  unsigned i;
+
+  for (i = 0; i < EXT2_BLOCK_CACHE_SIZE; i++)
+    {
+      grub_free (block_cache[i].buf);
+      block_cache[i].buf = NULL;
+    }
+  block_cache_reclaim.size = 0;
+}
+
+/* The table is direct-mapped and keeps no usage order, so it is dropped
+   as a whole.  */
+static grub_size_t
+block_cache_shrink (grub_size_t wanted __attribute__ ((unused)))
+{
+  grub_size_t freed = block_cache_reclaim.size;
+
+  block_cache_flush ();
+  return freed;
+}
+
+/* Read SIZE bytes at OFFSET of the filesystem block at SECTOR into BUF,
+   like grub_disk_read, going through the block cache.  */
+static grub_err_t
+grub_ext2_read_meta (struct grub_ext2_data *data, grub_disk_addr_t sector,
+		     grub_off_t offset, grub_size_t size, void *buf)
+{
+  grub_disk_addr_t part_start = grub_partition_get_start (data->disk->partition);
+  grub_size_t blksz = EXT2_BLOCK_SIZE (data);
+  struct grub_ext2_block_cache *slot;
+
+  if (blksz > EXT2_BLOCK_CACHE_MAX_SIZE || offset + size > blksz)
+    return grub_disk_read (data->disk, sector, offset, size, buf);
+
+  if (block_cache_generation != grub_disk_generation)
+    {
+      block_cache_flush ();
+      block_cache_generation = grub_disk_generation;
+    }
+
+  grub_reclaim_touch (&block_cache_reclaim);
+  slot = &block_cache[(sector >> LOG2_EXT2_BLOCK_SIZE (data))
+		      % EXT2_BLOCK_CACHE_SIZE];
+  if (!slot->buf || slot->sector != sector || slot->size != blksz
+      || slot->dev_id != data->disk->dev->id
+      || slot->disk_id != data->disk->id || slot->part_start != part_start)
+    {
+      grub_err_t err;
+
+      if (slot->buf && slot->size != blksz)
+	{
+	  grub_free (slot->buf);
+	  slot->buf = NULL;
+	  block_cache_reclaim.size -= slot->size;
+	}
+      if (!slot->buf)
+	{
+	  slot->buf = grub_malloc (blksz);
+	  if (!slot->buf)
+	    {
+	      /* Not being able to cache the block is not an error.  */
+	      grub_errno = GRUB_ERR_NONE;
+	      return grub_disk_read (data->disk, sector, offset, size, buf);
+	    }
+	  slot->size = blksz;
+	  block_cache_reclaim.size += blksz;
+	}
+      block_cache_reclaim.busy++;
+      err = grub_disk_read (data->disk, sector, 0, blksz, slot->buf);
+      block_cache_reclaim.busy--;
+      if (err)
+	{
+	  grub_free (slot->buf);
+	  slot->buf = NULL;
+	  block_cache_reclaim.size -= blksz;
+	  return grub_errno;
+	}
+      slot->dev_id = data->disk->dev->id;
+      slot->disk_id = data->disk->id;
+      slot->part_start = part_start;
+      slot->sector = sector;
+    }
+
+  grub_memcpy (buf, slot->buf + offset, size);
+  return GRUB_ERR_NONE;
+}
+
 /* Read into BLKGRP the blockgroup descriptor of blockgroup GROUP of
    the mounted filesystem DATA.  */
 inline static grub_err_t
@@ -396,11 +566,11 @@ grub_ext2_blockgroup (struct grub_ext2_data *data, grub_uint64_t group,
   else
     /* Superblock.  */
     block++;
-  return grub_disk_read (data->disk,
-                         ((grub_le_to_cpu32 (data->sblock.first_data_block)
-			   + block)
-                          << LOG2_EXT2_BLOCK_SIZE (data)), offset,
-			 sizeof (struct grub_ext2_block_group), blkgrp);
+  return grub_ext2_read_meta (data,
+			      ((grub_le_to_cpu32 (data->sblock.first_data_block)
+				+ block)
+			       << LOG2_EXT2_BLOCK_SIZE (data)), offset,
+			      sizeof (struct grub_ext2_block_group), blkgrp);
 }
 
 static struct grub_ext4_extent_header *
@@ -451,8 +621,12 @@ grub_ext4_find_leaf (struct grub_ext2_data *data,
   return 0;
 }
 
+/* Map FILEBLOCK of NODE to a disk block.  For extent-mapped files store
+   in *COUNT how many blocks up to the end of the extent (or up to the
+   next extent in a hole) map the same way.  */
 static grub_disk_addr_t
-grub_ext2_read_block (grub_fshelp_node_t node, grub_disk_addr_t fileblock)
+grub_ext2_read_block (grub_fshelp_node_t node, grub_disk_addr_t fileblock,
+		      grub_disk_addr_t *count)
 {
   struct grub_ext2_data *data = node->data;
   struct grub_ext2_inode *inode = &node->inode;
@@ -486,9 +660,14 @@ grub_ext2_read_block (grub_fshelp_node_t node, grub_disk_addr_t fileblock)
 
       if (--i >= 0)
         {
-          fileblock -= grub_le_to_cpu32 (ext[i].block);
-          if (fileblock >= grub_le_to_cpu16 (ext[i].len))
-	    ret = 0;
+          grub_disk_addr_t off = fileblock - grub_le_to_cpu32 (ext[i].block);
+
+          if (off >= grub_le_to_cpu16 (ext[i].len))
+	    {
+	      ret = 0;
+	      if (i + 1 < grub_le_to_cpu16 (leaf->entries))
+		*count = grub_le_to_cpu32 (ext[i + 1].block) - fileblock;
+	    }
           else
             {
               grub_disk_addr_t start;
@@ -496,7 +675,8 @@ grub_ext2_read_block (grub_fshelp_node_t node, grub_disk_addr_t fileblock)
               start = grub_le_to_cpu16 (ext[i].start_hi);
               start = (start << 32) + grub_le_to_cpu32 (ext[i].start);
 
-              ret = fileblock + start;
+              ret = off + start;
+	      *count = grub_le_to_cpu16 (ext[i].len) - off;
             }
         }
       else
@@ -568,12 +748,12 @@ grub_ext2_read_file (grub_fshelp_node_t node,
 		     grub_disk_read_hook_t read_hook, void *read_hook_data,
 		     grub_off_t pos, grub_size_t len, char *buf)
 {
-  return grub_fshelp_read_file (node->data->disk, node,
-				read_hook, read_hook_data,
-				pos, len, buf, grub_ext2_read_block,
-				grub_cpu_to_le32 (node->inode.size)
-				| (((grub_off_t) grub_cpu_to_le32 (node->inode.size_high)) << 32),
-				LOG2_EXT2_BLOCK_SIZE (node->data), 0);
+  return grub_fshelp_read_file_extents (node->data->disk, node,
+					read_hook, read_hook_data,
+					pos, len, buf, grub_ext2_read_block,
+					grub_cpu_to_le32 (node->inode.size)
+					| (((grub_off_t) grub_cpu_to_le32 (node->inode.size_high)) << 32),
+					LOG2_EXT2_BLOCK_SIZE (node->data), 0);
 
 }
 
@@ -611,10 +791,10 @@ grub_ext2_read_inode (struct grub_ext2_data *data,
 	     << 32);
 
   /* Read the inode.  */
-  if (grub_disk_read (data->disk,
-		      ((base + blkno) << LOG2_EXT2_BLOCK_SIZE (data)),
-		      EXT2_INODE_SIZE (data) * blkoff,
-		      sizeof (struct grub_ext2_inode), inode))
+  if (grub_ext2_read_meta (data,
+			   ((base + blkno) << LOG2_EXT2_BLOCK_SIZE (data)),
+			   EXT2_INODE_SIZE (data) * blkoff,
+			   sizeof (struct grub_ext2_inode), inode))
     return grub_errno;
 
   return 0;
@@ -735,6 +915,61 @@ grub_ext2_read_symlink (grub_fshelp_node_t node)
   return symlink;
 }
 
+/* Make the node for the directory entry pointing at inode INO, and find
+   out what it is.  */
+static struct grub_fshelp_node *
+grub_ext2_dirent_node (struct grub_fshelp_node *diro, grub_uint32_t ino,
+		       grub_uint8_t filetype, enum grub_fshelp_filetype *type)
+{
+  struct grub_fshelp_node *fdiro;
+
+  *type = GRUB_FSHELP_UNKNOWN;
+
+  fdiro = grub_malloc (sizeof (struct grub_fshelp_node));
+  if (! fdiro)
+    return 0;
+
+  fdiro->data = diro->data;
+  fdiro->ino = ino;
+
+  if (filetype != FILETYPE_UNKNOWN)
+    {
+      fdiro->inode_read = 0;
+
+      if (filetype == FILETYPE_DIRECTORY)
+	*type = GRUB_FSHELP_DIR;
+      else if (filetype == FILETYPE_SYMLINK)
+	*type = GRUB_FSHELP_SYMLINK;
+      else if (filetype == FILETYPE_REG)
+	*type = GRUB_FSHELP_REG;
+    }
+  else
+    {
+      /* The filetype can not be read from the dirent, read
+	 the inode to get more information.  */
+      grub_ext2_read_inode (diro->data, ino, &fdiro->inode);
+      if (grub_errno)
+	{
+	  grub_free (fdiro);
+	  return 0;
+	}
+
+      fdiro->inode_read = 1;
+
+      if ((grub_le_to_cpu16 (fdiro->inode.mode)
+	   & FILETYPE_INO_MASK) == FILETYPE_INO_DIRECTORY)
+	*type = GRUB_FSHELP_DIR;
+      else if ((grub_le_to_cpu16 (fdiro->inode.mode)
+		& FILETYPE_INO_MASK) == FILETYPE_INO_SYMLINK)
+	*type = GRUB_FSHELP_SYMLINK;
+      else if ((grub_le_to_cpu16 (fdiro->inode.mode)
+		& FILETYPE_INO_MASK) == FILETYPE_INO_REG)
+	*type = GRUB_FSHELP_REG;
+    }
+
+  return fdiro;
+}
+
 static int
 grub_ext2_iterate_dir (grub_fshelp_node_t dir,
 		       grub_fshelp_iterate_dir_hook_t hook, void *hook_data)
@@ -766,69 +1001,484 @@ grub_ext2_iterate_dir (grub_fshelp_node_t dir,
 	{
 	  char filename[MAX_NAMELEN + 1];
 	  struct grub_fshelp_node *fdiro;
-	  enum grub_fshelp_filetype type = GRUB_FSHELP_UNKNOWN;
+	  enum grub_fshelp_filetype type;
 
 	  grub_ext2_read_file (diro, 0, 0, fpos + sizeof (struct ext2_dirent),
 			       dirent.namelen, filename);
 	  if (grub_errno)
 	    return 0;
 
-	  fdiro = grub_malloc (sizeof (struct grub_fshelp_node));
+	  filename[dirent.namelen] = '\0';
+
+	  fdiro = grub_ext2_dirent_node (diro, grub_le_to_cpu32 (dirent.inode),
+					 dirent.filetype, &type);
 	  if (! fdiro)
 	    return 0;
 
-	  fdiro->data = diro->data;
-	  fdiro->ino = grub_le_to_cpu32 (dirent.inode);
+	  if (hook (filename, type, fdiro, hook_data))
+	    return 1;
+	}
 
-	  filename[dirent.namelen] = '\0';
+      fpos += grub_le_to_cpu16 (dirent.direntlen);
+    }
 
-	  if (dirent.filetype != FILETYPE_UNKNOWN)
-	    {
-	      fdiro->inode_read = 0;
-
-	      if (dirent.filetype == FILETYPE_DIRECTORY)
-		type = GRUB_FSHELP_DIR;
-	      else if (dirent.filetype == FILETYPE_SYMLINK)
-		type = GRUB_FSHELP_SYMLINK;
-	      else if (dirent.filetype == FILETYPE_REG)
-		type = GRUB_FSHELP_REG;
-	    }
-	  else
+  return 0;
+}
+
+/* Name hashes of hash tree directories, as computed by Linux.  */
+
+static grub_uint32_t
+grub_ext2_dx_hack_hash (const char *name, int len, int is_unsigned)
+{
+  grub_uint32_t hash, hash0 = 0x12a3fe2d, hash1 = 0x37abe8f9;
+  int i;
+
+  for (i = 0; i < len; i++)
+    {
+      int c = is_unsigned ? (int) (grub_uint8_t) name[i]
+	: (int) (grub_int8_t) name[i];
+
+      hash = hash1 + (hash0 ^ (grub_uint32_t) (c * 7152373));
+      if (hash & 0x80000000)
+	hash -= 0x7fffffff;
+      hash1 = hash0;
+      hash0 = hash;
+    }
+
+  return hash0 << 1;
+}
+
+/* Pack up to NUM words of NAME into BUF, padded with the length.  */
+static void
+grub_ext2_dx_str2hashbuf (const char *name, int len, grub_uint32_t *buf,
+			  int num, int is_unsigned)
+{
+  grub_uint32_t pad, val;
+  int i;
+
+  pad = (grub_uint32_t) len | ((grub_uint32_t) len << 8);
+  pad |= pad << 16;
+
+  val = pad;
+  if (len > num * 4)
+    len = num * 4;
+  for (i = 0; i < len; i++)
+    {
+      int c = is_unsigned ? (int) (grub_uint8_t) name[i]
+	: (int) (grub_int8_t) name[i];
+
+      val = (grub_uint32_t) c + (val << 8);
+      if ((i % 4) == 3)
+	{
+	  *buf++ = val;
+	  val = pad;
+	  num--;
+	}
+    }
+  if (--num >= 0)
+    *buf++ = val;
+  while (--num >= 0)
+    *buf++ = pad;
+}
+
+#define DX_ROL(x, s)	(((x) << (s)) | ((x) >> (32 - (s))))
+#define DX_F(x, y, z)	((z) ^ ((x) & ((y) ^ (z))))
+#define DX_G(x, y, z)	(((x) & (y)) + (((x) ^ (y)) & (z)))
+#define DX_H(x, y, z)	((x) ^ (y) ^ (z))
+#define DX_ROUND(f, a, b, c, d, x, s)		\
+  (a += f (b, c, d) + (x), a = DX_ROL (a, s))
+#define DX_K2	013240474631U
+#define DX_K3	015666365641U
+
+static void
+grub_ext2_dx_half_md4 (grub_uint32_t buf[4], const grub_uint32_t in[8])
+{
+  grub_uint32_t a = buf[0], b = buf[1], c = buf[2], d = buf[3];
+
+  DX_ROUND (DX_F, a, b, c, d, in[0], 3);
+  DX_ROUND (DX_F, d, a, b, c, in[1], 7);
+  DX_ROUND (DX_F, c, d, a, b, in[2], 11);
+  DX_ROUND (DX_F, b, c, d, a, in[3], 19);
+  DX_ROUND (DX_F, a, b, c, d, in[4], 3);
+  DX_ROUND (DX_F, d, a, b, c, in[5], 7);
+  DX_ROUND (DX_F, c, d, a, b, in[6], 11);
+  DX_ROUND (DX_F, b, c, d, a, in[7], 19);
+
+  DX_ROUND (DX_G, a, b, c, d, in[1] + DX_K2, 3);
+  DX_ROUND (DX_G, d, a, b, c, in[3] + DX_K2, 5);
+  DX_ROUND (DX_G, c, d, a, b, in[5] + DX_K2, 9);
+  DX_ROUND (DX_G, b, c, d, a, in[7] + DX_K2, 13);
+  DX_ROUND (DX_G, a, b, c, d, in[0] + DX_K2, 3);
+  DX_ROUND (DX_G, d, a, b, c, in[2] + DX_K2, 5);
+  DX_ROUND (DX_G, c, d, a, b, in[4] + DX_K2, 9);
+  DX_ROUND (DX_G, b, c, d, a, in[6] + DX_K2, 13);
+
+  DX_ROUND (DX_H, a, b, c, d, in[3] + DX_K3, 3);
+  DX_ROUND (DX_H, d, a, b, c, in[7] + DX_K3, 9);
+  DX_ROUND (DX_H, c, d, a, b, in[2] + DX_K3, 11);
+  DX_ROUND (DX_H, b, c, d, a, in[6] + DX_K3, 15);
+  DX_ROUND (DX_H, a, b, c, d, in[1] + DX_K3, 3);
+  DX_ROUND (DX_H, d, a, b, c, in[5] + DX_K3, 9);
+  DX_ROUND (DX_H, c, d, a, b, in[0] + DX_K3, 11);
+  DX_ROUND (DX_H, b, c, d, a, in[4] + DX_K3, 15);
+
+  buf[0] += a;
+  buf[1] += b;
+  buf[2] += c;
+  buf[3] += d;
+}
+
+static void
+grub_ext2_dx_tea (grub_uint32_t buf[4], const grub_uint32_t in[4])
+{
+  grub_uint32_t sum = 0;
+  grub_uint32_t b0 = buf[0], b1 = buf[1];
+  int n;
+
+  for (n = 0; n < 16; n++)
+    {
+      sum += 0x9e3779b9;
+      b0 += ((b1 << 4) + in[0]) ^ (b1 + sum) ^ ((b1 >> 5) + in[1]);
+      b1 += ((b0 << 4) + in[2]) ^ (b0 + sum) ^ ((b0 >> 5) + in[3]);
+    }
+
+  buf[0] += b0;
+  buf[1] += b1;
+}
+
+/* Hash NAME the way directories of DATA using VERSION do.  The lowest bit
+   is left clear, it marks collisions in the index.  */
+static grub_uint32_t
+grub_ext2_dx_hash (struct grub_ext2_data *data, int version,
+		   const char *name, int len)
+{
+  grub_uint32_t buf[4] = { 0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476 };
+  grub_uint32_t in[8];
+  grub_uint32_t hash;
+  int is_unsigned = (version >= EXT2_DX_HASH_LEGACY_UNSIGNED);
+  int i;
+
+  for (i = 0; i < 4; i++)
+    if (data->sblock.hash_seed[i])
+      break;
+  if (i < 4)
+    for (i = 0; i < 4; i++)
+      buf[i] = grub_le_to_cpu32 (data->sblock.hash_seed[i]);
+
+  switch (version)
+    {
+    case EXT2_DX_HASH_LEGACY:
+    case EXT2_DX_HASH_LEGACY_UNSIGNED:
+      hash = grub_ext2_dx_hack_hash (name, len, is_unsigned);
+      break;
+
+    case EXT2_DX_HASH_HALF_MD4:
+    case EXT2_DX_HASH_HALF_MD4_UNSIGNED:
+      for (; len > 0; len -= 32, name += 32)
+	{
+	  grub_ext2_dx_str2hashbuf (name, len, in, 8, is_unsigned);
+	  grub_ext2_dx_half_md4 (buf, in);
+	}
+      hash = buf[1];
+      break;
+
+    default:
+      for (; len > 0; len -= 16, name += 16)
+	{
+	  grub_ext2_dx_str2hashbuf (name, len, in, 4, is_unsigned);
+	  grub_ext2_dx_tea (buf, in);
+	}
+      hash = buf[0];
+      break;
+    }
+
+  hash &= ~1U;
+  /* The very last hash value means end of directory to readdir.  */
+  if (hash == (0x7fffffffU << 1))
+    hash = (0x7fffffffU - 1) << 1;
+  return hash;
+}
+
+/* One index block on the way from the root of a hash tree to a leaf.  */
+struct grub_ext2_dx_frame
+{
+  struct grub_ext2_dx_entry *entries;
+  unsigned count;
+  unsigned at;
+};
+
+/* Set up FRAME for the entries at OFFSET of the index block in BUF, and
+   pick the last entry whose hash is not above HASH.  Return 0 if the
+   block does not look like an index.  */
+static int
+grub_ext2_dx_frame_init (struct grub_ext2_dx_frame *frame, char *buf,
+			 grub_uint32_t offset, grub_uint32_t blocksize,
+			 grub_uint32_t hash)
+{
+  struct grub_ext2_dx_countlimit *cl;
+  unsigned low, high;
+
+  if (offset + sizeof (struct grub_ext2_dx_entry) > blocksize)
+    return 0;
+
+  cl = (struct grub_ext2_dx_countlimit *) (buf + offset);
+  frame->entries = (struct grub_ext2_dx_entry *) (buf + offset);
+  frame->count = grub_le_to_cpu16 (cl->count);
+  if (frame->count == 0 || frame->count > grub_le_to_cpu16 (cl->limit)
+      || offset + frame->count * sizeof (struct grub_ext2_dx_entry) > blocksize)
+    return 0;
+
+  /* Entry 0 has no hash of its own and covers everything below entry 1.  */
+  low = 1;
+  high = frame->count;
+  while (low < high)
+    {
+      unsigned mid = low + (high - low) / 2;
+
+      if (grub_le_to_cpu32 (frame->entries[mid].hash) > hash)
+	high = mid;
+      else
+	low = mid + 1;
+    }
+  frame->at = low - 1;
+
+  return 1;
+}
+
+static grub_uint32_t
+grub_ext2_dx_block (struct grub_ext2_dx_frame *frame)
+{
+  return grub_le_to_cpu32 (frame->entries[frame->at].block) & 0x0fffffff;
+}
+
+/* Look NAME up in the hash tree directory DIRO, reading only the index
+   blocks on the way to its leaf.  Return 0 if the tree can not be used,
+   in which case the caller has to scan the directory instead.  */
+static int
+grub_ext2_dx_lookup (struct grub_fshelp_node *diro, const char *name,
+		     grub_fshelp_node_t *foundnode,
+		     enum grub_fshelp_filetype *foundtype)
+{
+  struct grub_ext2_data *data = diro->data;
+  grub_uint32_t blocksize = EXT2_BLOCK_SIZE (data);
+  grub_uint64_t nblocks;
+  struct grub_ext2_dx_frame frames[EXT2_DX_MAX_INDIRECT + 1];
+  struct grub_ext2_dx_root_info *info;
+  int namelen = grub_strlen (name);
+  int levels, level, version;
+  grub_uint32_t hash, block;
+  char *bufs, *leaf;
+  int ret = 0;
+
+  nblocks = (grub_le_to_cpu32 (diro->inode.size)
+	     | (((grub_uint64_t) grub_le_to_cpu32 (diro->inode.size_high))
+		<< 32)) >> LOG2_BLOCK_SIZE (data);
+  if (nblocks < 2 || namelen > MAX_NAMELEN)
+    return 0;
+
+  /* One buffer per index level, and one for the leaf.  */
+  bufs = grub_malloc ((EXT2_DX_MAX_INDIRECT + 2) * blocksize);
+  if (! bufs)
+    {
+      grub_errno = GRUB_ERR_NONE;
+      return 0;
+    }
+  leaf = bufs + (EXT2_DX_MAX_INDIRECT + 1) * blocksize;
+
+  if (grub_ext2_read_file (diro, 0, 0, 0, blocksize, bufs)
+      != (grub_ssize_t) blocksize)
+    goto fail;
+
+  /* The root block starts with "." and "..", 12 bytes each.  */
+  info = (struct grub_ext2_dx_root_info *) (bufs + 24);
+  version = info->hash_version;
+  levels = info->indirect_levels;
+  if (info->reserved_zero != 0 || info->info_length < sizeof (*info)
+      || version > EXT2_DX_HASH_TEA || levels > EXT2_DX_MAX_INDIRECT)
+    goto fail;
+  if (data->sblock.flags
+      & grub_cpu_to_le32_compile_time (EXT2_FLAGS_UNSIGNED_HASH))
+    version += EXT2_DX_HASH_LEGACY_UNSIGNED;
+
+  hash = grub_ext2_dx_hash (data, version, name, namelen);
+
+  if (! grub_ext2_dx_frame_init (&frames[0], bufs, 24 + info->info_length,
+				 blocksize, hash))
+    goto fail;
+
+  /* Index blocks below the root start with an empty 8-byte entry.  */
+  for (level = 1; level <= levels; level++)
+    {
+      char *buf = bufs + level * blocksize;
+
+      block = grub_ext2_dx_block (&frames[level - 1]);
+      if (block >= nblocks
+	  || grub_ext2_read_file (diro, 0, 0,
+				  (grub_off_t) block << LOG2_BLOCK_SIZE (data),
+				  blocksize, buf) != (grub_ssize_t) blocksize
+	  || ! grub_ext2_dx_frame_init (&frames[level], buf, 8, blocksize, hash))
+	goto fail;
+    }
+
+  while (1)
+    {
+      grub_uint32_t pos;
+
+      block = grub_ext2_dx_block (&frames[levels]);
+      if (block >= nblocks
+	  || grub_ext2_read_file (diro, 0, 0,
+				  (grub_off_t) block << LOG2_BLOCK_SIZE (data),
+				  blocksize, leaf) != (grub_ssize_t) blocksize)
+	goto fail;
+
+      for (pos = 0; pos + sizeof (struct ext2_dirent) <= blocksize; )
+	{
+	  struct ext2_dirent *dirent = (struct ext2_dirent *) (leaf + pos);
+	  grub_uint16_t direntlen = grub_le_to_cpu16 (dirent->direntlen);
+
+	  if (direntlen < sizeof (struct ext2_dirent)
+	      || pos + direntlen > blocksize
+	      || sizeof (struct ext2_dirent) + dirent->namelen > direntlen)
+	    goto fail;
+
+	  if (dirent->inode != 0 && dirent->namelen == namelen
+	      && grub_memcmp (dirent + 1, name, namelen) == 0)
 	    {
-	      /* The filetype can not be read from the dirent, read
-		 the inode to get more information.  */
-	      grub_ext2_read_inode (diro->data,
-                                    grub_le_to_cpu32 (dirent.inode),
-				    &fdiro->inode);
-	      if (grub_errno)
-		{
-		  grub_free (fdiro);
-		  return 0;
-		}
-
-	      fdiro->inode_read = 1;
-
-	      if ((grub_le_to_cpu16 (fdiro->inode.mode)
-		   & FILETYPE_INO_MASK) == FILETYPE_INO_DIRECTORY)
-		type = GRUB_FSHELP_DIR;
-	      else if ((grub_le_to_cpu16 (fdiro->inode.mode)
-			& FILETYPE_INO_MASK) == FILETYPE_INO_SYMLINK)
-		type = GRUB_FSHELP_SYMLINK;
-	      else if ((grub_le_to_cpu16 (fdiro->inode.mode)
-			& FILETYPE_INO_MASK) == FILETYPE_INO_REG)
-		type = GRUB_FSHELP_REG;
+	      *foundnode = grub_ext2_dirent_node (diro,
+						  grub_le_to_cpu32 (dirent->inode),
+						  dirent->filetype, foundtype);
+	      ret = 1;
+	      goto done;
 	    }
 
-	  if (hook (filename, type, fdiro, hook_data))
-	    return 1;
+	  pos += direntlen;
 	}
 
-      fpos += grub_le_to_cpu16 (dirent.direntlen);
+      /* Names with the same hash may spill into the following leaves,
+	 which then start with that hash.  */
+      for (level = levels; level >= 0; level--)
+	if (frames[level].at + 1 < frames[level].count)
+	  break;
+      if (level < 0)
+	break;
+
+      frames[level].at++;
+      if ((grub_le_to_cpu32 (frames[level].entries[frames[level].at].hash)
+	   & ~1U) != hash)
+	break;
+
+      for (level++; level <= levels; level++)
+	{
+	  char *buf = bufs + level * blocksize;
+
+	  block = grub_ext2_dx_block (&frames[level - 1]);
+	  if (block >= nblocks
+	      || grub_ext2_read_file (diro, 0, 0,
+				      (grub_off_t) block
+				      << LOG2_BLOCK_SIZE (data),
+				      blocksize, buf) != (grub_ssize_t) blocksize
+	      || ! grub_ext2_dx_frame_init (&frames[level], buf, 8,
+					    blocksize, hash))
+	    goto fail;
+	  frames[level].at = 0;
+	}
     }
 
-  return 0;
+  /* Not there.  */
+  ret = 1;
+  goto done;
+
+ fail:
+  grub_errno = GRUB_ERR_NONE;
+ done:
+  grub_free (bufs);
+  return ret;
+}
+
+/* Context for grub_ext2_lookup_file.  */
+struct grub_ext2_lookup_ctx
+{
+  const char *name;
+  grub_fshelp_node_t *foundnode;
+  enum grub_fshelp_filetype *foundtype;
+};
+
+/* Helper for grub_ext2_lookup_file.  */
+static int
+grub_ext2_lookup_iter (const char *filename,
+		       enum grub_fshelp_filetype filetype,
+		       grub_fshelp_node_t node, void *data)
+{
+  struct grub_ext2_lookup_ctx *ctx = data;
+
+  if (grub_strcmp (filename, ctx->name) != 0)
+    {
+      grub_free (node);
+      return 0;
+    }
+
+  *ctx->foundnode = node;
+  *ctx->foundtype = filetype;
+  return 1;
 }
 
+/* Find NAME in the directory DIR.  Hash tree directories go straight to
+   the leaf holding NAME, everything else is scanned.  */
+static grub_err_t
+grub_ext2_lookup_file (grub_fshelp_node_t dir, const char *name,
+		       grub_fshelp_node_t *foundnode,
+		       enum grub_fshelp_filetype *foundtype)
+{
+  struct grub_ext2_lookup_ctx ctx = {
+    .name = name,
+    .foundnode = foundnode,
+    .foundtype = foundtype
+  };
+
+  if (! dir->inode_read)
+    {
+      grub_ext2_read_inode (dir->data, dir->ino, &dir->inode);
+      if (grub_errno)
+	return grub_errno;
+      dir->inode_read = 1;
+    }
+
+  if ((dir->inode.flags & grub_cpu_to_le32_compile_time (EXT2_INDEX_FL))
+      && (dir->data->sblock.feature_compatibility
+	  & grub_cpu_to_le32_compile_time (EXT2_FEATURE_COMPAT_DIR_INDEX))
+      && grub_ext2_dx_lookup (dir, name, foundnode, foundtype))
+    return grub_errno;
+
+  grub_ext2_iterate_dir (dir, grub_ext2_lookup_iter, &ctx);
+  return grub_errno;
+}
+
+/* Nodes only point at their mount, so lookups can be kept across mounts.  */
+static grub_size_t
+grub_ext2_node_size (grub_fshelp_node_t node __attribute__ ((unused)))
+{
+  return sizeof (struct grub_fshelp_node);
+}
+
+static grub_uint64_t
+grub_ext2_node_ident (grub_fshelp_node_t node)
+{
+  return node->ino;
+}
+
+static void
+grub_ext2_node_attach (grub_fshelp_node_t node, grub_fshelp_node_t root)
+{
+  node->data = root->data;
+}
+
+static const struct grub_fshelp_cache_ops grub_ext2_cache_ops =
+  {
+    .node_size = grub_ext2_node_size,
+    .ident = grub_ext2_node_ident,
+    .attach = grub_ext2_node_attach
+  };
+
 /* Open a file named NAME and initialize FILE.  */
 static grub_err_t
 grub_ext2_open (struct grub_file *file, const char *name)
@@ -846,9 +1496,10 @@ grub_ext2_open (struct grub_file *file, const char *name)
       goto fail;
     }
 
-  err = grub_fshelp_find_file (name, &data->diropen, &fdiro,
-			       grub_ext2_iterate_dir,
-			       grub_ext2_read_symlink, GRUB_FSHELP_REG);
+  err = grub_fshelp_find_file_cached (name, &data->diropen, &fdiro,
+				      NULL, grub_ext2_lookup_file,
+				      grub_ext2_read_symlink, GRUB_FSHELP_REG,
+				      data->disk, &grub_ext2_cache_ops);
   if (err)
     goto fail;
 
@@ -900,6 +1551,21 @@ grub_ext2_read (grub_file_t file, char *buf, grub_size_t len)
 			      file->offset, len, buf);
 }
 
+static grub_err_t
+grub_ext2_map (grub_file_t file, grub_size_t len,
+	       grub_fs_extent_hook_t hook, void *hook_data)
+{
+  struct grub_ext2_data *data = (struct grub_ext2_data *) file->data;
+  struct grub_fshelp_node *node = &data->diropen;
+
+  return grub_fshelp_map_file_extents (node, file->offset, len,
+				       grub_ext2_read_block,
+				       grub_cpu_to_le32 (node->inode.size)
+				       | (((grub_off_t) grub_cpu_to_le32 (node->inode.size_high)) << 32),
+				       LOG2_EXT2_BLOCK_SIZE (data), 0,
+				       hook, hook_data);
+}
+
 
 /* Context for grub_ext2_dir.  */
 struct grub_ext2_dir_ctx
@@ -929,6 +1595,12 @@ grub_ext2_dir_iter (const char *filename, enum grub_fshelp_filetype filetype,
     {
       info.mtimeset = 1;
       info.mtime = grub_le_to_cpu32 (node->inode.mtime);
+      if ((filetype & GRUB_FSHELP_TYPE_MASK) == GRUB_FSHELP_REG)
+	{
+	  info.sizeset = 1;
+	  info.size = grub_le_to_cpu32 (node->inode.size);
+	  info.size |= ((grub_uint64_t) grub_le_to_cpu32 (node->inode.size_high)) << 32;
+	}
     }
 
   info.dir = ((filetype & GRUB_FSHELP_TYPE_MASK) == GRUB_FSHELP_DIR);
@@ -952,9 +1624,10 @@ grub_ext2_dir (grub_device_t device, const char *path, grub_fs_dir_hook_t hook,
   if (! ctx.data)
     goto fail;
 
-  grub_fshelp_find_file (path, &ctx.data->diropen, &fdiro,
-			 grub_ext2_iterate_dir, grub_ext2_read_symlink,
-			 GRUB_FSHELP_DIR);
+  grub_fshelp_find_file_cached (path, &ctx.data->diropen, &fdiro,
+				NULL, grub_ext2_lookup_file,
+				grub_ext2_read_symlink, GRUB_FSHELP_DIR,
+				ctx.data->disk, &grub_ext2_cache_ops);
   if (grub_errno)
     goto fail;
 
@@ -1048,6 +1721,12 @@ grub_ext2_mtime (grub_device_t device, grub_int32_t *tm)
 
 
 
+static const struct grub_fs_magic grub_ext2_magics[] =
+  {
+    { 1024 + 56, 2, "\x53\xef" },
+    { 0, 0, 0 }
+  };
+
 static struct grub_fs grub_ext2_fs =
   {
     .name = "ext2",
@@ -1055,9 +1734,11 @@ static struct grub_fs grub_ext2_fs =
     .open = grub_ext2_open,
     .read = grub_ext2_read,
     .close = grub_ext2_close,
+    .map = grub_ext2_map,
     .label = grub_ext2_label,
     .uuid = grub_ext2_uuid,
     .mtime = grub_ext2_mtime,
+    .magics = grub_ext2_magics,
 #ifdef GRUB_UTIL
     .reserved_first_sector = 1,
     .blocklist_install = 1,
@@ -1068,10 +1749,13 @@ static struct grub_fs grub_ext2_fs =
 GRUB_MOD_INIT(ext2)
 {
   grub_fs_register (&grub_ext2_fs);
+  grub_reclaim_register (&block_cache_reclaim);
   my_mod = mod;
 }
 
 GRUB_MOD_FINI(ext2)
 {
   grub_fs_unregister (&grub_ext2_fs);
+  grub_reclaim_unregister (&block_cache_reclaim);
+  block_cache_flush ();
 }
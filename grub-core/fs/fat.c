@@ -19,6 +19,7 @@
 
 #include <grub/fs.h>
 #include <grub/disk.h>
+#include <grub/partition.h>
 #include <grub/file.h>
 #include <grub/types.h>
 #include <grub/misc.h>
@@ -161,6 +162,9 @@ typedef struct grub_fat_dir_entry grub_fat_dir_node_t;
 
 #endif
 
+/* How much of the FAT to read at once when following a cluster chain.  */
+#define GRUB_FAT_CACHE_SIZE 4096
+
 struct grub_fat_data
 {
   int logical_sector_bits;
@@ -182,6 +186,11 @@ struct grub_fat_data
   grub_uint32_t num_clusters;
 
   grub_uint32_t uuid;
+
+  /* The part of the FAT last read, at FAT_CACHE_START bytes into it.  */
+  grub_uint32_t fat_cache_start;
+  grub_uint32_t fat_cache_len;
+  grub_uint8_t fat_cache[GRUB_FAT_CACHE_SIZE];
 };
 
 struct grub_fshelp_node {
@@ -234,6 +243,9 @@ grub_fat_mount (grub_disk_t disk)
   if (! data)
     goto fail;
 
+  data->fat_cache_start = 0;
+  data->fat_cache_len = 0;
+
   /* Read the BPB.  */
   if (grub_disk_read (disk, 0, 0, sizeof (bpb), &bpb))
     goto fail;
@@ -444,16 +456,115 @@ grub_fat_mount (grub_disk_t disk)
   return 0;
 }
 
+/* Transfer SIZE bytes at SECTOR and OFFSET on DISK, which hold the file
+   data at POS.  Read them into BUF, or if EXTENT_HOOK is set, just
+   report their location to it.  */
+static grub_err_t
+grub_fat_transfer (grub_disk_t disk, grub_disk_addr_t sector,
+		   grub_off_t offset, grub_size_t size, char *buf,
+		   grub_off_t pos, grub_disk_read_hook_t read_hook,
+		   void *read_hook_data, grub_fs_extent_hook_t extent_hook,
+		   void *extent_hook_data)
+{
+  if (extent_hook)
+    {
+      struct grub_fs_extent extent = {
+	.offset = pos,
+	.length = size,
+	.sector = sector,
+	.sector_offset = offset,
+	.hole = 0
+      };
+
+      return extent_hook (&extent, extent_hook_data);
+    }
+
+  disk->read_hook = read_hook;
+  disk->read_hook_data = read_hook_data;
+  grub_disk_read (disk, sector, offset, size, buf);
+  disk->read_hook = 0;
+  return grub_errno;
+}
+
+/* Set NEXT to the FAT entry of CLUSTER.  */
+static grub_err_t
+grub_fat_next_cluster (grub_disk_t disk, struct grub_fat_data *data,
+		       grub_uint32_t cluster, grub_uint32_t *next)
+{
+  grub_uint32_t fat_offset, fat_len, entry_len;
+  grub_uint32_t value = 0;
+
+  switch (data->fat_size)
+    {
+    case 32:
+      fat_offset = cluster << 2;
+      break;
+    case 16:
+      fat_offset = cluster << 1;
+      break;
+    default:
+      /* case 12: */
+      fat_offset = cluster + (cluster >> 1);
+      break;
+    }
+  entry_len = (data->fat_size + 7) >> 3;
+
+  /* Read the FAT.  */
+  if (fat_offset < data->fat_cache_start
+      || (fat_offset + entry_len
+	  > data->fat_cache_start + data->fat_cache_len))
+    {
+      data->fat_cache_start = fat_offset & ~(GRUB_DISK_SECTOR_SIZE - 1);
+      fat_len = data->sectors_per_fat << GRUB_DISK_SECTOR_BITS;
+      data->fat_cache_len = sizeof (data->fat_cache);
+      if (data->fat_cache_start + data->fat_cache_len > fat_len)
+	data->fat_cache_len = fat_len - data->fat_cache_start;
+      if (data->fat_cache_len < fat_offset - data->fat_cache_start + entry_len)
+	data->fat_cache_len = fat_offset - data->fat_cache_start + entry_len;
+
+      if (grub_disk_read (disk, data->fat_sector, data->fat_cache_start,
+			  data->fat_cache_len, data->fat_cache))
+	{
+	  data->fat_cache_len = 0;
+	  return grub_errno;
+	}
+    }
+
+  grub_memcpy (&value, data->fat_cache + fat_offset - data->fat_cache_start,
+	       entry_len);
+  value = grub_le_to_cpu32 (value);
+  switch (data->fat_size)
+    {
+    case 16:
+      value &= 0xFFFF;
+      break;
+    case 12:
+      if (cluster & 1)
+	value >>= 4;
+
+      value &= 0x0FFF;
+      break;
+    }
+
+  *next = value;
+  return GRUB_ERR_NONE;
+}
+
+/* Read LEN bytes of NODE at OFFSET into BUF.  If EXTENT_HOOK is set,
+   nothing is read; the disk location of the data is passed to the hook
+   instead.  */
 static grub_ssize_t
-grub_fat_read_data (grub_disk_t disk, grub_fshelp_node_t node,
+grub_fat_walk_data (grub_disk_t disk, grub_fshelp_node_t node,
 		    grub_disk_read_hook_t read_hook, void *read_hook_data,
-		    grub_off_t offset, grub_size_t len, char *buf)
+		    grub_off_t offset, grub_size_t len, char *buf,
+		    grub_fs_extent_hook_t extent_hook, void *extent_hook_data)
 {
   grub_size_t size;
   grub_uint32_t logical_cluster;
   unsigned logical_cluster_bits;
   grub_ssize_t ret = 0;
   unsigned long sector;
+  grub_off_t pos = offset;
 
 #ifndef MODE_EXFAT
   /* This is a special case. FAT12 and FAT16 doesn't have the root directory
@@ -464,7 +575,8 @@ grub_fat_read_data (grub_disk_t disk, grub_fshelp_node_t node,
       if (size > len)
 	size = len;
 
-      if (grub_disk_read (disk, node->data->root_sector, offset, size, buf))
+      if (grub_fat_transfer (disk, node->data->root_sector, offset, size,
+			     buf, pos, 0, 0, extent_hook, extent_hook_data))
 	return -1;
 
       return size;
@@ -474,17 +586,21 @@ grub_fat_read_data (grub_disk_t disk, grub_fshelp_node_t node,
 #ifdef MODE_EXFAT
   if (node->is_contiguous)
     {
-      /* Read the data here.  */
+      /* The clusters of the file follow each other, so there is no chain
+	 to walk and all of it is transferred at once.  */
+      if (offset >= (grub_uint64_t) node->file_size)
+	return 0;
+      if (len > node->file_size - offset)
+	len = node->file_size - offset;
+
       sector = (node->data->cluster_sector
 		+ ((node->file_cluster - 2)
 		   << node->data->cluster_bits));
 
-      disk->read_hook = read_hook;
-      disk->read_hook_data = read_hook_data;
-      grub_disk_read (disk, sector + (offset >> GRUB_DISK_SECTOR_BITS),
-		      offset & (GRUB_DISK_SECTOR_SIZE - 1), len, buf);
-      disk->read_hook = 0;
-      if (grub_errno)
+      if (grub_fat_transfer (disk, sector + (offset >> GRUB_DISK_SECTOR_BITS),
+			     offset & (GRUB_DISK_SECTOR_SIZE - 1), len, buf,
+			     pos, read_hook, read_hook_data,
+			     extent_hook, extent_hook_data))
 	return -1;
 
       return len;
@@ -509,42 +625,11 @@ grub_fat_read_data (grub_disk_t disk, grub_fshelp_node_t node,
 	{
 	  /* Find next cluster.  */
 	  grub_uint32_t next_cluster;
-	  grub_uint32_t fat_offset;
 
-	  switch (node->data->fat_size)
-	    {
-	    case 32:
-	      fat_offset = node->cur_cluster << 2;
-	      break;
-	    case 16:
-	      fat_offset = node->cur_cluster << 1;
-	      break;
-	    default:
-	      /* case 12: */
-	      fat_offset = node->cur_cluster + (node->cur_cluster >> 1);
-	      break;
-	    }
-
-	  /* Read the FAT.  */
-	  if (grub_disk_read (disk, node->data->fat_sector, fat_offset,
-			      (node->data->fat_size + 7) >> 3,
-			      (char *) &next_cluster))
+	  if (grub_fat_next_cluster (disk, node->data, node->cur_cluster,
+				     &next_cluster))
 	    return -1;
 
-	  next_cluster = grub_le_to_cpu32 (next_cluster);
-	  switch (node->data->fat_size)
-	    {
-	    case 16:
-	      next_cluster &= 0xFFFF;
-	      break;
-	    case 12:
-	      if (node->cur_cluster & 1)
-		next_cluster >>= 4;
-
-	      next_cluster &= 0x0FFF;
-	      break;
-	    }
-
 	  grub_dprintf ("fat", "fat_size=%d, next_cluster=%u\n",
 			node->data->fat_size, next_cluster);
 
@@ -568,18 +653,38 @@ grub_fat_read_data (grub_disk_t disk, grub_fshelp_node_t node,
 		+ ((node->cur_cluster - 2)
 		   << node->data->cluster_bits));
       size = (1 << logical_cluster_bits) - offset;
+
+      /* Take in the clusters that directly follow on the disk, so that
+	 they are transferred at once.  */
+      while (size < len)
+	{
+	  grub_uint32_t next_cluster;
+
+	  if (grub_fat_next_cluster (disk, node->data, node->cur_cluster,
+				     &next_cluster))
+	    return -1;
+	  if (next_cluster != node->cur_cluster + 1
+	      || next_cluster >= node->data->num_clusters)
+	    break;
+
+	  node->cur_cluster = next_cluster;
+	  node->cur_cluster_num++;
+	  logical_cluster++;
+	  size += 1 << logical_cluster_bits;
+	}
+
       if (size > len)
 	size = len;
 
-      disk->read_hook = read_hook;
-      disk->read_hook_data = read_hook_data;
-      grub_disk_read (disk, sector, offset, size, buf);
-      disk->read_hook = 0;
-      if (grub_errno)
+      if (grub_fat_transfer (disk, sector, offset, size, buf, pos,
+			     read_hook, read_hook_data,
+			     extent_hook, extent_hook_data))
 	return -1;
 
       len -= size;
-      buf += size;
+      if (buf)
+	buf += size;
+      pos += size;
       ret += size;
       logical_cluster++;
       offset = 0;
@@ -588,6 +693,15 @@ grub_fat_read_data (grub_disk_t disk, grub_fshelp_node_t node,
   return ret;
 }
 
+static grub_ssize_t
+grub_fat_read_data (grub_disk_t disk, grub_fshelp_node_t node,
+		    grub_disk_read_hook_t read_hook, void *read_hook_data,
+		    grub_off_t offset, grub_size_t len, char *buf)
+{
+  return grub_fat_walk_data (disk, node, read_hook, read_hook_data,
+			     offset, len, buf, 0, 0);
+}
+
 struct grub_fat_iterate_context
 {
 #ifdef MODE_EXFAT
@@ -598,12 +712,19 @@ struct grub_fat_iterate_context
   char *filename;
   grub_uint16_t *unibuf;
   grub_ssize_t offset;
+  /* The cached entries of the directory and the next one to return.  */
+  int started;
+  struct grub_fat_dir_cache *listing;
+  grub_size_t pos;
 };
 
 static grub_err_t
 grub_fat_iterate_init (struct grub_fat_iterate_context *ctxt)
 {
   ctxt->offset = -sizeof (struct grub_fat_dir_entry);
+  ctxt->started = 0;
+  ctxt->listing = NULL;
+  ctxt->pos = 0;
 
 #ifndef MODE_EXFAT
   /* Allocate space enough to hold a long name.  */
@@ -623,16 +744,19 @@ grub_fat_iterate_init (struct grub_fat_iterate_context *ctxt)
   return GRUB_ERR_NONE;
 }
 
+static void dir_cache_release (struct grub_fat_dir_cache *listing);
+
 static void
 grub_fat_iterate_fini (struct grub_fat_iterate_context *ctxt)
 {
+  dir_cache_release (ctxt->listing);
   grub_free (ctxt->filename);
   grub_free (ctxt->unibuf);
 }
 
 #ifdef MODE_EXFAT
 static grub_err_t
-grub_fat_iterate_dir_next (grub_fshelp_node_t node,
+grub_fat_iterate_dir_read (grub_fshelp_node_t node,
 			   struct grub_fat_iterate_context *ctxt)
 {
   grub_memset (&ctxt->dir, 0, sizeof (ctxt->dir));
@@ -681,8 +805,8 @@ grub_fat_iterate_dir_next (grub_fshelp_node_t node,
 		  ctxt->dir.file_size
 		    = grub_cpu_to_le64 (sec.type_specific.stream_extension.file_size);
 		  ctxt->dir.have_stream = 1;
-		  ctxt->dir.is_contiguous = !!(dir.type_specific.stream_extension.flags
-					       & grub_cpu_to_le16_compile_time (FLAG_CONTIGUOUS));
+		  ctxt->dir.is_contiguous = !!(sec.type_specific.stream_extension.flags
+					       & FLAG_CONTIGUOUS);
 		  break;
 		case 0xc1:
 		  {
@@ -728,7 +852,7 @@ grub_fat_iterate_dir_next (grub_fshelp_node_t node,
 #else
 
 static grub_err_t
-grub_fat_iterate_dir_next (grub_fshelp_node_t node,
+grub_fat_iterate_dir_read (grub_fshelp_node_t node,
 			   struct grub_fat_iterate_context *ctxt)
 {
   char *filep = 0;
@@ -854,6 +978,169 @@ grub_fat_iterate_dir_next (grub_fshelp_node_t node,
 
 #endif
 
+/* Volumes are mounted again for every operation and every lookup lists
+   its directory from the start, so the entries of the directories read
+   last are kept across mounts.  */
+#define GRUB_FAT_DIR_CACHE_SIZE 8
+
+struct grub_fat_dir_cache_entry
+{
+  grub_fat_dir_node_t dir;
+  char *filename;
+};
+
+struct grub_fat_dir_cache
+{
+  unsigned long dev_id;
+  unsigned long disk_id;
+  grub_disk_addr_t part_start;
+  grub_uint32_t cluster;
+  grub_size_t count;
+  struct grub_fat_dir_cache_entry *entries;
+  /* Walks in progress and whether the cache still holds it.  */
+  unsigned refs;
+  int cached;
+};
+
+static struct grub_fat_dir_cache *dir_cache[GRUB_FAT_DIR_CACHE_SIZE];
+static unsigned long dir_cache_generation;
+
+static void
+dir_cache_free (struct grub_fat_dir_cache *listing)
+{
+  grub_size_t i;
+
+  for (i = 0; i < listing->count; i++)
+    grub_free (listing->entries[i].filename);
+  grub_free (listing->entries);
+  grub_free (listing);
+}
+
+static void
+dir_cache_evict (unsigned slot)
+{
+  struct grub_fat_dir_cache *listing = dir_cache[slot];
+
+  dir_cache[slot] = NULL;
+  if (!listing)
+    return;
+  listing->cached = 0;
+  if (!listing->refs)
+    dir_cache_free (listing);
+}
+
+static void
+dir_cache_release (struct grub_fat_dir_cache *listing)
+{
+  if (listing && --listing->refs == 0 && !listing->cached)
+    dir_cache_free (listing);
+}
+
+/* Return the entries of the directory NODE with a reference held, or
+   NULL if it has to be read entry by entry.  */
+static struct grub_fat_dir_cache *
+dir_cache_get (grub_fshelp_node_t node)
+{
+  grub_disk_addr_t part_start = grub_partition_get_start (node->disk->partition);
+  struct grub_fat_iterate_context ctxt;
+  struct grub_fat_dir_cache *listing;
+  grub_size_t alloc = 0;
+  unsigned slot, i;
+  grub_err_t err;
+
+  if (dir_cache_generation != grub_disk_generation)
+    {
+      for (i = 0; i < GRUB_FAT_DIR_CACHE_SIZE; i++)
+	dir_cache_evict (i);
+      dir_cache_generation = grub_disk_generation;
+    }
+
+  slot = node->file_cluster % GRUB_FAT_DIR_CACHE_SIZE;
+  listing = dir_cache[slot];
+  if (listing && listing->cluster == node->file_cluster
+      && listing->dev_id == node->disk->dev->id
+      && listing->disk_id == node->disk->id
+      && listing->part_start == part_start)
+    {
+      listing->refs++;
+      return listing;
+    }
+
+  listing = grub_zalloc (sizeof (*listing));
+  if (!listing)
+    goto fail;
+
+  if (grub_fat_iterate_init (&ctxt))
+    goto fail;
+
+  while (!(err = grub_fat_iterate_dir_read (node, &ctxt)))
+    {
+      struct grub_fat_dir_cache_entry *entry;
+
+      if (listing->count == alloc)
+	{
+	  alloc = alloc ? 2 * alloc : 32;
+	  entry = grub_realloc (listing->entries, alloc * sizeof (*entry));
+	  if (!entry)
+	    break;
+	  listing->entries = entry;
+	}
+
+      entry = &listing->entries[listing->count];
+      entry->filename = grub_strdup (ctxt.filename);
+      if (!entry->filename)
+	break;
+      entry->dir = ctxt.dir;
+      listing->count++;
+    }
+
+  grub_fat_iterate_fini (&ctxt);
+  if (err != GRUB_ERR_EOF)
+    goto fail;
+
+  listing->dev_id = node->disk->dev->id;
+  listing->disk_id = node->disk->id;
+  listing->part_start = part_start;
+  listing->cluster = node->file_cluster;
+  listing->refs = 1;
+  listing->cached = 1;
+  dir_cache_evict (slot);
+  dir_cache[slot] = listing;
+
+  return listing;
+
+ fail:
+  /* Reading entry by entry gets as far as the directory is sane.  */
+  if (listing)
+    dir_cache_free (listing);
+  grub_errno = GRUB_ERR_NONE;
+  return NULL;
+}
+
+static grub_err_t
+grub_fat_iterate_dir_next (grub_fshelp_node_t node,
+			   struct grub_fat_iterate_context *ctxt)
+{
+  struct grub_fat_dir_cache_entry *entry;
+
+  if (!ctxt->started)
+    {
+      ctxt->started = 1;
+      ctxt->listing = dir_cache_get (node);
+    }
+
+  if (!ctxt->listing)
+    return grub_fat_iterate_dir_read (node, ctxt);
+
+  if (ctxt->pos == ctxt->listing->count)
+    return GRUB_ERR_EOF;
+
+  entry = &ctxt->listing->entries[ctxt->pos++];
+  ctxt->dir = entry->dir;
+  grub_strcpy (ctxt->filename, entry->filename);
+  return GRUB_ERR_NONE;
+}
+
 static grub_err_t lookup_file (grub_fshelp_node_t node,
 			       const char *name,
 			       grub_fshelp_node_t *foundnode,
@@ -881,7 +1168,10 @@ static grub_err_t lookup_file (grub_fshelp_node_t node,
 	{
 	  *foundnode = grub_malloc (sizeof (struct grub_fshelp_node));
 	  if (!*foundnode)
-	    return grub_errno;
+	    {
+	      grub_fat_iterate_fini (&ctxt);
+	      return grub_errno;
+	    }
 	  (*foundnode)->attr = ctxt.dir.attr;
 #ifdef MODE_EXFAT
 	  (*foundnode)->file_size = ctxt.dir.file_size;
@@ -914,6 +1204,33 @@ static grub_err_t lookup_file (grub_fshelp_node_t node,
 
 }
 
+/* Nodes only point at their mount, so lookups can be kept across mounts.  */
+static grub_size_t
+grub_fat_node_size (grub_fshelp_node_t node __attribute__ ((unused)))
+{
+  return sizeof (struct grub_fshelp_node);
+}
+
+static grub_uint64_t
+grub_fat_node_ident (grub_fshelp_node_t node)
+{
+  return node->file_cluster;
+}
+
+static void
+grub_fat_node_attach (grub_fshelp_node_t node, grub_fshelp_node_t root)
+{
+  node->data = root->data;
+  node->disk = root->disk;
+}
+
+static const struct grub_fshelp_cache_ops grub_fat_cache_ops =
+  {
+    .node_size = grub_fat_node_size,
+    .ident = grub_fat_node_ident,
+    .attach = grub_fat_node_attach
+  };
+
 static grub_err_t
 grub_fat_dir (grub_device_t device, const char *path, grub_fs_dir_hook_t hook,
 	      void *hook_data)
@@ -943,7 +1260,9 @@ grub_fat_dir (grub_device_t device, const char *path, grub_fs_dir_hook_t hook,
 #endif
   };
 
-  err = grub_fshelp_find_file_lookup (path, &root, &found, lookup_file, NULL, GRUB_FSHELP_DIR);
+  err = grub_fshelp_find_file_cached (path, &root, &found, NULL, lookup_file,
+				      NULL, GRUB_FSHELP_DIR, disk,
+				      &grub_fat_cache_ops);
   if (err)
     goto fail;
 
@@ -961,10 +1280,13 @@ grub_fat_dir (grub_device_t device, const char *path, grub_fs_dir_hook_t hook,
 #ifdef MODE_EXFAT
       if (!ctxt.dir.have_stream)
 	continue;
+      info.size = ctxt.dir.file_size;
 #else
       if (ctxt.dir.attr & GRUB_FAT_ATTR_VOLUME_ID)
 	continue;
+      info.size = grub_le_to_cpu32 (ctxt.dir.file_size);
 #endif
+      info.sizeset = !info.dir;
 
       if (hook (ctxt.filename, &info, hook_data))
 	break;
@@ -1011,7 +1333,9 @@ grub_fat_open (grub_file_t file, const char *name)
 #endif
   };
 
-  err = grub_fshelp_find_file_lookup (name, &root, &found, lookup_file, NULL, GRUB_FSHELP_REG);
+  err = grub_fshelp_find_file_cached (name, &root, &found, NULL, lookup_file,
+				      NULL, GRUB_FSHELP_REG, disk,
+				      &grub_fat_cache_ops);
   if (err)
     goto fail;
 
@@ -1040,6 +1364,23 @@ grub_fat_read (grub_file_t file, char *buf, grub_size_t len)
 			     file->offset, len, buf);
 }
 
+static grub_err_t
+grub_fat_map (grub_file_t file, grub_size_t len,
+	      grub_fs_extent_hook_t hook, void *hook_data)
+{
+  grub_ssize_t res;
+
+  res = grub_fat_walk_data (file->device->disk, file->data, 0, 0,
+			    file->offset, len, 0, hook, hook_data);
+  if (res < 0)
+    return grub_errno;
+  /* The cluster chain ended before the directory entry's size.  */
+  if ((grub_size_t) res != len)
+    return grub_error (GRUB_ERR_BAD_FS, "file shorter than its size");
+
+  return GRUB_ERR_NONE;
+}
+
 static grub_err_t
 grub_fat_close (grub_file_t file)
 {
@@ -1229,6 +1570,7 @@ static struct grub_fs grub_fat_fs =
     .open = grub_fat_open,
     .read = grub_fat_read,
     .close = grub_fat_close,
+    .map = grub_fat_map,
     .label = grub_fat_label,
     .uuid = grub_fat_uuid,
 #ifdef GRUB_UTIL
@@ -1259,6 +1601,10 @@ GRUB_MOD_FINI(exfat)
 GRUB_MOD_FINI(fat)
 #endif
 {
+  unsigned i;
+
   grub_fs_unregister (&grub_fat_fs);
+  for (i = 0; i < GRUB_FAT_DIR_CACHE_SIZE; i++)
+    dir_cache_evict (i);
 }
 
@@ -24,6 +24,7 @@
 #include <grub/fshelp.h>
 #include <grub/dl.h>
 #include <grub/i18n.h>
+#include <grub/partition.h>
 
 GRUB_MOD_LICENSE ("GPLv3+");
 
@@ -36,6 +37,28 @@ typedef grub_err_t (*lookup_file_func) (grub_fshelp_node_t dir,
 					enum grub_fshelp_filetype *foundtype);
 typedef char *(*read_symlink_func) (grub_fshelp_node_t node);
 
+/* Number of remembered lookups.  The table is direct-mapped: a new
+   entry replaces whatever hashed to the same slot.  */
+#define DENTRY_CACHE_SIZE 256
+
+/* The result of looking up NAME in the directory PARENT of a filesystem
+   on a disk, kept across mounts.  NODE is NULL if NAME does not exist.  */
+struct dentry
+{
+  const struct grub_fshelp_cache_ops *ops;
+  unsigned long dev_id;
+  unsigned long disk_id;
+  grub_disk_addr_t start;
+  grub_uint64_t parent;
+  char *name;
+  grub_fshelp_node_t node;
+  grub_size_t node_size;
+  enum grub_fshelp_filetype type;
+};
+
+static struct dentry *dentry_cache[DENTRY_CACHE_SIZE];
+static unsigned long dentry_cache_generation;
+
 struct stack_element {
   struct stack_element *parent;
   grub_fshelp_node_t node;
@@ -54,8 +77,121 @@ struct grub_fshelp_find_file_ctx
 
   /* Current file being traversed and its parents.  */
   struct stack_element *currnode;
+
+  /* Where to remember lookups, if the filesystem allows it.  */
+  grub_disk_t disk;
+  const struct grub_fshelp_cache_ops *cache_ops;
 };
 
+static void
+dentry_free (struct dentry *d)
+{
+  if (!d)
+    return;
+  grub_free (d->name);
+  grub_free (d->node);
+  grub_free (d);
+}
+
+static unsigned
+dentry_slot (struct grub_fshelp_find_file_ctx *ctx, grub_uint64_t parent,
+	     const char *name)
+{
+  grub_uint32_t h = ctx->disk->id * 31 + ctx->disk->dev->id;
+
+  h = h * 31 + (grub_uint32_t) parent + (grub_uint32_t) (parent >> 32);
+  for (; *name; name++)
+    h = h * 31 + (grub_uint8_t) *name;
+  return h % DENTRY_CACHE_SIZE;
+}
+
+/* Look NAME up in the directory PARENT through the cache.  Return 1 and
+   set FOUNDNODE (NULL if NAME is known not to exist) and FOUNDTYPE on a
+   hit.  */
+static int
+dentry_lookup (struct grub_fshelp_find_file_ctx *ctx,
+	       grub_fshelp_node_t parent, const char *name,
+	       grub_fshelp_node_t *foundnode,
+	       enum grub_fshelp_filetype *foundtype)
+{
+  grub_uint64_t ident;
+  struct dentry *d;
+  unsigned i;
+
+  if (dentry_cache_generation != grub_disk_generation)
+    {
+      for (i = 0; i < DENTRY_CACHE_SIZE; i++)
+	{
+	  dentry_free (dentry_cache[i]);
+	  dentry_cache[i] = 0;
+	}
+      dentry_cache_generation = grub_disk_generation;
+    }
+
+  ident = ctx->cache_ops->ident (parent);
+  d = dentry_cache[dentry_slot (ctx, ident, name)];
+  if (!d || d->ops != ctx->cache_ops || d->parent != ident
+      || d->dev_id != ctx->disk->dev->id || d->disk_id != ctx->disk->id
+      || d->start != grub_partition_get_start (ctx->disk->partition)
+      || grub_strcmp (d->name, name) != 0)
+    return 0;
+
+  *foundnode = 0;
+  *foundtype = d->type;
+  if (!d->node)
+    return 1;
+
+  *foundnode = grub_malloc (d->node_size);
+  if (!*foundnode)
+    {
+      grub_errno = GRUB_ERR_NONE;
+      return 0;
+    }
+  grub_memcpy (*foundnode, d->node, d->node_size);
+  ctx->cache_ops->attach (*foundnode, ctx->rootnode);
+  return 1;
+}
+
+static void
+dentry_store (struct grub_fshelp_find_file_ctx *ctx,
+	      grub_fshelp_node_t parent, const char *name,
+	      grub_fshelp_node_t foundnode,
+	      enum grub_fshelp_filetype foundtype)
+{
+  struct dentry *d;
+  unsigned slot;
+
+  d = grub_zalloc (sizeof (*d));
+  if (!d)
+    goto fail;
+  d->name = grub_strdup (name);
+  if (!d->name)
+    goto fail;
+  if (foundnode)
+    {
+      d->node_size = ctx->cache_ops->node_size (foundnode);
+      d->node = grub_malloc (d->node_size);
+      if (!d->node)
+	goto fail;
+      grub_memcpy (d->node, foundnode, d->node_size);
+    }
+  d->ops = ctx->cache_ops;
+  d->dev_id = ctx->disk->dev->id;
+  d->disk_id = ctx->disk->id;
+  d->start = grub_partition_get_start (ctx->disk->partition);
+  d->parent = ctx->cache_ops->ident (parent);
+  d->type = foundtype;
+
+  slot = dentry_slot (ctx, d->parent, name);
+  dentry_free (dentry_cache[slot]);
+  dentry_cache[slot] = d;
+  return;
+
+ fail:
+  dentry_free (d);
+  grub_errno = GRUB_ERR_NONE;
+}
+
 /* Helper for find_file_iter.  */
 static void
 free_node (grub_fshelp_node_t node, struct grub_fshelp_find_file_ctx *ctx)
@@ -202,10 +338,19 @@ find_file (char *currpath,
       /* Iterate over the directory.  */
       c = *next;
       *next = '\0';
-      if (lookup_file)
-	err = lookup_file (ctx->currnode->node, name, &foundnode, &foundtype);
-      else
-	err = directory_find_file (ctx->currnode->node, name, &foundnode, &foundtype, iterate_dir);
+      err = GRUB_ERR_NONE;
+      if (!ctx->cache_ops
+	  || !dentry_lookup (ctx, ctx->currnode->node, name,
+			     &foundnode, &foundtype))
+	{
+	  if (lookup_file)
+	    err = lookup_file (ctx->currnode->node, name, &foundnode, &foundtype);
+	  else
+	    err = directory_find_file (ctx->currnode->node, name, &foundnode, &foundtype, iterate_dir);
+	  if (!err && ctx->cache_ops && foundnode != ctx->rootnode)
+	    dentry_store (ctx, ctx->currnode->node, name,
+			  foundnode, foundtype);
+	}
       *next = c;
 
       if (err)
@@ -264,13 +409,17 @@ grub_fshelp_find_file_real (const char *path, grub_fshelp_node_t rootnode,
 			    iterate_dir_func iterate_dir,
 			    lookup_file_func lookup_file,
 			    read_symlink_func read_symlink,
-			    enum grub_fshelp_filetype expecttype)
+			    enum grub_fshelp_filetype expecttype,
+			    grub_disk_t disk,
+			    const struct grub_fshelp_cache_ops *cache_ops)
 {
   struct grub_fshelp_find_file_ctx ctx = {
     .path = path,
     .rootnode = rootnode,
     .symlinknest = 0,
-    .currnode = 0
+    .currnode = 0,
+    .disk = disk,
+    .cache_ops = cache_ops
   };
   grub_err_t err;
   enum grub_fshelp_filetype foundtype;
@@ -327,7 +476,7 @@ grub_fshelp_find_file (const char *path, grub_fshelp_node_t rootnode,
 {
   return grub_fshelp_find_file_real (path, rootnode, foundnode,
 				     iterate_dir, NULL, 
-				     read_symlink, expecttype);
+				     read_symlink, expecttype, NULL, NULL);
 
 }
 
@@ -340,27 +489,66 @@ grub_fshelp_find_file_lookup (const char *path, grub_fshelp_node_t rootnode,
 {
   return grub_fshelp_find_file_real (path, rootnode, foundnode,
 				     NULL, lookup_file, 
-				     read_symlink, expecttype);
+				     read_symlink, expecttype, NULL, NULL);
 
 }
 
-/* Read LEN bytes from the file NODE on disk DISK into the buffer BUF,
-   beginning with the block POS.  READ_HOOK should be set before
-   reading a block from the file.  READ_HOOK_DATA is passed through as
-   the DATA argument to READ_HOOK.  GET_BLOCK is used to translate
-   file blocks to disk blocks.  The file is FILESIZE bytes big and the
-   blocks have a size of LOG2BLOCKSIZE (in log2).  */
-grub_ssize_t
-grub_fshelp_read_file (grub_disk_t disk, grub_fshelp_node_t node,
-		       grub_disk_read_hook_t read_hook, void *read_hook_data,
-		       grub_off_t pos, grub_size_t len, char *buf,
-		       grub_disk_addr_t (*get_block) (grub_fshelp_node_t node,
-                                                      grub_disk_addr_t block),
-		       grub_off_t filesize, int log2blocksize,
-		       grub_disk_addr_t blocks_start)
+/* Like grub_fshelp_find_file (if ITERATE_DIR is set) or
+   grub_fshelp_find_file_lookup (if LOOKUP_FILE is), but remember every
+   lookup on DISK, including failed ones, so that later opens of the same
+   paths on any mount of this filesystem skip the directory scans.  */
+grub_err_t
+grub_fshelp_find_file_cached (const char *path, grub_fshelp_node_t rootnode,
+			      grub_fshelp_node_t *foundnode,
+			      iterate_dir_func iterate_dir,
+			      lookup_file_func lookup_file,
+			      read_symlink_func read_symlink,
+			      enum grub_fshelp_filetype expecttype,
+			      grub_disk_t disk,
+			      const struct grub_fshelp_cache_ops *cache_ops)
 {
-  grub_disk_addr_t i, blockcnt;
-  int blocksize = 1 << (log2blocksize + GRUB_DISK_SECTOR_BITS);
+  return grub_fshelp_find_file_real (path, rootnode, foundnode,
+				     iterate_dir, lookup_file,
+				     read_symlink, expecttype, disk,
+				     cache_ops);
+}
+
+/* Map the file block BLOCK of NODE with GET_EXTENT if the filesystem
+   can describe runs of blocks, else with GET_BLOCK.  Return the disk
+   block, 0 for a hole, and store in *COUNT how many blocks are mapped
+   the same way, limited to the LAST file block.  */
+static grub_disk_addr_t
+get_run (grub_fshelp_node_t node, grub_disk_addr_t block,
+	 grub_disk_addr_t last,
+	 grub_disk_addr_t (*get_block) (grub_fshelp_node_t node,
+					grub_disk_addr_t block),
+	 grub_fshelp_get_extent_t get_extent, grub_disk_addr_t *count)
+{
+  grub_disk_addr_t blknr;
+
+  *count = 1;
+  if (get_extent)
+    blknr = get_extent (node, block, count);
+  else
+    blknr = get_block (node, block);
+
+  if (*count == 0 || *count > last - block + 1)
+    *count = last - block + 1;
+  return blknr;
+}
+
+static grub_ssize_t
+read_file_real (grub_disk_t disk, grub_fshelp_node_t node,
+		grub_disk_read_hook_t read_hook, void *read_hook_data,
+		grub_off_t pos, grub_size_t len, char *buf,
+		grub_disk_addr_t (*get_block) (grub_fshelp_node_t node,
+					       grub_disk_addr_t block),
+		grub_fshelp_get_extent_t get_extent,
+		grub_off_t filesize, int log2blocksize,
+		grub_disk_addr_t blocks_start)
+{
+  int log2bytes = log2blocksize + GRUB_DISK_SECTOR_BITS;
+  grub_off_t end;
 
   if (pos > filesize)
     {
@@ -372,58 +560,303 @@ grub_fshelp_read_file (grub_disk_t disk, grub_fshelp_node_t node,
   /* Adjust LEN so it we can't read past the end of the file.  */
   if (pos + len > filesize)
     len = filesize - pos;
+  end = pos + len;
 
-  blockcnt = ((len + pos) + blocksize - 1) >> (log2blocksize + GRUB_DISK_SECTOR_BITS);
-
-  for (i = pos >> (log2blocksize + GRUB_DISK_SECTOR_BITS); i < blockcnt; i++)
+  while (pos < end)
     {
-      grub_disk_addr_t blknr;
-      int blockoff = pos & (blocksize - 1);
-      int blockend = blocksize;
+      grub_disk_addr_t block = pos >> log2bytes;
+      grub_disk_addr_t blknr, count;
+      grub_off_t run_end;
+      grub_size_t size;
 
-      int skipfirst = 0;
-
-      blknr = get_block (node, i);
+      blknr = get_run (node, block, (end - 1) >> log2bytes,
+		       get_block, get_extent, &count);
       if (grub_errno)
 	return -1;
 
-      blknr = blknr << log2blocksize;
-
-      /* Last block.  */
-      if (i == blockcnt - 1)
-	{
-	  blockend = (len + pos) & (blocksize - 1);
-
-	  /* The last portion is exactly blocksize.  */
-	  if (! blockend)
-	    blockend = blocksize;
-	}
-
-      /* First block.  */
-      if (i == (pos >> (log2blocksize + GRUB_DISK_SECTOR_BITS)))
-	{
-	  skipfirst = blockoff;
-	  blockend -= skipfirst;
-	}
+      run_end = (block + count) << log2bytes;
+      if (run_end > end)
+	run_end = end;
+      size = run_end - pos;
 
-      /* If the block number is 0 this block is not stored on disk but
+      /* If the block number is 0 this run is not stored on disk but
 	 is zero filled instead.  */
       if (blknr)
 	{
 	  disk->read_hook = read_hook;
 	  disk->read_hook_data = read_hook_data;
 
-	  grub_disk_read (disk, blknr + blocks_start, skipfirst,
-			  blockend, buf);
+	  grub_disk_read (disk, (blknr << log2blocksize) + blocks_start,
+			  pos - (block << log2bytes), size, buf);
 	  disk->read_hook = 0;
 	  if (grub_errno)
 	    return -1;
 	}
       else
-	grub_memset (buf, 0, blockend);
+	grub_memset (buf, 0, size);
 
-      buf += blocksize - skipfirst;
+      buf += size;
+      pos += size;
     }
 
   return len;
 }
+
+/* Read LEN bytes from the file NODE on disk DISK into the buffer BUF,
+   beginning with the block POS.  READ_HOOK should be set before
+   reading a block from the file.  READ_HOOK_DATA is passed through as
+   the DATA argument to READ_HOOK.  GET_BLOCK is used to translate
+   file blocks to disk blocks.  The file is FILESIZE bytes big and the
+   blocks have a size of LOG2BLOCKSIZE (in log2).  */
+grub_ssize_t
+grub_fshelp_read_file (grub_disk_t disk, grub_fshelp_node_t node,
+		       grub_disk_read_hook_t read_hook, void *read_hook_data,
+		       grub_off_t pos, grub_size_t len, char *buf,
+		       grub_disk_addr_t (*get_block) (grub_fshelp_node_t node,
+                                                      grub_disk_addr_t block),
+		       grub_off_t filesize, int log2blocksize,
+		       grub_disk_addr_t blocks_start)
+{
+  return read_file_real (disk, node, read_hook, read_hook_data, pos, len,
+			 buf, get_block, 0, filesize, log2blocksize,
+			 blocks_start);
+}
+
+/* Same as grub_fshelp_read_file, but GET_EXTENT maps runs of blocks, so
+   that each run is read from disk at once.  */
+grub_ssize_t
+grub_fshelp_read_file_extents (grub_disk_t disk, grub_fshelp_node_t node,
+			       grub_disk_read_hook_t read_hook,
+			       void *read_hook_data,
+			       grub_off_t pos, grub_size_t len, char *buf,
+			       grub_fshelp_get_extent_t get_extent,
+			       grub_off_t filesize, int log2blocksize,
+			       grub_disk_addr_t blocks_start)
+{
+  return read_file_real (disk, node, read_hook, read_hook_data, pos, len,
+			 buf, 0, get_extent, filesize, log2blocksize,
+			 blocks_start);
+}
+
+static grub_err_t
+map_file_real (grub_fshelp_node_t node,
+	       grub_off_t pos, grub_size_t len,
+	       grub_disk_addr_t (*get_block) (grub_fshelp_node_t node,
+					      grub_disk_addr_t block),
+	       grub_fshelp_get_extent_t get_extent,
+	       grub_off_t filesize, int log2blocksize,
+	       grub_disk_addr_t blocks_start,
+	       grub_fs_extent_hook_t hook, void *hook_data)
+{
+  int log2bytes = log2blocksize + GRUB_DISK_SECTOR_BITS;
+  grub_off_t end;
+  grub_err_t err;
+
+  if (pos > filesize)
+    return grub_error (GRUB_ERR_OUT_OF_RANGE,
+		       N_("attempt to read past the end of file"));
+
+  if (pos + len > filesize)
+    len = filesize - pos;
+  end = pos + len;
+
+  while (pos < end)
+    {
+      struct grub_fs_extent extent;
+      grub_disk_addr_t block = pos >> log2bytes;
+      grub_disk_addr_t blknr, count;
+      grub_off_t run_end;
+
+      blknr = get_run (node, block, (end - 1) >> log2bytes,
+		       get_block, get_extent, &count);
+      if (grub_errno)
+	return grub_errno;
+
+      run_end = (block + count) << log2bytes;
+      if (run_end > end)
+	run_end = end;
+
+      extent.offset = pos;
+      extent.length = run_end - pos;
+      /* As in grub_fshelp_read_file, block 0 stands for a hole.  */
+      extent.hole = (blknr == 0);
+      extent.sector = (blknr << log2blocksize) + blocks_start;
+      extent.sector_offset = pos - (block << log2bytes);
+
+      err = hook (&extent, hook_data);
+      if (err)
+	return err;
+
+      pos += extent.length;
+    }
+
+  return GRUB_ERR_NONE;
+}
+
+/* Call HOOK with the disk extents of LEN bytes of the file NODE,
+   beginning with the byte POS.  GET_BLOCK, FILESIZE, LOG2BLOCKSIZE and
+   BLOCKS_START are as for grub_fshelp_read_file.  Every block is
+   reported separately; grub_file_map merges the adjacent ones.  */
+grub_err_t
+grub_fshelp_map_file (grub_fshelp_node_t node,
+		      grub_off_t pos, grub_size_t len,
+		      grub_disk_addr_t (*get_block) (grub_fshelp_node_t node,
+						     grub_disk_addr_t block),
+		      grub_off_t filesize, int log2blocksize,
+		      grub_disk_addr_t blocks_start,
+		      grub_fs_extent_hook_t hook, void *hook_data)
+{
+  return map_file_real (node, pos, len, get_block, 0, filesize,
+			log2blocksize, blocks_start, hook, hook_data);
+}
+
+/* Same as grub_fshelp_map_file, but every run GET_EXTENT finds is
+   reported as one extent.  */
+grub_err_t
+grub_fshelp_map_file_extents (grub_fshelp_node_t node,
+			      grub_off_t pos, grub_size_t len,
+			      grub_fshelp_get_extent_t get_extent,
+			      grub_off_t filesize, int log2blocksize,
+			      grub_disk_addr_t blocks_start,
+			      grub_fs_extent_hook_t hook, void *hook_data)
+{
+  return map_file_real (node, pos, len, 0, get_extent, filesize,
+			log2blocksize, blocks_start, hook, hook_data);
+}
+
+/* Number of decompressed units kept.  Units are at most 64 KiB with the
+   filesystems using them.  */
+#define UNIT_CACHE_SIZE 16
+
+static struct grub_fshelp_unit unit_cache[UNIT_CACHE_SIZE];
+static unsigned long unit_cache_generation;
+static unsigned long unit_cache_clock;
+
+static void
+unit_wait (struct grub_fshelp_unit *unit)
+{
+  if (!unit->pending)
+    return;
+  grub_job_wait (&unit->job);
+  unit->pending = 0;
+  grub_free (unit->src);
+  unit->src = NULL;
+}
+
+static void
+unit_release (struct grub_fshelp_unit *unit)
+{
+  unit_wait (unit);
+  grub_free (unit->data);
+  grub_memset (unit, 0, sizeof (*unit));
+}
+
+static struct grub_fshelp_unit *
+unit_lookup (grub_disk_t disk, grub_uint64_t file, grub_uint64_t index)
+{
+  grub_disk_addr_t part_start = grub_partition_get_start (disk->partition);
+  unsigned i;
+
+  if (unit_cache_generation != grub_disk_generation)
+    {
+      grub_fshelp_unit_flush ();
+      unit_cache_generation = grub_disk_generation;
+    }
+
+  for (i = 0; i < UNIT_CACHE_SIZE; i++)
+    if (unit_cache[i].data && unit_cache[i].index == index
+	&& unit_cache[i].file == file
+	&& unit_cache[i].dev_id == disk->dev->id
+	&& unit_cache[i].disk_id == disk->id
+	&& unit_cache[i].part_start == part_start)
+      {
+	unit_cache[i].last_use = ++unit_cache_clock;
+	return &unit_cache[i];
+      }
+  return NULL;
+}
+
+struct grub_fshelp_unit *
+grub_fshelp_unit_find (grub_disk_t disk, grub_uint64_t file,
+		       grub_uint64_t index)
+{
+  struct grub_fshelp_unit *unit;
+
+  unit = unit_lookup (disk, file, index);
+  if (unit)
+    unit_wait (unit);
+  return unit;
+}
+
+int
+grub_fshelp_unit_present (grub_disk_t disk, grub_uint64_t file,
+			  grub_uint64_t index)
+{
+  return unit_lookup (disk, file, index) != NULL;
+}
+
+struct grub_fshelp_unit *
+grub_fshelp_unit_new (grub_disk_t disk, grub_uint64_t file,
+		      grub_uint64_t index, grub_size_t size)
+{
+  struct grub_fshelp_unit *unit = &unit_cache[0];
+  grub_uint8_t *data;
+  grub_size_t alloc;
+  unsigned i;
+
+  for (i = 1; i < UNIT_CACHE_SIZE && unit->data; i++)
+    if (!unit_cache[i].data || unit_cache[i].last_use < unit->last_use)
+      unit = &unit_cache[i];
+
+  /* Keep the old buffer if it is large enough.  */
+  unit_wait (unit);
+  data = unit->data;
+  alloc = unit->alloc;
+  if (alloc < size)
+    {
+      grub_free (data);
+      data = grub_malloc (size);
+      alloc = size;
+    }
+  grub_memset (unit, 0, sizeof (*unit));
+  if (!data)
+    return NULL;
+
+  unit->data = data;
+  unit->alloc = alloc;
+  unit->dev_id = disk->dev->id;
+  unit->disk_id = disk->id;
+  unit->part_start = grub_partition_get_start (disk->partition);
+  unit->file = file;
+  unit->index = index;
+  unit->last_use = ++unit_cache_clock;
+  return unit;
+}
+
+void
+grub_fshelp_unit_submit (struct grub_fshelp_unit *unit)
+{
+  unit->err = 0;
+  unit->pending = 1;
+  grub_job_submit (&unit->job);
+}
+
+void
+grub_fshelp_unit_drop (struct grub_fshelp_unit *unit)
+{
+  unit_release (unit);
+}
+
+void
+grub_fshelp_unit_flush (void)
+{
+  unsigned i;
+
+  for (i = 0; i < UNIT_CACHE_SIZE; i++)
+    unit_release (&unit_cache[i]);
+}
+
+GRUB_MOD_FINI(fshelp)
+{
+  grub_fshelp_unit_flush ();
+}
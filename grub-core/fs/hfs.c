@@ -1413,6 +1413,12 @@ grub_hfs_uuid (grub_device_t device, char **uuid)
 
 
 
+static const struct grub_fs_magic grub_hfs_magics[] =
+  {
+    { GRUB_HFS_SBLOCK << GRUB_DISK_SECTOR_BITS, 2, "BD" },
+    { 0, 0, 0 }
+  };
+
 static struct grub_fs grub_hfs_fs =
   {
     .name = "hfs",
@@ -1423,6 +1429,7 @@ static struct grub_fs grub_hfs_fs =
     .label = grub_hfs_label,
     .uuid = grub_hfs_uuid,
     .mtime = grub_hfs_mtime,
+    .magics = grub_hfs_magics,
 #ifdef GRUB_UTIL
     .reserved_first_sector = 1,
     .blocklist_install = 1,
@@ -25,6 +25,7 @@
 #include <grub/mm.h>
 #include <grub/misc.h>
 #include <grub/disk.h>
+#include <grub/partition.h>
 #include <grub/dl.h>
 #include <grub/types.h>
 #include <grub/fshelp.h>
@@ -105,6 +106,25 @@ enum grub_hfsplus_filetype
 
 static grub_dl_t my_mod;
 
+/* B-tree nodes of the catalog, extents overflow and attributes files,
+   kept across mounts.  The table is direct-mapped on the node number.  */
+#define HFSPLUS_NODE_CACHE_SIZE 64
+
+struct grub_hfsplus_node_cache
+{
+  unsigned long dev_id;
+  unsigned long disk_id;
+  grub_disk_addr_t part_start;
+  grub_disk_addr_t embedded_offset;
+  grub_uint32_t fileid;
+  grub_uint64_t nodeno;
+  grub_size_t size;
+  char *buf;
+};
+
+static struct grub_hfsplus_node_cache node_cache[HFSPLUS_NODE_CACHE_SIZE];
+static unsigned long node_cache_generation;
+
 
 
 grub_err_t (*grub_hfsplus_open_compressed) (struct grub_fshelp_node *node);
@@ -113,12 +133,13 @@ grub_ssize_t (*grub_hfsplus_read_compressed) (struct grub_hfsplus_file *node,
 					      grub_size_t len,
 					      char *buf);
 
-/* Find the extent that points to FILEBLOCK.  If it is not in one of
-   the 8 extents described by EXTENT, return -1.  In that case set
-   FILEBLOCK to the next block.  */
+/* Find the extent that points to FILEBLOCK and store in *COUNT how many
+   blocks are left in it.  If it is not in one of the 8 extents
+   described by EXTENT, return -1.  In that case set FILEBLOCK to the
+   next block.  */
 static grub_disk_addr_t
 grub_hfsplus_find_block (struct grub_hfsplus_extent *extent,
-			 grub_disk_addr_t *fileblock)
+			 grub_disk_addr_t *fileblock, grub_disk_addr_t *count)
 {
   int i;
   grub_disk_addr_t blksleft = *fileblock;
@@ -127,7 +148,10 @@ grub_hfsplus_find_block (struct grub_hfsplus_extent *extent,
   for (i = 0; i < 8; i++)
     {
       if (blksleft < grub_be_to_cpu32 (extent[i].count))
-	return grub_be_to_cpu32 (extent[i].start) + blksleft;
+	{
+	  *count = grub_be_to_cpu32 (extent[i].count) - blksleft;
+	  return grub_be_to_cpu32 (extent[i].start) + blksleft;
+	}
       blksleft -= grub_be_to_cpu32 (extent[i].count);
     }
 
@@ -139,14 +163,28 @@ static int grub_hfsplus_cmp_extkey (struct grub_hfsplus_key *keya,
 				    struct grub_hfsplus_key_internal *keyb);
 
 /* Search for the block FILEBLOCK inside the file NODE.  Return the
-   blocknumber of this block on disk.  */
+   blocknumber of this block on disk, and in *COUNT the number of blocks
+   which follow it in the same extent.  */
 static grub_disk_addr_t
-grub_hfsplus_read_block (grub_fshelp_node_t node, grub_disk_addr_t fileblock)
+grub_hfsplus_read_block (grub_fshelp_node_t node, grub_disk_addr_t fileblock,
+			 grub_disk_addr_t *count)
 {
   struct grub_hfsplus_btnode *nnode = 0;
   grub_disk_addr_t blksleft = fileblock;
   struct grub_hfsplus_extent *extents = node->compressed 
     ? &node->resource_extents[0] : &node->extents[0];
+  int type = node->compressed ? 0xff : 0;
+
+  /* Fragmented files are mostly read in order, so the overflow record
+     used last is likely to hold this block too.  */
+  if (node->overflow_type == type && fileblock >= node->overflow_start)
+    {
+      grub_disk_addr_t blk, left = fileblock - node->overflow_start;
+
+      blk = grub_hfsplus_find_block (node->overflow, &left, count);
+      if (blk != 0xffffffffffffffffULL)
+	return blk;
+    }
 
   while (1)
     {
@@ -156,7 +194,7 @@ grub_hfsplus_read_block (grub_fshelp_node_t node, grub_disk_addr_t fileblock)
       grub_off_t ptr;
 
       /* Try to find this block in the current set of extents.  */
-      blk = grub_hfsplus_find_block (extents, &blksleft);
+      blk = grub_hfsplus_find_block (extents, &blksleft, count);
 
       /* The previous iteration of this loop allocated memory.  The
 	 code above used this memory, it can be freed now.  */
@@ -180,7 +218,7 @@ grub_hfsplus_read_block (grub_fshelp_node_t node, grub_disk_addr_t fileblock)
       extoverflow.extkey.fileid = node->fileid;
       extoverflow.extkey.type = 0;
       extoverflow.extkey.start = fileblock - blksleft;
-      extoverflow.extkey.type = node->compressed ? 0xff : 0;
+      extoverflow.extkey.type = type;
       if (grub_hfsplus_btree_search (&node->data->extoverflow_tree,
 				     &extoverflow,
 				     grub_hfsplus_cmp_extkey, &nnode, &ptr)
@@ -195,7 +233,10 @@ grub_hfsplus_read_block (grub_fshelp_node_t node, grub_disk_addr_t fileblock)
       /* The extent overflow file has 8 extents right after the key.  */
       key = (struct grub_hfsplus_extkey *)
 	grub_hfsplus_btree_recptr (&node->data->extoverflow_tree, nnode, ptr);
-      extents = (struct grub_hfsplus_extent *) (key + 1);
+      grub_memcpy (node->overflow, key + 1, sizeof (node->overflow));
+      node->overflow_start = extoverflow.extkey.start;
+      node->overflow_type = type;
+      extents = node->overflow;
 
       /* The block wasn't found.  Perhaps the next iteration will find
 	 it.  The last block we found is stored in BLKSLEFT now.  */
@@ -215,12 +256,13 @@ grub_hfsplus_read_file (grub_fshelp_node_t node,
 			grub_disk_read_hook_t read_hook, void *read_hook_data,
 			grub_off_t pos, grub_size_t len, char *buf)
 {
-  return grub_fshelp_read_file (node->data->disk, node,
-				read_hook, read_hook_data,
-				pos, len, buf, grub_hfsplus_read_block,
-				node->size,
-				node->data->log2blksize - GRUB_DISK_SECTOR_BITS,
-				node->data->embedded_offset);
+  return grub_fshelp_read_file_extents (node->data->disk, node,
+					read_hook, read_hook_data,
+					pos, len, buf, grub_hfsplus_read_block,
+					node->size,
+					node->data->log2blksize
+					- GRUB_DISK_SECTOR_BITS,
+					node->data->embedded_offset);
 }
 
 static struct grub_hfsplus_data *
@@ -298,6 +340,7 @@ grub_hfsplus_mount (grub_disk_t disk)
   data->catalog_tree.file.data = data;
   data->catalog_tree.file.fileid = GRUB_HFSPLUS_FILEID_CATALOG;
   data->catalog_tree.file.compressed = 0;
+  data->catalog_tree.file.overflow_type = -1;
   grub_memcpy (&data->catalog_tree.file.extents,
 	       data->volheader.catalog_file.extents,
 	       sizeof data->volheader.catalog_file.extents);
@@ -313,11 +356,13 @@ grub_hfsplus_mount (grub_disk_t disk)
   data->attr_tree.file.size =
     grub_be_to_cpu64 (data->volheader.attr_file.size);
   data->attr_tree.file.compressed = 0;
+  data->attr_tree.file.overflow_type = -1;
 
   /* Make a new node for the extent overflow file.  */
   data->extoverflow_tree.file.data = data;
   data->extoverflow_tree.file.fileid = GRUB_HFSPLUS_FILEID_OVERFLOW;
   data->extoverflow_tree.file.compressed = 0;
+  data->extoverflow_tree.file.overflow_type = -1;
   grub_memcpy (&data->extoverflow_tree.file.extents,
 	       data->volheader.extents_file.extents,
 	       sizeof data->volheader.catalog_file.extents);
@@ -372,6 +417,7 @@ grub_hfsplus_mount (grub_disk_t disk)
 
   data->dirroot.data = data;
   data->dirroot.fileid = GRUB_HFSPLUS_FILEID_ROOTDIR;
+  data->dirroot.overflow_type = -1;
 
   return data;
 
@@ -491,6 +537,77 @@ grub_hfsplus_read_symlink (grub_fshelp_node_t node)
   return symlink;
 }
 
+static void
+node_cache_flush (void)
+{
+  unsigned i;
+
+  for (i = 0; i < HFSPLUS_NODE_CACHE_SIZE; i++)
+    {
+      grub_free (node_cache[i].buf);
+      node_cache[i].buf = NULL;
+    }
+}
+
+static struct grub_hfsplus_node_cache *
+node_cache_slot (struct grub_hfsplus_btree *btree, grub_uint64_t nodeno)
+{
+  return &node_cache[(nodeno + btree->file.fileid) % HFSPLUS_NODE_CACHE_SIZE];
+}
+
+/* Return the node NODENO of BTREE.  It stays valid until the next call
+   and must not be modified.  */
+static struct grub_hfsplus_btnode *
+grub_hfsplus_read_node (struct grub_hfsplus_btree *btree,
+			grub_uint64_t nodeno)
+{
+  struct grub_hfsplus_data *data = btree->file.data;
+  grub_disk_addr_t part_start = grub_partition_get_start (data->disk->partition);
+  struct grub_hfsplus_node_cache *slot;
+  char *buf;
+
+  if (node_cache_generation != grub_disk_generation)
+    {
+      node_cache_flush ();
+      node_cache_generation = grub_disk_generation;
+    }
+
+  slot = node_cache_slot (btree, nodeno);
+  if (slot->buf && slot->nodeno == nodeno
+      && slot->fileid == btree->file.fileid && slot->size == btree->nodesize
+      && slot->dev_id == data->disk->dev->id
+      && slot->disk_id == data->disk->id && slot->part_start == part_start
+      && slot->embedded_offset == data->embedded_offset)
+    return (struct grub_hfsplus_btnode *) slot->buf;
+
+  /* Reading may have to search the extents overflow tree, which goes
+     through the cache as well, so only fill the slot once the node is
+     in.  */
+  buf = grub_malloc (btree->nodesize);
+  if (!buf)
+    return NULL;
+  if (grub_hfsplus_read_file (&btree->file, 0, 0,
+			      nodeno * (grub_disk_addr_t) btree->nodesize,
+			      btree->nodesize, buf) <= 0)
+    {
+      grub_free (buf);
+      return NULL;
+    }
+
+  slot = node_cache_slot (btree, nodeno);
+  grub_free (slot->buf);
+  slot->dev_id = data->disk->dev->id;
+  slot->disk_id = data->disk->id;
+  slot->part_start = part_start;
+  slot->embedded_offset = data->embedded_offset;
+  slot->fileid = btree->file.fileid;
+  slot->nodeno = nodeno;
+  slot->size = btree->nodesize;
+  slot->buf = buf;
+
+  return (struct grub_hfsplus_btnode *) buf;
+}
+
 static int
 grub_hfsplus_btree_iterate_node (struct grub_hfsplus_btree *btree,
 				 struct grub_hfsplus_btnode *first_node,
@@ -505,6 +622,7 @@ grub_hfsplus_btree_iterate_node (struct grub_hfsplus_btree *btree,
   for (;;)
     {
       char *cnode = (char *) first_node;
+      struct grub_hfsplus_btnode *next;
 
       /* Iterate over all records in this node.  */
       for (rec = first_rec; rec < grub_be_to_cpu16 (first_node->count); rec++)
@@ -525,12 +643,11 @@ grub_hfsplus_btree_iterate_node (struct grub_hfsplus_btree *btree,
 	saved_node = first_node->next;
       node_count++;
 
-      if (grub_hfsplus_read_file (&btree->file, 0, 0,
-				  (((grub_disk_addr_t)
-				    grub_be_to_cpu32 (first_node->next))
-				   * btree->nodesize),
-				  btree->nodesize, cnode) <= 0)
+      next = grub_hfsplus_read_node (btree,
+				     grub_be_to_cpu32 (first_node->next));
+      if (!next)
 	return 1;
+      grub_memcpy (cnode, next, btree->nodesize);
 
       /* Don't skip any record in the next iteration.  */
       first_rec = 0;
@@ -552,7 +669,6 @@ grub_hfsplus_btree_search (struct grub_hfsplus_btree *btree,
 			   grub_off_t *keyoffset)
 {
   grub_uint64_t currnode;
-  char *node;
   struct grub_hfsplus_btnode *nodedesc;
   grub_disk_addr_t rec;
   grub_uint64_t save_node;
@@ -564,10 +680,6 @@ grub_hfsplus_btree_search (struct grub_hfsplus_btree *btree,
       return 0;
     }
 
-  node = grub_malloc (btree->nodesize);
-  if (! node)
-    return grub_errno;
-
   currnode = btree->root;
   save_node = currnode - 1;
   while (1)
@@ -575,25 +687,15 @@ grub_hfsplus_btree_search (struct grub_hfsplus_btree *btree,
       int match = 0;
 
       if (save_node == currnode)
-	{
-	  grub_free (node);
-	  return grub_error (GRUB_ERR_BAD_FS, "HFS+ btree loop");
-	}
+	return grub_error (GRUB_ERR_BAD_FS, "HFS+ btree loop");
       if (!(node_count & (node_count - 1)))
 	save_node = currnode;
       node_count++;
 
       /* Read a node.  */
-      if (grub_hfsplus_read_file (&btree->file, 0, 0,
-				  (grub_disk_addr_t) currnode
-				  * (grub_disk_addr_t) btree->nodesize,
-				  btree->nodesize, (char *) node) <= 0)
-	{
-	  grub_free (node);
-	  return grub_error (GRUB_ERR_BAD_FS, "couldn't read i-node");
-	}
-
-      nodedesc = (struct grub_hfsplus_btnode *) node;
+      nodedesc = grub_hfsplus_read_node (btree, currnode);
+      if (!nodedesc)
+	return grub_error (GRUB_ERR_BAD_FS, "couldn't read i-node");
 
       /* Find the record in this tree.  */
       for (rec = 0; rec < grub_be_to_cpu16 (nodedesc->count); rec++)
@@ -606,9 +708,13 @@ grub_hfsplus_btree_search (struct grub_hfsplus_btree *btree,
 	  if (nodedesc->type == GRUB_HFSPLUS_BTNODE_TYPE_LEAF
 	      && compare_keys (currkey, key) == 0)
 	    {
-	      /* An exact match was found!  */
+	      /* An exact match was found!  The caller gets its own
+		 copy of the cached node.  */
 
-	      *matchnode = nodedesc;
+	      *matchnode = grub_malloc (btree->nodesize);
+	      if (!*matchnode)
+		return grub_errno;
+	      grub_memcpy (*matchnode, nodedesc, btree->nodesize);
 	      *keyoffset = rec;
 
 	      return 0;
@@ -640,7 +746,6 @@ grub_hfsplus_btree_search (struct grub_hfsplus_btree *btree,
       if (! match)
 	{
 	  *matchnode = 0;
-	  grub_free (node);
 	  return 0;
 	}
     }
@@ -706,6 +811,7 @@ list_nodes (void *record, void *hook_arg)
       node->mtime = 0;
       node->size = 0;
       node->fileid = grub_be_to_cpu32 (fileinfo->parentid);
+      node->overflow_type = -1;
 
       ctx->ret = ctx->hook ("..", GRUB_FSHELP_DIR, node, ctx->hook_data);
       return ctx->ret;
@@ -762,6 +868,7 @@ list_nodes (void *record, void *hook_arg)
   node->compressed = 0;
   node->cbuf = 0;
   node->compress_index = 0;
+  node->overflow_type = -1;
 
   grub_memcpy (node->extents, fileinfo->data.extents,
 	       sizeof (node->extents));
@@ -1075,6 +1182,14 @@ grub_hfsplus_uuid (grub_device_t device, char **uuid)
 
 
 
+static const struct grub_fs_magic grub_hfsplus_magics[] =
+  {
+    { GRUB_HFSPLUS_SBLOCK << GRUB_DISK_SECTOR_BITS, 2, "H+" },
+    { GRUB_HFSPLUS_SBLOCK << GRUB_DISK_SECTOR_BITS, 2, "HX" },
+    { GRUB_HFSPLUS_SBLOCK << GRUB_DISK_SECTOR_BITS, 2, "BD" },
+    { 0, 0, 0 }
+  };
+
 static struct grub_fs grub_hfsplus_fs =
   {
     .name = "hfsplus",
@@ -1085,6 +1200,7 @@ static struct grub_fs grub_hfsplus_fs =
     .label = grub_hfsplus_label,
     .mtime = grub_hfsplus_mtime,
     .uuid = grub_hfsplus_uuid,
+    .magics = grub_hfsplus_magics,
 #ifdef GRUB_UTIL
     .reserved_first_sector = 1,
     .blocklist_install = 1,
@@ -1101,4 +1217,5 @@ GRUB_MOD_INIT(hfsplus)
 GRUB_MOD_FINI(hfsplus)
 {
   grub_fs_unregister (&grub_hfsplus_fs);
+  node_cache_flush ();
 }
@@ -24,6 +24,7 @@
 #include <grub/mm.h>
 #include <grub/deflate.h>
 #include <grub/file.h>
+#include <grub/fshelp.h>
 
 GRUB_MOD_LICENSE ("GPLv3+");
 
@@ -112,11 +113,67 @@ grub_hfsplus_cmp_attrkey (struct grub_hfsplus_key *keya,
 
 #define HFSPLUS_COMPRESS_BLOCK_SIZE 65536
 
+/* Decompress the chunk BLOCK of NODE into the unit cache, so that
+   reading a file in small pieces doesn't inflate its chunks again.  */
+static struct grub_fshelp_unit *
+hfsplus_get_block (struct grub_hfsplus_file *node, grub_uint32_t block)
+{
+  struct grub_fshelp_unit *unit;
+  grub_disk_t disk = node->data->disk;
+  grub_uint32_t sz;
+  grub_size_t ts;
+  char *tmp_buf;
+
+  unit = grub_fshelp_unit_find (disk, node->fileid, block);
+  if (unit)
+    return unit;
+
+  if (block >= node->compress_index_size)
+    {
+      grub_error (GRUB_ERR_BAD_FS, "compressed chunk out of range");
+      return NULL;
+    }
+  sz = grub_le_to_cpu32 (node->compress_index[block].size);
+  tmp_buf = grub_malloc (sz);
+  if (!tmp_buf)
+    return NULL;
+  if (grub_hfsplus_read_file (node, 0, 0,
+			      grub_le_to_cpu32 (node->compress_index[block].start) + 0x104,
+			      sz, tmp_buf)
+      != (grub_ssize_t) sz)
+    {
+      grub_free (tmp_buf);
+      return NULL;
+    }
+
+  ts = HFSPLUS_COMPRESS_BLOCK_SIZE;
+  if (ts > node->size - (grub_uint64_t) block * HFSPLUS_COMPRESS_BLOCK_SIZE)
+    ts = node->size - (grub_uint64_t) block * HFSPLUS_COMPRESS_BLOCK_SIZE;
+  unit = grub_fshelp_unit_new (disk, node->fileid, block, ts);
+  if (!unit)
+    {
+      grub_free (tmp_buf);
+      return NULL;
+    }
+  if (grub_zlib_decompress (tmp_buf, sz, 0, (char *) unit->data, ts)
+      != (grub_ssize_t) ts)
+    {
+      if (!grub_errno)
+	grub_error (GRUB_ERR_BAD_COMPRESSED_DATA,
+		    "premature end of compressed");
+      grub_fshelp_unit_drop (unit);
+      grub_free (tmp_buf);
+      return NULL;
+    }
+  unit->size = ts;
+  grub_free (tmp_buf);
+  return unit;
+}
+
 static grub_ssize_t
 hfsplus_read_compressed_real (struct grub_hfsplus_file *node,
 			      grub_off_t pos, grub_size_t len, char *buf)
 {
-  char *tmp_buf = 0;
   grub_size_t len0 = len;
 
   if (node->compressed == 1)
@@ -130,52 +187,29 @@ hfsplus_read_compressed_real (struct grub_hfsplus_file *node,
   while (len)
     {
       grub_uint32_t block = pos / HFSPLUS_COMPRESS_BLOCK_SIZE;
-      grub_size_t curlen = HFSPLUS_COMPRESS_BLOCK_SIZE
-	- (pos % HFSPLUS_COMPRESS_BLOCK_SIZE);
+      grub_size_t off = pos % HFSPLUS_COMPRESS_BLOCK_SIZE;
+      grub_size_t curlen = HFSPLUS_COMPRESS_BLOCK_SIZE - off;
+      struct grub_fshelp_unit *unit;
 
       if (curlen > len)
 	curlen = len;
 
-      if (node->cbuf_block != block)
+      unit = hfsplus_get_block (node, block);
+      if (!unit)
+	return -1;
+      if (off + curlen > unit->size)
 	{
-	  grub_uint32_t sz = grub_le_to_cpu32 (node->compress_index[block].size);
-	  grub_size_t ts;
-	  if (!tmp_buf)
-	    tmp_buf = grub_malloc (HFSPLUS_COMPRESS_BLOCK_SIZE);
-	  if (!tmp_buf)
-	    return -1;
-	  if (grub_hfsplus_read_file (node, 0, 0,
-				      grub_le_to_cpu32 (node->compress_index[block].start) + 0x104,
-				      sz, tmp_buf)
-	      != (grub_ssize_t) sz)
-	    {
-	      grub_free (tmp_buf);
-	      return -1;
-	    }
-	  ts = HFSPLUS_COMPRESS_BLOCK_SIZE;
-	  if (ts > node->size - (pos & ~(HFSPLUS_COMPRESS_BLOCK_SIZE)))
-	    ts = node->size - (pos & ~(HFSPLUS_COMPRESS_BLOCK_SIZE));
-	  if (grub_zlib_decompress (tmp_buf, sz, 0,
-				    node->cbuf, ts) != (grub_ssize_t) ts)
-	    {
-	      if (!grub_errno)
-		grub_error (GRUB_ERR_BAD_COMPRESSED_DATA,
-			    "premature end of compressed");
-
-	      grub_free (tmp_buf);
-	      return -1;
-	    }
-	  node->cbuf_block = block;
+	  grub_error (GRUB_ERR_BAD_COMPRESSED_DATA,
+		      "premature end of compressed");
+	  return -1;
 	}
-      grub_memcpy (buf, node->cbuf + (pos % HFSPLUS_COMPRESS_BLOCK_SIZE),
-		   curlen);
+      grub_memcpy (buf, unit->data + off, curlen);
       if (grub_file_progress_hook && node->file)
 	grub_file_progress_hook (0, 0, curlen, node->file);
       buf += curlen;
       pos += curlen;
       len -= curlen;
     }
-  grub_free (tmp_buf);
   return len0;
 }
 
@@ -267,16 +301,7 @@ hfsplus_open_compressed_real (struct grub_hfsplus_file *node)
 	  return 0;
 	}
 
-      node->cbuf_block = -1;
-
-      node->cbuf = grub_malloc (HFSPLUS_COMPRESS_BLOCK_SIZE);
       grub_free (attr_node);
-      if (!node->cbuf)
-	{
-	  node->compressed = 0;
-	  grub_free (node->compress_index);
-	  return grub_errno;
-	}
       return 0;
     }
   if (cmp_head->type != HFSPLUS_COMPRESSION_INLINE)
@@ -26,6 +26,7 @@
 #include <grub/dl.h>
 #include <grub/types.h>
 #include <grub/fshelp.h>
+#include <grub/partition.h>
 #include <grub/charset.h>
 #include <grub/datetime.h>
 
@@ -861,11 +862,242 @@ grub_iso9660_dir_iter (const char *filename,
   grub_memset (&info, 0, sizeof (info));
   info.dir = ((filetype & GRUB_FSHELP_TYPE_MASK) == GRUB_FSHELP_DIR);
   info.mtimeset = !!iso9660_to_unixtime2 (&node->dirents[0].mtime, &info.mtime);
+  if ((filetype & GRUB_FSHELP_TYPE_MASK) == GRUB_FSHELP_REG)
+    {
+      info.sizeset = 1;
+      info.size = get_node_size (node);
+    }
 
   grub_free (node);
   return ctx->hook (filename, &info, ctx->hook_data);
 }
 
+/* Nodes only point at their mount, so lookups can be kept across mounts.  */
+static grub_size_t
+grub_iso9660_node_size (grub_fshelp_node_t node)
+{
+  grub_size_t size = sizeof (struct grub_fshelp_node);
+
+  /* As allocated by grub_iso9660_iterate_dir.  */
+  if (node->alloc_dirents > ARRAY_SIZE (node->dirents))
+    size += ((node->alloc_dirents - ARRAY_SIZE (node->dirents))
+	     * sizeof (node->dirents[0]));
+  if (node->have_symlink)
+    {
+      const char *symlink = (node->symlink
+			     + node->have_dirents * sizeof (node->dirents[0])
+			     - sizeof (node->dirents));
+      grub_size_t end = symlink + grub_strlen (symlink) + 1 - (char *) node;
+
+      if (end > size)
+	size = end;
+    }
+  return size;
+}
+
+static grub_uint64_t
+grub_iso9660_node_ident (grub_fshelp_node_t node)
+{
+  return grub_le_to_cpu32 (node->dirents[0].first_sector);
+}
+
+static void
+grub_iso9660_node_attach (grub_fshelp_node_t node, grub_fshelp_node_t root)
+{
+  node->data = root->data;
+}
+
+static const struct grub_fshelp_cache_ops grub_iso9660_cache_ops =
+  {
+    .node_size = grub_iso9660_node_size,
+    .ident = grub_iso9660_node_ident,
+    .attach = grub_iso9660_node_attach
+  };
+
+/* Directories whose names have been resolved, kept across mounts so that
+   every further lookup in them skips reading the records and parsing
+   their Rock Ridge entries.  */
+#define DIR_INDEX_MAX 16
+
+struct grub_iso9660_index_entry
+{
+  char *name;
+  grub_size_t namelen;
+  enum grub_fshelp_filetype type;
+  grub_fshelp_node_t node;
+  grub_size_t node_size;
+};
+
+struct grub_iso9660_dir_index
+{
+  struct grub_iso9660_dir_index *next;
+  unsigned long dev_id;
+  unsigned long disk_id;
+  grub_disk_addr_t part_start;
+  grub_uint32_t extent;
+  grub_size_t n_entries, alloc_entries;
+  struct grub_iso9660_index_entry *entries;
+};
+
+static struct grub_iso9660_dir_index *dir_index;
+static unsigned dir_index_count;
+static unsigned long dir_index_generation;
+
+static void
+dir_index_free (struct grub_iso9660_dir_index *idx)
+{
+  grub_size_t i;
+
+  for (i = 0; i < idx->n_entries; i++)
+    {
+      grub_free (idx->entries[i].name);
+      grub_free (idx->entries[i].node);
+    }
+  grub_free (idx->entries);
+  grub_free (idx);
+}
+
+static void
+dir_index_flush (void)
+{
+  while (dir_index)
+    {
+      struct grub_iso9660_dir_index *idx = dir_index;
+
+      dir_index = idx->next;
+      dir_index_free (idx);
+    }
+  dir_index_count = 0;
+}
+
+/* Helper for dir_index_get.  */
+static int
+dir_index_add (const char *filename, enum grub_fshelp_filetype filetype,
+	       grub_fshelp_node_t node, void *data)
+{
+  struct grub_iso9660_dir_index *idx = data;
+  struct grub_iso9660_index_entry *e;
+
+  if (idx->n_entries >= idx->alloc_entries)
+    {
+      struct grub_iso9660_index_entry *new_entries;
+
+      idx->alloc_entries = idx->alloc_entries ? idx->alloc_entries * 2 : 32;
+      new_entries = grub_realloc (idx->entries, idx->alloc_entries
+				  * sizeof (idx->entries[0]));
+      if (!new_entries)
+	{
+	  grub_free (node);
+	  return 1;
+	}
+      idx->entries = new_entries;
+    }
+
+  e = &idx->entries[idx->n_entries];
+  e->name = grub_strdup (filename);
+  if (!e->name)
+    {
+      grub_free (node);
+      return 1;
+    }
+  e->namelen = grub_strlen (filename);
+  e->type = filetype;
+  e->node = node;
+  e->node_size = grub_iso9660_node_size (node);
+  idx->n_entries++;
+  return 0;
+}
+
+/* Return the index of the directory DIR, reading it in if needed.  */
+static struct grub_iso9660_dir_index *
+dir_index_get (grub_fshelp_node_t dir)
+{
+  grub_disk_t disk = dir->data->disk;
+  grub_disk_addr_t part_start = grub_partition_get_start (disk->partition);
+  grub_uint32_t extent = grub_le_to_cpu32 (dir->dirents[0].first_sector);
+  struct grub_iso9660_dir_index *idx, **prev;
+
+  if (dir_index_generation != grub_disk_generation)
+    {
+      dir_index_flush ();
+      dir_index_generation = grub_disk_generation;
+    }
+
+  for (prev = &dir_index; *prev; prev = &(*prev)->next)
+    {
+      idx = *prev;
+      if (idx->extent == extent && idx->dev_id == disk->dev->id
+	  && idx->disk_id == disk->id && idx->part_start == part_start)
+	{
+	  *prev = idx->next;
+	  idx->next = dir_index;
+	  dir_index = idx;
+	  return idx;
+	}
+    }
+
+  idx = grub_zalloc (sizeof (*idx));
+  if (!idx)
+    return NULL;
+  grub_iso9660_iterate_dir (dir, dir_index_add, idx);
+  if (grub_errno)
+    {
+      dir_index_free (idx);
+      return NULL;
+    }
+  idx->dev_id = disk->dev->id;
+  idx->disk_id = disk->id;
+  idx->part_start = part_start;
+  idx->extent = extent;
+
+  idx->next = dir_index;
+  dir_index = idx;
+  if (++dir_index_count > DIR_INDEX_MAX)
+    {
+      for (prev = &dir_index->next; (*prev)->next; prev = &(*prev)->next);
+      dir_index_free (*prev);
+      *prev = NULL;
+      dir_index_count--;
+    }
+  return idx;
+}
+
+/* Find NAME in the directory DIR through its index.  */
+static grub_err_t
+grub_iso9660_lookup_file (grub_fshelp_node_t dir, const char *name,
+			  grub_fshelp_node_t *foundnode,
+			  enum grub_fshelp_filetype *foundtype)
+{
+  struct grub_iso9660_dir_index *idx;
+  grub_size_t namelen = grub_strlen (name);
+  grub_size_t i;
+
+  idx = dir_index_get (dir);
+  if (!idx)
+    return grub_errno;
+
+  for (i = 0; i < idx->n_entries; i++)
+    {
+      struct grub_iso9660_index_entry *e = &idx->entries[i];
+
+      if (e->namelen != namelen || e->type == GRUB_FSHELP_UNKNOWN
+	  || ((e->type & GRUB_FSHELP_CASE_INSENSITIVE)
+	      ? grub_strcasecmp (name, e->name)
+	      : grub_strcmp (name, e->name)))
+	continue;
+
+      *foundnode = grub_malloc (e->node_size);
+      if (!*foundnode)
+	return grub_errno;
+      grub_memcpy (*foundnode, e->node, e->node_size);
+      (*foundnode)->data = dir->data;
+      *foundtype = e->type;
+      return GRUB_ERR_NONE;
+    }
+
+  return GRUB_ERR_NONE;
+}
+
 static grub_err_t
 grub_iso9660_dir (grub_device_t device, const char *path,
 		  grub_fs_dir_hook_t hook, void *hook_data)
@@ -888,11 +1120,12 @@ grub_iso9660_dir (grub_device_t device, const char *path,
   rootnode.dirents[0] = data->voldesc.rootdir;
 
   /* Use the fshelp function to traverse the path.  */
-  if (grub_fshelp_find_file (path, &rootnode,
-			     &foundnode,
-			     grub_iso9660_iterate_dir,
-			     grub_iso9660_read_symlink,
-			     GRUB_FSHELP_DIR))
+  if (grub_fshelp_find_file_cached (path, &rootnode,
+				    &foundnode,
+				    NULL, grub_iso9660_lookup_file,
+				    grub_iso9660_read_symlink,
+				    GRUB_FSHELP_DIR, data->disk,
+				    &grub_iso9660_cache_ops))
     goto fail;
 
   /* List the files in the directory.  */
@@ -931,11 +1164,12 @@ grub_iso9660_open (struct grub_file *file, const char *name)
   rootnode.dirents[0] = data->voldesc.rootdir;
 
   /* Use the fshelp function to traverse the path.  */
-  if (grub_fshelp_find_file (name, &rootnode,
-			     &foundnode,
-			     grub_iso9660_iterate_dir,
-			     grub_iso9660_read_symlink,
-			     GRUB_FSHELP_REG))
+  if (grub_fshelp_find_file_cached (name, &rootnode,
+				    &foundnode,
+				    NULL, grub_iso9660_lookup_file,
+				    grub_iso9660_read_symlink,
+				    GRUB_FSHELP_REG, data->disk,
+				    &grub_iso9660_cache_ops))
     goto fail;
 
   data->node = foundnode;
@@ -1100,6 +1334,12 @@ grub_iso9660_mtime (grub_device_t device, grub_int32_t *timebuf)
 
 
 
+static const struct grub_fs_magic grub_iso9660_magics[] =
+  {
+    { 16 * 2048 + 1, 5, "CD001" },
+    { 0, 0, 0 }
+  };
+
 static struct grub_fs grub_iso9660_fs =
   {
     .name = "iso9660",
@@ -1110,6 +1350,7 @@ static struct grub_fs grub_iso9660_fs =
     .label = grub_iso9660_label,
     .uuid = grub_iso9660_uuid,
     .mtime = grub_iso9660_mtime,
+    .magics = grub_iso9660_magics,
 #ifdef GRUB_UTIL
     .reserved_first_sector = 1,
     .blocklist_install = 1,
@@ -1126,4 +1367,5 @@ GRUB_MOD_INIT(iso9660)
 GRUB_MOD_FINI(iso9660)
 {
   grub_fs_unregister (&grub_iso9660_fs);
+  dir_index_flush ();
 }
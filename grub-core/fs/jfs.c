@@ -26,6 +26,7 @@
 #include <grub/types.h>
 #include <grub/charset.h>
 #include <grub/i18n.h>
+#include <grub/partition.h>
 
 GRUB_MOD_LICENSE ("GPLv3+");
 
@@ -254,10 +255,85 @@ struct grub_jfs_diropen
 } GRUB_PACKED;
 
 
+/* Pages of the extent and directory trees, kept across mounts.  The
+   inode map is walked for every inode read and a file's extent tree for
+   every block of it, so the same few pages are asked for over and over.
+   The table is direct-mapped on the block number.  */
+#define JFS_NODE_CACHE_SIZE 32
+
+struct grub_jfs_node_cache
+{
+  unsigned long dev_id;
+  unsigned long disk_id;
+  grub_disk_addr_t part_start;
+  grub_uint64_t blk;
+  grub_size_t size;
+  char *buf;
+};
+
+static struct grub_jfs_node_cache node_cache[JFS_NODE_CACHE_SIZE];
+static unsigned long node_cache_generation;
+
 static grub_dl_t my_mod;
 
 static grub_err_t grub_jfs_lookup_symlink (struct grub_jfs_data *data, grub_uint32_t ino);
 
+static void
+node_cache_flush (void)
+{
+  unsigned i;
+
+  for (i = 0; i < JFS_NODE_CACHE_SIZE; i++)
+    {
+      grub_free (node_cache[i].buf);
+      node_cache[i].buf = NULL;
+    }
+}
+
+/* Return the first SIZE bytes of the filesystem block BLK.  They stay
+   valid until the next call and must not be modified.  */
+static void *
+grub_jfs_read_node (struct grub_jfs_data *data, grub_uint64_t blk,
+		    grub_size_t size)
+{
+  grub_disk_addr_t part_start = grub_partition_get_start (data->disk->partition);
+  struct grub_jfs_node_cache *slot;
+  char *buf;
+
+  if (node_cache_generation != grub_disk_generation)
+    {
+      node_cache_flush ();
+      node_cache_generation = grub_disk_generation;
+    }
+
+  slot = &node_cache[blk % JFS_NODE_CACHE_SIZE];
+  if (slot->buf && slot->blk == blk && slot->size == size
+      && slot->dev_id == data->disk->dev->id
+      && slot->disk_id == data->disk->id && slot->part_start == part_start)
+    return slot->buf;
+
+  buf = grub_malloc (size);
+  if (!buf)
+    return NULL;
+  if (grub_disk_read (data->disk,
+		      blk << (grub_le_to_cpu16 (data->sblock.log2_blksz)
+			      - GRUB_DISK_SECTOR_BITS), 0, size, buf))
+    {
+      grub_free (buf);
+      return NULL;
+    }
+
+  grub_free (slot->buf);
+  slot->dev_id = data->disk->dev->id;
+  slot->disk_id = data->disk->id;
+  slot->part_start = part_start;
+  slot->blk = blk;
+  slot->size = size;
+  slot->buf = buf;
+
+  return buf;
+}
+
 static grub_int64_t
 getblk (struct grub_jfs_treehead *treehead,
 	struct grub_jfs_tree_extent *extents,
@@ -286,25 +362,20 @@ getblk (struct grub_jfs_treehead *treehead,
 
   if (found != -1)
     {
-      grub_int64_t ret = -1;
       struct
       {
 	struct grub_jfs_treehead treehead;
 	struct grub_jfs_tree_extent extents[254];
       } *tree;
 
-      tree = grub_zalloc (sizeof (*tree));
+      /* TREEHEAD and EXTENTS may point into the cached parent, which
+	 this can evict; nothing of them is used past this point.  */
+      tree = grub_jfs_read_node (data,
+				 grub_le_to_cpu32 (extents[found].extent.blk2),
+				 sizeof (*tree));
       if (!tree)
 	return -1;
-
-      if (!grub_disk_read (data->disk,
-			   ((grub_disk_addr_t) grub_le_to_cpu32 (extents[found].extent.blk2))
-			   << (grub_le_to_cpu16 (data->sblock.log2_blksz)
-			       - GRUB_DISK_SECTOR_BITS), 0,
-			   sizeof (*tree), (char *) tree))
-	ret = getblk (&tree->treehead, &tree->extents[0], data, blk);
-      grub_free (tree);
-      return ret;
+      return getblk (&tree->treehead, &tree->extents[0], data, blk);
     }
 
   return -1;
@@ -458,26 +529,28 @@ grub_jfs_opendir (struct grub_jfs_data *data, struct grub_jfs_inode *inode)
     }
 
   blk = grub_le_to_cpu32 (de[inode->dir.header.sorted[0]].ex.blk2);
-  blk <<= (grub_le_to_cpu16 (data->sblock.log2_blksz) - GRUB_DISK_SECTOR_BITS);
 
-  /* Read in the nodes until we are on the leaf node level.  */
+  /* Read in the nodes until we are on the leaf node level.  The internal
+     nodes come from the cache; the leaf is copied out since getent
+     follows the sibling chain in place.  */
   do
     {
       int index;
-      if (grub_disk_read (data->disk, blk, 0,
-			  grub_le_to_cpu32 (data->sblock.blksz),
-			  diro->dirpage->sorted))
+      void *node;
+
+      node = grub_jfs_read_node (data, blk,
+				 grub_le_to_cpu32 (data->sblock.blksz));
+      if (!node)
 	{
 	  grub_free (diro->dirpage);
 	  grub_free (diro);
 	  return 0;
 	}
+      grub_memcpy (diro->dirpage, node, grub_le_to_cpu32 (data->sblock.blksz));
 
       de = (struct grub_jfs_internal_dirent *) diro->dirpage->dirent;
       index = diro->dirpage->sorted[diro->dirpage->header.sindex * 32];
-      blk = (grub_le_to_cpu32 (de[index].ex.blk2)
-	     << (grub_le_to_cpu16 (data->sblock.log2_blksz)
-		 - GRUB_DISK_SECTOR_BITS));
+      blk = grub_le_to_cpu32 (de[index].ex.blk2);
     } while (!(diro->dirpage->header.flags & GRUB_JFS_TREE_LEAF));
 
   diro->leaf = diro->dirpage->dirent;
@@ -927,6 +1000,12 @@ grub_jfs_label (grub_device_t device, char **label)
 }
 
 
+static const struct grub_fs_magic grub_jfs_magics[] =
+  {
+    { GRUB_JFS_SBLOCK << GRUB_DISK_SECTOR_BITS, 4, "JFS1" },
+    { 0, 0, 0 }
+  };
+
 static struct grub_fs grub_jfs_fs =
   {
     .name = "jfs",
@@ -936,6 +1015,7 @@ static struct grub_fs grub_jfs_fs =
     .close = grub_jfs_close,
     .label = grub_jfs_label,
     .uuid = grub_jfs_uuid,
+    .magics = grub_jfs_magics,
 #ifdef GRUB_UTIL
     .reserved_first_sector = 1,
     .blocklist_install = 1,
@@ -952,4 +1032,5 @@ GRUB_MOD_INIT(jfs)
 GRUB_MOD_FINI(jfs)
 {
   grub_fs_unregister (&grub_jfs_fs);
+  node_cache_flush ();
 }
@@ -25,6 +25,7 @@
 #include <grub/disk.h>
 #include <grub/dl.h>
 #include <grub/fshelp.h>
+#include <grub/partition.h>
 #include <grub/ntfs.h>
 #include <grub/charset.h>
 
@@ -107,7 +108,10 @@ init_attr (struct grub_ntfs_attr *at, struct grub_ntfs_file *mft)
   at->mft = mft;
   at->flags = (mft == &mft->data->mmft) ? GRUB_NTFS_AF_MMFT : 0;
   at->attr_nxt = mft->buf + u16at (mft->buf, 0x14);
-  at->attr_end = at->emft_buf = at->edat_buf = at->sbuf = NULL;
+  at->attr_end = at->emft_buf = at->edat_buf = NULL;
+  at->runs_attr = NULL;
+  at->runs = NULL;
+  at->n_runs = 0;
 }
 
 static void
@@ -115,7 +119,7 @@ free_attr (struct grub_ntfs_attr *at)
 {
   grub_free (at->emft_buf);
   grub_free (at->edat_buf);
-  grub_free (at->sbuf);
+  grub_free (at->runs);
 }
 
 static grub_uint8_t *
@@ -362,6 +366,123 @@ grub_ntfs_read_block (grub_fshelp_node_t node, grub_disk_addr_t block)
 					 ctx->curr_vcn + ctx->curr_lcn);
 }
 
+/* Decode the whole run list of the non-resident attribute PA into AT.  */
+static grub_err_t
+decode_runs (struct grub_ntfs_attr *at, grub_uint8_t *pa)
+{
+  grub_uint8_t *run = pa + u16at (pa, 0x20);
+  grub_uint8_t *end = pa + u32at (pa, 4);
+  grub_disk_addr_t vcn = u64at (pa, 0x10), lcn = 0;
+  grub_size_t alloc = 0;
+
+  grub_free (at->runs);
+  at->runs = NULL;
+  at->n_runs = 0;
+  at->runs_attr = NULL;
+
+  while (run < end && *run)
+    {
+      grub_uint8_t c1 = (*run) & 0x7, c2 = ((*run) >> 4) & 0x7;
+      grub_disk_addr_t val;
+      struct grub_ntfs_run *r;
+
+      if (!c1 || run + 1 + c1 + c2 > end)
+	return grub_error (GRUB_ERR_BAD_FS, "invalid run list");
+      if (at->n_runs == alloc)
+	{
+	  struct grub_ntfs_run *new_runs;
+
+	  alloc = alloc ? 2 * alloc : 16;
+	  new_runs = grub_realloc (at->runs, alloc * sizeof (at->runs[0]));
+	  if (!new_runs)
+	    return grub_errno;
+	  at->runs = new_runs;
+	}
+      run++;
+      r = &at->runs[at->n_runs++];
+      r->vcn = vcn;
+      vcn += read_run_data (run, c1, 0);
+      r->next_vcn = vcn;
+      run += c1;
+      val = read_run_data (run, c2, 1);
+      run += c2;
+      lcn += val;
+      r->lcn = val ? lcn : 0;
+    }
+
+  at->runs_attr = pa;
+  return GRUB_ERR_NONE;
+}
+
+/* Read LEN bytes at OFS of the attribute whose runs are decoded in AT,
+   with one disk read per run.  */
+static grub_err_t
+read_runs (struct grub_ntfs_attr *at, grub_uint8_t *dest,
+	   grub_disk_addr_t ofs, grub_size_t len,
+	   grub_disk_read_hook_t read_hook, void *read_hook_data)
+{
+  grub_disk_t disk = at->mft->data->disk;
+  int log_spc = at->mft->data->log_spc;
+  int shift = log_spc + GRUB_NTFS_BLK_SHR;
+  grub_size_t lo = 0, hi;
+
+  while (len)
+    {
+      grub_disk_addr_t vcn = ofs >> shift;
+      struct grub_ntfs_run *r;
+      grub_size_t n;
+
+      /* Find the run holding VCN.  Reads are mostly sequential, so try the
+	 one after the last first.  */
+      if (!(lo < at->n_runs && at->runs[lo].vcn <= vcn
+	    && vcn < at->runs[lo].next_vcn))
+	{
+	  lo = 0;
+	  hi = at->n_runs;
+	  while (lo < hi)
+	    {
+	      grub_size_t mid = (lo + hi) / 2;
+
+	      if (at->runs[mid].next_vcn <= vcn)
+		lo = mid + 1;
+	      else
+		hi = mid;
+	    }
+	  if (lo == at->n_runs || at->runs[lo].vcn > vcn)
+	    return grub_error (GRUB_ERR_BAD_FS, "run list overflown");
+	}
+      r = &at->runs[lo];
+
+      n = len;
+      if (n > (r->next_vcn << shift) - ofs)
+	n = (r->next_vcn << shift) - ofs;
+
+      if (r->lcn == 0)
+	grub_memset (dest, 0, n);
+      else
+	{
+	  grub_err_t err;
+
+	  disk->read_hook = read_hook;
+	  disk->read_hook_data = read_hook_data;
+	  err = grub_disk_read (disk, (r->lcn << log_spc)
+				+ (ofs >> GRUB_NTFS_BLK_SHR)
+				- (r->vcn << log_spc),
+				ofs & (GRUB_DISK_SECTOR_SIZE - 1), n, dest);
+	  disk->read_hook = 0;
+	  if (err)
+	    return err;
+	}
+
+      dest += n;
+      ofs += n;
+      len -= n;
+      lo++;
+    }
+
+  return GRUB_ERR_NONE;
+}
+
 static grub_err_t
 read_data (struct grub_ntfs_attr *at, grub_uint8_t *pa, grub_uint8_t *dest,
 	   grub_disk_addr_t ofs, grub_size_t len, int cached,
@@ -405,6 +526,18 @@ read_data (struct grub_ntfs_attr *at, grub_uint8_t *pa, grub_uint8_t *dest,
 		      "ntfscomp");
     }
 
+  /* Attributes held in the record itself stay where they are, so their
+     runs only need decoding once.  Those spread over an attribute list
+     are found one extent at a time.  */
+  if (!(at->flags & (GRUB_NTFS_AF_ALST | GRUB_NTFS_AF_GPOS))
+      && pa >= at->mft->buf
+      && pa < at->mft->buf + (at->mft->data->mft_size << GRUB_NTFS_BLK_SHR))
+    {
+      if (at->runs_attr != pa && decode_runs (at, pa))
+	return grub_errno;
+      return read_runs (at, dest, ofs, len, read_hook, read_hook_data);
+    }
+
   ctx->target_vcn = ofs >> (GRUB_NTFS_BLK_SHR + ctx->comp.log_spc);
   while (ctx->next_vcn <= ctx->target_vcn)
     {
@@ -490,14 +623,86 @@ read_attr (struct grub_ntfs_attr *at, grub_uint8_t *dest, grub_disk_addr_t ofs,
   return ret;
 }
 
+/* Fixed-up MFT records, kept across mounts.  The table is direct-mapped
+   on the record number.  */
+#define MFT_CACHE_SIZE 64
+
+struct grub_ntfs_mft_cache
+{
+  unsigned long dev_id;
+  unsigned long disk_id;
+  grub_disk_addr_t part_start;
+  grub_uint64_t mftno;
+  grub_size_t size;
+  grub_uint8_t *buf;
+};
+
+static struct grub_ntfs_mft_cache mft_cache[MFT_CACHE_SIZE];
+static unsigned long mft_cache_generation;
+
+static void
+mft_cache_flush (void)
+{
+  unsigned i;
+
+  for (i = 0; i < MFT_CACHE_SIZE; i++)
+    {
+      grub_free (mft_cache[i].buf);
+      mft_cache[i].buf = NULL;
+    }
+}
+
+static struct grub_ntfs_mft_cache *
+mft_cache_slot (grub_uint64_t mftno)
+{
+  if (mft_cache_generation != grub_disk_generation)
+    {
+      mft_cache_flush ();
+      mft_cache_generation = grub_disk_generation;
+    }
+  return &mft_cache[mftno % MFT_CACHE_SIZE];
+}
+
 static grub_err_t
 read_mft (struct grub_ntfs_data *data, grub_uint8_t *buf, grub_uint64_t mftno)
 {
+  grub_disk_addr_t part_start = grub_partition_get_start (data->disk->partition);
+  grub_size_t size = data->mft_size << GRUB_NTFS_BLK_SHR;
+  struct grub_ntfs_mft_cache *slot = mft_cache_slot (mftno);
+
+  if (slot->buf && slot->mftno == mftno && slot->size == size
+      && slot->dev_id == data->disk->dev->id
+      && slot->disk_id == data->disk->id && slot->part_start == part_start)
+    {
+      grub_memcpy (buf, slot->buf, size);
+      return GRUB_ERR_NONE;
+    }
+
   if (read_attr
       (&data->mmft.attr, buf, mftno * ((grub_disk_addr_t) data->mft_size << GRUB_NTFS_BLK_SHR),
        data->mft_size << GRUB_NTFS_BLK_SHR, 0, 0, 0))
     return grub_error (GRUB_ERR_BAD_FS, "read MFT 0x%llx fails", (unsigned long long) mftno);
-  return fixup (buf, data->mft_size, (const grub_uint8_t *) "FILE");
+  if (fixup (buf, data->mft_size, (const grub_uint8_t *) "FILE"))
+    return grub_errno;
+
+  if (!slot->buf || slot->size != size)
+    {
+      grub_free (slot->buf);
+      slot->buf = grub_malloc (size);
+      if (!slot->buf)
+	{
+	  /* Not being able to cache the record is not an error.  */
+	  grub_errno = GRUB_ERR_NONE;
+	  return GRUB_ERR_NONE;
+	}
+    }
+  grub_memcpy (slot->buf, buf, size);
+  slot->dev_id = data->disk->dev->id;
+  slot->disk_id = data->disk->id;
+  slot->part_start = part_start;
+  slot->mftno = mftno;
+  slot->size = size;
+  return GRUB_ERR_NONE;
 }
 
 static grub_err_t
@@ -1094,9 +1299,6 @@ grub_ntfs_read (grub_file_t file, char *buf, grub_size_t len)
   struct grub_ntfs_file *mft;
 
   mft = &((struct grub_ntfs_data *) file->data)->cmft;
-  if (file->read_hook)
-    mft->attr.save_pos = 1;
-
   read_attr (&mft->attr, (grub_uint8_t *) buf, file->offset, len, 1,
 	     file->read_hook, file->read_hook_data);
   return (grub_errno) ? -1 : (grub_ssize_t) len;
@@ -1209,6 +1411,12 @@ grub_ntfs_uuid (grub_device_t device, char **uuid)
   return grub_errno;
 }
 
+static const struct grub_fs_magic grub_ntfs_magics[] =
+  {
+    { 3, 4, "NTFS" },
+    { 0, 0, 0 }
+  };
+
 static struct grub_fs grub_ntfs_fs =
   {
     .name = "ntfs",
@@ -1218,6 +1426,7 @@ static struct grub_fs grub_ntfs_fs =
     .close = grub_ntfs_close,
     .label = grub_ntfs_label,
     .uuid = grub_ntfs_uuid,
+    .magics = grub_ntfs_magics,
 #ifdef GRUB_UTIL
     .reserved_first_sector = 1,
     .blocklist_install = 1,
@@ -1234,4 +1443,5 @@ GRUB_MOD_INIT (ntfs)
 GRUB_MOD_FINI (ntfs)
 {
   grub_fs_unregister (&grub_ntfs_fs);
+  mft_cache_flush ();
 }
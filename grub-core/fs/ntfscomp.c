@@ -22,414 +22,411 @@
 #include <grub/disk.h>
 #include <grub/dl.h>
 #include <grub/ntfs.h>
+#include <grub/fshelp.h>
+#include <grub/job.h>
 
 GRUB_MOD_LICENSE ("GPLv3+");
 
-static grub_err_t
-decomp_nextvcn (struct grub_ntfs_comp *cc)
+/* Data is compressed in units of 16 clusters, each made of LZNT1 chunks
+   which decompress to GRUB_NTFS_COM_LEN bytes.  Decompressed units go to
+   the fshelp unit cache under the MFT record and attribute type, and
+   while processors are idle the units after a read are decoded there
+   ahead of time.  */
+#define UNIT_CLUSTERS 16
+
+/* Units of a large read worked on at once.  */
+#define UNIT_BATCH 8
+
+/* Units decoded ahead of a read.  */
+#define UNIT_AHEAD 2
+
+enum
+  {
+    DECODE_OK,
+    DECODE_OVERFLOWN,
+    DECODE_BAD_SIZE,
+    DECODE_TOO_LARGE,
+    DECODE_EMPTY_WINDOW
+  };
+
+/* Decompress the LZNT1 chunks at SRC, SRC_SIZE bytes long, into the
+   DEST_SIZE bytes of DEST.  Chunks missing at the end are zero.  This only
+   touches SRC and DEST, so it can run as a job.  */
+static int
+decode_chunks (const grub_uint8_t *src, grub_size_t src_size,
+	       grub_uint8_t *dest, grub_size_t dest_size)
 {
-  if (cc->comp_head >= cc->comp_tail)
-    return grub_error (GRUB_ERR_BAD_FS, "compression block overflown");
-  if (grub_disk_read
-      (cc->disk,
-       (cc->comp_table[cc->comp_head].next_lcn -
-	(cc->comp_table[cc->comp_head].next_vcn - cc->cbuf_vcn)) << cc->log_spc,
-       0,
-       1 << (cc->log_spc + GRUB_NTFS_BLK_SHR), cc->cbuf))
-    return grub_errno;
-  cc->cbuf_vcn++;
-  if ((cc->cbuf_vcn >= cc->comp_table[cc->comp_head].next_vcn))
-    cc->comp_head++;
-  cc->cbuf_ofs = 0;
-  return 0;
-}
+  const grub_uint8_t *end = src + src_size;
+  grub_size_t out;
 
-static grub_err_t
-decomp_getch (struct grub_ntfs_comp *cc, grub_uint8_t *res)
-{
-  if (cc->cbuf_ofs >= (1U << (cc->log_spc + GRUB_NTFS_BLK_SHR)))
+  for (out = 0; out < dest_size; out += GRUB_NTFS_COM_LEN)
     {
-      if (decomp_nextvcn (cc))
-	return grub_errno;
-    }
-  *res = cc->cbuf[cc->cbuf_ofs++];
-  return 0;
-}
-
-static grub_err_t
-decomp_get16 (struct grub_ntfs_comp *cc, grub_uint16_t * res)
-{
-  grub_uint8_t c1 = 0, c2 = 0;
-
-  if ((decomp_getch (cc, &c1)) || (decomp_getch (cc, &c2)))
-    return grub_errno;
-  *res = ((grub_uint16_t) c2) * 256 + ((grub_uint16_t) c1);
-  return 0;
-}
-
-/* Decompress a block (4096 bytes) */
-static grub_err_t
-decomp_block (struct grub_ntfs_comp *cc, grub_uint8_t *dest)
-{
-  grub_uint16_t flg, cnt;
+      grub_uint8_t *chunk = dest + out;
+      const grub_uint8_t *chunk_end;
+      grub_uint32_t copied = 0;
+      grub_uint16_t flg;
+      grub_size_t cnt;
 
-  if (decomp_get16 (cc, &flg))
-    return grub_errno;
-  cnt = (flg & 0xFFF) + 1;
+      if (end - src < 2 || (src[0] == 0 && src[1] == 0))
+	{
+	  grub_memset (chunk, 0, dest_size - out);
+	  break;
+	}
+      flg = src[0] | (src[1] << 8);
+      src += 2;
+      cnt = (flg & 0xFFF) + 1;
+      if (cnt > (grub_size_t) (end - src))
+	return DECODE_OVERFLOWN;
+      chunk_end = src + cnt;
+
+      if (!(flg & 0x8000))
+	{
+	  if (cnt != GRUB_NTFS_COM_LEN)
+	    return DECODE_BAD_SIZE;
+	  grub_memcpy (chunk, src, GRUB_NTFS_COM_LEN);
+	  src = chunk_end;
+	  continue;
+	}
 
-  if (dest)
-    {
-      if (flg & 0x8000)
+      while (src < chunk_end)
 	{
-	  grub_uint8_t tag;
-	  grub_uint32_t bits, copied;
+	  grub_uint8_t tag = *src++;
+	  int bits;
 
-	  bits = copied = tag = 0;
-	  while (cnt > 0)
+	  for (bits = 8; bits && src < chunk_end; bits--, tag >>= 1)
 	    {
-	      if (copied > GRUB_NTFS_COM_LEN)
-		return grub_error (GRUB_ERR_BAD_FS,
-				   "compression block too large");
+	      grub_uint32_t i, len, delta, code, lmask, dshift;
 
-	      if (!bits)
+	      if (!(tag & 1))
 		{
-		  if (decomp_getch (cc, &tag))
-		    return grub_errno;
-
-		  bits = 8;
-		  cnt--;
-		  if (cnt <= 0)
-		    break;
+		  if (copied >= GRUB_NTFS_COM_LEN)
+		    return DECODE_TOO_LARGE;
+		  chunk[copied++] = *src++;
+		  continue;
 		}
-	      if (tag & 1)
+
+	      if (chunk_end - src < 2)
+		return DECODE_OVERFLOWN;
+	      code = src[0] | (src[1] << 8);
+	      src += 2;
+
+	      if (!copied)
+		return DECODE_EMPTY_WINDOW;
+
+	      for (i = copied - 1, lmask = 0xFFF, dshift = 12; i >= 0x10;
+		   i >>= 1)
 		{
-		  grub_uint32_t i, len, delta, code, lmask, dshift;
-		  grub_uint16_t word;
-
-		  if (decomp_get16 (cc, &word))
-		    return grub_errno;
-
-		  code = word;
-		  cnt -= 2;
-
-		  if (!copied)
-		    {
-		      grub_error (GRUB_ERR_BAD_FS, "nontext window empty");
-		      return 0;
-		    }
-
-		  for (i = copied - 1, lmask = 0xFFF, dshift = 12; i >= 0x10;
-		       i >>= 1)
-		    {
-		      lmask >>= 1;
-		      dshift--;
-		    }
-
-		  delta = code >> dshift;
-		  len = (code & lmask) + 3;
-
-		  for (i = 0; i < len; i++)
-		    {
-		      dest[copied] = dest[copied - delta - 1];
-		      copied++;
-		    }
+		  lmask >>= 1;
+		  dshift--;
 		}
-	      else
-		{
-		  grub_uint8_t ch = 0;
 
-		  if (decomp_getch (cc, &ch))
-		    return grub_errno;
-		  dest[copied++] = ch;
-		  cnt--;
-		}
-	      tag >>= 1;
-	      bits--;
+	      delta = (code >> dshift) + 1;
+	      len = (code & lmask) + 3;
+	      if (delta > copied || len > GRUB_NTFS_COM_LEN - copied)
+		return DECODE_TOO_LARGE;
+
+	      for (i = 0; i < len; i++, copied++)
+		chunk[copied] = chunk[copied - delta];
 	    }
-	  return 0;
-	}
-      else
-	{
-	  if (cnt != GRUB_NTFS_COM_LEN)
-	    return grub_error (GRUB_ERR_BAD_FS,
-			       "invalid compression block size");
 	}
+      grub_memset (chunk + copied, 0, GRUB_NTFS_COM_LEN - copied);
     }
+  return DECODE_OK;
+}
 
-  while (cnt > 0)
+static grub_err_t
+decode_error (int err)
+{
+  switch (err)
     {
-      int n;
-
-      n = (1 << (cc->log_spc + GRUB_NTFS_BLK_SHR)) - cc->cbuf_ofs;
-      if (n > cnt)
-	n = cnt;
-      if ((dest) && (n))
-	{
-	  grub_memcpy (dest, &cc->cbuf[cc->cbuf_ofs], n);
-	  dest += n;
-	}
-      cnt -= n;
-      cc->cbuf_ofs += n;
-      if ((cnt) && (decomp_nextvcn (cc)))
-	return grub_errno;
+    case DECODE_OK:
+      return GRUB_ERR_NONE;
+    case DECODE_OVERFLOWN:
+      return grub_error (GRUB_ERR_BAD_FS, "compression block overflown");
+    case DECODE_BAD_SIZE:
+      return grub_error (GRUB_ERR_BAD_FS, "invalid compression block size");
+    case DECODE_EMPTY_WINDOW:
+      return grub_error (GRUB_ERR_BAD_FS, "nontext window empty");
+    default:
+      return grub_error (GRUB_ERR_BAD_FS, "compression block too large");
     }
-  return 0;
 }
 
-static grub_err_t
-read_block (struct grub_ntfs_rlst *ctx, grub_uint8_t *buf, grub_size_t num)
+static void
+decode_unit_job (struct grub_job *job)
+{
+  struct grub_fshelp_unit *unit = (struct grub_fshelp_unit *) job;
+
+  unit->err = decode_chunks (unit->src, unit->src_size,
+			     unit->data, unit->size);
+}
+
+enum
+  {
+    UNIT_SPARSE,
+    UNIT_COMPRESSED,
+    UNIT_PLAIN
+  };
+
+/* Find the runs of the unit starting at VCN.  Return its kind and set
+   CLUSTERS to the number of clusters it has on disk.  The run list only
+   moves forward, so units must be located in ascending order.  */
+static int
+locate_unit (struct grub_ntfs_rlst *ctx, grub_disk_addr_t vcn,
+	     grub_disk_addr_t *clusters)
 {
-  int log_cpb = GRUB_NTFS_LOG_COM_SEC - ctx->comp.log_spc;
+  struct grub_ntfs_comp *cc = &ctx->comp;
+
+  while (ctx->next_vcn <= vcn)
+    if (grub_ntfs_read_run_list (ctx))
+      return -1;
 
-  while (num)
+  /* A unit is compressed if it ends in a sparse run, and holds nothing
+     at all if it begins in one.  */
+  cc->comp_tail = 0;
+  while (vcn + UNIT_CLUSTERS > ctx->next_vcn
+	 && !(ctx->flags & GRUB_NTFS_RF_BLNK))
     {
-      grub_size_t nn;
+      cc->comp_table[cc->comp_tail].next_vcn = ctx->next_vcn;
+      cc->comp_table[cc->comp_tail].next_lcn =
+	ctx->curr_lcn + ctx->next_vcn - ctx->curr_vcn;
+      cc->comp_tail++;
+      if (grub_ntfs_read_run_list (ctx))
+	return -1;
+    }
 
-      if ((ctx->target_vcn & 0xF) == 0)
-	{
+  if (!(ctx->flags & GRUB_NTFS_RF_BLNK))
+    {
+      *clusters = UNIT_CLUSTERS;
+      return UNIT_PLAIN;
+    }
+  if (cc->comp_tail == 0)
+    {
+      *clusters = 0;
+      return UNIT_SPARSE;
+    }
+  *clusters = cc->comp_table[cc->comp_tail - 1].next_vcn - vcn;
+  return UNIT_COMPRESSED;
+}
 
-	  if (ctx->comp.comp_head != ctx->comp.comp_tail
-	      && !(ctx->flags & GRUB_NTFS_RF_BLNK))
-	    return grub_error (GRUB_ERR_BAD_FS, "invalid compression block");
-	  ctx->comp.comp_head = ctx->comp.comp_tail = 0;
-	  ctx->comp.cbuf_vcn = ctx->target_vcn;
-	  ctx->comp.cbuf_ofs = (1 << (ctx->comp.log_spc + GRUB_NTFS_BLK_SHR));
-	  if (ctx->target_vcn >= ctx->next_vcn)
-	    {
-	      if (grub_ntfs_read_run_list (ctx))
-		return grub_errno;
-	    }
-	  while (ctx->target_vcn + 16 > ctx->next_vcn)
-	    {
-	      if (ctx->flags & GRUB_NTFS_RF_BLNK)
-		break;
-	      ctx->comp.comp_table[ctx->comp.comp_tail].next_vcn = ctx->next_vcn;
-	      ctx->comp.comp_table[ctx->comp.comp_tail].next_lcn =
-		ctx->curr_lcn + ctx->next_vcn - ctx->curr_vcn;
-	      ctx->comp.comp_tail++;
-	      if (grub_ntfs_read_run_list (ctx))
-		return grub_errno;
-	    }
-	}
+/* Read LEN bytes at OFS of the clusters on disk of the unit at VCN,
+   located last, into BUF.  */
+static grub_err_t
+read_raw (struct grub_ntfs_rlst *ctx, grub_disk_addr_t vcn,
+	  grub_size_t ofs, grub_size_t len, grub_uint8_t *buf)
+{
+  struct grub_ntfs_comp *cc = &ctx->comp;
+  int shift = cc->log_spc + GRUB_NTFS_BLK_SHR;
+  grub_disk_addr_t v = vcn + (ofs >> shift);
+  grub_size_t skip = ofs & ((1 << shift) - 1);
+  int i;
 
-      nn = (16 - (unsigned) (ctx->target_vcn & 0xF)) >> log_cpb;
-      if (nn > num)
-	nn = num;
-      num -= nn;
+  for (i = 0; i <= cc->comp_tail && len; i++)
+    {
+      grub_disk_addr_t lcn;
+      grub_size_t cnt;
 
-      if (ctx->flags & GRUB_NTFS_RF_BLNK)
+      if (i < cc->comp_tail)
 	{
-	  ctx->target_vcn += nn << log_cpb;
-	  if (ctx->comp.comp_tail == 0)
-	    {
-	      if (buf)
-		{
-		  grub_memset (buf, 0, nn * GRUB_NTFS_COM_LEN);
-		  buf += nn * GRUB_NTFS_COM_LEN;
-		  if (grub_file_progress_hook && ctx->file)
-		    grub_file_progress_hook (0, 0, nn * GRUB_NTFS_COM_LEN,
-					     ctx->file);
-		}
-	    }
-	  else
-	    {
-	      while (nn)
-		{
-		  if (decomp_block (&ctx->comp, buf))
-		    return grub_errno;
-		  if (buf)
-		    buf += GRUB_NTFS_COM_LEN;
-		  if (grub_file_progress_hook && ctx->file)
-		    grub_file_progress_hook (0, 0, GRUB_NTFS_COM_LEN,
-					     ctx->file);
-		  nn--;
-		}
-	    }
+	  if (v >= cc->comp_table[i].next_vcn)
+	    continue;
+	  lcn = cc->comp_table[i].next_lcn - (cc->comp_table[i].next_vcn - v);
+	  cnt = ((cc->comp_table[i].next_vcn - v) << shift) - skip;
 	}
       else
 	{
-	  nn <<= log_cpb;
-	  while ((ctx->comp.comp_head < ctx->comp.comp_tail) && (nn))
-	    {
-	      grub_disk_addr_t tt;
-
-	      tt =
-		ctx->comp.comp_table[ctx->comp.comp_head].next_vcn -
-		ctx->target_vcn;
-	      if (tt > nn)
-		tt = nn;
-	      ctx->target_vcn += tt;
-	      if (buf)
-		{
-		  if (grub_disk_read
-		      (ctx->comp.disk,
-		       (ctx->comp.comp_table[ctx->comp.comp_head].next_lcn -
-			(ctx->comp.comp_table[ctx->comp.comp_head].next_vcn -
-			 ctx->target_vcn)) << ctx->comp.log_spc, 0,
-		       tt << (ctx->comp.log_spc + GRUB_NTFS_BLK_SHR), buf))
-		    return grub_errno;
-		  if (grub_file_progress_hook && ctx->file)
-		    grub_file_progress_hook (0, 0,
-					     tt << (ctx->comp.log_spc
-						    + GRUB_NTFS_BLK_SHR),
-					     ctx->file);
-		  buf += tt << (ctx->comp.log_spc + GRUB_NTFS_BLK_SHR);
-		}
-	      nn -= tt;
-	      if (ctx->target_vcn >=
-		  ctx->comp.comp_table[ctx->comp.comp_head].next_vcn)
-		ctx->comp.comp_head++;
-	    }
-	  if (nn)
-	    {
-	      if (buf)
-		{
-		  if (grub_disk_read
-		      (ctx->comp.disk,
-		       (ctx->target_vcn - ctx->curr_vcn +
-			ctx->curr_lcn) << ctx->comp.log_spc, 0,
-		       nn << (ctx->comp.log_spc + GRUB_NTFS_BLK_SHR), buf))
-		    return grub_errno;
-		  buf += nn << (ctx->comp.log_spc + GRUB_NTFS_BLK_SHR);
-		  if (grub_file_progress_hook && ctx->file)
-		    grub_file_progress_hook (0, 0,
-					     nn << (ctx->comp.log_spc
-						    + GRUB_NTFS_BLK_SHR),
-					     ctx->file);
-		}
-	      ctx->target_vcn += nn;
-	    }
+	  /* The rest of a plain unit is in the current run.  */
+	  lcn = ctx->curr_lcn + v - ctx->curr_vcn;
+	  cnt = len;
 	}
+      if (cnt > len)
+	cnt = len;
+      if (grub_disk_read (cc->disk, lcn << cc->log_spc, skip, cnt, buf))
+	return grub_errno;
+      buf += cnt;
+      len -= cnt;
+      v += (skip + cnt) >> shift;
+      skip = 0;
     }
-  return 0;
+  return GRUB_ERR_NONE;
 }
 
+/* Put LEN bytes at OFS of the unit at VCN, located last as KIND with N
+   clusters on disk, into DEST.  Compressed units must be read whole.  */
 static grub_err_t
-ntfscomp (grub_uint8_t *dest, grub_disk_addr_t ofs,
-	  grub_size_t len, struct grub_ntfs_rlst *ctx)
+read_unit (struct grub_ntfs_rlst *ctx, grub_disk_addr_t vcn, int kind,
+	   grub_disk_addr_t n, grub_size_t ofs, grub_size_t len,
+	   grub_uint8_t *dest)
 {
-  grub_err_t ret;
-  grub_disk_addr_t vcn;
-
-  if (ctx->attr->sbuf)
-    {
-      if ((ofs & (~(GRUB_NTFS_COM_LEN - 1))) == ctx->attr->save_pos)
-	{
-	  grub_disk_addr_t n;
-
-	  n = GRUB_NTFS_COM_LEN - (ofs - ctx->attr->save_pos);
-	  if (n > len)
-	    n = len;
-
-	  grub_memcpy (dest, ctx->attr->sbuf + ofs - ctx->attr->save_pos, n);
-	  if (grub_file_progress_hook && ctx->file)
-	    grub_file_progress_hook (0, 0, n, ctx->file);
-	  if (n == len)
-	    return 0;
+  grub_uint8_t *raw;
+  grub_size_t raw_size;
+  int err;
 
-	  dest += n;
-	  len -= n;
-	  ofs += n;
-	}
-    }
-  else
+  switch (kind)
     {
-      ctx->attr->sbuf = grub_malloc (GRUB_NTFS_COM_LEN);
-      if (ctx->attr->sbuf == NULL)
-	return grub_errno;
-      ctx->attr->save_pos = 1;
+    case UNIT_SPARSE:
+      grub_memset (dest, 0, len);
+      return GRUB_ERR_NONE;
+    case UNIT_PLAIN:
+      return read_raw (ctx, vcn, ofs, len, dest);
     }
 
-  vcn = ctx->target_vcn = (ofs >> GRUB_NTFS_COM_LOG_LEN) * (GRUB_NTFS_COM_SEC >> ctx->comp.log_spc);
-  ctx->target_vcn &= ~0xFULL;
-  while (ctx->next_vcn <= ctx->target_vcn)
+  raw_size = n << (ctx->comp.log_spc + GRUB_NTFS_BLK_SHR);
+  raw = grub_malloc (raw_size);
+  if (!raw)
+    return grub_errno;
+  if (read_raw (ctx, vcn, 0, raw_size, raw))
     {
-      if (grub_ntfs_read_run_list (ctx))
-	return grub_errno;
+      grub_free (raw);
+      return grub_errno;
     }
+  err = decode_chunks (raw, raw_size, dest, len);
+  grub_free (raw);
+  return decode_error (err);
+}
 
-  ctx->comp.comp_head = ctx->comp.comp_tail = 0;
-  ctx->comp.cbuf = grub_malloc (1 << (ctx->comp.log_spc + GRUB_NTFS_BLK_SHR));
-  if (!ctx->comp.cbuf)
-    return 0;
-
-  ret = 0;
-
-  //ctx->comp.disk->read_hook = read_hook;
-  //ctx->comp.disk->read_hook_data = read_hook_data;
+/* Read the compressed unit INDEX, located last with N clusters on disk,
+   into the cache.  It is decompressed on another processor if one is
+   idle.  */
+static grub_err_t
+load_unit (struct grub_ntfs_rlst *ctx, grub_uint64_t file,
+	   grub_uint64_t index, grub_disk_addr_t n, int shift)
+{
+  struct grub_fshelp_unit *unit;
 
-  if ((vcn > ctx->target_vcn) &&
-      (read_block
-       (ctx, NULL, (vcn - ctx->target_vcn) >> (GRUB_NTFS_LOG_COM_SEC - ctx->comp.log_spc))))
+  unit = grub_fshelp_unit_new (ctx->comp.disk, file, index, 1 << shift);
+  if (!unit)
+    return grub_errno;
+  unit->size = 1 << shift;
+  unit->src_size = n << (ctx->comp.log_spc + GRUB_NTFS_BLK_SHR);
+  unit->src = grub_malloc (unit->src_size);
+  if (!unit->src
+      || read_raw (ctx, index * UNIT_CLUSTERS, 0, unit->src_size, unit->src))
     {
-      ret = grub_errno;
-      goto quit;
+      grub_fshelp_unit_drop (unit);
+      return grub_errno;
     }
-
-  if (ofs % GRUB_NTFS_COM_LEN)
+  unit->job.run = decode_unit_job;
+  if (grub_job_workers ())
     {
-      grub_uint32_t t, n, o;
-      void *file = ctx->file;
-
-      ctx->file = 0;
-
-      t = ctx->target_vcn << (ctx->comp.log_spc + GRUB_NTFS_BLK_SHR);
-      if (read_block (ctx, ctx->attr->sbuf, 1))
-	{
-	  ret = grub_errno;
-	  goto quit;
-	}
-
-      ctx->file = file;
-
-      ctx->attr->save_pos = t;
-
-      o = ofs % GRUB_NTFS_COM_LEN;
-      n = GRUB_NTFS_COM_LEN - o;
-      if (n > len)
-	n = len;
-      grub_memcpy (dest, &ctx->attr->sbuf[o], n);
-      if (grub_file_progress_hook && ctx->file)
-	grub_file_progress_hook (0, 0, n, ctx->file);
-      if (n == len)
-	goto quit;
-      dest += n;
-      len -= n;
+      grub_fshelp_unit_submit (unit);
+      return GRUB_ERR_NONE;
     }
 
-  if (read_block (ctx, dest, len / GRUB_NTFS_COM_LEN))
+  decode_unit_job (&unit->job);
+  grub_free (unit->src);
+  unit->src = NULL;
+  if (unit->err)
     {
-      ret = grub_errno;
-      goto quit;
+      decode_error (unit->err);
+      grub_fshelp_unit_drop (unit);
     }
+  return grub_errno;
+}
 
-  dest += (len / GRUB_NTFS_COM_LEN) * GRUB_NTFS_COM_LEN;
-  len = len % GRUB_NTFS_COM_LEN;
-  if (len)
+static grub_err_t
+ntfscomp (grub_uint8_t *dest, grub_disk_addr_t ofs,
+	  grub_size_t len, struct grub_ntfs_rlst *ctx)
+{
+  grub_disk_t disk = ctx->comp.disk;
+  int shift = ctx->comp.log_spc + GRUB_NTFS_BLK_SHR + 4;
+  grub_uint64_t unit_size = 1ULL << shift;
+  grub_uint64_t file, first, last, index, batch_end;
+  grub_disk_addr_t n;
+  int kind;
+
+  if (ctx->comp.log_spc > GRUB_NTFS_LOG_COM_SEC)
+    return grub_error (GRUB_ERR_BAD_FS, "invalid compression unit size");
+
+  /* GRUB only reads the first attribute of each type.  */
+  file = (ctx->attr->mft->ino << 8) | *ctx->attr->attr_cur;
+
+  first = ofs >> shift;
+  last = (ofs + len - 1) >> shift;
+  for (index = first; index <= last; index = batch_end)
     {
-      grub_uint32_t t;
-      void *file = ctx->file;
-
-      ctx->file = 0;
-      t = ctx->target_vcn << (ctx->comp.log_spc + GRUB_NTFS_BLK_SHR);
-      if (read_block (ctx, ctx->attr->sbuf, 1))
+      grub_uint64_t i;
+      unsigned direct = 0;
+
+      batch_end = index + UNIT_BATCH;
+      if (batch_end > last + 1)
+	batch_end = last + 1;
+
+      /* Plain and sparse units go straight to DEST, and so do whole
+	 compressed ones unless there are processors to decompress them
+	 on.  The others are read into the cache for the whole batch
+	 before any is copied, so that they are decompressed together.  */
+      for (i = index; i < batch_end; i++)
 	{
-	  ret = grub_errno;
-	  goto quit;
+	  grub_uint64_t o = i == first ? ofs & (unit_size - 1) : 0;
+	  grub_uint64_t cnt = unit_size - o;
+
+	  if (cnt > ofs + len - (i << shift) - o)
+	    cnt = ofs + len - (i << shift) - o;
+
+	  if (grub_fshelp_unit_present (disk, file, i))
+	    continue;
+	  kind = locate_unit (ctx, i * UNIT_CLUSTERS, &n);
+	  if (kind < 0)
+	    return grub_errno;
+	  if (kind == UNIT_COMPRESSED
+	      && (cnt != unit_size || grub_job_workers ()))
+	    {
+	      if (load_unit (ctx, file, i, n, shift))
+		return grub_errno;
+	      continue;
+	    }
+	  if (read_unit (ctx, i * UNIT_CLUSTERS, kind, n, o, cnt,
+			 dest + (i << shift) + o - ofs))
+	    return grub_errno;
+	  direct |= 1U << (i - index);
 	}
 
-      ctx->attr->save_pos = t;
+      for (i = index; i < batch_end; i++)
+	{
+	  struct grub_fshelp_unit *unit;
+	  grub_uint64_t o = i == first ? ofs & (unit_size - 1) : 0;
+	  grub_uint64_t cnt = unit_size - o;
 
-      grub_memcpy (dest, ctx->attr->sbuf, len);
-      if (grub_file_progress_hook && file)
-	grub_file_progress_hook (0, 0, len, file);
+	  if (cnt > ofs + len - (i << shift) - o)
+	    cnt = ofs + len - (i << shift) - o;
+
+	  if (!(direct & (1U << (i - index))))
+	    {
+	      unit = grub_fshelp_unit_find (disk, file, i);
+	      if (!unit)
+		return grub_error (GRUB_ERR_BUG, "compression unit lost");
+	      if (unit->err)
+		{
+		  decode_error (unit->err);
+		  grub_fshelp_unit_drop (unit);
+		  return grub_errno;
+		}
+	      grub_memcpy (dest + (i << shift) + o - ofs, unit->data + o, cnt);
+	    }
+	  if (grub_file_progress_hook && ctx->file)
+	    grub_file_progress_hook (0, 0, cnt, ctx->file);
+	}
     }
 
-quit:
-  //ctx->comp.disk->read_hook = 0;
-  if (ctx->comp.cbuf)
-    grub_free (ctx->comp.cbuf);
-  return ret;
+  /* Attribute lists can't be followed ahead without disturbing the
+     caller, and running out of runs is no error to report.  */
+  if (grub_job_workers () && !(ctx->attr->flags & GRUB_NTFS_AF_ALST))
+    for (index = last + 1; index <= last + UNIT_AHEAD; index++)
+      {
+	if (grub_fshelp_unit_present (disk, file, index))
+	  continue;
+	kind = locate_unit (ctx, index * UNIT_CLUSTERS, &n);
+	if (kind < 0
+	    || (kind == UNIT_COMPRESSED && load_unit (ctx, file, index, n,
+						      shift)))
+	  {
+	    grub_errno = GRUB_ERR_NONE;
+	    break;
+	  }
+      }
+
+  return GRUB_ERR_NONE;
 }
 
 GRUB_MOD_INIT (ntfscomp)
@@ -440,4 +437,5 @@ GRUB_MOD_INIT (ntfscomp)
 GRUB_MOD_FINI (ntfscomp)
 {
   grub_ntfscomp_func = NULL;
+  grub_fshelp_unit_flush ();
 }
@@ -39,6 +39,7 @@
 #include <grub/types.h>
 #include <grub/fshelp.h>
 #include <grub/i18n.h>
+#include <grub/partition.h>
 
 GRUB_MOD_LICENSE ("GPLv3+");
 
@@ -243,6 +244,25 @@ grub_reiserfs_read_real (struct grub_fshelp_node *node,
 			 grub_disk_read_hook_t read_hook,
 			 void *read_hook_data);
 
+/* Tree nodes, kept across mounts.  Every lookup starts at the root, and
+   a file read looks up each of its items twice, so the upper levels and
+   the current leaf are almost always here.  The table is direct-mapped
+   on the block number.  */
+#define REISERFS_NODE_CACHE_SIZE 32
+
+struct grub_reiserfs_node_cache
+{
+  unsigned long dev_id;
+  unsigned long disk_id;
+  grub_disk_addr_t part_start;
+  grub_uint32_t block_number;
+  grub_uint16_t block_size;
+  char *buf;
+};
+
+static struct grub_reiserfs_node_cache node_cache[REISERFS_NODE_CACHE_SIZE];
+static unsigned long node_cache_generation;
+
 /* Internal-only functions. Not to be used outside of this file.  */
 
 /* Return the type of given v2 key.  */
@@ -470,6 +490,67 @@ grub_reiserfs_compare_keys (const struct grub_reiserfs_key *key1,
   return 0;
 }
 
+static void
+node_cache_flush (void)
+{
+  unsigned i;
+
+  for (i = 0; i < REISERFS_NODE_CACHE_SIZE; i++)
+    {
+      grub_free (node_cache[i].buf);
+      node_cache[i].buf = NULL;
+    }
+}
+
+/* Return the tree node in block BLOCK_NUMBER of DATA.  It stays valid
+   until the next call and must not be modified.  */
+static struct grub_reiserfs_block_header *
+grub_reiserfs_read_node (struct grub_reiserfs_data *data,
+			 grub_uint32_t block_number)
+{
+  grub_uint16_t block_size = grub_le_to_cpu16 (data->superblock.block_size);
+  grub_disk_addr_t part_start = grub_partition_get_start (data->disk->partition);
+  struct grub_reiserfs_node_cache *slot;
+  char *buf;
+
+  if (node_cache_generation != grub_disk_generation)
+    {
+      node_cache_flush ();
+      node_cache_generation = grub_disk_generation;
+    }
+
+  slot = &node_cache[block_number % REISERFS_NODE_CACHE_SIZE];
+  if (slot->buf && slot->block_number == block_number
+      && slot->block_size == block_size
+      && slot->dev_id == data->disk->dev->id
+      && slot->disk_id == data->disk->id && slot->part_start == part_start)
+    return (struct grub_reiserfs_block_header *) slot->buf;
+
+  buf = grub_malloc (block_size);
+  if (! buf)
+    return NULL;
+  if (grub_disk_read (data->disk,
+		      (grub_disk_addr_t) block_number
+		      * (block_size >> GRUB_DISK_SECTOR_BITS),
+		      (((grub_off_t) block_number * block_size)
+		       & (GRUB_DISK_SECTOR_SIZE - 1)),
+		      block_size, buf))
+    {
+      grub_free (buf);
+      return NULL;
+    }
+
+  grub_free (slot->buf);
+  slot->dev_id = data->disk->dev->id;
+  slot->disk_id = data->disk->id;
+  slot->part_start = part_start;
+  slot->block_number = block_number;
+  slot->block_size = block_size;
+  slot->buf = buf;
+
+  return (struct grub_reiserfs_block_header *) buf;
+}
+
 /* Find the item identified by KEY in mounted filesystem DATA, and fill ITEM
    accordingly to what was found.  */
 static grub_err_t
@@ -480,7 +561,7 @@ grub_reiserfs_get_item (struct grub_reiserfs_data *data,
   grub_uint32_t block_number;
   struct grub_reiserfs_block_header *block_header = 0;
   struct grub_reiserfs_key *block_key = 0;
-  grub_uint16_t block_size, item_count, current_level;
+  grub_uint16_t item_count, current_level;
   grub_uint16_t i;
   grub_uint16_t previous_level = ~0;
   struct grub_reiserfs_item_header *item_headers = 0;
@@ -505,25 +586,16 @@ grub_reiserfs_get_item (struct grub_reiserfs_data *data,
     }
 #endif
 
-  block_size = grub_le_to_cpu16 (data->superblock.block_size);
   block_number = grub_le_to_cpu32 (data->superblock.root_block);
 #ifdef GRUB_REISERFS_DEBUG
   grub_printf("Searching for ");
   grub_reiserfs_print_key (key);
 #endif
-  block_header = grub_malloc (block_size);
-  if (! block_header)
-    goto fail;
-
   item->next_offset = 0;
   do
     {
-      grub_disk_read (data->disk,
-                      block_number * (block_size >> GRUB_DISK_SECTOR_BITS),
-                      (((grub_off_t) block_number * block_size)
-                       & (GRUB_DISK_SECTOR_SIZE - 1)),
-                      block_size, block_header);
-      if (grub_errno)
+      block_header = grub_reiserfs_read_node (data, block_number);
+      if (! block_header)
         goto fail;
       current_level = grub_le_to_cpu16 (block_header->level);
       grub_dprintf ("reiserfs_tree", " at level %d\n", current_level);
@@ -651,12 +723,9 @@ grub_reiserfs_get_item (struct grub_reiserfs_data *data,
     }
 
   assert (grub_errno == GRUB_ERR_NONE);
-  grub_free (block_header);
   return GRUB_ERR_NONE;
 
  fail:
-  assert (grub_errno != GRUB_ERR_NONE);
-  grub_free (block_header);
   assert (grub_errno != GRUB_ERR_NONE);
   return grub_errno;
 }
@@ -1139,55 +1208,89 @@ grub_reiserfs_read_real (struct grub_fshelp_node *node,
             current_position += item_size;
           break;
         case GRUB_REISERFS_INDIRECT:
-          indirect_block_count = item_size / sizeof (*indirect_block_ptr);
-          indirect_block_ptr = grub_malloc (item_size);
-          if (! indirect_block_ptr)
-            goto fail;
-          grub_disk_read (found.data->disk,
-                          found.block_number * (block_size >> GRUB_DISK_SECTOR_BITS),
-                          grub_le_to_cpu16 (found.header.item_location),
-                          item_size, indirect_block_ptr);
-          if (grub_errno)
-            goto fail;
-          found.data->disk->read_hook = read_hook;
-          found.data->disk->read_hook_data = read_hook_data;
-          for (indirect_block = 0;
-               indirect_block < indirect_block_count
-                 && current_position < final_position;
-               indirect_block++)
-            {
-              block = grub_le_to_cpu32 (indirect_block_ptr[indirect_block]) *
-                      (block_size >> GRUB_DISK_SECTOR_BITS);
-              grub_dprintf ("reiserfs_blocktype", "I: %u\n", (unsigned) block);
-              if (current_position + block_size >= initial_position)
-                {
-                  offset = MAX ((signed) (initial_position - current_position),
-                                0);
-                  length = (MIN (block_size, final_position - current_position)
-                            - offset);
-                  grub_dprintf ("reiserfs",
-                                "Reading indirect block %u from %u to %u...\n",
-                                (unsigned) block, (unsigned) offset,
-                                (unsigned) (offset + length));
-#if 0
-                  grub_dprintf ("reiserfs",
-                                "\nib=%04d/%04d, ip=%d, cp=%d, fp=%d, off=%d, l=%d, tl=%d\n",
-                                indirect_block + 1, indirect_block_count,
-                                initial_position, current_position,
-                                final_position, offset, length, len);
-#endif
-                  grub_disk_read (found.data->disk, block, offset, length, buf);
-                  if (grub_errno)
-                    goto fail;
-                  buf += length;
-                  current_position += offset + length;
-                }
-              else
-                current_position += block_size;
-            }
-          found.data->disk->read_hook = 0;
-          grub_free (indirect_block_ptr);
-          indirect_block_ptr = 0;
+          {
+            struct grub_reiserfs_block_header *leaf;
+            grub_uint64_t run_start = 0;
+            grub_size_t run_length = 0;
+            char *run_buf = buf;
+
+            /* The leaf is the one just found, so this hits the cache.  */
+            leaf = grub_reiserfs_read_node (data, found.block_number);
+            if (! leaf)
+              goto fail;
+            if ((grub_uint32_t) grub_le_to_cpu16 (found.header.item_location)
+                + item_size > block_size)
+              {
+                grub_error (GRUB_ERR_BAD_FS, "indirect item out of block");
+                goto fail;
+              }
+            indirect_block_count = item_size / sizeof (*indirect_block_ptr);
+            indirect_block_ptr = grub_malloc (item_size);
+            if (! indirect_block_ptr)
+              goto fail;
+            grub_memcpy (indirect_block_ptr,
+                         (char *) leaf
+                         + grub_le_to_cpu16 (found.header.item_location),
+                         item_size);
+            found.data->disk->read_hook = read_hook;
+            found.data->disk->read_hook_data = read_hook_data;
+            for (indirect_block = 0;
+                 indirect_block < indirect_block_count
+                   && current_position < final_position;
+                 indirect_block++)
+              {
+                grub_uint64_t start;
+
+                block = ((grub_disk_addr_t)
+                         grub_le_to_cpu32 (indirect_block_ptr[indirect_block])
+                         * (block_size >> GRUB_DISK_SECTOR_BITS));
+                grub_dprintf ("reiserfs_blocktype", "I: %u\n", (unsigned) block);
+                if (current_position + block_size >= initial_position)
+                  {
+                    offset = MAX ((signed) (initial_position - current_position),
+                                  0);
+                    length = (MIN (block_size, final_position - current_position)
+                              - offset);
+                    grub_dprintf ("reiserfs",
+                                  "Reading indirect block %u from %u to %u...\n",
+                                  (unsigned) block, (unsigned) offset,
+                                  (unsigned) (offset + length));
+                    /* Blocks which follow each other on disk are read
+                       with a single request.  */
+                    start = (block << GRUB_DISK_SECTOR_BITS) + offset;
+                    if (run_length && run_start + run_length != start)
+                      {
+                        grub_disk_read (found.data->disk,
+                                        run_start >> GRUB_DISK_SECTOR_BITS,
+                                        run_start & (GRUB_DISK_SECTOR_SIZE - 1),
+                                        run_length, run_buf);
+                        if (grub_errno)
+                          goto fail;
+                        run_length = 0;
+                      }
+                    if (! run_length)
+                      {
+                        run_start = start;
+                        run_buf = buf;
+                      }
+                    run_length += length;
+                    buf += length;
+                    current_position += offset + length;
+                  }
+                else
+                  current_position += block_size;
+              }
+            if (run_length)
+              grub_disk_read (found.data->disk,
+                              run_start >> GRUB_DISK_SECTOR_BITS,
+                              run_start & (GRUB_DISK_SECTOR_SIZE - 1),
+                              run_length, run_buf);
+            found.data->disk->read_hook = 0;
+            if (grub_errno)
+              goto fail;
+            grub_free (indirect_block_ptr);
+            indirect_block_ptr = 0;
+          }
           break;
         default:
           goto fail;
@@ -1292,6 +1395,11 @@ grub_reiserfs_dir_iter (const char *filename,
   info.dir = ((filetype & GRUB_FSHELP_TYPE_MASK) == GRUB_FSHELP_DIR);
   info.mtimeset = 1;
   info.mtime = node->mtime;
+  if ((filetype & GRUB_FSHELP_TYPE_MASK) == GRUB_FSHELP_REG)
+    {
+      info.sizeset = 1;
+      info.size = node->size;
+    }
   grub_free (node);
   return ctx->hook (filename, &info, ctx->hook_data);
 }
@@ -1399,6 +1507,13 @@ grub_reiserfs_uuid (grub_device_t device, char **uuid)
   return grub_errno;
 }
 
+static const struct grub_fs_magic grub_reiserfs_magics[] =
+  {
+    { REISERFS_SUPER_BLOCK_OFFSET + 52, sizeof (REISERFS_MAGIC_STRING) - 1,
+      REISERFS_MAGIC_STRING },
+    { 0, 0, 0 }
+  };
+
 static struct grub_fs grub_reiserfs_fs =
   {
     .name = "reiserfs",
@@ -1408,6 +1523,7 @@ static struct grub_fs grub_reiserfs_fs =
     .close = grub_reiserfs_close,
     .label = grub_reiserfs_label,
     .uuid = grub_reiserfs_uuid,
+    .magics = grub_reiserfs_magics,
 #ifdef GRUB_UTIL
     .reserved_first_sector = 1,
     .blocklist_install = 1,
@@ -1424,4 +1540,5 @@ GRUB_MOD_INIT(reiserfs)
 GRUB_MOD_FINI(reiserfs)
 {
   grub_fs_unregister (&grub_reiserfs_fs);
+  node_cache_flush ();
 }
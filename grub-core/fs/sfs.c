@@ -738,6 +738,12 @@ grub_sfs_label (grub_device_t device, char **label)
 }
 
 
+static const struct grub_fs_magic grub_sfs_magics[] =
+  {
+    { 0, 4, "SFS\0" },
+    { 0, 0, 0 }
+  };
+
 static struct grub_fs grub_sfs_fs =
   {
     .name = "sfs",
@@ -746,6 +752,7 @@ static struct grub_fs grub_sfs_fs =
     .read = grub_sfs_read,
     .close = grub_sfs_close,
     .label = grub_sfs_label,
+    .magics = grub_sfs_magics,
 #ifdef GRUB_UTIL
     .reserved_first_sector = 0,
     .blocklist_install = 1,
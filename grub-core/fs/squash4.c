@@ -22,10 +22,12 @@
 #include <grub/mm.h>
 #include <grub/misc.h>
 #include <grub/disk.h>
+#include <grub/partition.h>
 #include <grub/dl.h>
 #include <grub/types.h>
 #include <grub/fshelp.h>
 #include <grub/deflate.h>
+#include <grub/zstd.h>
 #include <minilzo.h>
 
 #include "xz.h"
@@ -183,6 +185,7 @@ enum
     COMPRESSION_ZLIB = 1,
     COMPRESSION_LZO = 3,
     COMPRESSION_XZ = 4,
+    COMPRESSION_ZSTD = 6,
   };
 
 
@@ -216,6 +219,136 @@ struct grub_fshelp_node
   } stack[1];
 };
 
+/* Decompressed metadata, fragment and data blocks, most recently used
+   first.  They are kept across mounts, since every open mounts afresh and
+   reading many small files goes through the same blocks again.  */
+#define SQUASH_CACHE_BLOCKS 32
+#define SQUASH_CACHE_BYTES (4 * 1024 * 1024)
+
+struct grub_squash_cache_block
+{
+  struct grub_squash_cache_block *next;
+  unsigned long dev_id;
+  unsigned long disk_id;
+  grub_disk_addr_t part_start;
+  /* Where the compressed block is on disk.  */
+  grub_uint64_t start;
+  grub_size_t size;
+  char *buf;
+};
+
+static struct grub_squash_cache_block *block_cache;
+static unsigned block_cache_count;
+static grub_size_t block_cache_bytes;
+static unsigned long block_cache_generation;
+
+static void
+block_cache_flush (void)
+{
+  while (block_cache)
+    {
+      struct grub_squash_cache_block *b = block_cache;
+
+      block_cache = b->next;
+      grub_free (b->buf);
+      grub_free (b);
+    }
+  block_cache_count = 0;
+  block_cache_bytes = 0;
+}
+
+/* Point OUT at the CSIZE bytes at START decompressed, at most USIZE of
+   them, and set OUTSIZE to how many there are.  They stay valid until
+   the next call.  */
+static grub_err_t
+get_block (struct grub_squash_data *data, grub_uint64_t start,
+	   grub_size_t csize, grub_size_t usize,
+	   const char **out, grub_size_t *outsize)
+{
+  grub_disk_addr_t part_start = grub_partition_get_start (data->disk->partition);
+  struct grub_squash_cache_block *b, **prev;
+  grub_ssize_t ret;
+  char *tmp;
+  grub_err_t err;
+
+  if (block_cache_generation != grub_disk_generation)
+    {
+      block_cache_flush ();
+      block_cache_generation = grub_disk_generation;
+    }
+
+  for (prev = &block_cache; *prev; prev = &(*prev)->next)
+    {
+      b = *prev;
+      if (b->start == start && b->dev_id == data->disk->dev->id
+	  && b->disk_id == data->disk->id && b->part_start == part_start)
+	{
+	  *prev = b->next;
+	  b->next = block_cache;
+	  block_cache = b;
+	  *out = b->buf;
+	  *outsize = b->size;
+	  return GRUB_ERR_NONE;
+	}
+    }
+
+  b = grub_zalloc (sizeof (*b));
+  if (!b)
+    return grub_errno;
+  b->buf = grub_malloc (usize);
+  tmp = grub_malloc (csize);
+  if (!b->buf || !tmp)
+    {
+      grub_free (tmp);
+      grub_free (b->buf);
+      grub_free (b);
+      return grub_errno;
+    }
+
+  err = grub_disk_read (data->disk, start >> GRUB_DISK_SECTOR_BITS,
+			start & (GRUB_DISK_SECTOR_SIZE - 1), csize, tmp);
+  ret = err ? -1 : data->decompress (tmp, csize, 0, b->buf, usize, data);
+  grub_free (tmp);
+  if (ret < 0)
+    {
+      grub_free (b->buf);
+      grub_free (b);
+      if (!grub_errno)
+	grub_error (GRUB_ERR_BAD_FS, "incorrect compressed chunk");
+      return grub_errno;
+    }
+
+  b->dev_id = data->disk->dev->id;
+  b->disk_id = data->disk->id;
+  b->part_start = part_start;
+  b->start = start;
+  b->size = ret;
+  b->next = block_cache;
+  block_cache = b;
+  block_cache_count++;
+  block_cache_bytes += b->size;
+
+  /* Drop the least recently used blocks, but never the new one.  */
+  while (block_cache->next
+	 && (block_cache_count > SQUASH_CACHE_BLOCKS
+	     || block_cache_bytes > SQUASH_CACHE_BYTES))
+    {
+      struct grub_squash_cache_block *last;
+
+      for (prev = &block_cache->next; (*prev)->next; prev = &(*prev)->next);
+      last = *prev;
+      *prev = NULL;
+      block_cache_count--;
+      block_cache_bytes -= last->size;
+      grub_free (last->buf);
+      grub_free (last);
+    }
+
+  *out = b->buf;
+  *outsize = b->size;
+  return GRUB_ERR_NONE;
+}
+
 static grub_err_t
 read_chunk (struct grub_squash_data *data, void *buf, grub_size_t len,
 	    grub_uint64_t chunk_start, grub_off_t offset)
@@ -254,29 +387,17 @@ read_chunk (struct grub_squash_data *data, void *buf, grub_size_t len,
 	}
       else
 	{
-	  char *tmp;
+	  const char *block;
 	  grub_size_t bsize = grub_le_to_cpu16 (d) & ~SQUASH_CHUNK_FLAGS; 
-	  grub_disk_addr_t a = chunk_start + 2;
-	  tmp = grub_malloc (bsize);
-	  if (!tmp)
-	    return grub_errno;
-	  /* FIXME: buffer uncompressed data.  */
-	  err = grub_disk_read (data->disk, (a >> GRUB_DISK_SECTOR_BITS),
-				a & (GRUB_DISK_SECTOR_SIZE - 1),
-				bsize, tmp);
-	  if (err)
-	    {
-	      grub_free (tmp);
-	      return err;
-	    }
+	  grub_size_t usize;
 
-	  if (data->decompress (tmp, bsize, offset,
-				buf, csize, data) < 0)
-	    {
-	      grub_free (tmp);
-	      return grub_errno;
-	    }
-	  grub_free (tmp);
+	  err = get_block (data, chunk_start + 2, bsize, SQUASH_CHUNK_SIZE,
+			   &block, &usize);
+	  if (err)
+	    return err;
+	  if (offset + csize > usize)
+	    return grub_error (GRUB_ERR_BAD_FS, "incorrect compressed chunk");
+	  grub_memcpy (buf, block + offset, csize);
 	}
       len -= csize;
       offset += csize;
@@ -377,6 +498,14 @@ xz_decompress (char *inbuf, grub_size_t insize, grub_off_t off,
   return ret;
 }
 
+static grub_ssize_t
+zstd_decompress (char *inbuf, grub_size_t insize, grub_off_t off,
+		 char *outbuf, grub_size_t outsize,
+		 struct grub_squash_data *data __attribute__ ((unused)))
+{
+  return grub_zstd_decompress (inbuf, insize, off, outbuf, outsize);
+}
+
 static struct grub_squash_data *
 squash_mount (grub_disk_t disk)
 {
@@ -439,6 +568,9 @@ squash_mount (grub_disk_t disk)
 	  return NULL;
 	}
       break;
+    case grub_cpu_to_le16_compile_time (COMPRESSION_ZSTD):
+      data->decompress = zstd_decompress;
+      break;
     default:
       grub_free (data);
       grub_error (GRUB_ERR_BAD_FS, "unsupported compression %d",
@@ -656,6 +788,17 @@ grub_squash_dir_iter (const char *filename, enum grub_fshelp_filetype filetype,
   info.dir = ((filetype & GRUB_FSHELP_TYPE_MASK) == GRUB_FSHELP_DIR);
   info.mtimeset = 1;
   info.mtime = grub_le_to_cpu32 (node->ino.mtime);
+  switch (node->ino.type)
+    {
+    case grub_cpu_to_le16_compile_time (SQUASH_TYPE_LONG_REGULAR):
+      info.sizeset = 1;
+      info.size = grub_le_to_cpu64 (node->ino.long_file.size);
+      break;
+    case grub_cpu_to_le16_compile_time (SQUASH_TYPE_REGULAR):
+      info.sizeset = 1;
+      info.size = grub_le_to_cpu32 (node->ino.file.size);
+      break;
+    }
   grub_free (node);
   return ctx->hook (filename, &info, ctx->hook_data);
 }
@@ -829,6 +972,25 @@ direct_read (struct grub_squash_data *data,
 	  char *block;
 	  grub_size_t csize;
 	  csize = grub_le_to_cpu32 (ino->block_sizes[i]) & ~SQUASH_BLOCK_FLAGS;
+	  /* Keep blocks that are read piecemeal, decompress whole ones
+	     straight into BUF.  */
+	  if (curread < data->blksz)
+	    {
+	      const char *cblock;
+	      grub_size_t usize;
+
+	      err = get_block (data, ino->cumulated_block_sizes[i] + a, csize,
+			       data->blksz, &cblock, &usize);
+	      if (err)
+		return -1;
+	      if (boff + curread > usize)
+		{
+		  grub_error (GRUB_ERR_BAD_FS, "incorrect compressed chunk");
+		  return -1;
+		}
+	      grub_memcpy (buf, cblock + boff, curread);
+	      goto next_block;
+	    }
 	  block = grub_malloc (csize);
 	  if (!block)
 	    return -1;
@@ -862,6 +1024,7 @@ direct_read (struct grub_squash_data *data,
 			      curread, buf);
       if (err)
 	return -1;
+    next_block:
       off += curread;
       len -= curread;
       buf += curread;
@@ -909,32 +1072,22 @@ grub_squash_read_data (struct grub_squash_data *data,
   else
     b = grub_le_to_cpu32 (ino->ino.file.offset) + off;
   
-  /* FIXME: cache uncompressed chunks.  */
   if (compressed)
     {
-      char *block;
-      block = grub_malloc (grub_le_to_cpu32 (frag.size));
-      if (!block)
-	return -1;
-      err = grub_disk_read (data->disk,
-			    a >> GRUB_DISK_SECTOR_BITS,
-			    a & (GRUB_DISK_SECTOR_SIZE - 1),
-			    grub_le_to_cpu32 (frag.size), block);
+      const char *block;
+      grub_size_t usize;
+
+      /* A fragment block holds the tails of many files.  */
+      err = get_block (data, a, grub_le_to_cpu32 (frag.size), data->blksz,
+		       &block, &usize);
       if (err)
+	return -1;
+      if (b + len > usize)
 	{
-	  grub_free (block);
+	  grub_error (GRUB_ERR_BAD_FS, "incorrect compressed chunk");
 	  return -1;
 	}
-      if (data->decompress (block, grub_le_to_cpu32 (frag.size),
-			    b, buf, len, data)
-	  != (grub_ssize_t) len)
-	{
-	  grub_free (block);
-	  if (!grub_errno)
-	    grub_error (GRUB_ERR_BAD_FS, "incorrect compressed chunk");
-	  return -1;
-	}
-      grub_free (block);
+      grub_memcpy (buf, block + b, len);
     }
   else
     {
@@ -975,6 +1128,12 @@ grub_squash_mtime (grub_device_t dev, grub_int32_t *tm)
   return GRUB_ERR_NONE;
 } 
 
+static const struct grub_fs_magic grub_squash_magics[] =
+  {
+    { 0, 4, "hsqs" },
+    { 0, 0, 0 }
+  };
+
 static struct grub_fs grub_squash_fs =
   {
     .name = "squash4",
@@ -983,6 +1142,7 @@ static struct grub_fs grub_squash_fs =
     .read = grub_squash_read,
     .close = grub_squash_close,
     .mtime = grub_squash_mtime,
+    .magics = grub_squash_magics,
 #ifdef GRUB_UTIL
     .reserved_first_sector = 0,
     .blocklist_install = 0,
@@ -998,5 +1158,6 @@ GRUB_MOD_INIT(squash4)
 GRUB_MOD_FINI(squash4)
 {
   grub_fs_unregister (&grub_squash_fs);
+  block_cache_flush ();
 }
 
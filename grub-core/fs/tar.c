@@ -217,11 +217,32 @@ grub_cpio_rewind (struct grub_archelp_data *data)
   data->next_hofs = 0;
 }
 
+static grub_disk_t
+grub_cpio_get_disk (struct grub_archelp_data *data)
+{
+  return data->disk;
+}
+
+static grub_off_t
+grub_cpio_tell (struct grub_archelp_data *data)
+{
+  return data->next_hofs;
+}
+
+static void
+grub_cpio_seek (struct grub_archelp_data *data, grub_off_t ofs)
+{
+  data->next_hofs = ofs;
+}
+
 static struct grub_archelp_ops arcops =
   {
     .find_file = grub_cpio_find_file,
     .get_link_target = grub_cpio_get_link_target,
-    .rewind = grub_cpio_rewind
+    .rewind = grub_cpio_rewind,
+    .get_disk = grub_cpio_get_disk,
+    .tell = grub_cpio_tell,
+    .seek = grub_cpio_seek
   };
 
 static struct grub_archelp_data *
@@ -310,6 +331,23 @@ grub_cpio_read (grub_file_t file, char *buf, grub_size_t len)
   return ret;
 }
 
+/* Archive members are stored in one piece.  */
+static grub_err_t
+grub_cpio_map (grub_file_t file, grub_size_t len,
+	       grub_fs_extent_hook_t hook, void *hook_data)
+{
+  struct grub_archelp_data *data = file->data;
+  struct grub_fs_extent extent = {
+    .offset = file->offset,
+    .length = len,
+    .sector = 0,
+    .sector_offset = data->dofs + file->offset,
+    .hole = 0
+  };
+
+  return hook (&extent, hook_data);
+}
+
 static grub_err_t
 grub_cpio_close (grub_file_t file)
 {
@@ -328,6 +366,7 @@ static struct grub_fs grub_cpio_fs = {
   .open = grub_cpio_open,
   .read = grub_cpio_read,
   .close = grub_cpio_close,
+  .map = grub_cpio_map,
 #ifdef GRUB_UTIL
   .reserved_first_sector = 0,
   .blocklist_install = 0,
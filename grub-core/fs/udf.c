@@ -351,6 +351,8 @@ struct grub_udf_data
   struct grub_udf_lvd lvd;
   struct grub_udf_pd pds[GRUB_UDF_MAX_PDS];
   struct grub_udf_partmap *pms[GRUB_UDF_MAX_PMS];
+  /* Start of the partition each partition map refers to.  */
+  grub_uint32_t part_start[GRUB_UDF_MAX_PMS];
   struct grub_udf_long_ad root_icb;
   int npd, npm, lbshift;
 };
@@ -359,6 +361,16 @@ struct grub_fshelp_node
 {
   struct grub_udf_data *data;
   int part_ref;
+  /* The allocation descriptor which mapped the last block looked up:
+     the file offset it starts at, the sector and size of the extent
+     holding it (0 if it is in the file entry), its offset there and
+     how many descriptor bytes are left from it.  */
+  int ad_valid;
+  grub_uint64_t ad_filebytes;
+  grub_disk_addr_t ad_aed;
+  grub_uint32_t ad_aed_len;
+  grub_uint32_t ad_offset;
+  grub_ssize_t ad_len;
   union
   {
     struct grub_udf_file_entry fe;
@@ -390,8 +402,7 @@ grub_udf_get_block (struct grub_udf_data *data,
       return 0;
     }
 
-  return (U32 (data->pds[data->pms[part_ref]->type1.part_num].start)
-          + U32 (block));
+  return data->part_start[part_ref] + U32 (block);
 }
 
 static grub_err_t
@@ -420,26 +431,56 @@ grub_udf_read_icb (struct grub_udf_data *data,
 
   node->part_ref = icb->block.part_ref;
   node->data = data;
+  node->ad_valid = 0;
   return 0;
 }
 
+/* Read the allocation extent descriptor of SIZE bytes at sector SEC
+   into BUF, which holds one logical block.  */
+static grub_err_t
+grub_udf_read_aed (struct grub_udf_data *data, grub_disk_addr_t sec,
+		   grub_uint32_t size, char *buf)
+{
+  struct grub_udf_aed *extension = (struct grub_udf_aed *) buf;
+
+  if (size < sizeof (*extension) || size > U32 (data->lvd.bsize))
+    return grub_error (GRUB_ERR_BAD_FS, "invalid aed size");
+
+  if (grub_disk_read (data->disk, sec << data->lbshift, 0, size, buf))
+    return grub_errno;
+
+  if (U16 (extension->tag.tag_ident) != GRUB_UDF_TAG_IDENT_AED
+      || U32 (extension->ae_len) > size - sizeof (*extension))
+    return grub_error (GRUB_ERR_BAD_FS, "invalid aed tag");
+
+  return GRUB_ERR_NONE;
+}
+
+/* Map FILEBLOCK of NODE to a disk block and store in *COUNT how many
+   blocks up to the end of its allocation descriptor map the same way.  */
 static grub_disk_addr_t
-grub_udf_read_block (grub_fshelp_node_t node, grub_disk_addr_t fileblock)
+grub_udf_read_block (grub_fshelp_node_t node, grub_disk_addr_t fileblock,
+		     grub_disk_addr_t *count)
 {
+  int log2bytes = GRUB_DISK_SECTOR_BITS + node->data->lbshift;
   char *buf = NULL;
-  char *ptr;
+  char *area, *ptr;
   grub_ssize_t len;
-  grub_disk_addr_t filebytes;
+  grub_disk_addr_t filebytes, adbytes = 0;
+  grub_disk_addr_t aed = 0;
+  grub_uint32_t aed_len = 0;
+  grub_size_t ad_size;
+  int is_short;
 
   switch (U16 (node->block.fe.tag.tag_ident))
     {
     case GRUB_UDF_TAG_IDENT_FE:
-      ptr = (char *) &node->block.fe.ext_attr[0] + U32 (node->block.fe.ext_attr_length);
+      area = (char *) &node->block.fe.ext_attr[0] + U32 (node->block.fe.ext_attr_length);
       len = U32 (node->block.fe.alloc_descs_length);
       break;
 
     case GRUB_UDF_TAG_IDENT_EFE:
-      ptr = (char *) &node->block.efe.ext_attr[0] + U32 (node->block.efe.ext_attr_length);
+      area = (char *) &node->block.efe.ext_attr[0] + U32 (node->block.efe.ext_attr_length);
       len = U32 (node->block.efe.alloc_descs_length);
       break;
 
@@ -448,114 +489,96 @@ grub_udf_read_block (grub_fshelp_node_t node, grub_disk_addr_t fileblock)
       return 0;
     }
 
-  if ((U16 (node->block.fe.icbtag.flags) & GRUB_UDF_ICBTAG_FLAG_AD_MASK)
-      == GRUB_UDF_ICBTAG_FLAG_AD_SHORT)
-    {
-      struct grub_udf_short_ad *ad = (struct grub_udf_short_ad *) ptr;
+  is_short = ((U16 (node->block.fe.icbtag.flags) & GRUB_UDF_ICBTAG_FLAG_AD_MASK)
+	      == GRUB_UDF_ICBTAG_FLAG_AD_SHORT);
+  ad_size = (is_short ? sizeof (struct grub_udf_short_ad)
+	     : sizeof (struct grub_udf_long_ad));
+  filebytes = fileblock * U32 (node->data->lvd.bsize);
+  ptr = area;
 
-      filebytes = fileblock * U32 (node->data->lvd.bsize);
-      while (len >= (grub_ssize_t) sizeof (struct grub_udf_short_ad))
+  /* Resume from the descriptor which mapped the previous lookup rather
+     than walking the whole chain again.  */
+  if (node->ad_valid && filebytes >= node->ad_filebytes)
+    {
+      aed = node->ad_aed;
+      aed_len = node->ad_aed_len;
+      if (aed)
 	{
-	  grub_uint32_t adlen = U32 (ad->length) & 0x3fffffff;
-	  grub_uint32_t adtype = U32 (ad->length) >> 30;
-	  if (adtype == 3)
-	    {
-	      struct grub_udf_aed *extension;
-	      grub_disk_addr_t sec = grub_udf_get_block(node->data,
-							node->part_ref,
-							ad->position);
-	      if (!buf)
-		{
-		  buf = grub_malloc (U32 (node->data->lvd.bsize));
-		  if (!buf)
-		    return 0;
-		}
-	      if (grub_disk_read (node->data->disk, sec << node->data->lbshift,
-				  0, adlen, buf))
-		goto fail;
+	  buf = grub_malloc (U32 (node->data->lvd.bsize));
+	  if (!buf)
+	    return 0;
+	  if (grub_udf_read_aed (node->data, aed, aed_len, buf))
+	    goto fail;
+	  area = buf + sizeof (struct grub_udf_aed);
+	}
+      ptr = area + node->ad_offset;
+      len = node->ad_len;
+      adbytes = node->ad_filebytes;
+    }
 
-	      extension = (struct grub_udf_aed *) buf;
-	      if (U16 (extension->tag.tag_ident) != GRUB_UDF_TAG_IDENT_AED)
-		{
-		  grub_error (GRUB_ERR_BAD_FS, "invalid aed tag");
-		  goto fail;
-		}
+  while (len >= (grub_ssize_t) ad_size)
+    {
+      grub_uint32_t adlen, adtype, block;
+      grub_uint16_t part_ref;
 
-	      len = U32 (extension->ae_len);
-	      ad = (struct grub_udf_short_ad *)
-		    (buf + sizeof (struct grub_udf_aed));
-	      continue;
-	    }
+      if (is_short)
+	{
+	  struct grub_udf_short_ad *ad = (struct grub_udf_short_ad *) ptr;
 
-	  if (filebytes < adlen)
-	    {
-	      grub_uint32_t ad_pos = ad->position;
-	      grub_free (buf);
-	      return ((U32 (ad_pos) & GRUB_UDF_EXT_MASK) ? 0 :
-		      (grub_udf_get_block (node->data, node->part_ref, ad_pos)
-		       + (filebytes >> (GRUB_DISK_SECTOR_BITS
-					+ node->data->lbshift))));
-	    }
+	  adlen = U32 (ad->length);
+	  block = ad->position;
+	  part_ref = node->part_ref;
+	}
+      else
+	{
+	  struct grub_udf_long_ad *ad = (struct grub_udf_long_ad *) ptr;
 
-	  filebytes -= adlen;
-	  ad++;
-	  len -= sizeof (struct grub_udf_short_ad);
+	  adlen = U32 (ad->length);
+	  block = ad->block.block_num;
+	  part_ref = ad->block.part_ref;
 	}
-    }
-  else
-    {
-      struct grub_udf_long_ad *ad = (struct grub_udf_long_ad *) ptr;
+      adtype = adlen >> 30;
+      adlen &= 0x3fffffff;
 
-      filebytes = fileblock * U32 (node->data->lvd.bsize);
-      while (len >= (grub_ssize_t) sizeof (struct grub_udf_long_ad))
+      if (adtype == 3)
 	{
-	  grub_uint32_t adlen = U32 (ad->length) & 0x3fffffff;
-	  grub_uint32_t adtype = U32 (ad->length) >> 30;
-	  if (adtype == 3)
+	  aed = grub_udf_get_block (node->data, part_ref, block);
+	  aed_len = adlen;
+	  if (!buf)
 	    {
-	      struct grub_udf_aed *extension;
-	      grub_disk_addr_t sec = grub_udf_get_block(node->data,
-							ad->block.part_ref,
-							ad->block.block_num);
+	      buf = grub_malloc (U32 (node->data->lvd.bsize));
 	      if (!buf)
-		{
-		  buf = grub_malloc (U32 (node->data->lvd.bsize));
-		  if (!buf)
-		    return 0;
-		}
-	      if (grub_disk_read (node->data->disk, sec << node->data->lbshift,
-				  0, adlen, buf))
-		goto fail;
-
-	      extension = (struct grub_udf_aed *) buf;
-	      if (U16 (extension->tag.tag_ident) != GRUB_UDF_TAG_IDENT_AED)
-		{
-		  grub_error (GRUB_ERR_BAD_FS, "invalid aed tag");
-		  goto fail;
-		}
-
-	      len = U32 (extension->ae_len);
-	      ad = (struct grub_udf_long_ad *)
-		    (buf + sizeof (struct grub_udf_aed));
-	      continue;
-	    }
-	      
-	  if (filebytes < adlen)
-	    {
-	      grub_uint32_t ad_block_num = ad->block.block_num;
-	      grub_uint32_t ad_part_ref = ad->block.part_ref;
-	      grub_free (buf);
-	      return ((U32 (ad_block_num) & GRUB_UDF_EXT_MASK) ?  0 :
-		      (grub_udf_get_block (node->data, ad_part_ref,
-					   ad_block_num)
-		       + (filebytes >> (GRUB_DISK_SECTOR_BITS
-				        + node->data->lbshift))));
+		return 0;
 	    }
+	  if (grub_udf_read_aed (node->data, aed, aed_len, buf))
+	    goto fail;
+
+	  len = U32 (((struct grub_udf_aed *) buf)->ae_len);
+	  area = ptr = buf + sizeof (struct grub_udf_aed);
+	  continue;
+	}
 
-	  filebytes -= adlen;
-	  ad++;
-	  len -= sizeof (struct grub_udf_long_ad);
+      if (filebytes - adbytes < adlen)
+	{
+	  grub_disk_addr_t offset = filebytes - adbytes;
+
+	  node->ad_valid = 1;
+	  node->ad_filebytes = adbytes;
+	  node->ad_aed = aed;
+	  node->ad_aed_len = aed_len;
+	  node->ad_offset = ptr - area;
+	  node->ad_len = len;
+
+	  grub_free (buf);
+	  *count = ((adlen - 1) >> log2bytes) - (offset >> log2bytes) + 1;
+	  return ((U32 (block) & GRUB_UDF_EXT_MASK) ? 0 :
+		  (grub_udf_get_block (node->data, part_ref, block)
+		   + (offset >> log2bytes)));
 	}
+
+      adbytes += adlen;
+      ptr += ad_size;
+      len -= ad_size;
     }
 
 fail:
@@ -591,11 +614,11 @@ grub_udf_read_file (grub_fshelp_node_t node,
       return 0;
     }
 
-  return grub_fshelp_read_file (node->data->disk, node,
-				read_hook, read_hook_data,
-				pos, len, buf, grub_udf_read_block,
-				U64 (node->block.fe.file_size),
-				node->data->lbshift, 0);
+  return grub_fshelp_read_file_extents (node->data->disk, node,
+					read_hook, read_hook_data,
+					pos, len, buf, grub_udf_read_block,
+					U64 (node->block.fe.file_size),
+					node->data->lbshift, 0);
 }
 
 static unsigned sblocklist[] = { 256, 512, 0 };
@@ -763,6 +786,7 @@ grub_udf_mount (grub_disk_t disk)
 	if (data->pms[i]->type1.part_num == data->pds[j].part_num)
 	  {
 	    data->pms[i]->type1.part_num = j;
+	    data->part_start[i] = U32 (data->pds[j].start);
 	    break;
 	  }
 
@@ -813,7 +837,7 @@ grub_udf_get_cluster_sector (grub_disk_t disk, grub_uint64_t *sec_per_lcn)
   if (!data)
     return 0;
 
-  ret = U32 (data->pds[data->pms[0]->type1.part_num].start);
+  ret = data->part_start[0];
   *sec_per_lcn = 1ULL << data->lbshift;
   grub_free (data);
   return ret;
@@ -34,6 +34,21 @@ GRUB_MOD_LICENSE ("GPLv3+");
 #define XFS_INODE_FORMAT_EXT	2
 #define XFS_INODE_FORMAT_BTREE	3
 
+/* Directory blocks, told apart by their magic.  */
+#define XFS_DIR2_BLOCK_MAGIC	0x58443242	/* XD2B */
+#define XFS_DIR3_BLOCK_MAGIC	0x58444233	/* XDB3 */
+#define XFS_DIR2_LEAF1_MAGIC	0xd2f1
+#define XFS_DIR3_LEAF1_MAGIC	0x3df1
+#define XFS_DIR2_LEAFN_MAGIC	0xd2ff
+#define XFS_DIR3_LEAFN_MAGIC	0x3dff
+#define XFS_DA_NODE_MAGIC	0xfebe
+#define XFS_DA3_NODE_MAGIC	0x3ebe
+
+/* Byte offset in the directory at which the hash index starts.  */
+#define XFS_DIR2_LEAF_OFFSET	(1ULL << 35)
+/* Deepest index a directory can have.  */
+#define XFS_DA_NODE_MAXDEPTH	5
+
 /* Superblock version field flags */
 #define XFS_SB_VERSION_NUMBITS		0x000f
 #define	XFS_SB_VERSION_ATTRBIT		0x0010
@@ -196,6 +211,25 @@ struct grub_xfs_dirblock_tail
   grub_uint32_t leaf_stale;
 } GRUB_PACKED;
 
+/* The start of every block of the hash index.  On V5 filesystems it is
+   followed by crc, uuid and the like before COUNT.  */
+struct grub_xfs_da_blkinfo
+{
+  grub_uint32_t forw;
+  grub_uint32_t back;
+  grub_uint16_t magic;
+  grub_uint16_t pad;
+} GRUB_PACKED;
+
+/* Entry of the hash index.  In leaves VAL is the address of the
+   directory entry in 8-byte units, in interior nodes it is the block
+   holding the hashes up to HASHVAL.  */
+struct grub_xfs_da_entry
+{
+  grub_uint32_t hashval;
+  grub_uint32_t val;
+} GRUB_PACKED;
+
 struct grub_fshelp_node
 {
   struct grub_xfs_data *data;
@@ -495,8 +529,12 @@ get_fsb (const void *keys, int idx)
   return grub_be_to_cpu64 (grub_get_unaligned64 (p));
 }
 
+/* Map FILEBLOCK of NODE to a disk block and store in *COUNT how many
+   blocks up to the end of its extent, or of the hole before the next
+   one, map the same way.  */
 static grub_disk_addr_t
-grub_xfs_read_block (grub_fshelp_node_t node, grub_disk_addr_t fileblock)
+grub_xfs_read_block (grub_fshelp_node_t node, grub_disk_addr_t fileblock,
+		     grub_disk_addr_t *count)
 {
   struct grub_xfs_btree_node *leaf = 0;
   int ex, nrec;
@@ -586,10 +624,14 @@ grub_xfs_read_block (grub_fshelp_node_t node, grub_disk_addr_t fileblock)
 
       /* Sparse block.  */
       if (fileblock < offset)
-        break;
+        {
+          *count = offset - fileblock;
+          break;
+        }
       else if (fileblock < offset + size)
         {
           ret = (fileblock - offset + start);
+          *count = offset + size - fileblock;
           break;
         }
     }
@@ -607,12 +649,13 @@ grub_xfs_read_file (grub_fshelp_node_t node,
 		    grub_disk_read_hook_t read_hook, void *read_hook_data,
 		    grub_off_t pos, grub_size_t len, char *buf, grub_uint32_t header_size)
 {
-  return grub_fshelp_read_file (node->data->disk, node,
-				read_hook, read_hook_data,
-				pos, len, buf, grub_xfs_read_block,
-				grub_be_to_cpu64 (node->inode.size) + header_size,
-				node->data->sblock.log2_bsize
-				- GRUB_DISK_SECTOR_BITS, 0);
+  return grub_fshelp_read_file_extents (node->data->disk, node,
+					read_hook, read_hook_data,
+					pos, len, buf, grub_xfs_read_block,
+					grub_be_to_cpu64 (node->inode.size)
+					+ header_size,
+					node->data->sblock.log2_bsize
+					- GRUB_DISK_SECTOR_BITS, 0);
 }
 
 
@@ -685,27 +728,38 @@ struct grub_xfs_iterate_dir_ctx
   struct grub_fshelp_node *diro;
 };
 
-/* Helper for grub_xfs_iterate_dir.  */
-static int iterate_dir_call_hook (grub_uint64_t ino, const char *filename,
-				  struct grub_xfs_iterate_dir_ctx *ctx)
+/* Make the node for inode INO found in the directory DIRO.  */
+static struct grub_fshelp_node *
+grub_xfs_dir_node (struct grub_fshelp_node *diro, grub_uint64_t ino)
 {
   struct grub_fshelp_node *fdiro;
-  grub_err_t err;
 
-  fdiro = grub_malloc (grub_xfs_fshelp_size(ctx->diro->data) + 1);
+  fdiro = grub_malloc (grub_xfs_fshelp_size(diro->data) + 1);
   if (!fdiro)
-    {
-      grub_print_error ();
-      return 0;
-    }
+    return 0;
 
   /* The inode should be read, otherwise the filetype can
      not be determined.  */
   fdiro->ino = ino;
   fdiro->inode_read = 1;
-  fdiro->data = ctx->diro->data;
-  err = grub_xfs_read_inode (ctx->diro->data, ino, &fdiro->inode);
-  if (err)
+  fdiro->data = diro->data;
+  if (grub_xfs_read_inode (diro->data, ino, &fdiro->inode))
+    {
+      grub_free (fdiro);
+      return 0;
+    }
+
+  return fdiro;
+}
+
+/* Helper for grub_xfs_iterate_dir.  */
+static int iterate_dir_call_hook (grub_uint64_t ino, const char *filename,
+				  struct grub_xfs_iterate_dir_ctx *ctx)
+{
+  struct grub_fshelp_node *fdiro;
+
+  fdiro = grub_xfs_dir_node (ctx->diro, ino);
+  if (!fdiro)
     {
       grub_print_error ();
       return 0;
@@ -875,6 +929,338 @@ grub_xfs_iterate_dir (grub_fshelp_node_t dir,
 }
 
 
+/* The name hash used by the directory index.  */
+static grub_uint32_t
+grub_xfs_da_hashname (const grub_uint8_t *name, int namelen)
+{
+  grub_uint32_t hash;
+
+#define XFS_ROL32(x, y) (((x) << (y)) | ((x) >> (32 - (y))))
+  for (hash = 0; namelen >= 4; namelen -= 4, name += 4)
+    hash = ((grub_uint32_t) name[0] << 21) ^ ((grub_uint32_t) name[1] << 14)
+      ^ ((grub_uint32_t) name[2] << 7) ^ name[3] ^ XFS_ROL32 (hash, 7 * 4);
+
+  switch (namelen)
+    {
+    case 3:
+      return ((grub_uint32_t) name[0] << 14) ^ ((grub_uint32_t) name[1] << 7)
+	^ name[2] ^ XFS_ROL32 (hash, 7 * 3);
+    case 2:
+      return ((grub_uint32_t) name[0] << 7) ^ name[1]
+	^ XFS_ROL32 (hash, 7 * 2);
+    case 1:
+      return name[0] ^ XFS_ROL32 (hash, 7 * 1);
+    default:
+      return hash;
+    }
+#undef XFS_ROL32
+}
+
+/* Read the directory block at filesystem block DABLK of DIR, which may
+   lie past the size of the directory, into BUF.  */
+static int
+grub_xfs_read_dirblock (struct grub_fshelp_node *dir, grub_uint64_t dablk,
+			char *buf)
+{
+  struct grub_xfs_data *data = dir->data;
+  int dirblk_size = 1 << (data->sblock.log2_bsize + data->sblock.log2_dirblk);
+  grub_off_t pos = dablk << data->sblock.log2_bsize;
+
+  return grub_xfs_read_file (dir, 0, 0, pos, dirblk_size, buf,
+			     pos + dirblk_size) == dirblk_size;
+}
+
+/* Context for grub_xfs_da_lookup.  */
+struct grub_xfs_da_lookup_ctx
+{
+  struct grub_fshelp_node *diro;
+  const char *name;
+  int namelen;
+  /* The data block in DATABLOCK, or -1.  */
+  grub_int64_t datablk;
+  char *datablock;
+  grub_fshelp_node_t *foundnode;
+  enum grub_fshelp_filetype *foundtype;
+};
+
+/* Check whether the entry at ADDR, taken from the hash index, is the one
+   looked for.  Return 1 if it is, 0 if not and -1 if the directory is
+   damaged.  */
+static int
+grub_xfs_da_check (struct grub_xfs_da_lookup_ctx *ctx, grub_uint32_t addr)
+{
+  struct grub_xfs_data *data = ctx->diro->data;
+  int dirblk_log2 = data->sblock.log2_bsize + data->sblock.log2_dirblk;
+  grub_uint64_t byte = (grub_uint64_t) addr << 3;
+  grub_int64_t blk = byte >> dirblk_log2;
+  grub_uint32_t off = byte & ((1 << dirblk_log2) - 1);
+  struct grub_xfs_dir2_entry *de;
+
+  if (off + sizeof (*de) + ctx->namelen > (1U << dirblk_log2))
+    return -1;
+
+  if (blk != ctx->datablk)
+    {
+      ctx->datablk = -1;
+      if (!grub_xfs_read_dirblock (ctx->diro,
+				   (grub_uint64_t) blk << data->sblock.log2_dirblk,
+				   ctx->datablock))
+	return -1;
+      ctx->datablk = blk;
+    }
+
+  de = (struct grub_xfs_dir2_entry *) (ctx->datablock + off);
+  if (de->len != ctx->namelen
+      || grub_memcmp (de + 1, ctx->name, ctx->namelen) != 0)
+    return 0;
+
+  *ctx->foundnode = grub_xfs_dir_node (ctx->diro,
+				       grub_be_to_cpu64 (de->inode));
+  if (*ctx->foundnode)
+    *ctx->foundtype = grub_xfs_mode_to_filetype ((*ctx->foundnode)->inode.mode);
+  return 1;
+}
+
+/* Number of entries in the index block BUF.  */
+static int
+grub_xfs_da_count (struct grub_xfs_data *data, const char *buf)
+{
+  const char *p = buf + (data->hascrc ? 56 : sizeof (struct grub_xfs_da_blkinfo));
+
+  return grub_be_to_cpu16 (grub_get_unaligned16 (p));
+}
+
+/* Index of the first of the COUNT entries with a hash not below HASH.  */
+static int
+grub_xfs_da_search (struct grub_xfs_da_entry *ents, int count,
+		    grub_uint32_t hash)
+{
+  int low = 0, high = count;
+
+  while (low < high)
+    {
+      int mid = low + (high - low) / 2;
+
+      if (grub_be_to_cpu32 (ents[mid].hashval) < hash)
+	low = mid + 1;
+      else
+	high = mid;
+    }
+  return low;
+}
+
+/* Check the COUNT leaf entries from START on which have HASH.  Return 1 if
+   the name was found, 0 if the entries with HASH may go on in the next
+   leaf, 2 if they do not and -1 on damage.  */
+static int
+grub_xfs_da_scan_leaf (struct grub_xfs_da_lookup_ctx *ctx,
+		       struct grub_xfs_da_entry *ents, int start, int count,
+		       grub_uint32_t hash)
+{
+  int i;
+
+  for (i = start; i < count; i++)
+    {
+      grub_uint32_t addr = grub_be_to_cpu32 (ents[i].val);
+      int r;
+
+      if (grub_be_to_cpu32 (ents[i].hashval) != hash)
+	return 2;
+      /* Stale entry.  */
+      if (addr == 0)
+	continue;
+      r = grub_xfs_da_check (ctx, addr);
+      if (r)
+	return r;
+    }
+  return 0;
+}
+
+/* Look NAME up through the hash index of the block, leaf or node format
+   directory DIRO, reading only the blocks on the way to it.  Return 0 if
+   the index can not be used, in which case the directory has to be
+   scanned instead.  */
+static int
+grub_xfs_da_lookup (struct grub_fshelp_node *diro, const char *name,
+		    grub_fshelp_node_t *foundnode,
+		    enum grub_fshelp_filetype *foundtype)
+{
+  struct grub_xfs_data *data = diro->data;
+  int dirblk_size = 1 << (data->sblock.log2_bsize + data->sblock.log2_dirblk);
+  int hdrsize = data->hascrc ? 64 : 16;
+  struct grub_xfs_da_lookup_ctx ctx = {
+    .diro = diro,
+    .name = name,
+    .namelen = grub_strlen (name),
+    .datablk = -1,
+    .foundnode = foundnode,
+    .foundtype = foundtype
+  };
+  grub_uint32_t hash = grub_xfs_da_hashname ((const grub_uint8_t *) name,
+					     ctx.namelen);
+  struct grub_xfs_da_blkinfo *info;
+  struct grub_xfs_da_entry *ents;
+  grub_uint64_t dablk;
+  char *buf;
+  int count, depth, r = -1;
+
+  if (ctx.namelen > 255)
+    return 0;
+
+  buf = grub_malloc (2 * dirblk_size);
+  if (!buf)
+    {
+      grub_errno = GRUB_ERR_NONE;
+      return 0;
+    }
+  ctx.datablock = buf + dirblk_size;
+
+  /* A block directory keeps its leaf entries at the end of its only
+     block, just in front of the tail.  A leaf directory with a single
+     data block has the same size, but not the same magic.  */
+  if (grub_be_to_cpu64 (diro->inode.size) == (grub_uint64_t) dirblk_size)
+    {
+      struct grub_xfs_dirblock_tail *tail = grub_xfs_dir_tail (data, buf);
+      grub_uint32_t magic;
+
+      if (!grub_xfs_read_dirblock (diro, 0, buf))
+	goto out;
+      magic = grub_be_to_cpu32 (grub_get_unaligned32 (buf));
+      if (magic == XFS_DIR2_BLOCK_MAGIC || magic == XFS_DIR3_BLOCK_MAGIC)
+	{
+	  count = grub_be_to_cpu32 (tail->leaf_count);
+	  if (count <= 0
+	      || (grub_size_t) count * sizeof (*ents) > (grub_size_t) dirblk_size)
+	    goto out;
+
+	  ents = (struct grub_xfs_da_entry *) tail - count;
+	  /* The entries point back into this very block.  */
+	  ctx.datablock = buf;
+	  ctx.datablk = 0;
+	  r = grub_xfs_da_scan_leaf (&ctx, ents,
+				     grub_xfs_da_search (ents, count, hash),
+				     count, hash);
+	  goto out;
+	}
+    }
+
+  /* Otherwise the index starts at XFS_DIR2_LEAF_OFFSET, with either the
+     only leaf or the root of a tree of nodes over the leaves.  */
+  dablk = XFS_DIR2_LEAF_OFFSET >> data->sblock.log2_bsize;
+  for (depth = 0; ; depth++)
+    {
+      grub_uint16_t magic;
+
+      if (depth > XFS_DA_NODE_MAXDEPTH
+	  || !grub_xfs_read_dirblock (diro, dablk, buf))
+	goto out;
+
+      info = (struct grub_xfs_da_blkinfo *) buf;
+      magic = grub_be_to_cpu16 (info->magic);
+      count = grub_xfs_da_count (data, buf);
+      ents = (struct grub_xfs_da_entry *) (buf + hdrsize);
+      if (count <= 0
+	  || hdrsize + (grub_size_t) count * sizeof (*ents)
+	     > (grub_size_t) dirblk_size)
+	goto out;
+
+      if (magic == XFS_DA_NODE_MAGIC || magic == XFS_DA3_NODE_MAGIC)
+	{
+	  /* Each entry holds the highest hash below it, descend into the
+	     first one that may hold HASH.  */
+	  int i = grub_xfs_da_search (ents, count, hash);
+
+	  if (i == count)
+	    i = count - 1;
+	  dablk = grub_be_to_cpu32 (ents[i].val);
+	  continue;
+	}
+
+      if (magic != XFS_DIR2_LEAF1_MAGIC && magic != XFS_DIR3_LEAF1_MAGIC
+	  && magic != XFS_DIR2_LEAFN_MAGIC && magic != XFS_DIR3_LEAFN_MAGIC)
+	goto out;
+      break;
+    }
+
+  /* Names with the same hash can run on into the following leaves.  */
+  r = grub_xfs_da_scan_leaf (&ctx, ents, grub_xfs_da_search (ents, count, hash),
+			     count, hash);
+  for (depth = 0; r == 0 && info->forw && depth < 64; depth++)
+    {
+      grub_uint16_t magic;
+
+      r = -1;
+      if (!grub_xfs_read_dirblock (diro, grub_be_to_cpu32 (info->forw), buf))
+	break;
+      magic = grub_be_to_cpu16 (info->magic);
+      count = grub_xfs_da_count (data, buf);
+      if ((magic != XFS_DIR2_LEAFN_MAGIC && magic != XFS_DIR3_LEAFN_MAGIC)
+	  || count <= 0
+	  || hdrsize + (grub_size_t) count * sizeof (*ents)
+	     > (grub_size_t) dirblk_size)
+	break;
+      r = grub_xfs_da_scan_leaf (&ctx, ents, 0, count, hash);
+    }
+
+ out:
+  grub_free (buf);
+  if (r < 0)
+    {
+      grub_errno = GRUB_ERR_NONE;
+      return 0;
+    }
+  return 1;
+}
+
+/* Context for grub_xfs_lookup_file.  */
+struct grub_xfs_lookup_ctx
+{
+  const char *name;
+  grub_fshelp_node_t *foundnode;
+  enum grub_fshelp_filetype *foundtype;
+};
+
+/* Helper for grub_xfs_lookup_file.  */
+static int
+grub_xfs_lookup_iter (const char *filename, enum grub_fshelp_filetype filetype,
+		      grub_fshelp_node_t node, void *data)
+{
+  struct grub_xfs_lookup_ctx *ctx = data;
+
+  if (grub_strcmp (filename, ctx->name) != 0)
+    {
+      grub_free (node);
+      return 0;
+    }
+
+  *ctx->foundnode = node;
+  *ctx->foundtype = filetype;
+  return 1;
+}
+
+/* Find NAME in the directory DIR.  Directories that are not inline in
+   their inode are looked up through their hash index.  */
+static grub_err_t
+grub_xfs_lookup_file (grub_fshelp_node_t dir, const char *name,
+		      grub_fshelp_node_t *foundnode,
+		      enum grub_fshelp_filetype *foundtype)
+{
+  struct grub_xfs_lookup_ctx ctx = {
+    .name = name,
+    .foundnode = foundnode,
+    .foundtype = foundtype
+  };
+
+  if ((dir->inode.format == XFS_INODE_FORMAT_EXT
+       || dir->inode.format == XFS_INODE_FORMAT_BTREE)
+      && grub_xfs_da_lookup (dir, name, foundnode, foundtype))
+    return grub_errno;
+
+  grub_xfs_iterate_dir (dir, grub_xfs_lookup_iter, &ctx);
+  return grub_errno;
+}
+
+
 static struct grub_xfs_data *
 grub_xfs_mount (grub_disk_t disk)
 {
@@ -948,12 +1334,44 @@ grub_xfs_dir_iter (const char *filename, enum grub_fshelp_filetype filetype,
     {
       info.mtimeset = 1;
       info.mtime = grub_be_to_cpu32 (node->inode.mtime.sec);
+      if ((filetype & GRUB_FSHELP_TYPE_MASK) == GRUB_FSHELP_REG)
+	{
+	  info.sizeset = 1;
+	  info.size = grub_be_to_cpu64 (node->inode.size);
+	}
     }
   info.dir = ((filetype & GRUB_FSHELP_TYPE_MASK) == GRUB_FSHELP_DIR);
   grub_free (node);
   return ctx->hook (filename, &info, ctx->hook_data);
 }
 
+/* Nodes only point at their mount, so lookups can be kept across mounts.  */
+static grub_size_t
+grub_xfs_node_size (grub_fshelp_node_t node)
+{
+  /* As allocated by grub_xfs_iterate_dir.  */
+  return grub_xfs_fshelp_size (node->data) + 1;
+}
+
+static grub_uint64_t
+grub_xfs_node_ident (grub_fshelp_node_t node)
+{
+  return node->ino;
+}
+
+static void
+grub_xfs_node_attach (grub_fshelp_node_t node, grub_fshelp_node_t root)
+{
+  node->data = root->data;
+}
+
+static const struct grub_fshelp_cache_ops grub_xfs_cache_ops =
+  {
+    .node_size = grub_xfs_node_size,
+    .ident = grub_xfs_node_ident,
+    .attach = grub_xfs_node_attach
+  };
+
 static grub_err_t
 grub_xfs_dir (grub_device_t device, const char *path,
 	      grub_fs_dir_hook_t hook, void *hook_data)
@@ -968,8 +1386,10 @@ grub_xfs_dir (grub_device_t device, const char *path,
   if (!data)
     goto mount_fail;
 
-  grub_fshelp_find_file (path, &data->diropen, &fdiro, grub_xfs_iterate_dir,
-			 grub_xfs_read_symlink, GRUB_FSHELP_DIR);
+  grub_fshelp_find_file_cached (path, &data->diropen, &fdiro,
+				NULL, grub_xfs_lookup_file,
+				grub_xfs_read_symlink, GRUB_FSHELP_DIR,
+				data->disk, &grub_xfs_cache_ops);
   if (grub_errno)
     goto fail;
 
@@ -1001,8 +1421,10 @@ grub_xfs_open (struct grub_file *file, const char *name)
   if (!data)
     goto mount_fail;
 
-  grub_fshelp_find_file (name, &data->diropen, &fdiro, grub_xfs_iterate_dir,
-			 grub_xfs_read_symlink, GRUB_FSHELP_REG);
+  grub_fshelp_find_file_cached (name, &data->diropen, &fdiro,
+				NULL, grub_xfs_lookup_file,
+				grub_xfs_read_symlink, GRUB_FSHELP_REG,
+				data->disk, &grub_xfs_cache_ops);
   if (grub_errno)
     goto fail;
 
@@ -1049,6 +1471,22 @@ grub_xfs_read (grub_file_t file, char *buf, grub_size_t len)
 }
 
 
+static grub_err_t
+grub_xfs_map (grub_file_t file, grub_size_t len,
+	      grub_fs_extent_hook_t hook, void *hook_data)
+{
+  struct grub_xfs_data *data =
+    (struct grub_xfs_data *) file->data;
+
+  return grub_fshelp_map_file_extents (&data->diropen, file->offset, len,
+				       grub_xfs_read_block,
+				       grub_be_to_cpu64 (data->diropen.inode.size),
+				       data->sblock.log2_bsize
+				       - GRUB_DISK_SECTOR_BITS,
+				       0, hook, hook_data);
+}
+
+
 static grub_err_t
 grub_xfs_close (grub_file_t file)
 {
@@ -1114,6 +1552,12 @@ grub_xfs_uuid (grub_device_t device, char **uuid)
 
 
 
+static const struct grub_fs_magic grub_xfs_magics[] =
+  {
+    { 0, 4, "XFSB" },
+    { 0, 0, 0 }
+  };
+
 static struct grub_fs grub_xfs_fs =
   {
     .name = "xfs",
@@ -1121,8 +1565,10 @@ static struct grub_fs grub_xfs_fs =
     .open = grub_xfs_open,
     .read = grub_xfs_read,
     .close = grub_xfs_close,
+    .map = grub_xfs_map,
     .label = grub_xfs_label,
     .uuid = grub_xfs_uuid,
+    .magics = grub_xfs_magics,
 #ifdef GRUB_UTIL
     .reserved_first_sector = 0,
     .blocklist_install = 1,
@@ -1449,6 +1449,70 @@ recovery (grub_uint8_t *bufs[4], grub_size_t s, const int nbufs,
     }      
 }
 
+/* Tell the disks holding LEN bytes at OFFSET of DESC that they are about
+   to be read, so that the columns of a RAID-Z stripe are transferred
+   together rather than one after the other.  */
+static void
+prefetch_device (grub_uint64_t offset, struct grub_zfs_device_desc *desc,
+		 grub_size_t len)
+{
+  switch (desc->type)
+    {
+    case DEVICE_LEAF:
+      if (desc->dev)
+	grub_disk_prefetch (desc->dev->disk, DVA_OFFSET_TO_PHYS_SECTOR (offset),
+			    (len + GRUB_DISK_SECTOR_SIZE - 1)
+			    >> GRUB_DISK_SECTOR_BITS);
+      return;
+    case DEVICE_MIRROR:
+      /* Only the first child is read unless it fails.  */
+      if (desc->n_children > 0)
+	prefetch_device (offset, &desc->children[0], len);
+      return;
+    case DEVICE_RAIDZ:
+      {
+	unsigned c = 0;
+	grub_uint64_t high;
+	grub_uint64_t devn;
+	grub_uint32_t s;
+
+	if (desc->nparity < 1 || desc->nparity > 3
+	    || desc->n_children <= desc->nparity)
+	  return;
+
+	/* Same mapping as in read_device.  */
+	s = (((len + (1 << desc->ashift) - 1) >> desc->ashift)
+	     + (desc->n_children - desc->nparity) - 1);
+	if (desc->nparity == 2)
+	  c = 2;
+	if (desc->nparity == 3)
+	  c = 3;
+	while (len > 0)
+	  {
+	    grub_size_t csize;
+
+	    if (desc->nparity == 1
+		&& ((offset >> (desc->ashift + 20 - desc->max_children_ashift))
+		    & 1) == c)
+	      c++;
+
+	    high = grub_divmod64 ((offset >> desc->ashift) + c,
+				  desc->n_children, &devn);
+	    csize = (s / (desc->n_children - desc->nparity)) << desc->ashift;
+	    if (csize > len)
+	      csize = len;
+	    prefetch_device ((high << desc->ashift)
+			     | (offset & ((1 << desc->ashift) - 1)),
+			     &desc->children[devn], csize);
+	    c++;
+	    s--;
+	    len -= csize;
+	  }
+	return;
+      }
+    }
+}
+
 static grub_err_t
 read_device (grub_uint64_t offset, struct grub_zfs_device_desc *desc,
 	     grub_size_t len, void *buf)
@@ -1525,6 +1589,7 @@ read_device (grub_uint64_t offset, struct grub_zfs_device_desc *desc,
 	else
 	  idx = ((len + (1 << desc->ashift) - 1) >> desc->ashift) - 1;
 	orig_idx = idx;
+	prefetch_device (offset, desc, len);
 	while (len > 0)
 	  {
 	    grub_size_t csize;
@@ -1995,6 +2060,130 @@ zio_read (blkptr_t *bp, grub_zfs_endian_t endian, void **buf,
   return GRUB_ERR_NONE;
 }
 
+/* Verified and decompressed metadata blocks, kept across mounts and
+   looked up by pool, DVA and birth txg.  Least recently used blocks are
+   dropped first.  */
+#define ZFS_CACHE_BLOCKS 64
+#define ZFS_CACHE_BYTES (2 << 20)
+#define ZFS_CACHE_MAX_BLOCK (128 << 10)
+
+struct grub_zfs_cache_block
+{
+  struct grub_zfs_cache_block *next;
+  grub_uint64_t guid;
+  dva_t dva;
+  grub_uint64_t birth;
+  grub_size_t size;
+  void *buf;
+};
+
+static struct grub_zfs_cache_block *block_cache;
+static unsigned block_cache_count;
+static grub_size_t block_cache_bytes;
+static unsigned long block_cache_generation;
+
+static void
+block_cache_flush (void)
+{
+  while (block_cache)
+    {
+      struct grub_zfs_cache_block *b = block_cache;
+
+      block_cache = b->next;
+      grub_free (b->buf);
+      grub_free (b);
+    }
+  block_cache_count = 0;
+  block_cache_bytes = 0;
+}
+
+/* Like zio_read, but go through the block cache.  */
+static grub_err_t
+zio_read_cached (blkptr_t *bp, grub_zfs_endian_t endian, void **buf,
+		 grub_size_t *size, struct grub_zfs_data *data)
+{
+  struct grub_zfs_cache_block *b, **prev;
+  grub_size_t lsize;
+  grub_err_t err;
+
+  /* Embedded blocks are in the pointer already and decrypted ones must
+     not outlive the key.  */
+  if (BP_IS_EMBEDDED (bp) || BP_IS_HOLE (bp)
+      || ((grub_zfs_to_cpu64 (bp->blk_prop, endian) >> 60) & 3))
+    return zio_read (bp, endian, buf, size, data);
+
+  if (block_cache_generation != grub_disk_generation)
+    {
+      block_cache_flush ();
+      block_cache_generation = grub_disk_generation;
+    }
+
+  for (prev = &block_cache; *prev; prev = &(*prev)->next)
+    {
+      b = *prev;
+      if (b->guid == data->guid && b->birth == bp->blk_birth
+	  && b->dva.dva_word[0] == bp->blk_dva[0].dva_word[0]
+	  && b->dva.dva_word[1] == bp->blk_dva[0].dva_word[1])
+	{
+	  *buf = grub_malloc (b->size);
+	  if (!*buf)
+	    return grub_errno;
+	  grub_memcpy (*buf, b->buf, b->size);
+	  if (size)
+	    *size = b->size;
+	  *prev = b->next;
+	  b->next = block_cache;
+	  block_cache = b;
+	  return GRUB_ERR_NONE;
+	}
+    }
+
+  err = zio_read (bp, endian, buf, &lsize, data);
+  if (size)
+    *size = lsize;
+  if (err || lsize > ZFS_CACHE_MAX_BLOCK)
+    return err;
+
+  b = grub_malloc (sizeof (*b));
+  if (!b)
+    {
+      grub_errno = GRUB_ERR_NONE;
+      return GRUB_ERR_NONE;
+    }
+  b->buf = grub_malloc (lsize);
+  if (!b->buf)
+    {
+      grub_free (b);
+      grub_errno = GRUB_ERR_NONE;
+      return GRUB_ERR_NONE;
+    }
+  grub_memcpy (b->buf, *buf, lsize);
+  b->guid = data->guid;
+  b->dva = bp->blk_dva[0];
+  b->birth = bp->blk_birth;
+  b->size = lsize;
+  b->next = block_cache;
+  block_cache = b;
+  block_cache_count++;
+  block_cache_bytes += lsize;
+
+  /* Drop the least recently used blocks, but never the new one.  */
+  while (block_cache->next
+	 && (block_cache_count > ZFS_CACHE_BLOCKS
+	     || block_cache_bytes > ZFS_CACHE_BYTES))
+    {
+      for (prev = &block_cache->next; (*prev)->next; prev = &(*prev)->next);
+      b = *prev;
+      *prev = NULL;
+      block_cache_count--;
+      block_cache_bytes -= b->size;
+      grub_free (b->buf);
+      grub_free (b);
+    }
+
+  return GRUB_ERR_NONE;
+}
+
 /*
  * Get the block from a block id.
  * push the block onto the stack.
@@ -2047,12 +2236,17 @@ dmu_read (dnode_end_t * dn, grub_uint64_t blkid, void **buf,
       if (level == 0)
 	{
 	  grub_dprintf ("zfs", "endian = %d\n", endian);
-	  err = zio_read (bp, endian, buf, 0, data);
+	  /* File contents are mostly read once, keep them out of the
+	     cache.  */
+	  if (dn->dn.dn_type == DMU_OT_PLAIN_FILE_CONTENTS)
+	    err = zio_read (bp, endian, buf, 0, data);
+	  else
+	    err = zio_read_cached (bp, endian, buf, 0, data);
 	  endian = (grub_zfs_to_cpu64 (bp->blk_prop, endian) >> 63) & 1;
 	  break;
 	}
       grub_dprintf ("zfs", "endian = %d\n", endian);
-      err = zio_read (bp, endian, &tmpbuf, 0, data);
+      err = zio_read_cached (bp, endian, &tmpbuf, 0, data);
       endian = (grub_zfs_to_cpu64 (bp->blk_prop, endian) >> 63) & 1;
       if (err)
 	break;
@@ -3138,7 +3332,7 @@ make_mdn (dnode_end_t * mdn, struct grub_zfs_data *data)
   grub_dprintf ("zfs", "endian = %d\n", mdn->endian);
 
   bp = &(((dsl_dataset_phys_t *) DN_BONUS (&mdn->dn))->ds_bp);
-  err = zio_read (bp, mdn->endian, &osp, &ospsize, data);
+  err = zio_read_cached (bp, mdn->endian, &osp, &ospsize, data);
   if (err)
     return err;
   if (ospsize < OBJSET_PHYS_SIZE_V14)
@@ -4375,4 +4569,5 @@ GRUB_MOD_INIT (zfs)
 GRUB_MOD_FINI (zfs)
 {
   grub_fs_unregister (&grub_zfs_fs);
+  block_cache_flush ();
 }
@@ -60,17 +60,62 @@ fletcher_2(const void *buf, grub_uint64_t size, grub_zfs_endian_t endian,
   zcp->zc_word[3] = grub_cpu_to_zfs64 (b1, endian);
 }
 
+/* Fletcher-4 kept in four lanes, lane I summing words I, I + 4, I + 8 and
+   so on, then combined into the single-lane result the way ZFS's
+   superscalar4 implementation does.  The lanes don't depend on each
+   other, so the four running sums of a word no longer wait on those of
+   the word before it.  Only whole groups of four words are summed.  */
+static inline void __attribute__ ((always_inline))
+fletcher_4_lanes (const grub_uint32_t *ip, const grub_uint32_t *ipend,
+		  grub_zfs_endian_t endian, grub_uint64_t *abcd)
+{
+  grub_uint64_t a[4] = { 0 }, b[4] = { 0 }, c[4] = { 0 }, d[4] = { 0 };
+  unsigned i;
+
+  for (; ip < ipend; ip += 4)
+    for (i = 0; i < 4; i++)
+      {
+	a[i] += grub_zfs_to_cpu32 (ip[i], endian);
+	b[i] += a[i];
+	c[i] += b[i];
+	d[i] += c[i];
+      }
+
+  abcd[0] = a[0] + a[1] + a[2] + a[3];
+  abcd[1] = 4 * (b[0] + b[1] + b[2] + b[3])
+    - a[1] - 2 * a[2] - 3 * a[3];
+  abcd[2] = 16 * (c[0] + c[1] + c[2] + c[3])
+    + a[2] + 3 * a[3]
+    - 6 * b[0] - 10 * b[1] - 14 * b[2] - 18 * b[3];
+  abcd[3] = 64 * (d[0] + d[1] + d[2] + d[3])
+    - a[3]
+    + 4 * b[0] + 10 * b[1] + 20 * b[2] + 34 * b[3]
+    - 48 * c[0] - 64 * c[1] - 80 * c[2] - 96 * c[3];
+}
+
 void
 fletcher_4 (const void *buf, grub_uint64_t size, grub_zfs_endian_t endian, 
 	    zio_cksum_t *zcp)
 {
   const grub_uint32_t *ip = buf;
   const grub_uint32_t *ipend = ip + (size / sizeof (grub_uint32_t));
+  const grub_uint32_t *lanesend = ip + ((size / sizeof (grub_uint32_t)) & ~3);
+  grub_uint64_t abcd[4];
   grub_uint64_t a, b, c, d;
-  
-  for (a = b = c = d = 0; ip < ipend; ip++) 
+
+  /* Separate copies so that the byte order is settled outside the loop.  */
+  if (endian == GRUB_ZFS_BIG_ENDIAN)
+    fletcher_4_lanes (ip, lanesend, GRUB_ZFS_BIG_ENDIAN, abcd);
+  else
+    fletcher_4_lanes (ip, lanesend, GRUB_ZFS_LITTLE_ENDIAN, abcd);
+
+  a = abcd[0];
+  b = abcd[1];
+  c = abcd[2];
+  d = abcd[3];
+  for (ip = lanesend; ip < ipend; ip++) 
     {
-      a += grub_zfs_to_cpu32 (ip[0], endian);;
+      a += grub_zfs_to_cpu32 (ip[0], endian);
       b += a;
       c += b;
       d += c;
@@ -81,4 +126,3 @@ fletcher_4 (const void *buf, grub_uint64_t size, grub_zfs_endian_t endian,
   zcp->zc_word[2] = grub_cpu_to_zfs64 (c, endian);
   zcp->zc_word[3] = grub_cpu_to_zfs64 (d, endian);
 }
-
@@ -167,6 +167,13 @@ LZ4_uncompress_unknownOutputSize(const char *source,
 	BYTE *const oend = op + maxOutputSize;
 	BYTE *cpy;
 
+	/*
+	 * Below these the shortcut's fixed-size copies of up to 16 literal
+	 * and 18 match bytes stay inside the buffers.
+	 */
+	const BYTE *const shortiend = iend - 14 - 2;
+	BYTE *const shortoend = oend - 14 - 18;
+
 	size_t dec[] = { 0, 3, 2, 3, 0, 0, 0, 0 };
 
 	/* Main Loop */
@@ -176,7 +183,42 @@ LZ4_uncompress_unknownOutputSize(const char *source,
 
 		/* get runlength */
 		token = *ip++;
-		if ((length = (token >> ML_BITS)) == RUN_MASK) {
+		length = token >> ML_BITS;
+
+		/*
+		 * Shortcut for a short literal run followed by a short match
+		 * (the usual sequence) away from the ends of the buffers:
+		 * copy a fixed 16 literal bytes and, when the match doesn't
+		 * overlap within 8 bytes, a fixed 18 match bytes.  What is
+		 * copied past the sequence is overwritten by the next one.
+		 */
+		if (length != RUN_MASK && likely(ip < shortiend) &&
+		    likely(op <= shortoend)) {
+			size_t offset;
+
+			A64(op) = A64(ip);
+			A64(op + 8) = A64(ip + 8);
+			op += length;
+			ip += length;
+
+			length = token & ML_MASK;
+			offset = grub_le_to_cpu16(A16(ip));
+			ref = op - offset;
+			if (length != ML_MASK && offset >= 8 &&
+			    ref >= (BYTE *) dest) {
+				ip += 2;
+				A64(op) = A64(ref);
+				A64(op + 8) = A64(ref + 8);
+				A16(op + 16) = A16(ref + 16);
+				op += length + MINMATCH;
+				continue;
+			}
+			/* Take the long way for the match. */
+			cpy = op;
+			goto _get_offset;
+		}
+
+		if (length == RUN_MASK) {
 			int s = 255;
 			while ((ip < iend) && (s == 255)) {
 				s = *ip++;
@@ -213,6 +255,7 @@ LZ4_uncompress_unknownOutputSize(const char *source,
 		op = cpy;
 
 		/* get offset */
+	_get_offset:
 		LZ4_READ_LITTLEENDIAN_16(ref, cpy, ip);
 		ip += 2;
 		if (ref < (BYTE * const) dest)
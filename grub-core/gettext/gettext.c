@@ -36,12 +36,6 @@ GRUB_MOD_LICENSE ("GPLv3+");
 
 static const char *(*grub_gettext_original) (const char *s);
 
-struct grub_gettext_msg
-{
-  char *name;
-  char *translated;
-};
-
 struct header
 {
   grub_uint32_t magic;
@@ -49,6 +43,8 @@ struct header
   grub_uint32_t number_of_strings;
   grub_uint32_t offset_original;
   grub_uint32_t offset_translation;
+  grub_uint32_t hash_size;
+  grub_uint32_t offset_hash;
 };
 
 struct string_descriptor 
@@ -57,191 +53,156 @@ struct string_descriptor
   grub_uint32_t offset;
 };
 
+/* The whole .mo file is kept in memory.  Translations are copied out the
+   first time they are asked for and never freed, since callers may hold
+   on to them across a language change.  */
 struct grub_gettext_context
 {
-  grub_file_t fd_mo;
-  grub_off_t grub_gettext_offset_original;
-  grub_off_t grub_gettext_offset_translation;
+  char *mo;
+  grub_size_t mo_size;
+  grub_size_t grub_gettext_offset_original;
+  grub_size_t grub_gettext_offset_translation;
   grub_size_t grub_gettext_max;
-  int grub_gettext_max_log;
-  struct grub_gettext_msg *grub_gettext_msg_list;
+  grub_size_t hash_offset;
+  grub_uint32_t hash_size;
+  char **translated;
 };
 
 static struct grub_gettext_context main_context, secondary_context;
 
 #define MO_MAGIC_NUMBER 		0x950412de
 
-static grub_err_t
-grub_gettext_pread (grub_file_t file, void *buf, grub_size_t len,
-		    grub_off_t offset)
+static grub_uint32_t
+mo_word (const struct grub_gettext_context *ctx, grub_size_t off)
 {
-  if (len == 0)
-    return GRUB_ERR_NONE;
-  if (grub_file_seek (file, offset) == (grub_off_t) - 1)
-    return grub_errno;
-  if (grub_file_read (file, buf, len) != (grub_ssize_t) len)
-    {
-      if (!grub_errno)
-	grub_error (GRUB_ERR_READ_ERROR, N_("premature end of file"));
-      return grub_errno;
-    }
-  return GRUB_ERR_NONE;
+  return grub_le_to_cpu32 (grub_get_unaligned32 (ctx->mo + off));
 }
 
-static char *
-grub_gettext_getstr_from_position (struct grub_gettext_context *ctx,
-				   grub_off_t off,
-				   grub_size_t position)
+/* String POSITION of the table at TABLE, or NULL if the descriptor points
+   outside the file or the string isn't terminated.  */
+static const char *
+mo_string (const struct grub_gettext_context *ctx, grub_size_t table,
+	   grub_size_t position)
 {
-  grub_off_t internal_position;
-  grub_size_t length;
-  grub_off_t offset;
-  char *translation;
-  struct string_descriptor desc;
-  grub_err_t err;
-
-  internal_position = (off + position * sizeof (desc));
-
-  err = grub_gettext_pread (ctx->fd_mo, (char *) &desc,
-			    sizeof (desc), internal_position);
-  if (err)
-    return NULL;
-  length = grub_cpu_to_le32 (desc.length);
-  offset = grub_cpu_to_le32 (desc.offset);
+  grub_size_t desc = table + position * sizeof (struct string_descriptor);
+  grub_uint32_t length, offset;
 
-  translation = grub_malloc (length + 1);
-  if (!translation)
+  length = mo_word (ctx, desc);
+  offset = mo_word (ctx, desc + 4);
+  if (offset >= ctx->mo_size || length >= ctx->mo_size - offset
+      || ctx->mo[offset + length] != '\0')
     return NULL;
-
-  err = grub_gettext_pread (ctx->fd_mo, translation, length, offset);
-  if (err)
-    {
-      grub_free (translation);
-      return NULL;
-    }
-  translation[length] = '\0';
-
-  return translation;
+  return ctx->mo + offset;
 }
 
-static const char *
-grub_gettext_gettranslation_from_position (struct grub_gettext_context *ctx,
-					   grub_size_t position)
+/* The hash function gettext uses when building the table.  */
+static grub_uint32_t
+mo_hash (const char *str)
 {
-  if (!ctx->grub_gettext_msg_list[position].translated)
-    ctx->grub_gettext_msg_list[position].translated
-      = grub_gettext_getstr_from_position (ctx,
-					   ctx->grub_gettext_offset_translation,
-					   position);
-  return ctx->grub_gettext_msg_list[position].translated;
-}
+  grub_uint32_t hval = 0, g;
 
-static const char *
-grub_gettext_getstring_from_position (struct grub_gettext_context *ctx,
-				      grub_size_t position)
-{
-  if (!ctx->grub_gettext_msg_list[position].name)
-    ctx->grub_gettext_msg_list[position].name
-      = grub_gettext_getstr_from_position (ctx,
-					   ctx->grub_gettext_offset_original,
-					   position);
-  return ctx->grub_gettext_msg_list[position].name;
+  while (*str)
+    {
+      hval <<= 4;
+      hval += (grub_uint8_t) *str++;
+      g = hval & (0xfU << 28);
+      if (g)
+	{
+	  hval ^= g >> 24;
+	  hval ^= g;
+	}
+    }
+  return hval;
 }
 
-static const char *
-grub_gettext_translate_real (struct grub_gettext_context *ctx,
-			     const char *orig)
+/* Index of ORIG in the original strings, or -1.  */
+static grub_ssize_t
+mo_find (const struct grub_gettext_context *ctx, const char *orig)
 {
-  grub_size_t current = 0;
-  int i;
   const char *current_string;
-  static int depth = 0;
-
-  if (!ctx->grub_gettext_msg_list || !ctx->fd_mo)
-    return NULL;
-
-  /* Shouldn't happen. Just a precaution if our own code
-     calls gettext somehow.  */
-  if (depth > 2)
-    return NULL;
-  depth++;
-
-  /* Make sure we can use grub_gettext_translate for error messages.  Push
-     active error message to error stack and reset error message.  */
-  grub_error_push ();
+  grub_size_t lo, hi;
 
-  for (i = ctx->grub_gettext_max_log; i >= 0; i--)
+  if (ctx->hash_size > 2)
     {
-      grub_size_t test;
-      int cmp;
+      grub_uint32_t hval = mo_hash (orig);
+      grub_uint32_t idx = hval % ctx->hash_size;
+      grub_uint32_t incr = 1 + hval % (ctx->hash_size - 2);
+      grub_uint32_t tries;
 
-      test = current | (1 << i);
-      if (test >= ctx->grub_gettext_max)
-	continue;
-
-      current_string = grub_gettext_getstring_from_position (ctx, test);
-
-      if (!current_string)
+      for (tries = 0; tries < ctx->hash_size; tries++)
 	{
-	  grub_errno = GRUB_ERR_NONE;
-	  grub_error_pop ();
-	  depth--;
-	  return NULL;
-	}
+	  grub_uint32_t nstr = mo_word (ctx, ctx->hash_offset + 4 * idx);
 
-      /* Search by bisection.  */
-      cmp = grub_strcmp (current_string, orig);
-      if (cmp <= 0)
-	current = test;
-      if (cmp == 0)
-	{
-	  const char *ret = 0;
-	  ret = grub_gettext_gettranslation_from_position (ctx, current);
-	  if (!ret)
+	  if (nstr == 0)
+	    return -1;
+	  nstr--;
+	  if (nstr < ctx->grub_gettext_max)
 	    {
-	      grub_errno = GRUB_ERR_NONE;
-	      grub_error_pop ();
-	      depth--;
-	      return NULL;
+	      current_string = mo_string (ctx,
+					  ctx->grub_gettext_offset_original,
+					  nstr);
+	      if (current_string && grub_strcmp (current_string, orig) == 0)
+		return nstr;
 	    }
-	  grub_error_pop ();
-	  depth--;
-	  return ret;      
+	  if (idx >= ctx->hash_size - incr)
+	    idx -= ctx->hash_size - incr;
+	  else
+	    idx += incr;
 	}
+      return -1;
     }
 
-  if (current == 0 && ctx->grub_gettext_max != 0)
+  /* No hash table: the original strings are sorted.  */
+  lo = 0;
+  hi = ctx->grub_gettext_max;
+  while (lo < hi)
     {
-      current_string = grub_gettext_getstring_from_position (ctx, 0);
+      grub_size_t mid = lo + (hi - lo) / 2;
+      int cmp;
 
+      current_string = mo_string (ctx, ctx->grub_gettext_offset_original,
+				  mid);
       if (!current_string)
-	{
-	  grub_errno = GRUB_ERR_NONE;
-	  grub_error_pop ();
-	  depth--;
-	  return NULL;
-	}
-
-      if (grub_strcmp (current_string, orig) == 0)
-	{
-	  const char *ret = 0;
-	  ret = grub_gettext_gettranslation_from_position (ctx, current);
-	  if (!ret)
-	    {
-	      grub_errno = GRUB_ERR_NONE;
-	      grub_error_pop ();
-	      depth--;
-	      return NULL;
-	    }
-	  grub_error_pop ();
-	  depth--;
-	  return ret;      
-	}
+	return -1;
+      cmp = grub_strcmp (current_string, orig);
+      if (cmp == 0)
+	return mid;
+      if (cmp < 0)
+	lo = mid + 1;
+      else
+	hi = mid;
     }
+  return -1;
+}
+
+static const char *
+grub_gettext_translate_real (struct grub_gettext_context *ctx,
+			     const char *orig)
+{
+  grub_ssize_t position;
+  const char *translation;
+
+  if (!ctx->mo)
+    return NULL;
+
+  position = mo_find (ctx, orig);
+  if (position < 0)
+    return NULL;
 
-  grub_error_pop ();
-  depth--;
-  return NULL;
+  if (!ctx->translated[position])
+    {
+      translation = mo_string (ctx, ctx->grub_gettext_offset_translation,
+			       position);
+      if (!translation)
+	return NULL;
+
+      /* Make sure we can use grub_gettext_translate for error messages.  */
+      grub_error_push ();
+      ctx->translated[position] = grub_strdup (translation);
+      grub_errno = GRUB_ERR_NONE;
+      grub_error_pop ();
+    }
+  return ctx->translated[position];
 }
 
 static const char *
@@ -263,19 +224,9 @@ grub_gettext_translate (const char *orig)
 static void
 grub_gettext_delete_list (struct grub_gettext_context *ctx)
 {
-  struct grub_gettext_msg *l = ctx->grub_gettext_msg_list;
-  grub_size_t i;
-
-  if (!l)
-    return;
-  ctx->grub_gettext_msg_list = 0;
-  for (i = 0; i < ctx->grub_gettext_max; i++)
-    grub_free (l[i].name);
-  /* Don't delete the translated message because could be in use.  */
-  grub_free (l);
-  if (ctx->fd_mo)
-    grub_file_close (ctx->fd_mo);
-  ctx->fd_mo = 0;
+  grub_free (ctx->mo);
+  /* Don't delete the translated messages because they could be in use.  */
+  grub_free (ctx->translated);
   grub_memset (ctx, 0, sizeof (*ctx));
 }
 
@@ -285,34 +236,54 @@ grub_mofile_open (struct grub_gettext_context *ctx,
 		  const char *filename)
 {
   struct header head;
-  grub_err_t err;
   grub_file_t fd;
-
-  /* Using fd_mo and not another variable because
-     it's needed for grub_gettext_get_info.  */
+  grub_off_t size;
+  char *mo;
+  grub_size_t tables;
 
   fd = grub_file_open (filename);
 
   if (!fd)
     return grub_errno;
 
-  err = grub_gettext_pread (fd, &head, sizeof (head), 0);
-  if (err)
+  size = grub_file_size (fd);
+  if (size < sizeof (head) || size == GRUB_FILE_SIZE_UNKNOWN
+      || size > GRUB_UINT_MAX)
     {
       grub_file_close (fd);
-      return err;
+      return grub_error (GRUB_ERR_BAD_FILE_TYPE,
+			 "mo: invalid mo file: %s", filename);
     }
 
-  if (head.magic != grub_cpu_to_le32_compile_time (MO_MAGIC_NUMBER))
+  mo = grub_malloc (size);
+  if (!mo)
+    {
+      grub_file_close (fd);
+      return grub_errno;
+    }
+
+  if (grub_file_read (fd, mo, size) != (grub_ssize_t) size)
     {
+      grub_free (mo);
       grub_file_close (fd);
+      if (!grub_errno)
+	grub_error (GRUB_ERR_READ_ERROR, N_("premature end of file"));
+      return grub_errno;
+    }
+  grub_file_close (fd);
+
+  grub_memcpy (&head, mo, sizeof (head));
+
+  if (head.magic != grub_cpu_to_le32_compile_time (MO_MAGIC_NUMBER))
+    {
+      grub_free (mo);
       return grub_error (GRUB_ERR_BAD_FILE_TYPE,
 			 "mo: invalid mo magic in file: %s", filename);
     }
 
   if (head.version != 0)
     {
-      grub_file_close (fd);
+      grub_free (mo);
       return grub_error (GRUB_ERR_BAD_FILE_TYPE,
 			 "mo: invalid mo version in file: %s", filename);
     }
@@ -320,17 +291,33 @@ grub_mofile_open (struct grub_gettext_context *ctx,
   ctx->grub_gettext_offset_original = grub_le_to_cpu32 (head.offset_original);
   ctx->grub_gettext_offset_translation = grub_le_to_cpu32 (head.offset_translation);
   ctx->grub_gettext_max = grub_le_to_cpu32 (head.number_of_strings);
-  for (ctx->grub_gettext_max_log = 0; ctx->grub_gettext_max >> ctx->grub_gettext_max_log;
-       ctx->grub_gettext_max_log++);
+  ctx->hash_size = grub_le_to_cpu32 (head.hash_size);
+  ctx->hash_offset = grub_le_to_cpu32 (head.offset_hash);
+
+  /* Both descriptor tables and the hash table must be inside the file.  */
+  tables = ctx->grub_gettext_max * sizeof (struct string_descriptor);
+  if (ctx->grub_gettext_max > size / sizeof (struct string_descriptor)
+      || ctx->grub_gettext_offset_original > size - tables
+      || ctx->grub_gettext_offset_translation > size - tables)
+    {
+      grub_free (mo);
+      grub_memset (ctx, 0, sizeof (*ctx));
+      return grub_error (GRUB_ERR_BAD_FILE_TYPE,
+			 "mo: invalid mo file: %s", filename);
+    }
+  if (ctx->hash_size > size / 4 || ctx->hash_offset > size - 4 * ctx->hash_size)
+    ctx->hash_size = 0;
 
-  ctx->grub_gettext_msg_list = grub_zalloc (ctx->grub_gettext_max
-					    * sizeof (ctx->grub_gettext_msg_list[0]));
-  if (!ctx->grub_gettext_msg_list)
+  ctx->translated = grub_zalloc (ctx->grub_gettext_max
+				 * sizeof (ctx->translated[0]) + 1);
+  if (!ctx->translated)
     {
-      grub_file_close (fd);
+      grub_free (mo);
+      grub_memset (ctx, 0, sizeof (*ctx));
       return grub_errno;
     }
-  ctx->fd_mo = fd;
+  ctx->mo = mo;
+  ctx->mo_size = size;
   if (grub_gettext != grub_gettext_translate)
     {
       grub_gettext_original = grub_gettext;
@@ -0,0 +1,354 @@
+/* bitmap_cache.c - Cache of decoded and scaled theme bitmaps.  */
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2026  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Decoding a PNG or JPEG and scaling it with the bilinear filter is by far
+   the most expensive part of loading a theme, and the same assets are
+   loaded again whenever the view is rebuilt for a new mode or a new box
+   size.  Keep the results, keyed by file name and target geometry, and
+   hand out copies.  */
+
+#include <grub/types.h>
+#include <grub/misc.h>
+#include <grub/mm.h>
+#include <grub/err.h>
+#include <grub/video.h>
+#include <grub/bitmap.h>
+#include <grub/bitmap_scale.h>
+#include <grub/bitmap_cache.h>
+#include <grub/reclaim.h>
+
+/* Least recently used entries are dropped once the cached pixel data
+   grows beyond this.  */
+#define BITMAP_CACHE_MAX_SIZE (32 * 1024 * 1024)
+
+struct bitmap_cache_entry
+{
+  struct bitmap_cache_entry *next;
+
+  char *path;
+  /* -1 for the bitmap as decoded from PATH.  */
+  int width;
+  int height;
+  grub_video_bitmap_selection_method_t selection_method;
+  grub_video_bitmap_v_align_t v_align;
+  grub_video_bitmap_h_align_t h_align;
+
+  struct grub_video_bitmap *bitmap;
+  grub_size_t size;
+};
+
+/* Most recently used first.  */
+static struct bitmap_cache_entry *bitmap_cache;
+
+static grub_size_t bitmap_cache_shrink (grub_size_t wanted);
+
+/* Its size is the cached pixel data.  It is busy while a cached bitmap
+   is being copied or scaled, which allocates.  */
+static struct grub_reclaim_cache bitmap_cache_reclaim =
+  {
+    .name = "gfxmenu bitmaps",
+    .shrink = bitmap_cache_shrink
+  };
+
+static grub_size_t
+bitmap_data_size (struct grub_video_bitmap *bitmap)
+{
+  return (grub_size_t) bitmap->mode_info.pitch * bitmap->mode_info.height;
+}
+
+static void
+free_entry (struct bitmap_cache_entry *entry)
+{
+  bitmap_cache_reclaim.size -= entry->size;
+  grub_free (entry->path);
+  grub_video_bitmap_destroy (entry->bitmap);
+  grub_free (entry);
+}
+
+void
+grub_gfxmenu_bitmap_cache_clear (void)
+{
+  struct bitmap_cache_entry *entry, *next;
+
+  for (entry = bitmap_cache; entry; entry = next)
+    {
+      next = entry->next;
+      free_entry (entry);
+    }
+  bitmap_cache = 0;
+}
+
+/* Drop entries from the tail until WANTED bytes of pixel data are
+   freed.  */
+static grub_size_t
+bitmap_cache_shrink (grub_size_t wanted)
+{
+  struct bitmap_cache_entry **prev;
+  grub_size_t freed = 0;
+
+  while (bitmap_cache && freed < wanted)
+    {
+      for (prev = &bitmap_cache; (*prev)->next; prev = &(*prev)->next)
+        ;
+      freed += (*prev)->size;
+      free_entry (*prev);
+      *prev = 0;
+    }
+
+  return freed;
+}
+
+void
+grub_gfxmenu_bitmap_cache_init (void)
+{
+  grub_reclaim_register (&bitmap_cache_reclaim);
+}
+
+void
+grub_gfxmenu_bitmap_cache_fini (void)
+{
+  grub_reclaim_unregister (&bitmap_cache_reclaim);
+  grub_gfxmenu_bitmap_cache_clear ();
+}
+
+static struct grub_video_bitmap *
+lookup (const char *path, int width, int height,
+        grub_video_bitmap_selection_method_t selection_method,
+        grub_video_bitmap_v_align_t v_align,
+        grub_video_bitmap_h_align_t h_align)
+{
+  struct bitmap_cache_entry **prev, *entry;
+
+  for (prev = &bitmap_cache; (entry = *prev); prev = &entry->next)
+    if (entry->width == width && entry->height == height
+        && entry->selection_method == selection_method
+        && entry->v_align == v_align && entry->h_align == h_align
+        && grub_strcmp (entry->path, path) == 0)
+      {
+        /* Move to the front.  */
+        *prev = entry->next;
+        entry->next = bitmap_cache;
+        bitmap_cache = entry;
+        grub_reclaim_touch (&bitmap_cache_reclaim);
+        return entry->bitmap;
+      }
+
+  return 0;
+}
+
+/* Take ownership of BITMAP and add it to the cache.  On failure BITMAP is
+   destroyed and 0 returned.  */
+static struct grub_video_bitmap *
+insert (struct grub_video_bitmap *bitmap, const char *path,
+        int width, int height,
+        grub_video_bitmap_selection_method_t selection_method,
+        grub_video_bitmap_v_align_t v_align,
+        grub_video_bitmap_h_align_t h_align)
+{
+  struct bitmap_cache_entry *entry, **prev;
+
+  entry = grub_malloc (sizeof (*entry));
+  if (! entry)
+    {
+      grub_video_bitmap_destroy (bitmap);
+      return 0;
+    }
+  entry->path = grub_strdup (path);
+  if (! entry->path)
+    {
+      grub_free (entry);
+      grub_video_bitmap_destroy (bitmap);
+      return 0;
+    }
+  entry->width = width;
+  entry->height = height;
+  entry->selection_method = selection_method;
+  entry->v_align = v_align;
+  entry->h_align = h_align;
+  entry->bitmap = bitmap;
+  entry->size = bitmap_data_size (bitmap);
+
+  bitmap_cache_reclaim.size += entry->size;
+  entry->next = bitmap_cache;
+  bitmap_cache = entry;
+  grub_reclaim_touch (&bitmap_cache_reclaim);
+
+  /* Trim from the tail, but always keep the new entry.  */
+  while (bitmap_cache_reclaim.size > BITMAP_CACHE_MAX_SIZE
+         && bitmap_cache->next)
+    {
+      for (prev = &bitmap_cache->next; (*prev)->next; prev = &(*prev)->next)
+        ;
+      free_entry (*prev);
+      *prev = 0;
+    }
+
+  return bitmap;
+}
+
+static grub_err_t
+copy_bitmap (struct grub_video_bitmap **dst, struct grub_video_bitmap *src)
+{
+  grub_size_t size = bitmap_data_size (src);
+
+  *dst = grub_malloc (sizeof (**dst));
+  if (! *dst)
+    return grub_errno;
+
+  (*dst)->mode_info = src->mode_info;
+  (*dst)->data = grub_malloc (size);
+  if (! (*dst)->data)
+    {
+      grub_free (*dst);
+      *dst = 0;
+      return grub_errno;
+    }
+  grub_memcpy ((*dst)->data, src->data, size);
+
+  return GRUB_ERR_NONE;
+}
+
+static struct grub_video_bitmap *
+get_raw (const char *path)
+{
+  struct grub_video_bitmap *bitmap;
+
+  bitmap = lookup (path, -1, -1, GRUB_VIDEO_BITMAP_SELECTION_METHOD_STRETCH,
+                   0, 0);
+  if (bitmap)
+    return bitmap;
+
+  if (grub_video_bitmap_load (&bitmap, path) != GRUB_ERR_NONE)
+    return 0;
+
+  return insert (bitmap, path, -1, -1,
+                 GRUB_VIDEO_BITMAP_SELECTION_METHOD_STRETCH, 0, 0);
+}
+
+/* Load the bitmap in PATH, reusing an earlier decode if possible.  */
+grub_err_t
+grub_gfxmenu_bitmap_load (struct grub_video_bitmap **bitmap,
+                          const char *path)
+{
+  struct grub_video_bitmap *raw;
+  grub_err_t err;
+
+  *bitmap = 0;
+
+  bitmap_cache_reclaim.busy++;
+  raw = get_raw (path);
+  if (raw)
+    err = copy_bitmap (bitmap, raw);
+  else
+    err = grub_errno;
+  bitmap_cache_reclaim.busy--;
+
+  return err;
+}
+
+static grub_err_t
+load_scaled (struct grub_video_bitmap **bitmap, const char *path,
+             int width, int height,
+             grub_video_bitmap_selection_method_t selection_method,
+             grub_video_bitmap_v_align_t v_align,
+             grub_video_bitmap_h_align_t h_align)
+{
+  struct grub_video_bitmap *scaled;
+  struct grub_video_bitmap *raw;
+
+  *bitmap = 0;
+
+  if (selection_method == GRUB_VIDEO_BITMAP_SELECTION_METHOD_STRETCH)
+    {
+      v_align = 0;
+      h_align = 0;
+    }
+
+  scaled = lookup (path, width, height, selection_method, v_align, h_align);
+  if (! scaled)
+    {
+      struct grub_video_bitmap *reduced = 0;
+
+      /* Without a full size decode at hand, let the reader go straight
+         to something close to the target size.  That is not kept: it is
+         only good for this one geometry.  */
+      raw = lookup (path, -1, -1, GRUB_VIDEO_BITMAP_SELECTION_METHOD_STRETCH,
+                    0, 0);
+      if (! raw && width > 0 && height > 0)
+        {
+          if (grub_video_bitmap_load_reduced (&reduced, path,
+                                              width, height) != GRUB_ERR_NONE)
+            return grub_errno;
+          raw = reduced;
+        }
+      else if (! raw)
+        {
+          raw = get_raw (path);
+          if (! raw)
+            return grub_errno;
+        }
+
+      if (reduced && (int) reduced->mode_info.width == width
+          && (int) reduced->mode_info.height == height)
+        {
+          scaled = reduced;
+          reduced = 0;
+        }
+      else if (selection_method == GRUB_VIDEO_BITMAP_SELECTION_METHOD_STRETCH)
+        grub_video_bitmap_create_scaled (&scaled, width, height, raw,
+                                         GRUB_VIDEO_BITMAP_SCALE_METHOD_BEST);
+      else
+        grub_video_bitmap_scale_proportional
+          (&scaled, width, height, raw, GRUB_VIDEO_BITMAP_SCALE_METHOD_BEST,
+           selection_method, v_align, h_align);
+      grub_video_bitmap_destroy (reduced);
+      if (! scaled)
+        return grub_errno;
+
+      scaled = insert (scaled, path, width, height,
+                       selection_method, v_align, h_align);
+      if (! scaled)
+        return grub_errno;
+    }
+
+  return copy_bitmap (bitmap, scaled);
+}
+
+/* Load the bitmap in PATH scaled to WIDTH by HEIGHT, as
+   grub_video_bitmap_scale_proportional would, reusing an earlier decode
+   or scale if possible.  The alignment is ignored for
+   GRUB_VIDEO_BITMAP_SELECTION_METHOD_STRETCH.  */
+grub_err_t
+grub_gfxmenu_bitmap_load_scaled (struct grub_video_bitmap **bitmap,
+                                 const char *path,
+                                 int width, int height,
+                                 grub_video_bitmap_selection_method_t
+                                 selection_method,
+                                 grub_video_bitmap_v_align_t v_align,
+                                 grub_video_bitmap_h_align_t h_align)
+{
+  grub_err_t err;
+
+  bitmap_cache_reclaim.busy++;
+  err = load_scaled (bitmap, path, width, height,
+                     selection_method, v_align, h_align);
+  bitmap_cache_reclaim.busy--;
+
+  return err;
+}
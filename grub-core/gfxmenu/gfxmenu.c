@@ -35,6 +35,7 @@
 #include <grub/menu_viewer.h>
 #include <grub/gfxmenu_model.h>
 #include <grub/gfxmenu_view.h>
+#include <grub/bitmap_cache.h>
 #include <grub/time.h>
 #include <grub/i18n.h>
 
@@ -141,10 +142,14 @@ GRUB_MOD_INIT (gfxmenu)
       }
 
   grub_gfxmenu_try_hook = grub_gfxmenu_try;
+  grub_gfxmenu_bitmap_cache_init ();
+  grub_gfxmenu_theme_pack_init (mod);
 }
 
 GRUB_MOD_FINI (gfxmenu)
 {
   grub_gfxmenu_view_destroy (cached_view);
+  grub_gfxmenu_bitmap_cache_fini ();
+  grub_gfxmenu_theme_pack_fini ();
   grub_gfxmenu_try_hook = NULL;
 }
@@ -246,6 +246,10 @@ box_paint (void *vself, const grub_video_rect_t *region)
     {
       grub_gui_component_t comp = cur->component;
       grub_video_rect_t r;
+
+      if (!grub_gfxmenu_paint_wanted (comp))
+        continue;
+
       comp->ops->get_bounds(comp, &r);
 
       if (!grub_video_have_common_points (region, &r))
@@ -139,6 +139,9 @@ canvas_paint (void *vself, const grub_video_rect_t *region)
       r.height = h;
       comp->ops->set_bounds (comp, &r);
 
+      if (!grub_gfxmenu_paint_wanted (comp))
+        continue;
+
       if (!grub_video_have_common_points (region, &r))
         continue;
 
@@ -23,6 +23,7 @@
 #include <grub/gui_string_util.h>
 #include <grub/bitmap.h>
 #include <grub/bitmap_scale.h>
+#include <grub/bitmap_cache.h>
 
 struct grub_gui_image
 {
@@ -32,6 +33,7 @@ struct grub_gui_image
   grub_video_rect_t bounds;
   char *id;
   char *theme_dir;
+  char *path;
   struct grub_video_bitmap *raw_bitmap;
   struct grub_video_bitmap *bitmap;
 };
@@ -49,6 +51,7 @@ image_destroy (void *vself)
   if (self->raw_bitmap)
     grub_video_bitmap_destroy (self->raw_bitmap);
 
+  grub_free (self->path);
   grub_free (self);
 }
 
@@ -146,11 +149,10 @@ rescale_image (grub_gui_image_t self)
     return grub_errno;
 
   /* Create the scaled bitmap.  */
-  grub_video_bitmap_create_scaled (&self->bitmap,
-                                   width,
-                                   height,
-                                   self->raw_bitmap,
-                                   GRUB_VIDEO_BITMAP_SCALE_METHOD_BEST);
+  grub_gfxmenu_bitmap_load_scaled (&self->bitmap, self->path,
+                                   width, height,
+                                   GRUB_VIDEO_BITMAP_SELECTION_METHOD_STRETCH,
+                                   0, 0);
   return grub_errno;
 }
 
@@ -191,15 +193,27 @@ static grub_err_t
 load_image (grub_gui_image_t self, const char *path)
 {
   struct grub_video_bitmap *bitmap;
-  if (grub_video_bitmap_load (&bitmap, path) != GRUB_ERR_NONE)
+  char *new_path;
+
+  new_path = grub_strdup (path);
+  if (! new_path)
     return grub_errno;
+  if (grub_gfxmenu_bitmap_load (&bitmap, path) != GRUB_ERR_NONE)
+    {
+      grub_free (new_path);
+      return grub_errno;
+    }
 
   if (self->bitmap && (self->bitmap != self->raw_bitmap))
     grub_video_bitmap_destroy (self->bitmap);
   if (self->raw_bitmap)
     grub_video_bitmap_destroy (self->raw_bitmap);
 
+  /* Make sure rescale_image doesn't keep a stale scaled bitmap.  */
+  self->bitmap = 0;
   self->raw_bitmap = bitmap;
+  grub_free (self->path);
+  self->path = new_path;
   return rescale_image (self);
 }
 
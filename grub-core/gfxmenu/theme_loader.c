@@ -31,6 +31,7 @@
 #include <grub/gfxmenu_view.h>
 #include <grub/gui.h>
 #include <grub/color.h>
+#include <grub/bitmap_cache.h>
 
 static grub_err_t
 parse_proportional_spec (const char *value, signed *abs, grub_fixed_signed_t *prop);
@@ -169,14 +170,16 @@ theme_set_string (grub_gfxmenu_view_t view,
       path = grub_resolve_relative_path (theme_dir, value);
       if (! path)
         return grub_errno;
-      if (grub_video_bitmap_load (&raw_bitmap, path) != GRUB_ERR_NONE)
+      /* Decode it now to catch errors; it is scaled to the screen size
+         from the cache once the view is drawn.  */
+      if (grub_gfxmenu_bitmap_load (&raw_bitmap, path) != GRUB_ERR_NONE)
         {
           grub_free (path);
           return grub_errno;
         }
-      grub_free(path);
-      grub_video_bitmap_destroy (view->raw_desktop_image);
-      view->raw_desktop_image = raw_bitmap;
+      grub_video_bitmap_destroy (raw_bitmap);
+      grub_free (view->desktop_image_path);
+      view->desktop_image_path = path;
     }
   else if (! grub_strcmp ("desktop-image-scale-method", name))
     {
@@ -734,11 +737,31 @@ done:
 
 /* Set properties on the view based on settings from the specified
    theme file.  */
+/* Load theme.txt from PACKED, the pack made from THEME_PATH.  */
+static grub_err_t
+load_packed_theme (grub_gfxmenu_view_t view, const char *theme_path,
+		   char *packed)
+{
+  if (grub_gfxmenu_view_load_theme (view, packed) == GRUB_ERR_NONE)
+    {
+      /* Callers compare it with the theme they asked for.  */
+      grub_free (view->theme_path);
+      view->theme_path = grub_strdup (theme_path);
+    }
+  grub_free (packed);
+  return grub_errno;
+}
+
 grub_err_t
 grub_gfxmenu_view_load_theme (grub_gfxmenu_view_t view, const char *theme_path)
 {
   grub_file_t file;
   struct parsebuf p;
+  char *packed;
+
+  packed = grub_gfxmenu_theme_pack_lookup (theme_path);
+  if (packed)
+    return load_packed_theme (view, theme_path, packed);
 
   p.view = view;
   p.theme_dir = grub_get_dirname (theme_path);
@@ -770,6 +793,17 @@ grub_gfxmenu_view_load_theme (grub_gfxmenu_view_t view, const char *theme_path)
       return grub_errno;
     }
 
+  /* The whole theme packed in an archive, which keeps the buffer.  */
+  if (grub_gfxmenu_theme_pack_check (p.buf, p.len))
+    {
+      grub_file_close (file);
+      grub_free (p.theme_dir);
+      packed = grub_gfxmenu_theme_pack_add (theme_path, p.buf, p.len);
+      if (! packed)
+	return grub_errno;
+      return load_packed_theme (view, theme_path, packed);
+    }
+
   if (view->canvas)
     view->canvas->component.ops->destroy (view->canvas);
 
@@ -0,0 +1,278 @@
+/* theme_pack.c - Themes packed into a single archive.  */
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2026  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <grub/types.h>
+#include <grub/misc.h>
+#include <grub/mm.h>
+#include <grub/err.h>
+#include <grub/dl.h>
+#include <grub/disk.h>
+#include <grub/device.h>
+#include <grub/fs.h>
+#include <grub/font.h>
+#include <grub/gfxmenu_view.h>
+
+/* A theme may be packed into one uncompressed tar archive, as made by
+   `tar -cf theme.tar -C THEME_DIR .', and given as the theme file.  The
+   archive is read into the heap once and shown as the memory disk
+   (gfxthemeN), so that theme.txt, the images and the fonts are all read
+   from memory instead of being looked up on the boot disk one by one.
+
+   Fonts keep their file open to load glyphs on demand, so once a font
+   has been loaded from a pack the module can no longer be unloaded.  */
+
+#define TAR_MAGIC_OFFSET	257
+
+struct theme_pack
+{
+  struct theme_pack *next;
+  /* Path the pack was loaded from.  */
+  char *path;
+  /* Device name, gfxthemeN.  */
+  char *name;
+  char *data;
+  grub_size_t size;
+  unsigned long id;
+};
+
+static struct theme_pack *packs;
+static unsigned long last_id;
+static grub_dl_t pack_mod;
+static int fonts_loaded;
+
+static struct theme_pack *
+find_pack_by_name (const char *name)
+{
+  struct theme_pack *pack;
+
+  for (pack = packs; pack; pack = pack->next)
+    if (grub_strcmp (pack->name, name) == 0)
+      return pack;
+  return 0;
+}
+
+static int
+grub_gfxtheme_iterate (grub_disk_dev_iterate_hook_t hook, void *hook_data,
+		       grub_disk_pull_t pull)
+{
+  struct theme_pack *pack;
+
+  if (pull != GRUB_DISK_PULL_NONE)
+    return 0;
+
+  for (pack = packs; pack; pack = pack->next)
+    if (hook (pack->name, hook_data))
+      return 1;
+  return 0;
+}
+
+static grub_err_t
+grub_gfxtheme_open (const char *name, grub_disk_t disk)
+{
+  struct theme_pack *pack;
+
+  pack = find_pack_by_name (name);
+  if (! pack)
+    return grub_error (GRUB_ERR_UNKNOWN_DEVICE, "not a theme pack");
+
+  disk->total_sectors = pack->size >> GRUB_DISK_SECTOR_BITS;
+  disk->max_agglomerate = GRUB_DISK_MAX_MAX_AGGLOMERATE;
+  disk->id = pack->id;
+  disk->memory = pack->data;
+
+  return GRUB_ERR_NONE;
+}
+
+static void
+grub_gfxtheme_close (grub_disk_t disk __attribute ((unused)))
+{
+}
+
+static grub_err_t
+grub_gfxtheme_read (grub_disk_t disk, grub_disk_addr_t sector,
+		    grub_size_t size, char *buf)
+{
+  grub_memcpy (buf, disk->memory + (sector << GRUB_DISK_SECTOR_BITS),
+	       size << GRUB_DISK_SECTOR_BITS);
+  return 0;
+}
+
+static grub_err_t
+grub_gfxtheme_write (grub_disk_t disk __attribute ((unused)),
+		     grub_disk_addr_t sector __attribute ((unused)),
+		     grub_size_t size __attribute ((unused)),
+		     const char *buf __attribute ((unused)))
+{
+  return grub_error (GRUB_ERR_NOT_IMPLEMENTED_YET,
+		     "theme packs are read-only");
+}
+
+static struct grub_disk_dev grub_gfxtheme_dev =
+  {
+    .name = "gfxtheme",
+    .id = GRUB_DISK_DEVICE_GFXTHEME_ID,
+    .iterate = grub_gfxtheme_iterate,
+    .open = grub_gfxtheme_open,
+    .close = grub_gfxtheme_close,
+    .read = grub_gfxtheme_read,
+    .write = grub_gfxtheme_write,
+    .next = 0
+  };
+
+int
+grub_gfxmenu_theme_pack_check (const char *buf, grub_size_t len)
+{
+  return (len >= GRUB_DISK_SECTOR_SIZE
+	  && grub_memcmp (buf + TAR_MAGIC_OFFSET, "ustar", 5) == 0);
+}
+
+char *
+grub_gfxmenu_theme_pack_lookup (const char *path)
+{
+  struct theme_pack *pack;
+
+  for (pack = packs; pack; pack = pack->next)
+    if (grub_strcmp (pack->path, path) == 0)
+      return grub_xasprintf ("(%s)/theme.txt", pack->name);
+  return 0;
+}
+
+/* Helper for load_fonts.  */
+static int
+load_fonts_iter (const char *filename, const struct grub_dirhook_info *info,
+		 void *data)
+{
+  struct theme_pack *pack = data;
+  grub_size_t len = grub_strlen (filename);
+  char *path;
+
+  if (info->dir || len < 4 || grub_strcmp (filename + len - 4, ".pf2") != 0)
+    return 0;
+
+  path = grub_xasprintf ("(%s)/%s", pack->name, filename);
+  if (! path)
+    return 1;
+  if (grub_font_load (path) && ! fonts_loaded)
+    {
+      fonts_loaded = 1;
+      grub_dl_ref (pack_mod);
+    }
+  grub_free (path);
+  grub_errno = GRUB_ERR_NONE;
+  return 0;
+}
+
+/* Load the fonts at the top of PACK, which a theme directory would need
+   loadfont commands for.  */
+static void
+load_fonts (struct theme_pack *pack)
+{
+  grub_device_t dev;
+  grub_fs_t fs;
+
+  dev = grub_device_open (pack->name);
+  if (! dev)
+    return;
+
+  fs = grub_fs_probe (dev);
+  if (fs)
+    fs->dir (dev, "/", load_fonts_iter, pack);
+  grub_device_close (dev);
+}
+
+char *
+grub_gfxmenu_theme_pack_add (const char *path, char *buf, grub_size_t len)
+{
+  struct theme_pack *pack;
+  grub_size_t size;
+  char *data;
+
+  /* Whole sectors, the last one padded with zeros.  */
+  size = ALIGN_UP (len, GRUB_DISK_SECTOR_SIZE);
+  if (size != len)
+    {
+      data = grub_realloc (buf, size);
+      if (! data)
+	{
+	  grub_free (buf);
+	  return 0;
+	}
+      grub_memset (data + len, 0, size - len);
+    }
+  else
+    data = buf;
+
+  pack = grub_zalloc (sizeof (*pack));
+  if (! pack)
+    {
+      grub_free (data);
+      return 0;
+    }
+
+  pack->id = last_id++;
+  pack->path = grub_strdup (path);
+  pack->name = grub_xasprintf ("gfxtheme%lu", pack->id);
+  pack->data = data;
+  pack->size = size;
+  if (! pack->path || ! pack->name)
+    {
+      grub_free (pack->path);
+      grub_free (pack->name);
+      grub_free (pack->data);
+      grub_free (pack);
+      return 0;
+    }
+
+  if (! packs)
+    grub_disk_dev_register (&grub_gfxtheme_dev);
+  else
+    grub_disk_generation++;
+  pack->next = packs;
+  packs = pack;
+
+  load_fonts (pack);
+
+  return grub_xasprintf ("(%s)/theme.txt", pack->name);
+}
+
+void
+grub_gfxmenu_theme_pack_init (grub_dl_t mod)
+{
+  pack_mod = mod;
+}
+
+void
+grub_gfxmenu_theme_pack_fini (void)
+{
+  struct theme_pack *pack, *next;
+
+  if (! packs)
+    return;
+
+  grub_disk_dev_unregister (&grub_gfxtheme_dev);
+  for (pack = packs; pack; pack = next)
+    {
+      next = pack->next;
+      grub_free (pack->path);
+      grub_free (pack->name);
+      grub_free (pack->data);
+      grub_free (pack);
+    }
+  packs = 0;
+}
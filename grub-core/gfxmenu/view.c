@@ -36,6 +36,7 @@
 #include <grub/gfxmenu_view.h>
 #include <grub/gui_string_util.h>
 #include <grub/icon_manager.h>
+#include <grub/bitmap_cache.h>
 #include <grub/i18n.h>
 
 static void
@@ -86,6 +87,8 @@ grub_gfxmenu_view_new (const char *theme_path,
   default_bg_color = grub_video_rgba_color_rgb (255, 255, 255);
 
   view->canvas = 0;
+  view->backdrop = 0;
+  view->need_to_draw_backdrop = 1;
 
   view->title_font = default_font;
   view->message_font = default_font;
@@ -93,7 +96,7 @@ grub_gfxmenu_view_new (const char *theme_path,
   view->title_color = default_fg_color;
   view->message_color = default_bg_color;
   view->message_bg_color = default_fg_color;
-  view->raw_desktop_image = 0;
+  view->desktop_image_path = 0;
   view->scaled_desktop_image = 0;
   view->desktop_image_scale_method = GRUB_VIDEO_BITMAP_SELECTION_METHOD_STRETCH;
   view->desktop_image_h_align = GRUB_VIDEO_BITMAP_H_ALIGN_CENTER;
@@ -134,8 +137,10 @@ grub_gfxmenu_view_destroy (grub_gfxmenu_view_t view)
       grub_gfxmenu_timeout_notifications = grub_gfxmenu_timeout_notifications->next;
       grub_free (p);
     }
-  grub_video_bitmap_destroy (view->raw_desktop_image);
+  grub_free (view->desktop_image_path);
   grub_video_bitmap_destroy (view->scaled_desktop_image);
+  if (view->backdrop)
+    grub_video_delete_render_target (view->backdrop);
   if (view->terminal_box)
     view->terminal_box->destroy (view->terminal_box);
   grub_free (view->terminal_font_name);
@@ -195,6 +200,79 @@ struct progress_value_data
 
 struct grub_gfxmenu_timeout_notify *grub_gfxmenu_timeout_notifications;
 
+enum paint_layer
+  {
+    PAINT_LAYER_ALL,
+    /* Only what comes before the first live component.  */
+    PAINT_LAYER_BACKDROP,
+    /* Only the first live component and what comes after it.  */
+    PAINT_LAYER_LIVE
+  };
+
+static enum paint_layer paint_layer = PAINT_LAYER_ALL;
+static int paint_live_reached;
+
+static void
+find_live_visit (grub_gui_component_t component, void *userdata)
+{
+  int *live = userdata;
+  struct grub_gfxmenu_timeout_notify *cur;
+
+  if (component->ops->is_instance (component, "list"))
+    *live = 1;
+  for (cur = grub_gfxmenu_timeout_notifications; cur; cur = cur->next)
+    if (cur->self == component)
+      *live = 1;
+}
+
+int
+grub_gfxmenu_paint_wanted (grub_gui_component_t component)
+{
+  if (paint_layer == PAINT_LAYER_ALL)
+    return 1;
+
+  /* A container holding a live component counts as live itself, so that
+     each component lands in exactly one of the layers and the paint
+     order is kept.  */
+  if (!paint_live_reached)
+    grub_gui_iterate_recursively (component, find_live_visit,
+				  &paint_live_reached);
+
+  if (paint_layer == PAINT_LAYER_BACKDROP)
+    return !paint_live_reached;
+  return paint_live_reached;
+}
+
+static void
+draw_backdrop (grub_gfxmenu_view_t view)
+{
+  view->need_to_draw_backdrop = 0;
+
+  if (!view->backdrop
+      && grub_video_create_render_target (&view->backdrop,
+					  view->screen.width,
+					  view->screen.height,
+					  GRUB_VIDEO_MODE_TYPE_RGB)
+	 != GRUB_ERR_NONE)
+    {
+      /* Paint everything straight to the screen then.  */
+      view->backdrop = 0;
+      grub_errno = GRUB_ERR_NONE;
+      return;
+    }
+
+  grub_video_set_active_render_target (view->backdrop);
+  redraw_background (view, &view->screen);
+  if (view->canvas)
+    {
+      paint_layer = PAINT_LAYER_BACKDROP;
+      paint_live_reached = 0;
+      view->canvas->component.ops->paint (view->canvas, &view->screen);
+      paint_layer = PAINT_LAYER_ALL;
+    }
+  grub_video_set_active_render_target (GRUB_VIDEO_RENDER_TARGET_DISPLAY);
+}
+
 static void
 update_timeouts (int visible, int start, int value, int end)
 {
@@ -321,6 +399,9 @@ grub_gfxmenu_view_redraw (grub_gfxmenu_view_t view,
   if (grub_video_have_common_points (&view->terminal_rect, region))
     grub_gfxterm_schedule_repaint ();
 
+  if (view->need_to_draw_backdrop)
+    draw_backdrop (view);
+
   grub_video_set_active_render_target (GRUB_VIDEO_RENDER_TARGET_DISPLAY);
   grub_video_area_status_t area_status;
   grub_video_get_area_status (&area_status);
@@ -328,9 +409,21 @@ grub_gfxmenu_view_redraw (grub_gfxmenu_view_t view,
     grub_video_set_region (region->x, region->y,
                            region->width, region->height);
 
-  redraw_background (view, region);
+  if (view->backdrop)
+    {
+      grub_video_blit_render_target (view->backdrop, GRUB_VIDEO_BLIT_REPLACE,
+				     region->x, region->y,
+				     region->x - view->screen.x,
+				     region->y - view->screen.y,
+				     region->width, region->height);
+      paint_layer = PAINT_LAYER_LIVE;
+      paint_live_reached = 0;
+    }
+  else
+    redraw_background (view, region);
   if (view->canvas)
     view->canvas->component.ops->paint (view->canvas, region);
+  paint_layer = PAINT_LAYER_ALL;
   draw_title (view);
   if (grub_video_have_common_points (&view->progress_message_frame, region))
     draw_message (view);
@@ -345,6 +438,7 @@ grub_gfxmenu_view_draw (grub_gfxmenu_view_t view)
   init_terminal (view);
 
   init_background (view);
+  view->need_to_draw_backdrop = 1;
 
   /* Clear the screen; there may be garbage left over in video memory. */
   grub_video_fill_rect (grub_video_map_rgb (0, 0, 0),
@@ -553,26 +647,17 @@ init_terminal (grub_gfxmenu_view_t view)
 static void
 init_background (grub_gfxmenu_view_t view)
 {
-  if (view->scaled_desktop_image)
+  if (view->scaled_desktop_image || ! view->desktop_image_path)
     return;
 
   struct grub_video_bitmap *scaled_bitmap;
-  if (view->desktop_image_scale_method ==
-      GRUB_VIDEO_BITMAP_SELECTION_METHOD_STRETCH)
-    grub_video_bitmap_create_scaled (&scaled_bitmap,
-                                     view->screen.width,
-                                     view->screen.height,
-                                     view->raw_desktop_image,
-                                     GRUB_VIDEO_BITMAP_SCALE_METHOD_BEST);
-  else
-    grub_video_bitmap_scale_proportional (&scaled_bitmap,
-                                          view->screen.width,
-                                          view->screen.height,
-                                          view->raw_desktop_image,
-                                          GRUB_VIDEO_BITMAP_SCALE_METHOD_BEST,
-                                          view->desktop_image_scale_method,
-                                          view->desktop_image_v_align,
-                                          view->desktop_image_h_align);
+  grub_gfxmenu_bitmap_load_scaled (&scaled_bitmap,
+                                   view->desktop_image_path,
+                                   view->screen.width,
+                                   view->screen.height,
+                                   view->desktop_image_scale_method,
+                                   view->desktop_image_v_align,
+                                   view->desktop_image_h_align);
   if (! scaled_bitmap)
     return;
   view->scaled_desktop_image = scaled_bitmap;
@@ -24,6 +24,7 @@
 #include <grub/video.h>
 #include <grub/bitmap.h>
 #include <grub/bitmap_scale.h>
+#include <grub/bitmap_cache.h>
 #include <grub/gfxwidgets.h>
 
 enum box_pixmaps
@@ -144,8 +145,9 @@ scale_pixmap (grub_gfxmenu_box_t self, int i, int w, int h)
 
       /* Don't try to create a bitmap with a zero dimension.  */
       if (w != 0 && h != 0)
-        grub_video_bitmap_create_scaled (scaled, w, h, raw,
-                                         GRUB_VIDEO_BITMAP_SCALE_METHOD_BEST);
+        grub_gfxmenu_bitmap_load_scaled
+          (scaled, self->pixmap_paths[i], w, h,
+           GRUB_VIDEO_BITMAP_SELECTION_METHOD_STRETCH, 0, 0);
     }
 
   return grub_errno;
@@ -272,11 +274,16 @@ destroy (grub_gfxmenu_box_t self)
       if (self->scaled_pixmaps[i])
         grub_video_bitmap_destroy(self->scaled_pixmaps[i]);
       self->scaled_pixmaps[i] = 0;
+
+      grub_free (self->pixmap_paths[i]);
+      self->pixmap_paths[i] = 0;
     }
   grub_free (self->raw_pixmaps);
   self->raw_pixmaps = 0;
   grub_free (self->scaled_pixmaps);
   self->scaled_pixmaps = 0;
+  grub_free (self->pixmap_paths);
+  self->pixmap_paths = 0;
 
   /* Free self:  must be the last step!  */
   grub_free (self);
@@ -307,6 +314,8 @@ grub_gfxmenu_create_box (const char *pixmaps_prefix,
   box->scaled_pixmaps =
     (struct grub_video_bitmap **)
     grub_malloc (BOX_NUM_PIXMAPS * sizeof (struct grub_video_bitmap *));
+  box->pixmap_paths =
+    (char **) grub_malloc (BOX_NUM_PIXMAPS * sizeof (char *));
 
   /* Initialize all pixmap pointers to NULL so that proper destruction can
      be performed if an error is encountered partway through construction.  */
@@ -314,6 +323,8 @@ grub_gfxmenu_create_box (const char *pixmaps_prefix,
       box->raw_pixmaps[i] = 0;
   for (i = 0; i < BOX_NUM_PIXMAPS; i++)
       box->scaled_pixmaps[i] = 0;
+  for (i = 0; i < BOX_NUM_PIXMAPS; i++)
+      box->pixmap_paths[i] = 0;
 
   /* Load the pixmaps.  */
   for (i = 0; i < BOX_NUM_PIXMAPS; i++)
@@ -335,8 +346,13 @@ grub_gfxmenu_create_box (const char *pixmaps_prefix,
           path_end = grub_stpcpy (path_end, box_pixmap_names[i]);
           path_end = grub_stpcpy (path_end, pixmaps_suffix);
 
-          grub_video_bitmap_load (&box->raw_pixmaps[i], path);
-          grub_free (path);
+          grub_gfxmenu_bitmap_load (&box->raw_pixmaps[i], path);
+
+          /* Keep the path around for scaling through the cache.  */
+          if (box->raw_pixmaps[i])
+            box->pixmap_paths[i] = path;
+          else
+            grub_free (path);
 
           /* Ignore missing pixmaps.  */
           grub_errno = GRUB_ERR_NONE;
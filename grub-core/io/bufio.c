@@ -29,47 +29,96 @@ GRUB_MOD_LICENSE ("GPLv3+");
 
 #define GRUB_BUFIO_DEF_SIZE	8192
 #define GRUB_BUFIO_MAX_SIZE	1048576
+/* Sequential reading doesn't grow the buffer past this.  */
+#define GRUB_BUFIO_GROW_SIZE	131072
+/* So that disk drivers can read straight into it.  */
+#define GRUB_BUFIO_ALIGN	4096
 
 struct grub_bufio
 {
   grub_file_t file;
+  /* Size of the buffer as asked for, and how much is read into it at a
+     time, which grows while the file is read sequentially.  */
+  grub_size_t base_size;
   grub_size_t block_size;
+  grub_size_t buffer_size;
   grub_size_t buffer_len;
   grub_off_t buffer_at;
-  char buffer[0];
+  /* Where the next read starts if the file is read sequentially.  */
+  grub_off_t next_offset;
+  /* The whole of FILE if it is stored contiguously in memory.  */
+  const char *memory;
+  char *buffer;
 };
 typedef struct grub_bufio *grub_bufio_t;
 
 static struct grub_fs grub_bufio_fs;
 
+static char *
+grub_bufio_alloc (grub_size_t size)
+{
+#if defined (GRUB_MACHINE_EMU) || defined (GRUB_UTIL)
+  return grub_malloc (size);
+#else
+  return grub_memalign (GRUB_BUFIO_ALIGN, size);
+#endif
+}
+
 grub_file_t
 grub_bufio_open (grub_file_t io, int size)
 {
   grub_file_t file;
   grub_bufio_t bufio = 0;
+  const char *memory = NULL;
 
   file = (grub_file_t) grub_zalloc (sizeof (*file));
   if (! file)
     return 0;
 
-  if (size == 0)
-    size = GRUB_BUFIO_DEF_SIZE;
-  else if (size > GRUB_BUFIO_MAX_SIZE)
-    size = GRUB_BUFIO_MAX_SIZE;
+  /* Files on the memdisk can be served without any buffering.  */
+  if (io->offset == 0 && io->size != GRUB_FILE_SIZE_UNKNOWN)
+    {
+      memory = grub_file_map_memory (io, io->size);
+      if (memory)
+	grub_file_seek (io, 0);
+    }
 
-  if ((size < 0) || ((unsigned) size > io->size))
-    size = ((io->size > GRUB_BUFIO_MAX_SIZE) ? GRUB_BUFIO_MAX_SIZE :
-            io->size);
+  if (memory)
+    size = 0;
+  else
+    {
+      if (size == 0)
+	size = GRUB_BUFIO_DEF_SIZE;
+      else if (size > GRUB_BUFIO_MAX_SIZE)
+	size = GRUB_BUFIO_MAX_SIZE;
+
+      if ((size < 0) || ((unsigned) size > io->size))
+	size = ((io->size > GRUB_BUFIO_MAX_SIZE) ? GRUB_BUFIO_MAX_SIZE :
+		io->size);
+    }
 
-  bufio = grub_zalloc (sizeof (struct grub_bufio) + size);
+  bufio = grub_zalloc (sizeof (struct grub_bufio));
   if (! bufio)
     {
       grub_free (file);
       return 0;
     }
+  if (size)
+    {
+      bufio->buffer = grub_bufio_alloc (size);
+      if (! bufio->buffer)
+	{
+	  grub_free (bufio);
+	  grub_free (file);
+	  return 0;
+	}
+    }
 
   bufio->file = io;
+  bufio->base_size = size;
   bufio->block_size = size;
+  bufio->buffer_size = size;
+  bufio->memory = memory;
 
   file->device = io->device;
   file->size = io->size;
@@ -99,17 +148,67 @@ grub_buffile_open (const char *name, int size)
   return file;
 }
 
+/* Pick how much to read into the buffer next: more while the file is read
+   sequentially, the size asked for otherwise.  */
+static void
+grub_bufio_adapt (grub_file_t file, grub_bufio_t bufio, int sequential)
+{
+  grub_size_t size, limit;
+  char *buffer;
+
+  if (! sequential)
+    {
+      bufio->block_size = bufio->base_size;
+      return;
+    }
+
+  limit = GRUB_BUFIO_GROW_SIZE;
+  if (file->size != GRUB_FILE_SIZE_UNKNOWN && file->size < limit)
+    limit = file->size;
+  if (bufio->block_size >= limit)
+    return;
+
+  size = bufio->block_size * 2;
+  if (size > limit)
+    size = limit;
+
+  if (size > bufio->buffer_size)
+    {
+      buffer = grub_bufio_alloc (size);
+      if (! buffer)
+	{
+	  grub_errno = GRUB_ERR_NONE;
+	  return;
+	}
+      grub_free (bufio->buffer);
+      bufio->buffer = buffer;
+      bufio->buffer_size = size;
+      bufio->buffer_len = 0;
+    }
+  bufio->block_size = size;
+}
+
 static grub_ssize_t
 grub_bufio_read (grub_file_t file, char *buf, grub_size_t len)
 {
   grub_size_t res = 0;
-  grub_off_t next_buf;
+  grub_off_t at;
   grub_bufio_t bufio = file->data;
   grub_ssize_t really_read;
+  int sequential;
 
   if (file->size == GRUB_FILE_SIZE_UNKNOWN)
     file->size = bufio->file->size;
 
+  if (bufio->memory)
+    {
+      /* grub_file_read has already clipped LEN to the file size.  */
+      grub_memcpy (buf, bufio->memory + file->offset, len);
+      return len;
+    }
+
+  sequential = (file->offset == bufio->next_offset);
+
   /* First part: use whatever we already have in the buffer.  */
   if ((file->offset >= bufio->buffer_at) &&
       (file->offset < bufio->buffer_at + bufio->buffer_len))
@@ -129,65 +228,64 @@ grub_bufio_read (grub_file_t file, char *buf, grub_size_t len)
       buf += n;
     }
   if (len == 0)
-    return res;
+    goto out;
 
   /* Need to read some more.  */
-  next_buf = (file->offset + res + len - 1) & ~((grub_off_t) bufio->block_size - 1);
-  /* Now read between file->offset + res and bufio->buffer_at.  */
-  if (file->offset + res < next_buf)
+  grub_bufio_adapt (file, bufio, sequential);
+  at = file->offset + res;
+  if (grub_file_seek (bufio->file, at) == (grub_off_t) -1)
+    return -1;
+
+  /* Whatever wouldn't fit in the buffer goes straight to the caller,
+     it would only be copied again.  */
+  if (len >= bufio->block_size)
     {
-      grub_size_t read_now;
-      read_now = next_buf - (file->offset + res);
-      grub_file_seek (bufio->file, file->offset + res);
-      really_read = grub_file_read (bufio->file, buf, read_now);
+      really_read = grub_file_read (bufio->file, buf, len);
       if (really_read < 0)
 	return -1;
-      if (file->size == GRUB_FILE_SIZE_UNKNOWN)
-	file->size = bufio->file->size;
-      len -= really_read;
-      buf += really_read;
       res += really_read;
-
-      /* Partial read. File ended unexpectedly. Save the last chunk in buffer.
-       */
-      if (really_read != (grub_ssize_t) read_now)
-	{
-	  bufio->buffer_len = really_read;
-	  if (bufio->buffer_len > bufio->block_size)
-	    bufio->buffer_len = bufio->block_size;
-	  bufio->buffer_at = file->offset + res - bufio->buffer_len;
-	  grub_memcpy (&bufio->buffer[0], buf - bufio->buffer_len,
-		       bufio->buffer_len);
-	  return res;
-	}
+      goto out;
     }
 
   /* Read into buffer.  */
-  grub_file_seek (bufio->file, next_buf);
   really_read = grub_file_read (bufio->file, bufio->buffer,
 				bufio->block_size);
   if (really_read < 0)
     return -1;
-  bufio->buffer_at = next_buf;
+  bufio->buffer_at = at;
   bufio->buffer_len = really_read;
 
-  if (file->size == GRUB_FILE_SIZE_UNKNOWN)
-    file->size = bufio->file->size;
-
   if (len > bufio->buffer_len)
     len = bufio->buffer_len;
-  grub_memcpy (buf, &bufio->buffer[file->offset + res - next_buf], len);
+  grub_memcpy (buf, bufio->buffer, len);
   res += len;
 
+ out:
+  if (file->size == GRUB_FILE_SIZE_UNKNOWN)
+    file->size = bufio->file->size;
+  bufio->next_offset = file->offset + res;
   return res;
 }
 
+static grub_err_t
+grub_bufio_map (grub_file_t file, grub_size_t len,
+		grub_fs_extent_hook_t hook, void *hook_data)
+{
+  grub_bufio_t bufio = file->data;
+
+  if (grub_file_seek (bufio->file, file->offset) == (grub_off_t) -1)
+    return grub_errno;
+
+  return grub_file_map (bufio->file, len, hook, hook_data);
+}
+
 static grub_err_t
 grub_bufio_close (grub_file_t file)
 {
   grub_bufio_t bufio = file->data;
 
   grub_file_close (bufio->file);
+  grub_free (bufio->buffer);
   grub_free (bufio);
 
   file->device = 0;
@@ -202,6 +300,7 @@ static struct grub_fs grub_bufio_fs =
     .open = 0,
     .read = grub_bufio_read,
     .close = grub_bufio_close,
+    .map = grub_bufio_map,
     .label = 0,
     .next = 0
   };
@@ -55,7 +55,34 @@ GRUB_MOD_LICENSE ("GPLv3+");
 #define WSIZE	0x8000
 
 
-#define INBUFSIZ  0x2000
+#define INBUFSIZ  0x8000
+
+/* Huffman code lookup table entry.  OP tells what the entry is:
+   GZIO_LITERAL means that VAL is a literal, GZIO_BASE | n that VAL is
+   the base of a length or distance followed by n extra bits, GZIO_EOB
+   is the end of block, GZIO_LINK | n means that VAL is the offset of a
+   second-level table indexed by the next n bits, and GZIO_INVALID is an
+   unused code.  Looking the latter up implies an error in the data.
+   BITS is the length of the whole code.  */
+struct gzio_code
+{
+  grub_uint8_t op;
+  grub_uint8_t bits;
+  grub_uint16_t val;
+};
+
+#define GZIO_LITERAL	0x00
+#define GZIO_BASE	0x10
+#define GZIO_EOB	0x20
+#define GZIO_LINK	0x40
+#define GZIO_INVALID	0x80
+#define GZIO_OP_BITS	0x0f
+
+/* Sizes of the literal/length and distance tables, first and second
+   levels together, which are enough for any valid set of codes with
+   first levels of 9 and 6 bits (as computed by zlib's "enough").  */
+#define ENOUGH_LENS	852
+#define ENOUGH_DISTS	592
 
 /* The state stored in filesystem-specific data.  */
 struct grub_gzio
@@ -82,24 +109,34 @@ struct grub_gzio
   /* The input buffer.  */
   grub_uint8_t inbuf[INBUFSIZ];
   int inbuf_d;
+  /* The number of valid bytes in the input buffer.  */
+  int inbuf_len;
   /* The bit buffer.  */
-  unsigned long bb;
+  grub_uint64_t bb;
   /* The bits in the bit buffer.  */
   unsigned bk;
   /* The sliding window in uncompressed data.  */
   grub_uint8_t slide[WSIZE];
-  /* Current position in the slide.  */
+  /* Where the current window is inflated: the slide, or a stretch of the
+     caller's buffer right after the previous window, which then holds
+     the history at negative offsets instead of wrapping around.  */
+  grub_uint8_t *window;
+  int window_linear;
+  /* Current position in the window.  */
   unsigned wp;
   /* The literal/length code table.  */
-  struct huft *tl;
+  const struct gzio_code *tl;
   /* The distance code table.  */
-  struct huft *td;
+  const struct gzio_code *td;
   /* The lookup bits for the literal/length code table. */
   int bl;
   /* The lookup bits for the distance code table.  */
   int bd;
   /* The original offset value.  */
   grub_off_t saved_offset;
+  /* Storage for the tables of dynamic blocks.  */
+  struct gzio_code ltab[ENOUGH_LENS];
+  struct gzio_code dtab[ENOUGH_DISTS];
 };
 typedef struct grub_gzio *grub_gzio_t;
 
@@ -166,7 +203,6 @@ eat_field (grub_file_t file, int len)
 
 typedef unsigned char uch;
 typedef unsigned short ush;
-typedef unsigned long ulg;
 
 static int
 test_gzip_header (grub_file_t file)
@@ -229,26 +265,6 @@ test_gzip_header (grub_file_t file)
 }
 
 
-/* Huffman code lookup table entry--this entry is four bytes for machines
-   that have 16-bit pointers (e.g. PC's in the small or medium model).
-   Valid extra bits are 0..13.  e == 15 is EOB (end of block), e == 16
-   means that v is a literal, 16 < e < 32 means that v is a pointer to
-   the next table, which codes e - 16 bits, and lastly e == 99 indicates
-   an unused code.  If a code with e == 99 is looked up, this implies an
-   error in the data. */
-struct huft
-{
-  uch e;			/* number of extra bits or operation */
-  uch b;			/* number of bits in this code or subcode */
-  union
-    {
-      ush n;			/* literal, length base, or distance base */
-      struct huft *t;		/* pointer to next level of table */
-    }
-  v;
-};
-
-
 /* The inflate algorithm uses a sliding 32K byte window on the uncompressed
    stream to find repeated byte strings.  This is implemented here as a
    circular buffer.  The index is updated simply by incrementing and then
@@ -314,6 +330,9 @@ static ush cpdext[] =
    about one bit more than those, so lbits is 8+1 and dbits is 5+1.
    The optimum values may differ though from machine to machine, and
    possibly even between compilers.  Your mileage may vary.
+
+   The tables built here have at most two levels, so the subsidiary
+   tables are as large as the longest code they hold requires.
  */
 
 
@@ -321,8 +340,7 @@ static int lbits = 9;		/* bits in base literal/length lookup table */
 static int dbits = 6;		/* bits in base distance lookup table */
 
 
-/* If BMAX needs to be larger than 16, then h and x[] should be ulg. */
-#define BMAX 16			/* maximum bit length of any code (16 for explode) */
+#define BMAX 15			/* maximum bit length of any code */
 #define N_MAX 288		/* maximum number of codes in any set */
 
 
@@ -363,28 +381,61 @@ static ush mask_bits[] =
   0x01ff, 0x03ff, 0x07ff, 0x0fff, 0x1fff, 0x3fff, 0x7fff, 0xffff
 };
 
-#define NEEDBITS(n) do {while(k<(n)){b|=((ulg)get_byte(gzio))<<k;k+=8;}} while (0)
+#define NEEDBITS(n) do {while(k<(n)){b|=((grub_uint64_t)get_byte(gzio))<<k;k+=8;}} while (0)
 #define DUMPBITS(n) do {b>>=(n);k-=(n);} while (0)
 
-static int
-get_byte (grub_gzio_t gzio)
+/* Return the buffered input and store its size in *AVAIL.  */
+static inline const grub_uint8_t *
+input_peek (grub_gzio_t gzio, grub_size_t *avail)
 {
   if (gzio->mem_input)
     {
-      if (gzio->mem_input_off < gzio->mem_input_size)
-	return gzio->mem_input[gzio->mem_input_off++];
-      return 0;
+      *avail = gzio->mem_input_size - gzio->mem_input_off;
+      return gzio->mem_input + gzio->mem_input_off;
     }
 
-  if (gzio->file && (grub_file_tell (gzio->file)
-		     == (grub_off_t) gzio->data_offset
-		     || gzio->inbuf_d == INBUFSIZ))
-    {
-      gzio->inbuf_d = 0;
-      grub_file_read (gzio->file, gzio->inbuf, INBUFSIZ);
-    }
+  *avail = gzio->inbuf_len - gzio->inbuf_d;
+  return gzio->inbuf + gzio->inbuf_d;
+}
+
+static inline void
+input_skip (grub_gzio_t gzio, grub_size_t n)
+{
+  if (gzio->mem_input)
+    gzio->mem_input_off += n;
+  else
+    gzio->inbuf_d += n;
+}
+
+/* Read more of the underlying file once the input buffer is used up.  */
+static void
+input_fill (grub_gzio_t gzio)
+{
+  grub_ssize_t res;
+
+  if (gzio->mem_input || gzio->inbuf_d < gzio->inbuf_len)
+    return;
+
+  res = grub_file_read (gzio->file, gzio->inbuf, INBUFSIZ);
+  gzio->inbuf_d = 0;
+  gzio->inbuf_len = res > 0 ? res : 0;
+}
+
+static int
+get_byte (grub_gzio_t gzio)
+{
+  const grub_uint8_t *p;
+  grub_size_t avail;
+
+  input_fill (gzio);
+  p = input_peek (gzio, &avail);
 
-  return gzio->inbuf[gzio->inbuf_d++];
+  /* Past the end of the input, act as if it was followed by zeros.  */
+  if (avail == 0)
+    return 0;
+
+  input_skip (gzio, 1);
+  return *p;
 }
 
 static void
@@ -403,245 +454,344 @@ gzio_seek (grub_gzio_t gzio, grub_off_t off)
 }
 
 /* more function prototypes */
-static int huft_build (unsigned *, unsigned, unsigned, ush *, ush *,
-		       struct huft **, int *);
-static int huft_free (struct huft *);
-static int inflate_codes_in_window (grub_gzio_t);
+static void inflate_codes_in_window (grub_gzio_t);
 
 
-/* Given a list of code lengths and a maximum table size, make a set of
-   tables to decode that set of codes.  Return zero on success, one if
-   the given code set is incomplete (the tables are still built in this
-   case), two if the input is invalid (all zero length codes or an
-   oversubscribed set of lengths), and three if not enough memory. */
+/* Given a list of code lengths LENS for N symbols (all assumed <= 15),
+   make a table to decode that set of codes in TABLE, which has room for
+   SIZE entries.  Symbols below S are literals, 256 being the end of
+   block; the others take their base from BASE and their number of extra
+   bits from EXTRA.  *BITS holds the wanted number of bits of the first
+   level on entry and the number actually used on return.  Return zero
+   on success, one if the given code set is incomplete (unless
+   INCOMPLETE_OK is set or there is just one code), two if it is
+   oversubscribed, and three if TABLE is too small.  */
 
 static int
-huft_build (unsigned *b,	/* code lengths in bits (all assumed <= BMAX) */
-	    unsigned n,		/* number of codes (assumed <= N_MAX) */
-	    unsigned s,		/* number of simple-valued codes (0..s-1) */
-	    ush * d,		/* list of base values for non-simple codes */
-	    ush * e,		/* list of extra bits for non-simple codes */
-	    struct huft **t,	/* result: starting table */
-	    int *m)		/* maximum lookup bits, returns actual */
+build_table (const uch *lens, unsigned n, unsigned s,
+	     const ush *base, const ush *extra,
+	     struct gzio_code *table, unsigned size, int *bits,
+	     int incomplete_ok)
 {
-  unsigned a;			/* counter for codes of length k */
-  unsigned c[BMAX + 1];		/* bit length count table */
-  unsigned f;			/* i repeats in table every f entries */
-  int g;			/* maximum code length */
-  int h;			/* table level */
-  register unsigned i;		/* counter, current code */
-  register unsigned j;		/* counter */
-  register int k;		/* number of bits in current code */
-  int l;			/* bits per table (returned in m) */
-  register unsigned *p;		/* pointer into c[], b[], or v[] */
-  register struct huft *q;	/* points to current table */
-  struct huft r;		/* table entry for structure assignment */
-  struct huft *u[BMAX];		/* table stack */
-  unsigned v[N_MAX];		/* values in order of bit length */
-  register int w;		/* bits before this table == (l * h) */
-  unsigned x[BMAX + 1];		/* bit offsets, then code stack */
-  unsigned *xp;			/* pointer into x */
-  int y;			/* number of dummy codes added */
-  unsigned z;			/* number of entries in current table */
-
-  /* Generate counts for each bit length */
-  grub_memset ((char *) c, 0, sizeof (c));
-  p = b;
-  i = n;
-  do
+  unsigned count[BMAX + 1];	/* number of codes of each length */
+  unsigned offs[BMAX + 1];	/* offsets in sorted for each length */
+  ush sorted[N_MAX];		/* symbols ordered by code length */
+  ush codes[N_MAX];		/* codes of the symbols in sorted */
+  unsigned root, min, max, len, sym, i, j, ncodes;
+  unsigned code, next, prefix, cur_prefix, sub_off = 0, sub_bits = 0;
+  int left;
+  struct gzio_code invalid = { .op = GZIO_INVALID, .bits = 1, .val = 0 };
+
+  grub_memset (count, 0, sizeof (count));
+  for (sym = 0; sym < n; sym++)
+    count[lens[sym]]++;
+
+  for (max = BMAX; max > 0 && ! count[max]; max--);
+  if (max == 0)
     {
-      c[*p]++;			/* assume all entries <= BMAX */
-      p++;			/* Can't combine with above line (Solaris bug) */
-    }
-  while (--i);
-  if (c[0] == n)		/* null input--all zero length codes */
-    {
-      *t = (struct huft *) NULL;
-      *m = 0;
+      /* No codes at all, as in the distances of a block made only of
+	 literals.  Any lookup finds an unused code.  */
+      if (size < 2)
+	return 3;
+      table[0] = table[1] = invalid;
+      *bits = 1;
       return 0;
     }
+  for (min = 1; min < max && ! count[min]; min++);
 
-  /* Find minimum and maximum length, bound *m by those */
-  l = *m;
-  for (j = 1; j <= BMAX; j++)
-    if (c[j])
-      break;
-  k = j;			/* minimum code length */
-  if ((unsigned) l < j)
-    l = j;
-  for (i = BMAX; i; i--)
-    if (c[i])
-      break;
-  g = i;			/* maximum code length */
-  if ((unsigned) l > i)
-    l = i;
-  *m = l;
-
-  /* Adjust last length count to fill out codes, if needed */
-  for (y = 1 << j; j < i; j++, y <<= 1)
-    if ((y -= c[j]) < 0)
-      return 2;			/* bad input: more codes than bits */
-  if ((y -= c[i]) < 0)
-    return 2;
-  c[i] += y;
-
-  /* Generate starting offsets into the value table for each length */
-  x[1] = j = 0;
-  p = c + 1;
-  xp = x + 2;
-  while (--i)
-    {				/* note that i == g from above */
-      *xp++ = (j += *p++);
-    }
+  root = *bits;
+  if (root > max)
+    root = max;
+  if (root < min)
+    root = min;
 
-  /* Make a table of values in order of bit lengths */
-  p = b;
-  i = 0;
-  do
+  left = 1;
+  for (len = 1; len <= BMAX; len++)
     {
-      if ((j = *p++) != 0)
-	v[x[j]++] = i;
+      left <<= 1;
+      left -= count[len];
+      if (left < 0)
+	return 2;
     }
-  while (++i < n);
-
-  /* Generate the Huffman codes and for each, make the table entries */
-  x[0] = i = 0;			/* first Huffman code is zero */
-  p = v;			/* grab values in bit order */
-  h = -1;			/* no tables yet--level -1 */
-  w = -l;			/* bits decoded == (l * h) */
-  u[0] = (struct huft *) NULL;	/* just to keep compilers happy */
-  q = (struct huft *) NULL;	/* ditto */
-  z = 0;			/* ditto */
-
-  /* go through the bit lengths (k already is bits in shortest code) */
-  for (; k <= g; k++)
+  if (left > 0 && ! incomplete_ok && max != 1)
+    return 1;
+
+  offs[1] = 0;
+  for (len = 1; len < BMAX; len++)
+    offs[len + 1] = offs[len] + count[len];
+  ncodes = offs[BMAX] + count[BMAX];
+  for (sym = 0; sym < n; sym++)
+    if (lens[sym])
+      sorted[offs[lens[sym]]++] = sym;
+
+  /* Assign the canonical codes.  */
+  code = 0;
+  len = lens[sorted[0]];
+  for (i = 0; i < ncodes; i++)
     {
-      a = c[k];
-      while (a--)
-	{
-	  /* here i is the Huffman code of length k bits for value *p */
-	  /* make tables up to required level */
-	  while (k > w + l)
-	    {
-	      h++;
-	      w += l;		/* previous table always l bits */
-
-	      /* compute minimum size table less than or equal to l bits */
-	      z = (z = (unsigned) (g - w)) > (unsigned) l ? (unsigned) l : z;	/* upper limit on table size */
-	      if ((f = 1 << (j = k - w)) > a + 1)	/* try a k-w bit table */
-		{		/* too few codes for k-w bit table */
-		  f -= a + 1;	/* deduct codes from patterns left */
-		  xp = c + k;
-		  while (++j < z)	/* try smaller tables up to z bits */
-		    {
-		      if ((f <<= 1) <= *++xp)
-			break;	/* enough codes to use up j bits */
-		      f -= *xp;	/* else deduct codes from patterns */
-		    }
-		}
-	      z = 1 << j;	/* table entries for j-bit table */
-
-	      /* allocate and link in new table */
-	      q = (struct huft *) grub_zalloc ((z + 1) * sizeof (struct huft));
-	      if (! q)
-		{
-		  if (h)
-		    huft_free (u[0]);
-		  return 3;
-		}
+      code <<= lens[sorted[i]] - len;
+      len = lens[sorted[i]];
+      codes[i] = code++;
+    }
 
-	      *t = q + 1;	/* link to list for huft_free() */
-	      *(t = &(q->v.t)) = (struct huft *) NULL;
-	      u[h] = ++q;	/* table starts after link */
+  if (size < (1U << root))
+    return 3;
+  for (i = 0; i < (1U << root); i++)
+    table[i] = invalid;
+  next = 1U << root;
+  cur_prefix = ~0U;
 
-	      /* connect to last table, if there is one */
-	      if (h)
-		{
-		  x[h] = i;	/* save pattern for backing up */
-		  r.b = (uch) l;	/* bits to dump before this table */
-		  r.e = (uch) (16 + j);		/* bits in this table */
-		  r.v.t = q;	/* pointer to this table */
-		  j = i >> (w - l);	/* (get around Turbo C bug) */
-		  u[h - 1][j] = r;	/* connect to last table */
-		}
-	    }
+  for (i = 0; i < ncodes; i++)
+    {
+      struct gzio_code entry;
+      unsigned rev;
 
-	  /* set up table entry in r */
-	  r.b = (uch) (k - w);
-	  if (p >= v + n)
-	    r.e = 99;		/* out of values--invalid code */
-	  else if (*p < s)
-	    {
-	      r.e = (uch) (*p < 256 ? 16 : 15);		/* 256 is end-of-block code */
-	      r.v.n = (ush) (*p);	/* simple code is just the value */
-	      p++;		/* one compiler does not like *p++ */
-	    }
-	  else
-	    {
-	      r.e = (uch) e[*p - s];	/* non-simple--look up in lists */
-	      r.v.n = d[*p++ - s];
-	    }
+      sym = sorted[i];
+      len = lens[sym];
+      entry.bits = len;
+      if (sym < s)
+	{
+	  entry.op = sym < 256 ? GZIO_LITERAL : GZIO_EOB;
+	  entry.val = sym;
+	}
+      else if (extra[sym - s] > GZIO_OP_BITS)
+	{
+	  entry.op = GZIO_INVALID;
+	  entry.val = 0;
+	}
+      else
+	{
+	  entry.op = GZIO_BASE | extra[sym - s];
+	  entry.val = base[sym - s];
+	}
 
-	  /* fill code-like entries with r */
-	  f = 1 << (k - w);
-	  for (j = i >> w; j < z; j += f)
-	    q[j] = r;
+      /* Codes are sent starting with their most significant bit, while
+	 the bit buffer is consumed from its least significant end.  */
+      rev = 0;
+      for (j = 0; j < len; j++)
+	rev |= ((codes[i] >> j) & 1) << (len - 1 - j);
 
-	  /* backwards increment the k-bit code i */
-	  for (j = 1 << (k - 1); i & j; j >>= 1)
-	    i ^= j;
-	  i ^= j;
+      if (len <= root)
+	{
+	  for (j = rev; j < (1U << root); j += 1U << len)
+	    table[j] = entry;
+	  continue;
+	}
 
-	  /* backup over finished tables */
-	  while ((i & ((1 << w) - 1)) != x[h])
-	    {
-	      h--;		/* don't need to update q */
-	      w -= l;
-	    }
+      prefix = rev & ((1U << root) - 1);
+      if (prefix != cur_prefix)
+	{
+	  unsigned top = codes[i] >> (len - root);
+
+	  /* The codes sharing this first-level entry follow each other,
+	     and the last of them is the longest one.  */
+	  for (j = i + 1; j < ncodes
+		 && ((unsigned) codes[j] >> (lens[sorted[j]] - root)) == top; j++);
+	  sub_bits = lens[sorted[j - 1]] - root;
+
+	  if (next + (1U << sub_bits) > size)
+	    return 3;
+	  sub_off = next;
+	  next += 1U << sub_bits;
+	  for (j = 0; j < (1U << sub_bits); j++)
+	    table[sub_off + j] = invalid;
+
+	  table[prefix].op = GZIO_LINK | sub_bits;
+	  table[prefix].bits = root;
+	  table[prefix].val = sub_off;
+	  cur_prefix = prefix;
 	}
+
+      for (j = rev >> root; j < (1U << sub_bits); j += 1U << (len - root))
+	table[sub_off + j] = entry;
     }
 
-  /* Return true (1) if we were given an incomplete table */
-  return y != 0 && g != 1;
+  *bits = root;
+  return 0;
 }
 
 
-/* Free the malloc'ed tables built by huft_build(), which makes a linked
-   list of the tables it made, with the links in a dummy first entry of
-   each table.  */
-static int
-huft_free (struct huft *t)
+/* Look up the code at the bottom of the bit buffer B in TABLE, whose
+   first level uses ROOT bits.  */
+static inline struct gzio_code
+lookup_code (const struct gzio_code *table, unsigned root, grub_uint64_t b)
 {
-  register struct huft *p, *q;
+  struct gzio_code c = table[b & mask_bits[root]];
+
+  if (c.op & GZIO_LINK)
+    c = table[c.val + ((b >> root) & mask_bits[c.op & GZIO_OP_BITS])];
+  return c;
+}
 
 
-  /* Go through linked list, freeing from the malloced (t[-1]) address. */
-  p = t;
-  while (p != (struct huft *) NULL)
+/* Copy LEN bytes from SRC to DEST, front to back, so that an overlap
+   replicates the bytes as the LZ77 semantics demand.  Whole words can
+   be moved as long as SRC is ahead of DEST or at least a word behind.  */
+static inline void
+copy_forward (grub_uint8_t *dest, const grub_uint8_t *src, unsigned len)
+{
+  if (src < dest && dest - src < 8)
     {
-      q = (--p)->v.t;
-      grub_free ((char *) p);
-      p = q;
+      /* A short repeated pattern.  Extend it byte by byte to a whole
+	 number of periods spanning a word, then take it from there.  */
+      unsigned dist = dest - src, period = dist, n;
+
+      while (period < 8)
+	period += dist;
+      for (n = period - dist; len && n; len--, n--)
+	*dest++ = *src++;
+      src = dest - period;
+    }
+
+  for (; len >= 8; len -= 8, dest += 8, src += 8)
+    grub_set_unaligned64 (dest, grub_get_unaligned64 (src));
+
+  while (len--)
+    *dest++ = *src++;
+}
+
+/* Append LEN bytes found DIST bytes back to the window at W.  The caller
+   makes sure that they fit before the end of the window.  */
+static void
+copy_match (grub_gzio_t gzio, unsigned w, unsigned dist, unsigned len)
+{
+  grub_uint8_t *slide = gzio->window;
+  unsigned s = (w - dist) & (WSIZE - 1);
+
+  if (gzio->window_linear)
+    {
+      copy_forward (slide + w, slide + w - dist, len);
+      return;
+    }
+
+  while (len)
+    {
+      unsigned e = len;
+
+      /* The part of the previous window after W isn't overwritten yet;
+	 copy it up to the end of the window, then carry on from the
+	 start.  */
+      if (s >= w && e > WSIZE - s)
+	e = WSIZE - s;
+      copy_forward (slide + w, slide + s, e);
+
+      w += e;
+      s = (s + e) & (WSIZE - 1);
+      len -= e;
     }
-  return 0;
 }
 
 
 /*
- *  inflate (decompress) the codes in a deflated (compressed) block.
- *  Return an error code or zero if it all goes ok.
+ *  Decode the current block for as long as the buffered input surely
+ *  holds a whole literal/length and distance pair and the window has
+ *  room for the longest match.  The bit buffer is refilled 64 bits at a
+ *  time straight from the input buffer, so the only per-symbol work is
+ *  one or two table lookups.  Return 1 at the end of the block, -1 on
+ *  error and 0 when the careful path has to take over.
  */
 
 static int
+inflate_fast (grub_gzio_t gzio, grub_uint64_t *bp, unsigned *kp,
+	      unsigned *wp)
+{
+  const struct gzio_code *tl = gzio->tl, *td = gzio->td;
+  unsigned bl = gzio->bl, bd = gzio->bd;
+  const grub_uint8_t *in, *in_start, *in_end;
+  grub_uint64_t b = *bp;
+  unsigned k = *kp;
+  unsigned w = *wp;
+  grub_size_t avail;
+  int ret = 0;
+
+  in_start = in = input_peek (gzio, &avail);
+  in_end = in + avail;
+
+  while (w <= WSIZE - 258 && in_end - in >= 8)
+    {
+      struct gzio_code c;
+      unsigned e, n, d;
+
+      /* A length/distance pair takes at most 15 + 5 + 15 + 13 bits.  */
+      if (k < 48)
+	{
+	  b |= grub_le_to_cpu64 (grub_get_unaligned64 (in)) << k;
+	  in += (63 - k) >> 3;
+	  k |= 56;
+	}
+
+      c = lookup_code (tl, bl, b);
+      DUMPBITS (c.bits);
+      if (c.op == GZIO_LITERAL)
+	{
+	  gzio->window[w++] = c.val;
+	  continue;
+	}
+      if (c.op == GZIO_EOB)
+	{
+	  ret = 1;
+	  break;
+	}
+      if (c.op == GZIO_INVALID)
+	{
+	  grub_error (GRUB_ERR_BAD_COMPRESSED_DATA, "an unused code found");
+	  ret = -1;
+	  break;
+	}
+      e = c.op & GZIO_OP_BITS;
+      n = c.val + ((unsigned) b & mask_bits[e]);
+      DUMPBITS (e);
+
+      c = lookup_code (td, bd, b);
+      DUMPBITS (c.bits);
+      if (c.op == GZIO_INVALID)
+	{
+	  grub_error (GRUB_ERR_BAD_COMPRESSED_DATA, "an unused code found");
+	  ret = -1;
+	  break;
+	}
+      e = c.op & GZIO_OP_BITS;
+      d = c.val + ((unsigned) b & mask_bits[e]);
+      DUMPBITS (e);
+
+      if (d > gzio->saved_offset + w)
+	{
+	  grub_error (GRUB_ERR_BAD_COMPRESSED_DATA, "invalid distance");
+	  ret = -1;
+	  break;
+	}
+
+      copy_match (gzio, w, d, n);
+      w += n;
+    }
+
+  /* Drop the bits which were loaded ahead but not accounted for; the
+     bytes holding them are left in the input.  */
+  b &= ((grub_uint64_t) 1 << k) - 1;
+  input_skip (gzio, in - in_start);
+
+  *bp = b;
+  *kp = k;
+  *wp = w;
+  return ret;
+}
+
+
+/*
+ *  inflate (decompress) the codes in a deflated (compressed) block
+ *  until either the block or the window ends.
+ */
+
+static void
 inflate_codes_in_window (grub_gzio_t gzio)
 {
-  register unsigned e;		/* table entry flag/number of extra bits */
-  unsigned n, d;		/* length and index for copy */
+  struct gzio_code c;		/* table entry */
+  unsigned e;			/* number of extra bits */
+  unsigned n, d;		/* length and distance for copy */
   unsigned w;			/* current window position */
-  struct huft *t;		/* pointer to table entry */
-  unsigned ml, md;		/* masks for bl and bd bits */
-  register ulg b;		/* bit buffer */
-  register unsigned k;		/* number of bits in bit buffer */
+  grub_uint64_t b;		/* bit buffer */
+  unsigned k;			/* number of bits in bit buffer */
+  int ret;
 
   /* make local copies of globals */
   d = gzio->inflate_d;
@@ -650,109 +800,86 @@ inflate_codes_in_window (grub_gzio_t gzio)
   k = gzio->bk;
   w = gzio->wp;			/* initialize window position */
 
-  /* inflate the coded data */
-  ml = mask_bits[gzio->bl];		/* precompute masks for speed */
-  md = mask_bits[gzio->bd];
   for (;;)			/* do until end of block */
     {
-      if (! gzio->code_state)
+      if (gzio->code_state)
 	{
-	  NEEDBITS ((unsigned) gzio->bl);
-	  if ((e = (t = gzio->tl + ((unsigned) b & ml))->e) > 16)
-	    do
-	      {
-		if (e == 99)
-		  {
-		    grub_error (GRUB_ERR_BAD_COMPRESSED_DATA,
-				"an unused code found");
-		    return 1;
-		  }
-		DUMPBITS (t->b);
-		e -= 16;
-		NEEDBITS (e);
-	      }
-	    while ((e = (t = t->v.t + ((unsigned) b & mask_bits[e]))->e) > 16);
-	  DUMPBITS (t->b);
-
-	  if (e == 16)		/* then it's a literal */
-	    {
-	      gzio->slide[w++] = (uch) t->v.n;
-	      if (w == WSIZE)
-		break;
-	    }
-	  else
-	    /* it's an EOB or a length */
+	  /* finish a copy interrupted by the end of the window */
+	  while (n && w < WSIZE)
 	    {
-	      /* exit if end of block */
-	      if (e == 15)
-		{
-		  gzio->block_len = 0;
-		  break;
-		}
-
-	      /* get length of block to copy */
-	      NEEDBITS (e);
-	      n = t->v.n + ((unsigned) b & mask_bits[e]);
-	      DUMPBITS (e);
-
-	      /* decode distance of block to copy */
-	      NEEDBITS ((unsigned) gzio->bd);
-	      if ((e = (t = gzio->td + ((unsigned) b & md))->e) > 16)
-		do
-		  {
-		    if (e == 99)
-		      {
-			grub_error (GRUB_ERR_BAD_COMPRESSED_DATA,
-				    "an unused code found");
-			return 1;
-		      }
-		    DUMPBITS (t->b);
-		    e -= 16;
-		    NEEDBITS (e);
-		  }
-		while ((e = (t = t->v.t + ((unsigned) b & mask_bits[e]))->e)
-		       > 16);
-	      DUMPBITS (t->b);
-	      NEEDBITS (e);
-	      d = w - t->v.n - ((unsigned) b & mask_bits[e]);
-	      DUMPBITS (e);
-	      gzio->code_state++;
+	      if (gzio->window_linear)
+		gzio->window[w] = *(gzio->window + w - d);
+	      else
+		gzio->window[w] = gzio->window[(w - d) & (WSIZE - 1)];
+	      w++;
+	      n--;
 	    }
+	  if (n)
+	    break;
+	  gzio->code_state = 0;
 	}
 
-      if (gzio->code_state)
+      ret = inflate_fast (gzio, &b, &k, &w);
+      if (ret < 0)
+	return;
+      if (ret > 0)
 	{
-	  /* do the copy */
-	  do
-	    {
-	      n -= (e = (e = WSIZE - ((d &= WSIZE - 1) > w ? d : w)) > n ? n
-		    : e);
-
-	      if (w - d >= e)
-		{
-		  grub_memmove (gzio->slide + w, gzio->slide + d, e);
-		  w += e;
-		  d += e;
-		}
-	      else
-		/* purposefully use the overlap for extra copies here!! */
-		{
-		  while (e--)
-		    gzio->slide[w++] = gzio->slide[d++];
-		}
-
-	      if (w == WSIZE)
-		break;
-	    }
-	  while (n);
+	  gzio->block_len = 0;
+	  break;
+	}
+      if (w == WSIZE)
+	break;
 
-	  if (! n)
-	    gzio->code_state--;
+      /* Close to the end of the input buffer or of the window, decode
+	 one symbol at a time, pulling in only the bytes needed.  */
+      NEEDBITS (BMAX);
+      c = lookup_code (gzio->tl, gzio->bl, b);
+      DUMPBITS (c.bits);
 
-	  /* did we break from the loop too soon? */
+      if (c.op == GZIO_LITERAL)
+	{
+	  gzio->window[w++] = c.val;
 	  if (w == WSIZE)
 	    break;
+	  continue;
+	}
+      if (c.op == GZIO_EOB)
+	{
+	  gzio->block_len = 0;
+	  break;
+	}
+      if (c.op == GZIO_INVALID)
+	{
+	  grub_error (GRUB_ERR_BAD_COMPRESSED_DATA, "an unused code found");
+	  return;
+	}
+
+      /* get length of block to copy */
+      e = c.op & GZIO_OP_BITS;
+      NEEDBITS (e);
+      n = c.val + ((unsigned) b & mask_bits[e]);
+      DUMPBITS (e);
+
+      /* decode distance of block to copy */
+      NEEDBITS (BMAX);
+      c = lookup_code (gzio->td, gzio->bd, b);
+      DUMPBITS (c.bits);
+      if (c.op == GZIO_INVALID)
+	{
+	  grub_error (GRUB_ERR_BAD_COMPRESSED_DATA, "an unused code found");
+	  return;
 	}
+      e = c.op & GZIO_OP_BITS;
+      NEEDBITS (e);
+      d = c.val + ((unsigned) b & mask_bits[e]);
+      DUMPBITS (e);
+
+      if (d > gzio->saved_offset + w)
+	{
+	  grub_error (GRUB_ERR_BAD_COMPRESSED_DATA, "invalid distance");
+	  return;
+	}
+      gzio->code_state = 1;
     }
 
   /* restore the globals from the locals */
@@ -761,8 +888,6 @@ inflate_codes_in_window (grub_gzio_t gzio)
   gzio->wp = w;			/* restore global window pointer */
   gzio->bb = b;			/* restore global bit buffer */
   gzio->bk = k;
-
-  return ! gzio->block_len;
 }
 
 
@@ -771,8 +896,8 @@ inflate_codes_in_window (grub_gzio_t gzio)
 static void
 init_stored_block (grub_gzio_t gzio)
 {
-  register ulg b;		/* bit buffer */
-  register unsigned k;		/* number of bits in bit buffer */
+  grub_uint64_t b;		/* bit buffer */
+  unsigned k;			/* number of bits in bit buffer */
 
   /* make local copies of globals */
   b = gzio->bb;			/* initialize bit buffer */
@@ -797,48 +922,60 @@ init_stored_block (grub_gzio_t gzio)
 }
 
 
-/* get header for an inflated type 1 (fixed Huffman codes) block.  We should
-   either replace this with a custom decoder, or at least precompute the
-   Huffman tables. */
+/* get header for an inflated type 1 (fixed Huffman codes) block.  The
+   tables are the same for all such blocks, so they are built once.  */
 
 static void
 init_fixed_block (grub_gzio_t gzio)
 {
-  int i;			/* temporary variable */
-  unsigned l[288];		/* length list for huft_build */
-
-  /* set up literal table */
-  for (i = 0; i < 144; i++)
-    l[i] = 8;
-  for (; i < 256; i++)
-    l[i] = 9;
-  for (; i < 280; i++)
-    l[i] = 7;
-  for (; i < 288; i++)		/* make a complete, but wrong code set */
-    l[i] = 8;
-  gzio->bl = 7;
-  if (huft_build (l, 288, 257, cplens, cplext, &gzio->tl, &gzio->bl) != 0)
-    {
-      if (grub_errno == GRUB_ERR_NONE)
-	grub_error (GRUB_ERR_BAD_COMPRESSED_DATA,
-		    "failed in building a Huffman code table");
-      return;
-    }
+  static struct gzio_code fixed_tl[1 << 9];
+  static struct gzio_code fixed_td[1 << 5];
+  static int fixed_bl, fixed_bd;
+  static int fixed_built;
 
-  /* set up distance table */
-  for (i = 0; i < 30; i++)	/* make an incomplete code set */
-    l[i] = 5;
-  gzio->bd = 5;
-  if (huft_build (l, 30, 0, cpdist, cpdext, &gzio->td, &gzio->bd) > 1)
+  if (! fixed_built)
     {
-      if (grub_errno == GRUB_ERR_NONE)
-	grub_error (GRUB_ERR_BAD_COMPRESSED_DATA,
-		    "failed in building a Huffman code table");
-      huft_free (gzio->tl);
-      gzio->tl = 0;
-      return;
+      int i;			/* temporary variable */
+      uch l[288];		/* length list for build_table */
+
+      /* set up literal table */
+      for (i = 0; i < 144; i++)
+	l[i] = 8;
+      for (; i < 256; i++)
+	l[i] = 9;
+      for (; i < 280; i++)
+	l[i] = 7;
+      for (; i < 288; i++)	/* make a complete, but wrong code set */
+	l[i] = 8;
+      fixed_bl = lbits;
+      if (build_table (l, 288, 257, cplens, cplext, fixed_tl,
+		       ARRAY_SIZE (fixed_tl), &fixed_bl, 0) != 0)
+	{
+	  grub_error (GRUB_ERR_BAD_COMPRESSED_DATA,
+		      "failed in building a Huffman code table");
+	  return;
+	}
+
+      /* set up distance table */
+      for (i = 0; i < 30; i++)	/* make an incomplete code set */
+	l[i] = 5;
+      fixed_bd = dbits;
+      if (build_table (l, 30, 0, cpdist, cpdext, fixed_td,
+		       ARRAY_SIZE (fixed_td), &fixed_bd, 1) != 0)
+	{
+	  grub_error (GRUB_ERR_BAD_COMPRESSED_DATA,
+		      "failed in building a Huffman code table");
+	  return;
+	}
+
+      fixed_built = 1;
     }
 
+  gzio->tl = fixed_tl;
+  gzio->bl = fixed_bl;
+  gzio->td = fixed_td;
+  gzio->bd = fixed_bd;
+
   /* indicate we're now working on a block */
   gzio->code_state = 0;
   gzio->block_len++;
@@ -853,14 +990,15 @@ init_dynamic_block (grub_gzio_t gzio)
   int i;			/* temporary variables */
   unsigned j;
   unsigned l;			/* last length */
-  unsigned m;			/* mask for bit lengths table */
   unsigned n;			/* number of lengths to get */
   unsigned nb;			/* number of bit length codes */
   unsigned nl;			/* number of literal/length codes */
   unsigned nd;			/* number of distance codes */
-  unsigned ll[286 + 30];	/* literal/length and distance code lengths */
-  register ulg b;		/* bit buffer */
-  register unsigned k;		/* number of bits in bit buffer */
+  uch ll[286 + 30];		/* literal/length and distance code lengths */
+  struct gzio_code cl[1 << 7];	/* bit length code table */
+  int cl_bits;			/* lookup bits for the bit length codes */
+  grub_uint64_t b;		/* bit buffer */
+  unsigned k;			/* number of bits in bit buffer */
 
   /* make local bit buffer */
   b = gzio->bb;
@@ -893,8 +1031,9 @@ init_dynamic_block (grub_gzio_t gzio)
     ll[bitorder[j]] = 0;
 
   /* build decoding table for trees--single level, 7 bit lookup */
-  gzio->bl = 7;
-  if (huft_build (ll, 19, 19, NULL, NULL, &gzio->tl, &gzio->bl) != 0)
+  cl_bits = 7;
+  if (build_table (ll, 19, 19, NULL, NULL, cl, ARRAY_SIZE (cl),
+		   &cl_bits, 0) != 0)
     {
       grub_error (GRUB_ERR_BAD_COMPRESSED_DATA,
 		  "failed in building a Huffman code table");
@@ -903,14 +1042,20 @@ init_dynamic_block (grub_gzio_t gzio)
 
   /* read in literal and distance code lengths */
   n = nl + nd;
-  m = mask_bits[gzio->bl];
   i = l = 0;
   while ((unsigned) i < n)
     {
-      NEEDBITS ((unsigned) gzio->bl);
-      j = (gzio->td = gzio->tl + ((unsigned) b & m))->b;
-      DUMPBITS (j);
-      j = gzio->td->v.n;
+      struct gzio_code c;
+
+      NEEDBITS ((unsigned) cl_bits);
+      c = lookup_code (cl, cl_bits, b);
+      if (c.op == GZIO_INVALID)
+	{
+	  grub_error (GRUB_ERR_BAD_COMPRESSED_DATA, "an unused code found");
+	  return;
+	}
+      DUMPBITS (c.bits);
+      j = c.val;
       if (j < 16)		/* length of code in bits (0..15) */
 	ll[i++] = l = j;	/* save last length in l */
       else if (j == 16)		/* repeat last length 3 to 6 times */
@@ -957,32 +1102,36 @@ init_dynamic_block (grub_gzio_t gzio)
 	}
     }
 
-  /* free decoding table for trees */
-  huft_free (gzio->tl);
-  gzio->td = 0;
-  gzio->tl = 0;
-
   /* restore the global bit buffer */
   gzio->bb = b;
   gzio->bk = k;
 
+  /* a block without an end can't be decoded */
+  if (ll[256] == 0)
+    {
+      grub_error (GRUB_ERR_BAD_COMPRESSED_DATA, "missing end-of-block code");
+      return;
+    }
+
   /* build the decoding tables for literal/length and distance codes */
   gzio->bl = lbits;
-  if (huft_build (ll, nl, 257, cplens, cplext, &gzio->tl, &gzio->bl) != 0)
+  if (build_table (ll, nl, 257, cplens, cplext, gzio->ltab,
+		   ARRAY_SIZE (gzio->ltab), &gzio->bl, 0) != 0)
     {
       grub_error (GRUB_ERR_BAD_COMPRESSED_DATA,
 		  "failed in building a Huffman code table");
       return;
     }
+  gzio->tl = gzio->ltab;
   gzio->bd = dbits;
-  if (huft_build (ll + nl, nd, 0, cpdist, cpdext, &gzio->td, &gzio->bd) != 0)
+  if (build_table (ll + nl, nd, 0, cpdist, cpdext, gzio->dtab,
+		   ARRAY_SIZE (gzio->dtab), &gzio->bd, 0) != 0)
     {
-      huft_free (gzio->tl);
-      gzio->tl = 0;
       grub_error (GRUB_ERR_BAD_COMPRESSED_DATA,
 		  "failed in building a Huffman code table");
       return;
     }
+  gzio->td = gzio->dtab;
 
   /* indicate we're now working on a block */
   gzio->code_state = 0;
@@ -993,8 +1142,8 @@ init_dynamic_block (grub_gzio_t gzio)
 static void
 get_new_block (grub_gzio_t gzio)
 {
-  register ulg b;		/* bit buffer */
-  register unsigned k;		/* number of bits in bit buffer */
+  grub_uint64_t b;		/* bit buffer */
+  unsigned k;			/* number of bits in bit buffer */
 
   /* make local bit buffer */
   b = gzio->bb;
@@ -1063,16 +1212,43 @@ inflate_window (grub_gzio_t gzio)
        */
       if (gzio->block_type == INFLATE_STORED)
 	{
-	  int w = gzio->wp;
+	  unsigned w = gzio->wp;
+
+	  /* The bytes already in the bit buffer come first.  */
+	  while (gzio->block_len && w < WSIZE && gzio->bk >= 8)
+	    {
+	      gzio->window[w++] = gzio->bb & 0xff;
+	      gzio->bb >>= 8;
+	      gzio->bk -= 8;
+	      gzio->block_len--;
+	    }
 
 	  /*
-	   *  This is basically a glorified pass-through
+	   *  The rest is basically a glorified memcpy.
 	   */
 
 	  while (gzio->block_len && w < WSIZE && grub_errno == GRUB_ERR_NONE)
 	    {
-	      gzio->slide[w++] = get_byte (gzio);
-	      gzio->block_len--;
+	      const grub_uint8_t *p;
+	      grub_size_t avail;
+
+	      input_fill (gzio);
+	      p = input_peek (gzio, &avail);
+	      if (avail == 0)
+		{
+		  grub_error (GRUB_ERR_BAD_COMPRESSED_DATA,
+			      "premature end of compressed");
+		  break;
+		}
+	      if (avail > (grub_size_t) gzio->block_len)
+		avail = gzio->block_len;
+	      if (avail > WSIZE - w)
+		avail = WSIZE - w;
+
+	      grub_memcpy (gzio->window + w, p, avail);
+	      input_skip (gzio, avail);
+	      w += avail;
+	      gzio->block_len -= avail;
 	    }
 
 	  gzio->wp = w;
@@ -1084,13 +1260,7 @@ inflate_window (grub_gzio_t gzio)
        *  Expand other kind of block.
        */
 
-      if (inflate_codes_in_window (gzio))
-	{
-	  huft_free (gzio->tl);
-	  huft_free (gzio->td);
-	  gzio->tl = 0;
-	  gzio->td = 0;
-	}
+      inflate_codes_in_window (gzio);
     }
 
   gzio->saved_offset += gzio->wp;
@@ -1105,6 +1275,10 @@ initialize_tables (grub_gzio_t gzio)
   gzio->saved_offset = 0;
   gzio_seek (gzio, gzio->data_offset);
 
+  /* Drop the buffered input.  */
+  gzio->inbuf_d = 0;
+  gzio->inbuf_len = 0;
+
   /* Initialize the bit buffer.  */
   gzio->bk = 0;
   gzio->bb = 0;
@@ -1112,10 +1286,7 @@ initialize_tables (grub_gzio_t gzio)
   /* Reset partial decompression code.  */
   gzio->last_block = 0;
   gzio->block_len = 0;
-
-  /* Reset memory allocation stuff.  */
-  huft_free (gzio->tl);
-  huft_free (gzio->td);
+  gzio->code_state = 0;
   gzio->tl = NULL;
   gzio->td = NULL;
 }
@@ -1213,16 +1384,38 @@ test_zlib_header (grub_gzio_t gzio)
   return 1;
 }
 
+/* Put the last window, which was inflated into the caller's buffer
+   ending at END, back into the slide for later reads.  */
+static void
+save_window (grub_gzio_t gzio, const grub_uint8_t *end)
+{
+  grub_size_t n = WSIZE, first;
+  unsigned s;
+
+  if (gzio->saved_offset < WSIZE)
+    n = gzio->saved_offset;
+  s = (gzio->saved_offset - n) & (WSIZE - 1);
+  first = WSIZE - s;
+  if (first > n)
+    first = n;
+  grub_memcpy (gzio->slide + s, end - n, first);
+  grub_memcpy (gzio->slide, end - n + first, n - first);
+}
+
 static grub_ssize_t
 grub_gzio_read_real (grub_gzio_t gzio, grub_off_t offset,
 		     char *buf, grub_size_t len)
 {
   grub_ssize_t ret = 0;
+  char *direct_end = NULL;
 
   /* Do we reset decompression to the beginning of the file?  */
   if (gzio->saved_offset > offset + WSIZE)
     initialize_tables (gzio);
 
+  gzio->window = gzio->slide;
+  gzio->window_linear = 0;
+
   /*
    *  This loop operates upon uncompressed data only.  The only
    *  special thing it does is to make sure the decompression
@@ -1234,6 +1427,33 @@ grub_gzio_read_real (grub_gzio_t gzio, grub_off_t offset,
       register grub_size_t size;
       register char *srcaddr;
 
+      /* Inflate whole windows straight into BUF once the window before
+	 them is there to refer back to, saving a copy of every byte.  */
+      if (offset == gzio->saved_offset && len >= WSIZE
+	  && (ret >= WSIZE || offset == 0))
+	{
+	  gzio->window = (grub_uint8_t *) buf;
+	  gzio->window_linear = 1;
+	  inflate_window (gzio);
+	  gzio->window = gzio->slide;
+	  gzio->window_linear = 0;
+
+	  if (gzio->wp == 0)
+	    break;
+	  buf += gzio->wp;
+	  len -= gzio->wp;
+	  ret += gzio->wp;
+	  offset += gzio->wp;
+	  direct_end = buf;
+	  continue;
+	}
+
+      if (direct_end)
+	{
+	  save_window (gzio, (grub_uint8_t *) direct_end);
+	  direct_end = NULL;
+	}
+
       while (offset >= gzio->saved_offset)
 	{
 	  inflate_window (gzio);
@@ -1258,6 +1478,9 @@ grub_gzio_read_real (grub_gzio_t gzio, grub_off_t offset,
     }
 
  out:
+  if (direct_end)
+    save_window (gzio, (grub_uint8_t *) direct_end);
+
   if (grub_errno != GRUB_ERR_NONE)
     ret = -1;
 
@@ -1268,7 +1491,11 @@ static grub_ssize_t
 grub_gzio_read (grub_file_t file, char *buf, grub_size_t len)
 {
   grub_ssize_t ret;
+  grub_boot_span_t span;
+
+  span = grub_boot_span_begin ("Decompressing %s", file->name);
   ret = grub_gzio_read_real (file->data, file->offset, buf, len);
+  grub_boot_span_end (span, ret > 0 ? ret : 0);
 
   if (!grub_errno && ret != (grub_ssize_t) len)
     {
@@ -1285,8 +1512,6 @@ grub_gzio_close (grub_file_t file)
   grub_gzio_t gzio = file->data;
 
   grub_file_close (gzio->file);
-  huft_free (gzio->tl);
-  huft_free (gzio->td);
   grub_free (gzio);
 
   /* No need to close the same device twice.  */
@@ -1323,6 +1548,56 @@ grub_zlib_decompress (char *inbuf, grub_size_t insize, grub_off_t off,
   return ret;
 }
 
+/* Incremental decompression of an in-memory zlib stream, for callers that
+   consume the output piecewise and would rather not hold all of it.  */
+struct grub_zlib_stream
+{
+  struct grub_gzio gzio;
+  grub_off_t offset;
+};
+
+struct grub_zlib_stream *
+grub_zlib_stream_open (char *inbuf, grub_size_t insize)
+{
+  struct grub_zlib_stream *stream;
+
+  stream = grub_zalloc (sizeof (*stream));
+  if (! stream)
+    return 0;
+  stream->gzio.mem_input = (grub_uint8_t *) inbuf;
+  stream->gzio.mem_input_size = insize;
+  stream->gzio.mem_input_off = 0;
+
+  if (!test_zlib_header (&stream->gzio))
+    {
+      grub_free (stream);
+      return 0;
+    }
+
+  return stream;
+}
+
+/* Read the next LEN bytes of output.  Returns the number of bytes read,
+   which is less than LEN only at the end of the stream, or -1.  */
+grub_ssize_t
+grub_zlib_stream_read (struct grub_zlib_stream *stream, char *outbuf,
+		       grub_size_t len)
+{
+  grub_ssize_t ret;
+
+  ret = grub_gzio_read_real (&stream->gzio, stream->offset, outbuf, len);
+  if (ret > 0)
+    stream->offset += ret;
+
+  return ret;
+}
+
+void
+grub_zlib_stream_close (struct grub_zlib_stream *stream)
+{
+  grub_free (stream);
+}
+
 grub_ssize_t
 grub_deflate_decompress (char *inbuf, grub_size_t insize, grub_off_t off,
 			 char *outbuf, grub_size_t outsize)
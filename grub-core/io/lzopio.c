@@ -23,6 +23,7 @@
 #include <grub/fs.h>
 #include <grub/dl.h>
 #include <grub/crypto.h>
+#include <grub/job.h>
 #include <minilzo.h>
 
 GRUB_MOD_LICENSE ("GPLv3+");
@@ -59,6 +60,29 @@ struct block_header
   unsigned char *udata;
 };
 
+/* Where each block starts, in the uncompressed data and in the file.  */
+struct block_index
+{
+  grub_off_t uoff;
+  grub_off_t hoff;
+};
+
+/* Blocks are independent, so the ones after the block being read are
+   decoded ahead into a small ring when grub_job_submit has processors to
+   run them on.  */
+#define LZOPIO_SLOTS 4
+#define NO_BLOCK ((grub_size_t) -1)
+
+struct lzopio_slot
+{
+  struct grub_job job;
+  const struct grub_lzopio *lzopio;
+  grub_size_t n;
+  int pending;
+  int err;
+  struct block_header block;
+};
+
 struct grub_lzopio
 {
   grub_file_t file;
@@ -66,39 +90,29 @@ struct grub_lzopio
   int has_ucheck;
   const gcry_md_spec_t *ucheck_fun;
   const gcry_md_spec_t *ccheck_fun;
-  grub_off_t saved_off;		/* Rounded down to block boundary.  */
   grub_off_t start_block_off;
-  struct block_header block;
+  struct block_index *index;
+  grub_size_t nblocks;
+  struct lzopio_slot slots[LZOPIO_SLOTS];
 };
 
 typedef struct grub_lzopio *grub_lzopio_t;
 static struct grub_fs grub_lzopio_fs;
 
-/* Some helper functions. On errors memory allocated by those function is free
- * either on close() so no risk of leaks. This makes functions simpler.  */
-
-/* Read block header from file, after successful exit file points to
- * beginning of block data.  */
+/* Read block header from file into BLOCK, after successful exit file points
+ * to beginning of block data.  */
 static int
-read_block_header (struct grub_lzopio *lzopio)
+read_block_header (struct grub_lzopio *lzopio, struct block_header *block)
 {
-  lzopio->saved_off += lzopio->block.usize;
-
-  /* Free cached block data if any.  */
-  grub_free (lzopio->block.udata);
-  grub_free (lzopio->block.cdata);
-  lzopio->block.udata = NULL;
-  lzopio->block.cdata = NULL;
-
-  if (grub_file_read (lzopio->file, &lzopio->block.usize,
-		      sizeof (lzopio->block.usize)) !=
-      sizeof (lzopio->block.usize))
+  if (grub_file_read (lzopio->file, &block->usize,
+		      sizeof (block->usize)) !=
+      sizeof (block->usize))
     return -1;
 
-  lzopio->block.usize = grub_be_to_cpu32 (lzopio->block.usize);
+  block->usize = grub_be_to_cpu32 (block->usize);
 
   /* Last block has uncompressed data size == 0 and no other fields.  */
-  if (lzopio->block.usize == 0)
+  if (block->usize == 0)
     {
       if (grub_file_tell (lzopio->file) == grub_file_size (lzopio->file))
 	return 0;
@@ -107,167 +121,300 @@ read_block_header (struct grub_lzopio *lzopio)
     }
 
   /* Read compressed data block size.  */
-  if (grub_file_read (lzopio->file, &lzopio->block.csize,
-		      sizeof (lzopio->block.csize)) !=
-      sizeof (lzopio->block.csize))
+  if (grub_file_read (lzopio->file, &block->csize,
+		      sizeof (block->csize)) !=
+      sizeof (block->csize))
     return -1;
 
-  lzopio->block.csize = grub_be_to_cpu32 (lzopio->block.csize);
+  block->csize = grub_be_to_cpu32 (block->csize);
 
   /* Corrupted.  */
-  if (lzopio->block.csize > lzopio->block.usize)
+  if (block->csize > block->usize)
     return -1;
 
   /* Read checksum of uncompressed data.  */
   if (lzopio->has_ucheck)
     {
-      if (grub_file_read (lzopio->file, &lzopio->block.ucheck,
-			  sizeof (lzopio->block.ucheck)) !=
-	  sizeof (lzopio->block.ucheck))
+      if (grub_file_read (lzopio->file, &block->ucheck,
+			  sizeof (block->ucheck)) !=
+	  sizeof (block->ucheck))
 	return -1;
-
-      lzopio->block.ucheck = lzopio->block.ucheck;
     }
 
   /* Read checksum of compressed data.  */
   if (lzopio->has_ccheck)
     {
       /* Incompressible data block.  */
-      if (lzopio->block.csize == lzopio->block.usize)
+      if (block->csize == block->usize)
 	{
-	  lzopio->block.ccheck = lzopio->block.ucheck;
+	  block->ccheck = block->ucheck;
 	}
       else
 	{
-	  if (grub_file_read (lzopio->file, &lzopio->block.ccheck,
-			      sizeof (lzopio->block.ccheck)) !=
-	      sizeof (lzopio->block.ccheck))
+	  if (grub_file_read (lzopio->file, &block->ccheck,
+			      sizeof (block->ccheck)) !=
+	      sizeof (block->ccheck))
 	    return -1;
-
-	  lzopio->block.ccheck = lzopio->block.ccheck;
 	}
     }
 
   return 0;
 }
 
-/* Read block data into memory. File must be set to beginning of block data.
- * Can't be called on last block.  */
 static int
-read_block_data (struct grub_lzopio *lzopio)
+check_data (const gcry_md_spec_t *fun, const void *data, grub_size_t size,
+	    grub_uint32_t check)
 {
-  lzopio->block.cdata = grub_malloc (lzopio->block.csize);
-  if (!lzopio->block.cdata)
+  grub_uint8_t computed_hash[GRUB_CRYPTO_MAX_MDLEN];
+
+  if (!fun)
+    return 0;
+
+  if (fun->mdlen > GRUB_CRYPTO_MAX_MDLEN)
     return -1;
 
-  if (grub_file_read (lzopio->file, lzopio->block.cdata, lzopio->block.csize)
-      != (grub_ssize_t) lzopio->block.csize)
+  grub_crypto_hash (fun, computed_hash, data, size);
+
+  if (grub_memcmp (computed_hash, &check, sizeof (check)) != 0)
     return -1;
 
-  if (lzopio->ccheck_fun)
-    {
-      grub_uint8_t computed_hash[GRUB_CRYPTO_MAX_MDLEN];
+  return 0;
+}
 
-      if (lzopio->ccheck_fun->mdlen > GRUB_CRYPTO_MAX_MDLEN)
-	return -1;
+/* Check and uncompress a block whose data has been read.  Touches nothing
+   but the slot, so that it can run as a job.  */
+static void
+decode_block (struct grub_job *job)
+{
+  struct lzopio_slot *slot = (struct lzopio_slot *) job;
+  const struct grub_lzopio *lzopio = slot->lzopio;
+  struct block_header *block = &slot->block;
+  lzo_uint usize = block->usize;
 
-      grub_crypto_hash (lzopio->ccheck_fun, computed_hash,
-			lzopio->block.cdata,
-			lzopio->block.csize);
+  slot->err = -1;
 
-      if (grub_memcmp
-	  (computed_hash, &lzopio->block.ccheck,
-	   sizeof (lzopio->block.ccheck)) != 0)
-	return -1;
+  /* Incompressible data was read into UDATA directly.  */
+  if (block->csize == block->usize)
+    {
+      if (check_data (lzopio->ccheck_fun, block->udata, block->csize,
+		      block->ccheck) == 0)
+	slot->err = 0;
+      return;
     }
 
-  return 0;
+  if (check_data (lzopio->ccheck_fun, block->cdata, block->csize,
+		  block->ccheck) < 0)
+    return;
+
+  if (lzo1x_decompress_safe (block->cdata, block->csize,
+			     block->udata, &usize, NULL)
+      != LZO_E_OK || usize != block->usize)
+    return;
+
+  if (check_data (lzopio->ucheck_fun, block->udata, block->usize,
+		  block->ucheck) < 0)
+    return;
+
+  slot->err = 0;
 }
 
-/* Read block data, uncompressed and also store it in memory.  */
-/* XXX Investigate possibility of in-place decompression to reduce memory
- * footprint. Or try to uncompress directly to buf if possible.  */
+/* Wait for SLOT and drop the block it holds.  */
+static void
+release_slot (struct lzopio_slot *slot)
+{
+  if (slot->pending)
+    grub_job_wait (&slot->job);
+  slot->pending = 0;
+  grub_free (slot->block.cdata);
+  grub_free (slot->block.udata);
+  slot->block.cdata = NULL;
+  slot->block.udata = NULL;
+  slot->n = NO_BLOCK;
+}
+
+/* Read block N into SLOT, uncompressing it into UDATA if given or into
+   a buffer owned by the slot otherwise.  Decoding is left to the
+   caller.  */
 static int
-uncompress_block (struct grub_lzopio *lzopio)
+load_block (struct grub_lzopio *lzopio, struct lzopio_slot *slot,
+	    grub_size_t n, unsigned char *udata)
 {
-  lzo_uint usize = lzopio->block.usize;
+  struct block_header *block = &slot->block;
+
+  slot->lzopio = lzopio;
+  slot->job.run = decode_block;
+  slot->n = n;
 
-  if (read_block_data (lzopio) < 0)
+  if (grub_file_seek (lzopio->file, lzopio->index[n].hoff)
+      == (grub_off_t) -1
+      || read_block_header (lzopio, block) < 0
+      || block->usize != lzopio->index[n + 1].uoff - lzopio->index[n].uoff)
     return -1;
 
-  /* Incompressible data. */
-  if (lzopio->block.csize == lzopio->block.usize)
-    {
-      lzopio->block.udata = lzopio->block.cdata;
-      lzopio->block.cdata = NULL;
-    }
-  else
-    {
-      lzopio->block.udata = grub_malloc (lzopio->block.usize);
-      if (!lzopio->block.udata)
-	return -1;
+  block->udata = udata;
+  if (!block->udata)
+    block->udata = grub_malloc (block->usize);
+  if (!block->udata)
+    return -1;
 
-      if (lzo1x_decompress_safe (lzopio->block.cdata, lzopio->block.csize,
-				 lzopio->block.udata, &usize, NULL)
-	  != LZO_E_OK)
-	return -1;
+  if (block->csize == block->usize)
+    return (grub_file_read (lzopio->file, block->udata, block->csize)
+	    == (grub_ssize_t) block->csize) ? 0 : -1;
 
-      if (lzopio->ucheck_fun)
-	{
-	  grub_uint8_t computed_hash[GRUB_CRYPTO_MAX_MDLEN];
+  block->cdata = grub_malloc (block->csize);
+  if (!block->cdata
+      || grub_file_read (lzopio->file, block->cdata, block->csize)
+	 != (grub_ssize_t) block->csize)
+    return -1;
 
-	  if (lzopio->ucheck_fun->mdlen > GRUB_CRYPTO_MAX_MDLEN)
-	    return -1;
+  return 0;
+}
 
-	  grub_crypto_hash (lzopio->ucheck_fun, computed_hash,
-			    lzopio->block.udata,
-			    lzopio->block.usize);
+/* Start decoding the blocks after N which aren't in the ring yet.  */
+static void
+decode_ahead (struct grub_lzopio *lzopio, grub_size_t n)
+{
+  grub_size_t next;
+  unsigned i;
 
-	  if (grub_memcmp
-	      (computed_hash, &lzopio->block.ucheck,
-	       sizeof (lzopio->block.ucheck)) != 0)
-	    return -1;
+  for (next = n + 1; next < n + LZOPIO_SLOTS && next < lzopio->nblocks;
+       next++)
+    {
+      struct lzopio_slot *slot = NULL;
+
+      for (i = 0; i < LZOPIO_SLOTS; i++)
+	if (lzopio->slots[i].n == next)
+	  break;
+      if (i < LZOPIO_SLOTS)
+	continue;
+
+      if (!grub_job_workers ())
+	return;
+
+      /* Reuse a slot holding nothing or a block already behind us.  */
+      for (i = 0; i < LZOPIO_SLOTS; i++)
+	if (lzopio->slots[i].n == NO_BLOCK || lzopio->slots[i].n < n)
+	  {
+	    slot = &lzopio->slots[i];
+	    break;
+	  }
+      if (!slot)
+	return;
+
+      release_slot (slot);
+      if (load_block (lzopio, slot, next, NULL) < 0)
+	{
+	  /* The reader will run into this again and report it.  */
+	  release_slot (slot);
+	  grub_errno = GRUB_ERR_NONE;
+	  return;
 	}
+      slot->pending = 1;
+      grub_job_submit (&slot->job);
+    }
+}
 
-      /* Compressed data can be free now.  */
-      grub_free (lzopio->block.cdata);
-      lzopio->block.cdata = NULL;
+/* Return the slot holding block N, decoded and checked.  */
+static struct lzopio_slot *
+get_block (struct grub_lzopio *lzopio, grub_size_t n)
+{
+  struct lzopio_slot *slot = NULL;
+  unsigned i;
+
+  for (i = 0; i < LZOPIO_SLOTS; i++)
+    if (lzopio->slots[i].n == n)
+      {
+	slot = &lzopio->slots[i];
+	if (slot->pending)
+	  grub_job_wait (&slot->job);
+	slot->pending = 0;
+	return slot->err ? NULL : slot;
+      }
+
+  /* Evict whichever block is furthest from N.  */
+  slot = &lzopio->slots[0];
+  for (i = 0; i < LZOPIO_SLOTS; i++)
+    {
+      grub_size_t cur = lzopio->slots[i].n;
+
+      if (cur == NO_BLOCK)
+	{
+	  slot = &lzopio->slots[i];
+	  break;
+	}
+      if ((cur < n ? n - cur + LZOPIO_SLOTS : cur - n)
+	  > (slot->n < n ? n - slot->n + LZOPIO_SLOTS : slot->n - n))
+	slot = &lzopio->slots[i];
     }
 
-  return 0;
+  release_slot (slot);
+  if (load_block (lzopio, slot, n, NULL) < 0)
+    {
+      release_slot (slot);
+      return NULL;
+    }
+  decode_block (&slot->job);
+  return slot->err ? NULL : slot;
 }
 
-/* Jump to next block and read its header.  */
-static int
-jump_block (struct grub_lzopio *lzopio)
+/* Find the block containing uncompressed offset OFF.  */
+static grub_size_t
+find_block (const struct grub_lzopio *lzopio, grub_off_t off)
 {
-  /* only jump if block was not decompressed (and read from disk) */
-  if (!lzopio->block.udata)
+  grub_size_t lo = 0, hi = lzopio->nblocks;
+
+  while (hi - lo > 1)
     {
-      grub_off_t off = grub_file_tell (lzopio->file) + lzopio->block.csize;
+      grub_size_t mid = lo + (hi - lo) / 2;
 
-      if (grub_file_seek (lzopio->file, off) == ((grub_off_t) - 1))
-	return -1;
+      if (lzopio->index[mid].uoff <= off)
+	lo = mid;
+      else
+	hi = mid;
     }
 
-  return read_block_header (lzopio);
+  return lo;
 }
 
+/* Walk the block headers once, recording where every block starts.  */
 static int
-calculate_uncompressed_size (grub_file_t file)
+build_index (grub_file_t file)
 {
   grub_lzopio_t lzopio = file->data;
+  struct block_header block;
+  grub_size_t alloc = 0;
   grub_off_t usize_total = 0;
 
-  if (read_block_header (lzopio) < 0)
-    return -1;
-
   /* FIXME: Don't do this for not easily seekable files.  */
-  while (lzopio->block.usize != 0)
+  while (1)
     {
-      usize_total += lzopio->block.usize;
+      grub_off_t hoff = grub_file_tell (lzopio->file);
+
+      /* One more entry than blocks: the last one marks the end.  */
+      if (lzopio->nblocks == alloc)
+	{
+	  struct block_index *n;
+
+	  alloc = alloc ? 2 * alloc : 64;
+	  n = grub_realloc (lzopio->index, alloc * sizeof (*n));
+	  if (!n)
+	    return -1;
+	  lzopio->index = n;
+	}
+      lzopio->index[lzopio->nblocks].uoff = usize_total;
+      lzopio->index[lzopio->nblocks].hoff = hoff;
 
-      if (jump_block (lzopio) < 0)
+      if (read_block_header (lzopio, &block) < 0)
+	return -1;
+      if (block.usize == 0)
+	break;
+
+      usize_total += block.usize;
+      lzopio->nblocks++;
+
+      if (grub_file_seek (lzopio->file,
+			  grub_file_tell (lzopio->file) + block.csize)
+	  == (grub_off_t) -1)
 	return -1;
     }
 
@@ -389,17 +536,9 @@ test_header (grub_file_t file)
 
   lzopio->start_block_off = grub_file_tell (lzopio->file);
 
-  if (calculate_uncompressed_size (file) < 0)
-    goto CORRUPTED;
-
-  /* Get back to start block.  */
-  grub_file_seek (lzopio->file, lzopio->start_block_off);
-
-  /* Read first block - grub_lzopio_read() expects valid block.  */
-  if (read_block_header (lzopio) < 0)
+  if (build_index (file) < 0)
     goto CORRUPTED;
 
-  lzopio->saved_off = 0;
   return 1;
 
 CORRUPTED:
@@ -412,6 +551,7 @@ grub_lzopio_open (grub_file_t io,
 {
   grub_file_t file;
   grub_lzopio_t lzopio;
+  unsigned i;
 
   file = (grub_file_t) grub_zalloc (sizeof (*file));
   if (!file)
@@ -425,6 +565,8 @@ grub_lzopio_open (grub_file_t io,
     }
 
   lzopio->file = io;
+  for (i = 0; i < LZOPIO_SLOTS; i++)
+    lzopio->slots[i].n = NO_BLOCK;
 
   file->device = io->device;
   file->data = lzopio;
@@ -439,6 +581,7 @@ grub_lzopio_open (grub_file_t io,
     {
       grub_errno = GRUB_ERR_NONE;
       grub_file_seek (io, 0);
+      grub_free (lzopio->index);
       grub_free (lzopio);
       grub_free (file);
 
@@ -449,76 +592,97 @@ grub_lzopio_open (grub_file_t io,
 }
 
 static grub_ssize_t
-grub_lzopio_read (grub_file_t file, char *buf, grub_size_t len)
+grub_lzopio_read_real (grub_file_t file, char *buf, grub_size_t len)
 {
   grub_lzopio_t lzopio = file->data;
   grub_ssize_t ret = 0;
-  grub_off_t off;
+  grub_off_t pos = grub_file_tell (file);
 
-  /* Backward seek before last read block.  */
-  if (lzopio->saved_off > grub_file_tell (file))
+  while (len != 0 && pos < file->size)
     {
-      grub_file_seek (lzopio->file, lzopio->start_block_off);
-
-      if (read_block_header (lzopio) < 0)
-	goto CORRUPTED;
-
-      lzopio->saved_off = 0;
-    }
-
-  /* Forward to first block with requested data.  */
-  while (lzopio->saved_off + lzopio->block.usize <= grub_file_tell (file))
-    {
-      /* EOF, could be possible files with unknown size.  */
-      if (lzopio->block.usize == 0)
-	return 0;
-
-      if (jump_block (lzopio) < 0)
-	goto CORRUPTED;
-    }
+      grub_size_t n = find_block (lzopio, pos);
+      grub_off_t off = pos - lzopio->index[n].uoff;
+      grub_size_t usize = lzopio->index[n + 1].uoff - lzopio->index[n].uoff;
+      struct lzopio_slot *slot;
+      unsigned i;
+      grub_size_t to_copy;
 
-  off = grub_file_tell (file) - lzopio->saved_off;
+      for (i = 0; i < LZOPIO_SLOTS; i++)
+	if (lzopio->slots[i].n == n)
+	  break;
 
-  while (len != 0 && lzopio->block.usize != 0)
-    {
-      grub_size_t to_copy;
+      /* A whole block that is wanted and not decoded yet goes straight
+	 into BUF unless other processors can do the work.  */
+      if (i == LZOPIO_SLOTS && off == 0 && len >= usize
+	  && !grub_job_workers ())
+	{
+	  struct lzopio_slot direct = { .n = NO_BLOCK };
+	  int err;
+
+	  err = load_block (lzopio, &direct, n, (unsigned char *) buf);
+	  if (!err)
+	    {
+	      decode_block (&direct.job);
+	      err = direct.err;
+	    }
+	  grub_free (direct.block.cdata);
+	  if (err)
+	    goto CORRUPTED;
+
+	  to_copy = usize;
+	}
+      else
+	{
+	  slot = get_block (lzopio, n);
+	  if (!slot)
+	    goto CORRUPTED;
 
-      /* Block not decompressed yet.  */
-      if (!lzopio->block.udata && uncompress_block (lzopio) < 0)
-	goto CORRUPTED;
+	  decode_ahead (lzopio, n);
 
-      /* Copy requested data into buffer.  */
-      to_copy = lzopio->block.usize - off;
-      if (to_copy > len)
-	to_copy = len;
-      grub_memcpy (buf, lzopio->block.udata + off, to_copy);
+	  /* Copy requested data into buffer.  */
+	  to_copy = usize - off;
+	  if (to_copy > len)
+	    to_copy = len;
+	  grub_memcpy (buf, slot->block.udata + off, to_copy);
+	}
 
       len -= to_copy;
       buf += to_copy;
       ret += to_copy;
-      off = 0;
-
-      /* Read next block if needed.  */
-      if (len > 0 && read_block_header (lzopio) < 0)
-	goto CORRUPTED;
+      pos += to_copy;
     }
 
   return ret;
 
 CORRUPTED:
-  grub_error (GRUB_ERR_BAD_COMPRESSED_DATA, N_("lzop file corrupted"));
+  if (!grub_errno)
+    grub_error (GRUB_ERR_BAD_COMPRESSED_DATA, N_("lzop file corrupted"));
   return -1;
 }
 
+static grub_ssize_t
+grub_lzopio_read (grub_file_t file, char *buf, grub_size_t len)
+{
+  grub_ssize_t ret;
+  grub_boot_span_t span;
+
+  span = grub_boot_span_begin ("Decompressing %s", file->name);
+  ret = grub_lzopio_read_real (file, buf, len);
+  grub_boot_span_end (span, ret > 0 ? ret : 0);
+  return ret;
+}
+
 /* Release everything, including the underlying file object.  */
 static grub_err_t
 grub_lzopio_close (grub_file_t file)
 {
   grub_lzopio_t lzopio = file->data;
+  unsigned i;
 
+  for (i = 0; i < LZOPIO_SLOTS; i++)
+    release_slot (&lzopio->slots[i]);
   grub_file_close (lzopio->file);
-  grub_free (lzopio->block.cdata);
-  grub_free (lzopio->block.udata);
+  grub_free (lzopio->index);
   grub_free (lzopio);
 
   /* Device must not be closed twice.  */
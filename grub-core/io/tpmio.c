@@ -0,0 +1,199 @@
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2015  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Measure a file into the TPM while it is being read, so that the data
+   is hashed once, in the pass that brings it in, instead of being handed
+   to the firmware to hash again after loading.  */
+
+#include <grub/file.h>
+#include <grub/dl.h>
+#include <grub/mm.h>
+#include <grub/misc.h>
+#include <grub/err.h>
+#include <grub/i18n.h>
+#include <grub/crypto.h>
+#include <grub/tpm.h>
+
+GRUB_MOD_LICENSE ("GPLv3+");
+
+/* Hash after every chunk this big, while it is still in the cache.  */
+#define TPMIO_CHUNK_SIZE (256 * 1024)
+
+struct grub_tpmio
+{
+  grub_file_t parent;
+  const gcry_md_spec_t *hash;
+  void *context;
+  /* Bytes hashed so far, which is also where the next read has to
+     start.  */
+  grub_off_t hashed;
+  grub_uint8_t pcr;
+  char *kind;
+  char *description;
+};
+typedef struct grub_tpmio *grub_tpmio_t;
+
+static grub_err_t
+grub_tpmio_extend (grub_tpmio_t tpmio)
+{
+  tpmio->hash->final (tpmio->context);
+  return grub_tpm_measure_digest (tpmio->hash->read (tpmio->context),
+				  tpmio->pcr, tpmio->kind,
+				  tpmio->description);
+}
+
+static grub_ssize_t
+grub_tpmio_read (grub_file_t file, char *buf, grub_size_t len)
+{
+  grub_tpmio_t tpmio = file->data;
+  grub_file_t parent = tpmio->parent;
+  grub_disk_read_hook_t read_hook = parent->read_hook;
+  void *read_hook_data = parent->read_hook_data;
+  grub_size_t done = 0;
+  grub_ssize_t res = 0;
+
+  /* The digest only covers the file if every byte goes through it once,
+     in order.  */
+  if (file->offset != tpmio->hashed)
+    {
+      grub_error (GRUB_ERR_BAD_ARGUMENT,
+		  N_("measured file `%s' must be read sequentially"),
+		  file->name);
+      return -1;
+    }
+
+  parent->read_hook = file->read_hook;
+  parent->read_hook_data = file->read_hook_data;
+
+  while (done < len)
+    {
+      grub_size_t chunk = len - done;
+
+      if (chunk > TPMIO_CHUNK_SIZE)
+	chunk = TPMIO_CHUNK_SIZE;
+
+      res = grub_file_read_direct (parent, buf + done, chunk);
+      if (res <= 0)
+	break;
+
+      tpmio->hash->write (tpmio->context, buf + done, res);
+      tpmio->hashed += res;
+      done += res;
+    }
+
+  parent->read_hook = read_hook;
+  parent->read_hook_data = read_hook_data;
+
+  if (res < 0)
+    return -1;
+
+  /* Extend as soon as the last byte is in, so that the event lands in the
+     log in the same place as with grub_tpm_measure.  */
+  if (tpmio->hashed == file->size && done > 0
+      && grub_tpmio_extend (tpmio))
+    return -1;
+
+  return done;
+}
+
+static grub_err_t
+grub_tpmio_close (grub_file_t file)
+{
+  grub_tpmio_t tpmio = file->data;
+
+  grub_file_close (tpmio->parent);
+  grub_free (tpmio->context);
+  grub_free (tpmio->kind);
+  grub_free (tpmio->description);
+  grub_free (tpmio);
+
+  /* No need to close the same device twice.  */
+  file->device = 0;
+  file->name = 0;
+
+  return GRUB_ERR_NONE;
+}
+
+static struct grub_fs grub_tpmio_fs =
+  {
+    .name = "tpmio",
+    .dir = 0,
+    .open = 0,
+    .read = grub_tpmio_read,
+    .close = grub_tpmio_close,
+    .label = 0,
+    .next = 0
+  };
+
+grub_file_t
+grub_tpm_measure_open (grub_file_t parent, grub_uint8_t pcr,
+		       const char *kind, const char *description)
+{
+  grub_file_t file;
+  grub_tpmio_t tpmio;
+  const gcry_md_spec_t *hash;
+
+  if (grub_tpm_hash_mode () != GRUB_TPM_HASH_SHA1
+      || parent->size == GRUB_FILE_SIZE_UNKNOWN || parent->size == 0)
+    return parent;
+
+  hash = grub_crypto_lookup_md_by_name ("sha1");
+  if (!hash)
+    {
+      /* Fall back to letting the firmware hash the loaded data.  */
+      grub_errno = GRUB_ERR_NONE;
+      return parent;
+    }
+
+  file = grub_zalloc (sizeof (*file));
+  if (!file)
+    return 0;
+
+  tpmio = grub_zalloc (sizeof (*tpmio));
+  if (!tpmio)
+    {
+      grub_free (file);
+      return 0;
+    }
+
+  tpmio->parent = parent;
+  tpmio->hash = hash;
+  tpmio->pcr = pcr;
+  tpmio->context = grub_malloc (hash->contextsize);
+  tpmio->kind = grub_strdup (kind);
+  tpmio->description = grub_strdup (description);
+  if (!tpmio->context || !tpmio->kind || !tpmio->description)
+    {
+      grub_free (tpmio->context);
+      grub_free (tpmio->kind);
+      grub_free (tpmio->description);
+      grub_free (tpmio);
+      grub_free (file);
+      return 0;
+    }
+  hash->init (tpmio->context);
+
+  file->name = parent->name;
+  file->device = parent->device;
+  file->size = parent->size;
+  file->data = tpmio;
+  file->fs = &grub_tpmio_fs;
+  file->not_easily_seekable = 1;
+
+  return file;
+}
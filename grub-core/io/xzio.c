@@ -33,6 +33,15 @@ GRUB_MOD_LICENSE ("GPLv3+");
 #define VLI_MAX_DIGITS 9
 #define XZ_STREAM_FOOTER_SIZE 12
 
+/* One record of the stream index.  */
+struct grub_xzio_block
+{
+  /* Offset of the block header in the compressed file.  */
+  grub_off_t coff;
+  /* Offset of the block data in the uncompressed file.  */
+  grub_off_t uoff;
+};
+
 struct grub_xzio
 {
   grub_file_t file;
@@ -41,6 +50,15 @@ struct grub_xzio
   grub_uint8_t inbuf[XZBUFSIZ];
   grub_uint8_t outbuf[XZBUFSIZ];
   grub_off_t saved_offset;
+  /* Stream header, replayed to the decoder when jumping to a block.  */
+  grub_uint8_t header[STREAM_HEADER_SIZE];
+  /* Block map built from the index, or NULL if it is unusable.  */
+  struct grub_xzio_block *blocks;
+  grub_size_t nblocks;
+  /* Start of the stream index.  Decoding that started at a block other
+     than the first stops here since the index would not match.  */
+  grub_off_t index_off;
+  int skip_index;
 };
 
 typedef struct grub_xzio *grub_xzio_t;
@@ -99,6 +117,7 @@ test_header (grub_file_t file)
 
   if (xzio->buf.in_size != STREAM_HEADER_SIZE)
     return 0;
+  grub_memcpy (xzio->header, xzio->inbuf, STREAM_HEADER_SIZE);
 
   ret = xz_dec_run (xzio->dec, &xzio->buf);
 
@@ -112,7 +131,7 @@ test_header (grub_file_t file)
 }
 
 /* Try to find out size of uncompressed data,
- * also do some footer sanity checks.  */
+ * also do some footer sanity checks and map the blocks.  */
 static int
 test_footer (grub_file_t file)
 {
@@ -122,7 +141,10 @@ test_footer (grub_file_t file)
   grub_uint8_t imarker;
   grub_uint64_t uncompressed_size_total = 0;
   grub_uint64_t uncompressed_size;
+  grub_uint64_t unpadded_size;
   grub_uint64_t records;
+  grub_off_t block_off = STREAM_HEADER_SIZE;
+  grub_size_t i = 0;
 
   grub_file_seek (xzio->file, xzio->file->size - FOOTER_MAGIC_SIZE);
   if (grub_file_read (xzio->file, footer, FOOTER_MAGIC_SIZE)
@@ -139,35 +161,105 @@ test_footer (grub_file_t file)
   backsize = (grub_le_to_cpu32 (backsize) + 1) * 4;
 
   /* Set file to the beginning of stream index.  */
-  grub_file_seek (xzio->file,
-		  xzio->file->size - XZ_STREAM_FOOTER_SIZE - backsize);
+  xzio->index_off = xzio->file->size - XZ_STREAM_FOOTER_SIZE - backsize;
+  grub_file_seek (xzio->file, xzio->index_off);
 
   /* Test index marker.  */
   if (grub_file_read (xzio->file, &imarker, sizeof (imarker))
-      != sizeof (imarker) && imarker != 0x00)
+      != sizeof (imarker) || imarker != 0x00)
     goto ERROR;
 
   if (read_vli (xzio->file, &records) <= 0)
     goto ERROR;
 
-  for (; records != 0; records--)
+  /* Each record is at least two bytes.  */
+  if (records <= backsize / 2
+      && records <= GRUB_SIZE_MAX / sizeof (xzio->blocks[0]))
+    {
+      xzio->blocks = grub_malloc (records * sizeof (xzio->blocks[0]));
+      if (!xzio->blocks)
+	grub_errno = GRUB_ERR_NONE;
+    }
+
+  for (; records != 0; records--, i++)
     {
-      if (read_vli (xzio->file, &uncompressed_size) <= 0)	/* Ignore unpadded.  */
+      if (read_vli (xzio->file, &unpadded_size) <= 0)
 	goto ERROR;
       if (read_vli (xzio->file, &uncompressed_size) <= 0)	/* Uncompressed.  */
 	goto ERROR;
 
+      if (xzio->blocks)
+	{
+	  xzio->blocks[i].coff = block_off;
+	  xzio->blocks[i].uoff = uncompressed_size_total;
+	}
+      block_off += ALIGN_UP (unpadded_size, 4);
       uncompressed_size_total += uncompressed_size;
     }
 
+  /* The map is only usable if the blocks exactly fill the space before
+     the index, i.e. this is a single stream without padding.  */
+  if (xzio->blocks && block_off == xzio->index_off)
+    xzio->nblocks = i;
+  else
+    {
+      grub_free (xzio->blocks);
+      xzio->blocks = NULL;
+    }
+
   file->size = uncompressed_size_total;
   grub_file_seek (xzio->file, STREAM_HEADER_SIZE);
   return 1;
 
 ERROR:
+  grub_free (xzio->blocks);
+  xzio->blocks = NULL;
   return 0;
 }
 
+/* Index of the last block starting at or before OFFSET.  */
+static grub_size_t
+find_block (grub_xzio_t xzio, grub_off_t offset)
+{
+  grub_size_t lo = 0, hi = xzio->nblocks;
+
+  while (hi - lo > 1)
+    {
+      grub_size_t mid = (lo + hi) / 2;
+
+      if (xzio->blocks[mid].uoff <= offset)
+	lo = mid;
+      else
+	hi = mid;
+    }
+  return lo;
+}
+
+/* Restart the decoder at block B.  For any block but the first the
+   stream header is replayed and the input cut off before the index.  */
+static void
+jump_block (grub_xzio_t xzio, grub_size_t b)
+{
+  xz_dec_reset (xzio->dec);
+  xzio->buf.out_pos = 0;
+  xzio->buf.in_pos = 0;
+
+  if (b == 0)
+    {
+      xzio->saved_offset = 0;
+      xzio->buf.in_size = 0;
+      xzio->skip_index = 0;
+      grub_file_seek (xzio->file, 0);
+      return;
+    }
+
+  grub_memcpy (xzio->inbuf, xzio->header, STREAM_HEADER_SIZE);
+  xzio->buf.in_size = STREAM_HEADER_SIZE;
+  xzio->saved_offset = xzio->blocks[b].uoff;
+  xzio->skip_index = 1;
+  grub_file_seek (xzio->file, xzio->blocks[b].coff);
+}
+
 static grub_file_t
 grub_xzio_open (grub_file_t io,
 		const char *name __attribute__ ((unused)))
@@ -217,6 +309,7 @@ grub_xzio_open (grub_file_t io,
       grub_errno = GRUB_ERR_NONE;
       grub_file_seek (io, 0);
       xz_dec_end (xzio->dec);
+      grub_free (xzio->blocks);
       grub_free (xzio);
       grub_free (file);
 
@@ -227,7 +320,7 @@ grub_xzio_open (grub_file_t io,
 }
 
 static grub_ssize_t
-grub_xzio_read (grub_file_t file, char *buf, grub_size_t len)
+grub_xzio_read_real (grub_file_t file, char *buf, grub_size_t len)
 {
   grub_ssize_t ret = 0;
   grub_ssize_t readret;
@@ -235,29 +328,54 @@ grub_xzio_read (grub_file_t file, char *buf, grub_size_t len)
   grub_xzio_t xzio = file->data;
   grub_off_t current_offset;
 
-  /* If seek backward need to reset decoder and start from beginning of file.
-     TODO Possible improvement by jumping blocks.  */
-  if (file->offset < xzio->saved_offset)
+  /* On a backward seek, or a forward one past the current block, restart
+     at the block holding the offset.  Without a block map a backward
+     seek has to start over from the beginning of the file.  */
+  if (xzio->nblocks)
     {
-      xz_dec_reset (xzio->dec);
-      xzio->saved_offset = 0;
-      xzio->buf.out_pos = 0;
-      xzio->buf.in_pos = 0;
-      xzio->buf.in_size = 0;
-      grub_file_seek (xzio->file, 0);
+      grub_size_t b = find_block (xzio, file->offset);
+
+      if (file->offset < xzio->saved_offset
+	  || b > find_block (xzio, xzio->saved_offset))
+	jump_block (xzio, b);
     }
+  else if (file->offset < xzio->saved_offset)
+    jump_block (xzio, 0);
 
   current_offset = xzio->saved_offset;
 
   while (len > 0)
     {
-      xzio->buf.out_size = file->offset + ret + len - current_offset;
-      if (xzio->buf.out_size > XZBUFSIZ)
-	xzio->buf.out_size = XZBUFSIZ;
+      /* The decoder keeps its own dictionary, so once the data wanted is
+	 next let it write into the caller's buffer.  */
+      if (current_offset == file->offset + ret)
+	{
+	  xzio->buf.out = (grub_uint8_t *) buf;
+	  xzio->buf.out_size = len;
+	}
+      else
+	{
+	  xzio->buf.out = xzio->outbuf;
+	  xzio->buf.out_size = file->offset + ret + len - current_offset;
+	  if (xzio->buf.out_size > XZBUFSIZ)
+	    xzio->buf.out_size = XZBUFSIZ;
+	}
       /* Feed input.  */
       if (xzio->buf.in_pos == xzio->buf.in_size)
 	{
-	  readret = grub_file_read (xzio->file, xzio->inbuf, XZBUFSIZ);
+	  grub_size_t toread = XZBUFSIZ;
+
+	  if (xzio->skip_index)
+	    {
+	      grub_off_t pos = grub_file_tell (xzio->file);
+
+	      /* The rest is the index; let the decoder drain.  */
+	      if (pos >= xzio->index_off)
+		toread = 0;
+	      else if (toread > xzio->index_off - pos)
+		toread = xzio->index_off - pos;
+	    }
+	  readret = grub_file_read (xzio->file, xzio->inbuf, toread);
 	  if (readret < 0)
 	    return -1;
 	  xzio->buf.in_size = readret;
@@ -265,6 +383,9 @@ grub_xzio_read (grub_file_t file, char *buf, grub_size_t len)
 	}
 
       xzret = xz_dec_run (xzio->dec, &xzio->buf);
+      if (xzio->skip_index && xzio->buf.in_size == 0
+	  && xzio->buf.out_pos == 0)
+	break;
       switch (xzret)
 	{
 	case XZ_MEMLIMIT_ERROR:
@@ -286,8 +407,9 @@ grub_xzio_read (grub_file_t file, char *buf, grub_size_t len)
 	  /* Store first chunk of data in buffer.  */
 	  {
 	    grub_size_t delta = new_offset - (file->offset + ret);
-	    grub_memmove (buf, xzio->buf.out + (xzio->buf.out_pos - delta),
-			  delta);
+	    if (xzio->buf.out != (grub_uint8_t *) buf)
+	      grub_memmove (buf, xzio->buf.out + (xzio->buf.out_pos - delta),
+			    delta);
 	    len -= delta;
 	    buf += delta;
 	    ret += delta;
@@ -300,12 +422,26 @@ grub_xzio_read (grub_file_t file, char *buf, grub_size_t len)
 	break;
     }
 
+  xzio->buf.out = xzio->outbuf;
+
   if (ret >= 0)
     xzio->saved_offset = file->offset + ret;
 
   return ret;
 }
 
+static grub_ssize_t
+grub_xzio_read (grub_file_t file, char *buf, grub_size_t len)
+{
+  grub_ssize_t ret;
+  grub_boot_span_t span;
+
+  span = grub_boot_span_begin ("Decompressing %s", file->name);
+  ret = grub_xzio_read_real (file, buf, len);
+  grub_boot_span_end (span, ret > 0 ? ret : 0);
+  return ret;
+}
+
 /* Release everything, including the underlying file object.  */
 static grub_err_t
 grub_xzio_close (grub_file_t file)
@@ -315,6 +451,7 @@ grub_xzio_close (grub_file_t file)
   xz_dec_end (xzio->dec);
 
   grub_file_close (xzio->file);
+  grub_free (xzio->blocks);
   grub_free (xzio);
 
   /* Device must not be closed twice.  */
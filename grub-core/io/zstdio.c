@@ -0,0 +1,1632 @@
+/* zstdio.c - decompression support for zstd */
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2026  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* The decoder follows RFC 8878.  A compressed file is a sequence of
+   frames; the frame boundaries are indexed when the file is opened,
+   either from the seek table of the seekable format or by walking the
+   block headers, so that a seek only has to decompress from the start
+   of the frame holding the target offset.  Content checksums are
+   skipped, not verified.  */
+
+#include <grub/err.h>
+#include <grub/types.h>
+#include <grub/mm.h>
+#include <grub/misc.h>
+#include <grub/fs.h>
+#include <grub/file.h>
+#include <grub/dl.h>
+#include <grub/zstd.h>
+#include <grub/i18n.h>
+
+GRUB_MOD_LICENSE ("GPLv3+");
+
+#define ZSTD_MAGIC		0xfd2fb528
+#define ZSTD_SKIPPABLE_MAGIC	0x184d2a50
+#define ZSTD_SKIPPABLE_MASK	0xfffffff0
+#define ZSTD_SEEKTABLE_MAGIC	0x184d2a5e
+#define ZSTD_SEEKABLE_MAGIC	0x8f92eab1
+#define ZSTD_SEEKABLE_FOOTER	9
+
+#define ZSTD_BLOCK_MAX		(128 * 1024)
+#define ZSTD_WINDOW_LOG_MAX	27
+
+enum
+  {
+    ZSTD_BLOCK_RAW,
+    ZSTD_BLOCK_RLE,
+    ZSTD_BLOCK_COMPRESSED,
+    ZSTD_BLOCK_RESERVED
+  };
+
+enum
+  {
+    ZSTD_LIT_RAW,
+    ZSTD_LIT_RLE,
+    ZSTD_LIT_COMPRESSED,
+    ZSTD_LIT_TREELESS
+  };
+
+enum
+  {
+    ZSTD_SEQ_PREDEFINED,
+    ZSTD_SEQ_RLE,
+    ZSTD_SEQ_FSE,
+    ZSTD_SEQ_REPEAT
+  };
+
+#define ZSTD_HUF_LOG_MAX	11
+#define ZSTD_FSE_LOG_MAX	9
+#define ZSTD_WEIGHT_LOG_MAX	6
+#define ZSTD_LL_MAX		35
+#define ZSTD_ML_MAX		52
+#define ZSTD_OF_MAX		31
+#define ZSTD_LL_LOG_MAX		9
+#define ZSTD_ML_LOG_MAX		9
+#define ZSTD_OF_LOG_MAX		8
+
+static const grub_uint32_t ll_base[ZSTD_LL_MAX + 1] =
+  {
+    0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15,
+    16, 18, 20, 22, 24, 28, 32, 40, 48, 64, 128, 256, 512, 1024, 2048,
+    4096, 8192, 16384, 32768, 65536
+  };
+
+static const grub_uint8_t ll_bits[ZSTD_LL_MAX + 1] =
+  {
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    1, 1, 1, 1, 2, 2, 3, 3, 4, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16
+  };
+
+static const grub_uint32_t ml_base[ZSTD_ML_MAX + 1] =
+  {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 17, 18,
+    19, 20, 21, 22, 23, 24, 25, 26, 27, 28, 29, 30, 31, 32, 33, 34,
+    35, 37, 39, 41, 43, 47, 51, 59, 67, 83, 99, 131, 259, 515, 1027, 2051,
+    4099, 8195, 16387, 32771, 65539
+  };
+
+static const grub_uint8_t ml_bits[ZSTD_ML_MAX + 1] =
+  {
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    1, 1, 1, 1, 2, 2, 3, 3, 4, 4, 5, 7, 8, 9, 10, 11,
+    12, 13, 14, 15, 16
+  };
+
+/* Predefined distributions, RFC 8878 section 3.1.1.3.2.2.  */
+static const grub_int16_t ll_default[ZSTD_LL_MAX + 1] =
+  {
+    4, 3, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 1, 1, 1,
+    2, 2, 2, 2, 2, 2, 2, 2, 2, 3, 2, 1, 1, 1, 1, 1,
+    -1, -1, -1, -1
+  };
+
+static const grub_int16_t ml_default[ZSTD_ML_MAX + 1] =
+  {
+    1, 4, 3, 2, 2, 2, 2, 2, 2, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, -1, -1,
+    -1, -1, -1, -1, -1
+  };
+
+static const grub_int16_t of_default[29] =
+  {
+    1, 1, 1, 1, 1, 1, 2, 2, 2, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, -1, -1, -1, -1, -1
+  };
+
+struct zstd_fse_entry
+{
+  grub_uint16_t new_state;
+  grub_uint8_t symbol;
+  grub_uint8_t nbits;
+};
+
+struct zstd_fse_table
+{
+  int valid;
+  unsigned log;
+  struct zstd_fse_entry e[1 << ZSTD_FSE_LOG_MAX];
+};
+
+struct zstd_huf_entry
+{
+  grub_uint8_t symbol;
+  grub_uint8_t nbits;
+};
+
+struct zstd_huf_table
+{
+  int valid;
+  unsigned log;
+  struct zstd_huf_entry e[1 << ZSTD_HUF_LOG_MAX];
+};
+
+/* State carried from one block of a frame to the next.  */
+struct zstd_entropy
+{
+  struct zstd_huf_table huf;
+  struct zstd_fse_table ll;
+  struct zstd_fse_table of;
+  struct zstd_fse_table ml;
+  grub_uint32_t rep[3];
+  grub_uint8_t lit[ZSTD_BLOCK_MAX];
+};
+
+struct zstd_frame_header
+{
+  grub_uint64_t content_size;
+  grub_uint64_t window_size;
+  grub_size_t size;
+  int checksum;
+};
+
+#define ZSTD_CONTENT_SIZE_UNKNOWN ((grub_uint64_t) -1)
+
+struct zstd_frame
+{
+  /* Offset of the frame header in the compressed stream.  */
+  grub_off_t coff;
+  /* Offset of the first byte of the frame in the uncompressed stream.  */
+  grub_off_t uoff;
+};
+
+struct grub_zstdio
+{
+  /* The underlying file object.  */
+  grub_file_t file;
+  /* If input is in memory following fields are used instead of file.  */
+  const grub_uint8_t *mem_input;
+  grub_size_t mem_input_size;
+  /* One compressed block, for file input.  */
+  grub_uint8_t *cbuf;
+
+  /* Frames known so far, in stream order.  */
+  struct zstd_frame *frames;
+  unsigned nframes;
+  unsigned frames_alloc;
+  /* Set once FRAMES lists every frame of the stream.  */
+  int index_complete;
+  /* Uncompressed size, if the index was completed at open time.  */
+  grub_off_t size;
+
+  /* The frame being decoded.  */
+  int active;
+  int frame_done;
+  unsigned cur;
+  grub_off_t cpos;
+  struct zstd_frame_header hdr;
+
+  /* Decoded data of the current frame; WIN[0] is at WIN_UOFF.  At least
+     one window size of history is kept when the buffer is slid.  */
+  grub_uint8_t *win;
+  grub_size_t win_alloc;
+  grub_size_t win_len;
+  grub_off_t win_uoff;
+
+  struct zstd_entropy ent;
+};
+typedef struct grub_zstdio *grub_zstdio_t;
+
+static struct grub_fs grub_zstdio_fs;
+
+static unsigned
+highbit (grub_uint32_t v)
+{
+  unsigned n = 0;
+
+  while (v >>= 1)
+    n++;
+  return n;
+}
+
+static grub_err_t
+corrupted (void)
+{
+  return grub_error (GRUB_ERR_BAD_COMPRESSED_DATA, N_("zstd data corrupted"));
+}
+
+/* Backward bit stream: the last byte holds a marker bit above the first
+   bits to be read, and reading proceeds towards the first byte.  */
+struct zstd_bits
+{
+  const grub_uint8_t *start;
+  const grub_uint8_t *ptr;
+  grub_uint64_t container;
+  unsigned consumed;
+};
+
+static grub_err_t
+bits_init (struct zstd_bits *br, const grub_uint8_t *src, grub_size_t size)
+{
+  grub_uint8_t last;
+
+  if (size == 0 || src[size - 1] == 0)
+    return corrupted ();
+  last = src[size - 1];
+
+  br->start = src;
+  if (size >= sizeof (br->container))
+    {
+      br->ptr = src + size - sizeof (br->container);
+      br->container = grub_le_to_cpu64 (grub_get_unaligned64 (br->ptr));
+      br->consumed = 0;
+    }
+  else
+    {
+      grub_size_t i;
+
+      br->ptr = src;
+      br->container = 0;
+      for (i = 0; i < size; i++)
+	br->container |= (grub_uint64_t) src[i] << (8 * i);
+      br->consumed = (sizeof (br->container) - size) * 8;
+    }
+  br->consumed += 8 - highbit (last);
+  return GRUB_ERR_NONE;
+}
+
+static inline grub_uint64_t
+bits_peek (const struct zstd_bits *br, unsigned n)
+{
+  return ((br->container << (br->consumed & 63)) >> 1) >> (63 - n);
+}
+
+static inline grub_uint64_t
+bits_read (struct zstd_bits *br, unsigned n)
+{
+  grub_uint64_t v = bits_peek (br, n);
+
+  br->consumed += n;
+  return v;
+}
+
+/* Refill the container so that at least 57 bits are available, unless
+   the stream is nearly exhausted.  Returns nonzero once more bits have
+   been consumed than the stream holds.  */
+static inline int
+bits_reload (struct zstd_bits *br)
+{
+  if (br->consumed > 64)
+    return 1;
+
+  if (br->ptr >= br->start + sizeof (br->container))
+    {
+      br->ptr -= br->consumed >> 3;
+      br->consumed &= 7;
+    }
+  else if (br->ptr == br->start)
+    return 0;
+  else
+    {
+      grub_size_t nb = br->consumed >> 3;
+
+      if (nb > (grub_size_t) (br->ptr - br->start))
+	nb = br->ptr - br->start;
+      br->ptr -= nb;
+      br->consumed -= nb * 8;
+    }
+  br->container = grub_le_to_cpu64 (grub_get_unaligned64 (br->ptr));
+  return 0;
+}
+
+static inline int
+bits_finished (struct zstd_bits *br)
+{
+  bits_reload (br);
+  return br->ptr == br->start && br->consumed == 64;
+}
+
+/* Parse the normalized counts of an FSE table description.  */
+static grub_err_t
+fse_read_counts (const grub_uint8_t *src, grub_size_t size,
+		 grub_int16_t *norm, unsigned *nsym, unsigned max_sym,
+		 unsigned *log, unsigned max_log, grub_size_t *used)
+{
+  grub_size_t bitpos = 0;
+  int remaining, threshold;
+  unsigned nbits, s = 0;
+  int prev0 = 0;
+
+/* Little-endian bits starting at BITPOS, reading zeros past the end.  */
+#define PEEK32()							\
+  ({									\
+    grub_uint32_t v_ = 0;						\
+    unsigned i_;							\
+    for (i_ = 0; i_ < 4 && (bitpos >> 3) + i_ < size; i_++)		\
+      v_ |= (grub_uint32_t) src[(bitpos >> 3) + i_] << (8 * i_);	\
+    v_ >> (bitpos & 7);							\
+  })
+
+  if (size < 1)
+    return corrupted ();
+
+  *log = (PEEK32 () & 0xf) + 5;
+  bitpos += 4;
+  if (*log > max_log)
+    return corrupted ();
+
+  remaining = (1 << *log) + 1;
+  threshold = 1 << *log;
+  nbits = *log + 1;
+
+  while (remaining > 1 && s <= max_sym)
+    {
+      int max, count;
+
+      if (prev0)
+	{
+	  unsigned repeat, i;
+
+	  /* Two-bit flags give runs of zero probabilities; 3 means the
+	     run continues.  */
+	  do
+	    {
+	      repeat = PEEK32 () & 3;
+	      bitpos += 2;
+	      if (s + repeat > max_sym + 1)
+		return corrupted ();
+	      for (i = 0; i < repeat; i++)
+		norm[s++] = 0;
+	    }
+	  while (repeat == 3);
+	  if (s > max_sym)
+	    return corrupted ();
+	}
+
+      max = (2 * threshold - 1) - remaining;
+      count = PEEK32 () & (threshold - 1);
+      if (count < max)
+	bitpos += nbits - 1;
+      else
+	{
+	  count = PEEK32 () & (2 * threshold - 1);
+	  if (count >= threshold)
+	    count -= max;
+	  bitpos += nbits;
+	}
+      count--;
+      remaining -= count < 0 ? -count : count;
+      norm[s++] = count;
+      prev0 = (count == 0);
+      while (remaining < threshold)
+	{
+	  nbits--;
+	  threshold >>= 1;
+	}
+    }
+#undef PEEK32
+
+  if (remaining != 1 || bitpos > size * 8)
+    return corrupted ();
+
+  *nsym = s;
+  *used = (bitpos + 7) >> 3;
+  return GRUB_ERR_NONE;
+}
+
+/* Spread the symbols of a normalized distribution over a decoding
+   table, RFC 8878 section 4.1.1.  */
+static grub_err_t
+fse_build (struct zstd_fse_table *t, const grub_int16_t *norm,
+	   unsigned nsym, unsigned log)
+{
+  grub_uint16_t next[256];
+  unsigned size = 1 << log;
+  unsigned high = size - 1;
+  unsigned step = (size >> 1) + (size >> 3) + 3;
+  unsigned pos = 0, s, u;
+
+  for (s = 0; s < nsym; s++)
+    if (norm[s] == -1)
+      {
+	t->e[high--].symbol = s;
+	next[s] = 1;
+      }
+    else
+      next[s] = norm[s];
+
+  for (s = 0; s < nsym; s++)
+    {
+      int i;
+
+      for (i = 0; i < norm[s]; i++)
+	{
+	  t->e[pos].symbol = s;
+	  do
+	    pos = (pos + step) & (size - 1);
+	  while (pos > high);
+	}
+    }
+  if (pos != 0)
+    return corrupted ();
+
+  for (u = 0; u < size; u++)
+    {
+      unsigned n = next[t->e[u].symbol]++;
+      unsigned nb = log - highbit (n);
+
+      t->e[u].nbits = nb;
+      t->e[u].new_state = (n << nb) - size;
+    }
+  t->log = log;
+  t->valid = 1;
+  return GRUB_ERR_NONE;
+}
+
+static inline unsigned
+fse_update (const struct zstd_fse_table *t, unsigned state,
+	    struct zstd_bits *br)
+{
+  const struct zstd_fse_entry *e = &t->e[state];
+
+  return e->new_state + bits_read (br, e->nbits);
+}
+
+/* Decode the FSE compressed Huffman weights, RFC 8878 section 4.2.1.2.  */
+static grub_err_t
+read_weights_fse (const grub_uint8_t *src, grub_size_t size,
+		  grub_uint8_t *weights, unsigned *nw)
+{
+  struct zstd_fse_table t;
+  grub_int16_t norm[256];
+  unsigned nsym, log, s1, s2, n = 0;
+  grub_size_t used;
+  struct zstd_bits br;
+
+  if (fse_read_counts (src, size, norm, &nsym, 255, &log,
+		       ZSTD_WEIGHT_LOG_MAX, &used)
+      || fse_build (&t, norm, nsym, log)
+      || bits_init (&br, src + used, size - used))
+    return grub_errno;
+
+  s1 = bits_read (&br, log);
+  s2 = bits_read (&br, log);
+  bits_reload (&br);
+  for (;;)
+    {
+      if (n > 253)
+	return corrupted ();
+      weights[n++] = t.e[s1].symbol;
+      s1 = fse_update (&t, s1, &br);
+      if (bits_reload (&br))
+	{
+	  weights[n++] = t.e[s2].symbol;
+	  break;
+	}
+      if (n > 253)
+	return corrupted ();
+      weights[n++] = t.e[s2].symbol;
+      s2 = fse_update (&t, s2, &br);
+      if (bits_reload (&br))
+	{
+	  weights[n++] = t.e[s1].symbol;
+	  break;
+	}
+    }
+  *nw = n;
+  return GRUB_ERR_NONE;
+}
+
+static grub_err_t
+read_huffman_table (struct zstd_huf_table *huf, const grub_uint8_t *src,
+		    grub_size_t size, grub_size_t *used)
+{
+  grub_uint8_t weights[256];
+  unsigned rank_start[ZSTD_HUF_LOG_MAX + 2];
+  unsigned nw = 0, i, w, maxbits;
+  grub_uint32_t sum = 0, rest;
+
+  if (size < 1)
+    return corrupted ();
+
+  if (src[0] >= 128)
+    {
+      nw = src[0] - 127;
+      *used = 1 + (nw + 1) / 2;
+      if (size < *used)
+	return corrupted ();
+      for (i = 0; i < nw; i++)
+	weights[i] = (i & 1) ? src[1 + i / 2] & 0xf : src[1 + i / 2] >> 4;
+    }
+  else
+    {
+      *used = 1 + src[0];
+      if (size < *used
+	  || read_weights_fse (src + 1, src[0], weights, &nw))
+	return corrupted ();
+    }
+
+  for (i = 0; i < nw; i++)
+    {
+      if (weights[i] > ZSTD_HUF_LOG_MAX)
+	return corrupted ();
+      if (weights[i])
+	sum += 1 << (weights[i] - 1);
+    }
+  if (sum == 0)
+    return corrupted ();
+
+  /* The weight of the last symbol makes the total a power of two.  */
+  maxbits = highbit (sum) + 1;
+  if (maxbits > ZSTD_HUF_LOG_MAX)
+    return corrupted ();
+  rest = (1 << maxbits) - sum;
+  if (rest & (rest - 1))
+    return corrupted ();
+  weights[nw++] = highbit (rest) + 1;
+
+  /* Longest codes come first; each symbol of weight W fills 2^(W-1)
+     consecutive entries.  */
+  grub_memset (rank_start, 0, sizeof (rank_start));
+  for (i = 0; i < nw; i++)
+    if (weights[i])
+      rank_start[weights[i] + 1] += 1 << (weights[i] - 1);
+  for (w = 2; w <= ZSTD_HUF_LOG_MAX + 1; w++)
+    rank_start[w] += rank_start[w - 1];
+
+  for (i = 0; i < nw; i++)
+    {
+      unsigned u, len;
+
+      w = weights[i];
+      if (!w)
+	continue;
+      len = 1 << (w - 1);
+      for (u = rank_start[w]; u < rank_start[w] + len; u++)
+	{
+	  huf->e[u].symbol = i;
+	  huf->e[u].nbits = maxbits + 1 - w;
+	}
+      rank_start[w] += len;
+    }
+  huf->log = maxbits;
+  huf->valid = 1;
+  return GRUB_ERR_NONE;
+}
+
+static grub_err_t
+decode_huffman_stream (const struct zstd_huf_table *huf,
+		       const grub_uint8_t *src, grub_size_t size,
+		       grub_uint8_t *out, grub_size_t n)
+{
+  const struct zstd_huf_entry *e;
+  grub_uint8_t *end = out + n;
+  unsigned log = huf->log;
+  struct zstd_bits br;
+
+  if (bits_init (&br, src, size))
+    return grub_errno;
+
+/* Four symbols of at most 11 bits fit in a freshly reloaded container.  */
+#define DECODE_SYMBOL()				\
+  e = &huf->e[bits_peek (&br, log)];		\
+  *out++ = e->symbol;				\
+  br.consumed += e->nbits
+
+  while (end - out >= 4)
+    {
+      bits_reload (&br);
+      DECODE_SYMBOL ();
+      DECODE_SYMBOL ();
+      DECODE_SYMBOL ();
+      DECODE_SYMBOL ();
+    }
+  while (out < end)
+    {
+      bits_reload (&br);
+      DECODE_SYMBOL ();
+    }
+#undef DECODE_SYMBOL
+
+  if (!bits_finished (&br))
+    return corrupted ();
+  return GRUB_ERR_NONE;
+}
+
+/* Decode the literals section of a block at SRC, RFC 8878 section
+   3.1.1.3.1.  */
+static grub_err_t
+decode_literals (struct zstd_entropy *ent, const grub_uint8_t *src,
+		 grub_size_t size, grub_size_t *used,
+		 const grub_uint8_t **lits, grub_size_t *nlits)
+{
+  unsigned type, format, streams;
+  grub_size_t hsize, regen, csize, tsize = 0;
+  grub_uint32_t h;
+
+  if (size < 1)
+    return corrupted ();
+  type = src[0] & 3;
+  format = (src[0] >> 2) & 3;
+
+  if (type == ZSTD_LIT_RAW || type == ZSTD_LIT_RLE)
+    {
+      switch (format)
+	{
+	case 1:
+	  hsize = 2;
+	  if (size < hsize)
+	    return corrupted ();
+	  regen = (src[0] >> 4) | (src[1] << 4);
+	  break;
+	case 3:
+	  hsize = 3;
+	  if (size < hsize)
+	    return corrupted ();
+	  regen = (src[0] >> 4) | (src[1] << 4) | ((grub_size_t) src[2] << 12);
+	  break;
+	default:
+	  hsize = 1;
+	  regen = src[0] >> 3;
+	  break;
+	}
+      if (regen > ZSTD_BLOCK_MAX)
+	return corrupted ();
+
+      if (type == ZSTD_LIT_RAW)
+	{
+	  if (size - hsize < regen)
+	    return corrupted ();
+	  *lits = src + hsize;
+	  *used = hsize + regen;
+	}
+      else
+	{
+	  if (size - hsize < 1)
+	    return corrupted ();
+	  grub_memset (ent->lit, src[hsize], regen);
+	  *lits = ent->lit;
+	  *used = hsize + 1;
+	}
+      *nlits = regen;
+      return GRUB_ERR_NONE;
+    }
+
+  hsize = format < 2 ? 3 : format + 2;
+  if (size < hsize)
+    return corrupted ();
+  h = src[0] | (src[1] << 8) | (src[2] << 16);
+  streams = format == 0 ? 1 : 4;
+  switch (format)
+    {
+    case 0:
+    case 1:
+      regen = (h >> 4) & 0x3ff;
+      csize = (h >> 14) & 0x3ff;
+      break;
+    case 2:
+      h |= (grub_uint32_t) src[3] << 24;
+      regen = (h >> 4) & 0x3fff;
+      csize = h >> 18;
+      break;
+    default:
+      h |= (grub_uint32_t) src[3] << 24;
+      regen = (h >> 4) & 0x3ffff;
+      csize = (h >> 22) | ((grub_size_t) src[4] << 10);
+      break;
+    }
+  if (regen > ZSTD_BLOCK_MAX || csize > size - hsize)
+    return corrupted ();
+  src += hsize;
+  *used = hsize + csize;
+
+  if (type == ZSTD_LIT_COMPRESSED)
+    {
+      if (read_huffman_table (&ent->huf, src, csize, &tsize))
+	return grub_errno;
+      src += tsize;
+      csize -= tsize;
+    }
+  else if (!ent->huf.valid)
+    return corrupted ();
+
+  if (streams == 1)
+    {
+      if (decode_huffman_stream (&ent->huf, src, csize, ent->lit, regen))
+	return grub_errno;
+    }
+  else
+    {
+      grub_size_t sizes[4], seg = (regen + 3) / 4;
+      unsigned i;
+
+      if (csize < 6 || 3 * seg > regen)
+	return corrupted ();
+      sizes[0] = grub_le_to_cpu16 (grub_get_unaligned16 (src));
+      sizes[1] = grub_le_to_cpu16 (grub_get_unaligned16 (src + 2));
+      sizes[2] = grub_le_to_cpu16 (grub_get_unaligned16 (src + 4));
+      src += 6;
+      csize -= 6;
+      if (sizes[0] + sizes[1] + sizes[2] > csize)
+	return corrupted ();
+      sizes[3] = csize - sizes[0] - sizes[1] - sizes[2];
+
+      for (i = 0; i < 4; i++)
+	{
+	  if (decode_huffman_stream (&ent->huf, src, sizes[i],
+				     ent->lit + i * seg,
+				     i < 3 ? seg : regen - 3 * seg))
+	    return grub_errno;
+	  src += sizes[i];
+	}
+    }
+
+  *lits = ent->lit;
+  *nlits = regen;
+  return GRUB_ERR_NONE;
+}
+
+static grub_err_t
+read_seq_table (struct zstd_fse_table *t, unsigned mode,
+		const grub_uint8_t **src, const grub_uint8_t *end,
+		const grub_int16_t *predef, unsigned predef_nsym,
+		unsigned predef_log, unsigned max_sym, unsigned max_log)
+{
+  grub_int16_t norm[ZSTD_ML_MAX + 1];
+  unsigned nsym, log;
+  grub_size_t used;
+
+  switch (mode)
+    {
+    case ZSTD_SEQ_PREDEFINED:
+      return fse_build (t, predef, predef_nsym, predef_log);
+
+    case ZSTD_SEQ_RLE:
+      if (*src >= end || **src > max_sym)
+	return corrupted ();
+      t->e[0].symbol = **src;
+      t->e[0].nbits = 0;
+      t->e[0].new_state = 0;
+      t->log = 0;
+      t->valid = 1;
+      (*src)++;
+      return GRUB_ERR_NONE;
+
+    case ZSTD_SEQ_FSE:
+      if (fse_read_counts (*src, end - *src, norm, &nsym, max_sym,
+			   &log, max_log, &used))
+	return grub_errno;
+      *src += used;
+      return fse_build (t, norm, nsym, log);
+
+    default:
+      if (!t->valid)
+	return corrupted ();
+      return GRUB_ERR_NONE;
+    }
+}
+
+/* Copy a match of LEN bytes from DIST bytes back; the two may overlap.  */
+static void
+copy_match (grub_uint8_t *dest, grub_size_t dist, grub_size_t len)
+{
+  const grub_uint8_t *src = dest - dist;
+
+  if (dist >= sizeof (grub_uint64_t))
+    for (; len >= sizeof (grub_uint64_t); len -= sizeof (grub_uint64_t))
+      {
+	grub_set_unaligned64 (dest, grub_get_unaligned64 (src));
+	dest += sizeof (grub_uint64_t);
+	src += sizeof (grub_uint64_t);
+      }
+  while (len--)
+    *dest++ = *src++;
+}
+
+/* Decode a compressed block and append it to OUT at *POS, where
+   OUT[0..*POS) is the history the block may refer to.  */
+static grub_err_t
+decode_compressed_block (struct zstd_entropy *ent, const grub_uint8_t *src,
+			 grub_size_t size, grub_uint8_t *out,
+			 grub_size_t *pos, grub_size_t out_size)
+{
+  const grub_uint8_t *end = src + size;
+  const grub_uint8_t *lits = NULL, *lits_end;
+  grub_size_t nlits = 0, used = 0, nseq, i;
+  grub_size_t op = *pos;
+  struct zstd_bits br;
+  unsigned ll_state, of_state, ml_state, modes;
+
+  if (decode_literals (ent, src, size, &used, &lits, &nlits))
+    return grub_errno;
+  src += used;
+  lits_end = lits + nlits;
+
+  if (src >= end)
+    return corrupted ();
+  nseq = *src++;
+  if (nseq >= 128)
+    {
+      if (src >= end)
+	return corrupted ();
+      if (nseq == 255)
+	{
+	  if (end - src < 2)
+	    return corrupted ();
+	  nseq = src[0] + (src[1] << 8) + 0x7f00;
+	  src += 2;
+	}
+      else
+	nseq = ((nseq - 128) << 8) + *src++;
+    }
+
+  if (nseq)
+    {
+      if (src >= end)
+	return corrupted ();
+      modes = *src++;
+      if ((modes & 3)
+	  || read_seq_table (&ent->ll, modes >> 6, &src, end, ll_default,
+			     ZSTD_LL_MAX + 1, 6, ZSTD_LL_MAX, ZSTD_LL_LOG_MAX)
+	  || read_seq_table (&ent->of, (modes >> 4) & 3, &src, end,
+			     of_default, ARRAY_SIZE (of_default), 5,
+			     ZSTD_OF_MAX, ZSTD_OF_LOG_MAX)
+	  || read_seq_table (&ent->ml, (modes >> 2) & 3, &src, end,
+			     ml_default, ZSTD_ML_MAX + 1, 6, ZSTD_ML_MAX,
+			     ZSTD_ML_LOG_MAX))
+	return corrupted ();
+
+      if (bits_init (&br, src, end - src))
+	return grub_errno;
+      ll_state = bits_read (&br, ent->ll.log);
+      of_state = bits_read (&br, ent->of.log);
+      ml_state = bits_read (&br, ent->ml.log);
+      bits_reload (&br);
+
+      for (i = 0; i < nseq; i++)
+	{
+	  unsigned ofc = ent->of.e[of_state].symbol;
+	  unsigned mlc = ent->ml.e[ml_state].symbol;
+	  unsigned llc = ent->ll.e[ll_state].symbol;
+	  grub_uint32_t offset, ml, ll;
+
+	  offset = ((grub_uint32_t) 1 << ofc) + bits_read (&br, ofc);
+	  bits_reload (&br);
+	  ml = ml_base[mlc] + bits_read (&br, ml_bits[mlc]);
+	  ll = ll_base[llc] + bits_read (&br, ll_bits[llc]);
+	  bits_reload (&br);
+
+	  if (offset > 3)
+	    {
+	      ent->rep[2] = ent->rep[1];
+	      ent->rep[1] = ent->rep[0];
+	      ent->rep[0] = offset - 3;
+	    }
+	  else
+	    {
+	      unsigned idx = offset - 1 + (ll == 0);
+
+	      if (idx)
+		{
+		  offset = idx == 3 ? ent->rep[0] - 1 : ent->rep[idx];
+		  if (idx > 1)
+		    ent->rep[2] = ent->rep[1];
+		  ent->rep[1] = ent->rep[0];
+		  ent->rep[0] = offset;
+		}
+	    }
+	  offset = ent->rep[0];
+
+	  if (i + 1 < nseq)
+	    {
+	      ll_state = fse_update (&ent->ll, ll_state, &br);
+	      ml_state = fse_update (&ent->ml, ml_state, &br);
+	      of_state = fse_update (&ent->of, of_state, &br);
+	      bits_reload (&br);
+	    }
+
+	  if (ll > (grub_size_t) (lits_end - lits)
+	      || ll + ml > out_size - op)
+	    return corrupted ();
+	  grub_memcpy (out + op, lits, ll);
+	  lits += ll;
+	  op += ll;
+
+	  if (offset == 0 || offset > op)
+	    return corrupted ();
+	  copy_match (out + op, offset, ml);
+	  op += ml;
+	}
+
+      if (!bits_finished (&br))
+	return corrupted ();
+    }
+
+  if ((grub_size_t) (lits_end - lits) > out_size - op)
+    return corrupted ();
+  grub_memcpy (out + op, lits, lits_end - lits);
+  op += lits_end - lits;
+
+  *pos = op;
+  return GRUB_ERR_NONE;
+}
+
+/* Return a pointer to LEN bytes of compressed input at OFF.  */
+static const grub_uint8_t *
+input_get (grub_zstdio_t zstdio, grub_off_t off, grub_size_t len)
+{
+  if (zstdio->mem_input)
+    {
+      if (off > zstdio->mem_input_size
+	  || len > zstdio->mem_input_size - off)
+	{
+	  corrupted ();
+	  return NULL;
+	}
+      return zstdio->mem_input + off;
+    }
+
+  if (len > ZSTD_BLOCK_MAX)
+    {
+      corrupted ();
+      return NULL;
+    }
+  grub_file_seek (zstdio->file, off);
+  if (grub_file_read (zstdio->file, zstdio->cbuf, len) != (grub_ssize_t) len)
+    {
+      if (!grub_errno)
+	corrupted ();
+      return NULL;
+    }
+  return zstdio->cbuf;
+}
+
+static grub_off_t
+input_size (grub_zstdio_t zstdio)
+{
+  if (zstdio->mem_input)
+    return zstdio->mem_input_size;
+  return grub_file_size (zstdio->file);
+}
+
+static grub_err_t
+read_frame_header (grub_zstdio_t zstdio, grub_off_t coff,
+		   struct zstd_frame_header *hdr)
+{
+  const grub_uint8_t *p;
+  unsigned fhd, fcs_size, did_size, single;
+  static const unsigned did_sizes[4] = { 0, 1, 2, 4 };
+  grub_size_t i;
+
+  p = input_get (zstdio, coff, 5);
+  if (!p)
+    return grub_errno;
+  fhd = p[4];
+  if (fhd & 0x08)
+    return corrupted ();
+  single = (fhd >> 5) & 1;
+  did_size = did_sizes[fhd & 3];
+  fcs_size = (fhd >> 6) ? 1U << (fhd >> 6) : single;
+  hdr->checksum = (fhd >> 2) & 1;
+  hdr->size = 5 + !single + did_size + fcs_size;
+
+  p = input_get (zstdio, coff, hdr->size);
+  if (!p)
+    return grub_errno;
+  p += 5;
+
+  if (!single)
+    {
+      grub_uint64_t base = 1ULL << (10 + (*p >> 3));
+
+      hdr->window_size = base + (base / 8) * (*p & 7);
+      p++;
+    }
+
+  for (i = 0; i < did_size; i++)
+    if (*p++)
+      return grub_error (GRUB_ERR_NOT_IMPLEMENTED_YET,
+			 "zstd dictionaries are not supported");
+
+  hdr->content_size = 0;
+  for (i = 0; i < fcs_size; i++)
+    hdr->content_size |= (grub_uint64_t) p[i] << (8 * i);
+  if (fcs_size == 2)
+    hdr->content_size += 256;
+  else if (fcs_size == 0)
+    hdr->content_size = ZSTD_CONTENT_SIZE_UNKNOWN;
+
+  if (single)
+    hdr->window_size = hdr->content_size;
+  if (hdr->window_size > (1 << ZSTD_WINDOW_LOG_MAX))
+    return grub_error (GRUB_ERR_OUT_OF_RANGE, "zstd window too large");
+  return GRUB_ERR_NONE;
+}
+
+/* Find the first zstd frame at or after *COFF, skipping skippable
+   frames.  Returns 1 if there is one and 0 at the end of the stream
+   or before bytes that do not start a frame.  */
+static int
+find_frame (grub_zstdio_t zstdio, grub_off_t *coff)
+{
+  grub_off_t size = input_size (zstdio);
+
+  while (*coff + 4 <= size)
+    {
+      const grub_uint8_t *p = input_get (zstdio, *coff, 4);
+      grub_uint32_t magic;
+
+      if (!p)
+	return -1;
+      magic = grub_le_to_cpu32 (grub_get_unaligned32 (p));
+      if (magic == ZSTD_MAGIC)
+	return 1;
+      if ((magic & ZSTD_SKIPPABLE_MASK) != ZSTD_SKIPPABLE_MAGIC
+	  || *coff + 8 > size)
+	return 0;
+      p = input_get (zstdio, *coff + 4, 4);
+      if (!p)
+	return -1;
+      *coff += 8 + grub_le_to_cpu32 (grub_get_unaligned32 (p));
+    }
+  return 0;
+}
+
+static grub_err_t
+add_frame (grub_zstdio_t zstdio, grub_off_t coff, grub_off_t uoff)
+{
+  if (zstdio->nframes == zstdio->frames_alloc)
+    {
+      struct zstd_frame *n;
+      unsigned alloc = zstdio->frames_alloc ? 2 * zstdio->frames_alloc : 8;
+
+      n = grub_realloc (zstdio->frames, alloc * sizeof (n[0]));
+      if (!n)
+	return grub_errno;
+      zstdio->frames = n;
+      zstdio->frames_alloc = alloc;
+    }
+  zstdio->frames[zstdio->nframes].coff = coff;
+  zstdio->frames[zstdio->nframes].uoff = uoff;
+  zstdio->nframes++;
+  return GRUB_ERR_NONE;
+}
+
+/* Append the frame following the one that ends at COFF, UOFF, or mark
+   the index complete if there is none.  */
+static grub_err_t
+add_next_frame (grub_zstdio_t zstdio, grub_off_t coff, grub_off_t uoff)
+{
+  switch (find_frame (zstdio, &coff))
+    {
+    case 1:
+      return add_frame (zstdio, coff, uoff);
+    case 0:
+      zstdio->index_complete = 1;
+      return GRUB_ERR_NONE;
+    default:
+      return grub_errno;
+    }
+}
+
+/* Build the frame index from a seek table at the end of the stream.  */
+static int
+read_seek_table (grub_zstdio_t zstdio)
+{
+  grub_off_t size = input_size (zstdio), table, coff = 0, uoff = 0;
+  const grub_uint8_t *p;
+  grub_uint32_t nframes, i;
+  grub_size_t esize;
+  grub_uint8_t *entries;
+
+  if (size < ZSTD_SEEKABLE_FOOTER + 8)
+    return 0;
+  p = input_get (zstdio, size - ZSTD_SEEKABLE_FOOTER, ZSTD_SEEKABLE_FOOTER);
+  if (!p || grub_le_to_cpu32 (grub_get_unaligned32 (p + 5))
+      != ZSTD_SEEKABLE_MAGIC || (p[4] & 0x7c))
+    return 0;
+  nframes = grub_le_to_cpu32 (grub_get_unaligned32 (p));
+  esize = (p[4] & 0x80) ? 12 : 8;
+  if (nframes == 0
+      || (grub_off_t) nframes * esize > size - ZSTD_SEEKABLE_FOOTER - 8)
+    return 0;
+
+  table = size - ZSTD_SEEKABLE_FOOTER - 8 - (grub_off_t) nframes * esize;
+  p = input_get (zstdio, table, 8);
+  if (!p || grub_le_to_cpu32 (grub_get_unaligned32 (p))
+      != ZSTD_SEEKTABLE_MAGIC
+      || grub_le_to_cpu32 (grub_get_unaligned32 (p + 4))
+      != nframes * esize + ZSTD_SEEKABLE_FOOTER)
+    return 0;
+
+  entries = grub_malloc (nframes * esize);
+  if (!entries)
+    return -1;
+  if (zstdio->mem_input)
+    grub_memcpy (entries, zstdio->mem_input + table + 8, nframes * esize);
+  else
+    {
+      grub_file_seek (zstdio->file, table + 8);
+      if (grub_file_read (zstdio->file, entries, nframes * esize)
+	  != (grub_ssize_t) (nframes * esize))
+	{
+	  grub_free (entries);
+	  return 0;
+	}
+    }
+
+  for (i = 0; i < nframes; i++)
+    {
+      if (add_frame (zstdio, coff, uoff))
+	{
+	  grub_free (entries);
+	  return -1;
+	}
+      coff += grub_le_to_cpu32 (grub_get_unaligned32 (entries + i * esize));
+      uoff += grub_le_to_cpu32 (grub_get_unaligned32 (entries + i * esize
+						      + 4));
+    }
+  grub_free (entries);
+
+  if (coff != table)
+    {
+      zstdio->nframes = 0;
+      return 0;
+    }
+  zstdio->index_complete = 1;
+  zstdio->size = uoff;
+  return 1;
+}
+
+/* Index the frames by walking the block headers.  Stops at the first
+   frame that does not record its content size; the frames after it are
+   found as decoding reaches them.  */
+static grub_err_t
+index_frames (grub_zstdio_t zstdio)
+{
+  grub_off_t coff = 0, uoff = 0;
+
+  switch (read_seek_table (zstdio))
+    {
+    case 1:
+      return GRUB_ERR_NONE;
+    case 0:
+      grub_errno = GRUB_ERR_NONE;
+      break;
+    default:
+      return grub_errno;
+    }
+
+  for (;;)
+    {
+      struct zstd_frame_header hdr;
+      int last = 0;
+
+      if (add_next_frame (zstdio, coff, uoff))
+	return grub_errno;
+      if (zstdio->index_complete)
+	{
+	  zstdio->size = uoff;
+	  return GRUB_ERR_NONE;
+	}
+      coff = zstdio->frames[zstdio->nframes - 1].coff;
+
+      if (read_frame_header (zstdio, coff, &hdr))
+	return grub_errno;
+      if (hdr.content_size == ZSTD_CONTENT_SIZE_UNKNOWN)
+	return GRUB_ERR_NONE;
+
+      coff += hdr.size;
+      while (!last)
+	{
+	  const grub_uint8_t *p = input_get (zstdio, coff, 3);
+	  grub_uint32_t h;
+
+	  if (!p)
+	    return grub_errno;
+	  h = p[0] | (p[1] << 8) | (p[2] << 16);
+	  last = h & 1;
+	  coff += 3 + (((h >> 1) & 3) == ZSTD_BLOCK_RLE ? 1 : h >> 3);
+	}
+      if (hdr.checksum)
+	coff += 4;
+      uoff += hdr.content_size;
+    }
+}
+
+static grub_err_t
+start_frame (grub_zstdio_t zstdio, unsigned f)
+{
+  zstdio->active = 0;
+  if (read_frame_header (zstdio, zstdio->frames[f].coff, &zstdio->hdr))
+    return grub_errno;
+
+  zstdio->cur = f;
+  zstdio->cpos = zstdio->frames[f].coff + zstdio->hdr.size;
+  zstdio->win_uoff = zstdio->frames[f].uoff;
+  zstdio->win_len = 0;
+  zstdio->frame_done = 0;
+  zstdio->ent.huf.valid = 0;
+  zstdio->ent.ll.valid = 0;
+  zstdio->ent.of.valid = 0;
+  zstdio->ent.ml.valid = 0;
+  zstdio->ent.rep[0] = 1;
+  zstdio->ent.rep[1] = 4;
+  zstdio->ent.rep[2] = 8;
+  zstdio->active = 1;
+  return GRUB_ERR_NONE;
+}
+
+/* Decode the next block of the current frame into OUT at *POS.  */
+static grub_err_t
+read_block (grub_zstdio_t zstdio, grub_uint8_t *out, grub_size_t *pos,
+	    grub_size_t out_size)
+{
+  const grub_uint8_t *p;
+  grub_uint32_t h;
+  grub_size_t bsize;
+
+  p = input_get (zstdio, zstdio->cpos, 3);
+  if (!p)
+    return grub_errno;
+  h = p[0] | (p[1] << 8) | (p[2] << 16);
+  bsize = h >> 3;
+  zstdio->cpos += 3;
+
+  if (bsize > ZSTD_BLOCK_MAX)
+    return corrupted ();
+  if (out_size - *pos > ZSTD_BLOCK_MAX)
+    out_size = *pos + ZSTD_BLOCK_MAX;
+
+  switch ((h >> 1) & 3)
+    {
+    case ZSTD_BLOCK_RAW:
+      if (bsize > out_size - *pos)
+	return corrupted ();
+      if (zstdio->mem_input)
+	{
+	  p = input_get (zstdio, zstdio->cpos, bsize);
+	  if (!p)
+	    return grub_errno;
+	  grub_memcpy (out + *pos, p, bsize);
+	}
+      else
+	{
+	  grub_file_seek (zstdio->file, zstdio->cpos);
+	  if (grub_file_read (zstdio->file, out + *pos, bsize)
+	      != (grub_ssize_t) bsize)
+	    {
+	      if (!grub_errno)
+		corrupted ();
+	      return grub_errno;
+	    }
+	}
+      *pos += bsize;
+      zstdio->cpos += bsize;
+      break;
+
+    case ZSTD_BLOCK_RLE:
+      if (bsize > out_size - *pos)
+	return corrupted ();
+      p = input_get (zstdio, zstdio->cpos, 1);
+      if (!p)
+	return grub_errno;
+      grub_memset (out + *pos, *p, bsize);
+      *pos += bsize;
+      zstdio->cpos++;
+      break;
+
+    case ZSTD_BLOCK_COMPRESSED:
+      p = input_get (zstdio, zstdio->cpos, bsize);
+      if (!p || decode_compressed_block (&zstdio->ent, p, bsize,
+					 out, pos, out_size))
+	return grub_errno;
+      zstdio->cpos += bsize;
+      break;
+
+    default:
+      return corrupted ();
+    }
+
+  if (h & 1)
+    {
+      if (zstdio->hdr.checksum)
+	zstdio->cpos += 4;
+      zstdio->frame_done = 1;
+    }
+  return GRUB_ERR_NONE;
+}
+
+/* Decode the next block of the current frame into the window.  */
+static grub_err_t
+read_window_block (grub_zstdio_t zstdio)
+{
+  grub_off_t start = zstdio->frames[zstdio->cur].uoff;
+  grub_size_t need;
+
+  /* Twice the window keeps the sliding memmove amortized.  */
+  need = 2 * zstdio->hdr.window_size + ZSTD_BLOCK_MAX;
+  if (zstdio->hdr.content_size < need)
+    need = zstdio->hdr.content_size;
+  if (need > zstdio->win_alloc)
+    {
+      grub_free (zstdio->win);
+      zstdio->win_alloc = 0;
+      zstdio->win = grub_malloc (need);
+      if (!zstdio->win)
+	return grub_errno;
+      zstdio->win_alloc = need;
+    }
+
+  if (zstdio->win_alloc - zstdio->win_len < ZSTD_BLOCK_MAX)
+    {
+      grub_size_t keep = zstdio->win_len;
+
+      if (keep > zstdio->hdr.window_size)
+	keep = zstdio->hdr.window_size;
+      grub_memmove (zstdio->win, zstdio->win + zstdio->win_len - keep, keep);
+      zstdio->win_uoff += zstdio->win_len - keep;
+      zstdio->win_len = keep;
+    }
+
+  if (read_block (zstdio, zstdio->win, &zstdio->win_len, zstdio->win_alloc))
+    return grub_errno;
+
+  if (zstdio->frame_done
+      && zstdio->hdr.content_size != ZSTD_CONTENT_SIZE_UNKNOWN
+      && zstdio->win_uoff + zstdio->win_len - start
+      != zstdio->hdr.content_size)
+    return corrupted ();
+  return GRUB_ERR_NONE;
+}
+
+/* Decode the whole current frame straight into BUF, which is exactly
+   the size of its content.  */
+static grub_err_t
+read_frame_direct (grub_zstdio_t zstdio, grub_uint8_t *buf)
+{
+  grub_size_t pos = 0;
+
+  while (!zstdio->frame_done)
+    if (read_block (zstdio, buf, &pos, zstdio->hdr.content_size))
+      return grub_errno;
+  if (pos != zstdio->hdr.content_size)
+    return corrupted ();
+
+  zstdio->win_uoff += pos;
+  zstdio->win_len = 0;
+  return GRUB_ERR_NONE;
+}
+
+/* Index of the last frame starting at or before OFFSET.  */
+static unsigned
+frame_for_offset (grub_zstdio_t zstdio, grub_off_t offset)
+{
+  unsigned lo = 0, hi = zstdio->nframes;
+
+  while (hi - lo > 1)
+    {
+      unsigned mid = (lo + hi) / 2;
+
+      if (zstdio->frames[mid].uoff <= offset)
+	lo = mid;
+      else
+	hi = mid;
+    }
+  return lo;
+}
+
+static grub_ssize_t
+grub_zstdio_read_real (grub_zstdio_t zstdio, grub_off_t offset,
+		       char *buf, grub_size_t len)
+{
+  grub_ssize_t ret = 0;
+
+  while (len > 0)
+    {
+      unsigned f;
+
+      if (zstdio->active && offset >= zstdio->win_uoff
+	  && offset - zstdio->win_uoff < zstdio->win_len)
+	{
+	  grub_size_t n = zstdio->win_len - (offset - zstdio->win_uoff);
+
+	  if (n > len)
+	    n = len;
+	  grub_memcpy (buf, zstdio->win + (offset - zstdio->win_uoff), n);
+	  buf += n;
+	  len -= n;
+	  offset += n;
+	  ret += n;
+	  continue;
+	}
+
+      if (zstdio->nframes == 0)
+	break;
+
+      /* Restart at the frame holding OFFSET if it is behind the window
+	 or in a later frame than the current one.  */
+      f = frame_for_offset (zstdio, offset);
+      if (!zstdio->active || offset < zstdio->win_uoff || f > zstdio->cur)
+	{
+	  if (start_frame (zstdio, f))
+	    goto fail;
+	}
+      else if (zstdio->frame_done)
+	{
+	  if (zstdio->cur + 1 == zstdio->nframes)
+	    {
+	      if (!zstdio->index_complete
+		  && add_next_frame (zstdio, zstdio->cpos,
+				     zstdio->win_uoff + zstdio->win_len))
+		goto fail;
+	      if (zstdio->cur + 1 == zstdio->nframes)
+		break;
+	    }
+	  if (start_frame (zstdio, zstdio->cur + 1))
+	    goto fail;
+	}
+      else
+	{
+	  if (read_window_block (zstdio))
+	    goto fail;
+	  continue;
+	}
+
+      /* A fresh frame that is wanted whole, whether reached by seeking or
+	 by reading on from the previous one, skips the window.  */
+      if (offset == zstdio->win_uoff
+	  && zstdio->hdr.content_size <= len)
+	{
+	  if (read_frame_direct (zstdio, (grub_uint8_t *) buf))
+	    goto fail;
+	  buf += zstdio->hdr.content_size;
+	  len -= zstdio->hdr.content_size;
+	  offset += zstdio->hdr.content_size;
+	  ret += zstdio->hdr.content_size;
+	}
+    }
+
+  return ret;
+
+ fail:
+  zstdio->active = 0;
+  return -1;
+}
+
+static grub_file_t
+grub_zstdio_open (grub_file_t io,
+		  const char *name __attribute__ ((unused)))
+{
+  grub_file_t file;
+  grub_zstdio_t zstdio;
+  grub_uint32_t magic;
+
+  if (grub_file_tell (io) != 0)
+    grub_file_seek (io, 0);
+  if (grub_file_read (io, &magic, sizeof (magic)) != sizeof (magic)
+      || grub_le_to_cpu32 (magic) != ZSTD_MAGIC)
+    {
+      grub_errno = GRUB_ERR_NONE;
+      grub_file_seek (io, 0);
+      return io;
+    }
+
+  file = (grub_file_t) grub_zalloc (sizeof (*file));
+  if (!file)
+    return 0;
+
+  zstdio = grub_zalloc (sizeof (*zstdio));
+  if (!zstdio)
+    {
+      grub_free (file);
+      return 0;
+    }
+  zstdio->cbuf = grub_malloc (ZSTD_BLOCK_MAX);
+  if (!zstdio->cbuf)
+    {
+      grub_free (zstdio);
+      grub_free (file);
+      return 0;
+    }
+
+  zstdio->file = io;
+
+  file->device = io->device;
+  file->data = zstdio;
+  file->fs = &grub_zstdio_fs;
+  file->not_easily_seekable = 1;
+
+  if (index_frames (zstdio))
+    {
+      grub_free (zstdio->frames);
+      grub_free (zstdio->cbuf);
+      grub_free (zstdio);
+      grub_free (file);
+      grub_file_seek (io, 0);
+      return 0;
+    }
+
+  if (zstdio->index_complete)
+    file->size = zstdio->size;
+  else
+    file->size = GRUB_FILE_SIZE_UNKNOWN;
+
+  return file;
+}
+
+static grub_ssize_t
+grub_zstdio_read (grub_file_t file, char *buf, grub_size_t len)
+{
+  return grub_zstdio_read_real (file->data, file->offset, buf, len);
+}
+
+/* Release everything, including the underlying file object.  */
+static grub_err_t
+grub_zstdio_close (grub_file_t file)
+{
+  grub_zstdio_t zstdio = file->data;
+
+  grub_file_close (zstdio->file);
+  grub_free (zstdio->frames);
+  grub_free (zstdio->win);
+  grub_free (zstdio->cbuf);
+  grub_free (zstdio);
+
+  /* Device must not be closed twice.  */
+  file->device = 0;
+  file->name = 0;
+  return grub_errno;
+}
+
+grub_ssize_t
+grub_zstd_decompress (char *inbuf, grub_size_t insize, grub_off_t off,
+		      char *outbuf, grub_size_t outsize)
+{
+  grub_zstdio_t zstdio;
+  grub_ssize_t ret = -1;
+
+  zstdio = grub_zalloc (sizeof (*zstdio));
+  if (!zstdio)
+    return -1;
+  zstdio->mem_input = (grub_uint8_t *) inbuf;
+  zstdio->mem_input_size = insize;
+
+  if (insize < 4
+      || grub_le_to_cpu32 (grub_get_unaligned32 (inbuf)) != ZSTD_MAGIC)
+    corrupted ();
+  else if (!index_frames (zstdio))
+    ret = grub_zstdio_read_real (zstdio, off, outbuf, outsize);
+
+  grub_free (zstdio->frames);
+  grub_free (zstdio->win);
+  grub_free (zstdio);
+  return ret;
+}
+
+static struct grub_fs grub_zstdio_fs = {
+  .name = "zstdio",
+  .dir = 0,
+  .open = 0,
+  .read = grub_zstdio_read,
+  .close = grub_zstdio_close,
+  .label = 0,
+  .next = 0
+};
+
+GRUB_MOD_INIT (zstdio)
+{
+  grub_file_filter_register (GRUB_FILE_FILTER_ZSTDIO, grub_zstdio_open);
+}
+
+GRUB_MOD_FINI (zstdio)
+{
+  grub_file_filter_unregister (GRUB_FILE_FILTER_ZSTDIO);
+}
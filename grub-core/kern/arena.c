@@ -0,0 +1,166 @@
+/* arena.c - bump allocator for transient allocations */
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2026  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <grub/arena.h>
+#include <grub/err.h>
+#include <grub/i18n.h>
+#include <grub/misc.h>
+#include <grub/mm.h>
+
+#define GRUB_ARENA_CHUNK_SIZE	4096
+#define GRUB_ARENA_ALIGN	sizeof (grub_uint64_t)
+
+struct grub_arena_chunk
+{
+  struct grub_arena_chunk *next;
+  grub_size_t size;
+  grub_size_t used;
+  grub_uint64_t data[0];
+};
+
+struct grub_arena
+{
+  /* Newest first; allocations are only made from the head.  */
+  struct grub_arena_chunk *chunks;
+  grub_size_t chunk_size;
+  /* Start of the most recent allocation, for grub_arena_realloc.  */
+  char *last;
+};
+
+grub_arena_t
+grub_arena_create (grub_size_t chunk_size)
+{
+  grub_arena_t arena;
+
+  arena = grub_zalloc (sizeof (*arena));
+  if (!arena)
+    return NULL;
+  arena->chunk_size = ALIGN_UP (chunk_size ? : GRUB_ARENA_CHUNK_SIZE,
+			       GRUB_ARENA_ALIGN);
+  return arena;
+}
+
+void
+grub_arena_reset (grub_arena_t arena)
+{
+  struct grub_arena_chunk *chunk, *next;
+
+  if (!arena || !arena->chunks)
+    return;
+
+  /* Keep the newest chunk for reuse.  */
+  for (chunk = arena->chunks->next; chunk; chunk = next)
+    {
+      next = chunk->next;
+      grub_free (chunk);
+    }
+  arena->chunks->next = NULL;
+  arena->chunks->used = 0;
+  arena->last = NULL;
+}
+
+void
+grub_arena_destroy (grub_arena_t arena)
+{
+  struct grub_arena_chunk *chunk, *next;
+
+  if (!arena)
+    return;
+
+  for (chunk = arena->chunks; chunk; chunk = next)
+    {
+      next = chunk->next;
+      grub_free (chunk);
+    }
+  grub_free (arena);
+}
+
+void *
+grub_arena_alloc (grub_arena_t arena, grub_size_t size)
+{
+  struct grub_arena_chunk *chunk = arena->chunks;
+  grub_size_t off;
+
+  if (size > ~(grub_size_t) 0 - sizeof (*chunk) - GRUB_ARENA_ALIGN)
+    {
+      grub_error (GRUB_ERR_OUT_OF_MEMORY, N_("out of memory"));
+      return NULL;
+    }
+  size = ALIGN_UP (size, GRUB_ARENA_ALIGN);
+  if (!chunk || chunk->size - chunk->used < size)
+    {
+      grub_size_t csize = arena->chunk_size;
+
+      if (csize < size)
+	csize = size;
+      chunk = grub_malloc (sizeof (*chunk) + csize);
+      if (!chunk)
+	return NULL;
+      chunk->size = csize;
+      chunk->used = 0;
+      chunk->next = arena->chunks;
+      arena->chunks = chunk;
+    }
+
+  off = chunk->used;
+  chunk->used += size;
+  arena->last = (char *) chunk->data + off;
+  return arena->last;
+}
+
+void *
+grub_arena_realloc (grub_arena_t arena, void *ptr, grub_size_t old_size,
+		    grub_size_t new_size)
+{
+  struct grub_arena_chunk *chunk = arena->chunks;
+  void *q;
+
+  if (ptr && ptr == arena->last)
+    {
+      grub_size_t off = (char *) ptr - (char *) chunk->data;
+
+      if (new_size <= chunk->size - off)
+	{
+	  chunk->used = off + ALIGN_UP (new_size, GRUB_ARENA_ALIGN);
+	  if (chunk->used > chunk->size)
+	    chunk->used = chunk->size;
+	  return ptr;
+	}
+    }
+
+  q = grub_arena_alloc (arena, new_size);
+  if (q && ptr)
+    grub_memcpy (q, ptr, old_size < new_size ? old_size : new_size);
+  return q;
+}
+
+char *
+grub_arena_strndup (grub_arena_t arena, const char *s, grub_size_t n)
+{
+  grub_size_t len;
+  char *p;
+
+  for (len = 0; len < n && s[len]; len++);
+  p = grub_arena_alloc (arena, len + 1);
+  if (!p)
+    return NULL;
+  grub_memcpy (p, s, len);
+  p[len] = '\0';
+  return p;
+}
@@ -34,6 +34,42 @@ grub_efi_get_time_ms (void)
   return tmr;
 }
 
+#ifdef __aarch64__
+static grub_uint64_t timer_start;
+/* Generic timer rates in ms and ns per 2^32 ticks.  */
+static grub_uint64_t timer_ms_rate, timer_ns_rate;
+
+static grub_uint64_t
+grub_arm64_get_time_ms (void)
+{
+  return grub_time_scale (grub_arm64_get_cntvct () - timer_start,
+			  timer_ms_rate);
+}
+
+static grub_uint64_t
+grub_arm64_get_time_ns (void)
+{
+  return grub_time_scale (grub_arm64_get_cntvct () - timer_start,
+			  timer_ns_rate);
+}
+
+/* The firmware programs CNTFRQ, so no calibration is needed.  */
+static int
+grub_arm64_timer_init (void)
+{
+  grub_uint64_t hz = grub_arm64_get_cntfrq () & 0xffffffff;
+
+  if (!hz)
+    return 0;
+  timer_start = grub_arm64_get_cntvct ();
+  timer_ms_rate = grub_divmod64 (1000ULL << 32, hz, 0);
+  timer_ns_rate = grub_divmod64 (1000000000ULL << 32, hz, 0);
+  grub_install_get_time_ms (grub_arm64_get_time_ms);
+  grub_install_get_time_ns (grub_arm64_get_time_ns);
+  return 1;
+}
+#endif
+
 static void 
 increment_timer (grub_efi_event_t event __attribute__ ((unused)),
 		 void *context __attribute__ ((unused)))
@@ -48,6 +84,11 @@ grub_machine_init (void)
 
   grub_efi_init ();
 
+#ifdef __aarch64__
+  if (grub_arm64_timer_init ())
+    return;
+#endif
+
   b = grub_efi_system_table->boot_services;
 
   efi_call_5 (b->create_event, GRUB_EFI_EVT_TIMER | GRUB_EFI_EVT_NOTIFY_SIGNAL,
@@ -62,13 +103,17 @@ grub_machine_fini (int flags)
 {
   grub_efi_boot_services_t *b;
 
+  grub_efi_mm_release_heap ();
   if (!(flags & GRUB_LOADER_FLAG_NORETURN))
     return;
 
   b = grub_efi_system_table->boot_services;
 
-  efi_call_3 (b->set_timer, tmr_evt, GRUB_EFI_TIMER_CANCEL, 0);
-  efi_call_1 (b->close_event, tmr_evt);
+  if (tmr_evt)
+    {
+      efi_call_3 (b->set_timer, tmr_evt, GRUB_EFI_TIMER_CANCEL, 0);
+      efi_call_1 (b->close_event, tmr_evt);
+    }
 
   grub_efi_fini ();
 }
@@ -25,28 +25,81 @@
 #include <grub/time.h>
 #include <grub/file.h>
 #include <grub/i18n.h>
+#include <grub/reclaim.h>
 
 #define	GRUB_CACHE_TIMEOUT	2
 
 /* The last time the disk was used.  */
 static grub_uint64_t grub_last_time = 0;
 
-struct grub_disk_cache grub_disk_cache_table[GRUB_DISK_CACHE_NUM];
+struct grub_disk_cache *grub_disk_cache_table;
+unsigned grub_disk_cache_sets;
+
+/* The number of sets the cache should have, given the heap size.  */
+static unsigned grub_disk_cache_wanted_sets = GRUB_DISK_CACHE_DEFAULT_SETS;
+static grub_size_t grub_disk_cache_heap_size;
+
+/* Incremented on every cache access, used for LRU replacement.  */
+static unsigned long grub_disk_cache_clock;
 
 void (*grub_disk_firmware_fini) (void);
 int grub_disk_firmware_is_tainted;
 
-#if DISK_CACHE_STATS
 static unsigned long grub_disk_cache_hits;
 static unsigned long grub_disk_cache_misses;
 
+/* Requests passed down to the disk drivers, and the bytes they asked for.  */
+static unsigned long grub_disk_dev_reads;
+static grub_uint64_t grub_disk_dev_read_bytes;
+
 void
 grub_disk_cache_get_performance (unsigned long *hits, unsigned long *misses)
 {
   *hits = grub_disk_cache_hits;
   *misses = grub_disk_cache_misses;
 }
-#endif
+
+void
+grub_disk_get_read_stats (unsigned long *reads, grub_uint64_t *bytes)
+{
+  *reads = grub_disk_dev_reads;
+  *bytes = grub_disk_dev_read_bytes;
+}
+
+/* Read SIZE native sectors at SECTOR, already transformed, from the
+   driver.  */
+static grub_err_t
+grub_disk_dev_read (grub_disk_t disk, grub_disk_addr_t sector,
+		    grub_size_t size, char *buf)
+{
+  struct grub_disk_dev_stats *stats = &disk->dev->stats;
+  grub_uint64_t bytes = (grub_uint64_t) size << disk->log_sector_size;
+  grub_uint64_t start, time;
+  grub_boot_span_t span;
+  grub_err_t err;
+
+  grub_disk_dev_reads++;
+  grub_disk_dev_read_bytes += bytes;
+
+  span = grub_boot_span_begin ("Reading %s", disk->name);
+  start = grub_get_time_ms ();
+  err = (disk->dev->read) (disk, sector, size, buf);
+  time = grub_get_time_ms () - start;
+  grub_boot_span_end (span, bytes);
+
+  if (stats->reads == 0 || time < stats->min_read_time)
+    stats->min_read_time = time;
+  if (time > stats->max_read_time)
+    stats->max_read_time = time;
+  stats->read_time += time;
+  stats->reads++;
+  stats->read_bytes += bytes;
+  if (bytes > (GRUB_DISK_SECTOR_SIZE << GRUB_DISK_CACHE_BITS))
+    stats->agglomerated_reads++;
+  if (bytes > stats->largest_read)
+    stats->largest_read = bytes;
+  return err;
+}
 
 grub_err_t (*grub_disk_write_weak) (grub_disk_t disk,
 				    grub_disk_addr_t sector,
@@ -60,41 +113,164 @@ grub_disk_cache_invalidate_all (void)
 {
   unsigned i;
 
-  for (i = 0; i < GRUB_DISK_CACHE_NUM; i++)
+  if (! grub_disk_cache_table)
+    return;
+
+  for (i = 0; i < grub_disk_cache_sets * GRUB_DISK_CACHE_WAYS; i++)
     {
       struct grub_disk_cache *cache = grub_disk_cache_table + i;
 
       if (cache->data && ! cache->lock)
+	grub_disk_cache_free_line (cache);
+    }
+}
+
+/* Account for SIZE more bytes of heap.  The memory manager calls this
+   before it can allocate anything, so only the wanted geometry is recorded
+   here and the table itself is (re)allocated on the next disk open.  */
+void
+grub_disk_cache_add_heap (grub_size_t size)
+{
+  grub_size_t sets;
+
+  grub_disk_cache_heap_size += size;
+  sets = ((grub_disk_cache_heap_size >> GRUB_DISK_CACHE_HEAP_SHIFT)
+	  / (GRUB_DISK_CACHE_WAYS
+	     << (GRUB_DISK_CACHE_BITS + GRUB_DISK_SECTOR_BITS)));
+  if (sets < GRUB_DISK_CACHE_MIN_SETS)
+    sets = GRUB_DISK_CACHE_MIN_SETS;
+  if (sets > GRUB_DISK_CACHE_MAX_SETS)
+    sets = GRUB_DISK_CACHE_MAX_SETS;
+  grub_disk_cache_wanted_sets = sets;
+}
+
+/* Free unlocked lines, oldest first, until WANTED bytes are freed.  Lines
+   are freed by age, widening the window each time round, so that this
+   takes a few sweeps over the table rather than one per line.  */
+static grub_size_t
+grub_disk_cache_shrink (grub_size_t wanted)
+{
+  grub_size_t freed = 0;
+  unsigned long oldest = grub_disk_cache_clock;
+  unsigned long window = 1;
+  unsigned i, n;
+
+  if (! grub_disk_cache_table)
+    return 0;
+
+  n = grub_disk_cache_sets * GRUB_DISK_CACHE_WAYS;
+  for (i = 0; i < n; i++)
+    if (grub_disk_cache_table[i].data && ! grub_disk_cache_table[i].lock
+	&& grub_disk_cache_table[i].last_use < oldest)
+      oldest = grub_disk_cache_table[i].last_use;
+
+  while (freed < wanted)
+    {
+      int left = 0;
+
+      for (i = 0; i < n; i++)
 	{
-	  grub_free (cache->data);
-	  cache->data = 0;
+	  struct grub_disk_cache *cache = grub_disk_cache_table + i;
+
+	  if (! cache->data || cache->lock)
+	    continue;
+	  if (cache->last_use - oldest < window)
+	    {
+	      grub_disk_cache_free_line (cache);
+	      freed += GRUB_DISK_SECTOR_SIZE << GRUB_DISK_CACHE_BITS;
+	    }
+	  else
+	    left = 1;
 	}
+
+      if (! left)
+	break;
+      window <<= 1;
     }
+
+  return freed;
 }
 
-static char *
-grub_disk_cache_fetch (unsigned long dev_id, unsigned long disk_id,
-		       grub_disk_addr_t sector)
+struct grub_reclaim_cache grub_disk_cache_reclaim =
+  {
+    .name = "disk",
+    .shrink = grub_disk_cache_shrink
+  };
+
+/* Bring the cache table to the wanted geometry.  Failing to do so is not
+   fatal: the old table, if any, is kept.  */
+static void
+grub_disk_cache_setup (void)
+{
+  struct grub_disk_cache *table;
+  unsigned i;
+
+  if (grub_disk_cache_table
+      && grub_disk_cache_sets == grub_disk_cache_wanted_sets)
+    return;
+
+  if (grub_disk_cache_table)
+    for (i = 0; i < grub_disk_cache_sets * GRUB_DISK_CACHE_WAYS; i++)
+      if (grub_disk_cache_table[i].lock)
+	return;
+
+  table = grub_zalloc (grub_disk_cache_wanted_sets * GRUB_DISK_CACHE_WAYS
+		       * sizeof (*table));
+  if (! table)
+    {
+      grub_errno = GRUB_ERR_NONE;
+      return;
+    }
+
+  grub_disk_cache_invalidate_all ();
+  if (! grub_disk_cache_table)
+    grub_reclaim_register (&grub_disk_cache_reclaim);
+  grub_free (grub_disk_cache_table);
+  grub_disk_cache_table = table;
+  grub_disk_cache_sets = grub_disk_cache_wanted_sets;
+}
+
+/* Return the line holding SECTOR, if any.  */
+static struct grub_disk_cache *
+grub_disk_cache_lookup (unsigned long dev_id, unsigned long disk_id,
+			grub_disk_addr_t sector)
 {
   struct grub_disk_cache *cache;
-  unsigned cache_index;
+  unsigned i;
+
+  if (! grub_disk_cache_table)
+    return 0;
 
-  cache_index = grub_disk_cache_get_index (dev_id, disk_id, sector);
-  cache = grub_disk_cache_table + cache_index;
+  cache = grub_disk_cache_get_set (dev_id, disk_id, sector);
 
-  if (cache->dev_id == dev_id && cache->disk_id == disk_id
-      && cache->sector == sector)
+  for (i = 0; i < GRUB_DISK_CACHE_WAYS; i++, cache++)
+    if (cache->data && cache->dev_id == dev_id && cache->disk_id == disk_id
+	&& cache->sector == sector)
+      return cache;
+
+  return 0;
+}
+
+static char *
+grub_disk_cache_fetch (grub_disk_t disk, grub_disk_addr_t sector)
+{
+  unsigned long dev_id = disk->dev->id;
+  unsigned long disk_id = disk->id;
+  struct grub_disk_cache *cache;
+
+  cache = grub_disk_cache_lookup (dev_id, disk_id, sector);
+  if (cache)
     {
       cache->lock = 1;
-#if DISK_CACHE_STATS
+      cache->last_use = ++grub_disk_cache_clock;
+      grub_reclaim_touch (&grub_disk_cache_reclaim);
       grub_disk_cache_hits++;
-#endif
+      disk->dev->stats.cache_hits++;
       return cache->data;
     }
 
-#if DISK_CACHE_STATS
   grub_disk_cache_misses++;
-#endif
+  disk->dev->stats.cache_misses++;
 
   return 0;
 }
@@ -104,53 +280,89 @@ grub_disk_cache_unlock (unsigned long dev_id, unsigned long disk_id,
 			grub_disk_addr_t sector)
 {
   struct grub_disk_cache *cache;
-  unsigned cache_index;
+  unsigned i;
+
+  if (! grub_disk_cache_table)
+    return;
 
-  cache_index = grub_disk_cache_get_index (dev_id, disk_id, sector);
-  cache = grub_disk_cache_table + cache_index;
+  cache = grub_disk_cache_get_set (dev_id, disk_id, sector);
 
-  if (cache->dev_id == dev_id && cache->disk_id == disk_id
-      && cache->sector == sector)
-    cache->lock = 0;
+  for (i = 0; i < GRUB_DISK_CACHE_WAYS; i++, cache++)
+    if (cache->dev_id == dev_id && cache->disk_id == disk_id
+	&& cache->sector == sector)
+      cache->lock = 0;
 }
 
 static grub_err_t
 grub_disk_cache_store (unsigned long dev_id, unsigned long disk_id,
 		       grub_disk_addr_t sector, const char *data)
 {
-  unsigned cache_index;
-  struct grub_disk_cache *cache;
+  struct grub_disk_cache *set, *cache = 0;
+  unsigned i;
+
+  if (! grub_disk_cache_table)
+    return GRUB_ERR_NONE;
+
+  set = grub_disk_cache_get_set (dev_id, disk_id, sector);
 
-  cache_index = grub_disk_cache_get_index (dev_id, disk_id, sector);
-  cache = grub_disk_cache_table + cache_index;
+  /* Prefer the line already holding this sector, then an empty line, then
+     the least recently used unlocked one.  */
+  for (i = 0; i < GRUB_DISK_CACHE_WAYS; i++)
+    {
+      if (set[i].lock)
+	continue;
+      if (set[i].data && set[i].dev_id == dev_id && set[i].disk_id == disk_id
+	  && set[i].sector == sector)
+	{
+	  cache = set + i;
+	  break;
+	}
+      if (! cache || (cache->data
+		      && (! set[i].data || set[i].last_use < cache->last_use)))
+	cache = set + i;
+    }
 
-  cache->lock = 1;
-  grub_free (cache->data);
-  cache->data = 0;
-  cache->lock = 0;
+  if (! cache)
+    return GRUB_ERR_NONE;
 
-  cache->data = grub_malloc (GRUB_DISK_SECTOR_SIZE << GRUB_DISK_CACHE_BITS);
+  /* All lines have the same size, so an evicted buffer is reused.  */
   if (! cache->data)
-    return grub_errno;
+    {
+      cache->data = grub_malloc (GRUB_DISK_SECTOR_SIZE << GRUB_DISK_CACHE_BITS);
+      if (! cache->data)
+	return grub_errno;
+      grub_disk_cache_reclaim.size += GRUB_DISK_SECTOR_SIZE << GRUB_DISK_CACHE_BITS;
+    }
 
   grub_memcpy (cache->data, data,
 	       GRUB_DISK_SECTOR_SIZE << GRUB_DISK_CACHE_BITS);
   cache->dev_id = dev_id;
   cache->disk_id = disk_id;
   cache->sector = sector;
+  cache->last_use = ++grub_disk_cache_clock;
+  grub_reclaim_touch (&grub_disk_cache_reclaim);
 
   return GRUB_ERR_NONE;
 }
 
-
+
 
 grub_disk_dev_t grub_disk_dev_list;
+unsigned long grub_disk_generation;
+
+void
+grub_disk_drop_caches (void)
+{
+  grub_disk_cache_invalidate_all ();
+  grub_disk_generation++;
+}
 
 void
 grub_disk_dev_register (grub_disk_dev_t dev)
 {
   dev->next = grub_disk_dev_list;
   grub_disk_dev_list = dev;
+  grub_disk_generation++;
 }
 
 void
@@ -162,6 +374,10 @@ grub_disk_dev_unregister (grub_disk_dev_t dev)
     if (q == dev)
       {
         *p = q->next;
+	grub_disk_generation++;
+	/* Files may keep disks of DEV open, close them while its code is
+	   still there.  */
+	grub_file_mounts_flush ();
 	break;
       }
 }
@@ -268,6 +484,8 @@ grub_disk_open (const char *name)
 		      + GRUB_CACHE_TIMEOUT * 1000))
     grub_disk_cache_invalidate_all ();
 
+  grub_disk_cache_setup ();
+
   grub_last_time = current_time;
 
  fail:
@@ -321,7 +539,7 @@ grub_disk_read_small_real (grub_disk_t disk, grub_disk_addr_t sector,
   char *tmp_buf;
 
   /* Fetch the cache.  */
-  data = grub_disk_cache_fetch (disk->dev->id, disk->id, sector);
+  data = grub_disk_cache_fetch (disk, sector);
   if (data)
     {
       /* Just copy it!  */
@@ -341,10 +559,10 @@ grub_disk_read_small_real (grub_disk_t disk, grub_disk_addr_t sector,
       < (disk->total_sectors << (disk->log_sector_size - GRUB_DISK_SECTOR_BITS)))
     {
       grub_err_t err;
-      err = (disk->dev->read) (disk, transform_sector (disk, sector),
-			       1U << (GRUB_DISK_CACHE_BITS
-				      + GRUB_DISK_SECTOR_BITS
-				      - disk->log_sector_size), tmp_buf);
+      err = grub_disk_dev_read (disk, transform_sector (disk, sector),
+				1U << (GRUB_DISK_CACHE_BITS
+				       + GRUB_DISK_SECTOR_BITS
+				       - disk->log_sector_size), tmp_buf);
       if (!err)
 	{
 	  /* Copy it and store it in the disk cache.  */
@@ -377,8 +595,8 @@ grub_disk_read_small_real (grub_disk_t disk, grub_disk_addr_t sector,
     if (!tmp_buf)
       return grub_errno;
     
-    if ((disk->dev->read) (disk, transform_sector (disk, aligned_sector),
-			   num, tmp_buf))
+    if (grub_disk_dev_read (disk, transform_sector (disk, aligned_sector),
+			    num, tmp_buf))
       {
 	grub_error_push ();
 	grub_dprintf ("disk", "%s read failed\n", disk->name);
@@ -408,21 +626,110 @@ grub_disk_read_small (grub_disk_t disk, grub_disk_addr_t sector,
   return GRUB_ERR_NONE;
 }
 
-/* Read data from the disk.  */
-grub_err_t
-grub_disk_read (grub_disk_t disk, grub_disk_addr_t sector,
-		grub_off_t offset, grub_size_t size, void *buf)
+/* Called after a successful read of the 512B sectors START to END - 1.
+   Once a read directly follows the previous one, the window behind it is
+   brought into the cache ahead of time: through the device's prefetch
+   hook if it has one, otherwise with a single large read.  The window
+   doubles while the stream goes on.  */
+static void
+grub_disk_readahead (grub_disk_t disk, grub_disk_addr_t start,
+		     grub_disk_addr_t end)
 {
-  /* First of all, check if the region is within the disk.  */
-  if (grub_disk_adjust_range (disk, &sector, &offset, size) != GRUB_ERR_NONE)
+  grub_disk_addr_t from, to, total;
+  unsigned max_window = disk->max_agglomerate;
+  char *tmp_buf;
+  grub_disk_addr_t i;
+
+  if (start > disk->readahead_next
+      || start + GRUB_DISK_CACHE_SIZE < disk->readahead_next)
     {
-      grub_error_push ();
-      grub_dprintf ("disk", "Read out of range: sector 0x%llx (%s).\n",
-		    (unsigned long long) sector, grub_errmsg);
-      grub_error_pop ();
-      return grub_errno;
+      /* Not sequential.  */
+      disk->readahead_next = end;
+      disk->readahead_end = 0;
+      disk->readahead_window = 0;
+      return;
+    }
+  disk->readahead_next = end;
+
+  if (max_window > GRUB_DISK_READAHEAD_MAX_WINDOW)
+    max_window = GRUB_DISK_READAHEAD_MAX_WINDOW;
+  if (max_window == 0 || disk->total_sectors == GRUB_DISK_SIZE_UNKNOWN
+      || ! grub_disk_cache_table)
+    return;
+
+  if (disk->readahead_window == 0)
+    disk->readahead_window = GRUB_DISK_READAHEAD_MIN_WINDOW;
+  /* Wait until the reader is in the second half of the window.  */
+  else if (disk->readahead_end
+	   > end + ((disk->readahead_window << GRUB_DISK_CACHE_BITS) >> 1))
+    return;
+  else if (disk->readahead_window < max_window)
+    disk->readahead_window <<= 1;
+  if (disk->readahead_window > max_window)
+    disk->readahead_window = max_window;
+
+  from = ALIGN_UP (end, GRUB_DISK_CACHE_SIZE);
+  if (from < disk->readahead_end)
+    from = disk->readahead_end;
+  to = (ALIGN_UP (end, GRUB_DISK_CACHE_SIZE)
+	+ ((grub_disk_addr_t) disk->readahead_window << GRUB_DISK_CACHE_BITS));
+
+  /* Only whole cache units strictly inside the disk are cached.  */
+  total = disk->total_sectors << (disk->log_sector_size
+				  - GRUB_DISK_SECTOR_BITS);
+  if (total <= GRUB_DISK_CACHE_SIZE)
+    return;
+  total = (total - 1) & ~((grub_disk_addr_t) GRUB_DISK_CACHE_SIZE - 1);
+  if (to > total)
+    to = total;
+
+  /* Skip what is already there.  */
+  disk->readahead_end = to;
+  while (from < to
+	 && grub_disk_cache_lookup (disk->dev->id, disk->id, from))
+    from += GRUB_DISK_CACHE_SIZE;
+  if (from >= to)
+    return;
+
+  if (disk->dev->prefetch)
+    {
+      if ((disk->dev->prefetch) (disk, transform_sector (disk, from),
+				 (to - from) >> (disk->log_sector_size
+						 - GRUB_DISK_SECTOR_BITS))
+	  == GRUB_ERR_NONE)
+	return;
+      grub_errno = GRUB_ERR_NONE;
     }
 
+  tmp_buf = grub_malloc ((to - from) << GRUB_DISK_SECTOR_BITS);
+  if (! tmp_buf)
+    {
+      grub_errno = GRUB_ERR_NONE;
+      return;
+    }
+
+  if (grub_disk_dev_read (disk, transform_sector (disk, from),
+			  (to - from) >> (disk->log_sector_size
+					  - GRUB_DISK_SECTOR_BITS), tmp_buf))
+    {
+      grub_free (tmp_buf);
+      grub_errno = GRUB_ERR_NONE;
+      disk->readahead_end = 0;
+      return;
+    }
+
+  for (i = from; i < to; i += GRUB_DISK_CACHE_SIZE)
+    grub_disk_cache_store (disk->dev->id, disk->id, i,
+			   tmp_buf + ((i - from) << GRUB_DISK_SECTOR_BITS));
+  grub_free (tmp_buf);
+  grub_errno = GRUB_ERR_NONE;
+}
+
+static grub_err_t
+grub_disk_read_real (grub_disk_t disk, grub_disk_addr_t sector,
+		     grub_off_t offset, grub_size_t size, void *buf)
+{
+
   /* First read until first cache boundary.   */
   if (offset || (sector & (GRUB_DISK_CACHE_SIZE - 1)))
     {
@@ -461,9 +768,8 @@ grub_disk_read (grub_disk_t disk, grub_disk_addr_t sector,
 	     && agglomerate < disk->max_agglomerate;
 	   agglomerate++)
 	{
-	  data = grub_disk_cache_fetch (disk->dev->id, disk->id,
-					sector + (agglomerate
-						  << GRUB_DISK_CACHE_BITS));
+	  data = grub_disk_cache_fetch (disk, sector + (agglomerate
+							<< GRUB_DISK_CACHE_BITS));
 	  if (data)
 	    break;
 	}
@@ -483,20 +789,23 @@ grub_disk_read (grub_disk_t disk, grub_disk_addr_t sector,
 	{
 	  grub_disk_addr_t i;
 
-	  err = (disk->dev->read) (disk, transform_sector (disk, sector),
-				   agglomerate << (GRUB_DISK_CACHE_BITS
-						   + GRUB_DISK_SECTOR_BITS
-						   - disk->log_sector_size),
-				   buf);
+	  err = grub_disk_dev_read (disk, transform_sector (disk, sector),
+				    agglomerate << (GRUB_DISK_CACHE_BITS
+						    + GRUB_DISK_SECTOR_BITS
+						    - disk->log_sector_size),
+				    buf);
 	  if (err)
 	    return err;
-	  
-	  for (i = 0; i < agglomerate; i ++)
-	    grub_disk_cache_store (disk->dev->id, disk->id,
-				   sector + (i << GRUB_DISK_CACHE_BITS),
-				   (char *) buf
-				   + (i << (GRUB_DISK_CACHE_BITS
-					    + GRUB_DISK_SECTOR_BITS)));
+
+	  /* Large transfers went straight into BUF, keep them out of the
+	     cache as well.  */
+	  if (agglomerate <= GRUB_DISK_READAHEAD_MAX_WINDOW)
+	    for (i = 0; i < agglomerate; i ++)
+	      grub_disk_cache_store (disk->dev->id, disk->id,
+				     sector + (i << GRUB_DISK_CACHE_BITS),
+				     (char *) buf
+				     + (i << (GRUB_DISK_CACHE_BITS
+					      + GRUB_DISK_SECTOR_BITS)));
 
 
 	  if (disk->read_hook)
@@ -532,6 +841,106 @@ grub_disk_read (grub_disk_t disk, grub_disk_addr_t sector,
   return grub_errno;
 }
 
+/* Read data from the disk.  */
+grub_err_t
+grub_disk_read (grub_disk_t disk, grub_disk_addr_t sector,
+		grub_off_t offset, grub_size_t size, void *buf)
+{
+  grub_disk_addr_t start;
+
+  /* First of all, check if the region is within the disk.  */
+  if (grub_disk_adjust_range (disk, &sector, &offset, size) != GRUB_ERR_NONE)
+    {
+      grub_error_push ();
+      grub_dprintf ("disk", "Read out of range: sector 0x%llx (%s).\n",
+		    (unsigned long long) sector, grub_errmsg);
+      grub_error_pop ();
+      return grub_errno;
+    }
+
+  /* Memory-backed disks need neither the cache nor read-ahead.  */
+  if (disk->memory)
+    {
+      grub_memcpy (buf, disk->memory + (sector << GRUB_DISK_SECTOR_BITS)
+		   + offset, size);
+      if (disk->read_hook)
+	(disk->read_hook) (sector, offset, size, disk->read_hook_data);
+      return GRUB_ERR_NONE;
+    }
+
+  start = sector;
+  if (grub_disk_read_real (disk, sector, offset, size, buf))
+    return grub_errno;
+
+  grub_disk_readahead (disk, start, start + ((offset + size
+					      + GRUB_DISK_SECTOR_SIZE - 1)
+					     >> GRUB_DISK_SECTOR_BITS));
+  return GRUB_ERR_NONE;
+}
+
+/* Ask the device to start reading SIZE 512B sectors at SECTOR in the
+   background, so that a grub_disk_read of them shortly afterwards does
+   not have to wait for the transfer.  Does nothing if the device has no
+   prefetch hook or the data is already cached.  */
+void
+grub_disk_prefetch (grub_disk_t disk, grub_disk_addr_t sector,
+		    grub_size_t size)
+{
+  grub_disk_addr_t from, to, total;
+  grub_off_t offset = 0;
+
+  if (! disk->dev->prefetch || size == 0)
+    return;
+
+  if (grub_disk_adjust_range (disk, &sector, &offset,
+			      size << GRUB_DISK_SECTOR_BITS) != GRUB_ERR_NONE)
+    {
+      grub_errno = GRUB_ERR_NONE;
+      return;
+    }
+
+  /* grub_disk_read_real asks the device for whole cache units.  */
+  from = sector & ~((grub_disk_addr_t) GRUB_DISK_CACHE_SIZE - 1);
+  to = ALIGN_UP (sector + size, GRUB_DISK_CACHE_SIZE);
+  if (disk->total_sectors != GRUB_DISK_SIZE_UNKNOWN)
+    {
+      total = disk->total_sectors << (disk->log_sector_size
+				      - GRUB_DISK_SECTOR_BITS);
+      if (to > total)
+	to = total;
+    }
+
+  while (from < to
+	 && grub_disk_cache_lookup (disk->dev->id, disk->id, from))
+    from += GRUB_DISK_CACHE_SIZE;
+  if (from >= to)
+    return;
+
+  if ((disk->dev->prefetch) (disk, transform_sector (disk, from),
+			     (to - from) >> (disk->log_sector_size
+					     - GRUB_DISK_SECTOR_BITS)))
+    grub_errno = GRUB_ERR_NONE;
+}
+
+/* Return the address of SIZE bytes at SECTOR and OFFSET of DISK if the
+   disk is held in memory, so that they can be used in place.  Return
+   NULL without setting an error otherwise.  */
+void *
+grub_disk_map_memory (grub_disk_t disk, grub_disk_addr_t sector,
+		      grub_off_t offset, grub_size_t size)
+{
+  if (! disk->memory)
+    return NULL;
+
+  if (grub_disk_adjust_range (disk, &sector, &offset, size) != GRUB_ERR_NONE)
+    {
+      grub_errno = GRUB_ERR_NONE;
+      return NULL;
+    }
+
+  return disk->memory + (sector << GRUB_DISK_SECTOR_BITS) + offset;
+}
+
 grub_uint64_t
 grub_disk_get_size (grub_disk_t disk)
 {
@@ -55,11 +55,29 @@ transform_sector (grub_disk_t disk, grub_disk_addr_t sector)
   return sector >> (disk->log_sector_size - GRUB_DISK_SECTOR_BITS);
 }
 
-static unsigned
-grub_disk_cache_get_index (unsigned long dev_id, unsigned long disk_id,
-			   grub_disk_addr_t sector)
+/* Return the first line of the set SECTOR belongs to.  The cache table
+   must be allocated.  */
+static struct grub_disk_cache *
+grub_disk_cache_get_set (unsigned long dev_id, unsigned long disk_id,
+			 grub_disk_addr_t sector)
 {
-  return ((dev_id * 524287UL + disk_id * 2606459UL
-	   + ((unsigned) (sector >> GRUB_DISK_CACHE_BITS)))
-	  % GRUB_DISK_CACHE_NUM);
+  unsigned set;
+
+  set = ((dev_id * 524287UL + disk_id * 2606459UL
+	  + ((unsigned) (sector >> GRUB_DISK_CACHE_BITS)))
+	 % grub_disk_cache_sets);
+  return grub_disk_cache_table + set * GRUB_DISK_CACHE_WAYS;
+}
+
+/* Release the buffer of CACHE.  Lines of a crypto device hold decrypted
+   data, which is cleared first so that it doesn't linger in freed heap
+   memory after GRUB is done with it.  */
+static void
+grub_disk_cache_free_line (struct grub_disk_cache *cache)
+{
+  if (cache->dev_id == GRUB_DISK_DEVICE_CRYPTODISK_ID)
+    grub_memset (cache->data, 0, GRUB_DISK_SECTOR_SIZE << GRUB_DISK_CACHE_BITS);
+  grub_free (cache->data);
+  cache->data = 0;
+  grub_disk_cache_reclaim.size -= GRUB_DISK_SECTOR_SIZE << GRUB_DISK_CACHE_BITS;
 }
@@ -33,6 +33,7 @@
 #include <grub/cache.h>
 #include <grub/i18n.h>
 #include <grub/tpm.h>
+#include <grub/kernel.h>
 
 /* Platforms where modules are in a readonly area of memory.  */
 #if defined(GRUB_MACHINE_QEMU)
@@ -84,19 +85,22 @@ grub_dl_remove (grub_dl_t mod)
 
 struct grub_symbol
 {
-  struct grub_symbol *next;
   const char *name;
   void *addr;
   int isfunc;
+  unsigned hash;
   grub_dl_t mod;	/* The module to which this symbol belongs.  */
 };
 typedef struct grub_symbol *grub_symbol_t;
 
-/* The size of the symbol table.  */
-#define GRUB_SYMTAB_SIZE	509
+/* The initial size of the symbol table, a power of two.  It is doubled
+   whenever it gets half full.  */
+#define GRUB_SYMTAB_INITIAL_LOG2	10
 
-/* The symbol table (using an open-hash).  */
-static struct grub_symbol *grub_symtab[GRUB_SYMTAB_SIZE];
+/* The symbol table (open addressing with linear probing).  */
+static grub_symbol_t *grub_symtab;
+static unsigned grub_symtab_log2;
+static unsigned grub_symtab_count;
 
 /* Simple hash function.  */
 static unsigned
@@ -107,7 +111,61 @@ grub_symbol_hash (const char *s)
   while (*s)
     key = key * 65599 + *s++;
 
-  return (key + (key >> 5)) % GRUB_SYMTAB_SIZE;
+  return key + (key >> 5);
+}
+
+/* First slot to probe for HASH.  */
+static inline unsigned
+grub_symtab_slot (unsigned hash)
+{
+  return (hash * 2654435761U) >> (32 - grub_symtab_log2);
+}
+
+/* Put SYM into the table, which has room for it.  If NEWEST, a symbol
+   with the same name already present is moved further down the probe
+   sequence, so that the newest registration wins as it always has.  */
+static void
+grub_symtab_insert (grub_symbol_t sym, int newest)
+{
+  unsigned mask = (1U << grub_symtab_log2) - 1;
+  unsigned i;
+
+  for (i = grub_symtab_slot (sym->hash); grub_symtab[i]; i = (i + 1) & mask)
+    if (newest && grub_symtab[i]->hash == sym->hash
+	&& grub_strcmp (grub_symtab[i]->name, sym->name) == 0)
+      {
+	grub_symbol_t old = grub_symtab[i];
+	grub_symtab[i] = sym;
+	sym = old;
+      }
+  grub_symtab[i] = sym;
+}
+
+/* Reallocate the table with 2^LOG2 slots and reinsert every symbol.  */
+static grub_err_t
+grub_symtab_rehash (unsigned log2)
+{
+  grub_symbol_t *old = grub_symtab;
+  unsigned old_size = grub_symtab ? 1U << grub_symtab_log2 : 0;
+  unsigned i, start = 0;
+
+  grub_symtab = grub_zalloc (sizeof (grub_symtab[0]) << log2);
+  if (! grub_symtab)
+    {
+      grub_symtab = old;
+      return grub_errno;
+    }
+  grub_symtab_log2 = log2;
+
+  /* Start after an empty slot so that every probe run is walked in
+     order, which keeps duplicates in their order too.  */
+  while (start < old_size && old[start])
+    start++;
+  for (i = 0; i < old_size; i++)
+    if (old[(start + i) & (old_size - 1)])
+      grub_symtab_insert (old[(start + i) & (old_size - 1)], 0);
+  grub_free (old);
+  return GRUB_ERR_NONE;
 }
 
 /* Resolve the symbol name NAME and return the address.
@@ -115,22 +173,62 @@ grub_symbol_hash (const char *s)
 static grub_symbol_t
 grub_dl_resolve_symbol (const char *name)
 {
-  grub_symbol_t sym;
+  unsigned hash, mask, i;
+
+  if (! grub_symtab)
+    return 0;
 
-  for (sym = grub_symtab[grub_symbol_hash (name)]; sym; sym = sym->next)
-    if (grub_strcmp (sym->name, name) == 0)
-      return sym;
+  hash = grub_symbol_hash (name);
+  mask = (1U << grub_symtab_log2) - 1;
+  for (i = grub_symtab_slot (hash); grub_symtab[i]; i = (i + 1) & mask)
+    if (grub_symtab[i]->hash == hash
+	&& grub_strcmp (grub_symtab[i]->name, name) == 0)
+      return grub_symtab[i];
 
   return 0;
 }
 
+/* Return the name of the function in MOD, or in the kernel if MOD is NULL,
+   which starts closest below ADDR, and the distance in *OFFSET.  Only the
+   symbols other modules may link against are known, so a static function
+   shows up as the global one before it.  Return NULL if there is none.  */
+const char *
+grub_dl_find_function (grub_dl_t mod, void *addr, grub_size_t *offset)
+{
+  grub_symbol_t best = 0;
+  unsigned i, size;
+
+  if (! grub_symtab)
+    return 0;
+
+  size = 1U << grub_symtab_log2;
+  for (i = 0; i < size; i++)
+    if (grub_symtab[i] && grub_symtab[i]->isfunc
+	&& grub_symtab[i]->mod == mod
+	&& (grub_addr_t) grub_symtab[i]->addr <= (grub_addr_t) addr
+	&& (! best || best->addr < grub_symtab[i]->addr))
+      best = grub_symtab[i];
+
+  if (! best)
+    return 0;
+  *offset = (grub_addr_t) addr - (grub_addr_t) best->addr;
+  return best->name;
+}
+
 /* Register a symbol with the name NAME and the address ADDR.  */
 grub_err_t
 grub_dl_register_symbol (const char *name, void *addr, int isfunc,
 			 grub_dl_t mod)
 {
   grub_symbol_t sym;
-  unsigned k;
+
+  if (! grub_symtab
+      || 2 * (grub_symtab_count + 1) > (1U << grub_symtab_log2))
+    {
+      if (grub_symtab_rehash (grub_symtab ? grub_symtab_log2 + 1
+			      : GRUB_SYMTAB_INITIAL_LOG2))
+	return grub_errno;
+    }
 
   sym = (grub_symbol_t) grub_malloc (sizeof (*sym));
   if (! sym)
@@ -151,10 +249,10 @@ grub_dl_register_symbol (const char *name, void *addr, int isfunc,
   sym->addr = addr;
   sym->mod = mod;
   sym->isfunc = isfunc;
+  sym->hash = grub_symbol_hash (name);
 
-  k = grub_symbol_hash (name);
-  sym->next = grub_symtab[k];
-  grub_symtab[k] = sym;
+  grub_symtab_insert (sym, 1);
+  grub_symtab_count++;
 
   return GRUB_ERR_NONE;
 }
@@ -163,28 +261,41 @@ grub_dl_register_symbol (const char *name, void *addr, int isfunc,
 static void
 grub_dl_unregister_symbols (grub_dl_t mod)
 {
-  unsigned i;
+  unsigned i, size, removed = 0;
 
   if (! mod)
     grub_fatal ("core symbols cannot be unregistered");
 
-  for (i = 0; i < GRUB_SYMTAB_SIZE; i++)
-    {
-      grub_symbol_t sym, *p, q;
+  if (! grub_symtab)
+    return;
 
-      for (p = &grub_symtab[i], sym = *p; sym; sym = q)
-	{
-	  q = sym->next;
-	  if (sym->mod == mod)
-	    {
-	      *p = q;
-	      grub_free ((void *) sym->name);
-	      grub_free (sym);
-	    }
-	  else
-	    p = &sym->next;
-	}
-    }
+  size = 1U << grub_symtab_log2;
+  for (i = 0; i < size; i++)
+    if (grub_symtab[i] && grub_symtab[i]->mod == mod)
+      {
+	grub_free ((void *) grub_symtab[i]->name);
+	grub_free (grub_symtab[i]);
+	grub_symtab[i] = 0;
+	removed++;
+      }
+  if (! removed)
+    return;
+  grub_symtab_count -= removed;
+
+  /* The holes break probe runs; close them by reinserting everything
+     that follows a hole up to the next empty slot.  */
+  for (i = 0; i < size; i++)
+    if (! grub_symtab[i])
+      {
+	unsigned j;
+
+	for (j = (i + 1) & (size - 1); grub_symtab[j]; j = (j + 1) & (size - 1))
+	  {
+	    grub_symbol_t sym = grub_symtab[j];
+	    grub_symtab[j] = 0;
+	    grub_symtab_insert (sym, 0);
+	  }
+      }
 }
 
 /* Return the address of a section whose index is N.  */
@@ -245,6 +356,10 @@ grub_dl_load_segments (grub_dl_t mod, const Elf_Ehdr *e)
        i < e->e_shnum;
        i++, s = (const Elf_Shdr *)((const char *) s + e->e_shentsize))
     {
+      /* Symbol, string and relocation sections are used in place in the
+	 ELF image and need no room here.  */
+      if (!(s->sh_flags & SHF_ALLOC))
+	continue;
       tsize = ALIGN_UP (tsize, s->sh_addralign) + s->sh_size;
       if (talign < s->sh_addralign)
 	talign = s->sh_addralign;
@@ -688,6 +803,7 @@ grub_dl_load_file (const char *filename)
   grub_ssize_t size;
   void *core = 0;
   grub_dl_t mod = 0;
+  grub_boot_span_t span;
 
 #ifdef GRUB_MACHINE_EFI
   if (grub_efi_secure_boot ())
@@ -698,17 +814,21 @@ grub_dl_load_file (const char *filename)
     }
 #endif
 
-  grub_boot_time ("Loading module %s", filename);
+  span = grub_boot_span_begin ("Loading module %s", filename);
 
   file = grub_file_open (filename);
   if (! file)
-    return 0;
+    {
+      grub_boot_span_end (span, 0);
+      return 0;
+    }
 
   size = grub_file_size (file);
   core = grub_malloc (size);
   if (! core)
     {
       grub_file_close (file);
+      grub_boot_span_end (span, 0);
       return 0;
     }
 
@@ -716,6 +836,7 @@ grub_dl_load_file (const char *filename)
     {
       grub_file_close (file);
       grub_free (core);
+      grub_boot_span_end (span, 0);
       return 0;
     }
 
@@ -728,6 +849,7 @@ grub_dl_load_file (const char *filename)
 
   mod = grub_dl_load_core (core, size);
   grub_free (core);
+  grub_boot_span_end (span, size);
   if (! mod)
     return 0;
 
@@ -735,6 +857,176 @@ grub_dl_load_file (const char *filename)
   return mod;
 }
 
+/* Modules embedded compressed in the image, not loaded yet.  */
+struct grub_dl_embedded
+{
+  struct grub_dl_embedded *next;
+  const struct grub_module_lz4_header *header;
+  /* Of the compressed data.  */
+  grub_size_t size;
+};
+
+static struct grub_dl_embedded *grub_dl_embedded_list;
+
+/* Read an LZ4 length extension into *LEN.  */
+static int
+lz4_length (const grub_uint8_t **src, const grub_uint8_t *end,
+	    grub_size_t *len)
+{
+  grub_uint8_t b;
+
+  do
+    {
+      if (*src >= end)
+	return 1;
+      b = *(*src)++;
+      *len += b;
+    }
+  while (b == 255);
+  return 0;
+}
+
+static grub_err_t
+lz4_decompress (const grub_uint8_t *src, grub_size_t srclen,
+		grub_uint8_t *dst, grub_size_t dstlen)
+{
+  const grub_uint8_t *send = src + srclen;
+  grub_uint8_t *d = dst, *dend = dst + dstlen;
+  grub_size_t len, off;
+  grub_uint8_t token;
+
+  while (src < send)
+    {
+      token = *src++;
+      len = token >> 4;
+      if (len == 15 && lz4_length (&src, send, &len))
+	goto corrupt;
+      if (len > (grub_size_t) (send - src) || len > (grub_size_t) (dend - d))
+	goto corrupt;
+      grub_memcpy (d, src, len);
+      d += len;
+      src += len;
+
+      /* The last sequence has no match.  */
+      if (src == send)
+	break;
+
+      if (send - src < 2)
+	goto corrupt;
+      off = src[0] | (src[1] << 8);
+      src += 2;
+      if (off == 0 || off > (grub_size_t) (d - dst))
+	goto corrupt;
+      len = token & 15;
+      if (len == 15 && lz4_length (&src, send, &len))
+	goto corrupt;
+      len += 4;
+      if (len > (grub_size_t) (dend - d))
+	goto corrupt;
+      if (off >= len)
+	{
+	  grub_memcpy (d, d - off, len);
+	  d += len;
+	}
+      else
+	for (; len; len--, d++)
+	  *d = d[-off];
+    }
+
+  if (d == dend)
+    return GRUB_ERR_NONE;
+
+ corrupt:
+  return grub_error (GRUB_ERR_BAD_COMPRESSED_DATA,
+		     N_("embedded module is corrupted"));
+}
+
+static grub_dl_t
+grub_dl_load_lz4 (const struct grub_module_lz4_header *header,
+		  grub_size_t size)
+{
+  grub_dl_t mod;
+  void *core;
+
+  core = grub_malloc (header->size);
+  if (! core)
+    return 0;
+  if (lz4_decompress ((const grub_uint8_t *) (header + 1), size, core,
+		      header->size))
+    {
+      grub_free (core);
+      return 0;
+    }
+  mod = grub_dl_load_core (core, header->size);
+  grub_free (core);
+  return mod;
+}
+
+/* Load the compressed module in HEADER, or remember it for later if it is
+   only to be loaded on demand.  */
+grub_err_t
+grub_dl_load_embedded (struct grub_module_header *header)
+{
+  const struct grub_module_lz4_header *lz4;
+  struct grub_dl_embedded *e;
+  grub_size_t size;
+
+  lz4 = (const struct grub_module_lz4_header *) (header + 1);
+  size = header->size - sizeof (*header) - sizeof (*lz4);
+
+  if (! (lz4->flags & GRUB_MODULE_LZ4_LAZY))
+    return grub_dl_load_lz4 (lz4, size) ? GRUB_ERR_NONE : grub_errno;
+
+  /* The module space is given back to the heap once startup is done,
+     keep a copy where that happens.  */
+  e = grub_malloc (sizeof (*e)
+		   + (GRUB_KERNEL_PRELOAD_SPACE_REUSABLE
+		      ? sizeof (*lz4) + size : 0));
+  if (! e)
+    return grub_errno;
+  if (GRUB_KERNEL_PRELOAD_SPACE_REUSABLE)
+    {
+      grub_memcpy (e + 1, lz4, sizeof (*lz4) + size);
+      lz4 = (const struct grub_module_lz4_header *) (e + 1);
+    }
+  e->header = lz4;
+  e->size = size;
+  e->next = grub_dl_embedded_list;
+  grub_dl_embedded_list = e;
+  return GRUB_ERR_NONE;
+}
+
+/* Load NAME if it was embedded to be loaded on demand.  */
+static grub_dl_t
+grub_dl_load_lazy (const char *name)
+{
+  struct grub_dl_embedded **p, *e;
+  grub_dl_t mod;
+
+  for (p = &grub_dl_embedded_list; *p; p = &(*p)->next)
+    if (grub_strncmp ((*p)->header->name, name,
+		      sizeof ((*p)->header->name)) == 0)
+      break;
+  e = *p;
+  if (! e)
+    return 0;
+
+  /* Loading the dependencies changes the list.  */
+  *p = e->next;
+  mod = grub_dl_load_lz4 (e->header, e->size);
+  if (! mod)
+    {
+      e->next = grub_dl_embedded_list;
+      grub_dl_embedded_list = e;
+      return 0;
+    }
+  grub_free (e);
+
+  /* Like a module loaded from a file, it can go when nothing needs it.  */
+  mod->ref_count--;
+  return mod;
+}
+
 /* Load a module using a symbolic name.  */
 grub_dl_t
 grub_dl_load (const char *name)
@@ -750,6 +1042,10 @@ grub_dl_load (const char *name)
   if (grub_no_modules)
     return 0;
 
+  mod = grub_dl_load_lazy (name);
+  if (mod || grub_errno)
+    return mod;
+
   if (! grub_dl_dir) {
     grub_error (GRUB_ERR_FILE_NOT_FOUND, N_("variable `%s' isn't set"), "prefix");
     return 0;
@@ -28,6 +28,57 @@
 
 grub_addr_t grub_modbase;
 
+#define GRUB_EFI_IDLE_MAX_EVENTS	8
+
+static grub_efi_event_t idle_timer;
+static grub_efi_event_t idle_events[GRUB_EFI_IDLE_MAX_EVENTS];
+static unsigned idle_n_events;
+
+void
+grub_efi_idle_add_event (grub_efi_event_t event)
+{
+  if (event && idle_n_events < GRUB_EFI_IDLE_MAX_EVENTS)
+    idle_events[idle_n_events++] = event;
+}
+
+void
+grub_efi_idle_remove_event (grub_efi_event_t event)
+{
+  unsigned i;
+
+  for (i = 0; i < idle_n_events; i++)
+    if (idle_events[i] == event)
+      {
+	idle_events[i] = idle_events[--idle_n_events];
+	return;
+      }
+}
+
+/* Sleep in WaitForEvent until the timer, a key press or one of the idle
+   events, rather than spinning on the terminals.  */
+static void
+grub_efi_idle (grub_uint32_t ms)
+{
+  grub_efi_boot_services_t *b = grub_efi_system_table->boot_services;
+  grub_efi_event_t events[GRUB_EFI_IDLE_MAX_EVENTS + 2];
+  grub_efi_uintn_t n = 0, index;
+  unsigned i;
+
+  if (efi_call_3 (b->set_timer, idle_timer, GRUB_EFI_TIMER_RELATIVE,
+		  (grub_efi_uint64_t) ms * 10000) != GRUB_EFI_SUCCESS)
+    return;
+
+  events[n++] = idle_timer;
+  if (grub_efi_system_table->con_in
+      && grub_efi_system_table->con_in->wait_for_key)
+    events[n++] = grub_efi_system_table->con_in->wait_for_key;
+  for (i = 0; i < idle_n_events; i++)
+    events[n++] = idle_events[i];
+
+  efi_call_3 (b->wait_for_event, n, events, &index);
+  efi_call_3 (b->set_timer, idle_timer, GRUB_EFI_TIMER_CANCEL, 0);
+}
+
 void
 grub_efi_init (void)
 {
@@ -43,6 +94,11 @@ grub_efi_init (void)
 	      0, 0, 0, NULL);
 
   grub_efidisk_init ();
+
+  if (efi_call_5 (grub_efi_system_table->boot_services->create_event,
+		  GRUB_EFI_EVT_TIMER, GRUB_EFI_TPL_CALLBACK, 0, 0,
+		  &idle_timer) == GRUB_EFI_SUCCESS)
+    grub_machine_idle = grub_efi_idle;
 }
 
 void (*grub_efi_net_config) (grub_efi_handle_t hnd, 
@@ -75,6 +131,14 @@ grub_machine_get_bootlocation (char **device, char **path)
 void
 grub_efi_fini (void)
 {
+  if (idle_timer)
+    {
+      grub_machine_idle = NULL;
+      efi_call_1 (grub_efi_system_table->boot_services->close_event,
+		  idle_timer);
+      idle_timer = 0;
+    }
+  idle_n_events = 0;
   grub_efidisk_fini ();
   grub_console_fini ();
 }
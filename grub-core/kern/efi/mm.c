@@ -19,6 +19,7 @@
 
 #include <grub/misc.h>
 #include <grub/mm.h>
+#include <grub/mm_private.h>
 #include <grub/efi/api.h>
 #include <grub/efi/efi.h>
 #include <grub/cpu/efi/memory.h>
@@ -42,6 +43,21 @@
 #define MIN_HEAP_SIZE	0x100000
 #define MAX_HEAP_SIZE	(1600 * 0x100000)
 
+/* The heap claimed at startup.  The rest is requested from the firmware
+   when an allocation fails, in chunks of at least HEAP_GROWTH_SIZE.  */
+#define DEFAULT_HEAP_SIZE	(16 * 0x100000)
+#define HEAP_GROWTH_SIZE	(4 * 0x100000)
+#define MAX_HEAP_GROWTHS	64
+
+/* Regions added after startup, so that they can be given back.  */
+static struct
+{
+  grub_efi_physical_address_t addr;
+  grub_efi_uintn_t pages;
+} heap_growths[MAX_HEAP_GROWTHS];
+static unsigned heap_growth_count;
+static grub_efi_uint64_t heap_pages;
+
 static void *finish_mmap_buf = 0;
 static grub_efi_uintn_t finish_mmap_size = 0;
 static grub_efi_uintn_t finish_key = 0;
@@ -49,6 +65,17 @@ static grub_efi_uintn_t finish_desc_size;
 static grub_efi_uint32_t finish_desc_version;
 int grub_efi_is_finished = 0;
 
+/* Bumped whenever GRUB allocates or frees firmware pages, which is what
+   changes the memory map while GRUB runs.  */
+grub_uint64_t grub_efi_mmap_generation;
+
+/* The map returned by grub_efi_get_cached_memory_map.  */
+static grub_efi_memory_descriptor_t *cached_mmap;
+static grub_efi_uintn_t cached_mmap_alloc;
+static grub_efi_uintn_t cached_mmap_count;
+static grub_efi_uintn_t cached_mmap_key;
+static grub_uint64_t cached_mmap_generation;
+
 /* Allocate pages below a specified address */
 void *
 grub_efi_allocate_pages_max (grub_efi_physical_address_t max,
@@ -78,6 +105,7 @@ grub_efi_allocate_pages_max (grub_efi_physical_address_t max,
 	return 0;
     }
 
+  grub_efi_mmap_generation++;
   return (void *) ((grub_addr_t) address);
 }
 
@@ -127,6 +155,7 @@ grub_efi_allocate_pages (grub_efi_physical_address_t address,
 	return 0;
     }
 
+  grub_efi_mmap_generation++;
   return (void *) ((grub_addr_t) address);
 }
 
@@ -139,6 +168,7 @@ grub_efi_free_pages (grub_efi_physical_address_t address,
 
   b = grub_efi_system_table->boot_services;
   efi_call_2 (b->free_pages, address, pages);
+  grub_efi_mmap_generation++;
 }
 
 #if defined (__i386__) || defined (__x86_64__)
@@ -230,6 +260,7 @@ grub_efi_finish_boot_services (grub_efi_uintn_t *outbuf_size, void *outbuf,
       grub_printf ("Trying to terminate EFI services again\n");
     }
   grub_efi_is_finished = 1;
+  grub_efi_mmap_generation++;
   if (outbuf_size)
     *outbuf_size = finish_mmap_size;
   if (outbuf)
@@ -308,6 +339,86 @@ grub_efi_get_memory_map (grub_efi_uintn_t *memory_map_size,
     return -1;
 }
 
+/* Return the memory map sorted by address, with adjacent descriptors of the
+   same type and attributes merged, and its length in *COUNT.  The firmware
+   is only asked again after GRUB allocated or freed pages, so the map does
+   not show what the firmware allocated for itself meanwhile.  The returned
+   array stays valid until the next call; MAP_KEY, if not NULL, receives the
+   key the firmware returned with it.  */
+const grub_efi_memory_descriptor_t *
+grub_efi_get_cached_memory_map (grub_efi_uintn_t *count,
+				grub_efi_uintn_t *map_key)
+{
+  grub_efi_memory_descriptor_t *d, tmp;
+  grub_efi_uintn_t size, desc_size, key, i, j, n;
+  int ret;
+
+  if (cached_mmap && cached_mmap_generation == grub_efi_mmap_generation)
+    goto out;
+
+  while (1)
+    {
+      size = cached_mmap_alloc;
+      ret = grub_efi_get_memory_map (&size, cached_mmap, &key, &desc_size, 0);
+      if (ret > 0)
+	break;
+      if (ret < 0)
+	{
+	  grub_error (GRUB_ERR_IO, "couldn't retrieve memory map");
+	  return NULL;
+	}
+
+      /* Allocating the buffer may split a few more descriptors.  */
+      grub_free (cached_mmap);
+      cached_mmap_alloc = size + 8 * desc_size;
+      cached_mmap = grub_malloc (cached_mmap_alloc);
+      if (!cached_mmap)
+	{
+	  cached_mmap_alloc = 0;
+	  return NULL;
+	}
+    }
+  cached_mmap_generation = grub_efi_mmap_generation;
+  cached_mmap_key = key;
+  n = size / desc_size;
+
+  /* Drop the firmware's descriptor stride, so that callers can index.  */
+  if (desc_size != sizeof (*d))
+    for (i = 1; i < n; i++)
+      grub_memmove (&cached_mmap[i], (char *) cached_mmap + i * desc_size,
+		    sizeof (*d));
+
+  /* The firmware usually returns the map sorted already, which is the best
+     case for an insertion sort.  */
+  for (i = 1; i < n; i++)
+    {
+      tmp = cached_mmap[i];
+      for (j = i; j > 0
+	     && cached_mmap[j - 1].physical_start > tmp.physical_start; j--)
+	cached_mmap[j] = cached_mmap[j - 1];
+      cached_mmap[j] = tmp;
+    }
+
+  for (i = 1, j = 0; i < n; i++)
+    {
+      d = &cached_mmap[j];
+      if (d->type == cached_mmap[i].type
+	  && d->attribute == cached_mmap[i].attribute
+	  && d->physical_start + (d->num_pages << 12)
+	     == cached_mmap[i].physical_start)
+	d->num_pages += cached_mmap[i].num_pages;
+      else
+	cached_mmap[++j] = cached_mmap[i];
+    }
+  cached_mmap_count = n ? j + 1 : 0;
+
+ out:
+  *count = cached_mmap_count;
+  if (map_key)
+    *map_key = cached_mmap_key;
+  return cached_mmap;
+}
+
 /* Sort the memory map in place.  */
 static void
 sort_memory_map (grub_efi_memory_descriptor_t *memory_map,
@@ -441,6 +552,7 @@ add_memory_regions (grub_efi_memory_descriptor_t *memory_map,
 		    (unsigned) pages);
 
       grub_mm_init_region (addr, PAGES_TO_BYTES (pages));
+      heap_pages += pages;
 
       required_pages -= pages;
       if (required_pages == 0)
@@ -472,6 +584,83 @@ print_memory_map (grub_efi_memory_descriptor_t *memory_map,
 }
 #endif
 
+/* Add a heap region able to hold SIZE more bytes.  Called by
+   grub_memalign when the heap is exhausted.  */
+static grub_err_t
+grub_efi_mm_grow (grub_size_t size)
+{
+  grub_efi_uintn_t pages;
+  void *addr;
+
+  if (grub_efi_is_finished || heap_growth_count == MAX_HEAP_GROWTHS
+      || size > MAX_HEAP_SIZE)
+    return GRUB_ERR_OUT_OF_MEMORY;
+
+  /* Leave room for the region and block headers.  */
+  pages = BYTES_TO_PAGES (size + 0x1000);
+  if (pages < BYTES_TO_PAGES (HEAP_GROWTH_SIZE))
+    pages = BYTES_TO_PAGES (HEAP_GROWTH_SIZE);
+  if (heap_pages + pages > BYTES_TO_PAGES (MAX_HEAP_SIZE))
+    return GRUB_ERR_OUT_OF_MEMORY;
+
+  addr = grub_efi_allocate_pages (0, pages);
+  if (!addr)
+    return GRUB_ERR_OUT_OF_MEMORY;
+  /* Avoid less than 1MB, as for the initial heap.  */
+  if ((grub_addr_t) addr < 0x100000)
+    {
+      grub_efi_free_pages ((grub_addr_t) addr, pages);
+      return GRUB_ERR_OUT_OF_MEMORY;
+    }
+
+  heap_growths[heap_growth_count].addr = (grub_addr_t) addr;
+  heap_growths[heap_growth_count].pages = pages;
+  heap_growth_count++;
+  heap_pages += pages;
+
+  /* Keep one cell short of the end, so that grub_mm_init_region never
+     merges this region with a neighbour and it can be released alone.  */
+  grub_mm_init_region (addr, PAGES_TO_BYTES (pages) - GRUB_MM_ALIGN);
+  return GRUB_ERR_NONE;
+}
+
+/* Give the regions added by grub_efi_mm_grow back to the firmware if
+   nothing is allocated in them any more.  Called before a loader is
+   started.  */
+void
+grub_efi_mm_release_heap (void)
+{
+  unsigned i, j;
+
+  if (grub_efi_is_finished || heap_growth_count == 0)
+    return;
+
+  grub_mm_flush_bins ();
+
+  for (i = 0, j = 0; i < heap_growth_count; i++)
+    {
+      grub_mm_region_t r, *rp;
+      grub_addr_t addr = heap_growths[i].addr;
+
+      for (rp = &grub_mm_base; *rp; rp = &((*rp)->next))
+	if ((grub_addr_t) *rp - (*rp)->pre_size == addr)
+	  break;
+      r = *rp;
+
+      if (r && r->first->magic == GRUB_MM_FREE_MAGIC
+	  && r->first->next == r->first
+	  && (r->first->size << GRUB_MM_ALIGN_LOG2) == r->size)
+	{
+	  *rp = r->next;
+	  grub_efi_free_pages (addr, heap_growths[i].pages);
+	  heap_pages -= heap_growths[i].pages;
+	  continue;
+	}
+      heap_growths[j++] = heap_growths[i];
+    }
+  heap_growth_count = j;
+}
+
 void
 grub_efi_mm_init (void)
 {
@@ -523,14 +712,15 @@ grub_efi_mm_init (void)
   filtered_memory_map_end = filter_memory_map (memory_map, filtered_memory_map,
 					       desc_size, memory_map_end);
 
-  /* By default, request a quarter of the available memory.  */
+  /* Start with a quarter of the available memory, but no more than
+     DEFAULT_HEAP_SIZE; grub_efi_mm_grow adds the rest on demand.  */
   total_pages = get_total_pages (filtered_memory_map, desc_size,
 				 filtered_memory_map_end);
   required_pages = (total_pages >> 2);
   if (required_pages < BYTES_TO_PAGES (MIN_HEAP_SIZE))
     required_pages = BYTES_TO_PAGES (MIN_HEAP_SIZE);
-  else if (required_pages > BYTES_TO_PAGES (MAX_HEAP_SIZE))
-    required_pages = BYTES_TO_PAGES (MAX_HEAP_SIZE);
+  else if (required_pages > BYTES_TO_PAGES (DEFAULT_HEAP_SIZE))
+    required_pages = BYTES_TO_PAGES (DEFAULT_HEAP_SIZE);
 
   /* Sort the filtered descriptors, so that GRUB can allocate pages
      from smaller regions.  */
@@ -556,4 +746,6 @@ grub_efi_mm_init (void)
   /* Release the memory maps.  */
   grub_efi_free_pages ((grub_addr_t) memory_map,
 		       2 * BYTES_TO_PAGES (MEMORY_MAP_SIZE));
+
+  grub_mm_add_region_fn = grub_efi_mm_grow;
 }
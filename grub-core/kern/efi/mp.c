@@ -0,0 +1,186 @@
+/* mp.c - run jobs on application processors through EFI_MP_SERVICES  */
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2026  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <grub/err.h>
+#include <grub/job.h>
+#include <grub/mm.h>
+#include <grub/types.h>
+#include <grub/efi/api.h>
+#include <grub/efi/efi.h>
+
+#if defined (__i386__) || defined (__x86_64__) || defined (__aarch64__)
+
+/* The firmware calls the procedure with the EFI calling convention, which
+   on x86_64 is not the one GRUB is built with.  */
+#if defined (__x86_64__) && !defined (__MINGW64__) && !defined (__CYGWIN__)
+#define AP_PROCEDURE __attribute__ ((ms_abi))
+#else
+#define AP_PROCEDURE
+#endif
+
+#define MAX_WORKERS 32
+
+struct worker
+{
+  /* The firmware keeps using SSE on the processor after we return, but
+     jobs may clobber any vector register (cryptodisk uses AES-NI).  */
+  grub_uint8_t fpu_state[512];
+  struct grub_job *job;
+  grub_efi_uintn_t number;
+  grub_efi_event_t event;
+  volatile int busy;
+};
+
+static grub_efi_mp_services_t *mp;
+static struct worker *workers;
+static unsigned nworkers;
+static int probed;
+
+static void AP_PROCEDURE
+run_worker (void *arg)
+{
+  struct worker *w = arg;
+  struct grub_job *job = w->job;
+
+#if defined (__i386__) || defined (__x86_64__)
+  asm volatile ("fxsave %0" : "=m" (w->fpu_state));
+#endif
+  job->run (job);
+#if defined (__i386__) || defined (__x86_64__)
+  asm volatile ("fxrstor %0" : : "m" (w->fpu_state));
+#endif
+
+  /* Results first, then the flag grub_job_wait polls.  */
+#ifdef __aarch64__
+  asm volatile ("dmb ish" : : : "memory");
+#else
+  asm volatile ("" : : : "memory");
+#endif
+  job->done = 1;
+  w->busy = 0;
+}
+
+static void
+probe (void)
+{
+  grub_efi_guid_t guid = GRUB_EFI_MP_SERVICES_GUID;
+  grub_efi_processor_information_t info;
+  grub_efi_uintn_t count, enabled, self, i;
+  const grub_efi_uint32_t usable = (GRUB_EFI_PROCESSOR_ENABLED_BIT
+				    | GRUB_EFI_PROCESSOR_HEALTH_STATUS_BIT);
+
+  probed = 1;
+
+  mp = grub_efi_locate_protocol (&guid, 0);
+  if (!mp)
+    return;
+  if (efi_call_3 (mp->get_number_of_processors, mp, &count, &enabled)
+      != GRUB_EFI_SUCCESS || enabled < 2
+      || efi_call_2 (mp->who_am_i, mp, &self) != GRUB_EFI_SUCCESS)
+    return;
+  if (count > MAX_WORKERS + 1)
+    count = MAX_WORKERS + 1;
+
+  workers = grub_memalign (16, (count - 1) * sizeof (*workers));
+  if (!workers)
+    {
+      grub_errno = GRUB_ERR_NONE;
+      return;
+    }
+
+  for (i = 0; i < count && nworkers < count - 1; i++)
+    {
+      if (i == self
+	  || efi_call_3 (mp->get_processor_info, mp, i, &info)
+	     != GRUB_EFI_SUCCESS
+	  || (info.status_flag & GRUB_EFI_PROCESSOR_AS_BSP_BIT)
+	  || (info.status_flag & usable) != usable)
+	continue;
+      /* Without an event StartupThisAP blocks until the job is done.  */
+      if (efi_call_5 (grub_efi_system_table->boot_services->create_event,
+		      0, 0, NULL, NULL, &workers[nworkers].event)
+	  != GRUB_EFI_SUCCESS)
+	continue;
+      workers[nworkers].number = i;
+      workers[nworkers].busy = 0;
+      nworkers++;
+    }
+}
+
+unsigned
+grub_efi_mp_workers (void)
+{
+  unsigned i, idle = 0;
+
+  if (grub_efi_is_finished)
+    return 0;
+  if (!probed)
+    probe ();
+
+  for (i = 0; i < nworkers; i++)
+    if (!workers[i].busy)
+      idle++;
+  return idle;
+}
+
+int
+grub_efi_mp_start (struct grub_job *job)
+{
+  unsigned i;
+
+  if (grub_efi_is_finished || !grub_efi_mp_workers ())
+    return 0;
+
+  for (i = 0; i < nworkers; i++)
+    {
+      struct worker *w = &workers[i];
+
+      if (w->busy)
+	continue;
+      w->job = job;
+      w->busy = 1;
+      /* The firmware only accepts the processor again once it has
+	 noticed the previous procedure returned, so NOT_READY just means
+	 trying the next one.  The event is never waited on; grub_job_wait
+	 polls the job instead.  */
+      if (efi_call_7 (mp->startup_this_ap, mp,
+		      (grub_efi_ap_procedure_t) run_worker, w->number,
+		      w->event, 0, w, NULL) == GRUB_EFI_SUCCESS)
+	return 1;
+      w->busy = 0;
+    }
+
+  return 0;
+}
+
+#else
+
+unsigned
+grub_efi_mp_workers (void)
+{
+  return 0;
+}
+
+int
+grub_efi_mp_start (struct grub_job *job __attribute__ ((unused)))
+{
+  return 0;
+}
+
+#endif
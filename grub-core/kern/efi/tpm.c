@@ -170,10 +170,12 @@ typedef struct {
 } Event;
 
 
+/* With DIGEST set, BUF and SIZE are ignored and the firmware extends the
+   PCR with DIGEST instead of hashing anything itself.  */
 static grub_err_t
 grub_tpm1_log_event(grub_efi_handle_t tpm_handle, unsigned char *buf,
-		    grub_size_t size, grub_uint8_t pcr,
-		    const char *description)
+		    grub_size_t size, const grub_uint8_t *digest,
+		    grub_uint8_t pcr, const char *description)
 {
   Event *event;
   grub_efi_status_t status;
@@ -198,6 +200,14 @@ grub_tpm1_log_event(grub_efi_handle_t tpm_handle, unsigned char *buf,
   event->eventsize = grub_strlen(description) + 1;
   grub_memcpy(event->event, description, event->eventsize);
 
+  /* HashLogExtendEvent uses the digest in the event when given no data.  */
+  if (digest)
+    {
+      grub_memcpy(event->digest, digest, sizeof (event->digest));
+      buf = 0;
+      size = 0;
+    }
+
   algorithm = TCG_ALG_SHA;
   status = efi_call_7 (tpm->log_extend_event, tpm, buf, (grub_uint64_t) size,
 		       algorithm, event, &eventnum, &lastevent);
@@ -275,8 +285,51 @@ grub_tpm_log_event(unsigned char *buf, grub_size_t size, grub_uint8_t pcr,
     return 0;
 
   if (protocol_version == 1) {
-    return grub_tpm1_log_event(tpm_handle, buf, size, pcr, description);
+    return grub_tpm1_log_event(tpm_handle, buf, size, 0, pcr, description);
   } else {
     return grub_tpm2_log_event(tpm_handle, buf, size, pcr, description);
   }
 }
+
+grub_tpm_hash_mode_t
+grub_tpm_hash_mode(void)
+{
+  grub_efi_handle_t tpm_handle;
+  grub_efi_uint8_t protocol_version;
+
+  if (!grub_tpm_handle_find(&tpm_handle, &protocol_version))
+    return GRUB_TPM_HASH_NONE;
+
+  /* TCG2 HashLogExtendEvent has no way to take a digest computed by the
+     caller, so the firmware keeps doing the hashing there.  */
+  if (protocol_version == 1) {
+    grub_efi_tpm_protocol_t *tpm;
+
+    tpm = grub_efi_open_protocol (tpm_handle, &tpm_guid,
+				  GRUB_EFI_OPEN_PROTOCOL_GET_PROTOCOL);
+    return grub_tpm_present(tpm) ? GRUB_TPM_HASH_SHA1 : GRUB_TPM_HASH_NONE;
+  } else {
+    grub_efi_tpm2_protocol_t *tpm;
+
+    tpm = grub_efi_open_protocol (tpm_handle, &tpm2_guid,
+				  GRUB_EFI_OPEN_PROTOCOL_GET_PROTOCOL);
+    return grub_tpm2_present(tpm) ? GRUB_TPM_HASH_FIRMWARE : GRUB_TPM_HASH_NONE;
+  }
+}
+
+grub_err_t
+grub_tpm_log_digest(const grub_uint8_t *digest, grub_uint8_t pcr,
+		    const char *description)
+{
+  grub_efi_handle_t tpm_handle;
+  grub_efi_uint8_t protocol_version;
+
+  if (!grub_tpm_handle_find(&tpm_handle, &protocol_version))
+    return 0;
+
+  if (protocol_version != 1)
+    return grub_error (GRUB_ERR_NOT_IMPLEMENTED_YET,
+		       N_("TPM doesn't accept precomputed digests"));
+
+  return grub_tpm1_log_event(tpm_handle, 0, 0, digest, pcr, description);
+}
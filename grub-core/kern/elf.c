@@ -152,6 +152,82 @@ grub_elf_open (const char *name)
   return elf;
 }
 
+/* A segment as grub_elfXX_load puts it in memory.  */
+struct grub_elf_segment
+{
+  grub_addr_t addr;
+  grub_off_t offset;
+  grub_size_t filesz;
+  grub_size_t memsz;
+};
+
+static int
+grub_elf_segments_overlap (const struct grub_elf_segment *segs, unsigned n)
+{
+  unsigned i, j;
+
+  for (i = 0; i < n; i++)
+    for (j = i + 1; j < n; j++)
+      if (segs[i].addr < segs[j].addr + segs[j].memsz
+	  && segs[j].addr < segs[i].addr + segs[i].memsz)
+	return 1;
+  return 0;
+}
+
+/* Read and clear the N segments in SEGS.  Unless they overlap in memory,
+   in which case the order they are written in matters, they are taken in
+   file order, so that there is no seeking back and forth.  Segments that
+   follow each other both in the file and in memory are read with one
+   request.  */
+static grub_err_t
+grub_elf_load_segments (grub_elf_t elf, const char *filename,
+			struct grub_elf_segment *segs, unsigned n)
+{
+  unsigned i, j;
+
+  if (!grub_elf_segments_overlap (segs, n))
+    for (i = 1; i < n; i++)
+      {
+	struct grub_elf_segment seg = segs[i];
+
+	for (j = i; j > 0 && segs[j - 1].offset > seg.offset; j--)
+	  segs[j] = segs[j - 1];
+	segs[j] = seg;
+      }
+
+  for (i = 0; i < n; i = j)
+    {
+      grub_size_t len = segs[i].filesz;
+
+      for (j = i + 1; j < n
+	     && segs[j - 1].filesz == segs[j - 1].memsz
+	     && segs[j].offset == segs[i].offset + len
+	     && segs[j].addr == segs[i].addr + len; j++)
+	len += segs[j].filesz;
+
+      if (len)
+	{
+	  if (grub_file_seek (elf->file, segs[i].offset) == (grub_off_t) -1)
+	    return grub_errno;
+	  if (grub_file_read_direct (elf->file, (void *) segs[i].addr, len)
+	      != (grub_ssize_t) len)
+	    {
+	      if (!grub_errno)
+		grub_error (GRUB_ERR_FILE_READ_ERROR,
+			    N_("premature end of file %s"), filename);
+	      return grub_errno;
+	    }
+	}
+
+      /* Only the last of a run can have anything to clear.  */
+      if (segs[j - 1].filesz < segs[j - 1].memsz)
+	grub_memset ((void *) (segs[j - 1].addr + segs[j - 1].filesz), 0,
+		     segs[j - 1].memsz - segs[j - 1].filesz);
+    }
+
+  return GRUB_ERR_NONE;
+}
+
 
 #define grub_swap_bytes_halfXX grub_swap_bytes16
 #define grub_swap_bytes_wordXX grub_swap_bytes32
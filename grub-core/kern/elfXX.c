@@ -111,6 +111,13 @@ grub_elfXX_load (grub_elf_t elf, const char *filename,
   grub_addr_t load_base = (grub_addr_t) -1ULL;
   grub_size_t load_size = 0;
   ElfXX_Phdr *phdr;
+  struct grub_elf_segment *segs;
+  unsigned nsegs = 0;
+  grub_err_t err;
+
+  segs = grub_malloc (elf->ehdr.ehdrXX.e_phnum * sizeof (*segs));
+  if (!segs)
+    return grub_errno;
 
   FOR_ELFXX_PHDRS(elf, phdr)
   {
@@ -143,29 +150,20 @@ grub_elfXX_load (grub_elf_t elf, const char *filename,
 		  (unsigned long long) load_addr,
 		  (unsigned long long) phdr->p_memsz);
 
-    if (grub_file_seek (elf->file, phdr->p_offset) == (grub_off_t) -1)
-      return grub_errno;
-
-    if (phdr->p_filesz)
-      {
-	grub_ssize_t read;
-	read = grub_file_read (elf->file, (void *) load_addr, phdr->p_filesz);
-	if (read != (grub_ssize_t) phdr->p_filesz)
-	  {
-	    if (!grub_errno)
-	      grub_error (GRUB_ERR_FILE_READ_ERROR, N_("premature end of file %s"),
-			  filename);
-	    return grub_errno;
-	  }
-      }
-
-    if (phdr->p_filesz < phdr->p_memsz)
-      grub_memset ((void *) (grub_addr_t) (load_addr + phdr->p_filesz),
-		   0, phdr->p_memsz - phdr->p_filesz);
+    segs[nsegs].addr = load_addr;
+    segs[nsegs].offset = phdr->p_offset;
+    segs[nsegs].filesz = phdr->p_filesz;
+    segs[nsegs].memsz = phdr->p_memsz;
+    nsegs++;
 
     load_size += phdr->p_memsz;
   }
 
+  err = grub_elf_load_segments (elf, filename, segs, nsegs);
+  grub_free (segs);
+  if (err)
+    return err;
+
   if (base)
     *base = load_base;
   if (size)
@@ -30,6 +30,7 @@
 #include <grub/misc.h>
 #include <grub/i18n.h>
 #include <grub/list.h>
+#include <grub/time.h>
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -58,6 +59,95 @@ static struct
   int device_map;
 } map[256];
 
+/* Read accounting, to study access patterns and how they would fare on
+   slow media.  If GRUB_HOSTDISK_TRACE names a file, every read request
+   is logged there as "DISK SECTOR BYTES MS", with SECTOR in 512-byte
+   units and MS the time since startup.  GRUB_HOSTDISK_LATENCY=US[:US_KIB]
+   holds up every request by US microseconds plus US_KIB per KiB read,
+   as slow firmware would.  */
+static FILE *trace_file;
+static grub_uint64_t trace_start;
+static unsigned long latency_request, latency_kib;
+static grub_uint64_t latency_owed;
+static unsigned long account_reads;
+static grub_uint64_t account_bytes, account_delay;
+
+static void
+account_read (grub_disk_t disk, grub_disk_addr_t sector, grub_size_t size)
+{
+  grub_uint64_t bytes = (grub_uint64_t) size << disk->log_sector_size;
+
+  account_reads++;
+  account_bytes += bytes;
+
+  if (trace_file)
+    fprintf (trace_file, "%s %llu %llu %llu\n", disk->name,
+	     (unsigned long long) (sector << (disk->log_sector_size
+					      - GRUB_DISK_SECTOR_BITS)),
+	     (unsigned long long) bytes,
+	     (unsigned long long) (grub_get_time_ms () - trace_start));
+
+  if (latency_request || latency_kib)
+    {
+      grub_uint64_t delay = latency_request + (bytes >> 10) * latency_kib;
+
+      account_delay += delay;
+      /* Sleeps are in milliseconds; carry the rest over.  */
+      latency_owed += delay;
+      if (latency_owed >= 1000)
+	{
+	  grub_millisleep (latency_owed / 1000);
+	  latency_owed %= 1000;
+	}
+    }
+}
+
+static void
+account_init (void)
+{
+  const char *v;
+
+  v = getenv ("GRUB_HOSTDISK_TRACE");
+  if (v && *v)
+    {
+      trace_file = grub_util_fopen (v, "w");
+      if (! trace_file)
+	grub_util_warn (_("cannot open `%s': %s"), v, strerror (errno));
+    }
+  trace_start = grub_get_time_ms ();
+
+  v = getenv ("GRUB_HOSTDISK_LATENCY");
+  if (v && *v)
+    {
+      char *end;
+
+      latency_request = strtoul (v, &end, 0);
+      if (*end == ':')
+	latency_kib = strtoul (end + 1, &end, 0);
+    }
+}
+
+static void
+account_fini (void)
+{
+  if (! account_reads)
+    return;
+
+  grub_util_info ("%lu disk reads, %llu KiB, %llu ms of simulated latency",
+		  account_reads, (unsigned long long) (account_bytes >> 10),
+		  (unsigned long long) (account_delay / 1000));
+  if (trace_file)
+    {
+      fprintf (trace_file, "# %lu reads, %llu bytes, %llu us of simulated latency\n",
+	       account_reads, (unsigned long long) account_bytes,
+	       (unsigned long long) account_delay);
+      fclose (trace_file);
+      trace_file = NULL;
+    }
+  account_reads = 0;
+  account_bytes = account_delay = 0;
+}
+
 static int
 unescape_cmp (const char *a, const char *b_escaped)
 {
@@ -282,6 +372,8 @@ static grub_err_t
 grub_util_biosdisk_read (grub_disk_t disk, grub_disk_addr_t sector,
 			 grub_size_t size, char *buf)
 {
+  account_read (disk, sector, size);
+
   while (size)
     {
       grub_util_fd_t fd;
@@ -573,6 +665,7 @@ void
 grub_util_biosdisk_init (const char *dev_map)
 {
   read_device_map (dev_map);
+  account_init ();
   grub_disk_dev_register (&grub_util_biosdisk_dev);
 }
 
@@ -590,6 +683,7 @@ grub_util_biosdisk_fini (void)
       map[i].drive = map[i].device = NULL;
     }
 
+  account_fini ();
   grub_disk_dev_unregister (&grub_util_biosdisk_dev);
 }
 
@@ -25,7 +25,15 @@
 #include <setjmp.h>
 #include <string.h>
 #include <signal.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <sys/types.h>
+#ifndef __MINGW32__
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#endif
 
 #include <grub/dl.h>
 #include <grub/mm.h>
@@ -34,6 +42,7 @@
 #include <grub/emu/hostdisk.h>
 #include <grub/time.h>
 #include <grub/emu/console.h>
+#include <grub/emu/batch.h>
 #include <grub/emu/misc.h>
 #include <grub/kernel.h>
 #include <grub/normal.h>
@@ -59,6 +68,23 @@ static char *root_dev = NULL, *dir = NULL;
 
 grub_addr_t grub_modbase = 0;
 
+/* In batch mode normal mode runs scripts read from BATCH_FD instead of
+   grub.cfg and the shell.  Scripts are separated by NUL bytes.  After
+   each one a NUL byte and the script's error number in decimal, followed
+   by a newline, are written to standard output, so that a caller can
+   tell where the script's output ends.  With a socket, each connection
+   gets the same treatment, with standard output going to the
+   connection while it is open.  */
+static int batch_mode;
+static char *batch_socket;
+static int batch_fd = -1;
+static char batch_buf[4096];
+static grub_size_t batch_pos, batch_end;
+#ifndef __MINGW32__
+static int batch_listen_fd = -1;
+static int batch_stdout = -1;
+#endif
+
 void
 grub_reboot (void)
 {
@@ -84,6 +110,196 @@ grub_machine_fini (int flags)
     grub_console_fini ();
 }
 
+int
+grub_emu_batch_mode (void)
+{
+  return batch_mode;
+}
+
+static void
+batch_init (void)
+{
+  if (! batch_socket)
+    {
+      int null_fd;
+
+      /* Keep the console off the scripts: its input is switched to
+	 non-blocking mode and read key by key.  */
+      batch_fd = dup (STDIN_FILENO);
+      null_fd = open ("/dev/null", O_RDONLY);
+      if (batch_fd < 0 || null_fd < 0)
+	grub_util_error (_("cannot open batch input: %s"), strerror (errno));
+      dup2 (null_fd, STDIN_FILENO);
+      close (null_fd);
+      return;
+    }
+
+#ifdef __MINGW32__
+  grub_util_error ("%s", _("batch sockets are not supported on this host"));
+#else
+  {
+    struct sockaddr_un addr;
+    struct stat st;
+
+    if (strlen (batch_socket) >= sizeof (addr.sun_path))
+      grub_util_error (_("socket name `%s' is too long"), batch_socket);
+
+    memset (&addr, 0, sizeof (addr));
+    addr.sun_family = AF_UNIX;
+    strcpy (addr.sun_path, batch_socket);
+
+    /* Left over from an emulator that was killed.  */
+    if (lstat (batch_socket, &st) == 0 && S_ISSOCK (st.st_mode))
+      unlink (batch_socket);
+
+    batch_listen_fd = socket (AF_UNIX, SOCK_STREAM, 0);
+    if (batch_listen_fd < 0
+	|| bind (batch_listen_fd, (struct sockaddr *) &addr, sizeof (addr)) < 0
+	|| listen (batch_listen_fd, 1) < 0)
+      grub_util_error (_("cannot listen on `%s': %s"), batch_socket,
+		       strerror (errno));
+
+    /* A caller going away early must not take the emulator with it.  */
+    signal (SIGPIPE, SIG_IGN);
+  }
+#endif
+}
+
+static void
+batch_fini (void)
+{
+#ifndef __MINGW32__
+  if (batch_listen_fd >= 0)
+    {
+      close (batch_listen_fd);
+      unlink (batch_socket);
+    }
+#endif
+}
+
+/* Get the next input, if any.  */
+static int
+batch_open (void)
+{
+#ifndef __MINGW32__
+  if (batch_listen_fd >= 0)
+    {
+      int fd;
+
+      do
+	fd = accept (batch_listen_fd, 0, 0);
+      while (fd < 0 && errno == EINTR);
+      if (fd < 0)
+	{
+	  grub_util_warn (_("cannot accept a connection: %s"),
+			  strerror (errno));
+	  return -1;
+	}
+
+      if (batch_stdout < 0)
+	batch_stdout = dup (STDOUT_FILENO);
+      dup2 (fd, STDOUT_FILENO);
+      batch_fd = fd;
+      return 0;
+    }
+#endif
+  return -1;
+}
+
+static void
+batch_close (void)
+{
+  close (batch_fd);
+  batch_fd = -1;
+  batch_pos = batch_end = 0;
+#ifndef __MINGW32__
+  if (batch_stdout >= 0)
+    dup2 (batch_stdout, STDOUT_FILENO);
+#endif
+}
+
+/* Return the next byte of the batch input, or -1 at its end.  */
+static int
+batch_getc (void)
+{
+  if (batch_pos == batch_end)
+    {
+      ssize_t n;
+
+      do
+	n = read (batch_fd, batch_buf, sizeof (batch_buf));
+      while (n < 0 && errno == EINTR);
+      if (n <= 0)
+	return -1;
+      batch_pos = 0;
+      batch_end = n;
+    }
+  return (unsigned char) batch_buf[batch_pos++];
+}
+
+char *
+grub_emu_batch_read (void)
+{
+  char *script = 0;
+  grub_size_t len = 0, alloc = 0;
+
+  while (1)
+    {
+      int c;
+
+      if (batch_fd < 0 && batch_open () < 0)
+	return 0;
+
+      c = batch_getc ();
+      if (c < 0)
+	{
+	  /* An unterminated script at the end of the input still runs;
+	     the end is seen again on the next call.  */
+	  if (script)
+	    break;
+	  batch_close ();
+	  continue;
+	}
+
+      if (len + 1 >= alloc)
+	{
+	  char *new_script;
+
+	  alloc = alloc ? 2 * alloc : 256;
+	  new_script = grub_realloc (script, alloc);
+	  if (! new_script)
+	    {
+	      grub_free (script);
+	      return 0;
+	    }
+	  script = new_script;
+	}
+
+      if (c == 0)
+	break;
+      script[len++] = c;
+    }
+
+  script[len] = 0;
+  return script;
+}
+
+void
+grub_emu_batch_done (grub_err_t err)
+{
+  char rec[32];
+  int len;
+  ssize_t actual;
+
+  rec[0] = 0;
+  len = grub_snprintf (rec + 1, sizeof (rec) - 1, "%d\n", (int) err);
+  actual = write (STDOUT_FILENO, rec, len + 1);
+  if (actual < len + 1)
+    {
+      /* A caller that hung up finds out at its next connection.  */
+    }
+}
+
 
 
 static struct argp_option options[] = {
@@ -95,6 +311,8 @@ static struct argp_option options[] = {
    N_("use GRUB files in the directory DIR [default=%s]"), 0},
   {"verbose",     'v', 0,      0, N_("print verbose messages."), 0},
   {"hold",     'H', N_("SECS"),      OPTION_ARG_OPTIONAL, N_("wait until a debugger will attach"), 0},
+  {"batch",    'b', N_("SOCKET"),    OPTION_ARG_OPTIONAL,
+   N_("run NUL-separated scripts from standard input until its end, or from each connection to the Unix socket SOCKET, instead of grub.cfg and the shell"), 0},
   { 0, 0, 0, 0, 0, 0 }
 };
 
@@ -148,6 +366,11 @@ argp_parser (int key, char *arg, struct argp_state *state)
     case 'v':
       verbosity++;
       break;
+    case 'b':
+      batch_mode = 1;
+      free (batch_socket);
+      batch_socket = arg ? xstrdup (arg) : NULL;
+      break;
 
     case ARGP_KEY_ARG:
       {
@@ -209,6 +432,8 @@ main (int argc, char *argv[])
     }
 
   signal (SIGINT, SIG_IGN);
+  if (batch_mode)
+    batch_init ();
   grub_console_init ();
   grub_host_init ();
 
@@ -229,6 +454,9 @@ main (int argc, char *argv[])
   if (setjmp (main_env) == 0)
     grub_main ();
 
+  if (batch_mode)
+    batch_fini ();
+
   grub_fini_all ();
   grub_hostfs_fini ();
   grub_host_fini ();
@@ -149,3 +149,13 @@ grub_get_time_ms (void)
 
   return (tv.tv_sec * 1000 + tv.tv_usec / 1000);
 }
+
+grub_uint64_t
+grub_get_time_ns (void)
+{
+  struct timeval tv;
+
+  gettimeofday (&tv, 0);
+
+  return (tv.tv_sec * 1000000000ULL + tv.tv_usec * 1000ULL);
+}
@@ -28,45 +28,111 @@ static struct grub_env_context initial_context;
 /* The current context.  */
 struct grub_env_context *grub_current_context = &initial_context;
 
-/* Return the hash representation of the string S.  */
-static unsigned int
-grub_env_hashval (const char *s)
+/* Smallest table allocated; it grows by doubling once it holds as many
+   variables as it has buckets.  */
+#define ENV_MIN_BUCKETS	16
+
+/* Return the hash representation of the string S (32-bit FNV-1a).  */
+grub_uint32_t
+grub_env_hash (const char *s)
 {
-  unsigned int i = 0;
+  grub_uint32_t h = 2166136261U;
 
-  /* XXX: This can be done much more efficiently.  */
   while (*s)
-    i += 5 * *(s++);
+    {
+      h ^= (grub_uint8_t) *s++;
+      h *= 16777619;
+    }
 
-  return i % HASHSZ;
+  return h;
 }
 
 static struct grub_env_var *
-grub_env_find (const char *name)
+grub_env_find_hashed (const char *name, grub_uint32_t hash)
 {
   struct grub_env_var *var;
-  int idx = grub_env_hashval (name);
+
+  if (! grub_current_context->nbuckets)
+    return 0;
 
   /* Look for the variable in the current context.  */
-  for (var = grub_current_context->vars[idx]; var; var = var->next)
-    if (grub_strcmp (var->name, name) == 0)
+  for (var = grub_current_context->vars[hash
+					 & (grub_current_context->nbuckets - 1)];
+       var; var = var->next)
+    if (var->hash == hash && grub_strcmp (var->name, name) == 0)
       return var;
 
   return 0;
 }
 
+static struct grub_env_var *
+grub_env_find (const char *name)
+{
+  return grub_env_find_hashed (name, grub_env_hash (name));
+}
+
 static void
+grub_env_link (struct grub_env_var **vars, unsigned int nbuckets,
+	       struct grub_env_var *var)
+{
+  unsigned int idx = var->hash & (nbuckets - 1);
+
+  var->prevp = &vars[idx];
+  var->next = vars[idx];
+  if (var->next)
+    var->next->prevp = &(var->next);
+  vars[idx] = var;
+}
+
+/* Double the bucket count of CONTEXT, moving every variable over.  */
+static grub_err_t
+grub_env_grow (struct grub_env_context *context)
+{
+  struct grub_env_var **vars;
+  unsigned int nbuckets, i;
+
+  nbuckets = context->nbuckets ? context->nbuckets * 2 : ENV_MIN_BUCKETS;
+  vars = grub_zalloc (nbuckets * sizeof (vars[0]));
+  if (! vars)
+    return grub_errno;
+
+  for (i = 0; i < context->nbuckets; i++)
+    {
+      struct grub_env_var *var, *next;
+
+      for (var = context->vars[i]; var; var = next)
+	{
+	  next = var->next;
+	  grub_env_link (vars, nbuckets, var);
+	}
+    }
+
+  grub_free (context->vars);
+  context->vars = vars;
+  context->nbuckets = nbuckets;
+
+  return GRUB_ERR_NONE;
+}
+
+static grub_err_t
 grub_env_insert (struct grub_env_context *context,
 		 struct grub_env_var *var)
 {
-  int idx = grub_env_hashval (var->name);
+  if (context->nvars >= context->nbuckets
+      && grub_env_grow (context) != GRUB_ERR_NONE)
+    {
+      /* A table that is merely full still works, just with longer
+	 chains.  */
+      if (! context->nbuckets)
+	return grub_errno;
+      grub_errno = GRUB_ERR_NONE;
+    }
 
   /* Insert the variable into the hashtable.  */
-  var->prevp = &context->vars[idx];
-  var->next = context->vars[idx];
-  if (var->next)
-    var->next->prevp = &(var->next);
-  context->vars[idx] = var;
+  grub_env_link (context->vars, context->nbuckets, var);
+  context->nvars++;
+
+  return GRUB_ERR_NONE;
 }
 
 static void
@@ -76,6 +142,7 @@ grub_env_remove (struct grub_env_var *var)
   *var->prevp = var->next;
   if (var->next)
     var->next->prevp = var->prevp;
+  grub_current_context->nvars--;
 }
 
 grub_err_t
@@ -112,12 +179,14 @@ grub_env_set (const char *name, const char *val)
   var->name = grub_strdup (name);
   if (! var->name)
     goto fail;
+  var->hash = grub_env_hash (name);
 
   var->value = grub_strdup (val);
   if (! var->value)
     goto fail;
 
-  grub_env_insert (grub_current_context, var);
+  if (grub_env_insert (grub_current_context, var) != GRUB_ERR_NONE)
+    goto fail;
 
   return GRUB_ERR_NONE;
 
@@ -129,12 +198,14 @@ grub_env_set (const char *name, const char *val)
   return grub_errno;
 }
 
+/* Like grub_env_get, for callers that keep HASH = grub_env_hash (NAME)
+   around between lookups of the same name.  */
 const char *
-grub_env_get (const char *name)
+grub_env_get_hashed (const char *name, grub_uint32_t hash)
 {
   struct grub_env_var *var;
 
-  var = grub_env_find (name);
+  var = grub_env_find_hashed (name, hash);
   if (! var)
     return 0;
 
@@ -144,6 +215,12 @@ grub_env_get (const char *name)
   return var->value;
 }
 
+const char *
+grub_env_get (const char *name)
+{
+  return grub_env_get_hashed (name, grub_env_hash (name));
+}
+
 void
 grub_env_unset (const char *name)
 {
@@ -170,10 +247,10 @@ struct grub_env_var *
 grub_env_update_get_sorted (void)
 {
   struct grub_env_var *sorted_list = 0;
-  int i;
+  unsigned int i;
 
   /* Add variables associated with this context into a sorted list.  */
-  for (i = 0; i < HASHSZ; i++)
+  for (i = 0; i < grub_current_context->nbuckets; i++)
     {
       struct grub_env_var *var;
 
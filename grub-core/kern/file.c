@@ -25,12 +25,150 @@
 #include <grub/fs.h>
 #include <grub/device.h>
 #include <grub/i18n.h>
+#include <grub/env.h>
 
 void (*EXPORT_VAR (grub_grubnet_fini)) (void);
 
 grub_file_filter_t grub_file_filters_all[GRUB_FILE_FILTER_MAX];
 grub_file_filter_t grub_file_filters_enabled[GRUB_FILE_FILTER_MAX];
 
+/* Disks files were opened on, kept open along with the filesystem found on
+   them so that the next file on the same device skips opening the disk and
+   its partition and probing.  Entries are dropped when the set of disks
+   changes, and live on detached while files still use them.  */
+#define GRUB_FILE_MOUNTS	8
+
+struct grub_file_mount
+{
+  /* The device name, NULL once detached.  */
+  char *name;
+  grub_device_t device;
+  grub_fs_t fs;
+  /* Open files on DEVICE.  */
+  unsigned refcount;
+  unsigned long last_use;
+};
+
+static struct grub_file_mount mounts[GRUB_FILE_MOUNTS];
+static unsigned long mounts_generation;
+static unsigned long mounts_clock;
+
+static void
+mount_drop (struct grub_file_mount *m)
+{
+  grub_free (m->name);
+  m->name = NULL;
+  if (m->refcount)
+    return;
+  if (m->device)
+    grub_device_close (m->device);
+  m->device = NULL;
+}
+
+/* Close every idle cached device before the disk driver goes away.  */
+void
+grub_file_mounts_flush (void)
+{
+  unsigned i;
+
+  for (i = 0; i < ARRAY_SIZE (mounts); i++)
+    mount_drop (&mounts[i]);
+}
+
+static void
+mounts_check_generation (void)
+{
+  if (mounts_generation == grub_disk_generation)
+    return;
+  grub_file_mounts_flush ();
+  mounts_generation = grub_disk_generation;
+}
+
+static int
+fs_registered (grub_fs_t fs)
+{
+  grub_fs_t p;
+
+  for (p = grub_fs_list; p; p = p->next)
+    if (p == fs)
+      return 1;
+  return 0;
+}
+
+/* Return the open device called NAME along with its filesystem, if it is
+   cached.  */
+static grub_device_t
+mount_get (const char *name, grub_fs_t *fs)
+{
+  struct grub_file_mount *m;
+
+  mounts_check_generation ();
+  for (m = mounts; m < mounts + ARRAY_SIZE (mounts); m++)
+    if (m->name && grub_strcmp (m->name, name) == 0)
+      {
+	/* The driver has been unloaded.  */
+	if (!fs_registered (m->fs))
+	  {
+	    mount_drop (m);
+	    return NULL;
+	  }
+	m->refcount++;
+	m->last_use = ++mounts_clock;
+	*fs = m->fs;
+	return m->device;
+      }
+  return NULL;
+}
+
+/* Remember DEVICE, just opened for a file, as NAME.  */
+static void
+mount_add (const char *name, grub_device_t device, grub_fs_t fs)
+{
+  struct grub_file_mount *m, *victim = NULL;
+
+  if (!device->disk)
+    return;
+
+  for (m = mounts; m < mounts + ARRAY_SIZE (mounts); m++)
+    if (!m->device)
+      {
+	victim = m;
+	break;
+      }
+    else if (!m->refcount && (!victim || m->last_use < victim->last_use))
+      victim = m;
+  if (!victim)
+    return;
+
+  mount_drop (victim);
+  victim->name = grub_strdup (name);
+  if (!victim->name)
+    {
+      grub_errno = GRUB_ERR_NONE;
+      return;
+    }
+  victim->device = device;
+  victim->fs = fs;
+  victim->refcount = 1;
+  victim->last_use = ++mounts_clock;
+}
+
+/* Let go of DEVICE, whether it is cached or not.  */
+static void
+mount_put (grub_device_t device)
+{
+  struct grub_file_mount *m;
+
+  for (m = mounts; m < mounts + ARRAY_SIZE (mounts); m++)
+    if (m->device == device && m->refcount)
+      {
+	if (--m->refcount == 0 && !m->name)
+	  mount_drop (m);
+	return;
+      }
+  grub_device_close (device);
+}
+
 /* Get the device part of the filename NAME. It is enclosed by parentheses.  */
 char *
 grub_file_get_device_name (const char *name)
@@ -64,8 +202,12 @@ grub_file_open (const char *name)
   grub_device_t device = 0;
   grub_file_t file = 0, last_file = 0;
   char *device_name;
-  const char *file_name;
+  const char *file_name, *mount_name;
+  grub_fs_t fs = 0;
   grub_file_filter_id_t filter;
+  grub_boot_span_t span;
+
+  span = grub_boot_span_begin ("Opening %s", name);
 
   device_name = grub_file_get_device_name (name);
   if (grub_errno)
@@ -78,14 +220,23 @@ grub_file_open (const char *name)
   else
     file_name = name;
 
-  device = grub_device_open (device_name);
-  grub_free (device_name);
+  mount_name = device_name ? : grub_env_get ("root");
+  if (mount_name && file_name[0] == '/')
+    device = mount_get (mount_name, &fs);
   if (! device)
-    goto fail;
+    device = grub_device_open (device_name);
+  if (! device)
+    {
+      grub_free (device_name);
+      goto fail;
+    }
 
   file = (grub_file_t) grub_zalloc (sizeof (*file));
   if (! file)
-    goto fail;
+    {
+      grub_free (device_name);
+      goto fail;
+    }
 
   file->device = device;
 
@@ -101,12 +252,20 @@ grub_file_open (const char *name)
      )
     /* This is a block list.  */
     file->fs = &grub_fs_blocklist;
+  else if (fs)
+    file->fs = fs;
   else
     {
       file->fs = grub_fs_probe (device);
       if (! file->fs)
-	goto fail;
+	{
+	  grub_free (device_name);
+	  goto fail;
+	}
+      if (mount_name)
+	mount_add (mount_name, device, file->fs);
     }
+  grub_free (device_name);
 
   if ((file->fs->open) (file, file_name) != GRUB_ERR_NONE)
     goto fail;
@@ -127,11 +286,12 @@ grub_file_open (const char *name)
   grub_memcpy (grub_file_filters_enabled, grub_file_filters_all,
 	       sizeof (grub_file_filters_enabled));
 
+  grub_boot_span_end (span, file ? file->size : 0);
   return file;
 
  fail:
   if (device)
-    grub_device_close (device);
+    mount_put (device);
 
   /* if (net) grub_net_close (net);  */
 
@@ -140,11 +300,30 @@ grub_file_open (const char *name)
   grub_memcpy (grub_file_filters_enabled, grub_file_filters_all,
 	       sizeof (grub_file_filters_enabled));
 
+  grub_boot_span_end (span, 0);
   return 0;
 }
 
 grub_disk_read_hook_t grub_file_progress_hook;
 
+/* Clip *LEN to what is left of FILE.  */
+static grub_err_t
+grub_file_clip_length (grub_file_t file, grub_size_t *len)
+{
+  if (file->offset > file->size)
+    return grub_error (GRUB_ERR_OUT_OF_RANGE,
+		       N_("attempt to read past the end of file"));
+
+  if (*len > file->size - file->offset)
+    *len = file->size - file->offset;
+
+  /* Prevent an overflow.  */
+  if ((grub_ssize_t) *len < 0)
+    *len >>= 1;
+
+  return GRUB_ERR_NONE;
+}
+
 grub_ssize_t
 grub_file_read (grub_file_t file, void *buf, grub_size_t len)
 {
@@ -152,25 +331,163 @@ grub_file_read (grub_file_t file, void *buf, grub_size_t len)
   grub_disk_read_hook_t read_hook;
   void *read_hook_data;
 
-  if (file->offset > file->size)
+  if (grub_file_clip_length (file, &len))
+    return -1;
+
+  if (len == 0)
+    return 0;
+  read_hook = file->read_hook;
+  read_hook_data = file->read_hook_data;
+  if (!file->read_hook)
     {
-      grub_error (GRUB_ERR_OUT_OF_RANGE,
-		  N_("attempt to read past the end of file"));
-      return -1;
+      file->read_hook = grub_file_progress_hook;
+      file->read_hook_data = file;
+      file->progress_offset = file->offset;
+    }
+  res = (file->fs->read) (file, buf, len);
+  file->read_hook = read_hook;
+  file->read_hook_data = read_hook_data;
+  if (res > 0)
+    file->offset += res;
+
+  return res;
+}
+
+/* Context for grub_file_map.  */
+struct grub_file_map_ctx
+{
+  grub_fs_extent_hook_t hook;
+  void *hook_data;
+  struct grub_fs_extent pending;
+  int have_pending;
+};
+
+/* Helper for grub_file_map.  Merge extents which continue each other
+   on disk, so that the caller sees the longest possible runs.  */
+static grub_err_t
+grub_file_map_iter (const struct grub_fs_extent *extent, void *data)
+{
+  struct grub_file_map_ctx *ctx = data;
+  struct grub_fs_extent *pending = &ctx->pending;
+  grub_err_t err;
+
+  if (extent->length == 0)
+    return GRUB_ERR_NONE;
+
+  if (ctx->have_pending
+      && pending->offset + pending->length == extent->offset
+      && pending->hole == extent->hole
+      && (pending->hole
+	  || ((pending->sector << GRUB_DISK_SECTOR_BITS)
+	      + pending->sector_offset + pending->length
+	      == (extent->sector << GRUB_DISK_SECTOR_BITS)
+	      + extent->sector_offset)))
+    {
+      pending->length += extent->length;
+      return GRUB_ERR_NONE;
+    }
+
+  if (ctx->have_pending)
+    {
+      err = ctx->hook (pending, ctx->hook_data);
+      if (err)
+	return err;
     }
 
+  *pending = *extent;
+  ctx->have_pending = 1;
+  return GRUB_ERR_NONE;
+}
+
+/* Call HOOK with the disk extents of the next LEN bytes of FILE.  Fails
+   with GRUB_ERR_NOT_IMPLEMENTED_YET if FILE isn't plainly stored on a
+   disk, e.g. because it is on the network or read through a filter.  */
+grub_err_t
+grub_file_map (grub_file_t file, grub_size_t len,
+	       grub_fs_extent_hook_t hook, void *hook_data)
+{
+  struct grub_file_map_ctx ctx = {
+    .hook = hook,
+    .hook_data = hook_data,
+    .have_pending = 0
+  };
+  grub_err_t err;
+
+  if (!file->fs->map || !file->device || !file->device->disk)
+    return grub_error (GRUB_ERR_NOT_IMPLEMENTED_YET,
+		       "file extents aren't available");
+
+  if (grub_file_clip_length (file, &len))
+    return grub_errno;
+
   if (len == 0)
-    return 0;
+    return GRUB_ERR_NONE;
 
-  if (len > file->size - file->offset)
-    len = file->size - file->offset;
+  err = (file->fs->map) (file, len, grub_file_map_iter, &ctx);
+  if (err)
+    return err;
 
-  /* Prevent an overflow.  */
-  if ((grub_ssize_t) len < 0)
-    len >>= 1;
+  if (ctx.have_pending)
+    return hook (&ctx.pending, hook_data);
+
+  return GRUB_ERR_NONE;
+}
+
+/* Context for grub_file_read_direct.  */
+struct grub_file_read_direct_ctx
+{
+  grub_file_t file;
+  char *buf;
+};
+
+/* Helper for grub_file_read_direct.  */
+static grub_err_t
+grub_file_read_direct_iter (const struct grub_fs_extent *extent, void *data)
+{
+  struct grub_file_read_direct_ctx *ctx = data;
+  grub_file_t file = ctx->file;
+  grub_disk_t disk = file->device->disk;
+  char *dest = ctx->buf + (extent->offset - file->offset);
+
+  if (extent->hole)
+    {
+      grub_memset (dest, 0, extent->length);
+      return GRUB_ERR_NONE;
+    }
+
+  disk->read_hook = file->read_hook;
+  disk->read_hook_data = file->read_hook_data;
+  grub_disk_read (disk, extent->sector, extent->sector_offset,
+		  extent->length, dest);
+  disk->read_hook = 0;
+
+  return grub_errno;
+}
+
+/* Like grub_file_read, but transfer each extent of the file straight
+   from the disk into BUF with a single request, bypassing the
+   filesystem's block-by-block read.  Meant for loaders filling large
+   buffers.  Files which cannot be mapped are read normally.  */
+grub_ssize_t
+grub_file_read_direct (grub_file_t file, void *buf, grub_size_t len)
+{
+  struct grub_file_read_direct_ctx ctx = {
+    .file = file,
+    .buf = buf
+  };
+  grub_disk_read_hook_t read_hook;
+  void *read_hook_data;
+  grub_err_t err;
+
+  if (!file->fs->map)
+    return grub_file_read (file, buf, len);
+
+  if (grub_file_clip_length (file, &len))
+    return -1;
 
   if (len == 0)
     return 0;
+
   read_hook = file->read_hook;
   read_hook_data = file->read_hook_data;
   if (!file->read_hook)
@@ -179,13 +496,79 @@ grub_file_read (grub_file_t file, void *buf, grub_size_t len)
       file->read_hook_data = file;
       file->progress_offset = file->offset;
     }
-  res = (file->fs->read) (file, buf, len);
+  err = grub_file_map (file, len, grub_file_read_direct_iter, &ctx);
   file->read_hook = read_hook;
   file->read_hook_data = read_hook_data;
-  if (res > 0)
-    file->offset += res;
 
-  return res;
+  if (err == GRUB_ERR_NOT_IMPLEMENTED_YET)
+    {
+      grub_errno = GRUB_ERR_NONE;
+      return grub_file_read (file, buf, len);
+    }
+  if (err)
+    return -1;
+
+  file->offset += len;
+  return len;
+}
+
+/* Context for grub_file_map_memory.  */
+struct grub_file_map_memory_ctx
+{
+  grub_disk_t disk;
+  char *start;
+  char *next;
+};
+
+/* Helper for grub_file_map_memory.  */
+static grub_err_t
+grub_file_map_memory_iter (const struct grub_fs_extent *extent, void *data)
+{
+  struct grub_file_map_memory_ctx *ctx = data;
+  char *p;
+
+  if (extent->hole)
+    return GRUB_ERR_NOT_IMPLEMENTED_YET;
+
+  p = grub_disk_map_memory (ctx->disk, extent->sector, extent->sector_offset,
+			    extent->length);
+  if (!p || (ctx->start && p != ctx->next))
+    return GRUB_ERR_NOT_IMPLEMENTED_YET;
+
+  if (!ctx->start)
+    ctx->start = p;
+  ctx->next = p + extent->length;
+  return GRUB_ERR_NONE;
+}
+
+/* If the next LEN bytes of FILE are stored contiguously on a disk held
+   in memory, e.g. the memdisk, return their address and advance FILE
+   past them, so that the caller can use them in place instead of
+   reading a copy.  The data must not be modified.  Return NULL without
+   setting an error if that isn't possible; the caller then falls back
+   to grub_file_read.  */
+void *
+grub_file_map_memory (grub_file_t file, grub_size_t len)
+{
+  struct grub_file_map_memory_ctx ctx = {
+    .start = NULL
+  };
+
+  if (!file->fs->map || !file->device || !file->device->disk
+      || !file->device->disk->memory || len == 0
+      || file->offset > file->size || file->size - file->offset < len)
+    return NULL;
+
+  ctx.disk = file->device->disk;
+  if (grub_file_map (file, len, grub_file_map_memory_iter, &ctx)
+      || ctx.next - ctx.start != (grub_ssize_t) len)
+    {
+      grub_errno = GRUB_ERR_NONE;
+      return NULL;
+    }
+
+  file->offset += len;
+  return ctx.start;
 }
 
 grub_err_t
@@ -195,7 +578,7 @@ grub_file_close (grub_file_t file)
     (file->fs->close) (file);
 
   if (file->device)
-    grub_device_close (file->device);
+    mount_put (file->device);
   grub_free (file->name);
   grub_free (file);
   return grub_errno;
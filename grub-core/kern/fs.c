@@ -27,6 +27,7 @@
 #include <grub/mm.h>
 #include <grub/term.h>
 #include <grub/i18n.h>
+#include <grub/partition.h>
 
 grub_fs_t grub_fs_list = 0;
 
@@ -41,6 +42,142 @@ probe_dummy_iter (const char *filename __attribute__ ((unused)),
   return 1;
 }
 
+/* The filesystem last found on each disk or partition, tried first when
+   it is probed again.  Dropped when the set of disks changes.  */
+struct grub_fs_probe_memo
+{
+  struct grub_fs_probe_memo *next;
+  unsigned long dev_id;
+  unsigned long disk_id;
+  grub_disk_addr_t start;
+  grub_fs_t fs;
+};
+
+static struct grub_fs_probe_memo *probe_memo;
+static unsigned long probe_memo_generation;
+
+static struct grub_fs_probe_memo *
+probe_memo_find (grub_disk_t disk)
+{
+  struct grub_fs_probe_memo *memo, *next;
+  grub_disk_addr_t start = grub_partition_get_start (disk->partition);
+
+  if (probe_memo_generation != grub_disk_generation)
+    {
+      for (memo = probe_memo; memo; memo = next)
+	{
+	  next = memo->next;
+	  grub_free (memo);
+	}
+      probe_memo = 0;
+      probe_memo_generation = grub_disk_generation;
+    }
+
+  for (memo = probe_memo; memo; memo = memo->next)
+    if (memo->dev_id == disk->dev->id && memo->disk_id == disk->id
+	&& memo->start == start)
+      return memo;
+  return 0;
+}
+
+static void
+probe_memo_set (grub_disk_t disk, grub_fs_t fs)
+{
+  struct grub_fs_probe_memo *memo;
+
+  memo = probe_memo_find (disk);
+  if (!memo)
+    {
+      memo = grub_malloc (sizeof (*memo));
+      if (!memo)
+	{
+	  grub_errno = GRUB_ERR_NONE;
+	  return;
+	}
+      memo->dev_id = disk->dev->id;
+      memo->disk_id = disk->id;
+      memo->start = grub_partition_get_start (disk->partition);
+      memo->next = probe_memo;
+      probe_memo = memo;
+    }
+  memo->fs = fs;
+}
+
+/* Return 0 if FS declares its magics and DISK has none of them.  The
+   magics of all filesystems sit in the first few cache units of the
+   device, so checking them costs a handful of reads which the drivers
+   then find in the disk cache.  */
+static int
+magic_match (grub_fs_t fs, grub_disk_t disk)
+{
+  const struct grub_fs_magic *m;
+  char buf[16];
+
+  if (!fs->magics)
+    return 1;
+
+  for (m = fs->magics; m->len; m++)
+    {
+      if (m->len > sizeof (buf))
+	return 1;
+      if (grub_disk_read (disk, 0, m->offset, m->len, buf))
+	{
+	  /* A device too small for the magic cannot hold the filesystem;
+	     for any other error let the driver decide.  */
+	  if (grub_errno != GRUB_ERR_OUT_OF_RANGE)
+	    {
+	      grub_errno = GRUB_ERR_NONE;
+	      return 1;
+	    }
+	  grub_errno = GRUB_ERR_NONE;
+	  continue;
+	}
+      if (grub_memcmp (buf, m->bytes, m->len) == 0)
+	return 1;
+    }
+
+  grub_dprintf ("fs", "%s magic not found.\n", fs->name);
+  return 0;
+}
+
+/* Return 1 if FS recognises DEVICE, 0 if not and -1 on an error which
+   ends the probe.  */
+static int
+probe_fs (grub_fs_t p, grub_device_t device)
+{
+  grub_dprintf ("fs", "Detecting %s...\n", p->name);
+
+  /* This is evil: newly-created just mounted BtrFS after copying all
+     GRUB files has a very peculiar unrecoverable corruption which
+     will be fixed at sync but we'd rather not do a global sync and
+     syncing just files doesn't seem to help. Relax the check for
+     this time.  */
+#ifdef GRUB_UTIL
+  if (grub_strcmp (p->name, "btrfs") == 0)
+    {
+      char *label = 0;
+      p->uuid (device, &label);
+      if (label)
+	grub_free (label);
+    }
+  else
+#endif
+    (p->dir) (device, "/", probe_dummy_iter, NULL);
+  if (grub_errno == GRUB_ERR_NONE)
+    return 1;
+
+  grub_error_push ();
+  grub_dprintf ("fs", "%s detection failed.\n", p->name);
+  grub_error_pop ();
+
+  if (grub_errno != GRUB_ERR_BAD_FS
+      && grub_errno != GRUB_ERR_OUT_OF_RANGE)
+    return -1;
+
+  grub_errno = GRUB_ERR_NONE;
+  return 0;
+}
+
 grub_fs_t
 grub_fs_probe (grub_device_t device)
 {
@@ -50,39 +187,37 @@ grub_fs_probe (grub_device_t device)
     {
       /* Make it sure not to have an infinite recursive calls.  */
       static int count = 0;
+      struct grub_fs_probe_memo *memo;
+      grub_fs_t last = 0;
+      int ret;
+
+      memo = probe_memo_find (device->disk);
+      if (memo)
+	for (p = grub_fs_list; p; p = p->next)
+	  if (p == memo->fs)
+	    {
+	      last = p;
+	      ret = probe_fs (p, device);
+	      if (ret > 0)
+		return p;
+	      if (ret < 0)
+		return 0;
+	      break;
+	    }
 
       for (p = grub_fs_list; p; p = p->next)
 	{
-	  grub_dprintf ("fs", "Detecting %s...\n", p->name);
+	  if (p == last || !magic_match (p, device->disk))
+	    continue;
 
-	  /* This is evil: newly-created just mounted BtrFS after copying all
-	     GRUB files has a very peculiar unrecoverable corruption which
-	     will be fixed at sync but we'd rather not do a global sync and
-	     syncing just files doesn't seem to help. Relax the check for
-	     this time.  */
-#ifdef GRUB_UTIL
-	  if (grub_strcmp (p->name, "btrfs") == 0)
+	  ret = probe_fs (p, device);
+	  if (ret > 0)
 	    {
-	      char *label = 0;
-	      p->uuid (device, &label);
-	      if (label)
-		grub_free (label);
+	      probe_memo_set (device->disk, p);
+	      return p;
 	    }
-	  else
-#endif
-	    (p->dir) (device, "/", probe_dummy_iter, NULL);
-	  if (grub_errno == GRUB_ERR_NONE)
-	    return p;
-
-	  grub_error_push ();
-	  grub_dprintf ("fs", "%s detection failed.\n", p->name);
-	  grub_error_pop ();
-
-	  if (grub_errno != GRUB_ERR_BAD_FS
-	      && grub_errno != GRUB_ERR_OUT_OF_RANGE)
+	  if (ret < 0)
 	    return 0;
-
-	  grub_errno = GRUB_ERR_NONE;
 	}
 
       /* Let's load modules automatically.  */
@@ -94,21 +229,22 @@ grub_fs_probe (grub_device_t device)
 	    {
 	      p = grub_fs_list;
 
-	      (p->dir) (device, "/", probe_dummy_iter, NULL);
-	      if (grub_errno == GRUB_ERR_NONE)
+	      if (!magic_match (p, device->disk))
+		continue;
+
+	      ret = probe_fs (p, device);
+	      if (ret > 0)
 		{
 		  count--;
+		  probe_memo_set (device->disk, p);
 		  return p;
 		}
 
-	      if (grub_errno != GRUB_ERR_BAD_FS
-		  && grub_errno != GRUB_ERR_OUT_OF_RANGE)
+	      if (ret < 0)
 		{
 		  count--;
 		  return 0;
 		}
-
-	      grub_errno = GRUB_ERR_NONE;
 	    }
 
 	  count--;
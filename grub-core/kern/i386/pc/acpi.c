@@ -20,8 +20,17 @@
 #include <grub/acpi.h>
 #include <grub/misc.h>
 
-struct grub_acpi_rsdp_v10 *
-grub_machine_acpi_get_rsdpv1 (void)
+/* The RSDPs found by the last scan.  The scan is repeated only when the
+   EBDA moves, which is what the acpi command does to publish its own.  */
+static struct
+{
+  int scanned;
+  grub_uint16_t ebda_seg;
+  void *rsdp;
+} rsdpv1_cache, rsdpv2_cache;
+
+static struct grub_acpi_rsdp_v10 *
+scan_rsdpv1 (void)
 {
   int ebda_len;
   grub_uint8_t *ebda, *ptr;
@@ -48,8 +57,8 @@ scan_bios:
   return 0;
 }
 
-struct grub_acpi_rsdp_v20 *
-grub_machine_acpi_get_rsdpv2 (void)
+static struct grub_acpi_rsdp_v20 *
+scan_rsdpv2 (void)
 {
   int ebda_len;
   grub_uint8_t *ebda, *ptr;
@@ -81,3 +90,31 @@ scan_bios:
       return (struct grub_acpi_rsdp_v20 *) ptr;
   return 0;
 }
+
+struct grub_acpi_rsdp_v10 *
+grub_machine_acpi_get_rsdpv1 (void)
+{
+  grub_uint16_t ebda_seg = * ((grub_uint16_t *) 0x40e);
+
+  if (!rsdpv1_cache.scanned || rsdpv1_cache.ebda_seg != ebda_seg)
+    {
+      rsdpv1_cache.rsdp = scan_rsdpv1 ();
+      rsdpv1_cache.ebda_seg = ebda_seg;
+      rsdpv1_cache.scanned = 1;
+    }
+  return rsdpv1_cache.rsdp;
+}
+
+struct grub_acpi_rsdp_v20 *
+grub_machine_acpi_get_rsdpv2 (void)
+{
+  grub_uint16_t ebda_seg = * ((grub_uint16_t *) 0x40e);
+
+  if (!rsdpv2_cache.scanned || rsdpv2_cache.ebda_seg != ebda_seg)
+    {
+      rsdpv2_cache.rsdp = scan_rsdpv2 ();
+      rsdpv2_cache.ebda_seg = ebda_seg;
+      rsdpv2_cache.scanned = 1;
+    }
+  return rsdpv2_cache.rsdp;
+}
@@ -130,3 +130,21 @@ grub_tpm_log_event(unsigned char *buf, grub_size_t size, grub_uint8_t pcr,
 
 	return 0;
 }
+
+grub_tpm_hash_mode_t
+grub_tpm_hash_mode(void)
+{
+	return tpm_present() ? GRUB_TPM_HASH_FIRMWARE : GRUB_TPM_HASH_NONE;
+}
+
+grub_err_t
+grub_tpm_log_digest(const grub_uint8_t *digest __attribute__ ((unused)),
+		    grub_uint8_t pcr __attribute__ ((unused)),
+		    const char *description __attribute__ ((unused)))
+{
+	if (!tpm_present())
+		return 0;
+
+	return grub_error (GRUB_ERR_NOT_IMPLEMENTED_YET,
+			   N_("TPM doesn't accept precomputed digests"));
+}
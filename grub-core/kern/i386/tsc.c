@@ -33,6 +33,9 @@ static grub_uint64_t tsc_boot_time;
    in 32-bit.  */
 grub_uint32_t grub_tsc_rate;
 
+/* Same in ns per 2^32 ticks.  */
+static grub_uint64_t tsc_ns_rate;
+
 static grub_uint64_t
 grub_tsc_get_time_ms (void)
 {
@@ -43,6 +46,12 @@ grub_tsc_get_time_ms (void)
   return ((al * grub_tsc_rate) >> 32) + ah * grub_tsc_rate;
 }
 
+static grub_uint64_t
+grub_tsc_get_time_ns (void)
+{
+  return grub_time_scale (grub_get_tsc () - tsc_boot_time, tsc_ns_rate);
+}
+
 static __inline int
 grub_cpu_is_tsc_supported (void)
 {
@@ -59,6 +68,43 @@ grub_cpu_is_tsc_supported (void)
 #endif
 }
 
+#ifndef GRUB_MACHINE_XEN
+/* Intel CPUs report the TSC frequency as a ratio to the crystal clock in
+   leaf 0x15.  When the crystal frequency is left out, the TSC runs at the
+   base frequency given in MHz by leaf 0x16.  Nothing to wait for here.  */
+static int
+calibrate_tsc_cpuid (void)
+{
+  grub_uint32_t max, a, b, c, d;
+  grub_uint64_t hz;
+
+  grub_cpuid (0, max, b, c, d);
+  if (max < 0x15)
+    return 0;
+
+  grub_cpuid (0x15, a, b, c, d);
+  if (!a || !b)
+    return 0;
+  if (c)
+    hz = grub_divmod64 ((grub_uint64_t) c * b, a, 0);
+  else if (max >= 0x16)
+    {
+      grub_cpuid (0x16, a, b, c, d);
+      hz = (grub_uint64_t) (a & 0xffff) * 1000000;
+    }
+  else
+    return 0;
+
+  /* Reject bogus values.  */
+  if (hz < 1000000)
+    return 0;
+
+  grub_tsc_rate = grub_divmod64 (1000ULL << 32, hz, 0);
+  tsc_ns_rate = grub_divmod64 (1000000000ULL << 32, hz, 0);
+  return 1;
+}
+#endif
+
 static int
 calibrate_tsc_hardcode (void)
 {
@@ -84,11 +130,15 @@ grub_tsc_init (void)
 #ifdef GRUB_MACHINE_XEN
   (void) (grub_tsc_calibrate_from_xen () || calibrate_tsc_hardcode());
 #elif defined (GRUB_MACHINE_EFI)
-  (void) (grub_tsc_calibrate_from_pit () || grub_tsc_calibrate_from_pmtimer () || grub_tsc_calibrate_from_efi() || calibrate_tsc_hardcode());
+  /* The PIT takes 55 ms, so try the 1 ms waits first.  */
+  (void) (calibrate_tsc_cpuid () || grub_tsc_calibrate_from_pmtimer () || grub_tsc_calibrate_from_efi() || grub_tsc_calibrate_from_pit () || calibrate_tsc_hardcode());
 #elif defined (GRUB_MACHINE_COREBOOT)
-  (void) (grub_tsc_calibrate_from_pmtimer () || grub_tsc_calibrate_from_pit () || calibrate_tsc_hardcode());
+  (void) (calibrate_tsc_cpuid () || grub_tsc_calibrate_from_pmtimer () || grub_tsc_calibrate_from_pit () || calibrate_tsc_hardcode());
 #else
-  (void) (grub_tsc_calibrate_from_pit () || calibrate_tsc_hardcode());
+  (void) (calibrate_tsc_cpuid () || grub_tsc_calibrate_from_pit () || calibrate_tsc_hardcode());
 #endif
+  if (!tsc_ns_rate)
+    tsc_ns_rate = (grub_uint64_t) grub_tsc_rate * 1000000;
   grub_install_get_time_ms (grub_tsc_get_time_ms);
+  grub_install_get_time_ns (grub_tsc_get_time_ns);
 }
@@ -70,6 +70,7 @@ grub_machine_init (void)
 void
 grub_machine_fini (int flags)
 {
+  grub_efi_mm_release_heap ();
   if (flags & GRUB_LOADER_FLAG_NORETURN)
     grub_efi_fini ();
 }
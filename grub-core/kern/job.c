@@ -0,0 +1,62 @@
+/* job.c - run independent pieces of work on other processors  */
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2026  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <grub/job.h>
+#ifdef GRUB_MACHINE_EFI
+#include <grub/efi/efi.h>
+#endif
+
+unsigned
+grub_job_workers (void)
+{
+#ifdef GRUB_MACHINE_EFI
+  return grub_efi_mp_workers ();
+#else
+  return 0;
+#endif
+}
+
+void
+grub_job_submit (struct grub_job *job)
+{
+  job->done = 0;
+#ifdef GRUB_MACHINE_EFI
+  if (grub_efi_mp_start (job))
+    return;
+#endif
+  job->run (job);
+  job->done = 1;
+}
+
+void
+grub_job_wait (struct grub_job *job)
+{
+  while (!job->done)
+#if defined (__i386__) || defined (__x86_64__)
+    asm volatile ("pause" : : : "memory");
+#else
+    asm volatile ("" : : : "memory");
+#endif
+  /* Don't let reads of the results move ahead of the flag.  */
+#ifdef __aarch64__
+  asm volatile ("dmb ish" : : : "memory");
+#else
+  asm volatile ("" : : : "memory");
+#endif
+}
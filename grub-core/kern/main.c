@@ -55,6 +55,13 @@ grub_load_modules (void)
   struct grub_module_header *header;
   FOR_MODULES (header)
   {
+    if (header->type == OBJ_TYPE_ELF_LZ4)
+      {
+	if (grub_dl_load_embedded (header))
+	  grub_fatal ("%s", grub_errmsg);
+	continue;
+      }
+
     /* Not an ELF module, skip.  */
     if (header->type != OBJ_TYPE_ELF)
       continue;
@@ -264,6 +271,8 @@ reclaim_module_space (void)
 void __attribute__ ((noreturn))
 grub_main (void)
 {
+  grub_memops_init ();
+
   /* First of all, initialize the machine.  */
   grub_machine_init ();
 
@@ -24,6 +24,9 @@
 #include <grub/term.h>
 #include <grub/env.h>
 #include <grub/i18n.h>
+#if (defined (__i386__) || defined (__x86_64__)) && !defined (GRUB_UTIL)
+#include <grub/i386/cpuid.h>
+#endif
 
 union printf_arg
 {
@@ -74,23 +77,178 @@ grub_gettext_dummy (const char *s)
 
 const char* (*grub_gettext) (const char *s) = grub_gettext_dummy;
 
-void *
-grub_memmove (void *dest, const void *src, grub_size_t n)
+/* The memory primitives work a word at a time.  Only the destination is
+   aligned; the source is read with unaligned loads where the CPU allows
+   them and a byte at a time otherwise, unless both happen to share the
+   same alignment.  On x86 the string instructions are used instead, in
+   their byte form when the CPU has ERMS (enhanced REP MOVSB/STOSB).  */
+
+typedef unsigned long grub_memword_t __attribute__ ((may_alias));
+
+struct grub_unaligned_memword
 {
-  char *d = (char *) dest;
-  const char *s = (const char *) src;
+  grub_memword_t v;
+} GRUB_PACKED __attribute__ ((may_alias));
 
-  if (d < s)
-    while (n--)
-      *d++ = *s++;
-  else
+#define MEMWORD_SIZE (sizeof (grub_memword_t))
+
+#if defined (__i386__) || defined (__x86_64__) || defined (__aarch64__)
+#define MEMWORD_UNALIGNED_OK 1
+#endif
+
+#if (defined (__i386__) || defined (__x86_64__)) && !defined (GRUB_UTIL)
+#define MEM_STRING_OPS 1
+
+static int mem_erms;
+#endif
+
+void
+grub_memops_init (void)
+{
+#ifdef MEM_STRING_OPS
+  grub_uint32_t eax, ebx, ecx, edx;
+
+  if (!grub_cpu_is_cpuid_supported ())
+    return;
+  grub_cpuid (0, eax, ebx, ecx, edx);
+  if (eax < 7)
+    return;
+  /* Leaf 7 needs ECX set, which grub_cpuid doesn't do.  */
+#ifdef __PIC__
+  asm volatile ("xchgl %%ebx, %1; cpuid; xchgl %%ebx, %1"
+		: "=a" (eax), "=r" (ebx), "=c" (ecx), "=d" (edx)
+		: "0" (7), "2" (0));
+#else
+  asm volatile ("cpuid" : "=a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx)
+		: "0" (7), "2" (0));
+#endif
+  mem_erms = !!(ebx & (1 << 9));
+#endif
+}
+
+static inline grub_memword_t
+memword_load (const grub_uint8_t *p)
+{
+  return ((const struct grub_unaligned_memword *) p)->v;
+}
+
+static inline int
+memword_can_load (const void *p)
+{
+#ifdef MEMWORD_UNALIGNED_OK
+  (void) p;
+  return 1;
+#else
+  return !((grub_addr_t) p & (MEMWORD_SIZE - 1));
+#endif
+}
+
+static void
+copy_forward (grub_uint8_t *d, const grub_uint8_t *s, grub_size_t n)
+{
+#ifdef MEM_STRING_OPS
+  if (n >= 4 * MEMWORD_SIZE)
     {
-      d += n;
-      s += n;
+      if (!mem_erms)
+	{
+	  grub_size_t words = n / MEMWORD_SIZE;
 
-      while (n--)
-	*--d = *--s;
+	  n &= MEMWORD_SIZE - 1;
+#ifdef __x86_64__
+	  asm volatile ("rep movsq" : "+D" (d), "+S" (s), "+c" (words)
+			: : "memory");
+#else
+	  asm volatile ("rep movsl" : "+D" (d), "+S" (s), "+c" (words)
+			: : "memory");
+#endif
+	}
+      asm volatile ("rep movsb" : "+D" (d), "+S" (s), "+c" (n) : : "memory");
+      return;
     }
+#endif
+
+  if (n >= 2 * MEMWORD_SIZE)
+    {
+      while ((grub_addr_t) d & (MEMWORD_SIZE - 1))
+	{
+	  *d++ = *s++;
+	  n--;
+	}
+      if (memword_can_load (s))
+	{
+	  for (; n >= 2 * MEMWORD_SIZE; n -= 2 * MEMWORD_SIZE)
+	    {
+	      grub_memword_t a = memword_load (s);
+	      grub_memword_t b = memword_load (s + MEMWORD_SIZE);
+
+	      ((grub_memword_t *) d)[0] = a;
+	      ((grub_memword_t *) d)[1] = b;
+	      d += 2 * MEMWORD_SIZE;
+	      s += 2 * MEMWORD_SIZE;
+	    }
+	  for (; n >= MEMWORD_SIZE; n -= MEMWORD_SIZE)
+	    {
+	      *(grub_memword_t *) d = memword_load (s);
+	      d += MEMWORD_SIZE;
+	      s += MEMWORD_SIZE;
+	    }
+	}
+    }
+  while (n--)
+    *d++ = *s++;
+}
+
+/* Copy from the end, for a destination overlapping the source from
+   above.  */
+static void
+copy_backward (grub_uint8_t *d, const grub_uint8_t *s, grub_size_t n)
+{
+  d += n;
+  s += n;
+
+  if (n >= 2 * MEMWORD_SIZE)
+    {
+      while ((grub_addr_t) d & (MEMWORD_SIZE - 1))
+	{
+	  *--d = *--s;
+	  n--;
+	}
+      if (memword_can_load (s))
+	{
+	  for (; n >= 2 * MEMWORD_SIZE; n -= 2 * MEMWORD_SIZE)
+	    {
+	      grub_memword_t a, b;
+
+	      d -= 2 * MEMWORD_SIZE;
+	      s -= 2 * MEMWORD_SIZE;
+	      a = memword_load (s);
+	      b = memword_load (s + MEMWORD_SIZE);
+	      ((grub_memword_t *) d)[0] = a;
+	      ((grub_memword_t *) d)[1] = b;
+	    }
+	  for (; n >= MEMWORD_SIZE; n -= MEMWORD_SIZE)
+	    {
+	      d -= MEMWORD_SIZE;
+	      s -= MEMWORD_SIZE;
+	      *(grub_memword_t *) d = memword_load (s);
+	    }
+	}
+    }
+  while (n--)
+    *--d = *--s;
+}
+
+void *
+grub_memmove (void *dest, const void *src, grub_size_t n)
+{
+  grub_uint8_t *d = dest;
+  const grub_uint8_t *s = src;
+
+  /* Only a destination inside the source needs copying from the end.  */
+  if (d <= s || d >= s + n)
+    copy_forward (d, s, n);
+  else
+    copy_backward (d, s, n);
 
   return dest;
 }
@@ -223,6 +381,28 @@ grub_memcmp (const void *s1, const void *s2, grub_size_t n)
   const grub_uint8_t *t1 = s1;
   const grub_uint8_t *t2 = s2;
 
+  /* Skip equal words; the bytes of the first differing one are compared
+     below.  */
+  if (n >= 2 * MEMWORD_SIZE)
+    {
+      while ((grub_addr_t) t1 & (MEMWORD_SIZE - 1))
+	{
+	  if (*t1 != *t2)
+	    return (int) *t1 - (int) *t2;
+	  t1++;
+	  t2++;
+	  n--;
+	}
+      if (memword_can_load (t2))
+	for (; n >= MEMWORD_SIZE; n -= MEMWORD_SIZE)
+	  {
+	    if (*(const grub_memword_t *) t1 != memword_load (t2))
+	      break;
+	    t1 += MEMWORD_SIZE;
+	    t2 += MEMWORD_SIZE;
+	  }
+    }
+
   while (n--)
     {
       if (*t1 != *t2)
@@ -445,9 +625,8 @@ grub_strndup (const char *s, grub_size_t n)
   grub_size_t len;
   char *p;
 
-  len = grub_strlen (s);
-  if (len > n)
-    len = n;
+  /* Don't look past N, S may be a slice of a much longer string.  */
+  for (len = 0; len < n && s[len]; len++);
   p = (char *) grub_malloc (len + 1);
   if (! p)
     return 0;
@@ -472,6 +651,29 @@ grub_memset (void *s, int c, grub_size_t len)
   void *p = s;
   grub_uint8_t pattern8 = c;
 
+#ifdef MEM_STRING_OPS
+  if (len >= 4 * MEMWORD_SIZE)
+    {
+      if (!mem_erms)
+	{
+	  grub_size_t words = len / MEMWORD_SIZE;
+	  grub_memword_t patternl = pattern8 * (~(grub_memword_t) 0 / 0xff);
+
+	  len &= MEMWORD_SIZE - 1;
+#ifdef __x86_64__
+	  asm volatile ("rep stosq" : "+D" (p), "+c" (words) : "a" (patternl)
+			: "memory");
+#else
+	  asm volatile ("rep stosl" : "+D" (p), "+c" (words) : "a" (patternl)
+			: "memory");
+#endif
+	}
+      asm volatile ("rep stosb" : "+D" (p), "+c" (len) : "a" (pattern8)
+		    : "memory");
+      return s;
+    }
+#endif
+
   if (len >= 3 * sizeof (unsigned long))
     {
       unsigned long patternl = 0;
@@ -1108,36 +1310,76 @@ grub_fatal (const char *fmt, ...)
 
 struct grub_boot_time *grub_boot_time_head;
 static struct grub_boot_time **boot_time_last = &grub_boot_time_head;
+static int boot_span_depth;
 
-void
-grub_real_boot_time (const char *file,
-		     const int line,
-		     const char *fmt, ...)
+static struct grub_boot_time *
+boot_time_add (const char *file, const int line, const char *fmt,
+	       va_list args)
 {
   struct grub_boot_time *n;
-  va_list args;
 
   grub_error_push ();
-  n = grub_malloc (sizeof (*n));
+  n = grub_zalloc (sizeof (*n));
   if (!n)
     {
       grub_errno = 0;
       grub_error_pop ();
-      return;
+      return 0;
     }
   n->file = file;
   n->line = line;
   n->tp = grub_get_time_ms ();
-  n->next = 0;
+  n->depth = boot_span_depth;
 
-  va_start (args, fmt);
   n->msg = grub_xvasprintf (fmt, args);    
-  va_end (args);
 
   *boot_time_last = n;
   boot_time_last = &n->next;
 
   grub_errno = 0;
   grub_error_pop ();
+  return n;
+}
+
+void
+grub_real_boot_time (const char *file,
+		     const int line,
+		     const char *fmt, ...)
+{
+  va_list args;
+
+  va_start (args, fmt);
+  boot_time_add (file, line, fmt, args);
+  va_end (args);
+}
+
+grub_boot_span_t
+grub_real_boot_span_begin (const char *file,
+			   const int line,
+			   const char *fmt, ...)
+{
+  struct grub_boot_time *n;
+  va_list args;
+
+  va_start (args, fmt);
+  n = boot_time_add (file, line, fmt, args);
+  va_end (args);
+  if (n)
+    {
+      n->is_span = 1;
+      boot_span_depth++;
+    }
+  return n;
+}
+
+void
+grub_boot_span_end (grub_boot_span_t span, grub_uint64_t bytes)
+{
+  if (!span)
+    return;
+  span->end = grub_get_time_ms ();
+  span->bytes = bytes;
+  /* Also closes whatever was left open inside.  */
+  boot_span_depth = span->depth;
 }
 #endif
@@ -53,6 +53,14 @@
   a typical optimization against defragmentation, and makes the
   implementation a bit easier.
 
+  Small blocks are not returned to the ring right away. grub_free puts a
+  block of up to GRUB_MM_BIN_MAX cells on a per-size bin instead, and
+  grub_memalign hands it out again for the next request of exactly that
+  size without walking the ring. Binned blocks carry their own magic and
+  look allocated to everything walking the free rings; the bins are
+  flushed back when an allocation would otherwise fail and before the
+  relocator claims memory.
+
   For safety, both allocated blocks and free ones are marked by magic
   numbers. Whenever anything unexpected is detected, GRUB aborts the
   operation.
@@ -67,6 +75,7 @@
 #include <grub/dl.h>
 #include <grub/i18n.h>
 #include <grub/mm_private.h>
+#include <grub/reclaim.h>
 
 #ifdef MM_DEBUG
 # undef grub_malloc
@@ -79,6 +88,17 @@
 
 
 grub_mm_region_t grub_mm_base;
+grub_err_t (*grub_mm_add_region_fn) (grub_size_t size);
+
+/* Largest block, in cells including the header, kept on a bin.  */
+#define GRUB_MM_BIN_MAX		16
+/* Bound memory parked on the bins.  */
+#define GRUB_MM_BIN_DEPTH	64
+
+static grub_mm_header_t bins[GRUB_MM_BIN_MAX + 1];
+static unsigned bin_count[GRUB_MM_BIN_MAX + 1];
+
+static struct grub_mm_profile *profile;
 
 /* Get a header from the pointer PTR, and set *P and *R to a pointer
    to the header and a pointer to its region, respectively. PTR must
@@ -98,7 +118,7 @@ get_header_from_pointer (void *ptr, grub_mm_header_t *p, grub_mm_region_t *r)
     grub_fatal ("out of range pointer %p", ptr);
 
   *p = (grub_mm_header_t) ptr - 1;
-  if ((*p)->magic == GRUB_MM_FREE_MAGIC)
+  if ((*p)->magic == GRUB_MM_FREE_MAGIC || (*p)->magic == GRUB_MM_BIN_MAGIC)
     grub_fatal ("double free at %p", *p);
   if ((*p)->magic != GRUB_MM_ALLOC_MAGIC)
     grub_fatal ("alloc magic is broken at %p: %lx", *p,
@@ -144,6 +164,7 @@ grub_mm_init_region (void *addr, grub_size_t size)
 	    grub_free (h + 1);
 	  }
 	*p = r;
+	grub_disk_cache_add_heap (size);
 	return;
       }
 
@@ -173,6 +194,8 @@ grub_mm_init_region (void *addr, grub_size_t size)
 
   *p = r;
   r->next = q;
+
+  grub_disk_cache_add_heap (size);
 }
 
 /* Allocate the number of units N with the alignment ALIGN from the ring
@@ -314,9 +337,85 @@ grub_real_malloc (grub_mm_header_t *first, grub_size_t n, grub_size_t align)
   return 0;
 }
 
-/* Allocate SIZE bytes with the alignment ALIGN and return the pointer.  */
-void *
-grub_memalign (grub_size_t align, grub_size_t size)
+/* Find or create the profile entry for CALLER.  */
+static struct grub_mm_profile_site *
+profile_site (void *caller)
+{
+  unsigned i, h;
+
+  h = (((grub_addr_t) caller >> 2) * 2654435761U) & (GRUB_MM_PROFILE_SITES - 1);
+  for (i = 0; i < GRUB_MM_PROFILE_SITES; i++)
+    {
+      struct grub_mm_profile_site *site;
+
+      site = &profile->sites[(h + i) & (GRUB_MM_PROFILE_SITES - 1)];
+      if (site->caller == caller)
+	return site;
+      if (!site->caller)
+	{
+	  site->caller = caller;
+	  return site;
+	}
+    }
+  return NULL;
+}
+
+/* Charge the block at PTR, if any, to CALLER.  */
+static void *
+profile_alloc (void *ptr, void *caller)
+{
+  grub_mm_header_t p;
+  struct grub_mm_profile_site *site = NULL;
+  grub_size_t bytes;
+
+  if (!ptr)
+    return ptr;
+
+  p = (grub_mm_header_t) ptr - 1;
+  if (profile && profile->active)
+    {
+      bytes = p->size << GRUB_MM_ALIGN_LOG2;
+      site = profile_site (caller);
+      if (site)
+	{
+	  site->count++;
+	  site->bytes += bytes;
+	  site->live += bytes;
+	  if (site->live > site->peak)
+	    site->peak = site->live;
+	  profile->live += bytes;
+	  if (profile->live > profile->peak)
+	    profile->peak = profile->live;
+	}
+      else
+	profile->dropped++;
+    }
+  p->site = site;
+  return ptr;
+}
+
+/* Uncharge the block P when it is freed.  */
+static void
+profile_free (grub_mm_header_t p)
+{
+  struct grub_mm_profile_site *site = p->site;
+  grub_size_t bytes = p->size << GRUB_MM_ALIGN_LOG2;
+
+  p->site = NULL;
+  /* Blocks not allocated through grub_memalign may carry anything in
+     the site field.  */
+  if (!profile || site < profile->sites
+      || site >= profile->sites + GRUB_MM_PROFILE_SITES)
+    return;
+
+  site->live = site->live > bytes ? site->live - bytes : 0;
+  profile->live = profile->live > bytes ? profile->live - bytes : 0;
+}
+
+/* Allocate SIZE bytes with the alignment ALIGN.  The callers charge the
+   block to their own caller for the profiler.  */
+static void *
+memalign_real (grub_size_t align, grub_size_t size)
 {
   grub_mm_region_t r;
   grub_size_t n = ((size + GRUB_MM_ALIGN - 1) >> GRUB_MM_ALIGN_LOG2) + 1;
@@ -329,6 +428,17 @@ grub_memalign (grub_size_t align, grub_size_t size)
   if (align == 0)
     align = 1;
 
+  if (n <= GRUB_MM_BIN_MAX && bins[n]
+      && (((grub_addr_t) (bins[n] + 1) >> GRUB_MM_ALIGN_LOG2) & (align - 1)) == 0)
+    {
+      grub_mm_header_t p = bins[n];
+
+      bins[n] = p->next;
+      bin_count[n]--;
+      p->magic = GRUB_MM_ALLOC_MAGIC;
+      return p + 1;
+    }
+
  again:
 
   for (r = grub_mm_base; r; r = r->next)
@@ -344,13 +454,32 @@ grub_memalign (grub_size_t align, grub_size_t size)
   switch (count)
     {
     case 0:
-      /* Invalidate disk caches.  */
-      grub_disk_cache_invalidate_all ();
+      /* Return binned blocks to the rings and shrink the least recently
+	 used caches by about as much as is asked for.  */
+      grub_mm_flush_bins ();
+      grub_reclaim_memory (n << GRUB_MM_ALIGN_LOG2);
       count++;
       goto again;
 
-#if 0
     case 1:
+      /* What was freed may have been scattered over the heap: drop all
+	 that the caches can give back.  */
+      count++;
+      if (grub_reclaim_memory (GRUB_RECLAIM_ALL))
+	goto again;
+      /* Fallthrough.  */
+
+    case 2:
+      /* Ask the platform for more heap.  */
+      count++;
+      if (grub_mm_add_region_fn
+	  && grub_mm_add_region_fn ((n + align) << GRUB_MM_ALIGN_LOG2)
+	     == GRUB_ERR_NONE)
+	goto again;
+      /* Fallthrough.  */
+
+#if 0
+    case 3:
       /* Unload unneeded modules.  */
       grub_dl_unload_unneeded ();
       count++;
@@ -366,11 +495,47 @@ grub_memalign (grub_size_t align, grub_size_t size)
   return 0;
 }
 
+/* Allocate SIZE bytes with the alignment ALIGN and return the pointer.  */
+void *
+grub_memalign (grub_size_t align, grub_size_t size)
+{
+  return profile_alloc (memalign_real (align, size),
+			__builtin_return_address (0));
+}
+
+int
+grub_mm_profile_start (void)
+{
+  if (!profile)
+    {
+      profile = profile_alloc (memalign_real (0, sizeof (*profile)), NULL);
+      if (!profile)
+	return grub_errno;
+    }
+  grub_memset (profile, 0, sizeof (*profile));
+  profile->active = 1;
+  return GRUB_ERR_NONE;
+}
+
+void
+grub_mm_profile_stop (void)
+{
+  if (profile)
+    profile->active = 0;
+}
+
+const struct grub_mm_profile *
+grub_mm_profile_get (void)
+{
+  return profile;
+}
+
 /* Allocate SIZE bytes and return the pointer.  */
 void *
 grub_malloc (grub_size_t size)
 {
-  return grub_memalign (0, size);
+  return profile_alloc (memalign_real (0, size),
+			__builtin_return_address (0));
 }
 
 /* Allocate SIZE bytes, clear them and return the pointer.  */
@@ -379,25 +544,18 @@ grub_zalloc (grub_size_t size)
 {
   void *ret;
 
-  ret = grub_memalign (0, size);
+  ret = profile_alloc (memalign_real (0, size),
+		       __builtin_return_address (0));
   if (ret)
     grub_memset (ret, 0, size);
 
   return ret;
 }
 
-/* Deallocate the pointer PTR.  */
-void
-grub_free (void *ptr)
+/* Return the allocated block P to the free ring of its region R.  */
+static void
+grub_free_real (grub_mm_header_t p, grub_mm_region_t r)
 {
-  grub_mm_header_t p;
-  grub_mm_region_t r;
-
-  if (! ptr)
-    return;
-
-  get_header_from_pointer (ptr, &p, &r);
-
   if (r->first->magic == GRUB_MM_ALLOC_MAGIC)
     {
       p->magic = GRUB_MM_FREE_MAGIC;
@@ -456,6 +614,52 @@ grub_free (void *ptr)
     }
 }
 
+/* Deallocate the pointer PTR.  */
+void
+grub_free (void *ptr)
+{
+  grub_mm_header_t p;
+  grub_mm_region_t r;
+
+  if (! ptr)
+    return;
+
+  get_header_from_pointer (ptr, &p, &r);
+  profile_free (p);
+
+  if (p->size <= GRUB_MM_BIN_MAX && bin_count[p->size] < GRUB_MM_BIN_DEPTH)
+    {
+      p->magic = GRUB_MM_BIN_MAGIC;
+      p->next = bins[p->size];
+      bins[p->size] = p;
+      bin_count[p->size]++;
+      return;
+    }
+
+  grub_free_real (p, r);
+}
+
+/* Give all binned blocks back to the free rings so that they can be
+   merged with their neighbours.  */
+void
+grub_mm_flush_bins (void)
+{
+  unsigned i;
+
+  for (i = 0; i <= GRUB_MM_BIN_MAX; i++)
+    while (bins[i])
+      {
+	grub_mm_header_t p = bins[i];
+	grub_mm_region_t r;
+
+	bins[i] = p->next;
+	p->magic = GRUB_MM_ALLOC_MAGIC;
+	get_header_from_pointer (p + 1, &p, &r);
+	grub_free_real (p, r);
+      }
+  grub_memset (bin_count, 0, sizeof (bin_count));
+}
+
 /* Reallocate SIZE bytes and return the pointer. The contents will be
    the same as that of PTR.  */
 void *
@@ -482,7 +686,7 @@ grub_realloc (void *ptr, grub_size_t size)
   if (p->size >= n)
     return ptr;
 
-  q = grub_malloc (size);
+  q = profile_alloc (memalign_real (0, size), __builtin_return_address (0));
   if (! q)
     return q;
 
@@ -499,6 +703,7 @@ void
 grub_mm_dump_free (void)
 {
   grub_mm_region_t r;
+  unsigned i;
 
   for (r = grub_mm_base; r; r = r->next)
     {
@@ -518,6 +723,14 @@ grub_mm_dump_free (void)
       while (p != r->first);
     }
 
+  for (i = 0; i <= GRUB_MM_BIN_MAX; i++)
+    {
+      grub_mm_header_t p;
+
+      for (p = bins[i]; p; p = p->next)
+	grub_printf ("B:%p:%u\n", p, (unsigned int) p->size << GRUB_MM_ALIGN_LOG2);
+    }
+
   grub_printf ("\n");
 }
 
@@ -545,6 +758,9 @@ grub_mm_dump (unsigned lineno)
 	    case GRUB_MM_ALLOC_MAGIC:
 	      grub_printf ("A:%p:%u\n", p, (unsigned int) p->size << GRUB_MM_ALIGN_LOG2);
 	      break;
+	    case GRUB_MM_BIN_MAGIC:
+	      grub_printf ("B:%p:%u\n", p, (unsigned int) p->size << GRUB_MM_ALIGN_LOG2);
+	      break;
 	    }
 	}
     }
@@ -27,6 +27,7 @@
 #endif
 
 grub_partition_map_t grub_partition_map_list;
+grub_partition_autoload_hook_t grub_partition_autoload_hook;
 
 /*
  * Checks that disk->partition contains part.  This function assumes that the
@@ -120,6 +121,7 @@ grub_partition_probe (struct grub_disk *disk, const char *str)
     {
       grub_partition_map_t partmap;
       int num;
+      int found, autoloaded = 0;
       const char *partname, *partname_end;
 
       partname = ptr;
@@ -128,7 +130,9 @@ grub_partition_probe (struct grub_disk *disk, const char *str)
       partname_end = ptr; 
       num = grub_strtoul (ptr, (char **) &ptr, 0) - 1;
 
+    retry:
       curpart = 0;
+      found = 0;
       /* Use the first partition map type found.  */
       FOR_PARTITION_MAPS(partmap)
       {
@@ -137,6 +141,7 @@ grub_partition_probe (struct grub_disk *disk, const char *str)
 	     != 0 || partmap->name[partname_end - partname] != 0))
 	  continue;
 
+	found = 1;
 	disk->partition = part;
 	curpart = grub_partition_map_probe (partmap, disk, num);
 	disk->partition = tail;
@@ -153,6 +158,23 @@ grub_partition_probe (struct grub_disk *disk, const char *str)
 	break;
       }
 
+      /* A partition map asked for by name may just not be loaded yet.  */
+      if (! found && partname_end != partname && ! autoloaded
+	  && grub_partition_autoload_hook)
+	{
+	  char *name;
+
+	  autoloaded = 1;
+	  name = grub_strndup (partname, partname_end - partname);
+	  if (name && grub_partition_autoload_hook (name))
+	    {
+	      grub_free (name);
+	      goto retry;
+	    }
+	  grub_free (name);
+	  grub_errno = GRUB_ERR_NONE;
+	}
+
       if (! curpart)
 	{
 	  while (part)
@@ -0,0 +1,94 @@
+/* reclaim.c - Registry of caches that can give memory back.  */
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2026  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <grub/reclaim.h>
+#include <grub/list.h>
+
+/* Caches are sized for speed, each on its own, so together they may hold
+   much of the heap.  Rather than failing a kernel or initrd allocation
+   for memory that is only caching disk blocks or glyphs, the memory
+   manager and the relocator ask the caches registered here to shrink.  */
+
+static struct grub_reclaim_cache *grub_reclaim_caches;
+
+unsigned long grub_reclaim_clock;
+
+/* Bumped on every grub_reclaim_memory call, to mark the caches already
+   shrunk by it.  */
+static unsigned long grub_reclaim_pass;
+
+/* Nonzero while shrinking or held.  */
+static int grub_reclaim_held;
+
+void
+grub_reclaim_register (struct grub_reclaim_cache *cache)
+{
+  cache->pass = grub_reclaim_pass;
+  grub_reclaim_touch (cache);
+  grub_list_push (GRUB_AS_LIST_P (&grub_reclaim_caches), GRUB_AS_LIST (cache));
+}
+
+void
+grub_reclaim_unregister (struct grub_reclaim_cache *cache)
+{
+  grub_list_remove (GRUB_AS_LIST (cache));
+}
+
+void
+grub_reclaim_hold (void)
+{
+  grub_reclaim_held++;
+}
+
+void
+grub_reclaim_release (void)
+{
+  grub_reclaim_held--;
+}
+
+grub_size_t
+grub_reclaim_memory (grub_size_t wanted)
+{
+  struct grub_reclaim_cache *cache, *oldest;
+  grub_size_t freed = 0;
+
+  /* Shrinking must not allocate, but should a callback do so anyway,
+     don't go round again from inside it.  */
+  if (grub_reclaim_held)
+    return 0;
+  grub_reclaim_hold ();
+  grub_reclaim_pass++;
+
+  while (freed < wanted)
+    {
+      oldest = 0;
+      FOR_LIST_ELEMENTS (cache, grub_reclaim_caches)
+	if (cache->pass != grub_reclaim_pass && ! cache->busy && cache->size
+	    && (! oldest || cache->last_use < oldest->last_use))
+	  oldest = cache;
+      if (! oldest)
+	break;
+
+      oldest->pass = grub_reclaim_pass;
+      freed += oldest->shrink (wanted - freed);
+    }
+
+  grub_reclaim_release ();
+  return freed;
+}
@@ -34,6 +34,12 @@ grub_uint8_t grub_term_highlight_color = GRUB_TERM_DEFAULT_HIGHLIGHT_COLOR;
 
 void (*grub_term_poll_usb) (int wait_for_completion) = NULL;
 void (*grub_net_poll_cards_idle) (void) = NULL;
+grub_uint64_t (*grub_net_poll_cards_deadline) (void) = NULL;
+void (*grub_machine_idle) (grub_uint32_t ms) = NULL;
+
+/* Longest sleep between two polls of the terminals, for the terminals
+   that can't wake the machine up.  */
+#define GRUB_TERM_IDLE_MAX_MS 10
 
 /* Put a Unicode character.  */
 static void
@@ -104,6 +110,35 @@ grub_getkey_noblock (void)
   return GRUB_TERM_NO_KEY;
 }
 
+/* Idle until the earliest of DEADLINE (grub_get_time_ms time, 0 for
+   none), the next network poll and the next terminal poll, or until the
+   firmware reports input.  Callers poll their sources again afterwards.  */
+void
+grub_term_idle (grub_uint64_t deadline)
+{
+  grub_uint64_t now, until;
+
+  if (!grub_machine_idle)
+    {
+      grub_cpu_idle ();
+      return;
+    }
+
+  now = grub_get_time_ms ();
+  until = now + GRUB_TERM_IDLE_MAX_MS;
+  if (deadline && deadline < until)
+    until = deadline;
+  if (grub_net_poll_cards_deadline)
+    {
+      grub_uint64_t net = grub_net_poll_cards_deadline ();
+      if (net < until)
+	until = net;
+    }
+
+  if (until > now)
+    grub_machine_idle (until - now);
+}
+
 int
 grub_getkey (void)
 {
@@ -116,7 +151,7 @@ grub_getkey (void)
       ret = grub_getkey_noblock ();
       if (ret != GRUB_TERM_NO_KEY)
 	return ret;
-      grub_cpu_idle ();
+      grub_term_idle (0);
     }
 }
 
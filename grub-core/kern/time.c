@@ -20,9 +20,11 @@
 #include <grub/time.h>
 
 typedef grub_uint64_t (*get_time_ms_func_t) (void);
+typedef grub_uint64_t (*get_time_ns_func_t) (void);
 
-/* Function pointer to the implementation in use.  */
+/* Function pointers to the implementations in use.  */
 static get_time_ms_func_t get_time_ms_func;
+static get_time_ns_func_t get_time_ns_func;
 
 grub_uint64_t
 grub_get_time_ms (void)
@@ -35,3 +37,17 @@ grub_install_get_time_ms (get_time_ms_func_t func)
 {
   get_time_ms_func = func;
 }
+
+grub_uint64_t
+grub_get_time_ns (void)
+{
+  if (get_time_ns_func)
+    return get_time_ns_func ();
+  return get_time_ms_func () * 1000000;
+}
+
+void
+grub_install_get_time_ns (get_time_ns_func_t func)
+{
+  get_time_ns_func = func;
+}
@@ -23,7 +23,9 @@
 
 GRUB_MOD_LICENSE ("GPLv3+");
 
-static grub_uint64_t crc64_table [256];
+/* crc64_table[k] advances a byte through k further zero bytes; see
+   lib/crc.c.  */
+static grub_uint64_t crc64_table [8][256];
 
 /* Helper for init_crc64_table.  */
 static grub_uint64_t
@@ -50,20 +52,25 @@ init_crc64_table (void)
 
   for(i = 0; i < 256; i++)
     {
-      crc64_table[i] = reflect(i, 8) << 56;
+      crc64_table[0][i] = reflect(i, 8) << 56;
       for (j = 0; j < 8; j++)
 	{
-	  crc64_table[i] = (crc64_table[i] << 1) ^
-            (crc64_table[i] & (1ULL << 63) ? polynomial : 0);
+	  crc64_table[0][i] = (crc64_table[0][i] << 1) ^
+            (crc64_table[0][i] & (1ULL << 63) ? polynomial : 0);
 	}
-      crc64_table[i] = reflect(crc64_table[i], 64);
+      crc64_table[0][i] = reflect(crc64_table[0][i], 64);
     }
+
+  for (j = 1; j < 8; j++)
+    for (i = 0; i < 256; i++)
+      crc64_table[j][i] = (crc64_table[j - 1][i] >> 8)
+	^ crc64_table[0][crc64_table[j - 1][i] & 0xff];
 }
 
 static void
 crc64_init (void *context)
 {
-  if (! crc64_table[1])
+  if (! crc64_table[0][1])
     init_crc64_table ();
   *(grub_uint64_t *) context = 0;
 }
@@ -71,13 +78,22 @@ crc64_init (void *context)
 static void
 crc64_write (void *context, const void *buf, grub_size_t size)
 {
-  unsigned i;
   const grub_uint8_t *data = buf;
   grub_uint64_t crc = ~grub_le_to_cpu64 (*(grub_uint64_t *) context);
 
-  for (i = 0; i < size; i++)
+  for (; size >= 8; data += 8, size -= 8)
+    {
+      grub_uint64_t v = grub_le_to_cpu64 (grub_get_unaligned64 (data)) ^ crc;
+
+      crc = crc64_table[7][v & 0xff] ^ crc64_table[6][(v >> 8) & 0xff]
+	^ crc64_table[5][(v >> 16) & 0xff] ^ crc64_table[4][(v >> 24) & 0xff]
+	^ crc64_table[3][(v >> 32) & 0xff] ^ crc64_table[2][(v >> 40) & 0xff]
+	^ crc64_table[1][(v >> 48) & 0xff] ^ crc64_table[0][v >> 56];
+    }
+
+  for (; size; size--)
     {
-      crc = (crc >> 8) ^ crc64_table[(crc & 0xFF) ^ *data];
+      crc = (crc >> 8) ^ crc64_table[0][(crc & 0xFF) ^ *data];
       data++;
     }
 
@@ -105,8 +105,14 @@ grub_cipher_unregister (gcry_cipher_spec_t *cipher)
 void 
 grub_md_register (gcry_md_spec_t *digest)
 {
-  digest->next = grub_digests;
-  grub_digests = digest;
+  gcry_md_spec_t **p;
+
+  /* Keep the list sorted by priority, newest first among equals.  */
+  for (p = &grub_digests; *p && (*p)->priority > digest->priority;
+       p = &(*p)->next)
+    ;
+  digest->next = *p;
+  *p = digest;
 }
 
 void 
@@ -25,6 +25,7 @@
 #include <grub/time.h>
 #include <grub/file.h>
 #include <grub/i18n.h>
+#include <grub/reclaim.h>
 
 GRUB_MOD_LICENSE ("GPLv3+");
 
@@ -34,21 +35,32 @@ static void
 grub_disk_cache_invalidate (unsigned long dev_id, unsigned long disk_id,
 			    grub_disk_addr_t sector)
 {
-  unsigned cache_index;
   struct grub_disk_cache *cache;
+  unsigned i;
+
+  if (! grub_disk_cache_table)
+    return;
 
   sector &= ~((grub_disk_addr_t) GRUB_DISK_CACHE_SIZE - 1);
-  cache_index = grub_disk_cache_get_index (dev_id, disk_id, sector);
-  cache = grub_disk_cache_table + cache_index;
+  cache = grub_disk_cache_get_set (dev_id, disk_id, sector);
+
+  for (i = 0; i < GRUB_DISK_CACHE_WAYS; i++, cache++)
+    if (cache->dev_id == dev_id && cache->disk_id == disk_id
+	&& cache->sector == sector && cache->data)
+      {
+	cache->lock = 1;
+	grub_disk_cache_free_line (cache);
+	cache->lock = 0;
+      }
+}
 
-  if (cache->dev_id == dev_id && cache->disk_id == disk_id
-      && cache->sector == sector && cache->data)
-    {
-      cache->lock = 1;
-      grub_free (cache->data);
-      cache->data = 0;
-      cache->lock = 0;
-    }
+static grub_err_t
+grub_disk_dev_write (grub_disk_t disk, grub_disk_addr_t sector,
+		     grub_size_t size, const char *buf)
+{
+  disk->dev->stats.writes++;
+  disk->dev->stats.write_bytes += (grub_uint64_t) size << disk->log_sector_size;
+  return (disk->dev->write) (disk, sector, size, buf);
 }
 
 grub_err_t
@@ -101,8 +113,8 @@ grub_disk_write (grub_disk_t disk, grub_disk_addr_t sector,
 
 	  grub_disk_cache_invalidate (disk->dev->id, disk->id, sector);
 
-	  if ((disk->dev->write) (disk, transform_sector (disk, sector),
-				  1, tmp_buf) != GRUB_ERR_NONE)
+	  if (grub_disk_dev_write (disk, transform_sector (disk, sector),
+				   1, tmp_buf) != GRUB_ERR_NONE)
 	    {
 	      grub_free (tmp_buf);
 	      goto finish;
@@ -130,8 +142,8 @@ grub_disk_write (grub_disk_t disk, grub_disk_addr_t sector,
 		 << (GRUB_DISK_CACHE_BITS + GRUB_DISK_SECTOR_BITS
 		     - disk->log_sector_size));
 
-	  if ((disk->dev->write) (disk, transform_sector (disk, sector),
-				  n, buf) != GRUB_ERR_NONE)
+	  if (grub_disk_dev_write (disk, transform_sector (disk, sector),
+				   n, buf) != GRUB_ERR_NONE)
 	    goto finish;
 
 	  while (n--)
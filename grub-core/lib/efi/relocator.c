@@ -23,44 +23,35 @@
 #include <grub/efi/api.h>
 #include <grub/term.h>
 
-#define NEXT_MEMORY_DESCRIPTOR(desc, size)	\
-  ((grub_efi_memory_descriptor_t *) ((char *) (desc) + (size)))
-
 unsigned 
 grub_relocator_firmware_get_max_events (void)
 {
-  grub_efi_uintn_t mmapsize = 0, descriptor_size = 0;
-  grub_efi_uint32_t descriptor_version = 0;
-  grub_efi_uintn_t key;
-  grub_efi_get_memory_map (&mmapsize, NULL, &key, &descriptor_size,
-			   &descriptor_version);
-  /* Since grub_relocator_firmware_fill_events uses malloc
-     we need some reserve. Hence +10.  */
-  return 2 * (mmapsize / descriptor_size + 10);
+  grub_efi_uintn_t count;
+
+  /* What the firmware allocated for itself is not tracked and a stale map
+     makes grub_relocator_firmware_alloc_region fail, so begin every
+     allocation with a fresh map.  grub_relocator_firmware_fill_events
+     then reuses it.  */
+  grub_efi_mmap_generation++;
+  if (!grub_efi_get_cached_memory_map (&count, NULL))
+    return 0;
+  /* The map is fetched again if the heap grew in between, so we need
+     some reserve. Hence +10.  */
+  return 2 * (count + 10);
 }
 
 unsigned 
 grub_relocator_firmware_fill_events (struct grub_relocator_mmap_event *events)
 {
-  grub_efi_uintn_t mmapsize = 0, desc_size = 0;
-  grub_efi_uint32_t descriptor_version = 0;
-  grub_efi_memory_descriptor_t *descs = NULL;
-  grub_efi_uintn_t key;
+  const grub_efi_memory_descriptor_t *descs, *desc;
+  grub_efi_uintn_t count;
   int counter = 0;
-  grub_efi_memory_descriptor_t *desc;
 
-  grub_efi_get_memory_map (&mmapsize, NULL, &key, &desc_size,
-			   &descriptor_version);
-  descs = grub_malloc (mmapsize);
+  descs = grub_efi_get_cached_memory_map (&count, NULL);
   if (!descs)
     return 0;
 
-  grub_efi_get_memory_map (&mmapsize, descs, &key, &desc_size,
-			   &descriptor_version);
-
-  for (desc = descs;
-       (char *) desc < ((char *) descs + mmapsize);
-       desc = NEXT_MEMORY_DESCRIPTOR (desc, desc_size))
+  for (desc = descs; desc < descs + count; desc++)
     {
       grub_uint64_t start = desc->physical_start;
       grub_uint64_t end = desc->physical_start + (desc->num_pages << 12);
@@ -103,7 +94,10 @@ grub_relocator_firmware_alloc_region (grub_addr_t start, grub_size_t size)
   b = grub_efi_system_table->boot_services;
   status = efi_call_4 (b->allocate_pages, GRUB_EFI_ALLOCATE_ADDRESS,
 		       GRUB_EFI_LOADER_DATA, size >> 12, &address);
-  return (status == GRUB_EFI_SUCCESS);
+  if (status != GRUB_EFI_SUCCESS)
+    return 0;
+  grub_efi_mmap_generation++;
+  return 1;
 }
 
 void
@@ -116,4 +110,5 @@ grub_relocator_firmware_free_region (grub_addr_t start, grub_size_t size)
 
   b = grub_efi_system_table->boot_services;
   efi_call_2 (b->free_pages, start, size >> 12);
+  grub_efi_mmap_generation++;
 }
@@ -179,33 +179,51 @@ insert:
 /* Rearrange FDT blocks in the canonical order: first the memory reservation
    block (just after the FDT header), then the structure block and finally the
    strings block. No free space is left between the first and the second block,
-   while the space between the second and the third block is given by the
-   clearance argument. */
-static int rearrange_blocks (void *fdt, unsigned int clearance)
+   while the free space is split between the gap after the structure block,
+   which gets at least struct_space bytes, and the end of the FDT, which gets
+   at least strings_space bytes for names appended to the strings block.
+   Blocks already laid out like that with enough room are left alone, so that
+   a series of edits does not move the strings block around every time. */
+static int rearrange_blocks (void *fdt, unsigned int struct_space,
+			     unsigned int strings_space)
 {
   grub_uint32_t off_mem_rsvmap = ALIGN_UP(sizeof(grub_fdt_header_t), 8);
   grub_uint32_t off_dt_struct = off_mem_rsvmap + get_mem_rsvmap_size (fdt);
-  grub_uint32_t off_dt_strings = off_dt_struct
-                                 + grub_fdt_get_size_dt_struct (fdt)
-                                 + clearance;
+  grub_uint32_t end_dt_struct = off_dt_struct + grub_fdt_get_size_dt_struct (fdt);
+  grub_uint32_t size_dt_strings = grub_fdt_get_size_dt_strings (fdt);
+  grub_uint32_t totalsize = grub_fdt_get_totalsize (fdt);
+  grub_uint32_t off_dt_strings, spare;
   grub_uint8_t *fdt_ptr = fdt;
   grub_uint8_t *tmp_fdt;
 
+  if (end_dt_struct + struct_space + size_dt_strings + strings_space > totalsize)
+    return -1;
+
+  if ((grub_fdt_get_off_mem_rsvmap (fdt) == off_mem_rsvmap)
+      && (grub_fdt_get_off_dt_struct (fdt) == off_dt_struct)
+      && (grub_fdt_get_off_dt_strings (fdt) >= end_dt_struct + struct_space)
+      && (grub_fdt_get_off_dt_strings (fdt) + size_dt_strings + strings_space
+	  <= totalsize))
+    return 0;
+
+  /* Most edits add to the structure block; names tend to be there already.
+     Keep an eighth of what is left over for the strings.  */
+  spare = totalsize - end_dt_struct - struct_space - size_dt_strings
+	  - strings_space;
+  off_dt_strings = totalsize - size_dt_strings - strings_space - spare / 8;
+
   if ((grub_fdt_get_off_mem_rsvmap (fdt) == off_mem_rsvmap)
       && (grub_fdt_get_off_dt_struct (fdt) == off_dt_struct))
     {
       /* No need to allocate memory for a temporary FDT, just move the strings
-         block if needed. */
-      if (grub_fdt_get_off_dt_strings (fdt) != off_dt_strings)
-        {
-          grub_memmove(fdt_ptr + off_dt_strings,
-                       fdt_ptr + grub_fdt_get_off_dt_strings (fdt),
-                       grub_fdt_get_size_dt_strings (fdt));
-          grub_fdt_set_off_dt_strings (fdt, off_dt_strings);
-        }
+         block. */
+      grub_memmove(fdt_ptr + off_dt_strings,
+                   fdt_ptr + grub_fdt_get_off_dt_strings (fdt),
+                   size_dt_strings);
+      grub_fdt_set_off_dt_strings (fdt, off_dt_strings);
       return 0;
     }
-  tmp_fdt = grub_malloc (grub_fdt_get_totalsize (fdt));
+  tmp_fdt = grub_malloc (totalsize);
   if (!tmp_fdt)
     return -1;
   grub_memcpy (tmp_fdt + off_mem_rsvmap,
@@ -218,17 +236,40 @@ static int rearrange_blocks (void *fdt, unsigned int clearance)
   grub_fdt_set_off_dt_struct (fdt, off_dt_struct);
   grub_memcpy (tmp_fdt + off_dt_strings,
                fdt_ptr + grub_fdt_get_off_dt_strings (fdt),
-               grub_fdt_get_size_dt_strings (fdt));
+               size_dt_strings);
   grub_fdt_set_off_dt_strings (fdt, off_dt_strings);
 
   /* Copy reordered blocks back to fdt. */
   grub_memcpy (fdt_ptr + off_mem_rsvmap, tmp_fdt + off_mem_rsvmap,
-               grub_fdt_get_totalsize (fdt) - off_mem_rsvmap);
+               totalsize - off_mem_rsvmap);
 
   grub_free(tmp_fdt);
   return 0;
 }
 
+/* Find NAME in the strings block, possibly as the tail of a longer string,
+   as dtc shares them.  Returns its offset or -1. */
+static int find_string (const void *fdt, const char *name)
+{
+  const char *strings = (const char *) fdt + grub_fdt_get_off_dt_strings (fdt);
+  grub_uint32_t size = grub_fdt_get_size_dt_strings (fdt);
+  grub_uint32_t len = grub_strlen (name);
+  grub_uint32_t pos = 0, end;
+
+  while (pos < size)
+    {
+      for (end = pos; end < size && strings[end]; end++)
+	;
+      if (end == size)
+	break;
+      if (end - pos >= len
+	  && grub_memcmp (strings + end - len, name, len) == 0)
+	return end - len;
+      pos = end + 1;
+    }
+  return -1;
+}
+
 static grub_uint32_t *find_prop (void *fdt, unsigned int nodeoffset,
 				 const char *name)
 {
@@ -354,7 +395,7 @@ int grub_fdt_add_subnode (void *fdt, unsigned int parentoffset,
   /* The new node entry will increase the size of the structure block: rearrange
      blocks such that there is sufficient free space between the structure and
      the strings block, then add the new node entry. */
-  if (rearrange_blocks (fdt, entry_size) < 0)
+  if (rearrange_blocks (fdt, entry_size, 0) < 0)
     return -1;
   return add_subnode (fdt, parentoffset, name);
 }
@@ -365,6 +406,7 @@ int grub_fdt_set_prop (void *fdt, unsigned int nodeoffset, const char *name,
   grub_uint32_t *prop;
   int prop_name_present = 0;
   grub_uint32_t nameoff = 0;
+  int off;
 
   if ((nodeoffset >= grub_fdt_get_size_dt_struct (fdt)) || (nodeoffset & 0x3)
       || (grub_be_to_cpu32(*(grub_uint32_t *) ((grub_addr_t) fdt
@@ -392,16 +434,22 @@ int grub_fdt_set_prop (void *fdt, unsigned int nodeoffset, const char *name,
           prop = NULL;
         }
     }
+  if (!prop_name_present && (off = find_string (fdt, name)) >= 0)
+    {
+      /* Another node has a property with that name: share it. */
+      nameoff = off;
+      prop_name_present = 1;
+    }
   if (!prop || !prop_name_present) {
-    unsigned int needed_space = 0;
+    unsigned int struct_space = 0, strings_space = 0;
 
     if (!prop)
-      needed_space = prop_entry_size(len);
+      struct_space = prop_entry_size(len);
     if (!prop_name_present)
-      needed_space += grub_strlen (name) + 1;
-    if (needed_space > get_free_space (fdt))
+      strings_space = grub_strlen (name) + 1;
+    if (struct_space + strings_space > get_free_space (fdt))
       return -1;
-    if (rearrange_blocks (fdt, !prop ? prop_entry_size(len) : 0) < 0)
+    if (rearrange_blocks (fdt, struct_space, strings_space) < 0)
       return -1;
   }
   if (!prop_name_present) {
@@ -31,6 +31,8 @@
 GRUB_MOD_LICENSE ("GPLv3+");
 
 static grub_uint8_t grub_gpt_magic[] = GRUB_GPT_HEADER_MAGIC;
+static const grub_gpt_part_type_t grub_gpt_partition_type_empty =
+  GRUB_GPT_PARTITION_TYPE_EMPTY;
 
 
 char *
@@ -46,11 +48,188 @@ grub_gpt_guid_to_str (grub_gpt_guid_t *guid)
 			 guid->data4[6], guid->data4[7]);
 }
 
+/* Validated tables of the disks looked at so far, so that looking up
+   partition labels and UUIDs, or running gptprio again, doesn't read and
+   checksum the whole table every time.  A table is dropped when it is
+   written through this module, and all of them when the set of disks
+   changes.  */
+struct grub_gpt_cache
+{
+  struct grub_gpt_cache *next;
+  unsigned long dev_id;
+  unsigned long disk_id;
+  grub_disk_addr_t start;
+  grub_gpt_t gpt;
+
+  /* Entry indices chained by partition GUID, in decreasing order within
+     each chain; uuid_next[i] is the next index after I.  */
+  grub_uint32_t *uuid_buckets;
+  grub_uint32_t *uuid_next;
+  grub_uint32_t uuid_mask;
+};
+
+#define GRUB_GPT_CACHE_NONE 0xffffffff
+
+static struct grub_gpt_cache *gpt_cache;
+static unsigned long gpt_cache_generation;
+
+static grub_gpt_t grub_gpt_read_disk (grub_disk_t disk);
+
+static void
+grub_gpt_cache_free (struct grub_gpt_cache *cache)
+{
+  grub_gpt_free (cache->gpt);
+  grub_free (cache->uuid_buckets);
+  grub_free (cache->uuid_next);
+  grub_free (cache);
+}
+
+static void
+grub_gpt_cache_flush (void)
+{
+  struct grub_gpt_cache *cache, *next;
+
+  for (cache = gpt_cache; cache; cache = next)
+    {
+      next = cache->next;
+      grub_gpt_cache_free (cache);
+    }
+  gpt_cache = 0;
+  gpt_cache_generation = grub_disk_generation;
+}
+
+static struct grub_gpt_cache **
+grub_gpt_cache_find (grub_disk_t disk)
+{
+  struct grub_gpt_cache **prev, *cache;
+  grub_disk_addr_t start;
+
+  if (gpt_cache_generation != grub_disk_generation)
+    grub_gpt_cache_flush ();
+
+  start = disk->partition ? grub_partition_get_start (disk->partition) : 0;
+  for (prev = &gpt_cache, cache = *prev; cache;
+       prev = &cache->next, cache = *prev)
+    if (cache->dev_id == disk->dev->id && cache->disk_id == disk->id
+	&& cache->start == start)
+      break;
+
+  return prev;
+}
+
+/* Forget the table of DISK, before it is written.  */
+static void
+grub_gpt_cache_drop (grub_disk_t disk)
+{
+  struct grub_gpt_cache **prev, *cache;
+
+  prev = grub_gpt_cache_find (disk);
+  cache = *prev;
+  if (!cache)
+    return;
+
+  *prev = cache->next;
+  grub_gpt_cache_free (cache);
+}
+
+/* The header describing the entries table that was loaded.  */
+static struct grub_gpt_header *
+grub_gpt_entries_header (grub_gpt_t gpt)
+{
+  if (gpt->status & GRUB_GPT_PRIMARY_ENTRIES_VALID)
+    return &gpt->primary;
+  return &gpt->backup;
+}
+
+static grub_uint32_t
+grub_gpt_guid_hash (const grub_gpt_guid_t *guid)
+{
+  grub_uint32_t words[4];
+
+  grub_memcpy (words, guid, sizeof (words));
+  return words[0] ^ words[1] ^ words[2] ^ words[3];
+}
+
+/* Hash the partition GUIDs of CACHE.  Failing only costs the lookups
+   their shortcut.  */
+static void
+grub_gpt_cache_hash (struct grub_gpt_cache *cache)
+{
+  grub_gpt_t gpt = cache->gpt;
+  grub_uint32_t count, size, nbuckets, i, h;
+  struct grub_gpt_partentry *entry;
+
+  size = grub_le_to_cpu32 (grub_gpt_entries_header (gpt)->partentry_size);
+  count = gpt->entries_size / size;
+
+  for (nbuckets = 1; nbuckets < count; nbuckets <<= 1)
+    ;
+
+  cache->uuid_buckets = grub_malloc (nbuckets * sizeof (grub_uint32_t));
+  cache->uuid_next = grub_malloc (count * sizeof (grub_uint32_t));
+  if (!cache->uuid_buckets || !cache->uuid_next)
+    {
+      grub_free (cache->uuid_buckets);
+      grub_free (cache->uuid_next);
+      cache->uuid_buckets = 0;
+      cache->uuid_next = 0;
+      grub_errno = GRUB_ERR_NONE;
+      return;
+    }
+  cache->uuid_mask = nbuckets - 1;
+
+  for (i = 0; i < nbuckets; i++)
+    cache->uuid_buckets[i] = GRUB_GPT_CACHE_NONE;
+
+  for (i = 0; i < count; i++)
+    {
+      entry = (struct grub_gpt_partentry *) ((char *) gpt->entries
+					     + (grub_size_t) i * size);
+      h = grub_gpt_guid_hash (&entry->guid) & cache->uuid_mask;
+      cache->uuid_next[i] = cache->uuid_buckets[h];
+      cache->uuid_buckets[h] = i;
+    }
+}
+
+/* Return the cached table of DISK, reading it first if needed.  */
+static struct grub_gpt_cache *
+grub_gpt_cache_get (grub_disk_t disk)
+{
+  struct grub_gpt_cache **prev, *cache;
+  grub_gpt_t gpt;
+
+  prev = grub_gpt_cache_find (disk);
+  if (*prev)
+    return *prev;
+
+  gpt = grub_gpt_read_disk (disk);
+  if (!gpt)
+    return 0;
+
+  cache = grub_zalloc (sizeof (*cache));
+  if (!cache)
+    {
+      grub_gpt_free (gpt);
+      return 0;
+    }
+
+  cache->dev_id = disk->dev->id;
+  cache->disk_id = disk->id;
+  cache->start = disk->partition
+    ? grub_partition_get_start (disk->partition) : 0;
+  cache->gpt = gpt;
+  grub_gpt_cache_hash (cache);
+
+  *prev = cache;
+  return cache;
+}
+
 static grub_err_t
 grub_gpt_device_partentry (grub_device_t device,
 			   struct grub_gpt_partentry *entry)
 {
   grub_disk_t disk = device->disk;
+  struct grub_gpt_cache *cache;
   grub_partition_t p;
   grub_err_t err;
 
@@ -62,6 +241,27 @@ grub_gpt_device_partentry (grub_device_t device,
 
   p = disk->partition;
   disk->partition = p->parent;
+
+  /* The partition map reads the primary table without checking it, so
+     only a valid primary can stand in for it.  */
+  cache = grub_gpt_cache_get (disk);
+  if (cache && (cache->gpt->status & GRUB_GPT_PRIMARY_VALID)
+      == GRUB_GPT_PRIMARY_VALID)
+    {
+      grub_size_t offset;
+
+      offset = (grub_size_t) p->number
+	* grub_le_to_cpu32 (cache->gpt->primary.partentry_size);
+      if (offset + sizeof (*entry) <= cache->gpt->entries_size)
+	{
+	  grub_memcpy (entry, (char *) cache->gpt->entries + offset,
+		       sizeof (*entry));
+	  disk->partition = p;
+	  return GRUB_ERR_NONE;
+	}
+    }
+  grub_errno = GRUB_ERR_NONE;
+
   err = grub_disk_read (disk, p->offset, p->index, sizeof (*entry), entry);
   disk->partition = p;
 
@@ -111,10 +311,14 @@ grub_gpt_part_uuid (grub_device_t device, char **uuid)
 grub_err_t
 grub_gpt_disk_uuid (grub_device_t device, char **uuid)
 {
-  grub_gpt_t gpt = grub_gpt_read (device->disk);
-  if (!gpt)
-    goto done;
+  struct grub_gpt_cache *cache;
+  grub_gpt_t gpt;
+
+  cache = grub_gpt_cache_get (device->disk);
+  if (!cache)
+    return grub_errno;
 
+  gpt = cache->gpt;
   grub_errno = GRUB_ERR_NONE;
 
   if (gpt->status & GRUB_GPT_PRIMARY_HEADER_VALID)
@@ -124,11 +328,80 @@ grub_gpt_disk_uuid (grub_device_t device, char **uuid)
   else
     grub_errno = grub_error (GRUB_ERR_BUG, "No valid GPT header");
 
-done:
-  grub_gpt_free (gpt);
   return grub_errno;
 }
 
+grub_err_t
+grub_gpt_find_part_uuid (grub_disk_t disk, const char *uuid,
+			 grub_uint32_t *number)
+{
+  struct grub_gpt_cache *cache;
+  struct grub_gpt_partentry *entry;
+  grub_gpt_guid_t guid;
+  grub_uint32_t size, i;
+  grub_uint64_t node;
+  char *str;
+  const char *ptr = uuid;
+  int j;
+
+  cache = grub_gpt_cache_get (disk);
+  if (!cache)
+    return grub_errno;
+
+  if ((cache->gpt->status & GRUB_GPT_PRIMARY_VALID) != GRUB_GPT_PRIMARY_VALID
+      || !cache->uuid_buckets)
+    return grub_error (GRUB_ERR_NOT_IMPLEMENTED_YET,
+		       "GPT partition lookup unavailable");
+
+  /* Parse UUID, then insist on it being in exactly the form
+     grub_gpt_part_uuid would have returned.  */
+  guid.data1 = grub_cpu_to_le32 (grub_strtoul (ptr, (char **) &ptr, 16));
+  if (*ptr++ != '-')
+    goto not_found;
+  guid.data2 = grub_cpu_to_le16 (grub_strtoul (ptr, (char **) &ptr, 16));
+  if (*ptr++ != '-')
+    goto not_found;
+  guid.data3 = grub_cpu_to_le16 (grub_strtoul (ptr, (char **) &ptr, 16));
+  if (*ptr++ != '-')
+    goto not_found;
+  node = grub_strtoul (ptr, (char **) &ptr, 16);
+  guid.data4[0] = node >> 8;
+  guid.data4[1] = node;
+  if (*ptr++ != '-')
+    goto not_found;
+  node = grub_strtoull (ptr, (char **) &ptr, 16);
+  for (j = 2; j < 8; j++)
+    guid.data4[j] = node >> (8 * (7 - j));
+  grub_errno = GRUB_ERR_NONE;
+
+  str = grub_gpt_guid_to_str (&guid);
+  if (!str)
+    return grub_errno;
+  j = grub_strcmp (str, uuid);
+  grub_free (str);
+  if (j != 0)
+    goto not_found;
+
+  size = grub_le_to_cpu32 (cache->gpt->primary.partentry_size);
+  for (i = cache->uuid_buckets[grub_gpt_guid_hash (&guid) & cache->uuid_mask];
+       i != GRUB_GPT_CACHE_NONE; i = cache->uuid_next[i])
+    {
+      entry = (struct grub_gpt_partentry *) ((char *) cache->gpt->entries
+					     + (grub_size_t) i * size);
+      if (grub_memcmp (&grub_gpt_partition_type_empty, &entry->type,
+		       sizeof (entry->type)) != 0
+	  && grub_memcmp (&guid, &entry->guid, sizeof (guid)) == 0)
+	{
+	  *number = i;
+	  return GRUB_ERR_NONE;
+	}
+    }
+
+not_found:
+  grub_errno = GRUB_ERR_NONE;
+  return grub_error (GRUB_ERR_FILE_NOT_FOUND, "no such partition: %s", uuid);
+}
+
 static grub_uint64_t
 grub_gpt_size_to_sectors (grub_gpt_t gpt, grub_size_t size)
 {
@@ -309,8 +582,8 @@ fail:
   return grub_errno;
 }
 
-grub_gpt_t
-grub_gpt_read (grub_disk_t disk)
+static grub_gpt_t
+grub_gpt_read_disk (grub_disk_t disk)
 {
   grub_gpt_t gpt;
 
@@ -367,6 +640,33 @@ fail:
   return NULL;
 }
 
+grub_gpt_t
+grub_gpt_read (grub_disk_t disk)
+{
+  struct grub_gpt_cache *cache;
+  grub_gpt_t gpt;
+
+  cache = grub_gpt_cache_get (disk);
+  if (!cache)
+    return NULL;
+
+  /* Callers get their own copy to modify.  */
+  gpt = grub_malloc (sizeof (*gpt));
+  if (!gpt)
+    return NULL;
+
+  grub_memcpy (gpt, cache->gpt, sizeof (*gpt));
+  gpt->entries = grub_malloc (gpt->entries_size);
+  if (!gpt->entries)
+    {
+      grub_free (gpt);
+      return NULL;
+    }
+  grub_memcpy (gpt->entries, cache->gpt->entries, gpt->entries_size);
+
+  return gpt;
+}
+
 grub_err_t
 grub_gpt_repair (grub_disk_t disk, grub_gpt_t gpt)
 {
@@ -444,9 +744,11 @@ grub_gpt_update_checksums (grub_gpt_t gpt)
   return GRUB_ERR_NONE;
 }
 
+/* Write HEADER and the part of its entries table from byte START to END.  */
 static grub_err_t
 grub_gpt_write_table (grub_disk_t disk, grub_gpt_t gpt,
-		      struct grub_gpt_header *header)
+		      struct grub_gpt_header *header,
+		      grub_size_t start, grub_size_t end)
 {
   grub_disk_addr_t addr;
 
@@ -461,7 +763,8 @@ grub_gpt_write_table (grub_disk_t disk, grub_gpt_t gpt,
     return grub_errno;
 
   addr = grub_gpt_sector_to_addr (gpt, grub_le_to_cpu64 (header->partitions));
-  if (grub_disk_write (disk, addr, 0, gpt->entries_size, gpt->entries))
+  if (grub_disk_write (disk, addr, start, end - start,
+		       (char *) gpt->entries + start))
     return grub_errno;
 
   return GRUB_ERR_NONE;
@@ -475,10 +778,46 @@ grub_gpt_write (grub_disk_t disk, grub_gpt_t gpt)
   if (!(gpt->status & GRUB_GPT_BOTH_VALID))
     return grub_error (GRUB_ERR_BAD_PART_TABLE, "Invalid GPT data");
 
-  if (grub_gpt_write_table (disk, gpt, &gpt->primary))
+  grub_gpt_cache_drop (disk);
+
+  if (grub_gpt_write_table (disk, gpt, &gpt->primary, 0, gpt->entries_size))
     return grub_errno;
 
-  if (grub_gpt_write_table (disk, gpt, &gpt->backup))
+  if (grub_gpt_write_table (disk, gpt, &gpt->backup, 0, gpt->entries_size))
+    return grub_errno;
+
+  return GRUB_ERR_NONE;
+}
+
+grub_err_t
+grub_gpt_write_entry (grub_disk_t disk, grub_gpt_t gpt, grub_uint32_t index)
+{
+  grub_size_t sector_size, start, end;
+
+  if (!(gpt->status & GRUB_GPT_BOTH_VALID))
+    return grub_error (GRUB_ERR_BAD_PART_TABLE, "Invalid GPT data");
+
+  start = index * sizeof (gpt->entries[0]);
+  end = start + sizeof (gpt->entries[0]);
+  if (end > gpt->entries_size)
+    return grub_error (GRUB_ERR_BUG, "GPT entry %u out of range", index);
+
+  if (grub_gpt_update_checksums (gpt))
+    return grub_errno;
+
+  /* Only the sectors holding the entry change, besides the headers.  */
+  sector_size = 1U << gpt->log_sector_size;
+  start = ALIGN_DOWN (start, sector_size);
+  end = ALIGN_UP (end, sector_size);
+  if (end > gpt->entries_size)
+    end = gpt->entries_size;
+
+  grub_gpt_cache_drop (disk);
+
+  if (grub_gpt_write_table (disk, gpt, &gpt->primary, start, end))
+    return grub_errno;
+
+  if (grub_gpt_write_table (disk, gpt, &gpt->backup, start, end))
     return grub_errno;
 
   return GRUB_ERR_NONE;
@@ -493,3 +832,8 @@ grub_gpt_free (grub_gpt_t gpt)
   grub_free (gpt->entries);
   grub_free (gpt);
 }
+
+GRUB_MOD_FINI (gpt)
+{
+  grub_gpt_cache_flush ();
+}
@@ -29,30 +29,109 @@ GRUB_MOD_LICENSE ("GPLv3+");
 
 #define UPDATE_INTERVAL 800
 
+/* Bounds on how much is read between two looks at the clock.  In between,
+   the hook only counts bytes.  */
+#define CHECK_MIN_BYTES (64 << 10)
+#define CHECK_MAX_BYTES (16 << 20)
+
+/* Return how far to read before looking at the clock again: about a
+   quarter of what FILE is expected to read during UPDATE_INTERVAL.  */
+static grub_off_t
+check_step (grub_file_t file)
+{
+  grub_uint64_t step;
+
+  /* ESTIMATED_SPEED is in hundredths of bytes per second.  */
+  step = grub_divmod64 (file->estimated_speed, 100 * 1000 * 4, 0)
+    * UPDATE_INTERVAL;
+  if (step < CHECK_MIN_BYTES)
+    return CHECK_MIN_BYTES;
+  if (step > CHECK_MAX_BYTES)
+    return CHECK_MAX_BYTES;
+  return step;
+}
+
+/* Show TEXT, GRUB_TERM_PROGRESS_WIDTH bytes long, at the right end of the
+   cursor line of TERM.  Only the runs of characters which differ from
+   what was drawn there last are sent, which matters on serial lines.  */
+static void
+draw_progress (struct grub_term_output *term, const char *text, int redraw)
+{
+  struct grub_term_coordinate old_pos, pos, at;
+  char run[GRUB_TERM_PROGRESS_WIDTH + 1];
+  unsigned width = grub_term_width (term);
+  unsigned i, start;
+
+  if (width < GRUB_TERM_PROGRESS_WIDTH + 1)
+    return;
+
+  old_pos = grub_term_getxy (term);
+  pos.x = width - GRUB_TERM_PROGRESS_WIDTH - 1;
+  pos.y = old_pos.y;
+  if (pos.x != term->progress_pos.x || pos.y != term->progress_pos.y)
+    redraw = 1;
+
+  for (i = 0; i < GRUB_TERM_PROGRESS_WIDTH; )
+    {
+      if (! redraw && text[i] == term->progress_text[i])
+	{
+	  i++;
+	  continue;
+	}
+      start = i;
+      while (i < GRUB_TERM_PROGRESS_WIDTH
+	     && (redraw || text[i] != term->progress_text[i]))
+	i++;
+
+      grub_memcpy (run, text + start, i - start);
+      run[i - start] = 0;
+      at.x = pos.x + start;
+      at.y = pos.y;
+      grub_term_gotoxy (term, at);
+      grub_puts_terminal (run, term);
+    }
+  grub_term_gotoxy (term, old_pos);
+
+  grub_memcpy (term->progress_text, text, sizeof (term->progress_text));
+  term->progress_pos = pos;
+
+  if (term->refresh)
+    term->refresh (term);
+}
+
 static void
 grub_file_progress_hook_real (grub_disk_addr_t sector __attribute__ ((unused)),
                               unsigned offset __attribute__ ((unused)),
                               unsigned length, void *data)
 {
   static int call_depth = 0;
+  static grub_file_t last_file;
   grub_uint64_t now;
   static grub_uint64_t last_progress_update_time;
   grub_file_t file = data;
   file->progress_offset += length;
 
+  if (file->progress_offset < file->progress_check
+      && file->progress_offset != file->size)
+    return;
+
   if (call_depth)
     return;
 
   call_depth = 1;
   now = grub_get_time_ms ();
+  file->progress_check = file->progress_offset + check_step (file);
 
   if (((now - last_progress_update_time > UPDATE_INTERVAL) &&
        (file->progress_offset - file->offset > 0)) ||
       (file->progress_offset == file->size))
     {
-      static char buffer[80];
+      char buffer[GRUB_TERM_PROGRESS_WIDTH + 1];
+      char *ptr;
       struct grub_term_output *term;
       const char *partial_file_name;
+      grub_size_t len;
+      int redraw = 0;
 
       unsigned long long percent;
       grub_uint64_t current_speed;
@@ -87,18 +166,32 @@ grub_file_progress_hook_real (grub_disk_addr_t sector __attribute__ ((unused)),
 
       file->estimated_speed = (file->estimated_speed + current_speed) >> 1;
 
-      grub_snprintf (buffer, sizeof (buffer), "      [ %.20s  %s  %llu%%  ",
+      grub_snprintf (buffer, sizeof (buffer), "[ %.20s  %s  %llu%%  ",
                      partial_file_name,
                      grub_get_human_size (file->progress_offset,
                                           GRUB_HUMAN_SIZE_NORMAL),
                      (unsigned long long) percent);
 
-      char *ptr = buffer + grub_strlen (buffer);
+      ptr = buffer + grub_strlen (buffer);
       grub_snprintf (ptr, sizeof (buffer) - (ptr - buffer), "%s ]",
                      grub_get_human_size (file->estimated_speed,
                                           GRUB_HUMAN_SIZE_SPEED));
 
-      grub_size_t len = grub_strlen (buffer);
+      /* Right-align in a fixed width, so that the text stays in place and
+	 only what changed has to be drawn again.  */
+      len = grub_strlen (buffer);
+      grub_memmove (buffer + sizeof (buffer) - 1 - len, buffer, len + 1);
+      grub_memset (buffer, ' ', sizeof (buffer) - 1 - len);
+
+      /* Columns are counted in bytes, which only holds for ASCII; always
+	 draw the whole text otherwise, as well as for a new file.  */
+      for (ptr = buffer; *ptr; ptr++)
+	if (*ptr & 0x80)
+	  redraw = 1;
+      if (file != last_file)
+	redraw = 1;
+      last_file = file;
+
       FOR_ACTIVE_TERM_OUTPUTS (term)
         {
           if (term->progress_update_counter++ > term->progress_update_divisor
@@ -106,18 +199,8 @@ grub_file_progress_hook_real (grub_disk_addr_t sector __attribute__ ((unused)),
 		  && term->progress_update_divisor
 		  != (unsigned) GRUB_PROGRESS_NO_UPDATE))
             {
-              struct grub_term_coordinate old_pos = grub_term_getxy (term);
-              struct grub_term_coordinate new_pos = old_pos;
-              new_pos.x = grub_term_width (term) - len - 1;
-
-              grub_term_gotoxy (term, new_pos);
-	      grub_puts_terminal (buffer, term);
-              grub_term_gotoxy (term, old_pos);
-
+	      draw_progress (term, buffer, redraw);
               term->progress_update_counter = 0;
-
-	      if (term->refresh)
-		term->refresh (term);
             }
         }
 
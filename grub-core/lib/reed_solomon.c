@@ -86,7 +86,10 @@ static gf_single_t *const sy ATTRIBUTE_TEXT = (void *) 0x100d00;
 static gf_single_t *const mstat ATTRIBUTE_TEXT = (void *) 0x100e00;
 static gf_single_t *const errvals ATTRIBUTE_TEXT = (void *) 0x100f00;
 static gf_single_t *const eqstat ATTRIBUTE_TEXT = (void *) 0x101000;
-/* Next available address: (void *) 0x112000.  */
+static gf_single_t *const gf_mul_table ATTRIBUTE_TEXT = (void *) 0x112000;
+static gf_single_t *const parity ATTRIBUTE_TEXT = (void *) 0x122000;
+static gf_single_t *const rs_polynomial ATTRIBUTE_TEXT = (void *) 0x13b000;
+/* Next available address: (void *) 0x13b100.  */
 #else
 
 static gf_single_t gf_powx[255 * 2];
@@ -99,14 +102,22 @@ static gf_single_t sy[256];
 static gf_single_t mstat[256];
 static gf_single_t errvals[256];
 static gf_single_t eqstat[65536 + 256];
+static gf_single_t gf_mul_table[256 * 256];
+static gf_single_t parity[MAX_BLOCK_SIZE];
+static gf_single_t rs_polynomial[256];
 #endif
 
-static gf_single_t
+/* Row A of gf_mul_table holds the products of A with every element.  */
+static inline const gf_single_t *
+gf_mul_row (gf_single_t a)
+{
+  return gf_mul_table + ((int) a << GF_SIZE);
+}
+
+static inline gf_single_t
 gf_mul (gf_single_t a, gf_single_t b)
 {
-  if (a == 0 || b == 0)
-    return 0;
-  return gf_powx[(int) gf_powx_inv[a] + (int) gf_powx_inv[b]];
+  return gf_mul_row (a)[b];
 }
 
 static inline gf_single_t
@@ -132,6 +143,16 @@ init_powx (void)
       else
 	cur <<= 1;
     }
+
+  for (i = 0; i < 256; i++)
+    {
+      gf_single_t *row = gf_mul_table + (i << GF_SIZE);
+      int j;
+
+      row[0] = 0;
+      for (j = 1; j < 256; j++)
+	row[j] = i ? gf_powx[(int) gf_powx_inv[i] + (int) gf_powx_inv[j]] : 0;
+    }
 }
 
 static gf_single_t
@@ -151,31 +172,39 @@ pol_evaluate (gf_single_t *pol, grub_size_t degree, int log_x)
   return s;
 }
 
+/* Compute the generator polynomial of degree RS into POL, leading
+   coefficient first.  */
+static void
+rs_generator (gf_single_t *pol, grub_size_t rs)
+{
+  int i, j;
+
+  for (i = 0; i < (int) rs; i++)
+    pol[i] = 0;
+  pol[rs] = 1;
+  /* Multiply with X - a^r */
+  for (j = 0; j < (int) rs; j++)
+    {
+      for (i = 0; i < (int) rs; i++)
+	if (pol[i])
+	  pol[i] = pol[i + 1] ^ gf_powx[j + (int) gf_powx_inv[pol[i]]];
+	else
+	  pol[i] = pol[i + 1];
+      if (pol[rs])
+	pol[rs] = gf_powx[j + (int) gf_powx_inv[pol[rs]]];
+    }
+}
+
 #if !defined (STANDALONE)
 static void
 rs_encode (gf_single_t *data, grub_size_t s, grub_size_t rs)
 {
-  gf_single_t *rs_polynomial;
   int i, j;
   gf_single_t *m;
   m = xmalloc ((s + rs) * sizeof (gf_single_t));
   grub_memcpy (m, data, s * sizeof (gf_single_t));
   grub_memset (m + s, 0, rs * sizeof (gf_single_t));
-  rs_polynomial = xmalloc ((rs + 1) * sizeof (gf_single_t));
-  grub_memset (rs_polynomial, 0, (rs + 1) * sizeof (gf_single_t));
-  rs_polynomial[rs] = 1;
-  /* Multiply with X - a^r */
-  for (j = 0; j < rs; j++)
-    {
-      for (i = 0; i < rs; i++)
-	if (rs_polynomial[i])
-	  rs_polynomial[i] = (rs_polynomial[i + 1]
-			      ^ gf_powx[j + (int) gf_powx_inv[rs_polynomial[i]]]);
-	else
-	  rs_polynomial[i] = rs_polynomial[i + 1];
-      if (rs_polynomial[rs])
-	rs_polynomial[rs] = gf_powx[j + (int) gf_powx_inv[rs_polynomial[rs]]];
-    }
+  rs_generator (rs_polynomial, rs);
   for (j = 0; j < s; j++)
     if (m[j])
       {
@@ -183,7 +212,6 @@ rs_encode (gf_single_t *data, grub_size_t s, grub_size_t rs)
 	for (i = 0; i <= rs; i++)
 	  m[i+j] ^= gf_mul (rs_polynomial[i], f);
       }
-  free (rs_polynomial);
   grub_memcpy (data + s, m + s, rs * sizeof (gf_single_t));
   free (m);
 }
@@ -294,32 +322,102 @@ rs_recover (gf_single_t *mm, grub_size_t s, grub_size_t rs)
   }
 }
 
+/* Every byte column I of a block is a codeword of DS data and RS
+   redundancy bytes, one from each sector.  Re-encode the columns [I0, I1),
+   which share DS and RS, a sector at a time: row K of PARITY holds the
+   remainder byte K of every column, rotated by BASE rows.  Only columns
+   whose redundancy differs from the computed one go through the syndrome
+   decoder, so an undamaged image costs DS * RS table lookups per column
+   instead of (DS + RS) * RS.  */
 static void
-decode_block (gf_single_t *ptr, grub_size_t s,
-	      gf_single_t *rptr, grub_size_t rs)
+decode_columns (gf_single_t *ptr, gf_single_t *rptr, int i0, int i1,
+		grub_size_t ds, grub_size_t rs)
 {
-  int i, j;
-  for (i = 0; i < SECTOR_SIZE; i++)
+  int i, j, k, row, base = 0;
+
+  rs_generator (rs_polynomial, rs);
+
+  for (k = 0; k < (int) rs; k++)
+    for (i = i0; i < i1; i++)
+      parity[SECTOR_SIZE * k + i] = 0;
+
+  for (j = 0; j < (int) ds; j++)
     {
-      grub_size_t ds = (s + SECTOR_SIZE - 1 - i) / SECTOR_SIZE;
-      grub_size_t rr = (rs + SECTOR_SIZE - 1 - i) / SECTOR_SIZE;
+      gf_single_t *feedback = parity + SECTOR_SIZE * base;
+      const gf_single_t *mul;
 
-      /* Nothing to do.  */
-      if (!ds || !rr)
+      for (i = i0; i < i1; i++)
+	feedback[i] ^= ptr[SECTOR_SIZE * j + i];
+      for (k = 1, row = base + 1; k < (int) rs; k++, row++)
+	{
+	  gf_single_t *cur;
+
+	  if (row == (int) rs)
+	    row = 0;
+	  cur = parity + SECTOR_SIZE * row;
+	  mul = gf_mul_row (rs_polynomial[k]);
+	  for (i = i0; i < i1; i++)
+	    cur[i] ^= mul[feedback[i]];
+	}
+      mul = gf_mul_row (rs_polynomial[rs]);
+      for (i = i0; i < i1; i++)
+	feedback[i] = mul[feedback[i]];
+      if (++base == (int) rs)
+	base = 0;
+    }
+
+  for (i = i0; i < i1; i++)
+    {
+      for (k = 0, row = base; k < (int) rs; k++, row++)
+	{
+	  if (row == (int) rs)
+	    row = 0;
+	  if (parity[SECTOR_SIZE * row + i] != rptr[SECTOR_SIZE * k + i])
+	    break;
+	}
+
+      /* No error detected.  */
+      if (k == (int) rs)
 	continue;
 
       for (j = 0; j < (int) ds; j++)
 	mstat[j] = ptr[SECTOR_SIZE * j + i];
-      for (j = 0; j < (int) rr; j++)
+      for (j = 0; j < (int) rs; j++)
 	mstat[j + ds] = rptr[SECTOR_SIZE * j + i];
 
-      rs_recover (mstat, ds, rr);
+      rs_recover (mstat, ds, rs);
 
       for (j = 0; j < (int) ds; j++)
 	ptr[SECTOR_SIZE * j + i] = mstat[j];
     }
 }
 
+static void
+decode_block (gf_single_t *ptr, grub_size_t s,
+	      gf_single_t *rptr, grub_size_t rs)
+{
+  int i0, i1;
+
+  for (i0 = 0; i0 < SECTOR_SIZE; i0 = i1)
+    {
+      grub_size_t ds = (s + SECTOR_SIZE - 1 - i0) / SECTOR_SIZE;
+      grub_size_t rr = (rs + SECTOR_SIZE - 1 - i0) / SECTOR_SIZE;
+
+      /* Columns past the remainder of S or RS have one byte less.  */
+      i1 = SECTOR_SIZE;
+      if ((int) (s % SECTOR_SIZE) > i0)
+	i1 = s % SECTOR_SIZE;
+      if ((int) (rs % SECTOR_SIZE) > i0 && (int) (rs % SECTOR_SIZE) < i1)
+	i1 = rs % SECTOR_SIZE;
+
+      /* Nothing to do.  */
+      if (!ds || !rr)
+	continue;
+
+      decode_columns (ptr, rptr, i0, i1, ds, rr);
+    }
+}
+
 #if !defined (STANDALONE)
 static void
 encode_block (gf_single_t *ptr, grub_size_t s,
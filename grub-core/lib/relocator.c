@@ -24,12 +24,15 @@
 #include <grub/memory.h>
 #include <grub/dl.h>
 #include <grub/i18n.h>
+#include <grub/reclaim.h>
 
 GRUB_MOD_LICENSE ("GPLv3+");
 
 struct grub_relocator
 {
   struct grub_relocator_chunk *chunks;
+  /* The same chunks as a balanced tree ordered by target.  */
+  struct grub_relocator_chunk *targets;
   grub_phys_addr_t postchunks;
   grub_phys_addr_t highestaddr;
   grub_phys_addr_t highestnonpostaddr;
@@ -62,6 +65,11 @@ struct grub_relocator_chunk
   grub_size_t size;
   struct grub_relocator_subchunk *subchunks;
   unsigned nsubchunks;
+  /* Target tree links.  TARGET_END is the highest target + size in this
+     subtree.  */
+  struct grub_relocator_chunk *tleft, *tright;
+  grub_phys_addr_t target_end;
+  int theight;
 };
 
 struct grub_relocator_extra_block
@@ -116,13 +124,175 @@ grub_relocator_new (void)
   return ret;
 }
 
+#define max(a, b) (((a) > (b)) ? (a) : (b))
+#define min(a, b) (((a) < (b)) ? (a) : (b))
+
+/* Loaders placing many chunks would otherwise check each new one against
+   all the previous ones, so the targets are kept in an interval tree: an
+   AVL tree ordered by target, with every node knowing how far the
+   targets in its subtree reach.  */
+
+static inline int
+target_height (struct grub_relocator_chunk *chunk)
+{
+  return chunk ? chunk->theight : 0;
+}
+
+static void
+target_update (struct grub_relocator_chunk *chunk)
+{
+  chunk->theight = 1 + max (target_height (chunk->tleft),
+			    target_height (chunk->tright));
+  chunk->target_end = chunk->target + chunk->size;
+  if (chunk->tleft && chunk->tleft->target_end > chunk->target_end)
+    chunk->target_end = chunk->tleft->target_end;
+  if (chunk->tright && chunk->tright->target_end > chunk->target_end)
+    chunk->target_end = chunk->tright->target_end;
+}
+
+static struct grub_relocator_chunk *
+target_rotate (struct grub_relocator_chunk *chunk, int right)
+{
+  struct grub_relocator_chunk *pivot;
+
+  if (right)
+    {
+      pivot = chunk->tleft;
+      chunk->tleft = pivot->tright;
+      pivot->tright = chunk;
+    }
+  else
+    {
+      pivot = chunk->tright;
+      chunk->tright = pivot->tleft;
+      pivot->tleft = chunk;
+    }
+  target_update (chunk);
+  target_update (pivot);
+  return pivot;
+}
+
+static struct grub_relocator_chunk *
+target_insert (struct grub_relocator_chunk *root,
+	       struct grub_relocator_chunk *chunk)
+{
+  int balance;
+
+  if (!root)
+    {
+      chunk->tleft = chunk->tright = NULL;
+      target_update (chunk);
+      return chunk;
+    }
+
+  if (chunk->target < root->target)
+    root->tleft = target_insert (root->tleft, chunk);
+  else
+    root->tright = target_insert (root->tright, chunk);
+  target_update (root);
+
+  balance = target_height (root->tleft) - target_height (root->tright);
+  if (balance > 1)
+    {
+      if (target_height (root->tleft->tleft)
+	  < target_height (root->tleft->tright))
+	root->tleft = target_rotate (root->tleft, 0);
+      return target_rotate (root, 1);
+    }
+  if (balance < -1)
+    {
+      if (target_height (root->tright->tright)
+	  < target_height (root->tright->tleft))
+	root->tright = target_rotate (root->tright, 1);
+      return target_rotate (root, 0);
+    }
+  return root;
+}
+
+static inline int
+target_overlaps (struct grub_relocator_chunk *chunk,
+		 grub_phys_addr_t target, grub_size_t size)
+{
+  return ((chunk->target <= target && target < chunk->target + chunk->size)
+	  || (target <= chunk->target && chunk->target < target + size));
+}
+
+/* Find the lowest, or with HIGHEST the highest, chunk whose target
+   overlaps TARGET..TARGET+SIZE.  */
+static struct grub_relocator_chunk *
+target_find (struct grub_relocator_chunk *root,
+	     grub_phys_addr_t target, grub_size_t size, int highest)
+{
+  struct grub_relocator_chunk *found = NULL;
+  int right_may_overlap;
+
+  /* Nothing in here reaches TARGET.  */
+  if (!root || root->target_end < target)
+    return NULL;
+
+  /* Everything right of ROOT starts at or after it.  */
+  right_may_overlap = (root->target <= target || root->target < target + size);
+
+  if (highest && right_may_overlap)
+    found = target_find (root->tright, target, size, 1);
+  else if (!highest)
+    found = target_find (root->tleft, target, size, 0);
+  if (found)
+    return found;
+
+  if (target_overlaps (root, target, size))
+    return root;
+
+  if (highest)
+    return target_find (root->tleft, target, size, 1);
+  if (right_may_overlap)
+    return target_find (root->tright, target, size, 0);
+  return NULL;
+}
+
+/* Store collision events for the chunks whose targets reach into
+   START..END in EVENTS, or only count them if EVENTS is NULL.  The other
+   chunks cannot affect an allocation there.  */
+static unsigned
+target_collisions (struct grub_relocator_chunk *root,
+		   grub_phys_addr_t start, grub_phys_addr_t end,
+		   struct grub_relocator_mmap_event *events)
+{
+  unsigned n;
+
+  if (!root || root->target_end < start)
+    return 0;
+
+  n = target_collisions (root->tleft, start, end, events);
+  if (root->target > end)
+    return n;
+  if (root->target + root->size >= start)
+    {
+      if (events)
+	{
+	  events[n].type = COLLISION_START;
+	  events[n].pos = root->target;
+	  events[n + 1].type = COLLISION_END;
+	  events[n + 1].pos = root->target + root->size;
+	}
+      n += 2;
+    }
+  return n + target_collisions (root->tright, start, end,
+				events ? events + n : NULL);
+}
+
+static void
+add_chunk (struct grub_relocator *rel, struct grub_relocator_chunk *chunk)
+{
+  chunk->next = rel->chunks;
+  rel->chunks = chunk;
+  rel->targets = target_insert (rel->targets, chunk);
+}
+
 #define DIGITSORT_BITS 8
 #define DIGITSORT_MASK ((1 << DIGITSORT_BITS) - 1)
 #define BITS_IN_BYTE 8
 
-#define max(a, b) (((a) > (b)) ? (a) : (b))
-#define min(a, b) (((a) < (b)) ? (a) : (b))
-
 static inline int
 is_start (int type)
 {
@@ -413,10 +583,10 @@ free_subchunk (const struct grub_relocator_subchunk *subchu)
 }
 
 static int
-malloc_in_range (struct grub_relocator *rel,
-		 grub_addr_t start, grub_addr_t end, grub_addr_t align,
-		 grub_size_t size, struct grub_relocator_chunk *res,
-		 int from_low_priv, int collisioncheck)
+malloc_in_range_real (struct grub_relocator *rel,
+		      grub_addr_t start, grub_addr_t end, grub_addr_t align,
+		      grub_size_t size, struct grub_relocator_chunk *res,
+		      int from_low_priv, int collisioncheck)
 {
   grub_mm_region_t r, *ra, base_saved;
   struct grub_relocator_mmap_event *events = NULL, *eventt = NULL, *t;
@@ -439,6 +609,9 @@ malloc_in_range (struct grub_relocator *rel,
   if (end < start + size)
     return 0;
 
+  /* Let the scan see small blocks parked on the heap bins as free.  */
+  grub_mm_flush_bins ();
+
   /* We have to avoid any allocations when filling scanline events. 
      Hence 2-stages.
    */
@@ -458,11 +631,7 @@ malloc_in_range (struct grub_relocator *rel,
     }
 
   if (collisioncheck && rel)
-    {
-      struct grub_relocator_chunk *chunk;
-      for (chunk = rel->chunks; chunk; chunk = chunk->next)
-	maxevents += 2;
-    }
+    maxevents += target_collisions (rel->targets, start, end, NULL);
 
 #if GRUB_RELOCATOR_HAVE_FIRMWARE_REQUESTS
   {
@@ -509,18 +678,7 @@ malloc_in_range (struct grub_relocator *rel,
     }
 
   if (collisioncheck && rel)
-    {
-      struct grub_relocator_chunk *chunk;
-      for (chunk = rel->chunks; chunk; chunk = chunk->next)
-	{
-	  events[N].type = COLLISION_START;
-	  events[N].pos = chunk->target;
-	  N++;
-	  events[N].type = COLLISION_END;
-	  events[N].pos = chunk->target + chunk->size;
-	  N++;
-	}
-    }
+    N += target_collisions (rel->targets, start, end, events + N);
 
 #if GRUB_RELOCATOR_HAVE_FIRMWARE_REQUESTS
   for (r = grub_mm_base; r; r = r->next)
@@ -541,6 +699,8 @@ malloc_in_range (struct grub_relocator *rel,
     struct grub_relocator_extra_block *cur;
     for (cur = extra_blocks; cur; cur = cur->next)
       {
+	if (cur->end < start || cur->start > end)
+	  continue;
 #ifdef DEBUG_RELOCATOR_NOMEM_DPRINTF
 	grub_dprintf ("relocator", "Blocking at 0x%lx-0x%lx\n",
 		      (unsigned long) cur->start, (unsigned long) cur->end);
@@ -592,6 +752,8 @@ malloc_in_range (struct grub_relocator *rel,
 
   for (ra = &base_saved, r = *ra; r; ra = &(r->next), r = *ra)
     {
+      int regbeg, wanted;
+
       pa = r->first;
       p = pa->next;
       if (p->magic == GRUB_MM_ALLOC_MAGIC)
@@ -602,7 +764,12 @@ malloc_in_range (struct grub_relocator *rel,
 	    grub_fatal ("%s:%d free magic broken at %p (0x%x)\n",
 			__FILE__,
 			__LINE__, p, p->magic);
-	  if (p == (grub_mm_header_t) (r + 1))
+	  regbeg = (p == (grub_mm_header_t) (r + 1));
+	  /* Only blocks reaching into the range matter.  */
+	  wanted = (grub_vtop (p + p->size) >= start
+		    && (regbeg ? grub_vtop (r) - r->pre_size
+			: grub_vtop (p)) <= end);
+	  if (wanted && regbeg)
 	    {
 	      events[N].type = REG_BEG_START;
 	      events[N].pos = grub_vtop (r) - r->pre_size;
@@ -616,7 +783,7 @@ malloc_in_range (struct grub_relocator *rel,
 		- sizeof (struct grub_mm_header);
 	      N++;
 	    }
-	  else
+	  else if (wanted)
 	    {
 	      events[N].type = IN_REG_START;
 	      events[N].pos = grub_vtop (p);
@@ -649,9 +816,17 @@ malloc_in_range (struct grub_relocator *rel,
 
   {
     unsigned i;
+    grub_addr_t differ = 0;
+
+    /* Skip the digits all positions share, usually the high ones.  */
+    for (j = 1; j < N; j++)
+      differ |= events[j].pos ^ events[0].pos;
+
     for (i = 0; i < (BITS_IN_BYTE * sizeof (grub_addr_t) / DIGITSORT_BITS);
 	 i++)
       {
+	if (!((differ >> (DIGITSORT_BITS * i)) & DIGITSORT_MASK))
+	  continue;
 	grub_memset (counter, 0, (1 + (1 << DIGITSORT_BITS)) * sizeof (counter[0]));
 	for (j = 0; j < N; j++)
 	  counter[((events[j].pos >> (DIGITSORT_BITS * i)) 
@@ -1190,6 +1365,24 @@ malloc_in_range (struct grub_relocator *rel,
   return 1;
 }
 
+/* The events are counted from the heap before they are allocated, so the
+   caches mustn't give memory back to the heap in between.  */
+static int
+malloc_in_range (struct grub_relocator *rel,
+		 grub_addr_t start, grub_addr_t end, grub_addr_t align,
+		 grub_size_t size, struct grub_relocator_chunk *res,
+		 int from_low_priv, int collisioncheck)
+{
+  int ret;
+
+  grub_reclaim_hold ();
+  ret = malloc_in_range_real (rel, start, end, align, size, res,
+			      from_low_priv, collisioncheck);
+  grub_reclaim_release ();
+
+  return ret;
+}
+
 static void
 adjust_limits (struct grub_relocator *rel, 
 	       grub_phys_addr_t *min_addr, grub_phys_addr_t *max_addr,
@@ -1220,16 +1413,15 @@ grub_relocator_alloc_chunk_addr (struct grub_relocator *rel,
 {
   struct grub_relocator_chunk *chunk;
   grub_phys_addr_t min_addr = 0, max_addr;
+  int reclaimed;
 
   if (target > ~size)
     return grub_error (GRUB_ERR_BUG, "address is out of range");
 
   adjust_limits (rel, &min_addr, &max_addr, target, target);
 
-  for (chunk = rel->chunks; chunk; chunk = chunk->next)
-    if ((chunk->target <= target && target < chunk->target + chunk->size)
-	|| (target <= chunk->target && chunk->target < target + size))
-      return grub_error (GRUB_ERR_BUG, "overlap detected");
+  if (target_find (rel->targets, target, size, 0))
+    return grub_error (GRUB_ERR_BUG, "overlap detected");
 
   chunk = grub_malloc (sizeof (struct grub_relocator_chunk));
   if (!chunk)
@@ -1240,7 +1432,9 @@ grub_relocator_alloc_chunk_addr (struct grub_relocator *rel,
 		(unsigned long long) min_addr, (unsigned long long) max_addr,
 		(unsigned long long) target);
 
-  do
+  /* The heap is one of the places chunks come from, so failing that,
+     have the caches give back what they can and try once more.  */
+  for (reclaimed = 0; ; reclaimed = 1)
     {
       /* A trick to improve Linux allocation.  */
 #if defined (__i386__) || defined (__x86_64__)
@@ -1267,11 +1461,13 @@ grub_relocator_alloc_chunk_addr (struct grub_relocator *rel,
 	  break;
 	}
 
+      if (!reclaimed && grub_reclaim_memory (GRUB_RECLAIM_ALL))
+	continue;
+
       grub_dprintf ("relocator", "not allocated\n");
       grub_free (chunk);
       return grub_error (GRUB_ERR_OUT_OF_MEMORY, N_("out of memory"));
     }
-  while (0);
 
   grub_dprintf ("relocator", "allocated 0x%llx/0x%llx\n",
 		(unsigned long long) chunk->src, (unsigned long long) target);
@@ -1304,8 +1500,7 @@ grub_relocator_alloc_chunk_addr (struct grub_relocator *rel,
 
   chunk->target = target;
   chunk->size = size;
-  chunk->next = rel->chunks;
-  rel->chunks = chunk;
+  add_chunk (rel, chunk);
   grub_dprintf ("relocator", "cur = %p, next = %p\n", rel->chunks,
 		rel->chunks->next);
 
@@ -1375,6 +1570,7 @@ grub_relocator_alloc_chunk_align (struct grub_relocator *rel,
     .found = 0
   };
   grub_addr_t min_addr2 = 0, max_addr2;
+  int reclaimed;
 
   if (max_addr > ~size)
     max_addr = ~size;
@@ -1400,8 +1596,7 @@ grub_relocator_alloc_chunk_align (struct grub_relocator *rel,
       grub_dprintf ("relocator", "chunks = %p\n", rel->chunks);
       ctx.chunk->target = ctx.chunk->src;
       ctx.chunk->size = size;
-      ctx.chunk->next = rel->chunks;
-      rel->chunks = ctx.chunk;
+      add_chunk (rel, ctx.chunk);
       ctx.chunk->srcv = grub_map_memory (ctx.chunk->src, ctx.chunk->size);
       *out = ctx.chunk;
       return GRUB_ERR_NONE;
@@ -1412,7 +1607,7 @@ grub_relocator_alloc_chunk_align (struct grub_relocator *rel,
 		(unsigned long) min_addr, (unsigned long) max_addr,
 		(unsigned long) min_addr2, (unsigned long) max_addr2);
 
-  do
+  for (reclaimed = 0; ; reclaimed = 1)
     {
       if (malloc_in_range (rel, min_addr2, max_addr2, align,
 			   size, ctx.chunk, 1, 1))
@@ -1426,9 +1621,12 @@ grub_relocator_alloc_chunk_align (struct grub_relocator *rel,
 	  break;
 	}
 
+      /* As in grub_relocator_alloc_chunk_addr.  */
+      if (!reclaimed && grub_reclaim_memory (GRUB_RECLAIM_ALL))
+	continue;
+
       return grub_error (GRUB_ERR_OUT_OF_MEMORY, N_("out of memory"));
     }
-  while (0);
 
   {
 #ifdef GRUB_MACHINE_EFI
@@ -1447,21 +1645,22 @@ grub_relocator_alloc_chunk_align (struct grub_relocator *rel,
   while (1)
     {
       struct grub_relocator_chunk *chunk2;
-      for (chunk2 = rel->chunks; chunk2; chunk2 = chunk2->next)
-	if ((chunk2->target <= ctx.chunk->target
-	     && ctx.chunk->target < chunk2->target + chunk2->size)
-	    || (ctx.chunk->target <= chunk2->target && chunk2->target
-		< ctx.chunk->target + size))
-	  {
-	    if (preference == GRUB_RELOCATOR_PREFERENCE_HIGH)
-	      ctx.chunk->target = ALIGN_DOWN (chunk2->target, align);
-	    else
-	      ctx.chunk->target = ALIGN_UP (chunk2->target + chunk2->size,
-					    align);
-	    break;
-	  }
+
+      /* Step past the nearest chunk in the way.  */
+      chunk2 = target_find (rel->targets, ctx.chunk->target, size,
+			    preference == GRUB_RELOCATOR_PREFERENCE_HIGH);
       if (!chunk2)
 	break;
+      if (preference == GRUB_RELOCATOR_PREFERENCE_HIGH)
+	{
+	  if (chunk2->target < size)
+	    return grub_error (GRUB_ERR_BAD_OS,
+			       "couldn't find suitable memory target");
+	  ctx.chunk->target = ALIGN_DOWN (chunk2->target - size, align);
+	}
+      else
+	ctx.chunk->target = ALIGN_UP (chunk2->target + chunk2->size,
+				      align);
     }
 
   grub_dprintf ("relocator", "relocators_size=%ld\n",
@@ -1476,8 +1675,7 @@ grub_relocator_alloc_chunk_align (struct grub_relocator *rel,
 		(unsigned long) rel->relocators_size);
 
   ctx.chunk->size = size;
-  ctx.chunk->next = rel->chunks;
-  rel->chunks = ctx.chunk;
+  add_chunk (rel, ctx.chunk);
   grub_dprintf ("relocator", "cur = %p, next = %p\n", rel->chunks,
 		rel->chunks->next);
   ctx.chunk->srcv = grub_map_memory (ctx.chunk->src, ctx.chunk->size);
@@ -0,0 +1,70 @@
+/* aesni.c - AES key schedule for the AES-NI instructions.  */
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2026  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <grub/types.h>
+#include <grub/misc.h>
+#include <grub/i386/cpuid.h>
+#include <grub/x86_64/aesni.h>
+
+/* CPUID.1:ECX.AES  */
+#define CPUID_AES (1 << 25)
+
+int
+grub_aesni_is_supported (void)
+{
+  static int supported = -1;
+
+  if (supported < 0)
+    {
+      grub_uint32_t eax, ebx, ecx, edx;
+
+      grub_cpuid (1, eax, ebx, ecx, edx);
+      supported = !!(ecx & CPUID_AES);
+    }
+  return supported;
+}
+
+/* FIPS-197 key expansion.  Words are kept in memory order, so the
+   schedule is directly usable as AES-NI round keys.  */
+void
+grub_aesni_set_key (struct grub_aesni_key *key, const grub_uint8_t *k,
+		    grub_size_t keylen)
+{
+  unsigned nk = keylen / 4, i;
+  grub_uint32_t *w = (grub_uint32_t *) key->enc;
+  grub_uint8_t rcon = 1;
+
+  key->rounds = nk + 6;
+  grub_memcpy (w, k, keylen);
+  for (i = nk; i < 4 * (key->rounds + 1); i++)
+    {
+      grub_uint32_t t = w[i - 1];
+
+      if (i % nk == 0)
+	{
+	  /* RotWord, then SubWord and Rcon on the first byte.  */
+	  t = grub_aesni_sub_word ((t >> 8) | (t << 24)) ^ rcon;
+	  rcon = (rcon << 1) ^ ((rcon & 0x80) ? 0x1b : 0);
+	}
+      else if (nk > 6 && i % nk == 4)
+	t = grub_aesni_sub_word (t);
+      w[i] = w[i - nk] ^ t;
+    }
+  grub_aesni_invert_key (key->dec, key->enc, key->rounds);
+}
@@ -0,0 +1,169 @@
+/* sha256_ni.c - SHA-256 using the x86 SHA extensions.  */
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2026  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <grub/types.h>
+#include <grub/misc.h>
+#include <grub/dl.h>
+#include <grub/crypto.h>
+#include <grub/i386/cpuid.h>
+
+GRUB_MOD_LICENSE ("GPLv3+");
+
+/* CPUID.1:ECX.SSSE3, CPUID.1:ECX.SSE4_1 and CPUID.7:EBX.SHA  */
+#define CPUID_SSSE3 (1 << 9)
+#define CPUID_SSE4_1 (1 << 19)
+#define CPUID_SHA (1 << 29)
+
+/* Implemented in sha256_ni_asm.S.  */
+void grub_sha256_ni_transform (grub_uint32_t *state, const void *data,
+			       grub_size_t nblocks);
+
+struct sha256_ni_context
+{
+  grub_uint32_t state[8];
+  grub_uint64_t count;
+  grub_uint8_t buf[64];
+  grub_uint8_t digest[32];
+};
+
+static unsigned char asn256[19] = /* Object ID is  2.16.840.1.101.3.4.2.1 */
+  { 0x30, 0x31, 0x30, 0x0d, 0x06, 0x09, 0x60, 0x86,
+    0x48, 0x01, 0x65, 0x03, 0x04, 0x02, 0x01, 0x05,
+    0x00, 0x04, 0x20 };
+
+static void
+sha256_ni_init (void *context)
+{
+  struct sha256_ni_context *ctx = context;
+  static const grub_uint32_t iv[8] =
+    {
+      0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+      0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+    };
+
+  grub_memcpy (ctx->state, iv, sizeof (iv));
+  ctx->count = 0;
+}
+
+static void
+sha256_ni_write (void *context, const void *data, grub_size_t len)
+{
+  struct sha256_ni_context *ctx = context;
+  const grub_uint8_t *p = data;
+  unsigned used = ctx->count % sizeof (ctx->buf);
+
+  ctx->count += len;
+  if (used)
+    {
+      unsigned n = sizeof (ctx->buf) - used;
+
+      if (len < n)
+	{
+	  grub_memcpy (ctx->buf + used, p, len);
+	  return;
+	}
+      grub_memcpy (ctx->buf + used, p, n);
+      grub_sha256_ni_transform (ctx->state, ctx->buf, 1);
+      p += n;
+      len -= n;
+    }
+  /* Whole blocks straight from the caller's buffer.  */
+  if (len >= sizeof (ctx->buf))
+    {
+      grub_sha256_ni_transform (ctx->state, p, len / sizeof (ctx->buf));
+      p += len & ~(sizeof (ctx->buf) - 1);
+      len &= sizeof (ctx->buf) - 1;
+    }
+  grub_memcpy (ctx->buf, p, len);
+}
+
+static void
+sha256_ni_final (void *context)
+{
+  struct sha256_ni_context *ctx = context;
+  grub_uint64_t bits = grub_cpu_to_be64 (ctx->count << 3);
+  unsigned used = ctx->count % sizeof (ctx->buf);
+  unsigned i;
+
+  ctx->buf[used++] = 0x80;
+  if (used > sizeof (ctx->buf) - sizeof (bits))
+    {
+      grub_memset (ctx->buf + used, 0, sizeof (ctx->buf) - used);
+      grub_sha256_ni_transform (ctx->state, ctx->buf, 1);
+      used = 0;
+    }
+  grub_memset (ctx->buf + used, 0, sizeof (ctx->buf) - sizeof (bits) - used);
+  grub_memcpy (ctx->buf + sizeof (ctx->buf) - sizeof (bits), &bits,
+	       sizeof (bits));
+  grub_sha256_ni_transform (ctx->state, ctx->buf, 1);
+
+  for (i = 0; i < ARRAY_SIZE (ctx->state); i++)
+    {
+      grub_uint32_t w = grub_cpu_to_be32 (ctx->state[i]);
+      grub_memcpy (ctx->digest + 4 * i, &w, sizeof (w));
+    }
+}
+
+static grub_uint8_t *
+sha256_ni_read (void *context)
+{
+  return ((struct sha256_ni_context *) context)->digest;
+}
+
+static gcry_md_spec_t sha256_ni_spec =
+  {
+    "SHA256", asn256, ARRAY_SIZE (asn256), 0, 32,
+    sha256_ni_init, sha256_ni_write, sha256_ni_final, sha256_ni_read,
+    sizeof (struct sha256_ni_context),
+    .blocksize = 64,
+    .priority = GRUB_MD_PRIORITY_HW
+  };
+
+static int
+sha256_ni_supported (void)
+{
+  grub_uint32_t max, eax, ebx, ecx, edx;
+
+  grub_cpuid (0, max, ebx, ecx, edx);
+  if (max < 7)
+    return 0;
+  grub_cpuid (1, eax, ebx, ecx, edx);
+  if (!(ecx & CPUID_SSSE3) || !(ecx & CPUID_SSE4_1))
+    return 0;
+  /* Leaf 7 has subleaves; grub_cpuid leaves %ecx unset.  */
+  asm volatile ("cpuid"
+		: "=a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx)
+		: "0" (7), "2" (0));
+  return !!(ebx & CPUID_SHA);
+}
+
+static int registered;
+
+GRUB_MOD_INIT(sha256_ni)
+{
+  registered = sha256_ni_supported ();
+  if (registered)
+    grub_md_register (&sha256_ni_spec);
+}
+
+GRUB_MOD_FINI(sha256_ni)
+{
+  if (registered)
+    grub_md_unregister (&sha256_ni_spec);
+}
@@ -43,6 +43,7 @@ extern grub_xen_reg_t grub_relocator_xen_remapper_virt2;
 extern grub_xen_reg_t grub_relocator_xen_remapper_map;
 extern grub_xen_reg_t grub_relocator_xen_mfn_list;
 extern grub_xen_reg_t grub_relocator_xen_remap_continue;
+extern grub_xen_reg_t grub_relocator_xen_multicall_list;
 #ifdef __i386__
 extern grub_xen_reg_t grub_relocator_xen_mmu_op_addr;
 extern grub_xen_reg_t grub_relocator_xen_remapper_map_high;
@@ -61,7 +62,7 @@ grub_relocator_xen_boot (struct grub_relocator *rel,
 {
   grub_err_t err;
   void *relst;
-  grub_relocator_chunk_t ch, ch_tramp;
+  grub_relocator_chunk_t ch, ch_tramp, ch_multicall;
   grub_xen_mfn_t *mfn_list =
     (grub_xen_mfn_t *) grub_xen_start_page_addr->mfn_list;
 
@@ -74,6 +75,18 @@ grub_relocator_xen_boot (struct grub_relocator *rel,
   if (err)
     return err;
 
+  /* The remapper queues the page table mappings in the page after its own
+     and hands them to the hypervisor in batches, rather than making one
+     hypercall per page.  It still runs on the current page tables, which
+     map every page at its pseudo-physical address.  */
+  if (remapper_pfn + 1 >= grub_xen_start_page_addr->nr_pages)
+    return grub_error (GRUB_ERR_OUT_OF_MEMORY, "no page left for the remapper");
+  err = grub_relocator_alloc_chunk_addr (rel, &ch_multicall,
+					 (remapper_pfn + 1) << 12, 4096);
+  if (err)
+    return err;
+  grub_relocator_xen_multicall_list = (remapper_pfn + 1) << 12;
+
   grub_relocator_xen_stack = state.stack;
   grub_relocator_xen_start_info = state.start_info;
   grub_relocator_xen_entry_point = state.entry_point;
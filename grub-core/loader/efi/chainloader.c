@@ -21,6 +21,7 @@
 
 #include <grub/loader.h>
 #include <grub/file.h>
+#include <grub/fs.h>
 #include <grub/err.h>
 #include <grub/device.h>
 #include <grub/disk.h>
@@ -57,7 +58,8 @@ grub_chainloader_unload (void)
 
   b = grub_efi_system_table->boot_services;
   efi_call_1 (b->unload_image, image_handle);
-  efi_call_2 (b->free_pages, address, pages);
+  if (address)
+    efi_call_2 (b->free_pages, address, pages);
 
   grub_free (file_path);
   grub_free (cmdline);
@@ -187,6 +189,29 @@ make_file_path (grub_efi_device_path_t *dp, const char *filename)
   return file_path;
 }
 
+/* Whether the firmware can read FILE itself through FILE_PATH: it has to
+   be on the partition DEV_HANDLE stands for, through a file system the
+   firmware also drives, and with no filter in between that would make
+   its bytes differ from what GRUB sees.  */
+static int
+firmware_can_read (grub_file_t file, grub_efi_handle_t dev_handle)
+{
+  grub_efi_guid_t sfs_guid = GRUB_EFI_SIMPLE_FILE_SYSTEM_PROTOCOL_GUID;
+  grub_fs_t fs;
+
+  if (! file->device || ! file->device->disk
+      || grub_efidisk_get_device_handle (file->device->disk) != dev_handle)
+    return 0;
+
+  fs = grub_fs_probe (file->device);
+  grub_errno = GRUB_ERR_NONE;
+  if (! fs || file->fs != fs)
+    return 0;
+
+  return grub_efi_open_protocol (dev_handle, &sfs_guid,
+				 GRUB_EFI_OPEN_PROTOCOL_GET_PROTOCOL) != 0;
+}
+
 static grub_err_t
 grub_cmd_chainloader (grub_command_t cmd __attribute__ ((unused)),
 		      int argc, char *argv[])
@@ -267,6 +292,20 @@ grub_cmd_chainloader (grub_command_t cmd __attribute__ ((unused)),
 		  filename);
       goto fail;
     }
+
+  /* Let the firmware load the image straight from the disk if it can,
+     rather than bringing it in through GRUB and handing over a copy.  */
+  if (firmware_can_read (file, dev_handle))
+    {
+      status = efi_call_6 (b->load_image, 0, grub_efi_image_handle,
+			   file_path, 0, 0, &image_handle);
+      if (status == GRUB_EFI_SUCCESS)
+	goto loaded;
+      grub_dprintf ("chain", "firmware could not load %s: %lx\n",
+		    filename, (unsigned long) status);
+      image_handle = 0;
+    }
+
   pages = (((grub_efi_uintn_t) size + ((1 << 12) - 1)) >> 12);
 
   status = efi_call_4 (b->allocate_pages, GRUB_EFI_ALLOCATE_ANY_PAGES,
@@ -339,6 +378,7 @@ grub_cmd_chainloader (grub_command_t cmd __attribute__ ((unused)),
       goto fail;
     }
 
+ loaded:
   /* LoadImage does not set a device handler when the image is
      loaded from memory, so it is necessary to set it explicitly here.
      This is a mess.  */
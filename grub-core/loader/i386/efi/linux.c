@@ -35,6 +35,9 @@ GRUB_MOD_LICENSE ("GPLv3+");
 static grub_dl_t my_mod;
 static int loaded;
 static void *kernel_mem;
+/* The pages holding the kernel, which start with the setup code ahead of
+   KERNEL_MEM.  */
+static void *kernel_alloc;
 static grub_uint64_t kernel_size;
 static grub_uint8_t *initrd_mem;
 static grub_uint32_t handover_offset;
@@ -104,8 +107,8 @@ grub_linuxefi_unload (void)
     grub_efi_free_pages((grub_efi_physical_address_t)initrd_mem, BYTES_TO_PAGES(params->ramdisk_size));
   if (linux_cmdline)
     grub_efi_free_pages((grub_efi_physical_address_t)linux_cmdline, BYTES_TO_PAGES(params->cmdline_size + 1));
-  if (kernel_mem)
-    grub_efi_free_pages((grub_efi_physical_address_t)kernel_mem, BYTES_TO_PAGES(kernel_size));
+  if (kernel_alloc)
+    grub_efi_free_pages((grub_efi_physical_address_t)kernel_alloc, BYTES_TO_PAGES(kernel_size));
   if (params)
     grub_efi_free_pages((grub_efi_physical_address_t)params, BYTES_TO_PAGES(16384));
   return GRUB_ERR_NONE;
@@ -116,6 +119,8 @@ grub_cmd_initrd (grub_command_t cmd __attribute__ ((unused)),
                  int argc, char *argv[])
 {
   grub_file_t *files = 0;
+  grub_file_t file;
+  int *measured = 0;
   int i, nfiles = 0;
   grub_size_t size = 0;
   grub_uint8_t *ptr;
@@ -133,15 +138,24 @@ grub_cmd_initrd (grub_command_t cmd __attribute__ ((unused)),
     }
 
   files = grub_zalloc (argc * sizeof (files[0]));
-  if (!files)
+  measured = grub_zalloc (argc * sizeof (measured[0]));
+  if (!files || !measured)
     goto fail;
 
   for (i = 0; i < argc; i++)
     {
       grub_file_filter_disable_compression ();
-      files[i] = grub_file_open (argv[i]);
-      if (! files[i])
+      file = grub_file_open (argv[i]);
+      if (! file)
         goto fail;
+      files[i] = grub_tpm_measure_open (file, GRUB_BINARY_PCR,
+                                        "grub_linuxefi", "Initrd");
+      if (! files[i])
+        {
+          grub_file_close (file);
+          goto fail;
+        }
+      measured[i] = (files[i] != file);
       nfiles++;
       size += ALIGN_UP (grub_file_size (files[i]), 4);
     }
@@ -169,7 +183,8 @@ grub_cmd_initrd (grub_command_t cmd __attribute__ ((unused)),
                         argv[i]);
           goto fail;
         }
-      grub_tpm_measure (ptr, cursize, GRUB_BINARY_PCR, "grub_linuxefi", "Initrd");
+      if (!measured[i])
+        grub_tpm_measure (ptr, cursize, GRUB_BINARY_PCR, "grub_linuxefi", "Initrd");
       ptr += cursize;
       grub_memset (ptr, 0, ALIGN_UP_OVERHEAD (cursize, 4));
       ptr += ALIGN_UP_OVERHEAD (cursize, 4);
@@ -181,6 +196,7 @@ grub_cmd_initrd (grub_command_t cmd __attribute__ ((unused)),
   for (i = 0; i < nfiles; i++)
     grub_file_close (files[i]);
   grub_free (files);
+  grub_free (measured);
 
   if (initrd_mem && grub_errno)
     grub_efi_free_pages((grub_efi_physical_address_t)initrd_mem, BYTES_TO_PAGES(size));
@@ -195,7 +211,8 @@ grub_cmd_linux (grub_command_t cmd __attribute__ ((unused)),
   grub_file_t file = 0;
   struct linux_kernel_header lh;
   grub_ssize_t len, start, filelen;
-  void *kernel = NULL;
+  grub_size_t head;
+  grub_uint8_t *image;
 
   grub_dl_ref (my_mod);
 
@@ -211,65 +228,97 @@ grub_cmd_linux (grub_command_t cmd __attribute__ ((unused)),
 
   filelen = grub_file_size (file);
 
-  kernel = grub_malloc(filelen);
-
-  if (!kernel)
+  /* The setup header is all that is needed to place the kernel.  */
+  if (grub_file_read (file, &lh, sizeof (lh)) != sizeof (lh))
     {
-      grub_error (GRUB_ERR_OUT_OF_MEMORY, N_("cannot allocate kernel buffer"));
+      if (!grub_errno)
+	grub_error (GRUB_ERR_BAD_OS, N_("premature end of file %s"),
+		    argv[0]);
       goto fail;
     }
 
-  if (grub_file_read (file, kernel, filelen) != filelen)
+  if (lh.boot_flag != grub_cpu_to_le16 (0xaa55))
     {
-      grub_error (GRUB_ERR_FILE_READ_ERROR, N_("Can't read kernel %s"), argv[0]);
+      grub_error (GRUB_ERR_BAD_OS, N_("invalid magic number"));
       goto fail;
     }
 
-  grub_tpm_measure (kernel, filelen, GRUB_BINARY_PCR, "grub_linuxefi", "Kernel");
+  if (lh.setup_sects > GRUB_LINUX_MAX_SETUP_SECTS)
+    {
+      grub_error (GRUB_ERR_BAD_OS, N_("too many setup sectors"));
+      goto fail;
+    }
 
-  if (! grub_linuxefi_secure_validate (kernel, filelen))
+  if (lh.version < grub_cpu_to_le16 (0x020b))
     {
-      grub_error (GRUB_ERR_INVALID_COMMAND, N_("%s has invalid signature"), argv[0]);
-      grub_free (kernel);
+      grub_error (GRUB_ERR_BAD_OS, N_("kernel too old"));
       goto fail;
     }
 
-  params = grub_efi_allocate_pages_max (0x3fffffff, BYTES_TO_PAGES(16384));
+  if (!lh.handover_offset)
+    {
+      grub_error (GRUB_ERR_BAD_OS, N_("kernel doesn't support EFI handover"));
+      goto fail;
+    }
 
-  if (! params)
+  start = (lh.setup_sects + 1) * 512;
+  len = filelen - start;
+  if (len <= 0)
     {
-      grub_error (GRUB_ERR_OUT_OF_MEMORY, "cannot allocate kernel parameters");
+      grub_error (GRUB_ERR_BAD_OS, N_("premature end of file %s"), argv[0]);
       goto fail;
     }
 
-  grub_memset (params, 0, 16384);
+  /* Read the whole file into the pages the kernel runs from, with the
+     setup code in front so that the rest starts on a page boundary, at
+     the preferred address if it is free.  The file stays in one piece
+     for the signature check and the measurement.  */
+  head = ALIGN_UP (start, 4096);
+  kernel_size = head + (lh.init_size > len ? lh.init_size : len);
 
-  grub_memcpy (&lh, kernel, sizeof (lh));
+  kernel_alloc = 0;
+  if (lh.pref_address >= head)
+    kernel_alloc = grub_efi_allocate_pages(lh.pref_address - head,
+					   BYTES_TO_PAGES(kernel_size));
 
-  if (lh.boot_flag != grub_cpu_to_le16 (0xaa55))
+  if (!kernel_alloc)
+    kernel_alloc = grub_efi_allocate_pages_max(0x3fffffff,
+					       BYTES_TO_PAGES(kernel_size));
+
+  if (!kernel_alloc)
     {
-      grub_error (GRUB_ERR_BAD_OS, N_("invalid magic number"));
+      grub_error (GRUB_ERR_OUT_OF_MEMORY, N_("can't allocate kernel"));
       goto fail;
     }
 
-  if (lh.setup_sects > GRUB_LINUX_MAX_SETUP_SECTS)
+  kernel_mem = (grub_uint8_t *) kernel_alloc + head;
+  image = (grub_uint8_t *) kernel_mem - start;
+
+  grub_file_seek (file, 0);
+  if (grub_file_read_direct (file, image, filelen) != filelen)
     {
-      grub_error (GRUB_ERR_BAD_OS, N_("too many setup sectors"));
+      grub_error (GRUB_ERR_FILE_READ_ERROR, N_("Can't read kernel %s"), argv[0]);
       goto fail;
     }
 
-  if (lh.version < grub_cpu_to_le16 (0x020b))
+  grub_tpm_measure (image, filelen, GRUB_BINARY_PCR, "grub_linuxefi", "Kernel");
+
+  if (! grub_linuxefi_secure_validate (image, filelen))
     {
-      grub_error (GRUB_ERR_BAD_OS, N_("kernel too old"));
+      grub_error (GRUB_ERR_INVALID_COMMAND, N_("%s has invalid signature"), argv[0]);
       goto fail;
     }
 
-  if (!lh.handover_offset)
+  params = grub_efi_allocate_pages_max (0x3fffffff, BYTES_TO_PAGES(16384));
+
+  if (! params)
     {
-      grub_error (GRUB_ERR_BAD_OS, N_("kernel doesn't support EFI handover"));
+      grub_error (GRUB_ERR_OUT_OF_MEMORY, "cannot allocate kernel parameters");
       goto fail;
     }
 
+  grub_memset (params, 0, 16384);
+
   linux_cmdline = grub_efi_allocate_pages_max(0x3fffffff,
 					 BYTES_TO_PAGES(lh.cmdline_size + 1));
 
@@ -289,23 +338,6 @@ grub_cmd_linux (grub_command_t cmd __attribute__ ((unused)),
 
   handover_offset = lh.handover_offset;
 
-  start = (lh.setup_sects + 1) * 512;
-  len = grub_file_size(file) - start;
-
-  kernel_mem = grub_efi_allocate_pages(lh.pref_address,
-				       BYTES_TO_PAGES(lh.init_size));
-
-  if (!kernel_mem)
-    kernel_mem = grub_efi_allocate_pages_max(0x3fffffff,
-					     BYTES_TO_PAGES(lh.init_size));
-
-  if (!kernel_mem)
-    {
-      grub_error (GRUB_ERR_OUT_OF_MEMORY, N_("can't allocate kernel"));
-      goto fail;
-    }
-
-  grub_memcpy (kernel_mem, (char *)kernel + start, len);
   grub_loader_set (grub_linuxefi_boot, grub_linuxefi_unload, 0);
   loaded=1;
 
@@ -319,8 +351,6 @@ grub_cmd_linux (grub_command_t cmd __attribute__ ((unused)),
   if (file)
     grub_file_close (file);
 
-  grub_free (kernel);
-
   if (grub_errno != GRUB_ERR_NONE)
     {
       grub_dl_unref (my_mod);
@@ -330,8 +360,11 @@ grub_cmd_linux (grub_command_t cmd __attribute__ ((unused)),
   if (linux_cmdline && !loaded)
     grub_efi_free_pages((grub_efi_physical_address_t)linux_cmdline, BYTES_TO_PAGES(lh.cmdline_size + 1));
 
-  if (kernel_mem && !loaded)
-    grub_efi_free_pages((grub_efi_physical_address_t)kernel_mem, BYTES_TO_PAGES(kernel_size));
+  if (kernel_alloc && !loaded)
+    {
+      grub_efi_free_pages((grub_efi_physical_address_t)kernel_alloc, BYTES_TO_PAGES(kernel_size));
+      kernel_alloc = 0;
+    }
 
   if (params && !loaded)
     grub_efi_free_pages((grub_efi_physical_address_t)params, BYTES_TO_PAGES(16384));
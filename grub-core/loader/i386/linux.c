@@ -152,25 +152,14 @@ find_efi_mmap_size (void)
 
 #endif
 
-/* Helper for find_mmap_size.  */
-static int
-count_hook (grub_uint64_t addr __attribute__ ((unused)),
-	    grub_uint64_t size __attribute__ ((unused)),
-	    grub_memory_type_t type __attribute__ ((unused)), void *data)
-{
-  grub_size_t *count = data;
-
-  (*count)++;
-  return 0;
-}
-
 /* Find the optimal number of pages for the memory map. */
 static grub_size_t
 find_mmap_size (void)
 {
+  const struct grub_memory_range *map;
   grub_size_t count = 0, mmap_size;
 
-  grub_mmap_iterate (count_hook, &count);
+  grub_mmap_get_map (&map, &count);
 
   mmap_size = count * sizeof (struct grub_e820_mmap);
 
@@ -710,7 +699,7 @@ grub_cmd_linux (grub_command_t cmd __attribute__ ((unused)),
       goto fail;
     }
 
-  if (grub_file_read (file, kernel, len) != len)
+  if (grub_file_read_direct (file, kernel, len) != len)
     {
       if (!grub_errno)
 	grub_error (GRUB_ERR_BAD_OS, N_("premature end of file %s"),
@@ -5,6 +5,8 @@
 #include <grub/file.h>
 #include <grub/mm.h>
 #include <grub/tpm.h>
+#include <grub/disk.h>
+#include <grub/partition.h>
 
 struct newc_head
 {
@@ -29,6 +31,35 @@ struct grub_linux_initrd_component
   grub_file_t file;
   char *newc_name;
   grub_off_t size;
+  /* Set if FILE measures itself while being read.  */
+  int measured;
+  /* Where the data goes in the loaded image.  */
+  grub_uint8_t *target;
+  /* Set once the data has been read as part of the batch of extents.  */
+  int mapped;
+};
+
+/* A piece of one component, to be read along with the pieces of all the
+   others.  */
+struct initrd_extent
+{
+  grub_disk_t disk;
+  /* Start on the whole disk, for putting the reads in order.  */
+  grub_disk_addr_t start;
+  grub_disk_addr_t sector;
+  grub_off_t sector_offset;
+  grub_size_t length;
+  grub_uint8_t *dest;
+  grub_file_t file;
+};
+
+struct initrd_extents
+{
+  struct initrd_extent *e;
+  grub_size_t n;
+  grub_size_t alloc;
+  /* The component being mapped.  */
+  struct grub_linux_initrd_component *comp;
 };
 
 struct dir
@@ -148,6 +179,7 @@ grub_initrd_init (int argc, char *argv[],
   int i;
   int newc = 0;
   struct dir *root = 0;
+  grub_file_t file;
 
   initrd_ctx->nfiles = 0;
   initrd_ctx->components = 0;
@@ -200,12 +232,23 @@ grub_initrd_init (int argc, char *argv[],
 	  newc = 0;
 	}
       grub_file_filter_disable_compression ();
-      initrd_ctx->components[i].file = grub_file_open (fname);
+      file = grub_file_open (fname);
+      if (!file)
+	{
+	  grub_initrd_close (initrd_ctx);
+	  return grub_errno;
+	}
+      initrd_ctx->components[i].file
+	= grub_tpm_measure_open (file, GRUB_BINARY_PCR, "grub_initrd",
+				 "Initrd");
       if (!initrd_ctx->components[i].file)
 	{
+	  grub_file_close (file);
 	  grub_initrd_close (initrd_ctx);
 	  return grub_errno;
 	}
+      initrd_ctx->components[i].measured
+	= (initrd_ctx->components[i].file != file);
       initrd_ctx->nfiles++;
       initrd_ctx->components[i].size
 	= grub_file_size (initrd_ctx->components[i].file);
@@ -245,6 +288,127 @@ grub_initrd_close (struct grub_linux_initrd_context *initrd_ctx)
   initrd_ctx->components = 0;
 }
 
+/* Helper for map_components.  */
+static grub_err_t
+add_extent (const struct grub_fs_extent *extent, void *data)
+{
+  struct initrd_extents *ctx = data;
+  grub_file_t file = ctx->comp->file;
+  grub_uint8_t *dest = ctx->comp->target + (extent->offset - file->offset);
+  struct initrd_extent *e;
+
+  if (extent->hole)
+    {
+      grub_memset (dest, 0, extent->length);
+      return GRUB_ERR_NONE;
+    }
+
+  if (ctx->n == ctx->alloc)
+    {
+      grub_size_t alloc = ctx->alloc ? 2 * ctx->alloc : 32;
+
+      e = grub_realloc (ctx->e, alloc * sizeof (ctx->e[0]));
+      if (!e)
+	return grub_errno;
+      ctx->e = e;
+      ctx->alloc = alloc;
+    }
+
+  e = &ctx->e[ctx->n++];
+  e->disk = file->device->disk;
+  e->start = extent->sector + (extent->sector_offset >> GRUB_DISK_SECTOR_BITS)
+    + grub_partition_get_start (e->disk->partition);
+  e->sector = extent->sector;
+  e->sector_offset = extent->sector_offset;
+  e->length = extent->length;
+  e->dest = dest;
+  e->file = file;
+  return GRUB_ERR_NONE;
+}
+
+static int
+extent_before (const struct initrd_extent *a, const struct initrd_extent *b)
+{
+  if (a->disk->dev->id != b->disk->dev->id)
+    return a->disk->dev->id < b->disk->dev->id;
+  if (a->disk->id != b->disk->id)
+    return a->disk->id < b->disk->id;
+  return a->start < b->start;
+}
+
+/* Collect the extents of every component stored plainly on a disk and
+   read them all in the order they are found on the disks, so that a set
+   of initrds goes by in one sweep instead of one file after another.
+   Components that cannot be mapped are left for grub_initrd_load.  */
+static grub_err_t
+map_components (struct grub_linux_initrd_context *initrd_ctx)
+{
+  struct initrd_extents ctx = { 0, 0, 0, 0 };
+  grub_size_t i, j;
+  int c;
+
+  for (c = 0; c < initrd_ctx->nfiles; c++)
+    {
+      struct grub_linux_initrd_component *comp = &initrd_ctx->components[c];
+      grub_size_t n = ctx.n;
+
+      ctx.comp = comp;
+      if (grub_file_map (comp->file, comp->size, add_extent, &ctx))
+	{
+	  if (grub_errno != GRUB_ERR_NOT_IMPLEMENTED_YET)
+	    goto fail;
+	  grub_errno = GRUB_ERR_NONE;
+	  ctx.n = n;
+	  continue;
+	}
+      comp->mapped = 1;
+    }
+
+  /* The extents of each file mostly come in disk order already.  */
+  for (i = 1; i < ctx.n; i++)
+    {
+      struct initrd_extent e = ctx.e[i];
+
+      for (j = i; j > 0 && extent_before (&e, &ctx.e[j - 1]); j--)
+	ctx.e[j] = ctx.e[j - 1];
+      ctx.e[j] = e;
+    }
+
+  for (c = 0; c < initrd_ctx->nfiles; c++)
+    if (initrd_ctx->components[c].mapped)
+      initrd_ctx->components[c].file->progress_offset
+	= initrd_ctx->components[c].file->offset;
+
+  for (i = 0; i < ctx.n; i++)
+    {
+      struct initrd_extent *e = &ctx.e[i];
+
+      if (e->file->read_hook)
+	{
+	  e->disk->read_hook = e->file->read_hook;
+	  e->disk->read_hook_data = e->file->read_hook_data;
+	}
+      else
+	{
+	  e->disk->read_hook = grub_file_progress_hook;
+	  e->disk->read_hook_data = e->file;
+	}
+      grub_disk_read (e->disk, e->sector, e->sector_offset,
+		      e->length, e->dest);
+      e->disk->read_hook = 0;
+      if (grub_errno)
+	goto fail;
+    }
+
+  for (c = 0; c < initrd_ctx->nfiles; c++)
+    if (initrd_ctx->components[c].mapped)
+      initrd_ctx->components[c].file->offset += initrd_ctx->components[c].size;
+
+ fail:
+  grub_free (ctx.e);
+  return grub_errno;
+}
+
 grub_err_t
 grub_initrd_load (struct grub_linux_initrd_context *initrd_ctx,
 		  char *argv[], void *target)
@@ -255,6 +419,8 @@ grub_initrd_load (struct grub_linux_initrd_context *initrd_ctx,
   struct dir *root = 0;
   grub_ssize_t cursize = 0;
 
+  /* Lay out the image first, so that the data of every component can be
+     read in whatever order suits the disks.  */
   for (i = 0; i < initrd_ctx->nfiles; i++)
     {
       grub_memset (ptr, 0, ALIGN_UP_OVERHEAD (cursize, 4));
@@ -280,16 +446,7 @@ grub_initrd_load (struct grub_linux_initrd_context *initrd_ctx,
 	}
 
       cursize = initrd_ctx->components[i].size;
-      if (grub_file_read (initrd_ctx->components[i].file, ptr, cursize)
-	  != cursize)
-	{
-	  if (!grub_errno)
-	    grub_error (GRUB_ERR_FILE_READ_ERROR, N_("premature end of file %s"),
-			argv[i]);
-	  grub_initrd_close (initrd_ctx);
-	  return grub_errno;
-	}
-      grub_tpm_measure (ptr, cursize, GRUB_BINARY_PCR, "grub_initrd", "Initrd");
+      initrd_ctx->components[i].target = ptr;
       ptr += cursize;
     }
   if (newc)
@@ -300,5 +457,32 @@ grub_initrd_load (struct grub_linux_initrd_context *initrd_ctx,
     }
   free_dir (root);
   root = 0;
+
+  if (map_components (initrd_ctx))
+    {
+      grub_initrd_close (initrd_ctx);
+      return grub_errno;
+    }
+
+  /* Read the rest, and measure in command line order whichever way the
+     data came in.  */
+  for (i = 0; i < initrd_ctx->nfiles; i++)
+    {
+      ptr = initrd_ctx->components[i].target;
+      cursize = initrd_ctx->components[i].size;
+      if (!initrd_ctx->components[i].mapped
+	  && grub_file_read_direct (initrd_ctx->components[i].file, ptr,
+				    cursize) != cursize)
+	{
+	  if (!grub_errno)
+	    grub_error (GRUB_ERR_FILE_READ_ERROR, N_("premature end of file %s"),
+			argv[i]);
+	  grub_initrd_close (initrd_ctx);
+	  return grub_errno;
+	}
+      if (!initrd_ctx->components[i].measured)
+	grub_tpm_measure (ptr, cursize, GRUB_BINARY_PCR, "grub_initrd",
+			  "Initrd");
+    }
   return GRUB_ERR_NONE;
 }
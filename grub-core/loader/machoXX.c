@@ -262,12 +262,20 @@ SUFFIX (grub_macho_size) (grub_macho_t macho, grub_macho_addr_t *segments_start,
   return GRUB_ERR_NONE;
 }
 
+/* A segment as grub_macho_load puts it in memory.  */
+struct load_segment
+{
+  grub_macho_addr_t vmaddr;
+  grub_macho_addr_t fileoff;
+  grub_macho_addr_t filesize;
+  grub_macho_addr_t vmsize;
+};
+
 struct do_load_ctx
 {
   int flags;
-  char *offset;
-  const char *filename;
-  int *darwin_version;
+  struct load_segment *segs;
+  unsigned nsegs;
 };
 
 static int
@@ -277,6 +285,7 @@ do_load(grub_macho_t _macho,
 {
   grub_macho_segment_t *hdr = (grub_macho_segment_t *) hdr0;
   struct do_load_ctx *ctx = _arg;
+  struct load_segment *seg;
 
   if (hdr->cmd != GRUB_MACHO_CMD_SEGMENT)
     return 0;
@@ -286,81 +295,140 @@ do_load(grub_macho_t _macho,
   if (! hdr->vmsize)
     return 0;
 
-  if (hdr->filesize)
+  if (! ctx->segs)
     {
-      grub_ssize_t read, toread = min (hdr->filesize, hdr->vmsize);
-      if (_macho->uncompressedXX)
-	{
-	  if (hdr->fileoff + (grub_size_t) toread
-	      > _macho->uncompressed_sizeXX)
-	    read = -1;
-	  else
-	    {
-	      read = toread;
-	      grub_memcpy (ctx->offset + hdr->vmaddr,
-			   _macho->uncompressedXX + hdr->fileoff, read);
-	    }
-	}
-      else
-	{
-	  if (grub_file_seek (_macho->file, hdr->fileoff
-			      + _macho->offsetXX) == (grub_off_t) -1)
-	    return 1;
-	  read = grub_file_read (_macho->file, ctx->offset + hdr->vmaddr,
-				 toread);
-	}
+      ctx->segs = grub_malloc (_macho->ncmdsXX * sizeof (ctx->segs[0]));
+      if (! ctx->segs)
+	return 1;
+    }
 
-      if (read != toread)
-	{
-	  /* XXX How can we free memory from `load_hook'? */
-	  if (!grub_errno)
-	    grub_error (GRUB_ERR_BAD_OS, N_("premature end of file %s"),
-			ctx->filename);
+  seg = &ctx->segs[ctx->nsegs++];
+  seg->vmaddr = hdr->vmaddr;
+  seg->fileoff = hdr->fileoff;
+  seg->filesize = min (hdr->filesize, hdr->vmsize);
+  seg->vmsize = hdr->vmsize;
+  return 0;
+}
 
-	  return 1;
-	}
-      if (ctx->darwin_version)
-	{
-	  const char *ptr = ctx->offset + hdr->vmaddr;
-	  const char *end = ptr + min (hdr->filesize, hdr->vmsize)
-	    - (sizeof ("Darwin Kernel Version ") - 1);
-	  for (; ptr < end; ptr++)
-	    if (grub_memcmp (ptr, "Darwin Kernel Version ",
-			     sizeof ("Darwin Kernel Version ") - 1) == 0)
-	      {
-		ptr += sizeof ("Darwin Kernel Version ") - 1;
-		*ctx->darwin_version = 0;
-		end += (sizeof ("Darwin Kernel Version ") - 1);
-		while (ptr < end && grub_isdigit (*ptr))
-		  *ctx->darwin_version = (*ptr++ - '0') + *ctx->darwin_version * 10;
-		break;
-	      }
-	}
-    }
+static int
+segments_overlap (const struct load_segment *segs, unsigned n)
+{
+  unsigned i, j;
 
-  if (hdr->filesize < hdr->vmsize)
-    grub_memset (ctx->offset + hdr->vmaddr + hdr->filesize,
-		 0, hdr->vmsize - hdr->filesize);
+  for (i = 0; i < n; i++)
+    for (j = i + 1; j < n; j++)
+      if (segs[i].vmaddr < segs[j].vmaddr + segs[j].vmsize
+	  && segs[j].vmaddr < segs[i].vmaddr + segs[i].vmsize)
+	return 1;
   return 0;
 }
 
-/* Load every loadable segment into memory specified by `_load_hook'.  */
+static void
+find_darwin_version (const char *ptr, grub_size_t size, int *darwin_version)
+{
+  const char *end = ptr + size - (sizeof ("Darwin Kernel Version ") - 1);
+
+  if (size < sizeof ("Darwin Kernel Version ") - 1)
+    return;
+
+  for (; ptr < end; ptr++)
+    if (grub_memcmp (ptr, "Darwin Kernel Version ",
+		     sizeof ("Darwin Kernel Version ") - 1) == 0)
+      {
+	ptr += sizeof ("Darwin Kernel Version ") - 1;
+	*darwin_version = 0;
+	end += (sizeof ("Darwin Kernel Version ") - 1);
+	while (ptr < end && grub_isdigit (*ptr))
+	  *darwin_version = (*ptr++ - '0') + *darwin_version * 10;
+	break;
+      }
+}
+
+/* Load every loadable segment into memory specified by `_load_hook'.
+   Unless they overlap in memory, segments are read in file order, and
+   those that follow each other both in the file and in memory with a
+   single request.  */
 grub_err_t
 SUFFIX (grub_macho_load) (grub_macho_t macho, const char *filename,
 			  char *offset, int flags, int *darwin_version)
 {
   struct do_load_ctx ctx = {
     .flags = flags,
-    .offset = offset,
-    .filename = filename,
-    .darwin_version = darwin_version
+    .segs = 0,
+    .nsegs = 0
   };
+  struct load_segment *segs;
+  unsigned i, j;
 
   if (darwin_version)
     *darwin_version = 0;
 
-  grub_macho_cmds_iterate (macho, do_load, &ctx, filename);
+  if (grub_macho_cmds_iterate (macho, do_load, &ctx, filename))
+    goto out;
+  segs = ctx.segs;
+
+  if (! segments_overlap (segs, ctx.nsegs))
+    for (i = 1; i < ctx.nsegs; i++)
+      {
+	struct load_segment seg = segs[i];
+
+	for (j = i; j > 0 && segs[j - 1].fileoff > seg.fileoff; j--)
+	  segs[j] = segs[j - 1];
+	segs[j] = seg;
+      }
+
+  for (i = 0; i < ctx.nsegs; i = j)
+    {
+      grub_size_t len = segs[i].filesize;
+      grub_ssize_t read;
+      char *dest = offset + segs[i].vmaddr;
+
+      for (j = i + 1; j < ctx.nsegs
+	     && segs[j - 1].filesize == segs[j - 1].vmsize
+	     && segs[j].fileoff == segs[i].fileoff + len
+	     && segs[j].vmaddr == segs[i].vmaddr + len; j++)
+	len += segs[j].filesize;
+
+      if (len)
+	{
+	  if (macho->uncompressedXX)
+	    {
+	      if (segs[i].fileoff + len > macho->uncompressed_sizeXX)
+		read = -1;
+	      else
+		{
+		  read = len;
+		  grub_memcpy (dest, macho->uncompressedXX + segs[i].fileoff,
+			       len);
+		}
+	    }
+	  else
+	    {
+	      if (grub_file_seek (macho->file, segs[i].fileoff
+				  + macho->offsetXX) == (grub_off_t) -1)
+		goto out;
+	      read = grub_file_read_direct (macho->file, dest, len);
+	    }
+
+	  if (read != (grub_ssize_t) len)
+	    {
+	      /* XXX How can we free memory from `load_hook'? */
+	      if (!grub_errno)
+		grub_error (GRUB_ERR_BAD_OS, N_("premature end of file %s"),
+			    filename);
+	      goto out;
+	    }
+	  if (darwin_version)
+	    find_darwin_version (dest, len, darwin_version);
+	}
+
+      if (segs[j - 1].filesize < segs[j - 1].vmsize)
+	grub_memset (offset + segs[j - 1].vmaddr + segs[j - 1].filesize,
+		     0, segs[j - 1].vmsize - segs[j - 1].filesize);
+    }
 
+ out:
+  grub_free (ctx.segs);
   return grub_errno;
 }
 
@@ -63,27 +63,32 @@ static int accepts_ega_text;
 static int console_required;
 static grub_dl_t my_mod;
 
-
-/* Helper for grub_get_multiboot_mmap_count.  */
-static int
-count_hook (grub_uint64_t addr __attribute__ ((unused)),
-	    grub_uint64_t size __attribute__ ((unused)),
-	    grub_memory_type_t type __attribute__ ((unused)), void *data)
+/* A module which has been opened but not placed in memory yet.  */
+struct pending_module
 {
-  grub_size_t *count = data;
+  struct pending_module *next;
+  grub_file_t file;
+  grub_size_t size;
+  char *name;
+  int argc;
+  char **argv;
+};
+
+/* Modules queued by "module --group", in command order.  */
+static struct pending_module *pending_modules;
+static struct pending_module **pending_modules_last = &pending_modules;
 
-  (*count)++;
-  return 0;
-}
 
 /* Return the length of the Multiboot mmap that will be needed to allocate
    our platform's map.  */
 grub_uint32_t
 grub_get_multiboot_mmap_count (void)
 {
-  grub_size_t count = 0;
+  const struct grub_memory_range *map;
+  grub_size_t count;
 
-  grub_mmap_iterate (count_hook, &count);
+  if (grub_mmap_get_map (&map, &count))
+    return 0;
 
   return count;
 }
@@ -119,6 +124,9 @@ grub_multiboot_set_video_mode (void)
   return err;
 }
 
+static grub_err_t load_pending_modules (void);
+static void free_pending_modules (void);
+
 static grub_err_t
 grub_multiboot_boot (void)
 {
@@ -127,6 +135,10 @@ grub_multiboot_boot (void)
 
   state.MULTIBOOT_ENTRY_REGISTER = grub_multiboot_payload_eip;
 
+  err = load_pending_modules ();
+  if (err)
+    return err;
+
   err = grub_multiboot_make_mbi (&state.MULTIBOOT_MBI_REGISTER);
 
   if (err)
@@ -145,6 +157,7 @@ grub_multiboot_boot (void)
 static grub_err_t
 grub_multiboot_unload (void)
 {
+  free_pending_modules ();
   grub_multiboot_free_mbi ();
 
   grub_relocator_unload (grub_multiboot_relocator);
@@ -273,6 +286,8 @@ grub_cmd_multiboot (grub_command_t cmd __attribute__ ((unused)),
 
   grub_dl_ref (my_mod);
 
+  free_pending_modules ();
+
   /* Skip filename.  */
   grub_multiboot_init_mbi (argc - 1, argv + 1);
 
@@ -304,28 +319,136 @@ grub_cmd_multiboot (grub_command_t cmd __attribute__ ((unused)),
   return grub_errno;
 }
 
+static void
+free_pending_modules (void)
+{
+  struct pending_module *mod, *next;
+  int i;
+
+  for (mod = pending_modules; mod; mod = next)
+    {
+      next = mod->next;
+      grub_file_close (mod->file);
+      for (i = 0; i < mod->argc; i++)
+	grub_free (mod->argv[i]);
+      grub_free (mod->argv);
+      grub_free (mod->name);
+      grub_free (mod);
+    }
+  pending_modules = NULL;
+  pending_modules_last = &pending_modules;
+}
+
 static grub_err_t
-grub_cmd_module (grub_command_t cmd __attribute__ ((unused)),
-		 int argc, char *argv[])
+alloc_modules (grub_size_t size, void **module, grub_addr_t *target)
 {
-  grub_file_t file = 0;
-  grub_ssize_t size;
-  void *module = NULL;
-  grub_addr_t target;
-  grub_err_t err;
-  int nounzip = 0;
+  grub_relocator_chunk_t ch;
   grub_uint64_t lowest_addr = 0;
+  grub_err_t err;
 
-  if (argc == 0)
-    return grub_error (GRUB_ERR_BAD_ARGUMENT, N_("filename expected"));
+#ifndef GRUB_USE_MULTIBOOT2
+  lowest_addr = 0x100000;
+  if (grub_multiboot_quirks & GRUB_MULTIBOOT_QUIRK_MODULES_AFTER_KERNEL)
+    lowest_addr = ALIGN_UP (highest_load + 1048576, 4096);
+#endif
+
+  err = grub_relocator_alloc_chunk_align (grub_multiboot_relocator, &ch,
+					  lowest_addr, (0xffffffff - size) + 1,
+					  size, MULTIBOOT_MOD_ALIGN,
+					  GRUB_RELOCATOR_PREFERENCE_NONE, 1);
+  if (err)
+    return err;
+  *module = get_virtual_current_address (ch);
+  *target = get_physical_target_address (ch);
+  return GRUB_ERR_NONE;
+}
+
+/* Place and read all queued modules.  They share one allocation when
+   possible, so that a group of modules is laid out in a single relocator
+   request and read in one go.  */
+static grub_err_t
+load_pending_modules (void)
+{
+  struct pending_module *mod;
+  grub_size_t total = 0, off = 0;
+  grub_uint8_t *base = NULL;
+  grub_addr_t base_target = 0;
+
+  if (!pending_modules)
+    return GRUB_ERR_NONE;
+
+  for (mod = pending_modules; mod; mod = mod->next)
+    total += ALIGN_UP (mod->size, MULTIBOOT_MOD_ALIGN);
 
-  if (grub_strcmp (argv[0], "--nounzip") == 0)
+  if (pending_modules->next && total
+      && alloc_modules (total, (void **) &base, &base_target))
     {
-      argv++;
-      argc--;
-      nounzip = 1;
+      /* Fall back to placing them one by one.  */
+      grub_errno = GRUB_ERR_NONE;
+      base = NULL;
+    }
+
+  for (mod = pending_modules; mod; mod = mod->next)
+    {
+      void *module = NULL;
+      grub_addr_t target = 0;
+
+      if (mod->size && base)
+	{
+	  module = base + off;
+	  target = base_target + off;
+	  off += ALIGN_UP (mod->size, MULTIBOOT_MOD_ALIGN);
+	}
+      else if (mod->size && alloc_modules (mod->size, &module, &target))
+	break;
+
+      if (grub_multiboot_add_module (target, mod->size, mod->argc, mod->argv))
+	break;
+
+      if (mod->size && grub_file_read_direct (mod->file, module, mod->size)
+	  != (grub_ssize_t) mod->size)
+	{
+	  if (!grub_errno)
+	    grub_error (GRUB_ERR_FILE_READ_ERROR,
+			N_("premature end of file %s"), mod->name);
+	  break;
+	}
+
+      grub_tpm_measure (module, mod->size, GRUB_BINARY_PCR, "grub_multiboot",
+			mod->name);
     }
 
+  free_pending_modules ();
+  return grub_errno;
+}
+
+static grub_err_t
+grub_cmd_module (grub_command_t cmd __attribute__ ((unused)),
+		 int argc, char *argv[])
+{
+  struct pending_module *mod;
+  int nounzip = 0, group = 0, option_found, i;
+
+  do
+    {
+      option_found = 0;
+      if (argc != 0 && grub_strcmp (argv[0], "--nounzip") == 0)
+	{
+	  argv++;
+	  argc--;
+	  nounzip = 1;
+	  option_found = 1;
+	}
+
+      if (argc != 0 && grub_strcmp (argv[0], "--group") == 0)
+	{
+	  argv++;
+	  argc--;
+	  group = 1;
+	  option_found = 1;
+	}
+    } while (option_found);
+
   if (argc == 0)
     return grub_error (GRUB_ERR_BAD_ARGUMENT, N_("filename expected"));
 
@@ -333,60 +456,48 @@ grub_cmd_module (grub_command_t cmd __attribute__ ((unused)),
     return grub_error (GRUB_ERR_BAD_ARGUMENT,
 		       N_("you need to load the kernel first"));
 
-  if (nounzip)
-    grub_file_filter_disable_compression ();
-
-  file = grub_file_open (argv[0]);
-  if (! file)
+  mod = grub_zalloc (sizeof (*mod));
+  if (!mod)
     return grub_errno;
 
-#ifndef GRUB_USE_MULTIBOOT2
-  lowest_addr = 0x100000;
-  if (grub_multiboot_quirks & GRUB_MULTIBOOT_QUIRK_MODULES_AFTER_KERNEL)
-    lowest_addr = ALIGN_UP (highest_load + 1048576, 4096);
-#endif
+  if (nounzip)
+    grub_file_filter_disable_compression ();
 
-  size = grub_file_size (file);
-  if (size)
-  {
-    grub_relocator_chunk_t ch;
-    err = grub_relocator_alloc_chunk_align (grub_multiboot_relocator, &ch,
-					    lowest_addr, (0xffffffff - size) + 1,
-					    size, MULTIBOOT_MOD_ALIGN,
-					    GRUB_RELOCATOR_PREFERENCE_NONE, 1);
-    if (err)
-      {
-	grub_file_close (file);
-	return err;
-      }
-    module = get_virtual_current_address (ch);
-    target = get_physical_target_address (ch);
-  }
-  else
+  mod->file = grub_file_open (argv[0]);
+  if (! mod->file)
     {
-      module = 0;
-      target = 0;
+      grub_free (mod);
+      return grub_errno;
     }
-
-  err = grub_multiboot_add_module (target, size, argc - 1, argv + 1);
-  if (err)
+  mod->size = grub_file_size (mod->file);
+  mod->name = grub_strdup (argv[0]);
+  mod->argv = grub_zalloc (argc * sizeof (mod->argv[0]));
+  if (!mod->name || !mod->argv)
+    goto fail;
+  for (mod->argc = 0; mod->argc < argc - 1; mod->argc++)
     {
-      grub_file_close (file);
-      return err;
+      mod->argv[mod->argc] = grub_strdup (argv[mod->argc + 1]);
+      if (!mod->argv[mod->argc])
+	goto fail;
     }
 
-  if (size && grub_file_read (file, module, size) != size)
-    {
-      grub_file_close (file);
-      if (!grub_errno)
-	grub_error (GRUB_ERR_FILE_READ_ERROR, N_("premature end of file %s"),
-		    argv[0]);
-      return grub_errno;
-    }
+  *pending_modules_last = mod;
+  pending_modules_last = &mod->next;
 
-  grub_file_close (file);
-  grub_tpm_measure (module, size, GRUB_BINARY_PCR, "grub_multiboot", argv[0]);
+  /* A module without --group is placed right away, along with the group
+     before it.  */
+  if (!group)
+    return load_pending_modules ();
   return GRUB_ERR_NONE;
+
+ fail:
+  grub_file_close (mod->file);
+  for (i = 0; i < mod->argc; i++)
+    grub_free (mod->argv[i]);
+  grub_free (mod->argv);
+  grub_free (mod->name);
+  grub_free (mod);
+  return grub_errno;
 }
 
 static grub_command_t cmd_multiboot, cmd_module;
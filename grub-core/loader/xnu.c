@@ -1297,6 +1297,165 @@ grub_cmd_xnu_kextdir (grub_command_t cmd __attribute__ ((unused)),
     }
 }
 
+/* One line of a kext list.  */
+struct grub_xnu_kextlist_entry
+{
+  char *plistname;
+  char *binname;
+  grub_file_t binfile;
+};
+
+static void
+grub_xnu_free_kextlist (struct grub_xnu_kextlist_entry *entries, int n)
+{
+  int i;
+
+  for (i = 0; i < n; i++)
+    {
+      if (entries[i].binfile)
+	grub_file_close (entries[i].binfile);
+      grub_free (entries[i].plistname);
+      grub_free (entries[i].binname);
+    }
+  grub_free (entries);
+}
+
+/* Read the kext list LISTNAME and open everything it names.  Each line
+   holds the path of an Info.plist and of the matching binary, or `-' if
+   there is none, both relative to DIRNAME.  Fails before anything is
+   loaded if the list is missing or names a file that is gone.  */
+static grub_err_t
+grub_xnu_open_kextlist (const char *listname, const char *dirname,
+			struct grub_xnu_kextlist_entry **entries_out,
+			int *n_out)
+{
+  struct grub_xnu_kextlist_entry *entries = 0;
+  grub_file_t file;
+  grub_size_t size;
+  char *buf, *line, *next, *bin, *end;
+  int n = 0, nlines = 1;
+
+  file = grub_file_open (listname);
+  if (! file)
+    return grub_errno;
+  size = grub_file_size (file);
+  buf = grub_malloc (size + 1);
+  if (! buf)
+    {
+      grub_file_close (file);
+      return grub_errno;
+    }
+  if (grub_file_read (file, buf, size) != (grub_ssize_t) size)
+    {
+      grub_file_close (file);
+      grub_free (buf);
+      if (!grub_errno)
+	grub_error (GRUB_ERR_FILE_READ_ERROR, N_("premature end of file %s"),
+		    listname);
+      return grub_errno;
+    }
+  grub_file_close (file);
+  buf[size] = 0;
+
+  for (line = buf; *line; line++)
+    if (*line == '\n')
+      nlines++;
+  entries = grub_zalloc (nlines * sizeof (entries[0]));
+  if (! entries)
+    goto fail;
+
+  for (line = buf; *line; line = next)
+    {
+      next = grub_strchr (line, '\n');
+      if (next)
+	*next++ = 0;
+      else
+	next = line + grub_strlen (line);
+
+      while (grub_isspace (*line))
+	line++;
+      if (*line == 0 || *line == '#')
+	continue;
+
+      for (bin = line; *bin && !grub_isspace (*bin); bin++);
+      if (*bin)
+	*bin++ = 0;
+      while (grub_isspace (*bin))
+	bin++;
+      for (end = bin; *end && !grub_isspace (*end); end++);
+      *end = 0;
+
+      entries[n].plistname = grub_xasprintf ("%s/%s", dirname, line);
+      if (! entries[n].plistname)
+	goto fail;
+      n++;
+      file = grub_file_open (entries[n - 1].plistname);
+      if (! file)
+	goto fail;
+      grub_file_close (file);
+
+      if (*bin && grub_strcmp (bin, "-") != 0)
+	{
+	  entries[n - 1].binname = grub_xasprintf ("%s/%s", dirname, bin);
+	  if (! entries[n - 1].binname)
+	    goto fail;
+	  entries[n - 1].binfile = grub_file_open (entries[n - 1].binname);
+	  if (! entries[n - 1].binfile)
+	    goto fail;
+	}
+    }
+
+  grub_free (buf);
+  *entries_out = entries;
+  *n_out = n;
+  return GRUB_ERR_NONE;
+
+ fail:
+  grub_free (buf);
+  if (entries)
+    grub_xnu_free_kextlist (entries, n);
+  return grub_errno;
+}
+
+/* Load the kexts named in a list, without looking through the directory
+   or at the plists to find them.  Scan the directory instead if the list
+   is unusable.  */
+static grub_err_t
+grub_cmd_xnu_kextlist (grub_command_t cmd,
+		       int argc, char *args[])
+{
+  struct grub_xnu_kextlist_entry *entries = 0;
+  grub_err_t err = GRUB_ERR_NONE;
+  int n = 0, i;
+
+  if (argc != 2 && argc != 3)
+    return grub_error (GRUB_ERR_BAD_ARGUMENT, N_("two arguments expected"));
+
+  if (! grub_xnu_heap_size)
+    return grub_error (GRUB_ERR_BAD_OS, N_("you need to load the kernel first"));
+
+  if (grub_xnu_open_kextlist (args[0], args[1], &entries, &n))
+    {
+      grub_dprintf ("xnu", "kext list %s is stale (%s), scanning %s\n",
+		    args[0], grub_errmsg, args[1]);
+      grub_errno = GRUB_ERR_NONE;
+      return grub_cmd_xnu_kextdir (cmd, argc - 1, args + 1);
+    }
+
+  for (i = 0; i < n && !err; i++)
+    {
+      grub_dprintf ("xnu", "%s:%s\n", entries[i].plistname,
+		    entries[i].binname ? : "0");
+      err = grub_xnu_load_driver (entries[i].plistname, entries[i].binfile,
+				  entries[i].binname);
+      /* grub_xnu_load_driver owns the binary now.  */
+      entries[i].binfile = 0;
+    }
+
+  grub_xnu_free_kextlist (entries, n);
+  return err;
+}
+
 static inline int
 hextoval (char c)
 {
@@ -1464,7 +1623,7 @@ grub_xnu_unlock (void)
 }
 
 static grub_command_t cmd_kernel64, cmd_kernel, cmd_mkext, cmd_kext;
-static grub_command_t cmd_kextdir, cmd_ramdisk, cmd_resume;
+static grub_command_t cmd_kextdir, cmd_kextlist, cmd_ramdisk, cmd_resume;
 static grub_extcmd_t cmd_splash;
 
 GRUB_MOD_INIT(xnu)
@@ -1487,6 +1646,12 @@ GRUB_MOD_INIT(xnu)
 				       /* TRANSLATORS: There are many extensions
 					  in extension directory.  */
 				       N_("Load XNU extension directory."));
+  cmd_kextlist = grub_register_command ("xnu_kextlist",
+					grub_cmd_xnu_kextlist,
+					N_("LIST DIRECTORY [OSBundleRequired]"),
+					N_("Load the XNU extensions named in"
+					   " LIST, or scan DIRECTORY if it is"
+					   " out of date."));
   cmd_ramdisk = grub_register_command ("xnu_ramdisk", grub_cmd_xnu_ramdisk, 0,
    /* TRANSLATORS: ramdisk here isn't identifier. It can be translated.  */
 				       N_("Load XNU ramdisk. "
@@ -1515,6 +1680,7 @@ GRUB_MOD_FINI(xnu)
   grub_unregister_command (cmd_mkext);
   grub_unregister_command (cmd_kext);
   grub_unregister_command (cmd_kextdir);
+  grub_unregister_command (cmd_kextlist);
   grub_unregister_command (cmd_ramdisk);
   grub_unregister_command (cmd_kernel);
   grub_unregister_extcmd (cmd_splash);
@@ -25,40 +25,23 @@
 #include <grub/mm.h>
 #include <grub/misc.h>
 
-#define NEXT_MEMORY_DESCRIPTOR(desc, size)      \
-  ((grub_efi_memory_descriptor_t *) ((char *) (desc) + (size)))
-
 grub_err_t
 grub_efi_mmap_iterate (grub_memory_hook_t hook, void *hook_data,
 		       int avoid_efi_boot_services)
 {
-  grub_efi_uintn_t mmap_size = 0;
-  grub_efi_memory_descriptor_t *map_buf = 0;
-  grub_efi_uintn_t map_key = 0;
-  grub_efi_uintn_t desc_size = 0;
-  grub_efi_uint32_t desc_version = 0;
-  grub_efi_memory_descriptor_t *desc;
-
-  if (grub_efi_get_memory_map (&mmap_size, map_buf,
-			       &map_key, &desc_size,
-			       &desc_version) < 0)
-    return grub_errno;
+  const grub_efi_memory_descriptor_t *map, *desc;
+  grub_efi_uintn_t count;
 
-  map_buf = grub_malloc (mmap_size);
-  if (! map_buf)
-    return grub_errno;
+  /* Boot services memory the firmware took for itself is not tracked by
+     the cached map, callers which have to avoid it get the current one.  */
+  if (avoid_efi_boot_services)
+    grub_efi_mmap_generation++;
 
-  if (grub_efi_get_memory_map (&mmap_size, map_buf,
-			       &map_key, &desc_size,
-			       &desc_version) <= 0)
-    {
-      grub_free (map_buf);
-      return grub_errno;
-    }
+  map = grub_efi_get_cached_memory_map (&count, NULL);
+  if (! map)
+    return grub_errno;
 
-  for (desc = map_buf;
-       desc < NEXT_MEMORY_DESCRIPTOR (map_buf, mmap_size);
-       desc = NEXT_MEMORY_DESCRIPTOR (desc, desc_size))
+  for (desc = map; desc < map + count; desc++)
     {
       grub_dprintf ("mmap", "EFI memory region 0x%llx-0x%llx: %d\n",
 		    (unsigned long long) desc->physical_start,
@@ -211,6 +194,7 @@ grub_mmap_register (grub_uint64_t start, grub_uint64_t size, int type)
     }
   status = efi_call_4 (b->allocate_pages, GRUB_EFI_ALLOCATE_ADDRESS,
 		       make_efi_memtype (type), pages, &address);
+  grub_efi_mmap_generation++;
   if (status != GRUB_EFI_SUCCESS)
     {
       grub_free (curover);
@@ -240,6 +224,7 @@ grub_mmap_unregister (int handle)
       if (curover->handle == handle)
 	{
 	  efi_call_2 (b->free_pages, curover->address, curover->pages);
+	  grub_efi_mmap_generation++;
 	  if (prevover != 0)
 	    prevover->next = curover->next;
 	  else
@@ -301,6 +286,7 @@ grub_mmap_malign_and_register (grub_uint64_t align __attribute__ ((unused)),
 	return 0;
     }
 
+  grub_efi_mmap_generation++;
   curover->next = overlays;
   curover->handle = curhandle++;
   curover->address = address;
@@ -25,6 +25,9 @@
 #include <grub/command.h>
 #include <grub/dl.h>
 #include <grub/i18n.h>
+#ifdef GRUB_MACHINE_EFI
+#include <grub/efi/efi.h>
+#endif
 
 GRUB_MOD_LICENSE ("GPLv3+");
 
@@ -37,6 +40,24 @@ static int curhandle = 1;
 
 static int current_priority = 1;
 
+/* The resolved map returned by grub_mmap_get_map.  */
+static struct grub_memory_range *map_cache;
+static grub_size_t map_cache_count;
+static int map_cache_valid;
+
+#if defined (GRUB_MACHINE_EFI)
+/* The firmware map only changes when GRUB allocates or frees pages.  */
+#define MACHINE_MMAP_GENERATION	grub_efi_mmap_generation
+#elif defined (GRUB_MACHINE_PCBIOS) || defined (GRUB_MACHINE_COREBOOT) \
+  || defined (GRUB_MACHINE_MULTIBOOT) || defined (GRUB_MACHINE_QEMU)
+/* These firmware maps never change.  */
+#define MACHINE_MMAP_GENERATION	0
+#endif
+
+#ifdef MACHINE_MMAP_GENERATION
+static grub_uint64_t map_cache_generation;
+#endif
+
 /* Scanline events. */
 struct grub_mmap_scan
 {
@@ -55,6 +76,7 @@ struct grub_mmap_iterate_ctx
 {
   struct grub_mmap_scan *scanline_events;
   int i;
+  int max;
 };
 
 /* Helper for grub_mmap_iterate.  */
@@ -83,6 +105,10 @@ fill_hook (grub_uint64_t addr, grub_uint64_t size, grub_memory_type_t type,
       type = GRUB_MEMORY_RESERVED;
     }
 
+  /* The firmware map may have grown since it was counted.  */
+  if (ctx->i + 2 > ctx->max)
+    return 1;
+
   ctx->scanline_events[ctx->i].pos = addr;
   ctx->scanline_events[ctx->i].type = 0;
   ctx->scanline_events[ctx->i].memtype = type;
@@ -106,14 +132,16 @@ struct mm_list
   int present;
 };
 
-grub_err_t
-grub_mmap_iterate (grub_memory_hook_t hook, void *hook_data)
+static grub_err_t
+build_map (void)
 {
   /* This function resolves overlapping regions and sorts the memory map.
      It uses scanline (sweeping) algorithm.
   */
   struct grub_mmap_iterate_ctx ctx;
   int i, done;
+  struct grub_memory_range *map;
+  grub_size_t count;
 
   struct grub_mmap_scan t;
 
@@ -134,6 +162,10 @@ grub_mmap_iterate (grub_memory_hook_t hook, void *hook_data)
 
   mmap_num = 0;
 
+#ifdef MACHINE_MMAP_GENERATION
+  map_cache_generation = MACHINE_MMAP_GENERATION;
+#endif
+
 #ifndef GRUB_MMAP_REGISTER_BY_FIRMWARE
   for (cur = grub_mmap_overlays; cur; cur = cur->next)
     mmap_num++;
@@ -147,14 +179,19 @@ grub_mmap_iterate (grub_memory_hook_t hook, void *hook_data)
 
   present = grub_zalloc (sizeof (present[0]) * current_priority);
 
-  if (! ctx.scanline_events || !present)
+  /* Every event ends at most one region.  */
+  map = grub_malloc (sizeof (map[0]) * 2 * mmap_num);
+
+  if (! ctx.scanline_events || !present || !map)
     {
       grub_free (ctx.scanline_events);
       grub_free (present);
+      grub_free (map);
       return grub_errno;
     }
 
   ctx.i = 0;
+  ctx.max = 2 * mmap_num;
 #ifndef GRUB_MMAP_REGISTER_BY_FIRMWARE
   /* Register scanline events. */
   for (cur = grub_mmap_overlays; cur; cur = cur->next)
@@ -174,6 +211,8 @@ grub_mmap_iterate (grub_memory_hook_t hook, void *hook_data)
 #endif /* ! GRUB_MMAP_REGISTER_BY_FIRMWARE */
 
   grub_machine_mmap_iterate (fill_hook, &ctx);
+  mmap_num = ctx.i / 2;
+  count = 0;
 
   /* Primitive bubble sort. It has complexity O(n^2) but since we're
      unlikely to have more than 100 chunks it's probably one of the
@@ -260,16 +299,16 @@ grub_mmap_iterate (grub_memory_hook_t hook, void *hook_data)
 	    }
       }
 
-      /* Announce region to the hook if necessary. */
+      /* Record the region if necessary. */
       if ((curtype == -1 || curtype != lasttype)
 	  && lastaddr != ctx.scanline_events[i].pos
 	  && lasttype != -1
-	  && lasttype != GRUB_MEMORY_HOLE
-	  && hook (lastaddr, ctx.scanline_events[i].pos - lastaddr, lasttype,
-		   hook_data))
+	  && lasttype != GRUB_MEMORY_HOLE)
 	{
-	  grub_free (ctx.scanline_events);
-	  return GRUB_ERR_NONE;
+	  map[count].addr = lastaddr;
+	  map[count].size = ctx.scanline_events[i].pos - lastaddr;
+	  map[count].type = lasttype;
+	  count++;
 	}
 
       /* Update last values if necessary. */
@@ -281,6 +320,49 @@ grub_mmap_iterate (grub_memory_hook_t hook, void *hook_data)
     }
 
   grub_free (ctx.scanline_events);
+  grub_free (present);
+
+  grub_free (map_cache);
+  map_cache = map;
+  map_cache_count = count;
+  map_cache_valid = 1;
+  return GRUB_ERR_NONE;
+}
+
+grub_err_t
+grub_mmap_get_map (const struct grub_memory_range **map, grub_size_t *count)
+{
+  grub_err_t err;
+
+#ifdef MACHINE_MMAP_GENERATION
+  if (!map_cache_valid || map_cache_generation != MACHINE_MMAP_GENERATION)
+#endif
+    {
+      err = build_map ();
+      if (err)
+	return err;
+    }
+
+  *map = map_cache;
+  *count = map_cache_count;
+  return GRUB_ERR_NONE;
+}
+
+grub_err_t
+grub_mmap_iterate (grub_memory_hook_t hook, void *hook_data)
+{
+  const struct grub_memory_range *map;
+  grub_size_t i, count;
+  grub_err_t err;
+
+  err = grub_mmap_get_map (&map, &count);
+  if (err)
+    return err;
+
+  for (i = 0; i < count; i++)
+    if (hook (map[i].addr, map[i].size, map[i].type, hook_data))
+      break;
+
   return GRUB_ERR_NONE;
 }
 
@@ -304,6 +386,7 @@ grub_mmap_register (grub_uint64_t start, grub_uint64_t size, int type)
   cur->handle = curhandle++;
   cur->priority = current_priority++;
   grub_mmap_overlays = cur;
+  map_cache_valid = 0;
 
   if (grub_machine_mmap_register (start, size, type, curhandle))
     {
@@ -333,6 +416,7 @@ grub_mmap_unregister (int handle)
 	else
 	  grub_mmap_overlays = cur->next;
 	grub_free (cur);
+	map_cache_valid = 0;
 	return GRUB_ERR_NONE;
       }
   return grub_error (GRUB_ERR_BUG, "mmap overlay not found");
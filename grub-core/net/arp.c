@@ -54,7 +54,8 @@ static grub_uint32_t pending_req;
 
 grub_err_t
 grub_net_arp_send_request (struct grub_net_network_level_interface *inf,
-			   const grub_net_network_level_address_t *proto_addr)
+			   const grub_net_network_level_address_t *proto_addr,
+			   int wait)
 {
   struct grub_net_buff nb;
   struct arppkt *arp_packet;
@@ -93,7 +94,7 @@ grub_net_arp_send_request (struct grub_net_network_level_interface *inf,
 
   nbd = nb.data;
   send_ethernet_packet (inf, &nb, target_mac_addr, GRUB_NET_ETHERTYPE_ARP);
-  for (i = 0; i < GRUB_NET_TRIES; i++)
+  for (i = 0; wait && i < GRUB_NET_TRIES; i++)
     {
       if (grub_net_link_layer_resolve_check (inf, proto_addr))
 	return GRUB_ERR_NONE;
@@ -131,10 +132,16 @@ grub_net_arp_receive (struct grub_net_buff *nb,
   if (arp_packet->sender_ip == pending_req)
     have_pending = 1;
 
-  sender_mac_addr.type = GRUB_NET_LINK_LEVEL_PROTOCOL_ETHERNET;
-  grub_memcpy (sender_mac_addr.mac, arp_packet->sender_mac,
-	       sizeof (sender_mac_addr.mac));
-  grub_net_link_layer_add_address (card, &sender_addr, &sender_mac_addr, 1);
+  /* Every request and reply, including gratuitous ones, names its sender.
+     Probes (RFC 5227) come from 0.0.0.0 and tell nothing.  */
+  if (arp_packet->sender_ip != 0)
+    {
+      sender_mac_addr.type = GRUB_NET_LINK_LEVEL_PROTOCOL_ETHERNET;
+      grub_memcpy (sender_mac_addr.mac, arp_packet->sender_mac,
+		   sizeof (sender_mac_addr.mac));
+      grub_net_link_layer_add_address (card, &sender_addr, &sender_mac_addr,
+				       1);
+    }
 
   FOR_NET_NETWORK_LEVEL_INTERFACES (inf)
   {
@@ -24,6 +24,7 @@
 #include <grub/net/netbuff.h>
 #include <grub/net/udp.h>
 #include <grub/datetime.h>
+#include <grub/time.h>
 
 static void
 parse_dhcp_vendor (const char *name, const void *vend, int limit, int *mask)
@@ -260,9 +261,27 @@ grub_net_configure_by_dhcp_ack (const char *name,
   else
     grub_errno = GRUB_ERR_NONE;
 
+  /* The boot server is contacted next; start resolving its next hop so
+     that the reply is already cached when the first file is opened.  */
+  if (bp->server_ip)
+    {
+      grub_net_network_level_address_t server, gateway;
+      struct grub_net_network_level_interface *route_inf;
+
+      server.type = GRUB_NET_NETWORK_LEVEL_PROTOCOL_IPV4;
+      server.ipv4 = bp->server_ip;
+      if (grub_net_route_address (server, &gateway, &route_inf) == 0)
+	grub_net_link_layer_prefetch (route_inf, &gateway);
+      grub_errno = GRUB_ERR_NONE;
+    }
+
   return inter;
 }
 
+/* Set when a BOOTP reply configured a card, to cut the wait in
+   grub_cmd_bootp short.  */
+static int bootp_answered;
+
 void
 grub_net_process_dhcp (struct grub_net_buff *nb,
 		       struct grub_net_card *card)
@@ -284,6 +303,7 @@ grub_net_process_dhcp (struct grub_net_buff *nb,
     grub_print_error ();
   else
     {
+      bootp_answered = 1;
       FOR_NET_NETWORK_LEVEL_INTERFACES(inf)
 	if (grub_memcmp (inf->name, card->name, grub_strlen (card->name)) == 0
 	    && grub_memcmp (inf->name + grub_strlen (card->name),
@@ -421,6 +441,95 @@ grub_cmd_dhcpopt (struct grub_command *cmd __attribute__ ((unused)),
 		     args[3]);
 }
 
+/* Configure CARD from the DHCP ACK its firmware received while booting,
+   if it kept one, without asking the network again.  */
+static int
+configure_from_firmware (struct grub_net_card *card)
+{
+  const struct grub_net_bootp_packet *bp;
+  grub_size_t size = 0;
+  char *name;
+
+  if (!card->driver->cached_dhcp_ack)
+    return 0;
+  bp = card->driver->cached_dhcp_ack (card, &size);
+  if (!bp || size <= OFFSET_OF (vendor, bp) || bp->opcode != 2
+      || !bp->your_ip
+      || grub_memcmp (bp->mac_addr, card->default_address.mac, 6) != 0)
+    return 0;
+
+  name = grub_xasprintf ("%s:dhcp", card->name);
+  if (!name)
+    {
+      grub_errno = GRUB_ERR_NONE;
+      return 0;
+    }
+  grub_net_configure_by_dhcp_ack (name, card, 0, bp, size, 0, 0, 0);
+  grub_free (name);
+  if (grub_errno)
+    {
+      grub_errno = GRUB_ERR_NONE;
+      return 0;
+    }
+  grub_dprintf ("net", "%s: configured from the firmware's DHCP ACK\n",
+		card->name);
+  return 1;
+}
+
+static grub_err_t
+send_bootp_request (struct grub_net_network_level_interface *iface,
+		    grub_uint32_t xid, grub_uint16_t secs)
+{
+  struct grub_net_bootp_packet *pack;
+  struct grub_net_buff *nb;
+  struct udphdr *udph;
+  grub_net_network_level_address_t target;
+  grub_net_link_level_address_t ll_target;
+  grub_err_t err;
+
+  nb = grub_netbuff_alloc (sizeof (*pack) + 64 + 128);
+  if (!nb)
+    return grub_errno;
+  err = grub_netbuff_reserve (nb, sizeof (*pack) + 64 + 128);
+  if (err)
+    goto out;
+  err = grub_netbuff_push (nb, sizeof (*pack) + 64);
+  if (err)
+    goto out;
+  pack = (void *) nb->data;
+  grub_memset (pack, 0, sizeof (*pack) + 64);
+  pack->opcode = 1;
+  pack->hw_type = 1;
+  pack->hw_len = 6;
+  pack->ident = grub_cpu_to_be32 (xid);
+  pack->seconds = grub_cpu_to_be16 (secs);
+
+  grub_memcpy (&pack->mac_addr, &iface->hwaddress.mac, 6);
+
+  grub_netbuff_push (nb, sizeof (*udph));
+
+  udph = (struct udphdr *) nb->data;
+  udph->src = grub_cpu_to_be16_compile_time (68);
+  udph->dst = grub_cpu_to_be16_compile_time (67);
+  udph->chksum = 0;
+  udph->len = grub_cpu_to_be16 (nb->tail - nb->data);
+  target.type = GRUB_NET_NETWORK_LEVEL_PROTOCOL_IPV4;
+  target.ipv4 = 0xffffffff;
+  err = grub_net_link_layer_resolve (iface, &target, &ll_target);
+  if (err)
+    goto out;
+
+  udph->chksum = grub_net_ip_transport_checksum (nb, GRUB_NET_IP_UDP,
+						 &iface->address,
+						 &target);
+
+  err = grub_net_send_ip_packet (iface, &target, &ll_target, nb,
+				 GRUB_NET_IP_UDP);
+ out:
+  grub_netbuff_free (nb);
+  return err;
+}
+
 /* FIXME: allow to specify mac address.  */
 static grub_err_t
 grub_cmd_bootp (struct grub_command *cmd __attribute__ ((unused)),
@@ -428,30 +537,43 @@ grub_cmd_bootp (struct grub_command *cmd __attribute__ ((unused)),
 {
   struct grub_net_card *card;
   struct grub_net_network_level_interface *ifaces;
-  grub_size_t ncards = 0;
+  grub_size_t ncandidates = 0, ncards = 0, nconfigured = 0;
   unsigned j = 0;
   int interval;
-  grub_err_t err;
+  grub_err_t err = GRUB_ERR_NONE;
+  struct grub_datetime date;
+  grub_int32_t t = 0;
+  grub_uint32_t xid, seed;
+  grub_uint64_t start;
 
   FOR_NET_CARDS (card)
   {
     if (argc > 0 && grub_strcmp (card->name, args[0]) != 0)
       continue;
-    ncards++;
+    ncandidates++;
   }
 
-  if (ncards == 0)
+  if (ncandidates == 0)
     return grub_error (GRUB_ERR_NET_NO_CARD, N_("no network card found"));
 
-  ifaces = grub_zalloc (ncards * sizeof (ifaces[0]));
+  ifaces = grub_zalloc (ncandidates * sizeof (ifaces[0]));
   if (!ifaces)
     return grub_errno;
 
-  j = 0;
   FOR_NET_CARDS (card)
   {
     if (argc > 0 && grub_strcmp (card->name, args[0]) != 0)
       continue;
+    /* The fast path.  Without a card name, one configured card is
+       enough.  */
+    if (configure_from_firmware (card))
+      {
+	nconfigured++;
+	if (argc == 0)
+	  break;
+	continue;
+      }
+    j = ncards;
     ifaces[j].card = card;
     ifaces[j].next = &ifaces[j+1];
     if (j)
@@ -462,106 +584,94 @@ grub_cmd_bootp (struct grub_command *cmd __attribute__ ((unused)),
       {
 	unsigned i;
 	for (i = 0; i < j; i++)
-	  grub_free (ifaces[i].name);
+	  {
+	    grub_free (ifaces[i].name);
+	    ifaces[i].card->num_ifaces--;
+	  }
+	card->num_ifaces--;
 	grub_free (ifaces);
 	return grub_errno;
       }
     ifaces[j].address.type = GRUB_NET_NETWORK_LEVEL_PROTOCOL_DHCP_RECV;
     grub_memcpy (&ifaces[j].hwaddress, &card->default_address, 
 		 sizeof (ifaces[j].hwaddress));
-    j++;
+    ncards++;
   }
+
+  if (ncards == 0 || (argc == 0 && nconfigured))
+    {
+      for (j = 0; j < ncards; j++)
+	{
+	  grub_free (ifaces[j].name);
+	  ifaces[j].card->num_ifaces--;
+	}
+      grub_free (ifaces);
+      return GRUB_ERR_NONE;
+    }
+
   ifaces[ncards - 1].next = grub_net_network_level_interfaces;
   if (grub_net_network_level_interfaces)
     grub_net_network_level_interfaces->prev = & ifaces[ncards - 1].next;
   grub_net_network_level_interfaces = &ifaces[0];
   ifaces[0].prev = &grub_net_network_level_interfaces;
+
+  /* One transaction per card for the whole exchange (RFC 2131 4.1), and
+     its timing spread a little so that machines reset together don't
+     keep asking in step.  */
+  if (grub_get_datetime (&date) || !grub_datetime2unixtime (&date, &t))
+    {
+      grub_errno = GRUB_ERR_NONE;
+      t = 0;
+    }
+  start = grub_get_time_ms ();
+  seed = t ^ (grub_uint32_t) start;
+  for (j = 0; j < 6; j++)
+    seed = seed * 31 + ifaces[0].hwaddress.mac[j];
+  xid = seed;
+
+  /* Ask on every card at once and back off exponentially.  */
   for (interval = 200; interval < 10000; interval *= 2)
     {
-      int done = 0;
+      int pending = 0, answered = 0;
+      grub_uint16_t secs = (grub_get_time_ms () - start) / 1000;
+
       for (j = 0; j < ncards; j++)
-	{
-	  struct grub_net_bootp_packet *pack;
-	  struct grub_datetime date;
-	  grub_int32_t t = 0;
-	  struct grub_net_buff *nb;
-	  struct udphdr *udph;
-	  grub_net_network_level_address_t target;
-	  grub_net_link_level_address_t ll_target;
-
-	  if (!ifaces[j].prev)
-	    continue;
-	  nb = grub_netbuff_alloc (sizeof (*pack) + 64 + 128);
-	  if (!nb)
-	    {
-	      grub_netbuff_free (nb);
-	      return grub_errno;
-	    }
-	  err = grub_netbuff_reserve (nb, sizeof (*pack) + 64 + 128);
-	  if (err)
-	    {
-	      grub_netbuff_free (nb);
-	      return err;
-	    }
-	  err = grub_netbuff_push (nb, sizeof (*pack) + 64);
-	  if (err)
-	    {
-	      grub_netbuff_free (nb);
-	      return err;
-	    }
-	  pack = (void *) nb->data;
-	  done = 1;
-	  grub_memset (pack, 0, sizeof (*pack) + 64);
-	  pack->opcode = 1;
-	  pack->hw_type = 1;
-	  pack->hw_len = 6;
-	  err = grub_get_datetime (&date);
-	  if (err || !grub_datetime2unixtime (&date, &t))
-	    {
-	      grub_errno = GRUB_ERR_NONE;
-	      t = 0;
-	    }
-	  pack->ident = grub_cpu_to_be32 (t);
-	  pack->seconds = grub_cpu_to_be16 (t);
-
-	  grub_memcpy (&pack->mac_addr, &ifaces[j].hwaddress.mac, 6); 
-
-	  grub_netbuff_push (nb, sizeof (*udph));
-
-	  udph = (struct udphdr *) nb->data;
-	  udph->src = grub_cpu_to_be16_compile_time (68);
-	  udph->dst = grub_cpu_to_be16_compile_time (67);
-	  udph->chksum = 0;
-	  udph->len = grub_cpu_to_be16 (nb->tail - nb->data);
-	  target.type = GRUB_NET_NETWORK_LEVEL_PROTOCOL_IPV4;
-	  target.ipv4 = 0xffffffff;
-	  err = grub_net_link_layer_resolve (&ifaces[j], &target, &ll_target);
-	  if (err)
-	    return err;
-
-	  udph->chksum = grub_net_ip_transport_checksum (nb, GRUB_NET_IP_UDP,
-							 &ifaces[j].address,
-							 &target);
-
-	  err = grub_net_send_ip_packet (&ifaces[j], &target, &ll_target, nb,
-					 GRUB_NET_IP_UDP);
-	  grub_netbuff_free (nb);
-	  if (err)
-	    return err;
-	}
-      if (!done)
+	if (ifaces[j].prev)
+	  pending = 1;
+	else
+	  answered = 1;
+      if (!pending || (argc == 0 && answered))
 	break;
-      grub_net_poll_cards (interval, 0);
+
+      for (j = 0; j < ncards && !err; j++)
+	if (ifaces[j].prev)
+	  err = send_bootp_request (&ifaces[j], xid + j, secs);
+      if (err)
+	break;
+
+      seed = seed * 1103515245 + 12345;
+      bootp_answered = 0;
+      grub_net_poll_cards (interval - interval / 4
+			   + (seed >> 16) % (interval / 2 + 1),
+			   &bootp_answered);
     }
 
-  err = GRUB_ERR_NONE;
+  if (!err)
+    for (j = 0; j < ncards; j++)
+      if (!ifaces[j].prev)
+	nconfigured++;
+
   for (j = 0; j < ncards; j++)
     {
       grub_free (ifaces[j].name);
       if (!ifaces[j].prev)
 	continue;
-      grub_error_push ();
       grub_net_network_level_interface_unregister (&ifaces[j]);
+      /* Without a card name the first answer wins; the cards still
+	 waiting don't matter then.  */
+      if (err || (argc == 0 && nconfigured))
+	continue;
+      grub_error_push ();
       err = grub_error (GRUB_ERR_FILE_NOT_FOUND,
 			N_("couldn't autoconfigure %s"),
 			ifaces[j].card->name);
@@ -0,0 +1,457 @@
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2026  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Cache of downloaded files in a preallocated file on a local disk,
+   named by $net_cache.  GRUB cannot grow files, so the file is created
+   from the OS, e.g. with "fallocate -l 512M", and written in place
+   through its extents.  A file of zeroes is an empty cache.
+
+   Layout, in 512-byte sectors: a header, a table of NETCACHE_ENTRIES
+   entries of one sector each, then the bodies.  Bodies are stored one
+   after the other, wrapping around at the end, and a store drops the
+   entries whose bodies it overwrites.  Each entry holds the SHA-256 of
+   its body, which is checked on every hit, so that a store cut short
+   by a reset can't be served.  */
+
+#include <grub/net.h>
+#include <grub/file.h>
+#include <grub/disk.h>
+#include <grub/env.h>
+#include <grub/mm.h>
+#include <grub/misc.h>
+#include <grub/dl.h>
+#include <grub/crypto.h>
+#include <grub/i18n.h>
+
+GRUB_MOD_LICENSE ("GPLv3+");
+
+#define NETCACHE_MAGIC "GRUB net cache 1"
+#define NETCACHE_ENTRY_MAGIC "NCENTRY1"
+#define NETCACHE_ENTRIES 64
+#define NETCACHE_DATA_START (1 + NETCACHE_ENTRIES)
+#define NETCACHE_MAP_CHUNK 0x40000000
+
+struct netcache_header
+{
+  char magic[16];
+  /* Sector where the next body goes.  */
+  grub_uint64_t next;
+  /* Sequence number of the last entry stored.  */
+  grub_uint64_t seq;
+  grub_uint8_t unused[GRUB_DISK_SECTOR_SIZE - 32];
+} GRUB_PACKED;
+
+struct netcache_entry
+{
+  char magic[8];
+  grub_uint64_t start;
+  grub_uint64_t size;
+  grub_uint64_t seq;
+  grub_uint32_t encoding;
+  grub_uint32_t unused;
+  grub_uint8_t sha256[32];
+  char key[312];
+  char validator[128];
+} GRUB_PACKED;
+
+struct netcache_extent
+{
+  grub_off_t offset;
+  grub_size_t length;
+  grub_disk_addr_t sector;
+  grub_off_t sector_offset;
+};
+
+static struct
+{
+  char *path;
+  unsigned long generation;
+  grub_file_t file;
+  struct netcache_extent *extents;
+  grub_size_t nextents;
+  grub_size_t allocated;
+  grub_uint64_t sectors;
+  struct netcache_header header;
+  struct netcache_entry entries[NETCACHE_ENTRIES];
+} cache;
+
+static void
+cache_close (void)
+{
+  if (cache.file)
+    grub_file_close (cache.file);
+  grub_free (cache.path);
+  grub_free (cache.extents);
+  cache.file = NULL;
+  cache.path = NULL;
+  cache.extents = NULL;
+  cache.nextents = 0;
+  cache.allocated = 0;
+}
+
+static grub_err_t
+map_iter (const struct grub_fs_extent *extent,
+	  void *data __attribute__ ((unused)))
+{
+  struct netcache_extent *e;
+
+  if (extent->hole)
+    return grub_error (GRUB_ERR_BAD_FILE_TYPE, "sparse file not allowed");
+
+  if (cache.nextents == cache.allocated)
+    {
+      struct netcache_extent *n;
+
+      cache.allocated = cache.allocated ? cache.allocated * 2 : 16;
+      n = grub_realloc (cache.extents,
+			cache.allocated * sizeof (cache.extents[0]));
+      if (!n)
+	return grub_errno;
+      cache.extents = n;
+    }
+  e = &cache.extents[cache.nextents++];
+  e->offset = extent->offset;
+  e->length = extent->length;
+  e->sector = extent->sector;
+  e->sector_offset = extent->sector_offset;
+  return GRUB_ERR_NONE;
+}
+
+/* Read or write LEN bytes at SECTOR of the cache file, directly on its
+   disk.  */
+static grub_err_t
+cache_io (grub_uint64_t sector, void *buf, grub_size_t len, int write)
+{
+  grub_disk_t disk = cache.file->device->disk;
+  grub_off_t pos = sector << GRUB_DISK_SECTOR_BITS;
+  char *ptr = buf;
+  grub_size_t i;
+
+  for (i = 0; i < cache.nextents && len; i++)
+    {
+      struct netcache_extent *e = &cache.extents[i];
+      grub_size_t n;
+      grub_off_t off;
+
+      if (pos >= e->offset + e->length)
+	continue;
+      n = e->offset + e->length - pos;
+      if (n > len)
+	n = len;
+      off = e->sector_offset + (pos - e->offset);
+      if (write ? grub_disk_write (disk, e->sector, off, n, ptr)
+	  : grub_disk_read (disk, e->sector, off, n, ptr))
+	return grub_errno;
+      ptr += n;
+      pos += n;
+      len -= n;
+    }
+  if (len)
+    return grub_error (GRUB_ERR_OUT_OF_RANGE, "outside of the cache file");
+  return GRUB_ERR_NONE;
+}
+
+static grub_err_t
+cache_load (const char *path)
+{
+  grub_file_t file;
+  grub_off_t pos;
+  const char *p;
+
+  file = grub_file_open (path);
+  if (!file)
+    return grub_errno;
+  cache.file = file;
+  cache.path = grub_strdup (path);
+  if (!cache.path)
+    return grub_errno;
+  cache.generation = grub_disk_generation;
+
+  if (!file->device->disk || file->size == GRUB_FILE_SIZE_UNKNOWN)
+    return grub_error (GRUB_ERR_BAD_DEVICE, "disk device required");
+  cache.sectors = file->size >> GRUB_DISK_SECTOR_BITS;
+  if (cache.sectors <= NETCACHE_DATA_START)
+    return grub_error (GRUB_ERR_BAD_FILE_TYPE, "cache file too small");
+
+  for (pos = 0; pos < file->size; pos += NETCACHE_MAP_CHUNK)
+    {
+      grub_off_t len = file->size - pos;
+
+      if (len > NETCACHE_MAP_CHUNK)
+	len = NETCACHE_MAP_CHUNK;
+      if (grub_file_seek (file, pos) == (grub_off_t) -1
+	  || grub_file_map (file, len, map_iter, NULL))
+	return grub_errno;
+    }
+
+  if (cache_io (0, &cache.header, sizeof (cache.header), 0)
+      || cache_io (1, cache.entries, sizeof (cache.entries), 0))
+    return grub_errno;
+
+  if (grub_memcmp (cache.header.magic, NETCACHE_MAGIC,
+		   sizeof (cache.header.magic)) == 0)
+    return GRUB_ERR_NONE;
+
+  /* Only a file of zeroes is taken over.  */
+  for (p = (const char *) &cache.header;
+       p < (const char *) (&cache.header + 1); p++)
+    if (*p)
+      return grub_error (GRUB_ERR_BAD_FILE_TYPE,
+			 "`%s' is not a network cache file", path);
+
+  grub_memset (cache.entries, 0, sizeof (cache.entries));
+  grub_memcpy (cache.header.magic, NETCACHE_MAGIC,
+	       sizeof (cache.header.magic));
+  cache.header.next = grub_cpu_to_le64 (NETCACHE_DATA_START);
+  cache.header.seq = 0;
+  if (cache_io (1, cache.entries, sizeof (cache.entries), 1))
+    return grub_errno;
+  return cache_io (0, &cache.header, sizeof (cache.header), 1);
+}
+
+/* Return nonzero if the cache named by $net_cache is usable.  */
+static int
+cache_get (void)
+{
+  const char *path = grub_env_get ("net_cache");
+
+  if (!path || !*path)
+    {
+      cache_close ();
+      return 0;
+    }
+  if (cache.path && grub_strcmp (cache.path, path) == 0
+      && cache.generation == grub_disk_generation)
+    return cache.file != NULL;
+
+  cache_close ();
+  if (cache_load (path))
+    {
+      grub_dprintf ("net", "network cache disabled: %s\n", grub_errmsg);
+      grub_errno = GRUB_ERR_NONE;
+      /* Remember the failure until $net_cache changes.  */
+      cache_close ();
+      cache.path = grub_strdup (path);
+      cache.generation = grub_disk_generation;
+      grub_errno = GRUB_ERR_NONE;
+      return 0;
+    }
+  return 1;
+}
+
+static int
+entry_used (const struct netcache_entry *e)
+{
+  return grub_memcmp (e->magic, NETCACHE_ENTRY_MAGIC, sizeof (e->magic)) == 0;
+}
+
+static struct netcache_entry *
+find_entry (const char *key)
+{
+  int i;
+
+  for (i = 0; i < NETCACHE_ENTRIES; i++)
+    if (entry_used (&cache.entries[i])
+	&& grub_strncmp (cache.entries[i].key, key,
+			 sizeof (cache.entries[i].key)) == 0)
+      return &cache.entries[i];
+  return NULL;
+}
+
+static grub_err_t
+drop_entry (struct netcache_entry *e)
+{
+  grub_memset (e, 0, sizeof (*e));
+  return cache_io (1 + (e - cache.entries), e, sizeof (*e), 1);
+}
+
+static char *
+netcache_lookup (const char *key)
+{
+  struct netcache_entry *e;
+
+  if (!cache_get ())
+    return NULL;
+  e = find_entry (key);
+  if (!e)
+    return NULL;
+  return grub_strndup (e->validator, sizeof (e->validator));
+}
+
+static grub_err_t
+netcache_fetch (const char *key, char **buf_out, grub_size_t *size_out,
+		grub_net_content_encoding_t *encoding)
+{
+  const gcry_md_spec_t *hash;
+  grub_uint8_t digest[32];
+  struct netcache_entry *e;
+  grub_uint64_t size;
+  char *buf;
+
+  if (!cache_get ())
+    return grub_error (GRUB_ERR_IO, "no network cache");
+  e = find_entry (key);
+  if (!e)
+    return grub_error (GRUB_ERR_FILE_NOT_FOUND, "not in the cache");
+  hash = grub_crypto_lookup_md_by_name ("sha256");
+  if (!hash)
+    return grub_error (GRUB_ERR_BAD_MODULE, "no SHA-256 available");
+
+  size = grub_le_to_cpu64 (e->size);
+  if (size != (grub_size_t) size)
+    return grub_error (GRUB_ERR_OUT_OF_RANGE, "cached file too large");
+  buf = grub_malloc (size ? size : 1);
+  if (!buf)
+    return grub_errno;
+  if (cache_io (grub_le_to_cpu64 (e->start), buf, size, 0))
+    {
+      grub_free (buf);
+      return grub_errno;
+    }
+  grub_crypto_hash (hash, digest, buf, size);
+  if (grub_memcmp (digest, e->sha256, sizeof (digest)) != 0)
+    {
+      grub_free (buf);
+      if (drop_entry (e))
+	grub_errno = GRUB_ERR_NONE;
+      return grub_error (GRUB_ERR_BAD_SIGNATURE, "cached copy is corrupted");
+    }
+
+  *buf_out = buf;
+  *size_out = size;
+  *encoding = grub_le_to_cpu32 (e->encoding);
+  return GRUB_ERR_NONE;
+}
+
+static grub_uint64_t
+body_sectors (grub_uint64_t size)
+{
+  return (size + GRUB_DISK_SECTOR_SIZE - 1) >> GRUB_DISK_SECTOR_BITS;
+}
+
+static int
+netcache_fits (grub_uint64_t size)
+{
+  return (cache_get ()
+	  && body_sectors (size) <= cache.sectors - NETCACHE_DATA_START);
+}
+
+static void
+netcache_store (const char *key, const char *validator, const char *buf,
+		grub_size_t size, grub_net_content_encoding_t encoding)
+{
+  const gcry_md_spec_t *hash;
+  struct netcache_entry *e, *slot = NULL;
+  grub_uint64_t start, end, seq;
+  int i;
+
+  if (grub_strlen (key) >= sizeof (e->key)
+      || grub_strlen (validator) >= sizeof (e->validator)
+      || !netcache_fits (size))
+    return;
+  hash = grub_crypto_lookup_md_by_name ("sha256");
+  if (!hash)
+    {
+      grub_errno = GRUB_ERR_NONE;
+      return;
+    }
+
+  start = grub_le_to_cpu64 (cache.header.next);
+  if (start < NETCACHE_DATA_START || start >= cache.sectors
+      || body_sectors (size) > cache.sectors - start)
+    start = NETCACHE_DATA_START;
+  end = start + body_sectors (size);
+
+  /* Drop the old copy and whatever the new body overwrites.  */
+  for (i = 0; i < NETCACHE_ENTRIES; i++)
+    {
+      grub_uint64_t s, n;
+
+      e = &cache.entries[i];
+      if (!entry_used (e))
+	continue;
+      s = grub_le_to_cpu64 (e->start);
+      n = body_sectors (grub_le_to_cpu64 (e->size));
+      if ((grub_strncmp (e->key, key, sizeof (e->key)) == 0
+	   || (s < end && start < s + n))
+	  && drop_entry (e))
+	goto fail;
+    }
+
+  /* Take a free slot, or else the oldest entry's.  */
+  for (i = 0; i < NETCACHE_ENTRIES; i++)
+    {
+      e = &cache.entries[i];
+      if (!entry_used (e))
+	{
+	  slot = e;
+	  break;
+	}
+      if (!slot || grub_le_to_cpu64 (e->seq) < grub_le_to_cpu64 (slot->seq))
+	slot = e;
+    }
+  if (entry_used (slot) && drop_entry (slot))
+    goto fail;
+
+  if (cache_io (start, (void *) buf, size, 1))
+    goto fail;
+
+  seq = grub_le_to_cpu64 (cache.header.seq) + 1;
+  grub_memcpy (slot->magic, NETCACHE_ENTRY_MAGIC, sizeof (slot->magic));
+  slot->start = grub_cpu_to_le64 (start);
+  slot->size = grub_cpu_to_le64 (size);
+  slot->seq = grub_cpu_to_le64 (seq);
+  slot->encoding = grub_cpu_to_le32 (encoding);
+  grub_crypto_hash (hash, slot->sha256, buf, size);
+  grub_strcpy (slot->key, key);
+  grub_strcpy (slot->validator, validator);
+  if (cache_io (1 + (slot - cache.entries), slot, sizeof (*slot), 1))
+    goto fail;
+
+  cache.header.next = grub_cpu_to_le64 (end);
+  cache.header.seq = grub_cpu_to_le64 (seq);
+  if (cache_io (0, &cache.header, sizeof (cache.header), 1))
+    goto fail;
+  grub_dprintf ("net", "%s: stored in the cache\n", key);
+  return;
+
+ fail:
+  grub_dprintf ("net", "%s: not cached: %s\n", key, grub_errmsg);
+  grub_errno = GRUB_ERR_NONE;
+  /* What is on disk is unknown now.  */
+  cache_close ();
+}
+
+static struct grub_net_cache_ops netcache_ops =
+  {
+    .lookup = netcache_lookup,
+    .fetch = netcache_fetch,
+    .fits = netcache_fits,
+    .store = netcache_store
+  };
+
+GRUB_MOD_INIT(netcache)
+{
+  grub_net_cache = &netcache_ops;
+}
+
+GRUB_MOD_FINI(netcache)
+{
+  grub_net_cache = NULL;
+  cache_close ();
+}
@@ -22,6 +22,7 @@
 #include <grub/i18n.h>
 #include <grub/err.h>
 #include <grub/time.h>
+#include <grub/reclaim.h>
 
 struct dns_cache_element
 {
@@ -41,6 +42,46 @@ typedef enum grub_dns_qtype_id
   } grub_dns_qtype_id_t;
 
 static struct dns_cache_element dns_cache[DNS_CACHE_SIZE];
+
+static grub_size_t dns_cache_shrink (grub_size_t wanted);
+
+static struct grub_reclaim_cache dns_cache_reclaim =
+  {
+    .name = "dns",
+    .shrink = dns_cache_shrink
+  };
+
+static grub_size_t
+dns_cache_entry_size (const struct dns_cache_element *element)
+{
+  return grub_strlen (element->name) + 1
+    + element->naddresses * sizeof (element->addresses[0]);
+}
+
+static void
+dns_cache_drop (struct dns_cache_element *element)
+{
+  if (element->name && element->addresses)
+    dns_cache_reclaim.size -= dns_cache_entry_size (element);
+  grub_free (element->name);
+  element->name = 0;
+  grub_free (element->addresses);
+  element->addresses = 0;
+}
+
+/* Entries are copied out on lookup, so all of them can go at any time
+   except while they are being copied.  */
+static grub_size_t
+dns_cache_shrink (grub_size_t wanted __attribute__ ((unused)))
+{
+  grub_size_t freed = dns_cache_reclaim.size;
+  int h;
+
+  for (h = 0; h < DNS_CACHE_SIZE; h++)
+    dns_cache_drop (&dns_cache[h]);
+
+  return freed;
+}
 static struct grub_net_network_level_address *dns_servers;
 static grub_size_t dns_nservers, dns_servers_alloc;
 
@@ -391,10 +432,8 @@ recv_hook (grub_net_udp_socket_t sock __attribute__ ((unused)),
       int h;
       grub_dprintf ("dns", "caching for %d seconds\n", ttl_all);
       h = hash (data->oname);
-      grub_free (dns_cache[h].name);
-      dns_cache[h].name = 0;
-      grub_free (dns_cache[h].addresses);
-      dns_cache[h].addresses = 0;
+      dns_cache_reclaim.busy++;
+      dns_cache_drop (&dns_cache[h]);
       dns_cache[h].name = grub_strdup (data->oname);
       dns_cache[h].naddresses = *data->naddresses;
       dns_cache[h].addresses = grub_malloc (*data->naddresses
@@ -407,9 +446,15 @@ recv_hook (grub_net_udp_socket_t sock __attribute__ ((unused)),
 	  grub_free (dns_cache[h].addresses);
 	  dns_cache[h].addresses = 0;
 	}
-      grub_memcpy (dns_cache[h].addresses, *data->addresses,
-		   *data->naddresses
-		   * sizeof (dns_cache[h].addresses[0]));
+      else
+	{
+	  grub_memcpy (dns_cache[h].addresses, *data->addresses,
+		       *data->naddresses
+		       * sizeof (dns_cache[h].addresses[0]));
+	  dns_cache_reclaim.size += dns_cache_entry_size (&dns_cache[h]);
+	  grub_reclaim_touch (&dns_cache_reclaim);
+	}
+      dns_cache_reclaim.busy--;
     }
   grub_netbuff_free (nb);
   grub_free (redirect_save);
@@ -458,15 +503,19 @@ grub_net_dns_lookup (const char *name,
 	  && grub_get_time_ms () < dns_cache[h].limit_time)
 	{
 	  grub_dprintf ("dns", "retrieved from cache\n");
+	  dns_cache_reclaim.busy++;
+	  grub_reclaim_touch (&dns_cache_reclaim);
 	  *addresses = grub_malloc (dns_cache[h].naddresses
 				    * sizeof ((*addresses)[0]));
-	  if (!*addresses)
-	    return grub_errno;
-	  *naddresses = dns_cache[h].naddresses;
-	  grub_memcpy (*addresses, dns_cache[h].addresses,
-		       dns_cache[h].naddresses
-		       * sizeof ((*addresses)[0]));
-	  return GRUB_ERR_NONE;
+	  if (*addresses)
+	    {
+	      *naddresses = dns_cache[h].naddresses;
+	      grub_memcpy (*addresses, dns_cache[h].addresses,
+			   dns_cache[h].naddresses
+			   * sizeof ((*addresses)[0]));
+	    }
+	  dns_cache_reclaim.busy--;
+	  return *addresses ? GRUB_ERR_NONE : grub_errno;
 	}
     }
 
@@ -757,6 +806,7 @@ grub_dns_init (void)
 				   N_("Remove a DNS server"));
   cmd_list = grub_register_command ("net_ls_dns", grub_cmd_list_dns,
 				   NULL, N_("List DNS servers"));
+  grub_reclaim_register (&dns_cache_reclaim);
 }
 
 void
@@ -766,4 +816,5 @@ grub_dns_fini (void)
   grub_unregister_command (cmd_add);
   grub_unregister_command (cmd_del);
   grub_unregister_command (cmd_list);
+  grub_reclaim_unregister (&dns_cache_reclaim);
 }
@@ -91,48 +91,48 @@ send_card_buffer (struct grub_net_card *dev,
   return GRUB_ERR_NONE;
 }
 
+/* Receive one frame straight into a netbuff, so it isn't copied.  */
 static struct grub_net_buff *
 get_card_packet (struct grub_net_card *dev)
 {
   grub_efi_simple_network_t *net = dev->efi_net;
   grub_err_t err;
-  grub_efi_status_t st;
-  grub_efi_uintn_t bufsize = dev->rcvbufsize;
-  struct grub_net_buff *nb;
+  grub_efi_status_t st = GRUB_EFI_NOT_READY;
+  grub_efi_uintn_t bufsize;
+  struct grub_net_buff *nb = NULL;
   int i;
 
   for (i = 0; i < 2; i++)
     {
-      if (!dev->rcvbuf)
-	dev->rcvbuf = grub_malloc (dev->rcvbufsize);
-      if (!dev->rcvbuf)
+      nb = grub_netbuff_alloc (dev->rcvbufsize + 2);
+      if (!nb)
 	return NULL;
 
+      /* Reserve 2 bytes so that 2 + 14/18 bytes of ethernet header is
+	 divisible by 4. So that IP header is aligned on 4 bytes. */
+      if (grub_netbuff_reserve (nb, 2))
+	{
+	  grub_netbuff_free (nb);
+	  return NULL;
+	}
+
+      bufsize = dev->rcvbufsize;
       st = efi_call_7 (net->receive, net, NULL, &bufsize,
-		       dev->rcvbuf, NULL, NULL, NULL);
+		       nb->data, NULL, NULL, NULL);
       if (st != GRUB_EFI_BUFFER_TOO_SMALL)
 	break;
       dev->rcvbufsize = 2 * ALIGN_UP (dev->rcvbufsize > bufsize
 				      ? dev->rcvbufsize : bufsize, 64);
-      grub_free (dev->rcvbuf);
-      dev->rcvbuf = 0;
+      grub_netbuff_free (nb);
+      nb = NULL;
     }
 
   if (st != GRUB_EFI_SUCCESS)
-    return NULL;
-
-  nb = grub_netbuff_alloc (bufsize + 2);
-  if (!nb)
-    return NULL;
-
-  /* Reserve 2 bytes so that 2 + 14/18 bytes of ethernet header is divisible
-     by 4. So that IP header is aligned on 4 bytes. */
-  if (grub_netbuff_reserve (nb, 2))
     {
       grub_netbuff_free (nb);
       return NULL;
     }
-  grub_memcpy (nb->data, dev->rcvbuf, bufsize);
+
   err = grub_netbuff_put (nb, bufsize);
   if (err)
     {
@@ -143,6 +143,22 @@ get_card_packet (struct grub_net_card *dev)
   return nb;
 }
 
+/* Drain the frames the firmware has queued, up to MAX.  */
+static int
+get_card_packets (struct grub_net_card *dev, struct grub_net_buff **nbs,
+		  int max)
+{
+  int n;
+
+  for (n = 0; n < max; n++)
+    {
+      nbs[n] = get_card_packet (dev);
+      if (!nbs[n])
+	break;
+    }
+  return n;
+}
+
 static grub_err_t
 open_card (struct grub_net_card *dev)
 {
@@ -212,13 +228,132 @@ close_card (struct grub_net_card *dev)
 	      grub_efi_image_handle, dev->efi_handle);
 }
 
+/* open_card normally receives all multicast already; only firmware that
+   cannot do that needs the group in its filter list.  */
+static grub_err_t
+multicast_filter (struct grub_net_card *dev,
+		  const grub_net_link_level_address_t *addr, int join)
+{
+  grub_efi_simple_network_t *net = dev->efi_net;
+  grub_efi_mac_address_t list[ARRAY_SIZE (net->mode->mcast_filter)];
+  grub_efi_uintn_t count, i, n = 0;
+  grub_efi_status_t status;
+
+  if (net->mode->receive_filter_setting
+      & (GRUB_EFI_SIMPLE_NETWORK_RECEIVE_PROMISCUOUS_MULTICAST
+	 | GRUB_EFI_SIMPLE_NETWORK_RECEIVE_PROMISCUOUS))
+    return GRUB_ERR_NONE;
+  if (!(net->mode->receive_filter_mask
+	& GRUB_EFI_SIMPLE_NETWORK_RECEIVE_MULTICAST))
+    return grub_error (GRUB_ERR_IO, "%s: no multicast receive filter",
+		       dev->name);
+
+  count = net->mode->mcast_filter_count;
+  if (count > ARRAY_SIZE (list))
+    count = ARRAY_SIZE (list);
+  for (i = 0; i < count; i++)
+    if (grub_memcmp (net->mode->mcast_filter[i], addr->mac,
+		     sizeof (addr->mac)) != 0)
+      grub_memcpy (list[n++], net->mode->mcast_filter[i], sizeof (list[0]));
+  if (join)
+    {
+      if (n >= ARRAY_SIZE (list) || n >= net->mode->max_mcast_filter_count)
+	return grub_error (GRUB_ERR_OUT_OF_RANGE, "%s: multicast filter full",
+			   dev->name);
+      grub_memset (list[n], 0, sizeof (list[n]));
+      grub_memcpy (list[n], addr->mac, sizeof (addr->mac));
+      n++;
+    }
+
+  if (n)
+    status = efi_call_6 (net->receive_filters, net,
+			 GRUB_EFI_SIMPLE_NETWORK_RECEIVE_MULTICAST, 0, 0,
+			 n, list);
+  else
+    status = efi_call_6 (net->receive_filters, net, 0,
+			 GRUB_EFI_SIMPLE_NETWORK_RECEIVE_MULTICAST, 1, 0, NULL);
+  if (status != GRUB_EFI_SUCCESS)
+    return grub_error (GRUB_ERR_IO, "%s: couldn't set multicast filter",
+		       dev->name);
+  return GRUB_ERR_NONE;
+}
+
+/* The PXE base code running on DEV: either on its own handle or, as
+   EDK2 does it, on an IPv4 or IPv6 child of it.  */
+static struct grub_efi_pxe *
+card_pxe (struct grub_net_card *dev)
+{
+  grub_efi_device_path_t *cdp;
+  grub_efi_handle_t *handles;
+  grub_efi_uintn_t num_handles, i;
+  struct grub_efi_pxe *pxe = NULL;
+
+  cdp = grub_efi_get_device_path (dev->efi_handle);
+  if (!cdp)
+    return NULL;
+  handles = grub_efi_locate_handle (GRUB_EFI_BY_PROTOCOL, &pxe_io_guid,
+				    0, &num_handles);
+  if (!handles)
+    return NULL;
+
+  for (i = 0; i < num_handles && !pxe; i++)
+    {
+      grub_efi_device_path_t *dp, *ldp, *dup_dp, *dup_ldp;
+      int match;
+
+      dp = grub_efi_get_device_path (handles[i]);
+      if (!dp)
+	continue;
+      match = grub_efi_compare_device_paths (dp, cdp) == 0;
+      if (!match)
+	{
+	  ldp = grub_efi_find_last_device_path (dp);
+	  if (GRUB_EFI_DEVICE_PATH_TYPE (ldp)
+	      != GRUB_EFI_MESSAGING_DEVICE_PATH_TYPE
+	      || (GRUB_EFI_DEVICE_PATH_SUBTYPE (ldp)
+		  != GRUB_EFI_IPV4_DEVICE_PATH_SUBTYPE
+		  && GRUB_EFI_DEVICE_PATH_SUBTYPE (ldp)
+		  != GRUB_EFI_IPV6_DEVICE_PATH_SUBTYPE))
+	    continue;
+	  dup_dp = grub_efi_duplicate_device_path (dp);
+	  if (!dup_dp)
+	    continue;
+	  dup_ldp = grub_efi_find_last_device_path (dup_dp);
+	  dup_ldp->type = GRUB_EFI_END_DEVICE_PATH_TYPE;
+	  dup_ldp->subtype = GRUB_EFI_END_ENTIRE_DEVICE_PATH_SUBTYPE;
+	  dup_ldp->length = sizeof (*dup_ldp);
+	  match = grub_efi_compare_device_paths (dup_dp, cdp) == 0;
+	  grub_free (dup_dp);
+	}
+      if (match)
+	pxe = grub_efi_open_protocol (handles[i], &pxe_io_guid,
+				      GRUB_EFI_OPEN_PROTOCOL_GET_PROTOCOL);
+    }
+  grub_free (handles);
+  return pxe;
+}
+
+static const struct grub_net_bootp_packet *
+cached_dhcp_ack (struct grub_net_card *dev, grub_size_t *size)
+{
+  struct grub_efi_pxe *pxe = card_pxe (dev);
+
+  if (!pxe)
+    return NULL;
+  *size = sizeof (pxe->mode->dhcp_ack);
+  return (const struct grub_net_bootp_packet *) &pxe->mode->dhcp_ack;
+}
+
 static struct grub_net_card_driver efidriver =
   {
     .name = "efinet",
     .open = open_card,
     .close = close_card,
     .send = send_card_buffer,
-    .recv = get_card_packet
+    .recv = get_card_packet,
+    .recv_batch = get_card_packets,
+    .multicast_filter = multicast_filter,
+    .cached_dhcp_ack = cached_dhcp_ack
   };
 
 grub_efi_handle_t
@@ -320,6 +455,8 @@ grub_efinet_findcards (void)
       card->efi_handle = *handle;
 
       grub_net_card_register (card);
+      /* Let the idle loop wake up as soon as a packet comes in.  */
+      grub_efi_idle_add_event (net->wait_for_packet);
     }
   grub_free (handles);
 }
@@ -399,6 +536,9 @@ GRUB_MOD_FINI(efinet)
 
   FOR_NET_CARDS_SAFE (card, next) 
     if (card->driver == &efidriver)
-      grub_net_card_unregister (card);
+      {
+	grub_efi_idle_remove_event (card->efi_net->wait_for_packet);
+	grub_net_card_unregister (card);
+      }
 }
 
@@ -297,12 +297,21 @@ grub_pxe_open (struct grub_net_card *dev __attribute__ ((unused)))
   return GRUB_ERR_NONE;
 } 
 
+static const struct grub_net_bootp_packet *
+grub_pxe_cached_dhcp_ack (struct grub_net_card *dev __attribute__ ((unused)),
+			  grub_size_t *size)
+{
+  *size = GRUB_PXE_BOOTP_SIZE;
+  return grub_pxe_get_cached (GRUB_PXENV_PACKET_TYPE_DHCP_ACK);
+}
+
 struct grub_net_card_driver grub_pxe_card_driver =
 {
   .open = grub_pxe_open,
   .close = grub_pxe_close,
   .send = grub_pxe_send,
-  .recv = grub_pxe_recv
+  .recv = grub_pxe_recv,
+  .cached_dhcp_ack = grub_pxe_cached_dhcp_ack
 };
 
 struct grub_net_card grub_pxe_card =
@@ -0,0 +1,717 @@
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2026  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <grub/dl.h>
+#include <grub/net.h>
+#include <grub/net/netbuff.h>
+#include <grub/mm.h>
+#include <grub/time.h>
+#include <grub/pci.h>
+#include <grub/misc.h>
+#include <grub/i18n.h>
+
+GRUB_MOD_LICENSE ("GPLv3+");
+
+#define GRUB_VIRTIO_PCI_VENDOR 0x1af4
+#define GRUB_VIRTIO_PCI_NET_TRANSITIONAL 0x1000
+#define GRUB_VIRTIO_PCI_NET_MODERN 0x1041
+
+/* Vendor specific PCI capabilities locating the register blocks.  */
+#define GRUB_VIRTIO_PCI_CAP_ID 0x09
+
+enum
+  {
+    GRUB_VIRTIO_PCI_CAP_COMMON_CFG = 1,
+    GRUB_VIRTIO_PCI_CAP_NOTIFY_CFG = 2,
+    GRUB_VIRTIO_PCI_CAP_ISR_CFG = 3,
+    GRUB_VIRTIO_PCI_CAP_DEVICE_CFG = 4
+  };
+
+/* Common configuration registers.  */
+enum
+  {
+    GRUB_VIRTIO_COMMON_DFSELECT = 0x00,
+    GRUB_VIRTIO_COMMON_DF = 0x04,
+    GRUB_VIRTIO_COMMON_GFSELECT = 0x08,
+    GRUB_VIRTIO_COMMON_GF = 0x0c,
+    GRUB_VIRTIO_COMMON_STATUS = 0x14,
+    GRUB_VIRTIO_COMMON_Q_SELECT = 0x16,
+    GRUB_VIRTIO_COMMON_Q_SIZE = 0x18,
+    GRUB_VIRTIO_COMMON_Q_ENABLE = 0x1c,
+    GRUB_VIRTIO_COMMON_Q_NOFF = 0x1e,
+    GRUB_VIRTIO_COMMON_Q_DESC = 0x20,
+    GRUB_VIRTIO_COMMON_Q_AVAIL = 0x28,
+    GRUB_VIRTIO_COMMON_Q_USED = 0x30,
+    GRUB_VIRTIO_COMMON_SIZE = 0x38
+  };
+
+enum
+  {
+    GRUB_VIRTIO_STATUS_ACKNOWLEDGE = 0x01,
+    GRUB_VIRTIO_STATUS_DRIVER = 0x02,
+    GRUB_VIRTIO_STATUS_DRIVER_OK = 0x04,
+    GRUB_VIRTIO_STATUS_FEATURES_OK = 0x08,
+    GRUB_VIRTIO_STATUS_FAILED = 0x80
+  };
+
+#define GRUB_VIRTIO_NET_F_MAC (1ULL << 5)
+#define GRUB_VIRTIO_F_VERSION_1 (1ULL << 32)
+
+enum
+  {
+    GRUB_VIRTQ_DESC_F_WRITE = 2
+  };
+
+#define GRUB_VIRTQ_USED_F_NO_NOTIFY 1
+
+enum
+  {
+    GRUB_VIRTIONET_RX_QUEUE = 0,
+    GRUB_VIRTIONET_TX_QUEUE = 1
+  };
+
+/* Descriptors per queue; the device may allow fewer.  */
+#define GRUB_VIRTIONET_QUEUE_SIZE 64
+/* Every descriptor has a buffer of its own, large enough for the header
+   and a full ethernet frame with a VLAN tag.  */
+#define GRUB_VIRTIONET_BUF_SIZE 2048
+/* With VERSION_1 the header always has the num_buffers field.  */
+#define GRUB_VIRTIONET_HDR_SIZE 12
+#define GRUB_VIRTIONET_TIMEOUT 4000
+
+struct grub_virtq_desc
+{
+  grub_uint64_t addr;
+  grub_uint32_t len;
+  grub_uint16_t flags;
+  grub_uint16_t next;
+} GRUB_PACKED;
+
+struct grub_virtq_avail
+{
+  grub_uint16_t flags;
+  grub_uint16_t idx;
+  grub_uint16_t ring[0];
+} GRUB_PACKED;
+
+struct grub_virtq_used_elem
+{
+  grub_uint32_t id;
+  grub_uint32_t len;
+} GRUB_PACKED;
+
+struct grub_virtq_used
+{
+  grub_uint16_t flags;
+  grub_uint16_t idx;
+  struct grub_virtq_used_elem ring[0];
+} GRUB_PACKED;
+
+struct grub_virtionet_queue
+{
+  unsigned size;
+  struct grub_pci_dma_chunk *desc_chunk;
+  volatile struct grub_virtq_desc *desc;
+  struct grub_pci_dma_chunk *avail_chunk;
+  volatile struct grub_virtq_avail *avail;
+  struct grub_pci_dma_chunk *used_chunk;
+  volatile struct grub_virtq_used *used;
+  struct grub_pci_dma_chunk *bufs;
+  volatile grub_uint16_t *notify;
+  /* Our copies of the avail index published and the used index seen.  */
+  grub_uint16_t avail_idx;
+  grub_uint16_t used_idx;
+  /* Transmit descriptors the device has handed back.  */
+  grub_uint16_t free[GRUB_VIRTIONET_QUEUE_SIZE];
+  unsigned nfree;
+};
+
+struct grub_virtionet
+{
+  grub_pci_device_t dev;
+  volatile grub_uint8_t *common;
+  volatile grub_uint8_t *notify_base;
+  grub_uint32_t notify_mult;
+  volatile grub_uint8_t *device;
+  struct grub_virtionet_queue queues[2];
+};
+
+static grub_uint8_t
+grub_virtionet_read8 (struct grub_virtionet *vn, unsigned reg)
+{
+  return *(volatile grub_uint8_t *) (vn->common + reg);
+}
+
+static void
+grub_virtionet_write8 (struct grub_virtionet *vn, unsigned reg,
+		       grub_uint8_t val)
+{
+  *(volatile grub_uint8_t *) (vn->common + reg) = val;
+}
+
+static grub_uint16_t
+grub_virtionet_read16 (struct grub_virtionet *vn, unsigned reg)
+{
+  return grub_le_to_cpu16 (*(volatile grub_uint16_t *) (vn->common + reg));
+}
+
+static void
+grub_virtionet_write16 (struct grub_virtionet *vn, unsigned reg,
+			grub_uint16_t val)
+{
+  *(volatile grub_uint16_t *) (vn->common + reg) = grub_cpu_to_le16 (val);
+}
+
+static grub_uint32_t
+grub_virtionet_read32 (struct grub_virtionet *vn, unsigned reg)
+{
+  return grub_le_to_cpu32 (*(volatile grub_uint32_t *) (vn->common + reg));
+}
+
+static void
+grub_virtionet_write32 (struct grub_virtionet *vn, unsigned reg,
+			grub_uint32_t val)
+{
+  *(volatile grub_uint32_t *) (vn->common + reg) = grub_cpu_to_le32 (val);
+}
+
+static void
+grub_virtionet_write64 (struct grub_virtionet *vn, unsigned reg,
+			grub_uint64_t val)
+{
+  grub_virtionet_write32 (vn, reg, val);
+  grub_virtionet_write32 (vn, reg + 4, val >> 32);
+}
+
+static void
+grub_virtionet_set_status (struct grub_virtionet *vn, grub_uint8_t bits)
+{
+  grub_virtionet_write8 (vn, GRUB_VIRTIO_COMMON_STATUS,
+			 grub_virtionet_read8 (vn, GRUB_VIRTIO_COMMON_STATUS)
+			 | bits);
+}
+
+/* Stop the device and make it forget the queues.  */
+static grub_err_t
+grub_virtionet_reset (struct grub_virtionet *vn)
+{
+  grub_uint64_t endtime = grub_get_time_ms () + GRUB_VIRTIONET_TIMEOUT;
+
+  grub_virtionet_write8 (vn, GRUB_VIRTIO_COMMON_STATUS, 0);
+  while (grub_virtionet_read8 (vn, GRUB_VIRTIO_COMMON_STATUS))
+    if (grub_get_time_ms () > endtime)
+      return grub_error (GRUB_ERR_IO, "virtio-net device does not reset");
+  return GRUB_ERR_NONE;
+}
+
+/* Reset the device and agree on VERSION_1 and MAC with it.  */
+static grub_err_t
+grub_virtionet_negotiate (struct grub_virtionet *vn)
+{
+  grub_uint64_t features;
+
+  if (grub_virtionet_reset (vn))
+    return grub_errno;
+  grub_virtionet_set_status (vn, GRUB_VIRTIO_STATUS_ACKNOWLEDGE);
+  grub_virtionet_set_status (vn, GRUB_VIRTIO_STATUS_DRIVER);
+
+  grub_virtionet_write32 (vn, GRUB_VIRTIO_COMMON_DFSELECT, 0);
+  features = grub_virtionet_read32 (vn, GRUB_VIRTIO_COMMON_DF);
+  grub_virtionet_write32 (vn, GRUB_VIRTIO_COMMON_DFSELECT, 1);
+  features |= (grub_uint64_t) grub_virtionet_read32 (vn, GRUB_VIRTIO_COMMON_DF)
+    << 32;
+  if (!(features & GRUB_VIRTIO_F_VERSION_1) || !(features & GRUB_VIRTIO_NET_F_MAC))
+    {
+      grub_virtionet_set_status (vn, GRUB_VIRTIO_STATUS_FAILED);
+      return grub_error (GRUB_ERR_NOT_IMPLEMENTED_YET,
+			 "virtio-net device lacks VERSION_1 or MAC");
+    }
+
+  features = GRUB_VIRTIO_F_VERSION_1 | GRUB_VIRTIO_NET_F_MAC;
+  grub_virtionet_write32 (vn, GRUB_VIRTIO_COMMON_GFSELECT, 0);
+  grub_virtionet_write32 (vn, GRUB_VIRTIO_COMMON_GF, features);
+  grub_virtionet_write32 (vn, GRUB_VIRTIO_COMMON_GFSELECT, 1);
+  grub_virtionet_write32 (vn, GRUB_VIRTIO_COMMON_GF, features >> 32);
+
+  grub_virtionet_set_status (vn, GRUB_VIRTIO_STATUS_FEATURES_OK);
+  if (!(grub_virtionet_read8 (vn, GRUB_VIRTIO_COMMON_STATUS)
+	& GRUB_VIRTIO_STATUS_FEATURES_OK))
+    {
+      grub_virtionet_set_status (vn, GRUB_VIRTIO_STATUS_FAILED);
+      return grub_error (GRUB_ERR_IO, "virtio-net device rejected features");
+    }
+  return GRUB_ERR_NONE;
+}
+
+static void
+grub_virtionet_notify (struct grub_virtionet_queue *q, unsigned index)
+{
+  if (!(grub_le_to_cpu16 (q->used->flags) & GRUB_VIRTQ_USED_F_NO_NOTIFY))
+    *q->notify = grub_cpu_to_le16 (index);
+}
+
+static grub_uint32_t
+grub_virtionet_buf_phys (struct grub_virtionet_queue *q, unsigned id)
+{
+  return grub_dma_get_phys (q->bufs) + id * GRUB_VIRTIONET_BUF_SIZE;
+}
+
+static grub_uint8_t *
+grub_virtionet_buf (struct grub_virtionet_queue *q, unsigned id)
+{
+  return (grub_uint8_t *) grub_dma_get_virt (q->bufs)
+    + id * GRUB_VIRTIONET_BUF_SIZE;
+}
+
+/* Hand queue INDEX to the device.  */
+static grub_err_t
+grub_virtionet_setup_queue (struct grub_virtionet *vn, unsigned index)
+{
+  struct grub_virtionet_queue *q = &vn->queues[index];
+  unsigned i;
+
+  grub_virtionet_write16 (vn, GRUB_VIRTIO_COMMON_Q_SELECT, index);
+  if (grub_virtionet_read16 (vn, GRUB_VIRTIO_COMMON_Q_SIZE) < q->size)
+    return grub_error (GRUB_ERR_IO, "virtio-net queue %u shrank", index);
+  grub_virtionet_write16 (vn, GRUB_VIRTIO_COMMON_Q_SIZE, q->size);
+  grub_virtionet_write64 (vn, GRUB_VIRTIO_COMMON_Q_DESC,
+			  grub_dma_get_phys (q->desc_chunk));
+  grub_virtionet_write64 (vn, GRUB_VIRTIO_COMMON_Q_AVAIL,
+			  grub_dma_get_phys (q->avail_chunk));
+  grub_virtionet_write64 (vn, GRUB_VIRTIO_COMMON_Q_USED,
+			  grub_dma_get_phys (q->used_chunk));
+  q->notify = (volatile grub_uint16_t *)
+    (vn->notify_base
+     + grub_virtionet_read16 (vn, GRUB_VIRTIO_COMMON_Q_NOFF) * vn->notify_mult);
+
+  q->avail->flags = 0;
+  q->avail->idx = 0;
+  q->used->flags = 0;
+  q->used->idx = 0;
+  q->avail_idx = 0;
+  q->used_idx = 0;
+  q->nfree = 0;
+  for (i = 0; i < q->size; i++)
+    {
+      q->desc[i].addr = grub_cpu_to_le64 (grub_virtionet_buf_phys (q, i));
+      q->desc[i].next = 0;
+      if (index == GRUB_VIRTIONET_RX_QUEUE)
+	{
+	  /* Every receive buffer is posted up front.  */
+	  q->desc[i].len = grub_cpu_to_le32 (GRUB_VIRTIONET_BUF_SIZE);
+	  q->desc[i].flags = grub_cpu_to_le16 (GRUB_VIRTQ_DESC_F_WRITE);
+	  q->avail->ring[i] = grub_cpu_to_le16 (i);
+	}
+      else
+	{
+	  q->desc[i].len = 0;
+	  q->desc[i].flags = 0;
+	  q->free[q->nfree++] = i;
+	}
+    }
+  if (index == GRUB_VIRTIONET_RX_QUEUE)
+    {
+      q->avail_idx = q->size;
+      q->avail->idx = grub_cpu_to_le16 (q->avail_idx);
+    }
+
+  grub_virtionet_write16 (vn, GRUB_VIRTIO_COMMON_Q_ENABLE, 1);
+  return GRUB_ERR_NONE;
+}
+
+static grub_err_t
+grub_virtionet_open (struct grub_net_card *card)
+{
+  struct grub_virtionet *vn = card->data;
+
+  if (grub_virtionet_negotiate (vn)
+      || grub_virtionet_setup_queue (vn, GRUB_VIRTIONET_RX_QUEUE)
+      || grub_virtionet_setup_queue (vn, GRUB_VIRTIONET_TX_QUEUE))
+    {
+      grub_virtionet_reset (vn);
+      return grub_error (GRUB_ERR_NET_NO_CARD, "%s: %s", card->name,
+			 grub_errmsg);
+    }
+  grub_virtionet_set_status (vn, GRUB_VIRTIO_STATUS_DRIVER_OK);
+  grub_virtionet_notify (&vn->queues[GRUB_VIRTIONET_RX_QUEUE],
+			 GRUB_VIRTIONET_RX_QUEUE);
+  return GRUB_ERR_NONE;
+}
+
+/* Stopping the device is what makes it let go of the buffers, before the
+   OS boots or the module goes away.  */
+static void
+grub_virtionet_close (struct grub_net_card *card)
+{
+  struct grub_virtionet *vn = card->data;
+
+  if (grub_virtionet_reset (vn))
+    grub_errno = GRUB_ERR_NONE;
+}
+
+/* Take back the transmit descriptors the device has finished with.  */
+static void
+grub_virtionet_reclaim (struct grub_virtionet_queue *q)
+{
+  while (q->used_idx != grub_le_to_cpu16 (q->used->idx))
+    {
+      grub_uint32_t id;
+
+      id = grub_le_to_cpu32 (q->used->ring[q->used_idx % q->size].id);
+      q->used_idx++;
+      if (id < q->size && q->nfree < q->size)
+	q->free[q->nfree++] = id;
+    }
+}
+
+/* Queue the frame and return; the device sends it on its own time.  */
+static grub_err_t
+grub_virtionet_send (struct grub_net_card *card, struct grub_net_buff *pack)
+{
+  struct grub_virtionet *vn = card->data;
+  struct grub_virtionet_queue *q = &vn->queues[GRUB_VIRTIONET_TX_QUEUE];
+  grub_size_t len = pack->tail - pack->data;
+  grub_uint64_t endtime;
+  grub_uint8_t *buf;
+  unsigned id;
+
+  if (len > GRUB_VIRTIONET_BUF_SIZE - GRUB_VIRTIONET_HDR_SIZE)
+    return grub_error (GRUB_ERR_OUT_OF_RANGE,
+		       N_("couldn't send network packet"));
+
+  grub_virtionet_reclaim (q);
+  endtime = grub_get_time_ms () + GRUB_VIRTIONET_TIMEOUT;
+  while (!q->nfree)
+    {
+      if (grub_get_time_ms () > endtime)
+	return grub_error (GRUB_ERR_TIMEOUT,
+			   N_("couldn't send network packet"));
+      grub_virtionet_reclaim (q);
+    }
+
+  id = q->free[--q->nfree];
+  buf = grub_virtionet_buf (q, id);
+  grub_memset (buf, 0, GRUB_VIRTIONET_HDR_SIZE);
+  grub_memcpy (buf + GRUB_VIRTIONET_HDR_SIZE, pack->data, len);
+  q->desc[id].len = grub_cpu_to_le32 (GRUB_VIRTIONET_HDR_SIZE + len);
+
+  q->avail->ring[q->avail_idx % q->size] = grub_cpu_to_le16 (id);
+  q->avail_idx++;
+  q->avail->idx = grub_cpu_to_le16 (q->avail_idx);
+  grub_virtionet_notify (q, GRUB_VIRTIONET_TX_QUEUE);
+
+  return GRUB_ERR_NONE;
+}
+
+/* Copy up to MAX received frames into netbuffs and post their
+   descriptors again.  */
+static int
+grub_virtionet_recv_batch (struct grub_net_card *card,
+			   struct grub_net_buff **nbs, int max)
+{
+  struct grub_virtionet *vn = card->data;
+  struct grub_virtionet_queue *q = &vn->queues[GRUB_VIRTIONET_RX_QUEUE];
+  grub_uint16_t posted = q->avail_idx;
+  int n = 0, dropped = 0;
+
+  while (n < max && q->used_idx != grub_le_to_cpu16 (q->used->idx))
+    {
+      volatile struct grub_virtq_used_elem *elem;
+      struct grub_net_buff *nb;
+      grub_uint32_t id, len;
+
+      elem = &q->used->ring[q->used_idx % q->size];
+      id = grub_le_to_cpu32 (elem->id);
+      len = grub_le_to_cpu32 (elem->len);
+      q->used_idx++;
+      if (id >= q->size)
+	continue;
+
+      if (len > GRUB_VIRTIONET_HDR_SIZE && len <= GRUB_VIRTIONET_BUF_SIZE)
+	{
+	  len -= GRUB_VIRTIONET_HDR_SIZE;
+	  nb = grub_netbuff_alloc (len + 2);
+	  /* Reserve 2 bytes so that the IP header is aligned on 4 bytes.  */
+	  if (nb && (grub_netbuff_reserve (nb, 2) || grub_netbuff_put (nb, len)))
+	    {
+	      grub_netbuff_free (nb);
+	      nb = NULL;
+	    }
+	  if (nb)
+	    {
+	      grub_memcpy (nb->data,
+			   grub_virtionet_buf (q, id) + GRUB_VIRTIONET_HDR_SIZE,
+			   len);
+	      nbs[n++] = nb;
+	    }
+	  else
+	    dropped = 1;
+	}
+
+      q->avail->ring[q->avail_idx % q->size] = grub_cpu_to_le16 (id);
+      q->avail_idx++;
+      /* Out of memory: leave the rest queued for the next poll.  */
+      if (dropped)
+	break;
+    }
+
+  if (q->avail_idx != posted)
+    {
+      q->avail->idx = grub_cpu_to_le16 (q->avail_idx);
+      grub_virtionet_notify (q, GRUB_VIRTIONET_RX_QUEUE);
+    }
+  return n;
+}
+
+static struct grub_net_buff *
+grub_virtionet_recv (struct grub_net_card *card)
+{
+  struct grub_net_buff *nb;
+
+  if (grub_virtionet_recv_batch (card, &nb, 1))
+    return nb;
+  return NULL;
+}
+
+static struct grub_net_card_driver grub_virtionet_driver =
+  {
+    .name = "virtionet",
+    .open = grub_virtionet_open,
+    .close = grub_virtionet_close,
+    .send = grub_virtionet_send,
+    .recv = grub_virtionet_recv,
+    .recv_batch = grub_virtionet_recv_batch
+  };
+
+static void
+grub_virtionet_queue_free (struct grub_virtionet_queue *q)
+{
+  if (q->desc_chunk)
+    grub_dma_free (q->desc_chunk);
+  if (q->avail_chunk)
+    grub_dma_free (q->avail_chunk);
+  if (q->used_chunk)
+    grub_dma_free (q->used_chunk);
+  if (q->bufs)
+    grub_dma_free (q->bufs);
+}
+
+static grub_err_t
+grub_virtionet_queue_alloc (struct grub_virtionet *vn, unsigned index)
+{
+  struct grub_virtionet_queue *q = &vn->queues[index];
+  unsigned max;
+
+  grub_virtionet_write16 (vn, GRUB_VIRTIO_COMMON_Q_SELECT, index);
+  max = grub_virtionet_read16 (vn, GRUB_VIRTIO_COMMON_Q_SIZE);
+  if (!max)
+    return grub_error (GRUB_ERR_IO, "virtio-net queue %u missing", index);
+  q->size = max < GRUB_VIRTIONET_QUEUE_SIZE ? max : GRUB_VIRTIONET_QUEUE_SIZE;
+
+  q->desc_chunk = grub_memalign_dma32 (16, q->size
+				       * sizeof (struct grub_virtq_desc));
+  q->avail_chunk = grub_memalign_dma32 (2, sizeof (struct grub_virtq_avail)
+					+ (q->size + 1) * sizeof (grub_uint16_t));
+  q->used_chunk = grub_memalign_dma32 (4, sizeof (struct grub_virtq_used)
+				       + q->size
+				       * sizeof (struct grub_virtq_used_elem)
+				       + sizeof (grub_uint16_t));
+  q->bufs = grub_memalign_dma32 (GRUB_VIRTIONET_BUF_SIZE,
+				 q->size * GRUB_VIRTIONET_BUF_SIZE);
+  if (!q->desc_chunk || !q->avail_chunk || !q->used_chunk || !q->bufs)
+    return grub_errno;
+  q->desc = grub_dma_get_virt (q->desc_chunk);
+  q->avail = grub_dma_get_virt (q->avail_chunk);
+  q->used = grub_dma_get_virt (q->used_chunk);
+  return GRUB_ERR_NONE;
+}
+
+/* Map the part of a capability's BAR it points at.  */
+static volatile grub_uint8_t *
+grub_virtionet_map_cap (grub_pci_device_t dev, grub_uint8_t pos)
+{
+  grub_pci_address_t addr;
+  grub_uint32_t bar, offset, length;
+  grub_uint64_t base;
+  grub_uint8_t barno;
+
+  barno = grub_pci_read_byte (grub_pci_make_address (dev, pos + 4));
+  offset = grub_pci_read (grub_pci_make_address (dev, pos + 8));
+  length = grub_pci_read (grub_pci_make_address (dev, pos + 12));
+  if (barno > 5)
+    return NULL;
+
+  addr = grub_pci_make_address (dev, GRUB_PCI_REG_ADDRESS_REG0 + 4 * barno);
+  bar = grub_pci_read (addr);
+  if ((bar & GRUB_PCI_ADDR_SPACE_MASK) != GRUB_PCI_ADDR_SPACE_MEMORY)
+    return NULL;
+  base = bar & GRUB_PCI_ADDR_MEM_MASK;
+  if ((bar & GRUB_PCI_ADDR_MEM_TYPE_MASK) == GRUB_PCI_ADDR_MEM_TYPE_64
+      && barno < 5)
+    {
+      addr = grub_pci_make_address (dev, GRUB_PCI_REG_ADDRESS_REG0
+				    + 4 * (barno + 1));
+      base |= (grub_uint64_t) grub_pci_read (addr) << 32;
+    }
+  base += offset;
+#if GRUB_CPU_SIZEOF_VOID_P == 4
+  if ((base + length) >> 32)
+    return NULL;
+#endif
+
+  return grub_pci_device_map_range (dev, base, length);
+}
+
+/* Find the common, notify and device configuration blocks.  Only the
+   first capability of each type is used, as the specification asks.  */
+static int
+grub_virtionet_find_caps (grub_pci_device_t dev, struct grub_virtionet *vn)
+{
+  grub_uint8_t pos;
+  int ttl = 48;
+
+  pos = grub_pci_read_byte (grub_pci_make_address (dev,
+						   GRUB_PCI_REG_CAP_POINTER));
+  while (ttl-- && pos >= 0x40)
+    {
+      grub_uint8_t id, type;
+
+      pos &= ~3;
+      id = grub_pci_read_byte (grub_pci_make_address (dev, pos));
+      if (id == 0xff)
+	break;
+      if (id == GRUB_VIRTIO_PCI_CAP_ID)
+	{
+	  type = grub_pci_read_byte (grub_pci_make_address (dev, pos + 3));
+	  if (type == GRUB_VIRTIO_PCI_CAP_COMMON_CFG && !vn->common)
+	    vn->common = grub_virtionet_map_cap (dev, pos);
+	  else if (type == GRUB_VIRTIO_PCI_CAP_NOTIFY_CFG && !vn->notify_base)
+	    {
+	      vn->notify_base = grub_virtionet_map_cap (dev, pos);
+	      vn->notify_mult = grub_pci_read (grub_pci_make_address (dev,
+								      pos + 16));
+	    }
+	  else if (type == GRUB_VIRTIO_PCI_CAP_DEVICE_CFG && !vn->device)
+	    vn->device = grub_virtionet_map_cap (dev, pos);
+	}
+      pos = grub_pci_read_byte (grub_pci_make_address (dev, pos + 1));
+    }
+
+  return vn->common && vn->notify_base && vn->device;
+}
+
+static int numcards;
+
+static int
+grub_virtionet_pciinit (grub_pci_device_t dev, grub_pci_id_t pciid,
+			void *data __attribute__ ((unused)))
+{
+  grub_pci_address_t addr;
+  struct grub_virtionet *vn;
+  struct grub_net_card *card;
+  unsigned i;
+
+  if ((pciid & 0xffff) != GRUB_VIRTIO_PCI_VENDOR
+      || ((pciid >> 16) != GRUB_VIRTIO_PCI_NET_MODERN
+	  && (pciid >> 16) != GRUB_VIRTIO_PCI_NET_TRANSITIONAL))
+    return 0;
+
+  vn = grub_zalloc (sizeof (*vn));
+  if (!vn)
+    return 1;
+  vn->dev = dev;
+
+  if (!grub_virtionet_find_caps (dev, vn))
+    {
+      /* Legacy-only devices have no capabilities to drive them by.  */
+      grub_dprintf ("virtionet", "%x:%x.%x: no modern interface\n",
+		    dev.bus, dev.device, dev.function);
+      grub_free (vn);
+      return 0;
+    }
+
+  addr = grub_pci_make_address (dev, GRUB_PCI_REG_COMMAND);
+  grub_pci_write_word (addr, grub_pci_read_word (addr)
+		       | GRUB_PCI_COMMAND_MEM_ENABLED
+		       | GRUB_PCI_COMMAND_BUS_MASTER);
+
+  card = grub_zalloc (sizeof (*card));
+  if (!card)
+    goto fail;
+
+  if (grub_virtionet_negotiate (vn)
+      || grub_virtionet_queue_alloc (vn, GRUB_VIRTIONET_RX_QUEUE)
+      || grub_virtionet_queue_alloc (vn, GRUB_VIRTIONET_TX_QUEUE))
+    goto fail;
+
+  card->default_address.type = GRUB_NET_LINK_LEVEL_PROTOCOL_ETHERNET;
+  for (i = 0; i < sizeof (card->default_address.mac); i++)
+    card->default_address.mac[i] = vn->device[i];
+  /* Leave the device stopped until the card is opened.  */
+  grub_virtionet_reset (vn);
+
+  card->name = grub_xasprintf ("virtionet%d", numcards);
+  if (!card->name)
+    goto fail;
+  numcards++;
+  card->driver = &grub_virtionet_driver;
+  card->mtu = 1500;
+  card->data = vn;
+
+  grub_dprintf ("virtionet", "%x:%x.%x: %s, queues of %u and %u\n",
+		dev.bus, dev.device, dev.function, card->name,
+		vn->queues[GRUB_VIRTIONET_RX_QUEUE].size,
+		vn->queues[GRUB_VIRTIONET_TX_QUEUE].size);
+  grub_net_card_register (card);
+  return 0;
+
+ fail:
+  grub_dprintf ("virtionet", "%x:%x.%x: %s\n", dev.bus, dev.device,
+		dev.function, grub_errmsg);
+  grub_errno = GRUB_ERR_NONE;
+  grub_virtionet_reset (vn);
+  grub_errno = GRUB_ERR_NONE;
+  grub_virtionet_queue_free (&vn->queues[GRUB_VIRTIONET_RX_QUEUE]);
+  grub_virtionet_queue_free (&vn->queues[GRUB_VIRTIONET_TX_QUEUE]);
+  grub_free (vn);
+  grub_free (card);
+  return 0;
+}
+
+GRUB_MOD_INIT(virtionet)
+{
+  grub_pci_iterate (grub_virtionet_pciinit, NULL);
+}
+
+GRUB_MOD_FINI(virtionet)
+{
+  struct grub_net_card *card, *next;
+
+  FOR_NET_CARDS_SAFE (card, next)
+    if (card->driver == &grub_virtionet_driver)
+      {
+	struct grub_virtionet *vn = card->data;
+
+	grub_net_card_unregister (card);
+	grub_virtionet_queue_free (&vn->queues[GRUB_VIRTIONET_RX_QUEUE]);
+	grub_virtionet_queue_free (&vn->queues[GRUB_VIRTIONET_TX_QUEUE]);
+	grub_free (vn);
+	grub_free ((char *) card->name);
+	grub_free (card);
+      }
+}
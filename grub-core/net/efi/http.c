@@ -0,0 +1,532 @@
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2026  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* HTTP and HTTPS through the firmware's EFI_HTTP_PROTOCOL.  When the
+   firmware has no usable HTTP stack, files are handed to the http module
+   instead.  */
+
+#include <grub/misc.h>
+#include <grub/net.h>
+#include <grub/net/netbuff.h>
+#include <grub/mm.h>
+#include <grub/dl.h>
+#include <grub/file.h>
+#include <grub/time.h>
+#include <grub/charset.h>
+#include <grub/i18n.h>
+#include <grub/efi/api.h>
+#include <grub/efi/efi.h>
+#include <grub/efi/http.h>
+
+GRUB_MOD_LICENSE ("GPLv3+");
+
+enum
+  {
+    EFIHTTP_CHUNK = 65536,
+    EFIHTTP_TIMEOUT = GRUB_NET_TRIES * GRUB_NET_INTERVAL
+  };
+
+static grub_efi_guid_t http_sb_guid = GRUB_EFI_HTTP_SERVICE_BINDING_PROTOCOL_GUID;
+static grub_efi_guid_t http_guid = GRUB_EFI_HTTP_PROTOCOL_GUID;
+
+typedef struct efihttp_data
+{
+  grub_efi_service_binding_t *sb;
+  grub_efi_handle_t child;
+  grub_efi_http_t *http;
+  grub_efi_event_t event;
+  char *filename;
+  int have_length;
+  grub_off_t remaining;
+} *efihttp_data_t;
+
+static grub_err_t efihttp_open (struct grub_file *file, const char *filename);
+
+static int
+is_https (grub_file_t file)
+{
+  return grub_strcmp (file->device->net->protocol->name, "https") == 0;
+}
+
+static void
+efihttp_stop (efihttp_data_t data)
+{
+  grub_efi_boot_services_t *b = grub_efi_system_table->boot_services;
+
+  if (data->http)
+    efi_call_2 (data->http->cancel, data->http, NULL);
+  if (data->child)
+    {
+      efi_call_4 (b->close_protocol, data->child, &http_guid,
+		  grub_efi_image_handle, data->child);
+      efi_call_2 (data->sb->destroy_child, data->sb, data->child);
+    }
+  if (data->event)
+    efi_call_1 (b->close_event, data->event);
+  data->http = 0;
+  data->child = 0;
+  data->event = 0;
+}
+
+/* Create and configure an HTTP child on the first NIC that offers one.  */
+static grub_err_t
+efihttp_start (grub_file_t file, efihttp_data_t data)
+{
+  grub_efi_boot_services_t *b = grub_efi_system_table->boot_services;
+  grub_efi_httpv4_access_point_t v4 = { .use_default_address = 1 };
+  grub_efi_httpv6_access_point_t v6 = { .local_port = 0 };
+  grub_efi_http_config_data_t config = {
+    .http_version = GRUB_EFI_HTTPVERSION11,
+    .timeout_millisec = EFIHTTP_TIMEOUT
+  };
+  grub_efi_handle_t *handles;
+  grub_efi_uintn_t num_handles, i;
+  grub_efi_status_t st;
+
+  if (grub_strchr (file->device->net->server, ':'))
+    {
+      config.local_address_is_ipv6 = 1;
+      config.access_point.ipv6_node = &v6;
+    }
+  else
+    config.access_point.ipv4_node = &v4;
+
+  handles = grub_efi_locate_handle (GRUB_EFI_BY_PROTOCOL, &http_sb_guid,
+				    0, &num_handles);
+  if (!handles)
+    return grub_error (GRUB_ERR_NET_NO_CARD,
+		       "no firmware HTTP service available");
+
+  for (i = 0; i < num_handles; i++)
+    {
+      data->sb = grub_efi_open_protocol (handles[i], &http_sb_guid,
+					 GRUB_EFI_OPEN_PROTOCOL_GET_PROTOCOL);
+      if (!data->sb)
+	continue;
+      data->child = 0;
+      st = efi_call_2 (data->sb->create_child, data->sb, &data->child);
+      if (st != GRUB_EFI_SUCCESS)
+	{
+	  data->child = 0;
+	  continue;
+	}
+      data->http = grub_efi_open_protocol (data->child, &http_guid,
+					   GRUB_EFI_OPEN_PROTOCOL_GET_PROTOCOL);
+      if (data->http)
+	{
+	  st = efi_call_2 (data->http->configure, data->http, &config);
+	  if (st == GRUB_EFI_SUCCESS || st == GRUB_EFI_ALREADY_STARTED)
+	    break;
+	}
+      efihttp_stop (data);
+    }
+  grub_free (handles);
+
+  if (!data->http)
+    return grub_error (GRUB_ERR_NET_NO_CARD,
+		       "no firmware HTTP service available");
+
+  st = efi_call_5 (b->create_event, 0, 0, NULL, NULL, &data->event);
+  if (st != GRUB_EFI_SUCCESS)
+    {
+      data->event = 0;
+      efihttp_stop (data);
+      return grub_error (GRUB_ERR_OUT_OF_MEMORY, "couldn't create event");
+    }
+  return GRUB_ERR_NONE;
+}
+
+static grub_efi_status_t
+efihttp_wait (efihttp_data_t data, grub_efi_http_token_t *token)
+{
+  grub_efi_boot_services_t *b = grub_efi_system_table->boot_services;
+  grub_uint64_t limit = grub_get_time_ms () + EFIHTTP_TIMEOUT;
+  grub_efi_status_t st;
+
+  while (1)
+    {
+      st = efi_call_1 (b->check_event, token->event);
+      if (st != GRUB_EFI_NOT_READY)
+	break;
+      efi_call_1 (data->http->poll, data->http);
+      if (grub_get_time_ms () > limit)
+	{
+	  efi_call_2 (data->http->cancel, data->http, token);
+	  return GRUB_EFI_TIMEOUT;
+	}
+    }
+  return token->status;
+}
+
+static void
+efihttp_free_headers (grub_efi_http_message_t *message)
+{
+  grub_efi_boot_services_t *b = grub_efi_system_table->boot_services;
+  grub_efi_uintn_t i;
+
+  if (!message->headers)
+    return;
+  for (i = 0; i < message->header_count; i++)
+    {
+      if (message->headers[i].field_name)
+	efi_call_1 (b->free_pool, message->headers[i].field_name);
+      if (message->headers[i].field_value)
+	efi_call_1 (b->free_pool, message->headers[i].field_value);
+    }
+  efi_call_1 (b->free_pool, message->headers);
+  message->headers = 0;
+  message->header_count = 0;
+}
+
+/* Receive the next piece of the body into the packet list.  RSP is set
+   for the first call after a request, to collect the status and
+   headers too.  */
+static grub_err_t
+efihttp_receive (grub_file_t file, grub_efi_http_response_data_t *rsp,
+		 grub_efi_http_message_t *message)
+{
+  efihttp_data_t data = file->data;
+  grub_efi_http_token_t token = { .event = data->event, .message = message };
+  struct grub_net_buff *nb;
+  grub_efi_status_t st;
+  grub_err_t err;
+
+  nb = grub_netbuff_alloc (EFIHTTP_CHUNK);
+  if (!nb)
+    return grub_errno;
+
+  message->data.response = rsp;
+  message->body = nb->data;
+  message->body_length = EFIHTTP_CHUNK;
+  if (data->have_length && data->remaining < EFIHTTP_CHUNK)
+    message->body_length = data->remaining;
+
+  st = efi_call_2 (data->http->response, data->http, &token);
+  if (st == GRUB_EFI_SUCCESS)
+    st = efihttp_wait (data, &token);
+
+  if (st == GRUB_EFI_CONNECTION_FIN && !rsp)
+    {
+      grub_netbuff_free (nb);
+      file->device->net->eof = 1;
+      if (data->have_length && data->remaining)
+	return grub_error (GRUB_ERR_FILE_READ_ERROR,
+			   N_("premature end of file %s"), data->filename);
+      return GRUB_ERR_NONE;
+    }
+  if (st != GRUB_EFI_SUCCESS)
+    {
+      grub_netbuff_free (nb);
+      return grub_error (GRUB_ERR_NET_UNKNOWN_ERROR,
+			 "firmware HTTP receive failed: 0x%" PRIxGRUB_SIZE,
+			 (grub_size_t) st);
+    }
+
+  if (!message->body_length)
+    {
+      grub_netbuff_free (nb);
+      return GRUB_ERR_NONE;
+    }
+  err = grub_netbuff_put (nb, message->body_length);
+  if (err)
+    {
+      grub_netbuff_free (nb);
+      return err;
+    }
+  if (data->have_length)
+    {
+      data->remaining -= message->body_length;
+      if (!data->remaining)
+	file->device->net->eof = 1;
+    }
+  return grub_net_put_packet (&file->device->net->packs, nb);
+}
+
+static char *
+efihttp_url (grub_file_t file, efihttp_data_t data)
+{
+  const char *server = file->device->net->server;
+
+  if (grub_strchr (server, ':'))
+    return grub_xasprintf ("%s://[%s]%s", is_https (file) ? "https" : "http",
+			   server, data->filename);
+  return grub_xasprintf ("%s://%s%s", is_https (file) ? "https" : "http",
+			 server, data->filename);
+}
+
+/* Send the GET for the file from OFFSET and read the response headers.  */
+static grub_err_t
+efihttp_request (grub_file_t file, grub_off_t offset, int initial)
+{
+  efihttp_data_t data = file->data;
+  char range[sizeof ("bytes=XXXXXXXXXXXXXXXXXXXX-")];
+  grub_efi_http_header_t headers[] = {
+    { (grub_efi_char8_t *) "Host",
+      (grub_efi_char8_t *) file->device->net->server },
+    { (grub_efi_char8_t *) "User-Agent",
+      (grub_efi_char8_t *) PACKAGE_STRING },
+    { (grub_efi_char8_t *) "Range", (grub_efi_char8_t *) range }
+  };
+  grub_efi_http_request_data_t req = { .method = GRUB_EFI_HTTPMETHODGET };
+  grub_efi_http_message_t message = {
+    .data.request = &req,
+    .header_count = initial ? 2 : 3,
+    .headers = headers
+  };
+  grub_efi_http_token_t token = { .event = data->event, .message = &message };
+  grub_efi_http_response_data_t rsp = { 0 };
+  grub_efi_http_message_t rsp_message = { .body = NULL };
+  grub_efi_status_t st;
+  grub_efi_uintn_t i;
+  char *url;
+  grub_size_t len;
+  grub_err_t err;
+
+  grub_snprintf (range, sizeof (range), "bytes=%" PRIuGRUB_UINT64_T "-",
+		 offset);
+
+  url = efihttp_url (file, data);
+  if (!url)
+    return grub_errno;
+  len = grub_strlen (url);
+  req.url = grub_malloc ((len + 1) * sizeof (req.url[0]));
+  if (!req.url)
+    {
+      grub_free (url);
+      return grub_errno;
+    }
+  len = grub_utf8_to_utf16 (req.url, len, (grub_uint8_t *) url, len, NULL);
+  req.url[len] = 0;
+  grub_free (url);
+
+  st = efi_call_2 (data->http->request, data->http, &token);
+  if (st == GRUB_EFI_SUCCESS)
+    st = efihttp_wait (data, &token);
+  grub_free (req.url);
+  if (st != GRUB_EFI_SUCCESS)
+    return grub_error (GRUB_ERR_NET_NO_ANSWER,
+		       "firmware HTTP request failed: 0x%" PRIxGRUB_SIZE,
+		       (grub_size_t) st);
+
+  err = efihttp_receive (file, &rsp, &rsp_message);
+  if (err)
+    {
+      efihttp_free_headers (&rsp_message);
+      return err;
+    }
+
+  switch (rsp.status_code)
+    {
+    case GRUB_EFI_HTTP_STATUS_200_OK:
+    case GRUB_EFI_HTTP_STATUS_206_PARTIAL_CONTENT:
+      break;
+    case GRUB_EFI_HTTP_STATUS_404_NOT_FOUND:
+      efihttp_free_headers (&rsp_message);
+      return grub_error (GRUB_ERR_FILE_NOT_FOUND, N_("file `%s' not found"),
+			 data->filename);
+    default:
+      efihttp_free_headers (&rsp_message);
+      return grub_error (GRUB_ERR_NET_UNKNOWN_ERROR,
+			 N_("unsupported HTTP error %d: %s"),
+			 (int) rsp.status_code, data->filename);
+    }
+
+  for (i = 0; i < rsp_message.header_count; i++)
+    if (grub_strcasecmp ((char *) rsp_message.headers[i].field_name,
+			 "Content-Length") == 0)
+      {
+	grub_off_t length;
+
+	length = grub_strtoull ((char *) rsp_message.headers[i].field_value,
+				0, 10);
+	if (grub_errno)
+	  {
+	    grub_errno = GRUB_ERR_NONE;
+	    break;
+	  }
+	if (initial)
+	  file->size = length;
+	/* The first piece of the body was read before the length was known.  */
+	data->have_length = 1;
+	data->remaining = length - rsp_message.body_length;
+	if (!data->remaining)
+	  file->device->net->eof = 1;
+	break;
+      }
+  efihttp_free_headers (&rsp_message);
+  return GRUB_ERR_NONE;
+}
+
+/* The GRUB stack owns the card once it has opened it, and the firmware
+   stack is then gone.  Pass the file on to the http module.  */
+static grub_err_t
+efihttp_fallback (struct grub_file *file, const char *filename)
+{
+  grub_net_app_level_t proto;
+  const char *name = file->device->net->protocol->name;
+  int try;
+
+  grub_errno = GRUB_ERR_NONE;
+  for (try = 0; try < 2; try++)
+    {
+      FOR_NET_APP_LEVEL (proto)
+	if (proto->open != efihttp_open && grub_strcmp (proto->name, name) == 0)
+	  {
+	    file->device->net->protocol = proto;
+	    return proto->open (file, filename);
+	  }
+      grub_dl_load ("http");
+      grub_errno = GRUB_ERR_NONE;
+    }
+  return grub_error (GRUB_ERR_NET_NO_CARD,
+		     "no firmware HTTP service available");
+}
+
+static grub_err_t
+efihttp_open (struct grub_file *file, const char *filename)
+{
+  efihttp_data_t data;
+  grub_err_t err;
+
+  data = grub_zalloc (sizeof (*data));
+  if (!data)
+    return grub_errno;
+  data->filename = grub_strdup (filename);
+  if (!data->filename)
+    {
+      grub_free (data);
+      return grub_errno;
+    }
+
+  file->size = GRUB_FILE_SIZE_UNKNOWN;
+  file->not_easily_seekable = 0;
+  file->data = data;
+  /* Data is fetched from packets_pulled; keep the read loop from polling
+     the cards, which would take the NIC away from the firmware.  */
+  file->device->net->stall = 1;
+
+  err = efihttp_start (file, data);
+  if (!err)
+    {
+      err = efihttp_request (file, 0, 1);
+      if (err)
+	efihttp_stop (data);
+      /* An answer from the server is final.  Only fall back when the
+	 firmware couldn't get the request out.  */
+      if (err && err != GRUB_ERR_NET_NO_ANSWER)
+	{
+	  grub_free (data->filename);
+	  grub_free (data);
+	  file->data = 0;
+	  return err;
+	}
+    }
+  if (err)
+    {
+      grub_free (data->filename);
+      grub_free (data);
+      file->data = 0;
+      file->device->net->stall = 0;
+      return efihttp_fallback (file, filename);
+    }
+  return GRUB_ERR_NONE;
+}
+
+static grub_err_t
+efihttp_seek (struct grub_file *file, grub_off_t off)
+{
+  efihttp_data_t data = file->data;
+  grub_err_t err;
+
+  while (file->device->net->packs.first)
+    {
+      grub_netbuff_free (file->device->net->packs.first->nb);
+      grub_net_remove_packet (file->device->net->packs.first);
+    }
+  file->device->net->offset = off;
+  file->device->net->eof = 0;
+
+  /* Start over on a new child rather than leave the firmware with a
+     half-read response.  */
+  efihttp_stop (data);
+  data->have_length = 0;
+  err = efihttp_start (file, data);
+  if (!err)
+    err = efihttp_request (file, off, 0);
+  return err;
+}
+
+static grub_err_t
+efihttp_close (struct grub_file *file)
+{
+  efihttp_data_t data = file->data;
+
+  if (!data)
+    return GRUB_ERR_NONE;
+  efihttp_stop (data);
+  grub_free (data->filename);
+  grub_free (data);
+  file->data = 0;
+  return GRUB_ERR_NONE;
+}
+
+static grub_err_t
+efihttp_packets_pulled (struct grub_file *file)
+{
+  efihttp_data_t data = file->data;
+  grub_efi_http_message_t message = { .body = NULL };
+
+  if (!data || !data->http || file->device->net->packs.first
+      || file->device->net->eof)
+    return GRUB_ERR_NONE;
+
+  if (efihttp_receive (file, NULL, &message))
+    file->device->net->eof = 1;
+  efihttp_free_headers (&message);
+  return GRUB_ERR_NONE;
+}
+
+static struct grub_net_app_protocol grub_efihttp_protocol =
+  {
+    .name = "http",
+    .open = efihttp_open,
+    .close = efihttp_close,
+    .seek = efihttp_seek,
+    .packets_pulled = efihttp_packets_pulled
+  };
+
+static struct grub_net_app_protocol grub_efihttps_protocol =
+  {
+    .name = "https",
+    .open = efihttp_open,
+    .close = efihttp_close,
+    .seek = efihttp_seek,
+    .packets_pulled = efihttp_packets_pulled
+  };
+
+GRUB_MOD_INIT (efihttp)
+{
+  grub_net_app_level_register (&grub_efihttp_protocol);
+  grub_net_app_level_register (&grub_efihttps_protocol);
+}
+
+GRUB_MOD_FINI (efihttp)
+{
+  grub_net_app_level_unregister (&grub_efihttps_protocol);
+  grub_net_app_level_unregister (&grub_efihttp_protocol);
+}
@@ -76,7 +76,15 @@ send_ethernet_packet (struct grub_net_network_level_interface *inf,
 	return err;
       inf->card->opened = 1;
     }
-  return inf->card->driver->send (inf->card, nb);
+  err = inf->card->driver->send (inf->card, nb);
+  if (err)
+    inf->card->stats.tx_errors++;
+  else
+    {
+      inf->card->stats.tx_packets++;
+      inf->card->stats.tx_bytes += nb->tail - nb->data;
+    }
+  return err;
 }
 
 grub_err_t
@@ -21,6 +21,7 @@
 #include <grub/net/ip.h>
 #include <grub/net/ethernet.h>
 #include <grub/net/netbuff.h>
+#include <grub/net/tls.h>
 #include <grub/net.h>
 #include <grub/mm.h>
 #include <grub/dl.h>
@@ -31,9 +32,27 @@ GRUB_MOD_LICENSE ("GPLv3+");
 
 enum
   {
-    HTTP_PORT = 80
+    HTTP_PORT = 80,
+    HTTPS_PORT = 443
   };
 
+/* A TCP connection to an HTTP server.  It is bound to the file whose
+   response it carries and, once that response has been read completely,
+   kept open for the next request to the same server.  */
+struct http_conn
+{
+  struct http_conn *next;
+  char *server;
+  grub_net_tcp_socket_t sock;
+  /* TLS session on top of SOCK for https.  */
+  grub_net_tls_t tls;
+  /* Data arrived while idle; free once the TLS layer has returned.  */
+  int stale;
+  grub_file_t file;
+};
+
+static struct http_conn *idle_conns;
+static struct grub_net_app_protocol grub_https_protocol;
 
 typedef struct http_data
 {
@@ -42,13 +61,18 @@ typedef struct http_data
   int headers_recv;
   int first_line_recv;
   int size_recv;
-  grub_net_tcp_socket_t sock;
+  struct http_conn *conn;
   char *filename;
   grub_err_t err;
   char *errmsg;
   int chunked;
   grub_size_t chunk_rem;
   int in_chunk_len;
+  int have_length;
+  grub_off_t body_rem;
+  /* The whole response has been received.  */
+  int done;
+  int conn_close;
 } *http_data_t;
 
 static grub_off_t
@@ -62,6 +86,75 @@ have_ahead (struct grub_file *file)
   return ret;
 }
 
+static void
+http_conn_free (struct http_conn *conn)
+{
+  if (conn->sock)
+    grub_net_tcp_close (conn->sock, GRUB_NET_TCP_ABORT);
+  if (conn->tls)
+    grub_net_tls->free (conn->tls);
+  grub_free (conn->server);
+  grub_free (conn);
+}
+
+static void
+http_conn_unlink (struct http_conn *conn)
+{
+  struct http_conn **prev;
+
+  for (prev = &idle_conns; *prev; prev = &(*prev)->next)
+    if (*prev == conn)
+      {
+	*prev = conn->next;
+	conn->next = 0;
+	return;
+      }
+}
+
+/* Detach the connection from FILE.  If the response has been read
+   completely and the server didn't ask to close, keep it for reuse.  */
+static void
+http_release_conn (grub_file_t file)
+{
+  http_data_t data = file->data;
+  struct http_conn *conn = data->conn;
+  struct http_conn *c;
+
+  if (!conn)
+    return;
+  data->conn = 0;
+  conn->file = 0;
+
+  if (!conn->sock || !data->done || data->conn_close)
+    {
+      http_conn_free (conn);
+      return;
+    }
+
+  for (c = idle_conns; c; c = c->next)
+    if (grub_strcmp (c->server, conn->server) == 0
+	&& !c->tls == !conn->tls)
+      {
+	http_conn_unlink (c);
+	http_conn_free (c);
+	break;
+      }
+
+  grub_net_tcp_unstall (conn->sock);
+  conn->next = idle_conns;
+  idle_conns = conn;
+}
+
+static void
+http_body_done (grub_file_t file, http_data_t data)
+{
+  data->done = 1;
+  file->device->net->eof = 1;
+  file->device->net->stall = 1;
+  if (file->size == GRUB_FILE_SIZE_UNKNOWN)
+    file->size = have_ahead (file);
+}
+
 static grub_err_t
 parse_line (grub_file_t file, http_data_t data, char *ptr, grub_size_t len)
 {
@@ -69,6 +162,16 @@ parse_line (grub_file_t file, http_data_t data, char *ptr, grub_size_t len)
   while (end > ptr && *(end - 1) == '\r')
     end--;
   *end = 0;
+  /* Trailer after the last chunk, terminated by an empty line.  */
+  if (data->in_chunk_len == 3)
+    {
+      if (ptr == end)
+	{
+	  data->in_chunk_len = 0;
+	  data->done = 1;
+	}
+      return GRUB_ERR_NONE;
+    }
   /* Trailing CRLF.  */
   if (data->in_chunk_len == 1)
     {
@@ -86,14 +189,23 @@ parse_line (grub_file_t file, http_data_t data, char *ptr, grub_size_t len)
 	  if (file->size == GRUB_FILE_SIZE_UNKNOWN)
 	    file->size = have_ahead (file);
 	}
-      data->in_chunk_len = 0;
+      data->in_chunk_len = data->chunk_rem ? 0 : 3;
       return GRUB_ERR_NONE;
     }
   if (ptr == end)
     {
       data->headers_recv = 1;
+      /* A 304 never has a body, whatever its headers say.  */
+      if (file->device->net->not_modified)
+	{
+	  data->chunked = 0;
+	  data->have_length = 1;
+	  data->body_rem = 0;
+	}
       if (data->chunked)
 	data->in_chunk_len = 2;
+      else if (data->have_length && data->body_rem == 0)
+	http_body_done (file, data);
       return GRUB_ERR_NONE;
     }
 
@@ -115,11 +227,17 @@ parse_line (grub_file_t file, http_data_t data, char *ptr, grub_size_t len)
 	case 200:
 	case 206:
 	  break;
+	case 304:
+	  if (!file->device->net->if_none_match)
+	    goto unsupported;
+	  file->device->net->not_modified = 1;
+	  break;
 	case 404:
 	  data->err = GRUB_ERR_FILE_NOT_FOUND;
 	  data->errmsg = grub_xasprintf (_("file `%s' not found"), data->filename);
 	  return GRUB_ERR_NONE;
 	default:
+	unsupported:
 	  data->err = GRUB_ERR_NET_UNKNOWN_ERROR;
 	  /* TRANSLATORS: GRUB HTTP code is pretty young. So even perfectly
 	     valid answers like 403 will trigger this very generic message.  */
@@ -131,11 +249,22 @@ parse_line (grub_file_t file, http_data_t data, char *ptr, grub_size_t len)
       return GRUB_ERR_NONE;
     }
   if (grub_memcmp (ptr, "Content-Length: ", sizeof ("Content-Length: ") - 1)
-      == 0 && !data->size_recv)
+      == 0)
     {
       ptr += sizeof ("Content-Length: ") - 1;
-      file->size = grub_strtoull (ptr, &ptr, 10);
-      data->size_recv = 1;
+      data->body_rem = grub_strtoull (ptr, &ptr, 10);
+      data->have_length = 1;
+      if (!data->size_recv)
+	{
+	  file->size = data->body_rem;
+	  data->size_recv = 1;
+	}
+      return GRUB_ERR_NONE;
+    }
+  if (grub_memcmp (ptr, "Connection: close",
+		   sizeof ("Connection: close") - 1) == 0)
+    {
+      data->conn_close = 1;
       return GRUB_ERR_NONE;
     }
   if (grub_memcmp (ptr, "Transfer-Encoding: chunked",
@@ -144,20 +273,53 @@ parse_line (grub_file_t file, http_data_t data, char *ptr, grub_size_t len)
       data->chunked = 1;
       return GRUB_ERR_NONE;
     }
+  if (grub_memcmp (ptr, "Content-Encoding: ",
+		   sizeof ("Content-Encoding: ") - 1) == 0)
+    {
+      ptr += sizeof ("Content-Encoding: ") - 1;
+      if (grub_strcmp (ptr, "gzip") == 0 || grub_strcmp (ptr, "x-gzip") == 0)
+	file->device->net->encoding = GRUB_NET_CONTENT_GZIP;
+      else if (grub_strcmp (ptr, "zstd") == 0)
+	file->device->net->encoding = GRUB_NET_CONTENT_ZSTD;
+      else if (grub_strcmp (ptr, "identity") != 0)
+	file->device->net->encoding = GRUB_NET_CONTENT_UNSUPPORTED;
+      return GRUB_ERR_NONE;
+    }
+  if (grub_memcmp (ptr, "ETag: ", sizeof ("ETag: ") - 1) == 0)
+    {
+      ptr += sizeof ("ETag: ") - 1;
+      grub_free (file->device->net->etag);
+      file->device->net->etag = grub_strdup (ptr);
+      grub_errno = GRUB_ERR_NONE;
+      return GRUB_ERR_NONE;
+    }
 
   return GRUB_ERR_NONE;  
 }
 
 static void
 http_err (grub_net_tcp_socket_t sock __attribute__ ((unused)),
-	  void *f)
+	  void *c)
 {
-  grub_file_t file = f;
-  http_data_t data = file->data;
+  struct http_conn *conn = c;
+  grub_file_t file = conn->file;
+  http_data_t data;
+
+  if (conn->sock)
+    grub_net_tcp_close (conn->sock, GRUB_NET_TCP_ABORT);
+  conn->sock = 0;
+  if (conn->tls)
+    grub_net_tls->shutdown (conn->tls);
+
+  /* The server closed an idle connection.  */
+  if (!file)
+    {
+      http_conn_unlink (conn);
+      http_conn_free (conn);
+      return;
+    }
 
-  if (data->sock)
-    grub_net_tcp_close (data->sock, GRUB_NET_TCP_ABORT);
-  data->sock = 0;
+  data = file->data;
   if (data->current_line)
     grub_free (data->current_line);
   data->current_line = 0;
@@ -170,13 +332,24 @@ http_err (grub_net_tcp_socket_t sock __attribute__ ((unused)),
 static grub_err_t
 http_receive (grub_net_tcp_socket_t sock __attribute__ ((unused)),
 	      struct grub_net_buff *nb,
-	      void *f)
+	      void *c)
 {
-  grub_file_t file = f;
-  http_data_t data = file->data;
+  struct http_conn *conn = c;
+  grub_file_t file = conn->file;
+  http_data_t data;
   grub_err_t err;
 
-  if (!data->sock)
+  /* Nothing is expected on an idle connection.  */
+  if (!file)
+    {
+      grub_netbuff_free (nb);
+      http_conn_unlink (conn);
+      http_conn_free (conn);
+      return GRUB_ERR_NONE;
+    }
+
+  data = file->data;
+  if (!conn->sock || data->done)
     {
       grub_netbuff_free (nb);
       return GRUB_ERR_NONE;
@@ -202,7 +375,8 @@ http_receive (grub_net_tcp_socket_t sock __attribute__ ((unused)),
 	  if (!t)
 	    {
 	      grub_netbuff_free (nb);
-	      grub_net_tcp_close (data->sock, GRUB_NET_TCP_ABORT);
+	      grub_net_tcp_close (conn->sock, GRUB_NET_TCP_ABORT);
+	      conn->sock = 0;
 	      return grub_errno;
 	    }
 	      
@@ -222,7 +396,8 @@ http_receive (grub_net_tcp_socket_t sock __attribute__ ((unused)),
 	  data->current_line_len = 0;
 	  if (err)
 	    {
-	      grub_net_tcp_close (data->sock, GRUB_NET_TCP_ABORT);
+	      grub_net_tcp_close (conn->sock, GRUB_NET_TCP_ABORT);
+	      conn->sock = 0;
 	      grub_netbuff_free (nb);
 	      return err;
 	    }
@@ -239,7 +414,8 @@ http_receive (grub_net_tcp_socket_t sock __attribute__ ((unused)),
 	      if (!data->current_line)
 		{
 		  grub_netbuff_free (nb);
-		  grub_net_tcp_close (data->sock, GRUB_NET_TCP_ABORT);
+		  grub_net_tcp_close (conn->sock, GRUB_NET_TCP_ABORT);
+		  conn->sock = 0;
 		  return grub_errno;
 		}
 	      data->current_line_len = (char *) nb->tail - ptr;
@@ -250,37 +426,50 @@ http_receive (grub_net_tcp_socket_t sock __attribute__ ((unused)),
 	  err = parse_line (file, data, ptr, ptr2 - ptr);
 	  if (err)
 	    {
-	      grub_net_tcp_close (data->sock, GRUB_NET_TCP_ABORT);
+	      grub_net_tcp_close (conn->sock, GRUB_NET_TCP_ABORT);
+	      conn->sock = 0;
 	      grub_netbuff_free (nb);
 	      return err;
 	    }
 	  ptr = ptr2 + 1;
 	}
 
-      if (((char *) nb->tail - ptr) <= 0)
+      if (data->done || ((char *) nb->tail - ptr) <= 0)
 	{
 	  grub_netbuff_free (nb);
 	  return GRUB_ERR_NONE;
-	} 
+	}
       err = grub_netbuff_pull (nb, ptr - (char *) nb->data);
       if (err)
 	{
-	  grub_net_tcp_close (data->sock, GRUB_NET_TCP_ABORT);
+	  grub_net_tcp_close (conn->sock, GRUB_NET_TCP_ABORT);
+	  conn->sock = 0;
 	  grub_netbuff_free (nb);
 	  return err;
 	}
+      if (!data->chunked && data->have_length
+	  && data->body_rem < (grub_off_t) (nb->tail - nb->data))
+	grub_netbuff_unput (nb, (nb->tail - nb->data) - data->body_rem);
       if (!(data->chunked && (grub_ssize_t) data->chunk_rem
 	    < nb->tail - nb->data))
 	{
+	  grub_size_t len = nb->tail - nb->data;
+
 	  grub_net_put_packet (&file->device->net->packs, nb);
 	  if (file->device->net->packs.count >= 20)
 	    file->device->net->stall = 1;
 
 	  if (file->device->net->packs.count >= 100)
-	    grub_net_tcp_stall (data->sock);
+	    grub_net_tcp_stall (conn->sock);
 
 	  if (data->chunked)
-	    data->chunk_rem -= nb->tail - nb->data;
+	    data->chunk_rem -= len;
+	  else if (data->have_length)
+	    {
+	      data->body_rem -= len;
+	      if (data->body_rem == 0)
+		http_body_done (file, data);
+	    }
 	  return GRUB_ERR_NONE;
 	}
       if (data->chunk_rem)
@@ -294,7 +483,7 @@ http_receive (grub_net_tcp_socket_t sock __attribute__ ((unused)),
 	  if (file->device->net->packs.count >= 20)
 	    {
 	      file->device->net->stall = 1;
-	      grub_net_tcp_stall (data->sock);
+	      grub_net_tcp_stall (conn->sock);
 	    }
 
 	  grub_net_put_packet (&file->device->net->packs, nb2);
@@ -304,6 +493,56 @@ http_receive (grub_net_tcp_socket_t sock __attribute__ ((unused)),
     }
 }
 
+/* Decrypted data from the TLS layer.  */
+static grub_err_t
+https_deliver (struct grub_net_buff *nb, void *c)
+{
+  struct http_conn *conn = c;
+  grub_err_t err;
+
+  /* The TLS layer is still using the connection, so don't free it as
+     http_receive would.  */
+  if (!conn->file)
+    {
+      grub_netbuff_free (nb);
+      conn->stale = 1;
+      return GRUB_ERR_NONE;
+    }
+
+  err = http_receive (conn->sock, nb, conn);
+  if (!conn->sock)
+    grub_net_tls->shutdown (conn->tls);
+  return err;
+}
+
+static grub_err_t
+https_receive (grub_net_tcp_socket_t sock __attribute__ ((unused)),
+	       struct grub_net_buff *nb,
+	       void *c)
+{
+  struct http_conn *conn = c;
+  grub_err_t err;
+
+  err = grub_net_tls->receive (conn->tls, nb);
+  if (!conn->file && (err || conn->stale))
+    {
+      http_conn_unlink (conn);
+      http_conn_free (conn);
+      return err;
+    }
+  if (err && conn->sock)
+    http_err (conn->sock, conn);
+  return err;
+}
+
+static grub_err_t
+http_send (struct http_conn *conn, struct grub_net_buff *nb)
+{
+  if (conn->tls)
+    return grub_net_tls->send (conn->tls, nb);
+  return grub_net_send_tcp_packet (conn->sock, nb, 1);
+}
+
 static grub_err_t
 http_establish (struct grub_file *file, grub_off_t offset, int initial)
 {
@@ -312,6 +551,9 @@ http_establish (struct grub_file *file, grub_off_t offset, int initial)
   int i;
   struct grub_net_buff *nb;
   grub_err_t err;
+  struct http_conn *conn;
+  int reused = 0;
+  int https = (file->device->net->protocol == &grub_https_protocol);
 
   nb = grub_netbuff_alloc (GRUB_NET_TCP_RESERVE_SIZE
 			   + sizeof ("GET ") - 1
@@ -320,6 +562,11 @@ http_establish (struct grub_file *file, grub_off_t offset, int initial)
 			   + grub_strlen (file->device->net->server)
 			   + sizeof ("\r\nUser-Agent: " PACKAGE_STRING
 				     "\r\n") - 1
+			   + sizeof ("Accept-Encoding: gzip, zstd\r\n") - 1
+			   + (file->device->net->if_none_match
+			      ? sizeof ("If-None-Match: \r\n") - 1
+			      + grub_strlen (file->device->net->if_none_match)
+			      : 0)
 			   + sizeof ("Range: bytes=XXXXXXXXXXXXXXXXXXXX"
 				     "-\r\n\r\n"));
   if (!nb)
@@ -376,7 +623,25 @@ http_establish (struct grub_file *file, grub_off_t offset, int initial)
     }
   grub_memcpy (ptr, "\r\nUser-Agent: " PACKAGE_STRING "\r\n",
 	       sizeof ("\r\nUser-Agent: " PACKAGE_STRING "\r\n") - 1);
-  if (!initial)
+  /* Range requests address the encoded body, which we never seek in;
+     see grub_net_fs_open.  */
+  if (initial)
+    {
+      ptr = nb->tail;
+      grub_netbuff_put (nb, sizeof ("Accept-Encoding: gzip, zstd\r\n") - 1);
+      grub_memcpy (ptr, "Accept-Encoding: gzip, zstd\r\n",
+		   sizeof ("Accept-Encoding: gzip, zstd\r\n") - 1);
+      if (file->device->net->if_none_match)
+	{
+	  ptr = nb->tail;
+	  grub_netbuff_put (nb, sizeof ("If-None-Match: \r\n") - 1
+			    + grub_strlen (file->device->net->if_none_match));
+	  grub_stpcpy (grub_stpcpy (grub_stpcpy ((char *) ptr,
+						 "If-None-Match: "),
+				    file->device->net->if_none_match), "\r\n");
+	}
+    }
+  else
     {
       ptr = nb->tail;
       grub_snprintf ((char *) ptr,
@@ -391,26 +656,96 @@ http_establish (struct grub_file *file, grub_off_t offset, int initial)
   grub_netbuff_put (nb, 2);
   grub_memcpy (ptr, "\r\n", 2);
 
-  data->sock = grub_net_tcp_open (file->device->net->server,
-				  HTTP_PORT, http_receive,
-				  http_err, http_err,
-				  file);
-  if (!data->sock)
+  for (conn = idle_conns; conn; conn = conn->next)
+    if (grub_strcmp (conn->server, file->device->net->server) == 0
+	&& !conn->tls == !https)
+      break;
+
+  if (conn)
     {
-      grub_netbuff_free (nb);
-      return grub_errno;
+      http_conn_unlink (conn);
+      reused = 1;
     }
+  else
+    {
+      conn = grub_zalloc (sizeof (*conn));
+      if (!conn)
+	{
+	  grub_netbuff_free (nb);
+	  return grub_errno;
+	}
+      conn->server = grub_strdup (file->device->net->server);
+      if (!conn->server)
+	{
+	  grub_free (conn);
+	  grub_netbuff_free (nb);
+	  return grub_errno;
+	}
+      if (https && !grub_net_tls)
+	{
+	  grub_dl_load ("tls");
+	  if (!grub_net_tls)
+	    {
+	      http_conn_free (conn);
+	      grub_netbuff_free (nb);
+	      return grub_errno ? : grub_error (GRUB_ERR_NET_NO_CARD,
+						N_("TLS isn't available"));
+	    }
+	}
+      conn->sock = grub_net_tcp_open (file->device->net->server,
+				      https ? HTTPS_PORT : HTTP_PORT,
+				      https ? https_receive : http_receive,
+				      http_err, http_err,
+				      conn);
+      if (!conn->sock)
+	{
+	  http_conn_free (conn);
+	  grub_netbuff_free (nb);
+	  return grub_errno;
+	}
+      if (https)
+	{
+	  conn->tls = grub_net_tls->new (conn->sock,
+					 file->device->net->server,
+					 https_deliver, conn);
+	  if (!conn->tls)
+	    {
+	      http_conn_free (conn);
+	      grub_netbuff_free (nb);
+	      return grub_errno;
+	    }
+	}
+    }
+
+  conn->file = file;
+  data->conn = conn;
 
-  //  grub_net_poll_cards (5000);
+  /* Errors during the handshake go through the file like any other.  */
+  if (https && !reused)
+    {
+      err = grub_net_tls->handshake (conn->tls);
+      if (err)
+	{
+	  grub_netbuff_free (nb);
+	  http_release_conn (file);
+	  return err;
+	}
+    }
 
-  err = grub_net_send_tcp_packet (data->sock, nb, 1);
+  err = http_send (conn, nb);
   if (err)
     {
-      grub_net_tcp_close (data->sock, GRUB_NET_TCP_ABORT);
+      http_release_conn (file);
+      /* The server may have closed the kept-alive TLS session.  */
+      if (reused)
+	{
+	  grub_errno = GRUB_ERR_NONE;
+	  return http_establish (file, offset, initial);
+	}
       return err;
     }
 
-  for (i = 0; !data->headers_recv && i < 100; i++)
+  for (i = 0; !data->headers_recv && conn->sock && i < 100; i++)
     {
       grub_net_tcp_retransmit ();
       grub_net_poll_cards (300, &data->headers_recv);
@@ -418,7 +753,15 @@ http_establish (struct grub_file *file, grub_off_t offset, int initial)
 
   if (!data->headers_recv)
     {
-      grub_net_tcp_close (data->sock, GRUB_NET_TCP_ABORT);
+      http_release_conn (file);
+      /* The server may have dropped the kept-alive connection before
+	 seeing our request.  Retry once on a fresh one.  */
+      if (reused && !data->first_line_recv && !data->err && !data->errmsg)
+	{
+	  file->device->net->eof = 0;
+	  file->device->net->stall = 0;
+	  return http_establish (file, offset, initial);
+	}
       if (data->err)
 	{
 	  char *str = data->errmsg;
@@ -438,10 +781,12 @@ http_seek (struct grub_file *file, grub_off_t off)
   struct http_data *old_data, *data;
   grub_err_t err;
   old_data = file->data;
-  /* FIXME: Reuse socket?  */
-  if (old_data->sock)
-    grub_net_tcp_close (old_data->sock, GRUB_NET_TCP_ABORT);
-  old_data->sock = 0;
+  /* The connection is reused for the range request when the current
+     response has been read to its end.  */
+  http_release_conn (file);
+  if (old_data->current_line)
+    grub_free (old_data->current_line);
+  old_data->current_line = 0;
 
   while (file->device->net->packs.first)
     {
@@ -450,6 +795,7 @@ http_seek (struct grub_file *file, grub_off_t off)
     }
 
   file->device->net->stall = 0;
+  file->device->net->eof = 0;
   file->device->net->offset = off;
 
   data = grub_zalloc (sizeof (*data));
@@ -518,8 +864,7 @@ http_close (struct grub_file *file)
   if (!data)
     return GRUB_ERR_NONE;
 
-  if (data->sock)
-    grub_net_tcp_close (data->sock, GRUB_NET_TCP_ABORT);
+  http_release_conn (file);
   if (data->current_line)
     grub_free (data->current_line);
   grub_free (data->filename);
@@ -537,8 +882,8 @@ http_packets_pulled (struct grub_file *file)
 
   if (!file->device->net->eof)
     file->device->net->stall = 0;
-  if (data && data->sock)
-    grub_net_tcp_unstall (data->sock);
+  if (data && data->conn && data->conn->sock)
+    grub_net_tcp_unstall (data->conn->sock);
   return 0;
 }
 
@@ -551,12 +896,31 @@ static struct grub_net_app_protocol grub_http_protocol =
     .packets_pulled = http_packets_pulled
   };
 
+static struct grub_net_app_protocol grub_https_protocol =
+  {
+    .name = "https",
+    .open = http_open,
+    .close = http_close,
+    .seek = http_seek,
+    .packets_pulled = http_packets_pulled
+  };
+
 GRUB_MOD_INIT (http)
 {
   grub_net_app_level_register (&grub_http_protocol);
+  grub_net_app_level_register (&grub_https_protocol);
 }
 
 GRUB_MOD_FINI (http)
 {
+  struct http_conn *conn, *next;
+
+  for (conn = idle_conns; conn; conn = next)
+    {
+      next = conn->next;
+      http_conn_free (conn);
+    }
+  idle_conns = 0;
+  grub_net_app_level_unregister (&grub_https_protocol);
   grub_net_app_level_unregister (&grub_http_protocol);
 }
@@ -446,7 +446,8 @@ grub_net_recv_icmp6_packet (struct grub_net_buff *nb,
 
 grub_err_t
 grub_net_icmp6_send_request (struct grub_net_network_level_interface *inf,
-			     const grub_net_network_level_address_t *proto_addr)
+			     const grub_net_network_level_address_t *proto_addr,
+			     int wait)
 {
   struct grub_net_buff *nb;
   grub_err_t err = GRUB_ERR_NONE;
@@ -520,7 +521,7 @@ grub_net_icmp6_send_request (struct grub_net_network_level_interface *inf,
   if (err)
     goto fail;
 
-  for (i = 0; i < GRUB_NET_TRIES; i++)
+  for (i = 0; wait && i < GRUB_NET_TRIES; i++)
     {
       if (grub_net_link_layer_resolve_check (inf, proto_addr))
 	break;
@@ -0,0 +1,190 @@
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2026  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <grub/net.h>
+#include <grub/net/ip.h>
+#include <grub/net/netbuff.h>
+#include <grub/list.h>
+#include <grub/mm.h>
+
+struct igmp_header
+{
+  grub_uint8_t type;
+  grub_uint8_t max_resp;
+  grub_uint16_t checksum;
+  grub_uint32_t group;
+} GRUB_PACKED;
+
+enum
+  {
+    IGMP_V2_MEMBERSHIP_REPORT = 0x16,
+    IGMP_LEAVE_GROUP = 0x17
+  };
+
+/* 224.0.0.2, where leave messages go.  */
+#define IGMP_ALL_ROUTERS 0xe0000002
+
+struct grub_net_ip4_membership
+{
+  struct grub_net_ip4_membership *next;
+  struct grub_net_ip4_membership **prev;
+  struct grub_net_network_level_interface *inf;
+  grub_uint32_t group;
+  unsigned refs;
+};
+
+static struct grub_net_ip4_membership *memberships;
+
+static void
+group_hwaddress (grub_uint32_t group, grub_net_link_level_address_t *ll)
+{
+  grub_uint32_t g = grub_be_to_cpu32 (group);
+
+  ll->type = GRUB_NET_LINK_LEVEL_PROTOCOL_ETHERNET;
+  ll->mac[0] = 0x01;
+  ll->mac[1] = 0x00;
+  ll->mac[2] = 0x5e;
+  ll->mac[3] = (g >> 16) & 0x7f;
+  ll->mac[4] = (g >> 8) & 0xff;
+  ll->mac[5] = g & 0xff;
+}
+
+static grub_err_t
+send_igmp (struct grub_net_network_level_interface *inf, grub_uint8_t type,
+	   grub_uint32_t group)
+{
+  grub_net_network_level_address_t target;
+  grub_net_link_level_address_t ll_target;
+  struct grub_net_buff *nb;
+  struct igmp_header *igmph;
+  grub_err_t err;
+
+  target.type = GRUB_NET_NETWORK_LEVEL_PROTOCOL_IPV4;
+  target.ipv4 = (type == IGMP_LEAVE_GROUP)
+    ? grub_cpu_to_be32_compile_time (IGMP_ALL_ROUTERS) : group;
+  group_hwaddress (target.ipv4, &ll_target);
+
+  nb = grub_netbuff_make_pkt (sizeof (*igmph));
+  if (!nb)
+    return grub_errno;
+
+  igmph = (struct igmp_header *) nb->data;
+  igmph->type = type;
+  igmph->max_resp = 0;
+  igmph->group = group;
+  igmph->checksum = 0;
+  igmph->checksum = grub_net_ip_chksum ((void *) igmph, sizeof (*igmph));
+
+  err = grub_net_send_ip_packet (inf, &target, &ll_target, nb,
+				 GRUB_NET_IP_IGMP);
+  grub_netbuff_free (nb);
+  return err;
+}
+
+static struct grub_net_ip4_membership *
+find_membership (struct grub_net_card *card, grub_uint32_t group)
+{
+  struct grub_net_ip4_membership *m;
+
+  FOR_LIST_ELEMENTS (m, memberships)
+    if (m->inf->card == card && m->group == group)
+      return m;
+  return NULL;
+}
+
+grub_err_t
+grub_net_ip4_multicast_join (struct grub_net_network_level_interface *inf,
+			     grub_uint32_t group)
+{
+  struct grub_net_ip4_membership *m;
+  struct grub_net_card *card = inf->card;
+  grub_net_link_level_address_t ll;
+  grub_err_t err;
+
+  if ((grub_be_to_cpu32 (group) >> 28) != 0xe)
+    return grub_error (GRUB_ERR_BAD_ARGUMENT, "not a multicast address");
+
+  m = find_membership (card, group);
+  if (m)
+    {
+      m->refs++;
+      return GRUB_ERR_NONE;
+    }
+
+  m = grub_zalloc (sizeof (*m));
+  if (!m)
+    return grub_errno;
+  m->inf = inf;
+  m->group = group;
+  m->refs = 1;
+
+  group_hwaddress (group, &ll);
+  if (card->driver->multicast_filter)
+    {
+      err = card->driver->multicast_filter (card, &ll, 1);
+      if (err)
+	{
+	  grub_free (m);
+	  return err;
+	}
+    }
+  grub_list_push (GRUB_AS_LIST_P (&memberships), GRUB_AS_LIST (m));
+
+  /* Snooping switches only forward the group once they have seen a report.
+     It is unsolicited, so send it twice in case one is lost.  */
+  err = send_igmp (inf, IGMP_V2_MEMBERSHIP_REPORT, group);
+  if (!err)
+    err = send_igmp (inf, IGMP_V2_MEMBERSHIP_REPORT, group);
+  if (err)
+    {
+      grub_dprintf ("net", "IGMP report failed: %s\n", grub_errmsg);
+      grub_errno = GRUB_ERR_NONE;
+    }
+  return GRUB_ERR_NONE;
+}
+
+void
+grub_net_ip4_multicast_leave (struct grub_net_network_level_interface *inf,
+			      grub_uint32_t group)
+{
+  struct grub_net_ip4_membership *m;
+  struct grub_net_card *card = inf->card;
+  grub_net_link_level_address_t ll;
+
+  m = find_membership (card, group);
+  if (!m || --m->refs)
+    return;
+
+  grub_list_remove (GRUB_AS_LIST (m));
+  if (send_igmp (m->inf, IGMP_LEAVE_GROUP, group))
+    grub_errno = GRUB_ERR_NONE;
+  group_hwaddress (group, &ll);
+  if (card->driver->multicast_filter
+      && card->driver->multicast_filter (card, &ll, 0))
+    grub_errno = GRUB_ERR_NONE;
+  grub_free (m);
+}
+
+struct grub_net_network_level_interface *
+grub_net_ip4_multicast_lookup (struct grub_net_card *card,
+			       grub_uint32_t group)
+{
+  struct grub_net_ip4_membership *m = find_membership (card, group);
+
+  return m ? m->inf : NULL;
+}
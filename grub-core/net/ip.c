@@ -24,7 +24,6 @@
 #include <grub/net.h>
 #include <grub/net/netbuff.h>
 #include <grub/mm.h>
-#include <grub/priority_queue.h>
 #include <grub/time.h>
 
 struct iphdr {
@@ -58,23 +57,14 @@ struct ip6hdr {
   ip6addr dest;
 } GRUB_PACKED ;
 
-static int
-cmp (const void *a__, const void *b__)
-{
-  struct grub_net_buff *a_ = *(struct grub_net_buff **) a__;
-  struct grub_net_buff *b_ = *(struct grub_net_buff **) b__;
-  struct iphdr *a = (struct iphdr *) a_->data;
-  struct iphdr *b = (struct iphdr *) b_->data;
-  /* We want the first elements to be on top.  */
-  if ((grub_be_to_cpu16 (a->frags) & OFFSET_MASK)
-      < (grub_be_to_cpu16 (b->frags) & OFFSET_MASK))
-    return +1;
-  if ((grub_be_to_cpu16 (a->frags) & OFFSET_MASK)
-      > (grub_be_to_cpu16 (b->frags) & OFFSET_MASK))
-    return -1;
-  return 0;
-}
+/* Largest payload an IPv4 datagram can carry.  */
+#define REASSEMBLE_MAX_LEN (0xffff - sizeof (struct iphdr))
+#define REASSEMBLE_MAX_UNITS ((REASSEMBLE_MAX_LEN + 7) / 8)
+#define REASSEMBLE_TIMEOUT 90000
+#define REASSEMBLE_MAX_PENDING 8
 
+/* A datagram being reassembled.  Fragments are copied into ASM_NETBUFF as
+   they arrive and HAVE records which 8-byte units have been filled in.  */
 struct reassemble
 {
   struct reassemble *next;
@@ -82,43 +72,90 @@ struct reassemble
   grub_uint32_t dest;
   grub_uint16_t id;
   grub_uint8_t proto;
-  grub_uint64_t last_time;
-  grub_priority_queue_t pq;
+  grub_uint8_t ttl;
+  grub_uint64_t expire;
   struct grub_net_buff *asm_netbuff;
+  /* Payload length, known once the last fragment has arrived.  */
   grub_size_t total_len;
-  grub_size_t cur_ptr;
-  grub_uint8_t ttl;
+  grub_size_t have_units;
+  grub_uint8_t have[(REASSEMBLE_MAX_UNITS + 7) / 8];
 };
 
+/* Pending datagrams, oldest first, so that expiry only looks at the head.  */
 static struct reassemble *reassembles;
-
-grub_uint16_t
-grub_net_ip_chksum (void *ipv, grub_size_t len)
+static struct reassemble **reassembles_tail = &reassembles;
+static unsigned reassembles_count;
+
+/* Ones' complement sum of LEN bytes at BUF, folded to 16 bits.  The data
+   is summed in host byte order, which by the byte-order independence of the
+   ones' complement sum (RFC 1071) yields the result already in the order it
+   is stored in the packet.  */
+static grub_uint16_t
+chksum_fold (const grub_uint8_t *buf, grub_size_t len)
 {
-  grub_uint16_t *ip = (grub_uint16_t *) ipv;
-  grub_uint32_t sum = 0;
-
-  for (; len >= 2; len -= 2)
+  grub_uint64_t sum = 0;
+
+  for (; len >= 16; len -= 16, buf += 16)
+    sum += (grub_uint64_t) grub_get_unaligned32 (buf)
+      + grub_get_unaligned32 (buf + 4)
+      + grub_get_unaligned32 (buf + 8)
+      + grub_get_unaligned32 (buf + 12);
+  for (; len >= 4; len -= 4, buf += 4)
+    sum += grub_get_unaligned32 (buf);
+  if (len >= 2)
     {
-      sum += grub_be_to_cpu16 (grub_get_unaligned16 (ip++));
-      if (sum > 0xFFFF)
-	sum -= 0xFFFF;
+      sum += grub_get_unaligned16 (buf);
+      buf += 2;
+      len -= 2;
     }
   if (len)
     {
-      sum += *((grub_uint8_t *) ip) << 8;
-      if (sum > 0xFFFF)
-	sum -= 0xFFFF;
+      grub_uint8_t last[2] = { *buf, 0 };
+      sum += grub_get_unaligned16 (last);
     }
 
-  if (sum >= 0xFFFF)
-    sum -= 0xFFFF;
+  sum = (sum & 0xffffffff) + (sum >> 32);
+  sum = (sum & 0xffffffff) + (sum >> 32);
+  sum = (sum & 0xffff) + (sum >> 16);
+  sum = (sum & 0xffff) + (sum >> 16);
+  return sum;
+}
+
+grub_uint16_t
+grub_net_ip_chksum (void *ipv, grub_size_t len)
+{
+  grub_uint16_t sum = chksum_fold (ipv, len);
+
+  /* Negative zero sums to a transmitted 0xffff, as before.  */
+  if (sum == 0xffff)
+    sum = 0;
 
-  return grub_cpu_to_be16 ((~sum) & 0x0000FFFF);
+  return ~sum;
+}
+
+/* Update checksum CHKSUM, as stored in a packet, for the LEN bytes at OLD
+   having been replaced with those at NEW (RFC 1624, eqn. 3).  LEN must be
+   even and the bytes 16-bit aligned within the checksummed data.  */
+grub_uint16_t
+grub_net_ip_chksum_update (grub_uint16_t chksum, const void *old,
+			   const void *new, grub_size_t len)
+{
+  grub_uint32_t sum = (grub_uint16_t) ~chksum;
+
+  sum += (grub_uint16_t) ~chksum_fold (old, len);
+  sum += chksum_fold (new, len);
+  sum = (sum & 0xffff) + (sum >> 16);
+  sum = (sum & 0xffff) + (sum >> 16);
+
+  return ~sum;
 }
 
 static int id = 0x2400;
 
+/* Fragments are sent straight out of NB: the headers of each one are pushed
+   over the tail of the previous fragment, which the card has already copied
+   out, and the bytes overwritten that way are put back afterwards since the
+   caller may send NB again (TCP retransmits).  */
 static grub_err_t
 send_fragmented (struct grub_net_network_level_interface * inf,
 		 const grub_net_network_level_address_t * target,
@@ -126,6 +163,8 @@ send_fragmented (struct grub_net_network_level_interface * inf,
 		 grub_net_ip_protocol_t proto,
 		 grub_net_link_level_address_t ll_target_addr)
 {
+  grub_uint8_t saved[sizeof (struct iphdr) + GRUB_NET_MAX_LINK_HEADER_SIZE];
+  grub_uint8_t *end = nb->tail;
   grub_size_t off = 0;
   grub_size_t fraglen;
   grub_err_t err;
@@ -133,50 +172,45 @@ send_fragmented (struct grub_net_network_level_interface * inf,
   fraglen = (inf->card->mtu - sizeof (struct iphdr)) & ~7;
   id++;
 
-  while (nb->tail - nb->data)
+  while (nb->data < end)
     {
+      grub_uint8_t *frag = nb->data;
       grub_size_t len = fraglen;
-      struct grub_net_buff *nb2;
+      grub_size_t keep = sizeof (saved);
       struct iphdr *iph;
 
-      if ((grub_ssize_t) len > nb->tail - nb->data)
-	len = nb->tail - nb->data;
-      nb2 = grub_netbuff_alloc (fraglen + sizeof (struct iphdr)
-				+ GRUB_NET_MAX_LINK_HEADER_SIZE);
-      if (!nb2)
-	return grub_errno;
-      err = grub_netbuff_reserve (nb2, GRUB_NET_MAX_LINK_HEADER_SIZE);
-      if (err)
-	return err;
-      err = grub_netbuff_put (nb2, sizeof (struct iphdr));
-      if (err)
-	return err;
+      if ((grub_ssize_t) len > end - frag)
+	len = end - frag;
+      if ((grub_ssize_t) keep > frag - nb->head)
+	keep = frag - nb->head;
+      grub_memcpy (saved, frag - keep, keep);
+      nb->tail = frag + len;
 
-      iph = (struct iphdr *) nb2->data;
-      iph->verhdrlen = ((4 << 4) | 5);
-      iph->service = 0;
-      iph->len = grub_cpu_to_be16 (len + sizeof (struct iphdr));
-      iph->ident = grub_cpu_to_be16 (id);
-      iph->frags = grub_cpu_to_be16 (off | (((grub_ssize_t) len 
-					     == nb->tail - nb->data)
-					    ? 0 : MORE_FRAGMENTS));
-      iph->ttl = 0xff;
-      iph->protocol = proto;
-      iph->src = inf->address.ipv4;
-      iph->dest = target->ipv4;
-      off += len / 8;
-
-      iph->chksum = 0;
-      iph->chksum = grub_net_ip_chksum ((void *) nb2->data, sizeof (*iph));
-      err = grub_netbuff_put (nb2, len);
-      if (err)
-	return err;
-      grub_memcpy (iph + 1, nb->data, len);
-      err = grub_netbuff_pull (nb, len);
-      if (err)
-	return err;
-      err = send_ethernet_packet (inf, nb2, ll_target_addr,
-				  GRUB_NET_ETHERTYPE_IP);
+      err = grub_netbuff_push (nb, sizeof (struct iphdr));
+      if (!err)
+	{
+	  iph = (struct iphdr *) nb->data;
+	  iph->verhdrlen = ((4 << 4) | 5);
+	  iph->service = 0;
+	  iph->len = grub_cpu_to_be16 (len + sizeof (struct iphdr));
+	  iph->ident = grub_cpu_to_be16 (id);
+	  iph->frags = grub_cpu_to_be16 (off | ((frag + len == end)
+						? 0 : MORE_FRAGMENTS));
+	  iph->ttl = 0xff;
+	  iph->protocol = proto;
+	  iph->src = inf->address.ipv4;
+	  iph->dest = target->ipv4;
+	  off += len / 8;
+
+	  iph->chksum = 0;
+	  iph->chksum = grub_net_ip_chksum ((void *) iph, sizeof (*iph));
+	  err = send_ethernet_packet (inf, nb, ll_target_addr,
+				      GRUB_NET_ETHERTYPE_IP);
+	}
+
+      grub_memcpy (frag - keep, saved, keep);
+      nb->data = frag + len;
+      nb->tail = end;
       if (err)
 	return err;
     }
@@ -270,7 +304,14 @@ handle_dgram (struct grub_net_buff *nb,
 	  }
 
 	bootp = (const struct grub_net_bootp_packet *) nb->data;
-	
+	/* Only replies; requests from other clients come here too.  */
+	if (nb->tail - nb->data < (grub_ssize_t) sizeof (*bootp)
+	    || bootp->opcode != 2)
+	  {
+	    grub_netbuff_free (nb);
+	    return GRUB_ERR_NONE;
+	  }
+
 	FOR_NET_NETWORK_LEVEL_INTERFACES (inf)
 	  if (inf->card == card
 	      && inf->address.type == GRUB_NET_NETWORK_LEVEL_PROTOCOL_DHCP_RECV
@@ -316,6 +357,11 @@ handle_dgram (struct grub_net_buff *nb,
       }
   }
  
+  /* IPv4 groups joined on this card.  */
+  if (!inf && dest->type == GRUB_NET_NETWORK_LEVEL_PROTOCOL_IPV4
+      && (grub_be_to_cpu32 (dest->ipv4) >> 28) == 0xe)
+    inf = grub_net_ip4_multicast_lookup (card, dest->ipv4);
+
   if (!inf && !(dest->type == GRUB_NET_NETWORK_LEVEL_PROTOCOL_IPV6
 		&& dest->ipv6[0] == grub_be_to_cpu64_compile_time (0xff02ULL
 								   << 48)
@@ -327,10 +373,27 @@ handle_dgram (struct grub_net_buff *nb,
   if (multicast)
     inf = NULL;
 
+  /* An on-link sender is a neighbour we are likely to answer; remember it
+     now rather than ARPing for it later.  Never override: the entry may
+     be from an ARP reply and frames can be forwarded.  */
+  if (inf && source->type == GRUB_NET_NETWORK_LEVEL_PROTOCOL_IPV4
+      && source->ipv4 != 0
+      && !grub_net_link_layer_resolve_check (inf, source))
+    {
+      grub_net_network_level_address_t gateway;
+      struct grub_net_network_level_interface *route_inf;
+
+      if (grub_net_route_address (*source, &gateway, &route_inf) == 0
+	  && route_inf->card == card
+	  && grub_net_addr_cmp (&gateway, source) == 0)
+	grub_net_link_layer_add_address (card, source, source_hwaddress, 0);
+      grub_errno = GRUB_ERR_NONE;
+    }
+
   switch (proto)
     {
     case GRUB_NET_IP_UDP:
-      return grub_net_recv_udp_packet (nb, inf, source);
+      return grub_net_recv_udp_packet (nb, inf, source, dest);
     case GRUB_NET_IP_TCP:
       return grub_net_recv_tcp_packet (nb, inf, source);
     case GRUB_NET_IP_ICMP:
@@ -348,33 +411,32 @@ handle_dgram (struct grub_net_buff *nb,
 static void
 free_rsm (struct reassemble *rsm)
 {
-  struct grub_net_buff **nb;
-  while ((nb = grub_priority_queue_top (rsm->pq)))
-    {
-      grub_netbuff_free (*nb);
-      grub_priority_queue_pop (rsm->pq);
-    }
   grub_netbuff_free (rsm->asm_netbuff);
-  grub_priority_queue_destroy (rsm->pq);
   grub_free (rsm);
 }
 
+static void
+unlink_rsm (struct reassemble **prev)
+{
+  struct reassemble *rsm = *prev;
+
+  *prev = rsm->next;
+  if (reassembles_tail == &rsm->next)
+    reassembles_tail = prev;
+  reassembles_count--;
+}
+
 static void
 free_old_fragments (void)
 {
-  struct reassemble *rsm, **prev;
-  grub_uint64_t limit_time = grub_get_time_ms () - 90000;
+  grub_uint64_t now = grub_get_time_ms ();
 
-  for (prev = &reassembles, rsm = *prev; rsm; rsm = *prev)
-    if (rsm->last_time < limit_time)
-      {
-	*prev = rsm->next;
-	free_rsm (rsm);
-      }
-    else
-      {
-	prev = &rsm->next;
-      }
+  while (reassembles && reassembles->expire <= now)
+    {
+      struct reassemble *rsm = reassembles;
+      unlink_rsm (&reassembles);
+      free_rsm (rsm);
+    }
 }
 
 static grub_err_t
@@ -459,142 +521,136 @@ grub_net_recv_ip4_packets (struct grub_net_buff *nb,
 			   &source, &dest, iph->ttl);
     }
 
-  for (prev = &reassembles, rsm = *prev; rsm; prev = &rsm->next, rsm = *prev)
-    if (rsm->source == iph->src && rsm->dest == iph->dest
-	&& rsm->id == iph->ident && rsm->proto == iph->protocol)
-      break;
-  if (!rsm)
-    {
-      rsm = grub_malloc (sizeof (*rsm));
-      if (!rsm)
-	return grub_errno;
-      rsm->source = iph->src;
-      rsm->dest = iph->dest;
-      rsm->id = iph->ident;
-      rsm->proto = iph->protocol;
-      rsm->next = reassembles;
-      reassembles = rsm;
-      prev = &reassembles;
-      rsm->pq = grub_priority_queue_new (sizeof (struct grub_net_buff **), cmp);
-      if (!rsm->pq)
-	{
-	  grub_free (rsm);
-	  return grub_errno;
-	}
-      rsm->asm_netbuff = 0;
-      rsm->total_len = 0;
-      rsm->cur_ptr = 0;
-      rsm->ttl = 0xff;
-    }
-  if (rsm->ttl > iph->ttl)
-    rsm->ttl = iph->ttl;
-  rsm->last_time = grub_get_time_ms ();
   free_old_fragments ();
 
-  err = grub_priority_queue_push (rsm->pq, &nb);
-  if (err)
-    return err;
+  {
+    grub_size_t off = 8 * (grub_be_to_cpu16 (iph->frags) & OFFSET_MASK);
+    int more = !!(grub_be_to_cpu16 (iph->frags) & MORE_FRAGMENTS);
+    grub_size_t len, unit, end_unit;
+    grub_net_network_level_address_t source;
+    grub_net_network_level_address_t dest;
+    grub_net_ip_protocol_t proto;
+    struct grub_net_buff *ret;
+    grub_uint8_t ttl;
+
+    err = grub_netbuff_pull (nb, ((iph->verhdrlen & 0xf)
+				  * sizeof (grub_uint32_t)));
+    if (err)
+      {
+	grub_netbuff_free (nb);
+	return err;
+      }
+    len = nb->tail - nb->data;
 
-  if (!(grub_be_to_cpu16 (iph->frags) & MORE_FRAGMENTS))
-    {
-      rsm->total_len = (8 * (grub_be_to_cpu16 (iph->frags) & OFFSET_MASK)
-			+ (nb->tail - nb->data));
-      rsm->total_len -= ((iph->verhdrlen & 0xf) * sizeof (grub_uint32_t));
-      rsm->asm_netbuff = grub_netbuff_alloc (rsm->total_len);
-      if (!rsm->asm_netbuff)
-	{
-	  *prev = rsm->next;
-	  free_rsm (rsm);
-	  return grub_errno;
-	}
-    }
-  if (!rsm->asm_netbuff)
-    return GRUB_ERR_NONE;
+    if ((more && (len == 0 || (len & 7))) || off + len > REASSEMBLE_MAX_LEN)
+      {
+	grub_dprintf ("net", "Bad IP fragment at %" PRIuGRUB_SIZE
+		      ", length %" PRIuGRUB_SIZE "\n", off, len);
+	grub_netbuff_free (nb);
+	return GRUB_ERR_NONE;
+      }
 
-  while (1)
-    {
-      struct grub_net_buff **nb_top_p, *nb_top;
-      grub_size_t copy;
-      grub_size_t res_len;
-      struct grub_net_buff *ret;
-      grub_net_ip_protocol_t proto;
-      grub_uint32_t src;
-      grub_uint32_t dst;
-      grub_net_network_level_address_t source;
-      grub_net_network_level_address_t dest;
-      grub_uint8_t ttl;
+    for (prev = &reassembles, rsm = *prev; rsm;
+	 prev = &rsm->next, rsm = *prev)
+      if (rsm->source == iph->src && rsm->dest == iph->dest
+	  && rsm->id == iph->ident && rsm->proto == iph->protocol)
+	break;
+    if (!rsm)
+      {
+	if (reassembles_count >= REASSEMBLE_MAX_PENDING)
+	  {
+	    rsm = reassembles;
+	    unlink_rsm (&reassembles);
+	    free_rsm (rsm);
+	  }
+	rsm = grub_zalloc (sizeof (*rsm));
+	if (!rsm)
+	  {
+	    grub_netbuff_free (nb);
+	    return grub_errno;
+	  }
+	/* Until the last fragment shows up the length is unknown, so make
+	   room for the largest datagram possible.  */
+	rsm->asm_netbuff = grub_netbuff_alloc (more ? REASSEMBLE_MAX_LEN
+					       : off + len);
+	if (!rsm->asm_netbuff)
+	  {
+	    grub_free (rsm);
+	    grub_netbuff_free (nb);
+	    return grub_errno;
+	  }
+	rsm->source = iph->src;
+	rsm->dest = iph->dest;
+	rsm->id = iph->ident;
+	rsm->proto = iph->protocol;
+	rsm->ttl = 0xff;
+	rsm->expire = grub_get_time_ms () + REASSEMBLE_TIMEOUT;
+	*reassembles_tail = rsm;
+	prev = reassembles_tail;
+	reassembles_tail = &rsm->next;
+	reassembles_count++;
+      }
+    if (rsm->ttl > iph->ttl)
+      rsm->ttl = iph->ttl;
 
-      nb_top_p = grub_priority_queue_top (rsm->pq);
-      if (!nb_top_p)
-	return GRUB_ERR_NONE;
-      nb_top = *nb_top_p;
-      grub_priority_queue_pop (rsm->pq);
-      iph = (struct iphdr *) nb_top->data;
-      err = grub_netbuff_pull (nb_top, ((iph->verhdrlen & 0xf)
-					* sizeof (grub_uint32_t)));
-      if (err)
-	{
-	  grub_netbuff_free (nb_top);
-	  return err;
-	}
-      if (rsm->cur_ptr < (grub_size_t) 8 * (grub_be_to_cpu16 (iph->frags)
-					    & OFFSET_MASK))
-	{
-	  grub_netbuff_free (nb_top);
-	  return GRUB_ERR_NONE;
-	}
+    if (!more)
+      {
+	if (rsm->total_len && rsm->total_len != off + len)
+	  {
+	    grub_netbuff_free (nb);
+	    return GRUB_ERR_NONE;
+	  }
+	rsm->total_len = off + len;
+      }
+    if (rsm->total_len && off + len > rsm->total_len)
+      {
+	if (off >= rsm->total_len)
+	  {
+	    grub_netbuff_free (nb);
+	    return GRUB_ERR_NONE;
+	  }
+	len = rsm->total_len - off;
+      }
 
-      rsm->cur_ptr = (8 * (grub_be_to_cpu16 (iph->frags) & OFFSET_MASK)
-		      + (nb_top->tail - nb_top->head));
-      if ((grub_size_t) 8 * (grub_be_to_cpu16 (iph->frags) & OFFSET_MASK)
-	  >= rsm->total_len)
-	{
-	  grub_netbuff_free (nb_top);
-	  continue;
-	}
-      copy = nb_top->tail - nb_top->data;
-      if (rsm->total_len - 8 * (grub_be_to_cpu16 (iph->frags) & OFFSET_MASK)
-	  < copy)
-	copy = rsm->total_len - 8 * (grub_be_to_cpu16 (iph->frags)
-				     & OFFSET_MASK);
-      grub_memcpy (&rsm->asm_netbuff->data[8 * (grub_be_to_cpu16 (iph->frags)
-						& OFFSET_MASK)],
-		   nb_top->data, copy);
-
-      if ((grub_be_to_cpu16 (iph->frags) & MORE_FRAGMENTS))
+    grub_memcpy (rsm->asm_netbuff->data + off, nb->data, len);
+    grub_netbuff_free (nb);
+
+    end_unit = (off + len + 7) / 8;
+    for (unit = off / 8; unit < end_unit; unit++)
+      if (!(rsm->have[unit / 8] & (1 << (unit % 8))))
 	{
-	  grub_netbuff_free (nb_top);
-	  continue;
+	  rsm->have[unit / 8] |= 1 << (unit % 8);
+	  rsm->have_units++;
 	}
-      grub_netbuff_free (nb_top);
 
-      ret = rsm->asm_netbuff;
-      proto = rsm->proto;
-      src = rsm->source;
-      dst = rsm->dest;
-      ttl = rsm->ttl;
+    if (!rsm->total_len || rsm->have_units != (rsm->total_len + 7) / 8)
+      return GRUB_ERR_NONE;
 
-      rsm->asm_netbuff = 0;
-      res_len = rsm->total_len;
-      *prev = rsm->next;
-      free_rsm (rsm);
+    ret = rsm->asm_netbuff;
+    rsm->asm_netbuff = 0;
+    unlink_rsm (prev);
 
-      if (grub_netbuff_put (ret, res_len))
-	{
-	  grub_netbuff_free (ret);
-	  return GRUB_ERR_NONE;
-	}
+    source.type = GRUB_NET_NETWORK_LEVEL_PROTOCOL_IPV4;
+    source.ipv4 = rsm->source;
 
-      source.type = GRUB_NET_NETWORK_LEVEL_PROTOCOL_IPV4;
-      source.ipv4 = src;
+    dest.type = GRUB_NET_NETWORK_LEVEL_PROTOCOL_IPV4;
+    dest.ipv4 = rsm->dest;
 
-      dest.type = GRUB_NET_NETWORK_LEVEL_PROTOCOL_IPV4;
-      dest.ipv4 = dst;
+    err = grub_netbuff_put (ret, rsm->total_len);
+    if (err)
+      {
+	free_rsm (rsm);
+	grub_netbuff_free (ret);
+	return GRUB_ERR_NONE;
+      }
 
-      return handle_dgram (ret, card, src_hwaddress,
-			   hwaddress, proto, &source, &dest,
-			   ttl);
-    }
+    proto = rsm->proto;
+    ttl = rsm->ttl;
+    free_rsm (rsm);
+
+    return handle_dgram (ret, card, src_hwaddress, hwaddress, proto,
+			 &source, &dest, ttl);
+  }
 }
 
 static grub_err_t
@@ -29,6 +29,7 @@
 #include <grub/net/ethernet.h>
 #include <grub/net/arp.h>
 #include <grub/net/ip.h>
+#include <grub/net/tls.h>
 #include <grub/loader.h>
 #include <grub/bufio.h>
 #include <grub/kernel.h>
@@ -50,36 +51,77 @@ struct grub_net_route
     struct grub_net_network_level_interface *interface;
     grub_net_network_level_address_t gw;
   };
+  /* Trie node holding this route and the next route with the same
+     prefix.  */
+  struct grub_net_route_node *node;
+  struct grub_net_route *node_next;
+};
+
+/* Binary trie over the address bits, one per address family.  A node at
+   depth N holds the routes whose prefix is its N-bit path, newest
+   first.  */
+struct grub_net_route_node
+{
+  struct grub_net_route_node *child[2];
+  struct grub_net_route_node *parent;
+  struct grub_net_route *routes;
 };
 
 struct grub_net_route *grub_net_routes = NULL;
+static struct grub_net_route_node *route_trie_ipv4, *route_trie_ipv6;
+static unsigned route_count;
 struct grub_net_network_level_interface *grub_net_network_level_interfaces = NULL;
 struct grub_net_card *grub_net_cards = NULL;
 struct grub_net_network_level_protocol *grub_net_network_level_protocols = NULL;
+struct grub_net_stats grub_net_stats;
 static struct grub_fs grub_net_fs;
 
 struct grub_net_link_layer_entry {
   int avail;
+  /* Next entry in the same hash chain, or -1.  */
+  int next;
   grub_net_network_level_address_t nl_address;
   grub_net_link_level_address_t ll_address;
 };
 
 #define LINK_LAYER_CACHE_SIZE 256
+#define LINK_LAYER_HASH_SIZE 64
+
+/* The neighbours of a card.  Entries are reused in turn, oldest first,
+   and found through hash chains.  */
+struct grub_net_link_layer_cache {
+  struct grub_net_link_layer_entry entries[LINK_LAYER_CACHE_SIZE];
+  int heads[LINK_LAYER_HASH_SIZE];
+  unsigned new_entry;
+};
+
+static unsigned
+link_layer_hash (const grub_net_network_level_address_t *proto)
+{
+  grub_uint32_t h;
+
+  if (proto->type == GRUB_NET_NETWORK_LEVEL_PROTOCOL_IPV6)
+    h = (proto->ipv6[1] ^ (proto->ipv6[1] >> 32)
+	 ^ proto->ipv6[0] ^ (proto->ipv6[0] >> 32));
+  else
+    h = proto->ipv4;
+  /* Fibonacci hashing; the top bits are the best mixed.  */
+  return (h * 0x9e3779b1) >> (32 - 6);
+}
 
 static struct grub_net_link_layer_entry *
 link_layer_find_entry (const grub_net_network_level_address_t *proto,
 		       const struct grub_net_card *card)
 {
-  unsigned i;
-  if (!card->link_layer_table)
+  struct grub_net_link_layer_cache *cache = card->link_layer_cache;
+  int i;
+
+  if (!cache)
     return NULL;
-  for (i = 0; i < LINK_LAYER_CACHE_SIZE; i++)
-    {
-      if (card->link_layer_table[i].avail == 1 
-	  && grub_net_addr_cmp (&card->link_layer_table[i].nl_address,
-				proto) == 0)
-	return &card->link_layer_table[i];
-    }
+  for (i = cache->heads[link_layer_hash (proto)]; i >= 0;
+       i = cache->entries[i].next)
+    if (grub_net_addr_cmp (&cache->entries[i].nl_address, proto) == 0)
+      return &cache->entries[i];
   return NULL;
 }
 
@@ -89,7 +131,10 @@ grub_net_link_layer_add_address (struct grub_net_card *card,
 				 const grub_net_link_level_address_t *ll,
 				 int override)
 {
+  struct grub_net_link_layer_cache *cache;
   struct grub_net_link_layer_entry *entry;
+  int *link;
+  unsigned i, h;
 
   /* Check if the sender is in the cache table.  */
   entry = link_layer_find_entry (nl, card);
@@ -100,16 +145,37 @@ grub_net_link_layer_add_address (struct grub_net_card *card,
     return;
 
   /* Add sender to cache table.  */
-  if (card->link_layer_table == NULL)
-    card->link_layer_table = grub_zalloc (LINK_LAYER_CACHE_SIZE
-					  * sizeof (card->link_layer_table[0]));
-  entry = &(card->link_layer_table[card->new_ll_entry]);
+  if (card->link_layer_cache == NULL)
+    {
+      card->link_layer_cache = grub_zalloc (sizeof (*card->link_layer_cache));
+      if (!card->link_layer_cache)
+	{
+	  grub_errno = GRUB_ERR_NONE;
+	  return;
+	}
+      for (i = 0; i < LINK_LAYER_HASH_SIZE; i++)
+	card->link_layer_cache->heads[i] = -1;
+    }
+  cache = card->link_layer_cache;
+
+  i = cache->new_entry;
+  entry = &cache->entries[i];
+  if (entry->avail)
+    for (link = &cache->heads[link_layer_hash (&entry->nl_address)];
+	 *link >= 0; link = &cache->entries[*link].next)
+      if (*link == (int) i)
+	{
+	  *link = entry->next;
+	  break;
+	}
+
+  h = link_layer_hash (nl);
   entry->avail = 1;
   grub_memcpy (&entry->ll_address, ll, sizeof (entry->ll_address));
   grub_memcpy (&entry->nl_address, nl, sizeof (entry->nl_address));
-  card->new_ll_entry++;
-  if (card->new_ll_entry == LINK_LAYER_CACHE_SIZE)
-    card->new_ll_entry = 0;
+  entry->next = cache->heads[h];
+  cache->heads[h] = i;
+  cache->new_entry = (i + 1) % LINK_LAYER_CACHE_SIZE;
 }
 
 int
@@ -171,10 +237,10 @@ grub_net_link_layer_resolve (struct grub_net_network_level_interface *inf,
   switch (proto_addr->type)
     {
     case GRUB_NET_NETWORK_LEVEL_PROTOCOL_IPV4:
-      err = grub_net_arp_send_request (inf, proto_addr);
+      err = grub_net_arp_send_request (inf, proto_addr, 1);
       break;
     case GRUB_NET_NETWORK_LEVEL_PROTOCOL_IPV6:
-      err = grub_net_icmp6_send_request (inf, proto_addr);
+      err = grub_net_icmp6_send_request (inf, proto_addr, 1);
       break;
     case GRUB_NET_NETWORK_LEVEL_PROTOCOL_DHCP_RECV:
       return grub_error (GRUB_ERR_BUG, "shouldn't reach here");
@@ -194,6 +260,37 @@ grub_net_link_layer_resolve (struct grub_net_network_level_interface *inf,
 		     N_("timeout: could not resolve hardware address"));
 }
 
+/* Send one ARP request or neighbour solicitation for PROTO_ADDR without
+   waiting for the answer.  The reply is learnt by whatever polls the card
+   next, so a later grub_net_link_layer_resolve finds it in the cache.  */
+void
+grub_net_link_layer_prefetch (struct grub_net_network_level_interface *inf,
+			      const grub_net_network_level_address_t *proto_addr)
+{
+  grub_err_t err;
+
+  if (grub_net_link_layer_resolve_check (inf, proto_addr))
+    return;
+  switch (proto_addr->type)
+    {
+    case GRUB_NET_NETWORK_LEVEL_PROTOCOL_IPV4:
+      if (proto_addr->ipv4 == 0
+	  || (grub_be_to_cpu32 (proto_addr->ipv4) >> 28) == 0xe)
+	return;
+      err = grub_net_arp_send_request (inf, proto_addr, 0);
+      break;
+    case GRUB_NET_NETWORK_LEVEL_PROTOCOL_IPV6:
+      if ((grub_be_to_cpu64 (proto_addr->ipv6[0]) >> 56) == 0xff)
+	return;
+      err = grub_net_icmp6_send_request (inf, proto_addr, 0);
+      break;
+    default:
+      return;
+    }
+  if (err)
+    grub_errno = GRUB_ERR_NONE;
+}
+
 void
 grub_net_card_unregister (struct grub_net_card *card)
 {
@@ -207,6 +304,8 @@ grub_net_card_unregister (struct grub_net_card *card)
 	card->driver->close (card);
       card->opened = 0;
     }
+  grub_free (card->link_layer_cache);
+  card->link_layer_cache = NULL;
   grub_list_remove (GRUB_AS_LIST (card));
 }
 
@@ -410,11 +509,132 @@ grub_cmd_ipv6_autoconf (struct grub_command *cmd __attribute__ ((unused)),
   return err;
 }
 
-static inline void
+static struct grub_net_route_node **
+route_trie_root (grub_network_level_protocol_id_t type, unsigned *bits)
+{
+  switch (type)
+    {
+    case GRUB_NET_NETWORK_LEVEL_PROTOCOL_IPV4:
+      *bits = 32;
+      return &route_trie_ipv4;
+    case GRUB_NET_NETWORK_LEVEL_PROTOCOL_IPV6:
+      *bits = 128;
+      return &route_trie_ipv6;
+    default:
+      return NULL;
+    }
+}
+
+/* Bit I of ADDR, counting from the most significant bit.  */
+static inline int
+route_addr_bit (const grub_net_network_level_address_t *addr, unsigned i)
+{
+  if (addr->type == GRUB_NET_NETWORK_LEVEL_PROTOCOL_IPV4)
+    return (grub_be_to_cpu32 (addr->ipv4) >> (31 - i)) & 1;
+  return (grub_be_to_cpu64 (addr->ipv6[i / 64]) >> (63 - i % 64)) & 1;
+}
+
+static void
 grub_net_route_register (struct grub_net_route *route)
 {
+  struct grub_net_route_node **link, *node = NULL;
+  grub_net_network_level_address_t base;
+  unsigned bits, masksize, i;
+
   grub_list_push (GRUB_AS_LIST_P (&grub_net_routes),
 		  GRUB_AS_LIST (route));
+  route_count++;
+
+  link = route_trie_root (route->target.type, &bits);
+  if (!link)
+    return;
+  base.type = route->target.type;
+  if (base.type == GRUB_NET_NETWORK_LEVEL_PROTOCOL_IPV4)
+    {
+      base.ipv4 = route->target.ipv4.base;
+      masksize = route->target.ipv4.masksize;
+    }
+  else
+    {
+      base.ipv6[0] = route->target.ipv6.base[0];
+      base.ipv6[1] = route->target.ipv6.base[1];
+      masksize = route->target.ipv6.masksize;
+    }
+  if (masksize > bits)
+    masksize = bits;
+
+  for (i = 0; ; i++)
+    {
+      if (!*link)
+	{
+	  *link = grub_zalloc (sizeof (**link));
+	  if (!*link)
+	    {
+	      /* Still listed, just never matched.  */
+	      grub_errno = GRUB_ERR_NONE;
+	      return;
+	    }
+	  (*link)->parent = node;
+	}
+      node = *link;
+      if (i == masksize)
+	break;
+      link = &node->child[route_addr_bit (&base, i)];
+    }
+  route->node = node;
+  route->node_next = node->routes;
+  node->routes = route;
+}
+
+static void
+grub_net_route_unregister (struct grub_net_route *route)
+{
+  struct grub_net_route_node *node = route->node, *parent;
+  struct grub_net_route **link;
+  unsigned bits;
+
+  grub_list_remove (GRUB_AS_LIST (route));
+  route_count--;
+  if (!node)
+    return;
+
+  for (link = &node->routes; *link != route; link = &(*link)->node_next);
+  *link = route->node_next;
+
+  /* Prune the branch that led only to this route.  */
+  while (node && !node->routes && !node->child[0] && !node->child[1])
+    {
+      parent = node->parent;
+      if (parent)
+	parent->child[parent->child[1] == node] = NULL;
+      else
+	*route_trie_root (route->target.type, &bits) = NULL;
+      grub_free (node);
+      node = parent;
+    }
+}
+
+/* Longest prefix match; among routes with the same prefix the newest
+   wins.  */
+static struct grub_net_route *
+route_lookup (const grub_net_network_level_address_t *addr)
+{
+  struct grub_net_route_node **root, *node;
+  struct grub_net_route *best = NULL;
+  unsigned bits, i;
+
+  root = route_trie_root (addr->type, &bits);
+  if (!root)
+    return NULL;
+  for (node = *root, i = 0; node; i++)
+    {
+      if (node->routes)
+	best = node->routes;
+      if (i == bits)
+	break;
+      node = node->child[route_addr_bit (addr, i)];
+    }
+  return best;
 }
 
 #define FOR_NET_ROUTES(var) for (var = grub_net_routes; var; var = var->next)
@@ -503,46 +723,6 @@ parse_ip6 (const char *val, grub_uint64_t *ip, const char **rest)
   return 1;
 }
 
-static int
-match_net (const grub_net_network_level_netaddress_t *net,
-	   const grub_net_network_level_address_t *addr)
-{
-  if (net->type != addr->type)
-    return 0;
-  switch (net->type)
-    {
-    case GRUB_NET_NETWORK_LEVEL_PROTOCOL_DHCP_RECV:
-      return 0;
-    case GRUB_NET_NETWORK_LEVEL_PROTOCOL_IPV4:
-      {
-	grub_uint32_t mask = (0xffffffffU << (32 - net->ipv4.masksize));
-	if (net->ipv4.masksize == 0)
-	  mask = 0;
-	return ((grub_be_to_cpu32 (net->ipv4.base) & mask)
-		== (grub_be_to_cpu32 (addr->ipv4) & mask));
-      }
-    case GRUB_NET_NETWORK_LEVEL_PROTOCOL_IPV6:
-      {
-	grub_uint64_t mask[2];
-	if (net->ipv6.masksize <= 64)
-	  {
-	    mask[0] = 0xffffffffffffffffULL << (64 - net->ipv6.masksize);
-	    mask[1] = 0;
-	  }
-	else 
-	  {
-	    mask[0] = 0xffffffffffffffffULL;
-	    mask[1] = 0xffffffffffffffffULL << (128 - net->ipv6.masksize);
-	  }
-	return (((grub_be_to_cpu64 (net->ipv6.base[0]) & mask[0])
-		== (grub_be_to_cpu64 (addr->ipv6[0]) & mask[0]))
-		&& ((grub_be_to_cpu64 (net->ipv6.base[1]) & mask[1])
-		    == (grub_be_to_cpu64 (addr->ipv6[1]) & mask[1])));
-      }
-    }
-  return 0;
-}
-
 grub_err_t
 grub_net_resolve_address (const char *name,
 			  grub_net_network_level_address_t *addr)
@@ -616,67 +796,19 @@ grub_net_resolve_net_address (const char *name,
 		     name);
 }
 
-static int
-route_cmp (const struct grub_net_route *a, const struct grub_net_route *b)
-{
-  if (a == NULL && b == NULL)
-    return 0;
-  if (b == NULL)
-    return +1;
-  if (a == NULL)
-    return -1;
-  if (a->target.type < b->target.type)
-    return -1;
-  if (a->target.type > b->target.type)
-    return +1;
-  switch (a->target.type)
-    {
-    case GRUB_NET_NETWORK_LEVEL_PROTOCOL_DHCP_RECV:
-      break;
-    case GRUB_NET_NETWORK_LEVEL_PROTOCOL_IPV6:
-      if (a->target.ipv6.masksize > b->target.ipv6.masksize)
-	return +1;
-      if (a->target.ipv6.masksize < b->target.ipv6.masksize)
-	return -1;
-      break;
-    case GRUB_NET_NETWORK_LEVEL_PROTOCOL_IPV4:
-      if (a->target.ipv4.masksize > b->target.ipv4.masksize)
-	return +1;
-      if (a->target.ipv4.masksize < b->target.ipv4.masksize)
-	return -1;
-      break;
-    }
-  return 0;
-}
-
 grub_err_t
 grub_net_route_address (grub_net_network_level_address_t addr,
 			grub_net_network_level_address_t *gateway,
 			struct grub_net_network_level_interface **interf)
 {
-  struct grub_net_route *route;
   unsigned int depth = 0;
-  unsigned int routecnt = 0;
-  struct grub_net_network_level_protocol *prot = NULL;
   grub_net_network_level_address_t curtarget = addr;
 
   *gateway = addr;
 
-  FOR_NET_ROUTES(route)
-    routecnt++;
-
-  for (depth = 0; depth < routecnt + 2 && depth < GRUB_UINT_MAX; depth++)
+  for (depth = 0; depth < route_count + 2 && depth < GRUB_UINT_MAX; depth++)
     {
-      struct grub_net_route *bestroute = NULL;
-      FOR_NET_ROUTES(route)
-      {
-	if (depth && prot != route->prot)
-	  continue;
-	if (!match_net (&route->target, &curtarget))
-	  continue;
-	if (route_cmp (route, bestroute) > 0)
-	  bestroute = route;
-      }
+      struct grub_net_route *bestroute = route_lookup (&curtarget);
       if (bestroute == NULL)
 	return grub_error (GRUB_ERR_NET_NO_ROUTE,
 			   N_("destination unreachable"));
@@ -1065,16 +1197,15 @@ grub_cmd_delroute (struct grub_command *cmd __attribute__ ((unused)),
   if (argc != 1)
     return grub_error (GRUB_ERR_BAD_ARGUMENT, N_("one argument expected"));
   
-  for (prev = &grub_net_routes, route = *prev; route; prev = &((*prev)->next),
-	 route = *prev)
+  for (prev = &grub_net_routes, route = *prev; route; route = *prev)
     if (grub_strcmp (route->name, args[0]) == 0)
       {
-	*prev = route->next;
+	grub_net_route_unregister (route);
 	grub_free (route->name);
 	grub_free (route);
-	if (!*prev)
-	  break;
       }
+    else
+      prev = &route->next;
 
   return GRUB_ERR_NONE;
 }
@@ -1247,6 +1378,65 @@ grub_cmd_listcards (struct grub_command *cmd __attribute__ ((unused)),
   return GRUB_ERR_NONE;
 }
 
+void
+grub_net_rtt_sample (struct grub_net_rtt_stats *stats, grub_uint32_t rtt)
+{
+  if (!stats->samples || rtt < stats->min)
+    stats->min = rtt;
+  if (rtt > stats->max)
+    stats->max = rtt;
+  stats->total += rtt;
+  stats->samples++;
+}
+
+static void
+print_rtt (const char *name, const struct grub_net_rtt_stats *stats)
+{
+  if (!stats->samples)
+    return;
+  grub_printf_ (N_("%s rtt: min/avg/max %u/%llu/%u ms (%lu samples)\n"),
+		name, stats->min,
+		(unsigned long long) grub_divmod64 (stats->total,
+						    stats->samples, 0),
+		stats->max, stats->samples);
+}
+
+static grub_err_t
+grub_cmd_stats (struct grub_command *cmd __attribute__ ((unused)),
+		int argc __attribute__ ((unused)),
+		char **args __attribute__ ((unused)))
+{
+  struct grub_net_card *card;
+
+  FOR_NET_CARDS (card)
+  {
+    grub_printf_ (N_("%s: rx %lu packets (%llu KiB), %lu dropped;"
+		     " tx %lu packets (%llu KiB), %lu errors\n"),
+		  card->name, card->stats.rx_packets,
+		  (unsigned long long) (card->stats.rx_bytes >> 10),
+		  card->stats.rx_dropped, card->stats.tx_packets,
+		  (unsigned long long) (card->stats.tx_bytes >> 10),
+		  card->stats.tx_errors);
+  }
+
+  grub_printf_ (N_("tcp: %lu retransmits, %lu out of order,"
+		   " %lu duplicates\n"),
+		grub_net_stats.tcp_retransmits,
+		grub_net_stats.tcp_out_of_order,
+		grub_net_stats.tcp_duplicates);
+  print_rtt ("tcp", &grub_net_stats.tcp_rtt);
+  grub_printf_ (N_("tftp: %lu files, %lu blocks, %lu duplicates,"
+		   " %lu out of order, %lu timeouts\n"),
+		grub_net_stats.tftp_files, grub_net_stats.tftp_blocks,
+		grub_net_stats.tftp_duplicates,
+		grub_net_stats.tftp_out_of_order,
+		grub_net_stats.tftp_timeouts);
+  print_rtt ("tftp", &grub_net_stats.tftp_rtt);
+  grub_net_tcp_print_stats ();
+
+  return GRUB_ERR_NONE;
+}
+
 static grub_err_t
 grub_cmd_listaddrs (struct grub_command *cmd __attribute__ ((unused)),
 		    int argc __attribute__ ((unused)),
@@ -1265,6 +1455,8 @@ grub_cmd_listaddrs (struct grub_command *cmd __attribute__ ((unused)),
 }
 
 grub_net_app_level_t grub_net_app_level_list;
+struct grub_net_cache_ops *grub_net_cache;
+struct grub_net_tls_ops *grub_net_tls;
 struct grub_net_socket *grub_net_sockets;
 
 static grub_net_t
@@ -1378,15 +1570,32 @@ grub_net_open_real (const char *name)
 	  if (skip)
 	    continue;
 
-	  if (sizeof ("http") - 1 == protnamelen
-	      && grub_memcmp ("http", protname, protnamelen) == 0)
+#ifdef GRUB_MACHINE_EFI
+	  /* Prefer the firmware HTTP stack; efihttp hands files over to the
+	     http module itself when the firmware can't serve them.  */
+	  if ((sizeof ("http") - 1 == protnamelen
+	       && grub_memcmp ("http", protname, protnamelen) == 0)
+	      || (sizeof ("https") - 1 == protnamelen
+		  && grub_memcmp ("https", protname, protnamelen) == 0))
+	    {
+	      if (grub_dl_load ("efihttp"))
+		continue;
+	      grub_errno = GRUB_ERR_NONE;
+	    }
+#endif
+	  if ((sizeof ("http") - 1 == protnamelen
+	       && grub_memcmp ("http", protname, protnamelen) == 0)
+	      || (sizeof ("https") - 1 == protnamelen
+		  && grub_memcmp ("https", protname, protnamelen) == 0))
 	    {
 	      grub_dl_load ("http");
 	      grub_errno = GRUB_ERR_NONE;
 	      continue;
 	    }
-	  if (sizeof ("tftp") - 1 == protnamelen
-	      && grub_memcmp ("tftp", protname, protnamelen) == 0)
+	  if ((sizeof ("tftp") - 1 == protnamelen
+	       && grub_memcmp ("tftp", protname, protnamelen) == 0)
+	      || (sizeof ("mtftp") - 1 == protnamelen
+		  && grub_memcmp ("mtftp", protname, protnamelen) == 0))
 	    {
 	      grub_dl_load ("tftp");
 	      grub_errno = GRUB_ERR_NONE;
@@ -1413,11 +1622,657 @@ grub_net_fs_dir (grub_device_t device, const char *path __attribute__ ((unused))
   return GRUB_ERR_NONE;
 }
 
+/* Files fetched ahead of time by net_prefetch.  The first open of the
+   same protocol, server and path is served from memory; the entry is
+   dropped when that file is closed.  */
+struct grub_net_prefetch
+{
+  struct grub_net_prefetch *next;
+  struct grub_net_prefetch **prev;
+  char *protocol;
+  char *server;
+  char *name;
+  char *buf;
+  grub_size_t size;
+  grub_size_t alloc;
+  grub_size_t pos;
+  grub_net_content_encoding_t encoding;
+  /* Only while the download is in progress.  */
+  struct grub_file *file;
+  grub_uint64_t last_progress;
+};
+
+/* Size of the packets handed to bufio when serving a prefetched file.  */
+#define GRUB_NET_PREFETCH_CHUNK 65536
+
+static struct grub_net_prefetch *grub_net_prefetched;
+
+static void
+prefetch_free (struct grub_net_prefetch *pf)
+{
+  grub_free (pf->protocol);
+  grub_free (pf->server);
+  grub_free (pf->name);
+  grub_free (pf->buf);
+  grub_free (pf);
+}
+
+static void
+prefetch_flush (void)
+{
+  while (grub_net_prefetched)
+    {
+      struct grub_net_prefetch *pf = grub_net_prefetched;
+      grub_list_remove (GRUB_AS_LIST (pf));
+      prefetch_free (pf);
+    }
+}
+
+static struct grub_net_prefetch *
+prefetch_claim (const char *protocol, const char *server, const char *name)
+{
+  struct grub_net_prefetch *pf;
+
+  FOR_LIST_ELEMENTS (pf, grub_net_prefetched)
+    if (grub_strcmp (pf->protocol, protocol) == 0
+	&& grub_strcmp (pf->server, server) == 0
+	&& grub_strcmp (pf->name, name) == 0)
+      {
+	grub_list_remove (GRUB_AS_LIST (pf));
+	return pf;
+      }
+  return NULL;
+}
+
+static grub_err_t
+prefetched_open (struct grub_file *file,
+		 const char *filename __attribute__ ((unused)))
+{
+  struct grub_net_prefetch *pf = file->data;
+
+  file->size = pf->size;
+  file->not_easily_seekable = 0;
+  pf->pos = 0;
+  file->device->net->encoding = pf->encoding;
+  /* Nothing to wait for from the network.  */
+  file->device->net->stall = 1;
+  file->device->net->eof = (pf->size == 0);
+  return GRUB_ERR_NONE;
+}
+
+static grub_err_t
+prefetched_packets_pulled (struct grub_file *file)
+{
+  struct grub_net_prefetch *pf = file->data;
+  grub_net_t net = file->device->net;
+  struct grub_net_buff *nb;
+  grub_size_t len;
+  grub_err_t err;
+
+  if (net->packs.first || pf->pos >= pf->size)
+    return GRUB_ERR_NONE;
+
+  len = pf->size - pf->pos;
+  if (len > GRUB_NET_PREFETCH_CHUNK)
+    len = GRUB_NET_PREFETCH_CHUNK;
+  nb = grub_netbuff_alloc (len);
+  if (!nb)
+    return grub_errno;
+  err = grub_netbuff_put (nb, len);
+  if (err)
+    {
+      grub_netbuff_free (nb);
+      return err;
+    }
+  grub_memcpy (nb->data, pf->buf + pf->pos, len);
+  err = grub_net_put_packet (&net->packs, nb);
+  if (err)
+    {
+      grub_netbuff_free (nb);
+      return err;
+    }
+  pf->pos += len;
+  if (pf->pos == pf->size)
+    net->eof = 1;
+  return GRUB_ERR_NONE;
+}
+
+static grub_err_t
+prefetched_seek (struct grub_file *file, grub_off_t off)
+{
+  struct grub_net_prefetch *pf = file->data;
+  grub_net_t net = file->device->net;
+
+  while (net->packs.first)
+    {
+      grub_netbuff_free (net->packs.first->nb);
+      grub_net_remove_packet (net->packs.first);
+    }
+  pf->pos = off < pf->size ? off : pf->size;
+  net->offset = off;
+  net->eof = (pf->pos == pf->size);
+  return GRUB_ERR_NONE;
+}
+
+static grub_err_t
+prefetched_close (struct grub_file *file)
+{
+  prefetch_free (file->data);
+  file->data = NULL;
+  return GRUB_ERR_NONE;
+}
+
+/* Not registered: grub_net_fs_open switches to it when it finds a
+   matching prefetched file.  */
+static struct grub_net_app_protocol grub_net_prefetched_protocol =
+  {
+    .name = "prefetched",
+    .open = prefetched_open,
+    .seek = prefetched_seek,
+    .close = prefetched_close,
+    .packets_pulled = prefetched_packets_pulled
+  };
+
+/* Start downloading NAME, a full "(proto,server)/path" file name.  */
+static struct grub_net_prefetch *
+prefetch_start (const char *name)
+{
+  struct grub_net_prefetch *pf;
+  struct grub_file *file;
+  grub_device_t dev;
+  const char *path;
+  char *devname;
+  grub_net_t net;
+
+  devname = grub_file_get_device_name (name);
+  if (grub_errno)
+    return NULL;
+  path = grub_strchr (name, ')');
+  if (!devname || !path)
+    {
+      grub_free (devname);
+      grub_error (GRUB_ERR_BAD_FILENAME, N_("`%s' is not a network file"),
+		  name);
+      return NULL;
+    }
+  path++;
+
+  dev = grub_device_open (devname);
+  grub_free (devname);
+  if (!dev)
+    return NULL;
+  net = dev->net;
+  if (!net)
+    {
+      grub_device_close (dev);
+      grub_error (GRUB_ERR_BAD_FILENAME, N_("`%s' is not a network file"),
+		  name);
+      return NULL;
+    }
+
+  file = grub_zalloc (sizeof (*file));
+  pf = grub_zalloc (sizeof (*pf));
+  if (!file || !pf)
+    goto fail_alloc;
+  pf->protocol = grub_strdup (net->protocol->name);
+  pf->server = grub_strdup (net->server);
+  pf->name = grub_strdup (path);
+  net->name = grub_strdup (path);
+  if (!pf->protocol || !pf->server || !pf->name || !net->name)
+    goto fail_alloc;
+
+  file->device = dev;
+  file->size = GRUB_FILE_SIZE_UNKNOWN;
+  net->packs.first = NULL;
+  net->packs.last = NULL;
+  if (net->protocol->open (file, path))
+    goto fail;
+
+  /* Size the buffer up front when the server told us the length.  */
+  if (file->size != GRUB_FILE_SIZE_UNKNOWN && file->size > 0
+      && file->size < 0x40000000)
+    {
+      pf->buf = grub_malloc (file->size);
+      if (pf->buf)
+	pf->alloc = file->size;
+      grub_errno = GRUB_ERR_NONE;
+    }
+
+  pf->file = file;
+  pf->last_progress = grub_get_time_ms ();
+  return pf;
+
+ fail_alloc:
+  grub_error (GRUB_ERR_OUT_OF_MEMORY, N_("out of memory"));
+ fail:
+  while (net->packs.first)
+    {
+      grub_netbuff_free (net->packs.first->nb);
+      grub_net_remove_packet (net->packs.first);
+    }
+  grub_free (net->name);
+  grub_device_close (dev);
+  grub_free (file);
+  if (pf)
+    prefetch_free (pf);
+  return NULL;
+}
+
+/* Move whatever the protocol queued for PF into its buffer.  */
+static grub_err_t
+prefetch_drain (struct grub_net_prefetch *pf)
+{
+  grub_net_t net = pf->file->device->net;
+
+  while (net->packs.first)
+    {
+      struct grub_net_buff *nb = net->packs.first->nb;
+      grub_size_t len = nb->tail - nb->data;
+
+      if (len > pf->alloc - pf->size)
+	{
+	  grub_size_t alloc = pf->alloc ? pf->alloc * 2 : 65536;
+	  char *buf;
+
+	  while (alloc < pf->size + len)
+	    alloc *= 2;
+	  buf = grub_realloc (pf->buf, alloc);
+	  if (!buf)
+	    return grub_errno;
+	  pf->buf = buf;
+	  pf->alloc = alloc;
+	}
+      grub_memcpy (pf->buf + pf->size, nb->data, len);
+      pf->size += len;
+      grub_netbuff_free (nb);
+      grub_net_remove_packet (net->packs.first);
+      pf->last_progress = grub_get_time_ms ();
+    }
+  net->offset = pf->size;
+  if (net->protocol->packets_pulled)
+    return net->protocol->packets_pulled (pf->file);
+  return GRUB_ERR_NONE;
+}
+
+/* Close the download side of PF.  */
+static void
+prefetch_stop (struct grub_net_prefetch *pf)
+{
+  grub_net_t net = pf->file->device->net;
+
+  while (net->packs.first)
+    {
+      grub_netbuff_free (net->packs.first->nb);
+      grub_net_remove_packet (net->packs.first);
+    }
+  pf->encoding = net->encoding;
+  net->protocol->close (pf->file);
+  grub_free (net->etag);
+  grub_free (net->name);
+  grub_device_close (pf->file->device);
+  grub_free (pf->file);
+  pf->file = NULL;
+}
+
+grub_err_t
+grub_net_prefetch (int n, char **names)
+{
+  struct grub_net_prefetch **pending;
+  grub_err_t ret = GRUB_ERR_NONE;
+  int active = 0;
+  int i;
+
+  pending = grub_zalloc (n * sizeof (pending[0]));
+  if (!pending)
+    return grub_errno;
+
+  for (i = 0; i < n; i++)
+    {
+      pending[i] = prefetch_start (names[i]);
+      if (!pending[i])
+	{
+	  ret = grub_errno;
+	  grub_print_error ();
+	  continue;
+	}
+      active++;
+    }
+
+  /* Every open socket keeps receiving while we poll, so the files
+     arrive side by side instead of one after the other.  */
+  while (active)
+    {
+      grub_uint64_t now;
+
+      grub_net_poll_cards (1, NULL);
+      now = grub_get_time_ms ();
+      for (i = 0; i < n; i++)
+	{
+	  struct grub_net_prefetch *pf = pending[i];
+	  grub_net_t net;
+
+	  if (!pf)
+	    continue;
+	  net = pf->file->device->net;
+	  if (prefetch_drain (pf) == GRUB_ERR_NONE)
+	    {
+	      if (net->eof && !net->packs.first)
+		{
+		  struct grub_net_prefetch *old;
+
+		  prefetch_stop (pf);
+		  /* A second prefetch of the same file replaces the first.  */
+		  old = prefetch_claim (pf->protocol, pf->server, pf->name);
+		  if (old)
+		    prefetch_free (old);
+		  grub_list_push (GRUB_AS_LIST_P (&grub_net_prefetched),
+				  GRUB_AS_LIST (pf));
+		  pending[i] = NULL;
+		  active--;
+		  continue;
+		}
+	      if (now - pf->last_progress
+		  < GRUB_NET_TRIES * GRUB_NET_INTERVAL)
+		continue;
+	      grub_error (GRUB_ERR_TIMEOUT, N_("timeout reading `%s'"),
+			  names[i]);
+	    }
+	  ret = grub_errno;
+	  grub_print_error ();
+	  prefetch_stop (pf);
+	  prefetch_free (pf);
+	  pending[i] = NULL;
+	  active--;
+	}
+    }
+
+  grub_free (pending);
+  if (ret)
+    return grub_error (ret, N_("some files could not be prefetched"));
+  return GRUB_ERR_NONE;
+}
+
+static grub_err_t
+grub_cmd_prefetch (struct grub_command *cmd __attribute__ ((unused)),
+		   int argc, char **args)
+{
+  if (argc < 1)
+    return grub_error (GRUB_ERR_BAD_ARGUMENT, N_("filename expected"));
+  return grub_net_prefetch (argc, args);
+}
+
+static grub_ssize_t
+grub_net_fs_read_real (grub_file_t file, char *buf, grub_size_t len);
+
+static int
+net_name_has_suffix (const char *name, const char *suffix)
+{
+  grub_size_t nlen = grub_strlen (name), slen = grub_strlen (suffix);
+
+  return nlen >= slen && grub_strcmp (name + nlen - slen, suffix) == 0;
+}
+
+/* Serve FILE from BUF, a whole body of SIZE bytes, through the
+   prefetched protocol.  Takes over BUF.  */
+static grub_err_t
+net_serve_buffer (struct grub_file *file, const char *name, char *buf,
+		  grub_size_t size, grub_net_content_encoding_t encoding)
+{
+  grub_net_t net = file->device->net;
+  struct grub_net_prefetch *pf;
+
+  pf = grub_zalloc (sizeof (*pf));
+  if (!pf)
+    {
+      grub_free (buf);
+      return grub_errno;
+    }
+  pf->buf = buf;
+  pf->size = size;
+  pf->alloc = size;
+  pf->encoding = encoding;
+
+  net->protocol = &grub_net_prefetched_protocol;
+  net->offset = 0;
+  file->data = pf;
+  return prefetched_open (file, name);
+}
+
+static void
+net_drop_packets (grub_net_t net)
+{
+  while (net->packs.first)
+    {
+      grub_netbuff_free (net->packs.first->nb);
+      grub_net_remove_packet (net->packs.first);
+    }
+}
+
+/* Read the rest of the response into memory and serve FILE from there.
+   This is needed for encoded responses: the decompression filters need
+   the whole stream to be seekable (gzio reads the size from the trailer,
+   zstdio indexes the frames) and an HTTP range addresses the encoded
+   bytes.  The buffer holds the compressed form, so it stays as small as
+   the transfer.  */
+static grub_err_t
+net_buffer_body (struct grub_file *file, const char *name)
+{
+  grub_net_t net = file->device->net;
+  grub_size_t size = 0, alloc = 65536;
+  char *buf;
+  grub_ssize_t r;
+
+  if (file->size != GRUB_FILE_SIZE_UNKNOWN && file->size > 0
+      && file->size < 0x40000000)
+    alloc = file->size;
+  buf = grub_malloc (alloc);
+  if (!buf)
+    goto fail;
+
+  while (1)
+    {
+      if (size == alloc)
+	{
+	  char *n = grub_realloc (buf, alloc * 2);
+	  if (!n)
+	    goto fail;
+	  buf = n;
+	  alloc *= 2;
+	}
+      r = grub_net_fs_read_real (file, buf + size, alloc - size);
+      if (r < 0)
+	goto fail;
+      if (r == 0)
+	break;
+      size += r;
+    }
+
+  net_drop_packets (net);
+  net->protocol->close (file);
+  return net_serve_buffer (file, name, buf, size, net->encoding);
+
+ fail:
+  net_drop_packets (net);
+  net->protocol->close (file);
+  grub_free (buf);
+  return grub_errno;
+}
+
+/* Decide from the response how FILE's body is encoded.  */
+static grub_err_t
+net_check_encoding (struct grub_file *file, const char *name)
+{
+  grub_net_t net = file->device->net;
+  grub_net_content_encoding_t encoding = net->encoding;
+
+  /* Some servers label foo.gz as gzip-encoded; the caller wants the
+     file as stored, like a browser saving it would.  */
+  if ((encoding == GRUB_NET_CONTENT_GZIP
+       && net_name_has_suffix (name, ".gz"))
+      || (encoding == GRUB_NET_CONTENT_ZSTD
+	  && net_name_has_suffix (name, ".zst")))
+    encoding = GRUB_NET_CONTENT_IDENTITY;
+  net->encoding = encoding;
+  if (encoding == GRUB_NET_CONTENT_UNSUPPORTED)
+    {
+      net_drop_packets (net);
+      net->protocol->close (file);
+      return grub_error (GRUB_ERR_NOT_IMPLEMENTED_YET,
+			 N_("unsupported content encoding for `%s'"), name);
+    }
+  return GRUB_ERR_NONE;
+}
+
+/* FILE has just been opened, and CACHED is the validator of the copy
+   of KEY in the cache, if any.  Serve FILE from the cache when that copy
+   is current, otherwise download it in full and store it.  */
+static grub_err_t
+net_cache_open (struct grub_file *file, const char *name, const char *key,
+		const char *cached)
+{
+  grub_net_t net = file->device->net;
+  char *validator = NULL;
+  char *buf;
+  grub_size_t size;
+  grub_net_content_encoding_t encoding;
+  grub_err_t err = GRUB_ERR_NONE;
+
+  if (net->etag)
+    validator = grub_xasprintf ("etag:%s", net->etag);
+  else if (file->size != GRUB_FILE_SIZE_UNKNOWN)
+    validator = grub_xasprintf ("size:%" PRIuGRUB_UINT64_T,
+				(grub_uint64_t) file->size);
+  grub_errno = GRUB_ERR_NONE;
+
+  if (cached && (net->not_modified
+		 || (validator && grub_strcmp (validator, cached) == 0)))
+    {
+      if (grub_net_cache->fetch (key, &buf, &size, &encoding)
+	  == GRUB_ERR_NONE)
+	{
+	  grub_dprintf ("net", "%s: served from the cache\n", key);
+	  grub_free (validator);
+	  net_drop_packets (net);
+	  net->protocol->close (file);
+	  return net_serve_buffer (file, name, buf, size, encoding);
+	}
+      grub_dprintf ("net", "%s: cached copy unusable: %s\n", key,
+		    grub_errmsg);
+      grub_errno = GRUB_ERR_NONE;
+
+      if (net->not_modified)
+	{
+	  /* A 304 has no body to fall back on; ask again.  */
+	  grub_free (validator);
+	  net_drop_packets (net);
+	  net->protocol->close (file);
+	  net->not_modified = 0;
+	  grub_free (net->etag);
+	  net->etag = NULL;
+	  net->offset = 0;
+	  net->eof = 0;
+	  net->stall = 0;
+	  net->encoding = GRUB_NET_CONTENT_IDENTITY;
+	  err = net->protocol->open (file, name);
+	  if (!err)
+	    err = net_check_encoding (file, name);
+	  if (!err)
+	    err = net_cache_open (file, name, key, NULL);
+	  return err;
+	}
+    }
+
+  if (validator && file->size != GRUB_FILE_SIZE_UNKNOWN
+      && grub_net_cache->fits (file->size))
+    {
+      err = net_buffer_body (file, name);
+      if (!err)
+	{
+	  struct grub_net_prefetch *pf = file->data;
+
+	  grub_net_cache->store (key, validator, pf->buf, pf->size,
+				 pf->encoding);
+	  grub_errno = GRUB_ERR_NONE;
+	}
+    }
+  grub_free (validator);
+  return err;
+}
+
+/* Put the gzio or zstdio filter on top of BUFIO, which reads the encoded
+   body through FILE.  On failure the whole stack is closed, except for
+   the device, which grub_file_open still owns.  */
+static grub_file_t
+net_decode (grub_file_t file, grub_file_t bufio, const char *name)
+{
+  grub_net_content_encoding_t encoding = file->device->net->encoding;
+  grub_file_filter_id_t id = GRUB_FILE_FILTER_GZIO;
+  const char *mod = "gzio";
+  struct grub_device *shadow;
+  grub_net_t net = file->device->net;
+  grub_file_t decoded = NULL;
+
+  if (encoding == GRUB_NET_CONTENT_ZSTD)
+    {
+      id = GRUB_FILE_FILTER_ZSTDIO;
+      mod = "zstdio";
+    }
+
+  /* Closing BUFIO closes the device of FILE too.  Give it a copy to
+     close, allocated now so that there is no failure on the way out.  */
+  shadow = grub_zalloc (sizeof (*shadow));
+  if (shadow)
+    shadow->net = grub_malloc (sizeof (*shadow->net));
+
+  if (shadow && shadow->net)
+    {
+      if (!grub_file_filters_all[id])
+	grub_dl_load (mod);
+      if (grub_file_filters_all[id])
+	{
+	  grub_errno = GRUB_ERR_NONE;
+	  decoded = grub_file_filters_all[id] (bufio, name);
+	}
+      if (decoded && decoded != bufio)
+	{
+	  grub_free (shadow->net);
+	  grub_free (shadow);
+	  return decoded;
+	}
+      if (!grub_errno)
+	grub_error (GRUB_ERR_BAD_COMPRESSED_DATA,
+		    N_("`%s' is not %s-encoded"), name,
+		    encoding == GRUB_NET_CONTENT_ZSTD ? "zstd" : "gzip");
+
+      grub_memcpy (shadow->net, net, sizeof (*net));
+      shadow->net->server = NULL;
+      file->device = shadow;
+      /* grub_net_fs_close frees the name through the copy.  */
+      net->name = NULL;
+      net->packs.first = NULL;
+      net->packs.last = NULL;
+      grub_file_close (bufio);
+      return NULL;
+    }
+
+  /* Out of memory: release what matters and leave BUFIO itself.  */
+  if (shadow)
+    grub_free (shadow->net);
+  grub_free (shadow);
+  net_drop_packets (net);
+  net->protocol->close (file);
+  grub_free (net->name);
+  net->name = NULL;
+  return NULL;
+}
+
 static grub_err_t
 grub_net_fs_open (struct grub_file *file_out, const char *name)
 {
   grub_err_t err;
   struct grub_file *file, *bufio;
+  struct grub_net_prefetch *pf;
+  char *key = NULL, *cached = NULL;
 
   file = grub_malloc (sizeof (*file));
   if (!file)
@@ -1430,14 +2285,44 @@ grub_net_fs_open (struct grub_file *file_out, const char *name)
   if (!file->device->net->name)
     return grub_errno;
 
+  pf = prefetch_claim (file->device->net->protocol->name,
+		       file->device->net->server, name);
+  if (pf)
+    {
+      file->device->net->protocol = &grub_net_prefetched_protocol;
+      file->data = pf;
+    }
+
+  if (!pf && grub_net_cache)
+    {
+      key = grub_xasprintf ("%s,%s%s", file->device->net->protocol->name,
+			    file->device->net->server, name);
+      if (key)
+	cached = grub_net_cache->lookup (key);
+      grub_errno = GRUB_ERR_NONE;
+      if (cached && grub_strncmp (cached, "etag:", 5) == 0)
+	file->device->net->if_none_match = cached + 5;
+    }
+
+  file->device->net->encoding = GRUB_NET_CONTENT_IDENTITY;
+  file->device->net->etag = NULL;
+  file->device->net->not_modified = 0;
   err = file->device->net->protocol->open (file, name);
+  file->device->net->if_none_match = NULL;
+  if (!err)
+    err = net_check_encoding (file, name);
+  if (!err && key)
+    err = net_cache_open (file, name, key, cached);
+  if (!err && file->device->net->encoding != GRUB_NET_CONTENT_IDENTITY
+      && file->device->net->protocol != &grub_net_prefetched_protocol)
+    err = net_buffer_body (file, name);
+  grub_free (key);
+  grub_free (cached);
+  grub_free (file->device->net->etag);
+  file->device->net->etag = NULL;
   if (err)
     {
-      while (file->device->net->packs.first)
-	{
-	  grub_netbuff_free (file->device->net->packs.first->nb);
-	  grub_net_remove_packet (file->device->net->packs.first);
-	}
+      net_drop_packets (file->device->net);
       grub_free (file->device->net->name);
       grub_free (file);
       return err;
@@ -1456,6 +2341,13 @@ grub_net_fs_open (struct grub_file *file_out, const char *name)
       return grub_errno;
     }
 
+  if (file->device->net->encoding != GRUB_NET_CONTENT_IDENTITY)
+    {
+      bufio = net_decode (file, bufio, name);
+      if (!bufio)
+	return grub_errno;
+    }
+
   grub_memcpy (file_out, bufio, sizeof (struct grub_file));
   grub_free (bufio);
   return GRUB_ERR_NONE;
@@ -1470,6 +2362,8 @@ grub_net_fs_close (grub_file_t file)
       grub_net_remove_packet (file->device->net->packs.first);
     }
   file->device->net->protocol->close (file);
+  grub_free (file->device->net->etag);
+  file->device->net->etag = NULL;
   grub_free (file->device->net->name);
   return GRUB_ERR_NONE;
 }
@@ -1496,24 +2390,45 @@ receive_packets (struct grub_net_card *card, int *stop_condition)
     {
       /* Maybe should be better have a fixed number of packets for each card
 	 and just mark them as used and not used.  */ 
-      struct grub_net_buff *nb;
+      struct grub_net_buff *nbs[GRUB_NET_RECV_BATCH];
+      int n, i;
 
       if (received > 10 && stop_condition && *stop_condition)
 	break;
 
-      nb = card->driver->recv (card);
-      if (!nb)
+      if (card->driver->recv_batch)
+	n = card->driver->recv_batch (card, nbs, GRUB_NET_RECV_BATCH);
+      else
+	{
+	  nbs[0] = card->driver->recv (card);
+	  n = nbs[0] ? 1 : 0;
+	}
+      if (!n)
 	{
+	  /* The drivers give up on a packet when they cannot allocate a
+	     buffer for it.  */
+	  if (grub_errno == GRUB_ERR_OUT_OF_MEMORY)
+	    card->stats.rx_dropped++;
 	  card->last_poll = grub_get_time_ms ();
 	  break;
 	}
-      received++;
-      grub_net_recv_ethernet_packet (nb, card);
-      if (grub_errno)
+      for (i = 0; i < n; i++)
 	{
-	  grub_dprintf ("net", "error receiving: %d: %s\n", grub_errno,
-			grub_errmsg);
-	  grub_errno = GRUB_ERR_NONE;
+	  received++;
+	  card->stats.rx_packets++;
+	  card->stats.rx_bytes += nbs[i]->tail - nbs[i]->data;
+	  grub_net_recv_ethernet_packet (nbs[i], card);
+	  if (grub_errno)
+	    {
+	      grub_dprintf ("net", "error receiving: %d: %s\n", grub_errno,
+			    grub_errmsg);
+	      grub_errno = GRUB_ERR_NONE;
+	    }
+	}
+      if (card->driver->recv_batch && n < GRUB_NET_RECV_BATCH)
+	{
+	  card->last_poll = grub_get_time_ms ();
+	  break;
 	}
     }
   grub_print_error ();
@@ -1565,8 +2480,12 @@ grub_net_poll_cards (unsigned time, int *stop_condition)
   start_time = grub_get_time_ms ();
   while ((grub_get_time_ms () - start_time) < time
 	 && (!stop_condition || !*stop_condition))
-    FOR_NET_CARDS (card)
-      receive_packets (card, stop_condition);
+    {
+      FOR_NET_CARDS (card)
+	receive_packets (card, stop_condition);
+      /* Keep TCP retransmission and delayed ACK timers running.  */
+      grub_net_tcp_retransmit ();
+    }
   grub_net_tcp_retransmit ();
 }
 
@@ -1585,6 +2504,29 @@ grub_net_poll_cards_idle_real (void)
   grub_net_tcp_retransmit ();
 }
 
+/* Cards that want to be polled on every pass are polled this often when
+   idle; a driver that can wake the machine up on a packet gets polled
+   right away anyway.  */
+#define GRUB_NET_IDLE_POLL_MS 10
+
+static grub_uint64_t
+grub_net_poll_cards_deadline_real (void)
+{
+  struct grub_net_card *card;
+  grub_uint64_t deadline = ~(grub_uint64_t) 0;
+
+  FOR_NET_CARDS (card)
+  {
+    grub_uint64_t next = card->last_poll
+      + (card->idle_poll_delay_ms ? card->idle_poll_delay_ms
+	 : GRUB_NET_IDLE_POLL_MS);
+
+    if (next < deadline)
+      deadline = next;
+  }
+  return deadline;
+}
+
 /*  Read from the packets list*/
 static grub_ssize_t
 grub_net_fs_read_real (grub_file_t file, char *buf, grub_size_t len)
@@ -1732,6 +2674,8 @@ grub_net_fini_hw (int noreturn __attribute__ ((unused)))
 	  card->driver->close (card);
 	card->opened = 0;
       }
+  prefetch_flush ();
+  grub_netbuff_pool_flush ();
   return GRUB_ERR_NONE;
 }
 
@@ -1745,7 +2689,7 @@ static struct grub_preboot *fini_hnd;
 
 static grub_command_t cmd_addaddr, cmd_deladdr, cmd_addroute, cmd_delroute;
 static grub_command_t cmd_lsroutes, cmd_lscards;
-static grub_command_t cmd_lsaddr, cmd_slaac;
+static grub_command_t cmd_lsaddr, cmd_slaac, cmd_prefetch, cmd_stats;
 
 GRUB_MOD_INIT(net)
 {
@@ -1788,6 +2732,12 @@ GRUB_MOD_INIT(net)
 				       "", N_("list network cards"));
   cmd_lsaddr = grub_register_command ("net_ls_addr", grub_cmd_listaddrs,
 				       "", N_("list network addresses"));
+  cmd_stats = grub_register_command ("net_stats", grub_cmd_stats,
+				     "", N_("Show network statistics."));
+  cmd_prefetch = grub_register_command ("net_prefetch", grub_cmd_prefetch,
+					N_("FILE..."),
+					N_("Download network files ahead of"
+					   " their use."));
   grub_bootp_init ();
   grub_dns_init ();
 
@@ -1796,6 +2746,7 @@ GRUB_MOD_INIT(net)
 						grub_net_restore_hw,
 						GRUB_LOADER_PREBOOT_HOOK_PRIO_DISK);
   grub_net_poll_cards_idle = grub_net_poll_cards_idle_real;
+  grub_net_poll_cards_deadline = grub_net_poll_cards_deadline_real;
 }
 
 GRUB_MOD_FINI(net)
@@ -1813,9 +2764,12 @@ GRUB_MOD_FINI(net)
   grub_unregister_command (cmd_lscards);
   grub_unregister_command (cmd_lsaddr);
   grub_unregister_command (cmd_slaac);
+  grub_unregister_command (cmd_prefetch);
+  grub_unregister_command (cmd_stats);
   grub_fs_unregister (&grub_net_fs);
   grub_net_open = NULL;
   grub_net_fini_hw (0);
   grub_loader_unregister_preboot_hook (fini_hnd);
-  grub_net_poll_cards_idle = grub_net_poll_cards_idle_real;
+  grub_net_poll_cards_idle = NULL;
+  grub_net_poll_cards_deadline = NULL;
 }
@@ -21,6 +21,15 @@
 #include <grub/mm.h>
 #include <grub/net/netbuff.h>
 
+/* Freed buffers of the common sizes are kept and handed out again, so
+   the packet path doesn't go through the general allocator for every
+   frame.  Class N holds buffers of (N + 1) * NETBUFF_ALIGN bytes.  */
+#define NETBUFF_POOL_CLASSES 8
+#define NETBUFF_POOL_DEPTH 64
+
+static struct grub_net_buff *pool[NETBUFF_POOL_CLASSES][NETBUFF_POOL_DEPTH];
+static unsigned pool_count[NETBUFF_POOL_CLASSES];
+
 grub_err_t
 grub_netbuff_put (struct grub_net_buff *nb, grub_size_t len)
 {
@@ -83,6 +92,18 @@ grub_netbuff_alloc (grub_size_t len)
     len = NETBUFFMINLEN;
 
   len = ALIGN_UP (len, NETBUFF_ALIGN);
+
+  if (len / NETBUFF_ALIGN <= NETBUFF_POOL_CLASSES)
+    {
+      unsigned class = len / NETBUFF_ALIGN - 1;
+      if (pool_count[class])
+	{
+	  nb = pool[class][--pool_count[class]];
+	  nb->data = nb->tail = nb->head;
+	  return nb;
+	}
+    }
+
 #ifdef GRUB_MACHINE_EMU
   data = grub_malloc (len + sizeof (*nb));
 #else
@@ -120,11 +141,34 @@ grub_netbuff_make_pkt (grub_size_t len)
 void
 grub_netbuff_free (struct grub_net_buff *nb)
 {
+  grub_size_t len;
+
   if (!nb)
     return;
+
+  len = nb->end - nb->head;
+  if (len % NETBUFF_ALIGN == 0 && len / NETBUFF_ALIGN <= NETBUFF_POOL_CLASSES)
+    {
+      unsigned class = len / NETBUFF_ALIGN - 1;
+      if (pool_count[class] < NETBUFF_POOL_DEPTH)
+	{
+	  pool[class][pool_count[class]++] = nb;
+	  return;
+	}
+    }
   grub_free (nb->head);
 }
 
+void
+grub_netbuff_pool_flush (void)
+{
+  unsigned class;
+
+  for (class = 0; class < NETBUFF_POOL_CLASSES; class++)
+    while (pool_count[class])
+      grub_free (pool[class][--pool_count[class]]->head);
+}
+
 grub_err_t
 grub_netbuff_clear (struct grub_net_buff *nb)
 {
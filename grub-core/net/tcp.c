@@ -22,21 +22,49 @@
 #include <grub/net/netbuff.h>
 #include <grub/time.h>
 #include <grub/priority_queue.h>
+#include <grub/mm_private.h>
+#include <grub/i18n.h>
 
 #define TCP_SYN_RETRANSMISSION_TIMEOUT GRUB_NET_INTERVAL
 #define TCP_SYN_RETRANSMISSION_COUNT GRUB_NET_TRIES
-#define TCP_RETRANSMISSION_TIMEOUT GRUB_NET_INTERVAL
 #define TCP_RETRANSMISSION_COUNT GRUB_NET_TRIES
+/* Give up on a segment unacknowledged for this long.  */
+#define TCP_RETRANSMISSION_TIME_LIMIT (GRUB_NET_TRIES * GRUB_NET_INTERVAL)
+
+/* Retransmission timeout bounds (RFC 6298), in milliseconds.  The RTO
+   starts at the old fixed interval until the first RTT sample.  */
+#define TCP_RTO_INITIAL GRUB_NET_INTERVAL
+#define TCP_RTO_MIN 200
+#define TCP_RTO_MAX (8 * GRUB_NET_INTERVAL)
+
+/* ACK every second full segment, or after this many milliseconds.  */
+#define TCP_DELAYED_ACK_SEGMENTS 2
+#define TCP_DELAYED_ACK_TIMEOUT 40
+
+/* The receive window is this fraction of the free heap, within bounds.  */
+#define TCP_WINDOW_HEAP_SHIFT 4
+#define TCP_WINDOW_MIN 8192
+#define TCP_WINDOW_MAX (4 << 20)
+#define TCP_WSCALE_MAX 14
+
+#define TCP_SACK_BLOCKS 3
 
 struct unacked
 {
   struct unacked *next;
   struct unacked **prev;
   struct grub_net_buff *nb;
+  grub_uint64_t first_try;
   grub_uint64_t last_try;
   int try_count;
 };
 
+struct tcp_sack_block
+{
+  grub_uint32_t start;
+  grub_uint32_t end;
+};
+
 enum
   {
     TCP_FIN = 0x1,
@@ -47,6 +75,21 @@ enum
     TCP_URG = 0x20,
   };
 
+enum
+  {
+    TCP_OPT_END = 0,
+    TCP_OPT_NOP = 1,
+    TCP_OPT_MSS = 2,
+    TCP_OPT_WSCALE = 3,
+    TCP_OPT_SACK_PERMITTED = 4,
+    TCP_OPT_SACK = 5
+  };
+
+/* MSS, NOP + window scale, SACK permitted + 2 NOPs.  */
+#define TCP_SYN_OPTIONS_SIZE 12
+/* 2 NOPs + SACK header + blocks.  */
+#define TCP_SACK_OPTIONS_SIZE(n) (4 + 8 * (n))
+
 struct grub_net_tcp_socket
 {
   struct grub_net_tcp_socket *next;
@@ -65,7 +108,24 @@ struct grub_net_tcp_socket
   grub_uint32_t my_cur_seq;
   grub_uint32_t their_start_seq;
   grub_uint32_t their_cur_seq;
-  grub_uint16_t my_window;
+  grub_uint32_t my_window;
+  /* Shift applied to the advertised window, 0 unless the peer agreed.  */
+  int my_wscale;
+  int sack_ok;
+  struct tcp_sack_block sack[TCP_SACK_BLOCKS];
+  int nsack;
+  /* In-order segments received since the last ACK.  */
+  int ack_segs;
+  int ack_pending;
+  grub_uint64_t ack_time;
+  /* Smoothed RTT scaled by 8 and RTT variance scaled by 4, in ms.  */
+  grub_uint32_t srtt;
+  grub_uint32_t rttvar;
+  grub_uint32_t rto;
+  unsigned long retransmits;
+  unsigned long out_of_order;
+  unsigned long duplicates;
+  struct grub_net_rtt_stats rtt;
   struct unacked *unack_first;
   struct unacked *unack_last;
   grub_err_t (*recv_hook) (grub_net_tcp_socket_t sock, struct grub_net_buff *nb,
@@ -130,6 +190,178 @@ static struct grub_net_tcp_listen *tcp_listens;
 #define FOR_TCP_SOCKETS(var) FOR_LIST_ELEMENTS (var, tcp_sockets)
 #define FOR_TCP_LISTENS(var) FOR_LIST_ELEMENTS (var, tcp_listens)
 
+/* Sequence number comparison modulo 2^32.  */
+static inline int
+seq_lt (grub_uint32_t a, grub_uint32_t b)
+{
+  return (grub_int32_t) (a - b) < 0;
+}
+
+static inline int
+seq_le (grub_uint32_t a, grub_uint32_t b)
+{
+  return (grub_int32_t) (a - b) <= 0;
+}
+
+static inline grub_uint16_t
+tcp_window (grub_net_tcp_socket_t sock)
+{
+  if (sock->i_stall)
+    return 0;
+  return grub_cpu_to_be16 (sock->my_window >> sock->my_wscale);
+}
+
+/* Size the receive window from the free heap, so that a fast link isn't
+   throttled by the window while the buffered data still fits in memory.  */
+static grub_uint32_t
+tcp_receive_window (void)
+{
+  grub_size_t free = 0;
+#ifndef GRUB_MACHINE_EMU
+  grub_mm_region_t r;
+
+  for (r = grub_mm_base; r; r = r->next)
+    {
+      grub_mm_header_t p = r->first;
+
+      if (p->magic != GRUB_MM_FREE_MAGIC)
+	continue;
+      do
+	{
+	  free += p->size << GRUB_MM_ALIGN_LOG2;
+	  p = p->next;
+	}
+      while (p != r->first);
+    }
+#else
+  free = (grub_size_t) TCP_WINDOW_MAX << TCP_WINDOW_HEAP_SHIFT;
+#endif
+  free >>= TCP_WINDOW_HEAP_SHIFT;
+  if (free < TCP_WINDOW_MIN)
+    return TCP_WINDOW_MIN;
+  if (free > TCP_WINDOW_MAX)
+    return TCP_WINDOW_MAX;
+  return free;
+}
+
+static void
+tcp_rtt_sample (grub_net_tcp_socket_t sock, grub_uint32_t rtt)
+{
+  grub_int32_t delta;
+
+  grub_net_rtt_sample (&sock->rtt, rtt);
+  grub_net_rtt_sample (&grub_net_stats.tcp_rtt, rtt);
+
+  if (!sock->srtt)
+    {
+      sock->srtt = (rtt << 3) ? : 1;
+      sock->rttvar = rtt << 1;
+    }
+  else
+    {
+      delta = rtt - (sock->srtt >> 3);
+      sock->srtt += delta;
+      if (!sock->srtt)
+	sock->srtt = 1;
+      if (delta < 0)
+	delta = -delta;
+      delta -= sock->rttvar >> 2;
+      sock->rttvar += delta;
+    }
+  sock->rto = (sock->srtt >> 3) + sock->rttvar;
+  if (sock->rto < TCP_RTO_MIN)
+    sock->rto = TCP_RTO_MIN;
+  if (sock->rto > TCP_RTO_MAX)
+    sock->rto = TCP_RTO_MAX;
+}
+
+/* Remember the out-of-order range [START, END) for SACK.  The newest block
+   goes first as RFC 2018 asks.  */
+static void
+tcp_sack_add (grub_net_tcp_socket_t sock, grub_uint32_t start,
+	      grub_uint32_t end)
+{
+  struct tcp_sack_block blocks[TCP_SACK_BLOCKS];
+  int i, n = 0;
+
+  for (i = 0; i < sock->nsack; i++)
+    {
+      struct tcp_sack_block *b = &sock->sack[i];
+      if (seq_lt (end, b->start) || seq_lt (b->end, start))
+	{
+	  if (n < TCP_SACK_BLOCKS - 1)
+	    blocks[n++] = *b;
+	  continue;
+	}
+      if (seq_lt (b->start, start))
+	start = b->start;
+      if (seq_lt (end, b->end))
+	end = b->end;
+    }
+  sock->sack[0].start = start;
+  sock->sack[0].end = end;
+  for (i = 0; i < n; i++)
+    sock->sack[i + 1] = blocks[i];
+  sock->nsack = n + 1;
+}
+
+static void
+tcp_sack_trim (grub_net_tcp_socket_t sock)
+{
+  int i, n = 0;
+
+  for (i = 0; i < sock->nsack; i++)
+    if (seq_lt (sock->their_cur_seq, sock->sack[i].end))
+      {
+	sock->sack[n] = sock->sack[i];
+	if (seq_lt (sock->sack[n].start, sock->their_cur_seq))
+	  sock->sack[n].start = sock->their_cur_seq;
+	n++;
+      }
+  sock->nsack = n;
+}
+
+static void
+tcp_parse_syn_options (grub_net_tcp_socket_t sock, struct tcphdr *tcph)
+{
+  grub_uint8_t *ptr = (grub_uint8_t *) (tcph + 1);
+  grub_uint8_t *end = (grub_uint8_t *) tcph
+    + (grub_be_to_cpu16 (tcph->flags) >> 12) * 4;
+  int wscale_ok = 0;
+
+  while (ptr < end)
+    {
+      if (*ptr == TCP_OPT_END)
+	break;
+      if (*ptr == TCP_OPT_NOP)
+	{
+	  ptr++;
+	  continue;
+	}
+      if (ptr + 1 >= end || ptr[1] < 2 || ptr + ptr[1] > end)
+	break;
+      switch (ptr[0])
+	{
+	case TCP_OPT_WSCALE:
+	  if (ptr[1] == 3)
+	    wscale_ok = 1;
+	  break;
+	case TCP_OPT_SACK_PERMITTED:
+	  sock->sack_ok = 1;
+	  break;
+	}
+      ptr += ptr[1];
+    }
+
+  /* Our window is only scaled if both sides sent the option.  */
+  if (!wscale_ok)
+    {
+      sock->my_wscale = 0;
+      if (sock->my_window > 0xffff)
+	sock->my_window = 0xffff;
+    }
+}
+
 grub_net_tcp_listen_t
 grub_net_tcp_listen (grub_uint16_t port,
 		     const struct grub_net_network_level_interface *inf,
@@ -204,6 +436,13 @@ tcp_send (struct grub_net_buff *nb, grub_net_tcp_socket_t socket)
   tcph->checksum = grub_net_ip_transport_checksum (nb, GRUB_NET_IP_TCP,
 						   &socket->inf->address,
 						   &socket->out_nla);
+  /* Every segment carries our cumulative ACK.  */
+  if ((tcph->flags & grub_cpu_to_be16_compile_time (TCP_ACK))
+      && tcph->ack == grub_cpu_to_be32 (socket->their_cur_seq))
+    {
+      socket->ack_pending = 0;
+      socket->ack_segs = 0;
+    }
   nbd = nb->data;
   if (size)
     {
@@ -214,7 +453,7 @@ tcp_send (struct grub_net_buff *nb, grub_net_tcp_socket_t socket)
       unack->next = NULL;
       unack->nb = nb;
       unack->try_count = 1;
-      unack->last_try = grub_get_time_ms ();
+      unack->first_try = unack->last_try = grub_get_time_ms ();
       if (!socket->unack_last)
 	socket->unack_first = socket->unack_last = unack;
       else
@@ -254,6 +493,10 @@ grub_net_tcp_close (grub_net_tcp_socket_t sock,
     return;
 
   sock->i_closed = 1;
+  grub_boot_time ("TCP port %d closed: %lu retransmits, %lu out of order,"
+		  " %lu duplicates, rtt %u ms", sock->out_port,
+		  sock->retransmits, sock->out_of_order, sock->duplicates,
+		  sock->srtt >> 3);
 
   nb_fin = grub_netbuff_alloc (sizeof (*tcph_fin)
 			       + GRUB_NET_OUR_MAX_IP_HEADER_SIZE
@@ -300,8 +543,12 @@ ack_real (grub_net_tcp_socket_t sock, int res)
   struct grub_net_buff *nb_ack;
   struct tcphdr *tcph_ack;
   grub_err_t err;
+  int nsack = (!res && sock->sack_ok) ? sock->nsack : 0;
+  grub_size_t optlen = nsack ? TCP_SACK_OPTIONS_SIZE (nsack) : 0;
 
-  nb_ack = grub_netbuff_alloc (sizeof (*tcph_ack) + 128);
+  nb_ack = grub_netbuff_alloc (sizeof (*tcph_ack)
+			       + TCP_SACK_OPTIONS_SIZE (TCP_SACK_BLOCKS)
+			       + 128);
   if (!nb_ack)
     return;
   err = grub_netbuff_reserve (nb_ack, 128);
@@ -313,7 +560,7 @@ ack_real (grub_net_tcp_socket_t sock, int res)
       return;
     }
 
-  err = grub_netbuff_put (nb_ack, sizeof (*tcph_ack));
+  err = grub_netbuff_put (nb_ack, sizeof (*tcph_ack) + optlen);
   if (err)
     {
       grub_netbuff_free (nb_ack);
@@ -322,6 +569,24 @@ ack_real (grub_net_tcp_socket_t sock, int res)
       return;
     }
   tcph_ack = (void *) nb_ack->data;
+  if (nsack)
+    {
+      grub_uint8_t *opt = (grub_uint8_t *) (tcph_ack + 1);
+      int i;
+
+      opt[0] = TCP_OPT_NOP;
+      opt[1] = TCP_OPT_NOP;
+      opt[2] = TCP_OPT_SACK;
+      opt[3] = 2 + 8 * nsack;
+      for (i = 0; i < nsack; i++)
+	{
+	  grub_uint32_t v;
+	  v = grub_cpu_to_be32 (sock->sack[i].start);
+	  grub_memcpy (opt + 4 + 8 * i, &v, 4);
+	  v = grub_cpu_to_be32 (sock->sack[i].end);
+	  grub_memcpy (opt + 8 + 8 * i, &v, 4);
+	}
+    }
   if (res)
     {
       tcph_ack->ack = grub_cpu_to_be32_compile_time (0);
@@ -331,9 +596,8 @@ ack_real (grub_net_tcp_socket_t sock, int res)
   else
     {
       tcph_ack->ack = grub_cpu_to_be32 (sock->their_cur_seq);
-      tcph_ack->flags = grub_cpu_to_be16_compile_time ((5 << 12) | TCP_ACK);
-      tcph_ack->window = !sock->i_stall ? grub_cpu_to_be16 (sock->my_window)
-	: 0;
+      tcph_ack->flags = grub_cpu_to_be16 (((5 + optlen / 4) << 12) | TCP_ACK);
+      tcph_ack->window = tcp_window (sock);
     }
   tcph_ack->urgent = 0;
   tcph_ack->src = grub_cpu_to_be16 (sock->in_port);
@@ -363,38 +627,55 @@ grub_net_tcp_retransmit (void)
 {
   grub_net_tcp_socket_t sock;
   grub_uint64_t ctime = grub_get_time_ms ();
-  grub_uint64_t limit_time = ctime - TCP_RETRANSMISSION_TIMEOUT;
 
   FOR_TCP_SOCKETS (sock)
   {
     struct unacked *unack;
+
+    if (sock->ack_pending
+	&& ctime - sock->ack_time >= TCP_DELAYED_ACK_TIMEOUT)
+      ack (sock);
+
     for (unack = sock->unack_first; unack; unack = unack->next)
       {
 	struct tcphdr *tcph;
 	grub_uint8_t *nbd;
 	grub_err_t err;
-
-	if (unack->last_try > limit_time)
+	grub_uint64_t timeout;
+
+	/* Exponential backoff from the current RTO.  */
+	if (unack->try_count > 8)
+	  timeout = TCP_RTO_MAX;
+	else
+	  timeout = (grub_uint64_t) sock->rto << (unack->try_count - 1);
+	if (timeout > TCP_RTO_MAX)
+	  timeout = TCP_RTO_MAX;
+	if (ctime - unack->last_try < timeout)
 	  continue;
-	
-	if (unack->try_count > TCP_RETRANSMISSION_COUNT)
+
+	if (unack->try_count > TCP_RETRANSMISSION_COUNT
+	    || ctime - unack->first_try > TCP_RETRANSMISSION_TIME_LIMIT)
 	  {
 	    error (sock);
 	    break;
 	  }
 	unack->try_count++;
 	unack->last_try = ctime;
+	sock->retransmits++;
+	grub_net_stats.tcp_retransmits++;
 	nbd = unack->nb->data;
 	tcph = (struct tcphdr *) nbd;
 
 	if ((tcph->flags & grub_cpu_to_be16_compile_time (TCP_ACK))
 	    && tcph->ack != grub_cpu_to_be32 (sock->their_cur_seq))
 	  {
-	    tcph->checksum = 0;
-	    tcph->checksum = grub_net_ip_transport_checksum (unack->nb,
-							     GRUB_NET_IP_TCP,
-							     &sock->inf->address,
-							     &sock->out_nla);
+	    grub_uint32_t old_ack = tcph->ack;
+	    grub_uint32_t new_ack = grub_cpu_to_be32 (sock->their_cur_seq);
+
+	    tcph->ack = new_ack;
+	    tcph->checksum = grub_net_ip_chksum_update (tcph->checksum,
+							&old_ack, &new_ack,
+							sizeof (new_ack));
 	  }
 
 	err = grub_net_send_ip_packet (sock->inf, &(sock->out_nla),
@@ -410,6 +691,31 @@ grub_net_tcp_retransmit (void)
   }
 }
 
+void
+grub_net_tcp_print_stats (void)
+{
+  grub_net_tcp_socket_t sock;
+
+  FOR_TCP_SOCKETS (sock)
+  {
+    char buf[GRUB_NET_MAX_STR_ADDR_LEN];
+
+    grub_net_addr_to_str (&sock->out_nla, buf);
+    grub_printf_ (N_("tcp %d -> %s:%d%s: %lu retransmits, %lu out of order,"
+		     " %lu duplicates\n"),
+		  sock->in_port, buf, sock->out_port,
+		  sock->i_closed ? _(" (closed)") : "",
+		  sock->retransmits, sock->out_of_order, sock->duplicates);
+    if (sock->rtt.samples)
+      grub_printf_ (N_("  rtt: min/avg/max %u/%llu/%u ms, smoothed %u ms,"
+		       " rto %u ms\n"),
+		    sock->rtt.min,
+		    (unsigned long long) grub_divmod64 (sock->rtt.total,
+							sock->rtt.samples, 0),
+		    sock->rtt.max, sock->srtt >> 3, sock->rto);
+  }
+}
+
 grub_uint16_t
 grub_net_ip_transport_checksum (struct grub_net_buff *nb,
 				grub_uint16_t proto,
@@ -569,7 +875,9 @@ grub_net_tcp_open (char *server,
   struct tcphdr *tcph;
   int i;
   grub_uint8_t *nbd;
+  grub_uint8_t *opt;
   grub_net_link_level_address_t ll_target_addr;
+  grub_uint16_t mss;
 
   err = grub_net_resolve_address (server, &addr);
   if (err)
@@ -614,7 +922,7 @@ grub_net_tcp_open (char *server,
       return NULL;
     }
 
-  err = grub_netbuff_put (nb, sizeof (*tcph));
+  err = grub_netbuff_put (nb, sizeof (*tcph) + TCP_SYN_OPTIONS_SIZE);
   if (err)
     {
       grub_netbuff_free (nb);
@@ -630,11 +938,37 @@ grub_net_tcp_open (char *server,
   tcph = (void *) nb->data;
   socket->my_start_seq = grub_get_time_ms ();
   socket->my_cur_seq = socket->my_start_seq + 1;
-  socket->my_window = 8192;
+  socket->rto = TCP_RTO_INITIAL;
+  socket->my_window = tcp_receive_window ();
+  while (socket->my_wscale < TCP_WSCALE_MAX
+	 && (socket->my_window >> socket->my_wscale) > 0xffff)
+    socket->my_wscale++;
+
+  if (addr.type == GRUB_NET_NETWORK_LEVEL_PROTOCOL_IPV4)
+    mss = inf->card->mtu - GRUB_NET_OUR_IPV4_HEADER_SIZE - sizeof (*tcph);
+  else
+    mss = inf->card->mtu - GRUB_NET_OUR_IPV6_HEADER_SIZE - sizeof (*tcph);
+  opt = (grub_uint8_t *) (tcph + 1);
+  opt[0] = TCP_OPT_MSS;
+  opt[1] = 4;
+  opt[2] = mss >> 8;
+  opt[3] = mss & 0xff;
+  opt[4] = TCP_OPT_NOP;
+  opt[5] = TCP_OPT_WSCALE;
+  opt[6] = 3;
+  opt[7] = socket->my_wscale;
+  opt[8] = TCP_OPT_SACK_PERMITTED;
+  opt[9] = 2;
+  opt[10] = TCP_OPT_NOP;
+  opt[11] = TCP_OPT_NOP;
+
   tcph->seqnr = grub_cpu_to_be32 (socket->my_start_seq);
   tcph->ack = grub_cpu_to_be32_compile_time (0);
-  tcph->flags = grub_cpu_to_be16_compile_time ((5 << 12) | TCP_SYN);
-  tcph->window = grub_cpu_to_be16 (socket->my_window);
+  tcph->flags = grub_cpu_to_be16_compile_time (((5 + TCP_SYN_OPTIONS_SIZE / 4)
+						<< 12) | TCP_SYN);
+  /* The window in a SYN is never scaled.  */
+  tcph->window = grub_cpu_to_be16 (socket->my_window > 0xffff ? 0xffff
+				   : socket->my_window);
   tcph->urgent = 0;
   tcph->src = grub_cpu_to_be16 (socket->in_port);
   tcph->dst = grub_cpu_to_be16 (socket->out_port);
@@ -720,8 +1054,7 @@ grub_net_send_tcp_packet (const grub_net_tcp_socket_t socket,
       tcph = (struct tcphdr *) nb2->data;
       tcph->ack = grub_cpu_to_be32 (socket->their_cur_seq);
       tcph->flags = grub_cpu_to_be16_compile_time ((5 << 12) | TCP_ACK);
-      tcph->window = !socket->i_stall ? grub_cpu_to_be16 (socket->my_window)
-	: 0;
+      tcph->window = tcp_window (socket);
       tcph->urgent = 0;
       err = grub_netbuff_put (nb2, fraglen);
       if (err)
@@ -744,7 +1077,7 @@ grub_net_send_tcp_packet (const grub_net_tcp_socket_t socket,
   tcph->ack = grub_cpu_to_be32 (socket->their_cur_seq);
   tcph->flags = (grub_cpu_to_be16_compile_time ((5 << 12) | TCP_ACK)
 		 | (push ? grub_cpu_to_be16_compile_time (TCP_PUSH) : 0));
-  tcph->window = !socket->i_stall ? grub_cpu_to_be16 (socket->my_window) : 0;
+  tcph->window = tcp_window (socket);
   tcph->urgent = 0;
   return tcp_send (nb, socket);
 }
@@ -815,6 +1148,7 @@ grub_net_recv_tcp_packet (struct grub_net_buff *nb,
       {
 	sock->their_start_seq = grub_be_to_cpu32 (tcph->seqnr);
 	sock->their_cur_seq = sock->their_start_seq + 1;
+	tcp_parse_syn_options (sock, tcph);
 	sock->established = 1;
       }
 
@@ -833,6 +1167,7 @@ grub_net_recv_tcp_packet (struct grub_net_buff *nb,
       {
 	struct unacked *unack, *next;
 	grub_uint32_t acked = grub_be_to_cpu32 (tcph->ack);
+	grub_uint64_t ctime = grub_get_time_ms ();
 	for (unack = sock->unack_first; unack; unack = next)
 	  {
 	    grub_uint32_t seqnr;
@@ -848,6 +1183,9 @@ grub_net_recv_tcp_packet (struct grub_net_buff *nb,
 
 	    if (seqnr > acked)
 	      break;
+	    /* Karn's algorithm: only sample segments sent once.  */
+	    if (unack->try_count == 1)
+	      tcp_rtt_sample (sock, ctime - unack->last_try);
 	    grub_netbuff_free (unack->nb);
 	    grub_free (unack);
 	  }
@@ -858,6 +1196,8 @@ grub_net_recv_tcp_packet (struct grub_net_buff *nb,
 
     if (grub_be_to_cpu32 (tcph->seqnr) < sock->their_cur_seq)
       {
+	sock->duplicates++;
+	grub_net_stats.tcp_duplicates++;
 	ack (sock);
 	grub_netbuff_free (nb);
 	return GRUB_ERR_NONE;
@@ -869,6 +1209,18 @@ grub_net_recv_tcp_packet (struct grub_net_buff *nb,
 	reset (sock);
       }
 
+    {
+      grub_uint32_t seqnr = grub_be_to_cpu32 (tcph->seqnr);
+      grub_ssize_t len = nb->tail - nb->data
+	- (grub_be_to_cpu16 (tcph->flags) >> 12) * sizeof (grub_uint32_t);
+      if (len > 0 && seq_lt (sock->their_cur_seq, seqnr))
+	{
+	  sock->out_of_order++;
+	  grub_net_stats.tcp_out_of_order++;
+	  tcp_sack_add (sock, seqnr, seqnr + len);
+	}
+    }
+
     err = grub_priority_queue_push (sock->pq, &nb);
     if (err)
       {
@@ -880,6 +1232,7 @@ grub_net_recv_tcp_packet (struct grub_net_buff *nb,
       struct grub_net_buff **nb_top_p, *nb_top;
       int do_ack = 0;
       int just_closed = 0;
+      int had_holes = sock->nsack;
       while (1)
 	{
 	  nb_top_p = grub_priority_queue_top (sock->pq);
@@ -929,13 +1282,23 @@ grub_net_recv_tcp_packet (struct grub_net_buff *nb,
 	  if ((nb_top->tail - nb_top->data) > 0)
 	    {
 	      grub_net_put_packet (&sock->packs, nb_top);
-	      do_ack = 1;
+	      sock->ack_segs++;
 	    }
 	  else
 	    grub_netbuff_free (nb_top);
 	}
+      tcp_sack_trim (sock);
+      /* Delay the ACK unless this may have filled a hole or enough
+	 segments are waiting.  */
+      if (had_holes || sock->ack_segs >= TCP_DELAYED_ACK_SEGMENTS)
+	do_ack = 1;
       if (do_ack)
 	ack (sock);
+      else if (sock->ack_segs && !sock->ack_pending)
+	{
+	  sock->ack_pending = 1;
+	  sock->ack_time = grub_get_time_ms ();
+	}
       while (sock->packs.first)
 	{
 	  nb = sock->packs.first->nb;
@@ -973,6 +1336,7 @@ grub_net_recv_tcp_packet (struct grub_net_buff *nb,
 	sock->their_cur_seq = sock->their_start_seq + 1;
 	sock->my_cur_seq = sock->my_start_seq = grub_get_time_ms ();
 	sock->my_window = 8192;
+	sock->rto = TCP_RTO_INITIAL;
 
 	sock->pq = grub_priority_queue_new (sizeof (struct grub_net_buff *),
 					    cmp);
@@ -26,6 +26,7 @@
 #include <grub/dl.h>
 #include <grub/file.h>
 #include <grub/priority_queue.h>
+#include <grub/time.h>
 #include <grub/i18n.h>
 
 GRUB_MOD_LICENSE ("GPLv3+");
@@ -42,6 +43,14 @@ enum
 enum
   {
     TFTP_DEFAULTSIZE_PACKET = 512,
+    TFTP_MAX_BLKSIZE = 65464,
+    /* Blocks the server may send before waiting for an ACK (RFC 7440).  */
+    TFTP_WINDOWSIZE = 16,
+    /* Re-acknowledge a partial window after this long without data.  */
+    TFTP_WINDOW_TIMEOUT = GRUB_NET_INTERVAL,
+    /* Give up on a multicast session after this long without a new block
+       and fetch what is missing over unicast.  */
+    TFTP_MCAST_REPAIR_TIMEOUT = 3000
   };
 
 enum
@@ -102,13 +111,41 @@ typedef struct tftp_data
   grub_uint64_t file_size;
   grub_uint64_t block;
   grub_uint32_t block_size;
+  grub_uint32_t window_size;
   grub_uint64_t ack_sent;
+  /* Last block for which a duplicate triggered a repeated ACK.  */
+  grub_uint64_t dup_acked;
+  grub_uint64_t last_rx;
+  /* When the request or ACK now waited on was sent, 0 once answered.  */
+  grub_uint64_t rtt_start;
+  unsigned long duplicates;
+  unsigned long out_of_order;
+  unsigned long timeouts;
   int have_oack;
   struct grub_error_saved save_err;
+  grub_net_network_level_address_t server;
   grub_net_udp_socket_t sock;
   grub_priority_queue_t pq;
+  /* RFC 2090 multicast transfer.  Only the master client acknowledges.  */
+  int mcast;
+  int master;
+  grub_uint32_t mcast_group;
+  grub_uint16_t mcast_port;
+  grub_net_udp_socket_t mcast_sock;
+  struct grub_net_network_level_interface *mcast_inf;
+  /* Blocks received so far, by absolute number, and when one was last new.  */
+  grub_uint8_t *have;
+  grub_uint64_t have_blocks;
+  grub_uint64_t last_new;
+  /* Unicast session fetching the blocks multicast did not deliver.  */
+  int repair;
+  int repair_tries;
+  grub_uint64_t repair_block;
 } *tftp_data_t;
 
+static grub_err_t
+tftp_receive (grub_net_udp_socket_t sock, struct grub_net_buff *nb, void *f);
+
 static int
 cmp_block (grub_uint16_t a, grub_uint16_t b)
 {
@@ -156,9 +193,292 @@ ack (tftp_data_t data, grub_uint64_t block)
   if (err)
     return err;
   data->ack_sent = block;
+  data->rtt_start = grub_get_time_ms ();
+  return GRUB_ERR_NONE;
+}
+
+/* Tell the server we are done with the transfer and close the session.  */
+static void
+tftp_abort (tftp_data_t data)
+{
+  grub_uint8_t nbdata[512];
+  grub_err_t err;
+  struct grub_net_buff nb_err;
+  struct tftphdr *tftph;
+
+  nb_err.head = nbdata;
+  nb_err.end = nbdata + sizeof (nbdata);
+
+  grub_netbuff_clear (&nb_err);
+  grub_netbuff_reserve (&nb_err, 512);
+  err = grub_netbuff_push (&nb_err, sizeof (tftph->opcode)
+			   + sizeof (tftph->u.err.errcode)
+			   + sizeof ("closed"));
+  if (!err)
+    {
+      tftph = (struct tftphdr *) nb_err.data;
+      tftph->opcode = grub_cpu_to_be16_compile_time (TFTP_ERROR);
+      tftph->u.err.errcode = grub_cpu_to_be16_compile_time (TFTP_EUNDEF);
+      grub_memcpy (tftph->u.err.errmsg, "closed", sizeof ("closed"));
+
+      err = grub_net_send_udp_packet (data->sock, &nb_err);
+    }
+  if (err)
+    grub_print_error ();
+  grub_net_udp_close (data->sock);
+  data->sock = NULL;
+}
+
+static char *
+rrq_add (char *rrq, const char *str)
+{
+  grub_strcpy (rrq, str);
+  return rrq + grub_strlen (str) + 1;
+}
+
+static grub_err_t
+send_rrq (grub_file_t file, tftp_data_t data, grub_uint32_t blksize)
+{
+  struct tftphdr *tftph;
+  grub_uint8_t open_data[1500];
+  struct grub_net_buff nb;
+  char optval[sizeof ("65464")];
+  char *rrq;
+  grub_err_t err;
+
+  nb.head = open_data;
+  nb.end = open_data + sizeof (open_data);
+  grub_netbuff_clear (&nb);
+
+  grub_netbuff_reserve (&nb, 1500);
+  err = grub_netbuff_push (&nb, sizeof (*tftph));
+  if (err)
+    return err;
+
+  tftph = (struct tftphdr *) nb.data;
+  tftph->opcode = grub_cpu_to_be16_compile_time (TFTP_RRQ);
+
+  rrq = (char *) tftph->u.rrq;
+  rrq = rrq_add (rrq, file->device->net->name);
+  rrq = rrq_add (rrq, "octet");
+
+  rrq = rrq_add (rrq, "blksize");
+  grub_snprintf (optval, sizeof (optval), "%u", blksize);
+  rrq = rrq_add (rrq, optval);
+
+  /* A repair session must number blocks exactly like the multicast one, so
+     it only asks for the block size.  */
+  if (!data->repair)
+    {
+      rrq = rrq_add (rrq, "windowsize");
+      grub_snprintf (optval, sizeof (optval), "%u", TFTP_WINDOWSIZE);
+      rrq = rrq_add (rrq, optval);
+
+      if (grub_strcmp (file->device->net->protocol->name, "mtftp") == 0)
+	{
+	  rrq = rrq_add (rrq, "multicast");
+	  rrq = rrq_add (rrq, "");
+	}
+    }
+
+  rrq = rrq_add (rrq, "tsize");
+  rrq = rrq_add (rrq, "0");
+
+  err = grub_netbuff_unput (&nb, nb.tail - (grub_uint8_t *) rrq);
+  if (err)
+    return err;
+
+  data->rtt_start = grub_get_time_ms ();
+  data->last_rx = data->rtt_start;
+  return grub_net_send_udp_packet (data->sock, &nb);
+}
+
+static int
+have_block (tftp_data_t data, grub_uint64_t block)
+{
+  return (block < data->have_blocks
+	  && (data->have[block / 8] & (1 << (block % 8))));
+}
+
+static grub_err_t
+mark_block (tftp_data_t data, grub_uint64_t block)
+{
+  if (block >= data->have_blocks)
+    {
+      grub_uint64_t n = data->have_blocks ? data->have_blocks : 8192;
+      grub_uint8_t *have;
+
+      while (n <= block)
+	n *= 2;
+      have = grub_realloc (data->have, n / 8);
+      if (!have)
+	return grub_errno;
+      grub_memset (have + data->have_blocks / 8, 0,
+		   (n - data->have_blocks) / 8);
+      data->have = have;
+      data->have_blocks = n;
+    }
+  data->have[block / 8] |= 1 << (block % 8);
   return GRUB_ERR_NONE;
 }
 
+/* Parse the "address,port,master" value of the multicast option.  Later
+   OACKs leave the address and port empty and only change the master.  */
+static grub_err_t
+parse_multicast (tftp_data_t data, const char *val, grub_size_t len)
+{
+  char buf[sizeof ("255.255.255.255,65535,1")];
+  grub_net_network_level_address_t addr;
+  char *port, *mc;
+
+  if (len >= sizeof (buf))
+    return grub_error (GRUB_ERR_NET_INVALID_RESPONSE,
+		       "invalid TFTP multicast option");
+  grub_memcpy (buf, val, len);
+  buf[len] = 0;
+
+  port = grub_strchr (buf, ',');
+  mc = port ? grub_strchr (port + 1, ',') : NULL;
+  if (!mc)
+    return grub_error (GRUB_ERR_NET_INVALID_RESPONSE,
+		       "invalid TFTP multicast option");
+  *port++ = 0;
+  *mc++ = 0;
+
+  if (buf[0])
+    {
+      if (grub_net_resolve_address (buf, &addr))
+	return grub_errno;
+      if (addr.type != GRUB_NET_NETWORK_LEVEL_PROTOCOL_IPV4)
+	return grub_error (GRUB_ERR_NET_BAD_ADDRESS,
+			   "TFTP multicast group is not IPv4");
+      data->mcast_group = addr.ipv4;
+    }
+  if (port[0])
+    data->mcast_port = grub_strtoul (port, 0, 10);
+  data->master = (grub_strtoul (mc, 0, 10) == 1);
+  return GRUB_ERR_NONE;
+}
+
+static void
+mcast_stop (tftp_data_t data)
+{
+  if (data->mcast_sock)
+    {
+      grub_net_udp_close (data->mcast_sock);
+      data->mcast_sock = NULL;
+    }
+  if (data->mcast_inf)
+    {
+      grub_net_ip4_multicast_leave (data->mcast_inf, data->mcast_group);
+      data->mcast_inf = NULL;
+    }
+}
+
+static grub_err_t
+mcast_start (grub_file_t file, tftp_data_t data)
+{
+  grub_net_network_level_address_t gateway;
+  struct grub_net_network_level_interface *inf;
+  grub_err_t err;
+
+  if (data->server.type != GRUB_NET_NETWORK_LEVEL_PROTOCOL_IPV4)
+    return grub_error (GRUB_ERR_NET_BAD_ADDRESS,
+		       "multicast TFTP needs an IPv4 server");
+  err = grub_net_route_address (data->server, &gateway, &inf);
+  if (err)
+    return err;
+  err = grub_net_ip4_multicast_join (inf, data->mcast_group);
+  if (err)
+    return err;
+  data->mcast_inf = inf;
+
+  /* Data for the group comes from the server's transfer port, like the
+     unicast session, but to the group's port.  */
+  data->mcast_sock = grub_net_udp_open_port (data->server, data->mcast_port,
+					     0, tftp_receive, file);
+  if (!data->mcast_sock)
+    {
+      mcast_stop (data);
+      return grub_errno;
+    }
+  data->mcast = 1;
+  data->last_new = grub_get_time_ms ();
+  return GRUB_ERR_NONE;
+}
+
+/* Queue a block of a multicast or repair transfer unless it has been
+   received before.  Returns 1 if NB was queued, otherwise frees it.  */
+static int
+queue_block (tftp_data_t data, struct grub_net_buff *nb)
+{
+  struct tftphdr *tftph = (struct tftphdr *) nb->data;
+  grub_uint16_t wire = grub_be_to_cpu16 (tftph->u.data.block);
+  grub_uint64_t block;
+
+  if (data->repair)
+    {
+      /* The repair session is lock-step from block 1 on; blocks that are
+	 already here are acknowledged and dropped.  */
+      if (!data->have_oack || wire != (grub_uint16_t) (data->repair_block + 1))
+	{
+	  if (data->have_oack && wire == (grub_uint16_t) data->repair_block)
+	    ack (data, data->repair_block);
+	  grub_netbuff_free (nb);
+	  return 0;
+	}
+      block = ++data->repair_block;
+      ack (data, block);
+    }
+  else
+    {
+      grub_int16_t ahead = (grub_int16_t) (wire
+					   - (grub_uint16_t) (data->block + 1));
+
+      if (ahead < 0)
+	{
+	  /* The server missed our ACK.  */
+	  if (data->master)
+	    ack (data, data->block);
+	  data->duplicates++;
+	  grub_net_stats.tftp_duplicates++;
+	  grub_netbuff_free (nb);
+	  return 0;
+	}
+      block = data->block + 1 + ahead;
+    }
+
+  if (block <= data->block || have_block (data, block))
+    {
+      data->duplicates++;
+      grub_net_stats.tftp_duplicates++;
+      grub_netbuff_free (nb);
+      return 0;
+    }
+  if (grub_priority_queue_push (data->pq, &nb))
+    {
+      grub_errno = GRUB_ERR_NONE;
+      grub_netbuff_free (nb);
+      return 0;
+    }
+  if (mark_block (data, block))
+    grub_errno = GRUB_ERR_NONE;
+
+  if (block != data->block + 1)
+    {
+      data->out_of_order++;
+      grub_net_stats.tftp_out_of_order++;
+    }
+  else if (data->rtt_start)
+    {
+      grub_net_rtt_sample (&grub_net_stats.tftp_rtt,
+			   grub_get_time_ms () - data->rtt_start);
+      data->rtt_start = 0;
+    }
+  data->last_new = grub_get_time_ms ();
+  return 1;
+}
+
 static grub_err_t
 tftp_receive (grub_net_udp_socket_t sock __attribute__ ((unused)),
 	      struct grub_net_buff *nb,
@@ -169,6 +489,9 @@ tftp_receive (grub_net_udp_socket_t sock __attribute__ ((unused)),
   tftp_data_t data = file->data;
   grub_err_t err;
   grub_uint8_t *ptr;
+  grub_uint32_t block_size, window_size;
+  char *mcast_opt = NULL;
+  grub_size_t mcast_len = 0;
 
   if (nb->tail - nb->data < (grub_ssize_t) sizeof (tftph->opcode))
     {
@@ -180,21 +503,76 @@ tftp_receive (grub_net_udp_socket_t sock __attribute__ ((unused)),
   switch (grub_be_to_cpu16 (tftph->opcode))
     {
     case TFTP_OACK:
-      data->block_size = TFTP_DEFAULTSIZE_PACKET;
-      data->have_oack = 1; 
+      if (data->rtt_start)
+	grub_net_rtt_sample (&grub_net_stats.tftp_rtt,
+			     grub_get_time_ms () - data->rtt_start);
+      block_size = TFTP_DEFAULTSIZE_PACKET;
+      window_size = 1;
       for (ptr = nb->data + sizeof (tftph->opcode); ptr < nb->tail;)
 	{
 	  if (grub_memcmp (ptr, "tsize\0", sizeof ("tsize\0") - 1) == 0)
 	    data->file_size = grub_strtoul ((char *) ptr + sizeof ("tsize\0")
 					    - 1, 0, 0);
 	  if (grub_memcmp (ptr, "blksize\0", sizeof ("blksize\0") - 1) == 0)
-	    data->block_size = grub_strtoul ((char *) ptr + sizeof ("blksize\0")
-					     - 1, 0, 0);
+	    block_size = grub_strtoul ((char *) ptr + sizeof ("blksize\0")
+				       - 1, 0, 0);
+	  if (grub_memcmp (ptr, "windowsize\0", sizeof ("windowsize\0") - 1) == 0)
+	    window_size = grub_strtoul ((char *) ptr
+					+ sizeof ("windowsize\0") - 1, 0, 0);
+	  if (grub_memcmp (ptr, "multicast\0", sizeof ("multicast\0") - 1) == 0)
+	    {
+	      mcast_opt = (char *) ptr + sizeof ("multicast\0") - 1;
+	      for (mcast_len = 0; (grub_uint8_t *) mcast_opt + mcast_len
+		     < nb->tail && mcast_opt[mcast_len]; mcast_len++);
+	    }
 	  while (ptr < nb->tail && *ptr)
 	    ptr++;
 	  ptr++;
 	}
+
+      if (data->repair)
+	{
+	  if (block_size != data->block_size)
+	    grub_dprintf ("tftp", "repair session has block size %u, not %u\n",
+			  block_size, data->block_size);
+	  else if (!data->have_oack)
+	    {
+	      data->have_oack = 1;
+	      ack (data, 0);
+	    }
+	  grub_netbuff_free (nb);
+	  grub_errno = GRUB_ERR_NONE;
+	  return GRUB_ERR_NONE;
+	}
+      /* Later OACKs of a multicast session hand the master role around.
+	 A new master asks for the first block it is missing.  */
+      if (data->mcast)
+	{
+	  if (mcast_opt && parse_multicast (data, mcast_opt, mcast_len)
+	      == GRUB_ERR_NONE && data->master)
+	    ack (data, data->block);
+	  grub_netbuff_free (nb);
+	  grub_errno = GRUB_ERR_NONE;
+	  return GRUB_ERR_NONE;
+	}
+
+      data->block_size = block_size;
+      data->window_size = window_size;
+      data->have_oack = 1;
+      if (data->window_size == 0 || data->window_size > TFTP_WINDOWSIZE)
+	data->window_size = 1;
       data->block = 0;
+      if (mcast_opt)
+	{
+	  err = parse_multicast (data, mcast_opt, mcast_len);
+	  if (!err)
+	    err = mcast_start (file, data);
+	  grub_netbuff_free (nb);
+	  if (!err && data->master)
+	    err = ack (data, 0);
+	  grub_error_save (&data->save_err);
+	  return GRUB_ERR_NONE;
+	}
       grub_netbuff_free (nb);
       err = ack (data, 0);
       grub_error_save (&data->save_err);
@@ -207,9 +585,38 @@ tftp_receive (grub_net_udp_socket_t sock __attribute__ ((unused)),
 	  return GRUB_ERR_NONE;
 	}
 
-      err = grub_priority_queue_push (data->pq, &nb);
-      if (err)
-	return err;
+      if (data->mcast || data->repair)
+	{
+	  data->last_rx = grub_get_time_ms ();
+	  if (!queue_block (data, nb))
+	    return GRUB_ERR_NONE;
+	}
+      else
+	{
+	  switch (cmp_block (grub_be_to_cpu16 (tftph->u.data.block),
+			     data->block + 1))
+	    {
+	    case 0:
+	      if (data->rtt_start)
+		grub_net_rtt_sample (&grub_net_stats.tftp_rtt,
+				     grub_get_time_ms () - data->rtt_start);
+	      data->rtt_start = 0;
+	      break;
+	    case 1:
+	      data->out_of_order++;
+	      grub_net_stats.tftp_out_of_order++;
+	      break;
+	    default:
+	      data->duplicates++;
+	      grub_net_stats.tftp_duplicates++;
+	      break;
+	    }
+
+	  err = grub_priority_queue_push (data->pq, &nb);
+	  if (err)
+	    return err;
+	  data->last_rx = grub_get_time_ms ();
+	}
 
       {
 	struct grub_net_buff **nb_top_p, *nb_top;
@@ -222,7 +629,20 @@ tftp_receive (grub_net_udp_socket_t sock __attribute__ ((unused)),
 	    tftph = (struct tftphdr *) nb_top->data;
 	    if (cmp_block (grub_be_to_cpu16 (tftph->u.data.block), data->block + 1) >= 0)
 	      break;
-	    ack (data, grub_be_to_cpu16 (tftph->u.data.block));
+	    /* A duplicate means the server missed an ACK.  With a window
+	       repeat the last one, once, rather than acknowledging an
+	       older block and rewinding the server.  queue_block has
+	       already dealt with multicast and repair duplicates.  */
+	    if (data->mcast || data->repair)
+	      grub_net_stats.tftp_duplicates++;
+	    else if (data->window_size == 1)
+	      ack (data, grub_be_to_cpu16 (tftph->u.data.block));
+	    else if (data->ack_sent == data->block
+		     && data->dup_acked != data->block)
+	      {
+		ack (data, data->block);
+		data->dup_acked = data->block;
+	      }
 	    grub_netbuff_free (nb_top);
 	    grub_priority_queue_pop (data->pq);
 	  }
@@ -232,15 +652,23 @@ tftp_receive (grub_net_udp_socket_t sock __attribute__ ((unused)),
 
 	    grub_priority_queue_pop (data->pq);
 
-	    if (file->device->net->packs.count < 50)
-	      err = ack (data, data->block + 1);
-	    else
+	    data->block++;
+	    grub_net_stats.tftp_blocks++;
+	    /* Acknowledge once per window.  Repair sessions acknowledge as
+	       they go and multicast ones only from the master.  */
+	    if (!data->repair && (!data->mcast || data->master)
+		&& data->block - data->ack_sent >= data->window_size)
 	      {
-		file->device->net->stall = 1;
-		err = 0;
+		if (file->device->net->packs.count < 50)
+		  err = ack (data, data->block);
+		else
+		  {
+		    file->device->net->stall = 1;
+		    err = 0;
+		  }
+		if (err)
+		  return err;
 	      }
-	    if (err)
-	      return err;
 
 	    err = grub_netbuff_pull (nb_top, sizeof (tftph->opcode) +
 				     sizeof (tftph->u.data.block));
@@ -248,15 +676,20 @@ tftp_receive (grub_net_udp_socket_t sock __attribute__ ((unused)),
 	      return err;
 	    size = nb_top->tail - nb_top->data;
 
-	    data->block++;
 	    if (size < data->block_size)
 	      {
-		if (data->ack_sent < data->block)
-		  ack (data, data->block);
+		mcast_stop (data);
+		if (data->repair || (data->mcast && !data->master))
+		  tftp_abort (data);
+		else
+		  {
+		    if (data->ack_sent < data->block)
+		      ack (data, data->block);
+		    grub_net_udp_close (data->sock);
+		    data->sock = NULL;
+		  }
 		file->device->net->eof = 1;
 		file->device->net->stall = 1;
-		grub_net_udp_close (data->sock);
-		data->sock = NULL;
 	      }
 	    /* Prevent garbage in broken cards. Is it still necessary
 	       given that IP implementation has been fixed?
@@ -272,6 +705,15 @@ tftp_receive (grub_net_udp_socket_t sock __attribute__ ((unused)),
 	      grub_net_put_packet (&file->device->net->packs, nb_top);
 	    else
 	      grub_netbuff_free (nb_top);
+
+	    /* Blocks queued behind a gap may now be in order.  */
+	    if (file->device->net->eof)
+	      break;
+	    nb_top_p = grub_priority_queue_top (data->pq);
+	    if (!nb_top_p)
+	      break;
+	    nb_top = *nb_top_p;
+	    tftph = (struct tftphdr *) nb_top->data;
 	  }
       }
       return GRUB_ERR_NONE;
@@ -304,64 +746,44 @@ static grub_err_t
 tftp_open (struct grub_file *file, const char *filename)
 {
   struct tftphdr *tftph;
-  char *rrq;
   int i;
-  int rrqlen;
-  int hdrlen;
-  grub_uint8_t open_data[1500];
-  struct grub_net_buff nb;
   tftp_data_t data;
   grub_err_t err;
-  grub_uint8_t *nbd;
   grub_net_network_level_address_t addr;
+  grub_net_network_level_address_t gateway;
+  struct grub_net_network_level_interface *inf;
+  grub_uint32_t blksize = TFTP_DEFAULTSIZE_PACKET * 2;
 
   data = grub_zalloc (sizeof (*data));
   if (!data)
     return grub_errno;
 
-  nb.head = open_data;
-  nb.end = open_data + sizeof (open_data);
-  grub_netbuff_clear (&nb);
-
-  grub_netbuff_reserve (&nb, 1500);
-  err = grub_netbuff_push (&nb, sizeof (*tftph));
+  err = grub_net_resolve_address (file->device->net->server, &addr);
   if (err)
-    return err;
-
-  tftph = (struct tftphdr *) nb.data;
-
-  rrq = (char *) tftph->u.rrq;
-  rrqlen = 0;
-
-  tftph->opcode = grub_cpu_to_be16_compile_time (TFTP_RRQ);
-  grub_strcpy (rrq, filename);
-  rrqlen += grub_strlen (filename) + 1;
-  rrq += grub_strlen (filename) + 1;
-
-  grub_strcpy (rrq, "octet");
-  rrqlen += grub_strlen ("octet") + 1;
-  rrq += grub_strlen ("octet") + 1;
-
-  grub_strcpy (rrq, "blksize");
-  rrqlen += grub_strlen ("blksize") + 1;
-  rrq += grub_strlen ("blksize") + 1;
-
-  grub_strcpy (rrq, "1024");
-  rrqlen += grub_strlen ("1024") + 1;
-  rrq += grub_strlen ("1024") + 1;
-
-  grub_strcpy (rrq, "tsize");
-  rrqlen += grub_strlen ("tsize") + 1;
-  rrq += grub_strlen ("tsize") + 1;
-
-  grub_strcpy (rrq, "0");
-  rrqlen += grub_strlen ("0") + 1;
-  rrq += grub_strlen ("0") + 1;
-  hdrlen = sizeof (tftph->opcode) + rrqlen;
+    {
+      grub_free (data);
+      return err;
+    }
+  data->server = addr;
 
-  err = grub_netbuff_unput (&nb, nb.tail - (nb.data + hdrlen));
-  if (err)
-    return err;
+  /* Ask for the largest block that fits the interface MTU so that data
+     packets are not fragmented.  */
+  if (grub_net_route_address (addr, &gateway, &inf) == GRUB_ERR_NONE
+      && inf->card->mtu)
+    {
+      grub_size_t overhead = GRUB_NET_UDP_HEADER_SIZE
+	+ sizeof (tftph->opcode) + sizeof (tftph->u.data.block)
+	+ (addr.type == GRUB_NET_NETWORK_LEVEL_PROTOCOL_IPV6
+	   ? GRUB_NET_OUR_IPV6_HEADER_SIZE : GRUB_NET_OUR_IPV4_HEADER_SIZE);
+
+      if (inf->card->mtu > overhead + TFTP_DEFAULTSIZE_PACKET)
+	blksize = inf->card->mtu - overhead;
+      else
+	blksize = TFTP_DEFAULTSIZE_PACKET;
+      if (blksize > TFTP_MAX_BLKSIZE)
+	blksize = TFTP_MAX_BLKSIZE;
+    }
+  grub_errno = GRUB_ERR_NONE;
 
   file->not_easily_seekable = 1;
   file->data = data;
@@ -370,13 +792,6 @@ tftp_open (struct grub_file *file, const char *filename)
   if (!data->pq)
     return grub_errno;
 
-  err = grub_net_resolve_address (file->device->net->server, &addr);
-  if (err)
-    {
-      destroy_pq (data);
-      return err;
-    }
-
   data->sock = grub_net_udp_open (addr,
 				  TFTP_SERVER_PORT, tftp_receive,
 				  file);
@@ -387,11 +802,14 @@ tftp_open (struct grub_file *file, const char *filename)
     }
 
   /* Receive OACK packet.  */
-  nbd = nb.data;
   for (i = 0; i < GRUB_NET_TRIES; i++)
     {
-      nb.data = nbd;
-      err = grub_net_send_udp_packet (data->sock, &nb);
+      if (i)
+	{
+	  data->timeouts++;
+	  grub_net_stats.tftp_timeouts++;
+	}
+      err = send_rrq (file, data, blksize);
       if (err)
 	{
 	  grub_net_udp_close (data->sock);
@@ -410,12 +828,14 @@ tftp_open (struct grub_file *file, const char *filename)
     grub_error_load (&data->save_err);
   if (grub_errno)
     {
+      mcast_stop (data);
       grub_net_udp_close (data->sock);
       destroy_pq (data);
       return grub_errno;
     }
 
   file->size = data->file_size;
+  grub_net_stats.tftp_files++;
 
   return GRUB_ERR_NONE;
 }
@@ -425,39 +845,44 @@ tftp_close (struct grub_file *file)
 {
   tftp_data_t data = file->data;
 
-  if (data->sock)
-    {
-      grub_uint8_t nbdata[512];
-      grub_err_t err;
-      struct grub_net_buff nb_err;
-      struct tftphdr *tftph;
-
-      nb_err.head = nbdata;
-      nb_err.end = nbdata + sizeof (nbdata);
-
-      grub_netbuff_clear (&nb_err);
-      grub_netbuff_reserve (&nb_err, 512);
-      err = grub_netbuff_push (&nb_err, sizeof (tftph->opcode)
-			       + sizeof (tftph->u.err.errcode)
-			       + sizeof ("closed"));
-      if (!err)
-	{
-	  tftph = (struct tftphdr *) nb_err.data;
-	  tftph->opcode = grub_cpu_to_be16_compile_time (TFTP_ERROR);
-	  tftph->u.err.errcode = grub_cpu_to_be16_compile_time (TFTP_EUNDEF);
-	  grub_memcpy (tftph->u.err.errmsg, "closed", sizeof ("closed"));
+  grub_boot_time ("TFTP %s closed: %llu blocks of %u bytes,"
+		  " %lu duplicates, %lu out of order, %lu timeouts",
+		  file->name, (unsigned long long) data->block,
+		  data->block_size, data->duplicates, data->out_of_order,
+		  data->timeouts);
 
-	  err = grub_net_send_udp_packet (data->sock, &nb_err);
-	}
-      if (err)
-	grub_print_error ();
-      grub_net_udp_close (data->sock);
-    }
+  mcast_stop (data);
+  if (data->sock)
+    tftp_abort (data);
   destroy_pq (data);
+  grub_free (data->have);
   grub_free (data);
   return GRUB_ERR_NONE;
 }
 
+/* The multicast session went quiet with blocks still missing: fetch the
+   file again over unicast, keeping only the blocks we do not have.  */
+static grub_err_t
+start_repair (struct grub_file *file, tftp_data_t data)
+{
+  grub_dprintf ("tftp", "multicast stalled after block %llu, repairing\n",
+		(unsigned long long) data->block);
+  mcast_stop (data);
+  tftp_abort (data);
+  data->mcast = 0;
+  data->master = 0;
+  data->repair = 1;
+  data->repair_block = 0;
+  data->repair_tries = 0;
+  data->have_oack = 0;
+
+  data->sock = grub_net_udp_open (data->server, TFTP_SERVER_PORT,
+				  tftp_receive, file);
+  if (!data->sock)
+    return grub_errno;
+  return send_rrq (file, data, data->block_size);
+}
+
 static grub_err_t
 tftp_packets_pulled (struct grub_file *file)
 {
@@ -467,8 +892,45 @@ tftp_packets_pulled (struct grub_file *file)
 
   if (!file->device->net->eof)
     file->device->net->stall = 0;
+  if (!data->sock)
+    return 0;
+
+  if (data->mcast)
+    {
+      /* Only count time the reader spent starved for data.  */
+      if (file->device->net->packs.first)
+	data->last_new = grub_get_time_ms ();
+      else if (grub_get_time_ms () - data->last_new
+	       >= TFTP_MCAST_REPAIR_TIMEOUT)
+	return start_repair (file, data);
+      if (!data->master)
+	return 0;
+    }
+  if (data->repair)
+    {
+      if (grub_get_time_ms () - data->last_rx < GRUB_NET_INTERVAL)
+	return 0;
+      data->timeouts++;
+      grub_net_stats.tftp_timeouts++;
+      if (data->have_oack)
+	return ack (data, data->repair_block);
+      if (data->repair_tries++ < GRUB_NET_TRIES)
+	return send_rrq (file, data, data->block_size);
+      return 0;
+    }
+
   if (data->ack_sent >= data->block)
     return 0;
+  /* In the middle of a window only acknowledge once the server seems to
+     have stopped sending, i.e. a packet was lost.  */
+  if (data->block - data->ack_sent < data->window_size
+      && grub_get_time_ms () - data->last_rx < TFTP_WINDOW_TIMEOUT)
+    return 0;
+  if (data->block - data->ack_sent < data->window_size)
+    {
+      data->timeouts++;
+      grub_net_stats.tftp_timeouts++;
+    }
   return ack (data, data->block);
 }
 
@@ -480,12 +942,23 @@ static struct grub_net_app_protocol grub_tftp_protocol =
     .packets_pulled = tftp_packets_pulled
   };
 
+/* RFC 2090 multicast TFTP.  Servers without it answer as for tftp.  */
+static struct grub_net_app_protocol grub_mtftp_protocol =
+  {
+    .name = "mtftp",
+    .open = tftp_open,
+    .close = tftp_close,
+    .packets_pulled = tftp_packets_pulled
+  };
+
 GRUB_MOD_INIT (tftp)
 {
   grub_net_app_level_register (&grub_tftp_protocol);
+  grub_net_app_level_register (&grub_mtftp_protocol);
 }
 
 GRUB_MOD_FINI (tftp)
 {
+  grub_net_app_level_unregister (&grub_mtftp_protocol);
   grub_net_app_level_unregister (&grub_tftp_protocol);
 }
@@ -0,0 +1,1744 @@
+/* tls.c - TLS 1.3 client (RFC 8446).  */
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2026  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <grub/types.h>
+#include <grub/misc.h>
+#include <grub/mm.h>
+#include <grub/err.h>
+#include <grub/dl.h>
+#include <grub/i18n.h>
+#include <grub/time.h>
+#include <grub/crypto.h>
+#include <grub/file.h>
+#include <grub/gcrypt/gcrypt.h>
+#include <grub/pubkey.h>
+#include <grub/net.h>
+#include <grub/net/tcp.h>
+#include <grub/net/netbuff.h>
+#include <grub/net/tls.h>
+#ifdef GRUB_MACHINE_EFI
+#include <grub/efi/api.h>
+#include <grub/efi/efi.h>
+#endif
+#ifdef __x86_64__
+#include <grub/i386/cpuid.h>
+#include <grub/i386/tsc.h>
+#endif
+
+#include "tls_private.h"
+
+GRUB_MOD_LICENSE ("GPLv3+");
+
+/* Both cipher suites use SHA-256, so every secret is this long.  */
+#define TLS_HASH_SIZE		32
+
+#define TLS_RECORD_HEADER_SIZE	5
+#define TLS_MAX_PLAINTEXT	16384
+#define TLS_MAX_CIPHERTEXT	(TLS_MAX_PLAINTEXT + 256)
+#define TLS_MAX_HANDSHAKE	(1 << 17)
+#define TLS_MAX_TICKET		4096
+/* Tickets kept per server; each one is used only once.  */
+#define TLS_TICKETS_PER_SERVER	4
+#define TLS_MAX_TICKET_LIFETIME	(7 * 24 * 3600)
+#define TLS_MAX_RSA_BYTES	1024
+
+enum
+  {
+    TLS_CONTENT_CCS = 20,
+    TLS_CONTENT_ALERT = 21,
+    TLS_CONTENT_HANDSHAKE = 22,
+    TLS_CONTENT_APPLICATION = 23
+  };
+
+enum
+  {
+    TLS_CLIENT_HELLO = 1,
+    TLS_SERVER_HELLO = 2,
+    TLS_NEW_SESSION_TICKET = 4,
+    TLS_ENCRYPTED_EXTENSIONS = 8,
+    TLS_CERTIFICATE = 11,
+    TLS_CERTIFICATE_REQUEST = 13,
+    TLS_CERTIFICATE_VERIFY = 15,
+    TLS_FINISHED = 20,
+    TLS_KEY_UPDATE = 24
+  };
+
+enum
+  {
+    TLS_EXT_SERVER_NAME = 0x0000,
+    TLS_EXT_SUPPORTED_GROUPS = 0x000a,
+    TLS_EXT_SIGNATURE_ALGORITHMS = 0x000d,
+    TLS_EXT_PRE_SHARED_KEY = 0x0029,
+    TLS_EXT_SUPPORTED_VERSIONS = 0x002b,
+    TLS_EXT_PSK_KEY_EXCHANGE_MODES = 0x002d,
+    TLS_EXT_KEY_SHARE = 0x0033
+  };
+
+enum
+  {
+    TLS_ALERT_CLOSE_NOTIFY = 0,
+    TLS_ALERT_UNEXPECTED_MESSAGE = 10,
+    TLS_ALERT_BAD_RECORD_MAC = 20,
+    TLS_ALERT_RECORD_OVERFLOW = 22,
+    TLS_ALERT_HANDSHAKE_FAILURE = 40,
+    TLS_ALERT_BAD_CERTIFICATE = 42,
+    TLS_ALERT_UNSUPPORTED_CERTIFICATE = 43,
+    TLS_ALERT_ILLEGAL_PARAMETER = 47,
+    TLS_ALERT_DECODE_ERROR = 50,
+    TLS_ALERT_DECRYPT_ERROR = 51,
+    TLS_ALERT_PROTOCOL_VERSION = 70,
+    TLS_ALERT_INTERNAL_ERROR = 80,
+    TLS_ALERT_MISSING_EXTENSION = 109,
+    TLS_ALERT_UNSUPPORTED_EXTENSION = 110
+  };
+
+#define TLS_GROUP_X25519		0x001d
+#define TLS_RSA_PSS_RSAE_SHA256		0x0804
+#define TLS_RSA_PSS_RSAE_SHA384		0x0805
+#define TLS_RSA_PSS_RSAE_SHA512		0x0806
+
+/* The random value of a HelloRetryRequest (RFC 8446, 4.1.3).  */
+static const grub_uint8_t hello_retry_random[32] =
+  {
+    0xcf, 0x21, 0xad, 0x74, 0xe5, 0x9a, 0x61, 0x11,
+    0xbe, 0x1d, 0x8c, 0x02, 0x1e, 0x65, 0xb8, 0x91,
+    0xc2, 0xa2, 0x11, 0x16, 0x7a, 0xbb, 0x8c, 0x5e,
+    0x07, 0x9e, 0x09, 0xe2, 0xc8, 0xa8, 0x33, 0x9c
+  };
+
+/* rsaEncryption, 1.2.840.113549.1.1.1.  */
+static const grub_uint8_t rsa_oid[] =
+  {
+    0x2a, 0x86, 0x48, 0x86, 0xf7, 0x0d, 0x01, 0x01, 0x01
+  };
+
+enum tls_state
+  {
+    TLS_WAIT_SERVER_HELLO,
+    TLS_WAIT_ENCRYPTED_EXTENSIONS,
+    TLS_WAIT_CERTIFICATE,
+    TLS_WAIT_CERTIFICATE_VERIFY,
+    TLS_WAIT_FINISHED,
+    TLS_CONNECTED,
+    TLS_CLOSED,
+    TLS_FAILED
+  };
+
+/* A session ticket, good for one resumption.  */
+struct tls_ticket
+{
+  struct tls_ticket *next;
+  char *server;
+  grub_uint64_t received;
+  grub_uint32_t lifetime;
+  grub_uint32_t age_add;
+  grub_uint8_t psk[TLS_HASH_SIZE];
+  grub_size_t len;
+  grub_uint8_t ticket[];
+};
+
+static struct tls_ticket *tickets;
+
+/* Keys of one direction of the record layer.  */
+struct tls_direction
+{
+  int active;
+  struct grub_tls_aead aead;
+  grub_uint8_t secret[TLS_HASH_SIZE];
+  grub_uint8_t iv[GRUB_TLS_AEAD_NONCE_SIZE];
+  grub_uint64_t seq;
+};
+
+struct grub_net_tls
+{
+  grub_net_tcp_socket_t sock;
+  char *server;
+  grub_err_t (*recv) (struct grub_net_buff *nb, void *data);
+  void *data;
+
+  enum tls_state state;
+  /* Set once the handshake is over, whatever its outcome.  */
+  int done;
+  grub_err_t err;
+  const char *errmsg;
+
+  const gcry_md_spec_t *md;
+  void *transcript;
+  grub_uint8_t empty_hash[TLS_HASH_SIZE];
+
+  grub_uint16_t suite;
+  grub_uint8_t session_id[32];
+  grub_uint8_t x25519_key[GRUB_TLS_X25519_SIZE];
+  struct tls_ticket *ticket;
+  int psk_accepted;
+  int cert_requested;
+  grub_uint8_t cert_request_context[255];
+  grub_size_t cert_request_context_len;
+  gcry_mpi_t rsa_n;
+  gcry_mpi_t rsa_e;
+
+  grub_uint8_t c_hs[TLS_HASH_SIZE];
+  grub_uint8_t s_hs[TLS_HASH_SIZE];
+  grub_uint8_t master[TLS_HASH_SIZE];
+  grub_uint8_t res_master[TLS_HASH_SIZE];
+
+  struct tls_direction rx;
+  struct tls_direction tx;
+  /* The receive keys changed; nothing may be left over from the record
+     that carried the change.  */
+  int rx_changed;
+
+  grub_uint8_t *rec;
+  grub_size_t rec_len;
+  grub_uint8_t *hs;
+  grub_size_t hs_len;
+};
+
+static inline grub_uint16_t
+get16 (const grub_uint8_t *p)
+{
+  return ((grub_uint16_t) p[0] << 8) | p[1];
+}
+
+static inline grub_uint32_t
+get24 (const grub_uint8_t *p)
+{
+  return ((grub_uint32_t) p[0] << 16) | ((grub_uint32_t) p[1] << 8) | p[2];
+}
+
+static inline grub_uint32_t
+get32 (const grub_uint8_t *p)
+{
+  return ((grub_uint32_t) get16 (p) << 16) | get16 (p + 2);
+}
+
+static inline grub_uint8_t *
+put16 (grub_uint8_t *p, grub_uint16_t v)
+{
+  p[0] = v >> 8;
+  p[1] = v;
+  return p + 2;
+}
+
+static inline grub_uint8_t *
+put24 (grub_uint8_t *p, grub_uint32_t v)
+{
+  p[0] = v >> 16;
+  return put16 (p + 1, v);
+}
+
+static inline grub_uint8_t *
+put32 (grub_uint8_t *p, grub_uint32_t v)
+{
+  return put16 (put16 (p, v >> 16), v);
+}
+
+/* Random numbers.  A SHA-256 pool seeded from the firmware's RNG protocol,
+   RDRAND and the timers, and re-keyed after every use.  */
+
+static grub_uint8_t rng_pool[TLS_HASH_SIZE];
+static grub_uint64_t rng_counter;
+static int rng_seeded;
+
+static void
+rng_hash (const gcry_md_spec_t *md, grub_uint8_t *out,
+	  const void *in, grub_size_t len)
+{
+  GRUB_PROPERLY_ALIGNED_ARRAY (ctx, GRUB_CRYPTO_MAX_MD_CONTEXT_SIZE);
+
+  md->init (ctx);
+  md->write (ctx, rng_pool, sizeof (rng_pool));
+  md->write (ctx, in, len);
+  md->final (ctx);
+  grub_memcpy (out, md->read (ctx), TLS_HASH_SIZE);
+  grub_memset (ctx, 0, md->contextsize);
+}
+
+static void
+rng_stir (const gcry_md_spec_t *md, const void *in, grub_size_t len)
+{
+  rng_hash (md, rng_pool, in, len);
+}
+
+#ifdef __x86_64__
+static int
+rdrand_supported (void)
+{
+  grub_uint32_t eax, ebx, ecx, edx;
+
+  if (!grub_cpu_is_cpuid_supported ())
+    return 0;
+  grub_cpuid (1, eax, ebx, ecx, edx);
+  return !!(ecx & (1 << 30));
+}
+
+static int
+rdrand64 (grub_uint64_t *v)
+{
+  int i;
+  grub_uint8_t ok;
+
+  for (i = 0; i < 10; i++)
+    {
+      asm volatile ("rdrand %0; setc %1" : "=r" (*v), "=qm" (ok) : : "cc");
+      if (ok)
+	return 1;
+    }
+  return 0;
+}
+#endif
+
+static void
+rng_seed (const gcry_md_spec_t *md)
+{
+  grub_uint64_t t;
+  int hw = 0;
+#ifdef GRUB_MACHINE_EFI
+  grub_efi_guid_t rng_guid = GRUB_EFI_RNG_PROTOCOL_GUID;
+  grub_efi_rng_protocol_t *rng;
+  grub_uint8_t buf[TLS_HASH_SIZE];
+
+  rng = grub_efi_locate_protocol (&rng_guid, 0);
+  if (rng && efi_call_4 (rng->get_rng, rng, NULL, sizeof (buf), buf)
+      == GRUB_EFI_SUCCESS)
+    {
+      rng_stir (md, buf, sizeof (buf));
+      grub_memset (buf, 0, sizeof (buf));
+      hw = 1;
+    }
+#endif
+#ifdef __x86_64__
+  if (rdrand_supported ())
+    {
+      int i;
+
+      for (i = 0; i < 4; i++)
+	if (rdrand64 (&t))
+	  {
+	    rng_stir (md, &t, sizeof (t));
+	    hw = 1;
+	  }
+    }
+#endif
+  t = grub_get_time_ms ();
+  rng_stir (md, &t, sizeof (t));
+
+  if (!hw)
+    grub_dprintf ("tls", "no hardware random source, "
+		  "keys only depend on the time\n");
+  rng_seeded = 1;
+}
+
+static void
+rng_bytes (const gcry_md_spec_t *md, grub_uint8_t *out, grub_size_t len)
+{
+  grub_uint8_t block[TLS_HASH_SIZE];
+  grub_uint64_t t;
+
+  if (!rng_seeded)
+    rng_seed (md);
+
+#ifdef __x86_64__
+  t = grub_get_tsc ();
+#else
+  t = grub_get_time_ms ();
+#endif
+  rng_stir (md, &t, sizeof (t));
+
+  while (len)
+    {
+      grub_size_t n = len < sizeof (block) ? len : sizeof (block);
+
+      rng_hash (md, block, &rng_counter, sizeof (rng_counter));
+      rng_counter++;
+      grub_memcpy (out, block, n);
+      out += n;
+      len -= n;
+    }
+  rng_stir (md, &rng_counter, sizeof (rng_counter));
+  rng_counter++;
+  grub_memset (block, 0, sizeof (block));
+}
+
+/* Key schedule (RFC 8446, 7.1).  */
+
+static void
+hkdf_extract (grub_net_tls_t tls, const grub_uint8_t *salt,
+	      const grub_uint8_t *ikm, grub_uint8_t *out)
+{
+  grub_crypto_hmac_buffer (tls->md, salt, TLS_HASH_SIZE, ikm, TLS_HASH_SIZE,
+			   out);
+}
+
+/* HKDF-Expand-Label.  LEN is at most one hash long, so a single HMAC
+   block is all HKDF-Expand needs.  */
+static void
+hkdf_expand_label (grub_net_tls_t tls, const grub_uint8_t *secret,
+		   const char *label, const grub_uint8_t *context,
+		   grub_size_t context_len, grub_uint8_t *out, grub_size_t len)
+{
+  grub_uint8_t info[2 + 1 + 255 + 1 + 255 + 1];
+  grub_uint8_t t[TLS_HASH_SIZE];
+  grub_size_t label_len = grub_strlen (label);
+  grub_uint8_t *p = info;
+
+  p = put16 (p, len);
+  *p++ = sizeof ("tls13 ") - 1 + label_len;
+  grub_memcpy (p, "tls13 ", sizeof ("tls13 ") - 1);
+  p += sizeof ("tls13 ") - 1;
+  grub_memcpy (p, label, label_len);
+  p += label_len;
+  *p++ = context_len;
+  grub_memcpy (p, context, context_len);
+  p += context_len;
+  *p++ = 1;
+
+  grub_crypto_hmac_buffer (tls->md, secret, TLS_HASH_SIZE, info, p - info, t);
+  grub_memcpy (out, t, len);
+  grub_memset (t, 0, sizeof (t));
+}
+
+static void
+derive_secret (grub_net_tls_t tls, const grub_uint8_t *secret,
+	       const char *label, const grub_uint8_t *hash, grub_uint8_t *out)
+{
+  hkdf_expand_label (tls, secret, label, hash, TLS_HASH_SIZE, out,
+		     TLS_HASH_SIZE);
+}
+
+static void
+finished_mac (grub_net_tls_t tls, const grub_uint8_t *secret,
+	      const grub_uint8_t *hash, grub_uint8_t *out)
+{
+  grub_uint8_t key[TLS_HASH_SIZE];
+
+  hkdf_expand_label (tls, secret, "finished", NULL, 0, key, sizeof (key));
+  grub_crypto_hmac_buffer (tls->md, key, sizeof (key), hash, TLS_HASH_SIZE,
+			   out);
+  grub_memset (key, 0, sizeof (key));
+}
+
+static void
+transcript_add (grub_net_tls_t tls, const grub_uint8_t *msg, grub_size_t len)
+{
+  tls->md->write (tls->transcript, msg, len);
+}
+
+static void
+transcript_hash (grub_net_tls_t tls, grub_uint8_t *out)
+{
+  GRUB_PROPERLY_ALIGNED_ARRAY (ctx, GRUB_CRYPTO_MAX_MD_CONTEXT_SIZE);
+
+  grub_memcpy (ctx, tls->transcript, tls->md->contextsize);
+  tls->md->final (ctx);
+  grub_memcpy (out, tls->md->read (ctx), TLS_HASH_SIZE);
+}
+
+static grub_err_t
+set_keys (grub_net_tls_t tls, struct tls_direction *dir,
+	  const grub_uint8_t *secret)
+{
+  grub_uint8_t key[GRUB_TLS_AEAD_MAX_KEY_SIZE];
+  grub_size_t key_size = grub_tls_aead_key_size (tls->suite);
+  grub_err_t err;
+
+  if (dir->active)
+    grub_tls_aead_fini (&dir->aead);
+  dir->active = 0;
+
+  if (secret != dir->secret)
+    grub_memcpy (dir->secret, secret, TLS_HASH_SIZE);
+  hkdf_expand_label (tls, dir->secret, "key", NULL, 0, key, key_size);
+  hkdf_expand_label (tls, dir->secret, "iv", NULL, 0, dir->iv,
+		     sizeof (dir->iv));
+  err = grub_tls_aead_init (&dir->aead, tls->suite, key);
+  grub_memset (key, 0, sizeof (key));
+  if (err)
+    return err;
+  dir->seq = 0;
+  dir->active = 1;
+  return GRUB_ERR_NONE;
+}
+
+static void
+record_nonce (const struct tls_direction *dir, grub_uint8_t *nonce)
+{
+  int i;
+
+  grub_memcpy (nonce, dir->iv, GRUB_TLS_AEAD_NONCE_SIZE);
+  for (i = 0; i < 8; i++)
+    nonce[GRUB_TLS_AEAD_NONCE_SIZE - 1 - i] ^= dir->seq >> (8 * i);
+}
+
+/* Record layer.  */
+
+static grub_err_t
+send_record (grub_net_tls_t tls, grub_uint8_t type,
+	     const grub_uint8_t *data, grub_size_t len)
+{
+  struct grub_net_buff *nb;
+  grub_uint8_t *rec;
+  grub_size_t total = TLS_RECORD_HEADER_SIZE + len;
+  grub_err_t err;
+
+  if (!tls->sock)
+    return grub_error (GRUB_ERR_NET_UNKNOWN_ERROR,
+		       N_("TLS connection is closed"));
+
+  if (tls->tx.active)
+    total += 1 + GRUB_TLS_AEAD_TAG_SIZE;
+
+  nb = grub_netbuff_alloc (GRUB_NET_TCP_RESERVE_SIZE + total);
+  if (!nb)
+    return grub_errno;
+  err = grub_netbuff_reserve (nb, GRUB_NET_TCP_RESERVE_SIZE);
+  if (!err)
+    err = grub_netbuff_put (nb, total);
+  if (err)
+    {
+      grub_netbuff_free (nb);
+      return err;
+    }
+
+  rec = nb->data;
+  rec[0] = tls->tx.active ? TLS_CONTENT_APPLICATION : type;
+  put16 (rec + 1, 0x0303);
+  put16 (rec + 3, total - TLS_RECORD_HEADER_SIZE);
+  grub_memcpy (rec + TLS_RECORD_HEADER_SIZE, data, len);
+  if (tls->tx.active)
+    {
+      grub_uint8_t nonce[GRUB_TLS_AEAD_NONCE_SIZE];
+
+      rec[TLS_RECORD_HEADER_SIZE + len] = type;
+      record_nonce (&tls->tx, nonce);
+      grub_tls_aead_seal (&tls->tx.aead, nonce, rec, TLS_RECORD_HEADER_SIZE,
+			  rec + TLS_RECORD_HEADER_SIZE, len + 1,
+			  rec + TLS_RECORD_HEADER_SIZE + len + 1);
+      tls->tx.seq++;
+    }
+
+  return grub_net_send_tcp_packet (tls->sock, nb, 1);
+}
+
+static grub_err_t
+send_handshake (grub_net_tls_t tls, const grub_uint8_t *msg, grub_size_t len)
+{
+  transcript_add (tls, msg, len);
+  return send_record (tls, TLS_CONTENT_HANDSHAKE, msg, len);
+}
+
+/* Abort the connection with ALERT and remember why for the caller.  */
+static grub_err_t
+tls_fail (grub_net_tls_t tls, grub_err_t err, grub_uint8_t alert,
+	  const char *msg)
+{
+  if (tls->state == TLS_FAILED)
+    return tls->err;
+
+  grub_dprintf ("tls", "%s: %s (alert %d)\n", tls->server, msg, alert);
+  if (tls->sock && alert != TLS_ALERT_CLOSE_NOTIFY)
+    {
+      grub_uint8_t a[2] = { 2, alert };
+
+      send_record (tls, TLS_CONTENT_ALERT, a, sizeof (a));
+      grub_errno = GRUB_ERR_NONE;
+    }
+  tls->state = TLS_FAILED;
+  tls->done = 1;
+  tls->err = err;
+  tls->errmsg = msg;
+  return err;
+}
+
+static grub_err_t
+decode_error (grub_net_tls_t tls)
+{
+  return tls_fail (tls, GRUB_ERR_NET_INVALID_RESPONSE, TLS_ALERT_DECODE_ERROR,
+		   N_("malformed handshake message"));
+}
+
+static grub_err_t
+unexpected_message (grub_net_tls_t tls)
+{
+  return tls_fail (tls, GRUB_ERR_NET_INVALID_RESPONSE,
+		   TLS_ALERT_UNEXPECTED_MESSAGE, N_("unexpected message"));
+}
+
+/* Tickets.  */
+
+static void
+ticket_free (struct tls_ticket *t)
+{
+  grub_memset (t->psk, 0, sizeof (t->psk));
+  grub_free (t->server);
+  grub_free (t);
+}
+
+static int
+ticket_expired (const struct tls_ticket *t, grub_uint64_t now)
+{
+  return now - t->received >= (grub_uint64_t) t->lifetime * 1000;
+}
+
+/* Take a ticket for SERVER off the list.  */
+static struct tls_ticket *
+ticket_take (const char *server)
+{
+  struct tls_ticket **prev, *t;
+  grub_uint64_t now = grub_get_time_ms ();
+
+  for (prev = &tickets; *prev; )
+    {
+      t = *prev;
+      if (ticket_expired (t, now))
+	{
+	  *prev = t->next;
+	  ticket_free (t);
+	  continue;
+	}
+      if (grub_strcmp (t->server, server) == 0)
+	{
+	  *prev = t->next;
+	  t->next = 0;
+	  return t;
+	}
+      prev = &t->next;
+    }
+  return 0;
+}
+
+static void
+ticket_store (struct tls_ticket *t)
+{
+  struct tls_ticket **prev, *oldest = 0, **oldest_prev = 0;
+  int count = 0;
+
+  for (prev = &tickets; *prev; prev = &(*prev)->next)
+    if (grub_strcmp ((*prev)->server, t->server) == 0)
+      {
+	count++;
+	oldest = *prev;
+	oldest_prev = prev;
+      }
+  if (count >= TLS_TICKETS_PER_SERVER)
+    {
+      *oldest_prev = oldest->next;
+      ticket_free (oldest);
+    }
+  t->next = tickets;
+  tickets = t;
+}
+
+/* Handshake.  */
+
+static int
+is_hostname (const char *server)
+{
+  const char *p;
+
+  if (grub_strchr (server, ':') || *server == '[')
+    return 0;
+  for (p = server; *p; p++)
+    if (!grub_isdigit (*p) && *p != '.')
+      return 1;
+  return 0;
+}
+
+static grub_err_t
+send_client_hello (grub_net_tls_t tls)
+{
+  grub_uint8_t *msg, *p, *ext, *psk_ext = 0, *binders = 0;
+  grub_size_t server_len = grub_strlen (tls->server);
+  int sni = is_hostname (tls->server) && server_len <= 255;
+  grub_uint8_t random[32];
+  grub_uint8_t pub[GRUB_TLS_X25519_SIZE];
+  grub_err_t err;
+
+  tls->ticket = ticket_take (tls->server);
+
+  msg = grub_malloc (512 + server_len
+		     + (tls->ticket ? tls->ticket->len : 0));
+  if (!msg)
+    return grub_errno;
+
+  rng_bytes (tls->md, random, sizeof (random));
+  rng_bytes (tls->md, tls->session_id, sizeof (tls->session_id));
+  rng_bytes (tls->md, tls->x25519_key, sizeof (tls->x25519_key));
+  grub_tls_x25519 (pub, tls->x25519_key, grub_tls_x25519_base);
+
+  p = msg;
+  *p++ = TLS_CLIENT_HELLO;
+  p += 3;
+  p = put16 (p, 0x0303);
+  grub_memcpy (p, random, sizeof (random));
+  p += sizeof (random);
+  *p++ = sizeof (tls->session_id);
+  grub_memcpy (p, tls->session_id, sizeof (tls->session_id));
+  p += sizeof (tls->session_id);
+
+  /* Prefer AES-GCM only where the CPU accelerates it.  */
+  p = put16 (p, 4);
+#ifdef GRUB_TLS_USE_AESNI
+  if (grub_aesni_is_supported ())
+    {
+      p = put16 (p, GRUB_TLS_AES_128_GCM_SHA256);
+      p = put16 (p, GRUB_TLS_CHACHA20_POLY1305_SHA256);
+    }
+  else
+#endif
+    {
+      p = put16 (p, GRUB_TLS_CHACHA20_POLY1305_SHA256);
+      p = put16 (p, GRUB_TLS_AES_128_GCM_SHA256);
+    }
+  *p++ = 1;
+  *p++ = 0;
+
+  ext = p;
+  p += 2;
+
+  if (sni)
+    {
+      p = put16 (p, TLS_EXT_SERVER_NAME);
+      p = put16 (p, 5 + server_len);
+      p = put16 (p, 3 + server_len);
+      *p++ = 0;
+      p = put16 (p, server_len);
+      grub_memcpy (p, tls->server, server_len);
+      p += server_len;
+    }
+
+  p = put16 (p, TLS_EXT_SUPPORTED_GROUPS);
+  p = put16 (p, 4);
+  p = put16 (p, 2);
+  p = put16 (p, TLS_GROUP_X25519);
+
+  p = put16 (p, TLS_EXT_SIGNATURE_ALGORITHMS);
+  p = put16 (p, 8);
+  p = put16 (p, 6);
+  p = put16 (p, TLS_RSA_PSS_RSAE_SHA256);
+  p = put16 (p, TLS_RSA_PSS_RSAE_SHA384);
+  p = put16 (p, TLS_RSA_PSS_RSAE_SHA512);
+
+  p = put16 (p, TLS_EXT_SUPPORTED_VERSIONS);
+  p = put16 (p, 3);
+  *p++ = 2;
+  p = put16 (p, 0x0304);
+
+  /* psk_dhe_ke: resumed sessions still get forward secrecy.  */
+  p = put16 (p, TLS_EXT_PSK_KEY_EXCHANGE_MODES);
+  p = put16 (p, 2);
+  *p++ = 1;
+  *p++ = 1;
+
+  p = put16 (p, TLS_EXT_KEY_SHARE);
+  p = put16 (p, 4 + 2 + GRUB_TLS_X25519_SIZE);
+  p = put16 (p, 2 + 2 + GRUB_TLS_X25519_SIZE);
+  p = put16 (p, TLS_GROUP_X25519);
+  p = put16 (p, GRUB_TLS_X25519_SIZE);
+  grub_memcpy (p, pub, GRUB_TLS_X25519_SIZE);
+  p += GRUB_TLS_X25519_SIZE;
+
+  /* pre_shared_key has to be the last extension.  */
+  if (tls->ticket)
+    {
+      struct tls_ticket *t = tls->ticket;
+      grub_uint32_t age = grub_get_time_ms () - t->received;
+
+      psk_ext = p;
+      p = put16 (p, TLS_EXT_PRE_SHARED_KEY);
+      p = put16 (p, 2 + 2 + t->len + 4 + 2 + 1 + TLS_HASH_SIZE);
+      p = put16 (p, 2 + t->len + 4);
+      p = put16 (p, t->len);
+      grub_memcpy (p, t->ticket, t->len);
+      p += t->len;
+      p = put32 (p, age + t->age_add);
+      binders = p;
+      p = put16 (p, 1 + TLS_HASH_SIZE);
+      *p++ = TLS_HASH_SIZE;
+      p += TLS_HASH_SIZE;
+    }
+
+  put16 (ext, p - ext - 2);
+  put24 (msg + 1, p - msg - 4);
+
+  if (psk_ext)
+    {
+      /* The binder covers the ClientHello up to the binders list.  */
+      GRUB_PROPERLY_ALIGNED_ARRAY (ctx, GRUB_CRYPTO_MAX_MD_CONTEXT_SIZE);
+      grub_uint8_t early[TLS_HASH_SIZE], binder_key[TLS_HASH_SIZE];
+      grub_uint8_t zero[TLS_HASH_SIZE], hash[TLS_HASH_SIZE];
+
+      grub_memset (zero, 0, sizeof (zero));
+      hkdf_extract (tls, zero, tls->ticket->psk, early);
+      derive_secret (tls, early, "res binder", tls->empty_hash, binder_key);
+      tls->md->init (ctx);
+      tls->md->write (ctx, msg, binders - msg);
+      tls->md->final (ctx);
+      grub_memcpy (hash, tls->md->read (ctx), sizeof (hash));
+      finished_mac (tls, binder_key, hash, binders + 3);
+      grub_memset (early, 0, sizeof (early));
+      grub_memset (binder_key, 0, sizeof (binder_key));
+    }
+
+  err = send_handshake (tls, msg, p - msg);
+  grub_free (msg);
+  return err;
+}
+
+static grub_err_t
+handle_server_hello (grub_net_tls_t tls, const grub_uint8_t *msg,
+		     grub_size_t len)
+{
+  const grub_uint8_t *p = msg + 4, *end = msg + len;
+  const grub_uint8_t *share = 0;
+  grub_uint16_t version = 0, suite;
+  grub_uint8_t shared[GRUB_TLS_X25519_SIZE], check = 0;
+  grub_uint8_t zero[TLS_HASH_SIZE], secret[TLS_HASH_SIZE];
+  grub_uint8_t hash[TLS_HASH_SIZE];
+  int psk = 0;
+  grub_size_t i;
+  grub_err_t err;
+
+  if (end - p < 2 + 32 + 1 + 32 + 2 + 1 + 2)
+    return decode_error (tls);
+  p += 2;
+  if (grub_memcmp (p, hello_retry_random, sizeof (hello_retry_random)) == 0)
+    return tls_fail (tls, GRUB_ERR_NET_INVALID_RESPONSE,
+		     TLS_ALERT_HANDSHAKE_FAILURE,
+		     N_("server asked to retry with another key share"));
+  p += 32;
+  if (*p++ != sizeof (tls->session_id)
+      || grub_memcmp (p, tls->session_id, sizeof (tls->session_id)) != 0)
+    return tls_fail (tls, GRUB_ERR_NET_INVALID_RESPONSE,
+		     TLS_ALERT_ILLEGAL_PARAMETER,
+		     N_("server didn't echo the session ID"));
+  p += sizeof (tls->session_id);
+  suite = get16 (p);
+  p += 2;
+  if ((suite != GRUB_TLS_AES_128_GCM_SHA256
+       && suite != GRUB_TLS_CHACHA20_POLY1305_SHA256) || *p++ != 0)
+    return tls_fail (tls, GRUB_ERR_NET_INVALID_RESPONSE,
+		     TLS_ALERT_ILLEGAL_PARAMETER,
+		     N_("server chose an unsupported cipher suite"));
+  if (get16 (p) != end - p - 2)
+    return decode_error (tls);
+  p += 2;
+
+  while (p < end)
+    {
+      grub_uint16_t type, elen;
+
+      if (end - p < 4)
+	return decode_error (tls);
+      type = get16 (p);
+      elen = get16 (p + 2);
+      p += 4;
+      if (end - p < elen)
+	return decode_error (tls);
+      switch (type)
+	{
+	case TLS_EXT_SUPPORTED_VERSIONS:
+	  if (elen != 2)
+	    return decode_error (tls);
+	  version = get16 (p);
+	  break;
+	case TLS_EXT_KEY_SHARE:
+	  if (elen != 4 + GRUB_TLS_X25519_SIZE
+	      || get16 (p) != TLS_GROUP_X25519
+	      || get16 (p + 2) != GRUB_TLS_X25519_SIZE)
+	    return tls_fail (tls, GRUB_ERR_NET_INVALID_RESPONSE,
+			     TLS_ALERT_ILLEGAL_PARAMETER,
+			     N_("invalid key share"));
+	  share = p + 4;
+	  break;
+	case TLS_EXT_PRE_SHARED_KEY:
+	  if (elen != 2)
+	    return decode_error (tls);
+	  if (!tls->ticket || get16 (p) != 0)
+	    return tls_fail (tls, GRUB_ERR_NET_INVALID_RESPONSE,
+			     TLS_ALERT_ILLEGAL_PARAMETER,
+			     N_("server selected an unknown session"));
+	  psk = 1;
+	  break;
+	default:
+	  return tls_fail (tls, GRUB_ERR_NET_INVALID_RESPONSE,
+			   TLS_ALERT_UNSUPPORTED_EXTENSION,
+			   N_("unexpected extension"));
+	}
+      p += elen;
+    }
+
+  if (version != 0x0304)
+    return tls_fail (tls, GRUB_ERR_NET_INVALID_RESPONSE,
+		     TLS_ALERT_PROTOCOL_VERSION,
+		     N_("server doesn't support TLS 1.3"));
+  if (!share)
+    return tls_fail (tls, GRUB_ERR_NET_INVALID_RESPONSE,
+		     TLS_ALERT_MISSING_EXTENSION, N_("no key share"));
+
+  grub_tls_x25519 (shared, tls->x25519_key, share);
+  grub_memset (tls->x25519_key, 0, sizeof (tls->x25519_key));
+  for (i = 0; i < sizeof (shared); i++)
+    check |= shared[i];
+  if (!check)
+    return tls_fail (tls, GRUB_ERR_NET_INVALID_RESPONSE,
+		     TLS_ALERT_ILLEGAL_PARAMETER, N_("invalid key share"));
+
+  tls->suite = suite;
+  tls->psk_accepted = psk;
+  transcript_add (tls, msg, len);
+  transcript_hash (tls, hash);
+
+  grub_memset (zero, 0, sizeof (zero));
+  hkdf_extract (tls, zero, psk ? tls->ticket->psk : zero, secret);
+  derive_secret (tls, secret, "derived", tls->empty_hash, secret);
+  hkdf_extract (tls, secret, shared, secret);
+  derive_secret (tls, secret, "c hs traffic", hash, tls->c_hs);
+  derive_secret (tls, secret, "s hs traffic", hash, tls->s_hs);
+  derive_secret (tls, secret, "derived", tls->empty_hash, secret);
+  hkdf_extract (tls, secret, zero, tls->master);
+  grub_memset (secret, 0, sizeof (secret));
+  grub_memset (shared, 0, sizeof (shared));
+
+  err = set_keys (tls, &tls->rx, tls->s_hs);
+  if (err)
+    return tls_fail (tls, err, TLS_ALERT_INTERNAL_ERROR,
+		     N_("couldn't set up the cipher"));
+  tls->rx_changed = 1;
+  tls->state = TLS_WAIT_ENCRYPTED_EXTENSIONS;
+  return GRUB_ERR_NONE;
+}
+
+/* Read the DER element at *P.  */
+static int
+der_next (const grub_uint8_t **p, const grub_uint8_t *end, grub_uint8_t *tag,
+	  const grub_uint8_t **val, grub_size_t *len)
+{
+  const grub_uint8_t *q = *p;
+  grub_size_t l;
+
+  if (end - q < 2)
+    return -1;
+  *tag = *q++;
+  l = *q++;
+  if (l & 0x80)
+    {
+      int n = l & 0x7f;
+
+      if (n == 0 || n > 3 || end - q < n)
+	return -1;
+      for (l = 0; n; n--)
+	l = (l << 8) | *q++;
+    }
+  if ((grub_size_t) (end - q) < l)
+    return -1;
+  *val = q;
+  *len = l;
+  *p = q + l;
+  return 0;
+}
+
+/* Extract the RSA public key from an X.509 certificate.  */
+static grub_err_t
+certificate_key (grub_net_tls_t tls, const grub_uint8_t *der,
+		 grub_size_t der_len)
+{
+  const grub_uint8_t *p = der, *end = der + der_len, *v, *alg;
+  grub_size_t len, alg_len;
+  grub_uint8_t tag;
+  int i;
+
+  /* Certificate, then tbsCertificate.  */
+  for (i = 0; i < 2; i++)
+    {
+      if (der_next (&p, end, &tag, &v, &len) || tag != 0x30)
+	goto bad;
+      p = v;
+      end = v + len;
+    }
+  /* Optional version, serial, signature, issuer, validity and subject.  */
+  if (der_next (&p, end, &tag, &v, &len))
+    goto bad;
+  if (tag == 0xa0 && der_next (&p, end, &tag, &v, &len))
+    goto bad;
+  for (i = 0; i < 4; i++)
+    if (der_next (&p, end, &tag, &v, &len))
+      goto bad;
+
+  /* SubjectPublicKeyInfo.  */
+  if (der_next (&p, end, &tag, &v, &len) || tag != 0x30)
+    goto bad;
+  p = v;
+  end = v + len;
+  if (der_next (&p, end, &tag, &v, &len) || tag != 0x30)
+    goto bad;
+  alg = v;
+  if (der_next (&alg, v + len, &tag, &v, &alg_len) || tag != 0x06)
+    goto bad;
+  if (alg_len != sizeof (rsa_oid) || grub_memcmp (v, rsa_oid, alg_len) != 0)
+    return tls_fail (tls, GRUB_ERR_NET_INVALID_RESPONSE,
+		     TLS_ALERT_UNSUPPORTED_CERTIFICATE,
+		     N_("only RSA server keys are supported"));
+  if (der_next (&p, end, &tag, &v, &len) || tag != 0x03 || len < 1 || *v)
+    goto bad;
+  p = v + 1;
+  end = v + len;
+
+  /* RSAPublicKey.  */
+  if (der_next (&p, end, &tag, &v, &len) || tag != 0x30)
+    goto bad;
+  p = v;
+  end = v + len;
+  if (der_next (&p, end, &tag, &v, &len) || tag != 0x02
+      || gcry_mpi_scan (&tls->rsa_n, GCRYMPI_FMT_USG, v, len, 0))
+    goto bad;
+  if (der_next (&p, end, &tag, &v, &len) || tag != 0x02
+      || gcry_mpi_scan (&tls->rsa_e, GCRYMPI_FMT_USG, v, len, 0))
+    goto bad;
+  return GRUB_ERR_NONE;
+
+ bad:
+  return tls_fail (tls, GRUB_ERR_NET_INVALID_RESPONSE,
+		   TLS_ALERT_BAD_CERTIFICATE, N_("malformed certificate"));
+}
+
+static void
+mgf1 (const gcry_md_spec_t *md, const grub_uint8_t *seed,
+      grub_uint8_t *out, grub_size_t len)
+{
+  GRUB_PROPERLY_ALIGNED_ARRAY (ctx, GRUB_CRYPTO_MAX_MD_CONTEXT_SIZE);
+  grub_uint8_t counter[4];
+  grub_uint32_t c;
+  const grub_uint8_t *h;
+  grub_size_t i;
+
+  for (c = 0; len; c++)
+    {
+      put32 (counter, c);
+      md->init (ctx);
+      md->write (ctx, seed, md->mdlen);
+      md->write (ctx, counter, sizeof (counter));
+      md->final (ctx);
+      h = md->read (ctx);
+      for (i = 0; i < md->mdlen && len; i++, len--)
+	*out++ ^= h[i];
+    }
+}
+
+/* Check an RSASSA-PSS signature (RFC 8017, 9.1.2) of CONTENT, with the
+   salt as long as the hash as TLS 1.3 requires.  */
+static int
+rsa_pss_verify (grub_net_tls_t tls, grub_uint16_t scheme,
+		const grub_uint8_t *sig, grub_size_t sig_len,
+		const grub_uint8_t *content, grub_size_t content_len)
+{
+  GRUB_PROPERLY_ALIGNED_ARRAY (ctx, GRUB_CRYPTO_MAX_MD_CONTEXT_SIZE);
+  grub_uint8_t em[TLS_MAX_RSA_BYTES], mhash[GRUB_CRYPTO_MAX_MDLEN];
+  grub_uint8_t zero[8];
+  const gcry_md_spec_t *md;
+  const char *name;
+  gcry_mpi_t s = 0, m = 0;
+  grub_size_t nbits, em_len, db_len, hlen, written, i;
+  grub_uint8_t topmask;
+  int ret = -1;
+
+  switch (scheme)
+    {
+    case TLS_RSA_PSS_RSAE_SHA256:
+      name = "sha256";
+      break;
+    case TLS_RSA_PSS_RSAE_SHA384:
+      name = "sha384";
+      break;
+    case TLS_RSA_PSS_RSAE_SHA512:
+      name = "sha512";
+      break;
+    default:
+      return -1;
+    }
+  md = grub_crypto_lookup_md_by_name (name);
+  if (!md)
+    {
+      grub_errno = GRUB_ERR_NONE;
+      return -1;
+    }
+  hlen = md->mdlen;
+
+  nbits = gcry_mpi_get_nbits (tls->rsa_n);
+  if (nbits < 1024 || (nbits + 7) / 8 != sig_len || sig_len > sizeof (em))
+    return -1;
+  em_len = (nbits - 1 + 7) / 8;
+  if (em_len < 2 * hlen + 2)
+    return -1;
+  topmask = 0xff >> (8 * em_len - (nbits - 1));
+
+  if (gcry_mpi_scan (&s, GCRYMPI_FMT_USG, sig, sig_len, 0))
+    goto out;
+  if (gcry_mpi_cmp (s, tls->rsa_n) >= 0)
+    goto out;
+  m = gcry_mpi_new (nbits);
+  if (!m)
+    goto out;
+  gcry_mpi_powm (m, s, tls->rsa_e, tls->rsa_n);
+  if (gcry_mpi_print (GCRYMPI_FMT_USG, em, sizeof (em), &written, m)
+      || written > em_len)
+    goto out;
+  grub_memmove (em + em_len - written, em, written);
+  grub_memset (em, 0, em_len - written);
+
+  if (em[em_len - 1] != 0xbc || (em[0] & ~topmask))
+    goto out;
+  db_len = em_len - hlen - 1;
+  mgf1 (md, em + db_len, em, db_len);
+  em[0] &= topmask;
+  for (i = 0; i < db_len - hlen - 1; i++)
+    if (em[i])
+      goto out;
+  if (em[i] != 1)
+    goto out;
+
+  grub_crypto_hash (md, mhash, content, content_len);
+  grub_memset (zero, 0, sizeof (zero));
+  md->init (ctx);
+  md->write (ctx, zero, sizeof (zero));
+  md->write (ctx, mhash, hlen);
+  md->write (ctx, em + db_len - hlen, hlen);
+  md->final (ctx);
+  if (grub_crypto_memcmp (md->read (ctx), em + db_len, hlen) == 0)
+    ret = 0;
+
+ out:
+  if (s)
+    gcry_mpi_release (s);
+  if (m)
+    gcry_mpi_release (m);
+  return ret;
+}
+
+static grub_err_t
+handle_certificate (grub_net_tls_t tls, const grub_uint8_t *msg,
+		    grub_size_t len)
+{
+  const grub_uint8_t *p = msg + 4, *end = msg + len;
+  grub_size_t cert_len;
+
+  if (end - p < 1 || end - p < 1 + *p + 3)
+    return decode_error (tls);
+  p += 1 + *p;
+  if (get24 (p) != (grub_size_t) (end - p - 3))
+    return decode_error (tls);
+  p += 3;
+  if (end - p < 3)
+    return tls_fail (tls, GRUB_ERR_NET_INVALID_RESPONSE,
+		     TLS_ALERT_DECODE_ERROR, N_("server sent no certificate"));
+  cert_len = get24 (p);
+  p += 3;
+  if (cert_len == 0 || (grub_size_t) (end - p) < cert_len)
+    return decode_error (tls);
+
+  if (certificate_key (tls, p, cert_len))
+    return tls->err;
+
+  transcript_add (tls, msg, len);
+  tls->state = TLS_WAIT_CERTIFICATE_VERIFY;
+  return GRUB_ERR_NONE;
+}
+
+static grub_err_t
+handle_certificate_verify (grub_net_tls_t tls, const grub_uint8_t *msg,
+			   grub_size_t len)
+{
+  static const char label[] = "TLS 1.3, server CertificateVerify";
+  grub_uint8_t content[64 + sizeof (label) + TLS_HASH_SIZE];
+  const grub_uint8_t *p = msg + 4;
+
+  if (len < 4 + 4 || get16 (p + 2) != (grub_size_t) (len - 4 - 4))
+    return decode_error (tls);
+
+  grub_memset (content, ' ', 64);
+  grub_memcpy (content + 64, label, sizeof (label));
+  transcript_hash (tls, content + 64 + sizeof (label));
+  if (rsa_pss_verify (tls, get16 (p), p + 4, len - 4 - 4,
+		      content, sizeof (content)))
+    return tls_fail (tls, GRUB_ERR_BAD_SIGNATURE, TLS_ALERT_DECRYPT_ERROR,
+		     N_("invalid server signature"));
+
+  /* There is neither a CA store nor a trusted clock here, so the server
+     key itself has to be among the keys trusted for signatures.  */
+  if (!grub_crypto_pk_locate_rsa_in_trustdb (tls->rsa_n, tls->rsa_e))
+    {
+      if (grub_verify_enforced ())
+	return tls_fail (tls, GRUB_ERR_BAD_SIGNATURE,
+			 TLS_ALERT_BAD_CERTIFICATE,
+			 N_("server key is not trusted"));
+      grub_dprintf ("tls", "%s: server key is not trusted\n", tls->server);
+    }
+
+  transcript_add (tls, msg, len);
+  tls->state = TLS_WAIT_FINISHED;
+  return GRUB_ERR_NONE;
+}
+
+static grub_err_t
+handle_finished (grub_net_tls_t tls, const grub_uint8_t *msg, grub_size_t len)
+{
+  grub_uint8_t hash[TLS_HASH_SIZE], mac[TLS_HASH_SIZE];
+  grub_uint8_t c_ap[TLS_HASH_SIZE], s_ap[TLS_HASH_SIZE];
+  grub_uint8_t out[4 + 1 + 255 + 3];
+  grub_err_t err;
+
+  if (len != 4 + TLS_HASH_SIZE)
+    return decode_error (tls);
+  transcript_hash (tls, hash);
+  finished_mac (tls, tls->s_hs, hash, mac);
+  if (grub_crypto_memcmp (mac, msg + 4, TLS_HASH_SIZE) != 0)
+    return tls_fail (tls, GRUB_ERR_NET_INVALID_RESPONSE,
+		     TLS_ALERT_DECRYPT_ERROR, N_("bad Finished message"));
+  transcript_add (tls, msg, len);
+
+  transcript_hash (tls, hash);
+  derive_secret (tls, tls->master, "c ap traffic", hash, c_ap);
+  derive_secret (tls, tls->master, "s ap traffic", hash, s_ap);
+  err = set_keys (tls, &tls->rx, s_ap);
+  if (err)
+    goto fail;
+  tls->rx_changed = 1;
+
+  /* Middlebox compatibility mode (RFC 8446, D.4).  */
+  err = send_record (tls, TLS_CONTENT_CCS, (const grub_uint8_t *) "\1", 1);
+  if (!err)
+    err = set_keys (tls, &tls->tx, tls->c_hs);
+  if (err)
+    goto fail;
+
+  /* We have no client certificate to offer.  */
+  if (tls->cert_requested)
+    {
+      grub_uint8_t *p = out;
+
+      *p++ = TLS_CERTIFICATE;
+      p = put24 (p, 1 + tls->cert_request_context_len + 3);
+      *p++ = tls->cert_request_context_len;
+      grub_memcpy (p, tls->cert_request_context,
+		   tls->cert_request_context_len);
+      p += tls->cert_request_context_len;
+      p = put24 (p, 0);
+      err = send_handshake (tls, out, p - out);
+      if (err)
+	goto fail;
+    }
+
+  transcript_hash (tls, hash);
+  out[0] = TLS_FINISHED;
+  put24 (out + 1, TLS_HASH_SIZE);
+  finished_mac (tls, tls->c_hs, hash, out + 4);
+  err = send_handshake (tls, out, 4 + TLS_HASH_SIZE);
+  if (!err)
+    err = set_keys (tls, &tls->tx, c_ap);
+  if (err)
+    goto fail;
+
+  transcript_hash (tls, hash);
+  derive_secret (tls, tls->master, "res master", hash, tls->res_master);
+
+  grub_memset (c_ap, 0, sizeof (c_ap));
+  grub_memset (s_ap, 0, sizeof (s_ap));
+  grub_memset (tls->c_hs, 0, sizeof (tls->c_hs));
+  grub_memset (tls->s_hs, 0, sizeof (tls->s_hs));
+  grub_memset (tls->master, 0, sizeof (tls->master));
+  tls->state = TLS_CONNECTED;
+  tls->done = 1;
+  grub_dprintf ("tls", "%s: connected with suite %04x%s\n", tls->server,
+		tls->suite, tls->psk_accepted ? ", resumed" : "");
+  return GRUB_ERR_NONE;
+
+ fail:
+  grub_memset (c_ap, 0, sizeof (c_ap));
+  grub_memset (s_ap, 0, sizeof (s_ap));
+  return tls_fail (tls, err, TLS_ALERT_INTERNAL_ERROR,
+		   N_("couldn't send the client Finished"));
+}
+
+static grub_err_t
+handle_new_session_ticket (grub_net_tls_t tls, const grub_uint8_t *msg,
+			   grub_size_t len)
+{
+  const grub_uint8_t *p = msg + 4, *end = msg + len, *nonce, *ticket;
+  grub_uint32_t lifetime, age_add;
+  grub_size_t nonce_len, ticket_len;
+  struct tls_ticket *t;
+
+  if (end - p < 4 + 4 + 1)
+    return decode_error (tls);
+  lifetime = get32 (p);
+  age_add = get32 (p + 4);
+  p += 8;
+  nonce_len = *p++;
+  nonce = p;
+  if ((grub_size_t) (end - p) < nonce_len + 2)
+    return decode_error (tls);
+  p += nonce_len;
+  ticket_len = get16 (p);
+  p += 2;
+  ticket = p;
+  if ((grub_size_t) (end - p) < ticket_len + 2)
+    return decode_error (tls);
+  p += ticket_len;
+  if (get16 (p) != end - p - 2)
+    return decode_error (tls);
+
+  if (!lifetime || !ticket_len || ticket_len > TLS_MAX_TICKET)
+    return GRUB_ERR_NONE;
+  if (lifetime > TLS_MAX_TICKET_LIFETIME)
+    lifetime = TLS_MAX_TICKET_LIFETIME;
+
+  /* Not being able to resume later isn't worth failing for.  */
+  t = grub_malloc (sizeof (*t) + ticket_len);
+  if (!t)
+    {
+      grub_errno = GRUB_ERR_NONE;
+      return GRUB_ERR_NONE;
+    }
+  t->server = grub_strdup (tls->server);
+  if (!t->server)
+    {
+      grub_free (t);
+      grub_errno = GRUB_ERR_NONE;
+      return GRUB_ERR_NONE;
+    }
+  t->received = grub_get_time_ms ();
+  t->lifetime = lifetime;
+  t->age_add = age_add;
+  t->len = ticket_len;
+  grub_memcpy (t->ticket, ticket, ticket_len);
+  hkdf_expand_label (tls, tls->res_master, "resumption", nonce, nonce_len,
+		     t->psk, sizeof (t->psk));
+  ticket_store (t);
+  return GRUB_ERR_NONE;
+}
+
+static grub_err_t
+handle_key_update (grub_net_tls_t tls, const grub_uint8_t *msg,
+		   grub_size_t len)
+{
+  grub_uint8_t secret[TLS_HASH_SIZE];
+  grub_err_t err;
+
+  if (len != 4 + 1 || msg[4] > 1)
+    return decode_error (tls);
+
+  hkdf_expand_label (tls, tls->rx.secret, "traffic upd", NULL, 0,
+		     secret, sizeof (secret));
+  err = set_keys (tls, &tls->rx, secret);
+  tls->rx_changed = 1;
+
+  if (!err && msg[4] == 1)
+    {
+      grub_uint8_t reply[5] = { TLS_KEY_UPDATE, 0, 0, 1, 0 };
+
+      err = send_record (tls, TLS_CONTENT_HANDSHAKE, reply, sizeof (reply));
+      hkdf_expand_label (tls, tls->tx.secret, "traffic upd", NULL, 0,
+			 secret, sizeof (secret));
+      if (!err)
+	err = set_keys (tls, &tls->tx, secret);
+    }
+  grub_memset (secret, 0, sizeof (secret));
+  if (err)
+    return tls_fail (tls, err, TLS_ALERT_INTERNAL_ERROR,
+		     N_("couldn't update the traffic keys"));
+  return GRUB_ERR_NONE;
+}
+
+static grub_err_t
+handle_handshake_message (grub_net_tls_t tls, const grub_uint8_t *msg,
+			  grub_size_t len)
+{
+  grub_uint8_t type = msg[0];
+
+  switch (tls->state)
+    {
+    case TLS_WAIT_SERVER_HELLO:
+      if (type == TLS_SERVER_HELLO)
+	return handle_server_hello (tls, msg, len);
+      break;
+
+    case TLS_WAIT_ENCRYPTED_EXTENSIONS:
+      if (type != TLS_ENCRYPTED_EXTENSIONS)
+	break;
+      if (len < 4 + 2 || get16 (msg + 4) != (grub_size_t) (len - 4 - 2))
+	return decode_error (tls);
+      transcript_add (tls, msg, len);
+      tls->state = tls->psk_accepted ? TLS_WAIT_FINISHED
+	: TLS_WAIT_CERTIFICATE;
+      return GRUB_ERR_NONE;
+
+    case TLS_WAIT_CERTIFICATE:
+      if (type == TLS_CERTIFICATE)
+	return handle_certificate (tls, msg, len);
+      if (type != TLS_CERTIFICATE_REQUEST || tls->cert_requested)
+	break;
+      if (len < 4 + 1 || len < 4 + 1 + (grub_size_t) msg[4])
+	return decode_error (tls);
+      tls->cert_requested = 1;
+      tls->cert_request_context_len = msg[4];
+      grub_memcpy (tls->cert_request_context, msg + 5, msg[4]);
+      transcript_add (tls, msg, len);
+      return GRUB_ERR_NONE;
+
+    case TLS_WAIT_CERTIFICATE_VERIFY:
+      if (type == TLS_CERTIFICATE_VERIFY)
+	return handle_certificate_verify (tls, msg, len);
+      break;
+
+    case TLS_WAIT_FINISHED:
+      if (type == TLS_FINISHED)
+	return handle_finished (tls, msg, len);
+      break;
+
+    case TLS_CONNECTED:
+      if (type == TLS_NEW_SESSION_TICKET)
+	return handle_new_session_ticket (tls, msg, len);
+      if (type == TLS_KEY_UPDATE)
+	return handle_key_update (tls, msg, len);
+      break;
+
+    default:
+      return GRUB_ERR_NONE;
+    }
+  return unexpected_message (tls);
+}
+
+/* Reassemble handshake messages, which may span or share records.  */
+static grub_err_t
+handshake_data (grub_net_tls_t tls, const grub_uint8_t *data, grub_size_t len)
+{
+  grub_uint8_t *t;
+  grub_size_t msg_len;
+  grub_err_t err;
+
+  if (len == 0)
+    return unexpected_message (tls);
+  if (tls->hs_len + len > TLS_MAX_HANDSHAKE + 4)
+    return tls_fail (tls, GRUB_ERR_NET_INVALID_RESPONSE,
+		     TLS_ALERT_DECODE_ERROR, N_("handshake message too long"));
+  t = grub_realloc (tls->hs, tls->hs_len + len);
+  if (!t)
+    return tls_fail (tls, grub_errno, TLS_ALERT_INTERNAL_ERROR,
+		     N_("out of memory"));
+  tls->hs = t;
+  grub_memcpy (tls->hs + tls->hs_len, data, len);
+  tls->hs_len += len;
+
+  while (tls->hs_len >= 4 && tls->state != TLS_FAILED
+	 && tls->state != TLS_CLOSED)
+    {
+      msg_len = 4 + get24 (tls->hs + 1);
+      if (msg_len > TLS_MAX_HANDSHAKE + 4)
+	return tls_fail (tls, GRUB_ERR_NET_INVALID_RESPONSE,
+			 TLS_ALERT_DECODE_ERROR,
+			 N_("handshake message too long"));
+      if (tls->hs_len < msg_len)
+	break;
+      tls->rx_changed = 0;
+      err = handle_handshake_message (tls, tls->hs, msg_len);
+      if (err)
+	return err;
+      grub_memmove (tls->hs, tls->hs + msg_len, tls->hs_len - msg_len);
+      tls->hs_len -= msg_len;
+      if (tls->rx_changed && tls->hs_len)
+	return unexpected_message (tls);
+    }
+  return GRUB_ERR_NONE;
+}
+
+static grub_err_t
+process_record (grub_net_tls_t tls)
+{
+  grub_uint8_t type = tls->rec[0];
+  grub_uint8_t *body = tls->rec + TLS_RECORD_HEADER_SIZE;
+  grub_size_t len = tls->rec_len - TLS_RECORD_HEADER_SIZE;
+  struct grub_net_buff *nb;
+  grub_err_t err;
+
+  /* Compatibility ChangeCipherSpec, only allowed during the handshake.  */
+  if (type == TLS_CONTENT_CCS && tls->state != TLS_CONNECTED
+      && len == 1 && body[0] == 1)
+    return GRUB_ERR_NONE;
+
+  if (tls->rx.active)
+    {
+      grub_uint8_t nonce[GRUB_TLS_AEAD_NONCE_SIZE];
+
+      if (type != TLS_CONTENT_APPLICATION || len < GRUB_TLS_AEAD_TAG_SIZE + 1)
+	return unexpected_message (tls);
+      len -= GRUB_TLS_AEAD_TAG_SIZE;
+      record_nonce (&tls->rx, nonce);
+      if (grub_tls_aead_open (&tls->rx.aead, nonce, tls->rec,
+			      TLS_RECORD_HEADER_SIZE, body, len, body + len))
+	return tls_fail (tls, GRUB_ERR_NET_INVALID_RESPONSE,
+			 TLS_ALERT_BAD_RECORD_MAC, N_("bad record MAC"));
+      tls->rx.seq++;
+      while (len && !body[len - 1])
+	len--;
+      if (!len)
+	return unexpected_message (tls);
+      type = body[--len];
+    }
+  else if (type != TLS_CONTENT_HANDSHAKE && type != TLS_CONTENT_ALERT)
+    return unexpected_message (tls);
+
+  if (tls->hs_len && type != TLS_CONTENT_HANDSHAKE)
+    return unexpected_message (tls);
+
+  switch (type)
+    {
+    case TLS_CONTENT_HANDSHAKE:
+      return handshake_data (tls, body, len);
+
+    case TLS_CONTENT_ALERT:
+      if (len != 2)
+	return decode_error (tls);
+      if (body[1] == TLS_ALERT_CLOSE_NOTIFY)
+	{
+	  tls->state = TLS_CLOSED;
+	  tls->done = 1;
+	  return GRUB_ERR_NONE;
+	}
+      grub_dprintf ("tls", "%s: received alert %d\n", tls->server, body[1]);
+      return tls_fail (tls, GRUB_ERR_NET_UNKNOWN_ERROR,
+		       TLS_ALERT_CLOSE_NOTIFY, N_("server sent an alert"));
+
+    case TLS_CONTENT_APPLICATION:
+      if (tls->state != TLS_CONNECTED)
+	return unexpected_message (tls);
+      if (!len)
+	return GRUB_ERR_NONE;
+      nb = grub_netbuff_alloc (len);
+      if (!nb)
+	return grub_errno;
+      err = grub_netbuff_put (nb, len);
+      if (err)
+	{
+	  grub_netbuff_free (nb);
+	  return err;
+	}
+      grub_memcpy (nb->data, body, len);
+      return tls->recv (nb, tls->data);
+
+    default:
+      return unexpected_message (tls);
+    }
+}
+
+/* Session interface.  */
+
+static grub_err_t
+tls_receive (grub_net_tls_t tls, struct grub_net_buff *nb)
+{
+  const grub_uint8_t *p = nb->data;
+  grub_size_t len = nb->tail - nb->data;
+  grub_size_t want, rec_size;
+  grub_err_t err = GRUB_ERR_NONE;
+
+  while (len && !err && tls->state != TLS_FAILED && tls->state != TLS_CLOSED)
+    {
+      if (tls->rec_len < TLS_RECORD_HEADER_SIZE)
+	want = TLS_RECORD_HEADER_SIZE - tls->rec_len;
+      else
+	want = TLS_RECORD_HEADER_SIZE + get16 (tls->rec + 3) - tls->rec_len;
+      if (want > len)
+	want = len;
+      grub_memcpy (tls->rec + tls->rec_len, p, want);
+      tls->rec_len += want;
+      p += want;
+      len -= want;
+
+      if (tls->rec_len < TLS_RECORD_HEADER_SIZE)
+	break;
+      rec_size = TLS_RECORD_HEADER_SIZE + get16 (tls->rec + 3);
+      if (rec_size > TLS_RECORD_HEADER_SIZE + TLS_MAX_CIPHERTEXT)
+	err = tls_fail (tls, GRUB_ERR_NET_INVALID_RESPONSE,
+			TLS_ALERT_RECORD_OVERFLOW, N_("record too long"));
+      else if (tls->rec_len == rec_size)
+	{
+	  err = process_record (tls);
+	  tls->rec_len = 0;
+	}
+    }
+
+  grub_netbuff_free (nb);
+  return err;
+}
+
+static grub_err_t
+tls_send (grub_net_tls_t tls, struct grub_net_buff *nb)
+{
+  const grub_uint8_t *p = nb->data;
+  grub_size_t len = nb->tail - nb->data, n;
+  grub_err_t err = GRUB_ERR_NONE;
+
+  if (tls->state != TLS_CONNECTED)
+    err = grub_error (GRUB_ERR_NET_UNKNOWN_ERROR,
+		      N_("TLS connection is closed"));
+
+  while (len && !err)
+    {
+      n = len < TLS_MAX_PLAINTEXT ? len : TLS_MAX_PLAINTEXT;
+      err = send_record (tls, TLS_CONTENT_APPLICATION, p, n);
+      p += n;
+      len -= n;
+    }
+
+  grub_netbuff_free (nb);
+  return err;
+}
+
+static grub_err_t
+tls_handshake (grub_net_tls_t tls)
+{
+  grub_err_t err;
+  int i;
+
+  err = send_client_hello (tls);
+  if (err)
+    return err;
+
+  for (i = 0; !tls->done && tls->sock && i < 100; i++)
+    {
+      grub_net_tcp_retransmit ();
+      grub_net_poll_cards (300, &tls->done);
+    }
+
+  switch (tls->state)
+    {
+    case TLS_CONNECTED:
+      return GRUB_ERR_NONE;
+    case TLS_FAILED:
+      return grub_error (tls->err, N_("TLS handshake with `%s' failed: %s"),
+			 tls->server, _(tls->errmsg));
+    case TLS_CLOSED:
+      return grub_error (GRUB_ERR_NET_UNKNOWN_ERROR,
+			 N_("TLS handshake with `%s' failed: %s"),
+			 tls->server, _("connection closed"));
+    default:
+      if (!tls->sock)
+	return grub_error (GRUB_ERR_NET_UNKNOWN_ERROR,
+			   N_("TLS handshake with `%s' failed: %s"),
+			   tls->server, _("connection closed"));
+      return grub_error (GRUB_ERR_TIMEOUT,
+			 N_("time out in TLS handshake with `%s'"),
+			 tls->server);
+    }
+}
+
+static void
+tls_shutdown (grub_net_tls_t tls)
+{
+  tls->sock = 0;
+  if (tls->state != TLS_FAILED)
+    tls->state = TLS_CLOSED;
+  tls->done = 1;
+}
+
+static void
+tls_free (grub_net_tls_t tls)
+{
+  if (tls->rx.active)
+    grub_tls_aead_fini (&tls->rx.aead);
+  if (tls->tx.active)
+    grub_tls_aead_fini (&tls->tx.aead);
+  if (tls->ticket)
+    ticket_free (tls->ticket);
+  if (tls->rsa_n)
+    gcry_mpi_release (tls->rsa_n);
+  if (tls->rsa_e)
+    gcry_mpi_release (tls->rsa_e);
+  grub_free (tls->transcript);
+  grub_free (tls->rec);
+  grub_free (tls->hs);
+  grub_free (tls->server);
+  grub_memset (tls, 0, sizeof (*tls));
+  grub_free (tls);
+}
+
+static grub_net_tls_t
+tls_new (grub_net_tcp_socket_t sock, const char *server,
+	 grub_err_t (*recv) (struct grub_net_buff *nb, void *data),
+	 void *data)
+{
+  grub_net_tls_t tls;
+  const gcry_md_spec_t *md;
+
+  md = grub_crypto_lookup_md_by_name ("sha256");
+  if (!md)
+    {
+      grub_error (GRUB_ERR_FILE_NOT_FOUND, N_("couldn't load %s hash"),
+		  "sha256");
+      return 0;
+    }
+
+  tls = grub_zalloc (sizeof (*tls));
+  if (!tls)
+    return 0;
+  tls->sock = sock;
+  tls->recv = recv;
+  tls->data = data;
+  tls->md = md;
+  tls->state = TLS_WAIT_SERVER_HELLO;
+  tls->server = grub_strdup (server);
+  tls->rec = grub_malloc (TLS_RECORD_HEADER_SIZE + TLS_MAX_CIPHERTEXT);
+  tls->transcript = grub_malloc (md->contextsize);
+  if (!tls->server || !tls->rec || !tls->transcript)
+    {
+      tls_free (tls);
+      return 0;
+    }
+  md->init (tls->transcript);
+  grub_crypto_hash (md, tls->empty_hash, "", 0);
+  return tls;
+}
+
+static struct grub_net_tls_ops tls_ops =
+  {
+    .new = tls_new,
+    .handshake = tls_handshake,
+    .receive = tls_receive,
+    .send = tls_send,
+    .shutdown = tls_shutdown,
+    .free = tls_free
+  };
+
+GRUB_MOD_INIT (tls)
+{
+  grub_net_tls = &tls_ops;
+}
+
+GRUB_MOD_FINI (tls)
+{
+  struct tls_ticket *t, *next;
+
+  grub_net_tls = 0;
+  for (t = tickets; t; t = next)
+    {
+      next = t->next;
+      ticket_free (t);
+    }
+  tickets = 0;
+  grub_memset (rng_pool, 0, sizeof (rng_pool));
+}
@@ -0,0 +1,775 @@
+/* tls_crypto.c - AES-GCM, ChaCha20-Poly1305 and X25519 for TLS.  */
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2026  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <grub/types.h>
+#include <grub/misc.h>
+#include <grub/mm.h>
+#include <grub/err.h>
+#include <grub/crypto.h>
+
+#include "tls_private.h"
+
+/* Counter blocks encrypted per call to the block cipher.  */
+#define GCM_BATCH 8
+
+static inline grub_uint32_t
+load_le32 (const grub_uint8_t *p)
+{
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((grub_uint32_t) p[3] << 24);
+}
+
+static inline void
+store_le32 (grub_uint8_t *p, grub_uint32_t v)
+{
+  p[0] = v;
+  p[1] = v >> 8;
+  p[2] = v >> 16;
+  p[3] = v >> 24;
+}
+
+static inline grub_uint64_t
+load_be64 (const grub_uint8_t *p)
+{
+  return ((grub_uint64_t) p[0] << 56) | ((grub_uint64_t) p[1] << 48)
+    | ((grub_uint64_t) p[2] << 40) | ((grub_uint64_t) p[3] << 32)
+    | ((grub_uint64_t) p[4] << 24) | ((grub_uint64_t) p[5] << 16)
+    | ((grub_uint64_t) p[6] << 8) | p[7];
+}
+
+static inline void
+store_be64 (grub_uint8_t *p, grub_uint64_t v)
+{
+  int i;
+
+  for (i = 7; i >= 0; i--, v >>= 8)
+    p[i] = v;
+}
+
+/* AES-GCM (NIST SP 800-38D).  */
+
+static void
+gcm_aes (struct grub_tls_aead *aead, grub_uint8_t *out,
+	 const grub_uint8_t *in, grub_size_t nblocks)
+{
+#ifdef GRUB_TLS_USE_AESNI
+  if (aead->gcm.aesni)
+    {
+      grub_aesni_ecb_encrypt (aead->gcm.aesni->enc, aead->gcm.aesni->rounds,
+			      out, in, nblocks);
+      return;
+    }
+#endif
+  grub_crypto_ecb_encrypt (aead->gcm.cipher, out, in, nblocks * 16);
+}
+
+/* Reduction of the four bits shifted out, for the 4-bit table method.  */
+static const grub_uint16_t gcm_last4[16] =
+  {
+    0x0000, 0x1c20, 0x3840, 0x2460, 0x7080, 0x6ca0, 0x48c0, 0x54e0,
+    0xe100, 0xfd20, 0xd940, 0xc560, 0x9180, 0x8da0, 0xa9c0, 0xb5e0
+  };
+
+static void
+gcm_gen_table (struct grub_tls_aead *aead, const grub_uint8_t *h)
+{
+  grub_uint64_t vh = load_be64 (h), vl = load_be64 (h + 8);
+  int i, j;
+
+  aead->gcm.hh[0] = 0;
+  aead->gcm.hl[0] = 0;
+  aead->gcm.hh[8] = vh;
+  aead->gcm.hl[8] = vl;
+  for (i = 4; i > 0; i >>= 1)
+    {
+      grub_uint32_t t = (vl & 1) * 0xe1000000U;
+
+      vl = (vh << 63) | (vl >> 1);
+      vh = (vh >> 1) ^ ((grub_uint64_t) t << 32);
+      aead->gcm.hh[i] = vh;
+      aead->gcm.hl[i] = vl;
+    }
+  for (i = 2; i <= 8; i *= 2)
+    for (j = 1; j < i; j++)
+      {
+	aead->gcm.hh[i + j] = aead->gcm.hh[i] ^ aead->gcm.hh[j];
+	aead->gcm.hl[i + j] = aead->gcm.hl[i] ^ aead->gcm.hl[j];
+      }
+}
+
+/* X = X * H in GF(2^128).  */
+static void
+gcm_mult (const struct grub_tls_aead *aead, grub_uint8_t *x)
+{
+  grub_uint64_t zh, zl;
+  grub_uint8_t lo, hi, rem;
+  int i;
+
+  lo = x[15] & 0xf;
+  zh = aead->gcm.hh[lo];
+  zl = aead->gcm.hl[lo];
+  for (i = 15; i >= 0; i--)
+    {
+      lo = x[i] & 0xf;
+      hi = x[i] >> 4;
+      if (i != 15)
+	{
+	  rem = zl & 0xf;
+	  zl = (zh << 60) | (zl >> 4);
+	  zh = (zh >> 4) ^ ((grub_uint64_t) gcm_last4[rem] << 48);
+	  zh ^= aead->gcm.hh[lo];
+	  zl ^= aead->gcm.hl[lo];
+	}
+      rem = zl & 0xf;
+      zl = (zh << 60) | (zl >> 4);
+      zh = (zh >> 4) ^ ((grub_uint64_t) gcm_last4[rem] << 48);
+      zh ^= aead->gcm.hh[hi];
+      zl ^= aead->gcm.hl[hi];
+    }
+  store_be64 (x, zh);
+  store_be64 (x + 8, zl);
+}
+
+static void
+gcm_ghash (const struct grub_tls_aead *aead, grub_uint8_t *s,
+	   const grub_uint8_t *data, grub_size_t len)
+{
+  grub_size_t i;
+
+  for (; len >= 16; data += 16, len -= 16)
+    {
+      grub_crypto_xor (s, s, data, 16);
+      gcm_mult (aead, s);
+    }
+  if (len)
+    {
+      for (i = 0; i < len; i++)
+	s[i] ^= data[i];
+      gcm_mult (aead, s);
+    }
+}
+
+/* Run the counter from J0 + 1 over DATA, hashing the ciphertext into S
+   before (DECRYPT) or after encryption.  */
+static void
+gcm_crypt (struct grub_tls_aead *aead, const grub_uint8_t *j0,
+	   grub_uint8_t *s, grub_uint8_t *data, grub_size_t len, int decrypt)
+{
+  grub_uint8_t ctr[GCM_BATCH * 16], ks[GCM_BATCH * 16];
+  grub_uint32_t counter = 2;
+  grub_size_t n, i;
+
+  while (len)
+    {
+      n = len < sizeof (ks) ? len : sizeof (ks);
+      for (i = 0; i < (n + 15) / 16; i++)
+	{
+	  grub_memcpy (ctr + 16 * i, j0, 12);
+	  ctr[16 * i + 12] = counter >> 24;
+	  ctr[16 * i + 13] = counter >> 16;
+	  ctr[16 * i + 14] = counter >> 8;
+	  ctr[16 * i + 15] = counter;
+	  counter++;
+	}
+      gcm_aes (aead, ks, ctr, (n + 15) / 16);
+      if (decrypt)
+	gcm_ghash (aead, s, data, n);
+      grub_crypto_xor (data, data, ks, n);
+      if (!decrypt)
+	gcm_ghash (aead, s, data, n);
+      data += n;
+      len -= n;
+    }
+}
+
+static void
+gcm_tag (struct grub_tls_aead *aead, const grub_uint8_t *j0, grub_uint8_t *s,
+	 grub_size_t aadlen, grub_size_t len, grub_uint8_t *tag)
+{
+  grub_uint8_t lens[16], ek[16];
+
+  store_be64 (lens, (grub_uint64_t) aadlen * 8);
+  store_be64 (lens + 8, (grub_uint64_t) len * 8);
+  gcm_ghash (aead, s, lens, 16);
+  gcm_aes (aead, ek, j0, 1);
+  grub_crypto_xor (tag, s, ek, 16);
+}
+
+/* ChaCha20 and Poly1305 (RFC 8439).  */
+
+#define ROTL32(v, n) (((v) << (n)) | ((v) >> (32 - (n))))
+#define QR(a, b, c, d)					\
+  do {							\
+    a += b; d ^= a; d = ROTL32 (d, 16);			\
+    c += d; b ^= c; b = ROTL32 (b, 12);			\
+    a += b; d ^= a; d = ROTL32 (d, 8);			\
+    c += d; b ^= c; b = ROTL32 (b, 7);			\
+  } while (0)
+
+static void
+chacha20_block (const grub_uint32_t *key, grub_uint32_t counter,
+		const grub_uint8_t *nonce, grub_uint8_t *out)
+{
+  grub_uint32_t in[16], x[16];
+  int i;
+
+  in[0] = 0x61707865;
+  in[1] = 0x3320646e;
+  in[2] = 0x79622d32;
+  in[3] = 0x6b206574;
+  for (i = 0; i < 8; i++)
+    in[4 + i] = key[i];
+  in[12] = counter;
+  in[13] = load_le32 (nonce);
+  in[14] = load_le32 (nonce + 4);
+  in[15] = load_le32 (nonce + 8);
+
+  grub_memcpy (x, in, sizeof (x));
+  for (i = 0; i < 10; i++)
+    {
+      QR (x[0], x[4], x[8], x[12]);
+      QR (x[1], x[5], x[9], x[13]);
+      QR (x[2], x[6], x[10], x[14]);
+      QR (x[3], x[7], x[11], x[15]);
+      QR (x[0], x[5], x[10], x[15]);
+      QR (x[1], x[6], x[11], x[12]);
+      QR (x[2], x[7], x[8], x[13]);
+      QR (x[3], x[4], x[9], x[14]);
+    }
+  for (i = 0; i < 16; i++)
+    store_le32 (out + 4 * i, x[i] + in[i]);
+}
+
+static void
+chacha20_crypt (const grub_uint32_t *key, const grub_uint8_t *nonce,
+		grub_uint8_t *data, grub_size_t len)
+{
+  grub_uint8_t ks[64];
+  grub_uint32_t counter = 1;
+  grub_size_t n;
+
+  for (; len; data += n, len -= n)
+    {
+      chacha20_block (key, counter++, nonce, ks);
+      n = len < sizeof (ks) ? len : sizeof (ks);
+      grub_crypto_xor (data, data, ks, n);
+    }
+}
+
+/* 26-bit limbs, so that products fit in 64 bits.  */
+struct poly1305
+{
+  grub_uint32_t r[5];
+  grub_uint32_t h[5];
+  grub_uint32_t pad[4];
+};
+
+static void
+poly1305_init (struct poly1305 *st, const grub_uint8_t *key)
+{
+  st->r[0] = load_le32 (key) & 0x3ffffff;
+  st->r[1] = (load_le32 (key + 3) >> 2) & 0x3ffff03;
+  st->r[2] = (load_le32 (key + 6) >> 4) & 0x3ffc0ff;
+  st->r[3] = (load_le32 (key + 9) >> 6) & 0x3f03fff;
+  st->r[4] = (load_le32 (key + 12) >> 8) & 0x00fffff;
+  grub_memset (st->h, 0, sizeof (st->h));
+  st->pad[0] = load_le32 (key + 16);
+  st->pad[1] = load_le32 (key + 20);
+  st->pad[2] = load_le32 (key + 24);
+  st->pad[3] = load_le32 (key + 28);
+}
+
+static void
+poly1305_block (struct poly1305 *st, const grub_uint8_t *m)
+{
+  grub_uint32_t r0 = st->r[0], r1 = st->r[1], r2 = st->r[2];
+  grub_uint32_t r3 = st->r[3], r4 = st->r[4];
+  grub_uint32_t s1 = r1 * 5, s2 = r2 * 5, s3 = r3 * 5, s4 = r4 * 5;
+  grub_uint32_t h0, h1, h2, h3, h4, c;
+  grub_uint64_t d0, d1, d2, d3, d4;
+
+  h0 = st->h[0] + (load_le32 (m) & 0x3ffffff);
+  h1 = st->h[1] + ((load_le32 (m + 3) >> 2) & 0x3ffffff);
+  h2 = st->h[2] + ((load_le32 (m + 6) >> 4) & 0x3ffffff);
+  h3 = st->h[3] + ((load_le32 (m + 9) >> 6) & 0x3ffffff);
+  h4 = st->h[4] + ((load_le32 (m + 12) >> 8) | (1 << 24));
+
+  d0 = ((grub_uint64_t) h0 * r0) + ((grub_uint64_t) h1 * s4)
+    + ((grub_uint64_t) h2 * s3) + ((grub_uint64_t) h3 * s2)
+    + ((grub_uint64_t) h4 * s1);
+  d1 = ((grub_uint64_t) h0 * r1) + ((grub_uint64_t) h1 * r0)
+    + ((grub_uint64_t) h2 * s4) + ((grub_uint64_t) h3 * s3)
+    + ((grub_uint64_t) h4 * s2);
+  d2 = ((grub_uint64_t) h0 * r2) + ((grub_uint64_t) h1 * r1)
+    + ((grub_uint64_t) h2 * r0) + ((grub_uint64_t) h3 * s4)
+    + ((grub_uint64_t) h4 * s3);
+  d3 = ((grub_uint64_t) h0 * r3) + ((grub_uint64_t) h1 * r2)
+    + ((grub_uint64_t) h2 * r1) + ((grub_uint64_t) h3 * r0)
+    + ((grub_uint64_t) h4 * s4);
+  d4 = ((grub_uint64_t) h0 * r4) + ((grub_uint64_t) h1 * r3)
+    + ((grub_uint64_t) h2 * r2) + ((grub_uint64_t) h3 * r1)
+    + ((grub_uint64_t) h4 * r0);
+
+  c = d0 >> 26;
+  h0 = d0 & 0x3ffffff;
+  d1 += c;
+  c = d1 >> 26;
+  h1 = d1 & 0x3ffffff;
+  d2 += c;
+  c = d2 >> 26;
+  h2 = d2 & 0x3ffffff;
+  d3 += c;
+  c = d3 >> 26;
+  h3 = d3 & 0x3ffffff;
+  d4 += c;
+  c = d4 >> 26;
+  h4 = d4 & 0x3ffffff;
+  h0 += c * 5;
+  c = h0 >> 26;
+  h0 &= 0x3ffffff;
+  h1 += c;
+
+  st->h[0] = h0;
+  st->h[1] = h1;
+  st->h[2] = h2;
+  st->h[3] = h3;
+  st->h[4] = h4;
+}
+
+/* Absorb DATA zero-padded to a multiple of 16 bytes, as the AEAD
+   construction does for both the AAD and the ciphertext.  */
+static void
+poly1305_update_padded (struct poly1305 *st, const grub_uint8_t *data,
+			grub_size_t len)
+{
+  grub_uint8_t block[16];
+
+  for (; len >= 16; data += 16, len -= 16)
+    poly1305_block (st, data);
+  if (len)
+    {
+      grub_memset (block, 0, sizeof (block));
+      grub_memcpy (block, data, len);
+      poly1305_block (st, block);
+    }
+}
+
+static void
+poly1305_finish (struct poly1305 *st, grub_uint8_t *mac)
+{
+  grub_uint32_t h0 = st->h[0], h1 = st->h[1], h2 = st->h[2];
+  grub_uint32_t h3 = st->h[3], h4 = st->h[4];
+  grub_uint32_t g0, g1, g2, g3, g4, c, mask;
+  grub_uint64_t f;
+
+  c = h1 >> 26;
+  h1 &= 0x3ffffff;
+  h2 += c;
+  c = h2 >> 26;
+  h2 &= 0x3ffffff;
+  h3 += c;
+  c = h3 >> 26;
+  h3 &= 0x3ffffff;
+  h4 += c;
+  c = h4 >> 26;
+  h4 &= 0x3ffffff;
+  h0 += c * 5;
+  c = h0 >> 26;
+  h0 &= 0x3ffffff;
+  h1 += c;
+
+  /* H - P; keep it if it didn't go negative.  */
+  g0 = h0 + 5;
+  c = g0 >> 26;
+  g0 &= 0x3ffffff;
+  g1 = h1 + c;
+  c = g1 >> 26;
+  g1 &= 0x3ffffff;
+  g2 = h2 + c;
+  c = g2 >> 26;
+  g2 &= 0x3ffffff;
+  g3 = h3 + c;
+  c = g3 >> 26;
+  g3 &= 0x3ffffff;
+  g4 = h4 + c - (1 << 26);
+
+  mask = (g4 >> 31) - 1;
+  h0 = (h0 & ~mask) | (g0 & mask);
+  h1 = (h1 & ~mask) | (g1 & mask);
+  h2 = (h2 & ~mask) | (g2 & mask);
+  h3 = (h3 & ~mask) | (g3 & mask);
+  h4 = (h4 & ~mask) | (g4 & mask);
+
+  h0 = h0 | (h1 << 26);
+  h1 = (h1 >> 6) | (h2 << 20);
+  h2 = (h2 >> 12) | (h3 << 14);
+  h3 = (h3 >> 18) | (h4 << 8);
+
+  f = (grub_uint64_t) h0 + st->pad[0];
+  store_le32 (mac, f);
+  f = (grub_uint64_t) h1 + st->pad[1] + (f >> 32);
+  store_le32 (mac + 4, f);
+  f = (grub_uint64_t) h2 + st->pad[2] + (f >> 32);
+  store_le32 (mac + 8, f);
+  f = (grub_uint64_t) h3 + st->pad[3] + (f >> 32);
+  store_le32 (mac + 12, f);
+
+  grub_memset (st, 0, sizeof (*st));
+}
+
+static void
+chacha20_poly1305_tag (const grub_uint32_t *key, const grub_uint8_t *nonce,
+		       const grub_uint8_t *aad, grub_size_t aadlen,
+		       const grub_uint8_t *data, grub_size_t len,
+		       grub_uint8_t *tag)
+{
+  struct poly1305 st;
+  grub_uint8_t block[64];
+  grub_uint32_t i;
+
+  chacha20_block (key, 0, nonce, block);
+  poly1305_init (&st, block);
+  poly1305_update_padded (&st, aad, aadlen);
+  poly1305_update_padded (&st, data, len);
+  for (i = 0; i < 8; i++)
+    {
+      block[i] = (grub_uint64_t) aadlen >> (8 * i);
+      block[8 + i] = (grub_uint64_t) len >> (8 * i);
+    }
+  poly1305_block (&st, block);
+  poly1305_finish (&st, tag);
+  grub_memset (block, 0, sizeof (block));
+}
+
+/* The AEAD interface.  */
+
+grub_size_t
+grub_tls_aead_key_size (grub_uint16_t suite)
+{
+  return suite == GRUB_TLS_AES_128_GCM_SHA256 ? 16 : 32;
+}
+
+grub_err_t
+grub_tls_aead_init (struct grub_tls_aead *aead, grub_uint16_t suite,
+		    const grub_uint8_t *key)
+{
+  const gcry_cipher_spec_t *aes;
+  grub_uint8_t h[16];
+  int i;
+
+  grub_memset (aead, 0, sizeof (*aead));
+  aead->suite = suite;
+
+  if (suite == GRUB_TLS_CHACHA20_POLY1305_SHA256)
+    {
+      for (i = 0; i < 8; i++)
+	aead->chacha_key[i] = load_le32 (key + 4 * i);
+      return GRUB_ERR_NONE;
+    }
+
+#ifdef GRUB_TLS_USE_AESNI
+  if (grub_aesni_is_supported ())
+    {
+      aead->gcm.aesni = grub_malloc (sizeof (*aead->gcm.aesni));
+      if (!aead->gcm.aesni)
+	return grub_errno;
+      grub_aesni_set_key (aead->gcm.aesni, key, 16);
+    }
+  else
+#endif
+    {
+      aes = grub_crypto_lookup_cipher_by_name ("AES");
+      if (!aes)
+	return grub_error (GRUB_ERR_FILE_NOT_FOUND,
+			   "couldn't load %s cipher", "AES");
+      aead->gcm.cipher = grub_crypto_cipher_open (aes);
+      if (!aead->gcm.cipher)
+	return grub_errno;
+      if (grub_crypto_cipher_set_key (aead->gcm.cipher, key, 16))
+	{
+	  grub_crypto_cipher_close (aead->gcm.cipher);
+	  aead->gcm.cipher = NULL;
+	  return grub_error (GRUB_ERR_BAD_ARGUMENT, "invalid AES key");
+	}
+    }
+
+  grub_memset (h, 0, sizeof (h));
+  gcm_aes (aead, h, h, 1);
+  gcm_gen_table (aead, h);
+  grub_memset (h, 0, sizeof (h));
+  return GRUB_ERR_NONE;
+}
+
+void
+grub_tls_aead_fini (struct grub_tls_aead *aead)
+{
+  if (aead->suite == GRUB_TLS_AES_128_GCM_SHA256)
+    {
+#ifdef GRUB_TLS_USE_AESNI
+      if (aead->gcm.aesni)
+	{
+	  grub_memset (aead->gcm.aesni, 0, sizeof (*aead->gcm.aesni));
+	  grub_free (aead->gcm.aesni);
+	}
+#endif
+      if (aead->gcm.cipher)
+	{
+	  grub_memset (aead->gcm.cipher->ctx, 0,
+		       aead->gcm.cipher->cipher->contextsize);
+	  grub_crypto_cipher_close (aead->gcm.cipher);
+	}
+    }
+  grub_memset (aead, 0, sizeof (*aead));
+}
+
+void
+grub_tls_aead_seal (struct grub_tls_aead *aead, const grub_uint8_t *nonce,
+		    const grub_uint8_t *aad, grub_size_t aadlen,
+		    grub_uint8_t *data, grub_size_t len, grub_uint8_t *tag)
+{
+  grub_uint8_t j0[16], s[16];
+
+  if (aead->suite == GRUB_TLS_CHACHA20_POLY1305_SHA256)
+    {
+      chacha20_crypt (aead->chacha_key, nonce, data, len);
+      chacha20_poly1305_tag (aead->chacha_key, nonce, aad, aadlen,
+			     data, len, tag);
+      return;
+    }
+
+  grub_memcpy (j0, nonce, 12);
+  j0[12] = j0[13] = j0[14] = 0;
+  j0[15] = 1;
+  grub_memset (s, 0, sizeof (s));
+  gcm_ghash (aead, s, aad, aadlen);
+  gcm_crypt (aead, j0, s, data, len, 0);
+  gcm_tag (aead, j0, s, aadlen, len, tag);
+}
+
+int
+grub_tls_aead_open (struct grub_tls_aead *aead, const grub_uint8_t *nonce,
+		    const grub_uint8_t *aad, grub_size_t aadlen,
+		    grub_uint8_t *data, grub_size_t len,
+		    const grub_uint8_t *tag)
+{
+  grub_uint8_t j0[16], s[16], expected[GRUB_TLS_AEAD_TAG_SIZE];
+
+  if (aead->suite == GRUB_TLS_CHACHA20_POLY1305_SHA256)
+    {
+      chacha20_poly1305_tag (aead->chacha_key, nonce, aad, aadlen,
+			     data, len, expected);
+      if (grub_crypto_memcmp (expected, tag, sizeof (expected)) != 0)
+	return -1;
+      chacha20_crypt (aead->chacha_key, nonce, data, len);
+      return 0;
+    }
+
+  grub_memcpy (j0, nonce, 12);
+  j0[12] = j0[13] = j0[14] = 0;
+  j0[15] = 1;
+  grub_memset (s, 0, sizeof (s));
+  gcm_ghash (aead, s, aad, aadlen);
+  gcm_crypt (aead, j0, s, data, len, 1);
+  gcm_tag (aead, j0, s, aadlen, len, expected);
+  return grub_crypto_memcmp (expected, tag, sizeof (expected)) ? -1 : 0;
+}
+
+/* X25519 (RFC 7748), with field elements as sixteen 16-bit limbs held in
+   64-bit integers.  Constant time.  */
+
+typedef grub_int64_t fe[16];
+
+const grub_uint8_t grub_tls_x25519_base[GRUB_TLS_X25519_SIZE] = { 9 };
+
+static void
+fe_carry (fe o)
+{
+  grub_int64_t c;
+  int i;
+
+  for (i = 0; i < 16; i++)
+    {
+      o[i] += (1LL << 16);
+      c = o[i] >> 16;
+      if (i < 15)
+	o[i + 1] += c - 1;
+      else
+	o[0] += 38 * (c - 1);
+      o[i] -= c * 65536;
+    }
+}
+
+static void
+fe_cswap (fe p, fe q, int b)
+{
+  grub_int64_t t, c = ~(b - 1);
+  int i;
+
+  for (i = 0; i < 16; i++)
+    {
+      t = c & (p[i] ^ q[i]);
+      p[i] ^= t;
+      q[i] ^= t;
+    }
+}
+
+static void
+fe_pack (grub_uint8_t *o, const fe n)
+{
+  fe m, t;
+  int i, j, b;
+
+  grub_memcpy (t, n, sizeof (t));
+  fe_carry (t);
+  fe_carry (t);
+  fe_carry (t);
+  for (j = 0; j < 2; j++)
+    {
+      m[0] = t[0] - 0xffed;
+      for (i = 1; i < 15; i++)
+	{
+	  m[i] = t[i] - 0xffff - ((m[i - 1] >> 16) & 1);
+	  m[i - 1] &= 0xffff;
+	}
+      m[15] = t[15] - 0x7fff - ((m[14] >> 16) & 1);
+      b = (m[15] >> 16) & 1;
+      m[14] &= 0xffff;
+      fe_cswap (t, m, 1 - b);
+    }
+  for (i = 0; i < 16; i++)
+    {
+      o[2 * i] = t[i] & 0xff;
+      o[2 * i + 1] = t[i] >> 8;
+    }
+}
+
+static void
+fe_unpack (fe o, const grub_uint8_t *n)
+{
+  int i;
+
+  for (i = 0; i < 16; i++)
+    o[i] = n[2 * i] + ((grub_int64_t) n[2 * i + 1] << 8);
+  o[15] &= 0x7fff;
+}
+
+static void
+fe_add (fe o, const fe a, const fe b)
+{
+  int i;
+
+  for (i = 0; i < 16; i++)
+    o[i] = a[i] + b[i];
+}
+
+static void
+fe_sub (fe o, const fe a, const fe b)
+{
+  int i;
+
+  for (i = 0; i < 16; i++)
+    o[i] = a[i] - b[i];
+}
+
+static void
+fe_mul (fe o, const fe a, const fe b)
+{
+  grub_int64_t t[31];
+  int i, j;
+
+  grub_memset (t, 0, sizeof (t));
+  for (i = 0; i < 16; i++)
+    for (j = 0; j < 16; j++)
+      t[i + j] += a[i] * b[j];
+  for (i = 0; i < 15; i++)
+    t[i] += 38 * t[i + 16];
+  for (i = 0; i < 16; i++)
+    o[i] = t[i];
+  fe_carry (o);
+  fe_carry (o);
+}
+
+static void
+fe_invert (fe o, const fe in)
+{
+  fe c;
+  int a;
+
+  grub_memcpy (c, in, sizeof (c));
+  /* in^(p - 2) with p = 2^255 - 19.  */
+  for (a = 253; a >= 0; a--)
+    {
+      fe_mul (c, c, c);
+      if (a != 2 && a != 4)
+	fe_mul (c, c, in);
+    }
+  grub_memcpy (o, c, sizeof (c));
+}
+
+void
+grub_tls_x25519 (grub_uint8_t *out, const grub_uint8_t *scalar,
+		 const grub_uint8_t *point)
+{
+  static const fe a24 = { 0xdb41, 1 };
+  grub_uint8_t z[32];
+  fe x, a, b, c, d, e, f;
+  int i, r;
+
+  grub_memcpy (z, scalar, 32);
+  z[31] = (z[31] & 127) | 64;
+  z[0] &= 248;
+  fe_unpack (x, point);
+  grub_memcpy (b, x, sizeof (b));
+  grub_memset (a, 0, sizeof (a));
+  grub_memset (c, 0, sizeof (c));
+  grub_memset (d, 0, sizeof (d));
+  a[0] = d[0] = 1;
+
+  /* Montgomery ladder.  */
+  for (i = 254; i >= 0; i--)
+    {
+      r = (z[i >> 3] >> (i & 7)) & 1;
+      fe_cswap (a, b, r);
+      fe_cswap (c, d, r);
+      fe_add (e, a, c);
+      fe_sub (a, a, c);
+      fe_add (c, b, d);
+      fe_sub (b, b, d);
+      fe_mul (d, e, e);
+      fe_mul (f, a, a);
+      fe_mul (a, c, a);
+      fe_mul (c, b, e);
+      fe_add (e, a, c);
+      fe_sub (a, a, c);
+      fe_mul (b, a, a);
+      fe_sub (c, d, f);
+      fe_mul (a, c, a24);
+      fe_add (a, a, d);
+      fe_mul (c, c, a);
+      fe_mul (a, d, f);
+      fe_mul (d, b, x);
+      fe_mul (b, e, e);
+      fe_cswap (a, b, r);
+      fe_cswap (c, d, r);
+    }
+  fe_invert (c, c);
+  fe_mul (a, a, c);
+  fe_pack (out, a);
+
+  grub_memset (z, 0, sizeof (z));
+}
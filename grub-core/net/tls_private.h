@@ -0,0 +1,92 @@
+/* tls_private.h - Ciphers and key exchange used by the TLS client.  */
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2026  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef GRUB_TLS_PRIVATE_HEADER
+#define GRUB_TLS_PRIVATE_HEADER	1
+
+#include <grub/types.h>
+#include <grub/err.h>
+#include <grub/crypto.h>
+
+#if defined (__x86_64__) && defined (GRUB_MACHINE_EFI)
+#include <grub/x86_64/aesni.h>
+#define GRUB_TLS_USE_AESNI 1
+#endif
+
+/* TLS 1.3 cipher suites (RFC 8446, B.4).  Both use SHA-256.  */
+#define GRUB_TLS_AES_128_GCM_SHA256		0x1301
+#define GRUB_TLS_CHACHA20_POLY1305_SHA256	0x1303
+
+#define GRUB_TLS_AEAD_TAG_SIZE		16
+#define GRUB_TLS_AEAD_NONCE_SIZE	12
+#define GRUB_TLS_AEAD_MAX_KEY_SIZE	32
+
+#define GRUB_TLS_X25519_SIZE		32
+
+struct grub_tls_aead
+{
+  grub_uint16_t suite;
+  union
+  {
+    struct
+    {
+#ifdef GRUB_TLS_USE_AESNI
+      struct grub_aesni_key *aesni;
+#endif
+      grub_crypto_cipher_handle_t cipher;
+      /* GHASH multiplication table for H, high and low halves.  */
+      grub_uint64_t hh[16];
+      grub_uint64_t hl[16];
+    } gcm;
+    grub_uint32_t chacha_key[8];
+  };
+};
+
+grub_size_t
+grub_tls_aead_key_size (grub_uint16_t suite);
+
+grub_err_t
+grub_tls_aead_init (struct grub_tls_aead *aead, grub_uint16_t suite,
+		    const grub_uint8_t *key);
+
+void
+grub_tls_aead_fini (struct grub_tls_aead *aead);
+
+/* Encrypt LEN bytes of DATA in place and write the tag to TAG.  */
+void
+grub_tls_aead_seal (struct grub_tls_aead *aead, const grub_uint8_t *nonce,
+		    const grub_uint8_t *aad, grub_size_t aadlen,
+		    grub_uint8_t *data, grub_size_t len, grub_uint8_t *tag);
+
+/* Decrypt LEN bytes of DATA in place.  Returns 0 when TAG matches; DATA is
+   garbage otherwise.  */
+int
+grub_tls_aead_open (struct grub_tls_aead *aead, const grub_uint8_t *nonce,
+		    const grub_uint8_t *aad, grub_size_t aadlen,
+		    grub_uint8_t *data, grub_size_t len,
+		    const grub_uint8_t *tag);
+
+/* OUT = SCALAR * POINT on Curve25519 (RFC 7748).  */
+void
+grub_tls_x25519 (grub_uint8_t *out, const grub_uint8_t *scalar,
+		 const grub_uint8_t *point);
+
+extern const grub_uint8_t grub_tls_x25519_base[GRUB_TLS_X25519_SIZE];
+
+#endif
@@ -65,12 +65,25 @@ grub_net_udp_open (grub_net_network_level_address_t addr,
 					    struct grub_net_buff *nb,
 					    void *data),
 		   void *recv_hook_data)
+{
+  static int in_port = 25300;
+
+  return grub_net_udp_open_port (addr, in_port++, out_port, recv_hook,
+				 recv_hook_data);
+}
+
+grub_net_udp_socket_t
+grub_net_udp_open_port (grub_net_network_level_address_t addr,
+			grub_uint16_t in_port, grub_uint16_t out_port,
+			grub_err_t (*recv_hook) (grub_net_udp_socket_t sock,
+						 struct grub_net_buff *nb,
+						 void *data),
+			void *recv_hook_data)
 {
   grub_err_t err;
   struct grub_net_network_level_interface *inf;
   grub_net_network_level_address_t gateway;
   grub_net_udp_socket_t socket;
-  static int in_port = 25300;
   grub_net_link_level_address_t ll_target_addr;
 
   if (addr.type != GRUB_NET_NETWORK_LEVEL_PROTOCOL_IPV4
@@ -96,7 +109,7 @@ grub_net_udp_open (grub_net_network_level_address_t addr,
   socket->inf = inf;
   socket->out_nla = addr;
   socket->ll_target_addr = ll_target_addr;
-  socket->in_port = in_port++;
+  socket->in_port = in_port;
   socket->status = GRUB_NET_SOCKET_START;
   socket->recv_hook = recv_hook;
   socket->recv_hook_data = recv_hook_data;
@@ -138,7 +151,8 @@ grub_net_send_udp_packet (const grub_net_udp_socket_t socket,
 grub_err_t
 grub_net_recv_udp_packet (struct grub_net_buff *nb,
 			  struct grub_net_network_level_interface *inf,
-			  const grub_net_network_level_address_t *source)
+			  const grub_net_network_level_address_t *source,
+			  const grub_net_network_level_address_t *dest)
 {
   struct udphdr *udph;
   grub_net_udp_socket_t sock;
@@ -174,8 +188,7 @@ grub_net_recv_udp_packet (struct grub_net_buff *nb,
 	    chk = udph->chksum;
 	    udph->chksum = 0;
 	    expected = grub_net_ip_transport_checksum (nb, GRUB_NET_IP_UDP,
-						       &sock->out_nla,
-						       &sock->inf->address);
+						       &sock->out_nla, dest);
 	    if (expected != chk)
 	      {
 		grub_dprintf ("net", "Invalid UDP checksum. "
@@ -22,11 +22,15 @@
 #include <grub/env.h>
 #include <grub/misc.h>
 #include <grub/fs.h>
+#include <grub/partition.h>
 #include <grub/normal.h>
 
 /* This is used to store the names of filesystem modules for auto-loading.  */
 static grub_named_list_t fs_module_list;
 
+/* Likewise for partition map modules.  */
+static grub_named_list_t partmap_module_list;
+
 /* The auto-loading hook for filesystems.  */
 static int
 autoload_fs_module (void)
@@ -62,91 +66,107 @@ autoload_fs_module (void)
   return ret;
 }
 
+static void
+free_module_list (grub_named_list_t *list)
+{
+  while (*list)
+    {
+      grub_named_list_t tmp;
+      tmp = (*list)->next;
+      grub_free ((*list)->name);
+      grub_free (*list);
+      *list = tmp;
+    }
+}
+
+/* Read the module list NAME, one module per line, from PREFIX into LIST.
+   LIST is left alone if the file can't be opened.  */
+static void
+read_module_list (const char *prefix, const char *name,
+		  grub_named_list_t *list)
+{
+  char *filename;
+  grub_file_t file;
+
+  filename = grub_xasprintf ("%s/" GRUB_TARGET_CPU "-" GRUB_PLATFORM
+			     "/%s", prefix, name);
+  if (! filename)
+    return;
+
+  file = grub_file_open (filename);
+  grub_free (filename);
+  if (! file)
+    return;
+
+  /* Override the previous list.  */
+  free_module_list (list);
+
+  while (1)
+    {
+      char *buf;
+      char *p;
+      char *q;
+      grub_named_list_t mod;
+
+      buf = grub_file_getline (file);
+      if (! buf)
+	break;
+
+      p = buf;
+      q = buf + grub_strlen (buf) - 1;
+
+      /* Ignore space.  */
+      while (grub_isspace (*p))
+	p++;
+
+      while (p < q && grub_isspace (*q))
+	*q-- = '\0';
+
+      /* If the line is empty, skip it.  */
+      if (p >= q)
+	{
+	  grub_free (buf);
+	  continue;
+	}
+
+      mod = grub_malloc (sizeof (*mod));
+      if (! mod)
+	{
+	  grub_free (buf);
+	  continue;
+	}
+
+      mod->name = grub_strdup (p);
+      grub_free (buf);
+      if (! mod->name)
+	{
+	  grub_free (mod);
+	  continue;
+	}
+
+      mod->next = *list;
+      *list = mod;
+    }
+
+  grub_file_close (file);
+}
+
 /* Read the file fs.lst for auto-loading.  */
 void
 read_fs_list (const char *prefix)
 {
   if (prefix)
     {
-      char *filename;
+      grub_fs_autoload_hook_t tmp_autoload_hook;
 
-      filename = grub_xasprintf ("%s/" GRUB_TARGET_CPU "-" GRUB_PLATFORM
-				 "/fs.lst", prefix);
-      if (filename)
-	{
-	  grub_file_t file;
-	  grub_fs_autoload_hook_t tmp_autoload_hook;
-
-	  /* This rules out the possibility that read_fs_list() is invoked
-	     recursively when we call grub_file_open() below.  */
-	  tmp_autoload_hook = grub_fs_autoload_hook;
-	  grub_fs_autoload_hook = NULL;
-
-	  file = grub_file_open (filename);
-	  if (file)
-	    {
-	      /* Override previous fs.lst.  */
-	      while (fs_module_list)
-		{
-		  grub_named_list_t tmp;
-		  tmp = fs_module_list->next;
-		  grub_free (fs_module_list);
-		  fs_module_list = tmp;
-		}
-
-	      while (1)
-		{
-		  char *buf;
-		  char *p;
-		  char *q;
-		  grub_named_list_t fs_mod;
-
-		  buf = grub_file_getline (file);
-		  if (! buf)
-		    break;
-
-		  p = buf;
-		  q = buf + grub_strlen (buf) - 1;
-
-		  /* Ignore space.  */
-		  while (grub_isspace (*p))
-		    p++;
-
-		  while (p < q && grub_isspace (*q))
-		    *q-- = '\0';
-
-		  /* If the line is empty, skip it.  */
-		  if (p >= q)
-		    {
-		      grub_free (buf);
-		      continue;
-		    }
-
-		  fs_mod = grub_malloc (sizeof (*fs_mod));
-		  if (! fs_mod)
-		    {
-		      grub_free (buf);
-		      continue;
-		    }
-
-		  fs_mod->name = grub_strdup (p);
-		  grub_free (buf);
-		  if (! fs_mod->name)
-		    {
-		      grub_free (fs_mod);
-		      continue;
-		    }
-
-		  fs_mod->next = fs_module_list;
-		  fs_module_list = fs_mod;
-		}
-
-	      grub_file_close (file);
-	      grub_fs_autoload_hook = tmp_autoload_hook;
-	    }
-
-	  grub_free (filename);
-	}
+      /* This rules out the possibility that read_fs_list() is invoked
+	 recursively when we call grub_file_open() below.  */
+      tmp_autoload_hook = grub_fs_autoload_hook;
+      grub_fs_autoload_hook = NULL;
+
+      read_module_list (prefix, "fs.lst", &fs_module_list);
+
+      grub_fs_autoload_hook = tmp_autoload_hook;
     }
 
   /* Ignore errors.  */
@@ -155,3 +175,44 @@ read_fs_list (const char *prefix)
   /* Set the hook.  */
   grub_fs_autoload_hook = autoload_fs_module;
 }
+
+/* The auto-loading hook for partition maps: NAME is provided by
+   part_NAME, if partmap.lst knows about it.  */
+static int
+autoload_partmap_module (const char *name)
+{
+  char *modname;
+  int ret = 0;
+
+  modname = grub_xasprintf ("part_%s", name);
+  if (! modname)
+    return 0;
+
+  if (! grub_dl_get (modname)
+      && grub_named_list_find (partmap_module_list, modname))
+    {
+      ret = (grub_dl_load (modname) != NULL);
+      if (grub_errno)
+	grub_print_error ();
+    }
+
+  grub_free (modname);
+  return ret;
+}
+
+/* Read the file partmap.lst for auto-loading.  */
+void
+read_partmap_list (const char *prefix)
+{
+  if (prefix)
+    {
+      /* Opening the list may itself probe partitions by name.  */
+      grub_partition_autoload_hook = NULL;
+      read_module_list (prefix, "partmap.lst", &partmap_module_list);
+    }
+
+  /* Ignore errors.  */
+  grub_errno = GRUB_ERR_NONE;
+
+  grub_partition_autoload_hook = autoload_partmap_module;
+}
@@ -261,130 +261,46 @@ grub_utf8_to_ucs4 (grub_uint32_t *dest, grub_size_t destsize,
   return p - dest;
 }
 
-static grub_uint8_t *join_types = NULL;
-
-static void
-unpack_join (void)
+static inline const struct grub_unicode_props *
+get_props (grub_uint32_t c)
 {
-  unsigned i;
-  struct grub_unicode_compact_range *cur;
-
-  join_types = grub_zalloc (GRUB_UNICODE_MAX_CACHED_CHAR);
-  if (!join_types)
-    {
-      grub_errno = GRUB_ERR_NONE;
-      return;
-    }
-  for (cur = grub_unicode_compact; cur->len; cur++)
-    for (i = cur->start; i < cur->start + (unsigned) cur->len
-	   && i < GRUB_UNICODE_MAX_CACHED_CHAR; i++)
-      join_types[i] = cur->join_type;
-}
+  unsigned block;
 
-static grub_uint8_t *bidi_types = NULL;
+  /* Latin-1 is block 0 and needs no page lookup.  */
+  if (c < GRUB_UNICODE_PROP_PAGE_SIZE)
+    return &grub_unicode_props[grub_unicode_prop_blocks[c]];
 
-static void
-unpack_bidi (void)
-{
-  unsigned i;
-  struct grub_unicode_compact_range *cur;
+  if (c > GRUB_UNICODE_LAST_VALID)
+    return &grub_unicode_props[0];
 
-  bidi_types = grub_zalloc (GRUB_UNICODE_MAX_CACHED_CHAR);
-  if (!bidi_types)
-    {
-      grub_errno = GRUB_ERR_NONE;
-      return;
-    }
-  for (cur = grub_unicode_compact; cur->len; cur++)
-    for (i = cur->start; i < cur->start + (unsigned) cur->len
-	   && i < GRUB_UNICODE_MAX_CACHED_CHAR; i++)
-      if (cur->bidi_mirror)
-	bidi_types[i] = cur->bidi_type | 0x80;
-      else
-	bidi_types[i] = cur->bidi_type | 0x00;
+  block = grub_unicode_prop_pages[c >> GRUB_UNICODE_PROP_PAGE_BITS];
+  return &grub_unicode_props[grub_unicode_prop_blocks
+			     [(block << GRUB_UNICODE_PROP_PAGE_BITS)
+			      | (c & (GRUB_UNICODE_PROP_PAGE_SIZE - 1))]];
 }
 
 static inline enum grub_bidi_type
 get_bidi_type (grub_uint32_t c)
 {
-  struct grub_unicode_compact_range *cur;
-
-  if (!bidi_types)
-    unpack_bidi ();
-
-  if (bidi_types && c < GRUB_UNICODE_MAX_CACHED_CHAR)
-    return bidi_types[c] & 0x7f;
-
-  for (cur = grub_unicode_compact; cur->len; cur++)
-    if (cur->start <= c && c < cur->start + (unsigned) cur->len)
-      return cur->bidi_type;
-
-  return GRUB_BIDI_TYPE_L;
+  return get_props (c)->bidi_type;
 }
 
 static inline enum grub_join_type
 get_join_type (grub_uint32_t c)
 {
-  struct grub_unicode_compact_range *cur;
-
-  if (!join_types)
-    unpack_join ();
-
-  if (join_types && c < GRUB_UNICODE_MAX_CACHED_CHAR)
-    return join_types[c];
-
-  for (cur = grub_unicode_compact; cur->len; cur++)
-    if (cur->start <= c && c < cur->start + (unsigned) cur->len)
-      return cur->join_type;
-
-  return GRUB_JOIN_TYPE_NONJOINING;
+  return get_props (c)->join_type;
 }
 
 static inline int
 is_mirrored (grub_uint32_t c)
 {
-  struct grub_unicode_compact_range *cur;
-
-  if (!bidi_types)
-    unpack_bidi ();
-
-  if (bidi_types && c < GRUB_UNICODE_MAX_CACHED_CHAR)
-    return !!(bidi_types[c] & 0x80);
-
-  for (cur = grub_unicode_compact; cur->len; cur++)
-    if (cur->start <= c && c < cur->start + (unsigned) cur->len)
-      return cur->bidi_mirror;
-
-  return 0;
+  return get_props (c)->bidi_mirror;
 }
 
 enum grub_comb_type
 grub_unicode_get_comb_type (grub_uint32_t c)
 {
-  static grub_uint8_t *comb_types = NULL;
-  struct grub_unicode_compact_range *cur;
-
-  if (!comb_types)
-    {
-      unsigned i;
-      comb_types = grub_zalloc (GRUB_UNICODE_MAX_CACHED_CHAR);
-      if (comb_types)
-	for (cur = grub_unicode_compact; cur->len; cur++)
-	  for (i = cur->start; i < cur->start + (unsigned) cur->len
-		 && i < GRUB_UNICODE_MAX_CACHED_CHAR; i++)
-	    comb_types[i] = cur->comb_type;
-      else
-	grub_errno = GRUB_ERR_NONE;
-    }
-
-  if (comb_types && c < GRUB_UNICODE_MAX_CACHED_CHAR)
-    return comb_types[c];
-
-  for (cur = grub_unicode_compact; cur->len; cur++)
-    if (cur->start <= c && c < cur->start + (unsigned) cur->len)
-      return cur->comb_type;
-
-  return GRUB_UNICODE_COMB_NONE;
+  return get_props (c)->comb_type;
 }
 
 #if HAVE_FONT_SOURCE
@@ -785,6 +701,48 @@ bidi_line_wrap (struct grub_unicode_glyph *visual_out,
 }
 
 
+/* Lay out a line made only of ASCII characters.  Such a line has no
+   combining marks, joiners or right-to-left characters, so every character
+   is its own glyph at embedding level 0 and the bidi resolution can be
+   skipped.  */
+static grub_ssize_t
+ascii_line_to_visual (const grub_uint32_t *logical,
+		      grub_size_t logical_len,
+		      struct grub_unicode_glyph *visual_out,
+		      grub_size_t (*getcharwidth) (const struct grub_unicode_glyph *visual, void *getcharwidth_arg),
+		      void *getcharwidth_arg,
+		      grub_size_t maxwidth, grub_size_t startwidth,
+		      grub_uint32_t contchar,
+		      struct grub_term_pos *pos,
+		      int primitive_wrap,
+		      grub_size_t log_end)
+{
+  struct grub_unicode_glyph *visual;
+  grub_ssize_t ret;
+  grub_size_t i;
+
+  if (!logical_len)
+    return 0;
+
+  visual = grub_zalloc (sizeof (visual[0]) * logical_len);
+  if (!visual)
+    return -1;
+
+  for (i = 0; i < logical_len; i++)
+    {
+      visual[i].base = logical[i];
+      visual[i].estimated_width = 1;
+      visual[i].orig_pos = i;
+      visual[i].bidi_type = GRUB_BIDI_TYPE_L;
+    }
+
+  ret = bidi_line_wrap (visual_out, visual, logical_len,
+			getcharwidth, getcharwidth_arg, maxwidth, startwidth,
+			contchar, pos, primitive_wrap, log_end);
+  grub_free (visual);
+  return ret;
+}
+
 static grub_ssize_t
 grub_bidi_line_logical_to_visual (const grub_uint32_t *logical,
 				  grub_size_t logical_len,
@@ -842,6 +800,15 @@ grub_bidi_line_logical_to_visual (const grub_uint32_t *logical,
       }							\
   }
 
+  for (i = 0; i < logical_len; i++)
+    if (logical[i] >= 0x80)
+      break;
+  if (i == logical_len)
+    return ascii_line_to_visual (logical, logical_len, visual_out,
+				 getcharwidth, getcharwidth_arg, maxwidth,
+				 startwidth, contchar, pos, primitive_wrap,
+				 log_end);
+
   visual = grub_malloc (sizeof (visual[0]) * logical_len);
   if (!visual)
     return -1;
@@ -1144,8 +1111,105 @@ grub_bidi_line_logical_to_visual (const grub_uint32_t *logical,
   }
 }
 
-grub_ssize_t
-grub_bidi_logical_to_visual (const grub_uint32_t *logical,
+/* Menu entries and theme labels are laid out again with the same parameters
+   on every redraw, so keep the visual glyphs of the last few strings.  The
+   width callback and its argument (the terminal) stand for the font: a
+   terminal only changes glyph widths together with its font, which also
+   changes the line width it asks for.  Layouts which report cursor
+   positions are not cached.  */
+#define LAYOUT_CACHE_SIZE 32
+#define LAYOUT_CACHE_MAX_LEN 1024
+
+struct layout_cache_entry
+{
+  grub_uint32_t *logical;
+  grub_size_t logical_len;
+  grub_uint32_t hash;
+  grub_size_t (*getcharwidth) (const struct grub_unicode_glyph *visual,
+			       void *getcharwidth_arg);
+  void *getcharwidth_arg;
+  grub_size_t max_length;
+  grub_size_t startwidth;
+  grub_uint32_t contchar;
+  int primitive_wrap;
+  struct grub_unicode_glyph *visual;
+  grub_ssize_t visual_len;
+};
+
+static struct layout_cache_entry layout_cache[LAYOUT_CACHE_SIZE];
+static unsigned layout_cache_next;
+
+static grub_uint32_t
+layout_hash (const grub_uint32_t *logical, grub_size_t logical_len)
+{
+  grub_uint32_t hash = 2166136261U;
+  grub_size_t i;
+
+  for (i = 0; i < logical_len; i++)
+    hash = (hash ^ logical[i]) * 16777619;
+  return hash;
+}
+
+static void
+destroy_visual (struct grub_unicode_glyph *visual, grub_ssize_t visual_len)
+{
+  grub_ssize_t i;
+
+  for (i = 0; i < visual_len; i++)
+    grub_unicode_destroy_glyph (&visual[i]);
+  grub_free (visual);
+}
+
+/* Copy VISUAL including the combining marks owned by its glyphs.  */
+static struct grub_unicode_glyph *
+copy_visual (const struct grub_unicode_glyph *visual, grub_ssize_t visual_len)
+{
+  struct grub_unicode_glyph *out;
+  grub_ssize_t i;
+
+  out = grub_malloc (sizeof (out[0]) * (visual_len + 1));
+  if (!out)
+    return NULL;
+  grub_memcpy (out, visual, sizeof (out[0]) * visual_len);
+  for (i = 0; i < visual_len; i++)
+    {
+      if (out[i].ncomb <= ARRAY_SIZE (out[i].combining_inline))
+	continue;
+      out[i].combining_ptr = grub_malloc (sizeof (out[i].combining_ptr[0])
+					  * out[i].ncomb);
+      if (!out[i].combining_ptr)
+	{
+	  out[i].ncomb = 0;
+	  destroy_visual (out, i);
+	  return NULL;
+	}
+      grub_memcpy (out[i].combining_ptr, visual[i].combining_ptr,
+		   sizeof (out[i].combining_ptr[0]) * out[i].ncomb);
+    }
+  return out;
+}
+
+static void
+layout_cache_free (struct layout_cache_entry *entry)
+{
+  grub_free (entry->logical);
+  if (entry->visual)
+    destroy_visual (entry->visual, entry->visual_len);
+  grub_memset (entry, 0, sizeof (*entry));
+}
+
+void
+grub_bidi_flush_cache (void)
+{
+  unsigned i;
+
+  for (i = 0; i < LAYOUT_CACHE_SIZE; i++)
+    layout_cache_free (&layout_cache[i]);
+  layout_cache_next = 0;
+}
+
+static grub_ssize_t
+bidi_logical_to_visual_real (const grub_uint32_t *logical,
 			     grub_size_t logical_len,
 			     struct grub_unicode_glyph **visual_out,
 			     grub_size_t (*getcharwidth) (const struct grub_unicode_glyph *visual, void *getcharwidth_arg),
@@ -1196,6 +1260,81 @@ grub_bidi_logical_to_visual (const grub_uint32_t *logical,
   return visual_ptr - *visual_out;
 }
 
+grub_ssize_t
+grub_bidi_logical_to_visual (const grub_uint32_t *logical,
+			     grub_size_t logical_len,
+			     struct grub_unicode_glyph **visual_out,
+			     grub_size_t (*getcharwidth) (const struct grub_unicode_glyph *visual, void *getcharwidth_arg),
+			     void *getcharwidth_arg,
+			     grub_size_t max_length, grub_size_t startwidth,
+			     grub_uint32_t contchar, struct grub_term_pos *pos, int primitive_wrap)
+{
+  struct layout_cache_entry *entry;
+  grub_uint32_t hash;
+  grub_ssize_t ret;
+  unsigned i;
+
+  if (pos || logical_len > LAYOUT_CACHE_MAX_LEN)
+    return bidi_logical_to_visual_real (logical, logical_len, visual_out,
+					getcharwidth, getcharwidth_arg,
+					max_length, startwidth, contchar,
+					pos, primitive_wrap);
+
+  hash = layout_hash (logical, logical_len);
+  for (i = 0; i < LAYOUT_CACHE_SIZE; i++)
+    {
+      entry = &layout_cache[i];
+      if (entry->visual && entry->hash == hash
+	  && entry->logical_len == logical_len
+	  && entry->getcharwidth == getcharwidth
+	  && entry->getcharwidth_arg == getcharwidth_arg
+	  && entry->max_length == max_length
+	  && entry->startwidth == startwidth
+	  && entry->contchar == contchar
+	  && entry->primitive_wrap == primitive_wrap
+	  && grub_memcmp (entry->logical, logical,
+			  sizeof (logical[0]) * logical_len) == 0)
+	{
+	  *visual_out = copy_visual (entry->visual, entry->visual_len);
+	  if (!*visual_out)
+	    return -1;
+	  return entry->visual_len;
+	}
+    }
+
+  ret = bidi_logical_to_visual_real (logical, logical_len, visual_out,
+				     getcharwidth, getcharwidth_arg,
+				     max_length, startwidth, contchar,
+				     pos, primitive_wrap);
+  if (ret < 0)
+    return ret;
+
+  entry = &layout_cache[layout_cache_next];
+  layout_cache_next = (layout_cache_next + 1) % LAYOUT_CACHE_SIZE;
+  layout_cache_free (entry);
+
+  entry->logical = grub_malloc (sizeof (logical[0]) * (logical_len + 1));
+  entry->visual = copy_visual (*visual_out, ret);
+  if (!entry->logical || !entry->visual)
+    {
+      /* The layout itself succeeded, it just isn't remembered.  */
+      layout_cache_free (entry);
+      grub_errno = GRUB_ERR_NONE;
+      return ret;
+    }
+  grub_memcpy (entry->logical, logical, sizeof (logical[0]) * logical_len);
+  entry->logical_len = logical_len;
+  entry->hash = hash;
+  entry->getcharwidth = getcharwidth;
+  entry->getcharwidth_arg = getcharwidth_arg;
+  entry->max_length = max_length;
+  entry->startwidth = startwidth;
+  entry->contchar = contchar;
+  entry->primitive_wrap = primitive_wrap;
+  entry->visual_len = ret;
+  return ret;
+}
+
 grub_uint32_t
 grub_unicode_mirror_code (grub_uint32_t in)
 {
@@ -56,7 +56,7 @@ static grub_err_t
 grub_env_new_context (int export_all)
 {
   struct grub_env_context *context;
-  int i;
+  unsigned int i;
   struct menu_pointer *menu;
 
   context = grub_zalloc (sizeof (*context));
@@ -76,7 +76,7 @@ grub_env_new_context (int export_all)
   current_menu = menu;
 
   /* Copy exported variables.  */
-  for (i = 0; i < HASHSZ; i++)
+  for (i = 0; i < context->prev->nbuckets; i++)
     {
       struct grub_env_var *var;
 
@@ -115,7 +115,7 @@ grub_err_t
 grub_env_context_close (void)
 {
   struct grub_env_context *context;
-  int i;
+  unsigned int i;
   struct menu_pointer *menu;
 
   if (! grub_current_context->prev)
@@ -123,7 +123,7 @@ grub_env_context_close (void)
 		       "cannot close the initial context");
 
   /* Free the variables associated with this context.  */
-  for (i = 0; i < HASHSZ; i++)
+  for (i = 0; i < grub_current_context->nbuckets; i++)
     {
       struct grub_env_var *p, *q;
 
@@ -138,6 +138,7 @@ grub_env_context_close (void)
 
   /* Restore the previous context.  */
   context = grub_current_context->prev;
+  grub_free (grub_current_context->vars);
   grub_free (grub_current_context);
   grub_current_context = context;
 
@@ -154,7 +155,6 @@ grub_err_t
 grub_env_extractor_close (int source)
 {
   grub_menu_t menu = NULL;
-  grub_menu_entry_t *last;
   grub_err_t err;
 
   if (source)
@@ -167,14 +167,16 @@ grub_env_extractor_close (int source)
   if (source && menu)
     {
       grub_menu_t menu2;
+      grub_menu_entry_t e, next;
       menu2 = grub_env_get_menu ();
-      
-      last = &menu2->entry_list;
-      while (*last)
-	last = &(*last)->next;
-      
-      *last = menu->entry_list;
-      menu2->size += menu->size;
+
+      for (e = menu->entry_list; e; e = next)
+	{
+	  next = e->next;
+	  grub_menu_append_entry (menu2, e);
+	}
+      grub_free (menu->entries);
+      grub_free (menu);
     }
 
   grub_extractor_level--;
@@ -33,6 +33,9 @@
 #include <grub/charset.h>
 #include <grub/script_sh.h>
 #include <grub/bufio.h>
+#ifdef GRUB_MACHINE_EMU
+#include <grub/emu/batch.h>
+#endif
 
 GRUB_MOD_LICENSE ("GPLv3+");
 
@@ -74,6 +77,7 @@ grub_normal_free_menu (grub_menu_t menu)
       entry = next_entry;
     }
 
+  grub_free (menu->entries);
   grub_free (menu);
   grub_env_unset_menu ();
 }
@@ -109,6 +113,8 @@ read_config_file (const char *config)
   char *old_file = 0, *old_dir = 0;
   char *config_dir, *ptr = 0;
   const char *ctmp;
+  char *text = 0;
+  grub_size_t text_len = 0, text_alloc = 0, n_lines = 0;
 
   grub_menu_t newmenu;
 
@@ -164,21 +170,45 @@ read_config_file (const char *config)
   grub_env_export ("config_file");
   grub_env_export ("config_directory");
 
+  /* Read all of it first, so that a file parsed before can be run
+     without parsing it again.  */
   while (1)
     {
       char *line;
-
-      /* Print an error, if any.  */
-      grub_print_error ();
-      grub_errno = GRUB_ERR_NONE;
+      grub_size_t len;
 
       if ((read_config_file_getline (&line, 0, file)) || (! line))
 	break;
 
-      grub_normal_parse_line (line, read_config_file_getline, file);
+      len = grub_strlen (line);
+      if (text_len + len + 2 > text_alloc)
+	{
+	  char *new_text;
+
+	  text_alloc = 2 * (text_len + len + 2);
+	  new_text = grub_realloc (text, text_alloc);
+	  if (! new_text)
+	    {
+	      grub_free (line);
+	      break;
+	    }
+	  text = new_text;
+	}
+      if (n_lines++)
+	text[text_len++] = '\n';
+      grub_memcpy (text + text_len, line, len + 1);
+      text_len += len;
       grub_free (line);
     }
 
+  /* Print an error, if any.  */
+  grub_print_error ();
+  grub_errno = GRUB_ERR_NONE;
+
+  if (text)
+    grub_script_execute_config (grub_env_get ("config_file"), text);
+  grub_free (text);
+
   if (old_file)
     grub_env_set ("config_file", old_file);
   else
@@ -240,6 +270,7 @@ read_lists (const char *val)
     {
       read_command_list (val);
       read_fs_list (val);
+      read_partmap_list (val);
       read_crypto_list (val);
       read_terminal_list (val);
     }
@@ -269,18 +300,18 @@ grub_normal_execute (const char *config, int nested, int batch)
       grub_register_variable_hook ("prefix", NULL, read_lists_hook);
     }
 
-  grub_boot_time ("Executing config file");
-
   if (config)
     {
+      grub_boot_span_t span;
+
+      span = grub_boot_span_begin ("Executing config file %s", config);
       menu = read_config_file (config);
+      grub_boot_span_end (span, 0);
 
       /* Ignore any error.  */
       grub_errno = GRUB_ERR_NONE;
     }
 
-  grub_boot_time ("Executed config file");
-
   if (! batch)
     {
       if (menu && menu->size)
@@ -294,12 +325,54 @@ grub_normal_execute (const char *config, int nested, int batch)
     }
 }
 
+#ifdef GRUB_MACHINE_EMU
+/* Run the scripts given to grub-emu --batch one after another.  Each gets
+   a fresh environment context and menu, as a configfile would; loaded
+   modules, open disks and their caches are kept, and so are functions
+   the scripts define.  */
+static void
+grub_normal_run_batch (void)
+{
+  char *script;
+
+  while ((script = grub_emu_batch_read ()))
+    {
+      grub_err_t err;
+
+      err = grub_env_context_open ();
+      if (err == GRUB_ERR_NONE)
+	{
+	  err = grub_script_execute_sourcecode (script);
+	  if (err == GRUB_ERR_NONE)
+	    err = grub_errno;
+	  grub_print_error ();
+	  grub_errno = GRUB_ERR_NONE;
+	  grub_env_context_close ();
+	}
+      grub_free (script);
+
+      grub_print_error ();
+      grub_errno = GRUB_ERR_NONE;
+      grub_emu_batch_done (err);
+    }
+}
+#endif
+
 /* This starts the normal mode.  */
 void
 grub_enter_normal_mode (const char *config)
 {
   grub_boot_time ("Entering normal mode");
   nested_level++;
+#ifdef GRUB_MACHINE_EMU
+  if (grub_emu_batch_mode ())
+    {
+      grub_normal_execute (0, 0, 1);
+      grub_normal_run_batch ();
+      /* grub-emu shuts down and exits when "rebooted".  */
+      grub_reboot ();
+    }
+#endif
   grub_normal_execute (config, 0, 0);
   grub_boot_time ("Entering shell");
   grub_cmdline_run (0, 1);
@@ -559,6 +632,7 @@ GRUB_MOD_FINI(normal)
   grub_script_fini ();
   grub_menu_fini ();
   grub_normal_auth_fini ();
+  grub_bidi_flush_cache ();
 
   grub_xputs = grub_xputs_saved;
 
@@ -69,7 +69,8 @@ grub_wait_after_message (void)
   endtime = grub_get_time_ms () + 10000;
 
   while (grub_get_time_ms () < endtime
-	 && grub_getkey_noblock () == GRUB_TERM_NO_KEY);
+	 && grub_getkey_noblock () == GRUB_TERM_NO_KEY)
+    grub_term_idle (endtime);
 
   grub_xputs ("\n");
 }
@@ -80,12 +81,57 @@ grub_menu_get_entry (grub_menu_t menu, int no)
 {
   grub_menu_entry_t e;
 
+  if (menu->entries)
+    return (no >= 0 && no < menu->size) ? menu->entries[no] : 0;
+
   for (e = menu->entry_list; e && no > 0; e = e->next, no--)
     ;
 
   return e;
 }
 
+/* Add ENTRY at the end of MENU.  This can't fail: if the index can't
+   grow it is dropped and lookups go back to walking the list.  */
+void
+grub_menu_append_entry (grub_menu_t menu, grub_menu_entry_t entry)
+{
+  grub_menu_entry_t *last;
+
+  entry->next = 0;
+
+  if (menu->size && menu->entries)
+    last = &menu->entries[menu->size - 1]->next;
+  else
+    for (last = &menu->entry_list; *last; last = &(*last)->next)
+      ;
+  *last = entry;
+
+  if (menu->entries || ! menu->size)
+    {
+      if (menu->size == menu->entries_alloc)
+	{
+	  grub_menu_entry_t *entries;
+	  int alloc = menu->entries_alloc ? menu->entries_alloc * 2 : 32;
+
+	  entries = grub_realloc (menu->entries, alloc * sizeof (entries[0]));
+	  if (! entries)
+	    {
+	      grub_errno = GRUB_ERR_NONE;
+	      grub_free (menu->entries);
+	      menu->entries = 0;
+	      menu->entries_alloc = 0;
+	      goto out;
+	    }
+	  menu->entries = entries;
+	  menu->entries_alloc = alloc;
+	}
+      menu->entries[menu->size] = entry;
+    }
+
+ out:
+  menu->size++;
+}
+
 /* Get the index of a menu entry associated with a given hotkey, or -1.  */
 static int
 get_entry_index_by_hotkey (grub_menu_t menu, int hotkey)
@@ -572,9 +618,10 @@ print_countdown (struct grub_term_coordinate *pos, int n)
    Esc pressed to exit a sub-menu or switching menu viewers).
    If the return value is not -1, then *AUTO_BOOT is nonzero iff the menu
    entry to be executed is a result of an automatic default selection because
-   of the timeout.  */
+   of the timeout, and *QUIET is nonzero iff that happened without anything
+   having been put on the screen.  */
 static int
-run_menu (grub_menu_t menu, int nested, int *auto_boot)
+run_menu (grub_menu_t menu, int nested, int *auto_boot, int *quiet)
 {
   grub_uint64_t saved_time;
   int default_entry, current_entry;
@@ -589,6 +636,7 @@ run_menu (grub_menu_t menu, int nested, int *auto_boot)
     default_entry = 0;
 
   timeout = grub_menu_get_timeout ();
+  *quiet = (timeout == 0);
   if (timeout < 0)
     /* If there is no timeout, the "countdown" and "hidden" styles result in
        the system doing nothing and providing no or very little indication
@@ -640,6 +688,9 @@ run_menu (grub_menu_t menu, int nested, int *auto_boot)
 	  if (timeout == 0)
 	    /* We will fall through to auto-booting the default entry.  */
 	    break;
+
+	  if (key == GRUB_TERM_NO_KEY)
+	    grub_term_idle (timeout > 0 ? saved_time + 1000 : 0);
 	}
 
       grub_env_unset ("timeout");
@@ -647,6 +698,7 @@ run_menu (grub_menu_t menu, int nested, int *auto_boot)
       if (entry >= 0)
 	{
 	  *auto_boot = 0;
+	  *quiet = 0;
 	  return entry;
 	}
     }
@@ -659,6 +711,7 @@ run_menu (grub_menu_t menu, int nested, int *auto_boot)
     }
 
   current_entry = default_entry;
+  *quiet = 0;
 
  refresh:
   menu_init (current_entry, menu, nested);
@@ -800,6 +853,8 @@ run_menu (grub_menu_t menu, int nested, int *auto_boot)
 	      break;
 	    }
 	}
+      else
+	grub_term_idle (timeout > 0 ? saved_time + 1000 : 0);
     }
 
   /* Never reach here.  */
@@ -852,6 +907,21 @@ static struct grub_menu_execute_callback execution_callback =
   .notify_failure = notify_execution_failure
 };
 
+static void
+notify_booting_quiet (grub_menu_entry_t entry __attribute__((unused)),
+		      void *userdata __attribute__((unused)))
+{
+}
+
+/* Callbacks used when the default entry is booted without the menu ever
+   being shown: the screen is only touched if something goes wrong.  */
+static struct grub_menu_execute_callback quiet_execution_callback =
+{
+  .notify_booting = notify_booting_quiet,
+  .notify_fallback = notify_fallback,
+  .notify_failure = notify_execution_failure
+};
+
 static grub_err_t
 show_menu (grub_menu_t menu, int nested, int autobooted)
 {
@@ -860,8 +930,9 @@ show_menu (grub_menu_t menu, int nested, int autobooted)
       int boot_entry;
       grub_menu_entry_t e;
       int auto_boot;
+      int quiet;
 
-      boot_entry = run_menu (menu, nested, &auto_boot);
+      boot_entry = run_menu (menu, nested, &auto_boot, &quiet);
       if (boot_entry < 0)
 	break;
 
@@ -869,13 +940,23 @@ show_menu (grub_menu_t menu, int nested, int autobooted)
       if (! e)
 	continue; /* Menu is empty.  */
 
-      grub_cls ();
-
-      if (auto_boot)
+      /* With timeout=0 go straight to the default entry: clearing the
+	 screen and announcing the boot costs a full redraw on graphical
+	 terminals, for output nobody gets to see.  */
+      if (auto_boot && quiet)
 	grub_menu_execute_with_fallback (menu, e, autobooted,
-					 &execution_callback, 0);
+					 &quiet_execution_callback, 0);
+      else if (auto_boot)
+	{
+	  grub_cls ();
+	  grub_menu_execute_with_fallback (menu, e, autobooted,
+					   &execution_callback, 0);
+	}
       else
-	grub_menu_execute_entry (e, 0);
+	{
+	  grub_cls ();
+	  grub_menu_execute_entry (e, 0);
+	}
       if (autobooted)
 	break;
     }
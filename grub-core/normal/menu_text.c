@@ -41,6 +41,9 @@ struct menu_viewer_data
     TIMEOUT_TERSE,
     TIMEOUT_TERSE_NO_MARGIN
   } timeout_msg;
+  /* The timeout message on screen, if it is on a single line.  */
+  grub_uint32_t *timeout_text;
+  grub_size_t timeout_len;
   grub_menu_t menu;
   struct grub_term_output *term;
 };
@@ -430,15 +433,87 @@ grub_menu_init_page (int nested, int edit,
     - geo->entry_width - 1;
 }
 
+/* Print the timeout message MSG.  If it and the previous one each fit
+   on one line, only the cells which differ are rewritten, so that the
+   countdown costs a few characters per second on serial consoles.  */
+static void
+print_timeout_message (struct menu_viewer_data *data, const char *msg,
+		       int margin_left, int margin_right)
+{
+  grub_uint32_t *text;
+  grub_ssize_t len;
+  grub_size_t same, oldwidth, newwidth;
+  grub_ssize_t i;
+  int single_line = 1;
+
+  len = grub_strlen (msg);
+  text = grub_malloc ((len + 1) * sizeof (*text));
+  if (!text)
+    {
+      grub_errno = GRUB_ERR_NONE;
+      grub_term_gotoxy (data->term, (struct grub_term_coordinate) {
+	  0, data->geo.timeout_y });
+      grub_print_message_indented (msg, margin_left, margin_right,
+				   data->term);
+      grub_free (data->timeout_text);
+      data->timeout_text = NULL;
+      return;
+    }
+  len = grub_utf8_to_ucs4 (text, len, (const grub_uint8_t *) msg, -1, 0);
+
+  /* Leave anything which might get reordered or combined to the full
+     printing code.  */
+  for (i = 0; i < len; i++)
+    if (text[i] < ' ' || text[i] >= 0x300)
+      single_line = 0;
+  if (single_line
+      && grub_ucs4_count_lines (text, text + len, margin_left, margin_right,
+				data->term) != 1)
+    single_line = 0;
+
+  if (single_line && data->timeout_text)
+    {
+      for (same = 0; same < data->timeout_len && same < (grub_size_t) len
+	     && data->timeout_text[same] == text[same]; same++);
+
+      oldwidth = grub_getstringwidth (data->timeout_text,
+				      data->timeout_text + data->timeout_len,
+				      data->term);
+      newwidth = grub_getstringwidth (text, text + len, data->term);
+
+      grub_term_gotoxy (data->term, (struct grub_term_coordinate) {
+	  grub_getstringwidth (text, text + same, data->term),
+	  data->geo.timeout_y });
+      for (i = same; i < len; i++)
+	grub_putcode (text[i], data->term);
+      if (oldwidth > newwidth)
+	grub_print_spaces (data->term, oldwidth - newwidth);
+    }
+  else
+    {
+      grub_term_gotoxy (data->term, (struct grub_term_coordinate) {
+	  0, data->geo.timeout_y });
+      grub_print_ucs4_menu (text, text + len, margin_left, margin_right,
+			    data->term, 0, -1, 0, 0);
+    }
+
+  grub_free (data->timeout_text);
+  data->timeout_text = NULL;
+  if (single_line)
+    {
+      data->timeout_text = text;
+      data->timeout_len = len;
+    }
+  else
+    grub_free (text);
+}
+
 static void
 menu_text_print_timeout (int timeout, void *dataptr)
 {
   struct menu_viewer_data *data = dataptr;
   char *msg_translated = 0;
 
-  grub_term_gotoxy (data->term,
-		    (struct grub_term_coordinate) { 0, data->geo.timeout_y });
-
   if (data->timeout_msg == TIMEOUT_TERSE
       || data->timeout_msg == TIMEOUT_TERSE_NO_MARGIN)
     msg_translated = grub_xasprintf (_("%ds"), timeout);
@@ -465,10 +540,9 @@ menu_text_print_timeout (int timeout, void *dataptr)
 	}
     }
 
-  grub_print_message_indented (msg_translated,
-			       data->timeout_msg == TIMEOUT_TERSE_NO_MARGIN ? 0 : 3,
-			       data->timeout_msg == TIMEOUT_TERSE_NO_MARGIN ? 0 : 1,
-			       data->term);
+  print_timeout_message (data, msg_translated,
+			 data->timeout_msg == TIMEOUT_TERSE_NO_MARGIN ? 0 : 3,
+			 data->timeout_msg == TIMEOUT_TERSE_NO_MARGIN ? 0 : 1);
   grub_free (msg_translated);
 
   grub_term_gotoxy (data->term,
@@ -498,6 +572,8 @@ menu_text_set_chosen_entry (int entry, void *dataptr)
       data->first = entry;
       complete_redraw = 1;
     }
+  if (!complete_redraw && data->offset == oldoffset)
+    return;
   if (complete_redraw)
     print_entries (data->menu, data);
   else
@@ -519,6 +595,7 @@ menu_text_fini (void *dataptr)
 
   grub_term_setcursor (data->term, 1);
   grub_term_cls (data->term);
+  grub_free (data->timeout_text);
   grub_free (data);
 }
 
@@ -534,6 +611,8 @@ menu_text_clear_timeout (void *dataptr)
 	  0, data->geo.timeout_y + i });
       grub_print_spaces (data->term, grub_term_width (data->term) - 1);
     }
+  grub_free (data->timeout_text);
+  data->timeout_text = NULL;
   if (data->geo.num_entries <= 5 && !data->geo.border)
     {
       grub_term_gotoxy (data->term,
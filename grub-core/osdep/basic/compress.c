@@ -2,6 +2,16 @@
 #include <grub/util/install.h>
 #include <grub/util/misc.h>
 
+void
+grub_install_compress_begin_batch (void)
+{
+}
+
+void
+grub_install_compress_end_batch (void)
+{
+}
+
 int 
 grub_install_compress_gzip (const char *src, const char *dest)
 {
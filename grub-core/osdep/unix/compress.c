@@ -16,26 +16,96 @@
  *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <config.h>
+
 #include <grub/emu/exec.h>
 #include <grub/util/install.h>
+#include <grub/util/misc.h>
+
+#include <unistd.h>
+#include <string.h>
+#include <stdlib.h>
+
+/* A compressor started during a batch and not yet waited for.  */
+struct compress_job
+{
+  pid_t pid;
+  char *src;
+  char *dest;
+};
+
+/* Zero outside of a batch.  */
+static int max_jobs;
+static int njobs;
+static struct compress_job *jobs;
+
+static void
+finish_oldest_job (void)
+{
+  struct compress_job job = jobs[0];
+
+  njobs--;
+  memmove (jobs, jobs + 1, njobs * sizeof (jobs[0]));
+  if (grub_util_exec_wait (job.pid) != 0)
+    grub_util_error (_("can't compress `%s' to `%s'"), job.src, job.dest);
+  free (job.src);
+  free (job.dest);
+}
+
+static int
+compress_run (const char *const *argv, const char *src, const char *dest)
+{
+  if (!max_jobs)
+    return grub_util_exec_redirect (argv, src, dest);
+
+  if (njobs == max_jobs)
+    finish_oldest_job ();
+  jobs[njobs].pid = grub_util_exec_redirect_all_start (argv, src, dest, NULL);
+  jobs[njobs].src = xstrdup (src);
+  jobs[njobs].dest = xstrdup (dest);
+  njobs++;
+  return 0;
+}
+
+void
+grub_install_compress_begin_batch (void)
+{
+  long n = sysconf (_SC_NPROCESSORS_ONLN);
+
+  if (n < 1)
+    n = 1;
+  max_jobs = n;
+  njobs = 0;
+  jobs = xmalloc (max_jobs * sizeof (jobs[0]));
+}
+
+void
+grub_install_compress_end_batch (void)
+{
+  while (njobs)
+    finish_oldest_job ();
+  free (jobs);
+  jobs = NULL;
+  max_jobs = 0;
+}
 
 int 
 grub_install_compress_gzip (const char *src, const char *dest)
 {
-  return grub_util_exec_redirect ((const char * []) { "gzip", "--best",
+  return compress_run ((const char * []) { "gzip", "--best",
 	"--stdout", NULL }, src, dest);
 }
 
 int 
 grub_install_compress_xz (const char *src, const char *dest)
 {
-  return grub_util_exec_redirect ((const char * []) { "xz",
+  return compress_run ((const char * []) { "xz",
 	"--lzma2=dict=128KiB", "--check=none", "--stdout", NULL }, src, dest);
 }
 
 int 
 grub_install_compress_lzop (const char *src, const char *dest)
 {
-  return grub_util_exec_redirect ((const char * []) { "lzop", "-9",  "-c",
+  return compress_run ((const char * []) { "lzop", "-9",  "-c",
 	NULL }, src, dest);
 }
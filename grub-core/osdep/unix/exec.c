@@ -33,12 +33,13 @@
 #include <string.h>
 #include <sys/wait.h>
 
-int
-grub_util_exec_redirect_all (const char *const *argv, const char *stdin_file,
-			     const char *stdout_file, const char *stderr_file)
+pid_t
+grub_util_exec_redirect_all_start (const char *const *argv,
+				   const char *stdin_file,
+				   const char *stdout_file,
+				   const char *stderr_file)
 {
   pid_t pid;
-  int status = -1;
   char *str, *pstr;
   const char *const *ptr;
   grub_size_t strl = 0;
@@ -128,12 +129,30 @@ grub_util_exec_redirect_all (const char *const *argv, const char *stdin_file,
       execvp ((char *) argv[0], (char **) argv);
       exit (127);
     }
+  return pid;
+}
+
+int
+grub_util_exec_wait (pid_t pid)
+{
+  int status = -1;
+
   waitpid (pid, &status, 0);
   if (!WIFEXITED (status))
     return -1;
   return WEXITSTATUS (status);
 }
 
+int
+grub_util_exec_redirect_all (const char *const *argv, const char *stdin_file,
+			     const char *stdout_file, const char *stderr_file)
+{
+  return grub_util_exec_wait (grub_util_exec_redirect_all_start (argv,
+								 stdin_file,
+								 stdout_file,
+								 stderr_file));
+}
+
 int
 grub_util_exec (const char *const *argv)
 {
@@ -105,6 +105,79 @@ struct embed_signature embed_signatures[] =
   };
 #endif
 
+/* Walking the chain of extended boot records costs a read per logical
+   partition, and every device walk iterates every disk again.  Remember the
+   partitions found on each disk, checked against the MBR they came from.  */
+struct msdos_cache
+{
+  struct msdos_cache *next;
+  enum grub_disk_dev_id dev_id;
+  unsigned long disk_id;
+  grub_disk_addr_t start;
+  grub_disk_addr_t delta;
+  struct grub_msdos_partition_mbr mbr;
+  unsigned nparts;
+  struct grub_partition *parts;
+};
+
+static struct msdos_cache *msdos_cache;
+static unsigned long msdos_cache_generation;
+
+static void
+msdos_cache_flush (void)
+{
+  struct msdos_cache *c, *next;
+
+  for (c = msdos_cache; c; c = next)
+    {
+      next = c->next;
+      grub_free (c->parts);
+      grub_free (c);
+    }
+  msdos_cache = 0;
+  msdos_cache_generation = grub_disk_generation;
+}
+
+static struct msdos_cache *
+msdos_cache_find (grub_disk_t disk, grub_disk_addr_t delta,
+		  const struct grub_msdos_partition_mbr *mbr)
+{
+  struct msdos_cache *c;
+
+  if (msdos_cache_generation != grub_disk_generation)
+    msdos_cache_flush ();
+
+  for (c = msdos_cache; c; c = c->next)
+    if (c->dev_id == disk->dev->id && c->disk_id == disk->id
+	&& c->start == grub_partition_get_start (disk->partition)
+	&& c->delta == delta
+	&& grub_memcmp (&c->mbr, mbr, sizeof (*mbr)) == 0)
+      return c;
+  return 0;
+}
+
+/* Append P to the partitions being collected in C.  */
+static int
+msdos_cache_record (struct msdos_cache *c, unsigned *alloc,
+		    const struct grub_partition *p)
+{
+  if (c->nparts == *alloc)
+    {
+      struct grub_partition *n;
+
+      n = grub_realloc (c->parts, sizeof (n[0]) * (*alloc ? 2 * *alloc : 8));
+      if (!n)
+	{
+	  grub_errno = GRUB_ERR_NONE;
+	  return 0;
+	}
+      c->parts = n;
+      *alloc = *alloc ? 2 * *alloc : 8;
+    }
+  c->parts[c->nparts++] = *p;
+  return 1;
+}
+
 grub_err_t
 grub_partition_msdos_iterate (grub_disk_t disk,
 			      grub_partition_iterate_hook_t hook,
@@ -116,6 +189,9 @@ grub_partition_msdos_iterate (grub_disk_t disk,
   grub_disk_addr_t lastaddr;
   grub_disk_addr_t ext_offset;
   grub_disk_addr_t delta = 0;
+  struct msdos_cache *cache;
+  unsigned alloc = 0;
+  int stopped = 0, cacheable = 1;
 
   if (disk->partition && disk->partition->partmap == &grub_msdos_partition_map)
     {
@@ -125,6 +201,38 @@ grub_partition_msdos_iterate (grub_disk_t disk,
 	return grub_error (GRUB_ERR_BAD_PART_TABLE, "no embedding supported");
     }
 
+  if (grub_disk_read (disk, 0, 0, sizeof (mbr), &mbr))
+    return grub_errno;
+
+  cache = msdos_cache_find (disk, delta, &mbr);
+  if (cache)
+    {
+      unsigned i;
+
+      for (i = 0; i < cache->nparts; i++)
+	{
+	  p = cache->parts[i];
+	  if (hook (disk, &p, hook_data))
+	    return grub_errno;
+	}
+      return GRUB_ERR_NONE;
+    }
+
+  cache = grub_zalloc (sizeof (*cache));
+  if (!cache)
+    {
+      grub_errno = GRUB_ERR_NONE;
+      cacheable = 0;
+    }
+  else
+    {
+      cache->dev_id = disk->dev->id;
+      cache->disk_id = disk->id;
+      cache->start = grub_partition_get_start (disk->partition);
+      cache->delta = delta;
+      grub_memcpy (&cache->mbr, &mbr, sizeof (mbr));
+    }
+
   p.offset = 0;
   ext_offset = 0;
   p.number = -1;
@@ -139,15 +247,18 @@ grub_partition_msdos_iterate (grub_disk_t disk,
       int i;
       struct grub_msdos_partition_entry *e;
 
-      /* Read the MBR.  */
-      if (grub_disk_read (disk, p.offset, 0, sizeof (mbr), &mbr))
+      /* Read the MBR, the first one has been read already.  */
+      if (labeln && grub_disk_read (disk, p.offset, 0, sizeof (mbr), &mbr))
 	goto finish;
 
       /* If this is a GPT partition, this MBR is just a dummy.  */
       if (p.offset == 0)
 	for (i = 0; i < 4; i++)
 	  if (mbr.entries[i].type == GRUB_PC_PARTITION_TYPE_GPT_DISK)
-	    return grub_error (GRUB_ERR_BAD_PART_TABLE, "dummy mbr");
+	    {
+	      grub_error (GRUB_ERR_BAD_PART_TABLE, "dummy mbr");
+	      goto finish;
+	    }
 
       /* This is our loop-detection algorithm. It works the following way:
 	 It saves last position which was a power of two. Then it compares the
@@ -155,7 +266,10 @@ grub_partition_msdos_iterate (grub_disk_t disk,
 	 will be broken by at most third walk.
        */
       if (labeln && lastaddr == p.offset)
-	return grub_error (GRUB_ERR_BAD_PART_TABLE, "loop detected");
+	{
+	  grub_error (GRUB_ERR_BAD_PART_TABLE, "loop detected");
+	  goto finish;
+	}
 
       labeln++;
       if ((labeln & (labeln - 1)) == 0)
@@ -163,11 +277,17 @@ grub_partition_msdos_iterate (grub_disk_t disk,
 
       /* Check if it is valid.  */
       if (mbr.signature != grub_cpu_to_le16_compile_time (GRUB_PC_PARTITION_SIGNATURE))
-	return grub_error (GRUB_ERR_BAD_PART_TABLE, "no signature");
+	{
+	  grub_error (GRUB_ERR_BAD_PART_TABLE, "no signature");
+	  goto finish;
+	}
 
       for (i = 0; i < 4; i++)
 	if (mbr.entries[i].flag & 0x7f)
-	  return grub_error (GRUB_ERR_BAD_PART_TABLE, "bad boot flag");
+	  {
+	    grub_error (GRUB_ERR_BAD_PART_TABLE, "bad boot flag");
+	    goto finish;
+	  }
 
       /* Analyze DOS partitions.  */
       for (p.index = 0; p.index < 4; p.index++)
@@ -193,8 +313,17 @@ grub_partition_msdos_iterate (grub_disk_t disk,
 	    {
 	      p.number++;
 
-	      if (hook (disk, &p, hook_data))
-		return grub_errno;
+	      if (cacheable)
+		cacheable = msdos_cache_record (cache, &alloc, &p);
+
+	      /* Once the hook is done, only carry on to complete the cache
+		 entry.  */
+	      if (!stopped && hook (disk, &p, hook_data))
+		{
+		  if (grub_errno || !cacheable)
+		    goto finish;
+		  stopped = 1;
+		}
 	    }
 	  else if (p.number < 3)
 	    /* If this partition is a logical one, shouldn't increase the
@@ -225,6 +354,21 @@ grub_partition_msdos_iterate (grub_disk_t disk,
     }
 
  finish:
+  if (cacheable && grub_errno == GRUB_ERR_NONE)
+    {
+      cache->next = msdos_cache;
+      msdos_cache = cache;
+    }
+  else if (cache)
+    {
+      grub_free (cache->parts);
+      grub_free (cache);
+    }
+
+  /* The hook never sees what lies past the partition it stopped at, so
+     neither do errors from there.  */
+  if (stopped)
+    grub_errno = GRUB_ERR_NONE;
   return grub_errno;
 }
 
@@ -428,4 +572,5 @@ GRUB_MOD_INIT(part_msdos)
 GRUB_MOD_FINI(part_msdos)
 {
   grub_partition_map_unregister (&grub_msdos_partition_map);
+  msdos_cache_flush ();
 }
@@ -43,19 +43,15 @@ round_up_exp (unsigned v)
 void
 grub_script_argv_free (struct grub_script_argv *argv)
 {
-  unsigned i;
-
-  if (argv->args)
-    {
-      for (i = 0; i < argv->argc; i++)
-	grub_free (argv->args[i]);
-
-      grub_free (argv->args);
-    }
+  /* The strings themselves all live in the arena.  */
+  grub_free (argv->args);
+  grub_arena_destroy (argv->arena);
 
   argv->argc = 0;
   argv->args = 0;
   argv->script = 0;
+  argv->arena = 0;
+  argv->last_len = 0;
 }
 
 /* Make argv from argc, args pair.  */
@@ -63,7 +59,7 @@ int
 grub_script_argv_make (struct grub_script_argv *argv, int argc, char **args)
 {
   int i;
-  struct grub_script_argv r = { 0, 0, 0 };
+  struct grub_script_argv r = { 0, 0, 0, 0, 0 };
 
   for (i = 0; i < argc; i++)
     if (grub_script_argv_next (&r)
@@ -85,12 +81,20 @@ grub_script_argv_next (struct grub_script_argv *argv)
   if (argv->args && argv->argc && argv->args[argv->argc - 1] == 0)
     return 0;
 
+  if (! argv->arena)
+    {
+      argv->arena = grub_arena_create (0);
+      if (! argv->arena)
+	return 1;
+    }
+
   p = grub_realloc (p, round_up_exp ((argv->argc + 2) * sizeof (char *)));
   if (! p)
     return 1;
 
   argv->argc++;
   argv->args = p;
+  argv->last_len = 0;
 
   if (argv->argc == 1)
     argv->args[0] = 0;
@@ -98,26 +102,56 @@ grub_script_argv_next (struct grub_script_argv *argv)
   return 0;
 }
 
+/* Make room for up to `len' more bytes at the end of the last argument
+   and return where they go.  grub_script_argv_commit finishes the append,
+   so callers can escape or otherwise rewrite straight into the argument.  */
+char *
+grub_script_argv_reserve (struct grub_script_argv *argv, grub_size_t len)
+{
+  grub_size_t a = argv->last_len;
+  char *p = argv->args[argv->argc - 1];
+
+  /* Successive appends to the last argument are normally the most recent
+     arena allocation and grow in place.  */
+  p = grub_arena_realloc (argv->arena, p, p ? a + 1 : 0, a + len + 1);
+  if (! p)
+    return 0;
+
+  argv->args[argv->argc - 1] = p;
+  return p + a;
+}
+
+/* Record that `len' bytes were written at the place returned by the last
+   grub_script_argv_reserve.  */
+void
+grub_script_argv_commit (struct grub_script_argv *argv, grub_size_t len)
+{
+  char *p = argv->args[argv->argc - 1];
+
+  argv->last_len += len;
+  p[argv->last_len] = 0;
+
+  /* P is the most recent arena allocation, so this only gives back the
+     part of the reservation that wasn't used.  */
+  grub_arena_realloc (argv->arena, p, argv->last_len + 1, argv->last_len + 1);
+}
+
 /* Append `s' to the last argument.  */
 int
 grub_script_argv_append (struct grub_script_argv *argv, const char *s,
 			 grub_size_t slen)
 {
-  grub_size_t a;
-  char *p = argv->args[argv->argc - 1];
+  char *p;
 
   if (! s)
     return 0;
 
-  a = p ? grub_strlen (p) : 0;
-
-  p = grub_realloc (p, round_up_exp ((a + slen + 1) * sizeof (char)));
+  p = grub_script_argv_reserve (argv, slen);
   if (! p)
     return 1;
 
-  grub_memcpy (p + a, s, slen);
-  p[a+slen] = 0;
-  argv->args[argv->argc - 1] = p;
+  grub_memcpy (p, s, slen);
+  grub_script_argv_commit (argv, slen);
 
   return 0;
 }
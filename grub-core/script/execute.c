@@ -53,55 +53,6 @@ static struct grub_script_scope *scope = 0;
 /* Wildcard translator for GRUB script.  */
 struct grub_script_wildcard_translator *grub_wildcard_translator;
 
-static char*
-wildcard_escape (const char *s)
-{
-  int i;
-  int len;
-  char ch;
-  char *p;
-
-  len = grub_strlen (s);
-  p = grub_malloc (len * 2 + 1);
-  if (! p)
-    return NULL;
-
-  i = 0;
-  while ((ch = *s++))
-    {
-      if (ch == '*' || ch == '\\' || ch == '?')
-	p[i++] = '\\';
-      p[i++] = ch;
-    }
-  p[i] = '\0';
-  return p;
-}
-
-static char*
-wildcard_unescape (const char *s)
-{
-  int i;
-  int len;
-  char ch;
-  char *p;
-
-  len = grub_strlen (s);
-  p = grub_malloc (len + 1);
-  if (! p)
-    return NULL;
-
-  i = 0;
-  while ((ch = *s++))
-    {
-      if (ch == '\\')
-	p[i++] = *s++;
-      else
-	p[i++] = ch;
-    }
-  p[i] = '\0';
-  return p;
-}
-
 static void
 replace_scope (struct grub_script_scope *new_scope)
 {
@@ -187,7 +138,7 @@ grub_script_setparams (grub_command_t cmd __attribute__((unused)),
 		       int argc, char **args)
 {
   struct grub_script_scope *new_scope;
-  struct grub_script_argv argv = { 0, 0, 0 };
+  struct grub_script_argv argv = { 0, 0, 0, 0, 0 };
 
   if (! scope)
     return GRUB_ERR_INVALID_COMMAND;
@@ -259,17 +210,18 @@ grub_env_special (const char *name)
 }
 
 static char **
-grub_script_env_get (const char *name, grub_script_arg_type_t type)
+grub_script_env_get (const char *name, grub_uint32_t hash,
+		     grub_script_arg_type_t type)
 {
   unsigned i;
-  struct grub_script_argv result = { 0, 0, 0 };
+  struct grub_script_argv result = { 0, 0, 0, 0, 0 };
 
   if (grub_script_argv_next (&result))
     goto fail;
 
   if (! grub_env_special (name))
     {
-      const char *v = grub_env_get (name);
+      const char *v = grub_env_get_hashed (name, hash);
       if (v && v[0])
 	{
 	  if (type == GRUB_SCRIPT_ARG_TYPE_VAR)
@@ -535,6 +487,41 @@ gettext_getlen (const char *str, grub_size_t len,
   return 0;
 }
 
+/* Append S to the last argument of RESULT, escaping wildcard characters
+   if ESCAPE_TYPE is positive and removing such escapes if it is negative.
+   Escaping is done straight into the argument.  */
+static int
+append (struct grub_script_argv *result,
+	const char *s, int escape_type)
+{
+  grub_size_t len = grub_strlen (s);
+  char *p, *op;
+  char ch;
+
+  if (escape_type == 0)
+    return grub_script_argv_append (result, s, len);
+
+  p = grub_script_argv_reserve (result, escape_type > 0 ? len * 2 : len);
+  if (! p)
+    return 1;
+
+  op = p;
+  while ((ch = *s++))
+    {
+      if (escape_type > 0)
+	{
+	  if (ch == '*' || ch == '\\' || ch == '?')
+	    *op++ = '\\';
+	}
+      else if (ch == '\\' && *s)
+	ch = *s++;
+      *op++ = ch;
+    }
+
+  grub_script_argv_commit (result, op - p);
+  return 0;
+}
+
 static int
 gettext_append (struct grub_script_argv *result, const char *orig_str)
 {
@@ -570,14 +557,8 @@ gettext_append (struct grub_script_argv *result, const char *orig_str)
   if (parse_string (template, gettext_putvar, &ctx, res))
     goto fail;
 
-  char *escaped = 0;
-  escaped = wildcard_escape (res);
-  if (grub_script_argv_append (result, escaped, grub_strlen (escaped)))
-    {
-      grub_free (escaped);
-      goto fail;
-    }
-  grub_free (escaped);
+  if (append (result, res, 1))
+    goto fail;
 
   rval = 0;
  fail:
@@ -591,29 +572,6 @@ gettext_append (struct grub_script_argv *result, const char *orig_str)
   return rval;
 }
 
-static int
-append (struct grub_script_argv *result,
-	const char *s, int escape_type)
-{
-  int r;
-  char *p = 0;
-
-  if (escape_type == 0)
-    return grub_script_argv_append (result, s, grub_strlen (s));
-
-  if (escape_type > 0)
-    p = wildcard_escape (s);
-  else if (escape_type < 0)
-    p = wildcard_unescape (s);
-
-  if (! p)
-    return 1;
-
-  r = grub_script_argv_append (result, p, grub_strlen (p));
-  grub_free (p);
-  return r;
-}
-
 /* Convert arguments in ARGLIST into ARGV form.  */
 static int
 grub_script_arglist_to_argv (struct grub_script_arglist *arglist,
@@ -622,7 +580,7 @@ grub_script_arglist_to_argv (struct grub_script_arglist *arglist,
   int i;
   char **values = 0;
   struct grub_script_arg *arg = 0;
-  struct grub_script_argv result = { 0, 0, 0 };
+  struct grub_script_argv result = { 0, 0, 0, 0, 0 };
 
   for (; arglist && arglist->arg; arglist = arglist->next)
     {
@@ -639,7 +597,8 @@ grub_script_arglist_to_argv (struct grub_script_arglist *arglist,
 	      {
 		int need_cleanup = 0;
 
-		values = grub_script_env_get (arg->str, arg->type);
+		values = grub_script_env_get (arg->str, arg->hash,
+					      arg->type);
 		for (i = 0; values && values[i]; i++)
 		  {
 		    if (!need_cleanup)
@@ -652,7 +611,7 @@ grub_script_arglist_to_argv (struct grub_script_arglist *arglist,
 
 			if (arg->type == GRUB_SCRIPT_ARG_TYPE_VAR)
 			  {
-			    int len;
+			    grub_size_t len;
 			    char ch;
 			    char *p;
 			    char *op;
@@ -662,7 +621,7 @@ grub_script_arglist_to_argv (struct grub_script_arglist *arglist,
 			    /* \? -> \\\? */
 			    /* \* -> \\\* */
 			    /* \ -> \\ */
-			    p = grub_malloc (len * 2 + 1);
+			    p = grub_script_argv_reserve (&result, len * 2);
 			    if (! p)
 			      {
 				need_cleanup = 1;
@@ -680,14 +639,7 @@ grub_script_arglist_to_argv (struct grub_script_arglist *arglist,
 				  }
 				*op++ = ch;
 			      }
-			    *op = '\0';
-
-			    if (grub_script_argv_append (&result, p, op - p))
-			      {
-				grub_free (p);
-				need_cleanup = 1;
-				/* Fall through to cleanup */
-			      }
+			    grub_script_argv_commit (&result, op - p);
 			  }
 			else
 			  {
@@ -710,19 +662,10 @@ cleanup:
 
 	    case GRUB_SCRIPT_ARG_TYPE_BLOCK:
 	      {
-		char *p;
 		if (grub_script_argv_append (&result, "{", 1))
 		  goto fail;
-		p = wildcard_escape (arg->str);
-		if (!p)
+		if (append (&result, arg->str, 1))
 		  goto fail;
-		if (grub_script_argv_append (&result, p,
-					     grub_strlen (p)))
-		  {
-		    grub_free (p);
-		    goto fail;
-		  }
-		grub_free (p);
 		if (grub_script_argv_append (&result, "}", 1))
 		  goto fail;
 	      }
@@ -764,6 +707,8 @@ cleanup:
 
   result.argc = 0;
   result.args = 0;
+  result.arena = 0;
+  result.last_len = 0;
   for (i = 0; unexpanded.args[i]; i++)
     {
       char **expansions = 0;
@@ -875,35 +820,261 @@ grub_script_execute_sourcecode_getline (char **line,
   return 0;
 }
 
-/* Execute a source script.  */
-grub_err_t
-grub_script_execute_sourcecode (const char *source)
+/* Sources parsed before, most recently used first.  The statements of a
+   grub.cfg or a submenu are kept parsed, so running the same text again
+   only has to compare it.  */
+#define SOURCE_CACHE_SIZE 8
+
+struct grub_script_source_stmt
+{
+  /* The parsed statement, or NULL if it has to be parsed again each time
+     because parsing it defines functions or fails.  */
+  struct grub_script *script;
+  /* Offset of the next statement, past the end for the last one.  */
+  grub_size_t next;
+};
+
+struct grub_script_source
+{
+  struct grub_script_source *next;
+  char *name;
+  char *text;
+  grub_size_t len;
+  struct grub_script_source_stmt *stmts;
+  grub_size_t n_stmts, alloc_stmts;
+  /* Number of runs in progress.  */
+  unsigned users;
+};
+
+static struct grub_script_source *source_cache;
+
+static void
+source_free (struct grub_script_source *src)
+{
+  grub_size_t i;
+
+  for (i = 0; i < src->n_stmts; i++)
+    grub_script_free (src->stmts[i].script);
+  grub_free (src->stmts);
+  grub_free (src->name);
+  grub_free (src->text);
+  grub_free (src);
+}
+
+static struct grub_script_source *
+source_find (const char *name, const char *text, grub_size_t len)
+{
+  struct grub_script_source *src, **prev;
+
+  for (prev = &source_cache; *prev; prev = &(*prev)->next)
+    {
+      src = *prev;
+      if (src->len == len
+	  && (name ? src->name && grub_strcmp (src->name, name) == 0
+	      : !src->name)
+	  && grub_memcmp (src->text, text, len) == 0)
+	{
+	  *prev = src->next;
+	  src->next = source_cache;
+	  source_cache = src;
+	  return src;
+	}
+    }
+  return NULL;
+}
+
+static void
+source_insert (struct grub_script_source *src)
+{
+  struct grub_script_source **prev;
+  unsigned n = 0;
+
+  src->next = source_cache;
+  source_cache = src;
+
+  /* Drop the least recently used sources which are not running.  */
+  for (prev = &source_cache; *prev; )
+    {
+      struct grub_script_source *cur = *prev;
+
+      if (++n > SOURCE_CACHE_SIZE && !cur->users)
+	{
+	  *prev = cur->next;
+	  source_free (cur);
+	  continue;
+	}
+      prev = &cur->next;
+    }
+}
+
+static grub_err_t
+source_add_stmt (struct grub_script_source *src, struct grub_script *script,
+		 const char *cursor)
+{
+  struct grub_script_source_stmt *stmt;
+
+  if (src->n_stmts == src->alloc_stmts)
+    {
+      struct grub_script_source_stmt *new_stmts;
+
+      src->alloc_stmts = src->alloc_stmts ? 2 * src->alloc_stmts : 32;
+      new_stmts = grub_realloc (src->stmts,
+				src->alloc_stmts * sizeof (src->stmts[0]));
+      if (!new_stmts)
+	return grub_errno;
+      src->stmts = new_stmts;
+    }
+
+  stmt = &src->stmts[src->n_stmts++];
+  stmt->script = script;
+  stmt->next = cursor ? (grub_size_t) (cursor - src->text) : src->len + 1;
+  return GRUB_ERR_NONE;
+}
+
+/* Run the statements of SOURCE one by one.  With KEEP_GOING, report the
+   error of each statement and go on with the next, as for a config
+   file; otherwise stop at the first one that can't be parsed.  NAME
+   identifies where SOURCE was read from, if anywhere.  */
+/* Number of sources being run, nested ones included.  */
+static unsigned source_depth;
+
+static grub_err_t
+execute_source (const char *name, const char *source, int keep_going)
 {
   grub_err_t ret = 0;
+  grub_size_t len = grub_strlen (source);
+  struct grub_script_source *src;
   struct grub_script *parsed_script;
+  const char *cursor;
+  grub_size_t i = 0;
+  int cached, complete = 1;
+
+  if (source_depth++ == 0 && grub_wildcard_translator
+      && grub_wildcard_translator->begin)
+    grub_wildcard_translator->begin ();
+
+  src = source_find (name, source, len);
+  cached = (src != NULL);
+  if (!src)
+    {
+      src = grub_zalloc (sizeof (*src));
+      if (src)
+	{
+	  src->len = len;
+	  src->text = grub_strdup (source);
+	  src->name = name ? grub_strdup (name) : NULL;
+	  if (!src->text || (name && !src->name))
+	    {
+	      source_free (src);
+	      src = NULL;
+	    }
+	}
+      if (!src)
+	{
+	  /* Just run it without keeping it.  */
+	  grub_errno = GRUB_ERR_NONE;
+	  complete = 0;
+	}
+    }
+  if (src)
+    {
+      src->users++;
+      source = src->text;
+    }
 
-  while (source)
+  cursor = source;
+  while (cursor)
     {
       char *line;
+      unsigned long functions = grub_script_function_changes;
+
+      if (keep_going)
+	{
+	  /* Print an error, if any.  */
+	  grub_print_error ();
+	  grub_errno = GRUB_ERR_NONE;
+	}
+
+      if (cached && src->stmts[i].script)
+	{
+	  ret = grub_script_execute (src->stmts[i].script);
+	  cursor = (src->stmts[i].next <= src->len
+		    ? src->text + src->stmts[i].next : NULL);
+	  i++;
+	  continue;
+	}
 
-      grub_script_execute_sourcecode_getline (&line, 0, &source);
+      grub_script_execute_sourcecode_getline (&line, 0, &cursor);
       parsed_script = grub_script_parse
-	(line, grub_script_execute_sourcecode_getline, &source);
+	(line, grub_script_execute_sourcecode_getline, &cursor);
+
+      if (cached)
+	i++;
+      else if (complete
+	       && source_add_stmt (src, (parsed_script
+					 && functions
+					    == grub_script_function_changes)
+				   ? parsed_script : NULL, cursor))
+	{
+	  complete = 0;
+	  grub_errno = GRUB_ERR_NONE;
+	}
+
       if (! parsed_script)
 	{
 	  ret = grub_errno;
 	  grub_free (line);
+	  if (keep_going)
+	    continue;
+	  complete = 0;
 	  break;
 	}
 
       ret = grub_script_execute (parsed_script);
-      grub_script_free (parsed_script);
+      if (cached || !complete || src->stmts[src->n_stmts - 1].script == NULL)
+	grub_script_free (parsed_script);
       grub_free (line);
     }
 
+  if (keep_going)
+    {
+      grub_print_error ();
+      grub_errno = GRUB_ERR_NONE;
+    }
+
+  if (src)
+    {
+      src->users--;
+      if (!cached)
+	{
+	  if (complete)
+	    source_insert (src);
+	  else
+	    source_free (src);
+	}
+    }
+
+  if (--source_depth == 0 && grub_wildcard_translator
+      && grub_wildcard_translator->end)
+    grub_wildcard_translator->end ();
+
   return ret;
 }
 
+/* Execute a source script.  */
+grub_err_t
+grub_script_execute_sourcecode (const char *source)
+{
+  return execute_source (NULL, source, 0);
+}
+
+/* Execute the config file NAME, whose lines are in SOURCE.  */
+grub_err_t
+grub_script_execute_config (const char *name, const char *source)
+{
+  return execute_source (name, source, 1);
+}
+
 /* Execute a source script in new scope.  */
 grub_err_t
 grub_script_execute_new_scope (const char *source, int argc, char **args)
@@ -939,7 +1110,8 @@ grub_script_execute_cmdline (struct grub_script_cmd *cmd)
   unsigned int i;
   char **args;
   int invert;
-  struct grub_script_argv argv = { 0, 0, 0 };
+  struct grub_script_argv argv = { 0, 0, 0, 0, 0 };
+  grub_boot_span_t span;
 
   /* Lookup the command.  */
   if (grub_script_arglist_to_argv (cmdline->arglist, &argv) || ! argv.args[0])
@@ -1018,6 +1190,7 @@ grub_script_execute_cmdline (struct grub_script_cmd *cmd)
     }
 
   /* Execute the GRUB command or function.  */
+  span = grub_boot_span_begin ("Command %s", cmdname);
   if (grubcmd)
     {
       if (grub_extractor_level && !(grubcmd->flags
@@ -1033,6 +1206,7 @@ grub_script_execute_cmdline (struct grub_script_cmd *cmd)
     }
   else
     ret = grub_script_function_call (func, argc, args);
+  grub_boot_span_end (span, 0);
 
   if (invert)
     {
@@ -1114,7 +1288,7 @@ grub_script_execute_cmdfor (struct grub_script_cmd *cmd)
 {
   unsigned i;
   grub_err_t result;
-  struct grub_script_argv argv = { 0, 0, 0 };
+  struct grub_script_argv argv = { 0, 0, 0, 0, 0 };
   struct grub_script_cmdfor *cmdfor = (struct grub_script_cmdfor *) cmd;
 
   if (grub_script_arglist_to_argv (cmdfor->words, &argv))
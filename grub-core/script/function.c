@@ -24,6 +24,9 @@
 
 grub_script_function_t grub_script_function_list;
 
+/* Bumped whenever a function is defined, which happens while parsing.  */
+unsigned long grub_script_function_changes;
+
 grub_script_function_t
 grub_script_function_create (struct grub_script_arg *functionname_arg,
 			     struct grub_script *cmd)
@@ -43,6 +46,7 @@ grub_script_function_create (struct grub_script_arg *functionname_arg,
     }
 
   func->func = cmd;
+  grub_script_function_changes++;
 
   /* Keep the list sorted for simplicity.  */
   p = &grub_script_function_list;
@@ -21,6 +21,7 @@
 #include <grub/script_sh.h>
 #include <grub/parser.h>
 #include <grub/mm.h>
+#include <grub/env.h>
 
 /* It is not possible to deallocate the memory when a syntax error was
    found.  Because of that it is required to keep track of all memory
@@ -139,6 +140,9 @@ grub_script_arg_add (struct grub_parser_param *state,
     return arg; /* argpart is freed later, during grub_script_free.  */
 
   grub_memcpy (argpart->str, str, len);
+  argpart->hash = 0;
+  if (type == GRUB_SCRIPT_ARG_TYPE_VAR || type == GRUB_SCRIPT_ARG_TYPE_DQVAR)
+    argpart->hash = grub_env_hash (argpart->str);
   argpart->next = 0;
 
   if (!arg)
@@ -34,6 +34,16 @@ static int f0_received = 0;
 
 static grub_uint8_t led_status;
 
+/* The controller is not polled again before NEXT_POLL.  While bytes come
+   in it is polled on every call, to get whole scancode sequences; while
+   idle the interval doubles up to AT_POLL_MAX_INTERVAL ms.  The
+   keyboard buffers its bytes until the controller's output buffer is
+   read, so none are lost meanwhile.  */
+#define AT_POLL_MAX_INTERVAL	8
+static grub_uint64_t next_poll;
+static unsigned poll_interval;
+static int byte_received;
+
 #define KEYBOARD_LED_SCROLL		(1 << 0)
 #define KEYBOARD_LED_NUM		(1 << 1)
 #define KEYBOARD_LED_CAPS		(1 << 2)
@@ -396,6 +406,7 @@ fetch_key (int *is_break)
   if (! KEYBOARD_ISREADY (grub_inb (KEYBOARD_REG_STATUS)))
     return -1;
   at_key = grub_inb (KEYBOARD_REG_DATA);
+  byte_received = 1;
   /* May happen if no keyboard is connected. Just ignore this.  */
   if (at_key == 0xff)
     return -1;
@@ -567,11 +578,24 @@ static int
 grub_at_keyboard_getkey (struct grub_term_input *term __attribute__ ((unused)))
 {
   int code;
+  grub_uint64_t now;
 
-  if (!grub_at_keyboard_is_alive ())
+  now = grub_get_time_ms ();
+  if (now < next_poll)
     return GRUB_TERM_NO_KEY;
 
-  code = grub_keyboard_getkey ();
+  byte_received = 0;
+  code = -1;
+  if (grub_at_keyboard_is_alive ())
+    code = grub_keyboard_getkey ();
+
+  if (byte_received)
+    poll_interval = 0;
+  else
+    poll_interval = poll_interval
+      ? grub_min (2 * poll_interval, AT_POLL_MAX_INTERVAL) : 1;
+  next_poll = now + poll_interval;
+
   if (code == -1)
     return GRUB_TERM_NO_KEY;
 #ifdef DEBUG_AT_KEYBOARD
@@ -607,6 +631,13 @@ grub_at_keyboard_getkey (struct grub_term_input *term __attribute__ ((unused)))
     }
 }
 
+/* The modifiers as of the last poll; the hardware is not asked.  */
+static int
+grub_at_keyboard_getkeystatus (struct grub_term_input *term __attribute__ ((unused)))
+{
+  return at_keyboard_status;
+}
+
 static void
 grub_keyboard_controller_init (void)
 {
@@ -669,6 +700,7 @@ grub_at_restore_hw (void)
     }
   set_scancodes ();
   keyboard_controller_led (led_status);
+  next_poll = 0;
 
   return GRUB_ERR_NONE;
 }
@@ -678,7 +710,8 @@ static struct grub_term_input grub_at_keyboard_term =
   {
     .name = "at_keyboard",
     .fini = grub_keyboard_controller_fini,
-    .getkey = grub_at_keyboard_getkey
+    .getkey = grub_at_keyboard_getkey,
+    .getkeystatus = grub_at_keyboard_getkeystatus
   };
 
 GRUB_MOD_INIT(at_keyboard)
@@ -18,6 +18,7 @@
 
 #include <grub/term.h>
 #include <grub/misc.h>
+#include <grub/mm.h>
 #include <grub/types.h>
 #include <grub/err.h>
 #include <grub/efi/efi.h>
@@ -65,6 +66,115 @@ map_char (grub_uint32_t c)
   return c;
 }
 
+/* Text is handed to the firmware in runs of characters which follow
+   each other on a row and share an attribute, as some firmware consoles
+   take milliseconds per call.  Moving the cursor and changing colors is
+   deferred until something is actually written.  A copy of the screen
+   is kept too, so that rewriting a cell with what it already shows, as
+   menu redraws mostly do, costs nothing.  */
+#define GRUB_CONSOLE_RUN_MAX	128
+#define GRUB_CONSOLE_CELL_UNKNOWN	0xffffffff
+
+/* Where GRUB believes the cursor is and the attribute it selected.  */
+static int logical_valid;
+static struct grub_term_coordinate logical_pos;
+static grub_efi_int32_t logical_attr;
+static grub_efi_uintn_t columns, rows;
+
+/* Characters not yet given to the firmware, which go at RUN_POS.  */
+static grub_efi_char16_t run[GRUB_CONSOLE_RUN_MAX + 1];
+static unsigned run_len;
+static struct grub_term_coordinate run_pos;
+static grub_efi_int32_t run_attr;
+
+/* The screen contents as attribute << 16 | character, and where our
+   last output left the firmware cursor.  */
+static grub_uint32_t *screen;
+static grub_efi_int32_t expected_column, expected_row;
+
+static struct grub_term_coordinate grub_console_getwh (struct grub_term_output *term);
+
+static void
+forget_screen (void)
+{
+  grub_free (screen);
+  screen = NULL;
+}
+
+static void
+load_logical (grub_efi_simple_text_output_interface_t *o)
+{
+  if (logical_valid)
+    return;
+
+  grub_console_getwh (NULL);
+  logical_pos.x = o->mode->cursor_column;
+  logical_pos.y = o->mode->cursor_row;
+  logical_attr = o->mode->attribute;
+  logical_valid = 1;
+}
+
+/* Put the firmware cursor at POS and select ATTR.  */
+static void
+sync_cursor (grub_efi_simple_text_output_interface_t *o,
+	     struct grub_term_coordinate pos, grub_efi_int32_t attr)
+{
+  /* The cursor moved behind our back, so somebody else wrote.  */
+  if (screen && (o->mode->cursor_column != expected_column
+		 || o->mode->cursor_row != expected_row))
+    forget_screen ();
+
+  if (o->mode->cursor_column != pos.x || o->mode->cursor_row != pos.y)
+    efi_call_3 (o->set_cursor_position, o, pos.x, pos.y);
+  if (o->mode->attribute != attr)
+    efi_call_2 (o->set_attributes, o, attr);
+}
+
+static void
+note_cursor (grub_efi_simple_text_output_interface_t *o)
+{
+  expected_column = o->mode->cursor_column;
+  expected_row = o->mode->cursor_row;
+}
+
+static void
+flush_run (grub_efi_simple_text_output_interface_t *o)
+{
+  if (!run_len)
+    return;
+
+  sync_cursor (o, run_pos, run_attr);
+  run[run_len] = 0;
+  run_len = 0;
+  efi_call_2 (o->output_string, o, run);
+  note_cursor (o);
+}
+
+/* Whether the console can show C.  Cached, as menus draw the same few
+   non-ASCII characters over and over.  */
+static int
+can_show (grub_efi_simple_text_output_interface_t *o, grub_efi_char16_t c)
+{
+  static struct
+  {
+    grub_efi_char16_t c;
+    int ok;
+  } cache[16];
+  static unsigned next;
+  grub_efi_char16_t str[2] = { c, 0 };
+  unsigned i;
+
+  for (i = 0; i < ARRAY_SIZE (cache); i++)
+    if (cache[i].c == c)
+      return cache[i].ok;
+
+  cache[next].c = c;
+  cache[next].ok = (efi_call_2 (o->test_string, o, str) == GRUB_EFI_SUCCESS);
+  i = next;
+  next = (next + 1) % ARRAY_SIZE (cache);
+  return cache[i].ok;
+}
+
 static void
 grub_console_putchar (struct grub_term_output *term __attribute__ ((unused)),
 		      const struct grub_unicode_glyph *c)
@@ -77,12 +187,54 @@ grub_console_putchar (struct grub_term_output *term __attribute__ ((unused)),
     return;
 
   o = grub_efi_system_table->con_out;
+  load_logical (o);
 
   /* For now, do not try to use a surrogate pair.  */
   if (c->base > 0xffff)
     str[0] = '?';
   else
     str[0] = (grub_efi_char16_t)  map_char (c->base & 0xffff);
+
+  /* Plain characters short of the last column, where the firmware may
+     wrap or scroll, are gathered into runs.  */
+  if (c->ncomb == 0 && c->estimated_width == 1
+      && str[0] >= ' ' && str[0] != 0x7f
+      && logical_pos.x + 1U < columns && logical_pos.y < rows
+      && (c->base <= 0x7f || can_show (o, str[0])))
+    {
+      grub_uint32_t cell = ((grub_uint32_t) logical_attr << 16) | str[0];
+      grub_uint32_t *shown = NULL;
+
+      if (screen)
+	{
+	  shown = &screen[logical_pos.y * columns + logical_pos.x];
+	  /* Spaces only show their background.  */
+	  if (*shown == cell
+	      || (str[0] == ' ' && (*shown & 0xffff) == ' '
+		  && ((*shown >> 16) & 0x70) == (logical_attr & 0x70)))
+	    {
+	      logical_pos.x++;
+	      return;
+	    }
+	}
+
+      if (run_len && (run_len == GRUB_CONSOLE_RUN_MAX
+		      || run_attr != logical_attr
+		      || run_pos.y != logical_pos.y
+		      || run_pos.x + run_len != logical_pos.x))
+	flush_run (o);
+      if (!run_len)
+	{
+	  run_pos = logical_pos;
+	  run_attr = logical_attr;
+	}
+      run[run_len++] = str[0];
+      if (shown)
+	*shown = cell;
+      logical_pos.x++;
+      return;
+    }
+
   j = 1;
   for (i = 0; i < c->ncomb && j + 1 < ARRAY_SIZE (str); i++)
     if (c->base < 0xffff)
@@ -94,7 +246,23 @@ grub_console_putchar (struct grub_term_output *term __attribute__ ((unused)),
       && efi_call_2 (o->test_string, o, str) != GRUB_EFI_SUCCESS)
     return;
 
+  flush_run (o);
+  sync_cursor (o, logical_pos, logical_attr);
+  if (screen)
+    {
+      /* A newline or the last column of the last row scrolls.  */
+      if (logical_pos.y + 1U >= rows
+	  && (str[0] == '\n' || logical_pos.x + 1U >= columns))
+	forget_screen ();
+      else if (logical_pos.x < columns && logical_pos.y < rows)
+	screen[logical_pos.y * columns + logical_pos.x]
+	  = GRUB_CONSOLE_CELL_UNKNOWN;
+    }
+
   efi_call_2 (o->output_string, o, str);
+  logical_pos.x = o->mode->cursor_column;
+  logical_pos.y = o->mode->cursor_row;
+  note_cursor (o);
 }
 
 const unsigned efi_codes[] =
@@ -207,12 +375,17 @@ grub_efi_console_input_init (struct grub_term_input *term)
   return 0;
 }
 
+static void grub_console_refresh (struct grub_term_output *term);
+
 static int
 grub_console_getkey (struct grub_term_input *term)
 {
   if (grub_efi_is_finished)
     return 0;
 
+  /* Whatever is to be answered must be visible.  */
+  grub_console_refresh (NULL);
+
   if (term->data)
     return grub_console_getkey_ex(term);
   else
@@ -223,15 +396,22 @@ static struct grub_term_coordinate
 grub_console_getwh (struct grub_term_output *term __attribute__ ((unused)))
 {
   grub_efi_simple_text_output_interface_t *o;
-  grub_efi_uintn_t columns, rows;
+  grub_efi_uintn_t new_columns, new_rows;
 
   o = grub_efi_system_table->con_out;
   if (grub_efi_is_finished || efi_call_4 (o->query_mode, o, o->mode->mode,
-					  &columns, &rows) != GRUB_EFI_SUCCESS)
+					  &new_columns, &new_rows) != GRUB_EFI_SUCCESS)
     {
       /* Why does this fail?  */
-      columns = 80;
-      rows = 25;
+      new_columns = 80;
+      new_rows = 25;
+    }
+
+  if (new_columns != columns || new_rows != rows)
+    {
+      forget_screen ();
+      columns = new_columns;
+      rows = new_rows;
     }
 
   return (struct grub_term_coordinate) { columns, rows };
@@ -240,42 +420,54 @@ grub_console_getwh (struct grub_term_output *term __attribute__ ((unused)))
 static struct grub_term_coordinate
 grub_console_getxy (struct grub_term_output *term __attribute__ ((unused)))
 {
-  grub_efi_simple_text_output_interface_t *o;
-
   if (grub_efi_is_finished)
     return (struct grub_term_coordinate) { 0, 0 };
 
-  o = grub_efi_system_table->con_out;
-  return (struct grub_term_coordinate) { o->mode->cursor_column, o->mode->cursor_row };
+  load_logical (grub_efi_system_table->con_out);
+  return logical_pos;
 }
 
 static void
 grub_console_gotoxy (struct grub_term_output *term __attribute__ ((unused)),
 		     struct grub_term_coordinate pos)
 {
-  grub_efi_simple_text_output_interface_t *o;
-
   if (grub_efi_is_finished)
     return;
 
-  o = grub_efi_system_table->con_out;
-  efi_call_3 (o->set_cursor_position, o, pos.x, pos.y);
+  load_logical (grub_efi_system_table->con_out);
+  logical_pos = pos;
 }
 
 static void
 grub_console_cls (struct grub_term_output *term __attribute__ ((unused)))
 {
   grub_efi_simple_text_output_interface_t *o;
-  grub_efi_int32_t orig_attr;
+  grub_err_t saved_errno = grub_errno;
+  grub_efi_uintn_t i;
 
   if (grub_efi_is_finished)
     return;
 
   o = grub_efi_system_table->con_out;
-  orig_attr = o->mode->attribute;
+  load_logical (o);
+  run_len = 0;
   efi_call_2 (o->set_attributes, o, GRUB_EFI_BACKGROUND_BLACK);
   efi_call_1 (o->clear_screen, o);
-  efi_call_2 (o->set_attributes, o, orig_attr);
+  efi_call_2 (o->set_attributes, o, logical_attr);
+  logical_pos.x = 0;
+  logical_pos.y = 0;
+  note_cursor (o);
+
+  grub_console_getwh (NULL);
+  if (!screen)
+    {
+      screen = grub_malloc (columns * rows * sizeof (screen[0]));
+      /* Without the copy nothing is skipped, which is fine.  */
+      grub_errno = saved_errno;
+    }
+  if (screen)
+    for (i = 0; i < columns * rows; i++)
+      screen[i] = (GRUB_EFI_BACKGROUND_BLACK << 16) | ' ';
 }
 
 static void
@@ -283,23 +475,20 @@ grub_console_setcolorstate (struct grub_term_output *term
 			    __attribute__ ((unused)),
 			    grub_term_color_state state)
 {
-  grub_efi_simple_text_output_interface_t *o;
-
   if (grub_efi_is_finished)
     return;
 
-  o = grub_efi_system_table->con_out;
+  load_logical (grub_efi_system_table->con_out);
 
   switch (state) {
     case GRUB_TERM_COLOR_STANDARD:
-      efi_call_2 (o->set_attributes, o, GRUB_TERM_DEFAULT_STANDARD_COLOR
-		  & 0x7f);
+      logical_attr = GRUB_TERM_DEFAULT_STANDARD_COLOR & 0x7f;
       break;
     case GRUB_TERM_COLOR_NORMAL:
-      efi_call_2 (o->set_attributes, o, grub_term_normal_color & 0x7f);
+      logical_attr = grub_term_normal_color & 0x7f;
       break;
     case GRUB_TERM_COLOR_HIGHLIGHT:
-      efi_call_2 (o->set_attributes, o, grub_term_highlight_color & 0x7f);
+      logical_attr = grub_term_highlight_color & 0x7f;
       break;
     default:
       break;
@@ -316,13 +505,33 @@ grub_console_setcursor (struct grub_term_output *term __attribute__ ((unused)),
     return;
 
   o = grub_efi_system_table->con_out;
+  if (on)
+    grub_console_refresh (NULL);
   efi_call_2 (o->enable_cursor, o, on);
 }
 
+/* Write out pending text and leave the cursor where GRUB put it.  */
+static void
+grub_console_refresh (struct grub_term_output *term __attribute__ ((unused)))
+{
+  grub_efi_simple_text_output_interface_t *o;
+
+  if (grub_efi_is_finished || !logical_valid)
+    return;
+
+  o = grub_efi_system_table->con_out;
+  flush_run (o);
+  sync_cursor (o, logical_pos, logical_attr);
+  note_cursor (o);
+}
+
 static grub_err_t
 grub_efi_console_output_init (struct grub_term_output *term)
 {
   grub_efi_set_text_mode (1);
+  logical_valid = 0;
+  run_len = 0;
+  forget_screen ();
   grub_console_setcursor (term, 1);
   return 0;
 }
@@ -330,8 +539,11 @@ grub_efi_console_output_init (struct grub_term_output *term)
 static grub_err_t
 grub_efi_console_output_fini (struct grub_term_output *term)
 {
+  grub_console_refresh (term);
   grub_console_setcursor (term, 0);
   grub_efi_set_text_mode (0);
+  logical_valid = 0;
+  forget_screen ();
   return 0;
 }
 
@@ -354,6 +566,7 @@ static struct grub_term_output grub_console_term_output =
     .cls = grub_console_cls,
     .setcolorstate = grub_console_setcolorstate,
     .setcursor = grub_console_setcursor,
+    .refresh = grub_console_refresh,
     .flags = GRUB_TERM_CODE_TYPE_VISUAL_GLYPHS,
     .progress_update_divisor = GRUB_PROGRESS_FAST
   };
@@ -376,6 +589,7 @@ grub_console_init (void)
 void
 grub_console_fini (void)
 {
+  grub_console_refresh (NULL);
   grub_term_unregister_input (&grub_console_term_input);
   grub_term_unregister_output (&grub_console_term_output);
 }
@@ -96,6 +96,11 @@ struct grub_virtual_screen
      of entries.  */
   struct grub_colored_char *text_buffer;
 
+  /* The text buffer row and the character row of the text layer showing
+     the top line.  Both are rings, so that scrolling moves neither.  */
+  unsigned int first_row;
+  unsigned int layer_first_row;
+
   int total_scroll;
 
   int functional;
@@ -168,6 +173,24 @@ set_term_color (grub_uint8_t term_color)
   grub_video_set_active_render_target (old_target);
 }
 
+/* Text buffer entry for column CX of line CY.  */
+static inline struct grub_colored_char *
+text_cell (unsigned int cx, unsigned int cy)
+{
+  cy += virtual_screen.first_row;
+  if (cy >= virtual_screen.rows)
+    cy -= virtual_screen.rows;
+  return virtual_screen.text_buffer + cx + cy * virtual_screen.columns;
+}
+
+/* Text layer y of line CY, counted before any pending scroll.  */
+static inline unsigned int
+layer_line_y (unsigned int cy)
+{
+  return ((cy + virtual_screen.layer_first_row) % virtual_screen.rows)
+    * virtual_screen.normal_char_height;
+}
+
 static void
 clear_char (struct grub_colored_char *c)
 {
@@ -226,6 +249,8 @@ grub_virtual_screen_setup (unsigned int x, unsigned int y,
   virtual_screen.cursor_x = 0;
   virtual_screen.cursor_y = 0;
   virtual_screen.cursor_state = 1;
+  virtual_screen.first_row = 0;
+  virtual_screen.layer_first_row = 0;
   virtual_screen.total_scroll = 0;
 
   /* Calculate size of text buffer.  */
@@ -421,6 +446,50 @@ grub_gfxterm_term_fini (struct grub_term_output *term __attribute__ ((unused)))
   return GRUB_ERR_NONE;
 }
 
+/* Draw the text layer onto the window area at X, Y, unrolling the ring
+   of character rows into screen order.  */
+static void
+blit_text_layer (enum grub_video_blit_operators oper,
+		 unsigned int x, unsigned int y,
+		 unsigned int width, unsigned int height)
+{
+  unsigned int ring = virtual_screen.rows * virtual_screen.normal_char_height;
+  int src_x = x - virtual_screen.offset_x;
+  int src_y = y - virtual_screen.offset_y;
+  unsigned int src, n;
+
+  /* Nothing of the text layer lies above it.  */
+  if (src_y < 0)
+    {
+      if ((unsigned int) -src_y >= height)
+	return;
+      height += src_y;
+      y -= src_y;
+      src_y = 0;
+    }
+
+  while (height && (unsigned int) src_y < ring)
+    {
+      src = (src_y + layer_line_y (0)) % ring;
+      n = height;
+      if (n > ring - src_y)
+	n = ring - src_y;
+      if (n > ring - src)
+	n = ring - src;
+
+      grub_video_blit_render_target (text_layer, oper, x, y, src_x, src,
+				     width, n);
+      y += n;
+      src_y += n;
+      height -= n;
+    }
+
+  /* Any partial line below the last row isn't part of the ring.  */
+  if (height)
+    grub_video_blit_render_target (text_layer, oper, x, y, src_x, src_y,
+				   width, height);
+}
+
 static void
 redraw_screen_rect (unsigned int x, unsigned int y,
                     unsigned int width, unsigned int height)
@@ -494,16 +563,10 @@ redraw_screen_rect (unsigned int x, unsigned int y,
 
   if (grub_gfxterm_background.blend_text_bg)
     /* Render text layer as blended.  */
-    grub_video_blit_render_target (text_layer, GRUB_VIDEO_BLIT_BLEND, x, y,
-                                   x - virtual_screen.offset_x,
-                                   y - virtual_screen.offset_y,
-                                   width, height);
+    blit_text_layer (GRUB_VIDEO_BLIT_BLEND, x, y, width, height);
   else
     /* Render text layer as replaced (to get texts background color).  */
-    grub_video_blit_render_target (text_layer, GRUB_VIDEO_BLIT_REPLACE, x, y,
-                                   x - virtual_screen.offset_x,
-                                   y - virtual_screen.offset_y,
-                                   width, height);
+    blit_text_layer (GRUB_VIDEO_BLIT_REPLACE, x, y, width, height);
 
   /* Restore saved viewport.  */
   grub_video_set_viewport (saved_view.x, saved_view.y,
@@ -612,6 +675,7 @@ paint_char (unsigned cx, unsigned cy)
   grub_video_color_t bgcolor;
   unsigned int x;
   unsigned int y;
+  unsigned int layer_y;
   int ascent;
   unsigned int height;
   unsigned int width;
@@ -620,8 +684,7 @@ paint_char (unsigned cx, unsigned cy)
     return;
 
   /* Find out active character.  */
-  p = (virtual_screen.text_buffer
-       + cx + (cy * virtual_screen.columns));
+  p = text_cell (cx, cy);
 
   if (!p->code.base)
     return;
@@ -643,11 +706,12 @@ paint_char (unsigned cx, unsigned cy)
 
   x = cx * virtual_screen.normal_char_width;
   y = (cy + virtual_screen.total_scroll) * virtual_screen.normal_char_height;
+  layer_y = layer_line_y (cy + virtual_screen.total_scroll);
 
   /* Render glyph to text layer.  */
   grub_video_set_active_render_target (text_layer);
-  grub_video_fill_rect (bgcolor, x, y, width, height);
-  grub_font_draw_glyph (glyph, color, x, y + ascent);
+  grub_video_fill_rect (bgcolor, x, layer_y, width, height);
+  grub_font_draw_glyph (glyph, color, x, layer_y + ascent);
   grub_video_set_active_render_target (render_target);
 
   /* Mark character to be drawn.  */
@@ -690,7 +754,11 @@ draw_cursor (int show)
   
   /* Render cursor to text layer.  */
   grub_video_set_active_render_target (text_layer);
-  grub_video_fill_rect (color, x, y, width, height);
+  grub_video_fill_rect (color, x,
+			layer_line_y (virtual_screen.cursor_y
+				      + virtual_screen.total_scroll)
+			+ grub_font_get_ascent (virtual_screen.font),
+			width, height);
   grub_video_set_active_render_target (render_target);
   
   /* Mark cursor to be redrawn.  */
@@ -699,6 +767,30 @@ draw_cursor (int show)
 		    width, height);
 }
 
+/* Scroll the text layer by the pending lines, by turning its ring and
+   clearing the lines that come into view at the bottom.  */
+static void
+scroll_text_layer (void)
+{
+  unsigned int lines = virtual_screen.total_scroll;
+  unsigned int i;
+
+  if (!virtual_screen.rows)
+    return;
+  if (lines > virtual_screen.rows)
+    lines = virtual_screen.rows;
+
+  virtual_screen.layer_first_row = (virtual_screen.layer_first_row + lines)
+    % virtual_screen.rows;
+
+  grub_video_set_active_render_target (text_layer);
+  for (i = virtual_screen.rows - lines; i < virtual_screen.rows; i++)
+    grub_video_fill_rect (virtual_screen.bg_color, 0, layer_line_y (i),
+			  virtual_screen.width,
+			  virtual_screen.normal_char_height);
+  grub_video_set_active_render_target (render_target);
+}
+
 static void
 real_scroll (void)
 {
@@ -711,11 +803,7 @@ real_scroll (void)
   /* If we have bitmap, re-draw screen, otherwise scroll physical screen too.  */
   if (grub_gfxterm_background.bitmap)
     {
-      /* Scroll physical screen.  */
-      grub_video_set_active_render_target (text_layer);
-      color = virtual_screen.bg_color;
-      grub_video_scroll (color, 0, -virtual_screen.normal_char_height
-			 * virtual_screen.total_scroll);
+      scroll_text_layer ();
 
       /* Mark virtual screen to be redrawn.  */
       dirty_region_add_virtualscreen ();
@@ -768,14 +856,7 @@ real_scroll (void)
 	}
       dirty_region_reset ();
 
-      /* Scroll physical screen.  */
-      grub_video_set_active_render_target (text_layer);
-      color = virtual_screen.bg_color;
-      grub_video_scroll (color, 0, -virtual_screen.normal_char_height
-			 * virtual_screen.total_scroll);
-
-      grub_video_set_active_render_target (render_target);
-
+      scroll_text_layer ();
     }
 
   was_scroll = virtual_screen.total_scroll;
@@ -800,22 +881,12 @@ scroll_up (void)
 {
   unsigned int i;
 
-  /* Clear first line in text buffer.  */
+  /* The first line becomes the new, cleared, last one.  */
   for (i = 0; i < virtual_screen.columns; i++)
-    grub_unicode_destroy_glyph (&virtual_screen.text_buffer[i].code);
-  
-  /* Scroll text buffer with one line to up.  */
-  grub_memmove (virtual_screen.text_buffer,
-                virtual_screen.text_buffer + virtual_screen.columns,
-                sizeof (*virtual_screen.text_buffer)
-                * virtual_screen.columns
-                * (virtual_screen.rows - 1));
-
-  /* Clear last line in text buffer.  */
-  for (i = virtual_screen.columns * (virtual_screen.rows - 1);
-       i < virtual_screen.columns * virtual_screen.rows;
-       i++)
-    clear_char (&(virtual_screen.text_buffer[i]));
+    clear_char (text_cell (i, 0));
+
+  if (++virtual_screen.first_row == virtual_screen.rows)
+    virtual_screen.first_row = 0;
 
   virtual_screen.total_scroll++;
 }
@@ -875,9 +946,7 @@ grub_gfxterm_putchar (struct grub_term_output *term,
 	}
 
       /* Find position on virtual screen, and fill information.  */
-      p = (virtual_screen.text_buffer +
-           virtual_screen.cursor_x +
-           virtual_screen.cursor_y * virtual_screen.columns);
+      p = text_cell (virtual_screen.cursor_x, virtual_screen.cursor_y);
       grub_unicode_destroy_glyph (&p->code);
       grub_unicode_set_glyph (&p->code, c);
       grub_errno = GRUB_ERR_NONE;
@@ -74,6 +74,7 @@ do_real_config (struct grub_serial_port *port)
 {
   int divisor;
   unsigned char status = 0;
+  unsigned char iir;
   grub_uint64_t endtime;
 
   const unsigned char parities[] = {
@@ -103,6 +104,13 @@ do_real_config (struct grub_serial_port *port)
   grub_outb (divisor & 0xFF, port->port + UART_DLL);
   grub_outb (divisor >> 8, port->port + UART_DLH);
 
+  /* Enable the FIFO.  This is done with DLAB still set, as that is the
+     only time a 16750 accepts the switch to its 64-byte FIFO; other
+     UARTs ignore the bit.  */
+  grub_outb ((port->config.rtscts ? UART_ENABLE_FIFO_TRIGGER1
+	      : UART_ENABLE_FIFO_TRIGGER14) | UART_ENABLE_64BYTE_FIFO,
+	     port->port + UART_FCR);
+
   /* Set the line status.  */
   status |= (parities[port->config.parity]
 	     | (port->config.word_len - 5)
@@ -110,21 +118,22 @@ do_real_config (struct grub_serial_port *port)
   grub_outb (status, port->port + UART_LCR);
 
   if (port->config.rtscts)
-    {
-      /* Enable the FIFO.  */
-      grub_outb (UART_ENABLE_FIFO_TRIGGER1, port->port + UART_FCR);
-
-      /* Turn on DTR and RTS.  */
-      grub_outb (UART_ENABLE_DTRRTS, port->port + UART_MCR);
-    }
+    /* Turn on DTR and RTS.  */
+    grub_outb (UART_ENABLE_DTRRTS, port->port + UART_MCR);
   else
-    {
-      /* Enable the FIFO.  */
-      grub_outb (UART_ENABLE_FIFO_TRIGGER14, port->port + UART_FCR);
-
-      /* Turn on DTR, RTS, and OUT2.  */
-      grub_outb (UART_ENABLE_DTRRTS | UART_ENABLE_OUT2, port->port + UART_MCR);
-    }
+    /* Turn on DTR, RTS, and OUT2.  */
+    grub_outb (UART_ENABLE_DTRRTS | UART_ENABLE_OUT2, port->port + UART_MCR);
+
+  /* Find out how many bytes may be written each time the transmitter
+     is found empty.  */
+  iir = grub_inb (port->port + UART_IIR);
+  if ((iir & UART_FIFO_ENABLED) != UART_FIFO_ENABLED)
+    port->tx_fifo_size = 1;
+  else if (iir & UART_64BYTE_FIFO)
+    port->tx_fifo_size = 64;
+  else
+    port->tx_fifo_size = 16;
+  port->tx_room = 0;
 
   /* Drain the input buffer.  */
   endtime = grub_get_time_ms () + 1000;
@@ -152,7 +161,9 @@ serial_hw_fetch (struct grub_serial_port *port)
   return -1;
 }
 
-/* Put a character.  */
+/* Put a character.  The line status is only polled once the transmit
+   FIFO may be full; after it is seen empty, a whole FIFO worth of
+   characters is written without looking at it again.  */
 static void
 serial_hw_put (struct grub_serial_port *port, const int c)
 {
@@ -160,6 +171,13 @@ serial_hw_put (struct grub_serial_port *port, const int c)
 
   do_real_config (port);
 
+  if (port->tx_room)
+    {
+      port->tx_room--;
+      grub_outb (c, port->port + UART_TX);
+      return;
+    }
+
   if (port->broken > 5)
     endtime = grub_get_time_ms ();
   else if (port->broken > 1)
@@ -180,6 +198,7 @@ serial_hw_put (struct grub_serial_port *port, const int c)
   if (port->broken)
     port->broken--;
 
+  port->tx_room = port->tx_fifo_size - 1;
   grub_outb (c, port->port + UART_TX);
 }
 
@@ -77,6 +77,15 @@ grub_terminfo_all_free (struct grub_term_output *term)
   grub_terminfo_free (&data->cursor_off);
 }
 
+/* Make the next escape sequences be sent even if they look redundant.  */
+static void
+grub_terminfo_forget_state (struct grub_terminfo_output_state *data)
+{
+  data->pos_sent = 0;
+  data->color_sent = 0;
+  data->cursor_sent = 0;
+}
+
 /* Set current terminfo type.  */
 grub_err_t
 grub_terminfo_set_current (struct grub_term_output *term,
@@ -102,6 +111,7 @@ grub_terminfo_set_current (struct grub_term_output *term,
    */
 
   grub_terminfo_all_free (term);
+  grub_terminfo_forget_state (data);
 
   if (grub_strcmp ("vt100", str) == 0)
     {
@@ -253,7 +263,15 @@ grub_terminfo_gotoxy (struct grub_term_output *term,
     }
 
   if (data->gotoxy)
-    putstr (term, grub_terminfo_tparm (data->gotoxy, pos.y, pos.x));
+    {
+      /* Once past the last column the terminal's cursor may be anywhere
+	 depending on how it handles wrapping, so don't trust it there.  */
+      if (data->pos_sent && pos.x == data->pos.x && pos.y == data->pos.y
+	  && pos.x < grub_term_width (term))
+	return;
+      putstr (term, grub_terminfo_tparm (data->gotoxy, pos.y, pos.x));
+      data->pos_sent = 1;
+    }
   else
     {
       if ((pos.y == data->pos.y) && (pos.x == data->pos.x - 1))
@@ -271,6 +289,7 @@ grub_terminfo_cls (struct grub_term_output *term)
     = (struct grub_terminfo_output_state *) term->data;
 
   putstr (term, grub_terminfo_tparm (data->cls));
+  data->pos_sent = 0;
   grub_terminfo_gotoxy (term, (struct grub_term_coordinate) { 0, 0 });
 }
 
@@ -312,6 +331,13 @@ grub_terminfo_setcolorstate (struct grub_term_output *term,
 	  return;
 	}
 
+      /* Remember the colors rather than the state, as the menu changes
+	 what the states stand for.  */
+      if (data->color_sent == (0x100 | (colormap[fg & 7] << 4)
+			       | colormap[bg & 7]))
+	return;
+      data->color_sent = 0x100 | (colormap[fg & 7] << 4) | colormap[bg & 7];
+
       putstr (term, grub_terminfo_tparm (data->setcolor, colormap[fg & 7],
 					 colormap[bg & 7]));
       return;
@@ -321,9 +347,15 @@ grub_terminfo_setcolorstate (struct grub_term_output *term,
     {
     case GRUB_TERM_COLOR_STANDARD:
     case GRUB_TERM_COLOR_NORMAL:
+      if (data->color_sent == 1)
+	break;
+      data->color_sent = 1;
       putstr (term, grub_terminfo_tparm (data->reverse_video_off));
       break;
     case GRUB_TERM_COLOR_HIGHLIGHT:
+      if (data->color_sent == 2)
+	break;
+      data->color_sent = 2;
       putstr (term, grub_terminfo_tparm (data->reverse_video_on));
       break;
     default:
@@ -337,6 +369,10 @@ grub_terminfo_setcursor (struct grub_term_output *term, const int on)
   struct grub_terminfo_output_state *data
     = (struct grub_terminfo_output_state *) term->data;
 
+  if (data->cursor_sent == (on ? 2 : 1))
+    return;
+  data->cursor_sent = on ? 2 : 1;
+
   if (on)
     putstr (term, grub_terminfo_tparm (data->cursor_on));
   else
@@ -650,6 +686,7 @@ grub_terminfo_input_init (struct grub_term_input *termi)
 grub_err_t
 grub_terminfo_output_init (struct grub_term_output *term)
 {
+  grub_terminfo_forget_state (term->data);
   grub_terminfo_cls (term);
   return GRUB_ERR_NONE;
 }
@@ -65,6 +65,9 @@ enum
 #define GRUB_USB_KEYBOARD_RIGHT_SHIFT 0x20
 #define GRUB_USB_KEYBOARD_RIGHT_ALT   0x40
 
+/* Longest time between two polls of an idle keyboard, in ms.  */
+#define GRUB_USB_KEYBOARD_POLL_MAX    32
+
 struct grub_usb_keyboard_data
 {
   grub_usb_device_t usbdev;
@@ -81,6 +84,12 @@ struct grub_usb_keyboard_data
   grub_uint8_t last_report[8];
   int index;
   int max_index;
+  /* The interrupt pipe is not checked again before NEXT_POLL.  The
+     interval starts at the endpoint's and doubles, up to
+     GRUB_USB_KEYBOARD_POLL_MAX, while no report comes in.  */
+  grub_uint64_t next_poll;
+  unsigned poll_interval;
+  unsigned min_poll_interval;
 };
 
 static int grub_usb_keyboard_getkey (struct grub_term_input *term);
@@ -144,6 +153,24 @@ grub_usb_keyboard_detach (grub_usb_device_t usbdev,
     }
 }
 
+/* Shortest time between reports from ENDP on USBDEV, in ms.  */
+static unsigned
+endp_poll_interval (grub_usb_device_t usbdev, struct grub_usb_desc_endp *endp)
+{
+  unsigned interval = endp->interval;
+
+  /* High speed intervals are 2^(bInterval-1) microframes of 125us.  */
+  if (usbdev->speed == GRUB_USB_SPEED_HIGH)
+    interval = (interval >= 4 && interval <= 16)
+      ? (1U << (interval - 1)) / 8 : 1;
+
+  if (interval < 1)
+    interval = 1;
+  if (interval > GRUB_USB_KEYBOARD_POLL_MAX)
+    interval = GRUB_USB_KEYBOARD_POLL_MAX;
+  return interval;
+}
+
 static int
 grub_usb_keyboard_attach (grub_usb_device_t usbdev, int configno, int interfno)
 {
@@ -256,6 +283,9 @@ grub_usb_keyboard_attach (grub_usb_device_t usbdev, int configno, int interfno)
   data->last_key = -1;
   data->mods = 0;
   data->dead = 0;
+  data->next_poll = 0;
+  data->min_poll_interval = endp_poll_interval (usbdev, endp);
+  data->poll_interval = data->min_poll_interval;
 
   grub_term_register_input_active ("usb_keyboard", &grub_usb_keyboards[curnum]);
 
@@ -360,6 +390,7 @@ grub_usb_keyboard_getkey (struct grub_term_input *term)
   struct grub_usb_keyboard_data *termdata = term->data;
   grub_size_t actual;
   int keycode = GRUB_TERM_NO_KEY;
+  grub_uint64_t now;
 
   if (termdata->dead)
     return GRUB_TERM_NO_KEY;
@@ -368,17 +399,34 @@ grub_usb_keyboard_getkey (struct grub_term_input *term)
     keycode = parse_keycode (termdata);
   if (keycode != GRUB_TERM_NO_KEY)
     return keycode;
-    
-  /* Poll interrupt pipe.  */
-  err = grub_usb_check_transfer (termdata->transfer, &actual);
+
+  now = grub_get_time_ms ();
+
+  /* Poll interrupt pipe, but not more often than reports can come.  */
+  if (now < termdata->next_poll)
+    err = GRUB_USB_ERR_WAIT;
+  else
+    {
+      err = grub_usb_check_transfer (termdata->transfer, &actual);
+      if (err == GRUB_USB_ERR_WAIT)
+	{
+	  /* A held key is released by the next report, so keep up with
+	     it to not repeat the key past the release.  */
+	  if (termdata->last_key == -1)
+	    termdata->poll_interval = grub_min (2 * termdata->poll_interval,
+						GRUB_USB_KEYBOARD_POLL_MAX);
+	}
+      else
+	termdata->poll_interval = termdata->min_poll_interval;
+      termdata->next_poll = now + termdata->poll_interval;
+    }
 
   if (err == GRUB_USB_ERR_WAIT)
     {
       if (termdata->last_key != -1
-	  && grub_get_time_ms () > termdata->repeat_time)
+	  && now > termdata->repeat_time)
 	{
-	  termdata->repeat_time = grub_get_time_ms ()
-	    + GRUB_TERM_REPEAT_INTERVAL;
+	  termdata->repeat_time = now + GRUB_TERM_REPEAT_INTERVAL;
 	  return termdata->last_key;
 	}
       return GRUB_TERM_NO_KEY;
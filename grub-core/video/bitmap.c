@@ -210,6 +210,38 @@ grub_video_bitmap_load (struct grub_video_bitmap **bitmap,
 			" unsupported format"), filename);
 }
 
+/* Loads bitmap for display at MIN_WIDTH by MIN_HEIGHT or smaller.  Readers
+   that can decode at a reduced size are allowed to return anything at
+   least that big, so that the caller's scaling pass has less to do.  */
+grub_err_t
+grub_video_bitmap_load_reduced (struct grub_video_bitmap **bitmap,
+                                const char *filename,
+                                unsigned int min_width,
+                                unsigned int min_height)
+{
+  grub_video_bitmap_reader_t reader = bitmap_readers_list;
+
+  if (!bitmap)
+    return grub_error (GRUB_ERR_BUG, "invalid argument");
+
+  *bitmap = 0;
+
+  while (reader)
+    {
+      if (match_extension (filename, reader->extension))
+        {
+          if (reader->reader_reduced)
+            return reader->reader_reduced (bitmap, filename,
+                                           min_width, min_height);
+          return reader->reader (bitmap, filename);
+        }
+
+      reader = reader->next;
+    }
+
+  return grub_video_bitmap_load (bitmap, filename);
+}
+
 /* Return mode info for bitmap.  */
 void grub_video_bitmap_get_mode_info (struct grub_video_bitmap *bitmap,
                                       struct grub_video_mode_info *mode_info)
@@ -365,12 +365,28 @@ scale_nn (struct grub_video_bitmap *dst, struct grub_video_bitmap *src)
   int sstride = src->mode_info.pitch;
   /* bytes_per_pixel is the same for both src and dst. */
   int bytes_per_pixel = dst->mode_info.bytes_per_pixel;
-  unsigned dy, sy, ystep, yfrac, yover;
+  unsigned dx, dy, sy, ystep, yfrac, yover, prev_sy = 0;
   unsigned sx, xstep, xfrac, xover;
-  grub_uint8_t *dptr, *dline_end, *sline;
+  unsigned *xofs;
+  grub_uint8_t *dptr, *sline;
+
+  /* Source offset of every destination column, the same for all rows.  */
+  xofs = grub_malloc (dw * sizeof (*xofs));
+  if (!xofs)
+    return grub_errno;
 
   xstep = sw / dw;
   xover = sw % dw;
+  for (dx = 0, sx = 0, xfrac = 0; dx < dw; dx++, sx += xstep, xfrac += xover)
+    {
+      if (xfrac >= dw)
+	{
+	  xfrac -= dw;
+	  sx++;
+	}
+      xofs[dx] = sx * bytes_per_pixel;
+    }
+
   ystep = sh / dh;
   yover = sh % dh;
 
@@ -382,28 +398,140 @@ scale_nn (struct grub_video_bitmap *dst, struct grub_video_bitmap *src)
 	  sy++;
 	}
       dptr = ddata + dy * dstride;
-      dline_end = dptr + dw * bytes_per_pixel;
+
+      /* When enlarging, most rows repeat the one above.  */
+      if (dy > 0 && sy == prev_sy)
+	{
+	  grub_memcpy (dptr, dptr - dstride, dw * bytes_per_pixel);
+	  continue;
+	}
+      prev_sy = sy;
+
       sline = sdata + sy * sstride;
-      for (sx = 0, xfrac = 0; dptr < dline_end; sx += xstep, xfrac += xover, dptr += bytes_per_pixel)
-        {
-          grub_uint8_t *sptr;
-          int comp;
+      if (bytes_per_pixel == 4)
+	for (dx = 0; dx < dw; dx++)
+	  ((grub_uint32_t *) dptr)[dx] = *(grub_uint32_t *) (sline + xofs[dx]);
+      else
+	for (dx = 0; dx < dw; dx++, dptr += bytes_per_pixel)
+	  {
+	    grub_uint8_t *sptr = sline + xofs[dx];
+	    int comp;
+
+	    for (comp = 0; comp < bytes_per_pixel; comp++)
+	      dptr[comp] = sptr[comp];
+	  }
+    }
+
+  grub_free (xofs);
+  return GRUB_ERR_NONE;
+}
 
-	  if (xfrac >= dw)
+/* Bilinear scaling to exactly twice the size.  Every destination pixel
+   is the source pixel, or the average of two or four neighbours, so no
+   weights are needed.  Gives the same result as scale_bilinear.  */
+static void
+scale_bilinear_2x (struct grub_video_bitmap *dst,
+		   struct grub_video_bitmap *src)
+{
+  grub_uint8_t *ddata = dst->data;
+  grub_uint8_t *sdata = src->data;
+  unsigned sw = src->mode_info.width;
+  unsigned sh = src->mode_info.height;
+  int dstride = dst->mode_info.pitch;
+  int sstride = src->mode_info.pitch;
+  int bytes_per_pixel = dst->mode_info.bytes_per_pixel;
+  unsigned sx, sy;
+
+  for (sy = 0; sy < sh; sy++)
+    {
+      const grub_uint8_t *s0 = sdata + sy * sstride;
+      /* The last row and column have nothing to blend with.  */
+      const grub_uint8_t *s1 = (sy < sh - 1) ? s0 + sstride : s0;
+      grub_uint8_t *d0 = ddata + 2 * sy * dstride;
+      grub_uint8_t *d1 = d0 + dstride;
+
+      for (sx = 0; sx < sw; sx++)
+	{
+	  int next = (sx < sw - 1) ? bytes_per_pixel : 0;
+	  int comp;
+
+	  for (comp = 0; comp < bytes_per_pixel; comp++)
 	    {
-	      xfrac -= dw;
-	      sx++;
+	      unsigned a = s0[comp];
+	      unsigned b = s0[comp + next];
+	      unsigned c = s1[comp];
+	      unsigned d = s1[comp + next];
+
+	      d0[comp] = a;
+	      d0[comp + bytes_per_pixel] = (a + b) >> 1;
+	      d1[comp] = (a + c) >> 1;
+	      d1[comp + bytes_per_pixel] = (a + b + c + d) >> 2;
 	    }
 
-          /* Get the address of the pixels in src and dst. */
-	  sptr = sline + sx * bytes_per_pixel;
+	  s0 += bytes_per_pixel;
+	  s1 += bytes_per_pixel;
+	  d0 += 2 * bytes_per_pixel;
+	  d1 += 2 * bytes_per_pixel;
+	}
+    }
+}
 
-	  /* Copy the pixel color value. */
-	  for (comp = 0; comp < bytes_per_pixel; comp++)
-	    dptr[comp] = sptr[comp];
-        }
+/* Horizontal pass of scale_bilinear: scale the source row SLINE to DW
+   pixels, leaving each component multiplied by 256 in OUT.  */
+static void
+scale_bilinear_row (grub_uint32_t *out, const grub_uint8_t *sline,
+		    const unsigned *xofs, const unsigned *xweight,
+		    unsigned dw, int bytes_per_pixel)
+{
+  unsigned dx;
+  int comp;
+
+  for (dx = 0; dx < dw; dx++, out += bytes_per_pixel)
+    {
+      const grub_uint8_t *sptr = sline + xofs[dx];
+      unsigned u = xweight[dx];
+
+      if (u == 0)
+	for (comp = 0; comp < bytes_per_pixel; comp++)
+	  out[comp] = sptr[comp] << 8;
+      else
+	for (comp = 0; comp < bytes_per_pixel; comp++)
+	  out[comp] = (256 - u) * sptr[comp]
+	    + u * sptr[comp + bytes_per_pixel];
     }
-  return GRUB_ERR_NONE;
+}
+
+/* Vertical pass of scale_bilinear: blend N components of two rows made
+   by scale_bilinear_row, with weight V for the lower one.  */
+static void
+scale_bilinear_blend (grub_uint8_t *dptr, const grub_uint32_t *h0,
+		      const grub_uint32_t *h1, unsigned v, unsigned n)
+{
+  unsigned i = 0;
+
+  if (v == 0)
+    {
+      for (; i < n; i++)
+	dptr[i] = h0[i] >> 8;
+      return;
+    }
+
+#if GRUB_CPU_SIZEOF_VOID_P == 8
+  /* Two components per multiplication.  Each product stays below 1 << 24,
+     so nothing carries from one 32-bit half into the other.  */
+  for (; i + 1 < n; i += 2)
+    {
+      grub_uint64_t a = h0[i] | ((grub_uint64_t) h0[i + 1] << 32);
+      grub_uint64_t b = h1[i] | ((grub_uint64_t) h1[i + 1] << 32);
+
+      a = a * (256 - v) + b * v;
+      dptr[i] = a >> 16;
+      dptr[i + 1] = a >> 48;
+    }
+#endif
+
+  for (; i < n; i++)
+    dptr[i] = (h0[i] * (256 - v) + h1[i] * v) >> 16;
 }
 
 /* Bilinear interpolation image scaling algorithm.
@@ -412,6 +540,12 @@ scale_nn (struct grub_video_bitmap *dst, struct grub_video_bitmap *src)
    dimensions of DST.  This function uses the bilinear interpolation algorithm
    to interpolate the pixels.
 
+   The interpolation is done in two passes: every source row that is
+   needed is scaled horizontally once, using per-column offsets and
+   weights computed up front, and destination rows are blended from two
+   of those.  Pixels in the last source row or column are not blended
+   with anything beyond it.
+
    Supports only direct color modes which have components separated
    into bytes (e.g., RGBA 8:8:8:8 or BGR 8:8:8 true color).
    But because of this simplifying assumption, the implementation is
@@ -433,83 +567,82 @@ scale_bilinear (struct grub_video_bitmap *dst, struct grub_video_bitmap *src)
   int sstride = src->mode_info.pitch;
   /* bytes_per_pixel is the same for both src and dst. */
   int bytes_per_pixel = dst->mode_info.bytes_per_pixel;
-  unsigned dy, syf, sy, ystep, yfrac, yover;
+  unsigned dx, dy, syf, sy, ystep, yfrac, yover;
   unsigned sxf, sx, xstep, xfrac, xover;
-  grub_uint8_t *dptr, *dline_end, *sline;
+  unsigned *xofs, *xweight;
+  unsigned row_len = dw * bytes_per_pixel;
+  grub_uint32_t *rows[2];
+  /* Source row held in ROWS[I], which is always for a row of parity I.  */
+  unsigned row_sy[2] = { ~0U, ~0U };
+
+  if (dw == 2 * sw && dh == 2 * sh)
+    {
+      scale_bilinear_2x (dst, src);
+      return GRUB_ERR_NONE;
+    }
+
+  xofs = grub_malloc (dw * sizeof (*xofs));
+  xweight = grub_malloc (dw * sizeof (*xweight));
+  rows[0] = grub_malloc (2 * row_len * sizeof (*rows[0]));
+  if (!xofs || !xweight || !rows[0])
+    {
+      grub_free (xofs);
+      grub_free (xweight);
+      grub_free (rows[0]);
+      return grub_errno;
+    }
+  rows[1] = rows[0] + row_len;
 
   xstep = (sw << 8) / dw;
   xover = (sw << 8) % dw;
+  for (dx = 0, sxf = 0, xfrac = 0; dx < dw;
+       dx++, sxf += xstep, xfrac += xover)
+    {
+      if (xfrac >= dw)
+	{
+	  xfrac -= dw;
+	  sxf++;
+	}
+      sx = sxf >> 8;
+      xofs[dx] = sx * bytes_per_pixel;
+      xweight[dx] = (sx < sw - 1) ? (sxf & 0xff) : 0;
+    }
+
   ystep = (sh << 8) / dh;
   yover = (sh << 8) % dh;
 
   for (dy = 0, syf = 0, yfrac = 0; dy < dh; dy++, syf += ystep, yfrac += yover)
     {
+      unsigned v;
+
       if (yfrac >= dh)
 	{
 	  yfrac -= dh;
 	  syf++;
 	}
       sy = syf >> 8;
-      dptr = ddata + dy * dstride;
-      dline_end = dptr + dw * bytes_per_pixel;
-      sline = sdata + sy * sstride;
-      for (sxf = 0, xfrac = 0; dptr < dline_end; sxf += xstep, xfrac += xover, dptr += bytes_per_pixel)
-        {
-          grub_uint8_t *sptr;
-          int comp;
+      v = (sy < sh - 1) ? (syf & 0xff) : 0;
 
-	  if (xfrac >= dw)
-	    {
-	      xfrac -= dw;
-	      sxf++;
-	    }
+      if (row_sy[sy & 1] != sy)
+	{
+	  scale_bilinear_row (rows[sy & 1], sdata + sy * sstride,
+			      xofs, xweight, dw, bytes_per_pixel);
+	  row_sy[sy & 1] = sy;
+	}
+      if (v && row_sy[(sy + 1) & 1] != sy + 1)
+	{
+	  scale_bilinear_row (rows[(sy + 1) & 1],
+			      sdata + (sy + 1) * sstride,
+			      xofs, xweight, dw, bytes_per_pixel);
+	  row_sy[(sy + 1) & 1] = sy + 1;
+	}
 
-          /* Get the address of the pixels in src and dst. */
-	  sx = sxf >> 8;
-	  sptr = sline + sx * bytes_per_pixel;
-
-          /* If we have enough space to do so, use bilinear interpolation.
-             Otherwise, fall back to nearest neighbor for this pixel. */
-          if (sx < sw - 1 && sy < sh - 1)
-            {
-              /* Do bilinear interpolation. */
-
-              /* Fixed-point .8 numbers representing the fraction of the
-                 distance in the x (u) and y (v) direction within the
-                 box of 4 pixels in the source. */
-              unsigned u = sxf & 0xff;
-              unsigned v = syf & 0xff;
-
-              for (comp = 0; comp < bytes_per_pixel; comp++)
-                {
-                  /* Get the component's values for the
-                     four source corner pixels. */
-                  unsigned f00 = sptr[comp];
-                  unsigned f10 = sptr[comp + bytes_per_pixel];
-                  unsigned f01 = sptr[comp + sstride];
-                  unsigned f11 = sptr[comp + sstride + bytes_per_pixel];
-
-                  /* Count coeffecients. */
-                  unsigned c00 = (256 - u) * (256 - v);
-                  unsigned c10 = u * (256 - v);
-                  unsigned c01 = (256 - u) * v;
-                  unsigned c11 = u * v;
-
-                  /* Interpolate. */
-                  unsigned fxy = c00 * f00 + c01 * f01 + c10 * f10 + c11 * f11;
-                  fxy = fxy >> 16;
-
-                  dptr[comp] = fxy;
-                }
-            }
-          else
-            {
-              /* Fall back to nearest neighbor interpolation. */
-              /* Copy the pixel color value. */
-              for (comp = 0; comp < bytes_per_pixel; comp++)
-                dptr[comp] = sptr[comp];
-            }
-        }
+      scale_bilinear_blend (ddata + dy * dstride, rows[sy & 1],
+			    rows[(sy + 1) & 1], v, row_len);
     }
+
+  grub_free (xofs);
+  grub_free (xweight);
+  grub_free (rows[0]);
   return GRUB_ERR_NONE;
 }
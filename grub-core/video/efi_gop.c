@@ -52,6 +52,84 @@ static struct
   grub_uint8_t *offscreen;
 } framebuffer;
 
+/* QueryMode answers of gop, asked once per mode: some firmware takes tens
+   of milliseconds per call, and the mode list is walked on every mode
+   set.  */
+enum
+  {
+    MODE_UNKNOWN,
+    MODE_VALID,
+    MODE_INVALID
+  };
+
+static struct
+{
+  struct grub_efi_gop *gop;
+  unsigned count;
+  grub_uint8_t *state;
+  struct grub_efi_gop_mode_info *info;
+} mode_cache;
+
+static void
+mode_cache_free (void)
+{
+  grub_free (mode_cache.state);
+  grub_free (mode_cache.info);
+  grub_memset (&mode_cache, 0, sizeof (mode_cache));
+}
+
+static struct grub_efi_gop_mode_info *
+grub_video_gop_query_mode (unsigned mode)
+{
+  static struct grub_efi_gop_mode_info uncached;
+  struct grub_efi_gop_mode_info *ret, *info = NULL;
+  grub_efi_uintn_t size;
+  grub_efi_status_t status;
+
+  if (mode_cache.gop != gop)
+    {
+      mode_cache_free ();
+      mode_cache.state = grub_zalloc (gop->mode->max_mode);
+      mode_cache.info = grub_malloc (gop->mode->max_mode
+				     * sizeof (mode_cache.info[0]));
+      if (mode_cache.state && mode_cache.info)
+	{
+	  mode_cache.gop = gop;
+	  mode_cache.count = gop->mode->max_mode;
+	}
+      else
+	{
+	  mode_cache_free ();
+	  grub_errno = GRUB_ERR_NONE;
+	}
+    }
+
+  if (mode < mode_cache.count)
+    {
+      if (mode_cache.state[mode] == MODE_VALID)
+	return &mode_cache.info[mode];
+      if (mode_cache.state[mode] == MODE_INVALID)
+	return NULL;
+      ret = &mode_cache.info[mode];
+    }
+  else
+    ret = &uncached;
+
+  status = efi_call_4 (gop->query_mode, gop, mode, &size, &info);
+  if (status || !info)
+    {
+      if (mode < mode_cache.count)
+	mode_cache.state[mode] = MODE_INVALID;
+      return NULL;
+    }
+
+  grub_memcpy (ret, info, sizeof (*ret));
+  efi_call_1 (grub_efi_system_table->boot_services->free_pool, info);
+  if (mode < mode_cache.count)
+    mode_cache.state[mode] = MODE_VALID;
+  return ret;
+}
+
 static int
 check_protocol_hook (const struct grub_video_mode_info *info __attribute__ ((unused)), void *hook_arg)
 {
@@ -263,19 +341,13 @@ grub_video_gop_iterate (int (*hook) (const struct grub_video_mode_info *info, vo
 
   for (mode = 0; mode < gop->mode->max_mode; mode++)
     {
-      grub_efi_uintn_t size;
-      grub_efi_status_t status;
-      struct grub_efi_gop_mode_info *info = NULL;
+      struct grub_efi_gop_mode_info *info;
       grub_err_t err;
       struct grub_video_mode_info mode_info;
-	 
-      status = efi_call_4 (gop->query_mode, gop, mode, &size, &info);
 
-      if (status)
-	{
-	  info = 0;
-	  continue;
-	}
+      info = grub_video_gop_query_mode (mode);
+      if (!info)
+	continue;
 
       err = grub_video_gop_fill_mode_info (mode, info, &mode_info);
       if (err)
@@ -397,15 +469,9 @@ grub_video_gop_setup (unsigned int width, unsigned int height,
       grub_dprintf ("video", "GOP: %d modes detected\n", gop->mode->max_mode);
       for (mode = 0; mode < gop->mode->max_mode; mode++)
 	{
-	  grub_efi_uintn_t size;
-	  grub_efi_status_t status;
-	 
-	  status = efi_call_4 (gop->query_mode, gop, mode, &size, &info);
-	  if (status)
-	    {
-	      info = 0;
-	      continue;
-	    }
+	  info = grub_video_gop_query_mode (mode);
+	  if (!info)
+	    continue;
 
 	  grub_dprintf ("video", "GOP: mode %d: %dx%d\n", mode, info->width,
 			info->height);
@@ -623,4 +689,5 @@ GRUB_MOD_FINI(efi_gop)
     }
   if (gop)
     grub_video_unregister (&grub_video_gop_adapter);
+  mode_cache_free ();
 }
@@ -769,8 +769,8 @@ grub_video_fbblit_replace_BGRX8888_RGBX8888 (struct grub_video_fbblit_info *dst,
 {
   int i;
   int j;
-  grub_uint8_t *srcptr;
-  grub_uint8_t *dstptr;
+  grub_uint32_t *srcptr;
+  grub_uint32_t *dstptr;
   unsigned int srcrowskip;
   unsigned int dstrowskip;
 
@@ -786,29 +786,16 @@ grub_video_fbblit_replace_BGRX8888_RGBX8888 (struct grub_video_fbblit_info *dst,
     {
       for (i = 0; i < width; i++)
         {
-#ifdef GRUB_CPU_WORDS_BIGENDIAN
-          grub_uint8_t a = *srcptr++;
-#endif
-          grub_uint8_t r = *srcptr++;
-          grub_uint8_t g = *srcptr++;
-          grub_uint8_t b = *srcptr++;
-#ifndef GRUB_CPU_WORDS_BIGENDIAN
-          grub_uint8_t a = *srcptr++;
-#endif
+          grub_uint32_t color = *srcptr++;
 
-#ifdef GRUB_CPU_WORDS_BIGENDIAN
-          *dstptr++ = a;
-#endif
-          *dstptr++ = b;
-          *dstptr++ = g;
-          *dstptr++ = r;
-#ifndef GRUB_CPU_WORDS_BIGENDIAN
-          *dstptr++ = a;
-#endif
+          /* Red and blue trade places, which are the outer colour bytes
+             of the word in either byte order.  */
+          *dstptr++ = (color & 0xFF00FF00)
+            | ((color >> 16) & 0xFF) | ((color & 0xFF) << 16);
         }
 
-      srcptr += srcrowskip;
-      dstptr += dstrowskip;
+      GRUB_VIDEO_FB_ADVANCE_POINTER (srcptr, srcrowskip);
+      GRUB_VIDEO_FB_ADVANCE_POINTER (dstptr, dstrowskip);
     }
 }
 
@@ -1159,6 +1146,24 @@ alpha_dilute (grub_uint8_t bg, grub_uint8_t fg, grub_uint8_t alpha)
   return h;
 }
 
+/* Blend the three colour bytes of FG over those of BG, two channels per
+   multiplication: each 16-bit lane holds at most 255 * 255, and dividing
+   by 255 rounds down exactly like alpha_dilute, in both lanes at once.
+   The top byte of the result is 0.  */
+static inline grub_uint32_t
+alpha_dilute_word (grub_uint32_t bg, grub_uint32_t fg, unsigned int alpha)
+{
+  grub_uint32_t rb, g;
+
+  rb = (fg & 0x00FF00FF) * alpha + (bg & 0x00FF00FF) * (255 ^ alpha);
+  g = ((fg >> 8) & 0xFF) * alpha + ((bg >> 8) & 0xFF) * (255 ^ alpha);
+
+  rb = ((rb + 0x00010001 + ((rb >> 8) & 0x00FF00FF)) >> 8) & 0x00FF00FF;
+  g = (g + 1 + (g >> 8)) >> 8;
+
+  return rb | (g << 8);
+}
+
 /* Generic blending blitter.  Works for every supported format.  */
 static void
 grub_video_fbblit_blend (struct grub_video_fbblit_info *dst,
@@ -1245,13 +1250,7 @@ grub_video_fbblit_blend_BGRA8888_RGBA8888 (struct grub_video_fbblit_info *dst,
       for (i = 0; i < width; i++)
         {
           grub_uint32_t color;
-          unsigned int sr;
-          unsigned int sg;
-          unsigned int sb;
           unsigned int a;
-          unsigned int dr;
-          unsigned int dg;
-          unsigned int db;
 
           color = *srcptr++;
 
@@ -1264,33 +1263,15 @@ grub_video_fbblit_blend_BGRA8888_RGBA8888 (struct grub_video_fbblit_info *dst,
               continue;
             }
 
-          sr = (color >> 0) & 0xFF;
-          sg = (color >> 8) & 0xFF;
-          sb = (color >> 16) & 0xFF;
+          /* Swap red and blue into the destination's order.  */
+          color = (color & 0x0000FF00)
+            | ((color >> 16) & 0xFF) | ((color & 0xFF) << 16);
 
-          if (a == 255)
-            {
-              /* Opaque pixel shortcut.  */
-              dr = sr;
-              dg = sg;
-              db = sb;
-            }
-          else
-            {
-              /* General pixel color blending.  */
-              color = *dstptr;
-
-              dr = (color >> 16) & 0xFF;
-              dr = alpha_dilute (dr, sr, a);
-              dg = (color >> 8) & 0xFF;
-              dg = alpha_dilute (dg, sg, a);
-              db = (color >> 0) & 0xFF;
-              db = alpha_dilute (db, sb, a);
-            }
-
-          color = (a << 24) | (dr << 16) | (dg << 8) | db;
+          /* Opaque pixels are copied, others blended.  */
+          if (a != 255)
+            color = alpha_dilute_word (*dstptr, color, a);
 
-          *dstptr++ = color;
+          *dstptr++ = (a << 24) | color;
         }
 
       GRUB_VIDEO_FB_ADVANCE_POINTER (srcptr, srcrowskip);
@@ -1405,13 +1386,7 @@ grub_video_fbblit_blend_RGBA8888_RGBA8888 (struct grub_video_fbblit_info *dst,
   int j;
   grub_uint32_t *srcptr;
   grub_uint32_t *dstptr;
-  unsigned int sr;
-  unsigned int sg;
-  unsigned int sb;
   unsigned int a;
-  unsigned int dr;
-  unsigned int dg;
-  unsigned int db;
   grub_size_t srcrowskip;
   grub_size_t dstrowskip;
 
@@ -1441,23 +1416,8 @@ grub_video_fbblit_blend_RGBA8888_RGBA8888 (struct grub_video_fbblit_info *dst,
               continue;
             }
 
-          sr = (color >> 0) & 0xFF;
-          sg = (color >> 8) & 0xFF;
-          sb = (color >> 16) & 0xFF;
-
-          color = *dstptr;
-
-          dr = (color >> 0) & 0xFF;
-          dg = (color >> 8) & 0xFF;
-          db = (color >> 16) & 0xFF;
-
-          dr = alpha_dilute (dr, sr, a);
-          dg = alpha_dilute (dg, sg, a);
-          db = alpha_dilute (db, sb, a);
-
-          color = (a << 24) | (db << 16) | (dg << 8) | dr;
-
-          *dstptr++ = color;
+          *dstptr = (a << 24) | alpha_dilute_word (*dstptr, color, a);
+          dstptr++;
         }
       GRUB_VIDEO_FB_ADVANCE_POINTER (srcptr, srcrowskip);
       GRUB_VIDEO_FB_ADVANCE_POINTER (dstptr, dstrowskip);
@@ -1664,6 +1624,49 @@ grub_video_fbblit_blend_XXXA8888_1bit (struct grub_video_fbblit_info *dst,
 				    src->mode_info->bg_blue,
 				    src->mode_info->bg_alpha);
 
+  /* Glyphs are drawn opaque over a transparent background, so pixels are
+     either replaced or left alone, and the mostly empty source bytes can
+     be skipped eight pixels at a time.  */
+  if (src->mode_info->fg_alpha == 255 && src->mode_info->bg_alpha == 0)
+    {
+      for (j = 0; j < height; j++)
+	{
+	  for (i = 0; i < width; )
+	    {
+	      if (srcmask == 0x80 && *srcptr == 0 && width - i >= 8)
+		{
+		  srcptr++;
+		  dstptr += 8;
+		  i += 8;
+		  continue;
+		}
+
+	      if (*srcptr & srcmask)
+		*dstptr = fgcolor;
+
+	      srcmask >>= 1;
+	      if (!srcmask)
+		{
+		  srcptr++;
+		  srcmask = 0x80;
+		}
+	      dstptr++;
+	      i++;
+	    }
+
+	  srcptr += srcrowskipbyte;
+	  if (srcmask >> srcrowskipbit)
+	    srcmask >>= srcrowskipbit;
+	  else
+	    {
+	      srcptr++;
+	      srcmask <<= 8 - srcrowskipbit;
+	    }
+	  GRUB_VIDEO_FB_ADVANCE_POINTER (dstptr, dstrowskip);
+	}
+      return;
+    }
+
   for (j = 0; j < height; j++)
     {
       for (i = 0; i < width; i++)
@@ -31,10 +31,21 @@ GRUB_MOD_LICENSE ("GPLv3+");
 typedef grub_err_t (*grub_video_fb_doublebuf_update_screen_t) (void);
 typedef volatile void *framebuf_t;
 
+/* Damage is kept as a few rectangles rather than one bounding box, so
+   that a blinking cursor and a progress bar at opposite ends of the
+   screen don't make every update copy everything in between.  */
+#define DIRTY_MAX_RECTS 4
+
+struct dirty_rect
+{
+  int x1, y1;
+  int x2, y2;
+};
+
 struct dirty
 {
-  int first_line;
-  int last_line;
+  unsigned int count;
+  struct dirty_rect rects[DIRTY_MAX_RECTS];
 };
 
 static struct
@@ -829,15 +840,63 @@ grub_video_fb_unmap_color_int (struct grub_video_fbblit_info * source,
     }
 }
 
+static inline int
+dirty_rect_area (const struct dirty_rect *rect)
+{
+  return (rect->x2 - rect->x1) * (rect->y2 - rect->y1);
+}
+
+static inline void
+dirty_rect_union (struct dirty_rect *rect, const struct dirty_rect *other)
+{
+  if (rect->x1 > other->x1)
+    rect->x1 = other->x1;
+  if (rect->y1 > other->y1)
+    rect->y1 = other->y1;
+  if (rect->x2 < other->x2)
+    rect->x2 = other->x2;
+  if (rect->y2 < other->y2)
+    rect->y2 = other->y2;
+}
+
 static void
-dirty (int y, int height)
+dirty (int x, int y, int width, int height)
 {
+  struct dirty *d = &framebuffer.current_dirty;
+  struct dirty_rect rect = { x, y, x + width, y + height };
+  struct dirty_rect merged;
+  unsigned int i, best = 0;
+  int growth, best_growth = -1;
+
   if (framebuffer.render_target != framebuffer.back_target)
     return;
-  if (framebuffer.current_dirty.first_line > y)
-    framebuffer.current_dirty.first_line = y;
-  if (framebuffer.current_dirty.last_line < y + height)
-    framebuffer.current_dirty.last_line = y + height;
+  if (width <= 0 || height <= 0)
+    return;
+
+  /* Find the rectangle that gains the least area by taking this one in;
+     for one that overlaps it or lies next to it that is nothing beyond
+     the area of this one.  Only start a new rectangle if every merge
+     would cost more.  */
+  for (i = 0; i < d->count; i++)
+    {
+      merged = d->rects[i];
+      dirty_rect_union (&merged, &rect);
+      growth = dirty_rect_area (&merged) - dirty_rect_area (&d->rects[i])
+	- dirty_rect_area (&rect);
+      if (best_growth < 0 || growth < best_growth)
+	{
+	  best = i;
+	  best_growth = growth;
+	}
+    }
+
+  if (d->count < DIRTY_MAX_RECTS && (d->count == 0 || best_growth > 0))
+    {
+      d->rects[d->count++] = rect;
+      return;
+    }
+
+  dirty_rect_union (&d->rects[best], &rect);
 }
 
 grub_err_t
@@ -895,7 +954,7 @@ grub_video_fb_fill_rect (grub_video_color_t color, int x, int y,
   x += area_x;
   y += area_y;
 
-  dirty (y, height);
+  dirty (x, y, width, height);
 
   /* Use fbblit_info to encapsulate rendering.  */
   target.mode_info = &framebuffer.render_target->mode_info;
@@ -1008,7 +1067,7 @@ grub_video_fb_blit_source (struct grub_video_fbblit_info *source,
   target.data = framebuffer.render_target->data;
 
   /* Do actual blitting.  */
-  dirty (y, height);
+  dirty (x, y, width, height);
   grub_video_fb_dispatch_blit (&target, source, oper, x, y, width, height,
                                offset_x, offset_y);
 
@@ -1060,7 +1119,9 @@ grub_video_fb_scroll (grub_video_color_t color, int dx, int dy)
   width = framebuffer.render_target->viewport.width - grub_abs (dx);
   height = framebuffer.render_target->viewport.height - grub_abs (dy);
 
-  dirty (framebuffer.render_target->viewport.y,
+  dirty (framebuffer.render_target->viewport.x,
+	 framebuffer.render_target->viewport.y,
+	 framebuffer.render_target->viewport.width,
 	 framebuffer.render_target->viewport.height);
 
   if (dx < 0)
@@ -1412,23 +1473,47 @@ grub_video_fb_get_active_render_target (struct grub_video_fbrender_target **targ
   return GRUB_ERR_NONE;
 }
 
+/* Copy what D marks as damaged from the back buffer to PAGE.  */
+static void
+dirty_copy (const struct dirty *d, framebuf_t page)
+{
+  struct grub_video_mode_info *mode_info = &framebuffer.back_target->mode_info;
+  const struct dirty_rect *rect;
+  grub_size_t offset, len;
+  unsigned int i;
+  int y;
+
+  for (i = 0; i < d->count; i++)
+    {
+      rect = &d->rects[i];
+      offset = rect->y1 * mode_info->pitch;
+
+      /* Whole lines in one go, or when pixels don't fill whole bytes.  */
+      if (mode_info->bpp < 8
+	  || (rect->x1 == 0 && rect->x2 == (int) mode_info->width))
+	{
+	  grub_memcpy ((char *) page + offset,
+		       (char *) framebuffer.back_target->data + offset,
+		       mode_info->pitch * (rect->y2 - rect->y1));
+	  continue;
+	}
+
+      offset += rect->x1 * mode_info->bytes_per_pixel;
+      len = (rect->x2 - rect->x1) * mode_info->bytes_per_pixel;
+      for (y = rect->y1; y < rect->y2; y++)
+	{
+	  grub_memcpy ((char *) page + offset,
+		       (char *) framebuffer.back_target->data + offset, len);
+	  offset += mode_info->pitch;
+	}
+    }
+}
+
 static grub_err_t
 doublebuf_blit_update_screen (void)
 {
-  if (framebuffer.current_dirty.first_line
-      <= framebuffer.current_dirty.last_line)
-    grub_memcpy ((char *) framebuffer.pages[0]
-		 + framebuffer.current_dirty.first_line
-		 * framebuffer.back_target->mode_info.pitch,
-		 (char *) framebuffer.back_target->data
-		 + framebuffer.current_dirty.first_line
-		 * framebuffer.back_target->mode_info.pitch,
-		 framebuffer.back_target->mode_info.pitch
-		 * (framebuffer.current_dirty.last_line
-		    - framebuffer.current_dirty.first_line));
-  framebuffer.current_dirty.first_line
-    = framebuffer.back_target->mode_info.height;
-  framebuffer.current_dirty.last_line = 0;
+  dirty_copy (&framebuffer.current_dirty, framebuffer.pages[0]);
+  framebuffer.current_dirty.count = 0;
 
   return GRUB_ERR_NONE;
 }
@@ -1461,8 +1546,7 @@ grub_video_fb_doublebuf_blit_init (struct grub_video_fbrender_target **back,
   framebuffer.pages[0] = framebuf;
   framebuffer.displayed_page = 0;
   framebuffer.render_page = 0;
-  framebuffer.current_dirty.first_line = mode_info.height;
-  framebuffer.current_dirty.last_line = 0;
+  framebuffer.current_dirty.count = 0;
 
   return GRUB_ERR_NONE;
 }
@@ -1472,26 +1556,15 @@ doublebuf_pageflipping_update_screen (void)
 {
   int new_displayed_page;
   grub_err_t err;
-  int first_line, last_line;
-
-  first_line = framebuffer.current_dirty.first_line;
-  last_line = framebuffer.current_dirty.last_line;
-  if (first_line > framebuffer.previous_dirty.first_line)
-    first_line = framebuffer.previous_dirty.first_line;
-  if (last_line < framebuffer.previous_dirty.last_line)
-    last_line = framebuffer.previous_dirty.last_line;
-
-  if (first_line <= last_line)
-    grub_memcpy ((char *) framebuffer.pages[framebuffer.render_page]
-		 + first_line * framebuffer.back_target->mode_info.pitch,
-		 (char *) framebuffer.back_target->data
-		 + first_line * framebuffer.back_target->mode_info.pitch,
-		 framebuffer.back_target->mode_info.pitch
-		 * (last_line - first_line));
+
+  /* The page being drawn lacks what changed since either page was last
+     shown.  */
+  dirty_copy (&framebuffer.previous_dirty,
+	      framebuffer.pages[framebuffer.render_page]);
+  dirty_copy (&framebuffer.current_dirty,
+	      framebuffer.pages[framebuffer.render_page]);
   framebuffer.previous_dirty = framebuffer.current_dirty;
-  framebuffer.current_dirty.first_line
-    = framebuffer.back_target->mode_info.height;
-  framebuffer.current_dirty.last_line = 0;
+  framebuffer.current_dirty.count = 0;
 
   /* Swap the page numbers in the framebuffer struct.  */
   new_displayed_page = framebuffer.render_page;
@@ -1544,12 +1617,8 @@ doublebuf_pageflipping_init (struct grub_video_mode_info *mode_info,
   framebuffer.pages[0] = page0_ptr;
   framebuffer.pages[1] = page1_ptr;
 
-  framebuffer.current_dirty.first_line
-    = framebuffer.back_target->mode_info.height;
-  framebuffer.current_dirty.last_line = 0;
-  framebuffer.previous_dirty.first_line
-    = framebuffer.back_target->mode_info.height;
-  framebuffer.previous_dirty.last_line = 0;
+  framebuffer.current_dirty.count = 0;
+  framebuffer.previous_dirty.count = 0;
 
   /* Set the framebuffer memory data pointer and display the right page.  */
   err = set_page_in (framebuffer.displayed_page);
@@ -1635,9 +1704,7 @@ grub_video_fb_setup (unsigned int mode_type, unsigned int mode_mask,
   framebuffer.displayed_page = 0;
   framebuffer.render_page = 0;
   framebuffer.set_page = 0;
-  framebuffer.current_dirty.first_line
-    = framebuffer.back_target->mode_info.height;
-  framebuffer.current_dirty.last_line = 0;
+  framebuffer.current_dirty.count = 0;
 
   mode_info->mode_type &= ~GRUB_VIDEO_MODE_TYPE_DOUBLE_BUFFERED;
 
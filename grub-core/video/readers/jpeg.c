@@ -57,6 +57,21 @@ enum
 
 #define JPEG_UNIT_SIZE		8
 
+/* Huffman codes up to this long are decoded with a single table lookup.  */
+#define JPEG_HUFF_LOOKUP_BITS	9
+
+/* Entropy coded data is read from the file in chunks of this size.  */
+#define JPEG_INPUT_SIZE		4096
+
+#ifdef GRUB_CPU_WORDS_BIGENDIAN
+#define JPEG_RED_OFFSET		2
+#define JPEG_BLUE_OFFSET	0
+#else
+#define JPEG_RED_OFFSET		0
+#define JPEG_BLUE_OFFSET	2
+#endif
+#define JPEG_GREEN_OFFSET	1
+
 static const grub_uint8_t jpeg_zigzag_order[64] = {
   0, 1, 8, 16, 9, 2, 3, 10,
   17, 24, 32, 25, 18, 11, 4, 5,
@@ -74,6 +89,12 @@ static grub_command_t cmd;
 
 typedef int jpeg_data_unit_t[64];
 
+/* Colour conversion terms, indexed by the Cr or Cb sample.  */
+static int jpeg_cr_r[256];
+static int jpeg_cr_g[256];
+static int jpeg_cb_g[256];
+static int jpeg_cb_b[256];
+
 struct grub_jpeg_data
 {
   grub_file_t file;
@@ -83,9 +104,23 @@ struct grub_jpeg_data
   unsigned image_width;
   unsigned image_height;
 
+  /* The image is decoded at 1 / (1 << scale) of its size, OUT_WIDTH by
+     OUT_HEIGHT, picking the largest scale that keeps it at least
+     MIN_WIDTH by MIN_HEIGHT.  */
+  unsigned min_width, min_height;
+  unsigned scale;
+  /* Chroma subsampled in both directions is decoded one step larger,
+     which is then exactly the output resolution.  */
+  unsigned chroma_scale;
+  unsigned out_width, out_height;
+
   grub_uint8_t *huff_value[4];
   int huff_offset[4][16];
   int huff_maxval[4][16];
+  /* Length << 8 | value for every code of up to JPEG_HUFF_LOOKUP_BITS,
+     indexed by the next JPEG_HUFF_LOOKUP_BITS of input, 0 for longer
+     codes.  */
+  grub_uint16_t huff_lookup[4][1 << JPEG_HUFF_LOOKUP_BITS];
 
   grub_uint8_t quan_table[2][64];
   int comp_index[3][3];
@@ -96,13 +131,22 @@ struct grub_jpeg_data
 
   unsigned log_vs, log_hs;
   int dri;
-  unsigned r1;
+  unsigned r1, c1;
 
   int dc_value[3];
 
   int color_components;
 
-  int bit_mask, bit_save;
+  grub_uint8_t in_buf[JPEG_INPUT_SIZE];
+  unsigned in_pos, in_len;
+
+  /* Unconsumed input bits, most significant first.  Once a marker is
+     reached the buffer is padded with zeros, BIT_PAD of which are still
+     in it.  */
+  grub_uint32_t bit_buf;
+  int bit_cnt;
+  int bit_pad;
+  int bit_eos;
 };
 
 static grub_uint8_t
@@ -127,43 +171,104 @@ grub_jpeg_get_word (struct grub_jpeg_data *data)
   return grub_be_to_cpu16 (r);
 }
 
+/* Next byte of entropy coded data, or -1 at the end of the file.  */
 static int
-grub_jpeg_get_bit (struct grub_jpeg_data *data)
+grub_jpeg_next_byte (struct grub_jpeg_data *data)
 {
-  int ret;
+  if (data->in_pos == data->in_len)
+    {
+      grub_ssize_t len;
+
+      len = grub_file_read (data->file, data->in_buf, sizeof (data->in_buf));
+      if (len <= 0)
+	return -1;
+      data->in_pos = 0;
+      data->in_len = len;
+    }
 
-  if (data->bit_mask == 0)
+  return data->in_buf[data->in_pos++];
+}
+
+/* Give back the bytes read ahead into IN_BUF, so that the file is
+   positioned right after the entropy coded data again.  */
+static void
+grub_jpeg_sync_input (struct grub_jpeg_data *data)
+{
+  if (data->in_pos != data->in_len)
+    grub_file_seek (data->file,
+		    data->file->offset - (data->in_len - data->in_pos));
+  data->in_pos = data->in_len = 0;
+}
+
+/* Top BIT_BUF up to at least 25 bits.  */
+static void
+grub_jpeg_fill_bits (struct grub_jpeg_data *data)
+{
+  while (data->bit_cnt <= 24)
     {
-      data->bit_save = grub_jpeg_get_byte (data);
-      if (data->bit_save == JPEG_ESC_CHAR)
+      int c = 0;
+
+      if (!data->bit_eos)
 	{
-	  if (grub_jpeg_get_byte (data) != 0)
+	  c = grub_jpeg_next_byte (data);
+	  if (c == JPEG_ESC_CHAR)
 	    {
-	      grub_error (GRUB_ERR_BAD_FILE_TYPE,
-			  "jpeg: invalid 0xFF in data stream");
-	      return 0;
+	      int c2;
+
+	      c2 = grub_jpeg_next_byte (data);
+	      if (c2 != 0)
+		{
+		  /* A marker.  Leave it to grub_jpeg_decode_jpeg and pad the
+		     data with zeros from here on.  */
+		  data->bit_eos = 1;
+		  if (c2 > 0)
+		    {
+		      grub_file_seek (data->file, data->file->offset
+				      - (data->in_len - data->in_pos) - 2);
+		      data->in_pos = data->in_len = 0;
+		    }
+		}
 	    }
+	  else if (c < 0)
+	    data->bit_eos = 1;
+	  if (data->bit_eos)
+	    c = 0;
 	}
-      data->bit_mask = 0x80;
+      if (data->bit_eos)
+	data->bit_pad += 8;
+
+      data->bit_buf |= (grub_uint32_t) c << (24 - data->bit_cnt);
+      data->bit_cnt += 8;
     }
+}
 
-  ret = ((data->bit_save & data->bit_mask) != 0);
-  data->bit_mask >>= 1;
-  return ret;
+static inline void
+grub_jpeg_skip_bits (struct grub_jpeg_data *data, int num)
+{
+  data->bit_buf <<= num;
+  data->bit_cnt -= num;
 }
 
 static int
 grub_jpeg_get_number (struct grub_jpeg_data *data, int num)
 {
-  int value, i, msb;
+  int value;
 
   if (num == 0)
     return 0;
 
-  msb = value = grub_jpeg_get_bit (data);
-  for (i = 1; i < num; i++)
-    value = (value << 1) + (grub_jpeg_get_bit (data) != 0);
-  if (!msb)
+  if (num > 16)
+    {
+      grub_error (GRUB_ERR_BAD_FILE_TYPE, "jpeg: invalid coefficient size");
+      return 0;
+    }
+
+  if (data->bit_cnt < num)
+    grub_jpeg_fill_bits (data);
+
+  value = data->bit_buf >> (32 - num);
+  grub_jpeg_skip_bits (data, num);
+  if (value < (1 << (num - 1)))
     value += 1 - (1 << num);
 
   return value;
@@ -175,14 +280,24 @@ grub_jpeg_get_huff_code (struct grub_jpeg_data *data, int id)
   int code;
   unsigned i;
 
-  code = 0;
-  for (i = 0; i < ARRAY_SIZE (data->huff_maxval[id]); i++)
+  if (data->bit_cnt < 16)
+    grub_jpeg_fill_bits (data);
+
+  code = data->huff_lookup[id][data->bit_buf >> (32 - JPEG_HUFF_LOOKUP_BITS)];
+  if (code)
+    {
+      grub_jpeg_skip_bits (data, code >> 8);
+      return code & 0xff;
+    }
+
+  for (i = JPEG_HUFF_LOOKUP_BITS; i < ARRAY_SIZE (data->huff_maxval[id]); i++)
     {
-      code <<= 1;
-      if (grub_jpeg_get_bit (data))
-	code++;
+      code = data->bit_buf >> (31 - i);
       if (code < data->huff_maxval[id][i])
-	return data->huff_value[id][code + data->huff_offset[id][i]];
+	{
+	  grub_jpeg_skip_bits (data, i + 1);
+	  return data->huff_value[id][code + data->huff_offset[id][i]];
+	}
     }
   grub_error (GRUB_ERR_BAD_FILE_TYPE, "jpeg: huffman decode fails");
   return 0;
@@ -217,6 +332,7 @@ grub_jpeg_decode_huff_table (struct grub_jpeg_data *data)
 	n += count[i];
 
       id += ac * 2;
+      grub_free (data->huff_value[id]);
       data->huff_value[id] = grub_malloc (n);
       if (grub_errno)
 	return grub_errno;
@@ -224,10 +340,30 @@ grub_jpeg_decode_huff_table (struct grub_jpeg_data *data)
       if (grub_file_read (data->file, data->huff_value[id], n) != n)
 	return grub_errno;
 
+      grub_memset (data->huff_lookup[id], 0, sizeof (data->huff_lookup[id]));
       base = 0;
       ofs = 0;
       for (i = 0; i < ARRAY_SIZE (count); i++)
 	{
+	  if (base + count[i] > (2 << i))
+	    return grub_error (GRUB_ERR_BAD_FILE_TYPE,
+			       "jpeg: invalid huffman table");
+
+	  if (i < JPEG_HUFF_LOOKUP_BITS)
+	    {
+	      unsigned shift = JPEG_HUFF_LOOKUP_BITS - 1 - i;
+	      int j, k;
+
+	      for (j = 0; j < count[i]; j++)
+		{
+		  grub_uint16_t entry;
+
+		  entry = ((i + 1) << 8) | data->huff_value[id][ofs + j];
+		  for (k = 0; k < (1 << shift); k++)
+		    data->huff_lookup[id][((base + j) << shift) + k] = entry;
+		}
+	    }
+
 	  base += count[i];
 	  ofs += count[i];
 
@@ -298,6 +434,16 @@ grub_jpeg_decode_sof (struct grub_jpeg_data *data)
   if ((!data->image_height) || (!data->image_width))
     return grub_error (GRUB_ERR_BAD_FILE_TYPE, "jpeg: invalid image size");
 
+  /* Halve the size as long as the result is still big enough, down to
+     an eighth, where a block is a single pixel.  */
+  data->scale = 0;
+  while (data->scale < 3
+	 && ((data->image_width + (2 << data->scale) - 1)
+	     >> (data->scale + 1)) >= data->min_width
+	 && ((data->image_height + (2 << data->scale) - 1)
+	     >> (data->scale + 1)) >= data->min_height)
+    data->scale++;
+
   cc = grub_jpeg_get_byte (data);
   if (cc != 1 && cc != 3)
     return grub_error (GRUB_ERR_BAD_FILE_TYPE,
@@ -348,17 +494,43 @@ grub_jpeg_decode_dri (struct grub_jpeg_data *data)
   return grub_errno;
 }
 
+static inline int
+grub_jpeg_clamp (int v)
+{
+  if ((unsigned) v > 255)
+    return v < 0 ? 0 : 255;
+  return v;
+}
+
+#define DESCALE(x) grub_jpeg_clamp (((x) >> (SHIFT_BITS * 2 + 3)) + 128)
+
+/* Full size IDCT.  COLS has a bit set for every column with a non-zero
+   AC coefficient; the others are all zero below the DC coefficient and
+   need no column pass.  */
 static void
-grub_jpeg_idct_transform (jpeg_data_unit_t du)
+grub_jpeg_idct_transform (jpeg_data_unit_t du, unsigned cols)
 {
   int *pd;
   int i;
   int t0, t1, t2, t3, t4, t5, t6, t7;
   int v0, v1, v2, v3, v4;
 
+  /* Only the DC coefficient: a flat block.  */
+  if (cols == 0)
+    {
+      v0 = grub_jpeg_clamp ((du[0] >> 3) + 128);
+      for (i = 0; i < JPEG_UNIT_SIZE * JPEG_UNIT_SIZE; i++)
+	du[i] = v0;
+      return;
+    }
+
+  cols |= 1;
   pd = du;
   for (i = 0; i < JPEG_UNIT_SIZE; i++, pd++)
     {
+      if (!(cols & (1 << i)))
+	continue;
+
       if ((pd[JPEG_UNIT_SIZE * 1] | pd[JPEG_UNIT_SIZE * 2] |
 	   pd[JPEG_UNIT_SIZE * 3] | pd[JPEG_UNIT_SIZE * 4] |
 	   pd[JPEG_UNIT_SIZE * 5] | pd[JPEG_UNIT_SIZE * 6] |
@@ -428,7 +600,7 @@ grub_jpeg_idct_transform (jpeg_data_unit_t du)
     {
       if ((pd[1] | pd[2] | pd[3] | pd[4] | pd[5] | pd[6] | pd[7]) == 0)
 	{
-	  pd[0] >>= (SHIFT_BITS + 3);
+	  pd[0] = grub_jpeg_clamp ((pd[0] >> (SHIFT_BITS + 3)) + 128);
 	  pd[1] = pd[2] = pd[3] = pd[4] = pd[5] = pd[6] = pd[7] = pd[0];
 	  continue;
 	}
@@ -467,32 +639,82 @@ grub_jpeg_idct_transform (jpeg_data_unit_t du)
       t6 = t6 * CONST (3.072711026) - v1 - v2;
       t7 = t7 * CONST (1.501321110) - v0 - v3;
 
-      pd[0] = (t0 + t7) >> (SHIFT_BITS * 2 + 3);
-      pd[7] = (t0 - t7) >> (SHIFT_BITS * 2 + 3);
-      pd[1] = (t1 + t6) >> (SHIFT_BITS * 2 + 3);
-      pd[6] = (t1 - t6) >> (SHIFT_BITS * 2 + 3);
-      pd[2] = (t2 + t5) >> (SHIFT_BITS * 2 + 3);
-      pd[5] = (t2 - t5) >> (SHIFT_BITS * 2 + 3);
-      pd[3] = (t3 + t4) >> (SHIFT_BITS * 2 + 3);
-      pd[4] = (t3 - t4) >> (SHIFT_BITS * 2 + 3);
+      pd[0] = DESCALE (t0 + t7);
+      pd[7] = DESCALE (t0 - t7);
+      pd[1] = DESCALE (t1 + t6);
+      pd[6] = DESCALE (t1 - t6);
+      pd[2] = DESCALE (t2 + t5);
+      pd[5] = DESCALE (t2 - t5);
+      pd[3] = DESCALE (t3 + t4);
+      pd[4] = DESCALE (t3 - t4);
     }
+}
+
+/* IDCTs for reduced size decoding.  They evaluate the low frequency
+   coefficients at 4, 2 or 1 points per row and column, which amounts to
+   a low-pass filter followed by subsampling.  The result is left in the
+   top left corner of DU.  */
+
+static void
+grub_jpeg_idct_4x4 (jpeg_data_unit_t du)
+{
+  int *pd;
+  int i;
+  int e0, e1, o0, o1;
 
-  for (i = 0; i < JPEG_UNIT_SIZE * JPEG_UNIT_SIZE; i++)
+  pd = du;
+  for (i = 0; i < 4; i++, pd++)
     {
-      du[i] += 128;
+      e0 = (pd[JPEG_UNIT_SIZE * 0] + pd[JPEG_UNIT_SIZE * 2]) << SHIFT_BITS;
+      e1 = (pd[JPEG_UNIT_SIZE * 0] - pd[JPEG_UNIT_SIZE * 2]) << SHIFT_BITS;
+      o0 = pd[JPEG_UNIT_SIZE * 1] * CONST (1.306562965)
+	+ pd[JPEG_UNIT_SIZE * 3] * CONST (0.541196100);
+      o1 = pd[JPEG_UNIT_SIZE * 1] * CONST (0.541196100)
+	- pd[JPEG_UNIT_SIZE * 3] * CONST (1.306562965);
+
+      pd[JPEG_UNIT_SIZE * 0] = e0 + o0;
+      pd[JPEG_UNIT_SIZE * 3] = e0 - o0;
+      pd[JPEG_UNIT_SIZE * 1] = e1 + o1;
+      pd[JPEG_UNIT_SIZE * 2] = e1 - o1;
+    }
 
-      if (du[i] < 0)
-	du[i] = 0;
-      if (du[i] > 255)
-	du[i] = 255;
+  pd = du;
+  for (i = 0; i < 4; i++, pd += JPEG_UNIT_SIZE)
+    {
+      e0 = (pd[0] + pd[2]) << SHIFT_BITS;
+      e1 = (pd[0] - pd[2]) << SHIFT_BITS;
+      o0 = pd[1] * CONST (1.306562965) + pd[3] * CONST (0.541196100);
+      o1 = pd[1] * CONST (0.541196100) - pd[3] * CONST (1.306562965);
+
+      pd[0] = DESCALE (e0 + o0);
+      pd[3] = DESCALE (e0 - o0);
+      pd[1] = DESCALE (e1 + o1);
+      pd[2] = DESCALE (e1 - o1);
     }
 }
+#undef DESCALE
+
+static void
+grub_jpeg_idct_2x2 (jpeg_data_unit_t du)
+{
+  int a, b, c, d;
+
+  a = du[0] + du[JPEG_UNIT_SIZE];
+  b = du[1] + du[JPEG_UNIT_SIZE + 1];
+  c = du[0] - du[JPEG_UNIT_SIZE];
+  d = du[1] - du[JPEG_UNIT_SIZE + 1];
+
+  du[0] = grub_jpeg_clamp (((a + b) >> 3) + 128);
+  du[1] = grub_jpeg_clamp (((a - b) >> 3) + 128);
+  du[JPEG_UNIT_SIZE] = grub_jpeg_clamp (((c + d) >> 3) + 128);
+  du[JPEG_UNIT_SIZE + 1] = grub_jpeg_clamp (((c - d) >> 3) + 128);
+}
 
 static void
 grub_jpeg_decode_du (struct grub_jpeg_data *data, int id, jpeg_data_unit_t du)
 {
   int h1, h2, qt;
-  unsigned pos;
+  unsigned pos, cols;
 
   grub_memset (du, 0, sizeof (jpeg_data_unit_t));
 
@@ -505,9 +727,11 @@ grub_jpeg_decode_du (struct grub_jpeg_data *data, int id, jpeg_data_unit_t du)
 
   du[0] = data->dc_value[id] * (int) data->quan_table[qt][0];
   pos = 1;
+  cols = 0;
   while (pos < ARRAY_SIZE (data->quan_table[qt]))
     {
       int num, val;
+      unsigned zz;
 
       num = grub_jpeg_get_huff_code (data, h2);
       if (!num)
@@ -516,57 +740,46 @@ grub_jpeg_decode_du (struct grub_jpeg_data *data, int id, jpeg_data_unit_t du)
       val = grub_jpeg_get_number (data, num & 0xF);
       num >>= 4;
       pos += num;
-      du[jpeg_zigzag_order[pos]] = val * (int) data->quan_table[qt][pos];
+      if (pos >= ARRAY_SIZE (data->quan_table[qt]))
+	{
+	  grub_error (GRUB_ERR_BAD_FILE_TYPE, "jpeg: invalid AC coefficient");
+	  return;
+	}
+      zz = jpeg_zigzag_order[pos];
+      du[zz] = val * (int) data->quan_table[qt][pos];
+      cols |= 1 << (zz % JPEG_UNIT_SIZE);
       pos++;
     }
 
-  grub_jpeg_idct_transform (du);
+  switch (id ? data->chroma_scale : data->scale)
+    {
+    case 0:
+      grub_jpeg_idct_transform (du, cols);
+      break;
+    case 1:
+      grub_jpeg_idct_4x4 (du);
+      break;
+    case 2:
+      grub_jpeg_idct_2x2 (du);
+      break;
+    default:
+      du[0] = grub_jpeg_clamp ((du[0] >> 3) + 128);
+      break;
+    }
 }
 
 static void
-grub_jpeg_ycrcb_to_rgb (int yy, int cr, int cb, grub_uint8_t * rgb)
+grub_jpeg_init_color_tables (void)
 {
-  int dd;
-
-  cr -= 128;
-  cb -= 128;
-
-  /* Red  */
-  dd = yy + ((cr * CONST (1.402)) >> SHIFT_BITS);
-  if (dd < 0)
-    dd = 0;
-  if (dd > 255)
-    dd = 255;
-#ifdef GRUB_CPU_WORDS_BIGENDIAN
-  rgb[2] = dd;
-#else
-  *(rgb++) = dd;
-#endif
-
-  /* Green  */
-  dd = yy - ((cb * CONST (0.34414) + cr * CONST (0.71414)) >> SHIFT_BITS);
-  if (dd < 0)
-    dd = 0;
-  if (dd > 255)
-    dd = 255;
-#ifdef GRUB_CPU_WORDS_BIGENDIAN
-  rgb[1] = dd;
-#else
-  *(rgb++) = dd;
-#endif
+  int i;
 
-  /* Blue  */
-  dd = yy + ((cb * CONST (1.772)) >> SHIFT_BITS);
-  if (dd < 0)
-    dd = 0;
-  if (dd > 255)
-    dd = 255;
-#ifdef GRUB_CPU_WORDS_BIGENDIAN
-  rgb[0] = dd;
-  rgb += 3;
-#else
-  *(rgb++) = dd;
-#endif
+  for (i = 0; i < 256; i++)
+    {
+      jpeg_cr_r[i] = ((i - 128) * CONST (1.402)) >> SHIFT_BITS;
+      jpeg_cr_g[i] = (i - 128) * CONST (0.71414);
+      jpeg_cb_g[i] = (i - 128) * CONST (0.34414);
+      jpeg_cb_b[i] = ((i - 128) * CONST (1.772)) >> SHIFT_BITS;
+    }
 }
 
 static grub_err_t
@@ -594,6 +807,9 @@ grub_jpeg_decode_sos (struct grub_jpeg_data *data)
 	return grub_error (GRUB_ERR_BAD_FILE_TYPE, "jpeg: invalid index");
 
       ht = grub_jpeg_get_byte (data);
+      if ((ht >> 4) > 1 || (ht & 0xF) > 1)
+	return grub_error (GRUB_ERR_BAD_FILE_TYPE,
+			   "jpeg: invalid huffman table index");
       data->comp_index[id][1] = (ht >> 4);
       data->comp_index[id][2] = (ht & 0xF) + 2;
     }
@@ -604,8 +820,15 @@ grub_jpeg_decode_sos (struct grub_jpeg_data *data)
   if (data->file->offset != data_offset)
     return grub_error (GRUB_ERR_BAD_FILE_TYPE, "jpeg: extra byte in sos");
 
-  if (grub_video_bitmap_create (data->bitmap, data->image_width,
-				data->image_height,
+  data->chroma_scale = data->scale;
+  if (data->scale && data->log_hs && data->log_vs)
+    data->chroma_scale--;
+  data->out_width = (data->image_width + (1 << data->scale) - 1)
+    >> data->scale;
+  data->out_height = (data->image_height + (1 << data->scale) - 1)
+    >> data->scale;
+  if (grub_video_bitmap_create (data->bitmap, data->out_width,
+				data->out_height,
 				GRUB_VIDEO_BLIT_FORMAT_RGB_888))
     return grub_errno;
 
@@ -616,63 +839,102 @@ grub_jpeg_decode_sos (struct grub_jpeg_data *data)
 static grub_err_t
 grub_jpeg_decode_data (struct grub_jpeg_data *data)
 {
-  unsigned c1, vb, hb, nr1, nc1;
+  unsigned c1, vb, hb, nr1, nc1, bs, log_bs, log_cvs, log_chs;
   int rst = data->dri;
 
-  vb = 8 << data->log_vs;
-  hb = 8 << data->log_hs;
-  nr1 = (data->image_height + vb - 1) >> (3 + data->log_vs);
-  nc1 = (data->image_width + hb - 1)  >> (3 + data->log_hs);
+  /* Blocks come out of the IDCT BS pixels square, at a row stride of
+     JPEG_UNIT_SIZE.  */
+  log_bs = 3 - data->scale;
+  bs = 1 << log_bs;
+  vb = bs << data->log_vs;
+  hb = bs << data->log_hs;
+  nr1 = (data->image_height + (8 << data->log_vs) - 1) >> (3 + data->log_vs);
+  nc1 = (data->image_width + (8 << data->log_hs) - 1) >> (3 + data->log_hs);
+  log_cvs = data->log_vs - (data->scale - data->chroma_scale);
+  log_chs = data->log_hs - (data->scale - data->chroma_scale);
+
+  /* BITMAP_PTR is kept at the start of the current MCU row and C1 at the
+     MCU in it, as a restart interval may end anywhere in a row.  */
+  for (; data->r1 < nr1 && (!data->dri || rst); rst--)
+    {
+      unsigned r2, c2, nr2, nc2;
+      grub_uint8_t *ptr2;
 
-  for (; data->r1 < nr1 && (!data->dri || rst);
-       data->r1++, data->bitmap_ptr += (vb * data->image_width - hb * nc1) * 3)
-    for (c1 = 0;  c1 < nc1 && (!data->dri || rst);
-	c1++, rst--, data->bitmap_ptr += hb * 3)
-      {
-	unsigned r2, c2, nr2, nc2;
-	grub_uint8_t *ptr2;
+      c1 = data->c1;
+      for (r2 = 0; r2 < (1U << data->log_vs); r2++)
+	for (c2 = 0; c2 < (1U << data->log_hs); c2++)
+	  grub_jpeg_decode_du (data, 0, data->ydu[r2 * 2 + c2]);
 
-	for (r2 = 0; r2 < (1U << data->log_vs); r2++)
-	  for (c2 = 0; c2 < (1U << data->log_hs); c2++)
-	    grub_jpeg_decode_du (data, 0, data->ydu[r2 * 2 + c2]);
+      if (data->color_components >= 3)
+	{
+	  grub_jpeg_decode_du (data, 1, data->cbdu);
+	  grub_jpeg_decode_du (data, 2, data->crdu);
+	}
 
-	if (data->color_components >= 3)
-	  {
-	    grub_jpeg_decode_du (data, 1, data->cbdu);
-	    grub_jpeg_decode_du (data, 2, data->crdu);
-	  }
+      if (grub_errno)
+	return grub_errno;
 
-	if (grub_errno)
-	  return grub_errno;
+      if (data->bit_cnt < data->bit_pad)
+	return grub_error (GRUB_ERR_BAD_FILE_TYPE,
+			   "jpeg: invalid 0xFF in data stream");
 
-	nr2 = (data->r1 == nr1 - 1) ? (data->image_height - data->r1 * vb) : vb;
-	nc2 = (c1 == nc1 - 1) ? (data->image_width - c1 * hb) : hb;
+      nr2 = (data->r1 == nr1 - 1) ? (data->out_height - data->r1 * vb) : vb;
+      nc2 = (c1 == nc1 - 1) ? (data->out_width - c1 * hb) : hb;
 
-	ptr2 = data->bitmap_ptr;
-	for (r2 = 0; r2 < nr2; r2++, ptr2 += (data->image_width - nc2) * 3)
-	  for (c2 = 0; c2 < nc2; c2++, ptr2 += 3)
-	    {
-	      unsigned i0;
-	      int yy;
+      ptr2 = data->bitmap_ptr + c1 * hb * 3;
+      for (r2 = 0; r2 < nr2; r2++, ptr2 += (data->out_width - nc2) * 3)
+	{
+	  const int *yrow;
 
-	      i0 = (r2 >> data->log_vs) * 8 + (c2 >> data->log_hs);
-	      yy = data->ydu[(r2 / 8) * 2 + (c2 / 8)][(r2 % 8) * 8 + (c2 % 8)];
+	  /* Index both luma blocks of this row from the left one.  */
+	  yrow = data->ydu[0] + (r2 >> log_bs) * 2 * ARRAY_SIZE (data->ydu[0])
+	    + (r2 & (bs - 1)) * JPEG_UNIT_SIZE;
 
-	      if (data->color_components >= 3)
-		{
-		  int cr, cb;
-		  cr = data->crdu[i0];
-		  cb = data->cbdu[i0];
-		  grub_jpeg_ycrcb_to_rgb (yy, cr, cb, ptr2);
-		}
-	      else
+	  if (data->color_components >= 3)
+	    {
+	      const int *crrow, *cbrow;
+
+	      crrow = data->crdu + (r2 >> log_cvs) * JPEG_UNIT_SIZE;
+	      cbrow = data->cbdu + (r2 >> log_cvs) * JPEG_UNIT_SIZE;
+	      for (c2 = 0; c2 < nc2; c2++, ptr2 += 3)
 		{
-		  ptr2[0] = yy;
-		  ptr2[1] = yy;
-		  ptr2[2] = yy;
+		  int yy, cr, cb;
+
+		  yy = yrow[(c2 >> log_bs) * ARRAY_SIZE (data->ydu[0])
+			    + (c2 & (bs - 1))];
+		  cr = crrow[c2 >> log_chs];
+		  cb = cbrow[c2 >> log_chs];
+
+		  ptr2[JPEG_RED_OFFSET] = grub_jpeg_clamp (yy + jpeg_cr_r[cr]);
+		  ptr2[JPEG_GREEN_OFFSET]
+		    = grub_jpeg_clamp (yy - ((jpeg_cb_g[cb] + jpeg_cr_g[cr])
+					     >> SHIFT_BITS));
+		  ptr2[JPEG_BLUE_OFFSET] = grub_jpeg_clamp (yy + jpeg_cb_b[cb]);
 		}
 	    }
-      }
+	  else
+	    for (c2 = 0; c2 < nc2; c2++, ptr2 += 3)
+	      {
+		int yy;
+
+		yy = yrow[(c2 >> log_bs) * ARRAY_SIZE (data->ydu[0])
+			  + (c2 & (bs - 1))];
+		ptr2[0] = yy;
+		ptr2[1] = yy;
+		ptr2[2] = yy;
+	      }
+	}
+
+      if (++data->c1 == nc1)
+	{
+	  data->c1 = 0;
+	  data->r1++;
+	  data->bitmap_ptr += vb * data->out_width * 3;
+	}
+    }
+
+  if (!data->bit_eos)
+    grub_jpeg_sync_input (data);
 
   return grub_errno;
 }
@@ -680,7 +942,10 @@ grub_jpeg_decode_data (struct grub_jpeg_data *data)
 static void
 grub_jpeg_reset (struct grub_jpeg_data *data)
 {
-  data->bit_mask = 0x0;
+  data->bit_buf = 0;
+  data->bit_cnt = 0;
+  data->bit_pad = 0;
+  data->bit_eos = 0;
 
   data->dc_value[0] = 0;
   data->dc_value[1] = 0;
@@ -756,6 +1021,9 @@ grub_jpeg_decode_jpeg (struct grub_jpeg_data *data)
 	    sz = grub_jpeg_get_word (data);
 	    if (grub_errno)
 	      return (grub_errno);
+	    if (sz < 2)
+	      return grub_error (GRUB_ERR_BAD_FILE_TYPE,
+				 "jpeg: invalid marker length");
 	    grub_file_seek (data->file, data->file->offset + sz - 2);
 	  }
 	}
@@ -765,8 +1033,10 @@ grub_jpeg_decode_jpeg (struct grub_jpeg_data *data)
 }
 
 static grub_err_t
-grub_video_reader_jpeg (struct grub_video_bitmap **bitmap,
-			const char *filename)
+grub_video_reader_jpeg_reduced (struct grub_video_bitmap **bitmap,
+				const char *filename,
+				unsigned int min_width,
+				unsigned int min_height)
 {
   grub_file_t file;
   struct grub_jpeg_data *data;
@@ -782,6 +1052,8 @@ grub_video_reader_jpeg (struct grub_video_bitmap **bitmap,
 
       data->file = file;
       data->bitmap = bitmap;
+      data->min_width = min_width;
+      data->min_height = min_height;
       grub_jpeg_decode_jpeg (data);
 
       for (i = 0; i < 4; i++)
@@ -800,6 +1072,13 @@ grub_video_reader_jpeg (struct grub_video_bitmap **bitmap,
   return grub_errno;
 }
 
+static grub_err_t
+grub_video_reader_jpeg (struct grub_video_bitmap **bitmap,
+			const char *filename)
+{
+  return grub_video_reader_jpeg_reduced (bitmap, filename, ~0U, ~0U);
+}
+
 #if defined(JPEG_DEBUG)
 static grub_err_t
 grub_cmd_jpegtest (grub_command_t cmdd __attribute__ ((unused)),
@@ -823,17 +1102,20 @@ grub_cmd_jpegtest (grub_command_t cmdd __attribute__ ((unused)),
 static struct grub_video_bitmap_reader jpg_reader = {
   .extension = ".jpg",
   .reader = grub_video_reader_jpeg,
+  .reader_reduced = grub_video_reader_jpeg_reduced,
   .next = 0
 };
 
 static struct grub_video_bitmap_reader jpeg_reader = {
   .extension = ".jpeg",
   .reader = grub_video_reader_jpeg,
+  .reader_reduced = grub_video_reader_jpeg_reduced,
   .next = 0
 };
 
 GRUB_MOD_INIT (jpeg)
 {
+  grub_jpeg_init_color_tables ();
   grub_video_bitmap_reader_register (&jpg_reader);
   grub_video_bitmap_reader_register (&jpeg_reader);
 #if defined(JPEG_DEBUG)
@@ -23,6 +23,7 @@
 #include <grub/mm.h>
 #include <grub/misc.h>
 #include <grub/bufio.h>
+#include <grub/deflate.h>
 
 GRUB_MOD_LICENSE ("GPLv3+");
 
@@ -60,70 +61,27 @@ enum
     PNG_CHUNK_PLTE = 0x504c5445
   };
 
-#define Z_DEFLATED		8
-#define Z_FLAG_DICT		32
-
-#define INFLATE_STORED		0
-#define INFLATE_FIXED		1
-#define INFLATE_DYNAMIC		2
-
-#define WSIZE			0x8000
-
-#define DEFLATE_HCLEN_BASE	4
-#define DEFLATE_HCLEN_MAX	19
-#define DEFLATE_HLIT_BASE	257
-#define DEFLATE_HLIT_MAX	288
-#define DEFLATE_HDIST_BASE	1
-#define DEFLATE_HDIST_MAX	30
-
-#define DEFLATE_HUFF_LEN	16
-
 #ifdef PNG_DEBUG
 static grub_command_t cmd;
 #endif
 
-struct huff_table
-{
-  int *values, *maxval, *offset;
-  int num_values, max_length;
-};
-
 struct grub_png_data
 {
   grub_file_t file;
   struct grub_video_bitmap **bitmap;
 
-  int bit_count, bit_save;
-
   grub_uint32_t next_offset;
 
   unsigned image_width, image_height;
   int bpp, is_16bit;
-  int raw_bytes, is_gray, is_alpha, is_palette;
+  int is_gray, is_palette;
   int row_bytes, color_bits;
-  grub_uint8_t *image_data;
-
-  int inside_idat, idat_remain;
 
-  int code_values[DEFLATE_HLIT_MAX];
-  int code_maxval[DEFLATE_HUFF_LEN];
-  int code_offset[DEFLATE_HUFF_LEN];
-
-  int dist_values[DEFLATE_HDIST_MAX];
-  int dist_maxval[DEFLATE_HUFF_LEN];
-  int dist_offset[DEFLATE_HUFF_LEN];
+  /* The concatenated contents of all IDAT chunks.  */
+  grub_uint8_t *idat;
+  grub_size_t idat_len, idat_size;
 
   grub_uint8_t palette[256][3];
-
-  struct huff_table code_table;
-  struct huff_table dist_table;
-
-  grub_uint8_t slide[WSIZE];
-  int wp;
-
-  grub_uint8_t *cur_rgb;
-
-  int cur_column, cur_filter, first_line;
 };
 
 static grub_uint32_t
@@ -142,85 +100,12 @@ grub_png_get_byte (struct grub_png_data *data)
 {
   grub_uint8_t r;
 
-  if ((data->inside_idat) && (data->idat_remain == 0))
-    {
-      grub_uint32_t len, type;
-
-      do
-	{
-          /* Skip crc checksum.  */
-	  grub_png_get_dword (data);
-
-          if (data->file->offset != data->next_offset)
-            {
-              grub_error (GRUB_ERR_BAD_FILE_TYPE,
-                          "png: chunk size error");
-              return 0;
-            }
-
-	  len = grub_png_get_dword (data);
-	  type = grub_png_get_dword (data);
-	  if (type != PNG_CHUNK_IDAT)
-	    {
-	      grub_error (GRUB_ERR_BAD_FILE_TYPE,
-			  "png: unexpected end of data");
-	      return 0;
-	    }
-
-          data->next_offset = data->file->offset + len + 4;
-	}
-      while (len == 0);
-      data->idat_remain = len;
-    }
-
   r = 0;
   grub_file_read (data->file, &r, 1);
 
-  if (data->inside_idat)
-    data->idat_remain--;
-
   return r;
 }
 
-static int
-grub_png_get_bits (struct grub_png_data *data, int num)
-{
-  int code, shift;
-
-  if (data->bit_count == 0)
-    {
-      data->bit_save = grub_png_get_byte (data);
-      data->bit_count = 8;
-    }
-
-  code = 0;
-  shift = 0;
-  while (grub_errno == 0)
-    {
-      int n;
-
-      n = data->bit_count;
-      if (n > num)
-	n = num;
-
-      code += (int) (data->bit_save & ((1 << n) - 1)) << shift;
-      num -= n;
-      if (!num)
-	{
-	  data->bit_count -= n;
-	  data->bit_save >>= n;
-	  break;
-	}
-
-      shift += n;
-
-      data->bit_save = grub_png_get_byte (data);
-      data->bit_count = 8;
-    }
-
-  return code;
-}
-
 static grub_err_t
 grub_png_decode_image_palette (struct grub_png_data *data,
 			       unsigned len)
@@ -305,28 +190,23 @@ grub_png_decode_image_header (struct grub_png_data *data)
   if (data->color_bits <= 4)
     data->row_bytes = (data->image_width * data->color_bits + 7) / 8;
 
-#ifndef GRUB_CPU_WORDS_BIGENDIAN
-  if (data->is_16bit || data->is_gray || data->is_palette)
-#endif
+  /* Low bit depth gray is expanded through the palette.  The generic
+     formula is (0xff * i) / ((1U << color_bits) - 1), but for the allowed
+     bit depths that is a plain multiplication.  */
+  if (data->is_gray && data->color_bits <= 4)
     {
-      data->image_data = grub_malloc (data->image_height * data->row_bytes);
-      if (grub_errno)
-        return grub_errno;
+      static const grub_uint8_t multipliers[5] =
+	{ 0xff, 0xff, 0x55, 0x24, 0x11 };
+      unsigned i;
 
-      data->cur_rgb = data->image_data;
-    }
-#ifndef GRUB_CPU_WORDS_BIGENDIAN
-  else
-    {
-      data->image_data = 0;
-      data->cur_rgb = (*data->bitmap)->data;
+      for (i = 0; i < (1U << data->color_bits); i++)
+	{
+	  grub_uint8_t col = multipliers[data->color_bits] * i;
+	  data->palette[i][0] = col;
+	  data->palette[i][1] = col;
+	  data->palette[i][2] = col;
+	}
     }
-#endif
-
-  data->raw_bytes = data->image_height * (data->row_bytes + 1);
-
-  data->cur_column = 0;
-  data->first_line = 1;
 
   if (grub_png_get_byte (data) != PNG_COMPRESSION_BASE)
     return grub_error (GRUB_ERR_BAD_FILE_TYPE,
@@ -346,679 +226,317 @@ grub_png_decode_image_header (struct grub_png_data *data)
   return grub_errno;
 }
 
-/* Order of the bit length code lengths.  */
-static const grub_uint8_t bitorder[] = {
-  16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15
-};
-
-/* Copy lengths for literal codes 257..285.  */
-static const int cplens[] = {
-  3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
-  35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258, 0, 0
-};
-
-/* Extra bits for literal codes 257..285.  */
-static const grub_uint8_t cplext[] = {
-  0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
-  3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0, 99, 99
-};				/* 99==invalid  */
-
-/* Copy offsets for distance codes 0..29.  */
-static const int cpdist[] = {
-  1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
-  257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145,
-  8193, 12289, 16385, 24577
-};
+/* Append the contents of an IDAT chunk of LEN bytes to the compressed
+   image data.  */
+static grub_err_t
+grub_png_read_image_data (struct grub_png_data *data, grub_uint32_t len)
+{
+  if (! *data->bitmap)
+    return grub_error (GRUB_ERR_BAD_FILE_TYPE, "png: missing header");
 
-/* Extra bits for distance codes.  */
-static const grub_uint8_t cpdext[] = {
-  0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
-  7, 7, 8, 8, 9, 9, 10, 10, 11, 11,
-  12, 12, 13, 13
-};
+  if (data->idat_len + len < data->idat_len)
+    return grub_error (GRUB_ERR_OUT_OF_RANGE, "png: image data too large");
 
-static void
-grub_png_init_huff_table (struct huff_table *ht, int cur_maxlen,
-			  int *cur_values, int *cur_maxval, int *cur_offset)
-{
-  ht->values = cur_values;
-  ht->maxval = cur_maxval;
-  ht->offset = cur_offset;
-  ht->num_values = 0;
-  ht->max_length = cur_maxlen;
-  grub_memset (cur_maxval, 0, sizeof (int) * cur_maxlen);
-}
+  if (data->idat_len + len > data->idat_size)
+    {
+      grub_size_t size = data->idat_size ? : 0x10000;
+      grub_uint8_t *idat;
 
-static void
-grub_png_insert_huff_item (struct huff_table *ht, int code, int len)
-{
-  int i, n;
+      while (size < data->idat_len + len)
+	{
+	  if (size * 2 < size)
+	    return grub_error (GRUB_ERR_OUT_OF_RANGE,
+			       "png: image data too large");
+	  size *= 2;
+	}
 
-  if (len == 0)
-    return;
+      idat = grub_realloc (data->idat, size);
+      if (! idat)
+	return grub_errno;
+      data->idat = idat;
+      data->idat_size = size;
+    }
 
-  if (len > ht->max_length)
+  if (grub_file_read (data->file, data->idat + data->idat_len, len)
+      != (grub_ssize_t) len)
     {
-      grub_error (GRUB_ERR_BAD_FILE_TYPE, "png: invalid code length");
-      return;
+      if (grub_errno == GRUB_ERR_NONE)
+	grub_error (GRUB_ERR_BAD_FILE_TYPE, "png: unexpected end of data");
+      return grub_errno;
     }
+  data->idat_len += len;
 
-  n = 0;
-  for (i = len; i < ht->max_length; i++)
-    n += ht->maxval[i];
-
-  for (i = 0; i < n; i++)
-    ht->values[ht->num_values - i] = ht->values[ht->num_values - i - 1];
+  /* Skip crc checksum.  */
+  grub_png_get_dword (data);
 
-  ht->values[ht->num_values - n] = code;
-  ht->num_values++;
-  ht->maxval[len - 1]++;
+  return grub_errno;
 }
 
-static void
-grub_png_build_huff_table (struct huff_table *ht)
+/* Byte-wise sum and floor average of four bytes at a time; carries never
+   cross into the neighbouring byte.  */
+static inline grub_uint32_t
+png_add_bytes (grub_uint32_t a, grub_uint32_t b)
 {
-  int base, ofs, i;
-
-  base = 0;
-  ofs = 0;
-  for (i = 0; i < ht->max_length; i++)
-    {
-      base += ht->maxval[i];
-      ofs += ht->maxval[i];
-
-      ht->maxval[i] = base;
-      ht->offset[i] = ofs - base;
-
-      base <<= 1;
-    }
+  return ((a & 0x7f7f7f7f) + (b & 0x7f7f7f7f)) ^ ((a ^ b) & 0x80808080);
 }
 
-static int
-grub_png_get_huff_code (struct grub_png_data *data, struct huff_table *ht)
+static inline grub_uint32_t
+png_avg_bytes (grub_uint32_t a, grub_uint32_t b)
 {
-  int code, i;
-
-  code = 0;
-  for (i = 0; i < ht->max_length; i++)
-    {
-      code = (code << 1) + grub_png_get_bits (data, 1);
-      if (code < ht->maxval[i])
-	return ht->values[code + ht->offset[i]];
-    }
-  return 0;
+  return (a & b) + (((a ^ b) & 0xfefefefe) >> 1);
 }
 
-static grub_err_t
-grub_png_init_fixed_block (struct grub_png_data *data)
+static inline grub_uint8_t
+png_paeth (int a, int b, int c)
 {
-  int i;
+  int pa, pb, pc;
 
-  grub_png_init_huff_table (&data->code_table, DEFLATE_HUFF_LEN,
-			    data->code_values, data->code_maxval,
-			    data->code_offset);
+  pa = b - c;
+  pb = a - c;
+  pc = pa + pb;
 
-  for (i = 0; i < 144; i++)
-    grub_png_insert_huff_item (&data->code_table, i, 8);
+  if (pa < 0)
+    pa = -pa;
+  if (pb < 0)
+    pb = -pb;
+  if (pc < 0)
+    pc = -pc;
 
-  for (; i < 256; i++)
-    grub_png_insert_huff_item (&data->code_table, i, 9);
-
-  for (; i < 280; i++)
-    grub_png_insert_huff_item (&data->code_table, i, 7);
-
-  for (; i < DEFLATE_HLIT_MAX; i++)
-    grub_png_insert_huff_item (&data->code_table, i, 8);
-
-  grub_png_build_huff_table (&data->code_table);
-
-  grub_png_init_huff_table (&data->dist_table, DEFLATE_HUFF_LEN,
-			    data->dist_values, data->dist_maxval,
-			    data->dist_offset);
-
-  for (i = 0; i < DEFLATE_HDIST_MAX; i++)
-    grub_png_insert_huff_item (&data->dist_table, i, 5);
-
-  grub_png_build_huff_table (&data->dist_table);
-
-  return grub_errno;
+  return ((pa <= pb) && (pa <= pc)) ? a : (pb <= pc) ? b : c;
 }
 
-static grub_err_t
-grub_png_init_dynamic_block (struct grub_png_data *data)
+/* Undo FILTER on the row CUR of LEN bytes in place.  PREV is the previous
+   row, already unfiltered, or zeros for the first row.  Whenever a pixel
+   is a whole number of 32-bit words, a word is done at a time.  */
+static void
+grub_png_unfilter_row (int filter, grub_uint8_t *cur,
+		       const grub_uint8_t *prev, int len, int bpp)
 {
-  int nl, nd, nb, i, prev;
-  struct huff_table cl;
-  int cl_values[sizeof (bitorder)];
-  int cl_maxval[8];
-  int cl_offset[8];
-  grub_uint8_t lens[DEFLATE_HCLEN_MAX];
+  int i = 0;
 
-  nl = DEFLATE_HLIT_BASE + grub_png_get_bits (data, 5);
-  nd = DEFLATE_HDIST_BASE + grub_png_get_bits (data, 5);
-  nb = DEFLATE_HCLEN_BASE + grub_png_get_bits (data, 4);
-
-  if ((nl > DEFLATE_HLIT_MAX) || (nd > DEFLATE_HDIST_MAX) ||
-      (nb > DEFLATE_HCLEN_MAX))
-    return grub_error (GRUB_ERR_BAD_FILE_TYPE, "png: too much data");
-
-  grub_png_init_huff_table (&cl, 8, cl_values, cl_maxval, cl_offset);
-
-  for (i = 0; i < nb; i++)
-    lens[bitorder[i]] = grub_png_get_bits (data, 3);
-
-  for (; i < DEFLATE_HCLEN_MAX; i++)
-    lens[bitorder[i]] = 0;
-
-  for (i = 0; i < DEFLATE_HCLEN_MAX; i++)
-    grub_png_insert_huff_item (&cl, i, lens[i]);
-
-  grub_png_build_huff_table (&cl);
-
-  grub_png_init_huff_table (&data->code_table, DEFLATE_HUFF_LEN,
-			    data->code_values, data->code_maxval,
-			    data->code_offset);
-
-  grub_png_init_huff_table (&data->dist_table, DEFLATE_HUFF_LEN,
-			    data->dist_values, data->dist_maxval,
-			    data->dist_offset);
-
-  prev = 0;
-  for (i = 0; i < nl + nd; i++)
+  switch (filter)
     {
-      int n, code;
-      struct huff_table *ht;
-
-      if (grub_errno)
-	return grub_errno;
-
-      if (i < nl)
-	{
-	  ht = &data->code_table;
-	  code = i;
-	}
+    case PNG_FILTER_VALUE_SUB:
+      if (bpp % 4 == 0)
+	for (i = bpp; i + 4 <= len; i += 4)
+	  grub_set_unaligned32 (cur + i,
+				png_add_bytes (grub_get_unaligned32 (cur + i),
+					       grub_get_unaligned32 (cur + i
+								     - bpp)));
       else
-	{
-	  ht = &data->dist_table;
-	  code = i - nl;
-	}
-
-      n = grub_png_get_huff_code (data, &cl);
-      if (n < 16)
-	{
-	  grub_png_insert_huff_item (ht, code, n);
-	  prev = n;
-	}
-      else if (n == 16)
-	{
-	  int c;
+	i = bpp;
+      for (; i < len; i++)
+	cur[i] += cur[i - bpp];
+      break;
+
+    case PNG_FILTER_VALUE_UP:
+      for (; i + 4 <= len; i += 4)
+	grub_set_unaligned32 (cur + i,
+			      png_add_bytes (grub_get_unaligned32 (cur + i),
+					     grub_get_unaligned32 (prev + i)));
+      for (; i < len; i++)
+	cur[i] += prev[i];
+      break;
+
+    case PNG_FILTER_VALUE_AVG:
+      for (; i < bpp; i++)
+	cur[i] += prev[i] >> 1;
+      if (bpp % 4 == 0)
+	for (; i + 4 <= len; i += 4)
+	  {
+	    grub_uint32_t avg;
 
-	  c = 3 + grub_png_get_bits (data, 2);
-	  while (c > 0)
-	    {
-	      grub_png_insert_huff_item (ht, code++, prev);
-	      i++;
-	      c--;
-	    }
-	  i--;
-	}
-      else if (n == 17)
-	i += 3 + grub_png_get_bits (data, 3) - 1;
-      else
-	i += 11 + grub_png_get_bits (data, 7) - 1;
+	    avg = png_avg_bytes (grub_get_unaligned32 (prev + i),
+				 grub_get_unaligned32 (cur + i - bpp));
+	    grub_set_unaligned32 (cur + i,
+				  png_add_bytes (grub_get_unaligned32 (cur + i),
+						 avg));
+	  }
+      for (; i < len; i++)
+	cur[i] += ((int) prev[i] + (int) cur[i - bpp]) >> 1;
+      break;
+
+    case PNG_FILTER_VALUE_PAETH:
+      for (; i < bpp; i++)
+	cur[i] += prev[i];
+      for (; i < len; i++)
+	cur[i] += png_paeth (cur[i - bpp], prev[i], prev[i - bpp]);
+      break;
     }
-
-  grub_png_build_huff_table (&data->code_table);
-  grub_png_build_huff_table (&data->dist_table);
-
-  return grub_errno;
 }
 
-static grub_err_t
-grub_png_output_byte (struct grub_png_data *data, grub_uint8_t n)
-{
-  if (--data->raw_bytes < 0)
-    return grub_error (GRUB_ERR_BAD_FILE_TYPE, "image size overflown");
-
-  if (data->cur_column == 0)
-    {
-      if (n >= PNG_FILTER_VALUE_LAST)
-	return grub_error (GRUB_ERR_BAD_FILE_TYPE, "invalid filter value");
+/* Byte positions of the channels in RGB_888 and RGBA_8888 bitmaps.  */
+#ifndef GRUB_CPU_WORDS_BIGENDIAN
+#define R4 0
+#define G4 1
+#define B4 2
+#define A4 3
+#define R3 0
+#define G3 1
+#define B3 2
+#else
+#define R4 3
+#define G4 2
+#define B4 1
+#define A4 0
+#define R3 2
+#define G3 1
+#define B3 0
+#endif
 
-      data->cur_filter = n;
-    }
-  else
-    *data->cur_rgb++ = n;
+/* Convert the unfiltered row SRC to the bitmap format into DST.  Only the
+   upper byte of 16-bit samples is kept.  */
+static void
+grub_png_convert_row (struct grub_png_data *data, const grub_uint8_t *src,
+		      grub_uint8_t *dst)
+{
+  unsigned i;
 
-  data->cur_column++;
-  if (data->cur_column == data->row_bytes + 1)
+  if (data->is_palette || data->color_bits <= 4)
     {
-      grub_uint8_t *blank_line = NULL;
-      grub_uint8_t *cur = data->cur_rgb - data->row_bytes;
-      grub_uint8_t *left = cur;
-      grub_uint8_t *up;
+      int shift = 8 - data->color_bits;
+      int mask = (1 << data->color_bits) - 1;
 
-      if (data->first_line)
+      for (i = 0; i < data->image_width; i++, dst += 3)
 	{
-	  blank_line = grub_zalloc (data->row_bytes);
-	  if (blank_line == NULL)
-	    return grub_errno;
+	  grub_uint8_t col = (*src >> shift) & mask;
 
-	  up = blank_line;
+	  dst[R3] = data->palette[col][0];
+	  dst[G3] = data->palette[col][1];
+	  dst[B3] = data->palette[col][2];
+	  shift -= data->color_bits;
+	  if (shift < 0)
+	    {
+	      src++;
+	      shift += 8;
+	    }
 	}
-      else
-	up = cur - data->row_bytes;
-
-      switch (data->cur_filter)
-	{
-	case PNG_FILTER_VALUE_SUB:
-	  {
-	    int i;
+      return;
+    }
 
-	    cur += data->bpp;
-	    for (i = data->bpp; i < data->row_bytes; i++, cur++, left++)
-	      *cur += *left;
+  {
+    int step = data->is_16bit ? 2 : 1;
+    int alpha = data->is_gray ? step : 3 * step;
+    int has_alpha = ((*data->bitmap)->mode_info.bytes_per_pixel == 4);
 
-	    break;
-	  }
-	case PNG_FILTER_VALUE_UP:
-	  {
-	    int i;
+    for (i = 0; i < data->image_width; i++, src += data->bpp)
+      {
+	grub_uint8_t r, g, b;
 
-	    for (i = 0; i < data->row_bytes; i++, cur++, up++)
-	      *cur += *up;
+	r = src[0];
+	g = data->is_gray ? r : src[step];
+	b = data->is_gray ? r : src[2 * step];
 
-	    break;
-	  }
-	case PNG_FILTER_VALUE_AVG:
+	if (has_alpha)
 	  {
-	    int i;
-
-	    for (i = 0; i < data->bpp; i++, cur++, up++)
-	      *cur += *up >> 1;
-
-	    for (; i < data->row_bytes; i++, cur++, up++, left++)
-	      *cur += ((int) *up + (int) *left) >> 1;
-
-	    break;
+	    dst[R4] = r;
+	    dst[G4] = g;
+	    dst[B4] = b;
+	    dst[A4] = src[alpha];
+	    dst += 4;
 	  }
-	case PNG_FILTER_VALUE_PAETH:
+	else
 	  {
-	    int i;
-	    grub_uint8_t *upper_left = up;
-
-	    for (i = 0; i < data->bpp; i++, cur++, up++)
-	      *cur += *up;
-
-	    for (; i < data->row_bytes; i++, cur++, up++, left++, upper_left++)
-	      {
-		int a, b, c, pa, pb, pc;
-
-                a = *left;
-                b = *up;
-                c = *upper_left;
-
-                pa = b - c;
-                pb = a - c;
-                pc = pa + pb;
-
-                if (pa < 0)
-                  pa = -pa;
-
-                if (pb < 0)
-                  pb = -pb;
-
-                if (pc < 0)
-                  pc = -pc;
-
-                *cur += ((pa <= pb) && (pa <= pc)) ? a : (pb <= pc) ? b : c;
-	      }
+	    dst[R3] = r;
+	    dst[G3] = g;
+	    dst[B3] = b;
+	    dst += 3;
 	  }
-	}
-
-      grub_free (blank_line);
-
-      data->cur_column = 0;
-      data->first_line = 0;
-    }
-
-  return grub_errno;
+      }
+  }
 }
 
+/* Read exactly LEN bytes of the decompressed image data.  */
 static grub_err_t
-grub_png_read_dynamic_block (struct grub_png_data *data)
+grub_png_inflate (struct grub_zlib_stream *stream, grub_uint8_t *buf,
+		  grub_size_t len)
 {
-  while (grub_errno == 0)
-    {
-      int n;
-
-      n = grub_png_get_huff_code (data, &data->code_table);
-      if (n < 256)
-	{
-	  data->slide[data->wp] = n;
-	  grub_png_output_byte (data, n);
-
-	  data->wp++;
-	  if (data->wp >= WSIZE)
-	    data->wp = 0;
-	}
-      else if (n == 256)
-	break;
-      else
-	{
-	  int len, dist, pos;
-
-	  n -= 257;
-	  len = cplens[n];
-	  if (cplext[n])
-	    len += grub_png_get_bits (data, cplext[n]);
-
-	  n = grub_png_get_huff_code (data, &data->dist_table);
-	  dist = cpdist[n];
-	  if (cpdext[n])
-	    dist += grub_png_get_bits (data, cpdext[n]);
-
-	  pos = data->wp - dist;
-	  if (pos < 0)
-	    pos += WSIZE;
-
-	  while (len > 0)
-	    {
-	      data->slide[data->wp] = data->slide[pos];
-	      grub_png_output_byte (data, data->slide[data->wp]);
-
-	      data->wp++;
-	      if (data->wp >= WSIZE)
-		data->wp = 0;
-
-	      pos++;
-	      if (pos >= WSIZE)
-		pos = 0;
-
-	      len--;
-	    }
-	}
-    }
+  if (grub_zlib_stream_read (stream, (char *) buf, len) != (grub_ssize_t) len
+      && grub_errno == GRUB_ERR_NONE)
+    grub_error (GRUB_ERR_BAD_FILE_TYPE, "png: image data too short");
 
   return grub_errno;
 }
 
+/* Inflate the image data one row at a time and unfilter each row.  When
+   the file's pixel layout matches the bitmap, rows go straight into the
+   bitmap; otherwise they are converted from a pair of scratch rows.  */
 static grub_err_t
 grub_png_decode_image_data (struct grub_png_data *data)
 {
-  grub_uint8_t cmf, flg;
-  int final;
+  struct grub_video_bitmap *bitmap = *data->bitmap;
+  struct grub_zlib_stream *stream;
+  grub_uint8_t *rows, *cur, *prev;
+  unsigned y;
+  int direct;
 
-  cmf = grub_png_get_byte (data);
-  flg = grub_png_get_byte (data);
+  if (! bitmap || ! data->idat_len)
+    return grub_error (GRUB_ERR_BAD_FILE_TYPE, "png: missing image data");
 
-  if ((cmf & 0xF) != Z_DEFLATED)
-    return grub_error (GRUB_ERR_BAD_FILE_TYPE,
-		       "png: only support deflate compression method");
+#ifndef GRUB_CPU_WORDS_BIGENDIAN
+  direct = !(data->is_16bit || data->is_gray || data->is_palette);
+#else
+  direct = 0;
+#endif
 
-  if (flg & Z_FLAG_DICT)
-    return grub_error (GRUB_ERR_BAD_FILE_TYPE,
-		       "png: dictionary not supported");
+  /* A zero row above the first one, plus a second scratch row when the
+     rows have to be converted.  */
+  rows = grub_zalloc (direct ? data->row_bytes : 2 * data->row_bytes);
+  if (! rows)
+    return grub_errno;
 
-  do
+  stream = grub_zlib_stream_open ((char *) data->idat, data->idat_len);
+  if (! stream)
     {
-      int block_type;
-
-      final = grub_png_get_bits (data, 1);
-      block_type = grub_png_get_bits (data, 2);
-
-      switch (block_type)
-	{
-	case INFLATE_STORED:
-	  {
-	    grub_uint16_t i, len;
-
-	    data->bit_count = 0;
-	    len = grub_png_get_byte (data);
-	    len += ((grub_uint16_t) grub_png_get_byte (data)) << 8;
+      grub_free (rows);
+      return grub_errno;
+    }
 
-            /* Skip NLEN field.  */
-	    grub_png_get_byte (data);
-	    grub_png_get_byte (data);
+  prev = rows;
+  cur = direct ? 0 : rows + data->row_bytes;
 
-	    for (i = 0; i < len; i++)
-	      grub_png_output_byte (data, grub_png_get_byte (data));
+  for (y = 0; y < data->image_height; y++)
+    {
+      grub_uint8_t *dst = (grub_uint8_t *) bitmap->data
+	+ y * bitmap->mode_info.pitch;
+      grub_uint8_t filter;
 
-	    break;
-	  }
+      if (direct)
+	cur = dst;
 
-	case INFLATE_FIXED:
-          grub_png_init_fixed_block (data);
-	  grub_png_read_dynamic_block (data);
-	  break;
+      if (grub_png_inflate (stream, &filter, 1)
+	  || grub_png_inflate (stream, cur, data->row_bytes))
+	break;
 
-	case INFLATE_DYNAMIC:
-	  grub_png_init_dynamic_block (data);
-	  grub_png_read_dynamic_block (data);
+      if (filter >= PNG_FILTER_VALUE_LAST)
+	{
+	  grub_error (GRUB_ERR_BAD_FILE_TYPE, "invalid filter value");
 	  break;
-
-	default:
-	  return grub_error (GRUB_ERR_BAD_FILE_TYPE,
-			     "png: unknown block type");
 	}
-    }
-  while ((!final) && (grub_errno == 0));
-
-  /* Skip adler checksum.  */
-  grub_png_get_dword (data);
 
-  /* Skip crc checksum.  */
-  grub_png_get_dword (data);
+      grub_png_unfilter_row (filter, cur, prev, data->row_bytes, data->bpp);
 
-  return grub_errno;
-}
-
-static const grub_uint8_t png_magic[8] =
-  { 0x89, 0x50, 0x4e, 0x47, 0xd, 0xa, 0x1a, 0x0a };
-
-static void
-grub_png_convert_image (struct grub_png_data *data)
-{
-  unsigned i;
-  grub_uint8_t *d1, *d2;
-
-  d1 = (*data->bitmap)->data;
-  d2 = data->image_data + data->is_16bit;
-
-#ifndef GRUB_CPU_WORDS_BIGENDIAN
-#define R4 3
-#define G4 2
-#define B4 1
-#define A4 0
-#define R3 2
-#define G3 1
-#define B3 0
-#else
-#define R4 0
-#define G4 1
-#define B4 2
-#define A4 3
-#define R3 0
-#define G3 1
-#define B3 2
-#endif
-
-  if (data->color_bits <= 4)
-    {
-      grub_uint8_t palette[16][3];
-      grub_uint8_t *d1c, *d2c;
-      int shift;
-      int mask = (1 << data->color_bits) - 1;
-      unsigned j;
-      if (data->is_gray)
-	{
-	  /* Generic formula is
-	     (0xff * i) / ((1U << data->color_bits) - 1)
-	     but for allowed bit depth of 1, 2 and for it's
-	     equivalent to
-	     (0xff / ((1U << data->color_bits) - 1)) * i
-	     Precompute the multipliers to avoid division.
-	  */
-
-	  const grub_uint8_t multipliers[5] = { 0xff, 0xff, 0x55, 0x24, 0x11 };
-	  for (i = 0; i < (1U << data->color_bits); i++)
-	    {
-	      grub_uint8_t col = multipliers[data->color_bits] * i;
-	      palette[i][0] = col;
-	      palette[i][1] = col;
-	      palette[i][2] = col;
-	    }
-	}
+      if (direct)
+	prev = cur;
       else
-	grub_memcpy (palette, data->palette, 3 << data->color_bits);
-      d1c = d1;
-      d2c = d2;
-      for (j = 0; j < data->image_height; j++, d1c += data->image_width * 3,
-	   d2c += data->row_bytes)
 	{
-	  d1 = d1c;
-	  d2 = d2c;
-	  shift = 8 - data->color_bits;
-	  for (i = 0; i < data->image_width; i++, d1 += 3)
-	    {
-	      grub_uint8_t col = (d2[0] >> shift) & mask;
-	      d1[R3] = data->palette[col][2];
-	      d1[G3] = data->palette[col][1];
-	      d1[B3] = data->palette[col][0];
-	      shift -= data->color_bits;
-	      if (shift < 0)
-		{
-		  d2++;
-		  shift += 8;
-		}
-	    }
-	}
-      return;
-    }
+	  grub_uint8_t *t = prev;
 
-  if (data->is_palette)
-    {
-      for (i = 0; i < (data->image_width * data->image_height);
-	   i++, d1 += 3, d2++)
-	{
-	  d1[R3] = data->palette[d2[0]][2];
-	  d1[G3] = data->palette[d2[0]][1];
-	  d1[B3] = data->palette[d2[0]][0];
-	}
-      return;
-    }
-  
-  if (data->is_gray)
-    {
-      switch (data->bpp)
-	{
-	case 4:
-	  /* 16-bit gray with alpha.  */
-	  for (i = 0; i < (data->image_width * data->image_height);
-	       i++, d1 += 4, d2 += 4)
-	    {
-	      d1[R4] = d2[3];
-	      d1[G4] = d2[3];
-	      d1[B4] = d2[3];
-	      d1[A4] = d2[1];
-	    }
-	  break;
-	case 2:
-	  if (data->is_16bit)
-	    /* 16-bit gray without alpha.  */
-	    {
-	      for (i = 0; i < (data->image_width * data->image_height);
-		   i++, d1 += 4, d2 += 2)
-		{
-		  d1[R3] = d2[1];
-		  d1[G3] = d2[1];
-		  d1[B3] = d2[1];
-		}
-	    }
-	  else
-	    /* 8-bit gray with alpha.  */
-	    {
-	      for (i = 0; i < (data->image_width * data->image_height);
-		   i++, d1 += 4, d2 += 2)
-		{
-		  d1[R4] = d2[1];
-		  d1[G4] = d2[1];
-		  d1[B4] = d2[1];
-		  d1[A4] = d2[0];
-		}
-	    }
-	  break;
-	  /* 8-bit gray without alpha.  */
-	case 1:
-	  for (i = 0; i < (data->image_width * data->image_height);
-	       i++, d1 += 3, d2++)
-	    {
-	      d1[R3] = d2[0];
-	      d1[G3] = d2[0];
-	      d1[B3] = d2[0];
-	    }
-	  break;
+	  grub_png_convert_row (data, cur, dst);
+	  prev = cur;
+	  cur = t;
 	}
-      return;
     }
 
-    {
-  /* Only copy the upper 8 bit.  */
-#ifndef GRUB_CPU_WORDS_BIGENDIAN
-      for (i = 0; i < (data->image_width * data->image_height * data->bpp >> 1);
-	   i++, d1++, d2 += 2)
-	*d1 = *d2;
-#else
-      switch (data->bpp)
-	{
-	  /* 16-bit with alpha.  */
-	case 8:
-	  for (i = 0; i < (data->image_width * data->image_height);
-	       i++, d1 += 4, d2+=8)
-	    {
-	      d1[0] = d2[7];
-	      d1[1] = d2[5];
-	      d1[2] = d2[3];
-	      d1[3] = d2[1];
-	    }
-	  break;
-	  /* 16-bit without alpha.  */
-	case 6:
-	  for (i = 0; i < (data->image_width * data->image_height);
-	       i++, d1 += 3, d2+=6)
-	    {
-	      d1[0] = d2[5];
-	      d1[1] = d2[3];
-	      d1[2] = d2[1];
-	    }
-	  break;
-	case 4:
-	  /* 8-bit with alpha.  */
-	  for (i = 0; i < (data->image_width * data->image_height);
-	       i++, d1 += 4, d2 += 4)
-	    {
-	      d1[0] = d2[3];
-	      d1[1] = d2[2];
-	      d1[2] = d2[1];
-	      d1[3] = d2[0];
-	    }
-	  break;
-	  /* 8-bit without alpha.  */
-	case 3:
-	  for (i = 0; i < (data->image_width * data->image_height);
-	       i++, d1 += 3, d2 += 3)
-	    {
-	      d1[0] = d2[2];
-	      d1[1] = d2[1];
-	      d1[2] = d2[0];
-	    }
-	  break;
-	}
-#endif
-    }
+  grub_zlib_stream_close (stream);
+  grub_free (rows);
 
+  return grub_errno;
 }
 
+static const grub_uint8_t png_magic[8] =
+  { 0x89, 0x50, 0x4e, 0x47, 0xd, 0xa, 0x1a, 0x0a };
+
 static grub_err_t
 grub_png_decode_png (struct grub_png_data *data)
 {
@@ -1049,20 +567,11 @@ grub_png_decode_png (struct grub_png_data *data)
 	  break;
 
 	case PNG_CHUNK_IDAT:
-	  data->inside_idat = 1;
-	  data->idat_remain = len;
-	  data->bit_count = 0;
-
-	  grub_png_decode_image_data (data);
-
-	  data->inside_idat = 0;
+	  grub_png_read_image_data (data, len);
 	  break;
 
 	case PNG_CHUNK_IEND:
-          if (data->image_data)
-            grub_png_convert_image (data);
-
-	  return grub_errno;
+	  return grub_png_decode_image_data (data);
 
 	default:
 	  grub_file_seek (data->file, data->file->offset + len + 4);
@@ -1098,7 +607,7 @@ grub_video_reader_png (struct grub_video_bitmap **bitmap,
 
       grub_png_decode_png (data);
 
-      grub_free (data->image_data);
+      grub_free (data->idat);
       grub_free (data);
     }
 
@@ -288,6 +288,55 @@ tga_load_truecolor_R8G8B8A8 (struct tga_data *data)
   return GRUB_ERR_NONE;
 }
 
+/* Uncompressed true color pixels are stored as plain rows, so read the
+   whole image into the bitmap at once and fix up the channel and row
+   order in place.  */
+static grub_err_t
+tga_load_truecolor_raw (struct tga_data *data)
+{
+  grub_uint8_t *base = data->bitmap->data;
+  grub_size_t pitch = data->bitmap->mode_info.pitch;
+  grub_size_t len = pitch * data->image_height;
+  unsigned int y;
+
+  if (grub_file_read (data->file, base, len) != (grub_ssize_t) len)
+    {
+      if (grub_errno == GRUB_ERR_NONE)
+	grub_error (GRUB_ERR_BAD_FILE_TYPE, "tga: premature end of data");
+      return grub_errno;
+    }
+
+#ifndef GRUB_CPU_WORDS_BIGENDIAN
+  {
+    grub_uint8_t *ptr;
+
+    for (ptr = base; ptr < base + len; ptr += data->bpp)
+      {
+	grub_uint8_t t = ptr[0];
+	ptr[0] = ptr[2];
+	ptr[2] = t;
+      }
+  }
+#endif
+
+  if ((data->hdr.image_descriptor & GRUB_TGA_IMAGE_ORIGIN_TOP) == 0)
+    for (y = 0; y < data->image_height / 2; y++)
+      {
+	grub_uint8_t *top = base + y * pitch;
+	grub_uint8_t *bottom = base + (data->image_height - 1 - y) * pitch;
+	grub_size_t i;
+
+	for (i = 0; i < pitch; i++)
+	  {
+	    grub_uint8_t t = top[i];
+	    top[i] = bottom[i];
+	    bottom[i] = t;
+	  }
+      }
+
+  return GRUB_ERR_NONE;
+}
+
 static grub_err_t
 grub_video_reader_tga (struct grub_video_bitmap **bitmap,
                        const char *filename)
@@ -430,7 +479,10 @@ grub_video_reader_tga (struct grub_video_bitmap **bitmap,
 
 	  data.bitmap = *bitmap;
 	  /* Load bitmap data.  */
-	  tga_load_truecolor_R8G8B8 (&data);
+	  if (data.uses_rle)
+	    tga_load_truecolor_R8G8B8 (&data);
+	  else
+	    tga_load_truecolor_raw (&data);
 	  break;
 
 	case 32:
@@ -445,7 +497,10 @@ grub_video_reader_tga (struct grub_video_bitmap **bitmap,
 
 	  data.bitmap = *bitmap;
 	  /* Load bitmap data.  */
-	  tga_load_truecolor_R8G8B8A8 (&data);
+	  if (data.uses_rle)
+	    tga_load_truecolor_R8G8B8A8 (&data);
+	  else
+	    tga_load_truecolor_raw (&data);
 	  break;
 
 	default:
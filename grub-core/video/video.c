@@ -531,6 +531,125 @@ parse_modespec (const char *current_mode, int *width, int *height, int *depth)
   return GRUB_ERR_NONE;
 }
 
+/* What grub_video_set_mode last settled on for a mode string, so that
+   setting the same gfxmode again (gfxterm init, gfxpayload) goes straight
+   to the adapter and mode that worked instead of trying every earlier
+   entry on every adapter.  */
+static struct
+{
+  char *modestring;
+  unsigned int modemask;
+  unsigned int modevalue;
+  grub_video_adapter_t adapter;
+  int width;
+  int height;
+  unsigned int flags;
+  unsigned int flagmask;
+} last_mode;
+
+/* Try to set mode WIDTHxHEIGHT matching FLAGS/FLAGMASK on adapter P and
+   leave P active if it works and suits MODEMASK/MODEVALUE.  */
+static int
+try_adapter (grub_video_adapter_t p, int width, int height,
+	     unsigned int flags, unsigned int flagmask,
+	     unsigned int modemask, unsigned int modevalue)
+{
+  struct grub_video_mode_info mode_info;
+  grub_err_t err;
+
+  grub_memset (&mode_info, 0, sizeof (mode_info));
+
+  /* Try to initialize adapter, if it fails, skip to next adapter.  */
+  err = p->init ();
+  if (err != GRUB_ERR_NONE)
+    {
+      grub_errno = GRUB_ERR_NONE;
+      return 0;
+    }
+
+  /* Try to initialize video mode.  */
+  err = p->setup (width, height, flags, flagmask);
+  if (err != GRUB_ERR_NONE)
+    {
+      p->fini ();
+      grub_errno = GRUB_ERR_NONE;
+      return 0;
+    }
+
+  err = p->get_info (&mode_info);
+  if (err != GRUB_ERR_NONE)
+    {
+      p->fini ();
+      grub_errno = GRUB_ERR_NONE;
+      return 0;
+    }
+
+  flags = mode_info.mode_type & ~GRUB_VIDEO_MODE_TYPE_DEPTH_MASK;
+  flags |= (mode_info.bpp << GRUB_VIDEO_MODE_TYPE_DEPTH_POS)
+    & GRUB_VIDEO_MODE_TYPE_DEPTH_MASK;
+
+  /* Check that mode is suitable for upper layer.  */
+  if ((flags & GRUB_VIDEO_MODE_TYPE_PURE_TEXT)
+      ? (((GRUB_VIDEO_MODE_TYPE_PURE_TEXT & modemask) != 0)
+	 && ((GRUB_VIDEO_MODE_TYPE_PURE_TEXT & modevalue) == 0))
+      : ((flags & modemask) != modevalue))
+    {
+      p->fini ();
+      grub_errno = GRUB_ERR_NONE;
+      return 0;
+    }
+
+  /* Valid mode found from adapter, and it has been activated.
+     Specify it as active adapter.  */
+  grub_video_adapter_active = p;
+  return 1;
+}
+
+static int
+try_last_mode (const char *modestring, unsigned int modemask,
+	       unsigned int modevalue)
+{
+  grub_video_adapter_t p;
+
+  if (!last_mode.modestring || last_mode.modemask != modemask
+      || last_mode.modevalue != modevalue
+      || grub_strcmp (last_mode.modestring, modestring) != 0)
+    return 0;
+
+  /* The adapter may have gone away with its module.  */
+  for (p = grub_video_adapter_list; p; p = p->next)
+    if (p == last_mode.adapter)
+      break;
+  if (!p)
+    return 0;
+
+  return try_adapter (p, last_mode.width, last_mode.height,
+		      last_mode.flags, last_mode.flagmask,
+		      modemask, modevalue);
+}
+
+static void
+remember_mode (const char *modestring, unsigned int modemask,
+	       unsigned int modevalue, int width, int height,
+	       unsigned int flags, unsigned int flagmask)
+{
+  if (!last_mode.modestring
+      || grub_strcmp (last_mode.modestring, modestring) != 0)
+    {
+      grub_free (last_mode.modestring);
+      last_mode.modestring = grub_strdup (modestring);
+      if (!last_mode.modestring)
+	grub_errno = GRUB_ERR_NONE;
+    }
+  last_mode.modemask = modemask;
+  last_mode.modevalue = modevalue;
+  last_mode.adapter = grub_video_adapter_active;
+  last_mode.width = width;
+  last_mode.height = height;
+  last_mode.flags = flags;
+  last_mode.flagmask = flagmask;
+}
+
 grub_err_t
 grub_video_set_mode (const char *modestring,
 		     unsigned int modemask,
@@ -612,6 +731,12 @@ grub_video_set_mode (const char *modestring,
       grub_video_adapter_active = 0;
     }
 
+  if (try_last_mode (modestring, modemask, modevalue))
+    {
+      grub_free (modevar);
+      return GRUB_ERR_NONE;
+    }
+
   /* Loop until all modes has been tested out.  */
   while (next_mode != NULL)
     {
@@ -696,61 +821,17 @@ grub_video_set_mode (const char *modestring,
 
       /* Loop thru all possible video adapter trying to find requested mode.  */
       for (p = grub_video_adapter_list; p; p = p->next)
-	{
-	  struct grub_video_mode_info mode_info;
-
-	  grub_memset (&mode_info, 0, sizeof (mode_info));
-
-	  /* Try to initialize adapter, if it fails, skip to next adapter.  */
-	  err = p->init ();
-	  if (err != GRUB_ERR_NONE)
-	    {
-	      grub_errno = GRUB_ERR_NONE;
-	      continue;
-	    }
-
-	  /* Try to initialize video mode.  */
-	  err = p->setup (width, height, flags, flagmask);
-	  if (err != GRUB_ERR_NONE)
-	    {
-	      p->fini ();
-	      grub_errno = GRUB_ERR_NONE;
-	      continue;
-	    }
+	if (try_adapter (p, width, height, flags, flagmask,
+			 modemask, modevalue))
+	  {
+	    remember_mode (modestring, modemask, modevalue, width, height,
+			   flags, flagmask);
 
-	  err = p->get_info (&mode_info);
-	  if (err != GRUB_ERR_NONE)
-	    {
-	      p->fini ();
-	      grub_errno = GRUB_ERR_NONE;
-	      continue;
-	    }
-
-	  flags = mode_info.mode_type & ~GRUB_VIDEO_MODE_TYPE_DEPTH_MASK;
-	  flags |= (mode_info.bpp << GRUB_VIDEO_MODE_TYPE_DEPTH_POS)
-	    & GRUB_VIDEO_MODE_TYPE_DEPTH_MASK;
-
-	  /* Check that mode is suitable for upper layer.  */
-	  if ((flags & GRUB_VIDEO_MODE_TYPE_PURE_TEXT)
-	      ? (((GRUB_VIDEO_MODE_TYPE_PURE_TEXT & modemask) != 0)
-		 && ((GRUB_VIDEO_MODE_TYPE_PURE_TEXT & modevalue) == 0))
-	      : ((flags & modemask) != modevalue))
-	    {
-	      p->fini ();
-	      grub_errno = GRUB_ERR_NONE;
-	      continue;
-	    }
-
-	  /* Valid mode found from adapter, and it has been activated.
-	     Specify it as active adapter.  */
-	  grub_video_adapter_active = p;
-
-	  /* Free memory.  */
-	  grub_free (modevar);
-
-	  return GRUB_ERR_NONE;
-	}
+	    /* Free memory.  */
+	    grub_free (modevar);
 
+	    return GRUB_ERR_NONE;
+	  }
     }
 
   /* Free memory.  */
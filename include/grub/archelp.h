@@ -47,6 +47,19 @@ struct grub_archelp_ops
 
   void
   (*rewind) (struct grub_archelp_data *data);
+
+  /* Optional.  With these archelp keeps an index of the archive, so
+     that lookups don't have to scan it from the start.  TELL returns
+     the offset of the header FIND_FILE reads next and SEEK makes it
+     read the header at OFS next.  */
+  grub_disk_t
+  (*get_disk) (struct grub_archelp_data *data);
+
+  grub_off_t
+  (*tell) (struct grub_archelp_data *data);
+
+  void
+  (*seek) (struct grub_archelp_data *data, grub_off_t ofs);
 };
 
 grub_err_t
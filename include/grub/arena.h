@@ -0,0 +1,44 @@
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2026  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef GRUB_ARENA_HEADER
+#define GRUB_ARENA_HEADER	1
+
+#include <grub/types.h>
+#include <grub/symbol.h>
+
+/* Bump allocator for short-lived allocations.  Memory handed out by an
+   arena is never freed on its own, only all at once by grub_arena_reset
+   or grub_arena_destroy.  */
+typedef struct grub_arena *grub_arena_t;
+
+/* CHUNK_SIZE of 0 selects the default.  */
+grub_arena_t EXPORT_FUNC(grub_arena_create) (grub_size_t chunk_size);
+void EXPORT_FUNC(grub_arena_destroy) (grub_arena_t arena);
+void EXPORT_FUNC(grub_arena_reset) (grub_arena_t arena);
+
+void *EXPORT_FUNC(grub_arena_alloc) (grub_arena_t arena, grub_size_t size);
+/* Resize PTR, which holds OLD_SIZE bytes.  The most recent allocation is
+   extended in place when there is room.  */
+void *EXPORT_FUNC(grub_arena_realloc) (grub_arena_t arena, void *ptr,
+				       grub_size_t old_size,
+				       grub_size_t new_size);
+char *EXPORT_FUNC(grub_arena_strndup) (grub_arena_t arena, const char *s,
+				       grub_size_t n);
+
+#endif
@@ -26,4 +26,23 @@ grub_cpu_idle (void)
 /*  __asm__ __volatile__ ("wfi"); */
 }
 
+/* Generic timer: virtual count and its frequency in Hz.  */
+static __inline grub_uint64_t
+grub_arm64_get_cntvct (void)
+{
+  grub_uint64_t v;
+
+  __asm__ __volatile__ ("isb; mrs %0, cntvct_el0" : "=r" (v) : : "memory");
+  return v;
+}
+
+static __inline grub_uint64_t
+grub_arm64_get_cntfrq (void)
+{
+  grub_uint64_t v;
+
+  __asm__ __volatile__ ("mrs %0, cntfrq_el0" : "=r" (v));
+  return v;
+}
+
 #endif /* ! KERNEL_CPU_TIME_HEADER */
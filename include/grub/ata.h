@@ -85,6 +85,8 @@ enum grub_ata_commands
     GRUB_ATA_CMD_READ_SECTORS_EXT	= 0x24,
     GRUB_ATA_CMD_READ_SECTORS_DMA	= 0xc8,
     GRUB_ATA_CMD_READ_SECTORS_DMA_EXT	= 0x25,
+    GRUB_ATA_CMD_READ_FPDMA_QUEUED	= 0x60,
+    GRUB_ATA_CMD_WRITE_FPDMA_QUEUED	= 0x61,
 
     GRUB_ATA_CMD_SECURITY_FREEZE_LOCK	= 0xf5,
     GRUB_ATA_CMD_SET_FEATURES		= 0xef,
@@ -182,6 +184,11 @@ struct grub_ata
 
   int dma;
 
+  /* Number of commands that can be queued (NCQ), 0 without NCQ.  The
+     controller driver sets its own limit on open and IDENTIFY lowers it
+     to what the device supports.  */
+  unsigned ncq_depth;
+
   grub_size_t maxbuffer;
 
   int *present;
@@ -213,6 +220,13 @@ struct grub_ata_dev
 			   struct grub_disk_ata_pass_through_parms *parms,
 			   int spinup);
 
+  /* Optional.  Transfer SIZE sectors at SECTOR as several queued commands
+     in flight at once.  Only used when ATA->ncq_depth is set; on failure
+     the transfer is done again through READWRITE.  */
+  grub_err_t (*readwrite_queued) (struct grub_ata *ata,
+				  grub_disk_addr_t sector, grub_size_t size,
+				  char *buf, int write);
+
   /* The next scsi device.  */
   struct grub_ata_dev *next;
 };
@@ -0,0 +1,68 @@
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2026  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef GRUB_BENCH_HEADER
+#define GRUB_BENCH_HEADER
+
+#include <grub/list.h>
+#include <grub/types.h>
+
+struct grub_bench
+{
+  /* The next benchmark.  */
+  struct grub_bench *next;
+  struct grub_bench **prev;
+
+  /* The benchmark name, "group/case".  */
+  char *name;
+
+  /* The function to time, or NULL if the benchmark cannot run here.  */
+  void (*run) (void *data);
+  void *data;
+
+  /* Bytes processed by one call of RUN, for the throughput column.  Zero
+     when a throughput makes no sense.  */
+  grub_size_t bytes;
+
+  /* Why the benchmark was skipped, when RUN is NULL.  */
+  char *reason;
+};
+typedef struct grub_bench *grub_bench_t;
+
+extern grub_bench_t grub_bench_list;
+
+void grub_bench_register (const char *name, void (*run) (void *data),
+			  void *data, grub_size_t bytes);
+
+/* Keep NAME in the report, so that runs on different hosts still line up,
+   but do not time it.  */
+void grub_bench_skip (const char *name, const char *reason);
+
+/* Keep the compiler from optimizing away work whose result is unused.  */
+static inline void
+grub_bench_use (const void *p)
+{
+  asm volatile ("" : : "r" (p) : "memory");
+}
+
+/* Provided by each benchmark program: set up the inputs and register the
+   benchmarks, and release them again.  */
+void grub_bench_init (void);
+void grub_bench_fini (void);
+
+#endif /* ! GRUB_BENCH_HEADER */
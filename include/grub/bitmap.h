@@ -42,6 +42,13 @@ struct grub_video_bitmap_reader
   grub_err_t (*reader) (struct grub_video_bitmap **bitmap,
                         const char *filename);
 
+  /* Optional reader that may decode at a reduced size, as long as the
+     result is still at least MIN_WIDTH by MIN_HEIGHT.  */
+  grub_err_t (*reader_reduced) (struct grub_video_bitmap **bitmap,
+                                const char *filename,
+                                unsigned int min_width,
+                                unsigned int min_height);
+
   /* Next reader.  */
   struct grub_video_bitmap_reader *next;
 };
@@ -59,6 +66,11 @@ grub_err_t EXPORT_FUNC (grub_video_bitmap_destroy) (struct grub_video_bitmap *bi
 grub_err_t EXPORT_FUNC (grub_video_bitmap_load) (struct grub_video_bitmap **bitmap,
 						 const char *filename);
 
+grub_err_t EXPORT_FUNC (grub_video_bitmap_load_reduced) (struct grub_video_bitmap **bitmap,
+							 const char *filename,
+							 unsigned int min_width,
+							 unsigned int min_height);
+
 /* Return bitmap width.  */
 static inline unsigned int
 grub_video_bitmap_get_width (struct grub_video_bitmap *bitmap)
@@ -0,0 +1,46 @@
+/* bitmap_cache.h - Cache of decoded and scaled theme bitmaps.  */
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2026  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef GRUB_BITMAP_CACHE_HEADER
+#define GRUB_BITMAP_CACHE_HEADER 1
+
+#include <grub/err.h>
+#include <grub/bitmap.h>
+#include <grub/bitmap_scale.h>
+
+/* Both functions return a new bitmap in *BITMAP which the caller owns and
+   must destroy; the cache keeps its own copy.  */
+grub_err_t grub_gfxmenu_bitmap_load (struct grub_video_bitmap **bitmap,
+                                     const char *path);
+grub_err_t
+grub_gfxmenu_bitmap_load_scaled (struct grub_video_bitmap **bitmap,
+                                 const char *path,
+                                 int width, int height,
+                                 grub_video_bitmap_selection_method_t
+                                 selection_method,
+                                 grub_video_bitmap_v_align_t v_align,
+                                 grub_video_bitmap_h_align_t h_align);
+void grub_gfxmenu_bitmap_cache_clear (void);
+
+/* Offer the cache to the memory manager for reclaiming, and withdraw it
+   before the module goes away.  */
+void grub_gfxmenu_bitmap_cache_init (void);
+void grub_gfxmenu_bitmap_cache_fini (void);
+
+#endif /* ! GRUB_BITMAP_CACHE_HEADER */
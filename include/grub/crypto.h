@@ -175,12 +175,18 @@ typedef struct gcry_md_spec
   grub_size_t contextsize; /* allocate this amount of context */
   /* Block size, needed for HMAC.  */
   grub_size_t blocksize;
+  /* Lookups by name prefer the provider with the highest priority.  */
+  int priority;
 #ifdef GRUB_UTIL
   const char *modname;
 #endif
   struct gcry_md_spec *next;
 } gcry_md_spec_t;
 
+/* Priority of implementations using dedicated CPU instructions; the
+   portable ones have 0.  */
+#define GRUB_MD_PRIORITY_HW 10
+
 struct gcry_mpi;
 typedef struct gcry_mpi *gcry_mpi_t;
 
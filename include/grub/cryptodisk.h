@@ -84,6 +84,8 @@ struct grub_cryptodisk
   grub_uint8_t *lrw_precalc;
   grub_uint8_t iv_prefix[64];
   grub_size_t iv_prefix_len;
+  /* State of iv_hash after hashing iv_prefix, or NULL.  */
+  void *iv_hash_ctx;
   grub_uint8_t key[GRUB_CRYPTODISK_MAX_KEYLEN];
   grub_size_t keysize;
 #ifdef GRUB_UTIL
@@ -98,6 +100,8 @@ struct grub_cryptodisk
   grub_uint64_t last_rekey;
   int rekey_derived_size;
   grub_disk_addr_t partition_start;
+  /* Data and XTS tweak keys for the AES-NI paths, or NULL.  */
+  struct grub_aesni_key *aesni;
 };
 typedef struct grub_cryptodisk *grub_cryptodisk_t;
 
@@ -134,6 +138,9 @@ gcry_err_code_t
 grub_cryptodisk_setkey (grub_cryptodisk_t dev,
 			grub_uint8_t *key, grub_size_t keysize);
 gcry_err_code_t
+grub_cryptodisk_set_iv_prefix (grub_cryptodisk_t dev,
+			       const grub_uint8_t *prefix, grub_size_t len);
+gcry_err_code_t
 grub_cryptodisk_decrypt (struct grub_cryptodisk *dev,
 			 grub_uint8_t * data, grub_size_t len,
 			 grub_disk_addr_t sector);
@@ -27,4 +27,16 @@ grub_ssize_t
 grub_deflate_decompress (char *inbuf, grub_size_t insize, grub_off_t off,
 			 char *outbuf, grub_size_t outsize);
 
+struct grub_zlib_stream;
+
+struct grub_zlib_stream *
+grub_zlib_stream_open (char *inbuf, grub_size_t insize);
+
+grub_ssize_t
+grub_zlib_stream_read (struct grub_zlib_stream *stream, char *outbuf,
+		       grub_size_t len);
+
+void
+grub_zlib_stream_close (struct grub_zlib_stream *stream);
+
 #endif
@@ -49,6 +49,8 @@ enum grub_disk_dev_id
     GRUB_DISK_DEVICE_CBFSDISK_ID,
     GRUB_DISK_DEVICE_UBOOTDISK_ID,
     GRUB_DISK_DEVICE_XEN,
+    GRUB_DISK_DEVICE_NVME_ID,
+    GRUB_DISK_DEVICE_GFXTHEME_ID,
   };
 
 struct grub_disk;
@@ -66,6 +68,24 @@ typedef enum
 
 typedef int (*grub_disk_dev_iterate_hook_t) (const char *name, void *data);
 
+/* What a disk device has been asked to do so far.  Times are in
+   milliseconds.  */
+struct grub_disk_dev_stats
+{
+  unsigned long reads;
+  grub_uint64_t read_bytes;
+  /* Reads of more than one cache line at once.  */
+  unsigned long agglomerated_reads;
+  grub_uint64_t largest_read;
+  grub_uint64_t read_time;
+  grub_uint64_t min_read_time;
+  grub_uint64_t max_read_time;
+  unsigned long writes;
+  grub_uint64_t write_bytes;
+  unsigned long cache_hits;
+  unsigned long cache_misses;
+};
+
 /* Disk device.  */
 struct grub_disk_dev
 {
@@ -93,6 +113,12 @@ struct grub_disk_dev
   grub_err_t (*write) (struct grub_disk *disk, grub_disk_addr_t sector,
 		       grub_size_t size, const char *buf);
 
+  /* Optional.  Start reading SIZE sectors from the sector SECTOR of the disk
+     DISK in the background, so that a later READ of them completes
+     quickly.  On failure the data is read synchronously instead.  */
+  grub_err_t (*prefetch) (struct grub_disk *disk, grub_disk_addr_t sector,
+			  grub_size_t size);
+
 #ifdef GRUB_UTIL
   struct grub_disk_memberlist *(*memberlist) (struct grub_disk *disk);
   const char * (*raidname) (struct grub_disk *disk);
@@ -100,6 +126,9 @@ struct grub_disk_dev
 
   /* The next disk device.  */
   struct grub_disk_dev *next;
+
+  /* Kept up to date by the disk layer.  */
+  struct grub_disk_dev_stats stats;
 };
 typedef struct grub_disk_dev *grub_disk_dev_t;
 
@@ -142,6 +171,18 @@ struct grub_disk
   /* Caller-specific data passed to the read hook.  */
   void *read_hook_data;
 
+  /* Sequential read detection, in 512B units from the start of the disk:
+     where the next read is expected to start, how far data has been read
+     ahead and the current read-ahead window in cache units.  */
+  grub_disk_addr_t readahead_next;
+  grub_disk_addr_t readahead_end;
+  unsigned int readahead_window;
+
+  /* Set by drivers whose whole disk is in memory at this address.  The
+     disk layer then copies from it directly and doesn't cache the disk,
+     and grub_disk_map_memory can hand out pointers into it.  */
+  char *memory;
+
   /* Device-specific data.  */
   void *data;
 };
@@ -160,21 +201,52 @@ typedef struct grub_disk_memberlist *grub_disk_memberlist_t;
 #define GRUB_DISK_SECTOR_SIZE	0x200
 #define GRUB_DISK_SECTOR_BITS	9
 
-/* The maximum number of disk caches.  */
-#define GRUB_DISK_CACHE_NUM	1021
-
 /* The size of a disk cache in 512B units. Must be at least as big as the
    largest supported sector size, currently 16K.  */
 #define GRUB_DISK_CACHE_BITS	6
 #define GRUB_DISK_CACHE_SIZE	(1 << GRUB_DISK_CACHE_BITS)
 
+/* The disk cache is set-associative: each (device, disk, sector) maps to
+   one set and may live in any of its GRUB_DISK_CACHE_WAYS lines, which are
+   replaced in LRU order.  */
+#define GRUB_DISK_CACHE_WAYS	4
+
+/* The number of sets is derived from the heap size reported by the memory
+   manager: at most 1 / (1 << GRUB_DISK_CACHE_HEAP_SHIFT) of it is used for
+   cached data, within the limits below.  The default roughly matches the
+   historical fixed table of 1021 lines.  */
+#define GRUB_DISK_CACHE_HEAP_SHIFT	2
+#define GRUB_DISK_CACHE_MIN_SETS	32
+#define GRUB_DISK_CACHE_DEFAULT_SETS	256
+#define GRUB_DISK_CACHE_MAX_SETS	8192
+
+/* The initial read-ahead window, in cache units.  It doubles as long as
+   the reads stay sequential, up to the disk's maximum agglomerate or
+   GRUB_DISK_READAHEAD_MAX_WINDOW, whichever is smaller.  Single reads
+   bigger than the maximum window are considered streaming and bypass the
+   cache.  */
+#define GRUB_DISK_READAHEAD_MIN_WINDOW	4
+#define GRUB_DISK_READAHEAD_MAX_WINDOW	64
+
 #define GRUB_DISK_MAX_MAX_AGGLOMERATE ((1 << (30 - GRUB_DISK_CACHE_BITS - GRUB_DISK_SECTOR_BITS)) - 1)
 
 /* Return value of grub_disk_get_size() in case disk size is unknown. */
 #define GRUB_DISK_SIZE_UNKNOWN	 0xffffffffffffffffULL
 
-/* This is called from the memory manager.  */
-void grub_disk_cache_invalidate_all (void);
+void EXPORT_FUNC(grub_disk_cache_invalidate_all) (void);
+/* Called from the memory manager.  */
+void grub_disk_cache_add_heap (grub_size_t size);
+
+/* Bumped whenever disks may have come or gone: a disk driver being
+   registered or unregistered, a device being attached or detached, or a
+   loopback or crypto disk being set up or removed.  Anything caching
+   per-disk results drops them when it changes.  */
+extern unsigned long EXPORT_VAR(grub_disk_generation);
+
+/* Forget every cached sector and, through grub_disk_generation, whatever
+   filesystems and open mounts cached on top of them, so that the next
+   access goes to the device.  */
+void EXPORT_FUNC(grub_disk_drop_caches) (void);
 
 void EXPORT_FUNC(grub_disk_dev_register) (grub_disk_dev_t dev);
 void EXPORT_FUNC(grub_disk_dev_unregister) (grub_disk_dev_t dev);
@@ -199,6 +271,13 @@ grub_err_t EXPORT_FUNC(grub_disk_read) (grub_disk_t disk,
 					grub_off_t offset,
 					grub_size_t size,
 					void *buf);
+void EXPORT_FUNC(grub_disk_prefetch) (grub_disk_t disk,
+				      grub_disk_addr_t sector,
+				      grub_size_t size);
+void *EXPORT_FUNC(grub_disk_map_memory) (grub_disk_t disk,
+					 grub_disk_addr_t sector,
+					 grub_off_t offset,
+					 grub_size_t size);
 grub_err_t grub_disk_write (grub_disk_t disk,
 			    grub_disk_addr_t sector,
 			    grub_off_t offset,
@@ -213,10 +292,11 @@ extern grub_err_t (*EXPORT_VAR(grub_disk_write_weak)) (grub_disk_t disk,
 
 grub_uint64_t EXPORT_FUNC(grub_disk_get_size) (grub_disk_t disk);
 
-#if DISK_CACHE_STATS
 void
 EXPORT_FUNC(grub_disk_cache_get_performance) (unsigned long *hits, unsigned long *misses);
-#endif
+void
+EXPORT_FUNC(grub_disk_get_read_stats) (unsigned long *reads,
+				       grub_uint64_t *bytes);
 
 extern void (* EXPORT_VAR(grub_disk_firmware_fini)) (void);
 extern int EXPORT_VAR(grub_disk_firmware_is_tainted);
@@ -241,9 +321,17 @@ struct grub_disk_cache
   grub_disk_addr_t sector;
   char *data;
   int lock;
+  /* Value of the cache clock when this line was last used.  */
+  unsigned long last_use;
 };
 
-extern struct grub_disk_cache EXPORT_VAR(grub_disk_cache_table)[GRUB_DISK_CACHE_NUM];
+/* GRUB_DISK_CACHE_SETS * GRUB_DISK_CACHE_WAYS lines, set by set.  NULL if
+   the cache couldn't be allocated.  */
+extern struct grub_disk_cache *EXPORT_VAR(grub_disk_cache_table);
+extern unsigned EXPORT_VAR(grub_disk_cache_sets);
+/* The cached data is accounted here, so that it can be given back when
+   memory runs low.  */
+extern struct grub_reclaim_cache EXPORT_VAR(grub_disk_cache_reclaim);
 
 #if defined (GRUB_UTIL)
 void grub_lvm_init (void);
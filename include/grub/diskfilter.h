@@ -148,11 +148,16 @@ struct grub_diskfilter
 typedef struct grub_diskfilter *grub_diskfilter_t;
 
 extern grub_diskfilter_t grub_diskfilter_list;
+/* Bumped whenever the list above changes, as disks scanned without a
+   diskfilter have to be scanned again with it.  */
+extern unsigned long grub_diskfilter_generation;
+
 static inline void
 grub_diskfilter_register_front (grub_diskfilter_t diskfilter)
 {
   grub_list_push (GRUB_AS_LIST_P (&grub_diskfilter_list),
 		  GRUB_AS_LIST (diskfilter));
+  grub_diskfilter_generation++;
 }
 
 static inline void
@@ -163,11 +168,13 @@ grub_diskfilter_register_back (grub_diskfilter_t diskfilter)
   diskfilter->next = NULL;
   diskfilter->prev = q;
   *q = diskfilter;
+  grub_diskfilter_generation++;
 }
 static inline void
 grub_diskfilter_unregister (grub_diskfilter_t diskfilter)
 {
   grub_list_remove (GRUB_AS_LIST (diskfilter));
+  grub_diskfilter_generation++;
 }
 
 struct grub_diskfilter_vg *
@@ -189,6 +196,9 @@ typedef grub_err_t (*grub_raid6_recover_func_t) (struct grub_diskfilter_segment
 extern grub_raid5_recover_func_t grub_raid5_recover_func;
 extern grub_raid6_recover_func_t grub_raid6_recover_func;
 
+/* DST ^= SRC, vectorised where the platform allows.  */
+void grub_raid_block_xor (char *dst, const char *src, grub_size_t size);
+
 grub_err_t grub_diskfilter_vg_register (struct grub_diskfilter_vg *vg);
 
 grub_err_t
@@ -200,6 +200,8 @@ typedef struct grub_dl *grub_dl_t;
 grub_dl_t grub_dl_load_file (const char *filename);
 grub_dl_t EXPORT_FUNC(grub_dl_load) (const char *name);
 grub_dl_t grub_dl_load_core (void *addr, grub_size_t size);
+struct grub_module_header;
+grub_err_t grub_dl_load_embedded (struct grub_module_header *header);
 grub_dl_t EXPORT_FUNC(grub_dl_load_core_noinit) (void *addr, grub_size_t size);
 int EXPORT_FUNC(grub_dl_unload) (grub_dl_t mod);
 void grub_dl_unload_unneeded (void);
@@ -244,6 +246,8 @@ grub_dl_get (const char *name)
 
 grub_err_t grub_dl_register_symbol (const char *name, void *addr,
 				    int isfunc, grub_dl_t mod);
+const char *EXPORT_FUNC(grub_dl_find_function) (grub_dl_t mod, void *addr,
+					       grub_size_t *offset);
 
 grub_err_t grub_arch_dl_check_header (void *ehdr);
 #ifndef GRUB_UTIL
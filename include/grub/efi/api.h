@@ -89,6 +89,21 @@
     { 0x8e, 0x39, 0x00, 0xa0, 0xc9, 0x69, 0x72, 0x3b } \
   }
 
+#define GRUB_EFI_BLOCK_IO2_GUID	\
+  { 0xa77b2472, 0xe282, 0x4e9f, \
+    { 0xa2, 0x45, 0xc2, 0xc0, 0xe2, 0x7b, 0xbc, 0xc1 } \
+  }
+
+#define GRUB_EFI_MP_SERVICES_GUID	\
+  { 0x3fdda605, 0xa76e, 0x4f46, \
+    { 0xad, 0x29, 0x12, 0xf4, 0x53, 0x1b, 0x3d, 0x08 } \
+  }
+
+#define GRUB_EFI_RNG_PROTOCOL_GUID	\
+  { 0x3152bca5, 0xeade, 0x433d, \
+    { 0x86, 0x2e, 0xc0, 0x1c, 0xdc, 0x29, 0x1f, 0x44 } \
+  }
+
 #define GRUB_EFI_SERIAL_IO_GUID \
   { 0xbb25cf6f, 0xf1d4, 0x11d2, \
     { 0x9a, 0x0c, 0x00, 0x90, 0x27, 0x3f, 0xc1, 0xfd } \
@@ -1578,9 +1593,17 @@ struct grub_efi_block_io_media
   grub_efi_uint32_t io_align;
   grub_efi_uint8_t pad2[4];
   grub_efi_lba_t last_block;
+  /* Only valid in GRUB_EFI_BLOCK_IO_REVISION2 and later.  */
+  grub_efi_lba_t lowest_aligned_lba;
+  grub_efi_uint32_t logical_blocks_per_physical_block;
+  /* Only valid in GRUB_EFI_BLOCK_IO_REVISION3 and later.  */
+  grub_efi_uint32_t optimal_transfer_length_granularity;
 };
 typedef struct grub_efi_block_io_media grub_efi_block_io_media_t;
 
+#define GRUB_EFI_BLOCK_IO_REVISION2	0x00020001
+#define GRUB_EFI_BLOCK_IO_REVISION3	0x0002001f
+
 typedef grub_uint8_t grub_efi_mac_t[32];
 
 struct grub_efi_simple_network_mode
@@ -1659,7 +1682,7 @@ struct grub_efi_simple_network
 				grub_efi_mac_t *src_addr,
 				grub_efi_mac_t *dest_addr,
 				grub_uint16_t *protocol);
-  void (*waitforpacket) (void);
+  grub_efi_event_t wait_for_packet;
   struct grub_efi_simple_network_mode *mode;
 };
 typedef struct grub_efi_simple_network grub_efi_simple_network_t;
@@ -1685,6 +1708,99 @@ struct grub_efi_block_io
 };
 typedef struct grub_efi_block_io grub_efi_block_io_t;
 
+struct grub_efi_block_io2_token
+{
+  grub_efi_event_t event;
+  grub_efi_status_t transaction_status;
+};
+typedef struct grub_efi_block_io2_token grub_efi_block_io2_token_t;
+
+struct grub_efi_block_io2
+{
+  grub_efi_block_io_media_t *media;
+  grub_efi_status_t (*reset) (struct grub_efi_block_io2 *this,
+			      grub_efi_boolean_t extended_verification);
+  grub_efi_status_t (*read_blocks_ex) (struct grub_efi_block_io2 *this,
+				       grub_efi_uint32_t media_id,
+				       grub_efi_lba_t lba,
+				       grub_efi_block_io2_token_t *token,
+				       grub_efi_uintn_t buffer_size,
+				       void *buffer);
+  grub_efi_status_t (*write_blocks_ex) (struct grub_efi_block_io2 *this,
+					grub_efi_uint32_t media_id,
+					grub_efi_lba_t lba,
+					grub_efi_block_io2_token_t *token,
+					grub_efi_uintn_t buffer_size,
+					void *buffer);
+  grub_efi_status_t (*flush_blocks_ex) (struct grub_efi_block_io2 *this,
+					grub_efi_block_io2_token_t *token);
+};
+typedef struct grub_efi_block_io2 grub_efi_block_io2_t;
+
+#define GRUB_EFI_PROCESSOR_AS_BSP_BIT		0x00000001
+#define GRUB_EFI_PROCESSOR_ENABLED_BIT		0x00000002
+#define GRUB_EFI_PROCESSOR_HEALTH_STATUS_BIT	0x00000004
+
+struct grub_efi_processor_information
+{
+  grub_efi_uint64_t processor_id;
+  grub_efi_uint32_t status_flag;
+  grub_efi_uint32_t package;
+  grub_efi_uint32_t core;
+  grub_efi_uint32_t thread;
+};
+typedef struct grub_efi_processor_information grub_efi_processor_information_t;
+
+/* Procedures started on other processors are called by the firmware with
+   its own calling convention; see kern/efi/mp.c.  */
+typedef void *grub_efi_ap_procedure_t;
+
+struct grub_efi_mp_services
+{
+  grub_efi_status_t (*get_number_of_processors) (struct grub_efi_mp_services *this,
+						 grub_efi_uintn_t *number,
+						 grub_efi_uintn_t *enabled);
+  grub_efi_status_t (*get_processor_info) (struct grub_efi_mp_services *this,
+					   grub_efi_uintn_t number,
+					   grub_efi_processor_information_t *info);
+  grub_efi_status_t (*startup_all_aps) (struct grub_efi_mp_services *this,
+					grub_efi_ap_procedure_t procedure,
+					grub_efi_boolean_t single_thread,
+					grub_efi_event_t wait_event,
+					grub_efi_uintn_t timeout,
+					void *argument,
+					grub_efi_uintn_t **failed);
+  grub_efi_status_t (*startup_this_ap) (struct grub_efi_mp_services *this,
+					grub_efi_ap_procedure_t procedure,
+					grub_efi_uintn_t number,
+					grub_efi_event_t wait_event,
+					grub_efi_uintn_t timeout,
+					void *argument,
+					grub_efi_boolean_t *finished);
+  grub_efi_status_t (*switch_bsp) (struct grub_efi_mp_services *this,
+				   grub_efi_uintn_t number,
+				   grub_efi_boolean_t enable_old_bsp);
+  grub_efi_status_t (*enable_disable_ap) (struct grub_efi_mp_services *this,
+					  grub_efi_uintn_t number,
+					  grub_efi_boolean_t enable,
+					  grub_efi_uint32_t *health);
+  grub_efi_status_t (*who_am_i) (struct grub_efi_mp_services *this,
+				 grub_efi_uintn_t *number);
+};
+typedef struct grub_efi_mp_services grub_efi_mp_services_t;
+
+struct grub_efi_rng_protocol
+{
+  grub_efi_status_t (*get_info) (struct grub_efi_rng_protocol *this,
+				 grub_efi_uintn_t *algorithm_list_size,
+				 grub_efi_guid_t *algorithm_list);
+  grub_efi_status_t (*get_rng) (struct grub_efi_rng_protocol *this,
+				grub_efi_guid_t *algorithm,
+				grub_efi_uintn_t value_length,
+				grub_efi_uint8_t *value);
+};
+typedef struct grub_efi_rng_protocol grub_efi_rng_protocol_t;
+
 #if (GRUB_TARGET_SIZEOF_VOID_P == 4) || defined (__ia64__) \
   || defined (__aarch64__) || defined (__MINGW64__) || defined (__CYGWIN__)
 
@@ -51,6 +51,9 @@ EXPORT_FUNC(grub_efi_get_memory_map) (grub_efi_uintn_t *memory_map_size,
 				      grub_efi_uintn_t *map_key,
 				      grub_efi_uintn_t *descriptor_size,
 				      grub_efi_uint32_t *descriptor_version);
+const grub_efi_memory_descriptor_t *
+EXPORT_FUNC(grub_efi_get_cached_memory_map) (grub_efi_uintn_t *count,
+					     grub_efi_uintn_t *map_key);
 grub_efi_loaded_image_t *EXPORT_FUNC(grub_efi_get_loaded_image) (grub_efi_handle_t image_handle);
 void EXPORT_FUNC(grub_efi_print_device_path) (grub_efi_device_path_t *dp);
 char *EXPORT_FUNC(grub_efi_get_filename) (grub_efi_device_path_t *dp);
@@ -81,6 +84,11 @@ int
 EXPORT_FUNC (grub_efi_compare_device_paths) (const grub_efi_device_path_t *dp1,
 					     const grub_efi_device_path_t *dp2);
 
+/* Events that wake grub_machine_idle up besides the console's key event,
+   such as a network card's packet arrival.  */
+void EXPORT_FUNC (grub_efi_idle_add_event) (grub_efi_event_t event);
+void EXPORT_FUNC (grub_efi_idle_remove_event) (grub_efi_event_t event);
+
 extern void (*EXPORT_VAR(grub_efi_net_config)) (grub_efi_handle_t hnd, 
 						char **device,
 						char **path);
@@ -88,16 +96,22 @@ extern void (*EXPORT_VAR(grub_efi_net_config)) (grub_efi_handle_t hnd,
 grub_addr_t grub_efi_modules_addr (void);
 
 void grub_efi_mm_init (void);
+void grub_efi_mm_release_heap (void);
 void grub_efi_mm_fini (void);
 void grub_efi_init (void);
 void grub_efi_fini (void);
 void grub_efi_set_prefix (void);
 
+struct grub_job;
+unsigned grub_efi_mp_workers (void);
+int grub_efi_mp_start (struct grub_job *job);
+
 /* Variables.  */
 extern grub_efi_system_table_t *EXPORT_VAR(grub_efi_system_table);
 extern grub_efi_handle_t EXPORT_VAR(grub_efi_image_handle);
 
 extern int EXPORT_VAR(grub_efi_is_finished);
+extern grub_uint64_t EXPORT_VAR(grub_efi_mmap_generation);
 
 struct grub_net_card;
 
@@ -0,0 +1,156 @@
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2026  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef GRUB_EFI_HTTP_HEADER
+#define GRUB_EFI_HTTP_HEADER	1
+
+#include <grub/efi/api.h>
+
+#define GRUB_EFI_HTTP_SERVICE_BINDING_PROTOCOL_GUID \
+  { 0xbdc8e6af, 0xd9bc, 0x4379, \
+    { 0xa7, 0x2a, 0xe0, 0xc4, 0xe7, 0x5d, 0xae, 0x1c } \
+  }
+
+#define GRUB_EFI_HTTP_PROTOCOL_GUID \
+  { 0x7a59b29b, 0x910b, 0x4171, \
+    { 0x82, 0x42, 0xa8, 0x5a, 0x0d, 0xf2, 0x5b, 0x5b } \
+  }
+
+#define GRUB_EFI_CONNECTION_FIN		GRUB_EFI_ERROR_CODE (104)
+#define GRUB_EFI_CONNECTION_RESET	GRUB_EFI_ERROR_CODE (105)
+#define GRUB_EFI_CONNECTION_REFUSED	GRUB_EFI_ERROR_CODE (106)
+
+struct grub_efi_service_binding
+{
+  grub_efi_status_t (*create_child) (struct grub_efi_service_binding *this,
+				     grub_efi_handle_t *child_handle);
+  grub_efi_status_t (*destroy_child) (struct grub_efi_service_binding *this,
+				      grub_efi_handle_t child_handle);
+};
+typedef struct grub_efi_service_binding grub_efi_service_binding_t;
+
+typedef enum
+  {
+    GRUB_EFI_HTTPVERSION10,
+    GRUB_EFI_HTTPVERSION11,
+    GRUB_EFI_HTTPVERSIONUNSUPPORTED
+  } grub_efi_http_version_t;
+
+typedef enum
+  {
+    GRUB_EFI_HTTPMETHODGET,
+    GRUB_EFI_HTTPMETHODPOST,
+    GRUB_EFI_HTTPMETHODPATCH,
+    GRUB_EFI_HTTPMETHODOPTIONS,
+    GRUB_EFI_HTTPMETHODCONNECT,
+    GRUB_EFI_HTTPMETHODHEAD,
+    GRUB_EFI_HTTPMETHODPUT,
+    GRUB_EFI_HTTPMETHODDELETE,
+    GRUB_EFI_HTTPMETHODTRACE
+  } grub_efi_http_method_t;
+
+/* Only the values GRUB looks at; the firmware numbers the status codes
+   in the order the UEFI specification lists them.  */
+typedef enum
+  {
+    GRUB_EFI_HTTP_STATUS_UNSUPPORTED_STATUS = 0,
+    GRUB_EFI_HTTP_STATUS_200_OK = 3,
+    GRUB_EFI_HTTP_STATUS_206_PARTIAL_CONTENT = 9,
+    GRUB_EFI_HTTP_STATUS_404_NOT_FOUND = 21
+  } grub_efi_http_status_code_t;
+
+typedef struct
+{
+  grub_efi_boolean_t use_default_address;
+  grub_efi_ipv4_address_t local_address;
+  grub_efi_ipv4_address_t local_subnet;
+  grub_efi_uint16_t local_port;
+} grub_efi_httpv4_access_point_t;
+
+typedef struct
+{
+  grub_efi_ipv6_address_t local_address;
+  grub_efi_uint16_t local_port;
+} grub_efi_httpv6_access_point_t;
+
+typedef struct
+{
+  grub_efi_http_version_t http_version;
+  grub_efi_uint32_t timeout_millisec;
+  grub_efi_boolean_t local_address_is_ipv6;
+  union
+  {
+    grub_efi_httpv4_access_point_t *ipv4_node;
+    grub_efi_httpv6_access_point_t *ipv6_node;
+  } access_point;
+} grub_efi_http_config_data_t;
+
+typedef struct
+{
+  grub_efi_http_method_t method;
+  grub_efi_char16_t *url;
+} grub_efi_http_request_data_t;
+
+typedef struct
+{
+  grub_efi_http_status_code_t status_code;
+} grub_efi_http_response_data_t;
+
+typedef struct
+{
+  grub_efi_char8_t *field_name;
+  grub_efi_char8_t *field_value;
+} grub_efi_http_header_t;
+
+typedef struct
+{
+  union
+  {
+    grub_efi_http_request_data_t *request;
+    grub_efi_http_response_data_t *response;
+  } data;
+  grub_efi_uintn_t header_count;
+  grub_efi_http_header_t *headers;
+  grub_efi_uintn_t body_length;
+  void *body;
+} grub_efi_http_message_t;
+
+typedef struct
+{
+  grub_efi_event_t event;
+  grub_efi_status_t status;
+  grub_efi_http_message_t *message;
+} grub_efi_http_token_t;
+
+struct grub_efi_http
+{
+  grub_efi_status_t (*get_mode_data) (struct grub_efi_http *this,
+				      grub_efi_http_config_data_t *config);
+  grub_efi_status_t (*configure) (struct grub_efi_http *this,
+				  grub_efi_http_config_data_t *config);
+  grub_efi_status_t (*request) (struct grub_efi_http *this,
+				grub_efi_http_token_t *token);
+  grub_efi_status_t (*cancel) (struct grub_efi_http *this,
+			       grub_efi_http_token_t *token);
+  grub_efi_status_t (*response) (struct grub_efi_http *this,
+				 grub_efi_http_token_t *token);
+  grub_efi_status_t (*poll) (struct grub_efi_http *this);
+};
+typedef struct grub_efi_http grub_efi_http_t;
+
+#endif
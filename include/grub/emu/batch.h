@@ -0,0 +1,35 @@
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2026  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef GRUB_EMU_BATCH_HEADER
+#define GRUB_EMU_BATCH_HEADER	1
+
+#include <grub/symbol.h>
+#include <grub/err.h>
+
+/* Whether grub-emu was started with --batch.  */
+int EXPORT_FUNC (grub_emu_batch_mode) (void);
+
+/* Read the next script to run, NULL once there are no more.  The caller
+   frees it.  */
+char * EXPORT_FUNC (grub_emu_batch_read) (void);
+
+/* Report that the last script read has finished with ERR.  */
+void EXPORT_FUNC (grub_emu_batch_done) (grub_err_t err);
+
+#endif /* ! GRUB_EMU_BATCH_HEADER */
@@ -31,6 +31,13 @@ grub_util_exec_pipe_stderr (const char *const *argv, int *fd);
 int
 grub_util_exec_redirect_all (const char *const *argv, const char *stdin_file,
 			     const char *stdout_file, const char *stderr_file);
+pid_t
+grub_util_exec_redirect_all_start (const char *const *argv,
+				   const char *stdin_file,
+				   const char *stdout_file,
+				   const char *stderr_file);
+int
+grub_util_exec_wait (pid_t pid);
 int
 grub_util_exec (const char *const *argv);
 int
@@ -40,12 +40,18 @@ struct grub_env_var
   struct grub_env_var *next;
   struct grub_env_var **prevp;
   struct grub_env_var *sorted_next;
+  /* grub_env_hash (name), so that lookups and table growth don't need
+     to look at the name again.  */
+  grub_uint32_t hash;
   int global;
 };
 
 grub_err_t EXPORT_FUNC(grub_env_set) (const char *name, const char *val);
 const char *EXPORT_FUNC(grub_env_get) (const char *name);
 void EXPORT_FUNC(grub_env_unset) (const char *name);
+grub_uint32_t EXPORT_FUNC(grub_env_hash) (const char *name);
+const char *EXPORT_FUNC(grub_env_get_hashed) (const char *name,
+					       grub_uint32_t hash);
 struct grub_env_var *EXPORT_FUNC(grub_env_update_get_sorted) (void);
 
 #define FOR_SORTED_ENV(var) for (var = grub_env_update_get_sorted (); var; var = var->sorted_next)
@@ -21,14 +21,14 @@
 
 #include <grub/env.h>
 
-/* The size of the hash table.  */
-#define	HASHSZ	13
-
 /* A hashtable for quick lookup of variables.  */
 struct grub_env_context
 {
-  /* A hash table for variables.  */
-  struct grub_env_var *vars[HASHSZ];
+  /* A hash table for variables, NBUCKETS long.  NBUCKETS is zero or a
+     power of two and grows with the number of variables.  */
+  struct grub_env_var **vars;
+  unsigned int nbuckets;
+  unsigned int nvars;
 
   /* One level deeper on the stack.  */
   struct grub_env_context *prev;
@@ -45,6 +45,8 @@ struct grub_file
   grub_uint64_t last_progress_time;
   grub_off_t last_progress_offset;
   grub_uint64_t estimated_speed;
+  /* Offset from which the progress hook looks at the clock again.  */
+  grub_off_t progress_check;
 
   /* The file size.  */
   grub_off_t size;
@@ -72,9 +74,10 @@ typedef enum grub_file_filter_id
     GRUB_FILE_FILTER_GZIO,
     GRUB_FILE_FILTER_XZIO,
     GRUB_FILE_FILTER_LZOPIO,
+    GRUB_FILE_FILTER_ZSTDIO,
     GRUB_FILE_FILTER_MAX,
     GRUB_FILE_FILTER_COMPRESSION_FIRST = GRUB_FILE_FILTER_GZIO,
-    GRUB_FILE_FILTER_COMPRESSION_LAST = GRUB_FILE_FILTER_LZOPIO,
+    GRUB_FILE_FILTER_COMPRESSION_LAST = GRUB_FILE_FILTER_ZSTDIO,
   } grub_file_filter_id_t;
 
 typedef grub_file_t (*grub_file_filter_t) (grub_file_t in, const char *filename);
@@ -134,9 +137,18 @@ char *EXPORT_FUNC(grub_file_get_device_name) (const char *name);
 grub_file_t EXPORT_FUNC(grub_file_open) (const char *name);
 grub_ssize_t EXPORT_FUNC(grub_file_read) (grub_file_t file, void *buf,
 					  grub_size_t len);
+grub_ssize_t EXPORT_FUNC(grub_file_read_direct) (grub_file_t file, void *buf,
+						 grub_size_t len);
+grub_err_t EXPORT_FUNC(grub_file_map) (grub_file_t file, grub_size_t len,
+				       grub_fs_extent_hook_t hook,
+				       void *hook_data);
+void *EXPORT_FUNC(grub_file_map_memory) (grub_file_t file, grub_size_t len);
 grub_off_t EXPORT_FUNC(grub_file_seek) (grub_file_t file, grub_off_t offset);
 grub_err_t EXPORT_FUNC(grub_file_close) (grub_file_t file);
 
+/* Close the disks kept open for opening files quickly.  */
+void grub_file_mounts_flush (void);
+
 /* Return value of grub_file_size() in case file size is unknown. */
 #define GRUB_FILE_SIZE_UNKNOWN	 0xffffffffffffffffULL
 
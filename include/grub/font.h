@@ -43,8 +43,11 @@ struct grub_font
   short descent;
   short leading;
   grub_uint32_t num_chars;
-  struct char_index_entry *char_index;
-  grub_uint16_t *bmp_idx;
+  grub_uint32_t num_runs;
+  struct char_index_run *char_runs;
+  grub_uint32_t *glyph_offsets;
+  struct grub_font_glyph ***glyph_slots;
+  struct font_page *pages;
 };
 
 /* Font type used to access font functions.  */
@@ -97,6 +100,9 @@ struct grub_font_glyph
    Must be called before any fonts are loaded or used.  */
 void grub_font_loader_init (void);
 
+/* Stop the font loader before the font module goes away.  */
+void grub_font_loader_fini (void);
+
 /* Load a font and add it to the beginning of the global font list.
    Returns: 0 upon success; nonzero upon failure.  */
 grub_font_t EXPORT_FUNC(grub_font_load) (const char *filename);
@@ -30,6 +30,7 @@
 #define FONT_FORMAT_SECTION_NAMES_ASCENT "ASCE"
 #define FONT_FORMAT_SECTION_NAMES_DESCENT "DESC"
 #define FONT_FORMAT_SECTION_NAMES_CHAR_INDEX "CHIX"
+#define FONT_FORMAT_SECTION_NAMES_CHAR_RANGES "CHRG"
 #define FONT_FORMAT_SECTION_NAMES_DATA "DATA"
 #define FONT_FORMAT_SECTION_NAMES_FAMILY "FAMI"
 #define FONT_FORMAT_SECTION_NAMES_SLAN "SLAN"
@@ -39,14 +39,48 @@ struct grub_dirhook_info
   unsigned mtimeset:1;
   unsigned case_insensitive:1;
   unsigned inodeset:1;
+  /* SIZE is that of a regular file, as grub_file_open would report it,
+     so callers need not open each entry to learn it.  */
+  unsigned sizeset:1;
   grub_int32_t mtime;
   grub_uint64_t inode;
+  grub_uint64_t size;
 };
 
 typedef int (*grub_fs_dir_hook_t) (const char *filename,
 				   const struct grub_dirhook_info *info,
 				   void *data);
 
+/* A run of file data stored contiguously on the underlying disk.  */
+struct grub_fs_extent
+{
+  /* Offset of the run within the file.  */
+  grub_off_t offset;
+
+  /* Length of the run in bytes.  */
+  grub_size_t length;
+
+  /* Start of the run on the file's disk, in the form grub_disk_read
+     takes it.  Ignored for holes.  */
+  grub_disk_addr_t sector;
+  grub_off_t sector_offset;
+
+  /* The run is not stored on disk and reads as zeroes.  */
+  int hole;
+};
+
+typedef grub_err_t (*grub_fs_extent_hook_t) (const struct grub_fs_extent *extent,
+					     void *data);
+
+/* LEN bytes which every instance of a filesystem has at byte OFFSET of
+   its device.  */
+struct grub_fs_magic
+{
+  grub_off_t offset;
+  grub_size_t len;
+  const char *bytes;
+};
+
 /* Filesystem descriptor.  */
 struct grub_fs
 {
@@ -70,6 +104,12 @@ struct grub_fs
   /* Close the file FILE.  */
   grub_err_t (*close) (struct grub_file *file);
 
+  /* Call HOOK, in file order, with the extents holding LEN bytes of
+     FILE starting at its current offset.  Optional; only meaningful
+     for filesystems whose file data lives unencoded on FILE's disk.  */
+  grub_err_t (*map) (struct grub_file *file, grub_size_t len,
+		     grub_fs_extent_hook_t hook, void *hook_data);
+
   /* Return the label of the device DEVICE in LABEL.  The label is
      returned in a grub_malloc'ed buffer and should be freed by the
      caller.  */
@@ -83,6 +123,10 @@ struct grub_fs
   /* Get writing time of filesystem. */
   grub_err_t (*mtime) (grub_device_t device, grub_int32_t *timebuf);
 
+  /* Optional, terminated by an entry with LEN 0.  If set, the filesystem
+     is only probed on devices having at least one of these.  */
+  const struct grub_fs_magic *magics;
+
 #ifdef GRUB_UTIL
   /* Determine sectors available for embedding.  */
   grub_err_t (*embed) (grub_device_t device, unsigned int *nsectors,
@@ -24,6 +24,8 @@
 #include <grub/symbol.h>
 #include <grub/err.h>
 #include <grub/disk.h>
+#include <grub/fs.h>
+#include <grub/job.h>
 
 typedef struct grub_fshelp_node *grub_fshelp_node_t;
 
@@ -44,6 +46,23 @@ typedef int (*grub_fshelp_iterate_dir_hook_t) (const char *filename,
 					       grub_fshelp_node_t node,
 					       void *data);
 
+/* What grub_fshelp_find_file_cached needs to keep nodes of a filesystem
+   beyond the mount they were found on.  */
+struct grub_fshelp_cache_ops
+{
+  /* Size in bytes of NODE.  Apart from what ATTACH sets, the node must
+     not point to anything.  */
+  grub_size_t (*node_size) (grub_fshelp_node_t node);
+
+  /* A number telling the directory NODE apart from every other directory
+     of its filesystem.  */
+  grub_uint64_t (*ident) (grub_fshelp_node_t node);
+
+  /* Make a copy of a node from an earlier mount belong to the mount whose
+     root is ROOT.  */
+  void (*attach) (grub_fshelp_node_t node, grub_fshelp_node_t root);
+};
+
 /* Lookup the node PATH.  The node ROOTNODE describes the root of the
    directory tree.  The node found is returned in FOUNDNODE, which is
    either a ROOTNODE or a new malloc'ed node.  ITERATE_DIR is used to
@@ -73,6 +92,30 @@ EXPORT_FUNC(grub_fshelp_find_file_lookup) (const char *path,
 					   char *(*read_symlink) (grub_fshelp_node_t node),
 					   enum grub_fshelp_filetype expect);
 
+grub_err_t
+EXPORT_FUNC(grub_fshelp_find_file_cached) (const char *path,
+					   grub_fshelp_node_t rootnode,
+					   grub_fshelp_node_t *foundnode,
+					   int (*iterate_dir) (grub_fshelp_node_t dir,
+							       grub_fshelp_iterate_dir_hook_t hook,
+							       void *hook_data),
+					   grub_err_t (*lookup_file) (grub_fshelp_node_t dir,
+								      const char *name,
+								      grub_fshelp_node_t *foundnode,
+								      enum grub_fshelp_filetype *foundtype),
+					   char *(*read_symlink) (grub_fshelp_node_t node),
+					   enum grub_fshelp_filetype expect,
+					   grub_disk_t disk,
+					   const struct grub_fshelp_cache_ops *cache_ops);
+
+/* Translate the file block BLOCK of NODE to a disk block, 0 standing
+   for a hole.  *COUNT is 1 on entry; the callback may raise it to the
+   number of blocks from BLOCK on which follow each other on disk (or
+   are all holes).  Errors are reported in grub_errno.  */
+typedef grub_disk_addr_t (*grub_fshelp_get_extent_t) (grub_fshelp_node_t node,
+						      grub_disk_addr_t block,
+						      grub_disk_addr_t *count);
+
 /* Read LEN bytes from the file NODE on disk DISK into the buffer BUF,
    beginning with the block POS.  READ_HOOK should be set before
    reading a block from the file.  GET_BLOCK is used to translate file
@@ -88,4 +131,98 @@ EXPORT_FUNC(grub_fshelp_read_file) (grub_disk_t disk, grub_fshelp_node_t node,
 				    grub_off_t filesize, int log2blocksize,
 				    grub_disk_addr_t blocks_start);
 
+/* Same as grub_fshelp_read_file, but GET_EXTENT maps whole runs of
+   blocks, and each run is read with a single disk read.  */
+grub_ssize_t
+EXPORT_FUNC(grub_fshelp_read_file_extents) (grub_disk_t disk,
+					    grub_fshelp_node_t node,
+					    grub_disk_read_hook_t read_hook,
+					    void *read_hook_data,
+					    grub_off_t pos, grub_size_t len,
+					    char *buf,
+					    grub_fshelp_get_extent_t get_extent,
+					    grub_off_t filesize,
+					    int log2blocksize,
+					    grub_disk_addr_t blocks_start);
+
+/* Call HOOK with the disk extents of LEN bytes of the file NODE,
+   beginning with the byte POS.  The arguments have the same meaning
+   as for grub_fshelp_read_file.  */
+grub_err_t
+EXPORT_FUNC(grub_fshelp_map_file) (grub_fshelp_node_t node,
+				   grub_off_t pos, grub_size_t len,
+				   grub_disk_addr_t (*get_block) (grub_fshelp_node_t node,
+								  grub_disk_addr_t block),
+				   grub_off_t filesize, int log2blocksize,
+				   grub_disk_addr_t blocks_start,
+				   grub_fs_extent_hook_t hook, void *hook_data);
+
+/* Same as grub_fshelp_map_file, with one extent per run of GET_EXTENT.  */
+grub_err_t
+EXPORT_FUNC(grub_fshelp_map_file_extents) (grub_fshelp_node_t node,
+					   grub_off_t pos, grub_size_t len,
+					   grub_fshelp_get_extent_t get_extent,
+					   grub_off_t filesize, int log2blocksize,
+					   grub_disk_addr_t blocks_start,
+					   grub_fs_extent_hook_t hook,
+					   void *hook_data);
+
+/* A decompressed piece of a compressed file, such as an NTFS compression
+   unit or an HFS+ resource fork chunk, kept across mounts.  Units are
+   named by the disk they were read from, a number the filesystem gives
+   the file and the index of the unit in the file.  */
+struct grub_fshelp_unit
+{
+  /* For units decoded by grub_fshelp_unit_submit: JOB decodes the
+     SRC_SIZE bytes at SRC into DATA and leaves a nonzero ERR on failure.
+     SRC is freed once the job has finished.  JOB comes first so that the
+     job function can cast it back to the unit.  */
+  struct grub_job job;
+  void *src;
+  grub_size_t src_size;
+  int err;
+
+  /* Decoded data, of which SIZE bytes are valid.  */
+  grub_uint8_t *data;
+  grub_size_t size;
+
+  /* Private to fshelp.  */
+  unsigned long dev_id;
+  unsigned long disk_id;
+  grub_disk_addr_t part_start;
+  grub_uint64_t file;
+  grub_uint64_t index;
+  grub_size_t alloc;
+  unsigned long last_use;
+  int pending;
+};
+
+/* Return the unit INDEX of FILE on DISK, waiting for it if it is still
+   being decoded, or NULL if it is not cached.  The unit stays valid until
+   the next call to grub_fshelp_unit_new.  */
+struct grub_fshelp_unit *
+EXPORT_FUNC(grub_fshelp_unit_find) (grub_disk_t disk, grub_uint64_t file,
+				    grub_uint64_t index);
+
+/* Return 1 if the unit INDEX of FILE on DISK is cached or being decoded,
+   without waiting for it.  */
+int
+EXPORT_FUNC(grub_fshelp_unit_present) (grub_disk_t disk, grub_uint64_t file,
+				       grub_uint64_t index);
+
+/* Make room for the unit INDEX of FILE on DISK, with SIZE bytes of data,
+   in place of the least recently used one.  The caller fills DATA in and
+   sets SIZE, or drops the unit again on failure.  */
+struct grub_fshelp_unit *
+EXPORT_FUNC(grub_fshelp_unit_new) (grub_disk_t disk, grub_uint64_t file,
+				   grub_uint64_t index, grub_size_t size);
+
+/* Run UNIT->job to fill UNIT in, on another processor if one is idle.  */
+void EXPORT_FUNC(grub_fshelp_unit_submit) (struct grub_fshelp_unit *unit);
+
+void EXPORT_FUNC(grub_fshelp_unit_drop) (struct grub_fshelp_unit *unit);
+
+/* Drop every unit, for modules with jobs in flight that are going away.  */
+void EXPORT_FUNC(grub_fshelp_unit_flush) (void);
+
 #endif /* ! GRUB_FSHELP_HEADER */
@@ -22,6 +22,7 @@
 
 #include <grub/types.h>
 #include <grub/err.h>
+#include <grub/dl.h>
 #include <grub/menu.h>
 #include <grub/font.h>
 #include <grub/gfxwidgets.h>
@@ -40,6 +41,14 @@ void grub_gfxmenu_view_destroy (grub_gfxmenu_view_t view);
 grub_err_t grub_gfxmenu_view_load_theme (grub_gfxmenu_view_t view,
                                          const char *theme_path);
 
+/* Themes packed into one tar archive, see theme_pack.c.  */
+int grub_gfxmenu_theme_pack_check (const char *buf, grub_size_t len);
+char *grub_gfxmenu_theme_pack_lookup (const char *path);
+char *grub_gfxmenu_theme_pack_add (const char *path, char *buf,
+				   grub_size_t len);
+void grub_gfxmenu_theme_pack_init (grub_dl_t mod);
+void grub_gfxmenu_theme_pack_fini (void);
+
 grub_err_t grub_gui_recreate_box (grub_gfxmenu_box_t *boxptr,
                                   const char *pattern, const char *theme_dir);
 
@@ -95,7 +104,7 @@ struct grub_gfxmenu_view
   grub_video_rgba_color_t title_color;
   grub_video_rgba_color_t message_color;
   grub_video_rgba_color_t message_bg_color;
-  struct grub_video_bitmap *raw_desktop_image;
+  char *desktop_image_path;
   struct grub_video_bitmap *scaled_desktop_image;
   grub_video_bitmap_selection_method_t desktop_image_scale_method;
   grub_video_bitmap_h_align_t desktop_image_h_align;
@@ -108,6 +117,10 @@ struct grub_gfxmenu_view
 
   grub_gui_container_t canvas;
 
+  /* Desktop and static components, see grub_gfxmenu_paint_wanted.  */
+  struct grub_video_render_target *backdrop;
+  int need_to_draw_backdrop;
+
   int double_repaint;
 
   int selected;
@@ -32,6 +32,7 @@ struct grub_gfxmenu_box
 
   struct grub_video_bitmap **raw_pixmaps;
   struct grub_video_bitmap **scaled_pixmaps;
+  char **pixmap_paths;
 
   void (*draw) (grub_gfxmenu_box_t self, int x, int y);
   void (*set_content_size) (grub_gfxmenu_box_t self,
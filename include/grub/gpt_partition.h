@@ -202,7 +202,9 @@ grub_gpt_sector_to_addr (grub_gpt_t gpt, grub_uint64_t sector)
   return (sector << (gpt->log_sector_size - GRUB_DISK_SECTOR_BITS));
 }
 
-/* Allocates and fills new grub_gpt structure, free with grub_gpt_free.  */
+/* Allocates and fills new grub_gpt structure, free with grub_gpt_free.
+ * The table is read and validated once per disk and copied after that,
+ * until it is written with grub_gpt_write or grub_gpt_write_entry.  */
 grub_gpt_t grub_gpt_read (grub_disk_t disk);
 
 /* Sync up primary and backup headers, recompute checksums.  */
@@ -214,6 +216,12 @@ grub_err_t grub_gpt_update_checksums (grub_gpt_t gpt);
 /* Write headers and entry tables back to disk.  */
 grub_err_t grub_gpt_write (grub_disk_t disk, grub_gpt_t gpt);
 
+/* Recompute checksums and write back the headers and only the sectors of
+   each entry table holding entry INDEX.  The rest of both tables must
+   already match what is on disk, i.e. GPT wasn't repaired.  */
+grub_err_t grub_gpt_write_entry (grub_disk_t disk, grub_gpt_t gpt,
+				 grub_uint32_t index);
+
 void grub_gpt_free (grub_gpt_t gpt);
 
 grub_err_t grub_gpt_pmbr_check (struct grub_msdos_partition_mbr *mbr);
@@ -236,4 +244,11 @@ grub_err_t grub_gpt_part_uuid (grub_device_t device, char **uuid);
  * The uuid is in a new buffer and should be freed by the caller.  */
 grub_err_t grub_gpt_disk_uuid (grub_device_t device, char **uuid);
 
+/* Find the partition of DISK whose uuid, as returned by grub_gpt_part_uuid,
+ * is UUID and store its partition number in NUMBER.  Fails with
+ * GRUB_ERR_FILE_NOT_FOUND if the table has no such partition, with other
+ * errors if DISK has no valid primary GPT to look in.  */
+grub_err_t grub_gpt_find_part_uuid (grub_disk_t disk, const char *uuid,
+				    grub_uint32_t *number);
+
 #endif /* ! GRUB_GPT_PARTITION_HEADER */
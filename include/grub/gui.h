@@ -117,6 +117,13 @@ grub_gfxmenu_timeout_unregister (grub_gui_component_t self)
       }
 }
 
+/* The view keeps the desktop and everything painted before the first
+   component that changes while the menu is shown (a list, or anything
+   following the timeout) in an offscreen backdrop, and repaints only the
+   rest.  Containers ask this for each child, in paint order, before
+   painting it.  */
+int grub_gfxmenu_paint_wanted (grub_gui_component_t component);
+
 typedef signed grub_fixed_signed_t;
 #define GRUB_FIXED_1 0x10000
 
@@ -88,8 +88,12 @@ struct grub_hfsplus_file
   char *cbuf;
   void *file;
   struct grub_hfsplus_compress_index *compress_index;
-  grub_uint32_t cbuf_block;
   grub_uint32_t compress_index_size;
+  /* The extents overflow record used last, -1 in OVERFLOW_TYPE if none.
+     Its extents start at the file block OVERFLOW_START.  */
+  struct grub_hfsplus_extent overflow[8];
+  grub_uint32_t overflow_start;
+  int overflow_type;
 };
 
 struct grub_hfsplus_btree
@@ -0,0 +1,47 @@
+/* job.h - run independent pieces of work on other processors  */
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2026  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef GRUB_JOB_HEADER
+#define GRUB_JOB_HEADER 1
+
+#include <grub/symbol.h>
+
+/* A job may end up running on a processor that GRUB knows nothing about,
+   concurrently with the caller.  RUN must therefore only touch memory
+   reachable from the job itself: no firmware calls, no allocation, no
+   grub_error, no printing and no writes to anything else the caller can
+   see before grub_job_wait returns.  Embed the job in a larger structure
+   to pass arguments and results.  */
+struct grub_job
+{
+  void (*run) (struct grub_job *job);
+  volatile int done;
+};
+
+/* Number of other processors jobs can currently be handed to.  Zero means
+   every job runs on the calling processor inside grub_job_submit.  */
+unsigned EXPORT_FUNC(grub_job_workers) (void);
+
+/* Start JOB.  When no worker is idle the job is run right away.  */
+void EXPORT_FUNC(grub_job_submit) (struct grub_job *job);
+
+/* Wait until JOB has finished.  Every submitted job must be waited for.  */
+void EXPORT_FUNC(grub_job_wait) (struct grub_job *job);
+
+#endif /* ! GRUB_JOB_HEADER */
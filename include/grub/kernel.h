@@ -28,7 +28,8 @@ enum
   OBJ_TYPE_MEMDISK,
   OBJ_TYPE_CONFIG,
   OBJ_TYPE_PREFIX,
-  OBJ_TYPE_PUBKEY
+  OBJ_TYPE_PUBKEY,
+  OBJ_TYPE_ELF_LZ4
 };
 
 /* The module header.  */
@@ -40,6 +41,20 @@ struct grub_module_header
   grub_uint32_t size;
 };
 
+/* An OBJ_TYPE_ELF_LZ4 object is this header followed by the module
+   compressed as a single LZ4 block.  */
+struct grub_module_lz4_header
+{
+  /* The size of the module once decompressed.  */
+  grub_uint32_t size;
+  grub_uint32_t flags;
+  /* The module name, to find it when it is asked for.  */
+  char name[32];
+};
+
+/* Only load the module when something asks for it.  */
+#define GRUB_MODULE_LZ4_LAZY	1
+
 /* "gmim" (GRUB Module Info Magic).  */
 #define GRUB_MODULE_MAGIC 0x676d696d
 
@@ -124,5 +139,11 @@ grub_machine_get_bootlocation (char **device, char **path);
 void grub_register_exported_symbols (void);
 
 extern void (*EXPORT_VAR(grub_net_poll_cards_idle)) (void);
+/* When the network cards next want an idle poll, in grub_get_time_ms
+   time.  */
+extern grub_uint64_t (*EXPORT_VAR(grub_net_poll_cards_deadline)) (void);
+/* Sleep for at most MS milliseconds, waking up early when an input source
+   that can tell (a key press, a received packet) may have something.  */
+extern void (*EXPORT_VAR(grub_machine_idle)) (grub_uint32_t ms);
 
 #endif /* ! GRUB_KERNEL_HEADER */
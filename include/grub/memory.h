@@ -45,8 +45,22 @@ typedef int (*grub_memory_hook_t) (grub_uint64_t,
 				   grub_memory_type_t,
 				   void *);
 
+/* One region of the resolved memory map.  */
+struct grub_memory_range
+{
+  grub_uint64_t addr;
+  grub_uint64_t size;
+  grub_memory_type_t type;
+};
+
 grub_err_t grub_mmap_iterate (grub_memory_hook_t hook, void *hook_data);
 
+/* Return the memory map with overlays applied, sorted and with adjacent
+   regions of the same type merged.  The array belongs to the mmap module
+   and stays valid until the map changes and it is asked for again.  */
+grub_err_t grub_mmap_get_map (const struct grub_memory_range **map,
+			      grub_size_t *count);
+
 #ifdef GRUB_MACHINE_EFI
 grub_err_t
 grub_efi_mmap_iterate (grub_memory_hook_t hook, void *hook_data,
@@ -71,6 +71,12 @@ struct grub_menu
 
   /* The list of menu entries.  */
   grub_menu_entry_t entry_list;
+
+  /* ENTRIES[I] is entry I of ENTRY_LIST, with room for ENTRIES_ALLOC
+     pointers.  NULL if it couldn't be allocated, in which case the list
+     is walked instead.  */
+  grub_menu_entry_t *entries;
+  int entries_alloc;
 };
 typedef struct grub_menu *grub_menu_t;
 
@@ -95,6 +101,7 @@ typedef struct grub_menu_execute_callback
 *grub_menu_execute_callback_t;
 
 grub_menu_entry_t grub_menu_get_entry (grub_menu_t menu, int no);
+void grub_menu_append_entry (grub_menu_t menu, grub_menu_entry_t entry);
 int grub_menu_get_timeout (void);
 void grub_menu_set_timeout (int timeout);
 void grub_menu_entry_run (grub_menu_entry_t entry);
@@ -38,6 +38,8 @@
 #define grub_dprintf(condition, ...) grub_real_dprintf(GRUB_FILE, __LINE__, condition, __VA_ARGS__)
 
 void *EXPORT_FUNC(grub_memmove) (void *dest, const void *src, grub_size_t n);
+/* Pick the memory primitives for this CPU.  */
+void grub_memops_init (void);
 char *EXPORT_FUNC(grub_strcpy) (char *dest, const char *src);
 
 static inline char *
@@ -438,7 +440,12 @@ grub_error_load (const struct grub_error_saved *save)
   grub_errno = save->grub_errno;
 }
 
+struct grub_boot_time;
+typedef struct grub_boot_time *grub_boot_span_t;
+
 #if BOOT_TIME_STATS
+/* A checkpoint, or a span if END is set.  Spans begun while another one
+   is open are nested in it, one level deeper.  */
 struct grub_boot_time
 {
   struct grub_boot_time *next;
@@ -446,6 +453,10 @@ struct grub_boot_time
   const char *file;
   int line;
   char *msg;
+  grub_uint64_t end;
+  grub_uint64_t bytes;
+  int depth;
+  int is_span;
 };
 
 extern struct grub_boot_time *EXPORT_VAR(grub_boot_time_head);
@@ -453,9 +464,17 @@ extern struct grub_boot_time *EXPORT_VAR(grub_boot_time_head);
 void EXPORT_FUNC(grub_real_boot_time) (const char *file,
 				       const int line,
 				       const char *fmt, ...) __attribute__ ((format (GNU_PRINTF, 3, 4)));
+grub_boot_span_t EXPORT_FUNC(grub_real_boot_span_begin) (const char *file,
+							 const int line,
+							 const char *fmt, ...) __attribute__ ((format (GNU_PRINTF, 3, 4)));
+void EXPORT_FUNC(grub_boot_span_end) (grub_boot_span_t span,
+				      grub_uint64_t bytes);
 #define grub_boot_time(...) grub_real_boot_time(GRUB_FILE, __LINE__, __VA_ARGS__)
+#define grub_boot_span_begin(...) grub_real_boot_span_begin(GRUB_FILE, __LINE__, __VA_ARGS__)
 #else
 #define grub_boot_time(...)
+#define grub_boot_span_begin(...) ((grub_boot_span_t) 0)
+#define grub_boot_span_end(span, bytes) ((void) (span))
 #endif
 
 #define grub_max(a, b) (((a) > (b)) ? (a) : (b))
@@ -35,6 +35,36 @@ void EXPORT_FUNC(grub_free) (void *ptr);
 void *EXPORT_FUNC(grub_realloc) (void *ptr, grub_size_t size);
 #ifndef GRUB_MACHINE_EMU
 void *EXPORT_FUNC(grub_memalign) (grub_size_t align, grub_size_t size);
+
+/* Heap usage per caller of the allocation functions, collected between
+   grub_mm_profile_start and grub_mm_profile_stop.  Sizes are in bytes of
+   heap consumed, headers included.  */
+#define GRUB_MM_PROFILE_SITES	1024
+
+struct grub_mm_profile_site
+{
+  void *caller;
+  grub_size_t count;
+  grub_uint64_t bytes;
+  grub_size_t live;
+  grub_size_t peak;
+};
+
+struct grub_mm_profile
+{
+  int active;
+  grub_size_t live;
+  grub_size_t peak;
+  /* Allocations not attributed because the table was full.  */
+  grub_size_t dropped;
+  struct grub_mm_profile_site sites[GRUB_MM_PROFILE_SITES];
+};
+
+/* Start or restart collecting; resets the counters.  */
+int EXPORT_FUNC(grub_mm_profile_start) (void);
+void EXPORT_FUNC(grub_mm_profile_stop) (void);
+/* NULL if the profiler never ran.  */
+const struct grub_mm_profile *EXPORT_FUNC(grub_mm_profile_get) (void);
 #endif
 
 void grub_mm_check_real (const char *file, int line);
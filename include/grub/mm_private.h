@@ -20,23 +20,21 @@
 #define GRUB_MM_PRIVATE_H	1
 
 #include <grub/mm.h>
+#include <grub/err.h>
 
 /* Magic words.  */
 #define GRUB_MM_FREE_MAGIC	0x2d3c2808
 #define GRUB_MM_ALLOC_MAGIC	0x6db08fa4
+#define GRUB_MM_BIN_MAGIC	0x41c7e35d
 
 typedef struct grub_mm_header
 {
   struct grub_mm_header *next;
   grub_size_t size;
   grub_size_t magic;
-#if GRUB_CPU_SIZEOF_VOID_P == 4
-  char padding[4];
-#elif GRUB_CPU_SIZEOF_VOID_P == 8
-  char padding[8];
-#else
-# error "unknown word size"
-#endif
+  /* Call site that allocated the block, while the profiler runs.  Also
+     pads the header to GRUB_MM_ALIGN.  */
+  struct grub_mm_profile_site *site;
 }
 *grub_mm_header_t;
 
@@ -59,6 +57,12 @@ typedef struct grub_mm_region
 
 #ifndef GRUB_MACHINE_EMU
 extern grub_mm_region_t EXPORT_VAR (grub_mm_base);
+
+void EXPORT_FUNC (grub_mm_flush_bins) (void);
+
+/* Set by the platform if it can enlarge the heap.  grub_memalign calls it
+   with the number of bytes it needs when the existing regions are full.  */
+extern grub_err_t (*grub_mm_add_region_fn) (grub_size_t size);
 #endif
 
 #endif
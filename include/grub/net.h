@@ -79,6 +79,19 @@ struct grub_net_card_driver
   grub_err_t (*send) (struct grub_net_card *dev,
 		      struct grub_net_buff *buf);
   struct grub_net_buff * (*recv) (struct grub_net_card *dev);
+  /* Optional.  Receive up to MAX frames into NBS and return how many were
+     received.  Fewer than MAX means the receive queue is empty.  */
+  int (*recv_batch) (struct grub_net_card *dev, struct grub_net_buff **nbs,
+		     int max);
+  /* Optional.  Start (JOIN nonzero) or stop accepting frames sent to the
+     multicast address ADDR.  Cards without it must pass all multicast.  */
+  grub_err_t (*multicast_filter) (struct grub_net_card *dev,
+				  const grub_net_link_level_address_t *addr,
+				  int join);
+  /* Optional.  Return the DHCP ACK the firmware received on DEV while
+     booting, and its size in *SIZE, or NULL.  */
+  const struct grub_net_bootp_packet *(*cached_dhcp_ack)
+    (struct grub_net_card *dev, grub_size_t *size);
 };
 
 typedef struct grub_net_packet
@@ -109,7 +122,50 @@ struct grub_net_slaac_mac_list
   char *name;
 };
 
-struct grub_net_link_layer_entry;
+struct grub_net_link_layer_cache;
+
+/* Traffic seen by a card since it was registered.  */
+struct grub_net_card_stats
+{
+  unsigned long rx_packets;
+  grub_uint64_t rx_bytes;
+  unsigned long tx_packets;
+  grub_uint64_t tx_bytes;
+  /* Packets left in the card because no buffer could be allocated.  */
+  unsigned long rx_dropped;
+  unsigned long tx_errors;
+};
+
+/* Round trip times, in milliseconds.  */
+struct grub_net_rtt_stats
+{
+  unsigned long samples;
+  grub_uint64_t total;
+  grub_uint32_t min;
+  grub_uint32_t max;
+};
+
+/* Protocol counters, summed over every socket and file so far.  */
+struct grub_net_stats
+{
+  unsigned long tcp_retransmits;
+  unsigned long tcp_out_of_order;
+  unsigned long tcp_duplicates;
+  struct grub_net_rtt_stats tcp_rtt;
+  unsigned long tftp_files;
+  unsigned long tftp_blocks;
+  unsigned long tftp_duplicates;
+  unsigned long tftp_out_of_order;
+  /* Requests sent again and partial windows acknowledged again after
+     a loss.  */
+  unsigned long tftp_timeouts;
+  struct grub_net_rtt_stats tftp_rtt;
+};
+
+extern struct grub_net_stats grub_net_stats;
+
+void
+grub_net_rtt_sample (struct grub_net_rtt_stats *stats, grub_uint32_t rtt);
 
 struct grub_net_card
 {
@@ -125,13 +181,13 @@ struct grub_net_card
   grub_uint64_t last_poll;
   grub_size_t mtu;
   struct grub_net_slaac_mac_list *slaac_list;
-  grub_ssize_t new_ll_entry;
-  struct grub_net_link_layer_entry *link_layer_table;
+  struct grub_net_link_layer_cache *link_layer_cache;
   void *txbuf;
   void *rcvbuf;
   grub_size_t rcvbufsize;
   grub_size_t txbufsize;
   int txbusy;
+  struct grub_net_card_stats stats;
   union
   {
 #ifdef GRUB_MACHINE_EFI
@@ -254,6 +310,16 @@ struct grub_net_app_protocol
   grub_err_t (*packets_pulled) (struct grub_file *file);
 };
 
+/* Content coding of the body a protocol delivers, as opposed to the
+   file itself.  */
+typedef enum grub_net_content_encoding
+  {
+    GRUB_NET_CONTENT_IDENTITY,
+    GRUB_NET_CONTENT_GZIP,
+    GRUB_NET_CONTENT_ZSTD,
+    GRUB_NET_CONTENT_UNSUPPORTED
+  } grub_net_content_encoding_t;
+
 typedef struct grub_net
 {
   char *server;
@@ -264,8 +330,34 @@ typedef struct grub_net
   grub_fs_t fs;
   int eof;
   int stall;
+  grub_net_content_encoding_t encoding;
+  /* Validator of the copy in the cache, to send with the request.  */
+  const char *if_none_match;
+  /* ETag of the response, and whether it said the cached copy is still
+     current.  */
+  char *etag;
+  int not_modified;
 } *grub_net_t;
 
+/* An on-disk cache of downloaded files, provided by the netcache module.
+   KEY is "protocol,server/path".  A validator names the version of the
+   file: "etag:<ETag>" or "size:<bytes>".  */
+struct grub_net_cache_ops
+{
+  /* Return the validator stored for KEY in a new string, or NULL.  */
+  char *(*lookup) (const char *key);
+  /* Read the body stored for KEY into a new buffer.  */
+  grub_err_t (*fetch) (const char *key, char **buf, grub_size_t *size,
+		       grub_net_content_encoding_t *encoding);
+  /* Whether a body of SIZE bytes can be stored at all.  */
+  int (*fits) (grub_uint64_t size);
+  /* Store BUF as the body of KEY.  Failures are not reported.  */
+  void (*store) (const char *key, const char *validator, const char *buf,
+		 grub_size_t size, grub_net_content_encoding_t encoding);
+};
+
+extern struct grub_net_cache_ops *grub_net_cache;
+
 extern grub_net_t (*EXPORT_VAR (grub_net_open)) (const char *name);
 
 struct grub_net_network_level_interface
@@ -487,6 +579,11 @@ grub_env_set_net_property (const char *intername, const char *suffix,
 void
 grub_net_poll_cards (unsigned time, int *stop_condition);
 
+/* Download the N network files NAMES concurrently; the next open of each
+   is served from memory.  */
+grub_err_t
+grub_net_prefetch (int n, char **names);
+
 void grub_bootp_init (void);
 void grub_bootp_fini (void);
 
@@ -507,6 +604,10 @@ grub_net_network_level_interface_unregister (struct grub_net_network_level_inter
 void
 grub_net_tcp_retransmit (void);
 
+/* Print the counters of every TCP socket opened so far.  */
+void
+grub_net_tcp_print_stats (void);
+
 void
 grub_net_link_layer_add_address (struct grub_net_card *card,
 				 const grub_net_network_level_address_t *nl,
@@ -519,6 +620,9 @@ grub_err_t
 grub_net_link_layer_resolve (struct grub_net_network_level_interface *inf,
 			     const grub_net_network_level_address_t *proto_addr,
 			     grub_net_link_level_address_t *hw_addr);
+void
+grub_net_link_layer_prefetch (struct grub_net_network_level_interface *inf,
+			      const grub_net_network_level_address_t *proto_addr);
 grub_err_t
 grub_net_dns_lookup (const char *name,
 		     const struct grub_net_network_level_address *servers,
@@ -537,5 +641,7 @@ extern char *grub_net_default_server;
 #define GRUB_NET_TRIES 40
 #define GRUB_NET_INTERVAL 400
 #define GRUB_NET_INTERVAL_ADDITION 20
+/* Frames drained from a card per recv_batch call.  */
+#define GRUB_NET_RECV_BATCH 16
 
 #endif /* ! GRUB_NET_HEADER */
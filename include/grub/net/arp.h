@@ -26,6 +26,7 @@ extern grub_err_t grub_net_arp_receive (struct grub_net_buff *nb,
 
 grub_err_t
 grub_net_arp_send_request (struct grub_net_network_level_interface *inf,
-			   const grub_net_network_level_address_t *proto_addr);
+			   const grub_net_network_level_address_t *proto_addr,
+			   int wait);
 
 #endif 
@@ -24,6 +24,7 @@
 typedef enum grub_net_ip_protocol
   {
     GRUB_NET_IP_ICMP = 1,
+    GRUB_NET_IP_IGMP = 2,
     GRUB_NET_IP_TCP = 6,
     GRUB_NET_IP_UDP = 17,
     GRUB_NET_IP_ICMPV6 = 58
@@ -43,6 +44,9 @@ grub_net_ipv6_get_id (const grub_net_link_level_address_t *addr)
 }
 
 grub_uint16_t grub_net_ip_chksum(void *ipv, grub_size_t len);
+grub_uint16_t grub_net_ip_chksum_update (grub_uint16_t chksum,
+					 const void *old, const void *new,
+					 grub_size_t len);
 
 grub_err_t
 grub_net_recv_ip_packets (struct grub_net_buff *nb,
@@ -73,7 +77,8 @@ grub_net_recv_icmp6_packet (struct grub_net_buff *nb,
 grub_err_t
 grub_net_recv_udp_packet (struct grub_net_buff *nb,
 			  struct grub_net_network_level_interface *inf,
-			  const grub_net_network_level_address_t *src);
+			  const grub_net_network_level_address_t *src,
+			  const grub_net_network_level_address_t *dst);
 grub_err_t
 grub_net_recv_tcp_packet (struct grub_net_buff *nb,
 			  struct grub_net_network_level_interface *inf,
@@ -85,12 +90,23 @@ grub_net_ip_transport_checksum (struct grub_net_buff *nb,
 				const grub_net_network_level_address_t *src,
 				const grub_net_network_level_address_t *dst);
 
+grub_err_t
+grub_net_ip4_multicast_join (struct grub_net_network_level_interface *inf,
+			     grub_uint32_t group);
+void
+grub_net_ip4_multicast_leave (struct grub_net_network_level_interface *inf,
+			      grub_uint32_t group);
+struct grub_net_network_level_interface *
+grub_net_ip4_multicast_lookup (struct grub_net_card *card,
+			       grub_uint32_t group);
+
 struct grub_net_network_level_interface *
 grub_net_ipv6_get_link_local (struct grub_net_card *card,
 			      const grub_net_link_level_address_t *hwaddr);
 grub_err_t
 grub_net_icmp6_send_request (struct grub_net_network_level_interface *inf,
-			     const grub_net_network_level_address_t *proto_addr);
+			     const grub_net_network_level_address_t *proto_addr,
+			     int wait);
 
 grub_err_t
 grub_net_icmp6_send_router_solicit (struct grub_net_network_level_interface *inf);
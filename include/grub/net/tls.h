@@ -0,0 +1,55 @@
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2026  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef GRUB_NET_TLS_HEADER
+#define GRUB_NET_TLS_HEADER	1
+
+#include <grub/types.h>
+#include <grub/err.h>
+#include <grub/net.h>
+#include <grub/net/tcp.h>
+
+struct grub_net_tls;
+typedef struct grub_net_tls *grub_net_tls_t;
+
+/* TLS 1.3 client sessions, provided by the tls module.  The session never
+   owns the socket: the caller keeps its TCP hooks and passes what they
+   receive on to RECEIVE.  */
+struct grub_net_tls_ops
+{
+  /* Create a session for SERVER over SOCK.  Decrypted application data
+     is handed to RECV, which takes ownership of the buffer.  */
+  grub_net_tls_t (*new) (grub_net_tcp_socket_t sock, const char *server,
+			 grub_err_t (*recv) (struct grub_net_buff *nb,
+					     void *data),
+			 void *data);
+  /* Send the ClientHello and poll until the handshake is over.  */
+  grub_err_t (*handshake) (grub_net_tls_t tls);
+  /* Process NB as received from the socket.  Takes ownership of NB.  */
+  grub_err_t (*receive) (grub_net_tls_t tls, struct grub_net_buff *nb);
+  /* Encrypt and send NB.  Takes ownership of NB.  */
+  grub_err_t (*send) (grub_net_tls_t tls, struct grub_net_buff *nb);
+  /* The socket is gone; nothing more will be received or sent.  */
+  void (*shutdown) (grub_net_tls_t tls);
+  void (*free) (grub_net_tls_t tls);
+};
+
+/* Set by the tls module when it is loaded.  */
+extern struct grub_net_tls_ops *grub_net_tls;
+
+#endif
@@ -40,6 +40,16 @@ grub_net_udp_open (grub_net_network_level_address_t addr,
 					    void *data),
 		   void *recv_hook_data);
 
+/* Like grub_net_udp_open, but receive on the given local port, e.g. the one
+   a multicast group is sent to.  */
+grub_net_udp_socket_t
+grub_net_udp_open_port (grub_net_network_level_address_t addr,
+			grub_uint16_t in_port, grub_uint16_t out_port,
+			grub_err_t (*recv_hook) (grub_net_udp_socket_t sock,
+						 struct grub_net_buff *nb,
+						 void *data),
+			void *recv_hook_data);
+
 void
 grub_net_udp_close (grub_net_udp_socket_t sock);
 
@@ -124,6 +124,7 @@ void read_command_list (const char *prefix);
 
 /* Defined in `autofs.c'.  */
 void read_fs_list (const char *prefix);
+void read_partmap_list (const char *prefix);
 
 void grub_context_init (void);
 void grub_context_fini (void);
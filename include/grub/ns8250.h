@@ -64,6 +64,14 @@
 /* Enable the FIFO.  */
 #define UART_ENABLE_FIFO_TRIGGER1       0x07
 
+/* Switch the 16750 to its 64-byte FIFO (only while DLAB is set), and
+   the IIR bit telling that it is in use.  */
+#define UART_ENABLE_64BYTE_FIFO	0x20
+#define UART_64BYTE_FIFO	0x20
+
+/* For IIR bits: set when the FIFO is working.  */
+#define UART_FIFO_ENABLED	0xC0
+
 /* Turn on DTR, RTS, and OUT2.  */
 #define UART_ENABLE_DTRRTS	0x03
 
@@ -127,14 +127,24 @@ struct grub_ntfs_bpb
   grub_uint32_t checksum;
 } GRUB_PACKED;
 
+/* One decoded entry of a run list.  LCN is 0 for a hole.  */
+struct grub_ntfs_run
+{
+  grub_disk_addr_t vcn;
+  grub_disk_addr_t next_vcn;
+  grub_disk_addr_t lcn;
+};
+
 struct grub_ntfs_attr
 {
   int flags;
   grub_uint8_t *emft_buf, *edat_buf;
   grub_uint8_t *attr_cur, *attr_nxt, *attr_end;
-  grub_uint32_t save_pos;
-  grub_uint8_t *sbuf;
   struct grub_ntfs_file *mft;
+  /* Decoded run list of the attribute at RUNS_ATTR.  */
+  grub_uint8_t *runs_attr;
+  struct grub_ntfs_run *runs;
+  grub_size_t n_runs;
 };
 
 struct grub_ntfs_file
@@ -169,11 +179,9 @@ struct grub_ntfs_comp_table_element
 struct grub_ntfs_comp
 {
   grub_disk_t disk;
-  int comp_head, comp_tail;
+  int comp_tail;
   struct grub_ntfs_comp_table_element comp_table[16];
-  grub_uint32_t cbuf_ofs, cbuf_vcn;
   int log_spc;
-  grub_uint8_t *cbuf;
 };
 
 struct grub_ntfs_rlst
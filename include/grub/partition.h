@@ -99,6 +99,12 @@ char *EXPORT_FUNC(grub_partition_get_name) (const grub_partition_t partition);
 
 extern grub_partition_map_t EXPORT_VAR(grub_partition_map_list);
 
+/* Called by grub_partition_probe with the name of a partition map that
+   isn't loaded, e.g. "gpt" for "(hd0,gpt1)".  Returns nonzero if it
+   loaded something worth retrying with.  */
+typedef int (*grub_partition_autoload_hook_t) (const char *name);
+extern grub_partition_autoload_hook_t EXPORT_VAR(grub_partition_autoload_hook);
+
 #ifndef GRUB_LST_GENERATOR
 static inline void
 grub_partition_map_register (grub_partition_map_t partmap)
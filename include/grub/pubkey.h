@@ -35,4 +35,11 @@ grub_crypto_pk_locate_subkey (grub_uint64_t keyid, struct grub_public_key *pkey)
 struct grub_public_subkey *
 grub_crypto_pk_locate_subkey_in_trustdb (grub_uint64_t keyid);
 
+struct grub_public_subkey *
+grub_crypto_pk_locate_rsa_in_trustdb (gcry_mpi_t n, gcry_mpi_t e);
+
+/* Whether check_signatures is set to enforce.  */
+int
+grub_verify_enforced (void);
+
 #endif
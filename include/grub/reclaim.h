@@ -0,0 +1,72 @@
+/* reclaim.h - Caches that give memory back when the heap runs low.  */
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2026  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef GRUB_RECLAIM_HEADER
+#define GRUB_RECLAIM_HEADER	1
+
+#include <grub/symbol.h>
+#include <grub/types.h>
+
+/* A cache whose memory can be given back when an allocation would
+   otherwise fail.  The owner keeps SIZE at the number of bytes the cache
+   holds, calls grub_reclaim_touch whenever the cache is used, and raises
+   BUSY while it holds pointers into the cache across code that may
+   allocate.
+
+   SHRINK frees at least WANTED bytes if it can, oldest data first, and
+   returns the number of bytes it freed.  It is called from within the
+   memory manager and must not allocate.  */
+struct grub_reclaim_cache
+{
+  struct grub_reclaim_cache *next;
+  struct grub_reclaim_cache **prev;
+  const char *name;
+  grub_size_t size;
+  unsigned long last_use;
+  int busy;
+  grub_size_t (*shrink) (grub_size_t wanted);
+  /* Private to the registry.  */
+  unsigned long pass;
+};
+
+/* Ask for everything that can be freed.  */
+#define GRUB_RECLAIM_ALL	((grub_size_t) -1)
+
+extern unsigned long EXPORT_VAR(grub_reclaim_clock);
+
+void EXPORT_FUNC(grub_reclaim_register) (struct grub_reclaim_cache *cache);
+void EXPORT_FUNC(grub_reclaim_unregister) (struct grub_reclaim_cache *cache);
+
+/* Shrink the registered caches, least recently used first, until WANTED
+   bytes have been freed or nothing more can be.  Return the number of
+   bytes freed.  */
+grub_size_t EXPORT_FUNC(grub_reclaim_memory) (grub_size_t wanted);
+
+/* Keep the caches as they are until the matching release, for code that
+   relies on the heap not changing under it.  */
+void EXPORT_FUNC(grub_reclaim_hold) (void);
+void EXPORT_FUNC(grub_reclaim_release) (void);
+
+static inline void
+grub_reclaim_touch (struct grub_reclaim_cache *cache)
+{
+  cache->last_use = ++grub_reclaim_clock;
+}
+
+#endif /* ! GRUB_RECLAIM_HEADER */
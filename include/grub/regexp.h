@@ -0,0 +1,31 @@
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2015  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef GRUB_REGEXP_HEADER
+#define GRUB_REGEXP_HEADER	1
+
+#include <regex.h>
+
+/* Return PATTERN compiled with CFLAGS, reusing an earlier compilation of
+   the same pattern when there is one.  The result belongs to the cache
+   and stays valid until the next call.  On failure return NULL and set
+   *ERR to the regcomp error code.  */
+const regex_t *grub_regexp_compile (const char *pattern, int cflags,
+				    int *err);
+
+#endif /* ! GRUB_REGEXP_HEADER */
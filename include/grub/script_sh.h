@@ -24,6 +24,7 @@
 #include <grub/err.h>
 #include <grub/parser.h>
 #include <grub/command.h>
+#include <grub/arena.h>
 
 struct grub_script_mem;
 
@@ -67,6 +68,10 @@ struct grub_script_arg
 
   char *str;
 
+  /* For variable references, grub_env_hash (str), worked out once at
+     parse time.  */
+  grub_uint32_t hash;
+
   /* Parsed block argument.  */
   struct grub_script *script;
 
@@ -80,12 +85,21 @@ struct grub_script_argv
   unsigned argc;
   char **args;
   struct grub_script *script;
+  /* Holds the argument strings; created by the first
+     grub_script_argv_next.  */
+  grub_arena_t arena;
+  /* Length of args[argc - 1] while it is being built.  */
+  grub_size_t last_len;
 };
 
 /* Pluggable wildcard translator.  */
 struct grub_script_wildcard_translator
 {
   grub_err_t (*expand) (const char *str, char ***expansions);
+  /* Called when the outermost script starts and when it has finished;
+     what the translator read from disks may be reused in between.  */
+  void (*begin) (void);
+  void (*end) (void);
 };
 extern struct grub_script_wildcard_translator *grub_wildcard_translator;
 extern struct grub_script_wildcard_translator grub_filename_translator;
@@ -250,6 +264,8 @@ int grub_script_argv_next     (struct grub_script_argv *argv);
 int grub_script_argv_append   (struct grub_script_argv *argv, const char *s,
 			       grub_size_t slen);
 int grub_script_argv_split_append (struct grub_script_argv *argv, const char *s);
+char *grub_script_argv_reserve (struct grub_script_argv *argv, grub_size_t len);
+void grub_script_argv_commit  (struct grub_script_argv *argv, grub_size_t len);
 
 struct grub_script_arglist *
 grub_script_create_arglist (struct grub_parser_param *state);
@@ -330,6 +346,7 @@ grub_err_t grub_script_execute_cmdwhile (struct grub_script_cmd *cmd);
 /* Execute any GRUB pre-parsed command or script.  */
 grub_err_t grub_script_execute (struct grub_script *script);
 grub_err_t grub_script_execute_sourcecode (const char *source);
+grub_err_t grub_script_execute_config (const char *name, const char *source);
 grub_err_t grub_script_execute_new_scope (const char *source, int argc, char **args);
 
 /* Break command for loops.  */
@@ -370,6 +387,7 @@ struct grub_script_function
 typedef struct grub_script_function *grub_script_function_t;
 
 extern grub_script_function_t grub_script_function_list;
+extern unsigned long grub_script_function_changes;
 
 #define FOR_SCRIPT_FUNCTIONS(var) for((var) = grub_script_function_list; \
 				      (var); (var) = (var)->next)
@@ -103,6 +103,10 @@ struct grub_scsi
   /* Size of one block.  */
   grub_uint32_t blocksize;
 
+  /* Largest data transfer of one command in bytes, 0 if not known.  Set
+     by the underlying device in its open function.  */
+  grub_size_t max_transfer;
+
   /* Device-specific data.  */
   void *data;
 };
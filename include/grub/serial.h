@@ -87,7 +87,14 @@ struct grub_serial_port
   union
   {
 #if defined(__mips__) || defined (__i386__) || defined (__x86_64__)
-    grub_port_t port;
+    struct
+    {
+      grub_port_t port;
+      /* How many bytes the transmitter takes once it is seen empty, and
+	 how many more may still be written before polling it again.  */
+      unsigned int tx_fifo_size;
+      unsigned int tx_room;
+    };
 #endif
     struct
     {
@@ -63,6 +63,9 @@
 #define GRUB_PROGRESS_FAST      0
 #define GRUB_PROGRESS_SLOW      2
 
+/* Width of the progress indicator drawn by lib/progress.c.  */
+#define GRUB_TERM_PROGRESS_WIDTH 56
+
 #ifndef ASM_FILE
 
 #include <grub/err.h>
@@ -222,6 +225,10 @@ struct grub_term_output
   /* Progress data. */
   grub_uint32_t progress_update_divisor;
   grub_uint32_t progress_update_counter;
+  /* What the progress indicator last showed here and where, so that an
+     update only rewrites the characters which changed.  */
+  struct grub_term_coordinate progress_pos;
+  char progress_text[GRUB_TERM_PROGRESS_WIDTH + 1];
 
   void *data;
 };
@@ -326,6 +333,7 @@ grub_term_unregister_output (grub_term_output_t term)
 void grub_putcode (grub_uint32_t code, struct grub_term_output *term);
 int EXPORT_FUNC(grub_getkey) (void);
 int EXPORT_FUNC(grub_getkey_noblock) (void);
+void EXPORT_FUNC(grub_term_idle) (grub_uint64_t deadline);
 void grub_cls (void);
 void EXPORT_FUNC(grub_refresh) (void);
 void grub_puts_terminal (const char *str, struct grub_term_output *term);
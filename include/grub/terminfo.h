@@ -56,6 +56,12 @@ struct grub_terminfo_output_state
   struct grub_term_coordinate size;
   struct grub_term_coordinate pos;
 
+  /* What the terminal was last told, so that repeating it can be left
+     out.  All zero means unknown.  */
+  int pos_sent;
+  int color_sent;
+  int cursor_sent;
+
   void (*put) (struct grub_term_output *term, const int c);
 };
 
@@ -32,6 +32,9 @@ grub_cpu_idle(void)
 
 void EXPORT_FUNC(grub_millisleep) (grub_uint32_t ms);
 grub_uint64_t EXPORT_FUNC(grub_get_time_ms) (void);
+/* Monotonic time in nanoseconds.  Only as precise as grub_get_time_ms
+   unless the platform installed a finer clock.  */
+grub_uint64_t EXPORT_FUNC(grub_get_time_ns) (void);
 
 grub_uint64_t grub_rtc_get_time_ms (void);
 
@@ -42,5 +45,17 @@ grub_sleep (grub_uint32_t s)
 }
 
 void grub_install_get_time_ms (grub_uint64_t (*get_time_ms_func) (void));
+void grub_install_get_time_ns (grub_uint64_t (*get_time_ns_func) (void));
+
+/* Convert TICKS of a counter to time units, RATE being the number of
+   units per tick in 32.32 fixed point.  */
+static __inline grub_uint64_t
+grub_time_scale (grub_uint64_t ticks, grub_uint64_t rate)
+{
+  grub_uint64_t rl = rate & 0xffffffff;
+
+  return ticks * (rate >> 32) + (ticks >> 32) * rl
+    + (((ticks & 0xffffffff) * rl) >> 32);
+}
 
 #endif /* ! KERNEL_TIME_HEADER */
@@ -19,6 +19,8 @@
 #ifndef GRUB_TPM_HEADER
 #define GRUB_TPM_HEADER 1
 
+#include <grub/file.h>
+
 #define SHA1_DIGEST_SIZE 20
 
 #define TPM_BASE 0x0
@@ -66,14 +68,42 @@ typedef struct {
         grub_uint8_t outDigest[SHA1_DIGEST_SIZE];               /* The PCR value after execution of the command. */
 } GRUB_PACKED ExtendOutgoing;
 
+/* How a measurement reaches the TPM.  */
+typedef enum grub_tpm_hash_mode
+  {
+    /* No usable TPM, measuring is a no-op.  */
+    GRUB_TPM_HASH_NONE,
+    /* The firmware has to be handed the data and hashes it itself.  */
+    GRUB_TPM_HASH_FIRMWARE,
+    /* The firmware also accepts a SHA-1 digest computed by GRUB.  */
+    GRUB_TPM_HASH_SHA1
+  } grub_tpm_hash_mode_t;
+
 grub_err_t EXPORT_FUNC(grub_tpm_measure) (unsigned char *buf, grub_size_t size,
 					  grub_uint8_t pcr, const char *kind,
 					  const char *description);
+/* Like grub_tpm_measure, for data whose SHA-1 DIGEST was computed by the
+   caller.  Only valid when grub_tpm_hash_mode returns GRUB_TPM_HASH_SHA1.  */
+grub_err_t EXPORT_FUNC(grub_tpm_measure_digest) (const grub_uint8_t *digest,
+						 grub_uint8_t pcr,
+						 const char *kind,
+						 const char *description);
+
+/* Wrap PARENT so that reading it through to the end measures its contents
+   with a digest computed as the data arrives.  Returns PARENT itself if the
+   TPM needs the data handed over instead, in which case the caller still
+   has to call grub_tpm_measure.  Implemented in the tpmio module.  */
+grub_file_t grub_tpm_measure_open (grub_file_t parent, grub_uint8_t pcr,
+				   const char *kind, const char *description);
+
 #if defined (GRUB_MACHINE_EFI) || defined (GRUB_MACHINE_PCBIOS)
 grub_err_t grub_tpm_execute(PassThroughToTPM_InputParamBlock *inbuf,
 			    PassThroughToTPM_OutputParamBlock *outbuf);
 grub_err_t grub_tpm_log_event(unsigned char *buf, grub_size_t size,
 			      grub_uint8_t pcr, const char *description);
+grub_tpm_hash_mode_t EXPORT_FUNC(grub_tpm_hash_mode) (void);
+grub_err_t grub_tpm_log_digest(const grub_uint8_t *digest, grub_uint8_t pcr,
+			       const char *description);
 #else
 static inline grub_err_t grub_tpm_execute(PassThroughToTPM_InputParamBlock *inbuf,
 					  PassThroughToTPM_OutputParamBlock *outbuf) { return 0; };
@@ -84,6 +114,16 @@ static inline grub_err_t grub_tpm_log_event(unsigned char *buf,
 {
 	return 0;
 };
+static inline grub_tpm_hash_mode_t grub_tpm_hash_mode (void)
+{
+	return GRUB_TPM_HASH_NONE;
+};
+static inline grub_err_t grub_tpm_log_digest(const grub_uint8_t *digest,
+					     grub_uint8_t pcr,
+					     const char *description)
+{
+	return 0;
+};
 #endif
 
 #endif
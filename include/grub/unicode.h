@@ -29,15 +29,14 @@ struct grub_unicode_bidi_pair
   grub_uint32_t replace;
 };
 
-struct grub_unicode_compact_range
+/* Properties shared by a set of codepoints, see grub_unicode_prop_pages.  */
+struct grub_unicode_props
 {
-  unsigned start:21;
-  unsigned len:9;
-  unsigned bidi_type:5;
-  unsigned comb_type:8;
-  unsigned bidi_mirror:1;
-  unsigned join_type:3;
-} GRUB_PACKED;
+  grub_uint8_t bidi_type;
+  grub_uint8_t comb_type;
+  grub_uint8_t bidi_mirror;
+  grub_uint8_t join_type;
+};
 
 /* Old-style Arabic shaping. Used for "visual UTF-8" and
    in grub-mkfont to find variant glyphs in absence of GPOS tables.  */
@@ -236,10 +235,18 @@ enum
     GRUB_UNICODE_LAST_VALID                = 0x10ffff
   };
 
-extern struct grub_unicode_compact_range grub_unicode_compact[];
 extern struct grub_unicode_bidi_pair grub_unicode_bidi_pairs[];
 
-#define GRUB_UNICODE_MAX_CACHED_CHAR 0x20000
+/* Codepoint properties in two levels: grub_unicode_prop_pages gives the
+   block of every page of codepoints, and the block gives for every
+   codepoint of the page its index in grub_unicode_props.  Page 0, that is
+   Latin-1, is block 0.  */
+#define GRUB_UNICODE_PROP_PAGE_BITS 8
+#define GRUB_UNICODE_PROP_PAGE_SIZE (1 << GRUB_UNICODE_PROP_PAGE_BITS)
+extern const struct grub_unicode_props grub_unicode_props[];
+extern const grub_uint8_t grub_unicode_prop_pages[];
+extern const grub_uint8_t grub_unicode_prop_blocks[];
+
 /*  Unicode mandates an arbitrary limit.  */
 #define GRUB_BIDI_MAX_EXPLICIT_LEVEL 61
 
@@ -260,6 +267,10 @@ grub_bidi_logical_to_visual (const grub_uint32_t *logical,
 			     struct grub_term_pos *pos,
 			     int primitive_wrap);
 
+/* Drop the layouts remembered by grub_bidi_logical_to_visual.  */
+void
+grub_bidi_flush_cache (void);
+
 enum grub_comb_type
 grub_unicode_get_comb_type (grub_uint32_t c);
 grub_size_t
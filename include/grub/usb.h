@@ -47,7 +47,8 @@ typedef enum
     GRUB_USB_SPEED_NONE,
     GRUB_USB_SPEED_LOW,
     GRUB_USB_SPEED_FULL,
-    GRUB_USB_SPEED_HIGH
+    GRUB_USB_SPEED_HIGH,
+    GRUB_USB_SPEED_SUPER
   } grub_usb_speed_t;
 
 typedef int (*grub_usb_iterate_hook_t) (grub_usb_device_t dev, void *data);
@@ -121,6 +122,10 @@ struct grub_usb_controller_dev
 
   grub_usb_speed_t (*detect_dev) (grub_usb_controller_t dev, int port, int *changed);
 
+  /* Release whatever the controller keeps for a device which is gone.
+     Optional.  */
+  void (*detach_dev) (grub_usb_controller_t dev, grub_usb_device_t usbdev);
+
   /* Per controller flag - port reset pending, don't do another reset */
   grub_uint64_t pending_reset;
 
@@ -228,6 +233,15 @@ struct grub_usb_device
   int split_hubport;
 
   int split_hubaddr;
+
+  /* Root hub port the device is behind, counting from 1, and the hub
+     ports on the way to it, 4 bits per tier (xHCI route string).  */
+  int root_portno;
+
+  grub_uint32_t route;
+
+  /* Per device state of the host controller driver.  */
+  void *controller_data;
 };
 
 
@@ -69,6 +69,9 @@ struct grub_usb_transfer
 
   void *controller_data;
 
+  /* Setup packet of a control transfer.  */
+  volatile struct grub_usb_packet_setup *setup;
+
   /* Used when finishing transfer to copy data back.  */
   struct grub_pci_dma_chunk *data_chunk;
   void *data;
@@ -42,7 +42,7 @@
     "no|xz|gz|lzo", 0,				  \
     N_("compress GRUB files [optional]"), 1 },			          \
   {"core-compress", GRUB_INSTALL_OPTIONS_INSTALL_CORE_COMPRESS,		\
-      "xz|none|auto",						\
+      "xz|lz4|none|auto",						\
       0, N_("choose the compression to use for core image"), 2},	\
     /* TRANSLATORS: platform here isn't identifier. It can be translated. */ \
   { "directory", 'd', N_("DIR"), 0,					\
@@ -145,7 +145,8 @@ typedef enum {
   GRUB_COMPRESSION_AUTO,
   GRUB_COMPRESSION_NONE,
   GRUB_COMPRESSION_XZ,
-  GRUB_COMPRESSION_LZMA
+  GRUB_COMPRESSION_LZMA,
+  GRUB_COMPRESSION_LZ4
 } grub_compression_t;
 
 void
@@ -171,6 +172,7 @@ void
 grub_install_generate_image (const char *dir, const char *prefix,
 			     FILE *out,
 			     const char *outname, char *mods[],
+			     char *lazy_mods[], int compress_mods,
 			     char *memdisk_path, char **pubkey_paths,
 			     size_t npubkeys,
 			     char *config_path,
@@ -226,6 +228,14 @@ grub_install_compress_lzop (const char *src, const char *dest);
 int 
 grub_install_compress_xz (const char *src, const char *dest);
 
+/* Until the matching end, let the functions above return as soon as the
+   compressor is started, with as many running at once as there are
+   CPUs.  Ending the batch waits for all of them and fails if any did.  */
+void
+grub_install_compress_begin_batch (void);
+void
+grub_install_compress_end_batch (void);
+
 void
 grub_install_get_blocklist (grub_device_t root_dev,
 			    const char *core_path, const char *core_img,
@@ -0,0 +1,51 @@
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2026  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef GRUB_AESNI_CPU_HEADER
+#define GRUB_AESNI_CPU_HEADER	1
+
+#include <grub/types.h>
+
+#define GRUB_AESNI_BLOCK_SIZE 16
+#define GRUB_AESNI_MAX_ROUNDS 14
+
+/* Expanded AES key in the byte order the AES-NI instructions use.  DEC
+   holds the schedule for the equivalent inverse cipher.  */
+struct grub_aesni_key
+{
+  grub_uint8_t enc[(GRUB_AESNI_MAX_ROUNDS + 1) * GRUB_AESNI_BLOCK_SIZE];
+  grub_uint8_t dec[(GRUB_AESNI_MAX_ROUNDS + 1) * GRUB_AESNI_BLOCK_SIZE];
+  unsigned rounds;
+};
+
+int grub_aesni_is_supported (void);
+
+/* KEYLEN is 16, 24 or 32.  */
+void grub_aesni_set_key (struct grub_aesni_key *key, const grub_uint8_t *k,
+			 grub_size_t keylen);
+
+/* Implemented in aesni_asm.S.  */
+grub_uint32_t grub_aesni_sub_word (grub_uint32_t w);
+void grub_aesni_invert_key (grub_uint8_t *dec, const grub_uint8_t *enc,
+			    unsigned rounds);
+void grub_aesni_ecb_encrypt (const grub_uint8_t *keys, unsigned rounds,
+			     void *out, const void *in, grub_size_t nblocks);
+void grub_aesni_ecb_decrypt (const grub_uint8_t *keys, unsigned rounds,
+			     void *out, const void *in, grub_size_t nblocks);
+
+#endif
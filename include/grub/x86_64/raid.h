@@ -0,0 +1,40 @@
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2026  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef GRUB_RAID_CPU_HEADER
+#define GRUB_RAID_CPU_HEADER	1
+
+#include <grub/types.h>
+
+/* Sizes handled by the routines below must be multiples of these.  */
+#define GRUB_RAID_SSE2_BLOCK 64
+#define GRUB_RAID_SSSE3_BLOCK 16
+
+/* DST ^= SRC.  Implemented in raid_xor_sse2.S.  */
+void grub_raid_xor_sse2 (void *dst, const void *src, grub_size_t size);
+
+/* GF(2^8) multiplication of every byte of SRC by a constant, given as
+   NIBBLES[0..15], its products with 0x00..0x0f, and NIBBLES[16..31], its
+   products with 0x00..0xf0.  The first stores the result into DST, the
+   second xors it into DST.  Implemented in raid6_ssse3.S.  */
+void grub_raid6_mul_ssse3 (void *dst, const void *src, grub_size_t size,
+			   const grub_uint8_t *nibbles);
+void grub_raid6_mul_xor_ssse3 (void *dst, const void *src, grub_size_t size,
+			       const grub_uint8_t *nibbles);
+
+#endif
@@ -227,7 +227,9 @@ sync_disk (struct test_data *data)
   if (msync (data->raw, DISK_SIZE, MS_SYNC | MS_INVALIDATE) < 0)
     grub_fatal ("Syncing disk failed: %s", strerror (errno));
 
+  /* Drop the sectors and the parsed tables cached from the old image.  */
   grub_disk_cache_invalidate_all ();
+  grub_disk_generation++;
 }
 
 static void
@@ -537,6 +539,38 @@ repair_test (void)
   close_disk (&data);
 }
 
+static void
+write_entry_test (void)
+{
+  struct test_data data;
+  grub_gpt_t gpt;
+
+  open_disk (&data);
+
+  /* Change one entry and write back only its sector.  */
+  gpt = read_disk (&data);
+  gpt->entries[1].attrib = grub_cpu_to_le64_compile_time (0);
+  grub_gpt_write_entry (data.dev->disk, gpt, 1);
+  grub_test_assert (grub_errno == GRUB_ERR_NONE,
+		    "write entry failed: %s", grub_errmsg);
+  grub_gpt_free (gpt);
+  sync_disk (&data);
+
+  /* Both tables must still be valid and carry the change.  */
+  gpt = read_disk (&data);
+  grub_test_assert ((gpt->status & GRUB_GPT_BOTH_VALID) == GRUB_GPT_BOTH_VALID,
+		    "unexpected status: 0x%02x", gpt->status);
+  grub_test_assert (gpt->entries[1].attrib == 0,
+		    "entry change was not written");
+  grub_test_assert (memcmp (&data.raw->primary_entries,
+			    &data.raw->backup_entries,
+			    sizeof (data.raw->primary_entries)) == 0,
+		    "primary and backup entries differ");
+  grub_gpt_free (gpt);
+
+  close_disk (&data);
+}
+
 static void
 search_part_label_test (void)
 {
@@ -657,6 +691,7 @@ grub_unit_test_init (void)
   grub_test_register ("gpt_read_invalid_test", read_invalid_entries_test);
   grub_test_register ("gpt_read_fallback_test", read_fallback_test);
   grub_test_register ("gpt_repair_test", repair_test);
+  grub_test_register ("gpt_write_entry_test", write_entry_test);
   grub_test_register ("gpt_search_part_label_test", search_part_label_test);
   grub_test_register ("gpt_search_uuid_test", search_part_uuid_test);
   grub_test_register ("gpt_search_disk_uuid_test", search_disk_uuid_test);
@@ -671,6 +706,7 @@ grub_unit_test_fini (void)
   grub_test_unregister ("gpt_read_invalid_test");
   grub_test_unregister ("gpt_read_fallback_test");
   grub_test_unregister ("gpt_repair_test");
+  grub_test_unregister ("gpt_write_entry_test");
   grub_test_unregister ("gpt_search_part_label_test");
   grub_test_unregister ("gpt_search_part_uuid_test");
   grub_test_unregister ("gpt_search_disk_uuid_test");
@@ -0,0 +1,236 @@
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2026  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Benchmark runner.  Every benchmark is timed in batches: the batch size is
+   grown until one batch takes its share of the time budget, then that many
+   batches are timed and the median is reported.  One line per benchmark, in
+   registration order, so that two reports can be diffed.  */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fnmatch.h>
+#include <unistd.h>
+
+#include <grub/list.h>
+#include <grub/misc.h>
+#include <grub/mm.h>
+#include <grub/bench.h>
+
+#define BENCH_MAX_REPEAT 31
+
+grub_bench_t grub_bench_list;
+
+static grub_bench_t *bench_tail = &grub_bench_list;
+
+static void
+bench_append (const char *name, void (*run) (void *data), void *data,
+	      grub_size_t bytes, const char *reason)
+{
+  grub_bench_t bench;
+
+  bench = grub_zalloc (sizeof (*bench));
+  if (!bench)
+    return;
+
+  bench->name = grub_strdup (name);
+  bench->run = run;
+  bench->data = data;
+  bench->bytes = bytes;
+  bench->reason = reason ? grub_strdup (reason) : NULL;
+
+  /* Keep registration order, grub_list_push would reverse it.  */
+  bench->prev = bench_tail;
+  *bench_tail = bench;
+  bench_tail = &bench->next;
+}
+
+void
+grub_bench_register (const char *name, void (*run) (void *data), void *data,
+		     grub_size_t bytes)
+{
+  bench_append (name, run, data, bytes, NULL);
+}
+
+void
+grub_bench_skip (const char *name, const char *reason)
+{
+  bench_append (name, NULL, NULL, 0, reason);
+}
+
+static grub_uint64_t
+now_ns (void)
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return (grub_uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static grub_uint64_t
+time_batch (grub_bench_t bench, grub_uint64_t iterations)
+{
+  grub_uint64_t start, i;
+
+  start = now_ns ();
+  for (i = 0; i < iterations; i++)
+    bench->run (bench->data);
+  return now_ns () - start;
+}
+
+static int
+compare_double (const void *a, const void *b)
+{
+  double x = *(const double *) a, y = *(const double *) b;
+
+  return (x > y) - (x < y);
+}
+
+static void
+run_bench (grub_bench_t bench, grub_uint64_t budget_ns, int repeat)
+{
+  double ns_per_op[BENCH_MAX_REPEAT];
+  grub_uint64_t iterations = 1, batch_ns, elapsed;
+  double median;
+  int i;
+
+  if (!bench->run)
+    {
+      printf ("%-32s skipped: %s\n", bench->name, bench->reason);
+      return;
+    }
+
+  batch_ns = budget_ns / repeat;
+
+  /* Warm up caches and lazily built tables before sizing the batch.  */
+  bench->run (bench->data);
+
+  while ((elapsed = time_batch (bench, iterations)) < batch_ns
+	 && iterations < (1ULL << 40))
+    {
+      /* Jump close to the target once the batch is long enough to
+	 measure, and keep doubling while it is not.  */
+      if (elapsed > batch_ns / 16)
+	iterations = iterations * batch_ns / elapsed + 1;
+      else
+	iterations *= 2;
+    }
+
+  for (i = 0; i < repeat; i++)
+    ns_per_op[i] = (double) time_batch (bench, iterations) / iterations;
+  qsort (ns_per_op, repeat, sizeof (ns_per_op[0]), compare_double);
+  median = ns_per_op[repeat / 2];
+
+  printf ("%-32s %12llu %14.1f", bench->name,
+	  (unsigned long long) iterations, median);
+  if (bench->bytes)
+    printf (" %10.1f", bench->bytes * 1000.0 / median);
+  else
+    printf (" %10s", "-");
+  printf (" %6.1f%%\n", (ns_per_op[repeat - 1] - ns_per_op[0]) * 100.0
+	  / median);
+  fflush (stdout);
+}
+
+static int
+selected (grub_bench_t bench, int npatterns, char **patterns)
+{
+  int i;
+
+  if (!npatterns)
+    return 1;
+  for (i = 0; i < npatterns; i++)
+    if (fnmatch (patterns[i], bench->name, 0) == 0)
+      return 1;
+  return 0;
+}
+
+static void
+usage (const char *prog, int status)
+{
+  fprintf (status ? stderr : stdout,
+	   "Usage: %s [-l] [-t MSEC] [-r COUNT] [PATTERN...]\n"
+	   "Time the benchmarks whose name matches one of the shell PATTERNs,\n"
+	   "or all of them.\n\n"
+	   "  -l        list the benchmarks instead of running them\n"
+	   "  -t MSEC   measuring time per benchmark (default 500)\n"
+	   "  -r COUNT  timed batches per benchmark, the median is reported\n"
+	   "            (default 5, at most %d)\n",
+	   prog, BENCH_MAX_REPEAT);
+  exit (status);
+}
+
+int
+main (int argc, char *argv[])
+{
+  grub_uint64_t budget_ns = 500000000ULL;
+  int repeat = 5, list = 0, opt;
+  grub_bench_t bench;
+
+  while ((opt = getopt (argc, argv, "lt:r:h")) != -1)
+    switch (opt)
+      {
+      case 'l':
+	list = 1;
+	break;
+      case 't':
+	budget_ns = strtoull (optarg, NULL, 10) * 1000000ULL;
+	break;
+      case 'r':
+	repeat = atoi (optarg);
+	if (repeat < 1 || repeat > BENCH_MAX_REPEAT)
+	  usage (argv[0], 1);
+	break;
+      case 'h':
+	usage (argv[0], 0);
+	break;
+      default:
+	usage (argv[0], 1);
+      }
+
+  grub_bench_init ();
+
+  if (!list)
+    printf ("%-32s %12s %14s %10s %7s\n", "# benchmark", "iterations",
+	    "ns/op", "MB/s", "spread");
+
+  FOR_LIST_ELEMENTS (bench, grub_bench_list)
+    if (selected (bench, argc - optind, argv + optind))
+      {
+	if (list)
+	  printf ("%s\n", bench->name);
+	else
+	  run_bench (bench, budget_ns, repeat);
+      }
+
+  grub_bench_fini ();
+
+  while (grub_bench_list)
+    {
+      bench = grub_bench_list;
+      grub_bench_list = bench->next;
+      grub_free (bench->name);
+      grub_free (bench->reason);
+      grub_free (bench);
+    }
+
+  return 0;
+}
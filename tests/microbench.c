@@ -0,0 +1,788 @@
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2026  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Microbenchmarks of the primitives the boot path spends its time in: the
+   memory functions, checksums and hashes, disk ciphers, decompressors,
+   framebuffer blits and the script parser.  They run the same code as the
+   modules, built for the host.  */
+
+#include <config.h>
+
+/* Benchmarks are normal programs, so they can include C library.  */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <grub/bench.h>
+#include <grub/crypto.h>
+#include <grub/cryptodisk.h>
+#include <grub/err.h>
+#include <grub/file.h>
+#include <grub/fs.h>
+#include <grub/misc.h>
+#include <grub/mm.h>
+#include <grub/lib/crc.h>
+#include <grub/script_sh.h>
+#include <grub/video.h>
+#include <grub/fbblit.h>
+#include <grub/fbutil.h>
+#include <grub/emu/misc.h>
+
+/* From the zfs module, which has no header for them.  */
+extern grub_err_t lz4_decompress (void *s_start, void *d_start,
+				  grub_size_t s_len, grub_size_t d_len);
+extern grub_err_t lzjb_decompress (void *s_start, void *d_start,
+				   grub_size_t s_len, grub_size_t d_len);
+
+#define BUF_SIZE	(1 << 20)
+#define TEXT_SIZE	(1 << 20)
+/* ZFS compresses records of at most 128K.  */
+#define RECORD_SIZE	(128 << 10)
+
+#define FB_WIDTH	1024
+#define FB_HEIGHT	768
+
+/* BUF_A holds random data and BUF_C a copy of it, BUF_B is scratch.  */
+static grub_uint8_t *buf_a, *buf_b, *buf_c;
+static char *text;
+
+static grub_uint32_t rnd_state = 0x2545f491;
+
+static grub_uint32_t
+rnd (void)
+{
+  rnd_state ^= rnd_state << 13;
+  rnd_state ^= rnd_state >> 17;
+  rnd_state ^= rnd_state << 5;
+  return rnd_state;
+}
+
+static void
+fill_random (grub_uint8_t *p, grub_size_t len)
+{
+  for (; len; len--)
+    *p++ = rnd ();
+}
+
+/* Something shaped like configuration files and kernel command lines, so
+   that the compressors find what they usually find.  */
+static void
+fill_text (char *p, grub_size_t len)
+{
+  static const char *const words[] =
+    {
+      "menuentry", "linux", "initrd", "root=UUID=", "quiet", "splash",
+      "search", "--no-floppy", "--fs-uuid", "--set=root", "insmod", "gzio",
+      "part_gpt", "ext2", "set", "timeout=5", "default=0", "echo",
+      "'Loading", "kernel", "...'", "/boot/vmlinuz", "ro", "if", "then",
+      "fi", "else", "$prefix", "{", "}", "load_video", "gfxmode=auto",
+      "e2fsck", "0x7f3a", "console=ttyS0,115200", "systemd.unit=rescue",
+    };
+  char *end = p + len;
+  unsigned column = 0;
+
+  while (p < end)
+    {
+      const char *w = words[rnd () % ARRAY_SIZE (words)];
+      grub_size_t l = grub_strlen (w);
+
+      if (column + l + 1 > 72)
+	{
+	  *p++ = '\n';
+	  column = 0;
+	  continue;
+	}
+      if ((grub_size_t) (end - p) <= l)
+	break;
+      grub_memcpy (p, w, l);
+      p += l;
+      *p++ = ' ';
+      column += l + 1;
+    }
+  while (p < end)
+    *p++ = '\n';
+}
+
+/* Memory functions.  */
+
+static void
+run_memmove_aligned (void *data __attribute__ ((unused)))
+{
+  grub_memmove (buf_b, buf_a, BUF_SIZE);
+}
+
+static void
+run_memmove_unaligned (void *data __attribute__ ((unused)))
+{
+  grub_memmove (buf_b + 1, buf_a + 3, BUF_SIZE - 8);
+}
+
+static void
+run_memmove_overlap (void *data __attribute__ ((unused)))
+{
+  /* Destination above the source: the backward copy.  */
+  grub_memmove (buf_b + 64, buf_b, BUF_SIZE - 64);
+}
+
+#define SMALL_STEP 61
+#define SMALL_SPAN (64 << 10)
+
+/* Many short copies of varying length and alignment, like the ones
+   filesystem drivers make for directory entries and inodes.  */
+static void
+run_memmove_small (void *data __attribute__ ((unused)))
+{
+  grub_size_t off;
+
+  for (off = 0; off < SMALL_SPAN; off += SMALL_STEP)
+    grub_memmove (buf_b + off, buf_a + (off ^ 3), 8 + (off & 31));
+}
+
+static grub_size_t
+small_bytes (void)
+{
+  grub_size_t off, total = 0;
+
+  for (off = 0; off < SMALL_SPAN; off += SMALL_STEP)
+    total += 8 + (off & 31);
+  return total;
+}
+
+static void
+run_memset (void *data __attribute__ ((unused)))
+{
+  grub_memset (buf_b, 0x5a, BUF_SIZE);
+}
+
+static void
+run_memcmp (void *data __attribute__ ((unused)))
+{
+  int r;
+
+  r = grub_memcmp (buf_a, buf_c, BUF_SIZE);
+  grub_bench_use (&r);
+}
+
+/* Checksums and hashes.  */
+
+static void
+run_crc32c (void *data __attribute__ ((unused)))
+{
+  grub_uint32_t crc;
+
+  crc = grub_getcrc32c (0, buf_a, BUF_SIZE);
+  grub_bench_use (&crc);
+}
+
+static void
+run_hash (void *data)
+{
+  grub_uint8_t out[GRUB_CRYPTO_MAX_MDLEN];
+
+  grub_crypto_hash (data, out, buf_a, BUF_SIZE);
+  grub_bench_use (out);
+}
+
+static void
+register_hash (const char *name, const gcry_md_spec_t *md)
+{
+  if (md)
+    grub_bench_register (name, run_hash, (void *) md, BUF_SIZE);
+  else
+    grub_bench_skip (name, "digest not registered");
+}
+
+/* Ciphers.  */
+
+static grub_uint8_t iv[GRUB_CRYPTO_MAX_CIPHER_BLOCKSIZE];
+
+static void
+run_cbc_decrypt (void *data)
+{
+  grub_memset (iv, 0, sizeof (iv));
+  grub_crypto_cbc_decrypt (data, buf_b, buf_a, BUF_SIZE, iv);
+}
+
+static void
+run_cryptodisk_decrypt (void *data)
+{
+  grub_cryptodisk_decrypt (data, buf_b, BUF_SIZE, 0);
+}
+
+static void
+register_cbc (const char *name, grub_size_t keysize)
+{
+  grub_crypto_cipher_handle_t cipher;
+  grub_uint8_t key[32];
+
+  fill_random (key, sizeof (key));
+  cipher = grub_crypto_cipher_open (GRUB_CIPHER_AES);
+  if (!cipher || grub_crypto_cipher_set_key (cipher, key, keysize))
+    {
+      grub_bench_skip (name, "cannot set up the cipher");
+      return;
+    }
+  grub_bench_register (name, run_cbc_decrypt, cipher, BUF_SIZE);
+}
+
+static void
+register_xts (const char *name, grub_size_t keysize)
+{
+  grub_cryptodisk_t dev;
+  grub_uint8_t key[64];
+
+  fill_random (key, sizeof (key));
+  dev = grub_zalloc (sizeof (*dev));
+  if (!dev)
+    return;
+  dev->cipher = grub_crypto_cipher_open (GRUB_CIPHER_AES);
+  dev->secondary_cipher = grub_crypto_cipher_open (GRUB_CIPHER_AES);
+  dev->mode = GRUB_CRYPTODISK_MODE_XTS;
+  dev->mode_iv = GRUB_CRYPTODISK_MODE_IV_PLAIN64;
+  dev->log_sector_size = 9;
+  if (!dev->cipher || !dev->secondary_cipher
+      || grub_cryptodisk_setkey (dev, key, keysize))
+    {
+      grub_bench_skip (name, "cannot set up the cipher");
+      return;
+    }
+  grub_bench_register (name, run_cryptodisk_decrypt, dev, BUF_SIZE);
+}
+
+/* Stream decompressors, reading through the file filters exactly like
+   "insmod gzio; linux /vmlinuz.gz" does.  */
+
+struct compressed
+{
+  grub_file_filter_id_t filter;
+  grub_uint8_t *data;
+  grub_size_t size;
+};
+
+static grub_ssize_t
+mem_read (grub_file_t file, char *buf, grub_size_t len)
+{
+  grub_memcpy (buf, (char *) file->data + file->offset, len);
+  return len;
+}
+
+static struct grub_fs mem_fs =
+  {
+    .name = "bench",
+    .read = mem_read
+  };
+
+static grub_ssize_t
+decompress (struct compressed *c)
+{
+  grub_file_t in, file;
+  grub_ssize_t r;
+
+  in = grub_zalloc (sizeof (*in));
+  if (!in)
+    return -1;
+  in->fs = &mem_fs;
+  in->data = c->data;
+  in->size = c->size;
+
+  file = grub_file_filters_all[c->filter] (in, "bench");
+  if (!file)
+    {
+      grub_file_close (in);
+      return -1;
+    }
+  r = grub_file_read (file, buf_b, TEXT_SIZE);
+  grub_file_close (file);
+  return r;
+}
+
+static void
+run_decompress (void *data)
+{
+  decompress (data);
+}
+
+/* Compress the text with the host's TOOL.  Returns 0 if the tool is not
+   there.  */
+static int
+host_compress (const char *tool, struct compressed *c)
+{
+  char in_name[] = "/tmp/grub-bench-XXXXXX";
+  char *out_name, *cmd;
+  FILE *f;
+  long size;
+  int fd, ok = 0;
+
+  fd = mkstemp (in_name);
+  if (fd < 0)
+    return 0;
+  if (write (fd, text, TEXT_SIZE) != TEXT_SIZE)
+    {
+      close (fd);
+      unlink (in_name);
+      return 0;
+    }
+  close (fd);
+
+  out_name = grub_xasprintf ("%s.out", in_name);
+  cmd = grub_xasprintf ("%s < %s > %s 2>/dev/null", tool, in_name, out_name);
+  if (system (cmd) == 0 && (f = fopen (out_name, "rb")))
+    {
+      fseek (f, 0, SEEK_END);
+      size = ftell (f);
+      fseek (f, 0, SEEK_SET);
+      c->data = grub_malloc (size);
+      if (size > 0 && c->data && fread (c->data, 1, size, f) == (size_t) size)
+	{
+	  c->size = size;
+	  ok = 1;
+	}
+      fclose (f);
+    }
+
+  unlink (out_name);
+  unlink (in_name);
+  grub_free (out_name);
+  grub_free (cmd);
+  return ok;
+}
+
+static void
+register_decompress (const char *name, grub_file_filter_id_t filter,
+		     const char *tool)
+{
+  struct compressed *c;
+
+  c = grub_zalloc (sizeof (*c));
+  if (!c)
+    return;
+  c->filter = filter;
+  if (!host_compress (tool, c))
+    {
+      char *reason = grub_xasprintf ("\"%s\" failed", tool);
+
+      grub_bench_skip (name, reason);
+      grub_free (reason);
+      grub_free (c);
+      return;
+    }
+  if (decompress (c) != TEXT_SIZE || grub_memcmp (buf_b, text, TEXT_SIZE))
+    grub_util_error ("%s: decompressed data differs", name);
+  grub_bench_register (name, run_decompress, c, TEXT_SIZE);
+}
+
+/* The ZFS block decompressors.  There is no host tool producing bare blocks,
+   so the inputs come from the small greedy encoders below; the decoders'
+   speed does not depend much on how good the match finder is.  */
+
+#define LZ4_HASH_BITS	12
+#define LZ4_MIN_MATCH	4
+/* The format wants the last 5 bytes as literals and no match starting in
+   the last 12.  */
+#define LZ4_LAST_LITERALS	5
+#define LZ4_MATCH_LIMIT		12
+
+static grub_uint8_t *
+lz4_put_length (grub_uint8_t *op, grub_size_t len)
+{
+  for (; len >= 255; len -= 255)
+    *op++ = 255;
+  *op++ = len;
+  return op;
+}
+
+static grub_uint8_t *
+lz4_put_sequence (grub_uint8_t *op, const grub_uint8_t *literals,
+		  grub_size_t nliterals, grub_size_t offset, grub_size_t mlen)
+{
+  grub_uint8_t *token = op++;
+
+  *token = (nliterals < 15 ? nliterals : 15) << 4;
+  if (nliterals >= 15)
+    op = lz4_put_length (op, nliterals - 15);
+  grub_memcpy (op, literals, nliterals);
+  op += nliterals;
+
+  if (!mlen)
+    return op;
+
+  *op++ = offset;
+  *op++ = offset >> 8;
+  mlen -= LZ4_MIN_MATCH;
+  *token |= mlen < 15 ? mlen : 15;
+  if (mlen >= 15)
+    op = lz4_put_length (op, mlen - 15);
+  return op;
+}
+
+/* Compress to DST as the zfs module expects it: the compressed size as
+   a big-endian 32-bit number, then an LZ4 block.  */
+static grub_size_t
+lz4_compress (const grub_uint8_t *src, grub_size_t len, grub_uint8_t *dst)
+{
+  static grub_uint32_t table[1 << LZ4_HASH_BITS];
+  const grub_uint8_t *ip = src, *anchor = src, *end = src + len;
+  grub_uint8_t *op = dst + 4;
+  grub_size_t size;
+
+  grub_memset (table, 0, sizeof (table));
+  while (ip + LZ4_MATCH_LIMIT < end)
+    {
+      grub_uint32_t seq = grub_get_unaligned32 (ip), h, pos;
+      const grub_uint8_t *ref;
+      grub_size_t mlen;
+
+      /* Positions are stored plus one, zero means none yet.  */
+      h = (seq * 2654435761U) >> (32 - LZ4_HASH_BITS);
+      pos = table[h];
+      table[h] = ip - src + 1;
+      ref = src + pos - 1;
+      if (!pos || ip - ref > 0xffff || grub_get_unaligned32 (ref) != seq)
+	{
+	  ip++;
+	  continue;
+	}
+
+      for (mlen = LZ4_MIN_MATCH;
+	   ip + mlen < end - LZ4_LAST_LITERALS && ref[mlen] == ip[mlen];
+	   mlen++);
+      op = lz4_put_sequence (op, anchor, ip - anchor, ip - ref, mlen);
+      ip += mlen;
+      anchor = ip;
+    }
+  op = lz4_put_sequence (op, anchor, end - anchor, 0, 0);
+
+  size = op - dst - 4;
+  dst[0] = size >> 24;
+  dst[1] = size >> 16;
+  dst[2] = size >> 8;
+  dst[3] = size;
+  return op - dst;
+}
+
+#define LZJB_MATCH_BITS		6
+#define LZJB_MATCH_MIN		3
+#define LZJB_MATCH_MAX		((1 << LZJB_MATCH_BITS) + (LZJB_MATCH_MIN - 1))
+#define LZJB_OFFSET_MASK	((1 << (16 - LZJB_MATCH_BITS)) - 1)
+#define LZJB_LEMPEL_SIZE	1024
+
+static grub_size_t
+lzjb_compress (const grub_uint8_t *src, grub_size_t len, grub_uint8_t *dst)
+{
+  grub_uint32_t lempel[LZJB_LEMPEL_SIZE];
+  const grub_uint8_t *ip = src, *end = src + len;
+  grub_uint8_t *op = dst, *copymap = NULL;
+  unsigned copymask = 1 << 7;
+
+  grub_memset (lempel, 0, sizeof (lempel));
+  while (ip < end)
+    {
+      const grub_uint8_t *ref;
+      grub_size_t offset, mlen;
+      grub_uint32_t h, pos;
+
+      if ((copymask <<= 1) == (1 << 8))
+	{
+	  copymask = 1;
+	  copymap = op++;
+	  *copymap = 0;
+	}
+      if (ip > end - LZJB_MATCH_MAX)
+	{
+	  *op++ = *ip++;
+	  continue;
+	}
+
+      h = (ip[0] << 16) + (ip[1] << 8) + ip[2];
+      h += h >> 9;
+      h += h >> 5;
+      h &= LZJB_LEMPEL_SIZE - 1;
+      pos = lempel[h];
+      lempel[h] = ip - src + 1;
+      ref = src + pos - 1;
+      offset = ip - ref;
+      if (!pos || offset > LZJB_OFFSET_MASK
+	  || ref[0] != ip[0] || ref[1] != ip[1] || ref[2] != ip[2])
+	{
+	  *op++ = *ip++;
+	  continue;
+	}
+
+      for (mlen = LZJB_MATCH_MIN; mlen < LZJB_MATCH_MAX && ref[mlen] == ip[mlen];
+	   mlen++);
+      *op++ = ((mlen - LZJB_MATCH_MIN) << (8 - LZJB_MATCH_BITS))
+	| (offset >> 8);
+      *op++ = offset;
+      *copymap |= copymask;
+      ip += mlen;
+    }
+  return op - dst;
+}
+
+struct zfs_block
+{
+  grub_err_t (*decompress) (void *s_start, void *d_start,
+			    grub_size_t s_len, grub_size_t d_len);
+  grub_uint8_t *data;
+  grub_size_t size;
+};
+
+static void
+run_zfs_block (void *data)
+{
+  struct zfs_block *b = data;
+
+  b->decompress (b->data, buf_b, b->size, RECORD_SIZE);
+}
+
+static void
+register_zfs_block (const char *name,
+		    grub_err_t (*decompress_fn) (void *, void *,
+						 grub_size_t, grub_size_t),
+		    grub_size_t (*compress_fn) (const grub_uint8_t *,
+						grub_size_t, grub_uint8_t *))
+{
+  struct zfs_block *b;
+
+  b = grub_zalloc (sizeof (*b));
+  if (!b)
+    return;
+  b->decompress = decompress_fn;
+  /* Both formats grow incompressible input by well under an eighth.  */
+  b->data = grub_malloc (RECORD_SIZE + RECORD_SIZE / 8 + 16);
+  if (!b->data)
+    return;
+  b->size = compress_fn ((grub_uint8_t *) text, RECORD_SIZE, b->data);
+
+  if (decompress_fn (b->data, buf_b, b->size, RECORD_SIZE)
+      || grub_memcmp (buf_b, text, RECORD_SIZE))
+    grub_util_error ("%s: decompressed data differs", name);
+  grub_bench_register (name, run_zfs_block, b, RECORD_SIZE);
+}
+
+/* Framebuffer blits.  */
+
+struct blit
+{
+  struct grub_video_mode_info target_mode, source_mode;
+  grub_uint8_t *target_data, *source_data;
+  struct grub_video_fbblit_info target, source;
+  enum grub_video_blit_operators oper;
+};
+
+static void
+set_mode_32 (struct grub_video_mode_info *mode,
+	     enum grub_video_blit_format format, int alpha)
+{
+  grub_memset (mode, 0, sizeof (*mode));
+  mode->width = FB_WIDTH;
+  mode->height = FB_HEIGHT;
+  mode->mode_type = GRUB_VIDEO_MODE_TYPE_RGB;
+  if (alpha)
+    mode->mode_type |= GRUB_VIDEO_MODE_TYPE_ALPHA;
+  mode->bpp = 32;
+  mode->bytes_per_pixel = 4;
+  mode->pitch = FB_WIDTH * 4;
+  mode->number_of_colors = 256;
+  mode->blit_format = format;
+  mode->red_mask_size = 8;
+  mode->green_mask_size = 8;
+  mode->green_field_pos = 8;
+  mode->blue_mask_size = 8;
+  mode->reserved_mask_size = 8;
+  mode->reserved_field_pos = 24;
+  if (format == GRUB_VIDEO_BLIT_FORMAT_BGRA_8888)
+    mode->red_field_pos = 16;
+  else
+    mode->blue_field_pos = 16;
+}
+
+static void
+run_blit (void *data)
+{
+  struct blit *b = data;
+
+  grub_video_fb_dispatch_blit (&b->target, &b->source, b->oper, 0, 0,
+			       FB_WIDTH, FB_HEIGHT, 0, 0);
+}
+
+/* Blit a full screen from an image in SOURCE format onto a BGRA screen,
+   which is what GOP framebuffers are.  */
+static void
+register_blit (const char *name, enum grub_video_blit_format source,
+	       enum grub_video_blit_operators oper)
+{
+  struct blit *b;
+
+  b = grub_zalloc (sizeof (*b));
+  if (!b)
+    return;
+  b->target_data = grub_zalloc (FB_WIDTH * FB_HEIGHT * 4);
+  b->source_data = grub_malloc (FB_WIDTH * FB_HEIGHT * 4);
+  if (!b->target_data || !b->source_data)
+    grub_util_error ("out of memory");
+  /* Random alpha makes the blend take all of its paths.  */
+  fill_random (b->source_data, FB_WIDTH * FB_HEIGHT * 4);
+  set_mode_32 (&b->target_mode, GRUB_VIDEO_BLIT_FORMAT_BGRA_8888, 0);
+  set_mode_32 (&b->source_mode, source, 1);
+  b->target.mode_info = &b->target_mode;
+  b->target.data = b->target_data;
+  b->source.mode_info = &b->source_mode;
+  b->source.data = b->source_data;
+  b->oper = oper;
+  grub_bench_register (name, run_blit, b, FB_WIDTH * FB_HEIGHT * 4);
+}
+
+/* Script parser.  */
+
+static char config[] =
+  "set default=0\n"
+  "set timeout=5\n"
+  "if [ x$feature_default_font_path = xy ] ; then\n"
+  "   font=unicode\n"
+  "else\n"
+  "  insmod part_gpt\n"
+  "  insmod ext2\n"
+  "  search --no-floppy --fs-uuid --set=root 4e1b3c52-0d3f-4a4b\n"
+  "  font=\"/usr/share/grub/unicode.pf2\"\n"
+  "fi\n"
+  "function load_video {\n"
+  "  if [ x$feature_all_video_module = xy ]; then\n"
+  "    insmod all_video\n"
+  "  else\n"
+  "    insmod efi_gop\n"
+  "    insmod video_bochs\n"
+  "  fi\n"
+  "}\n"
+  "menuentry 'Linux' --class gnu-linux --class os $menuentry_id_option "
+  "'gnulinux-simple' {\n"
+  "  load_video\n"
+  "  set gfxpayload=keep\n"
+  "  insmod gzio\n"
+  "  echo 'Loading Linux ...'\n"
+  "  linux /boot/vmlinuz root=UUID=4e1b3c52 ro quiet splash $vt_handoff\n"
+  "  echo 'Loading initial ramdisk ...'\n"
+  "  initrd /boot/initrd.img\n"
+  "}\n"
+  "submenu 'Advanced options' $menuentry_id_option 'gnulinux-advanced' {\n"
+  "  for kernel in /boot/vmlinuz-*; do\n"
+  "    menuentry \"Linux ${kernel}\" {\n"
+  "      linux ${kernel} root=UUID=4e1b3c52 ro single\n"
+  "    }\n"
+  "  done\n"
+  "}\n";
+
+static grub_err_t
+no_more_lines (char **line, int cont __attribute__ ((unused)),
+	       void *data __attribute__ ((unused)))
+{
+  *line = NULL;
+  return GRUB_ERR_NONE;
+}
+
+static void
+run_script_parse (void *data __attribute__ ((unused)))
+{
+  grub_script_free (grub_script_parse (config, no_more_lines, NULL));
+}
+
+static void
+register_script_parse (const char *name)
+{
+  struct grub_script *script;
+
+  script = grub_script_parse (config, no_more_lines, NULL);
+  if (!script)
+    {
+      grub_bench_skip (name, "the parser rejected the configuration");
+      grub_errno = GRUB_ERR_NONE;
+      return;
+    }
+  grub_script_free (script);
+  grub_bench_register (name, run_script_parse, NULL, sizeof (config) - 1);
+}
+
+void
+grub_bench_init (void)
+{
+  grub_init_all ();
+
+  buf_a = grub_malloc (BUF_SIZE);
+  buf_b = grub_malloc (BUF_SIZE);
+  buf_c = grub_malloc (BUF_SIZE);
+  text = grub_malloc (TEXT_SIZE);
+  if (!buf_a || !buf_b || !buf_c || !text)
+    grub_util_error ("out of memory");
+  fill_random (buf_a, BUF_SIZE);
+  grub_memcpy (buf_c, buf_a, BUF_SIZE);
+  fill_text (text, TEXT_SIZE);
+
+  grub_bench_register ("memmove/aligned-1M", run_memmove_aligned, NULL,
+		       BUF_SIZE);
+  grub_bench_register ("memmove/unaligned-1M", run_memmove_unaligned, NULL,
+		       BUF_SIZE - 8);
+  grub_bench_register ("memmove/overlap-1M", run_memmove_overlap, NULL,
+		       BUF_SIZE - 64);
+  grub_bench_register ("memmove/small", run_memmove_small, NULL,
+		       small_bytes ());
+  grub_bench_register ("memset/1M", run_memset, NULL, BUF_SIZE);
+  grub_bench_register ("memcmp/equal-1M", run_memcmp, NULL, BUF_SIZE);
+
+  grub_bench_register ("checksum/crc32c", run_crc32c, NULL, BUF_SIZE);
+  register_hash ("checksum/crc32", GRUB_MD_CRC32);
+  register_hash ("checksum/crc64", grub_crypto_lookup_md_by_name ("crc64"));
+  register_hash ("checksum/adler32",
+		 grub_crypto_lookup_md_by_name ("adler32"));
+  register_hash ("hash/sha1", GRUB_MD_SHA1);
+  register_hash ("hash/sha256", GRUB_MD_SHA256);
+  register_hash ("hash/sha512", GRUB_MD_SHA512);
+
+  register_cbc ("cipher/aes128-cbc-decrypt", 16);
+  register_cbc ("cipher/aes256-cbc-decrypt", 32);
+  register_xts ("cipher/aes128-xts-decrypt", 32);
+  register_xts ("cipher/aes256-xts-decrypt", 64);
+
+  register_decompress ("decompress/gzio", GRUB_FILE_FILTER_GZIO, "gzip -6");
+  register_decompress ("decompress/xzio", GRUB_FILE_FILTER_XZIO,
+		       "xz -6 --check=crc32");
+  register_decompress ("decompress/lzopio", GRUB_FILE_FILTER_LZOPIO, "lzop");
+  register_decompress ("decompress/zstdio", GRUB_FILE_FILTER_ZSTDIO,
+		       "zstd -3 -q");
+  register_zfs_block ("decompress/lz4-128K", lz4_decompress, lz4_compress);
+  register_zfs_block ("decompress/lzjb-128K", lzjb_decompress,
+		      lzjb_compress);
+
+  register_blit ("fbblit/replace-bgra", GRUB_VIDEO_BLIT_FORMAT_BGRA_8888,
+		 GRUB_VIDEO_BLIT_REPLACE);
+  register_blit ("fbblit/replace-rgba", GRUB_VIDEO_BLIT_FORMAT_RGBA_8888,
+		 GRUB_VIDEO_BLIT_REPLACE);
+  register_blit ("fbblit/blend-rgba", GRUB_VIDEO_BLIT_FORMAT_RGBA_8888,
+		 GRUB_VIDEO_BLIT_BLEND);
+
+  register_script_parse ("script/parse-grub.cfg");
+}
+
+void
+grub_bench_fini (void)
+{
+  grub_free (buf_a);
+  grub_free (buf_b);
+  grub_free (buf_c);
+  grub_free (text);
+}
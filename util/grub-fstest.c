@@ -35,6 +35,7 @@
 #include <grub/i18n.h>
 #include <grub/zfs/zfs.h>
 #include <grub/emu/hostfile.h>
+#include <grub/time.h>
 
 #include <stdio.h>
 #include <errno.h>
@@ -69,7 +70,8 @@ enum {
   CMD_BLOCKLIST,
   CMD_TESTLOAD,
   CMD_ZFSINFO,
-  CMD_XNU_UUID
+  CMD_XNU_UUID,
+  CMD_BENCH
 };
 #define BUF_SIZE  32256
 
@@ -367,6 +369,256 @@ cmd_crc (char *pathname)
   free (crc32_context);
 }
 
+struct bench_stats
+{
+  grub_uint64_t start;
+  unsigned long hits, misses, reads;
+  grub_uint64_t read_bytes;
+};
+
+struct bench_ctx
+{
+  grub_device_t dev;
+  grub_fs_t fs;
+  const char *dir;
+  char **dirs;
+  grub_size_t ndirs, alloc_dirs;
+  char **files;
+  grub_size_t nfiles, alloc_files;
+  char *largest;
+  grub_off_t largest_size;
+  unsigned long ops;
+};
+
+/* Start measuring with a cold cache.  */
+static void
+bench_start (struct bench_stats *st)
+{
+  grub_disk_cache_invalidate_all ();
+  grub_disk_cache_get_performance (&st->hits, &st->misses);
+  grub_disk_get_read_stats (&st->reads, &st->read_bytes);
+  st->start = grub_get_time_ms ();
+}
+
+static void
+bench_report (const char *name, const struct bench_stats *st,
+	      unsigned long ops, grub_uint64_t bytes)
+{
+  grub_uint64_t ms;
+  unsigned long hits, misses, reads;
+  grub_uint64_t read_bytes;
+
+  ms = grub_get_time_ms () - st->start;
+  if (ms == 0)
+    ms = 1;
+  grub_disk_cache_get_performance (&hits, &misses);
+  grub_disk_get_read_stats (&reads, &read_bytes);
+
+  printf ("%-8s %9lu ops %7llu ms %9llu ops/s", name, ops,
+	  (unsigned long long) ms, (unsigned long long) (ops * 1000ULL / ms));
+  if (bytes)
+    {
+      unsigned long long rate = bytes * 100 / 1048576 * 1000 / ms;
+      printf (" %6llu.%02llu MB/s", rate / 100, rate % 100);
+    }
+  printf (", %lu disk reads (%llu KiB), %lu cache hits, %lu misses\n",
+	  reads - st->reads,
+	  (unsigned long long) ((read_bytes - st->read_bytes) >> 10),
+	  hits - st->hits, misses - st->misses);
+}
+
+static char *
+bench_add (char ***list, grub_size_t *n, grub_size_t *alloc, char *name)
+{
+  if (*n == *alloc)
+    {
+      *alloc = 2 * *alloc + 16;
+      *list = xrealloc (*list, *alloc * sizeof ((*list)[0]));
+    }
+  (*list)[(*n)++] = name;
+  return name;
+}
+
+static int
+bench_collect_hook (const char *filename, const struct grub_dirhook_info *info,
+		    void *data)
+{
+  struct bench_ctx *ctx = data;
+  char *path;
+
+  if (grub_strcmp (filename, ".") == 0 || grub_strcmp (filename, "..") == 0)
+    return 0;
+
+  path = xasprintf ("%s%s%s", ctx->dir,
+		    ctx->dir[grub_strlen (ctx->dir) - 1] == '/' ? "" : "/",
+		    filename);
+  if (info->dir)
+    bench_add (&ctx->dirs, &ctx->ndirs, &ctx->alloc_dirs, path);
+  else
+    bench_add (&ctx->files, &ctx->nfiles, &ctx->alloc_files, path);
+  return 0;
+}
+
+static int
+bench_ls_hook (const char *filename __attribute__ ((unused)),
+	       const struct grub_dirhook_info *info __attribute__ ((unused)),
+	       void *data __attribute__ ((unused)))
+{
+  return 0;
+}
+
+static int
+bench_search_hook (const char *name, void *data)
+{
+  struct bench_ctx *ctx = data;
+  grub_device_t dev;
+  grub_fs_t fs;
+  char *uuid = NULL;
+
+  ctx->ops++;
+  dev = grub_device_open (name);
+  if (! dev)
+    {
+      grub_errno = GRUB_ERR_NONE;
+      return 0;
+    }
+  fs = grub_fs_probe (dev);
+  if (fs && fs->uuid)
+    fs->uuid (dev, &uuid);
+  grub_free (uuid);
+  grub_device_close (dev);
+  grub_errno = GRUB_ERR_NONE;
+  return 0;
+}
+
+static grub_file_t
+bench_open (const char *name)
+{
+  grub_file_t file;
+
+  if (uncompress == 0)
+    grub_file_filter_disable_compression ();
+  file = grub_file_open (name);
+  if (! file)
+    grub_util_error (_("cannot open `%s': %s"), name, grub_errmsg);
+  return file;
+}
+
+/* Run each workload over the tree at PATH ROUNDS times and report its
+   speed and the disk traffic it caused.  Every workload starts with an
+   empty disk cache, so the first round is a cold one.  */
+static void
+cmd_bench (char *path, int rounds)
+{
+  static char buf[BUF_SIZE];
+  struct bench_ctx ctx;
+  struct bench_stats st;
+  grub_uint64_t bytes;
+  grub_uint32_t seed = 1;
+  grub_size_t i;
+  int round;
+
+  memset (&ctx, 0, sizeof (ctx));
+  ctx.dev = grub_device_open (0);
+  if (! ctx.dev)
+    grub_util_error ("%s", grub_errmsg);
+  ctx.fs = grub_fs_probe (ctx.dev);
+  if (! ctx.fs)
+    grub_util_error ("%s", grub_errmsg);
+
+  bench_add (&ctx.dirs, &ctx.ndirs, &ctx.alloc_dirs, xstrdup (path));
+  for (i = 0; i < ctx.ndirs; i++)
+    {
+      ctx.dir = ctx.dirs[i];
+      if (ctx.fs->dir (ctx.dev, ctx.dir, bench_collect_hook, &ctx))
+	grub_util_error ("%s", grub_errmsg);
+    }
+  printf ("%" PRIuGRUB_SIZE " directories, %" PRIuGRUB_SIZE " files\n",
+	  ctx.ndirs, ctx.nfiles);
+
+  /* Directory listings.  */
+  bench_start (&st);
+  for (round = 0; round < rounds; round++)
+    for (i = 0; i < ctx.ndirs; i++)
+      if (ctx.fs->dir (ctx.dev, ctx.dirs[i], bench_ls_hook, NULL))
+	grub_util_error ("%s", grub_errmsg);
+  bench_report ("ls", &st, (unsigned long) rounds * ctx.ndirs, 0);
+
+  /* Lookups: open and close every file.  */
+  bench_start (&st);
+  for (round = 0; round < rounds; round++)
+    for (i = 0; i < ctx.nfiles; i++)
+      {
+	grub_file_t file = bench_open (ctx.files[i]);
+
+	if (! ctx.largest || file->size > ctx.largest_size)
+	  {
+	    ctx.largest = ctx.files[i];
+	    ctx.largest_size = file->size;
+	  }
+	grub_file_close (file);
+      }
+  bench_report ("lookup", &st, (unsigned long) rounds * ctx.nfiles, 0);
+
+  /* Sequential reads of every file.  */
+  bytes = 0;
+  bench_start (&st);
+  for (round = 0; round < rounds; round++)
+    for (i = 0; i < ctx.nfiles; i++)
+      {
+	grub_file_t file = bench_open (ctx.files[i]);
+	grub_ssize_t r;
+
+	while ((r = grub_file_read (file, buf, BUF_SIZE)) > 0)
+	  bytes += r;
+	if (r < 0)
+	  grub_util_error (_("cannot read `%s': %s"), ctx.files[i],
+			   grub_errmsg);
+	grub_file_close (file);
+      }
+  bench_report ("read", &st, (unsigned long) rounds * ctx.nfiles, bytes);
+
+  /* Random 4 KiB reads in the largest file.  */
+  if (ctx.largest && ctx.largest_size)
+    {
+      grub_file_t file = bench_open (ctx.largest);
+      unsigned long ops = (unsigned long) rounds * 256;
+      unsigned long n;
+
+      bytes = 0;
+      bench_start (&st);
+      for (n = 0; n < ops; n++)
+	{
+	  grub_ssize_t r;
+
+	  seed = seed * 1103515245 + 12345;
+	  grub_file_seek (file, ((grub_uint64_t) seed << 12) % ctx.largest_size);
+	  r = grub_file_read (file, buf, 4096);
+	  if (r < 0)
+	    grub_util_error (_("cannot read `%s': %s"), ctx.largest,
+			     grub_errmsg);
+	  bytes += r;
+	}
+      bench_report ("random", &st, ops, bytes);
+      grub_file_close (file);
+    }
+
+  /* What search does: probe every device for its filesystem UUID.  */
+  ctx.ops = 0;
+  bench_start (&st);
+  for (round = 0; round < rounds; round++)
+    grub_device_iterate (bench_search_hook, &ctx);
+  bench_report ("search", &st, ctx.ops, 0);
+
+  for (i = 0; i < ctx.ndirs; i++)
+    free (ctx.dirs[i]);
+  for (i = 0; i < ctx.nfiles; i++)
+    free (ctx.files[i]);
+  free (ctx.dirs);
+  free (ctx.files);
+  grub_device_close (ctx.dev);
+}
+
 static const char *root = NULL;
 static int args_count = 0;
 static int nparm = 0;
@@ -450,6 +702,9 @@ fstest (int n)
     case CMD_CRC:
       cmd_crc (args[0]);
       break;
+    case CMD_BENCH:
+      cmd_bench (args[0], n > 1 ? grub_strtoul (args[1], NULL, 0) : 1);
+      break;
     case CMD_BLOCKLIST:
       execute_command ("blocklist", n, args);
       grub_printf ("\n");
@@ -512,6 +767,7 @@ static struct argp_option options[] = {
   {N_("crc FILE"), 0, 0     , OPTION_DOC, N_("Get crc32 checksum of FILE."), 1},
   {N_("blocklist FILE"), 0, 0, OPTION_DOC, N_("Display blocklist of FILE."), 1},
   {N_("xnu_uuid DEVICE"), 0, 0, OPTION_DOC, N_("Compute XNU UUID of the device."), 1},
+  {N_("bench PATH [ROUNDS]"), 0, 0, OPTION_DOC, N_("Measure filesystem performance on the tree at PATH."), 1},
   
   {"root",      'r', N_("DEVICE_NAME"), 0, N_("Set root device."),                 2},
   {"skip",      's', N_("NUM"),           0, N_("Skip N bytes from output file."),   2},
@@ -706,6 +962,11 @@ argp_parser (int key, char *arg, struct argp_state *state)
 	  cmd = CMD_XNU_UUID;
 	  nparm = 0;
 	}
+      else if (grub_strcmp (arg, "bench") == 0)
+	{
+	  cmd = CMD_BENCH;
+	  nparm = 1;
+	}
       else
 	{
 	  fprintf (stderr, _("Invalid command %s.\n"), arg);
@@ -73,6 +73,105 @@ grub_install_help_filter (int key, const char *text,
 
 static int (*compress_func) (const char *src, const char *dest) = NULL;
 char *grub_install_copy_buffer;
+static char *compare_buffer;
+
+/* Whether files A and B both exist and have the same contents.  */
+static int
+files_equal (const char *a, const char *b)
+{
+  grub_util_fd_t fa, fb;
+  ssize_t ra, rb;
+  int equal = 0;
+
+  fa = grub_util_fd_open (a, GRUB_UTIL_FD_O_RDONLY);
+  if (!GRUB_UTIL_FD_IS_VALID (fa))
+    return 0;
+  fb = grub_util_fd_open (b, GRUB_UTIL_FD_O_RDONLY);
+  if (!GRUB_UTIL_FD_IS_VALID (fb))
+    {
+      grub_util_fd_close (fa);
+      return 0;
+    }
+
+  if (!grub_install_copy_buffer)
+    grub_install_copy_buffer = xmalloc (GRUB_INSTALL_COPY_BUFFER_SIZE);
+  if (!compare_buffer)
+    compare_buffer = xmalloc (GRUB_INSTALL_COPY_BUFFER_SIZE);
+
+  while (1)
+    {
+      ra = grub_util_fd_read (fa, grub_install_copy_buffer,
+			      GRUB_INSTALL_COPY_BUFFER_SIZE);
+      rb = grub_util_fd_read (fb, compare_buffer,
+			      GRUB_INSTALL_COPY_BUFFER_SIZE);
+      if (ra < 0 || ra != rb
+	  || memcmp (grub_install_copy_buffer, compare_buffer, ra) != 0)
+	break;
+      if (ra == 0)
+	{
+	  equal = 1;
+	  break;
+	}
+    }
+
+  grub_util_fd_close (fa);
+  grub_util_fd_close (fb);
+  return equal;
+}
+
+/* Put NAMENEW, a freshly written version of NAME, in its place, unless
+   NAME already holds the same thing.  Either way NAMENEW is gone
+   afterwards.  */
+static void
+replace_file (const char *namenew, const char *name)
+{
+  if (files_equal (namenew, name))
+    {
+      grub_util_info ("`%s' is up to date", name);
+      grub_util_unlink (namenew);
+      return;
+    }
+
+  if (grub_util_rename (namenew, name) < 0)
+    grub_util_error (_("cannot rename the file %s to %s"), namenew, name);
+}
+
+/* Destinations written by grub_install_compress_file during this run.  */
+static char **installed_files;
+static size_t n_installed_files;
+static size_t alloc_installed_files;
+
+static void
+note_installed_file (const char *name)
+{
+  if (n_installed_files == alloc_installed_files)
+    {
+      alloc_installed_files = 2 * alloc_installed_files + 64;
+      installed_files = xrealloc (installed_files,
+				  alloc_installed_files
+				  * sizeof (installed_files[0]));
+    }
+  installed_files[n_installed_files++] = xstrdup (name);
+}
+
+static int
+compare_names (const void *a, const void *b)
+{
+  return strcmp (*(char *const *) a, *(char *const *) b);
+}
+
+static int
+was_installed (const char *name)
+{
+  return bsearch (&name, installed_files, n_installed_files,
+		  sizeof (installed_files[0]), compare_names) != NULL;
+}
+
+/* Compressed files waiting for the compressor batch to finish before
+   they can be put in place.  */
+static int compress_batch;
+static char **pending_new, **pending_names;
+static size_t n_pending, alloc_pending;
 
 int
 grub_install_copy_file (const char *src,
@@ -81,6 +180,7 @@ grub_install_copy_file (const char *src,
 {
   grub_util_fd_t in, out;  
   ssize_t r;
+  char *dstnew;
 
   grub_util_info ("copying `%s' -> `%s'", src, dst);
 
@@ -93,13 +193,25 @@ grub_install_copy_file (const char *src,
 	grub_util_info (_("cannot open `%s': %s"), src, grub_util_fd_strerror ());
       return 0;
     }
-  out = grub_util_fd_open (dst, GRUB_UTIL_FD_O_WRONLY
+
+  /* Leave files that are already right alone, rather than writing them
+     again, and never leave DST half written.  */
+  if (files_equal (src, dst))
+    {
+      grub_util_info ("`%s' is up to date", dst);
+      grub_util_fd_close (in);
+      return 1;
+    }
+
+  dstnew = xasprintf ("%s.new", dst);
+  out = grub_util_fd_open (dstnew, GRUB_UTIL_FD_O_WRONLY
 			   | GRUB_UTIL_FD_O_CREATTRUNC);
   if (!GRUB_UTIL_FD_IS_VALID (out))
     {
-      grub_util_error (_("cannot open `%s': %s"), dst,
+      grub_util_error (_("cannot open `%s': %s"), dstnew,
 		       grub_util_fd_strerror ());
       grub_util_fd_close (in);
+      free (dstnew);
       return 0;
     }
 
@@ -121,6 +233,10 @@ grub_install_copy_file (const char *src,
     grub_util_error (_("cannot copy `%s' to `%s': %s"),
 		     src, dst, grub_util_fd_strerror ());
 
+  if (grub_util_rename (dstnew, dst) < 0)
+    grub_util_error (_("cannot rename the file %s to %s"), dstnew, dst);
+  free (dstnew);
+
   return 1;
 }
 
@@ -135,16 +251,45 @@ grub_install_compress_file (const char *in_name,
     ret = grub_install_copy_file (in_name, out_name, is_needed);
   else
     {
+      char *out_new;
+
+      /* During a batch the compressor only fails once it is too late to
+	 tell, so look for optional files first.  */
+      if (!is_needed && !grub_util_is_regular (in_name))
+	return 0;
       grub_util_info ("compressing `%s' -> `%s'", in_name, out_name);
-      ret = !compress_func (in_name, out_name);
+      out_new = xasprintf ("%s.new", out_name);
+      grub_util_unlink (out_new);
+      ret = !compress_func (in_name, out_new);
       if (!ret && is_needed)
 	grub_util_warn (_("can't compress `%s' to `%s'"), in_name, out_name);
+      if (ret && compress_batch)
+	{
+	  if (n_pending == alloc_pending)
+	    {
+	      alloc_pending = 2 * alloc_pending + 64;
+	      pending_new = xrealloc (pending_new,
+				      alloc_pending * sizeof (pending_new[0]));
+	      pending_names = xrealloc (pending_names,
+					alloc_pending
+					* sizeof (pending_names[0]));
+	    }
+	  pending_new[n_pending] = out_new;
+	  pending_names[n_pending++] = xstrdup (out_name);
+	  out_new = NULL;
+	}
+      else if (ret)
+	replace_file (out_new, out_name);
+      free (out_new);
     }
 
   if (!ret && is_needed)
     grub_util_error (_("cannot copy `%s' to `%s': %s"),
 		     in_name, out_name, grub_util_fd_strerror ());
 
+  if (ret)
+    note_installed_file (out_name);
+
   return ret;
 }
 
@@ -179,8 +324,11 @@ grub_install_mkdir_p (const char *dst)
   free (t);
 }
 
+/* Remove what an earlier installation left in DI and this one did not
+   install again.  Images are kept if KEEP_IMAGES, as they are written
+   after the files are copied.  */
 static void
-clean_grub_dir (const char *di)
+clean_grub_dir (const char *di, int keep_images)
 {
   grub_util_fd_dir_t d;
   grub_util_fd_dirent_t de;
@@ -195,14 +343,14 @@ clean_grub_dir (const char *di)
       const char *ext = strrchr (de->d_name, '.');
       if ((ext && (strcmp (ext, ".mod") == 0
 		   || strcmp (ext, ".lst") == 0
-		   || strcmp (ext, ".img") == 0
+		   || (strcmp (ext, ".img") == 0 && !keep_images)
 		   || strcmp (ext, ".mo") == 0)
 	   && strcmp (de->d_name, "menu.lst") != 0)
 	  || strcmp (de->d_name, "efiemu32.o") == 0
 	  || strcmp (de->d_name, "efiemu64.o") == 0)
 	{
 	  char *x = grub_util_path_concat (2, di, de->d_name);
-	  if (grub_util_unlink (x) < 0)
+	  if (!was_installed (x) && grub_util_unlink (x) < 0)
 	    grub_util_error (_("cannot delete `%s': %s"), x,
 			     grub_util_fd_strerror ());
 	  free (x);
@@ -318,6 +466,8 @@ grub_install_parse (int key, char *arg)
 			   _("grub-mkimage is compiled without XZ support"));
 #endif
 	}
+      else if (grub_strcmp (arg, "lz4") == 0)
+	compression = GRUB_COMPRESSION_LZ4;
       else if (grub_strcmp (arg, "none") == 0)
 	compression = GRUB_COMPRESSION_NONE;
       else if (grub_strcmp (arg, "auto") == 0)
@@ -432,6 +582,7 @@ grub_install_make_image_wrap_file (const char *dir, const char *prefix,
       [GRUB_COMPRESSION_NONE] = "none",
       [GRUB_COMPRESSION_XZ] = "xz",
       [GRUB_COMPRESSION_LZMA] = "lzma",
+      [GRUB_COMPRESSION_LZ4] = "lz4",
     };
   grub_size_t slen = 1;
   char *s, *p;
@@ -497,7 +648,7 @@ grub_install_make_image_wrap_file (const char *dir, const char *prefix,
     grub_util_error (_("unknown target format %s"), mkimage_target);
 
   grub_install_generate_image (dir, prefix, fp, outname,
-			       modules.entries, memdisk_path,
+			       modules.entries, NULL, 0, memdisk_path,
 			       pubkeys, npubkeys, config_path, tgt,
 			       note, compression);
   while (dc--)
@@ -511,16 +662,21 @@ grub_install_make_image_wrap (const char *dir, const char *prefix,
 			      const char *mkimage_target, int note)
 {
   FILE *fp;
+  char *outnew;
 
-  fp = grub_util_fopen (outname, "wb");
+  /* Keep the old image if the new one comes out the same.  */
+  outnew = xasprintf ("%s.new", outname);
+  fp = grub_util_fopen (outnew, "wb");
   if (! fp)
-    grub_util_error (_("cannot open `%s': %s"), outname,
+    grub_util_error (_("cannot open `%s': %s"), outnew,
 		     strerror (errno));
   grub_install_make_image_wrap_file (dir, prefix, fp, outname,
 				     memdisk_path, config_path,
 				     mkimage_target, note);
   grub_util_file_sync (fp);
   fclose (fp);
+  replace_file (outnew, outname);
+  free (outnew);
 }
 
 static void
@@ -738,9 +894,12 @@ grub_install_copy_files (const char *src,
   dst_fonts = grub_util_path_concat (2, dst, "fonts");
   grub_install_mkdir_p (dst_platform);
   grub_install_mkdir_p (dst_locale);
-  clean_grub_dir (dst);
-  clean_grub_dir (dst_platform);
-  clean_grub_dir (dst_locale);
+
+  if (compress_func)
+    {
+      grub_install_compress_begin_batch ();
+      compress_batch = 1;
+    }
 
   if (install_modules.is_default)
     copy_by_ext (src, dst_platform, ".mod", 1);
@@ -892,6 +1051,27 @@ grub_install_copy_files (const char *src,
       free (dstf);
     }
 
+  if (compress_func)
+    {
+      size_t j;
+
+      grub_install_compress_end_batch ();
+      compress_batch = 0;
+      for (j = 0; j < n_pending; j++)
+	{
+	  replace_file (pending_new[j], pending_names[j]);
+	  free (pending_new[j]);
+	  free (pending_names[j]);
+	}
+      n_pending = 0;
+    }
+
+  qsort (installed_files, n_installed_files, sizeof (installed_files[0]),
+	 compare_names);
+  clean_grub_dir (dst, 0);
+  clean_grub_dir (dst_platform, 1);
+  clean_grub_dir (dst_locale, 0);
+
   free (dst_platform);
   free (dst_locale);
   free (dst_fonts);
@@ -63,10 +63,19 @@
 #define grub_util_fopen fopen
 #endif
 
+#if defined (HAVE_PTHREAD) && !defined (GRUB_BUILD)
+#define GRUB_MKFONT_THREADS 1
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
 #define GRUB_FONT_DEFAULT_SIZE		16
 
 #define GRUB_FONT_RANGE_BLOCK		1024
 
+/* Number of code points a rendering thread takes at once.  */
+#define GRUB_FONT_RENDER_BATCH		256
+
 struct grub_glyph_info
 {
   struct grub_glyph_info *next;
@@ -90,7 +99,8 @@ enum
     GRUB_FONT_FLAG_BOLD	= 1,
     GRUB_FONT_FLAG_NOBITMAP = 2,
     GRUB_FONT_FLAG_NOHINTING = 4,
-    GRUB_FONT_FLAG_FORCEHINT = 8
+    GRUB_FONT_FLAG_FORCEHINT = 8,
+    GRUB_FONT_FLAG_RANGE_INDEX = 16
   };
 
 struct grub_font_info
@@ -113,6 +123,7 @@ struct grub_font_info
 };
 
 static int font_verbosity;
+static int font_jobs = 1;
 
 static void
 add_pixel (grub_uint8_t **data, int *mask, int not_blank)
@@ -588,10 +599,154 @@ process_cursive (struct gsub_feature *feature,
 }
 
 static void
-add_font (struct grub_font_info *font_info, FT_Face face, int nocut)
+add_code (grub_uint32_t **codes, size_t *num_codes, size_t *max_codes,
+	  grub_uint32_t char_code)
+{
+  if (*num_codes == *max_codes)
+    {
+      *max_codes = *max_codes ? *max_codes * 2 : GRUB_FONT_RENDER_BATCH;
+      *codes = xrealloc (*codes, *max_codes * sizeof ((*codes)[0]));
+    }
+  (*codes)[(*num_codes)++] = char_code;
+}
+
+#ifdef GRUB_MKFONT_THREADS
+
+/* Glyphs are rasterised by a pool of worker threads, each with its own
+   FreeType instance since a library handle and the faces opened from it
+   must not be used by several threads at once.  The workers take batches
+   of code points off a shared counter and render each batch into a font
+   of its own, and the batches are merged in order afterwards so that the
+   output is the same as when rendering on one thread.  */
+struct render_pool
+{
+  const struct grub_font_info *font_info;
+  const char *file;
+  int font_index;
+  int nocut;
+  const grub_uint32_t *codes;
+  size_t num_codes;
+  size_t num_batches;
+  size_t next_batch;
+  struct grub_font_info *batches;
+  pthread_mutex_t lock;
+};
+
+static void *
+render_worker (void *data)
+{
+  struct render_pool *pool = data;
+  FT_Library ft_lib;
+  FT_Face face;
+
+  if (FT_Init_FreeType (&ft_lib))
+    grub_util_error ("%s", _("FT_Init_FreeType fails"));
+  if (FT_New_Face (ft_lib, pool->file, pool->font_index, &face)
+      || FT_Set_Pixel_Sizes (face, pool->font_info->size,
+			     pool->font_info->size))
+    grub_util_error (_("can't open file %s, index %d"), pool->file,
+		     pool->font_index);
+
+  while (1)
+    {
+      struct grub_font_info *batch;
+      size_t n, end;
+
+      pthread_mutex_lock (&pool->lock);
+      n = pool->next_batch++;
+      pthread_mutex_unlock (&pool->lock);
+      if (n >= pool->num_batches)
+	break;
+
+      batch = &pool->batches[n];
+      end = (n + 1) * GRUB_FONT_RENDER_BATCH;
+      if (end > pool->num_codes)
+	end = pool->num_codes;
+      for (n *= GRUB_FONT_RENDER_BATCH; n < end; n++)
+	add_char (batch, face, pool->codes[n], pool->nocut);
+    }
+
+  FT_Done_Face (face);
+  FT_Done_FreeType (ft_lib);
+  return NULL;
+}
+
+static void
+render_parallel (struct grub_font_info *font_info, const char *file,
+		 int font_index, const grub_uint32_t *codes, size_t num_codes,
+		 int nocut)
+{
+  struct render_pool pool;
+  pthread_t *threads;
+  size_t i;
+  int nthreads;
+
+  pool.font_info = font_info;
+  pool.file = file;
+  pool.font_index = font_index;
+  pool.nocut = nocut;
+  pool.codes = codes;
+  pool.num_codes = num_codes;
+  pool.num_batches = (num_codes + GRUB_FONT_RENDER_BATCH - 1)
+    / GRUB_FONT_RENDER_BATCH;
+  pool.next_batch = 0;
+  pool.batches = xmalloc (pool.num_batches * sizeof (pool.batches[0]));
+  for (i = 0; i < pool.num_batches; i++)
+    {
+      pool.batches[i] = *font_info;
+      pool.batches[i].glyphs_unsorted = NULL;
+      pool.batches[i].num_glyphs = 0;
+    }
+  pthread_mutex_init (&pool.lock, NULL);
+
+  nthreads = font_jobs;
+  if ((size_t) nthreads > pool.num_batches)
+    nthreads = pool.num_batches;
+  threads = xmalloc (nthreads * sizeof (threads[0]));
+  for (i = 0; i < (size_t) nthreads; i++)
+    if (pthread_create (&threads[i], NULL, render_worker, &pool))
+      grub_util_error ("%s", _("cannot create rendering thread"));
+  for (i = 0; i < (size_t) nthreads; i++)
+    pthread_join (threads[i], NULL);
+  free (threads);
+  pthread_mutex_destroy (&pool.lock);
+
+  /* Each batch lists its glyphs last first, like add_glyph does, so put
+     the batches in front of each other in order.  */
+  for (i = 0; i < pool.num_batches; i++)
+    {
+      struct grub_font_info *batch = &pool.batches[i];
+      struct grub_glyph_info *last;
+
+      if (batch->max_width > font_info->max_width)
+	font_info->max_width = batch->max_width;
+      if (batch->max_height > font_info->max_height)
+	font_info->max_height = batch->max_height;
+      if (batch->min_y < font_info->min_y)
+	font_info->min_y = batch->min_y;
+      if (batch->max_y > font_info->max_y)
+	font_info->max_y = batch->max_y;
+
+      if (!batch->glyphs_unsorted)
+	continue;
+      for (last = batch->glyphs_unsorted; last->next; last = last->next);
+      last->next = font_info->glyphs_unsorted;
+      font_info->glyphs_unsorted = batch->glyphs_unsorted;
+      font_info->num_glyphs += batch->num_glyphs;
+    }
+  free (pool.batches);
+}
+
+#endif
+
+static void
+add_font (struct grub_font_info *font_info, FT_Face face, const char *file,
+	  int font_index, int nocut)
 {
   struct gsub_header *gsub = NULL;
   FT_ULong gsub_len = 0;
+  grub_uint32_t *codes = NULL;
+  size_t num_codes = 0, max_codes = 0;
 
   if (!FT_Load_Sfnt_Table (face, TTAG_GSUB, 0, NULL, &gsub_len))
     {
@@ -660,25 +815,53 @@ add_font (struct grub_font_info *font_info, FT_Face face, int nocut)
 	}
     }
 
+  /* Only the code points the font has a glyph for are rendered, so rather
+     than probing every code point of the ranges walk the character map.  */
   if (font_info->num_range)
     {
       int i;
-      grub_uint32_t j;
 
       for (i = 0; i < font_info->num_range; i++)
-	for (j = font_info->ranges[i * 2]; j <= font_info->ranges[i * 2 + 1];
-	     j++)
-	  add_char (font_info, face, j, nocut);
+	{
+	  grub_uint32_t from = font_info->ranges[i * 2];
+	  grub_uint32_t to = font_info->ranges[i * 2 + 1];
+	  grub_uint32_t char_code;
+	  FT_UInt glyph_index;
+
+	  if (from > to)
+	    continue;
+	  if (FT_Get_Char_Index (face, from))
+	    add_code (&codes, &num_codes, &max_codes, from);
+	  for (char_code = FT_Get_Next_Char (face, from, &glyph_index);
+	       glyph_index && char_code > from && char_code <= to;
+	       char_code = FT_Get_Next_Char (face, char_code, &glyph_index))
+	    add_code (&codes, &num_codes, &max_codes, char_code);
+	}
     }
   else
     {
-      grub_uint32_t char_code, glyph_index;
+      grub_uint32_t char_code;
+      FT_UInt glyph_index;
 
       for (char_code = FT_Get_First_Char (face, &glyph_index);
 	   glyph_index;
 	   char_code = FT_Get_Next_Char (face, char_code, &glyph_index))
-	add_char (font_info, face, char_code, nocut);
+	add_code (&codes, &num_codes, &max_codes, char_code);
     }
+
+#ifdef GRUB_MKFONT_THREADS
+  if (font_jobs > 1 && num_codes > GRUB_FONT_RENDER_BATCH)
+    render_parallel (font_info, file, font_index, codes, num_codes, nocut);
+  else
+#endif
+    {
+      size_t i;
+
+      for (i = 0; i < num_codes; i++)
+	add_char (font_info, face, codes[i], nocut);
+    }
+
+  free (codes);
 }
 
 static void
@@ -713,6 +896,76 @@ write_be16_section (const char *name, grub_uint16_t data, int* offset,
   *offset += 10;
 }
 
+/* Write the CHRG section: the runs of consecutive code points, then the
+   offset of the first glyph and the length of each glyph, from which
+   GRUB works out the glyph offsets instead of reading them from CHIX.
+   It goes right before CHIX, so the glyphs start after both sections.  */
+static void
+write_range_index (struct grub_font_info *font_info, int *offset,
+		   FILE *file, const char *filename)
+{
+  struct grub_glyph_info *cur;
+  grub_uint32_t num_runs, leng, data32;
+  grub_uint16_t data16;
+
+  if (font_info->num_glyphs == 0)
+    return;
+
+  num_runs = 0;
+  for (cur = font_info->glyphs_sorted;
+       cur < font_info->glyphs_sorted + font_info->num_glyphs; cur++)
+    {
+      if (10 + cur->bitmap_size > 0xffff)
+	{
+	  fprintf (stderr, _("WARNING: glyph U+%04x is too big for the range "
+			     "index, not adding it\n"), cur->char_code);
+	  return;
+	}
+      if (cur == font_info->glyphs_sorted
+	  || cur->char_code != cur[-1].char_code + 1)
+	num_runs++;
+    }
+
+  leng = 8 + num_runs * 8 + font_info->num_glyphs * 2;
+  if (font_verbosity > 0)
+    printf ("Number of character ranges: %d\n", num_runs);
+
+  grub_util_write_image (FONT_FORMAT_SECTION_NAMES_CHAR_RANGES,
+			 sizeof(FONT_FORMAT_SECTION_NAMES_CHAR_RANGES) - 1,
+			 file, filename);
+  data32 = grub_cpu_to_be32 (leng);
+  grub_util_write_image ((char *) &data32, 4, file, filename);
+  data32 = grub_cpu_to_be32 (num_runs);
+  grub_util_write_image ((char *) &data32, 4, file, filename);
+  *offset += 8 + leng;
+
+  for (cur = font_info->glyphs_sorted;
+       cur < font_info->glyphs_sorted + font_info->num_glyphs; )
+    {
+      struct grub_glyph_info *end;
+
+      for (end = cur + 1;
+	   end < font_info->glyphs_sorted + font_info->num_glyphs
+	     && end->char_code == end[-1].char_code + 1; end++);
+      data32 = grub_cpu_to_be32 (cur->char_code);
+      grub_util_write_image ((char *) &data32, 4, file, filename);
+      data32 = grub_cpu_to_be32 (end - cur);
+      grub_util_write_image ((char *) &data32, 4, file, filename);
+      cur = end;
+    }
+
+  /* The CHIX and DATA section headers and CHIX itself come in between.  */
+  data32 = grub_cpu_to_be32 (*offset + 8 + font_info->num_glyphs * 9 + 8);
+  grub_util_write_image ((char *) &data32, 4, file, filename);
+
+  for (cur = font_info->glyphs_sorted;
+       cur < font_info->glyphs_sorted + font_info->num_glyphs; cur++)
+    {
+      data16 = grub_cpu_to_be16 (10 + cur->bitmap_size);
+      grub_util_write_image ((char *) &data16, 2, file, filename);
+    }
+}
+
 static void
 print_glyphs (struct grub_font_info *font_info)
 {
@@ -886,6 +1139,9 @@ write_font_pf2 (struct grub_font_info *font_info, char *output_file)
   if (font_verbosity > 0)
     printf ("Number of glyph: %d\n", font_info->num_glyphs);
 
+  if (font_info->flags & GRUB_FONT_FLAG_RANGE_INDEX)
+    write_range_index (font_info, &offset, file, output_file);
+
   leng = grub_cpu_to_be32 (font_info->num_glyphs * 9);
   grub_util_write_image (FONT_FORMAT_SECTION_NAMES_CHAR_INDEX,
   			 sizeof(FONT_FORMAT_SECTION_NAMES_CHAR_INDEX) - 1,
@@ -962,6 +1218,12 @@ static struct argp_option options[] = {
       pre-rendered bitmap is available.
     */
    N_("ignore bitmap strikes when loading"), 0},
+  {"range-index",  0x102, 0, 0,
+   /* TRANSLATORS: the index maps characters to glyphs. This option adds
+      a smaller copy of it which GRUB loads faster.  */
+   N_("add a compact range-encoded character index"), 0},
+  {"jobs",  'j', N_("NUM"), 0,
+   N_("render glyphs with NUM threads [default=number of processors]"), 0},
   {"verbose",  'v', 0, 0, N_("print verbose messages."), 0},
   { 0, 0, 0, 0, 0, 0 }
 };
@@ -1002,7 +1264,7 @@ static int
 has_argument (int v)
 {
   return v =='o' || v == 'i' || v == 'r' || v == 'n' || v == 's'
-    || v == 'd' || v == 'c';
+    || v == 'd' || v == 'c' || v == 'j';
 }
 
 #endif
@@ -1032,6 +1294,16 @@ argp_parser (int key, char *arg, struct my_argp_state *state)
       arguments->font_info.flags |= GRUB_FONT_FLAG_FORCEHINT;
       break;
 
+    case 0x102:
+      arguments->font_info.flags |= GRUB_FONT_FLAG_RANGE_INDEX;
+      break;
+
+    case 'j':
+      font_jobs = strtoul (arg, NULL, 0);
+      if (font_jobs < 1)
+	font_jobs = 1;
+      break;
+
     case 'o':
       arguments->output_file = xstrdup (arg);
       break;
@@ -1167,6 +1439,12 @@ main (int argc, char *argv[])
   grub_util_host_init (&argc, &argv);
 #endif
 
+#if defined (GRUB_MKFONT_THREADS) && defined (_SC_NPROCESSORS_ONLN)
+  font_jobs = sysconf (_SC_NPROCESSORS_ONLN);
+  if (font_jobs < 1)
+    font_jobs = 1;
+#endif
+
   memset (&arguments, 0, sizeof (struct arguments));
   arguments.file_format = PF2;
   arguments.files_max = argc + 1;
@@ -1233,7 +1511,8 @@ main (int argc, char *argv[])
 			   size, size, err,
 			   (err > 0 && err < (signed) ARRAY_SIZE (ft_errmsgs))
 			   ? ft_errmsgs[err] : "");
-	add_font (&arguments.font_info, ft_face, arguments.file_format != PF2);
+	add_font (&arguments.font_info, ft_face, arguments.files[i],
+		  arguments.font_index, arguments.file_format != PF2);
 	FT_Done_Face (ft_face);
       }
   }
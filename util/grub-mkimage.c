@@ -79,7 +79,10 @@ static struct argp_option options[] = {
   {"note",   'n', 0, 0, N_("add NOTE segment for CHRP IEEE1275"), 0},
   {"output",  'o', N_("FILE"), 0, N_("output a generated image to FILE [default=stdout]"), 0},
   {"format",  'O', N_("FORMAT"), 0, 0, 0},
-  {"compression",  'C', "(xz|none|auto)", 0, N_("choose the compression to use for core image"), 0},
+  {"compression",  'C', "(xz|lz4|none|auto)", 0, N_("choose the compression to use for core image"), 0},
+  {"compress-modules", 'M', 0, 0, N_("store the embedded modules LZ4-compressed"), 0},
+  {"lazy-module",  'L', N_("MODULE"), 0,
+   N_("embed MODULE compressed and only load it when it is needed"), 0},
   {"verbose",     'v', 0,      0, N_("print verbose messages."), 0},
   { 0, 0, 0, 0, 0, 0 }
 };
@@ -113,6 +116,9 @@ struct arguments
   size_t nmodules;
   size_t modules_max;
   char **modules;
+  char **lazy_modules;
+  size_t nlazy_modules;
+  int compress_modules;
   char *output;
   char *dir;
   char *prefix;
@@ -183,6 +189,18 @@ argp_parser (int key, char *arg, struct argp_state *state)
       arguments->pubkeys[arguments->npubkeys++] = xstrdup (arg);
       break;
 
+    case 'M':
+      arguments->compress_modules = 1;
+      break;
+
+    case 'L':
+      arguments->lazy_modules = xrealloc (arguments->lazy_modules,
+					  sizeof (arguments->lazy_modules[0])
+					  * (arguments->nlazy_modules + 2));
+      arguments->lazy_modules[arguments->nlazy_modules++] = xstrdup (arg);
+      arguments->lazy_modules[arguments->nlazy_modules] = NULL;
+      break;
+
     case 'c':
       if (arguments->config)
 	free (arguments->config);
@@ -200,6 +218,8 @@ argp_parser (int key, char *arg, struct argp_state *state)
 			   _("grub-mkimage is compiled without XZ support"));
 #endif
 	}
+      else if (grub_strcmp (arg, "lz4") == 0)
+	arguments->comp = GRUB_COMPRESSION_LZ4;
       else if (grub_strcmp (arg, "none") == 0)
 	arguments->comp = GRUB_COMPRESSION_NONE;
       else if (grub_strcmp (arg, "auto") == 0)
@@ -296,7 +316,8 @@ main (int argc, char *argv[])
 
   grub_install_generate_image (arguments.dir, arguments.prefix, fp,
 			       arguments.output, arguments.modules,
-			       arguments.memdisk, arguments.pubkeys,
+			       arguments.lazy_modules,
+			       arguments.compress_modules, arguments.memdisk, arguments.pubkeys,
 			       arguments.npubkeys, arguments.config,
 			       arguments.image_target, arguments.note,
 			       arguments.comp);
@@ -121,6 +121,62 @@ translate_error (void)
   return ret;
 }
 
+/* The image is mounted read-only, so what fuse_getattr finds out about
+   a path stays true.  Finding it out means a directory walk and opening
+   the file, so keep it.  */
+#define STAT_CACHE_BUCKETS 4096
+
+struct stat_cache_entry
+{
+  struct stat_cache_entry *next;
+  char *path;
+  /* 0 or the negated errno fuse_getattr returns.  */
+  int ret;
+  struct stat st;
+};
+
+static struct stat_cache_entry *stat_cache[STAT_CACHE_BUCKETS];
+
+static unsigned
+stat_cache_hash (const char *path)
+{
+  unsigned h = 2166136261U;
+
+  for (; *path; path++)
+    h = (h ^ (unsigned char) *path) * 16777619U;
+  return h % STAT_CACHE_BUCKETS;
+}
+
+static struct stat_cache_entry *
+stat_cache_find (const char *path)
+{
+  struct stat_cache_entry *entry;
+
+  for (entry = stat_cache[stat_cache_hash (path)]; entry; entry = entry->next)
+    if (strcmp (entry->path, path) == 0)
+      return entry;
+  return NULL;
+}
+
+static void
+stat_cache_add (const char *path, int ret, const struct stat *st)
+{
+  struct stat_cache_entry *entry;
+  unsigned h;
+
+  if (stat_cache_find (path))
+    return;
+
+  h = stat_cache_hash (path);
+  entry = xmalloc (sizeof (*entry));
+  entry->path = xstrdup (path);
+  entry->ret = ret;
+  if (st)
+    entry->st = *st;
+  entry->next = stat_cache[h];
+  stat_cache[h] = entry;
+}
+
 /* Context for fuse_getattr.  */
 struct fuse_getattr_ctx
 {
@@ -147,7 +203,7 @@ fuse_getattr_find_file (const char *cur_filename,
 }
 
 static int
-fuse_getattr (const char *path, struct stat *st)
+fuse_getattr_real (const char *path, struct stat *st)
 {
   struct fuse_getattr_ctx ctx;
   char *pathname, *path2;
@@ -199,9 +255,11 @@ fuse_getattr (const char *path, struct stat *st)
   (fs->dir) (dev, path2, fuse_getattr_find_file, &ctx);
 
   grub_free (path2);
+  free (pathname);
   if (!ctx.file_exists)
     {
       grub_errno = GRUB_ERR_NONE;
+      stat_cache_add (path, -ENOENT, NULL);
       return -ENOENT;
     }
   st->st_dev = 0;
@@ -233,9 +291,24 @@ fuse_getattr (const char *path, struct stat *st)
   st->st_atime = st->st_mtime = st->st_ctime = ctx.file_info.mtimeset
     ? ctx.file_info.mtime : 0;
   grub_errno = GRUB_ERR_NONE;
+  stat_cache_add (path, 0, st);
   return 0;
 }
 
+static int
+fuse_getattr (const char *path, struct stat *st)
+{
+  struct stat_cache_entry *entry;
+
+  entry = stat_cache_find (path);
+  if (!entry)
+    return fuse_getattr_real (path, st);
+
+  if (entry->ret == 0)
+    *st = entry->st;
+  return entry->ret;
+}
+
 static int
 fuse_opendir (const char *path, struct fuse_file_info *fi) 
 {
@@ -243,9 +316,6 @@ fuse_opendir (const char *path, struct fuse_file_info *fi)
 }
 
 /* FIXME */
-static grub_file_t files[65536];
-static int first_fd = 1;
-
 static int 
 fuse_open (const char *path, struct fuse_file_info *fi __attribute__ ((unused)))
 {
@@ -253,9 +323,7 @@ fuse_open (const char *path, struct fuse_file_info *fi __attribute__ ((unused)))
   file = grub_file_open (path);
   if (! file)
     return translate_error ();
-  files[first_fd++] = file;
-  fi->fh = first_fd;
-  files[first_fd++] = file;
+  fi->fh = (grub_addr_t) file;
   grub_errno = GRUB_ERR_NONE;
   return 0;
 } 
@@ -264,7 +332,7 @@ static int
 fuse_read (const char *path, char *buf, size_t sz, off_t off,
 	   struct fuse_file_info *fi)
 {
-  grub_file_t file = files[fi->fh];
+  grub_file_t file = (grub_file_t) (grub_addr_t) fi->fh;
   grub_ssize_t size;
 
   if (off > file->size)
@@ -285,8 +353,7 @@ fuse_read (const char *path, char *buf, size_t sz, off_t off,
 static int 
 fuse_release (const char *path, struct fuse_file_info *fi)
 {
-  grub_file_close (files[fi->fh]);
-  files[fi->fh] = NULL;
+  grub_file_close ((grub_file_t) (grub_addr_t) fi->fh);
   grub_errno = GRUB_ERR_NONE;
   return 0;
 }
@@ -306,16 +373,20 @@ fuse_readdir_call_fill (const char *filename,
 {
   struct fuse_readdir_ctx *ctx = data;
   struct stat st;
+  char *tmp;
+  int known = 1;
+
+  if (ctx->path[0] && ctx->path[strlen (ctx->path) - 1] == '/')
+    tmp = xasprintf ("%s%s", ctx->path, filename);
+  else
+    tmp = xasprintf ("%s/%s", ctx->path, filename);
 
   grub_memset (&st, 0, sizeof (st));
   st.st_mode = info->dir ? (0555 | S_IFDIR) : (0444 | S_IFREG);
   if (!info->dir)
     {
       grub_file_t file;
-      char *tmp;
-      tmp = xasprintf ("%s/%s", ctx->path, filename);
       file = grub_file_open (tmp);
-      free (tmp);
       /* Symlink to directory.  */
       if (! file && grub_errno == GRUB_ERR_BAD_FILE_TYPE)
 	{
@@ -325,6 +396,7 @@ fuse_readdir_call_fill (const char *filename,
       else if (!file)
 	{
 	  grub_errno = GRUB_ERR_NONE;
+	  known = 0;
 	}
       else
 	{
@@ -336,6 +408,10 @@ fuse_readdir_call_fill (const char *filename,
   st.st_blocks = (st.st_size + 511) >> 9;
   st.st_atime = st.st_mtime = st.st_ctime
     = info->mtimeset ? info->mtime : 0;
+  /* Saves the lookup that usually comes for every entry listed.  */
+  if (known)
+    stat_cache_add (tmp, 0, &st);
+  free (tmp);
   ctx->fill (ctx->buf, filename, &st, 0);
   return 0;
 }
@@ -252,25 +252,71 @@ probe_abstraction (grub_disk_t disk, char delim)
     printf ("raid6rec%c", delim);
 }
 
-static void
-probe (const char *path, char **device_names, char delim)
+static char **
+get_devices (const char *path)
 {
-  char **drives_names = NULL;
+  char **device_names;
+  char *grub_path;
+
+  grub_path = grub_canonicalize_file_name (path);
+  if (! grub_path)
+    grub_util_error (_("failed to get canonical path of `%s'"), path);
+  device_names = grub_guess_root_devices (grub_path);
+  free (grub_path);
+
+  if (! device_names)
+    grub_util_error (_("cannot find a device for %s (is /dev mounted?)"), path);
+
+  return device_names;
+}
+
+static char **
+get_drives (char **device_names)
+{
+  char **drives_names;
   char **curdev, **curdrive;
-  char *grub_path = NULL;
   int ndev = 0;
 
-  if (path != NULL)
+  for (curdev = device_names; *curdev; curdev++)
     {
-      grub_path = grub_canonicalize_file_name (path);
-      if (! grub_path)
-	grub_util_error (_("failed to get canonical path of `%s'"), path);
-      device_names = grub_guess_root_devices (grub_path);
-      free (grub_path);
+      grub_util_pull_device (*curdev);
+      ndev++;
     }
+  
+  drives_names = xmalloc (sizeof (drives_names[0]) * (ndev + 1)); 
 
-  if (! device_names)
-    grub_util_error (_("cannot find a device for %s (is /dev mounted?)"), path);
+  for (curdev = device_names, curdrive = drives_names; *curdev; curdev++,
+       curdrive++)
+    {
+      *curdrive = grub_util_get_grub_dev (*curdev);
+      if (! *curdrive)
+	grub_util_error (_("cannot find a GRUB drive for %s.  Check your device.map"),
+			 *curdev);
+    }
+  *curdrive = 0;
+
+  return drives_names;
+}
+
+static void
+free_drives (char **drives_names)
+{
+  char **curdrive;
+
+  if (! drives_names)
+    return;
+  for (curdrive = drives_names; *curdrive; curdrive++)
+    free (*curdrive);
+  free (drives_names);
+}
+
+/* Print the current target for DEVICE_NAMES.  *DRIVES_CACHE keeps their
+   GRUB names across targets; it is filled in when first needed.  */
+static void
+probe (char **device_names, char ***drives_cache, char delim)
+{
+  char **drives_names;
+  char **curdev, **curdrive;
 
   if (print == PRINT_DEVICE)
     {
@@ -300,23 +346,9 @@ probe (const char *path, char **device_names, char delim)
       return;
     }
 
-  for (curdev = device_names; *curdev; curdev++)
-    {
-      grub_util_pull_device (*curdev);
-      ndev++;
-    }
-  
-  drives_names = xmalloc (sizeof (drives_names[0]) * (ndev + 1)); 
-
-  for (curdev = device_names, curdrive = drives_names; *curdev; curdev++,
-       curdrive++)
-    {
-      *curdrive = grub_util_get_grub_dev (*curdev);
-      if (! *curdrive)
-	grub_util_error (_("cannot find a GRUB drive for %s.  Check your device.map"),
-			 *curdev);
-    }
-  *curdrive = 0;
+  if (! *drives_cache)
+    *drives_cache = get_drives (device_names);
+  drives_names = *drives_cache;
 
   if (print == PRINT_DRIVE)
     {
@@ -325,7 +357,7 @@ probe (const char *path, char **device_names, char delim)
 	  printf ("(%s)", *curdrive);
 	  putchar (delim);
 	}
-      goto end;
+      return;
     }
 
   if (print == PRINT_ZERO_CHECK)
@@ -358,7 +390,7 @@ probe (const char *path, char **device_names, char delim)
 		  {
 		    grub_printf ("false\n");
 		    grub_device_close (dev);
-		    goto end;
+		    return;
 		  }
 	    }
 
@@ -413,7 +445,7 @@ probe (const char *path, char **device_names, char delim)
 	  putchar (delim);
 	}
       grub_device_close (dev);
-      goto end;
+      return;
     }
 
   for (curdrive = drives_names, curdev = device_names; *curdrive;
@@ -663,11 +695,6 @@ probe (const char *path, char **device_names, char delim)
 
       grub_device_close (dev);
     }
-
- end:
-  for (curdrive = drives_names; *curdrive; curdrive++)
-    free (*curdrive);
-  free (drives_names);
 }
 
 static struct argp_option options[] = {
@@ -718,6 +745,8 @@ struct arguments
   size_t ndevices;
   char *dev_map;
   int zero_delim;
+  int prints[ARRAY_SIZE (targets)];
+  size_t nprints;
 };
 
 static error_t
@@ -747,7 +776,14 @@ argp_parser (int key, char *arg, struct argp_state *state)
 	for (i = PRINT_FS; i < ARRAY_SIZE (targets); i++)
 	  if (strcmp (arg, targets[i]) == 0)
 	    {
+	      size_t j;
+
 	      print = i;
+	      for (j = 0; j < arguments->nprints; j++)
+		if (arguments->prints[j] == i)
+		  break;
+	      if (j == arguments->nprints)
+		arguments->prints[arguments->nprints++] = i;
 	      break;
 	    }
 	if (i == ARRAY_SIZE (targets))
@@ -780,17 +816,52 @@ argp_parser (int key, char *arg, struct argp_state *state)
 }
 
 static struct argp argp = {
-  options, argp_parser, N_("[OPTION]... [PATH|DEVICE]"),
+  options, argp_parser, N_("[OPTION]... [PATH...|DEVICE...]"),
   N_("\
-Probe device information for a given path (or device, if the -d option is given)."),
+Probe device information for a given path (or device, if the -d option is given).\v\
+With several paths or several --target options, every target is printed for \
+every path, in that order, and each answer is followed by an empty item."),
   NULL, help_filter, NULL
 };
 
+/* Print every requested target for DEVICE_NAMES.  */
+static void
+probe_all (char **device_names, struct arguments *arguments, int batch)
+{
+  char **drives_names = NULL;
+  size_t i;
+  char delim;
+
+  for (i = 0; i < arguments->nprints; i++)
+    {
+      print = arguments->prints[i];
+
+      if (print == PRINT_BIOS_HINT
+	  || print == PRINT_IEEE1275_HINT || print == PRINT_BAREMETAL_HINT
+	  || print == PRINT_EFI_HINT || print == PRINT_ARC_HINT)
+	delim = ' ';
+      else
+	delim = '\n';
+
+      if (arguments->zero_delim)
+	delim = '\0';
+
+      probe (device_names, &drives_names, delim);
+
+      if (delim == ' ')
+	putchar ('\n');
+      if (batch)
+	putchar (arguments->zero_delim ? '\0' : '\n');
+    }
+
+  free_drives (drives_names);
+}
+
 int
 main (int argc, char *argv[])
 {
-  char delim;
   struct arguments arguments;
+  int batch;
 
   grub_util_host_init (&argc, &argv);
 
@@ -811,16 +882,13 @@ main (int argc, char *argv[])
   if (verbosity > 1)
     grub_env_set ("debug", "all");
 
-  /* Obtain ARGUMENT.  */
-  if (arguments.ndevices != 1 && !argument_is_device)
-    {
-      char *program = xstrdup(program_name);
-      fprintf (stderr, _("Unknown extra argument `%s'."), arguments.devices[1]);
-      fprintf (stderr, "\n");
-      argp_help (&argp, stderr, ARGP_HELP_STD_USAGE, program);
-      free (program);
-      exit(1);
-    }
+  if (arguments.nprints == 0)
+    arguments.prints[arguments.nprints++] = print;
+
+  /* Several devices are the parts of one filesystem, but several paths are
+     separate queries.  */
+  batch = (arguments.nprints > 1
+	   || (arguments.ndevices > 1 && !argument_is_device));
 
   /* Initialize the emulated biosdisk driver.  */
   grub_util_biosdisk_init (arguments.dev_map ? : DEFAULT_DEVICE_MAP);
@@ -838,24 +906,17 @@ main (int argc, char *argv[])
   grub_mdraid1x_init ();
   grub_lvm_init ();
 
-  if (print == PRINT_BIOS_HINT
-      || print == PRINT_IEEE1275_HINT || print == PRINT_BAREMETAL_HINT
-      || print == PRINT_EFI_HINT || print == PRINT_ARC_HINT)
-    delim = ' ';
-  else
-    delim = '\n';
-
-  if (arguments.zero_delim)
-    delim = '\0';
-
-  /* Do it.  */
+  /* Do it.  Each path is resolved only once, whatever the number of
+     targets.  */
   if (argument_is_device)
-    probe (NULL, arguments.devices, delim);
+    probe_all (arguments.devices, &arguments, batch);
   else
-    probe (arguments.devices[0], NULL, delim);
+    {
+      size_t i;
 
-  if (delim == ' ')
-    putchar ('\n');
+      for (i = 0; i < arguments.ndevices; i++)
+	probe_all (get_devices (arguments.devices[i]), &arguments, batch);
+    }
 
   /* Free resources.  */
   grub_gcry_fini_all ();
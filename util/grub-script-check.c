@@ -34,6 +34,11 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+#ifndef __MINGW32__
+#include <sys/wait.h>
+#endif
 #pragma GCC diagnostic ignored "-Wmissing-prototypes"
 #pragma GCC diagnostic ignored "-Wmissing-declarations"
 #include <argp.h>
@@ -45,11 +50,18 @@
 struct arguments
 {
   int verbose;
-  char *filename;
+  int timing;
+  int jobs;
+  char **filenames;
+  int nfiles;
 };
 
 static struct argp_option options[] = {
   {"verbose",     'v', 0,      0, N_("print verbose messages."), 0},
+  {"timing",      't', 0,      0,
+   N_("print the result, size and reading and parsing time of each script."), 0},
+  {"jobs",        'j', N_("NUM"), 0,
+   N_("check up to NUM scripts at once [default=number of processors]."), 0},
   { 0, 0, 0, 0, 0, 0 }
 };
 
@@ -59,6 +71,7 @@ argp_parser (int key, char *arg, struct argp_state *state)
   /* Get the input argument from argp_parse, which we
      know is a pointer to our arguments structure. */
   struct arguments *arguments = state->input;
+  char *end;
 
   switch (key)
     {
@@ -66,17 +79,26 @@ argp_parser (int key, char *arg, struct argp_state *state)
       arguments->verbose = 1;
       break;
 
-    case ARGP_KEY_ARG:
-      if (state->arg_num == 0)
-	arguments->filename = xstrdup (arg);
-      else
+    case 't':
+      arguments->timing = 1;
+      break;
+
+    case 'j':
+      arguments->jobs = strtol (arg, &end, 0);
+      if (*end || arguments->jobs <= 0)
 	{
-	  /* Too many arguments. */
-	  fprintf (stderr, _("Unknown extra argument `%s'."), arg);
+	  fprintf (stderr, _("invalid number of jobs `%s'"), arg);
 	  fprintf (stderr, "\n");
 	  argp_usage (state);
 	}
       break;
+
+    case ARGP_KEY_ARG:
+      arguments->filenames = xrealloc (arguments->filenames,
+				       (arguments->nfiles + 1)
+				       * sizeof (arguments->filenames[0]));
+      arguments->filenames[arguments->nfiles++] = xstrdup (arg);
+      break;
     default:
       return ARGP_ERR_UNKNOWN;
     }
@@ -84,20 +106,51 @@ argp_parser (int key, char *arg, struct argp_state *state)
 }
 
 static struct argp argp = {
-  options, argp_parser, N_("[PATH]"),
-  N_("Checks GRUB script configuration file for syntax errors."),
+  options, argp_parser, N_("[PATH...]"),
+  N_("Checks GRUB script configuration files for syntax errors."),
   NULL, NULL, NULL
 };
 
-/* Context for main.  */
+enum check_status
+  {
+    CHECK_OK,
+    CHECK_OPEN_ERROR,
+    CHECK_SYNTAX_ERROR,
+    CHECK_NO_COMMANDS,
+    CHECK_FAILED
+  };
+
+/* What checking one script found.  Worker processes send it back to the
+   main one as is.  */
+struct check_result
+{
+  enum check_status status;
+  int open_errno;
+  unsigned lines;
+  unsigned statements;
+  grub_uint64_t read_us;
+  grub_uint64_t parse_us;
+};
+
+/* Context for check_file.  */
 struct main_ctx
 {
   int lineno;
   FILE *file;
-  struct arguments arguments;
+  int verbose;
+  grub_uint64_t read_us;
 };
 
-/* Helper for main.  */
+static grub_uint64_t
+get_time_us (void)
+{
+  struct timeval tv;
+
+  gettimeofday (&tv, 0);
+  return (grub_uint64_t) tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+/* Helper for check_file.  */
 static grub_err_t
 get_config_line (char **line, int cont __attribute__ ((unused)), void *data)
 {
@@ -106,8 +159,11 @@ get_config_line (char **line, int cont __attribute__ ((unused)), void *data)
   char *cmdline = 0;
   size_t len = 0;
   ssize_t curread;
+  grub_uint64_t start;
 
+  start = get_time_us ();
   curread = getline (&cmdline, &len, (ctx->file ?: stdin));
+  ctx->read_us += get_time_us () - start;
   if (curread == -1)
     {
       *line = 0;
@@ -118,7 +174,7 @@ get_config_line (char **line, int cont __attribute__ ((unused)), void *data)
       return grub_errno;
     }
 
-  if (ctx->arguments.verbose)
+  if (ctx->verbose)
     grub_printf ("%s", cmdline);
 
   for (i = 0; cmdline[i] != '\0'; i++)
@@ -139,58 +195,52 @@ get_config_line (char **line, int cont __attribute__ ((unused)), void *data)
   return 0;
 }
 
-int
-main (int argc, char *argv[])
+/* Check the script in FILENAME, or standard input if it is NULL.  */
+static void
+check_file (const char *filename, int verbose, struct check_result *res)
 {
   struct main_ctx ctx = {
     .lineno = 0,
-    .file = 0
+    .file = 0,
+    .verbose = verbose,
+    .read_us = 0
   };
   char *input;
   int found_input = 0, found_cmd = 0;
   struct grub_script *script = NULL;
 
-  grub_util_host_init (&argc, &argv);
-
-  memset (&ctx.arguments, 0, sizeof (struct arguments));
-
-  /* Check for options.  */
-  if (argp_parse (&argp, argc, argv, 0, 0, &ctx.arguments) != 0)
-    {
-      fprintf (stderr, "%s", _("Error in parsing command line arguments\n"));
-      exit(1);
-    }
+  memset (res, 0, sizeof (*res));
 
-  /* Obtain ARGUMENT.  */
-  if (!ctx.arguments.filename)
+  if (filename)
     {
-      ctx.file = 0; /* read from stdin */
-    }
-  else
-    {
-      ctx.file = grub_util_fopen (ctx.arguments.filename, "r");
+      ctx.file = grub_util_fopen (filename, "r");
       if (! ctx.file)
 	{
-          char *program = xstrdup(program_name);
-	  fprintf (stderr, _("cannot open `%s': %s"),
-		   ctx.arguments.filename, strerror (errno));
-          argp_help (&argp, stderr, ARGP_HELP_STD_USAGE, program);
-          free(program);
-          exit(1);
+	  res->status = CHECK_OPEN_ERROR;
+	  res->open_errno = errno;
+	  return;
 	}
     }
 
   do
     {
+      grub_uint64_t start, read_us;
+
       input = 0;
       get_config_line (&input, 0, &ctx);
       if (! input) 
 	break;
       found_input = 1;
 
+      /* Lexing happens on demand while parsing, so the two are timed
+	 together; reading continuation lines is left out.  */
+      start = get_time_us ();
+      read_us = ctx.read_us;
       script = grub_script_parse (input, get_config_line, &ctx);
+      res->parse_us += get_time_us () - start - (ctx.read_us - read_us);
       if (script)
 	{
+	  res->statements++;
 	  if (script->cmd)
 	    found_cmd = 1;
 	  grub_script_execute (script);
@@ -201,18 +251,226 @@ main (int argc, char *argv[])
     } while (script != 0);
 
   if (ctx.file) fclose (ctx.file);
+  grub_errno = GRUB_ERR_NONE;
 
+  res->lines = ctx.lineno;
+  res->read_us = ctx.read_us;
   if (found_input && script == 0)
+    res->status = CHECK_SYNTAX_ERROR;
+  else if (! found_cmd)
+    res->status = CHECK_NO_COMMANDS;
+  else
+    res->status = CHECK_OK;
+}
+
+/* Print what was found in FILENAME, prefixing messages with the name when
+   several scripts are checked.  Return whether the check failed.  */
+static int
+report (const char *filename, const struct check_result *res,
+	const struct arguments *arguments)
+{
+  static const char *const status_names[] =
     {
-      fprintf (stderr, _("Syntax error at line %u\n"), ctx.lineno);
-      return 1;
-    }
-  if (! found_cmd)
+      [CHECK_OK] = "ok",
+      [CHECK_OPEN_ERROR] = "unreadable",
+      [CHECK_SYNTAX_ERROR] = "syntax error",
+      [CHECK_NO_COMMANDS] = "no commands",
+      [CHECK_FAILED] = "failed"
+    };
+  int several = arguments->nfiles > 1;
+
+  if (several && res->status != CHECK_OK)
+    fprintf (stderr, "%s: ", filename);
+
+  switch (res->status)
     {
+    case CHECK_OK:
+      break;
+
+    case CHECK_OPEN_ERROR:
+      fprintf (stderr, _("cannot open `%s': %s"), filename,
+	       strerror (res->open_errno));
+      if (several)
+	fprintf (stderr, "\n");
+      else
+	{
+	  char *program = xstrdup(program_name);
+	  argp_help (&argp, stderr, ARGP_HELP_STD_USAGE, program);
+	  free(program);
+	}
+      break;
+
+    case CHECK_SYNTAX_ERROR:
+      fprintf (stderr, _("Syntax error at line %u\n"), res->lines);
+      break;
+
+    case CHECK_NO_COMMANDS:
       fprintf (stderr, _("Script `%s' contains no commands and will do nothing\n"),
-	       ctx.arguments.filename);
-      return 1;
+	       filename ? : "-");
+      break;
+
+    case CHECK_FAILED:
+      fprintf (stderr, "%s\n", _("checking failed"));
+      break;
     }
 
-  return 0;
+  if (arguments->timing)
+    printf ("%s: %s, %u lines, %u statements, read %" GRUB_HOST_PRIuLONG_LONG
+	    ".%03u ms, parse %" GRUB_HOST_PRIuLONG_LONG ".%03u ms\n",
+	    filename ? : "-", status_names[res->status], res->lines,
+	    res->statements,
+	    (unsigned long long) (res->read_us / 1000),
+	    (unsigned) (res->read_us % 1000),
+	    (unsigned long long) (res->parse_us / 1000),
+	    (unsigned) (res->parse_us % 1000));
+
+  return res->status != CHECK_OK;
+}
+
+#ifndef __MINGW32__
+/* Check the scripts in JOBS worker processes, worker I taking scripts I,
+   I + JOBS and so on, and report them in order as the results come in.
+   Processes rather than threads, because the parser and the script
+   engine keep global state (defined functions, grub_errno).  */
+static int
+check_parallel (const struct arguments *arguments, int jobs)
+{
+  int *fds;
+  pid_t *pids;
+  int i, j, failed = 0;
+
+  fds = xmalloc (jobs * sizeof (fds[0]));
+  pids = xmalloc (jobs * sizeof (pids[0]));
+
+  fflush (stdout);
+  fflush (stderr);
+
+  for (j = 0; j < jobs; j++)
+    {
+      int p[2];
+
+      if (pipe (p) < 0)
+	grub_util_error (_("cannot create a pipe: %s"), strerror (errno));
+      pids[j] = fork ();
+      if (pids[j] < 0)
+	grub_util_error (_("cannot fork: %s"), strerror (errno));
+      if (pids[j] == 0)
+	{
+	  close (p[0]);
+	  for (i = 0; i < j; i++)
+	    close (fds[i]);
+	  for (i = j; i < arguments->nfiles; i += jobs)
+	    {
+	      struct check_result res;
+	      const char *ptr = (const char *) &res;
+	      size_t left = sizeof (res);
+
+	      check_file (arguments->filenames[i], 0, &res);
+	      fflush (stdout);
+	      while (left)
+		{
+		  ssize_t n = write (p[1], ptr, left);
+		  if (n < 0 && errno == EINTR)
+		    continue;
+		  if (n <= 0)
+		    _exit (1);
+		  ptr += n;
+		  left -= n;
+		}
+	    }
+	  _exit (0);
+	}
+      close (p[1]);
+      fds[j] = p[0];
+    }
+
+  for (i = 0; i < arguments->nfiles; i++)
+    {
+      struct check_result res;
+      char *ptr = (char *) &res;
+      size_t left = sizeof (res);
+
+      while (left)
+	{
+	  ssize_t n = read (fds[i % jobs], ptr, left);
+	  if (n < 0 && errno == EINTR)
+	    continue;
+	  if (n <= 0)
+	    break;
+	  ptr += n;
+	  left -= n;
+	}
+      /* The worker died, for instance on a parser crash.  */
+      if (left)
+	{
+	  memset (&res, 0, sizeof (res));
+	  res.status = CHECK_FAILED;
+	}
+      failed |= report (arguments->filenames[i], &res, arguments);
+    }
+
+  for (j = 0; j < jobs; j++)
+    {
+      close (fds[j]);
+      waitpid (pids[j], NULL, 0);
+    }
+  free (fds);
+  free (pids);
+
+  return failed;
+}
+#endif
+
+int
+main (int argc, char *argv[])
+{
+  struct arguments arguments;
+  struct check_result res;
+  int i, jobs, failed = 0;
+
+  grub_util_host_init (&argc, &argv);
+
+  memset (&arguments, 0, sizeof (struct arguments));
+
+  /* Check for options.  */
+  if (argp_parse (&argp, argc, argv, 0, 0, &arguments) != 0)
+    {
+      fprintf (stderr, "%s", _("Error in parsing command line arguments\n"));
+      exit(1);
+    }
+
+  /* Without arguments, read from stdin.  */
+  if (arguments.nfiles == 0)
+    {
+      check_file (NULL, arguments.verbose, &res);
+      return report (NULL, &res, &arguments);
+    }
+
+  jobs = arguments.jobs;
+#ifdef _SC_NPROCESSORS_ONLN
+  if (! jobs)
+    jobs = sysconf (_SC_NPROCESSORS_ONLN);
+#endif
+  if (jobs > arguments.nfiles)
+    jobs = arguments.nfiles;
+  /* Verbose output from several scripts at once would be unreadable.  */
+  if (arguments.verbose)
+    jobs = 1;
+
+#ifndef __MINGW32__
+  if (jobs > 1)
+    failed = check_parallel (&arguments, jobs);
+  else
+#endif
+    for (i = 0; i < arguments.nfiles; i++)
+      {
+	check_file (arguments.filenames[i], arguments.verbose, &res);
+	failed |= report (arguments.filenames[i], &res, &arguments);
+      }
+
+  for (i = 0; i < arguments.nfiles; i++)
+    free (arguments.filenames[i]);
+  free (arguments.filenames);
+
+  return failed;
 }
@@ -51,13 +51,9 @@ infile = open (sys.argv[1], "r")
 outfile = open (sys.argv[4], "w")
 outfile.write ("#include <grub/unicode.h>\n")
 outfile.write ("\n")
-outfile.write ("struct grub_unicode_compact_range grub_unicode_compact[] = {\n")
 
-begincode = -2
-lastcode = -2
-lastbiditype = "X"
-lastmirrortype = False
-lastcombtype = -1
+defaultprops = ("L", 0, False, "NONJOINING")
+charprops = {}
 arabicsubst = {}
 for line in infile:
     sp = line.split (";")
@@ -124,31 +120,54 @@ for line in infile:
         arabicsubst[arabname][form] = curcode;
         if form == 0:
             arabicsubst[arabname]['join'] = curjoin
-    if lastcode + 1 != curcode or curbiditype != lastbiditype \
-            or curcombtype != lastcombtype or curmirrortype != lastmirrortype \
-            or curjoin != lastjoin:
-        if begincode != -2 and (lastbiditype != "L" or lastcombtype != 0 or \
-                                    lastmirrortype):
-            outfile.write (("{0x%x, 0x%x, GRUB_BIDI_TYPE_%s, %d, %d, GRUB_JOIN_TYPE_%s},\n" \
-                                % (begincode, lastcode - begincode + 1, \
-                                       lastbiditype, \
-                                       lastcombtype, lastmirrortype, \
-                                       lastjoin)))
-            if lastcode - begincode + 1 >= 0x200:
-                print ("Too long range")
-                raise
-        begincode = curcode
-    lastcode = curcode
-    lastjoin = curjoin
-    lastbiditype = curbiditype
-    lastcombtype = curcombtype
-    lastmirrortype = curmirrortype
-if lastbiditype != "L" or lastcombtype != 0 or lastmirrortype:
-    outfile.write (("{0x%x, 0x%x, GRUB_BIDI_TYPE_%s, %d, %d, GRUB_JOIN_TYPE_%s},\n" \
-                        % (begincode, lastcode, lastbiditype, lastcombtype, \
-                               lastmirrortype, lastjoin)))
-outfile.write ("{0, 0, 0, 0, 0, 0},\n")
+    if curbiditype != "L" or curcombtype != 0 or curmirrortype:
+        charprops[curcode] = (curbiditype, curcombtype, curmirrortype, curjoin)
+
+# Two-level lookup: grub_unicode_prop_pages gives for every page of
+# codepoints a block of grub_unicode_prop_blocks, which holds for every
+# codepoint of the page an index into grub_unicode_props.  Identical
+# pages share a block, and page 0 (Latin-1) is always block 0.
+pagebits = 8
+pagesize = 1 << pagebits
+maxcode = 0x110000
+props = [defaultprops]
+propindex = {defaultprops: 0}
+blocks = []
+blockindex = {}
+pages = []
+for page in range (maxcode >> pagebits):
+    block = []
+    for code in range (page << pagebits, (page + 1) << pagebits):
+        prop = charprops.get (code, defaultprops)
+        if prop not in propindex:
+            propindex[prop] = len (props)
+            props.append (prop)
+        block.append (propindex[prop])
+    block = tuple (block)
+    if block not in blockindex:
+        blockindex[block] = len (blocks)
+        blocks.append (block)
+    pages.append (blockindex[block])
+
+if len (props) > 256 or len (blocks) > 256:
+    print ("Unicode property tables too large")
+    raise
+
+outfile.write ("const struct grub_unicode_props grub_unicode_props[] = {\n")
+for prop in props:
+    outfile.write ("{GRUB_BIDI_TYPE_%s, %d, %d, GRUB_JOIN_TYPE_%s},\n" \
+                       % (prop[0], prop[1], prop[2], prop[3]))
+outfile.write ("};\n")
+
+outfile.write ("const grub_uint8_t grub_unicode_prop_pages[] = {\n")
+for i in range (0, len (pages), 16):
+    outfile.write ("".join ("%d, " % x for x in pages[i:i + 16]) + "\n")
+outfile.write ("};\n")
 
+outfile.write ("const grub_uint8_t grub_unicode_prop_blocks[] = {\n")
+for block in blocks:
+    for i in range (0, pagesize, 16):
+        outfile.write ("".join ("%d, " % x for x in block[i:i + 16]) + "\n")
 outfile.write ("};\n")
 
 infile.close ()
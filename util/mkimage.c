@@ -748,6 +748,110 @@ compress_kernel_lzma (char *kernel_img, size_t kernel_size,
     grub_util_error ("%s", _("cannot compress the kernel image"));
 }
 
+/* LZ4 block format.  The decoder, boot/i386/pc/lz4_decode.S, is much
+   smaller and faster than the LZMA one, for a larger image.  */
+#define LZ4_MIN_MATCH 4
+#define LZ4_MAX_OFFSET 65535
+#define LZ4_HASH_BITS 16
+/* The last five bytes are always literals and the last match starts at
+   least twelve bytes before the end.  */
+#define LZ4_LAST_LITERALS 5
+#define LZ4_MFLIMIT 12
+
+static grub_uint32_t
+lz4_hash (const unsigned char *p)
+{
+  grub_uint32_t v;
+
+  memcpy (&v, p, sizeof (v));
+  return (v * 2654435761U) >> (32 - LZ4_HASH_BITS);
+}
+
+static unsigned char *
+lz4_put_length (unsigned char *op, size_t len)
+{
+  for (; len >= 255; len -= 255)
+    *op++ = 255;
+  *op++ = len;
+  return op;
+}
+
+/* Emit NLIT literals from LIT followed by a match of MLEN bytes at
+   OFFSET, or no match if MLEN is 0.  */
+static unsigned char *
+lz4_put_sequence (unsigned char *op, const unsigned char *lit, size_t nlit,
+		  size_t offset, size_t mlen)
+{
+  unsigned char *token = op++;
+
+  *token = (nlit >= 15 ? 15 : nlit) << 4;
+  if (nlit >= 15)
+    op = lz4_put_length (op, nlit - 15);
+  memcpy (op, lit, nlit);
+  op += nlit;
+
+  if (!mlen)
+    return op;
+
+  *op++ = offset & 0xff;
+  *op++ = offset >> 8;
+  mlen -= LZ4_MIN_MATCH;
+  *token |= mlen >= 15 ? 15 : mlen;
+  if (mlen >= 15)
+    op = lz4_put_length (op, mlen - 15);
+  return op;
+}
+
+static void
+compress_kernel_lz4 (char *kernel_img, size_t kernel_size,
+		     char **core_img, size_t *core_size)
+{
+  const unsigned char *in = (const unsigned char *) kernel_img;
+  const unsigned char *end = in + kernel_size;
+  const unsigned char *ip = in, *anchor = in;
+  unsigned char *op;
+  size_t *table;
+
+  table = xmalloc (sizeof (*table) << LZ4_HASH_BITS);
+  memset (table, 0, sizeof (*table) << LZ4_HASH_BITS);
+
+  *core_img = xmalloc (kernel_size + kernel_size / 255 + 16);
+  op = (unsigned char *) *core_img;
+
+  /* Greedy matching against the last position seen with the same hash;
+     positions are stored plus one so that 0 means none.  */
+  while (kernel_size > LZ4_MFLIMIT && ip < end - LZ4_MFLIMIT)
+    {
+      grub_uint32_t h = lz4_hash (ip);
+      const unsigned char *match;
+      size_t len;
+
+      match = table[h] ? in + table[h] - 1 : NULL;
+      table[h] = ip - in + 1;
+      if (!match || ip - match > LZ4_MAX_OFFSET
+	  || memcmp (match, ip, LZ4_MIN_MATCH) != 0)
+	{
+	  ip++;
+	  continue;
+	}
+
+      len = LZ4_MIN_MATCH;
+      while (ip + len < end - LZ4_LAST_LITERALS && ip[len] == match[len])
+	len++;
+
+      op = lz4_put_sequence (op, anchor, ip - anchor, ip - match, len);
+      anchor = ip + len;
+      /* Index the positions inside the match as well.  */
+      for (ip++; ip < anchor; ip++)
+	if (ip < end - LZ4_MFLIMIT)
+	  table[lz4_hash (ip)] = ip - in + 1;
+    }
+
+  op = lz4_put_sequence (op, anchor, end - anchor, 0, 0);
+  *core_size = op - (unsigned char *) *core_img;
+  free (table);
+}
+
 #ifdef USE_LIBLZMA
 static void
 compress_kernel_xz (char *kernel_img, size_t kernel_size,
@@ -811,6 +915,14 @@ compress_kernel (const struct grub_install_image_target_desc *image_target, char
       return;
     }
 
+  if (image_target->flags & PLATFORM_FLAGS_DECOMPRESSORS
+      && (comp == GRUB_COMPRESSION_LZ4))
+    {
+      compress_kernel_lz4 (kernel_img, kernel_size, core_img,
+			   core_size);
+      return;
+    }
+
 #ifdef USE_LIBLZMA
  if (image_target->flags & PLATFORM_FLAGS_DECOMPRESSORS
      && (comp == GRUB_COMPRESSION_XZ))
@@ -981,9 +1093,72 @@ grub_install_get_image_targets_string (void)
   return formats;
 }
 
+/* A module the way it goes into the image.  */
+struct image_module
+{
+  char *data;
+  size_t size;
+  grub_uint32_t type;
+};
+
+/* Load the module at PATH, LZ4-compressed if it is LAZY or if COMPRESS
+   and that makes it smaller.  */
+static void
+prepare_module (const struct grub_install_image_target_desc *image_target,
+		struct image_module *m, const char *path, int lazy,
+		int compress)
+{
+  struct grub_module_lz4_header *header;
+  size_t size, lz4_size, name_len;
+  const char *name;
+  char *raw, *lz4;
+
+  size = grub_util_get_image_size (path);
+  raw = xmalloc (size);
+  grub_util_load_image (path, raw);
+
+  m->data = raw;
+  m->size = size;
+  m->type = OBJ_TYPE_ELF;
+  if (!lazy && !compress)
+    return;
+
+  compress_kernel_lz4 (raw, size, &lz4, &lz4_size);
+  if (!lazy && lz4_size + sizeof (*header) >= size)
+    {
+      free (lz4);
+      return;
+    }
+
+  name = strrchr (path, '/');
+  name = name ? name + 1 : path;
+  name_len = strlen (name);
+  if (name_len > 4 && strcmp (name + name_len - 4, ".mod") == 0)
+    name_len -= 4;
+  if (name_len >= sizeof (header->name))
+    grub_util_error (_("module name `%s' is too long"), name);
+
+  m->size = sizeof (*header) + lz4_size;
+  m->data = xmalloc (m->size);
+  m->type = OBJ_TYPE_ELF_LZ4;
+  header = (struct grub_module_lz4_header *) m->data;
+  memset (header, 0, sizeof (*header));
+  header->size = grub_host_to_target32 (size);
+  header->flags = grub_host_to_target32 (lazy ? GRUB_MODULE_LZ4_LAZY : 0);
+  memcpy (header->name, name, name_len);
+  memcpy (header + 1, lz4, lz4_size);
+  grub_util_info ("module %s compressed from %" GRUB_HOST_PRIuLONG_LONG
+		  " to %" GRUB_HOST_PRIuLONG_LONG " bytes",
+		  path, (unsigned long long) size,
+		  (unsigned long long) m->size);
+  free (lz4);
+  free (raw);
+}
+
 void
 grub_install_generate_image (const char *dir, const char *prefix,
 			     FILE *out, const char *outname, char *mods[],
+			     char *lazy_mods[], int compress_mods,
 			     char *memdisk_path, char **pubkey_paths,
 			     size_t npubkeys, char *config_path,
 			     const struct grub_install_image_target_desc *image_target,
@@ -996,7 +1171,9 @@ grub_install_generate_image (const char *dir, const char *prefix,
   size_t prefix_size = 0;
   char *kernel_path;
   size_t offset;
-  struct grub_util_path_list *path_list, *p, *next;
+  struct grub_util_path_list *path_list, *lazy_list = NULL, *p, *q, *next;
+  struct image_module *modules;
+  size_t nmodules, j;
   size_t bss_size;
   grub_uint64_t start_address;
   void *rel_section = 0;
@@ -1006,12 +1183,41 @@ grub_install_generate_image (const char *dir, const char *prefix,
   if (comp == GRUB_COMPRESSION_AUTO)
     comp = image_target->default_compression;
 
+  /* Only the i386-pc decompressor understands LZ4; anything else it gets
+     is LZMA.  */
   if (image_target->id == IMAGE_I386_PC
       || image_target->id == IMAGE_I386_PC_PXE
       || image_target->id == IMAGE_I386_PC_ELTORITO)
-    comp = GRUB_COMPRESSION_LZMA;
+    {
+      if (comp != GRUB_COMPRESSION_LZ4)
+	comp = GRUB_COMPRESSION_LZMA;
+    }
+  else if (comp == GRUB_COMPRESSION_LZ4)
+    grub_util_error ("%s", _("LZ4 is only supported for i386-pc images"));
 
   path_list = grub_util_resolve_dependencies (dir, "moddep.lst", mods);
+  if (lazy_mods && lazy_mods[0])
+    lazy_list = grub_util_resolve_dependencies (dir, "moddep.lst", lazy_mods);
+
+  /* Modules that are loaded at startup anyway aren't lazy.  */
+  nmodules = 0;
+  for (p = path_list; p; p = p->next)
+    nmodules++;
+  for (p = lazy_list; p; p = p->next)
+    nmodules++;
+  modules = xmalloc ((nmodules + 1) * sizeof (modules[0]));
+  nmodules = 0;
+  for (p = path_list; p; p = p->next)
+    prepare_module (image_target, &modules[nmodules++], p->name, 0,
+		    compress_mods);
+  for (p = lazy_list; p; p = p->next)
+    {
+      for (q = path_list; q; q = q->next)
+	if (strcmp (p->name, q->name) == 0)
+	  break;
+      if (!q)
+	prepare_module (image_target, &modules[nmodules++], p->name, 1, 1);
+    }
 
   kernel_path = grub_util_get_path (dir, "kernel.img");
 
@@ -1055,8 +1261,8 @@ grub_install_generate_image (const char *dir, const char *prefix,
       total_module_size += prefix_size + sizeof (struct grub_module_header);
     }
 
-  for (p = path_list; p; p = p->next)
-    total_module_size += (ALIGN_ADDR (grub_util_get_image_size (p->name))
+  for (j = 0; j < nmodules; j++)
+    total_module_size += (ALIGN_ADDR (modules[j].size)
 			  + sizeof (struct grub_module_header));
 
   grub_util_info ("the total module size is 0x%" GRUB_HOST_PRIxLONG_LONG,
@@ -1117,21 +1323,27 @@ grub_install_generate_image (const char *dir, const char *prefix,
 	offset = kernel_size + sizeof (struct grub_module_info32);
     }
 
-  for (p = path_list; p; p = p->next)
+  for (j = 0; j < nmodules; j++)
     {
       struct grub_module_header *header;
       size_t mod_size;
 
-      mod_size = ALIGN_ADDR (grub_util_get_image_size (p->name));
+      /* The decompressor wants the exact size, ELF modules have always
+	 been given with the padding.  */
+      mod_size = modules[j].size;
+      if (modules[j].type == OBJ_TYPE_ELF)
+	mod_size = ALIGN_ADDR (mod_size);
 
       header = (struct grub_module_header *) (kernel_img + offset);
-      header->type = grub_host_to_target32 (OBJ_TYPE_ELF);
+      header->type = grub_host_to_target32 (modules[j].type);
       header->size = grub_host_to_target32 (mod_size + sizeof (*header));
       offset += sizeof (*header);
 
-      grub_util_load_image (p->name, kernel_img + offset);
-      offset += mod_size;
+      memcpy (kernel_img + offset, modules[j].data, modules[j].size);
+      offset += ALIGN_ADDR (modules[j].size);
+      free (modules[j].data);
     }
+  free (modules);
 
   {
     size_t i;
@@ -1221,6 +1433,9 @@ grub_install_generate_image (const char *dir, const char *prefix,
 	case GRUB_COMPRESSION_LZMA:
 	  name = "lzma_decompress.img";
 	  break;
+	case GRUB_COMPRESSION_LZ4:
+	  name = "lz4_decompress.img";
+	  break;
 	case GRUB_COMPRESSION_NONE:
 	  name = "none_decompress.img";
 	  break;
@@ -1911,4 +2126,11 @@ grub_install_generate_image (const char *dir, const char *prefix,
       free (path_list);
       path_list = next;
     }
+  while (lazy_list)
+    {
+      next = lazy_list->next;
+      free ((void *) lazy_list->name);
+      free (lazy_list);
+      lazy_list = next;
+    }
 }